@@ -0,0 +1,360 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+'''
+Benchmark OpenVPN over an impaired link.
+
+Runs a point-to-point TLS tunnel between the host and a network
+namespace, with both peers impairing their link with --gremlin-impair,
+and measures for every scenario:
+
+  - the time from client start to "Peer Connection Initiated"
+    (handshake) and to "Initialization Sequence Completed",
+  - the TCP goodput through the tunnel with iperf3,
+  - the control channel retransmits and replayed data packets of both
+    peers, read with the "metrics" management command,
+  - the packets lost, dropped and reordered by the impairment.
+
+Each scenario is run --runs times and the median is reported, so that
+options like --tls-timeout, --replay-window or --fragment can be
+compared under the same conditions.  A scenario file is a JSON list:
+
+    [
+        {"name": "clean"},
+        {"name": "wan", "impair": "delay 40 jitter 10 loss 1"},
+        {"name": "wan-frag", "impair": "delay 40 jitter 10 loss 1",
+         "options": "--fragment 1200 --mssfix"},
+        {"name": "bursty", "impair": "loss 5 loss-burst 4 reorder 2",
+         "options": "--replay-window 256 --tls-timeout 1"}
+    ]
+
+"impair" is given to --gremlin-impair of both peers, "options" are
+added to both command lines.  Without a seed in "impair", every run
+uses its number as seed, so repeated benchmarks see the same loss
+pattern.
+
+This needs root (for the namespace and the tun devices), iproute2,
+iperf3 and an openvpn binary built with --enable-debug (the default).
+The sample keys of the source tree are used unless --keys is given.
+
+Usage example:
+    openvpn-gremlin-bench.py --openvpn src/openvpn/openvpn scenarios.json
+    openvpn-gremlin-bench.py --impair 'delay 20 loss 0.5' --runs 5
+'''
+
+import argparse
+import json
+import os
+import re
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+NETNS = 'ovpn-gremlin'
+VETH_HOST = 'gremlin0'
+VETH_NS = 'gremlin1'
+LINK_HOST = '10.198.0.1'
+LINK_NS = '10.198.0.2'
+TUN_HOST = '10.199.0.1'
+TUN_NS = '10.199.0.2'
+PORT = 11940
+MGMT_PORT = 11941
+
+HANDSHAKE = re.compile(r'Peer Connection Initiated')
+INITIALIZED = re.compile(r'Initialization Sequence Completed')
+IMPAIR_STATS = re.compile(r'GREMLIN: impaired link stats: (.*)')
+
+
+def run(cmd, check=True):
+    return subprocess.run(cmd, check=check, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True)
+
+
+def ns(cmd):
+    return ['ip', 'netns', 'exec', NETNS] + cmd
+
+
+def setup_netns():
+    teardown_netns()
+    run(['ip', 'netns', 'add', NETNS])
+    run(['ip', 'link', 'add', VETH_HOST, 'type', 'veth',
+         'peer', 'name', VETH_NS])
+    run(['ip', 'link', 'set', VETH_NS, 'netns', NETNS])
+    run(['ip', 'addr', 'add', LINK_HOST + '/30', 'dev', VETH_HOST])
+    run(['ip', 'link', 'set', VETH_HOST, 'up'])
+    run(ns(['ip', 'addr', 'add', LINK_NS + '/30', 'dev', VETH_NS]))
+    run(ns(['ip', 'link', 'set', VETH_NS, 'up']))
+    run(ns(['ip', 'link', 'set', 'lo', 'up']))
+
+
+def teardown_netns():
+    run(['ip', 'link', 'del', VETH_HOST], check=False)
+    run(['ip', 'netns', 'del', NETNS], check=False)
+
+
+def openvpn_cmd(args, keys, server, impair, options):
+    proto = args.proto + '4'
+    if args.proto == 'tcp':
+        proto += '-server' if server else '-client'
+    cmd = [args.openvpn, '--dev', 'tun', '--verb', '3', '--proto', proto,
+           '--ca', os.path.join(keys, 'ca.crt'),
+           '--management', '127.0.0.1', str(MGMT_PORT),
+           '--ping', '10', '--ping-restart', '60']
+    if server:
+        cmd += ['--tls-server', '--dh', 'none',
+                '--cert', os.path.join(keys, 'server.crt'),
+                '--key', os.path.join(keys, 'server.key'),
+                '--local', LINK_HOST, '--lport', str(PORT),
+                '--ifconfig', TUN_HOST, TUN_NS]
+    else:
+        cmd += ['--tls-client', '--remote-cert-tls', 'server',
+                '--cert', os.path.join(keys, 'client.crt'),
+                '--key', os.path.join(keys, 'client.key'),
+                '--remote', LINK_HOST, str(PORT), '--nobind',
+                '--ifconfig', TUN_NS, TUN_HOST]
+    if impair:
+        cmd += ['--gremlin-impair'] + impair.split()
+    return cmd + options.split()
+
+
+def metrics(netns):
+    '''Read the counters of the management "metrics" command.'''
+    cmd = ['python3', '-c', METRICS_SNIPPET, str(MGMT_PORT)]
+    out = run(ns(cmd) if netns else cmd, check=False).stdout
+    values = {}
+    for line in out.splitlines():
+        m = re.match(r'^(openvpn_\w+)(\{[^}]*\})? (\d+)$', line)
+        if m:
+            values[m.group(1) + (m.group(2) or '')] = int(m.group(3))
+    return values
+
+
+# runs inside the namespace of the peer whose management port is read
+METRICS_SNIPPET = '''
+import socket, sys
+s = socket.create_connection(("127.0.0.1", int(sys.argv[1])), 5)
+s.sendall(b"metrics\\n")
+data = b""
+while b"\\nEND" not in data:
+    chunk = s.recv(65536)
+    if not chunk:
+        break
+    data += chunk
+s.sendall(b"quit\\n")
+sys.stdout.write(data.decode("utf-8", "replace"))
+'''
+
+
+def wait_for(proc, pattern, timeout, start):
+    '''Return seconds from start until pattern shows up in proc's log.'''
+    deadline = time.monotonic() + timeout
+    for line in proc.log_lines(deadline):
+        if pattern.search(line):
+            return time.monotonic() - start
+    return None
+
+
+class Peer:
+    def __init__(self, cmd, logfile):
+        with open(logfile, 'w') as out:
+            self.proc = subprocess.Popen(cmd, stdin=subprocess.DEVNULL,
+                                         stdout=out,
+                                         stderr=subprocess.STDOUT)
+        # a file of our own, the offset of the child's one is shared
+        self.log = open(logfile)
+        self.pos = 0
+
+    def log_lines(self, deadline):
+        while time.monotonic() < deadline and self.proc.poll() is None:
+            self.log.seek(self.pos)
+            line = self.log.readline()
+            if line.endswith('\n'):
+                self.pos = self.log.tell()
+                yield line
+            else:
+                time.sleep(0.01)
+
+    def stop(self):
+        if self.proc.poll() is None:
+            self.proc.send_signal(signal.SIGTERM)
+            try:
+                self.proc.wait(10)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+        self.log.seek(0)
+        stats = {}
+        for line in self.log:
+            m = IMPAIR_STATS.search(line)
+            if m:
+                for item in m.group(1).split():
+                    key, value = item.split('=')
+                    stats[key] = int(value)
+        self.log.close()
+        return stats
+
+
+def run_once(args, keys, scenario, seed, workdir):
+    impair = scenario.get('impair', '')
+    if impair and 'seed' not in impair.split():
+        impair += ' seed %d' % seed
+    options = scenario.get('options', '')
+    result = {'handshake_s': None, 'initialized_s': None,
+              'goodput_mbit': None, 'tls_retransmits': None,
+              'replay_drops': None}
+
+    server = Peer(openvpn_cmd(args, keys, True, impair, options),
+                  os.path.join(workdir, 'server.log'))
+    start = time.monotonic()
+    client = Peer(ns(openvpn_cmd(args, keys, False, impair, options)),
+                  os.path.join(workdir, 'client.log'))
+    try:
+        result['handshake_s'] = wait_for(client, HANDSHAKE, args.timeout,
+                                         start)
+        result['initialized_s'] = wait_for(client, INITIALIZED,
+                                           args.timeout, start)
+        if result['initialized_s'] is not None:
+            measure(args, result)
+    finally:
+        client_stats = client.stop()
+        server_stats = server.stop()
+    for key in ('lost-out', 'lost-in', 'overflow', 'reordered'):
+        result['impair_' + key.replace('-', '_')] = (
+            client_stats.get(key, 0) + server_stats.get(key, 0))
+    return result
+
+
+def measure(args, result):
+    '''Measure goodput and read the counters of an established tunnel.'''
+    iperf = subprocess.Popen(['iperf3', '-s', '-1', '-B', TUN_HOST],
+                             stdout=subprocess.DEVNULL,
+                             stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+    out = run(ns(['iperf3', '-c', TUN_HOST, '-t', str(args.duration),
+                  '-J']), check=False).stdout
+    try:
+        iperf.wait(10)
+    except subprocess.TimeoutExpired:
+        iperf.kill()
+        iperf.wait()
+    try:
+        report = json.loads(out)
+        bps = report['end']['sum_received']['bits_per_second']
+        result['goodput_mbit'] = bps / 1e6
+    except (ValueError, KeyError):
+        pass
+
+    server_metrics = metrics(False)
+    client_metrics = metrics(True)
+    for name, key in (('tls_retransmits', 'openvpn_tls_retransmits_total'),
+                      ('replay_drops', 'openvpn_decrypt_errors_total'
+                                       '{reason="replay"}')):
+        result[name] = (server_metrics.get(key, 0)
+                        + client_metrics.get(key, 0))
+
+
+def median(values):
+    values = [v for v in values if v is not None]
+    return statistics.median(values) if values else None
+
+
+def summarize(name, runs):
+    summary = {'scenario': name, 'runs': len(runs),
+               'failed': sum(1 for r in runs if r['initialized_s'] is None)}
+    for key in runs[0]:
+        summary[key] = median([r[key] for r in runs])
+    return summary
+
+
+def fmt(value, spec):
+    return '-' if value is None else spec % value
+
+
+def print_table(summaries):
+    print('%-16s %4s %6s %9s %9s %9s %7s %7s %7s %7s'
+          % ('scenario', 'runs', 'failed', 'handshake', 'init',
+             'goodput', 'tls-rtx', 'replay', 'lost', 'reorder'))
+    for s in summaries:
+        lost = None
+        if s.get('impair_lost_out') is not None:
+            lost = s['impair_lost_out'] + s['impair_lost_in']
+        print('%-16s %4d %6d %8ss %8ss %5s Mb/s %7s %7s %7s %7s'
+              % (s['scenario'][:16], s['runs'], s['failed'],
+                 fmt(s['handshake_s'], '%.2f'),
+                 fmt(s['initialized_s'], '%.2f'),
+                 fmt(s['goodput_mbit'], '%.1f'),
+                 fmt(s.get('tls_retransmits'), '%d'),
+                 fmt(s.get('replay_drops'), '%d'),
+                 fmt(lost, '%d'),
+                 fmt(s.get('impair_reordered'), '%d')))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Measure handshake time, goodput and retransmits of '
+                    'an OpenVPN tunnel over a link impaired with '
+                    '--gremlin-impair.')
+    parser.add_argument('scenarios', nargs='?',
+                        help='JSON file with the scenarios to run')
+    parser.add_argument('--impair', default='',
+                        help='impairment of a single scenario, instead '
+                             'of a scenario file')
+    parser.add_argument('--options', default='',
+                        help='openvpn options of a single scenario')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='runs per scenario (default: 3)')
+    parser.add_argument('--duration', type=int, default=10,
+                        help='seconds of iperf3 traffic per run '
+                             '(default: 10)')
+    parser.add_argument('--timeout', type=float, default=60,
+                        help='give up on a handshake after this many '
+                             'seconds (default: 60)')
+    parser.add_argument('--proto', choices=('udp', 'tcp'), default='udp',
+                        help='transport protocol (default: udp)')
+    parser.add_argument('--openvpn', default='openvpn',
+                        help='openvpn binary to run (default: openvpn)')
+    parser.add_argument('--keys',
+                        default=os.path.join(os.path.dirname(
+                            os.path.abspath(__file__)),
+                            '..', '..', 'sample', 'sample-keys'),
+                        help='directory with ca.crt, server.crt/key and '
+                             'client.crt/key')
+    parser.add_argument('--json', action='store_true',
+                        help='print the results as JSON')
+    args = parser.parse_args()
+
+    if args.scenarios:
+        with open(args.scenarios) as f:
+            scenarios = json.load(f)
+    else:
+        scenarios = [{'name': 'cli', 'impair': args.impair,
+                      'options': args.options}]
+    if os.geteuid() != 0:
+        parser.error('must be run as root')
+
+    summaries = []
+    setup_netns()
+    try:
+        for scenario in scenarios:
+            runs = []
+            for i in range(args.runs):
+                with tempfile.TemporaryDirectory() as workdir:
+                    runs.append(run_once(args, args.keys, scenario, i + 1,
+                                         workdir))
+            summaries.append(summarize(scenario['name'], runs))
+            print('# %s done' % scenario['name'], file=sys.stderr)
+    finally:
+        teardown_netns()
+
+    if args.json:
+        print(json.dumps(summaries, indent=2, sort_keys=True))
+    else:
+        print_table(summaries)
+    return 0 if all(not s['failed'] for s in summaries) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
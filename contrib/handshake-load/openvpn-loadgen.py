@@ -0,0 +1,259 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+'''
+Handshake load generator for OpenVPN servers.
+
+Starts many OpenVPN clients against one server and measures how long
+each one needs for the TLS handshake and for the PUSH_REPLY.  The
+clients are ordinary openvpn processes, so the measured path is exactly
+the one real clients take.  They are started with --dev null and
+without executing ifconfig or routes, so no privileges are needed.
+
+For every client the time from process start to "Peer Connection
+Initiated" (handshake) and to the PUSH_REPLY is recorded.  At the end
+the handshake rate, latency percentiles and the failure reasons are
+printed.
+
+The client config must not contain 'dev', 'daemon' or 'log' options.
+When all clients use the same certificate, the server needs
+--duplicate-cn.  The file descriptor and process limits of the machine
+running the load generator usually have to be raised for more than a
+few hundred concurrent clients.
+
+Usage example:
+    openvpn-loadgen.py --clients 5000 --concurrency 500 client.conf
+    openvpn-loadgen.py --clients 1000 --rate 50 --hold 30 client.conf \\
+        -- --remote vpn.example.org 1194 udp
+'''
+
+import argparse
+import asyncio
+import json
+import re
+import signal
+import sys
+import time
+
+HANDSHAKE = re.compile(r'Peer Connection Initiated')
+PUSH_REPLY = re.compile(r"PUSH: Received control message: 'PUSH_REPLY")
+
+# the first matching pattern names the failure reason of a client
+FAILURES = [
+    (re.compile(r'AUTH_FAILED'), 'auth-failed'),
+    (re.compile(r'TLS key negotiation failed'), 'tls-timeout'),
+    (re.compile(r'TLS handshake failed'), 'tls-handshake-failed'),
+    (re.compile(r'VERIFY ERROR|certificate verify failed'), 'verify-failed'),
+    (re.compile(r'Connection refused'), 'connection-refused'),
+    (re.compile(r'Connection reset|SIGUSR1\[soft,connection-reset\]'),
+     'connection-reset'),
+    (re.compile(r'RESOLVE: Cannot resolve'), 'resolve-failed'),
+    (re.compile(r'Options error'), 'options-error'),
+    (re.compile(r'Exiting due to fatal error'), 'fatal-error'),
+]
+
+
+class Client:
+    def __init__(self):
+        self.handshake = None
+        self.push_reply = None
+        self.failure = None
+
+
+async def run_client(args, stats):
+    client = Client()
+    cmd = [args.openvpn, '--config', args.config,
+           '--dev', 'null', '--ifconfig-noexec', '--route-noexec',
+           '--verb', '3', '--connect-retry-max', '1'] + args.extra
+    start = time.monotonic()
+    try:
+        proc = await asyncio.create_subprocess_exec(
+            *cmd, stdin=asyncio.subprocess.DEVNULL,
+            stdout=asyncio.subprocess.PIPE,
+            stderr=asyncio.subprocess.STDOUT)
+    except OSError as e:
+        client.failure = 'spawn-failed: %s' % e.strerror
+        stats.append(client)
+        return
+
+    done = asyncio.Event()
+
+    # keep reading until the process exits, so that it never blocks on
+    # a full pipe while it is held open
+    async def read_log():
+        while True:
+            line = await proc.stdout.readline()
+            if not line:
+                done.set()
+                return
+            if done.is_set():
+                continue
+            line = line.decode('utf-8', 'replace')
+            now = time.monotonic() - start
+            if client.handshake is None and HANDSHAKE.search(line):
+                client.handshake = now
+            elif client.push_reply is None and PUSH_REPLY.search(line):
+                client.push_reply = now
+                done.set()
+            elif client.failure is None:
+                for pattern, reason in FAILURES:
+                    if pattern.search(line):
+                        client.failure = reason
+                        break
+                if client.failure == 'auth-failed':
+                    done.set()
+
+    reader = asyncio.ensure_future(read_log())
+    try:
+        await asyncio.wait_for(done.wait(), args.timeout)
+    except asyncio.TimeoutError:
+        if client.failure is None:
+            client.failure = 'timeout'
+
+    if client.push_reply is not None:
+        client.failure = None
+        if args.hold:
+            await asyncio.sleep(args.hold)
+    elif client.failure is None:
+        client.failure = 'exited'
+
+    if proc.returncode is None:
+        proc.send_signal(signal.SIGTERM)
+        try:
+            await asyncio.wait_for(proc.wait(), 10)
+        except asyncio.TimeoutError:
+            proc.kill()
+            await proc.wait()
+    await reader
+    stats.append(client)
+
+
+async def run(args):
+    stats = []
+    sem = asyncio.Semaphore(args.concurrency)
+    interval = 1.0 / args.rate if args.rate else 0
+
+    async def limited():
+        try:
+            await run_client(args, stats)
+        finally:
+            sem.release()
+
+    tasks = []
+    start = time.monotonic()
+    for i in range(args.clients):
+        await sem.acquire()
+        tasks.append(asyncio.ensure_future(limited()))
+        if interval:
+            await asyncio.sleep(max(0, start + (i + 1) * interval
+                                    - time.monotonic()))
+        if args.progress and (i + 1) % args.progress == 0:
+            print('# %d clients started, %d finished'
+                  % (i + 1, len(stats)), file=sys.stderr)
+    await asyncio.gather(*tasks)
+    return stats, time.monotonic() - start
+
+
+def percentiles(values):
+    values = sorted(values)
+    if not values:
+        return {}
+
+    def pick(p):
+        return values[min(len(values) - 1, int(p * len(values)))]
+    return {
+        'min': values[0],
+        'p50': pick(0.50),
+        'p90': pick(0.90),
+        'p99': pick(0.99),
+        'max': values[-1],
+    }
+
+
+def report(stats, elapsed, as_json):
+    ok = [c for c in stats if c.failure is None]
+    failures = {}
+    for c in stats:
+        if c.failure is not None:
+            failures[c.failure] = failures.get(c.failure, 0) + 1
+
+    result = {
+        'clients': len(stats),
+        'succeeded': len(ok),
+        'failed': len(stats) - len(ok),
+        'elapsed_s': elapsed,
+        'handshakes_per_s': len(ok) / elapsed if elapsed else 0,
+        'handshake_s': percentiles([c.handshake for c in ok
+                                    if c.handshake is not None]),
+        'push_reply_s': percentiles([c.push_reply for c in ok]),
+        'failures': failures,
+    }
+
+    if as_json:
+        print(json.dumps(result, indent=2, sort_keys=True))
+        return
+
+    print('clients: %d, succeeded: %d, failed: %d, elapsed: %.1f s'
+          % (result['clients'], result['succeeded'], result['failed'],
+             elapsed))
+    print('rate: %.1f handshakes/s' % result['handshakes_per_s'])
+    for name, key in (('handshake', 'handshake_s'),
+                      ('PUSH_REPLY', 'push_reply_s')):
+        p = result[key]
+        if p:
+            print('%-10s latency [ms]: min %.0f  p50 %.0f  p90 %.0f  '
+                  'p99 %.0f  max %.0f'
+                  % (name, p['min'] * 1000, p['p50'] * 1000,
+                     p['p90'] * 1000, p['p99'] * 1000, p['max'] * 1000))
+    for reason, count in sorted(failures.items(), key=lambda f: -f[1]):
+        print('failure %-24s %d' % (reason, count))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Measure handshake and PUSH_REPLY latency of an '
+                    'OpenVPN server under load.',
+        epilog='Arguments after -- are passed to every openvpn client.')
+    parser.add_argument('config', help='client config file')
+    parser.add_argument('--clients', type=int, default=100,
+                        help='number of clients to start (default: 100)')
+    parser.add_argument('--concurrency', type=int, default=50,
+                        help='maximum number of clients running at the '
+                             'same time (default: 50)')
+    parser.add_argument('--rate', type=float, default=0,
+                        help='start at most this many clients per second '
+                             '(default: no limit)')
+    parser.add_argument('--hold', type=float, default=0,
+                        help='keep each client connected for this many '
+                             'seconds after PUSH_REPLY (default: 0)')
+    parser.add_argument('--timeout', type=float, default=60,
+                        help='give up on a client after this many seconds '
+                             '(default: 60)')
+    parser.add_argument('--openvpn', default='openvpn',
+                        help='openvpn binary to run (default: openvpn)')
+    parser.add_argument('--progress', type=int, default=0,
+                        help='print progress every N started clients')
+    parser.add_argument('--json', action='store_true',
+                        help='print the result as JSON')
+    argv = sys.argv[1:]
+    extra = []
+    if '--' in argv:
+        extra = argv[argv.index('--') + 1:]
+        argv = argv[:argv.index('--')]
+    args = parser.parse_args(argv)
+    args.extra = extra
+
+    if args.clients < 1 or args.concurrency < 1:
+        parser.error('--clients and --concurrency must be at least 1')
+
+    loop = asyncio.new_event_loop()
+    try:
+        stats, elapsed = loop.run_until_complete(run(args))
+    finally:
+        loop.close()
+    report(stats, elapsed, args.json)
+    return 0 if stats and all(c.failure is None for c in stats) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
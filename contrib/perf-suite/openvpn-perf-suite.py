@@ -0,0 +1,428 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+'''
+Throughput and latency regression suite for OpenVPN.
+
+Runs the point-to-point TLS tunnel of tests/t_cltsrv.sh, with the sample
+keys of the source tree, between two network namespaces joined by a veth
+pair, and drives these workloads through it:
+
+  tcp       TCP goodput in Mbit/s (iperf3)
+  udp       UDP goodput in Mbit/s of full size datagrams (iperf3 -u)
+  pps       received packets per second of 64 byte datagrams (iperf3 -u)
+  latency   average and deviation of the round trip time in ms of a
+            fast ping through the tunnel
+
+for every combination of the configuration axes given on the command
+line:
+
+  --proto     udp, tcp
+  --cipher    any --data-ciphers entry, e.g. AES-256-GCM, CHACHA20-POLY1305
+  --dco       on, off (on only takes effect if ovpn-dco is loaded)
+  --compress  none, or an algorithm of --compress, e.g. lz4-v2, stub-v2
+  --fragment  0 for none, or a --fragment size, UDP without DCO only
+
+Combinations that OpenVPN cannot run (--fragment over TCP or with DCO)
+are skipped.  Each workload is run --runs times and the median is kept.
+
+The results are a JSON document with the versions of OpenVPN and of the
+kernel next to them, so that runs on the same machine can be compared.
+With --baseline the results are compared to an earlier document, and
+the script fails if a metric got worse by more than --threshold percent.
+
+This needs root (for the namespaces and the tun devices), iproute2,
+iperf3, ping and an openvpn binary.
+
+Usage example:
+    openvpn-perf-suite.py --openvpn src/openvpn/openvpn --json base.json
+    openvpn-perf-suite.py --openvpn src/openvpn/openvpn \\
+        --baseline base.json --proto udp --cipher AES-256-GCM
+'''
+
+import argparse
+import datetime
+import itertools
+import json
+import os
+import platform
+import re
+import signal
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+NETNS_SERVER = 'ovpn-perf-s'
+NETNS_CLIENT = 'ovpn-perf-c'
+VETH_SERVER = 'perf0'
+VETH_CLIENT = 'perf1'
+LINK_SERVER = '10.196.0.1'
+LINK_CLIENT = '10.196.0.2'
+TUN_SERVER = '10.197.0.1'
+TUN_CLIENT = '10.197.0.2'
+TUN_DEV = 'ovpnperf'
+PORT = 11950
+
+INITIALIZED = re.compile(r'Initialization Sequence Completed')
+PING_RTT = re.compile(r'= [\d.]+/([\d.]+)/[\d.]+/([\d.]+) ms')
+
+# metric: (unit, True if higher is better)
+METRICS = {
+    'tcp_mbit': ('Mb/s', True),
+    'udp_mbit': ('Mb/s', True),
+    'pps': ('pkt/s', True),
+    'rtt_ms': ('ms', False),
+    'rtt_mdev_ms': ('ms', False),
+}
+WORKLOADS = ('tcp', 'udp', 'pps', 'latency')
+
+
+def run(cmd, check=True, timeout=None):
+    return subprocess.run(cmd, check=check, stdout=subprocess.PIPE,
+                          stderr=subprocess.STDOUT, universal_newlines=True,
+                          timeout=timeout)
+
+
+def ns(netns, cmd):
+    return ['ip', 'netns', 'exec', netns] + cmd
+
+
+def setup_netns():
+    teardown_netns()
+    for netns in (NETNS_SERVER, NETNS_CLIENT):
+        run(['ip', 'netns', 'add', netns])
+        run(ns(netns, ['ip', 'link', 'set', 'lo', 'up']))
+    run(['ip', 'link', 'add', VETH_SERVER, 'netns', NETNS_SERVER,
+         'type', 'veth', 'peer', 'name', VETH_CLIENT, 'netns', NETNS_CLIENT])
+    for netns, dev, addr in ((NETNS_SERVER, VETH_SERVER, LINK_SERVER),
+                             (NETNS_CLIENT, VETH_CLIENT, LINK_CLIENT)):
+        run(ns(netns, ['ip', 'addr', 'add', addr + '/30', 'dev', dev]))
+        run(ns(netns, ['ip', 'link', 'set', dev, 'up']))
+
+
+def teardown_netns():
+    for netns in (NETNS_SERVER, NETNS_CLIENT):
+        run(['ip', 'netns', 'del', netns], check=False)
+
+
+def configurations(args):
+    '''All combinations of the axes that OpenVPN can run.'''
+    for proto, cipher, dco, compress, fragment in itertools.product(
+            args.proto, args.cipher, args.dco, args.compress,
+            args.fragment):
+        if fragment and (proto == 'tcp' or dco == 'on'):
+            continue
+        name = '%s-%s-dco%s-%s' % (proto, cipher.lower(), dco, compress)
+        if fragment:
+            name += '-frag%d' % fragment
+        yield {'name': name, 'proto': proto, 'cipher': cipher, 'dco': dco,
+               'compress': compress, 'fragment': fragment}
+
+
+def openvpn_cmd(args, config, server):
+    keys = args.keys
+    proto = config['proto'] + '4'
+    if config['proto'] == 'tcp':
+        proto += '-server' if server else '-client'
+    cmd = [args.openvpn, '--dev', TUN_DEV, '--dev-type', 'tun',
+           '--verb', '3', '--proto', proto,
+           '--ca', os.path.join(keys, 'ca.crt'),
+           '--data-ciphers', config['cipher'],
+           '--ping', '10', '--ping-restart', '60']
+    if server:
+        cmd += ['--tls-server', '--dh', 'none',
+                '--cert', os.path.join(keys, 'server.crt'),
+                '--key', os.path.join(keys, 'server.key'),
+                '--local', LINK_SERVER, '--lport', str(PORT),
+                '--ifconfig', TUN_SERVER, TUN_CLIENT]
+    else:
+        cmd += ['--tls-client', '--remote-cert-tls', 'server',
+                '--cert', os.path.join(keys, 'client.crt'),
+                '--key', os.path.join(keys, 'client.key'),
+                '--remote', LINK_SERVER, str(PORT), '--nobind',
+                '--ifconfig', TUN_CLIENT, TUN_SERVER]
+    if config['dco'] == 'off':
+        cmd += ['--disable-dco']
+    if config['compress'] != 'none':
+        cmd += ['--allow-compression', 'yes',
+                '--compress', config['compress']]
+    if config['fragment']:
+        cmd += ['--fragment', str(config['fragment']), '--mssfix']
+    return cmd + args.options.split()
+
+
+class Peer:
+    def __init__(self, netns, cmd, logfile):
+        self.logfile = logfile
+        with open(logfile, 'w') as out:
+            self.proc = subprocess.Popen(ns(netns, cmd),
+                                         stdin=subprocess.DEVNULL,
+                                         stdout=out,
+                                         stderr=subprocess.STDOUT)
+
+    def wait_for(self, pattern, timeout):
+        deadline = time.monotonic() + timeout
+        while time.monotonic() < deadline and self.proc.poll() is None:
+            with open(self.logfile) as log:
+                if pattern.search(log.read()):
+                    return True
+            time.sleep(0.1)
+        return False
+
+    def stop(self):
+        if self.proc.poll() is None:
+            self.proc.send_signal(signal.SIGTERM)
+            try:
+                self.proc.wait(10)
+            except subprocess.TimeoutExpired:
+                self.proc.kill()
+                self.proc.wait()
+
+
+def dco_active():
+    out = run(ns(NETNS_CLIENT, ['ip', '-d', 'link', 'show', 'dev', TUN_DEV]),
+              check=False).stdout
+    return 'ovpn-dco' in out
+
+
+def iperf3(args, extra):
+    '''Run iperf3 from the client to the server, return its JSON report.'''
+    server = subprocess.Popen(ns(NETNS_SERVER, ['iperf3', '-s', '-1',
+                                                '-B', TUN_SERVER]),
+                              stdout=subprocess.DEVNULL,
+                              stderr=subprocess.DEVNULL)
+    time.sleep(0.5)
+    try:
+        out = run(ns(NETNS_CLIENT, ['iperf3', '-c', TUN_SERVER,
+                                    '-t', str(args.duration), '-J'] + extra),
+                  check=False, timeout=args.duration + 30).stdout
+    except subprocess.TimeoutExpired:
+        out = ''
+    try:
+        server.wait(10)
+    except subprocess.TimeoutExpired:
+        server.kill()
+        server.wait()
+    try:
+        return json.loads(out)
+    except ValueError:
+        return None
+
+
+def measure(args, workload):
+    '''Run one workload through the tunnel, return its metrics.'''
+    if workload == 'tcp':
+        report = iperf3(args, [])
+        if report:
+            return {'tcp_mbit':
+                    report['end']['sum_received']['bits_per_second'] / 1e6}
+    elif workload == 'udp':
+        report = iperf3(args, ['-u', '-b', '0', '-l', str(args.udp_size)])
+        if report:
+            return {'udp_mbit': report['end']['sum']['bits_per_second']
+                    * (1 - report['end']['sum']['lost_percent'] / 100)
+                    / 1e6}
+    elif workload == 'pps':
+        report = iperf3(args, ['-u', '-b', '0', '-l', '64'])
+        if report:
+            s = report['end']['sum']
+            return {'pps': (s['packets'] - s['lost_packets']) / s['seconds']}
+    elif workload == 'latency':
+        out = run(ns(NETNS_CLIENT, ['ping', '-q', '-c', str(args.pings),
+                                    '-i', '0.01', '-s', '56', TUN_SERVER]),
+                  check=False).stdout
+        m = PING_RTT.search(out)
+        if m:
+            return {'rtt_ms': float(m.group(1)),
+                    'rtt_mdev_ms': float(m.group(2))}
+    return {}
+
+
+def run_config(args, config, workdir):
+    '''Bring up the tunnel of config and run all workloads --runs times.'''
+    server = Peer(NETNS_SERVER, openvpn_cmd(args, config, True),
+                  os.path.join(workdir, 'server.log'))
+    client = Peer(NETNS_CLIENT, openvpn_cmd(args, config, False),
+                  os.path.join(workdir, 'client.log'))
+    result = dict(config)
+    samples = {}
+    try:
+        result['up'] = (client.wait_for(INITIALIZED, args.timeout)
+                        and server.wait_for(INITIALIZED, args.timeout))
+        if result['up']:
+            result['dco_active'] = dco_active()
+            for _ in range(args.runs):
+                for workload in args.workloads:
+                    for key, value in measure(args, workload).items():
+                        samples.setdefault(key, []).append(value)
+    finally:
+        client.stop()
+        server.stop()
+    for key in METRICS:
+        if key in samples:
+            result[key] = statistics.median(samples[key])
+    return result
+
+
+def metadata(args):
+    version = run([args.openvpn, '--version'], check=False).stdout
+    cpu = ''
+    try:
+        with open('/proc/cpuinfo') as f:
+            m = re.search(r'^model name\s*:\s*(.*)$', f.read(), re.M)
+            cpu = m.group(1) if m else ''
+    except OSError:
+        pass
+    return {'openvpn': version.splitlines()[0] if version else '',
+            'kernel': platform.release(),
+            'cpu': cpu,
+            'date': datetime.datetime.now(datetime.timezone.utc)
+            .isoformat(timespec='seconds'),
+            'runs': args.runs, 'duration': args.duration}
+
+
+def compare(results, baseline, threshold):
+    '''Return the metrics that got worse than baseline by threshold %.'''
+    old = {r['name']: r for r in baseline['results']}
+    regressions = []
+    for r in results:
+        b = old.get(r['name'])
+        if not b:
+            continue
+        for key, (unit, higher_better) in METRICS.items():
+            if r.get(key) is None or not b.get(key):
+                continue
+            change = (r[key] - b[key]) * 100.0 / b[key]
+            r[key + '_change'] = change
+            if (-change if higher_better else change) > threshold:
+                regressions.append('%s %s: %.2f -> %.2f %s (%+.1f%%)'
+                                   % (r['name'], key, b[key], r[key], unit,
+                                      change))
+    return regressions
+
+
+def fmt(value, spec):
+    return '-' if value is None else spec % value
+
+
+def print_table(results):
+    print('%-40s %3s %9s %9s %10s %8s %8s'
+          % ('configuration', 'dco', 'tcp Mb/s', 'udp Mb/s', 'pkt/s',
+             'rtt ms', 'mdev ms'))
+    for r in results:
+        dco = '-' if 'dco_active' not in r else (
+            'yes' if r['dco_active'] else 'no')
+        print('%-40s %3s %9s %9s %10s %8s %8s'
+              % (r['name'][:40], dco,
+                 fmt(r.get('tcp_mbit'), '%.1f'),
+                 fmt(r.get('udp_mbit'), '%.1f'),
+                 fmt(r.get('pps'), '%.0f'),
+                 fmt(r.get('rtt_ms'), '%.3f'),
+                 fmt(r.get('rtt_mdev_ms'), '%.3f')))
+
+
+def comma_list(value):
+    return [v for v in value.split(',') if v]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Measure throughput, packet rate and latency of '
+                    'OpenVPN tunnels across configurations and compare '
+                    'them to a baseline.')
+    parser.add_argument('--proto', type=comma_list, default=['udp', 'tcp'],
+                        help='transport protocols (default: udp,tcp)')
+    parser.add_argument('--cipher', type=comma_list,
+                        default=['AES-256-GCM', 'CHACHA20-POLY1305'],
+                        help='data channel ciphers '
+                             '(default: AES-256-GCM,CHACHA20-POLY1305)')
+    parser.add_argument('--dco', type=comma_list, default=['off', 'on'],
+                        help='data channel offload (default: off,on)')
+    parser.add_argument('--compress', type=comma_list, default=['none'],
+                        help='compression algorithms, none for no '
+                             'compression (default: none)')
+    parser.add_argument('--fragment', type=lambda v: [int(x) for x in
+                                                      comma_list(v)],
+                        default=[0],
+                        help='--fragment sizes, 0 for none (default: 0)')
+    parser.add_argument('--workloads', type=comma_list,
+                        default=list(WORKLOADS),
+                        help='workloads to run (default: %s)'
+                             % ','.join(WORKLOADS))
+    parser.add_argument('--options', default='',
+                        help='more openvpn options for both peers')
+    parser.add_argument('--runs', type=int, default=3,
+                        help='runs per workload, the median is kept '
+                             '(default: 3)')
+    parser.add_argument('--duration', type=int, default=10,
+                        help='seconds of iperf3 traffic per run '
+                             '(default: 10)')
+    parser.add_argument('--udp-size', type=int, default=1400,
+                        help='datagram size of the udp workload '
+                             '(default: 1400)')
+    parser.add_argument('--pings', type=int, default=500,
+                        help='pings of the latency workload (default: 500)')
+    parser.add_argument('--timeout', type=float, default=30,
+                        help='give up on a tunnel that is not up after '
+                             'this many seconds (default: 30)')
+    parser.add_argument('--openvpn', default='openvpn',
+                        help='openvpn binary to run (default: openvpn)')
+    parser.add_argument('--keys',
+                        default=os.path.join(os.path.dirname(
+                            os.path.abspath(__file__)),
+                            '..', '..', 'sample', 'sample-keys'),
+                        help='directory with ca.crt, server.crt/key and '
+                             'client.crt/key')
+    parser.add_argument('--json', metavar='FILE',
+                        help='write the results to FILE, - for stdout')
+    parser.add_argument('--baseline', metavar='FILE',
+                        help='compare to the results in FILE')
+    parser.add_argument('--threshold', type=float, default=5,
+                        help='percent a metric may get worse than the '
+                             'baseline (default: 5)')
+    args = parser.parse_args()
+
+    for workload in args.workloads:
+        if workload not in WORKLOADS:
+            parser.error('unknown workload %s' % workload)
+    if os.geteuid() != 0:
+        parser.error('must be run as root')
+    baseline = None
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    results = []
+    setup_netns()
+    try:
+        for config in configurations(args):
+            with tempfile.TemporaryDirectory() as workdir:
+                results.append(run_config(args, config, workdir))
+            print('# %s done' % config['name'], file=sys.stderr)
+    finally:
+        teardown_netns()
+
+    regressions = compare(results, baseline, args.threshold) \
+        if baseline else []
+    doc = {'meta': metadata(args), 'results': results}
+
+    if args.json == '-':
+        print(json.dumps(doc, indent=2, sort_keys=True))
+    else:
+        print_table(results)
+        if args.json:
+            with open(args.json, 'w') as f:
+                json.dump(doc, f, indent=2, sort_keys=True)
+    for line in regressions:
+        print('REGRESSION: ' + line, file=sys.stderr)
+
+    failed = [r['name'] for r in results if not r['up']]
+    for name in failed:
+        print('FAILED: %s did not come up' % name, file=sys.stderr)
+    return 1 if failed or regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
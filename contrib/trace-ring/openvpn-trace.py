@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+# -*- coding: utf-8 -*-
+
+'''
+Decoder for the event ring written by OpenVPN's --trace-ring option.
+
+The ring can be read while OpenVPN is running, or after it exited.
+Events are printed oldest first, one per line:
+
+    <time> <peer> <event> len=<len> [details]
+
+Usage example:
+    openvpn-trace.py /dev/shm/openvpn.trace
+    openvpn-trace.py --last 1000 --peer 7 /dev/shm/openvpn.trace
+    openvpn-trace.py --disable /dev/shm/openvpn.trace   # freeze the ring
+    openvpn-trace.py --enable /dev/shm/openvpn.trace
+'''
+
+import argparse
+import mmap
+import struct
+import sys
+import time
+
+MAGIC = 0x5254564F
+VERSION = 1
+HEADER = struct.Struct('<IHHIIQ')       # see struct trace_ring
+EVENT = struct.Struct('<QIHHiI')        # see struct trace_event
+ENABLED_OFFSET = 12
+PEER_NONE = 0xFFFFFFFF
+
+TYPES = {
+    1: 'LINK_IN',
+    2: 'LINK_OUT',
+    3: 'TUN_IN',
+    4: 'TUN_OUT',
+    5: 'DECRYPT',
+    6: 'DROP',
+}
+
+DROP_REASONS = {
+    1: 'shaper',
+    2: 'queue-full',
+}
+
+
+def details(etype, flags, arg):
+    if etype == 5:
+        return 'ok' if arg else 'FAILED'
+    if etype == 6:
+        return 'reason=%s queue=%d' % (DROP_REASONS.get(flags, flags), arg)
+    return ''
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Decode an OpenVPN --trace-ring file.')
+    parser.add_argument('file', help='file given to --trace-ring')
+    parser.add_argument('--last', type=int, default=0,
+                        help='only print the last N events')
+    parser.add_argument('--peer', type=int,
+                        help='only print events of this peer-id')
+    parser.add_argument('--enable', action='store_true',
+                        help='resume recording')
+    parser.add_argument('--disable', action='store_true',
+                        help='stop recording, keeping the ring as it is')
+    args = parser.parse_args()
+
+    with open(args.file, 'r+b' if args.enable or args.disable else 'rb') as f:
+        m = mmap.mmap(f.fileno(), 0,
+                      access=mmap.ACCESS_WRITE if args.enable or args.disable
+                      else mmap.ACCESS_READ)
+        magic, version, event_size, size, enabled, head = HEADER.unpack_from(m, 0)
+        if magic != MAGIC or version != VERSION or event_size != EVENT.size:
+            sys.exit('%s: not a version %d trace ring' % (args.file, VERSION))
+
+        if args.enable or args.disable:
+            struct.pack_into('<I', m, ENABLED_OFFSET, 1 if args.enable else 0)
+            return
+
+        # OpenVPN may overwrite the oldest events while we copy them,
+        # so copy the ring and drop what was written meanwhile
+        events = bytes(m[HEADER.size:HEADER.size + size * EVENT.size])
+        head_after = HEADER.unpack_from(m, 0)[5]
+
+    first = max(0, head - size + (head_after - head))
+    if args.last:
+        first = max(first, head - args.last)
+
+    print('# %d events recorded, %d in the ring, recording %s'
+          % (head, head - first, 'on' if enabled else 'off'))
+    for n in range(first, head):
+        usec, peer, etype, flags, length, arg = \
+            EVENT.unpack_from(events, (n % size) * EVENT.size)
+        if args.peer is not None and peer != args.peer:
+            continue
+        line = '%s.%06d %s %s len=%d %s' % (
+            time.strftime('%H:%M:%S', time.localtime(usec // 1000000)),
+            usec % 1000000,
+            '-' if peer == PEER_NONE else peer,
+            TYPES.get(etype, etype),
+            length,
+            details(etype, flags, arg))
+        print(line.rstrip())
+
+
+if __name__ == '__main__':
+    main()
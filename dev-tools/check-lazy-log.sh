@@ -0,0 +1,36 @@
+#!/bin/sh
+# check-lazy-log.sh - Find log message arguments that are formatted
+#                     outside of msg()/dmsg() on the packet path.
+#
+# msg() and dmsg() only evaluate their arguments if the message level is
+# enabled.  A string that is formatted into a variable first is built for
+# every packet, even if it is never printed.  This script reports such
+# assignments unless one of the three lines before them tests the level
+# with check_debug_level() or msg_test().
+#
+# Usage: dev-tools/check-lazy-log.sh [file...]
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License version 2
+# as published by the Free Software Foundation.
+
+srcroot="$(cd "$(dirname "$0")/.." && pwd)"
+
+if [ $# -eq 0 ]; then
+    for f in forward.c multi.c mudp.c mtcp.c crypto.c ssl.c ssl_pkt.c; do
+        set -- "$@" "$srcroot/src/openvpn/$f"
+    done
+fi
+
+awk '
+    FNR == 1 { guard = 0 }
+    /check_debug_level\(|msg_test\(/ { guard = FNR }
+    /=[ \t]*(print_link_socket_actual|mroute_addr_print(_ex)?|print_sockaddr(_ex)?|format_hex)[ \t]*\(/ {
+        if (!guard || FNR - guard > 3)
+        {
+            printf("%s:%d: formatted outside of msg(): %s\n", FILENAME, FNR, $0)
+            bad = 1
+        }
+    }
+    END { exit bad }
+' "$@"
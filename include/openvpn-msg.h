@@ -42,7 +42,8 @@ typedef enum {
     msg_register_ring_buffers,
     msg_set_mtu,
     msg_add_wins_cfg,
-    msg_del_wins_cfg
+    msg_del_wins_cfg,
+    msg_route_batch
 } message_type_t;
 
 typedef struct {
@@ -79,6 +80,20 @@ typedef struct {
     int metric;
 } route_message_t;
 
+#define ROUTE_BATCH_MAX 64
+
+/*
+ * Up to ROUTE_BATCH_MAX route messages in one go, each with its own
+ * header of type msg_add_route or msg_del_route.  The size in the
+ * header only covers the first count routes.  A client sends an empty
+ * batch first, to find out whether the service knows them.
+ */
+typedef struct {
+    message_header_t header;
+    int count;
+    route_message_t routes[ROUTE_BATCH_MAX];
+} route_batch_message_t;
+
 typedef struct {
     message_header_t header;
     interface_t iface;
@@ -118,6 +133,14 @@ typedef struct {
     int error_number;
 } ack_message_t;
 
+/* reply to a route batch, starts like an ack_message_t */
+typedef struct {
+    message_header_t header;
+    int error_number;
+    int count;
+    int route_error[ROUTE_BATCH_MAX];
+} route_batch_ack_message_t;
+
 typedef struct {
     message_header_t header;
     interface_t iface;
@@ -0,0 +1,493 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "acl.h"
+#include "integer.h"
+#include "proto.h"
+
+#include "memdbg.h"
+
+/* IPv6 extension headers skipped to find the transport protocol */
+#define ACL_IPV6_HOPOPTS  0
+#define ACL_IPV6_ROUTING 43
+#define ACL_IPV6_FRAGMENT 44
+#define ACL_IPV6_AH      51
+#define ACL_IPV6_DSTOPTS 60
+
+/* the fields of a packet the rules look at */
+struct acl_packet
+{
+    bool ipv6;
+    int proto;
+    bool has_port;              /* false for non-first fragments */
+    uint16_t port;              /* host order */
+    uint32_t addr[4];
+};
+
+struct acl_list *
+acl_list_new(struct gc_arena *gc)
+{
+    struct acl_list *acl;
+    ALLOC_OBJ_CLEAR_GC(acl, struct acl_list, gc);
+    return acl;
+}
+
+struct acl_list *
+acl_list_clone(const struct acl_list *src, struct gc_arena *gc)
+{
+    struct acl_list *acl = acl_list_new(gc);
+
+    acl->deny = src->deny;
+    for (int i = 0; i < (int) SIZE(acl->chains); ++i)
+    {
+        const struct acl_chain *from = &src->chains[i];
+        struct acl_chain *to = &acl->chains[i];
+        if (from->n)
+        {
+            ALLOC_ARRAY_GC(to->rules, struct acl_rule, from->n, gc);
+            memcpy(to->rules, from->rules, from->n * sizeof(struct acl_rule));
+            to->n = to->capacity = from->n;
+        }
+    }
+    return acl;
+}
+
+static void
+chain_append(struct acl_chain *chain, const struct acl_rule *rule,
+             struct gc_arena *gc)
+{
+    if (chain->n == chain->capacity)
+    {
+        struct acl_rule *rules;
+        const int capacity = max_int(8, chain->capacity * 2);
+        ALLOC_ARRAY_GC(rules, struct acl_rule, capacity, gc);
+        if (chain->n)
+        {
+            memcpy(rules, chain->rules, chain->n * sizeof(struct acl_rule));
+        }
+        chain->rules = rules;
+        chain->capacity = capacity;
+    }
+    chain->rules[chain->n++] = *rule;
+}
+
+static bool
+parse_proto(const char *str, int *proto)
+{
+    if (!strcmp(str, "any"))
+    {
+        *proto = ACL_PROTO_ANY;
+    }
+    else if (!strcmp(str, "tcp"))
+    {
+        *proto = OPENVPN_IPPROTO_TCP;
+    }
+    else if (!strcmp(str, "udp"))
+    {
+        *proto = OPENVPN_IPPROTO_UDP;
+    }
+    else if (!strcmp(str, "icmp"))
+    {
+        *proto = 1;
+    }
+    else if (!strcmp(str, "icmpv6"))
+    {
+        *proto = OPENVPN_IPPROTO_ICMPV6;
+    }
+    else
+    {
+        char *end;
+        const long n = strtol(str, &end, 10);
+        if (!*str || *end || n < 0 || n > 255)
+        {
+            return false;
+        }
+        *proto = (int) n;
+    }
+    return true;
+}
+
+static bool
+parse_port(const char *str, uint16_t *port)
+{
+    char *end;
+    const long n = strtol(str, &end, 10);
+    if (!*str || *end || n < 0 || n > 65535)
+    {
+        return false;
+    }
+    *port = (uint16_t) n;
+    return true;
+}
+
+static bool
+parse_ports(const char *str, struct acl_rule *rule, struct gc_arena *gc)
+{
+    const char *dash = strchr(str, '-');
+    if (!dash)
+    {
+        if (!parse_port(str, &rule->port_lo))
+        {
+            return false;
+        }
+        rule->port_hi = rule->port_lo;
+        return true;
+    }
+
+    char *lo = string_alloc(str, gc);
+    lo[dash - str] = '\0';
+    return parse_port(lo, &rule->port_lo)
+           && parse_port(dash + 1, &rule->port_hi)
+           && rule->port_lo <= rule->port_hi;
+}
+
+/*
+ * Parse "address[/bits]".  Returns 4 for IPv4, 6 for IPv6 and 0 if
+ * the string is not an address.
+ */
+static int
+parse_network(const char *str, struct acl_rule *rule, struct gc_arena *gc)
+{
+    char *addr = string_alloc(str, gc);
+    char *slash = strchr(addr, '/');
+    long bits = -1;
+
+    if (slash)
+    {
+        char *end;
+        *slash = '\0';
+        bits = strtol(slash + 1, &end, 10);
+        if (!slash[1] || *end || bits < 0)
+        {
+            return 0;
+        }
+    }
+
+    int family;
+    int max_bits;
+    if (inet_pton(AF_INET, addr, rule->net) == 1)
+    {
+        family = 4;
+        max_bits = 32;
+    }
+    else if (inet_pton(AF_INET6, addr, rule->net) == 1)
+    {
+        family = 6;
+        max_bits = 128;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (bits < 0)
+    {
+        bits = max_bits;
+    }
+    else if (bits > max_bits)
+    {
+        return 0;
+    }
+
+    for (int i = 0; i < max_bits / 32; ++i)
+    {
+        const long b = min_int(max_int((int) bits - i * 32, 0), 32);
+        rule->mask[i] = b ? htonl(0xffffffffu << (32 - b)) : 0;
+        rule->net[i] &= rule->mask[i];
+    }
+    return family;
+}
+
+bool
+acl_list_add(struct acl_list *acl, const char **p, int msglevel,
+             struct gc_arena *gc)
+{
+    struct acl_rule rule;
+    int dir;
+    int family = 0;
+    struct buffer text = alloc_buf_gc(256, gc);
+
+    CLEAR(rule);
+    rule.proto = ACL_PROTO_ANY;
+    rule.port_hi = 65535;
+
+    if (!p[0] || !p[1])
+    {
+        msg(msglevel, "--acl: missing arguments");
+        return false;
+    }
+    if (!strcmp(p[0], "allow"))
+    {
+        rule.allow = true;
+    }
+    else if (strcmp(p[0], "deny"))
+    {
+        msg(msglevel, "--acl: the action must be 'allow' or 'deny'");
+        return false;
+    }
+    if (!strcmp(p[1], "in"))
+    {
+        dir = ACL_IN;
+    }
+    else if (!strcmp(p[1], "out"))
+    {
+        dir = ACL_OUT;
+    }
+    else
+    {
+        msg(msglevel, "--acl: the direction must be 'in' or 'out'");
+        return false;
+    }
+    buf_printf(&text, "%s %s", p[0], p[1]);
+
+    if (p[2])
+    {
+        if (!parse_proto(p[2], &rule.proto))
+        {
+            msg(msglevel, "--acl: bad protocol: %s", p[2]);
+            return false;
+        }
+        buf_printf(&text, " %s", p[2]);
+    }
+    if (p[2] && p[3])
+    {
+        if (strcmp(p[3], "any"))
+        {
+            family = parse_network(p[3], &rule, gc);
+            if (!family)
+            {
+                msg(msglevel, "--acl: bad address: %s", p[3]);
+                return false;
+            }
+        }
+        buf_printf(&text, " %s", p[3]);
+    }
+    if (p[2] && p[3] && p[4])
+    {
+        if (rule.proto != OPENVPN_IPPROTO_TCP && rule.proto != OPENVPN_IPPROTO_UDP)
+        {
+            msg(msglevel, "--acl: ports require the protocol tcp or udp");
+            return false;
+        }
+        if (!parse_ports(p[4], &rule, gc))
+        {
+            msg(msglevel, "--acl: bad port or port range: %s", p[4]);
+            return false;
+        }
+        buf_printf(&text, " %s", p[4]);
+    }
+    rule.text = BSTR(&text);
+
+    if (family != 6)
+    {
+        chain_append(&acl->chains[ACL_CHAIN(dir, 0)], &rule, gc);
+    }
+    if (family != 4)
+    {
+        chain_append(&acl->chains[ACL_CHAIN(dir, 1)], &rule, gc);
+    }
+    return true;
+}
+
+void
+acl_list_append(struct acl_list *acl, int chain, const struct acl_rule *rule,
+                struct gc_arena *gc)
+{
+    ASSERT(chain >= 0 && chain < (int) SIZE(acl->chains));
+    chain_append(&acl->chains[chain], rule, gc);
+}
+
+void
+acl_list_print(const struct acl_list *acl, int msglevel)
+{
+    static const char *names[] = { "in/IPv4", "in/IPv6", "out/IPv4", "out/IPv6" };
+
+    msg(msglevel, "*** ACL list, default %s", acl->deny ? "deny" : "allow");
+    for (int i = 0; i < (int) SIZE(acl->chains); ++i)
+    {
+        const struct acl_chain *chain = &acl->chains[i];
+        for (int j = 0; j < chain->n; ++j)
+        {
+            msg(msglevel, "  ACL %s [%d] %s", names[i], j, chain->rules[j].text);
+        }
+    }
+}
+
+static void
+read_port(const struct buffer *buf, int offset, int dir, struct acl_packet *pkt)
+{
+    if (BLEN(buf) >= offset + 4)
+    {
+        /* the port of the other end: destination of packets from the
+         * client, source of packets to it */
+        const uint8_t *ports = BPTR(buf) + offset + (dir == ACL_IN ? 2 : 0);
+        pkt->port = (uint16_t) (ports[0] << 8 | ports[1]);
+        pkt->has_port = true;
+    }
+}
+
+static bool
+parse_ipv4(const struct buffer *buf, int dir, struct acl_packet *pkt)
+{
+    if (BLEN(buf) < (int) sizeof(struct openvpn_iphdr))
+    {
+        return false;
+    }
+
+    const struct openvpn_iphdr *ip = (const struct openvpn_iphdr *) BPTR(buf);
+    pkt->ipv6 = false;
+    pkt->proto = ip->protocol;
+    pkt->addr[0] = dir == ACL_IN ? ip->daddr : ip->saddr;
+    if (!(ntohs(ip->frag_off) & OPENVPN_IP_OFFMASK))
+    {
+        read_port(buf, OPENVPN_IPH_GET_LEN(ip->version_len), dir, pkt);
+    }
+    return true;
+}
+
+static bool
+parse_ipv6(const struct buffer *buf, int dir, struct acl_packet *pkt)
+{
+    if (BLEN(buf) < (int) sizeof(struct openvpn_ipv6hdr))
+    {
+        return false;
+    }
+
+    const struct openvpn_ipv6hdr *ip6 = (const struct openvpn_ipv6hdr *) BPTR(buf);
+    pkt->ipv6 = true;
+    memcpy(pkt->addr, dir == ACL_IN ? &ip6->daddr : &ip6->saddr, sizeof(pkt->addr));
+
+    int proto = ip6->nexthdr;
+    int offset = sizeof(struct openvpn_ipv6hdr);
+    bool first_fragment = true;
+    for (int i = 0; i < 8; ++i)
+    {
+        const uint8_t *h = BPTR(buf) + offset;
+        if (proto != ACL_IPV6_HOPOPTS && proto != ACL_IPV6_ROUTING
+            && proto != ACL_IPV6_FRAGMENT && proto != ACL_IPV6_AH
+            && proto != ACL_IPV6_DSTOPTS)
+        {
+            break;
+        }
+        if (BLEN(buf) < offset + 8)
+        {
+            /* truncated, the transport protocol is unknown */
+            return false;
+        }
+        if (proto == ACL_IPV6_FRAGMENT)
+        {
+            first_fragment = !((h[2] << 8 | h[3]) & 0xfff8);
+            offset += 8;
+        }
+        else if (proto == ACL_IPV6_AH)
+        {
+            offset += (h[1] + 2) * 4;
+        }
+        else
+        {
+            offset += (h[1] + 1) * 8;
+        }
+        proto = h[0];
+    }
+
+    pkt->proto = proto;
+    if (first_fragment)
+    {
+        read_port(buf, offset, dir, pkt);
+    }
+    return true;
+}
+
+static bool
+rule_matches(const struct acl_rule *r, const struct acl_packet *pkt)
+{
+    if (r->proto != ACL_PROTO_ANY && r->proto != pkt->proto)
+    {
+        return false;
+    }
+    if (r->port_lo != 0 || r->port_hi != 65535)
+    {
+        if (!pkt->has_port || pkt->port < r->port_lo || pkt->port > r->port_hi)
+        {
+            return false;
+        }
+    }
+    if ((pkt->addr[0] & r->mask[0]) != r->net[0])
+    {
+        return false;
+    }
+    if (pkt->ipv6)
+    {
+        for (int i = 1; i < 4; ++i)
+        {
+            if ((pkt->addr[i] & r->mask[i]) != r->net[i])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool
+acl_permits(const struct acl_list *acl, int dir, const struct buffer *buf)
+{
+    struct acl_packet pkt;
+    bool parsed = false;
+
+    CLEAR(pkt);
+    if (BLEN(buf) > 0)
+    {
+        switch (OPENVPN_IPH_GET_VER(*BPTR(buf)))
+        {
+            case 4:
+                parsed = parse_ipv4(buf, dir, &pkt);
+                break;
+
+            case 6:
+                parsed = parse_ipv6(buf, dir, &pkt);
+                break;
+        }
+    }
+    if (!parsed)
+    {
+        return !acl->deny;
+    }
+
+    const struct acl_chain *chain = &acl->chains[ACL_CHAIN(dir, pkt.ipv6)];
+    for (int i = 0; i < chain->n; ++i)
+    {
+        const struct acl_rule *r = &chain->rules[i];
+        if (rule_matches(r, &pkt))
+        {
+            return r->allow;
+        }
+    }
+    return !acl->deny;
+}
@@ -0,0 +1,121 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef ACL_H
+#define ACL_H
+
+/**
+ * @file
+ * Per-client packet filter for --acl.
+ *
+ * The rules of a client are kept in four chains, one per direction and
+ * address family, so a packet is only compared against the rules that
+ * can apply to it.  An --acl rule without an address goes into the
+ * chains of both families.  Addresses and netmasks are stored as
+ * 32-bit words, so a rule matches with a few compares, and the first
+ * matching rule decides.  A packet that matches no rule is handled as
+ * --acl-default says.
+ *
+ * Ports are compared for TCP and UDP only.  A rule with ports never
+ * matches a fragment that does not carry the transport header.  IPv6
+ * extension headers are skipped to find the transport protocol.
+ */
+
+#include "buffer.h"
+
+#define ACL_IN  0               /**< packets the client sends */
+#define ACL_OUT 1               /**< packets sent to the client */
+
+#define ACL_PROTO_ANY (-1)
+
+struct acl_rule
+{
+    bool allow;
+    int proto;                  /* ACL_PROTO_ANY or the IP protocol */
+    uint16_t port_lo;
+    uint16_t port_hi;
+    uint32_t net[4];            /* network byte order, IPv4 uses net[0] */
+    uint32_t mask[4];
+    const char *text;           /* the rule as configured, for logging */
+};
+
+struct acl_chain
+{
+    int n;
+    int capacity;
+    struct acl_rule *rules;
+};
+
+struct acl_list
+{
+    bool deny;                  /**< --acl-default deny */
+    struct acl_chain chains[4]; /**< see ACL_CHAIN() */
+};
+
+/* chains[] index for a direction and an address family */
+#define ACL_CHAIN(dir, ipv6) ((dir) * 2 + (ipv6))
+
+struct acl_list *acl_list_new(struct gc_arena *gc);
+
+/**
+ * Copy a list, so that rules can be added to the copy without
+ * changing the original.
+ */
+struct acl_list *acl_list_clone(const struct acl_list *src, struct gc_arena *gc);
+
+/**
+ * Parse the arguments of an --acl option and append the rule.
+ *
+ * @param acl       list to append to
+ * @param p         arguments following "acl", NULL terminated
+ * @param msglevel  message level for parse errors
+ * @param gc        arena of the list
+ *
+ * @return          false if the arguments could not be parsed
+ */
+bool acl_list_add(struct acl_list *acl, const char **p, int msglevel,
+                  struct gc_arena *gc);
+
+/**
+ * Append an already parsed rule to one chain, for rebuilding a list
+ * rule by rule.  The rule's text must be allocated in \c gc or live
+ * at least as long.
+ */
+void acl_list_append(struct acl_list *acl, int chain, const struct acl_rule *rule,
+                     struct gc_arena *gc);
+
+void acl_list_print(const struct acl_list *acl, int msglevel);
+
+/**
+ * Check whether the list lets an IP packet pass.
+ *
+ * @param acl       list of the client
+ * @param dir       ACL_IN for packets from the client, ACL_OUT for
+ *                  packets to it
+ * @param buf       the packet, starting with the IP header
+ *
+ * @return          true if the packet may pass
+ */
+bool acl_permits(const struct acl_list *acl, int dir, const struct buffer *buf);
+
+#endif /* ACL_H */
@@ -293,9 +293,58 @@ check_hmac_token(hmac_ctx_t *ctx, const uint8_t *b64decoded, const char *usernam
     return memcmp_constant_time(&hmac_output, hmac, 32) == 0;
 }
 
-unsigned int
-verify_auth_token(struct user_pass *up, struct tls_multi *multi,
-                  struct tls_session *session)
+/*
+ * Returns the HMAC result of a previous verify_auth_token() call for the
+ * same token and username, or 0 if there is none.
+ */
+static unsigned int
+cached_hmac_token(const struct tls_multi *multi, const struct user_pass *up)
+{
+    const char *cached = multi->auth_token_verified;
+    size_t token_len = strlen(up->password);
+
+    if (!cached || strlen(cached) != token_len
+        || memcmp_constant_time(cached, up->password, token_len)
+        || strcmp(cached + token_len + 1, up->username))
+    {
+        return 0;
+    }
+    return multi->auth_token_verified_flags;
+}
+
+static void
+free_cached_hmac_token(struct tls_multi *multi)
+{
+    char *cached = multi->auth_token_verified;
+
+    if (cached)
+    {
+        size_t token_len = strlen(cached);
+        secure_memzero(cached, token_len + strlen(cached + token_len + 1) + 2);
+        free(cached);
+    }
+    multi->auth_token_verified = NULL;
+    multi->auth_token_verified_flags = 0;
+}
+
+static void
+cache_hmac_token(struct tls_multi *multi, const char *token,
+                 const char *username, unsigned int flags)
+{
+    size_t token_len = strlen(token);
+    size_t len = token_len + strlen(username) + 2;
+
+    free_cached_hmac_token(multi);
+    multi->auth_token_verified = malloc(len);
+    check_malloc_return(multi->auth_token_verified);
+    memcpy(multi->auth_token_verified, token, token_len + 1);
+    strcpy(multi->auth_token_verified + token_len + 1, username);
+    multi->auth_token_verified_flags = flags;
+}
+
+static unsigned int
+check_auth_token(struct user_pass *up, struct tls_multi *multi,
+                 struct tls_session *session, bool use_cache)
 {
     /*
      * Base64 is <= input and input is < USER_PASS_LEN, so using USER_PASS_LEN
@@ -332,22 +381,34 @@ verify_auth_token(struct user_pass *up, struct tls_multi *multi,
     timestamp_initial = ntohll(timestamp_initial);
 
     hmac_ctx_t *ctx = multi->opt.auth_token_key.hmac;
-    if (check_hmac_token(ctx, b64decoded, up->username))
+    if (use_cache)
     {
-        ret |= AUTH_TOKEN_HMAC_OK;
+        ret = cached_hmac_token(multi, up);
     }
-    else if (check_hmac_token(ctx, b64decoded, ""))
+    if (!ret)
     {
-        ret |= AUTH_TOKEN_HMAC_OK;
-        ret |= AUTH_TOKEN_VALID_EMPTYUSER;
-        /* overwrite the username of the client with the empty one */
-        strcpy(up->username, "");
+        if (check_hmac_token(ctx, b64decoded, up->username))
+        {
+            ret |= AUTH_TOKEN_HMAC_OK;
+        }
+        else if (check_hmac_token(ctx, b64decoded, ""))
+        {
+            ret |= AUTH_TOKEN_HMAC_OK;
+            ret |= AUTH_TOKEN_VALID_EMPTYUSER;
+        }
+        else
+        {
+            msg(M_WARN, "--auth-gen-token: HMAC on token from client failed (%s)",
+                up->username);
+            return 0;
+        }
+        cache_hmac_token(multi, up->password, up->username, ret);
     }
-    else
+
+    if (ret & AUTH_TOKEN_VALID_EMPTYUSER)
     {
-        msg(M_WARN, "--auth-gen-token: HMAC on token from client failed (%s)",
-            up->username);
-        return 0;
+        /* overwrite the username of the client with the empty one */
+        strcpy(up->username, "");
     }
 
     /* Accept session tokens only if their timestamp is in the acceptable range
@@ -399,6 +460,20 @@ verify_auth_token(struct user_pass *up, struct tls_multi *multi,
     return ret;
 }
 
+unsigned int
+verify_auth_token(struct user_pass *up, struct tls_multi *multi,
+                  struct tls_session *session)
+{
+    return check_auth_token(up, multi, session, false);
+}
+
+unsigned int
+verify_auth_token_cached(struct user_pass *up, struct tls_multi *multi,
+                         struct tls_session *session)
+{
+    return check_auth_token(up, multi, session, true);
+}
+
 void
 wipe_auth_token(struct tls_multi *multi)
 {
@@ -415,6 +490,7 @@ wipe_auth_token(struct tls_multi *multi)
                            strlen(multi->auth_token_initial));
             free(multi->auth_token_initial);
         }
+        free_cached_hmac_token(multi);
         multi->auth_token = NULL;
         multi->auth_token_initial = NULL;
     }
@@ -71,6 +71,17 @@ unsigned
 verify_auth_token(struct user_pass *up, struct tls_multi *multi,
                   struct tls_session *session);
 
+/**
+ * Like verify_auth_token(), but does not compute the HMAC again if the
+ * token and username are the same as in the last successful call for
+ * this multi, as they are on every renegotiation.  The timestamps and
+ * the session id are still checked.  The auth-token key of a tls_multi
+ * does not change during its lifetime, so the earlier result holds.
+ */
+unsigned
+verify_auth_token_cached(struct user_pass *up, struct tls_multi *multi,
+                         struct tls_session *session);
+
 
 
 /**
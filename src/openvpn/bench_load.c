@@ -0,0 +1,309 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "bench_load.h"
+#include "forward.h"
+#include "init.h"
+#include "proto.h"
+#include "ssl_pkt.h"
+
+#include "memdbg.h"
+
+#define BENCH_LOAD_PORT 9       /* UDP discard */
+
+struct bench_load_session
+{
+    struct crypto_options co;   /**< send key and packet ids only */
+    socket_descriptor_t sd;
+    struct openvpn_sockaddr remote;
+    uint32_t op_peer_id;        /**< DATA_V2 header, network order */
+    in_addr_t local;            /**< VPN address, network order */
+};
+
+static double
+bench_load_now(void)
+{
+    struct timeval tv;
+    openvpn_gettimeofday(&tv, NULL);
+    return (double) tv.tv_sec + (double) tv.tv_usec / 1000000;
+}
+
+static uint16_t
+bench_load_ip_checksum(const struct openvpn_iphdr *ip)
+{
+    const uint16_t *p = (const uint16_t *) ip;
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < sizeof(*ip) / 2; ++i)
+    {
+        sum += p[i];
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t) ~sum;
+}
+
+/*
+ * Run the event loop of a new session of c until the initialization
+ * sequence has completed, return false if it was ended by a signal.
+ */
+static bool
+bench_load_connect(struct context *c)
+{
+    context_clear_2(c);
+    c->mode = CM_P2P;
+
+    init_instance_handle_signals(c, c->es, CC_HARD_USR1_TO_HUP);
+
+    while (!IS_SIG(c) && !c->c2.do_up_ran)
+    {
+        pre_select(c);
+        if (IS_SIG(c))
+        {
+            break;
+        }
+        io_wait(c, p2p_iow_flags(c));
+        if (IS_SIG(c))
+        {
+            break;
+        }
+        if (c->c2.event_set_status != ES_TIMEOUT)
+        {
+            process_io(c);
+        }
+    }
+    return !IS_SIG(c);
+}
+
+/*
+ * Take what is needed to send data packets of the connected session of c
+ * into s, so that closing the session leaves it alone.
+ */
+static void
+bench_load_take(struct context *c, struct bench_load_session *s)
+{
+    struct tls_multi *multi = c->c2.tls_multi;
+    struct key_state *ks = &multi->session[TM_ACTIVE].key[KS_PRIMARY];
+    struct crypto_options *co = &ks->crypto_options;
+    bool ok = false;
+
+    if (!multi->use_peer_id)
+    {
+        msg(M_FATAL, "--bench-load: the server did not push a peer-id");
+    }
+    bool framing = c->c2.fec != NULL;
+#ifdef USE_COMP
+    framing |= c->c2.comp_context != NULL;
+#endif
+#ifdef ENABLE_FRAGMENT
+    framing |= c->c2.fragment != NULL;
+#endif
+    if (framing)
+    {
+        msg(M_FATAL, "--bench-load: compression, --fragment and --fec are "
+            "not supported");
+    }
+    s->local = htonl(getaddr(GETADDR_HOST_ORDER, c->options.ifconfig_local,
+                             0, &ok, NULL));
+    if (!ok)
+    {
+        msg(M_FATAL, "--bench-load: the server did not push an IPv4 address");
+    }
+
+    s->co.key_ctx_bi.encrypt = co->key_ctx_bi.encrypt;
+    s->co.key_ctx_bi.initialized = true;
+    s->co.packet_id.send = co->packet_id.send;
+    s->co.flags = co->flags;
+    s->co.epoch_key_type = co->epoch_key_type;
+    s->co.epoch_key_send = co->epoch_key_send;
+    CLEAR(co->key_ctx_bi.encrypt);
+
+    /* as tls_prepend_opcode_v2() */
+    s->op_peer_id = htonl(((P_DATA_V2 << P_OPCODE_SHIFT) | ks->key_id) << 24
+                          | (multi->peer_id & 0xFFFFFF));
+
+    s->remote = c->c2.link_socket_info->lsa->actual.dest;
+    s->sd = c->c2.link_socket->sd;
+    c->c2.link_socket->sd = SOCKET_UNDEFINED;
+}
+
+static void
+bench_load_send(struct context *c, struct bench_load_session *sessions,
+                int n, int headroom, struct gc_arena *gc)
+{
+    const struct options *o = &c->options;
+    struct buffer zero = alloc_buf_gc(o->ce.tun_mtu, gc);
+    struct buffer src = alloc_buf_gc(o->ce.tun_mtu + headroom, gc);
+    struct buffer work = alloc_buf_gc(o->ce.tun_mtu + 2 * headroom, gc);
+    uint64_t packets = 0, bytes = 0, failed = 0;
+
+    memset(BPTR(&zero), 0, zero.capacity);
+
+    for (int i = 0; i < o->bench_n_sizes; ++i)
+    {
+        const int size = o->bench_sizes[i];
+        if (size < (int) (sizeof(struct openvpn_iphdr) + sizeof(struct openvpn_udphdr))
+            || size > o->ce.tun_mtu)
+        {
+            msg(M_FATAL, "--bench-load: packet size %d is not between %d and "
+                "the tun MTU of %d", size,
+                (int) (sizeof(struct openvpn_iphdr) + sizeof(struct openvpn_udphdr)),
+                o->ce.tun_mtu);
+        }
+    }
+
+    msg(M_INFO, "BENCH-LOAD: sending from %d sessions for %d seconds",
+        n, o->bench_seconds);
+
+    const double start = bench_load_now();
+    double stop = start;
+
+    while (!IS_SIG(c) && stop < start + o->bench_seconds)
+    {
+        for (int i = 0; i < n; ++i)
+        {
+            struct bench_load_session *s = &sessions[i];
+            const int size = o->bench_sizes[packets % o->bench_n_sizes];
+            struct openvpn_iphdr ip;
+            struct openvpn_udphdr udp;
+
+            CLEAR(ip);
+            ip.version_len = 0x45;
+            ip.tot_len = htons((uint16_t) size);
+            ip.ttl = 64;
+            ip.protocol = OPENVPN_IPPROTO_UDP;
+            ip.saddr = s->local;
+            ip.daddr = sessions[(i + 1) % n].local;
+            ip.check = bench_load_ip_checksum(&ip);
+
+            CLEAR(udp);
+            udp.source = htons(BENCH_LOAD_PORT);
+            udp.dest = htons(BENCH_LOAD_PORT);
+            udp.len = htons((uint16_t) (size - sizeof(ip)));
+
+            struct buffer buf = src;
+            ASSERT(buf_init(&buf, headroom));
+            ASSERT(buf_write(&buf, &ip, sizeof(ip)));
+            ASSERT(buf_write(&buf, &udp, sizeof(udp)));
+            ASSERT(buf_write(&buf, BPTR(&zero), size - (int) (sizeof(ip) + sizeof(udp))));
+
+            struct buffer w = work;
+            ASSERT(buf_init(&w, headroom));
+            ASSERT(buf_write_prepend(&w, &s->op_peer_id, sizeof(s->op_peer_id)));
+            openvpn_encrypt(&buf, w, &s->co);
+
+            if (sendto(s->sd, BPTR(&buf), BLEN(&buf), 0, &s->remote.addr.sa,
+                       (socklen_t) af_addr_size(s->remote.addr.sa.sa_family)) < 0)
+            {
+                ++failed;
+            }
+            else
+            {
+                ++packets;
+                bytes += size;
+            }
+        }
+
+        /* don't let the clock source dominate with few sessions */
+        if (n >= 256 || (packets + failed) % 256 < (uint64_t) n)
+        {
+            stop = bench_load_now();
+        }
+    }
+    stop = bench_load_now();
+
+    const double elapsed = stop - start;
+    msg(M_INFO, "BENCH-LOAD: %d sessions, %.0f packets/s, %.3f Gbit/s of "
+        "payload, %" PRIu64 " packets not sent",
+        n, (double) packets / elapsed, (double) bytes * 8 / elapsed / 1000000000,
+        failed);
+}
+
+void
+tunnel_bench_load(struct context *c)
+{
+    const int n = c->options.bench_load_clients;
+    struct bench_load_session *sessions;
+    struct gc_arena gc = gc_new();
+    int headroom = 0;
+    int i;
+
+    ALLOC_ARRAY_CLEAR(sessions, struct bench_load_session, n);
+
+    msg(M_INFO, "Entering " PACKAGE_NAME " data channel load generator mode, "
+        "%d sessions.", n);
+
+    const double start = bench_load_now();
+    for (i = 0; i < n; ++i)
+    {
+        if (!bench_load_connect(c))
+        {
+            msg(M_WARN, "BENCH-LOAD: session %d did not come up", i + 1);
+            break;
+        }
+        bench_load_take(c, &sessions[i]);
+        headroom = c->c2.frame.buf.headroom;
+        uninit_management_callback();
+        close_instance(c);
+
+        if ((i + 1) % 1000 == 0)
+        {
+            msg(M_INFO, "BENCH-LOAD: %d sessions up", i + 1);
+        }
+    }
+
+    if (i == n)
+    {
+        const double elapsed = bench_load_now() - start;
+        msg(M_INFO, "BENCH-LOAD: %d sessions up in %.1f seconds, %.1f/s",
+            n, elapsed, (double) n / elapsed);
+        bench_load_send(c, sessions, n, headroom, &gc);
+    }
+    else
+    {
+        uninit_management_callback();
+        close_instance(c);
+        /* a restart would start all over */
+        if (c->sig->signal_received == SIGUSR1
+            || c->sig->signal_received == SIGHUP)
+        {
+            register_signal(c->sig, SIGTERM, "bench-load-failed");
+        }
+    }
+
+    for (int j = 0; j < i; ++j)
+    {
+        free_key_ctx(&sessions[j].co.key_ctx_bi.encrypt);
+        openvpn_close_socket(sessions[j].sd);
+    }
+    free(sessions);
+    gc_free(&gc);
+}
@@ -0,0 +1,54 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BENCH_LOAD_H
+#define BENCH_LOAD_H
+
+/**
+ * @file
+ * Data channel load generator for servers, for --bench-load.
+ *
+ * The client connects --bench-load times to the server, with one full
+ * handshake and PUSH_REPLY each, like a restart would do.  Once a
+ * session is up, the send half of its data channel key, its peer-id and
+ * its socket are kept and the rest of the session is closed without
+ * telling the server.
+ *
+ * Then DATA_V2 packets of the sessions, encrypted by openvpn_encrypt(),
+ * are sent in turn as fast as possible, each from the source port of its
+ * session.  The payload is an IPv4/UDP packet from the VPN address of
+ * the session to the one of the next session, so the server has to look
+ * up the instance of every packet, check its source address and route
+ * it, to another instance with --client-to-client or to its tun device
+ * otherwise.
+ */
+
+#include "openvpn.h"
+
+/**
+ * Run the load generator of \c c->options.bench_load_clients sessions,
+ * in place of tunnel_point_to_point().
+ */
+void tunnel_bench_load(struct context *c);
+
+#endif /* BENCH_LOAD_H */
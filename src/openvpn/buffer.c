@@ -186,6 +186,272 @@ free_buf(struct buffer *buf)
     CLEAR(*buf);
 }
 
+static bool huge_chunks_enabled;         /* GLOBAL */
+static int huge_chunks_mapped;          /* GLOBAL */
+static int huge_chunks_hugetlb;         /* GLOBAL */
+
+/* chunk header and carved objects are aligned to cache lines */
+#define HUGE_CHUNK_ALIGN 64
+
+void
+huge_chunks_enable(bool enable)
+{
+    huge_chunks_enabled = enable;
+}
+
+void
+huge_chunks_stats(int *mapped, int *hugetlb)
+{
+    *mapped = huge_chunks_mapped;
+    *hugetlb = huge_chunks_hugetlb;
+}
+
+static void *
+huge_chunk_map(void)
+{
+    void *chunk;
+
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+#ifdef MAP_HUGETLB
+    chunk = mmap(NULL, HUGE_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (chunk != MAP_FAILED)
+    {
+        ++huge_chunks_hugetlb;
+        ++huge_chunks_mapped;
+        return chunk;
+    }
+#endif
+    chunk = mmap(NULL, HUGE_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (chunk == MAP_FAILED)
+    {
+        msg(M_FATAL | M_ERRNO, "Out of memory mapping a %d byte chunk",
+            HUGE_CHUNK_SIZE);
+    }
+#ifdef MADV_HUGEPAGE
+    /* a failure only means that the kernel has no THP support */
+    madvise(chunk, HUGE_CHUNK_SIZE, MADV_HUGEPAGE);
+#endif
+#else  /* if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS) */
+    check_malloc_return(chunk = calloc(1, HUGE_CHUNK_SIZE));
+#endif
+    ++huge_chunks_mapped;
+    return chunk;
+}
+
+static void
+huge_chunk_unmap(void *chunk)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+    munmap(chunk, HUGE_CHUNK_SIZE);
+#else
+    free(chunk);
+#endif
+    --huge_chunks_mapped;
+}
+
+static void *
+huge_chunks_alloc(struct huge_chunks *hc, size_t size)
+{
+    size = (size + HUGE_CHUNK_ALIGN - 1) & ~((size_t) HUGE_CHUNK_ALIGN - 1);
+    if (hc->left < size)
+    {
+        uint8_t *chunk = huge_chunk_map();
+        *(void **) chunk = hc->list;
+        hc->list = chunk;
+        hc->next = chunk + HUGE_CHUNK_ALIGN;
+        hc->left = HUGE_CHUNK_SIZE - HUGE_CHUNK_ALIGN;
+    }
+    void *ret = hc->next;
+    hc->next += size;
+    hc->left -= size;
+    ++hc->n_carved;
+    return ret;
+}
+
+static void
+huge_chunks_free(struct huge_chunks *hc)
+{
+    while (hc->list)
+    {
+        void *next = *(void **) hc->list;
+        huge_chunk_unmap(hc->list);
+        hc->list = next;
+    }
+    CLEAR(*hc);
+}
+
+/* huge pages only pay off for objects that fill a chunk many times */
+static bool
+huge_chunks_worthwhile(size_t size)
+{
+    return huge_chunks_enabled && size <= HUGE_CHUNK_SIZE / 16;
+}
+
+struct buffer_pool *
+buffer_pool_new(size_t size)
+{
+    struct buffer_pool *pool;
+
+    if (!buf_size_valid(size) || size < sizeof(void *))
+    {
+        buf_size_error(size);
+    }
+    ALLOC_OBJ_CLEAR(pool, struct buffer_pool);
+    pool->size = size;
+    return pool;
+}
+
+void
+buffer_pool_free(struct buffer_pool *pool)
+{
+    if (pool)
+    {
+        ASSERT(!pool->n_out);
+        if (pool->huge)
+        {
+            huge_chunks_free(&pool->chunks);
+            pool->free_list = NULL;
+        }
+        while (pool->free_list)
+        {
+            void *next = *(void **) pool->free_list;
+            free(pool->free_list);
+            pool->free_list = next;
+        }
+        free(pool);
+    }
+}
+
+void
+buffer_pool_use_huge_pages(struct buffer_pool *pool)
+{
+    ASSERT(!pool->n_out && !pool->n_free);
+    pool->huge = huge_chunks_worthwhile(pool->size);
+}
+
+struct buffer
+buffer_pool_get(struct buffer_pool *pool)
+{
+    struct buffer buf;
+
+    if (pool->free_list)
+    {
+        CLEAR(buf);
+        buf.capacity = (int) pool->size;
+        buf.data = pool->free_list;
+        pool->free_list = *(void **) buf.data;
+        --pool->n_free;
+    }
+    else if (pool->huge)
+    {
+        CLEAR(buf);
+        buf.capacity = (int) pool->size;
+        buf.data = huge_chunks_alloc(&pool->chunks, pool->size);
+    }
+    else
+    {
+        buf = alloc_buf(pool->size);
+    }
+    ++pool->n_out;
+    return buf;
+}
+
+void
+buffer_pool_put(struct buffer_pool *pool, struct buffer *buf)
+{
+    if (buf->data)
+    {
+        ASSERT(buf->capacity == (int) pool->size && pool->n_out > 0);
+        *(void **) buf->data = pool->free_list;
+        pool->free_list = buf->data;
+        --pool->n_out;
+        ++pool->n_free;
+        CLEAR(*buf);
+    }
+}
+
+void
+object_cache_set_limit(struct object_cache *oc, int limit)
+{
+    ASSERT(oc->size >= sizeof(void *) && limit >= 0);
+    oc->limit = limit;
+    if (oc->huge)
+    {
+        /* carved objects can only be given back all together */
+        if (limit == 0 && oc->n_free == oc->chunks.n_carved)
+        {
+            huge_chunks_free(&oc->chunks);
+            oc->free_list = NULL;
+            oc->n_free = 0;
+            oc->huge = false;
+        }
+        return;
+    }
+    while (oc->n_free > limit)
+    {
+        void *next = *(void **) oc->free_list;
+        free(oc->free_list);
+        oc->free_list = next;
+        --oc->n_free;
+    }
+}
+
+void *
+object_cache_alloc(struct object_cache *oc)
+{
+    void *obj;
+
+    if (oc->free_list)
+    {
+        obj = oc->free_list;
+        oc->free_list = *(void **) obj;
+        --oc->n_free;
+        ++oc->n_reused;
+        memset(obj, 0, oc->size);
+    }
+    else if (oc->huge)
+    {
+        obj = huge_chunks_alloc(&oc->chunks, oc->size);
+    }
+    else
+    {
+        check_malloc_return(obj = calloc(1, oc->size));
+    }
+    return obj;
+}
+
+void
+object_cache_use_huge_pages(struct object_cache *oc)
+{
+    /* still carved from the last run if not all objects came back */
+    if (!oc->huge)
+    {
+        ASSERT(!oc->n_free);
+        oc->huge = huge_chunks_worthwhile(oc->size);
+    }
+}
+
+void
+object_cache_free(struct object_cache *oc, void *obj)
+{
+    if (obj && (oc->huge || oc->n_free < oc->limit))
+    {
+        *(void **) obj = oc->free_list;
+        oc->free_list = obj;
+        ++oc->n_free;
+    }
+    else
+    {
+        free(obj);
+    }
+}
+
+/*
+ * Free a buffer from alloc_buf_gc() before the arena.  Buffers small
+ * enough to live in a chunk are only released by gc_free().
+ */
 static void
 free_buf_gc(struct buffer *buf, struct gc_arena *gc)
 {
@@ -373,6 +639,59 @@ cleanup:
  * Garbage collection
  */
 
+/* Memory checkers need every allocation in a block of its own */
+#if !defined(DMALLOC) && !defined(USE_VALGRIND) && !defined(__SANITIZE_ADDRESS__)
+#define GC_CHUNKED
+#endif
+
+#define GC_CHUNK_SIZE   4096    /* bytes per chunk including the header */
+#define GC_CHUNK_HDR    16      /* header, rounded to the alignment */
+#define GC_ALIGN        16      /* alignment of small allocations */
+#define GC_SMALL_MAX    512     /* largest allocation taken from a chunk */
+#define GC_CHUNK_CACHE  64      /* freed chunks kept for reuse */
+
+/*
+ * The cache of freed chunks is kept per thread, so that gc arenas stay
+ * as safe to use from another thread as malloc() and free() are.
+ */
+#ifdef _MSC_VER
+#define GC_THREAD_LOCAL __declspec(thread)
+#else
+#define GC_THREAD_LOCAL __thread
+#endif
+
+static GC_THREAD_LOCAL struct gc_entry *gc_chunk_cache;
+static GC_THREAD_LOCAL int gc_chunk_cache_n;
+
+#ifdef GC_CHUNKED
+static void *
+gc_malloc_chunked(size_t size, struct gc_arena *a)
+{
+    size = (size + GC_ALIGN - 1) & ~((size_t) GC_ALIGN - 1);
+    if (!a->chunks || a->chunk_used + size > GC_CHUNK_SIZE)
+    {
+        struct gc_entry *c = gc_chunk_cache;
+        if (c)
+        {
+            gc_chunk_cache = c->next;
+            --gc_chunk_cache_n;
+        }
+        else
+        {
+            c = (struct gc_entry *) malloc(GC_CHUNK_SIZE);
+            check_malloc_return(c);
+        }
+        c->next = a->chunks;
+        a->chunks = c;
+        a->chunk_used = GC_CHUNK_HDR;
+    }
+
+    void *ret = (uint8_t *) a->chunks + a->chunk_used;
+    a->chunk_used += size;
+    return ret;
+}
+#endif
+
 void *
 #ifdef DMALLOC
 gc_malloc_debug(size_t size, bool clear, struct gc_arena *a, const char *file, int line)
@@ -381,6 +700,13 @@ gc_malloc(size_t size, bool clear, struct gc_arena *a)
 #endif
 {
     void *ret;
+#ifdef GC_CHUNKED
+    if (a && size <= GC_SMALL_MAX)
+    {
+        ret = gc_malloc_chunked(size, a);
+    }
+    else
+#endif
     if (a)
     {
         struct gc_entry *e;
@@ -456,6 +782,26 @@ x_gc_free(struct gc_arena *a)
         free(e);
         e = next;
     }
+
+    e = a->chunks;
+    a->chunks = NULL;
+    a->chunk_used = 0;
+
+    while (e != NULL)
+    {
+        struct gc_entry *next = e->next;
+        if (gc_chunk_cache_n < GC_CHUNK_CACHE)
+        {
+            e->next = gc_chunk_cache;
+            gc_chunk_cache = e;
+            ++gc_chunk_cache_n;
+        }
+        else
+        {
+            free(e);
+        }
+        e = next;
+    }
 }
 
 /*
@@ -516,6 +862,25 @@ gc_transfer(struct gc_arena *dest, struct gc_arena *src)
             dest->list = src->list;
             src->list = NULL;
         }
+
+        /* keep filling the first chunk of dest */
+        e = src->chunks;
+        if (e && dest->chunks)
+        {
+            while (e->next != NULL)
+            {
+                e = e->next;
+            }
+            e->next = dest->chunks->next;
+            dest->chunks->next = src->chunks;
+        }
+        else if (e)
+        {
+            dest->chunks = e;
+            dest->chunk_used = src->chunk_used;
+        }
+        src->chunks = NULL;
+        src->chunk_used = 0;
     }
 }
 
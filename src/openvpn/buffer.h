@@ -78,9 +78,10 @@ struct buffer
 /**
  * Garbage collection entry for one dynamically allocated block of memory.
  *
- * This structure represents one link in the linked list contained in a \c
- * gc_arena structure.  Each time the \c gc_malloc() function is called,
- * it allocates \c sizeof(gc_entry) + the requested number of bytes.  The
+ * This structure represents one link in the linked lists contained in a
+ * \c gc_arena structure.  A block is either a chunk that small \c
+ * gc_malloc() allocations are carved from, or holds a single larger
+ * allocation of \c sizeof(gc_entry) + the requested number of bytes.  The
  * \c gc_entry is then stored as a header in front of the memory address
  * returned to the caller.
  */
@@ -107,17 +108,24 @@ struct gc_entry_special
  * Garbage collection arena used to keep track of dynamically allocated
  * memory.
  *
- * This structure contains a linked list of \c gc_entry structures.  When
+ * This structure contains linked lists of \c gc_entry structures.  When
  * a block of memory is allocated using the \c gc_malloc() function, the
  * allocation is registered in the function's \c gc_arena argument.  All
  * the dynamically allocated memory registered in a \c gc_arena can be
  * freed using the \c gc_free() function.
+ *
+ * Small allocations are bumped from fixed-size chunks, and freed chunks
+ * are kept for reuse, so the short-lived arenas of the packet path do
+ * not call \c malloc() once warm.
  */
 struct gc_arena
 {
     struct gc_entry *list;      /**< First element of the linked list of
                                  *   \c gc_entry structures. */
     struct gc_entry_special *list_special;
+    struct gc_entry *chunks;    /**< Chunks of small allocations, the
+                                 *   first one is being filled. */
+    size_t chunk_used;          /**< Bytes used of the first chunk. */
 };
 
 
@@ -133,6 +141,13 @@ void buf_clear(struct buffer *buf);
 
 void free_buf(struct buffer *buf);
 
+/** Bytes of heap memory held by \c buf, for memory accounting. */
+static inline size_t
+buf_mem_usage(const struct buffer *buf)
+{
+    return buf->data ? (size_t) buf->capacity : 0;
+}
+
 bool buf_assign(struct buffer *dest, const struct buffer *src);
 
 void string_clear(char *str);
@@ -187,6 +202,132 @@ struct buffer string_alloc_buf(const char *str, struct gc_arena *gc);
 
 void gc_addspecial(void *addr, void (*free_function)(void *), struct gc_arena *a);
 
+/** Size of the chunks handed out by \c huge_chunks_alloc(), one huge page */
+#define HUGE_CHUNK_SIZE (2 * 1024 * 1024)
+
+/**
+ * Memory that a pool or cache carves its objects from when it uses huge
+ * pages.  The chunks are mapped with \c MAP_HUGETLB if the system has
+ * huge pages reserved, and are otherwise advised to become transparent
+ * huge pages.  Carved objects are never returned to the system one by
+ * one, only all chunks together.
+ */
+struct huge_chunks
+{
+    void *list;                 /**< Mapped chunks, each starts with a
+                                 *   pointer to the next. */
+    uint8_t *next;              /**< Unused space of the newest chunk. */
+    size_t left;                /**< Bytes left at \c next. */
+    int n_carved;               /**< Objects carved out of the chunks. */
+};
+
+/**
+ * Turn on huge page backing for the pools and caches that are set up
+ * from now on with \c buffer_pool_use_huge_pages() and
+ * \c object_cache_use_huge_pages().
+ */
+void huge_chunks_enable(bool enable);
+
+/**
+ * Report the chunks mapped by all pools and caches, and how many of them
+ * are backed by \c MAP_HUGETLB pages.
+ */
+void huge_chunks_stats(int *mapped, int *hugetlb);
+
+/**
+ * A pool of packet buffers that all have the same capacity.
+ *
+ * Buffers that are given back with \c buffer_pool_put() are kept on a
+ * free list, linked through their own storage, and handed out again by
+ * \c buffer_pool_get().  The pool never gives memory back to the
+ * system before \c buffer_pool_free(), so it holds as many buffers as
+ * were checked out at the same time.
+ */
+struct buffer_pool
+{
+    size_t size;                /**< Capacity of every buffer. */
+    int n_out;                  /**< Buffers currently checked out. */
+    int n_free;                 /**< Buffers on the free list. */
+    void *free_list;            /**< First free block, each free block
+                                 *   starts with a pointer to the next. */
+    bool huge;                  /**< Blocks come from \c chunks. */
+    struct huge_chunks chunks;
+};
+
+struct buffer_pool *buffer_pool_new(size_t size);
+
+/**
+ * Carve the buffers of an empty \c pool out of huge pages from now on,
+ * if \c huge_chunks_enable() was called.
+ */
+void buffer_pool_use_huge_pages(struct buffer_pool *pool);
+
+/**
+ * Free the pool and all buffers on its free list.  Every buffer that
+ * was checked out must have been given back.
+ */
+void buffer_pool_free(struct buffer_pool *pool);
+
+/**
+ * Check out an empty buffer with a capacity of \c pool->size.
+ */
+struct buffer buffer_pool_get(struct buffer_pool *pool);
+
+/**
+ * Give a buffer from \c buffer_pool_get() back to the pool and clear
+ * \c buf.
+ */
+void buffer_pool_put(struct buffer_pool *pool, struct buffer *buf);
+
+/**
+ * A cache of freed objects of one fixed size, used for structures that
+ * are created and destroyed at a high rate, such as one per connecting
+ * client.
+ *
+ * Up to \c limit freed objects are kept on a free list, linked through
+ * their own storage, and handed out again cleared by
+ * \c object_cache_alloc().  With a \c limit of 0 the cache behaves like
+ * plain \c calloc() and \c free().
+ */
+struct object_cache
+{
+    size_t size;                /**< Size of every object. */
+    int limit;                  /**< Most objects kept on the free list. */
+    int n_free;                 /**< Objects on the free list. */
+    uint64_t n_reused;          /**< Allocations served from the list. */
+    void *free_list;            /**< First free object, each free object
+                                 *   starts with a pointer to the next. */
+    bool huge;                  /**< Objects come from \c chunks and are
+                                 *   all kept, whatever the limit. */
+    struct huge_chunks chunks;
+};
+
+#define OBJECT_CACHE_INIT(type) { sizeof(type), 0, 0, 0, NULL }
+
+/**
+ * Set how many freed objects \c oc keeps, freeing any above the new
+ * limit.  A limit of 0 empties the cache.
+ */
+void object_cache_set_limit(struct object_cache *oc, int limit);
+
+/**
+ * Carve the objects of an empty \c oc out of huge pages from now on, if
+ * \c huge_chunks_enable() was called.  The memory then only goes back
+ * to the system when the limit is set to 0 with all objects freed.
+ */
+void object_cache_use_huge_pages(struct object_cache *oc);
+
+/**
+ * Return a zeroed object of \c oc->size bytes.
+ */
+void *object_cache_alloc(struct object_cache *oc);
+
+/**
+ * Give an object from \c object_cache_alloc() back to \c oc, or free it
+ * if the cache is full.
+ */
+void object_cache_free(struct object_cache *oc, void *obj);
+
 /**
  * allows to realloc a pointer previously allocated by gc_malloc or gc_realloc
  *
@@ -615,6 +756,39 @@ buf_inc_len(struct buffer *buf, int inc)
     return true;
 }
 
+/*
+ * Check once that there are headroom bytes in front of the data of a
+ * buffer and tailroom bytes behind it, for the unchecked functions
+ * below.  The data path uses them to build a packet whose layout is
+ * fixed by the negotiated format with a single check.
+ */
+static inline bool
+buf_reserve(const struct buffer *buf, int headroom, int tailroom)
+{
+    return buf_valid(buf) && headroom >= 0 && tailroom >= 0
+           && headroom <= buf->offset
+           && tailroom <= buf->capacity - buf->offset - buf->len;
+}
+
+/* Like buf_write_alloc(), for space checked with buf_reserve() */
+static inline uint8_t *
+buf_write_alloc_unchecked(struct buffer *buf, int size)
+{
+    uint8_t *ret = buf->data + buf->offset + buf->len;
+    buf->len += size;
+    return ret;
+}
+
+/* Like buf_read_alloc(), for a length checked with BLEN() */
+static inline uint8_t *
+buf_read_alloc_unchecked(struct buffer *buf, int size)
+{
+    uint8_t *ret = buf->data + buf->offset;
+    buf->offset += size;
+    buf->len -= size;
+    return ret;
+}
+
 /*
  * Make space to prepend to a buffer.
  * Return NULL if no space.
@@ -991,7 +1165,7 @@ void x_gc_freespecial(struct gc_arena *a);
 static inline bool
 gc_defined(struct gc_arena *a)
 {
-    return a->list != NULL;
+    return a->list != NULL || a->chunks != NULL;
 }
 
 static inline void
@@ -999,6 +1173,8 @@ gc_init(struct gc_arena *a)
 {
     a->list = NULL;
     a->list_special = NULL;
+    a->chunks = NULL;
+    a->chunk_used = 0;
 }
 
 static inline void
@@ -1018,7 +1194,7 @@ gc_new(void)
 static inline void
 gc_free(struct gc_arena *a)
 {
-    if (a->list)
+    if (a->list || a->chunks)
     {
         x_gc_free(a);
     }
@@ -0,0 +1,146 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "ccd_cache.h"
+#include "buffer.h"
+#include "crypto.h"
+#include "errlevel.h"
+#include "platform.h"
+
+#include "memdbg.h"
+
+static uint32_t
+ccd_cache_hash_function(const void *key, uint32_t iv)
+{
+    const char *path = key;
+    return hash_func((const uint8_t *) path, (uint32_t) strlen(path), iv);
+}
+
+static bool
+ccd_cache_compare_function(const void *key1, const void *key2)
+{
+    return !strcmp((const char *) key1, (const char *) key2);
+}
+
+struct ccd_cache *
+ccd_cache_new(interval_t max_age)
+{
+    struct ccd_cache *cc;
+
+    ALLOC_OBJ_CLEAR(cc, struct ccd_cache);
+    cc->hash = hash_init(256, get_random(), ccd_cache_hash_function,
+                         ccd_cache_compare_function);
+    cc->max_age = max_age;
+    return cc;
+}
+
+static void
+ccd_cache_entry_free(struct ccd_cache_entry *e)
+{
+    free(e->config);
+    free(e->path);
+    free(e);
+}
+
+void
+ccd_cache_free(struct ccd_cache *cc)
+{
+    if (!cc)
+    {
+        return;
+    }
+
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(cc->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        ccd_cache_entry_free(he->value);
+        hash_iterator_delete_element(&hi);
+    }
+    hash_iterator_free(&hi);
+    hash_free(cc->hash);
+    free(cc);
+}
+
+/* (re)load the file of e if it changed since it was last read */
+static void
+ccd_cache_refresh(struct ccd_cache_entry *e)
+{
+    platform_stat_t st;
+
+    e->checked = now;
+    if (platform_stat(e->path, &st) < 0)
+    {
+        free(e->config);
+        e->config = NULL;
+        return;
+    }
+
+    if (e->config && st.st_mtime == e->mtime && st.st_size == e->size)
+    {
+        return;
+    }
+
+    free(e->config);
+    e->config = NULL;
+    e->mtime = st.st_mtime;
+    e->size = st.st_size;
+
+    if (platform_test_file(e->path))
+    {
+        struct gc_arena gc = gc_new();
+        struct buffer buf = buffer_read_from_file(e->path, &gc);
+        /* an empty file is a valid CCD file */
+        e->config = string_alloc(buf.data ? BSTR(&buf) : "", NULL);
+        gc_free(&gc);
+    }
+    dmsg(D_MULTI_DEBUG, "CCD cache: %s %s", e->config ? "loaded" : "no file",
+         e->path);
+}
+
+const char *
+ccd_cache_get(struct ccd_cache *cc, const char *path)
+{
+    struct ccd_cache_entry *e = hash_lookup(cc->hash, path);
+
+    if (!e)
+    {
+        ALLOC_OBJ_CLEAR(e, struct ccd_cache_entry);
+        e->path = string_alloc(path, NULL);
+        ccd_cache_refresh(e);
+        hash_add(cc->hash, e->path, e, false);
+    }
+    else if (now >= e->checked + cc->max_age || now < e->checked)
+    {
+        ccd_cache_refresh(e);
+    }
+    return e->config;
+}
@@ -0,0 +1,74 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CCD_CACHE_H
+#define CCD_CACHE_H
+
+/**
+ * @file
+ * Cache of --client-config-dir files.
+ *
+ * Without the cache every connecting client causes the server to look
+ * up, open and read its CCD file (and the DEFAULT file if there is
+ * none), which turns a reconnect storm into a metadata storm when the
+ * directory lives on a network file system.  With --ccd-cache, the
+ * content of each file, or the fact that it does not exist, is kept in
+ * memory.  An entry is revalidated with a single stat() once it is
+ * older than the configured age and only read again if the
+ * modification time or the size changed.
+ */
+
+#include "basic.h"
+#include "list.h"
+#include "otime.h"
+
+struct ccd_cache_entry
+{
+    char *path;
+    char *config;       /* NULL if the file does not exist */
+    time_t checked;     /* last time the file was looked at */
+    time_t mtime;
+    off_t size;
+};
+
+struct ccd_cache
+{
+    struct hash *hash;
+    interval_t max_age;
+};
+
+/**
+ * Allocate a cache whose entries are revalidated after max_age seconds.
+ */
+struct ccd_cache *ccd_cache_new(interval_t max_age);
+
+void ccd_cache_free(struct ccd_cache *cc);
+
+/**
+ * Returns the content of the CCD file path, or NULL if it does not exist
+ * or cannot be read.  The returned string is owned by the cache and valid
+ * until the next call for the same path.
+ */
+const char *ccd_cache_get(struct ccd_cache *cc, const char *path);
+
+#endif /* CCD_CACHE_H */
@@ -48,6 +48,110 @@ add_entry(struct client_nat_option_list *dest,
     }
 }
 
+struct client_nat_compile_entry {
+    in_addr_t netmask;
+    struct client_nat_rule rule;
+};
+
+static int
+compile_entry_cmp(const void *a, const void *b)
+{
+    const struct client_nat_compile_entry *x = a;
+    const struct client_nat_compile_entry *y = b;
+
+    if (x->netmask != y->netmask)
+    {
+        return x->netmask < y->netmask ? -1 : 1;
+    }
+    if (x->rule.network != y->rule.network)
+    {
+        return x->rule.network < y->rule.network ? -1 : 1;
+    }
+    return x->rule.index - y->rule.index;
+}
+
+static int
+group_cmp(const void *a, const void *b)
+{
+    const struct client_nat_group *x = a;
+    const struct client_nat_group *y = b;
+    return x->min_index - y->min_index;
+}
+
+static void
+compile_table(struct client_nat_table *t,
+              const struct client_nat_option_list *list,
+              const int direction,
+              const int daddr)
+{
+    struct client_nat_compile_entry ce[MAX_CLIENT_NAT];
+    int n = 0;
+
+    for (int i = 0; i < list->n; ++i)
+    {
+        const struct client_nat_entry *e = &list->entries[i];
+        if ((e->type ^ direction) != daddr)
+        {
+            continue;
+        }
+
+        const in_addr_t from = direction ? e->foreign_network : e->network;
+        const in_addr_t to = direction ? e->network : e->foreign_network;
+
+        /* a network with host bits set never matches */
+        if (from & ~e->netmask)
+        {
+            continue;
+        }
+        ce[n].netmask = e->netmask;
+        ce[n].rule.network = from;
+        ce[n].rule.to = to;
+        ce[n].rule.index = i;
+        ++n;
+    }
+
+    qsort(ce, n, sizeof(ce[0]), compile_entry_cmp);
+
+    int n_rules = 0;
+    t->n_groups = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        struct client_nat_group *g = t->n_groups ? &t->groups[t->n_groups - 1] : NULL;
+        if (!g || g->netmask != ce[i].netmask)
+        {
+            g = &t->groups[t->n_groups++];
+            g->netmask = ce[i].netmask;
+            g->first = n_rules;
+            g->n = 0;
+            g->min_index = ce[i].rule.index;
+        }
+        else if (t->rules[n_rules - 1].network == ce[i].rule.network)
+        {
+            /* shadowed by an earlier entry for the same network */
+            continue;
+        }
+        t->rules[n_rules++] = ce[i].rule;
+        ++g->n;
+        g->min_index = min_int(g->min_index, ce[i].rule.index);
+    }
+
+    qsort(t->groups, t->n_groups, sizeof(t->groups[0]), group_cmp);
+}
+
+/*
+ * Build the lookup tables of client_nat_transform() from the entry
+ * list, whenever entries were added.
+ */
+static void
+client_nat_compile(struct client_nat_option_list *list)
+{
+    for (int direction = CN_OUTGOING; direction <= CN_INCOMING; ++direction)
+    {
+        compile_table(&list->tables[CN_TABLE(direction, 0)], list, direction, 0);
+        compile_table(&list->tables[CN_TABLE(direction, 1)], list, direction, 1);
+    }
+}
+
 void
 print_client_nat_list(const struct client_nat_option_list *list, int msglevel)
 {
@@ -100,6 +204,7 @@ copy_client_nat_option_list(struct client_nat_option_list *dest,
             break;
         }
     }
+    client_nat_compile(dest);
 }
 
 void
@@ -146,7 +251,10 @@ add_client_nat_to_option_list(struct client_nat_option_list *dest,
         return;
     }
 
-    add_entry(dest, &e);
+    if (add_entry(dest, &e))
+    {
+        client_nat_compile(dest);
+    }
 }
 
 #if 0
@@ -189,55 +297,83 @@ print_pkt(struct openvpn_iphdr *iph, const char *prefix, const int direction, co
     gc_free(&gc);
 }
 
+/*
+ * Return the first entry of the list that matches addr, the same
+ * one a linear scan over the entries in the order given would find.
+ */
+static const struct client_nat_rule *
+client_nat_lookup(const struct client_nat_table *t,
+                  const in_addr_t addr,
+                  in_addr_t *netmask)
+{
+    const struct client_nat_rule *best = NULL;
+
+    for (int i = 0; i < t->n_groups; ++i)
+    {
+        const struct client_nat_group *g = &t->groups[i];
+        if (best && best->index < g->min_index)
+        {
+            break;
+        }
+
+        const in_addr_t key = addr & g->netmask;
+        int lo = g->first;
+        int hi = g->first + g->n;
+        while (lo < hi)
+        {
+            const int mid = (lo + hi) / 2;
+            const struct client_nat_rule *r = &t->rules[mid];
+            if (r->network == key)
+            {
+                if (!best || r->index < best->index)
+                {
+                    best = r;
+                    *netmask = g->netmask;
+                }
+                break;
+            }
+            else if (r->network < key)
+            {
+                lo = mid + 1;
+            }
+            else
+            {
+                hi = mid;
+            }
+        }
+    }
+    return best;
+}
+
 void
 client_nat_transform(const struct client_nat_option_list *list,
                      struct buffer *ipbuf,
                      const int direction)
 {
     struct ip_tcp_udp_hdr *h = (struct ip_tcp_udp_hdr *) BPTR(ipbuf);
-    int i;
-    uint32_t addr, *addr_ptr;
-    const uint32_t *from, *to;
     int accumulate = 0;
-    unsigned int amask;
-    unsigned int alog = 0;
+    bool alog = false;
 
     if (check_debug_level(D_CLIENT_NAT))
     {
         print_pkt(&h->ip, "BEFORE", direction, D_CLIENT_NAT);
     }
 
-    for (i = 0; i < list->n; ++i)
+    for (int daddr = 0; daddr <= 1; ++daddr)
     {
-        const struct client_nat_entry *e = &list->entries[i]; /* current NAT rule */
-        if (e->type ^ direction)
-        {
-            addr = *(addr_ptr = &h->ip.daddr);
-            amask = 2;
-        }
-        else
-        {
-            addr = *(addr_ptr = &h->ip.saddr);
-            amask = 1;
-        }
-        if (direction)
-        {
-            from = &e->foreign_network;
-            to = &e->network;
-        }
-        else
-        {
-            from = &e->network;
-            to = &e->foreign_network;
-        }
+        uint32_t *addr_ptr = daddr ? &h->ip.daddr : &h->ip.saddr;
+        uint32_t addr = *addr_ptr;
+        in_addr_t netmask = 0;
+        const struct client_nat_rule *r =
+            client_nat_lookup(&list->tables[CN_TABLE(direction, daddr)], addr, &netmask);
 
-        if (((addr & e->netmask) == *from) && !(amask & alog))
+        if (r)
         {
             /* pre-adjust IP checksum */
             ADD_CHECKSUM_32(accumulate, addr);
 
             /* do NAT transform */
-            addr = (addr & ~e->netmask) | *to;
+            addr = (addr & ~netmask) | r->to;
 
             /* post-adjust IP checksum */
             SUB_CHECKSUM_32(accumulate, addr);
@@ -245,8 +381,7 @@ client_nat_transform(const struct client_nat_option_list *list,
             /* write the modified address to packet */
             *addr_ptr = addr;
 
-            /* mark as modified */
-            alog |= amask;
+            alog = true;
         }
     }
     if (alog)
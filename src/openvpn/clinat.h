@@ -40,9 +40,38 @@ struct client_nat_entry {
     in_addr_t foreign_network;
 };
 
+/*
+ * The entries compiled for one direction and one address of the
+ * packet.  Rules with the same netmask form a group, sorted by network
+ * for a binary search, and the groups are ordered by their first rule
+ * so the search can stop as soon as no earlier rule can match.
+ */
+struct client_nat_rule {
+    in_addr_t network;
+    in_addr_t to;
+    int index;              /* position in entries[], first match wins */
+};
+
+struct client_nat_group {
+    in_addr_t netmask;
+    int first;              /* first rule of the group in rules[] */
+    int n;
+    int min_index;          /* smallest index of the rules in the group */
+};
+
+struct client_nat_table {
+    int n_groups;
+    struct client_nat_group groups[MAX_CLIENT_NAT];
+    struct client_nat_rule rules[MAX_CLIENT_NAT];
+};
+
+/* tables[] index for a direction and the source or destination address */
+#define CN_TABLE(direction, daddr) ((direction) * 2 + (daddr))
+
 struct client_nat_option_list {
     int n;
     struct client_nat_entry entries[MAX_CLIENT_NAT];
+    struct client_nat_table tables[4]; /* compiled from entries[] */
 };
 
 struct client_nat_option_list *new_client_nat_list(struct gc_arena *gc);
@@ -29,6 +29,9 @@
 #include "syshead.h"
 
 #if defined(ENABLE_LZ4)
+#ifdef HAVE_LZ4_COMPRESS_FAST_EXTSTATE_FASTRESET
+#define LZ4_STATIC_LINKING_ONLY
+#endif
 #include <lz4.h>
 
 #include "comp.h"
@@ -53,6 +56,51 @@ lz4v2_compress_init(struct compress_context *compctx)
 static void
 lz4_compress_uninit(struct compress_context *compctx)
 {
+    free(compctx->wu.lz4.state);
+    compctx->wu.lz4.state = NULL;
+}
+
+/*
+ * Allocate the compression state on first use, so that peers which
+ * never compress do not pay for it.
+ */
+static void *
+lz4_compress_state(struct compress_context *compctx)
+{
+    if (!compctx->wu.lz4.state)
+    {
+        compctx->wu.lz4.state = malloc(LZ4_sizeofState());
+        check_malloc_return(compctx->wu.lz4.state);
+#ifdef HAVE_LZ4_COMPRESS_FAST_EXTSTATE_FASTRESET
+        LZ4_initStream(compctx->wu.lz4.state, LZ4_sizeofState());
+#endif
+    }
+    return compctx->wu.lz4.state;
+}
+
+/*
+ * Guess whether the payload is already compressed or encrypted, from the
+ * number of distinct byte values in a sample of its tail: random data
+ * uses about 100 of 128, text and protocol headers far fewer.
+ */
+static bool
+lz4_looks_incompressible(const struct buffer *buf)
+{
+    const int n = min_int(BLEN(buf), LZ4_ENTROPY_SAMPLE);
+    const uint8_t *p = BEND(buf) - n;
+    uint32_t seen[256 / 32] = { 0 };
+    int distinct = 0;
+
+    for (int i = 0; i < n; ++i)
+    {
+        const uint32_t bit = 1u << (p[i] & 31);
+        if (!(seen[p[i] >> 5] & bit))
+        {
+            seen[p[i] >> 5] |= bit;
+            ++distinct;
+        }
+    }
+    return distinct > n * 11 / 16;
 }
 
 static bool
@@ -81,7 +129,21 @@ do_lz4_compress(struct buffer *buf,
             return false;
         }
 
-        zlen = LZ4_compress_default((const char *)BPTR(buf), (char *)BPTR(work), BLEN(buf), zlen_max);
+        if (lz4_looks_incompressible(buf))
+        {
+            return false;
+        }
+
+        /* reuse the hash table instead of setting up a new one per packet */
+#ifdef HAVE_LZ4_COMPRESS_FAST_EXTSTATE_FASTRESET
+        zlen = LZ4_compress_fast_extState_fastReset(lz4_compress_state(compctx),
+                                                    (const char *)BPTR(buf), (char *)BPTR(work),
+                                                    BLEN(buf), zlen_max, 1);
+#else
+        zlen = LZ4_compress_fast_extState(lz4_compress_state(compctx),
+                                          (const char *)BPTR(buf), (char *)BPTR(work),
+                                          BLEN(buf), zlen_max, 1);
+#endif
 
         if (zlen <= 0)
         {
@@ -32,9 +32,12 @@
 extern const struct compress_alg lz4_alg;
 extern const struct compress_alg lz4v2_alg;
 
+/* bytes of a packet looked at to guess whether it is worth compressing */
+#define LZ4_ENTROPY_SAMPLE 128
+
 struct lz4_workspace
 {
-    int dummy;
+    void *state; /* LZ4 compression state, kept across packets */
 };
 
 #endif /* ENABLE_LZ4 */
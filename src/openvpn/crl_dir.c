@@ -0,0 +1,191 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#ifndef _WIN32
+#include <dirent.h>
+#endif
+
+#include "crl_dir.h"
+#include "buffer.h"
+#include "crypto.h"
+#include "error.h"
+#include "errlevel.h"
+#include "otime.h"
+#include "platform.h"
+
+#include "memdbg.h"
+
+static uint32_t
+crl_dir_hash_function(const void *key, uint32_t iv)
+{
+    const char *name = key;
+    return hash_func((const uint8_t *) name, (uint32_t) strlen(name), iv);
+}
+
+static bool
+crl_dir_compare_function(const void *key1, const void *key2)
+{
+    return !strcmp((const char *) key1, (const char *) key2);
+}
+
+static void
+crl_dir_clear(struct crl_dir *cd)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(cd->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        free(he->value);
+        hash_iterator_delete_element(&hi);
+    }
+    hash_iterator_free(&hi);
+}
+
+#ifndef _WIN32
+/* read the names in the directory into the hash */
+static bool
+crl_dir_scan(struct crl_dir *cd)
+{
+    DIR *dir = opendir(cd->path);
+    struct dirent *de;
+
+    crl_dir_clear(cd);
+    if (!dir)
+    {
+        msg(D_TLS_ERRORS | M_ERRNO, "VERIFY CRL: cannot read directory %s",
+            cd->path);
+        return false;
+    }
+
+    while ((de = readdir(dir)))
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+        {
+            continue;
+        }
+        char *name = string_alloc(de->d_name, NULL);
+        if (!hash_add(cd->hash, name, name, false))
+        {
+            free(name);
+        }
+    }
+    closedir(dir);
+
+    msg(D_HANDSHAKE, "VERIFY CRL: read %d revoked serials from %s",
+        hash_n_elements(cd->hash), cd->path);
+    return true;
+}
+
+/* read the directory again if it may have changed since the last scan */
+static void
+crl_dir_refresh(struct crl_dir *cd)
+{
+    platform_stat_t st;
+
+    cd->checked = now;
+    if (platform_stat(cd->path, &st) < 0)
+    {
+        crl_dir_clear(cd);
+        cd->valid = false;
+        return;
+    }
+
+    /*
+     * The modification time has a resolution of one second on some
+     * file systems, so a file added in the same second as the last scan
+     * would not change it.  Keep reading the directory until its
+     * modification time is older than the scan.
+     */
+    if (cd->valid && st.st_mtime == cd->mtime && cd->mtime < cd->scanned)
+    {
+        return;
+    }
+
+    cd->scanned = now;
+    cd->mtime = st.st_mtime;
+    cd->valid = crl_dir_scan(cd);
+}
+#endif /* ifndef _WIN32 */
+
+struct crl_dir *
+crl_dir_new(const char *path)
+{
+    struct crl_dir *cd;
+
+    ALLOC_OBJ_CLEAR(cd, struct crl_dir);
+    cd->path = string_alloc(path, NULL);
+    cd->hash = hash_init(256, get_random(), crl_dir_hash_function,
+                         crl_dir_compare_function);
+    /* read on first use, after a --chroot the path is relative to it */
+    return cd;
+}
+
+void
+crl_dir_free(struct crl_dir *cd)
+{
+    if (!cd)
+    {
+        return;
+    }
+
+    crl_dir_clear(cd);
+    hash_free(cd->hash);
+    free(cd->path);
+    free(cd);
+}
+
+bool
+crl_dir_is_revoked(struct crl_dir *cd, const char *serial)
+{
+#ifndef _WIN32
+    if (now != cd->checked)
+    {
+        crl_dir_refresh(cd);
+    }
+    if (cd->valid)
+    {
+        return hash_lookup(cd->hash, serial) != NULL;
+    }
+#endif
+
+    /* no index, look for the file itself */
+    struct gc_arena gc = gc_new();
+    struct buffer fn = alloc_buf_gc(strlen(cd->path) + strlen(serial) + 2, &gc);
+    buf_printf(&fn, "%s%c%s", cd->path, PATH_SEPARATOR, serial);
+
+    int fd = platform_open(BSTR(&fn), O_RDONLY, 0);
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    gc_free(&gc);
+    return fd >= 0;
+}
@@ -0,0 +1,67 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CRL_DIR_H
+#define CRL_DIR_H
+
+/**
+ * @file
+ * In-memory index of a --crl-verify directory.
+ *
+ * In "dir" mode a certificate is revoked if a file named after its
+ * serial number exists in the directory.  Instead of probing the file
+ * system for every certificate on every handshake, the names in the
+ * directory are read into a hash table.  The directory itself is
+ * stat()ed at most once per second and read again only when its
+ * modification time changed, so adding or removing a file takes effect
+ * within a second, also on network file systems where change
+ * notifications are not delivered.
+ */
+
+#include "basic.h"
+#include "list.h"
+
+struct crl_dir
+{
+    char *path;
+    struct hash *hash;  /* names of the files in the directory */
+    time_t checked;     /* last time the directory was stat()ed */
+    time_t scanned;     /* last time the directory was read */
+    time_t mtime;       /* of the directory when it was read */
+    bool valid;         /* directory was read successfully */
+};
+
+/**
+ * Allocate the index of the CRL directory path.  The directory is read
+ * by the first crl_dir_is_revoked() call.
+ */
+struct crl_dir *crl_dir_new(const char *path);
+
+void crl_dir_free(struct crl_dir *cd);
+
+/**
+ * Returns true if a file named serial exists in the directory.
+ */
+bool crl_dir_is_revoked(struct crl_dir *cd, const char *serial);
+
+#endif /* CRL_DIR_H */
@@ -29,12 +29,17 @@
 #include "syshead.h"
 
 #include "crypto.h"
+#include "crypto_epoch.h"
 #include "error.h"
 #include "integer.h"
 #include "platform.h"
+#include "comp.h"
 
 #include "memdbg.h"
 
+counter_type crypto_replay_errors_global; /* GLOBAL */
+counter_type crypto_auth_errors_global;   /* GLOBAL */
+
 /*
  * Encryption and Compression Routines.
  *
@@ -67,6 +72,13 @@ openvpn_encrypt_aead(struct buffer *buf, struct buffer work,
     const struct key_ctx *ctx = &opt->key_ctx_bi.encrypt;
     uint8_t *mac_out = NULL;
     const int mac_len = OPENVPN_AEAD_TAG_LENGTH;
+    const bool epoch_format = opt->flags & CO_EPOCH_DATA_KEY_FORMAT;
+
+    /* Move on to the next epoch key before the current one is used up */
+    if (epoch_format && opt->packet_id.send.id >= EPOCH_KEY_PACKETS)
+    {
+        epoch_iterate_send_key(opt);
+    }
 
     /* IV, packet-ID and implicit IV required for this mode. */
     ASSERT(ctx->cipher);
@@ -74,29 +86,41 @@ openvpn_encrypt_aead(struct buffer *buf, struct buffer work,
 
     gc_init(&gc);
 
-    /* Prepare IV */
-    {
-        struct buffer iv_buffer;
-        uint8_t iv[OPENVPN_MAX_IV_LENGTH] = {0};
-        const int iv_len = cipher_ctx_iv_length(ctx->cipher);
+    /* The packet ID is the explicit part of the IV, then come the tag and
+     * the ciphertext: check the room for all of it at once, and write the
+     * fields without checking each of them */
+    const int iv_len = ctx->iv_len;
+    const int packet_iv_len = iv_len - ctx->implicit_iv_len;
+    ASSERT(iv_len >= OPENVPN_AEAD_MIN_IV_LEN && iv_len <= OPENVPN_MAX_IV_LENGTH);
+    ASSERT(packet_iv_len == PACKET_ID_AEAD_SIZE(epoch_format));
 
-        ASSERT(iv_len >= OPENVPN_AEAD_MIN_IV_LEN && iv_len <= OPENVPN_MAX_IV_LENGTH);
+    if (!buf_reserve(&work, 0, packet_iv_len + mac_len + BLEN(buf) + ctx->block_size))
+    {
+        msg(D_CRYPT_ERRORS,
+            "ENCRYPT: buffer size error, bc=%d bo=%d bl=%d wc=%d wo=%d wl=%d",
+            buf->capacity, buf->offset, buf->len, work.capacity, work.offset,
+            work.len);
+        goto err;
+    }
 
-        buf_set_write(&iv_buffer, iv, iv_len);
+    /* Prepare IV */
+    {
+        uint8_t iv[OPENVPN_MAX_IV_LENGTH];
+        uint8_t *packet_iv = buf_write_alloc_unchecked(&work, packet_iv_len);
 
-        /* IV starts with packet id to make the IV unique for packet */
-        if (!packet_id_write(&opt->packet_id.send, &iv_buffer, false, false))
+        /* IV starts with packet id to make the IV unique for packet.  This
+         * is also the explicit part of the IV, so write it to the work
+         * buffer directly. */
+        if (!packet_id_store_aead(&opt->packet_id.send, epoch_format,
+                                  ctx->epoch, packet_iv))
         {
             msg(D_CRYPT_ERRORS, "ENCRYPT ERROR: packet ID roll over");
             goto err;
         }
 
         /* Remainder of IV consists of implicit part (unique per session) */
-        ASSERT(buf_write(&iv_buffer, ctx->implicit_iv, ctx->implicit_iv_len));
-        ASSERT(iv_buffer.len == iv_len);
-
-        /* Write explicit part of IV to work buffer */
-        ASSERT(buf_write(&work, iv, iv_len - ctx->implicit_iv_len));
+        memcpy(iv, packet_iv, packet_iv_len);
+        memcpy(iv + packet_iv_len, ctx->implicit_iv, ctx->implicit_iv_len);
         dmsg(D_PACKET_CONTENT, "ENCRYPT IV: %s", format_hex(iv, iv_len, 0, &gc));
 
         /* Init cipher_ctx with IV.  key & keylen are already initialized */
@@ -104,33 +128,25 @@ openvpn_encrypt_aead(struct buffer *buf, struct buffer work,
     }
 
     /* Reserve space for authentication tag */
-    mac_out = buf_write_alloc(&work, mac_len);
-    ASSERT(mac_out);
+    mac_out = buf_write_alloc_unchecked(&work, mac_len);
 
-    dmsg(D_PACKET_CONTENT, "ENCRYPT FROM: %s", format_hex(BPTR(buf), BLEN(buf), 80, &gc));
+    /* An in-place work buffer ends right where the payload starts */
+    ASSERT(work.data != buf->data || BEND(&work) == BPTR(buf));
 
-    /* Buffer overflow check */
-    if (!buf_safe(&work, buf->len + cipher_ctx_block_size(ctx->cipher)))
-    {
-        msg(D_CRYPT_ERRORS,
-            "ENCRYPT: buffer size error, bc=%d bo=%d bl=%d wc=%d wo=%d wl=%d",
-            buf->capacity, buf->offset, buf->len, work.capacity, work.offset,
-            work.len);
-        goto err;
-    }
+    dmsg(D_PACKET_CONTENT, "ENCRYPT FROM: %s", format_hex(BPTR(buf), BLEN(buf), 80, &gc));
 
     /* For AEAD ciphers, authenticate Additional Data, including opcode */
     ASSERT(cipher_ctx_update_ad(ctx->cipher, BPTR(&work), BLEN(&work) - mac_len));
     dmsg(D_PACKET_CONTENT, "ENCRYPT AD: %s",
          format_hex(BPTR(&work), BLEN(&work) - mac_len, 0, &gc));
 
-    /* Encrypt packet ID, payload */
+    /* Encrypt packet ID, payload, within the room checked above */
     ASSERT(cipher_ctx_update(ctx->cipher, BEND(&work), &outlen, BPTR(buf), BLEN(buf)));
-    ASSERT(buf_inc_len(&work, outlen));
+    work.len += outlen;
 
     /* Flush the encryption buffer */
     ASSERT(cipher_ctx_final(ctx->cipher, BEND(&work), &outlen));
-    ASSERT(buf_inc_len(&work, outlen));
+    work.len += outlen;
 
     /* Write authentication tag */
     ASSERT(cipher_ctx_get_tag(ctx->cipher, mac_out, mac_len));
@@ -166,7 +182,7 @@ openvpn_encrypt_v1(struct buffer *buf, struct buffer work,
         if (ctx->cipher)
         {
             uint8_t iv_buf[OPENVPN_MAX_IV_LENGTH] = {0};
-            const int iv_size = cipher_ctx_iv_length(ctx->cipher);
+            const int iv_size = ctx->iv_len;
             int outlen;
 
             /* Reserve space for HMAC */
@@ -177,7 +193,7 @@ openvpn_encrypt_v1(struct buffer *buf, struct buffer work,
                 hmac_start = BEND(&work);
             }
 
-            if (cipher_ctx_mode_cbc(ctx->cipher))
+            if (ctx->cbc)
             {
                 /* generate pseudo-random IV */
                 prng_bytes(iv_buf, iv_size);
@@ -192,7 +208,7 @@ openvpn_encrypt_v1(struct buffer *buf, struct buffer work,
                     goto err;
                 }
             }
-            else if (cipher_ctx_mode_ofb_cfb(ctx->cipher))
+            else if (ctx->ofb_cfb)
             {
                 struct buffer b;
 
@@ -218,7 +234,7 @@ openvpn_encrypt_v1(struct buffer *buf, struct buffer work,
             ASSERT(cipher_ctx_reset(ctx->cipher, iv_buf));
 
             /* Buffer overflow check */
-            if (!buf_safe(&work, buf->len + cipher_ctx_block_size(ctx->cipher)))
+            if (!buf_safe(&work, buf->len + ctx->block_size))
             {
                 msg(D_CRYPT_ERRORS, "ENCRYPT: buffer size error, bc=%d bo=%d bl=%d wc=%d wo=%d wl=%d cbs=%d",
                     buf->capacity,
@@ -227,7 +243,7 @@ openvpn_encrypt_v1(struct buffer *buf, struct buffer work,
                     work.capacity,
                     work.offset,
                     work.len,
-                    cipher_ctx_block_size(ctx->cipher));
+                    ctx->block_size);
                 goto err;
             }
 
@@ -296,7 +312,7 @@ openvpn_encrypt(struct buffer *buf, struct buffer work,
 {
     if (buf->len > 0 && opt)
     {
-        if (cipher_ctx_mode_aead(opt->key_ctx_bi.encrypt.cipher))
+        if (opt->key_ctx_bi.encrypt.aead)
         {
             openvpn_encrypt_aead(buf, work, opt);
         }
@@ -308,15 +324,54 @@ openvpn_encrypt(struct buffer *buf, struct buffer work,
 }
 
 bool
-crypto_check_replay(struct crypto_options *opt,
-                    const struct packet_id_net *pin, const char *error_prefix,
-                    struct gc_arena *gc)
+openvpn_encrypt_in_place_init(struct buffer *work, const struct buffer *buf,
+                              const struct crypto_options *opt, int reserve)
+{
+    if (!opt || buf->len <= 0
+        || !opt->key_ctx_bi.encrypt.aead)
+    {
+        return false;
+    }
+
+    const struct key_ctx *ctx = &opt->key_ctx_bi.encrypt;
+    const int header_len = ctx->iv_len - ctx->implicit_iv_len
+                           + OPENVPN_AEAD_TAG_LENGTH;
+    if (buf->offset < header_len + reserve)
+    {
+        return false;
+    }
+
+    *work = *buf;
+    work->offset = buf->offset - header_len;
+    work->len = 0;
+    return true;
+}
+
+bool
+openvpn_decrypt_in_place_init(struct buffer *work, const struct buffer *buf,
+                              const struct crypto_options *opt)
+{
+    if (!opt || buf->len <= 0
+        || !opt->key_ctx_bi.decrypt.aead)
+    {
+        return false;
+    }
+
+    *work = *buf;
+    return true;
+}
+
+/* check and record pin in the replay protection state rec of opt */
+static bool
+crypto_check_replay_rec(struct crypto_options *opt, struct packet_id_rec *rec,
+                        const struct packet_id_net *pin,
+                        const char *error_prefix, struct gc_arena *gc)
 {
     bool ret = false;
-    packet_id_reap_test(&opt->packet_id.rec);
-    if (packet_id_test(&opt->packet_id.rec, pin))
+    packet_id_reap_test(rec);
+    if (packet_id_test(rec, pin))
     {
-        packet_id_add(&opt->packet_id.rec, pin);
+        packet_id_add(rec, pin);
         if (opt->pid_persist && (opt->flags & CO_PACKET_ID_LONG_FORM))
         {
             packet_id_persist_save_obj(opt->pid_persist, &opt->packet_id);
@@ -325,6 +380,7 @@ crypto_check_replay(struct crypto_options *opt,
     }
     else
     {
+        ++crypto_replay_errors_global;
         if (!(opt->flags & CO_MUTE_REPLAY_WARNINGS))
         {
             msg(D_REPLAY_ERRORS, "%s: bad packet ID (may be a replay): %s -- "
@@ -336,6 +392,15 @@ crypto_check_replay(struct crypto_options *opt,
     return ret;
 }
 
+bool
+crypto_check_replay(struct crypto_options *opt,
+                    const struct packet_id_net *pin, const char *error_prefix,
+                    struct gc_arena *gc)
+{
+    return crypto_check_replay_rec(opt, &opt->packet_id.rec, pin,
+                                   error_prefix, gc);
+}
+
 /**
  * Unwrap (authenticate, decrypt and check replay protection) AEAD-mode data
  * channel packets.
@@ -352,6 +417,9 @@ openvpn_decrypt_aead(struct buffer *buf, struct buffer work,
     static const char error_prefix[] = "AEAD Decrypt error";
     struct packet_id_net pin = { 0 };
     const struct key_ctx *ctx = &opt->key_ctx_bi.decrypt;
+    struct packet_id_rec *rec = &opt->packet_id.rec;
+    const bool epoch_format = opt->flags & CO_EPOCH_DATA_KEY_FORMAT;
+    uint16_t epoch = 0;
     uint8_t *tag_ptr = NULL;
     int outlen;
     struct gc_arena gc;
@@ -361,29 +429,54 @@ openvpn_decrypt_aead(struct buffer *buf, struct buffer work,
     ASSERT(opt);
     ASSERT(frame);
     ASSERT(buf->len > 0);
-    ASSERT(ctx->cipher);
 
     dmsg(D_PACKET_CONTENT, "DECRYPT FROM: %s",
          format_hex(BPTR(buf), BLEN(buf), 80, &gc));
 
+    /* The packet ID, which is the explicit part of the IV, the tag and at
+     * least one byte of payload: check the length for all of it at once,
+     * and read the fields without checking each of them */
+    const int packet_iv_len = PACKET_ID_AEAD_SIZE(epoch_format);
+    const int tag_size = OPENVPN_AEAD_TAG_LENGTH;
+    if (BLEN(buf) < packet_iv_len + tag_size + 1)
+    {
+        CRYPT_ERROR("packet too short for packet-id, tag and payload");
+    }
+
+    /* The epoch in front of the packet ID selects the key */
+    if (epoch_format)
+    {
+        memcpy(&epoch, BPTR(buf), sizeof(epoch));
+        epoch = ntohs(epoch);
+        ctx = epoch_lookup_decrypt_key(opt, epoch);
+        if (!ctx)
+        {
+            CRYPT_ERROR("unknown data key epoch");
+        }
+        if (ctx == &opt->epoch_retiring_key)
+        {
+            rec = &opt->epoch_retiring_pid_rec;
+        }
+    }
+    ASSERT(ctx->cipher);
+
     ASSERT(ad_start >= buf->data && ad_start <= BPTR(buf));
 
-    ASSERT(buf_init(&work, frame->buf.headroom));
+    const bool in_place = (work.data == buf->data);
+    if (!in_place)
+    {
+        ASSERT(buf_init(&work, frame->buf.headroom));
+    }
 
     /* IV and Packet ID required for this mode */
     ASSERT(packet_id_initialized(&opt->packet_id));
 
     /* Combine IV from explicit part from packet and implicit part from context */
     {
-        uint8_t iv[OPENVPN_MAX_IV_LENGTH] = { 0 };
-        const int iv_len = cipher_ctx_iv_length(ctx->cipher);
-        const size_t packet_iv_len = iv_len - ctx->implicit_iv_len;
+        uint8_t iv[OPENVPN_MAX_IV_LENGTH];
+        const int iv_len = ctx->iv_len;
 
-        ASSERT(ctx->implicit_iv_len <= iv_len);
-        if (buf->len + ctx->implicit_iv_len < iv_len)
-        {
-            CRYPT_ERROR("missing IV info");
-        }
+        ASSERT(iv_len - ctx->implicit_iv_len == packet_iv_len);
 
         memcpy(iv, BPTR(buf), packet_iv_len);
         memcpy(iv + packet_iv_len, ctx->implicit_iv, ctx->implicit_iv_len);
@@ -398,30 +491,29 @@ openvpn_decrypt_aead(struct buffer *buf, struct buffer work,
     }
 
     /* Read packet ID from packet */
-    if (!packet_id_read(&pin, buf, false))
+    const uint8_t *packet_iv = buf_read_alloc_unchecked(buf, packet_iv_len);
+    if (epoch_format
+        ? packet_id_load_aead(&pin, true, packet_iv) != epoch
+        : !packet_id_load_aead(&pin, false, packet_iv))
     {
         CRYPT_ERROR("error reading packet-id");
     }
 
     /* keep the tag value to feed in later */
-    const int tag_size = OPENVPN_AEAD_TAG_LENGTH;
-    if (buf->len < tag_size)
-    {
-        CRYPT_ERROR("missing tag");
-    }
-    tag_ptr = BPTR(buf);
-    ASSERT(buf_advance(buf, tag_size));
+    tag_ptr = buf_read_alloc_unchecked(buf, tag_size);
     dmsg(D_PACKET_CONTENT, "DECRYPT MAC: %s", format_hex(tag_ptr, tag_size, 0, &gc));
 
-    if (buf->len < 1)
+    /* decrypting in place writes the plaintext over the ciphertext */
+    if (in_place)
     {
-        CRYPT_ERROR("missing payload");
+        work = *buf;
+        work.len = 0;
     }
 
     dmsg(D_PACKET_CONTENT, "DECRYPT FROM: %s", format_hex(BPTR(buf), BLEN(buf), 0, &gc));
 
     /* Buffer overflow check (should never fail) */
-    if (!buf_safe(&work, buf->len + cipher_ctx_block_size(ctx->cipher)))
+    if (!buf_reserve(&work, 0, buf->len + ctx->block_size))
     {
         CRYPT_ERROR("potential buffer overflow");
     }
@@ -440,18 +532,26 @@ openvpn_decrypt_aead(struct buffer *buf, struct buffer work,
     {
         CRYPT_ERROR("cipher update failed");
     }
-    ASSERT(buf_inc_len(&work, outlen));
+    work.len += outlen;
     if (!cipher_ctx_final_check_tag(ctx->cipher, BPTR(&work) + outlen,
                                     &outlen, tag_ptr, tag_size))
     {
+        ++crypto_auth_errors_global;
         CRYPT_ERROR("cipher final failed");
     }
-    ASSERT(buf_inc_len(&work, outlen));
+    work.len += outlen;
 
     dmsg(D_PACKET_CONTENT, "DECRYPT TO: %s",
          format_hex(BPTR(&work), BLEN(&work), 80, &gc));
 
-    if (!crypto_check_replay(opt, &pin, error_prefix, &gc))
+    /* The peer has moved on to a new epoch, follow it */
+    if (epoch_format && epoch > opt->key_ctx_bi.decrypt.epoch)
+    {
+        epoch_replace_update_recv_key(opt, epoch);
+        rec = &opt->packet_id.rec;
+    }
+
+    if (!crypto_check_replay_rec(opt, rec, &pin, error_prefix, &gc))
     {
         goto error_exit;
     }
@@ -516,6 +616,7 @@ openvpn_decrypt_v1(struct buffer *buf, struct buffer work,
             /* Compare locally computed HMAC with packet HMAC */
             if (memcmp_constant_time(local_hmac, BPTR(buf), hmac_len))
             {
+                ++crypto_auth_errors_global;
                 CRYPT_ERROR("packet HMAC authentication failed");
             }
 
@@ -526,7 +627,7 @@ openvpn_decrypt_v1(struct buffer *buf, struct buffer work,
 
         if (ctx->cipher)
         {
-            const int iv_size = cipher_ctx_iv_length(ctx->cipher);
+            const int iv_size = ctx->iv_len;
             uint8_t iv_buf[OPENVPN_MAX_IV_LENGTH] = { 0 };
             int outlen;
 
@@ -554,7 +655,7 @@ openvpn_decrypt_v1(struct buffer *buf, struct buffer work,
             }
 
             /* Buffer overflow check (should never happen) */
-            if (!buf_safe(&work, buf->len + cipher_ctx_block_size(ctx->cipher)))
+            if (!buf_safe(&work, buf->len + ctx->block_size))
             {
                 CRYPT_ERROR("potential buffer overflow");
             }
@@ -578,7 +679,7 @@ openvpn_decrypt_v1(struct buffer *buf, struct buffer work,
 
             /* Get packet ID from plaintext buffer or IV, depending on cipher mode */
             {
-                if (cipher_ctx_mode_cbc(ctx->cipher))
+                if (ctx->cbc)
                 {
                     if (packet_id_initialized(&opt->packet_id))
                     {
@@ -589,7 +690,7 @@ openvpn_decrypt_v1(struct buffer *buf, struct buffer work,
                         have_pin = true;
                     }
                 }
-                else if (cipher_ctx_mode_ofb_cfb(ctx->cipher))
+                else if (ctx->ofb_cfb)
                 {
                     struct buffer b;
 
@@ -649,7 +750,7 @@ openvpn_decrypt(struct buffer *buf, struct buffer work,
 
     if (buf->len > 0 && opt)
     {
-        if (cipher_ctx_mode_aead(opt->key_ctx_bi.decrypt.cipher))
+        if (opt->key_ctx_bi.decrypt.aead)
         {
             ret = openvpn_decrypt_aead(buf, work, opt, frame, ad_start);
         }
@@ -831,6 +932,11 @@ init_key_ctx(struct key_ctx *ctx, const struct key *key,
 
         ctx->cipher = cipher_ctx_new();
         cipher_ctx_init(ctx->cipher, key->cipher, kt->cipher, enc);
+        ctx->iv_len = cipher_ctx_iv_length(ctx->cipher);
+        ctx->block_size = cipher_ctx_block_size(ctx->cipher);
+        ctx->aead = cipher_ctx_mode_aead(ctx->cipher);
+        ctx->cbc = cipher_ctx_mode_cbc(ctx->cipher);
+        ctx->ofb_cfb = cipher_ctx_mode_ofb_cfb(ctx->cipher);
 
         const char *ciphername = cipher_kt_name(kt->cipher);
         msg(D_CIPHER_INIT, "%s: Cipher '%s' initialized with %d bit key",
@@ -899,6 +1005,10 @@ free_key_ctx(struct key_ctx *ctx)
         ctx->hmac = NULL;
     }
     ctx->implicit_iv_len = 0;
+    ctx->iv_len = 0;
+    ctx->block_size = 0;
+    ctx->epoch = 0;
+    ctx->aead = ctx->cbc = ctx->ofb_cfb = false;
 }
 
 void
@@ -994,6 +1104,31 @@ key2_print(const struct key2 *k,
     key_print(&k->keys[1], kt, prefix1);
 }
 
+/*
+ * Without TLS there is no key material to derive the implicit IV of
+ * AEAD ciphers from, so use a random one for both directions.
+ */
+static void
+test_crypto_implicit_iv(struct crypto_options *co)
+{
+    cipher_ctx_t *cipher = co->key_ctx_bi.encrypt.cipher;
+    if (cipher_ctx_mode_aead(cipher))
+    {
+        size_t impl_iv_len = cipher_ctx_iv_length(cipher) - sizeof(packet_id_type);
+        ASSERT(cipher_ctx_iv_length(cipher) <= OPENVPN_MAX_IV_LENGTH);
+        ASSERT(cipher_ctx_iv_length(cipher) >= OPENVPN_AEAD_MIN_IV_LEN);
+
+        /* Generate dummy implicit IV */
+        ASSERT(rand_bytes(co->key_ctx_bi.encrypt.implicit_iv,
+                          OPENVPN_MAX_IV_LENGTH));
+        co->key_ctx_bi.encrypt.implicit_iv_len = impl_iv_len;
+
+        memcpy(co->key_ctx_bi.decrypt.implicit_iv,
+               co->key_ctx_bi.encrypt.implicit_iv, OPENVPN_MAX_IV_LENGTH);
+        co->key_ctx_bi.decrypt.implicit_iv_len = impl_iv_len;
+    }
+}
+
 void
 test_crypto(struct crypto_options *co, struct frame *frame)
 {
@@ -1009,25 +1144,7 @@ test_crypto(struct crypto_options *co, struct frame *frame)
     /* init work */
     ASSERT(buf_init(&work, frame->buf.headroom));
 
-    /* init implicit IV */
-    {
-        cipher_ctx_t *cipher = co->key_ctx_bi.encrypt.cipher;
-        if (cipher_ctx_mode_aead(cipher))
-        {
-            size_t impl_iv_len = cipher_ctx_iv_length(cipher) - sizeof(packet_id_type);
-            ASSERT(cipher_ctx_iv_length(cipher) <= OPENVPN_MAX_IV_LENGTH);
-            ASSERT(cipher_ctx_iv_length(cipher) >= OPENVPN_AEAD_MIN_IV_LEN);
-
-            /* Generate dummy implicit IV */
-            ASSERT(rand_bytes(co->key_ctx_bi.encrypt.implicit_iv,
-                              OPENVPN_MAX_IV_LENGTH));
-            co->key_ctx_bi.encrypt.implicit_iv_len = impl_iv_len;
-
-            memcpy(co->key_ctx_bi.decrypt.implicit_iv,
-                   co->key_ctx_bi.encrypt.implicit_iv, OPENVPN_MAX_IV_LENGTH);
-            co->key_ctx_bi.decrypt.implicit_iv_len = impl_iv_len;
-        }
-    }
+    test_crypto_implicit_iv(co);
 
     msg(M_INFO, "Entering " PACKAGE_NAME " crypto self-test mode.");
     for (i = 1; i <= frame->buf.payload_size; ++i)
@@ -1078,6 +1195,147 @@ test_crypto(struct crypto_options *co, struct frame *frame)
     gc_free(&gc);
 }
 
+static inline uint64_t
+bench_crypto_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+/*
+ * Time stamp counter, 0 where we have no cheap way to read it.  This
+ * counts at a constant reference rate on current CPUs, which is not
+ * necessarily the rate the core actually runs at.
+ */
+static inline uint64_t
+bench_crypto_cycles(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    return __builtin_ia32_rdtsc();
+#else
+    return 0;
+#endif
+}
+
+void
+bench_crypto(const struct key_type *kt, const struct frame *frame,
+             struct compress_context *compctx,
+             const int *sizes, int n_sizes, int seconds)
+{
+    struct gc_arena gc = gc_new();
+    struct crypto_options co;
+    struct key2 key2 = { .n = 2 };
+    struct buffer src = alloc_buf_gc(frame->buf.payload_size, &gc);
+    struct buffer work = alloc_buf_gc(BUF_SIZE(frame), &gc);
+    struct buffer encrypt_workspace = alloc_buf_gc(BUF_SIZE(frame), &gc);
+    struct buffer decrypt_workspace = alloc_buf_gc(BUF_SIZE(frame), &gc);
+#ifdef USE_COMP
+    struct buffer compress_workspace = alloc_buf_gc(BUF_SIZE(frame), &gc);
+    struct buffer decompress_workspace = alloc_buf_gc(BUF_SIZE(frame), &gc);
+#endif
+    struct buffer name = alloc_buf_gc(128, &gc);
+    uint64_t packets = 0, bytes = 0;
+
+    buf_printf(&name, "%s", cipher_kt_name(kt->cipher));
+    if (!cipher_kt_mode_aead(kt->cipher) && md_defined(kt->digest))
+    {
+        buf_printf(&name, "/%s", md_kt_name(kt->digest));
+    }
+
+    CLEAR(co);
+    generate_key_random(&key2.keys[0]);
+    generate_key_random(&key2.keys[1]);
+    init_key_ctx_bi(&co.key_ctx_bi, &key2, KEY_DIRECTION_BIDIRECTIONAL, kt,
+                    "Benchmark");
+    secure_memzero(&key2, sizeof(key2));
+    packet_id_init(&co.packet_id, DEFAULT_SEQ_BACKTRACK,
+                   DEFAULT_TIME_BACKTRACK, "BENCH", 0);
+    if (cipher_kt_mode_ofb_cfb(kt->cipher))
+    {
+        co.flags |= CO_PACKET_ID_LONG_FORM;
+    }
+    test_crypto_implicit_iv(&co);
+
+    /* random payload, so that compression framing is measured without
+     * the compressor actually shrinking anything */
+    ASSERT(buf_init(&src, 0));
+    ASSERT(rand_bytes(BPTR(&src), src.capacity));
+
+    update_time();
+    const uint64_t start = bench_crypto_now();
+    const uint64_t start_cycles = bench_crypto_cycles();
+    const uint64_t end = start + (uint64_t) seconds * 1000000000;
+    uint64_t stop = start;
+
+    while (stop < end)
+    {
+        for (int i = 0; i < n_sizes; ++i)
+        {
+            struct buffer buf = work;
+            ASSERT(buf_init(&buf, frame->buf.headroom));
+            ASSERT(buf_write(&buf, BPTR(&src), sizes[i]));
+
+#ifdef USE_COMP
+            if (compctx)
+            {
+                (*compctx->alg.compress)(&buf, compress_workspace, compctx, frame);
+            }
+#endif
+            ASSERT(buf_init(&encrypt_workspace, frame->buf.headroom));
+            openvpn_encrypt(&buf, encrypt_workspace, &co);
+            openvpn_decrypt(&buf, decrypt_workspace, &co, frame, BPTR(&buf));
+#ifdef USE_COMP
+            if (compctx)
+            {
+                (*compctx->alg.decompress)(&buf, decompress_workspace, compctx, frame);
+            }
+#endif
+            if (buf.len != sizes[i])
+            {
+                msg(M_FATAL, "BENCHMARK FAILED, %s: size=%d buf.len=%d",
+                    BSTR(&name), sizes[i], buf.len);
+            }
+            bytes += sizes[i];
+        }
+        packets += n_sizes;
+
+        /* don't let the clock source dominate the small packet case */
+        if (packets % 1024 < (uint64_t) n_sizes)
+        {
+            stop = bench_crypto_now();
+        }
+    }
+    stop = bench_crypto_now();
+
+    const uint64_t cycles = bench_crypto_cycles() - start_cycles;
+    const double elapsed = (double) (stop - start) / 1000000000;
+    const double gbps = (double) bytes * 8 / elapsed / 1000000000;
+    const double ns_per_byte = (double) (stop - start) / (double) bytes;
+
+    if (cycles)
+    {
+        msg(M_INFO, "%-32s %10.0f packets/s %8.3f Gbit/s %7.3f ns/byte %7.3f cycles/byte",
+            BSTR(&name), (double) packets / elapsed, gbps, ns_per_byte,
+            (double) cycles / (double) bytes);
+    }
+    else
+    {
+        msg(M_INFO, "%-32s %10.0f packets/s %8.3f Gbit/s %7.3f ns/byte",
+            BSTR(&name), (double) packets / elapsed, gbps, ns_per_byte);
+    }
+
+    free_key_ctx_bi(&co.key_ctx_bi);
+    packet_id_free(&co.packet_id);
+    gc_free(&gc);
+}
+
 const char *
 print_key_filename(const char *str, bool is_inline)
 {
@@ -1599,10 +1857,45 @@ key_len_err:
     return 0;
 }
 
+/*
+ * Random bytes for prng_bytes() are fetched from rand_bytes() in batches
+ * of PRNG_BATCH bytes, so that the per-packet IVs of CBC ciphers do not
+ * go through the locking and dispatch of the crypto library each time.
+ * The bytes are wiped as they are handed out.
+ */
+#define PRNG_BATCH 1024
+
+static struct {
+    uint8_t bytes[PRNG_BATCH];
+    int avail;              /* unused bytes at the end of bytes */
+} prng_batch;
+
 void
 prng_bytes(uint8_t *output, int len)
 {
-    ASSERT(rand_bytes(output, len));
+    if (len > PRNG_BATCH / 4)
+    {
+        ASSERT(rand_bytes(output, len));
+        return;
+    }
+
+    if (len > prng_batch.avail)
+    {
+        ASSERT(rand_bytes(prng_batch.bytes, PRNG_BATCH));
+        prng_batch.avail = PRNG_BATCH;
+    }
+
+    uint8_t *p = prng_batch.bytes + PRNG_BATCH - prng_batch.avail;
+    memcpy(output, p, len);
+    secure_memzero(p, len);
+    prng_batch.avail -= len;
+}
+
+void
+prng_reset(void)
+{
+    secure_memzero(prng_batch.bytes, sizeof(prng_batch.bytes));
+    prng_batch.avail = 0;
 }
 
 /* an analogue to the random() function, but use prng_bytes */
@@ -108,6 +108,16 @@
  * <tt>   [ - opcode/peer-id - ] [ - packet ID - ] [ TAG ] [ * packet payload * ] </tt>
  *
  * @par
+ * <b>Epoch data key format</b> \n
+ * If both peers negotiated epoch data keys (see crypto_epoch.h), the packet
+ * ID of AEAD packets is 64 bits long: a 16-bit epoch followed by a 48-bit
+ * packet counter.  The epoch selects the data key, and the counter starts
+ * again with every new epoch.  The IV consists of the 64-bit packet ID
+ * followed by the implicit IV of the epoch. \n
+ * <i>Epoch data key format:</i> \n
+ * <tt>   [ - opcode/peer-id - ] [ - epoch - ] [ - packet ID - ] [ TAG ] [ * packet payload * ] </tt>
+ *
+ * @par
  * <b>No-crypto data channel format</b> \n
  * In no-crypto mode (\c \-\-cipher \c none is specified), both TLS-mode and
  * static key mode are supported. No encryption will be performed on the packet,
@@ -166,6 +176,15 @@ struct key_ctx
     uint8_t implicit_iv[OPENVPN_MAX_IV_LENGTH];
     /**< The implicit part of the IV */
     size_t implicit_iv_len;     /**< The length of implicit_iv */
+    int iv_len;                 /**< IV length of \c cipher */
+    int block_size;             /**< Block size of \c cipher */
+    bool aead;                  /**< \c cipher is an AEAD cipher */
+    bool cbc;                   /**< \c cipher is in CBC mode */
+    bool ofb_cfb;               /**< \c cipher is in OFB or CFB mode */
+    /* The cipher properties above are looked up once in init_key_ctx()
+     * instead of asking the crypto library again for every packet */
+    uint16_t epoch;             /**< Epoch of this key, only used with
+                                 *   \c CO_EPOCH_DATA_KEY_FORMAT */
 };
 
 #define KEY_DIRECTION_BIDIRECTIONAL 0 /* same keys for both directions */
@@ -223,6 +242,19 @@ struct key_ctx_bi
     bool initialized;
 };
 
+/**
+ * Secret from which the data channel keys of one epoch are derived, see
+ * crypto_epoch.h.
+ */
+struct epoch_key
+{
+    uint8_t epoch_key[SHA256_DIGEST_LENGTH];
+    uint16_t epoch;
+};
+
+/** Number of receive keys of the following epochs that are kept ready */
+#define EPOCH_FUTURE_KEYS 4
+
 /**
  * Security parameter state for processing data channel packets.
  * @ingroup data_crypto
@@ -279,9 +311,37 @@ struct crypto_options
     /**< Bit-flag indicating that renegotiations are using tls-crypt
      *   with a TLS-EKM derived key.
      */
+#define CO_EPOCH_DATA_KEY_FORMAT   (1<<8)
+    /**< Bit-flag indicating that the AEAD data channel keys are
+     *   replaced by epoch keys derived from the TLS-EKM key material
+     *   and that packets carry the epoch in their packet id.
+     */
+#define CO_MULTIPATH               (1<<9)
+    /**< Bit-flag indicating that data packets of the peer may come
+     *   from and go to several addresses, see --multipath.
+     */
 
     unsigned int flags;         /**< Bit-flags determining behavior of
                                  *   security operation functions. */
+
+    /** @name Epoch data keys, only used with \c CO_EPOCH_DATA_KEY_FORMAT
+     *  @{ */
+    struct key_type epoch_key_type;
+    /**< Cipher of the epoch data keys. */
+    struct epoch_key epoch_key_send;
+    /**< Epoch key of \c key_ctx_bi.encrypt. */
+    struct epoch_key epoch_key_recv;
+    /**< Epoch key of the last of the \c epoch_future_keys. */
+    struct key_ctx epoch_future_keys[EPOCH_FUTURE_KEYS];
+    /**< Receive keys of the epochs following the one of
+     *   \c key_ctx_bi.decrypt, to accept packets from the peer once
+     *   it has moved on to a new epoch. */
+    struct key_ctx epoch_retiring_key;
+    /**< Receive key of the previous epoch, for packets that were
+     *   reordered around the peer's epoch change. */
+    struct packet_id_rec epoch_retiring_pid_rec;
+    /**< Replay protection state of \c epoch_retiring_key. */
+    /** @} */
 };
 
 #define CRYPT_ERROR(format) \
@@ -363,7 +423,8 @@ void free_key_ctx_bi(struct key_ctx_bi *ctx);
  *
  * @param buf          - The %buffer containing the packet on which to
  *                       perform security operations.
- * @param work         - An initialized working %buffer.
+ * @param work         - An initialized working %buffer, or the one set
+ *                       up by \c openvpn_encrypt_in_place_init().
  * @param opt          - The security parameter state for this VPN tunnel.
  *
  * @return This function returns void.\n On return, the \a buf argument
@@ -394,7 +455,8 @@ void openvpn_encrypt(struct buffer *buf, struct buffer work,
  * @param buf          - The %buffer containing the packet received from a
  *                       remote OpenVPN peer on which to perform security
  *                       operations.
- * @param work         - A working %buffer.
+ * @param work         - A working %buffer, or the one set up by
+ *                       \c openvpn_decrypt_in_place_init().
  * @param opt          - The security parameter state for this VPN tunnel.
  * @param frame        - The packet geometry parameters for this VPN
  *                       tunnel.
@@ -412,8 +474,52 @@ bool openvpn_decrypt(struct buffer *buf, struct buffer work,
                      struct crypto_options *opt, const struct frame *frame,
                      const uint8_t *ad_start);
 
+/**
+ * Set up a working %buffer that makes \c openvpn_encrypt() encrypt the
+ * packet in \a buf in place.  The packet ID and the authentication tag
+ * are written into the headroom in front of the payload, and the payload
+ * is encrypted where it is instead of being copied into a separate
+ * working %buffer.  This is only possible with AEAD ciphers.
+ *
+ * The caller must own \a buf, and must not need the plaintext after
+ * encryption.  Like the regular working %buffer, \a work may have an
+ * opcode prepended before \c openvpn_encrypt() is called.
+ *
+ * @param work         - Set to the in-place working %buffer.
+ * @param buf          - The %buffer containing the packet to encrypt.
+ * @param opt          - The security parameters that will be used.
+ * @param reserve      - Headroom that must remain in front of the
+ *                       encrypted packet for headers added later.
+ *
+ * @return True if \a work was set up, false if the packet has to be
+ *     encrypted into a separate working %buffer.
+ */
+bool openvpn_encrypt_in_place_init(struct buffer *work, const struct buffer *buf,
+                                   const struct crypto_options *opt, int reserve);
+
+/**
+ * Set up a working %buffer that makes \c openvpn_decrypt() decrypt the
+ * packet in \a buf in place, leaving the plaintext where the ciphertext
+ * was.  This is only possible with AEAD ciphers.
+ *
+ * @param work         - Set to the in-place working %buffer.
+ * @param buf          - The %buffer containing the packet to decrypt.
+ * @param opt          - The security parameters that will be used.
+ *
+ * @return True if \a work was set up, false if the packet has to be
+ *     decrypted into a separate working %buffer.
+ */
+bool openvpn_decrypt_in_place_init(struct buffer *work, const struct buffer *buf,
+                                   const struct crypto_options *opt);
+
 /** @} name Functions for performing security operations on data channel packets */
 
+/** Data channel packets dropped because their packet ID was a replay. */
+extern counter_type crypto_replay_errors_global;
+
+/** Data channel packets dropped because authentication failed. */
+extern counter_type crypto_auth_errors_global;
+
 /**
  * Check packet ID for replay, and perform replay administration.
  *
@@ -491,11 +597,11 @@ read_pem_key_file(struct buffer *key, const char *pem_name,
                   const char *key_file, bool key_inline);
 
 /*
- * Message digest-based pseudo random number generator.
+ * Pseudo random number generator for per-packet use.
  *
- * If the PRNG was initialised with a certain message digest, uses the digest
- * to calculate the next random number, and prevent depletion of the entropy
- * pool.
+ * Small requests are served from a batch of bytes fetched from
+ * \c rand_bytes() at once, so that they are cheap.  The batch is not
+ * protected by a lock, only the main thread may call this.
  *
  * This PRNG is aimed at IV generation and similar miscellaneous tasks. Use
  * \c rand_bytes() for higher-assurance functionality.
@@ -507,6 +613,13 @@ read_pem_key_file(struct buffer *key, const char *pem_name,
  */
 void prng_bytes(uint8_t *output, int len);
 
+/**
+ * Discard the bytes that \c prng_bytes() has fetched but not handed out
+ * yet.  A process that forks must call this in the child, if both go
+ * on using \c prng_bytes(), or they would hand out the same bytes.
+ */
+void prng_reset(void);
+
 /* an analogue to the random() function, but use prng_bytes */
 long int get_random(void);
 
@@ -515,6 +628,27 @@ void print_cipher(const char *cipher);
 
 void test_crypto(struct crypto_options *co, struct frame *f);
 
+struct compress_context;
+
+/**
+ * Measure the data channel throughput of one cipher/HMAC combination.
+ *
+ * Encrypts and decrypts packets of the given sizes in turn with a random
+ * key for \c seconds and logs packets/s, Gbit/s and the time and
+ * cycles spent per payload byte.
+ *
+ * @param kt            Cipher and HMAC to benchmark
+ * @param frame         Buffer layout of the data channel
+ * @param compctx       If not NULL, also run the packets through the
+ *                      compression framing of this context
+ * @param sizes         Payload sizes to cycle through
+ * @param n_sizes       Number of entries in \c sizes
+ * @param seconds       How long to run
+ */
+void bench_crypto(const struct key_type *kt, const struct frame *frame,
+                  struct compress_context *compctx,
+                  const int *sizes, int n_sizes, int seconds);
+
 
 /* key direction functions */
 
@@ -93,6 +93,22 @@ provider_t *crypto_load_provider(const char *provider);
  */
 void crypto_unload_provider(const char *provname, provider_t *provider);
 
+/**
+ * Make the crypto library count the heap memory it uses.  Has to be
+ * called before the library allocates anything.
+ */
+void crypto_init_mem_accounting(void);
+
+/**
+ * Get the heap memory currently used by the crypto library.
+ *
+ * @param bytes     Set to the number of bytes in use.
+ * @return false if the memory use is not known, either because the
+ *         library does not support it or crypto_init_mem_accounting()
+ *         came too late.
+ */
+bool crypto_mem_in_use(size_t *bytes);
+
 #ifdef DMALLOC
 /*
  * OpenSSL memory debugging.  If dmalloc debugging is enabled, tell
@@ -109,6 +125,12 @@ void show_available_digests(void);
 
 void show_available_engines(void);
 
+/**
+ * Returns the hardware acceleration the crypto library uses for AES, like
+ * "AES-NI", or NULL if AES is computed in software.
+ */
+const char *crypto_aes_hw_accel(void);
+
 /**
  * Encode binary data as PEM.
  *
@@ -0,0 +1,276 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "crypto_epoch.h"
+#include "buffer.h"
+#include "integer.h"
+
+#include "memdbg.h"
+
+/* HKDF-Expand (RFC 5869) with SHA256 */
+static void
+ovpn_hkdf_expand(const uint8_t *secret, const uint8_t *info, int info_len,
+                 uint8_t *out, int out_len)
+{
+    hmac_ctx_t *hmac = hmac_ctx_new();
+    uint8_t t[SHA256_DIGEST_LENGTH];
+    int t_len = 0;
+
+    hmac_ctx_init(hmac, secret, "SHA256");
+
+    for (uint8_t block = 1; out_len > 0; block++)
+    {
+        hmac_ctx_reset(hmac);
+        hmac_ctx_update(hmac, t, t_len);
+        hmac_ctx_update(hmac, info, info_len);
+        hmac_ctx_update(hmac, &block, 1);
+        hmac_ctx_final(hmac, t);
+        t_len = sizeof(t);
+
+        const int n = min_int(out_len, t_len);
+        memcpy(out, t, n);
+        out += n;
+        out_len -= n;
+    }
+
+    secure_memzero(t, sizeof(t));
+    hmac_ctx_cleanup(hmac);
+    hmac_ctx_free(hmac);
+}
+
+void
+ovpn_expand_label(const uint8_t *secret, const char *label,
+                  uint8_t *out, uint16_t out_len)
+{
+    static const char prefix[] = "ovpn ";
+    const size_t prefix_len = sizeof(prefix) - 1;
+    const size_t label_len = strlen(label);
+    uint8_t info[2 + 1 + 255 + 1];
+    struct buffer b;
+
+    ASSERT(prefix_len + label_len <= 255);
+
+    /* struct HkdfLabel of RFC 8446 with an empty context */
+    buf_set_write(&b, info, sizeof(info));
+    ASSERT(buf_write_u16(&b, out_len)
+           && buf_write_u8(&b, (uint8_t)(prefix_len + label_len))
+           && buf_write(&b, prefix, prefix_len)
+           && buf_write(&b, label, label_len)
+           && buf_write_u8(&b, 0));
+
+    ovpn_hkdf_expand(secret, BPTR(&b), BLEN(&b), out, out_len);
+}
+
+void
+epoch_key_iterate(struct epoch_key *ek)
+{
+    struct epoch_key next;
+
+    ovpn_expand_label(ek->epoch_key, "datakey upd", next.epoch_key,
+                      sizeof(next.epoch_key));
+    next.epoch = ek->epoch + 1;
+    *ek = next;
+    secure_memzero(&next, sizeof(next));
+}
+
+/* derive the cipher key and implicit IV of an epoch and initialise ctx
+ * with them */
+static void
+epoch_init_data_key(struct key_ctx *ctx, const struct epoch_key *ek,
+                    const struct key_type *kt, int enc)
+{
+    char prefix[64];
+    struct key key;
+
+    openvpn_snprintf(prefix, sizeof(prefix), "%s Data Channel epoch %u",
+                     enc == OPENVPN_OP_ENCRYPT ? "Outgoing" : "Incoming",
+                     ek->epoch);
+
+    CLEAR(key);
+    ovpn_expand_label(ek->epoch_key, "data_key", key.cipher,
+                      cipher_kt_key_size(kt->cipher));
+    init_key_ctx(ctx, &key, kt, enc, prefix);
+    secure_memzero(&key, sizeof(key));
+
+    /* the explicit part of the IV is the whole 64-bit packet ID */
+    ASSERT(ctx->aead && ctx->iv_len >= OPENVPN_AEAD_MIN_IV_LEN);
+    ctx->implicit_iv_len = ctx->iv_len - PACKET_ID_EPOCH_SIZE;
+    ovpn_expand_label(ek->epoch_key, "data_iv", ctx->implicit_iv,
+                      ctx->implicit_iv_len);
+    ctx->epoch = ek->epoch;
+}
+
+/* the key material of a direction is the secret of the first epoch key */
+static void
+epoch_key_init(struct epoch_key *ek, const struct key *secret)
+{
+    ovpn_expand_label(secret->cipher, "datakey upd", ek->epoch_key,
+                      sizeof(ek->epoch_key));
+    ek->epoch = 1;
+}
+
+void
+epoch_init_key_ctx(struct crypto_options *co, const struct key_type *kt,
+                   const struct key *send_secret,
+                   const struct key *recv_secret)
+{
+    co->epoch_key_type = *kt;
+
+    epoch_key_init(&co->epoch_key_send, send_secret);
+    epoch_init_data_key(&co->key_ctx_bi.encrypt, &co->epoch_key_send, kt,
+                        OPENVPN_OP_ENCRYPT);
+
+    epoch_key_init(&co->epoch_key_recv, recv_secret);
+    epoch_init_data_key(&co->key_ctx_bi.decrypt, &co->epoch_key_recv, kt,
+                        OPENVPN_OP_DECRYPT);
+    for (int i = 0; i < EPOCH_FUTURE_KEYS; i++)
+    {
+        epoch_key_iterate(&co->epoch_key_recv);
+        epoch_init_data_key(&co->epoch_future_keys[i], &co->epoch_key_recv,
+                            kt, OPENVPN_OP_DECRYPT);
+    }
+
+    co->key_ctx_bi.initialized = true;
+}
+
+void
+free_epoch_key_ctx(struct crypto_options *co)
+{
+    for (int i = 0; i < EPOCH_FUTURE_KEYS; i++)
+    {
+        free_key_ctx(&co->epoch_future_keys[i]);
+    }
+    free_key_ctx(&co->epoch_retiring_key);
+    free(co->epoch_retiring_pid_rec.seq_words);
+    CLEAR(co->epoch_retiring_pid_rec);
+    secure_memzero(&co->epoch_key_send, sizeof(co->epoch_key_send));
+    secure_memzero(&co->epoch_key_recv, sizeof(co->epoch_key_recv));
+}
+
+void
+epoch_iterate_send_key(struct crypto_options *co)
+{
+    if (co->epoch_key_send.epoch == UINT16_MAX)
+    {
+        /* the renegotiation triggered at EPOCH_WRAP_TRIGGER did not
+         * happen, stay in the last epoch until the packet ID runs out */
+        return;
+    }
+
+    epoch_key_iterate(&co->epoch_key_send);
+    free_key_ctx(&co->key_ctx_bi.encrypt);
+    epoch_init_data_key(&co->key_ctx_bi.encrypt, &co->epoch_key_send,
+                        &co->epoch_key_type, OPENVPN_OP_ENCRYPT);
+    reset_packet_id_send(&co->packet_id.send);
+}
+
+const struct key_ctx *
+epoch_lookup_decrypt_key(const struct crypto_options *co, uint16_t epoch)
+{
+    const struct key_ctx *current = &co->key_ctx_bi.decrypt;
+
+    if (epoch == current->epoch)
+    {
+        return current;
+    }
+    if (co->epoch_retiring_key.cipher && epoch == co->epoch_retiring_key.epoch)
+    {
+        return &co->epoch_retiring_key;
+    }
+    if (epoch > current->epoch && epoch - current->epoch <= EPOCH_FUTURE_KEYS)
+    {
+        const struct key_ctx *future = &co->epoch_future_keys[epoch - current->epoch - 1];
+        /* there are no keys after the last epoch */
+        if (future->cipher)
+        {
+            return future;
+        }
+    }
+    return NULL;
+}
+
+void
+epoch_replace_update_recv_key(struct crypto_options *co, uint16_t epoch)
+{
+    const int skipped = epoch - co->key_ctx_bi.decrypt.epoch - 1;
+    ASSERT(skipped >= 0 && skipped < EPOCH_FUTURE_KEYS);
+
+    /* the current key and its replay state become the retiring ones */
+    free_key_ctx(&co->epoch_retiring_key);
+    free(co->epoch_retiring_pid_rec.seq_words);
+    co->epoch_retiring_key = co->key_ctx_bi.decrypt;
+    co->epoch_retiring_pid_rec = co->packet_id.rec;
+
+    co->key_ctx_bi.decrypt = co->epoch_future_keys[skipped];
+    for (int i = 0; i < skipped; i++)
+    {
+        free_key_ctx(&co->epoch_future_keys[i]);
+    }
+
+    /* keep the remaining future keys and derive the missing ones */
+    const int kept = EPOCH_FUTURE_KEYS - skipped - 1;
+    memmove(co->epoch_future_keys, co->epoch_future_keys + skipped + 1,
+            kept * sizeof(co->epoch_future_keys[0]));
+    for (int i = kept; i < EPOCH_FUTURE_KEYS; i++)
+    {
+        if (co->epoch_key_recv.epoch == UINT16_MAX)
+        {
+            CLEAR(co->epoch_future_keys[i]);
+            continue;
+        }
+        epoch_key_iterate(&co->epoch_key_recv);
+        epoch_init_data_key(&co->epoch_future_keys[i], &co->epoch_key_recv,
+                            &co->epoch_key_type, OPENVPN_OP_DECRYPT);
+    }
+
+    /* the packet counter starts again in the new epoch */
+    const struct packet_id_rec *old = &co->epoch_retiring_pid_rec;
+    struct packet_id pid;
+    packet_id_init(&pid, old->seq_backtrack, old->time_backtrack, old->name,
+                   old->unit);
+    co->packet_id.rec = pid.rec;
+}
+
+void
+epoch_advance_keys(struct crypto_options *co, uint16_t send_epoch,
+                   uint16_t recv_epoch)
+{
+    while (co->key_ctx_bi.encrypt.epoch < send_epoch
+           && co->epoch_key_send.epoch < UINT16_MAX)
+    {
+        epoch_iterate_send_key(co);
+    }
+
+    const uint16_t *current = &co->key_ctx_bi.decrypt.epoch;
+    while (*current < recv_epoch
+           && epoch_lookup_decrypt_key(co, *current + 1))
+    {
+        epoch_replace_update_recv_key(co, *current + 1);
+    }
+}
@@ -0,0 +1,145 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef CRYPTO_EPOCH_H
+#define CRYPTO_EPOCH_H
+
+/**
+ * @file
+ * Epoch data keys for AEAD ciphers.
+ *
+ * Instead of using the key material of a TLS session for the whole
+ * lifetime of the session, each direction derives a chain of epoch keys
+ * from it with HKDF-Expand-Label (RFC 8446, with the label prefix "ovpn "):
+ *
+ *     E_1   = ExpandLabel(key material, "datakey upd")
+ *     E_n+1 = ExpandLabel(E_n, "datakey upd")
+ *
+ * The cipher key and the implicit IV of epoch n are derived from E_n with
+ * the labels "data_key" and "data_iv".  The sender moves on to the next
+ * epoch after \c EPOCH_KEY_PACKETS packets, which keeps every key well
+ * within the usage limits of AES-GCM, without the TLS renegotiation that
+ * a packet ID wrap would otherwise force.  The epoch is sent in the
+ * packet ID, see crypto.h for the packet format.
+ *
+ * The receiver keeps the keys of the next \c EPOCH_FUTURE_KEYS epochs
+ * ready and switches to one of them as soon as a packet decrypted with it
+ * has been authenticated.  The key of the previous epoch is kept for
+ * packets that were reordered around the epoch change.
+ */
+
+#include "crypto.h"
+
+/**
+ * Number of packets sent with the data key of one epoch.  This is the
+ * AES-GCM confidentiality limit QUIC uses for full-size packets.
+ */
+#define EPOCH_KEY_PACKETS (1 << 23)
+
+/**
+ * Send epoch from which on a renegotiation is triggered, so that the
+ * epoch never wraps during the lifetime of a TLS session.
+ */
+#define EPOCH_WRAP_TRIGGER 0xF000
+
+/**
+ * HKDF-Expand-Label with SHA256 as defined in RFC 8446, using "ovpn " as
+ * prefix of the label and an empty context.
+ *
+ * @param secret        The secret, \c SHA256_DIGEST_LENGTH bytes.
+ * @param label         The label without the "ovpn " prefix.
+ * @param out           Output buffer.
+ * @param out_len       Number of bytes to derive.
+ */
+void ovpn_expand_label(const uint8_t *secret, const char *label,
+                       uint8_t *out, uint16_t out_len);
+
+/**
+ * Replace an epoch key by the epoch key of the next epoch.
+ */
+void epoch_key_iterate(struct epoch_key *ek);
+
+/**
+ * Initialise the epoch data keys of a data channel.
+ *
+ * @param co            The crypto options to initialise.  The replay
+ *                      protection state in \c co->packet_id must already
+ *                      be initialised.
+ * @param kt            The AEAD cipher to use.
+ * @param send_secret   Key material of the sending direction.
+ * @param recv_secret   Key material of the receiving direction.
+ */
+void epoch_init_key_ctx(struct crypto_options *co, const struct key_type *kt,
+                        const struct key *send_secret,
+                        const struct key *recv_secret);
+
+/**
+ * Free the epoch data keys of a data channel, apart from the keys in
+ * \c co->key_ctx_bi.
+ */
+void free_epoch_key_ctx(struct crypto_options *co);
+
+/**
+ * Move the sending direction to the next epoch.
+ */
+void epoch_iterate_send_key(struct crypto_options *co);
+
+/**
+ * Look up the receive key of an epoch.
+ *
+ * @return the key, or NULL if the epoch is neither the current, the
+ *         previous nor one of the next \c EPOCH_FUTURE_KEYS epochs.
+ */
+const struct key_ctx *epoch_lookup_decrypt_key(const struct crypto_options *co,
+                                               uint16_t epoch);
+
+/**
+ * Make the key of a future epoch the current receive key, after a packet
+ * of this epoch has been authenticated.  The current key becomes the
+ * retiring key, the keys of skipped epochs are dropped, and the list of
+ * future keys is filled up again.
+ *
+ * @param co            The crypto options.
+ * @param epoch         The epoch, one of the future epochs.
+ */
+void epoch_replace_update_recv_key(struct crypto_options *co, uint16_t epoch);
+
+/**
+ * Move both directions of freshly initialised epoch keys forward to the
+ * given epochs, for a data channel taken over from another process.
+ */
+void epoch_advance_keys(struct crypto_options *co, uint16_t send_epoch,
+                        uint16_t recv_epoch);
+
+/**
+ * Returns true if the sending direction is close to running out of
+ * epochs and the TLS session should be renegotiated.
+ */
+static inline bool
+epoch_close_to_wrapping(const struct crypto_options *co)
+{
+    return (co->flags & CO_EPOCH_DATA_KEY_FORMAT)
+           && co->epoch_key_send.epoch >= EPOCH_WRAP_TRIGGER;
+}
+
+#endif /* CRYPTO_EPOCH_H */
@@ -43,11 +43,13 @@
 #include "otime.h"
 #include "misc.h"
 
+#include <mbedtls/aesni.h>
 #include <mbedtls/base64.h>
 #include <mbedtls/des.h>
 #include <mbedtls/error.h>
 #include <mbedtls/md5.h>
 #include <mbedtls/cipher.h>
+#include <mbedtls/padlock.h>
 #include <mbedtls/pem.h>
 
 #include <mbedtls/entropy.h>
@@ -136,6 +138,17 @@ mbed_log_func_line(unsigned int flags, int errval, const char *func,
 }
 
 
+void
+crypto_init_mem_accounting(void)
+{
+}
+
+bool
+crypto_mem_in_use(size_t *bytes)
+{
+    return false;
+}
+
 #ifdef DMALLOC
 void
 crypto_init_dmalloc(void)
@@ -228,6 +241,24 @@ show_available_engines(void)
            "available\n");
 }
 
+const char *
+crypto_aes_hw_accel(void)
+{
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+    if (mbedtls_aesni_has_support(MBEDTLS_AESNI_AES))
+    {
+        return "AES-NI";
+    }
+#endif
+#if defined(MBEDTLS_PADLOCK_C) && defined(MBEDTLS_HAVE_X86)
+    if (mbedtls_padlock_has_support(MBEDTLS_PADLOCK_ACE))
+    {
+        return "VIA PadLock";
+    }
+#endif
+    return NULL;
+}
+
 bool
 crypto_pem_encode(const char *name, struct buffer *dst,
                   const struct buffer *src, struct gc_arena *gc)
@@ -543,51 +574,110 @@ cipher_kt_mode_aead(const char *ciphername)
  *
  */
 
-mbedtls_cipher_context_t *
+cipher_ctx_t *
 cipher_ctx_new(void)
 {
-    mbedtls_cipher_context_t *ctx;
-    ALLOC_OBJ(ctx, mbedtls_cipher_context_t);
+    cipher_ctx_t *ctx;
+    ALLOC_OBJ_CLEAR(ctx, cipher_ctx_t);
     return ctx;
 }
 
 void
-cipher_ctx_free(mbedtls_cipher_context_t *ctx)
+cipher_ctx_free(cipher_ctx_t *ctx)
 {
-    mbedtls_cipher_free(ctx);
+    if (ctx->aead == OPENVPN_MODE_GCM)
+    {
+        mbedtls_gcm_free(&ctx->u.gcm);
+    }
+#ifdef MBEDTLS_CHACHAPOLY_C
+    else if (ctx->aead == MBEDTLS_MODE_CHACHAPOLY)
+    {
+        mbedtls_chachapoly_free(&ctx->u.chachapoly);
+    }
+#endif
+    else
+    {
+        mbedtls_cipher_free(&ctx->u.cipher);
+    }
     free(ctx);
 }
 
+/* Returns the AEAD mode to use a direct context for, or 0 */
+static int
+cipher_kt_direct_aead(const mbedtls_cipher_info_t *kt)
+{
+    switch (kt->type)
+    {
+        case MBEDTLS_CIPHER_AES_128_GCM:
+        case MBEDTLS_CIPHER_AES_192_GCM:
+        case MBEDTLS_CIPHER_AES_256_GCM:
+            return OPENVPN_MODE_GCM;
+
+#ifdef MBEDTLS_CHACHAPOLY_C
+        case MBEDTLS_CIPHER_CHACHA20_POLY1305:
+            return MBEDTLS_MODE_CHACHAPOLY;
+
+#endif
+        default:
+            return 0;
+    }
+}
+
 void
-cipher_ctx_init(mbedtls_cipher_context_t *ctx, const uint8_t *key,
+cipher_ctx_init(cipher_ctx_t *ctx, const uint8_t *key,
                 const char *ciphername, const mbedtls_operation_t operation)
 {
     ASSERT(NULL != ciphername && NULL != ctx);
     CLEAR(*ctx);
 
     const mbedtls_cipher_info_t *kt = cipher_get(ciphername);
+    ASSERT(kt);
     int key_len = kt->key_bitlen/8;
 
-    ASSERT(kt);
+    ctx->kt = kt;
+    ctx->operation = operation;
+    ctx->aead = cipher_kt_direct_aead(kt);
+
+    if (ctx->aead == OPENVPN_MODE_GCM)
+    {
+        mbedtls_gcm_init(&ctx->u.gcm);
+        if (!mbed_ok(mbedtls_gcm_setkey(&ctx->u.gcm, MBEDTLS_CIPHER_ID_AES,
+                                        key, kt->key_bitlen)))
+        {
+            msg(M_FATAL, "mbed TLS GCM set key");
+        }
+        return;
+    }
+#ifdef MBEDTLS_CHACHAPOLY_C
+    if (ctx->aead == MBEDTLS_MODE_CHACHAPOLY)
+    {
+        mbedtls_chachapoly_init(&ctx->u.chachapoly);
+        if (!mbed_ok(mbedtls_chachapoly_setkey(&ctx->u.chachapoly, key)))
+        {
+            msg(M_FATAL, "mbed TLS ChaCha20-Poly1305 set key");
+        }
+        return;
+    }
+#endif
 
-    if (!mbed_ok(mbedtls_cipher_setup(ctx, kt)))
+    if (!mbed_ok(mbedtls_cipher_setup(&ctx->u.cipher, kt)))
     {
         msg(M_FATAL, "mbed TLS cipher context init #1");
     }
 
-    if (!mbed_ok(mbedtls_cipher_setkey(ctx, key, key_len*8, operation)))
+    if (!mbed_ok(mbedtls_cipher_setkey(&ctx->u.cipher, key, key_len*8, operation)))
     {
         msg(M_FATAL, "mbed TLS cipher set key");
     }
 
     /* make sure we used a big enough key */
-    ASSERT(ctx->key_bitlen <= key_len*8);
+    ASSERT(ctx->u.cipher.key_bitlen <= key_len*8);
 }
 
 int
-cipher_ctx_iv_length(const mbedtls_cipher_context_t *ctx)
+cipher_ctx_iv_length(const cipher_ctx_t *ctx)
 {
-    return mbedtls_cipher_get_iv_size(ctx);
+    return ctx->kt->iv_size;
 }
 
 int
@@ -598,7 +688,17 @@ cipher_ctx_get_tag(cipher_ctx_t *ctx, uint8_t *tag, int tag_len)
         return 0;
     }
 
-    if (!mbed_ok(mbedtls_cipher_write_tag(ctx, (unsigned char *) tag, tag_len)))
+    if (ctx->aead)
+    {
+        if (tag_len > sizeof(ctx->tag))
+        {
+            return 0;
+        }
+        memcpy(tag, ctx->tag, tag_len);
+        return 1;
+    }
+
+    if (!mbed_ok(mbedtls_cipher_write_tag(&ctx->u.cipher, (unsigned char *) tag, tag_len)))
     {
         return 0;
     }
@@ -607,17 +707,17 @@ cipher_ctx_get_tag(cipher_ctx_t *ctx, uint8_t *tag, int tag_len)
 }
 
 int
-cipher_ctx_block_size(const mbedtls_cipher_context_t *ctx)
+cipher_ctx_block_size(const cipher_ctx_t *ctx)
 {
-    return mbedtls_cipher_get_block_size(ctx);
+    return ctx->kt->block_size;
 }
 
 int
-cipher_ctx_mode(const mbedtls_cipher_context_t *ctx)
+cipher_ctx_mode(const cipher_ctx_t *ctx)
 {
     ASSERT(NULL != ctx);
 
-    return cipher_kt_mode(ctx->cipher_info);
+    return cipher_kt_mode(ctx->kt);
 }
 
 bool
@@ -645,14 +745,22 @@ cipher_ctx_mode_aead(const cipher_ctx_t *ctx)
 }
 
 int
-cipher_ctx_reset(mbedtls_cipher_context_t *ctx, const uint8_t *iv_buf)
+cipher_ctx_reset(cipher_ctx_t *ctx, const uint8_t *iv_buf)
 {
-    if (!mbed_ok(mbedtls_cipher_reset(ctx)))
+    if (ctx->aead)
+    {
+        /* GCM takes the IV together with the additional data */
+        memcpy(ctx->iv, iv_buf, ctx->kt->iv_size);
+        ctx->started = false;
+        return 1;
+    }
+
+    if (!mbed_ok(mbedtls_cipher_reset(&ctx->u.cipher)))
     {
         return 0;
     }
 
-    if (!mbed_ok(mbedtls_cipher_set_iv(ctx, iv_buf, ctx->cipher_info->iv_size)))
+    if (!mbed_ok(mbedtls_cipher_set_iv(&ctx->u.cipher, iv_buf, ctx->kt->iv_size)))
     {
         return 0;
     }
@@ -660,6 +768,36 @@ cipher_ctx_reset(mbedtls_cipher_context_t *ctx, const uint8_t *iv_buf)
     return 1;
 }
 
+/* Start the operation of a direct AEAD context, with the additional data */
+static bool
+cipher_ctx_aead_start(cipher_ctx_t *ctx, const uint8_t *ad, size_t ad_len)
+{
+    int ret = MBEDTLS_ERR_CIPHER_FEATURE_UNAVAILABLE;
+
+    if (ctx->aead == OPENVPN_MODE_GCM)
+    {
+        const int mode = ctx->operation == MBEDTLS_ENCRYPT
+                         ? MBEDTLS_GCM_ENCRYPT : MBEDTLS_GCM_DECRYPT;
+        ret = mbedtls_gcm_starts(&ctx->u.gcm, mode, ctx->iv, ctx->kt->iv_size,
+                                 ad, ad_len);
+    }
+#ifdef MBEDTLS_CHACHAPOLY_C
+    else
+    {
+        const mbedtls_chachapoly_mode_t mode = ctx->operation == MBEDTLS_ENCRYPT
+                                               ? MBEDTLS_CHACHAPOLY_ENCRYPT
+                                               : MBEDTLS_CHACHAPOLY_DECRYPT;
+        ret = mbedtls_chachapoly_starts(&ctx->u.chachapoly, ctx->iv, mode);
+        if (ret == 0 && ad_len)
+        {
+            ret = mbedtls_chachapoly_update_aad(&ctx->u.chachapoly, ad, ad_len);
+        }
+    }
+#endif
+    ctx->started = (ret == 0);
+    return mbed_ok(ret);
+}
+
 int
 cipher_ctx_update_ad(cipher_ctx_t *ctx, const uint8_t *src, int src_len)
 {
@@ -668,7 +806,13 @@ cipher_ctx_update_ad(cipher_ctx_t *ctx, const uint8_t *src, int src_len)
         return 0;
     }
 
-    if (!mbed_ok(mbedtls_cipher_update_ad(ctx, src, src_len)))
+    if (ctx->aead)
+    {
+        /* the direct contexts take all additional data at once */
+        return !ctx->started && cipher_ctx_aead_start(ctx, src, src_len);
+    }
+
+    if (!mbed_ok(mbedtls_cipher_update_ad(&ctx->u.cipher, src, src_len)))
     {
         return 0;
     }
@@ -677,12 +821,39 @@ cipher_ctx_update_ad(cipher_ctx_t *ctx, const uint8_t *src, int src_len)
 }
 
 int
-cipher_ctx_update(mbedtls_cipher_context_t *ctx, uint8_t *dst,
+cipher_ctx_update(cipher_ctx_t *ctx, uint8_t *dst,
                   int *dst_len, uint8_t *src, int src_len)
 {
+    if (ctx->aead)
+    {
+        int ret = MBEDTLS_ERR_CIPHER_FEATURE_UNAVAILABLE;
+
+        if (!ctx->started && !cipher_ctx_aead_start(ctx, NULL, 0))
+        {
+            return 0;
+        }
+        if (ctx->aead == OPENVPN_MODE_GCM)
+        {
+            ret = mbedtls_gcm_update(&ctx->u.gcm, (size_t) src_len, src, dst);
+        }
+#ifdef MBEDTLS_CHACHAPOLY_C
+        else
+        {
+            ret = mbedtls_chachapoly_update(&ctx->u.chachapoly, (size_t) src_len,
+                                            src, dst);
+        }
+#endif
+        if (!mbed_ok(ret))
+        {
+            return 0;
+        }
+        *dst_len = src_len;
+        return 1;
+    }
+
     size_t s_dst_len = *dst_len;
 
-    if (!mbed_ok(mbedtls_cipher_update(ctx, src, (size_t) src_len, dst,
+    if (!mbed_ok(mbedtls_cipher_update(&ctx->u.cipher, src, (size_t) src_len, dst,
                                        &s_dst_len)))
     {
         return 0;
@@ -693,12 +864,43 @@ cipher_ctx_update(mbedtls_cipher_context_t *ctx, uint8_t *dst,
     return 1;
 }
 
+/* Finish the operation of a direct AEAD context and keep the tag */
+static bool
+cipher_ctx_aead_finish(cipher_ctx_t *ctx)
+{
+    int ret = MBEDTLS_ERR_CIPHER_FEATURE_UNAVAILABLE;
+
+    if (!ctx->started && !cipher_ctx_aead_start(ctx, NULL, 0))
+    {
+        return false;
+    }
+    ctx->started = false;
+
+    if (ctx->aead == OPENVPN_MODE_GCM)
+    {
+        ret = mbedtls_gcm_finish(&ctx->u.gcm, ctx->tag, sizeof(ctx->tag));
+    }
+#ifdef MBEDTLS_CHACHAPOLY_C
+    else
+    {
+        ret = mbedtls_chachapoly_finish(&ctx->u.chachapoly, ctx->tag);
+    }
+#endif
+    return mbed_ok(ret);
+}
+
 int
-cipher_ctx_final(mbedtls_cipher_context_t *ctx, uint8_t *dst, int *dst_len)
+cipher_ctx_final(cipher_ctx_t *ctx, uint8_t *dst, int *dst_len)
 {
+    if (ctx->aead)
+    {
+        *dst_len = 0;
+        return cipher_ctx_aead_finish(ctx);
+    }
+
     size_t s_dst_len = *dst_len;
 
-    if (!mbed_ok(mbedtls_cipher_finish(ctx, dst, &s_dst_len)))
+    if (!mbed_ok(mbedtls_cipher_finish(&ctx->u.cipher, dst, &s_dst_len)))
     {
         return 0;
     }
@@ -709,7 +911,7 @@ cipher_ctx_final(mbedtls_cipher_context_t *ctx, uint8_t *dst, int *dst_len)
 }
 
 int
-cipher_ctx_final_check_tag(mbedtls_cipher_context_t *ctx, uint8_t *dst,
+cipher_ctx_final_check_tag(cipher_ctx_t *ctx, uint8_t *dst,
                            int *dst_len, uint8_t *tag, size_t tag_len)
 {
     size_t olen = 0;
@@ -724,7 +926,18 @@ cipher_ctx_final_check_tag(mbedtls_cipher_context_t *ctx, uint8_t *dst,
         return 0;
     }
 
-    if (!mbed_ok(mbedtls_cipher_finish(ctx, dst, &olen)))
+    if (ctx->aead)
+    {
+        *dst_len = 0;
+        if (tag_len > sizeof(ctx->tag) || !cipher_ctx_aead_finish(ctx))
+        {
+            msg(D_CRYPT_ERRORS, "%s: cipher_ctx_final() failed", __func__);
+            return 0;
+        }
+        return memcmp_constant_time(ctx->tag, tag, tag_len) == 0;
+    }
+
+    if (!mbed_ok(mbedtls_cipher_finish(&ctx->u.cipher, dst, &olen)))
     {
         msg(D_CRYPT_ERRORS, "%s: cipher_ctx_final() failed", __func__);
         return 0;
@@ -736,7 +949,7 @@ cipher_ctx_final_check_tag(mbedtls_cipher_context_t *ctx, uint8_t *dst,
     }
     *dst_len = olen;
 
-    if (!mbed_ok(mbedtls_cipher_check_tag(ctx, (const unsigned char *) tag,
+    if (!mbed_ok(mbedtls_cipher_check_tag(&ctx->u.cipher, (const unsigned char *) tag,
                                           tag_len)))
     {
         return 0;
@@ -32,12 +32,37 @@
 #include <mbedtls/cipher.h>
 #include <mbedtls/md.h>
 #include <mbedtls/ctr_drbg.h>
+#include <mbedtls/gcm.h>
+#ifdef MBEDTLS_CHACHAPOLY_C
+#include <mbedtls/chachapoly.h>
+#endif
 
 /** Generic message digest key type %context. */
 typedef mbedtls_md_info_t md_kt_t;
 
-/** Generic cipher %context. */
-typedef mbedtls_cipher_context_t cipher_ctx_t;
+/**
+ * Cipher %context.  AES-GCM and ChaCha20-Poly1305, the data channel
+ * ciphers, use their mbed TLS contexts directly, which saves the
+ * dispatch of the generic cipher API on every packet.  All other
+ * ciphers go through the generic API.
+ */
+typedef struct cipher_ctx
+{
+    const mbedtls_cipher_info_t *kt;
+    mbedtls_operation_t operation;
+    int aead;                   /**< OPENVPN_MODE_GCM or MBEDTLS_MODE_CHACHAPOLY
+                                 *   if a direct context is used, else 0 */
+    bool started;               /**< AEAD operation started for this IV */
+    union {
+        mbedtls_cipher_context_t cipher;
+        mbedtls_gcm_context gcm;
+#ifdef MBEDTLS_CHACHAPOLY_C
+        mbedtls_chachapoly_context chachapoly;
+#endif
+    } u;
+    unsigned char iv[MBEDTLS_MAX_IV_LENGTH];
+    unsigned char tag[16];      /**< tag of the last AEAD operation */
+} cipher_ctx_t;
 
 /** Generic message digest %context. */
 typedef mbedtls_md_context_t md_ctx_t;
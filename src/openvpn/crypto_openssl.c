@@ -49,10 +49,20 @@
 #include <openssl/rand.h>
 #include <openssl/ssl.h>
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <cpuid.h>
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#elif (defined(__aarch64__) || defined(__arm__)) \
+    && (defined(TARGET_LINUX) || defined(TARGET_ANDROID))
+#include <sys/auxv.h>
+#endif
+
 #if (OPENSSL_VERSION_NUMBER >= 0x10100000L) && !defined(LIBRESSL_VERSION_NUMBER)
 #include <openssl/kdf.h>
 #endif
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+#include <openssl/core_names.h>
 #include <openssl/provider.h>
 #endif
 
@@ -155,10 +165,41 @@ crypto_init_lib_engine(const char *engine_name)
 #endif
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+/*
+ * EVP_CIPHER_fetch() searches the method store of the providers each time,
+ * and setting up the data channel keys after a renegotiation needs several
+ * lookups of the same cipher.  Keep the ciphers looked up most recently.
+ * The cache is flushed whenever a provider is loaded or unloaded.
+ */
+#define CIPHER_CACHE_SIZE 8
+
+static struct
+{
+    char *name;
+    EVP_CIPHER *cipher;
+} cipher_cache[CIPHER_CACHE_SIZE]; /* GLOBAL */
+static int cipher_cache_next;      /* GLOBAL */
+
+static void
+cipher_cache_flush(void)
+{
+    for (int i = 0; i < CIPHER_CACHE_SIZE; i++)
+    {
+        free(cipher_cache[i].name);
+        EVP_CIPHER_free(cipher_cache[i].cipher);
+    }
+    CLEAR(cipher_cache);
+    cipher_cache_next = 0;
+}
+#endif /* OPENSSL_VERSION_NUMBER >= 0x30000000L */
+
 provider_t *
 crypto_load_provider(const char *provider)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    cipher_cache_flush();
+
     /* Load providers into the default (NULL) library context */
     OSSL_PROVIDER *prov = OSSL_PROVIDER_load(NULL, provider);
     if (!prov)
@@ -176,6 +217,7 @@ void
 crypto_unload_provider(const char *provname, provider_t *provider)
 {
 #if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    cipher_cache_flush();
     if (!OSSL_PROVIDER_unload(provider))
     {
         crypto_msg(M_FATAL, "failed to unload provider '%s'", provname);
@@ -211,6 +253,10 @@ crypto_init_lib(void)
 void
 crypto_uninit_lib(void)
 {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    cipher_cache_flush();
+#endif
+
 #ifdef CRYPTO_MDEBUG
     FILE *fp = fopen("sdlog", "w");
     ASSERT(fp);
@@ -316,6 +362,94 @@ crypto_init_dmalloc(void)
 }
 #endif /* DMALLOC */
 
+/*
+ * OpenSSL memory accounting: a header in front of each allocation keeps
+ * its size, so that the memory in use can be tracked on free and
+ * realloc.  OpenSSL is only used by the main thread.
+ */
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L && !defined(LIBRESSL_VERSION_NUMBER) \
+    && !defined(ENABLE_CRYPTO_WOLFSSL) && !defined(DMALLOC)
+#define CRYPTO_MEM_ACCOUNTING
+
+/* keeps the memory returned to OpenSSL aligned like malloc() does */
+#define CRYPTO_MEM_HEADER 16
+
+static bool crypto_mem_accounting;    /* GLOBAL */
+static size_t crypto_mem_bytes;       /* GLOBAL */
+
+static void *
+crypto_counting_malloc(size_t size, const char *file, int line)
+{
+    size_t *p = malloc(CRYPTO_MEM_HEADER + size);
+    if (!p)
+    {
+        return NULL;
+    }
+    *p = size;
+    crypto_mem_bytes += size;
+    return (uint8_t *) p + CRYPTO_MEM_HEADER;
+}
+
+static void
+crypto_counting_free(void *ptr, const char *file, int line)
+{
+    if (ptr)
+    {
+        size_t *p = (size_t *) ((uint8_t *) ptr - CRYPTO_MEM_HEADER);
+        crypto_mem_bytes -= *p;
+        free(p);
+    }
+}
+
+static void *
+crypto_counting_realloc(void *ptr, size_t size, const char *file, int line)
+{
+    if (!ptr)
+    {
+        return crypto_counting_malloc(size, file, line);
+    }
+    if (!size)
+    {
+        crypto_counting_free(ptr, file, line);
+        return NULL;
+    }
+
+    size_t *p = (size_t *) ((uint8_t *) ptr - CRYPTO_MEM_HEADER);
+    const size_t old_size = *p;
+    p = realloc(p, CRYPTO_MEM_HEADER + size);
+    if (!p)
+    {
+        return NULL;
+    }
+    *p = size;
+    crypto_mem_bytes += size - old_size;
+    return (uint8_t *) p + CRYPTO_MEM_HEADER;
+}
+#endif /* if OPENSSL_VERSION_NUMBER >= 0x10100000L ... */
+
+void
+crypto_init_mem_accounting(void)
+{
+#ifdef CRYPTO_MEM_ACCOUNTING
+    crypto_mem_accounting = CRYPTO_set_mem_functions(crypto_counting_malloc,
+                                                     crypto_counting_realloc,
+                                                     crypto_counting_free);
+#endif
+}
+
+bool
+crypto_mem_in_use(size_t *bytes)
+{
+#ifdef CRYPTO_MEM_ACCOUNTING
+    if (crypto_mem_accounting)
+    {
+        *bytes = crypto_mem_bytes;
+        return true;
+    }
+#endif
+    return false;
+}
+
 const cipher_name_pair cipher_name_translation_table[] = {
     { "AES-128-GCM", "id-aes128-GCM" },
     { "AES-192-GCM", "id-aes192-GCM" },
@@ -476,6 +610,48 @@ show_available_engines(void)
 #endif
 }
 
+/*
+ * OpenSSL uses the AES instructions of the CPU whenever there are any,
+ * so ask the CPU.
+ */
+const char *
+crypto_aes_hw_accel(void)
+{
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_AES))
+    {
+        return "AES-NI";
+    }
+#elif defined(_M_X64) || defined(_M_IX86)
+    int info[4];
+    __cpuid(info, 1);
+    if (info[2] & (1 << 25))
+    {
+        return "AES-NI";
+    }
+#elif defined(_M_ARM64)
+    if (IsProcessorFeaturePresent(PF_ARM_V8_CRYPTO_INSTRUCTIONS_AVAILABLE))
+    {
+        return "ARMv8 crypto extensions";
+    }
+#elif defined(__aarch64__) && defined(TARGET_DARWIN)
+    /* every 64-bit Apple CPU has them */
+    return "ARMv8 crypto extensions";
+#elif defined(__aarch64__) && defined(HWCAP_AES)
+    if (getauxval(AT_HWCAP) & HWCAP_AES)
+    {
+        return "ARMv8 crypto extensions";
+    }
+#elif defined(__arm__) && defined(HWCAP2_AES)
+    if (getauxval(AT_HWCAP2) & HWCAP2_AES)
+    {
+        return "ARMv8 crypto extensions";
+    }
+#endif
+    return NULL;
+}
+
 
 bool
 crypto_pem_encode(const char *name, struct buffer *dst,
@@ -589,8 +765,33 @@ cipher_get(const char *ciphername)
 {
     ASSERT(ciphername);
 
-    ciphername = translate_cipher_name_from_openvpn(ciphername);
-    return EVP_CIPHER_fetch(NULL, ciphername, NULL);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    for (int i = 0; i < CIPHER_CACHE_SIZE && cipher_cache[i].name; i++)
+    {
+        if (strcmp(cipher_cache[i].name, ciphername) == 0)
+        {
+            EVP_CIPHER_up_ref(cipher_cache[i].cipher);
+            return cipher_cache[i].cipher;
+        }
+    }
+#endif
+
+    evp_cipher_type *cipher =
+        EVP_CIPHER_fetch(NULL, translate_cipher_name_from_openvpn(ciphername), NULL);
+
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    if (cipher)
+    {
+        /* replace the oldest entry, the cache keeps its own reference */
+        free(cipher_cache[cipher_cache_next].name);
+        EVP_CIPHER_free(cipher_cache[cipher_cache_next].cipher);
+        cipher_cache[cipher_cache_next].name = string_alloc(ciphername, NULL);
+        cipher_cache[cipher_cache_next].cipher = cipher;
+        EVP_CIPHER_up_ref(cipher);
+        cipher_cache_next = (cipher_cache_next + 1) % CIPHER_CACHE_SIZE;
+    }
+#endif
+    return cipher;
 }
 
 bool
@@ -708,7 +909,7 @@ cipher_kt_block_size(const char *ciphername)
 
     strcpy(mode_str, "-CBC");
 
-    cbc_cipher = EVP_CIPHER_fetch(NULL, translate_cipher_name_from_openvpn(name), NULL);
+    cbc_cipher = cipher_get(name);
     if (cbc_cipher)
     {
         block_size = EVP_CIPHER_block_size(cbc_cipher);
@@ -868,7 +1069,18 @@ cipher_ctx_iv_length(const EVP_CIPHER_CTX *ctx)
 int
 cipher_ctx_get_tag(EVP_CIPHER_CTX *ctx, uint8_t *tag_buf, int tag_size)
 {
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    /* EVP_CIPHER_CTX_ctrl() would translate the control into this
+     * parameter for every packet, so pass the parameter directly */
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_CIPHER_PARAM_AEAD_TAG,
+                                          tag_buf, tag_size),
+        OSSL_PARAM_construct_end()
+    };
+    return EVP_CIPHER_CTX_get_params(ctx, params);
+#else
     return EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, tag_size, tag_buf);
+#endif
 }
 
 int
@@ -980,7 +1192,17 @@ cipher_ctx_final_check_tag(EVP_CIPHER_CTX *ctx, uint8_t *dst, int *dst_len,
                            uint8_t *tag, size_t tag_len)
 {
     ASSERT(tag_len < SIZE_MAX);
+#if OPENSSL_VERSION_NUMBER >= 0x30000000L
+    /* see cipher_ctx_get_tag() */
+    OSSL_PARAM params[] = {
+        OSSL_PARAM_construct_octet_string(OSSL_CIPHER_PARAM_AEAD_TAG,
+                                          tag, tag_len),
+        OSSL_PARAM_construct_end()
+    };
+    if (!EVP_CIPHER_CTX_set_params(ctx, params))
+#else
     if (!EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, tag_len, tag))
+#endif
     {
         return 0;
     }
@@ -317,6 +317,36 @@ dco_check_startup_option(int msglevel, const struct options *o)
         }
     }
 
+    if (o->n_listen_extra)
+    {
+        msg(msglevel, "Note: --listen-extra is set. Disabling data channel offload.");
+        return false;
+    }
+
+    if (o->pmtu_probe)
+    {
+        msg(msglevel, "Note: --pmtu-probe is set. Disabling data channel offload.");
+        return false;
+    }
+
+    if (o->bench_load_clients)
+    {
+        msg(msglevel, "Note: --bench-load is set. Disabling data channel offload.");
+        return false;
+    }
+
+    if (o->fec)
+    {
+        msg(msglevel, "Note: --fec is set. Disabling data channel offload.");
+        return false;
+    }
+
+    if (o->n_multipath)
+    {
+        msg(msglevel, "Note: --multipath is set. Disabling data channel offload.");
+        return false;
+    }
+
 #if defined(_WIN32)
     if (o->mode == MODE_SERVER)
     {
@@ -396,8 +426,33 @@ dco_check_startup_option(int msglevel, const struct options *o)
 bool
 dco_check_option(int msglevel, const struct options *o)
 {
+    /* With --dco-reject-incompatible only the cipher negotiated with a
+     * client has to be supported, multi_client_setup_dco_initial()
+     * checks it for each client */
+    const bool per_client = o->mode == MODE_SERVER && o->dco_reject_incompatible;
+
+#ifdef ENABLE_DEBUG
+    if (gremlin_impair_defined(&o->gremlin_impair))
+    {
+        msg(msglevel, "Note: --gremlin-impair disables data channel offload.");
+        return false;
+    }
+#endif
+
+    if (o->acl)
+    {
+        msg(msglevel, "Note: --acl disables data channel offload.");
+        return false;
+    }
+
+    if (o->handoff)
+    {
+        msg(msglevel, "Note: --handoff disables data channel offload.");
+        return false;
+    }
+
     /* At this point the ciphers have already been normalised */
-    if (o->enable_ncp_fallback
+    if (o->enable_ncp_fallback && !per_client
         && !tls_item_in_cipher_list(o->ciphername, dco_get_supported_ciphers()))
     {
         msg(msglevel, "Note: --data-cipher-fallback with cipher '%s' "
@@ -425,9 +480,14 @@ dco_check_option(int msglevel, const struct options *o)
     struct gc_arena gc = gc_new();
     char *tmp_ciphers = string_alloc(o->ncp_ciphers, &gc);
     const char *token;
+    bool supported = false;
     while ((token = strsep(&tmp_ciphers, ":")))
     {
-        if (!tls_item_in_cipher_list(token, dco_get_supported_ciphers()))
+        if (tls_item_in_cipher_list(token, dco_get_supported_ciphers()))
+        {
+            supported = true;
+        }
+        else if (!per_client)
         {
             msg(msglevel, "Note: cipher '%s' in --data-ciphers is not supported "
                 "by ovpn-dco, disabling data channel offload.", token);
@@ -437,6 +497,13 @@ dco_check_option(int msglevel, const struct options *o)
     }
     gc_free(&gc);
 
+    if (!supported)
+    {
+        msg(msglevel, "Note: no cipher in --data-ciphers is supported by "
+            "ovpn-dco, disabling data channel offload.");
+        return false;
+    }
+
     return true;
 }
 
@@ -152,6 +152,9 @@ close_fd(dco_context_t *dco)
     close(dco->pipefd[0]);
     close(dco->pipefd[1]);
     close(dco->fd);
+    free(dco->stats_buf);
+    dco->stats_buf = NULL;
+    dco->stats_buf_size = 0;
 }
 
 bool
@@ -327,6 +330,9 @@ dco_del_peer(dco_context_t *dco, unsigned int peerid)
         msg(M_WARN | M_ERRNO, "Failed to delete peer");
     }
 
+    /* the interface stops with its last peer */
+    dco->started = false;
+
     free(drv.ifd_data);
     nvlist_destroy(nvl);
 
@@ -385,12 +391,21 @@ key_to_nvlist(const uint8_t *key, const uint8_t *implicit_iv, const char *cipher
     return (nvl);
 }
 
+/*
+ * Bring the interface up.  Only needed for the first key after it had
+ * no peers, not for every key of a rekey.
+ */
 static int
 start_tun(dco_context_t *dco)
 {
     struct ifdrv drv;
     int ret;
 
+    if (dco->started)
+    {
+        return 0;
+    }
+
     CLEAR(drv);
     snprintf(drv.ifd_name, IFNAMSIZ, "%s", dco->ifname);
     drv.ifd_cmd = OVPN_START_VPN;
@@ -400,6 +415,7 @@ start_tun(dco_context_t *dco)
     {
         msg(M_ERR | M_ERRNO, "Failed to start vpn");
     }
+    dco->started = (ret == 0);
 
     return ret;
 }
@@ -546,6 +562,7 @@ dco_do_read(dco_context_t *dco)
             }
 
             dco->dco_message_type = OVPN_CMD_DEL_PEER;
+            dco->started = false;
             break;
 
         case OVPN_NOTIF_ROTATE_KEY:
@@ -681,57 +698,101 @@ static void
 dco_update_peer_stat(struct multi_context *m, uint32_t peerid, const nvlist_t *nvl)
 {
 
-    if (peerid >= m->max_clients || !m->instances[peerid])
+    struct multi_instance *mi = multi_peer_id_lookup(m, peerid);
+    if (!mi)
     {
         msg(M_WARN, "dco_update_peer_stat: invalid peer ID %d returned by kernel", peerid);
         return;
     }
 
-    struct multi_instance *mi = m->instances[peerid];
-
     mi->context.c2.dco_read_bytes = nvlist_get_number(nvl, "in");
     mi->context.c2.dco_write_bytes = nvlist_get_number(nvl, "out");
 }
 
-int
-dco_get_peer_stats_multi(dco_context_t *dco, struct multi_context *m)
-{
+/* first size of the stats reply buffer, which grows with the peers */
+#define DCO_STATS_BUF_SIZE 4096
 
+/*
+ * The kernel only reports the statistics of all peers at once.  Returns
+ * the unpacked reply, which the caller has to destroy, or NULL.
+ *
+ * The reply buffer is kept in dco and doubled when the kernel has more
+ * to report than fits, so a server with thousands of peers gets their
+ * statistics with one ioctl per call, once the buffer has grown.
+ */
+static nvlist_t *
+dco_get_all_peer_stats(dco_context_t *dco)
+{
     struct ifdrv drv;
-    uint8_t buf[4096];
     nvlist_t *nvl;
-    const nvlist_t *const *nvpeers;
-    size_t npeers;
     int ret;
 
-    if (!dco || !dco->open)
+    if (!dco->stats_buf)
     {
-        return 0;
+        dco->stats_buf_size = DCO_STATS_BUF_SIZE;
+        dco->stats_buf = malloc(dco->stats_buf_size);
+        check_malloc_return(dco->stats_buf);
     }
 
-    CLEAR(drv);
-    snprintf(drv.ifd_name, IFNAMSIZ, "%s", dco->ifname);
-    drv.ifd_cmd = OVPN_GET_PEER_STATS;
-    drv.ifd_len = sizeof(buf);
-    drv.ifd_data = buf;
+    while (true)
+    {
+        CLEAR(drv);
+        snprintf(drv.ifd_name, IFNAMSIZ, "%s", dco->ifname);
+        drv.ifd_cmd = OVPN_GET_PEER_STATS;
+        drv.ifd_len = dco->stats_buf_size;
+        drv.ifd_data = dco->stats_buf;
+
+        ret = ioctl(dco->fd, SIOCGDRVSPEC, &drv);
+        if (ret == 0 || errno != ENOSPC)
+        {
+            break;
+        }
+
+        free(dco->stats_buf);
+        dco->stats_buf_size *= 2;
+        dco->stats_buf = malloc(dco->stats_buf_size);
+        check_malloc_return(dco->stats_buf);
+        msg(D_DCO_DEBUG, "%s: reply buffer grown to %zu bytes", __func__,
+            dco->stats_buf_size);
+    }
 
-    ret = ioctl(dco->fd, SIOCGDRVSPEC, &drv);
     if (ret)
     {
         msg(M_WARN | M_ERRNO, "Failed to get peer stats");
-        return -EINVAL;
+        return NULL;
     }
 
-    nvl = nvlist_unpack(buf, drv.ifd_len, 0);
+    nvl = nvlist_unpack(dco->stats_buf, drv.ifd_len, 0);
     if (!nvl)
     {
         msg(M_WARN, "Failed to unpack nvlist");
+        return NULL;
+    }
+
+    return nvl;
+}
+
+int
+dco_get_peer_stats_multi(dco_context_t *dco, struct multi_context *m)
+{
+    const nvlist_t *const *nvpeers;
+    size_t npeers;
+
+    if (!dco || !dco->open)
+    {
+        return 0;
+    }
+
+    nvlist_t *nvl = dco_get_all_peer_stats(dco);
+    if (!nvl)
+    {
         return -EINVAL;
     }
 
     if (!nvlist_exists_nvlist_array(nvl, "peers"))
     {
         /* no peers */
+        nvlist_destroy(nvl);
         return 0;
     }
 
@@ -744,13 +805,46 @@ dco_get_peer_stats_multi(dco_context_t *dco, struct multi_context *m)
         dco_update_peer_stat(m, peerid, nvlist_get_nvlist(peer, "bytes"));
     }
 
+    nvlist_destroy(nvl);
     return 0;
 }
 
 int
 dco_get_peer_stats(struct context *c)
 {
-    /* Not implemented. */
+    const nvlist_t *const *nvpeers;
+    size_t npeers;
+
+    if (!c->c1.tuntap || !c->c1.tuntap->dco.open)
+    {
+        return 0;
+    }
+
+    nvlist_t *nvl = dco_get_all_peer_stats(&c->c1.tuntap->dco);
+    if (!nvl)
+    {
+        return -EINVAL;
+    }
+
+    if (nvlist_exists_nvlist_array(nvl, "peers"))
+    {
+        nvpeers = nvlist_get_nvlist_array(nvl, "peers", &npeers);
+        for (size_t i = 0; i < npeers; i++)
+        {
+            const nvlist_t *peer = nvpeers[i];
+            uint32_t peerid = nvlist_get_number(peer, "peerid");
+
+            if ((int) peerid == c->c2.tls_multi->dco_peer_id)
+            {
+                const nvlist_t *bytes = nvlist_get_nvlist(peer, "bytes");
+                c->c2.dco_read_bytes = nvlist_get_number(bytes, "in");
+                c->c2.dco_write_bytes = nvlist_get_number(bytes, "out");
+                break;
+            }
+        }
+    }
+
+    nvlist_destroy(nvl);
     return 0;
 }
 
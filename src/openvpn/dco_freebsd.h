@@ -52,6 +52,10 @@ typedef struct dco_context {
 
     char ifname[IFNAMSIZ];
 
+    bool started;               /* OVPN_START_VPN done since the last peer went */
+    uint8_t *stats_buf;         /* reply buffer of OVPN_GET_PEER_STATS */
+    size_t stats_buf_size;
+
     int dco_message_type;
     int dco_message_peer_id;
     int dco_del_peer_reason;
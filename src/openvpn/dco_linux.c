@@ -175,6 +175,9 @@ static int
 ovpn_nl_msg_send(dco_context_t *dco, struct nl_msg *nl_msg, ovpn_nl_cb cb,
                  void *cb_arg, const char *prefix)
 {
+    /* queued key operations must reach the kernel first */
+    dco_batch_flush(dco);
+
     dco->status = 1;
 
     nl_cb_set(dco->nl_cb, NL_CB_VALID, NL_CB_CUSTOM, cb, cb_arg);
@@ -336,6 +339,179 @@ ovpn_nl_cb_error(struct sockaddr_nl (*nla) __attribute__ ((unused)),
     return NL_STOP;
 }
 
+static struct dco_batch_op *
+dco_batch_find(dco_context_t *dco, uint32_t seq)
+{
+    for (int i = 0; i < dco->batch_len; i++)
+    {
+        if (nlmsg_hdr(dco->batch[i].nl_msg)->nlmsg_seq == seq)
+        {
+            return &dco->batch[i];
+        }
+    }
+    return NULL;
+}
+
+static int
+ovpn_nl_cb_batch_ack(struct nl_msg *msg, void *arg)
+{
+    dco_context_t *dco = arg;
+    struct dco_batch_op *op = dco_batch_find(dco, nlmsg_hdr(msg)->nlmsg_seq);
+
+    if (op && op->status == 1)
+    {
+        op->status = 0;
+        dco->status--;
+    }
+    return NL_SKIP;
+}
+
+static int
+ovpn_nl_cb_batch_error(struct sockaddr_nl *nla, struct nlmsgerr *err,
+                       void *arg)
+{
+    dco_context_t *dco = arg;
+    struct dco_batch_op *op = dco_batch_find(dco, err->msg.nlmsg_seq);
+
+    if (op && op->status == 1)
+    {
+        ovpn_nl_cb_error(nla, err, &op->status);
+        dco->status--;
+    }
+    /* the replies to the other operations may follow in the same read */
+    return NL_SKIP;
+}
+
+/**
+ * Queue a prepared netlink message that expects no answer but an ACK if
+ * dco_batch_begin() was called, otherwise send it right away.
+ *
+ * The message is not freed. The queue keeps its own reference.
+ * @return          0 if the message was queued, otherwise the status of
+ *                  sending it
+ */
+static int
+ovpn_nl_msg_queue(dco_context_t *dco, struct nl_msg *nl_msg,
+                  unsigned int peerid, const char *prefix)
+{
+    if (!dco->batching)
+    {
+        return ovpn_nl_msg_send(dco, nl_msg, NULL, NULL, prefix);
+    }
+
+    if (dco->batch_len == DCO_BATCH_MAX)
+    {
+        dco_batch_flush(dco);
+    }
+
+    struct dco_batch_op *op = &dco->batch[dco->batch_len++];
+    nlmsg_get(nl_msg);
+    op->nl_msg = nl_msg;
+    op->peerid = peerid;
+    op->prefix = prefix;
+    op->status = 1;
+
+    return 0;
+}
+
+void
+dco_batch_begin(dco_context_t *dco, dco_batch_error_fn error_fn, void *arg)
+{
+    dco->batching = true;
+    dco->batch_error = error_fn;
+    dco->batch_error_arg = arg;
+}
+
+void
+dco_batch_flush(dco_context_t *dco)
+{
+    const int n = dco->batch_len;
+    if (n == 0)
+    {
+        return;
+    }
+
+    msg(D_DCO_DEBUG, "%s: %d operations", __func__, n);
+
+    /* the kernel processes all messages of one write in order and
+     * acknowledges each of them on its own */
+    size_t len = 0;
+    for (int i = 0; i < n; i++)
+    {
+        nl_complete_msg(dco->nl_sock, dco->batch[i].nl_msg);
+        len += NLMSG_ALIGN(nlmsg_hdr(dco->batch[i].nl_msg)->nlmsg_len);
+    }
+
+    struct gc_arena gc = gc_new();
+    uint8_t *data = gc_malloc(len, true, &gc);
+    size_t offset = 0;
+    for (int i = 0; i < n; i++)
+    {
+        struct nlmsghdr *hdr = nlmsg_hdr(dco->batch[i].nl_msg);
+        memcpy(data + offset, hdr, hdr->nlmsg_len);
+        offset += NLMSG_ALIGN(hdr->nlmsg_len);
+    }
+
+    nl_cb_set(dco->nl_cb, NL_CB_VALID, NL_CB_CUSTOM, NULL, NULL);
+    nl_cb_err(dco->nl_cb, NL_CB_CUSTOM, ovpn_nl_cb_batch_error, dco);
+    nl_cb_set(dco->nl_cb, NL_CB_ACK, NL_CB_CUSTOM, ovpn_nl_cb_batch_ack, dco);
+
+    int ret = nl_sendto(dco->nl_sock, data, len);
+    if (ret < 0)
+    {
+        msg(M_WARN, "%s: cannot send netlink messages: %s", __func__,
+            nl_geterror(ret));
+        for (int i = 0; i < n; i++)
+        {
+            dco->batch[i].status = -EIO;
+        }
+    }
+    else
+    {
+        dco->status = n;
+        while (dco->status > 0)
+        {
+            ovpn_nl_recvmsgs(dco, __func__);
+        }
+    }
+
+    nl_cb_err(dco->nl_cb, NL_CB_CUSTOM, ovpn_nl_cb_error, &dco->status);
+    nl_cb_set(dco->nl_cb, NL_CB_ACK, NL_CB_CUSTOM, ovpn_nl_cb_finish,
+              &dco->status);
+
+    /* empty the queue before reporting errors, the error handler may
+     * talk to the kernel again */
+    dco->batch_len = 0;
+    for (int i = 0; i < n; i++)
+    {
+        struct dco_batch_op *op = &dco->batch[i];
+
+        nlmsg_free(op->nl_msg);
+        op->nl_msg = NULL;
+
+        if (op->status < 0)
+        {
+            msg(M_INFO, "%s: failed to send netlink message: %s (%d)",
+                op->prefix, strerror(-op->status), op->status);
+            if (dco->batch_error)
+            {
+                dco->batch_error(dco->batch_error_arg, op->peerid, op->status);
+            }
+        }
+    }
+
+    gc_free(&gc);
+}
+
+void
+dco_batch_end(dco_context_t *dco)
+{
+    dco_batch_flush(dco);
+    dco->batching = false;
+    dco->batch_error = NULL;
+    dco->batch_error_arg = NULL;
+}
+
 static void
 ovpn_dco_init_netlink(dco_context_t *dco)
 {
@@ -408,6 +584,11 @@ ovpn_dco_init(int mode, dco_context_t *dco)
 static void
 ovpn_dco_uninit_netlink(dco_context_t *dco)
 {
+    for (int i = 0; i < dco->batch_len; i++)
+    {
+        nlmsg_free(dco->batch[i].nl_msg);
+    }
+
     nl_socket_free(dco->nl_sock);
     dco->nl_sock = NULL;
 
@@ -489,7 +670,7 @@ dco_swap_keys(dco_context_t *dco, unsigned int peerid)
     NLA_PUT_U32(nl_msg, OVPN_SWAP_KEYS_ATTR_PEER_ID, peerid);
     nla_nest_end(nl_msg, attr);
 
-    ret = ovpn_nl_msg_send(dco, nl_msg, NULL, NULL, __func__);
+    ret = ovpn_nl_msg_queue(dco, nl_msg, peerid, __func__);
 
 nla_put_failure:
     nlmsg_free(nl_msg);
@@ -539,7 +720,7 @@ dco_del_key(dco_context_t *dco, unsigned int peerid,
     NLA_PUT_U8(nl_msg, OVPN_DEL_KEY_ATTR_KEY_SLOT, slot);
     nla_nest_end(nl_msg, attr);
 
-    ret = ovpn_nl_msg_send(dco, nl_msg, NULL, NULL, __func__);
+    ret = ovpn_nl_msg_queue(dco, nl_msg, peerid, __func__);
 
 nla_put_failure:
     nlmsg_free(nl_msg);
@@ -596,7 +777,7 @@ dco_new_key(dco_context_t *dco, unsigned int peerid, int keyid,
 
     nla_nest_end(nl_msg, attr);
 
-    ret = ovpn_nl_msg_send(dco, nl_msg, NULL, NULL, __func__);
+    ret = ovpn_nl_msg_queue(dco, nl_msg, peerid, __func__);
 
 nla_put_failure:
     nlmsg_free(nl_msg);
@@ -902,14 +1083,15 @@ dco_parse_peer_multi(struct nl_msg *msg, void *arg)
     struct multi_context *m = arg;
     uint32_t peer_id = nla_get_u32(tb_peer[OVPN_GET_PEER_RESP_ATTR_PEER_ID]);
 
-    if (peer_id >= m->max_clients || !m->instances[peer_id])
+    struct multi_instance *mi = multi_peer_id_lookup(m, peer_id);
+    if (!mi)
     {
         msg(M_WARN, "%s: cannot store DCO stats for peer %u", __func__,
             peer_id);
         return NL_SKIP;
     }
 
-    dco_update_peer_stat(&m->instances[peer_id]->context.c2, tb_peer, peer_id);
+    dco_update_peer_stat(&mi->context.c2, tb_peer, peer_id);
 
     return NL_OK;
 }
@@ -34,6 +34,23 @@
 typedef enum ovpn_key_slot dco_key_slot_t;
 typedef enum ovpn_cipher_alg dco_cipher_t;
 
+/**
+ * Called by dco_batch_flush() for every queued operation that the
+ * kernel rejected
+ */
+typedef void (*dco_batch_error_fn)(void *arg, unsigned int peerid, int err);
+
+/** Maximum number of key operations sent in one netlink write */
+#define DCO_BATCH_MAX 64
+
+/** A key operation queued by dco_batch_begin() */
+struct dco_batch_op
+{
+    struct nl_msg *nl_msg;
+    unsigned int peerid;
+    const char *prefix;  /**< name of the queueing function */
+    int status;          /**< 1 while no reply arrived, else 0 or -errno */
+};
 
 typedef struct
 {
@@ -53,7 +70,40 @@ typedef struct
     int dco_del_peer_reason;
     uint64_t dco_read_bytes;
     uint64_t dco_write_bytes;
+
+    bool batching;
+    int batch_len;
+    struct dco_batch_op batch[DCO_BATCH_MAX];
+    dco_batch_error_fn batch_error;
+    void *batch_error_arg;
 } dco_context_t;
 
+/**
+ * Queue the key operations (dco_new_key, dco_swap_keys and dco_del_key)
+ * instead of waiting for the kernel to acknowledge each of them.
+ * The queue is sent by dco_batch_flush(), and before any other netlink
+ * request so that the kernel sees all operations in order.
+ *
+ * @param dco       the DCO context
+ * @param error_fn  called for each queued operation that fails
+ * @param arg       passed to error_fn
+ */
+void dco_batch_begin(dco_context_t *dco, dco_batch_error_fn error_fn, void *arg);
+
+/**
+ * Send all queued key operations in one netlink write and wait for
+ * their acknowledgements.
+ *
+ * @param dco       the DCO context
+ */
+void dco_batch_flush(dco_context_t *dco);
+
+/**
+ * Send the queued key operations and stop queueing new ones.
+ *
+ * @param dco       the DCO context
+ */
+void dco_batch_end(dco_context_t *dco);
+
 #endif /* defined(ENABLE_DCO) && defined(TARGET_LINUX) */
 #endif /* ifndef DCO_LINUX_H */
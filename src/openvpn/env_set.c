@@ -90,51 +90,115 @@ env_string_equal(const char *s1, const char *s2)
     return false;
 }
 
+/*
+ * FNV-1a of the variable name, i.e. of str up to the '='.  The index
+ * lives in env_set.c rather than using struct hash, so that everything
+ * linking env_set.c does not also have to link list.c.
+ */
+static unsigned int
+env_name_bucket(const char *str)
+{
+    uint32_t h = 2166136261u;
+    for (; *str && *str != '='; ++str)
+    {
+        h = (h ^ (uint8_t)*str) * 16777619u;
+    }
+    return h % ENV_SET_INDEX_SIZE;
+}
+
+static struct env_item *
+find_env_item(const struct env_set *es, const char *str)
+{
+    struct env_item *item;
+
+    if (es->index)
+    {
+        item = es->index[env_name_bucket(str)];
+        while (item && !env_string_equal(item->string, str))
+        {
+            item = item->hash_next;
+        }
+    }
+    else
+    {
+        item = es->list;
+        while (item && !env_string_equal(item->string, str))
+        {
+            item = item->next;
+        }
+    }
+    return item;
+}
+
 static bool
-remove_env_item(const char *str, const bool do_free, struct env_item **list)
+remove_env_item(struct env_set *es, const char *str)
 {
-    struct env_item *current, *prev;
+    struct env_item *current;
 
     ASSERT(str);
-    ASSERT(list);
 
-    for (current = *list, prev = NULL; current != NULL; current = current->next)
+    current = find_env_item(es, str);
+    if (!current)
     {
-        if (env_string_equal(current->string, str))
+        return false;
+    }
+
+    if (current->prev)
+    {
+        current->prev->next = current->next;
+    }
+    else
+    {
+        es->list = current->next;
+    }
+    if (current->next)
+    {
+        current->next->prev = current->prev;
+    }
+
+    if (es->index)
+    {
+        struct env_item **pp = &es->index[env_name_bucket(current->string)];
+        while (*pp != current)
         {
-            if (prev)
-            {
-                prev->next = current->next;
-            }
-            else
-            {
-                *list = current->next;
-            }
-            if (do_free)
-            {
-                secure_memzero(current->string, strlen(current->string));
-                free(current->string);
-                free(current);
-            }
-            return true;
+            pp = &(*pp)->hash_next;
         }
-        prev = current;
+        *pp = current->hash_next;
     }
-    return false;
+
+    if (es->gc == NULL)
+    {
+        secure_memzero(current->string, strlen(current->string));
+        free(current->string);
+        free(current);
+    }
+    return true;
 }
 
 static void
-add_env_item(char *str, const bool do_alloc, struct env_item **list, struct gc_arena *gc)
+add_env_item(struct env_set *es, const char *str)
 {
     struct env_item *item;
 
     ASSERT(str);
-    ASSERT(list);
 
-    ALLOC_OBJ_GC(item, struct env_item, gc);
-    item->string = do_alloc ? string_alloc(str, gc) : str;
-    item->next = *list;
-    *list = item;
+    ALLOC_OBJ_GC(item, struct env_item, es->gc);
+    item->string = string_alloc(str, es->gc);
+    item->prev = NULL;
+    item->next = es->list;
+    if (es->list)
+    {
+        es->list->prev = item;
+    }
+    es->list = item;
+
+    item->hash_next = NULL;
+    if (es->index)
+    {
+        const unsigned int b = env_name_bucket(str);
+        item->hash_next = es->index[b];
+        es->index[b] = item;
+    }
 }
 
 /* struct env_set functions */
@@ -142,14 +206,14 @@ add_env_item(char *str, const bool do_alloc, struct env_item **list, struct gc_a
 static bool
 env_set_del_nolock(struct env_set *es, const char *str)
 {
-    return remove_env_item(str, es->gc == NULL, &es->list);
+    return remove_env_item(es, str);
 }
 
 static void
 env_set_add_nolock(struct env_set *es, const char *str)
 {
-    remove_env_item(str, es->gc == NULL, &es->list);
-    add_env_item((char *)str, true, &es->list, es->gc);
+    remove_env_item(es, str);
+    add_env_item(es, str);
 }
 
 struct env_set *
@@ -159,6 +223,10 @@ env_set_create(struct gc_arena *gc)
     ALLOC_OBJ_CLEAR_GC(es, struct env_set, gc);
     es->list = NULL;
     es->gc = gc;
+    if (!gc)
+    {
+        ALLOC_ARRAY_CLEAR(es->index, struct env_item *, ENV_SET_INDEX_SIZE);
+    }
     return es;
 }
 
@@ -175,10 +243,27 @@ env_set_destroy(struct env_set *es)
             free(e);
             e = next;
         }
+        free(es->index);
         free(es);
     }
 }
 
+size_t
+env_set_mem_usage(const struct env_set *es)
+{
+    size_t bytes = sizeof(*es);
+
+    if (es->index)
+    {
+        bytes += ENV_SET_INDEX_SIZE * sizeof(*es->index);
+    }
+    for (const struct env_item *e = es->list; e; e = e->next)
+    {
+        bytes += sizeof(*e) + strlen(e->string) + 1;
+    }
+    return bytes;
+}
+
 bool
 env_set_del(struct env_set *es, const char *str)
 {
@@ -197,14 +282,35 @@ env_set_add(struct env_set *es, const char *str)
     env_set_add_nolock(es, str);
 }
 
-const char *
-env_set_get(const struct env_set *es, const char *name)
+void
+env_set_restore(struct env_set *es, const struct env_set *saved)
 {
-    const struct env_item *item = es->list;
-    while (item && !env_string_equal(item->string, name))
+    struct env_item *e = es->list;
+
+    ASSERT(saved);
+    while (e)
+    {
+        struct env_item *next = e->next;
+        if (!find_env_item(saved, e->string))
+        {
+            remove_env_item(es, e->string);
+        }
+        e = next;
+    }
+    for (e = saved->list; e; e = e->next)
     {
-        item = item->next;
+        const struct env_item *cur = find_env_item(es, e->string);
+        if (!cur || strcmp(cur->string, e->string))
+        {
+            env_set_add_nolock(es, e->string);
+        }
     }
+}
+
+const char *
+env_set_get(const struct env_set *es, const char *name)
+{
+    const struct env_item *item = find_env_item(es, name);
     return item ? item->string : NULL;
 }
 
@@ -243,10 +349,21 @@ env_set_inherit(struct env_set *es, const struct env_set *src)
 
     if (src)
     {
+        /* the names in src are unique, so there is nothing to replace
+         * when inheriting into an empty set, e.g. a new client's c2.es */
+        const bool empty = !es->list;
+
         e = src->list;
         while (e)
         {
-            env_set_add_nolock(es, e->string);
+            if (empty)
+            {
+                add_env_item(es, e->string);
+            }
+            else
+            {
+                env_set_add_nolock(es, e->string);
+            }
             e = e->next;
         }
     }
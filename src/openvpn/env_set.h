@@ -37,11 +37,19 @@
 struct env_item {
     char *string;
     struct env_item *next;
+    struct env_item *prev;
+    struct env_item *hash_next; /* next item in the same index bucket */
 };
 
+/* Number of buckets of the name index of heap allocated env_sets */
+#define ENV_SET_INDEX_SIZE 64
+
 struct env_set {
     struct gc_arena *gc;
     struct env_item *list;
+    /* Index by variable name, only for sets created with a NULL gc,
+     * which are the long lived ones such as the per-client c2.es */
+    struct env_item **index;
 };
 
 /* set/delete environmental variable */
@@ -83,6 +91,9 @@ struct env_set *env_set_create(struct gc_arena *gc);
 
 void env_set_destroy(struct env_set *es);
 
+/* bytes of heap memory used by an env_set created with a NULL gc */
+size_t env_set_mem_usage(const struct env_set *es);
+
 bool env_set_del(struct env_set *es, const char *str);
 
 void env_set_add(struct env_set *es, const char *str);
@@ -93,6 +104,9 @@ void env_set_print(int msglevel, const struct env_set *es);
 
 void env_set_inherit(struct env_set *es, const struct env_set *src);
 
+/* undo the changes made to es since saved was inherited from it */
+void env_set_restore(struct env_set *es, const struct env_set *saved);
+
 /* returns true if environmental variable name starts with 'password' */
 static inline bool
 is_password_env_var(const char *str)
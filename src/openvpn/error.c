@@ -40,6 +40,7 @@
 #include "integer.h"
 #include "ps.h"
 #include "mstats.h"
+#include "trace.h"
 
 
 #if SYSLOG_CAPABILITY
@@ -56,6 +57,17 @@ static int mute_cutoff;     /* GLOBAL */
 static int mute_count;      /* GLOBAL */
 static int mute_category;   /* GLOBAL */
 
+/* --mute-repeats: last message printed and how often it came again */
+#define MSG_REPEAT_INTERVAL 10
+static bool mute_repeats;        /* GLOBAL */
+static char *repeat_line;        /* GLOBAL */
+static unsigned int repeat_flags; /* GLOBAL */
+static int repeat_count;         /* GLOBAL */
+static time_t repeat_reported;   /* GLOBAL */
+
+/* If true, the event loop flushes the log file, see msg_flush() */
+static bool defer_flush;    /* GLOBAL */
+
 /*
  * Output mode priorities are as follows:
  *
@@ -133,6 +145,12 @@ set_mute_cutoff(const int cutoff)
     }
 }
 
+void
+set_mute_repeats(bool enable)
+{
+    mute_repeats = enable;
+}
+
 int
 get_debug_level(void)
 {
@@ -207,6 +225,66 @@ msg_fp(const unsigned int flags)
 
 #define SWAP { tmp = m1; m1 = m2; m2 = tmp; }
 
+/* print how often the last message was repeated since it was printed */
+static void
+msg_repeats_report(void)
+{
+    if (repeat_count > 0)
+    {
+        const int n = repeat_count;
+        repeat_count = 0;
+        repeat_reported = now;
+        msg((repeat_flags & ~(M_ERRNO|M_OPTERR)) | M_NOMUTE,
+            "last message repeated %d times", n);
+    }
+}
+
+/*
+ * --mute-repeats: count a message that is identical to the last one
+ * printed instead of printing it again.  Returns true if it was counted.
+ */
+static bool
+msg_repeated(const unsigned int flags, const char *line)
+{
+    if (!mute_repeats || (flags & (M_FATAL|M_USAGE_SMALL|M_NOPREFIX|M_NOLF|M_NOMUTE)))
+    {
+        return false;
+    }
+    if (repeat_line && !strcmp(line, repeat_line))
+    {
+        ++repeat_count;
+        return true;
+    }
+    msg_repeats_report();
+    free(repeat_line);
+    repeat_line = string_alloc(line, NULL);
+    repeat_flags = flags;
+    repeat_reported = now;
+    return false;
+}
+
+void
+msg_flush(void)
+{
+    FILE *fp = msgfp ? msgfp : default_out;
+
+    if (repeat_count > 0 && now >= repeat_reported + MSG_REPEAT_INTERVAL)
+    {
+        msg_repeats_report();
+    }
+    defer_flush = false;
+    if (fp)
+    {
+        fflush(fp);
+    }
+}
+
+void
+msg_defer_flush(void)
+{
+    defer_flush = true;
+}
+
 int x_msg_line_num; /* GLOBAL */
 
 void
@@ -315,6 +393,13 @@ x_msg_va(const unsigned int flags, const char *format, va_list arglist)
         prefix_sep = prefix = "";
     }
 
+    openvpn_snprintf(m2, ERR_BUF_SIZE, "%s%s%s", prefix, prefix_sep, m1);
+    if (msg_repeated(flags, m2))
+    {
+        gc_free(&gc);
+        return;
+    }
+
     /* virtual output capability used to copy output to management subsystem */
     if (!forked)
     {
@@ -377,7 +462,12 @@ x_msg_va(const unsigned int flags, const char *format, va_list arglist)
                         m1,
                         (flags&M_NOLF) ? "" : "\n");
             }
-            fflush(fp);
+            /* during an event loop iteration, leave it to msg_flush()
+             * unless the message is important or a prompt */
+            if (!defer_flush || (flags & (M_FATAL|M_NONFATAL|M_WARN|M_NOLF)))
+            {
+                fflush(fp);
+            }
             ++x_msg_line_num;
         }
     }
@@ -760,6 +850,10 @@ openvpn_exit(const int status)
         mstats_close();
 #endif
 
+#ifdef ENABLE_TRACE
+        trace_close();
+#endif
+
 #ifdef ABORT_ON_ERROR
         if (status == OPENVPN_EXIT_STATUS_ERROR)
         {
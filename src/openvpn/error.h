@@ -185,6 +185,19 @@ bool set_debug_level(const int level, const unsigned int flags);
 
 bool set_mute_cutoff(const int cutoff);
 
+void set_mute_repeats(bool enable);
+
+/*
+ * The event loops call msg_defer_flush() when they wake up and
+ * msg_flush() before they go to sleep again, so that a burst of
+ * messages reaches the log file with one write.  msg_flush() also
+ * reports a message that --mute-repeats is still counting.  Call
+ * msg_flush() before fork() as well.
+ */
+void msg_defer_flush(void);
+
+void msg_flush(void);
+
 int get_debug_level(void);
 
 int get_mute_cutoff(void);
@@ -234,6 +234,8 @@ we_ctl(struct event_set *es, event_t event, unsigned int rwflags, void *arg)
 {
     struct we_set *wes = (struct we_set *) es;
 
+    rwflags &= ~EVENT_EDGE;
+
     dmsg(D_EVENT_WAIT, "WE_CTL n=%d ev=%p rwflags=0x%04x arg=" ptr_format,
          wes->n_events,
          event,
@@ -522,6 +524,20 @@ we_init(int *maxevents, unsigned int flags)
 
 #if EPOLL
 
+/*
+ * What an ep_set knows about a descriptor, indexed by the descriptor.
+ * wanted, ready and next are only used for EVENT_EDGE descriptors.
+ */
+struct ep_fd
+{
+    void *arg;
+    unsigned int wanted;        /* EVENT_READ/WRITE of the last ep_ctl */
+    unsigned int ready;         /* edges seen and not blocked since */
+    int next;                   /* ready list link, -1 at the end */
+    bool edge;                  /* registered edge-triggered */
+    bool listed;                /* on the ready list */
+};
+
 struct ep_set
 {
     struct event_set_functions func;
@@ -529,14 +545,54 @@ struct ep_set
     int epfd;
     int maxevents;
     struct epoll_event *events;
+
+    struct ep_fd *fds;
+    int n_fds;
+
+    /* EVENT_EDGE descriptors which may be wanted and ready without
+     * the kernel reporting them again, -1 if none */
+    int ready_head;
 };
 
+static struct ep_fd *
+ep_get_fd(struct ep_set *eps, event_t event)
+{
+    ASSERT(event >= 0);
+    if (event >= eps->n_fds)
+    {
+        const int n = max_int(event + 1, eps->n_fds * 2);
+        eps->fds = realloc(eps->fds, n * sizeof(struct ep_fd));
+        check_malloc_return(eps->fds);
+        for (int i = eps->n_fds; i < n; ++i)
+        {
+            CLEAR(eps->fds[i]);
+            eps->fds[i].next = -1;
+        }
+        eps->n_fds = n;
+    }
+    return &eps->fds[event];
+}
+
+/* put an EVENT_EDGE descriptor on the ready list if it is wanted and ready */
+static void
+ep_ready(struct ep_set *eps, event_t event)
+{
+    struct ep_fd *f = &eps->fds[event];
+    if (!f->listed && (f->wanted & f->ready))
+    {
+        f->next = eps->ready_head;
+        f->listed = true;
+        eps->ready_head = event;
+    }
+}
+
 static void
 ep_free(struct event_set *es)
 {
     struct ep_set *eps = (struct ep_set *) es;
     close(eps->epfd);
     free(eps->events);
+    free(eps->fds);
     free(eps);
 }
 
@@ -556,6 +612,14 @@ ep_del(struct event_set *es, event_t event)
     dmsg(D_EVENT_WAIT, "EP_DEL ev=%d", (int)event);
 
     ASSERT(!eps->fast);
+    if (event < eps->n_fds)
+    {
+        /* the ready list drops it lazily in ep_wait */
+        struct ep_fd *f = &eps->fds[event];
+        f->arg = NULL;
+        f->wanted = f->ready = 0;
+        f->edge = false;
+    }
     CLEAR(ev);
     if (epoll_ctl(eps->epfd, EPOLL_CTL_DEL, event, &ev) < 0)
     {
@@ -567,25 +631,55 @@ static void
 ep_ctl(struct event_set *es, event_t event, unsigned int rwflags, void *arg)
 {
     struct ep_set *eps = (struct ep_set *) es;
+    struct ep_fd *f = ep_get_fd(eps, event);
     struct epoll_event ev;
 
+    f->arg = arg;
+    f->wanted = rwflags & (EVENT_READ|EVENT_WRITE);
+
+    if (rwflags & EVENT_EDGE)
+    {
+        if (f->edge)
+        {
+            /* already registered for both directions, only what the
+             * caller wants to hear about has changed */
+            dmsg(D_EVENT_WAIT, "EP_CTL fd=%d rwflags=0x%04x ready=0x%04x arg=" ptr_format " [edge]",
+                 (int)event, rwflags, f->ready, (ptr_type)arg);
+            ep_ready(eps, event);
+            return;
+        }
+        f->edge = true;
+        f->ready = 0;
+    }
+    else
+    {
+        f->edge = false;
+    }
+
     CLEAR(ev);
 
-    ev.data.ptr = arg;
-    if (rwflags & EVENT_READ)
+    ev.data.fd = event;
+    if (f->edge)
     {
-        ev.events |= EPOLLIN;
+        ev.events = EPOLLIN|EPOLLOUT|EPOLLET;
     }
-    if (rwflags & EVENT_WRITE)
+    else
     {
-        ev.events |= EPOLLOUT;
+        if (rwflags & EVENT_READ)
+        {
+            ev.events |= EPOLLIN;
+        }
+        if (rwflags & EVENT_WRITE)
+        {
+            ev.events |= EPOLLOUT;
+        }
     }
 
     dmsg(D_EVENT_WAIT, "EP_CTL fd=%d rwflags=0x%04x ev=0x%08x arg=" ptr_format,
          (int)event,
          rwflags,
          (unsigned int)ev.events,
-         (ptr_type)ev.data.ptr);
+         (ptr_type)arg);
 
     if (epoll_ctl(eps->epfd, EPOLL_CTL_MOD, event, &ev) < 0)
     {
@@ -603,44 +697,85 @@ ep_ctl(struct event_set *es, event_t event, unsigned int rwflags, void *arg)
     }
 }
 
+static void
+ep_blocked(struct event_set *es, event_t event, unsigned int rwflags)
+{
+    struct ep_set *eps = (struct ep_set *) es;
+    if (event >= 0 && event < eps->n_fds)
+    {
+        eps->fds[event].ready &= ~rwflags;
+    }
+}
+
 static int
 ep_wait(struct event_set *es, const struct timeval *tv, struct event_set_return *out, int outlen)
 {
     struct ep_set *eps = (struct ep_set *) es;
-    int stat;
+    int stat, n = 0;
 
     if (outlen > eps->maxevents)
     {
         outlen = eps->maxevents;
     }
 
-    stat = epoll_wait(eps->epfd, eps->events, outlen, tv_to_ms_timeout(tv));
+    /* don't sleep while edge-triggered descriptors are known to be ready */
+    stat = epoll_wait(eps->epfd, eps->events, outlen,
+                      eps->ready_head >= 0 ? 0 : tv_to_ms_timeout(tv));
     ASSERT(stat <= outlen);
 
-    if (stat > 0)
+    for (int i = 0; i < stat; ++i)
     {
-        int i;
-        const struct epoll_event *ev = eps->events;
-        struct event_set_return *esr = out;
-        for (i = 0; i < stat; ++i)
+        const struct epoll_event *ev = &eps->events[i];
+        struct ep_fd *f = &eps->fds[ev->data.fd];
+        unsigned int rwflags = 0;
+
+        if (ev->events & (EPOLLIN|EPOLLPRI|EPOLLERR|EPOLLHUP))
         {
-            esr->rwflags = 0;
-            if (ev->events & (EPOLLIN|EPOLLPRI|EPOLLERR|EPOLLHUP))
-            {
-                esr->rwflags |= EVENT_READ;
-            }
-            if (ev->events & EPOLLOUT)
-            {
-                esr->rwflags |= EVENT_WRITE;
-            }
-            esr->arg = ev->data.ptr;
-            dmsg(D_EVENT_WAIT, "EP_WAIT[%d] rwflags=0x%04x ev=0x%08x arg=" ptr_format,
-                 i, esr->rwflags, ev->events, (ptr_type)ev->data.ptr);
-            ++ev;
-            ++esr;
+            rwflags |= EVENT_READ;
+        }
+        if (ev->events & EPOLLOUT)
+        {
+            rwflags |= EVENT_WRITE;
+        }
+        dmsg(D_EVENT_WAIT, "EP_WAIT[%d] fd=%d rwflags=0x%04x ev=0x%08x arg=" ptr_format "%s",
+             i, ev->data.fd, rwflags, ev->events, (ptr_type)f->arg, f->edge ? " [edge]" : "");
+
+        if (f->edge)
+        {
+            f->ready |= rwflags;
+            ep_ready(eps, ev->data.fd);
+        }
+        else
+        {
+            out[n].rwflags = rwflags;
+            out[n].arg = f->arg;
+            ++n;
         }
     }
-    return stat;
+
+    /* report edge-triggered descriptors until their reader or writer
+     * hits EAGAIN, drop those which are no longer wanted or ready */
+    int *link = &eps->ready_head;
+    while (*link >= 0)
+    {
+        struct ep_fd *f = &eps->fds[*link];
+        const unsigned int rwflags = f->wanted & f->ready;
+        if (!rwflags)
+        {
+            f->listed = false;
+            *link = f->next;
+            continue;
+        }
+        if (n < outlen)
+        {
+            out[n].rwflags = rwflags;
+            out[n].arg = f->arg;
+            ++n;
+        }
+        link = &f->next;
+    }
+
+    return (n == 0 && stat < 0) ? stat : n;
 }
 
 static struct event_set *
@@ -668,6 +803,7 @@ ep_init(int *maxevents, unsigned int flags)
     eps->func.del = ep_del;
     eps->func.ctl = ep_ctl;
     eps->func.wait = ep_wait;
+    eps->func.blocked = ep_blocked;
 
     /* fast method ("sort of") corresponds to epoll one-shot */
     if (flags & EVENT_METHOD_FAST)
@@ -682,6 +818,7 @@ ep_init(int *maxevents, unsigned int flags)
 
     /* set epoll control fd */
     eps->epfd = fd;
+    eps->ready_head = -1;
 
     return (struct event_set *) eps;
 }
@@ -39,6 +39,16 @@
 #define EVENT_READ      (1 << READ_SHIFT)
 #define EVENT_WRITE     (1 << WRITE_SHIFT)
 
+/*
+ * Optional rwflags bit for event_ctl.  The caller promises to report
+ * every EAGAIN on the descriptor with event_blocked() and to remove it
+ * with event_del() before closing it.  The epoll backend then registers
+ * the descriptor only once, edge-triggered, and keeps track of its
+ * readiness itself, so that switching between EVENT_READ and
+ * EVENT_WRITE costs no system call.  Other backends ignore it.
+ */
+#define EVENT_EDGE      (1 << 3)
+
 /* event flags returned by io_wait.
  *
  * All these events are defined as bits in a bitfield.
@@ -75,6 +85,10 @@
 #define DCO_SHIFT           10
 #define DCO_READ            (1 << (DCO_SHIFT + READ_SHIFT))
 #define DCO_WRITE           (1 << (DCO_SHIFT + WRITE_SHIFT))
+#define PKCS11_SHIFT        12
+#define PKCS11_SIGN_DONE    (1 << (PKCS11_SHIFT + READ_SHIFT))
+#define SOCKET_EXTRA_SHIFT  14
+#define SOCKET_EXTRA_READ   (1 << (SOCKET_EXTRA_SHIFT + READ_SHIFT))
 
 /*
  * Initialization flags passed to event_set_init
@@ -113,6 +127,9 @@ struct event_set_functions
      * length of event_set_return if at least 1 event is returned
      */
     int (*wait)(struct event_set *es, const struct timeval *tv, struct event_set_return *out, int outlen);
+
+    /* optional, see EVENT_EDGE */
+    void (*blocked)(struct event_set *es, event_t event, unsigned int rwflags);
 };
 
 struct event_set_return
@@ -162,6 +179,19 @@ event_ctl(struct event_set *es, event_t event, unsigned int rwflags, void *arg)
     (*es->func.ctl)(es, event, rwflags, arg);
 }
 
+/*
+ * A read (EVENT_READ) or write (EVENT_WRITE) on an event set with
+ * EVENT_EDGE returned EAGAIN.
+ */
+static inline void
+event_blocked(struct event_set *es, event_t event, unsigned int rwflags)
+{
+    if (es && es->func.blocked)
+    {
+        (*es->func.blocked)(es, event, rwflags);
+    }
+}
+
 static inline int
 event_wait(struct event_set *es, const struct timeval *tv, struct event_set_return *out, int outlen)
 {
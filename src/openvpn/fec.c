@@ -0,0 +1,268 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "error.h"
+#include "integer.h"
+#include "fec.h"
+
+#include "memdbg.h"
+
+/*
+ * XOR len bytes of src into acc, growing acc with zeros as needed.
+ * Return false if acc has no room for them.
+ */
+static bool
+fec_xor_into(struct buffer *acc, const uint8_t *src, int len)
+{
+    if (len > BLEN(acc))
+    {
+        uint8_t *ext = buf_write_alloc(acc, len - BLEN(acc));
+        if (!ext)
+        {
+            return false;
+        }
+        memset(ext, 0, BEND(acc) - ext);
+    }
+
+    uint8_t *dst = BPTR(acc);
+    for (int i = 0; i < len; ++i)
+    {
+        dst[i] ^= src[i];
+    }
+    return true;
+}
+
+static void
+fec_acc_reset(struct buffer *acc)
+{
+    memset(BPTR(acc), 0, BLEN(acc));
+    acc->len = 0;
+}
+
+static void
+fec_prepend_header(struct buffer *buf, uint8_t index, uint16_t seq)
+{
+    seq = htons(seq);
+    ASSERT(buf_write_prepend(buf, &seq, sizeof(seq)));
+    ASSERT(buf_write_prepend(buf, &index, sizeof(index)));
+}
+
+struct fec *
+fec_init(int group_size, const struct frame *frame)
+{
+    struct fec *f;
+
+    ASSERT(group_size >= FEC_GROUP_MIN && group_size <= FEC_GROUP_MAX);
+    ALLOC_OBJ_CLEAR(f, struct fec);
+    f->group_size = group_size;
+
+    f->acc = alloc_buf(BUF_SIZE(frame));
+    ASSERT(buf_init(&f->acc, frame->buf.headroom));
+    for (int i = 0; i < FEC_N_GROUPS; ++i)
+    {
+        f->groups[i].acc = alloc_buf(BUF_SIZE(frame));
+        ASSERT(buf_init(&f->groups[i].acc, frame->buf.headroom));
+    }
+    return f;
+}
+
+void
+fec_free(struct fec *f)
+{
+    if (!f)
+    {
+        return;
+    }
+
+    msg(D_MTU_INFO, "FEC: repair packets sent=" counter_format
+        ", packets rebuilt=" counter_format, f->n_repair_sent, f->n_rebuilt);
+    free_buf(&f->acc);
+    for (int i = 0; i < FEC_N_GROUPS; ++i)
+    {
+        free_buf(&f->groups[i].acc);
+    }
+    free(f);
+}
+
+void
+fec_outgoing(struct fec *f, struct buffer *buf)
+{
+    if (f->repair_out)
+    {
+        /* from fec_repair_ready(), already has its header */
+        f->repair_out = false;
+        return;
+    }
+    if (buf->len <= 0)
+    {
+        return;
+    }
+
+    if (f->index == 0)
+    {
+        if (f->repair_pending)
+        {
+            dmsg(D_FEC_DEBUG, "FEC: repair packet of group %d not sent", f->seq);
+            f->repair_pending = false;
+        }
+        fec_acc_reset(&f->acc);
+        f->len = 0;
+        f->broken = false;
+        ++f->seq;
+    }
+
+    f->len ^= (uint16_t) BLEN(buf);
+    if (!fec_xor_into(&f->acc, BPTR(buf), BLEN(buf)))
+    {
+        f->broken = true;
+    }
+    fec_prepend_header(buf, (uint8_t) f->index, f->seq);
+
+    if (++f->index == f->group_size)
+    {
+        f->index = 0;
+        f->repair_pending = !f->broken;
+    }
+}
+
+void
+fec_repair_ready(struct fec *f, struct buffer *buf)
+{
+    ASSERT(f->repair_pending);
+
+    uint16_t len = htons(f->len);
+    *buf = f->acc;
+    ASSERT(buf_write_prepend(buf, &len, sizeof(len)));
+    fec_prepend_header(buf, FEC_REPAIR, f->seq);
+
+    f->repair_pending = false;
+    f->repair_out = true;
+    ++f->n_repair_sent;
+}
+
+/*
+ * A repair packet arrived for group g, rebuild the packet missing from
+ * it in place, if there is exactly one.
+ */
+static void
+fec_rebuild(struct fec *f, struct fec_group *g, uint16_t seq, struct buffer *buf)
+{
+    const int len_xor = buf_read_u16(buf);
+    const uint32_t missing = ~g->map & (uint32_t) ((1ull << f->group_size) - 1);
+
+    if (len_xor < 0 || !g->defined || g->seq != seq || g->broken
+        || !missing || (missing & (missing - 1)))
+    {
+        /* nothing lost, or too much */
+        buf->len = 0;
+        return;
+    }
+
+    const int len = g->len ^ len_xor;
+    if (len > BLEN(buf))
+    {
+        msg(D_FEC_ERRORS, "FEC: bad repair packet for group %d", seq);
+        buf->len = 0;
+        return;
+    }
+
+    uint8_t *dst = BPTR(buf);
+    const uint8_t *src = BPTR(&g->acc);
+    const int n = min_int(len, BLEN(&g->acc));
+    for (int i = 0; i < n; ++i)
+    {
+        dst[i] ^= src[i];
+    }
+    buf->len = len;
+
+    g->map |= missing;
+    ++f->n_rebuilt;
+    dmsg(D_FEC_DEBUG, "FEC: rebuilt a packet of %d bytes in group %d", len, seq);
+}
+
+void
+fec_incoming(struct fec *f, struct buffer *buf)
+{
+    if (buf->len <= 0)
+    {
+        return;
+    }
+
+    const int index = buf_read_u8(buf);
+    const int seq = buf_read_u16(buf);
+    if (index < 0 || seq < 0)
+    {
+        msg(D_FEC_ERRORS, "FEC: header not found in packet");
+        buf->len = 0;
+        return;
+    }
+
+    struct fec_group *g = &f->groups[seq % FEC_N_GROUPS];
+
+    if (index == FEC_REPAIR)
+    {
+        fec_rebuild(f, g, (uint16_t) seq, buf);
+        return;
+    }
+    if (index >= f->group_size)
+    {
+        msg(D_FEC_ERRORS, "FEC: bad index %d in packet", index);
+        buf->len = 0;
+        return;
+    }
+
+    if (!g->defined || g->seq != seq)
+    {
+        if (g->defined && (int16_t) (seq - g->seq) < 0)
+        {
+            /* the group is long gone, just pass the packet on */
+            return;
+        }
+        g->defined = true;
+        g->seq = (uint16_t) seq;
+        g->map = 0;
+        g->len = 0;
+        g->broken = false;
+        fec_acc_reset(&g->acc);
+    }
+
+    if (g->map & (1u << index))
+    {
+        /* rebuilt before it arrived */
+        buf->len = 0;
+        return;
+    }
+
+    g->map |= 1u << index;
+    g->len ^= (uint16_t) BLEN(buf);
+    if (!fec_xor_into(&g->acc, BPTR(buf), BLEN(buf)))
+    {
+        g->broken = true;
+    }
+}
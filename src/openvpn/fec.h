@@ -0,0 +1,129 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FEC_H
+#define FEC_H
+
+/**
+ * @file
+ * Forward error correction of data channel packets, for --fec.
+ *
+ * Outgoing packets are numbered in groups of n.  After the last packet
+ * of a group a repair packet follows, which is the XOR of all packets
+ * of the group, padded to the longest one, and of their lengths.  A
+ * receiver that got all but one packet of a group and the repair packet
+ * rebuilds the missing one from them.
+ *
+ * The stage sits between fragmentation and encryption, so every packet
+ * on the wire is protected, and the repair packet is encrypted and
+ * authenticated like any other.  Each data packet carries a header of
+ * FEC_HEADER_SIZE bytes:
+ *
+ *   uint8  index in the group, or FEC_REPAIR for the repair packet
+ *   uint16 group number
+ *
+ * followed by the XOR of the lengths on repair packets only.
+ */
+
+#include "common.h"
+#include "buffer.h"
+#include "mtu.h"
+
+#define FEC_HEADER_SIZE   3
+#define FEC_OVERHEAD      (FEC_HEADER_SIZE + 2) /**< of a repair packet */
+#define FEC_REPAIR        0xFF
+
+#define FEC_GROUP_MIN     2
+#define FEC_GROUP_MAX     32    /**< bits in fec_group.map */
+
+/** Groups being received at the same time, for reordered packets */
+#define FEC_N_GROUPS      4
+
+/** One group of received packets */
+struct fec_group
+{
+    bool defined;
+    bool broken;                /**< a packet did not fit into acc */
+    uint16_t seq;
+    uint32_t map;               /**< bit i: packet i was received or rebuilt */
+    uint16_t len;               /**< XOR of their lengths */
+    struct buffer acc;          /**< XOR of their contents */
+};
+
+struct fec
+{
+    int group_size;
+
+    /* sending */
+    uint16_t seq;
+    int index;                  /**< of the next packet in the group */
+    uint16_t len;               /**< XOR of the lengths sent */
+    struct buffer acc;          /**< XOR of the packets sent */
+    bool broken;                /**< a packet did not fit into acc */
+    bool repair_pending;        /**< the group is complete */
+    bool repair_out;            /**< the repair packet is being sent */
+
+    /* receiving */
+    struct fec_group groups[FEC_N_GROUPS];
+
+    /* statistics */
+    counter_type n_repair_sent;
+    counter_type n_rebuilt;
+};
+
+/**
+ * Allocate the state for groups of \c group_size packets, with buffers
+ * for the packets of \c frame.
+ */
+struct fec *fec_init(int group_size, const struct frame *frame);
+
+void fec_free(struct fec *f);
+
+/**
+ * Add the header to an outgoing packet in \c buf and take it into the
+ * repair packet of its group.
+ */
+void fec_outgoing(struct fec *f, struct buffer *buf);
+
+/**
+ * Take the header from an incoming packet in \c buf.  A repair packet
+ * is replaced by the packet it rebuilds, or set to length 0 if it is
+ * not needed, as is a packet that was already rebuilt.
+ */
+void fec_incoming(struct fec *f, struct buffer *buf);
+
+/** Is a repair packet waiting to be sent? */
+static inline bool
+fec_repair_pending(const struct fec *f)
+{
+    return f->repair_pending;
+}
+
+/**
+ * Set \c buf to the pending repair packet, which stays valid until the
+ * next call to fec_outgoing().  The repair packet already has its
+ * header, and the following call to fec_outgoing() leaves it alone.
+ */
+void fec_repair_ready(struct fec *f, struct buffer *buf);
+
+#endif /* FEC_H */
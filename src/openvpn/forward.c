@@ -41,13 +41,28 @@
 #include "ssl_verify.h"
 #include "dco.h"
 #include "auth_token.h"
+#include "probe.h"
+#include "pkcs11.h"
 
 #include "memdbg.h"
 
-#include "mstats.h"
-
 counter_type link_read_bytes_global;  /* GLOBAL */
 counter_type link_write_bytes_global; /* GLOBAL */
+counter_type link_read_packets_global;  /* GLOBAL */
+counter_type link_write_packets_global; /* GLOBAL */
+
+struct event_loop_stats event_loop_stats_global; /* GLOBAL */
+
+const int event_loop_busy_bounds[EVENT_LOOP_BUCKETS - 1] = {
+    10, 100, 500, 1000, 10000, 100000, 1000000
+};
+const int event_loop_events_bounds[EVENT_LOOP_BUCKETS - 1] = {
+    0, 1, 2, 4, 8, 16, 64
+};
+
+/* headroom kept free in front of a packet that is encrypted in place, for
+ * the opcode and peer-id, the socks UDP header and the TCP packet length */
+#define ENCRYPT_IN_PLACE_RESERVE (4 + 10 + 2)
 
 /* show event wait debugging info */
 
@@ -93,24 +108,35 @@ check_tls_errors_nco(struct context *c)
  * TLS errors are fatal in TCP mode.
  * Also check for --tls-exit trigger.
  */
+static inline bool
+tls_errors_pending(const struct context *c)
+{
+    if (c->c2.tls_multi && c->c2.tls_exit_signal)
+    {
+        if (link_socket_connection_oriented(c->c2.link_socket))
+        {
+            return c->c2.tls_multi->n_soft_errors;
+        }
+        else
+        {
+            return c->c2.tls_multi->n_hard_errors;
+        }
+    }
+    return false;
+}
+
 static inline void
 check_tls_errors(struct context *c)
 {
-    if (c->c2.tls_multi && c->c2.tls_exit_signal)
+    if (tls_errors_pending(c))
     {
         if (link_socket_connection_oriented(c->c2.link_socket))
         {
-            if (c->c2.tls_multi->n_soft_errors)
-            {
-                check_tls_errors_co(c);
-            }
+            check_tls_errors_co(c);
         }
         else
         {
-            if (c->c2.tls_multi->n_hard_errors)
-            {
-                check_tls_errors_nco(c);
-            }
+            check_tls_errors_nco(c);
         }
     }
 }
@@ -124,6 +150,7 @@ context_immediate_reschedule(struct context *c)
 {
     c->c2.timeval.tv_sec = 0;  /* ZERO-TIMEOUT */
     c->c2.timeval.tv_usec = 0;
+    c->c2.pre_select_wakeup = now; /* see pre_select_needed() */
 }
 
 static inline void
@@ -255,6 +282,14 @@ check_incoming_control_channel(struct context *c)
         {
             receive_auth_failed(c, &buf);
         }
+        else if (buf_string_match_head_str(&buf, "PUSH_UPDATE_"))
+        {
+            receive_push_update_ack(c, &buf);
+        }
+        else if (buf_string_match_head_str(&buf, "PUSH_UPDATE"))
+        {
+            receive_push_update(c, &buf);
+        }
         else if (buf_string_match_head_str(&buf, "PUSH_"))
         {
             incoming_push_message(c, &buf);
@@ -492,6 +527,39 @@ check_inactivity_timeout(struct context *c)
     register_signal(c->sig, SIGTERM, "inactive");
 }
 
+/*
+ * Release the packet buffers that an idle connection does not need,
+ * called after --compact-idle seconds without tunnel traffic.
+ */
+static void
+check_compact_idle(struct context *c)
+{
+    int freed = 0;
+
+    /* buffers that are waiting to be written may point into the
+     * fragment buffers */
+    if (c->c2.to_link.len > 0 || c->c2.to_tun.len > 0)
+    {
+        return;
+    }
+
+    if (c->c2.tls_multi)
+    {
+        freed += tls_multi_compact(c->c2.tls_multi);
+    }
+#ifdef ENABLE_FRAGMENT
+    if (c->c2.fragment)
+    {
+        freed += fragment_compact(c->c2.fragment);
+    }
+#endif
+    if (freed)
+    {
+        msg(D_MULTI_DEBUG, "Idle for %d seconds, released %d bytes of packet buffers",
+            c->options.compact_idle, freed);
+    }
+}
+
 int
 get_server_poll_remaining_time(struct event_timeout *server_poll_timeout)
 {
@@ -578,6 +646,41 @@ check_fragment(struct context *c)
 }
 #endif /* ifdef ENABLE_FRAGMENT */
 
+/*
+ * Should we send a --fec repair packet?
+ */
+static void
+check_fec(struct context *c)
+{
+    if (fec_repair_pending(c->c2.fec) && !c->c2.to_link.len)
+    {
+        fec_repair_ready(c->c2.fec, &c->c2.buf);
+        encrypt_sign(c, false);
+    }
+}
+
+#ifdef ENABLE_DEBUG
+/*
+ * Send the next packet held back by --gremlin-impair once it is due.
+ */
+static void
+check_gremlin_impair(struct context *c)
+{
+    if (!c->c2.to_link.len)
+    {
+        struct link_socket_actual *to;
+        struct buffer *buf = gremlin_impair_ready(c->c2.gremlin_impair, &to);
+        if (buf)
+        {
+            c->c2.to_link = *buf;
+            c->c2.to_link_addr = to;
+        }
+    }
+
+    gremlin_impair_wakeup(c->c2.gremlin_impair, &c->c2.timeval);
+}
+#endif
+
 /*
  * Buffer reallocation, for use with null encryption.
  */
@@ -595,6 +698,24 @@ buffer_turnover(const uint8_t *orig_buf, struct buffer *dest_stub, struct buffer
     }
 }
 
+void
+compress_fragment(struct context *c)
+{
+#ifdef USE_COMP
+    /* Compress the packet. */
+    if (c->c2.comp_context)
+    {
+        (*c->c2.comp_context->alg.compress)(&c->c2.buf, get_context_buffers(c)->compress_buf, c->c2.comp_context, &c->c2.frame);
+    }
+#endif
+#ifdef ENABLE_FRAGMENT
+    if (c->c2.fragment)
+    {
+        fragment_outgoing(c->c2.fragment, &c->c2.buf, &c->c2.frame_fragment);
+    }
+#endif
+}
+
 /*
  * Compress, fragment, encrypt and HMAC-sign an outgoing packet.
  * Input: c->c2.buf
@@ -603,7 +724,7 @@ buffer_turnover(const uint8_t *orig_buf, struct buffer *dest_stub, struct buffer
 void
 encrypt_sign(struct context *c, bool comp_frag)
 {
-    struct context_buffers *b = c->c2.buffers;
+    struct context_buffers *b = get_context_buffers(c);
     const uint8_t *orig_buf = c->c2.buf.data;
     struct crypto_options *co = NULL;
 
@@ -626,43 +747,46 @@ encrypt_sign(struct context *c, bool comp_frag)
 
     if (comp_frag)
     {
-#ifdef USE_COMP
-        /* Compress the packet. */
-        if (c->c2.comp_context)
-        {
-            (*c->c2.comp_context->alg.compress)(&c->c2.buf, b->compress_buf, c->c2.comp_context, &c->c2.frame);
-        }
-#endif
-#ifdef ENABLE_FRAGMENT
-        if (c->c2.fragment)
-        {
-            fragment_outgoing(c->c2.fragment, &c->c2.buf, &c->c2.frame_fragment);
-        }
-#endif
+        compress_fragment(c);
     }
 
-    /* initialize work buffer with buf.headroom bytes of prepend capacity */
-    ASSERT(buf_init(&b->encrypt_buf, c->c2.frame.buf.headroom));
+    if (c->c2.fec)
+    {
+        fec_outgoing(c->c2.fec, &c->c2.buf);
+    }
 
     if (c->c2.tls_multi)
     {
         /* Get the key we will use to encrypt the packet. */
         tls_pre_encrypt(c->c2.tls_multi, &c->c2.buf, &co);
-        /* If using P_DATA_V2, prepend the 1-byte opcode and 3-byte peer-id to the
-         * packet before openvpn_encrypt(), so we can authenticate the opcode too.
-         */
-        if (c->c2.buf.len > 0 && c->c2.tls_multi->use_peer_id)
-        {
-            tls_prepend_opcode_v2(c->c2.tls_multi, &b->encrypt_buf);
-        }
     }
     else
     {
         co = &c->c2.crypto_options;
     }
 
+    /* A packet that is still in our tun read buffer can be encrypted in
+     * place, anything else (compressed, fragmented or queued packets) is
+     * encrypted into the work buffer with buf.headroom bytes of prepend
+     * capacity */
+    struct buffer work;
+    if (c->c2.buf.data != b->read_tun_buf.data
+        || !openvpn_encrypt_in_place_init(&work, &c->c2.buf, co, ENCRYPT_IN_PLACE_RESERVE))
+    {
+        work = b->encrypt_buf;
+        ASSERT(buf_init(&work, c->c2.frame.buf.headroom));
+    }
+
+    /* If using P_DATA_V2, prepend the 1-byte opcode and 3-byte peer-id to the
+     * packet before openvpn_encrypt(), so we can authenticate the opcode too.
+     */
+    if (c->c2.tls_multi && c->c2.buf.len > 0 && c->c2.tls_multi->use_peer_id)
+    {
+        tls_prepend_opcode_v2(c->c2.tls_multi, &work);
+    }
+
     /* Encrypt and authenticate the packet */
-    openvpn_encrypt(&c->c2.buf, b->encrypt_buf, co);
+    openvpn_encrypt(&c->c2.buf, work, co);
 
     /* Do packet administration */
     if (c->c2.tls_multi)
@@ -680,10 +804,35 @@ encrypt_sign(struct context *c, bool comp_frag)
     link_socket_get_outgoing_addr(&c->c2.buf, get_link_socket_info(c),
                                   &c->c2.to_link_addr);
 
+    /* spread data packets over the --multipath paths */
+    if (c->c2.multipath && c->c2.buf.len > 0 && c->c2.to_link_addr)
+    {
+        multipath_select(c->c2.multipath, &c->c2.to_link_addr);
+    }
+
     /* if null encryption, copy result to read_tun_buf */
     buffer_turnover(orig_buf, &c->c2.to_link, &c->c2.buf, &b->read_tun_buf);
 }
 
+/*
+ * Ping each --multipath path that was idle for a second, one per
+ * second, so that both ends know which paths are up.
+ */
+static void
+check_multipath(struct context *c)
+{
+    if (c->c2.multipath
+        && event_timeout_trigger(&c->c2.multipath_interval, &c->c2.timeval, ETT_DEFAULT))
+    {
+        c->c2.multipath->probe = multipath_probe_due(c->c2.multipath);
+        if (c->c2.multipath->probe >= 0 && !TO_LINK_DEF(c))
+        {
+            check_ping_send_dowork(c);
+        }
+        c->c2.multipath->probe = -1;
+    }
+}
+
 /*
  * Should we exit due to session timeout?
  */
@@ -713,6 +862,9 @@ process_coarse_timers(struct context *c)
         packet_id_persist_save(&c->c1.pid_persist);
     }
 
+    /* account for datagrams the kernel dropped, maybe grow --rcvbuf */
+    link_socket_check_drops(c->c2.link_socket);
+
     /* Should we write timer-triggered status file */
     if (c->c1.status_output
         && event_timeout_trigger(&c->c1.status_output->et, &c->c2.timeval, ETT_DEFAULT))
@@ -744,11 +896,11 @@ process_coarse_timers(struct context *c)
         check_send_auth_token(c);
     }
 
-    /* possibly exit due to --inactive */
-    if (c->options.inactivity_timeout
-        && event_timeout_trigger(&c->c2.inactivity_interval, &c->c2.timeval, ETT_DEFAULT))
+    /* release buffers of an idle connection */
+    if (c->options.compact_idle
+        && event_timeout_trigger(&c->c2.compact_idle_interval, &c->c2.timeval, ETT_DEFAULT))
     {
-        check_inactivity_timeout(c);
+        check_compact_idle(c);
     }
 
     if (c->sig->signal_received)
@@ -763,13 +915,6 @@ process_coarse_timers(struct context *c)
         return;
     }
 
-    /* restart if ping not received */
-    check_ping_restart(c);
-    if (c->sig->signal_received)
-    {
-        return;
-    }
-
     if (c->c2.tls_multi)
     {
         if (c->options.ce.connect_timeout
@@ -797,15 +942,18 @@ process_coarse_timers(struct context *c)
     /* Should we send an MTU load test? */
     check_send_occ_load_test(c);
 
+    /* Should we probe the path MTU? */
+    check_send_occ_pmtu_probe(c);
+
+    /* Should we ping an idle --multipath path? */
+    check_multipath(c);
+
     /* Should we send an OCC_EXIT message to remote? */
     if (c->c2.explicit_exit_notification_time_wait)
     {
         process_explicit_exit_notification_timer_wakeup(c);
     }
 
-    /* Should we ping the remote? */
-    check_ping_send(c);
-
 #ifdef ENABLE_MANAGEMENT
     if (management)
     {
@@ -838,6 +986,60 @@ check_coarse_timers(struct context *c)
     }
 }
 
+/*
+ * The keepalive timers are kept apart from the other coarse timers.
+ * Traffic pushes them back all the time, so most of their wakeups
+ * only find a new expiry, and pre_select_idle() handles those without
+ * a pass through pre_select().
+ */
+static void
+process_keepalive_timers(struct context *c)
+{
+    /* possibly exit due to --inactive */
+    if (c->options.inactivity_timeout
+        && event_timeout_trigger(&c->c2.inactivity_interval, &c->c2.timeval, ETT_DEFAULT))
+    {
+        check_inactivity_timeout(c);
+    }
+    if (c->sig->signal_received)
+    {
+        return;
+    }
+
+    /* restart if ping not received */
+    check_ping_restart(c);
+    if (c->sig->signal_received)
+    {
+        return;
+    }
+
+    /* Should we ping the remote? */
+    check_ping_send(c);
+}
+
+static void
+check_keepalive_timers(struct context *c)
+{
+    if (now < c->c2.keepalive_wakeup)
+    {
+        context_reschedule_sec(c, c->c2.keepalive_wakeup - now);
+        return;
+    }
+
+    const struct timeval save = c->c2.timeval;
+    c->c2.timeval.tv_sec = BIG_TIMEOUT;
+    c->c2.timeval.tv_usec = 0;
+    process_keepalive_timers(c);
+    c->c2.keepalive_wakeup = now + c->c2.timeval.tv_sec;
+
+    dmsg(D_INTERVAL, "TIMER: keepalive timer wakeup %" PRIi64 " seconds", (int64_t)c->c2.timeval.tv_sec);
+
+    if (c->c2.timeval.tv_sec > save.tv_sec)
+    {
+        c->c2.timeval = save;
+    }
+}
+
 static void
 check_timeout_random_component_dowork(struct context *c)
 {
@@ -904,6 +1106,24 @@ link_socket_write_post_size_adjust(int *size,
     }
 }
 
+#ifndef _WIN32
+/*
+ * Read a datagram from one of the --multipath sockets.
+ *
+ * Output: c->c2.buf
+ */
+static void
+read_incoming_link_extra(struct context *c)
+{
+    c->c2.buf = get_context_buffers(c)->read_link_buf;
+    ASSERT(buf_init(&c->c2.buf, c->c2.frame.buf.headroom));
+
+    const int status = link_socket_read_udp_extra(c->c2.link_socket, &c->c2.buf,
+                                                  &c->c2.from);
+    check_status(status, "read", c->c2.link_socket, NULL);
+}
+#endif
+
 /*
  * Output: c->c2.buf
  */
@@ -921,7 +1141,7 @@ read_incoming_link(struct context *c)
 
     perf_push(PERF_READ_IN_LINK);
 
-    c->c2.buf = c->c2.buffers->read_link_buf;
+    c->c2.buf = get_context_buffers(c)->read_link_buf;
     ASSERT(buf_init(&c->c2.buf, c->c2.frame.buf.headroom));
 
     status = link_socket_read(c->c2.link_socket,
@@ -984,18 +1204,14 @@ process_incoming_link_part1(struct context *c, struct link_socket_info *lsi, boo
     {
         c->c2.link_read_bytes += c->c2.buf.len;
         link_read_bytes_global += c->c2.buf.len;
-#ifdef ENABLE_MEMSTATS
-        if (mmap_stats)
-        {
-            mmap_stats->link_read_bytes = link_read_bytes_global;
-        }
-#endif
+        ++c->c2.link_read_packets;
+        ++link_read_packets_global;
         c->c2.original_recv_size = c->c2.buf.len;
+        trace_event(TRACE_LINK_IN, trace_peer(c), c->c2.buf.len, 0, 0);
 #ifdef ENABLE_MANAGEMENT
         if (management)
         {
             management_bytes_client(management, c->c2.buf.len, 0);
-            management_bytes_server(management, &c->c2.link_read_bytes, &c->c2.link_write_bytes, &c->c2.mda_context);
         }
 #endif
     }
@@ -1014,6 +1230,11 @@ process_incoming_link_part1(struct context *c, struct link_socket_info *lsi, boo
         }
         corrupt_gremlin(&c->c2.buf, c->options.gremlin);
     }
+    if (c->c2.gremlin_impair && c->c2.buf.len > 0
+        && gremlin_impair_incoming(c->c2.gremlin_impair))
+    {
+        c->c2.buf.len = 0;
+    }
 #endif
 
     /* log incoming packet */
@@ -1094,9 +1315,17 @@ process_incoming_link_part1(struct context *c, struct link_socket_info *lsi, boo
             c->c2.buf.len = 0;
         }
 
-        /* authenticate and decrypt the incoming packet */
-        decrypt_status = openvpn_decrypt(&c->c2.buf, c->c2.buffers->decrypt_buf,
-                                         co, &c->c2.frame, ad_start);
+        /* authenticate and decrypt the incoming packet, in place if it is
+         * in our link read buffer */
+        struct context_buffers *b = get_context_buffers(c);
+        struct buffer work = b->decrypt_buf;
+        if (c->c2.buf.data == b->read_link_buf.data)
+        {
+            openvpn_decrypt_in_place_init(&work, &c->c2.buf, co);
+        }
+        decrypt_status = openvpn_decrypt(&c->c2.buf, work, co, &c->c2.frame, ad_start);
+        trace_event(TRACE_DECRYPT, trace_peer(c), c->c2.buf.len, 0, decrypt_status);
+        OVPN_PROBE3(link_decrypt, trace_peer(c), c->c2.buf.len, decrypt_status);
 
         if (!decrypt_status && link_socket_connection_oriented(c->c2.link_socket))
         {
@@ -1114,9 +1343,51 @@ process_incoming_link_part1(struct context *c, struct link_socket_info *lsi, boo
     return decrypt_status;
 }
 
+/*
+ * A keepalive ping that arrives exactly as we frame our own pings is
+ * accounted for right after decryption, without going through
+ * defragmentation, decompression and the tun output stage.
+ */
+static bool
+process_incoming_ping(struct context *c, struct link_socket_info *lsi)
+{
+    if (!is_framed_ping_msg(c, &c->c2.buf))
+    {
+        return false;
+    }
+
+    if (!TLS_MODE(c))
+    {
+        link_socket_set_outgoing_addr(lsi, &c->c2.from, NULL, c->c2.es);
+    }
+
+    if (c->options.ping_rec_timeout)
+    {
+        event_timeout_reset(&c->c2.ping_rec_interval);
+    }
+
+    c->c2.link_read_bytes_auth += c->c2.buf.len;
+    c->c2.max_recv_size_local = max_int(c->c2.original_recv_size, c->c2.max_recv_size_local);
+
+    dmsg(D_PING, "RECEIVED PING PACKET");
+    c->c2.buf.len = 0;
+    buf_reset(&c->c2.to_tun);
+    return true;
+}
+
 void
 process_incoming_link_part2(struct context *c, struct link_socket_info *lsi, const uint8_t *orig_buf)
 {
+    if (c->c2.fec)
+    {
+        fec_incoming(c->c2.fec, &c->c2.buf);
+    }
+
+    if (c->c2.buf.len > 0 && process_incoming_ping(c, lsi))
+    {
+        return;
+    }
+
     if (c->c2.buf.len > 0)
     {
 #ifdef ENABLE_FRAGMENT
@@ -1130,7 +1401,7 @@ process_incoming_link_part2(struct context *c, struct link_socket_info *lsi, con
         /* decompress the incoming packet */
         if (c->c2.comp_context)
         {
-            (*c->c2.comp_context->alg.decompress)(&c->c2.buf, c->c2.buffers->decompress_buf, c->c2.comp_context, &c->c2.frame);
+            (*c->c2.comp_context->alg.decompress)(&c->c2.buf, get_context_buffers(c)->decompress_buf, c->c2.comp_context, &c->c2.frame);
         }
 #endif
 
@@ -1183,7 +1454,7 @@ process_incoming_link_part2(struct context *c, struct link_socket_info *lsi, con
             process_received_occ_msg(c);
         }
 
-        buffer_turnover(orig_buf, &c->c2.to_tun, &c->c2.buf, &c->c2.buffers->read_link_buf);
+        buffer_turnover(orig_buf, &c->c2.to_tun, &c->c2.buf, &get_context_buffers(c)->read_link_buf);
 
         /* to_tun defined + unopened tuntap can cause deadlock */
         if (!tuntap_defined(c->c1.tuntap))
@@ -1205,7 +1476,15 @@ process_incoming_link(struct context *c)
     struct link_socket_info *lsi = get_link_socket_info(c);
     const uint8_t *orig_buf = c->c2.buf.data;
 
-    process_incoming_link_part1(c, lsi, false);
+    /* packets over a --multipath socket come from the address of the
+     * connection, but are not taken for a float */
+    const bool extra = c->c2.from.listener != 0;
+
+    if (process_incoming_link_part1(c, lsi, extra) && c->c2.buf.len > 0
+        && c->c2.multipath)
+    {
+        multipath_incoming(c->c2.multipath, &c->c2.from, !extra);
+    }
     process_incoming_link_part2(c, lsi, orig_buf);
 
     perf_pop();
@@ -1271,7 +1550,7 @@ read_incoming_tun(struct context *c)
 
     perf_push(PERF_READ_IN_TUN);
 
-    c->c2.buf = c->c2.buffers->read_tun_buf;
+    c->c2.buf = get_context_buffers(c)->read_tun_buf;
 
 #ifdef _WIN32
     if (c->c1.tuntap->windows_driver == WINDOWS_DRIVER_WINTUN)
@@ -1326,6 +1605,13 @@ read_incoming_tun(struct context *c)
 
     /* Check the status return from read() */
     check_status(c->c2.buf.len, "read from TUN/TAP", NULL, c->c1.tuntap);
+    trace_event(TRACE_TUN_IN, trace_peer(c), c->c2.buf.len, 0, 0);
+
+    /* device is drained, stop reading ahead */
+    if (c->c2.buf.len <= 0)
+    {
+        c->c2.tun_read_ahead = 0;
+    }
 
     perf_pop();
 }
@@ -1339,11 +1625,12 @@ read_incoming_tun(struct context *c)
  * and sent to routing table, which sends it again to tun.
  */
 static void
-drop_if_recursive_routing(struct context *c, struct buffer *buf)
+drop_if_recursive_routing(struct context *c, struct buffer *buf,
+                          const struct ip_packet_info *ipi)
 {
     bool drop = false;
     struct openvpn_sockaddr tun_sa;
-    int ip_hdr_offset = 0;
+    const int ip_hdr_offset = ipi->l3_offset;
 
     if (c->c2.to_link_addr == NULL) /* no remote addr known */
     {
@@ -1352,9 +1639,7 @@ drop_if_recursive_routing(struct context *c, struct buffer *buf)
 
     tun_sa = c->c2.to_link_addr->dest;
 
-    int proto_ver = get_tun_ip_ver(TUNNEL_TYPE(c->c1.tuntap), &c->c2.buf, &ip_hdr_offset);
-
-    if (proto_ver == 4)
+    if (ipi->version == 4)
     {
         const struct openvpn_iphdr *pip;
 
@@ -1378,7 +1663,7 @@ drop_if_recursive_routing(struct context *c, struct buffer *buf)
             drop = true;
         }
     }
-    else if (proto_ver == 6)
+    else if (ipi->version == 6)
     {
         const struct openvpn_ipv6hdr *pip6;
 
@@ -1443,9 +1728,12 @@ process_incoming_tun(struct context *c)
 
     if (c->c2.buf.len > 0)
     {
+        struct ip_packet_info ipi;
+        ip_packet_parse(TUNNEL_TYPE(c->c1.tuntap), &c->c2.buf, &ipi);
+
         if ((c->options.mode == MODE_POINT_TO_POINT) && (!c->options.allow_recursive_routing))
         {
-            drop_if_recursive_routing(c, &c->c2.buf);
+            drop_if_recursive_routing(c, &c->c2.buf, &ipi);
         }
         /*
          * The --passtos and --mssfix options require
@@ -1453,7 +1741,10 @@ process_incoming_tun(struct context *c)
          */
         unsigned int flags = PIPV4_PASSTOS | PIP_MSSFIX | PIPV4_CLIENT_NAT
                              | PIPV6_IMCP_NOHOST_CLIENT;
-        process_ip_header(c, flags, &c->c2.buf);
+        if (c->c2.buf.len > 0)
+        {
+            process_ip_header_parsed(c, flags, &c->c2.buf, &ipi);
+        }
 
 #ifdef PACKET_TRUNCATION_CHECK
         /* if (c->c2.buf.len > 1) --c->c2.buf.len; */
@@ -1563,12 +1854,12 @@ ipv6_send_icmp_unreachable(struct context *c, struct buffer *buf, bool client)
     struct buffer *outbuf;
     if (client)
     {
-        c->c2.to_tun = c->c2.buffers->aux_buf;
+        c->c2.to_tun = get_context_buffers(c)->aux_buf;
         outbuf = &(c->c2.to_tun);
     }
     else
     {
-        c->c2.to_link = c->c2.buffers->aux_buf;
+        c->c2.to_link = get_context_buffers(c)->aux_buf;
         outbuf = &(c->c2.to_link);
     }
     ASSERT(buf_init(outbuf, totalheader_len));
@@ -1615,6 +1906,19 @@ ipv6_send_icmp_unreachable(struct context *c, struct buffer *buf, bool client)
 
 void
 process_ip_header(struct context *c, unsigned int flags, struct buffer *buf)
+{
+    struct ip_packet_info ipi;
+
+    if (buf->len > 0)
+    {
+        ip_packet_parse(TUNNEL_TYPE(c->c1.tuntap), buf, &ipi);
+        process_ip_header_parsed(c, flags, buf, &ipi);
+    }
+}
+
+void
+process_ip_header_parsed(struct context *c, unsigned int flags, struct buffer *buf,
+                         const struct ip_packet_info *ipi)
 {
     if (!c->options.ce.mssfix)
     {
@@ -1654,7 +1958,7 @@ process_ip_header(struct context *c, unsigned int flags, struct buffer *buf)
                      ))
         {
             struct buffer ipbuf = *buf;
-            if (is_ipv4(TUNNEL_TYPE(c->c1.tuntap), &ipbuf))
+            if (ipi->version == 4 && buf_advance(&ipbuf, ipi->l3_offset))
             {
 #if PASSTOS_CAPABILITY
                 /* extract TOS from IP header */
@@ -1665,9 +1969,9 @@ process_ip_header(struct context *c, unsigned int flags, struct buffer *buf)
 #endif
 
                 /* possibly alter the TCP MSS */
-                if (flags & PIP_MSSFIX)
+                if ((flags & PIP_MSSFIX) && ipi->l4_proto == OPENVPN_IPPROTO_TCP)
                 {
-                    mss_fixup_ipv4(&ipbuf, c->c2.frame.mss_fix);
+                    mss_fixup_packet(buf, ipi, c->c2.frame.mss_fix);
                 }
 
                 /* possibly do NAT on packet */
@@ -1686,12 +1990,12 @@ process_ip_header(struct context *c, unsigned int flags, struct buffer *buf)
                     }
                 }
             }
-            else if (is_ipv6(TUNNEL_TYPE(c->c1.tuntap), &ipbuf))
+            else if (ipi->version == 6 && buf_advance(&ipbuf, ipi->l3_offset))
             {
                 /* possibly alter the TCP MSS */
-                if (flags & PIP_MSSFIX)
+                if ((flags & PIP_MSSFIX) && ipi->l4_proto == OPENVPN_IPPROTO_TCP)
                 {
-                    mss_fixup_ipv6(&ipbuf, c->c2.frame.mss_fix);
+                    mss_fixup_packet(buf, ipi, c->c2.frame.mss_fix);
                 }
                 if (!(flags & PIP_OUTGOING) && (flags
                                                 &(PIPV6_IMCP_NOHOST_CLIENT | PIPV6_IMCP_NOHOST_SERVER)))
@@ -1709,13 +2013,17 @@ process_ip_header(struct context *c, unsigned int flags, struct buffer *buf)
 
 /*
  * Input: c->c2.to_link
+ *
+ * Returns true if the packet was not written because the socket
+ * would have blocked.
  */
 
-void
-process_outgoing_link(struct context *c)
+static bool
+process_outgoing_link_dowork(struct context *c)
 {
     struct gc_arena gc = gc_new();
     int error_code = 0;
+    bool blocked = false;
 
     perf_push(PERF_PROC_OUT_LINK);
 
@@ -1729,8 +2037,12 @@ process_outgoing_link(struct context *c)
         ASSERT(link_socket_actual_defined(c->c2.to_link_addr));
 
 #ifdef ENABLE_DEBUG
-        /* In gremlin-test mode, we may choose to drop this packet */
-        if (!c->options.gremlin || ask_gremlin(c->options.gremlin))
+        /* In gremlin-test mode, we may choose to drop this packet,
+         * --gremlin-impair may also hold it back for later */
+        if ((!c->options.gremlin || ask_gremlin(c->options.gremlin))
+            && !(c->c2.gremlin_impair
+                 && gremlin_impair_outgoing(c->c2.gremlin_impair, &c->c2.to_link,
+                                            c->c2.to_link_addr)))
 #endif
         {
             /*
@@ -1791,17 +2103,12 @@ process_outgoing_link(struct context *c)
                 c->c2.max_send_size_local = max_int(size, c->c2.max_send_size_local);
                 c->c2.link_write_bytes += size;
                 link_write_bytes_global += size;
-#ifdef ENABLE_MEMSTATS
-                if (mmap_stats)
-                {
-                    mmap_stats->link_write_bytes = link_write_bytes_global;
-                }
-#endif
+                ++c->c2.link_write_packets;
+                ++link_write_packets_global;
 #ifdef ENABLE_MANAGEMENT
                 if (management)
                 {
                     management_bytes_client(management, 0, size);
-                    management_bytes_server(management, &c->c2.link_read_bytes, &c->c2.link_write_bytes, &c->c2.mda_context);
                 }
 #endif
             }
@@ -1809,6 +2116,7 @@ process_outgoing_link(struct context *c)
 
         /* Check return status */
         error_code = openvpn_errno();
+        trace_event(TRACE_LINK_OUT, trace_peer(c), size, 0, 0);
         check_status(size, "write", c->c2.link_socket, NULL);
 
         if (size > 0)
@@ -1844,6 +2152,13 @@ process_outgoing_link(struct context *c)
             msg(M_INFO, "Network unreachable, restarting");
             register_signal(c->sig, SIGUSR1, "network-unreachable");
         }
+
+        blocked = size < 0 && error_code ==
+#ifdef _WIN32
+                  WSAEWOULDBLOCK;
+#else
+                  EAGAIN;
+#endif
     }
     else
     {
@@ -1856,37 +2171,73 @@ process_outgoing_link(struct context *c)
         }
     }
 
-    buf_reset(&c->c2.to_link);
-
     perf_pop();
     gc_free(&gc);
+    return blocked;
 }
 
 /*
- * Input: c->c2.to_tun
+ * Input: c->c2.to_link
+ *
+ * With a c->c2.link_queue, a packet the socket does not take right away
+ * waits there, behind those that already do, and the context goes on
+ * reading from the tun/tap device.
  */
 
 void
-process_outgoing_tun(struct context *c)
+process_outgoing_link(struct context *c)
 {
-    /*
-     * Set up for write() call to TUN/TAP
-     * device.
-     */
-    if (c->c2.to_tun.len <= 0)
+    struct packet_queue *q = c->c2.link_queue;
+    bool blocked = false;
+
+    if (c->c2.to_link.len > 0)
     {
-        return;
+        /* the socket may prepend to the buffer, keep the packet as it is */
+        const struct buffer pkt = c->c2.to_link;
+
+        if (pktq_empty(q))
+        {
+            blocked = process_outgoing_link_dowork(c);
+        }
+        if (q && (blocked || !pktq_empty(q))
+            && !pktq_push(q, &pkt, c->c2.to_link_addr))
+        {
+            msg(D_LINK_ERRORS, "TCP/UDP packet dropped, %d packets are waiting "
+                "for the socket", q->len);
+        }
+        buf_reset(&c->c2.to_link);
     }
 
-    perf_push(PERF_PROC_OUT_TUN);
+    /* write the packets that are waiting until the socket blocks again */
+    if (!blocked && !pktq_empty(q))
+    {
+        struct link_socket_actual *to_link_addr = c->c2.to_link_addr;
 
-    /*
-     * The --mssfix option requires
-     * us to examine the IP header (IPv4 or IPv6).
-     */
-    process_ip_header(c,
-                      PIP_MSSFIX | PIPV4_EXTRACT_DHCP_ROUTER | PIPV4_CLIENT_NAT | PIP_OUTGOING,
-                      &c->c2.to_tun);
+        while (!blocked && !pktq_empty(q) && !IS_SIG(c))
+        {
+            c->c2.to_link_addr = pktq_front(q, &c->c2.to_link);
+            blocked = process_outgoing_link_dowork(c);
+            if (!blocked)
+            {
+                pktq_pop(q);
+            }
+            buf_reset(&c->c2.to_link);
+        }
+        c->c2.to_link_addr = to_link_addr;
+    }
+}
+
+/*
+ * Input: c->c2.to_tun, after process_ip_header()
+ *
+ * Returns true if the packet was not written because the device
+ * would have blocked.
+ */
+
+static bool
+process_outgoing_tun_dowork(struct context *c)
+{
+    bool blocked = false;
 
     if (c->c2.to_tun.len <= c->c2.frame.buf.payload_size)
     {
@@ -1921,6 +2272,11 @@ process_outgoing_tun(struct context *c)
         {
             c->c2.tun_write_bytes += size;
         }
+        trace_event(TRACE_TUN_OUT, trace_peer(c), size, 0, 0);
+        OVPN_PROBE2(tun_write, trace_peer(c), size);
+#ifndef _WIN32
+        blocked = size < 0 && errno == EAGAIN;
+#endif
         check_status(size, "write to TUN/TAP", NULL, c->c1.tuntap);
 
         /* check written packet size */
@@ -1951,7 +2307,64 @@ process_outgoing_tun(struct context *c)
             c->c2.frame.buf.payload_size);
     }
 
-    buf_reset(&c->c2.to_tun);
+    return blocked;
+}
+
+/*
+ * Input: c->c2.to_tun
+ *
+ * With a c->c2.tun_queue, a packet the device does not take right away
+ * waits there, behind those that already do, and the context goes on
+ * reading from the link.
+ */
+
+void
+process_outgoing_tun(struct context *c)
+{
+    struct packet_queue *q = c->c2.tun_queue;
+    bool blocked = false;
+
+    if (c->c2.to_tun.len <= 0 && pktq_empty(q))
+    {
+        return;
+    }
+
+    perf_push(PERF_PROC_OUT_TUN);
+
+    if (c->c2.to_tun.len > 0)
+    {
+        /*
+         * The --mssfix option requires
+         * us to examine the IP header (IPv4 or IPv6).
+         */
+        process_ip_header(c,
+                          PIP_MSSFIX | PIPV4_EXTRACT_DHCP_ROUTER | PIPV4_CLIENT_NAT | PIP_OUTGOING,
+                          &c->c2.to_tun);
+
+        if (pktq_empty(q))
+        {
+            blocked = process_outgoing_tun_dowork(c);
+        }
+        if (q && (blocked || !pktq_empty(q))
+            && !pktq_push(q, &c->c2.to_tun, NULL))
+        {
+            msg(D_LINK_ERRORS, "TUN/TAP packet dropped, %d packets are waiting "
+                "for the device", q->len);
+        }
+        buf_reset(&c->c2.to_tun);
+    }
+
+    /* write the packets that are waiting until the device blocks again */
+    while (!blocked && !pktq_empty(q))
+    {
+        pktq_front(q, &c->c2.to_tun);
+        blocked = process_outgoing_tun_dowork(c);
+        if (!blocked)
+        {
+            pktq_pop(q);
+        }
+        buf_reset(&c->c2.to_tun);
+    }
 
     perf_pop();
 }
@@ -2018,10 +2431,248 @@ pre_select(struct context *c)
     }
 #endif
 
+    /* Should we send a --fec repair packet? */
+    if (c->c2.fec)
+    {
+        check_fec(c);
+    }
+
+#ifdef ENABLE_DEBUG
+    /* Should we send a packet held back by --gremlin-impair? */
+    if (c->c2.gremlin_impair)
+    {
+        check_gremlin_impair(c);
+    }
+#endif
+
+    /* remember when the earliest timer above is due */
+    c->c2.pre_select_wakeup = now + c->c2.timeval.tv_sec;
+
+    check_keepalive_timers(c);
+    if (c->sig->signal_received)
+    {
+        return;
+    }
+
     /* Update random component of timeout */
     check_timeout_random_component(c);
 }
 
+void
+pre_select_idle(struct context *c)
+{
+    c->c2.timeval.tv_sec = c->c2.pre_select_wakeup - now;
+    c->c2.timeval.tv_usec = 0;
+
+    check_keepalive_timers(c);
+    if (c->sig->signal_received)
+    {
+        return;
+    }
+
+    check_timeout_random_component(c);
+}
+
+bool
+pre_select_needed(const struct context *c)
+{
+    if (now >= c->c2.pre_select_wakeup)
+    {
+        return true;
+    }
+
+    /* control channel was active recently, see check_tls() */
+    if (c->c2.tmp_int.last_action + c->c2.tmp_int.horizon > now)
+    {
+        return true;
+    }
+
+    if (tls_test_payload_len(c->c2.tls_multi) > 0 || tls_errors_pending(c))
+    {
+        return true;
+    }
+
+    if (c->c2.occ_op >= 0)
+    {
+        return true;
+    }
+
+#ifdef ENABLE_FRAGMENT
+    if (c->c2.fragment && fragment_outgoing_defined(c->c2.fragment))
+    {
+        return true;
+    }
+#endif
+
+    if (c->c2.fec && fec_repair_pending(c->c2.fec))
+    {
+        return true;
+    }
+
+#ifdef ENABLE_DEBUG
+    struct timeval tv = { BIG_TIMEOUT, 0 };
+    if (c->c2.gremlin_impair && gremlin_impair_wakeup(c->c2.gremlin_impair, &tv))
+    {
+        return true;
+    }
+#endif
+
+    return false;
+}
+
+/*
+ * Adapt the --spin-wait budget to how long the event loop waited: grow
+ * it while events keep arriving within the budget, size it to catch
+ * events that arrived shortly after the spinning stopped, and halve it
+ * when the link goes quiet.
+ */
+static void
+event_wait_spin_adapt(struct context *c, bool hit, int status, const struct timeval *start)
+{
+    const int max_usec = c->options.spin_wait;
+    struct timeval tv;
+    int gap;
+
+    if (hit)
+    {
+        c->c2.spin_usec = min_int(max_usec, c->c2.spin_usec + c->c2.spin_usec / 4 + 1);
+        return;
+    }
+
+    openvpn_gettimeofday(&tv, NULL);
+    gap = tv_subtract(&tv, start, 1);
+    if (status > 0 && gap <= max_usec)
+    {
+        c->c2.spin_usec = min_int(max_usec, 2 * gap);
+    }
+    else
+    {
+        c->c2.spin_usec /= 2;
+    }
+}
+
+static inline uint64_t
+event_loop_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+static inline int
+event_loop_bucket(const int *bounds, const uint64_t value)
+{
+    int i = 0;
+    while (i < EVENT_LOOP_BUCKETS - 1 && value > (uint64_t) bounds[i])
+    {
+        ++i;
+    }
+    return i;
+}
+
+/*
+ * The event loop is about to wait: account the time since the last
+ * wait returned as the busy time of one iteration.  Repeated calls
+ * before the wait returns are ignored.
+ */
+static void
+event_loop_wait_begin(void)
+{
+    struct event_loop_stats *st = &event_loop_stats_global;
+
+    if (st->waiting)
+    {
+        return;
+    }
+    st->waiting = true;
+
+    if (st->wakeup)
+    {
+        const uint64_t busy = event_loop_now() - st->wakeup;
+        ++st->iterations;
+        st->busy_usec += busy;
+        ++st->busy_bucket[event_loop_bucket(event_loop_busy_bounds, busy)];
+    }
+}
+
+static void
+event_loop_wait_end(const int status)
+{
+    struct event_loop_stats *st = &event_loop_stats_global;
+    const int n = max_int(status, 0);
+
+    st->waiting = false;
+    st->wakeup = event_loop_now();
+    st->events += n;
+    ++st->events_bucket[event_loop_bucket(event_loop_events_bounds, n)];
+}
+
+static int
+event_wait_spin_dowork(struct context *c, struct event_set *es, const struct timeval *tv,
+                       struct event_set_return *out, int outlen)
+{
+    const struct timeval tv_zero = { 0, 0 };
+    struct timeval start, t;
+    int status = 0, budget, spun = 0;
+
+    if (c->options.spin_wait <= 0 || (tv->tv_sec == 0 && tv->tv_usec == 0))
+    {
+        return event_wait(es, tv, out, outlen);
+    }
+
+    openvpn_gettimeofday(&start, NULL);
+
+    /* --spin-wait cpu-percent: spin at most that share of every second */
+    if (start.tv_sec != c->c2.spin_window)
+    {
+        c->c2.spin_window = start.tv_sec;
+        c->c2.spin_window_usec = 0;
+    }
+    budget = min_int(c->c2.spin_usec,
+                     c->options.spin_wait_cpu * 10000 - c->c2.spin_window_usec);
+    if (tv->tv_sec == 0)
+    {
+        budget = min_int(budget, tv->tv_usec);
+    }
+
+    if (budget > 0)
+    {
+        do
+        {
+            status = event_wait(es, &tv_zero, out, outlen);
+            openvpn_gettimeofday(&t, NULL);
+            spun = tv_subtract(&t, &start, 1);
+        } while (status == 0 && spun < budget);
+        c->c2.spin_window_usec += spun;
+    }
+
+    if (status != 0)
+    {
+        event_wait_spin_adapt(c, true, status, &start);
+        return status;
+    }
+
+    status = event_wait(es, tv, out, outlen);
+    event_wait_spin_adapt(c, false, status, &start);
+    return status;
+}
+
+int
+event_wait_spin(struct context *c, struct event_set *es, const struct timeval *tv,
+                struct event_set_return *out, int outlen)
+{
+    event_loop_wait_begin();
+    const int status = event_wait_spin_dowork(c, es, tv, out, outlen);
+    event_loop_wait_end(status);
+    return status;
+}
+
 /*
  * Wait for I/O events.  Used for both TCP & UDP sockets
  * in point-to-point mode and for UDP sockets in
@@ -2050,6 +2701,12 @@ io_wait_dowork(struct context *c, const unsigned int flags)
 #if defined(TARGET_LINUX) || defined(TARGET_FREEBSD)
     static int dco_shift = DCO_SHIFT;    /* Event from DCO linux kernel module */
 #endif
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    static int pkcs11_shift = PKCS11_SHIFT;
+#endif
+#ifndef _WIN32
+    static int socket_extra_shift = SOCKET_EXTRA_SHIFT;
+#endif
 
     /*
      * Decide what kind of events we want to wait for.
@@ -2133,6 +2790,19 @@ io_wait_dowork(struct context *c, const unsigned int flags)
         socket |= EVENT_WRITE;
     }
 
+    /*
+     * packets waiting in the queues of the context?  Unlike a pending
+     * to_link or to_tun, they do not keep us from reading.
+     */
+    if (flags & IOW_LINK_QUEUED)
+    {
+        socket |= EVENT_WRITE;
+    }
+    if (flags & IOW_TUN_QUEUED)
+    {
+        tuntap |= EVENT_WRITE;
+    }
+
     /*
      * Force wait on TUN input, even if also waiting on TCP/UDP output
      */
@@ -2141,6 +2811,16 @@ io_wait_dowork(struct context *c, const unsigned int flags)
         tuntap |= EVENT_READ;
     }
 
+    /*
+     * Send the datagrams queued by --udp-send-batch before waiting, and
+     * wait until the socket is writable again if it did not take them all.
+     */
+    link_socket_send_batch_flush(c->c2.link_socket);
+    if (link_socket_send_batch_queued(c->c2.link_socket))
+    {
+        socket |= EVENT_WRITE;
+    }
+
 #ifdef _WIN32
     if (tuntap_is_wintun(c->c1.tuntap))
     {
@@ -2156,6 +2836,17 @@ io_wait_dowork(struct context *c, const unsigned int flags)
      * Configure event wait based on socket, tuntap flags.
      */
     socket_set(c->c2.link_socket, c->c2.event_set, socket, (void *)&socket_shift, NULL);
+#ifndef _WIN32
+    if ((socket & EVENT_READ) && c->c2.link_socket)
+    {
+        /* --listen-extra sockets are only read from */
+        for (int i = 0; i < c->c2.link_socket->n_extra; ++i)
+        {
+            event_ctl(c->c2.event_set, c->c2.link_socket->extra_sd[i], EVENT_READ,
+                      (void *)&socket_extra_shift);
+        }
+    }
+#endif
     tun_set(c->c1.tuntap, c->c2.event_set, tuntap, (void *)&tun_shift, NULL);
 #if defined(TARGET_LINUX) || defined(TARGET_FREEBSD)
     if (socket & EVENT_READ && c->c2.did_open_tun)
@@ -2179,6 +2870,14 @@ io_wait_dowork(struct context *c, const unsigned int flags)
     }
 #endif
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    /* signatures finished by --pkcs11-sign-thread */
+    if (pkcs11_sign_event_fd() >= 0)
+    {
+        event_ctl(c->c2.event_set, pkcs11_sign_event_fd(), EVENT_READ, (void *)&pkcs11_shift);
+    }
+#endif
+
     /*
      * Possible scenarios:
      *  (1) tcp/udp port has data available to read
@@ -2204,10 +2903,39 @@ io_wait_dowork(struct context *c, const unsigned int flags)
             }
 #endif
 
+            status = 0;
+#ifdef _WIN32
+            /*
+             * With packets written to the wintun ring that the driver was
+             * not told about yet, poll without sleeping first so that
+             * back-to-back packets join the batch, and only tell the
+             * driver when nothing else is ready.
+             */
+            if (wintun_receive_pending(c->c1.tuntap))
+            {
+                const struct timeval tv_zero = { 0, 0 };
+
+                event_loop_wait_begin();
+                status = event_wait(c->c2.event_set, &tv_zero, esr, SIZE(esr));
+                if (status == 0)
+                {
+                    wintun_receive_flush(c->c1.tuntap);
+                }
+                else
+                {
+                    event_loop_wait_end(status);
+                }
+            }
+#endif
+
             /*
              * Wait for something to happen.
              */
-            status = event_wait(c->c2.event_set, &c->c2.timeval, esr, SIZE(esr));
+            if (status == 0)
+            {
+                msg_flush();
+                status = event_wait_spin(c, c->c2.event_set, &c->c2.timeval, esr, SIZE(esr));
+            }
 
             check_status(status, "event_wait", NULL, NULL);
 
@@ -2225,6 +2953,13 @@ io_wait_dowork(struct context *c, const unsigned int flags)
             {
                 c->c2.event_set_status = ES_TIMEOUT;
             }
+
+            /* refill the --tun-read-ahead budget after waiting for tun input */
+            if (tuntap & EVENT_READ)
+            {
+                c->c2.tun_read_ahead = (status > 0 && (c->c2.event_set_status & TUN_READ))
+                                       ? c->options.tun_read_ahead : 0;
+            }
         }
         else
         {
@@ -2233,7 +2968,8 @@ io_wait_dowork(struct context *c, const unsigned int flags)
     }
 
     /* 'now' should always be a reasonably up-to-date timestamp */
-    update_time();
+    update_time_usec();
+    msg_defer_flush();
 
     /* set signal_received if a signal was received */
     if (c->c2.event_set_status & ES_ERROR)
@@ -2276,6 +3012,17 @@ process_io(struct context *c)
             process_incoming_link(c);
         }
     }
+#ifndef _WIN32
+    /* Incoming data on a --multipath socket */
+    else if (status & SOCKET_EXTRA_READ)
+    {
+        read_incoming_link_extra(c);
+        if (!IS_SIG(c) && c->c2.buf.len > 0)
+        {
+            process_incoming_link(c);
+        }
+    }
+#endif
     /* Incoming data on TUN device */
     else if (status & TUN_READ)
     {
@@ -50,6 +50,7 @@
 #include "openvpn.h"
 #include "occ.h"
 #include "ping.h"
+#include "trace.h"
 
 #define IOW_TO_TUN          (1<<0)
 #define IOW_TO_LINK         (1<<1)
@@ -61,6 +62,8 @@
 #define IOW_MBUF            (1<<7)
 #define IOW_READ_TUN_FORCE  (1<<8)
 #define IOW_WAIT_SIGNAL     (1<<9)
+#define IOW_LINK_QUEUED     (1<<10)
+#define IOW_TUN_QUEUED      (1<<11)
 
 #define IOW_READ            (IOW_READ_TUN|IOW_READ_LINK)
 
@@ -68,10 +71,76 @@ extern counter_type link_read_bytes_global;
 
 extern counter_type link_write_bytes_global;
 
+extern counter_type link_read_packets_global;
+
+extern counter_type link_write_packets_global;
+
+/** Number of buckets of the event loop histograms, the last one counts
+ *  the values above all the bounds. */
+#define EVENT_LOOP_BUCKETS 8
+
+/** Upper bounds of the finite buckets, in microseconds of busy time and
+ *  in events per wait. */
+extern const int event_loop_busy_bounds[EVENT_LOOP_BUCKETS - 1];
+extern const int event_loop_events_bounds[EVENT_LOOP_BUCKETS - 1];
+
+/**
+ * Process wide statistics of the main event loop, collected in
+ * \c event_wait_spin().  The busy time of an iteration, from the return
+ * of one wait to the start of the next, is also the longest time an
+ * event which became ready during the iteration waited to be handled.
+ */
+struct event_loop_stats
+{
+    counter_type iterations;
+    counter_type busy_usec;     /**< sum of the busy times */
+    counter_type busy_bucket[EVENT_LOOP_BUCKETS];  /**< not cumulative */
+    counter_type events;        /**< sum of the events returned by the waits */
+    counter_type events_bucket[EVENT_LOOP_BUCKETS]; /**< per wait, not cumulative */
+    uint64_t wakeup;            /**< return of the last wait, in microseconds */
+    bool waiting;
+};
+
+extern struct event_loop_stats event_loop_stats_global;
+
 void io_wait_dowork(struct context *c, const unsigned int flags);
 
+/**
+ * Like \c event_wait(), but with \c --spin-wait first poll \c es
+ * without sleeping for up to an adaptive budget, so that events which
+ * arrive soon are handled without a wakeup from sleep.
+ */
+int event_wait_spin(struct context *c, struct event_set *es, const struct timeval *tv,
+                    struct event_set_return *out, int outlen);
+
 void pre_select(struct context *c);
 
+/**
+ * Check whether \c pre_select() could change anything for this context.
+ *
+ * This is false while none of the timers that \c pre_select() looked at
+ * last time is due yet and nothing is waiting for the control channel,
+ * OCC or fragment handling.  The keepalive timers are not part of it,
+ * \c pre_select_idle() serves them.  Data channel packets only move those
+ * further out, so the wakeup time computed by the last \c pre_select()
+ * still holds for them.
+ *
+ * @param c     The context structure of the VPN tunnel.
+ *
+ * @return true if \c pre_select() has to be called.
+ */
+bool pre_select_needed(const struct context *c);
+
+/**
+ * Cheap replacement for \c pre_select() while \c pre_select_needed()
+ * is false: only serve the keepalive timers (\c --ping,
+ * \c --ping-restart and \c --inactive) and shorten the I/O wait
+ * timeout to the earliest timer found by the last \c pre_select().
+ *
+ * @param c     The context structure of the VPN tunnel.
+ */
+void pre_select_idle(struct context *c);
+
 void process_io(struct context *c);
 
 /**********************************************************************/
@@ -109,6 +178,15 @@ void process_io(struct context *c);
  */
 void encrypt_sign(struct context *c, bool comp_frag);
 
+/**
+ * Compress and fragment the packet in \c c->c2.buf, the first step of
+ * \c encrypt_sign() when its \c comp_frag parameter is true.
+ *
+ * @param c - The context structure of the VPN tunnel associated with this
+ *     packet.
+ */
+void compress_fragment(struct context *c);
+
 int get_server_poll_remaining_time(struct event_timeout *server_poll_timeout);
 
 /**********************************************************************/
@@ -302,6 +380,13 @@ void reschedule_multi_process(struct context *c);
 
 void process_ip_header(struct context *c, unsigned int flags, struct buffer *buf);
 
+/**
+ * Like process_ip_header(), for a packet whose headers were already
+ * parsed with ip_packet_parse().
+ */
+void process_ip_header_parsed(struct context *c, unsigned int flags, struct buffer *buf,
+                              const struct ip_packet_info *ipi);
+
 void schedule_exit(struct context *c, const int n_seconds, const int signal);
 
 static inline struct link_socket_info *
@@ -320,6 +405,10 @@ get_link_socket_info(struct context *c)
 static inline void
 register_activity(struct context *c, const int size)
 {
+    if (c->options.compact_idle)
+    {
+        event_timeout_reset(&c->c2.compact_idle_interval);
+    }
     if (c->options.inactivity_timeout)
     {
         c->c2.inactivity_bytes += size;
@@ -347,6 +436,23 @@ p2p_iow_flags(const struct context *c)
     {
         flags |= IOW_TO_TUN;
     }
+    /* read on while the queue of the other direction has room */
+    if (!pktq_empty(c->c2.link_queue))
+    {
+        flags |= IOW_LINK_QUEUED;
+        if (pktq_full(c->c2.link_queue))
+        {
+            flags &= ~IOW_READ_TUN;
+        }
+    }
+    if (!pktq_empty(c->c2.tun_queue))
+    {
+        flags |= IOW_TUN_QUEUED;
+        if (pktq_full(c->c2.tun_queue))
+        {
+            flags &= ~IOW_READ_LINK;
+        }
+    }
 #ifdef _WIN32
     if (tuntap_ring_empty(c->c1.tuntap))
     {
@@ -363,7 +469,8 @@ p2p_iow_flags(const struct context *c)
 static inline void
 io_wait(struct context *c, const unsigned int flags)
 {
-    if (c->c2.fast_io && (flags & (IOW_TO_TUN|IOW_TO_LINK|IOW_MBUF)))
+    if (c->c2.fast_io && (flags & (IOW_TO_TUN|IOW_TO_LINK|IOW_MBUF))
+        && !((flags & IOW_MBUF) && (flags & IOW_READ)))
     {
         /* fast path -- only for TUN/TAP/UDP writes */
         unsigned int ret = 0;
@@ -404,6 +511,29 @@ io_wait(struct context *c, const unsigned int flags)
             c->c2.event_set_status = ret;
         }
         else
+#else  /* ifdef _WIN32 */
+        /*
+         * Segments of a --tun-offload super-packet are handed out
+         * without waiting.  With --tun-read-ahead, the last wait
+         * reported the tun device as readable, so keep reading from it
+         * until it runs dry or the budget is used up, unless a timer is
+         * due.
+         */
+        if ((flags & (IOW_READ_TUN|IOW_TO_TUN|IOW_TO_LINK|IOW_MBUF
+                      |IOW_LINK_QUEUED|IOW_TUN_QUEUED)) == IOW_READ_TUN
+            && !((flags & IOW_FRAG) && TO_LINK_FRAG(c))
+            && !c->sig->signal_received
+            && (tun_read_residual(c->c1.tuntap)
+                || (c->c2.tun_read_ahead > 0
+                    && (c->c2.timeval.tv_sec || c->c2.timeval.tv_usec))))
+        {
+            if (!tun_read_residual(c->c1.tuntap))
+            {
+                c->c2.tun_read_ahead--;
+            }
+            c->c2.event_set_status = TUN_READ;
+        }
+        else
 #endif /* ifdef _WIN32 */
         {
             /* slow path */
@@ -412,6 +542,13 @@ io_wait(struct context *c, const unsigned int flags)
     }
 }
 
+/* peer-id of the context for trace_event() */
+static inline uint32_t
+trace_peer(const struct context *c)
+{
+    return c->c2.tls_multi ? c->c2.tls_multi->peer_id : TRACE_PEER_NONE;
+}
+
 static inline bool
 connection_established(struct context *c)
 {
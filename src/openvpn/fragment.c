@@ -37,23 +37,90 @@
 
 #define FRAG_ERR(s) { errmsg = s; goto error; }
 
+/*
+ * Reassembly buffers not in use by any tunnel instance.  They are shared
+ * by all instances, so that instances without fragmented packets in
+ * flight do not hold on to any.
+ */
+static struct {
+    struct buffer bufs[FRAG_POOL_SIZE];
+    int n;
+    int n_masters;
+} fragment_pool;
+
+static struct buffer
+fragment_pool_get(const struct frame *frame)
+{
+    while (fragment_pool.n > 0)
+    {
+        struct buffer buf = fragment_pool.bufs[--fragment_pool.n];
+        if (buf.capacity >= BUF_SIZE(frame))
+        {
+            return buf;
+        }
+        free_buf(&buf);
+    }
+    return alloc_buf(BUF_SIZE(frame));
+}
+
 static void
-fragment_list_buf_init(struct fragment_list *list, const struct frame *frame)
+fragment_pool_put(struct buffer *buf)
 {
-    int i;
-    for (i = 0; i < N_FRAG_BUF; ++i)
+    if (buf->data)
     {
-        list->fragments[i].buf = alloc_buf(BUF_SIZE(frame));
+        if (fragment_pool.n < FRAG_POOL_SIZE)
+        {
+            fragment_pool.bufs[fragment_pool.n++] = *buf;
+            CLEAR(*buf);
+        }
+        else
+        {
+            free_buf(buf);
+        }
     }
 }
 
 static void
-fragment_list_buf_free(struct fragment_list *list)
+fragment_pool_drain(void)
 {
-    int i;
-    for (i = 0; i < N_FRAG_BUF; ++i)
+    while (fragment_pool.n > 0)
     {
-        free_buf(&list->fragments[i].buf);
+        free_buf(&fragment_pool.bufs[--fragment_pool.n]);
+    }
+}
+
+static inline int
+index_of_lowest_bit(unsigned int x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctz(x);
+#else
+    int i = 0;
+    while (!(x & 1u))
+    {
+        x >>= 1;
+        ++i;
+    }
+    return i;
+#endif
+}
+
+/* end reassembly in slot i and give its buffer back to the pool */
+static void
+fragment_list_release(struct fragment_list *list, int i)
+{
+    static_assert(N_FRAG_BUF <= sizeof(list->active) * 8, "fragment_list.active too narrow");
+    list->fragments[i].defined = false;
+    list->active &= ~(1u << i);
+    fragment_pool_put(&list->fragments[i].buf);
+}
+
+static void
+fragment_list_release_all(struct fragment_list *list)
+{
+    while (list->active)
+    {
+        fragment_list_release(list, index_of_lowest_bit(list->active));
     }
 }
 
@@ -67,18 +134,18 @@ fragment_list_get_buf(struct fragment_list *list, int seq_id)
     int diff;
     if (abs(diff = modulo_subtract(seq_id, list->seq_id, N_SEQ_ID)) >= N_FRAG_BUF)
     {
-        int i;
-        for (i = 0; i < N_FRAG_BUF; ++i)
-        {
-            list->fragments[i].defined = false;
-        }
+        fragment_list_release_all(list);
         list->index = 0;
         list->seq_id = seq_id;
         diff = 0;
     }
     while (diff > 0)
     {
-        list->fragments[list->index = modulo_add(list->index, 1, N_FRAG_BUF)].defined = false;
+        list->index = modulo_add(list->index, 1, N_FRAG_BUF);
+        if (list->active & (1u << list->index))
+        {
+            fragment_list_release(list, list->index);
+        }
         list->seq_id = modulo_add(list->seq_id, 1, N_SEQ_ID);
         --diff;
     }
@@ -106,24 +173,37 @@ fragment_init(struct frame *frame)
 
     event_timeout_init(&ret->wakeup, FRAG_WAKEUP_INTERVAL, now);
 
+    ++fragment_pool.n_masters;
     return ret;
 }
 
 void
 fragment_free(struct fragment_master *f)
 {
-    fragment_list_buf_free(&f->incoming);
+    fragment_list_release_all(&f->incoming);
+    fragment_pool_put(&f->incoming_done);
     free_buf(&f->outgoing);
     free_buf(&f->outgoing_return);
     free(f);
+
+    if (--fragment_pool.n_masters == 0)
+    {
+        fragment_pool_drain();
+    }
 }
 
-void
-fragment_frame_init(struct fragment_master *f, const struct frame *frame)
+size_t
+fragment_mem_usage(const struct fragment_master *f)
 {
-    fragment_list_buf_init(&f->incoming, frame);
-    f->outgoing = alloc_buf(BUF_SIZE(frame));
-    f->outgoing_return = alloc_buf(BUF_SIZE(frame));
+    size_t bytes = sizeof(*f)
+                   + buf_mem_usage(&f->outgoing)
+                   + buf_mem_usage(&f->outgoing_return);
+
+    for (int i = 0; i < N_FRAG_BUF; ++i)
+    {
+        bytes += buf_mem_usage(&f->incoming.fragments[i].buf);
+    }
+    return bytes;
 }
 
 /*
@@ -140,6 +220,9 @@ fragment_incoming(struct fragment_master *f, struct buffer *buf,
     fragment_header_type flags = 0;
     int frag_type = 0;
 
+    /* the packet we returned last time has been dealt with by now */
+    fragment_pool_put(&f->incoming_done);
+
     if (buf->len > 0)
     {
         /* get flags from packet head */
@@ -209,7 +292,12 @@ fragment_incoming(struct fragment_master *f, struct buffer *buf,
                 frag->defined = true;
                 frag->max_frag_size = size;
                 frag->map = 0;
+                if (!frag->buf.data)
+                {
+                    frag->buf = fragment_pool_get(frame);
+                }
                 ASSERT(buf_init(&frag->buf, frame->buf.headroom));
+                f->incoming.active |= 1u << (frag - f->incoming.fragments);
             }
 
             /* copy the data to fragment buffer */
@@ -227,8 +315,11 @@ fragment_incoming(struct fragment_master *f, struct buffer *buf,
             /* received full datagram? */
             if ((frag->map & FRAG_MAP_MASK) == FRAG_MAP_MASK)
             {
-                frag->defined = false;
-                *buf = frag->buf;
+                /* hand the buffer out, it goes back to the pool on the next call */
+                f->incoming_done = frag->buf;
+                CLEAR(frag->buf);
+                fragment_list_release(&f->incoming, frag - f->incoming.fragments);
+                *buf = f->incoming_done;
             }
             else
             {
@@ -340,6 +431,11 @@ fragment_outgoing(struct fragment_master *f, struct buffer *buf,
             {
                 FRAG_ERR("too many fragments would be required to send datagram");
             }
+            if (!f->outgoing.data)
+            {
+                f->outgoing = alloc_buf(BUF_SIZE(frame));
+                f->outgoing_return = alloc_buf(BUF_SIZE(frame));
+            }
             ASSERT(buf_init(&f->outgoing, frame->buf.headroom));
             ASSERT(buf_copy(&f->outgoing, buf));
             f->outgoing_seq_id = modulo_add(f->outgoing_seq_id, 1, N_SEQ_ID);
@@ -412,18 +508,39 @@ fragment_ready_to_send(struct fragment_master *f, struct buffer *buf,
 static void
 fragment_ttl_reap(struct fragment_master *f)
 {
-    int i;
-    for (i = 0; i < N_FRAG_BUF; ++i)
+    unsigned int active = f->incoming.active;
+    while (active)
     {
-        struct fragment *frag = &f->incoming.fragments[i];
-        if (frag->defined && frag->timestamp + FRAG_TTL_SEC <= now)
+        const int i = index_of_lowest_bit(active);
+        active &= active - 1;
+        if (f->incoming.fragments[i].timestamp + FRAG_TTL_SEC <= now)
         {
             msg(D_FRAG_ERRORS, "FRAG TTL expired i=%d", i);
-            frag->defined = false;
+            fragment_list_release(&f->incoming, i);
         }
     }
 }
 
+int
+fragment_compact(struct fragment_master *f)
+{
+    int freed = 0;
+
+    /* reassembly buffers are only held while they are in use */
+    if (f->incoming_done.data)
+    {
+        freed += f->incoming_done.capacity;
+        free_buf(&f->incoming_done);
+    }
+    if (!fragment_outgoing_defined(f) && f->outgoing.data)
+    {
+        freed += f->outgoing.capacity + f->outgoing_return.capacity;
+        free_buf(&f->outgoing);
+        free_buf(&f->outgoing_return);
+    }
+    return freed;
+}
+
 /* called every FRAG_WAKEUP_INTERVAL seconds */
 void
 fragment_wakeup(struct fragment_master *f, struct frame *frame)
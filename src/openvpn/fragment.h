@@ -51,6 +51,11 @@
  *   reassembling incoming fragmented
  *   packets. */
 
+#define FRAG_POOL_SIZE               64
+/**< Maximum number of idle reassembly
+ *   buffers kept for reuse by all VPN
+ *   tunnel instances together. */
+
 #define FRAG_TTL_SEC                 10
 /**< Time-to-live in seconds for a %fragment. */
 
@@ -100,6 +105,9 @@ struct fragment_list {
                                  *   with the highest fragmentation
                                  *   sequence ID into the \c
                                  *   fragment_list.fragments array. */
+    unsigned int active;        /**< Bit \c i is set if \c
+                                 *   fragment_list.fragments[i] is \c
+                                 *   defined and holds a buffer. */
 
 /** Array of reassembly structures, each can contain one whole packet.
  *
@@ -179,6 +187,10 @@ struct fragment_master {
     struct fragment_list incoming;
     /**< List of structures for reassembling
      *   incoming packets. */
+    struct buffer incoming_done;
+    /**< Buffer of the packet last returned
+     *   by \c fragment_incoming(), given back
+     *   to the pool on its next call. */
 };
 
 
@@ -273,18 +285,6 @@ typedef uint32_t fragment_header_type;
 struct fragment_master *fragment_init(struct frame *frame);
 
 
-/**
- * Allocate internal packet buffers for a \c fragment_master structure.
- *
- * @param f            - The \c fragment_master structure for which to
- *                       allocate the internal buffers.
- * @param frame        - The packet geometry parameters for this VPN
- *                       tunnel, used to determine how much memory to
- *                       allocate for each packet buffer.
- */
-void fragment_frame_init(struct fragment_master *f, const struct frame *frame);
-
-
 /**
  * Free a \c fragment_master structure and its internal packet buffers.
  *
@@ -292,6 +292,12 @@ void fragment_frame_init(struct fragment_master *f, const struct frame *frame);
  */
 void fragment_free(struct fragment_master *f);
 
+/**
+ * Returns the bytes of heap memory used by a \c fragment_master
+ * structure and its packet buffers.
+ */
+size_t fragment_mem_usage(const struct fragment_master *f);
+
 /** @} name Functions for initialization and cleanup *//*******************/
 
 
@@ -470,6 +476,25 @@ fragment_housekeeping(struct fragment_master *f, struct frame *frame, struct tim
     }
 }
 
+/**
+ * Free the outgoing packet buffers of a \c fragment_master structure
+ * that do not hold a partly sent packet, and the buffer of the last
+ * reassembled packet.  They are allocated again when the next
+ * fragmented packet arrives or is sent.  Buffers of partly reassembled
+ * packets are drawn from a shared pool and are given back as soon as
+ * reassembly finishes or times out.
+ *
+ * The caller must make sure that no buffer returned by
+ * \c fragment_incoming() or \c fragment_ready_to_send() is still
+ * waiting to be written.
+ *
+ * @param f            - The \c fragment_master structure for this VPN
+ *                       tunnel.
+ *
+ * @return The number of bytes freed.
+ */
+int fragment_compact(struct fragment_master *f);
+
 /** @} name Functions for regular housekeeping *//*************************/
 
 
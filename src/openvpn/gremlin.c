@@ -40,6 +40,7 @@
 #include "misc.h"
 #include "otime.h"
 #include "gremlin.h"
+#include "socket.h"
 
 #include "memdbg.h"
 
@@ -231,4 +232,366 @@ corrupt_gremlin(struct buffer *buf, int flags)
         }
     }
 }
+
+/*
+ * --gremlin-impair
+ */
+
+/* a packet held back until its time has come */
+struct gremlin_packet
+{
+    struct gremlin_packet *next;
+    int64_t due;                  /* in microseconds */
+    struct link_socket_actual to;
+    int len;
+    uint8_t data[];
+};
+
+struct gremlin_impair
+{
+    const struct gremlin_impair_options *opt;
+    uint32_t rand;                /* xorshift state */
+    bool out_bad;                 /* in a loss burst */
+    bool in_bad;
+    int64_t link_free;            /* end of the last transmission at --rate */
+    int64_t last_due;             /* keeps jitter from reordering */
+
+    struct gremlin_packet *head;  /* ordered by due time */
+    int n_held;
+
+    struct buffer release;        /* packet returned by gremlin_impair_ready() */
+    int headroom;
+    struct link_socket_actual release_to;
+
+    counter_type n_out;
+    counter_type n_lost_out;
+    counter_type n_lost_in;
+    counter_type n_overflow;
+    counter_type n_reordered;
+};
+
+/* parse a percentage with up to two decimals into 1/100 of a percent */
+static bool
+parse_percent(const char *str, int *dest)
+{
+    char *end;
+    const double d = strtod(str, &end);
+
+    if (end == str || *end || d < 0 || d > 100)
+    {
+        return false;
+    }
+    *dest = (int) (d * 100 + 0.5);
+    return true;
+}
+
+static bool
+parse_int(const char *str, int min, int max, int *dest)
+{
+    char *end;
+    const long l = strtol(str, &end, 10);
+
+    if (end == str || *end || l < min || l > max)
+    {
+        return false;
+    }
+    *dest = (int) l;
+    return true;
+}
+
+bool
+gremlin_impair_parse(struct gremlin_impair_options *o,
+                     const char *key, const char *value, int msglevel)
+{
+    bool ok;
+    int seed = 0;
+
+    if (!strcmp(key, "delay"))
+    {
+        ok = parse_int(value, 0, 60000, &o->delay_ms);
+    }
+    else if (!strcmp(key, "jitter"))
+    {
+        ok = parse_int(value, 0, 60000, &o->jitter_ms);
+    }
+    else if (!strcmp(key, "loss"))
+    {
+        ok = parse_percent(value, &o->loss);
+    }
+    else if (!strcmp(key, "loss-burst"))
+    {
+        ok = parse_int(value, 1, 1000, &o->loss_burst);
+    }
+    else if (!strcmp(key, "reorder"))
+    {
+        ok = parse_percent(value, &o->reorder);
+    }
+    else if (!strcmp(key, "rate"))
+    {
+        ok = parse_int(value, 100, 1000000000, &o->rate);
+    }
+    else if (!strcmp(key, "limit"))
+    {
+        ok = parse_int(value, 1, 1000000, &o->limit);
+    }
+    else if (!strcmp(key, "seed"))
+    {
+        ok = parse_int(value, 1, INT_MAX, &seed);
+        o->seed = seed;
+    }
+    else
+    {
+        msg(msglevel, "--gremlin-impair: unknown impairment '%s'", key);
+        return false;
+    }
+
+    if (!ok)
+    {
+        msg(msglevel, "--gremlin-impair: bad value '%s' for %s", value, key);
+    }
+    return ok;
+}
+
+static inline int64_t
+max_int64(int64_t x, int64_t y)
+{
+    return x > y ? x : y;
+}
+
+static int64_t
+impair_now(void)
+{
+    struct timeval tv;
+    openvpn_gettimeofday(&tv, NULL);
+    return (int64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Our own generator, so that a --gremlin-impair seed makes the
+ * sequence of decisions reproducible.
+ */
+static uint32_t
+impair_random(struct gremlin_impair *g)
+{
+    uint32_t x = g->rand;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g->rand = x;
+    return x;
+}
+
+/* true with probability p in 1/100 of a percent */
+static bool
+impair_chance(struct gremlin_impair *g, int p)
+{
+    return p > 0 && (int) (impair_random(g) % 10000) < p;
+}
+
+/*
+ * Gilbert model of packet loss: in the bad state every packet is lost,
+ * each packet ends a burst with probability 1/loss_burst, and bursts
+ * start often enough for the average loss to be opt->loss.
+ */
+static bool
+impair_lose(struct gremlin_impair *g, bool *bad)
+{
+    const struct gremlin_impair_options *o = g->opt;
+
+    if (!o->loss)
+    {
+        return false;
+    }
+    if (o->loss_burst <= 1)
+    {
+        return impair_chance(g, o->loss);
+    }
+
+    if (*bad)
+    {
+        *bad = (impair_random(g) % o->loss_burst) != 0;
+    }
+    else if (o->loss >= 10000)
+    {
+        *bad = true;
+    }
+    else
+    {
+        const int p = (int) ((int64_t) o->loss * 10000
+                             / ((int64_t) o->loss_burst * (10000 - o->loss)));
+        *bad = impair_chance(g, max_int(p, 1));
+    }
+    return *bad;
+}
+
+struct gremlin_impair *
+gremlin_impair_new(const struct gremlin_impair_options *o, const struct frame *frame)
+{
+    struct gremlin_impair *g;
+
+    ALLOC_OBJ_CLEAR(g, struct gremlin_impair);
+    g->opt = o;
+    g->rand = o->seed ? o->seed : (uint32_t) get_random();
+    if (!g->rand)
+    {
+        g->rand = 1;
+    }
+    g->release = alloc_buf(BUF_SIZE(frame));
+    g->headroom = frame->buf.headroom;
+
+    msg(M_INFO, "GREMLIN: impairing the link: delay=%dms jitter=%dms loss=%d.%02d%% "
+        "loss-burst=%d reorder=%d.%02d%% rate=%d limit=%d",
+        o->delay_ms, o->jitter_ms, o->loss / 100, o->loss % 100,
+        max_int(o->loss_burst, 1), o->reorder / 100, o->reorder % 100,
+        o->rate, o->limit ? o->limit : GREMLIN_IMPAIR_LIMIT_DEFAULT);
+    return g;
+}
+
+void
+gremlin_impair_free(struct gremlin_impair *g)
+{
+    if (!g)
+    {
+        return;
+    }
+
+    msg(M_INFO, "GREMLIN: impaired link stats: out=" counter_format
+        " lost-out=" counter_format " lost-in=" counter_format
+        " overflow=" counter_format " reordered=" counter_format,
+        g->n_out, g->n_lost_out, g->n_lost_in, g->n_overflow, g->n_reordered);
+
+    while (g->head)
+    {
+        struct gremlin_packet *p = g->head;
+        g->head = p->next;
+        free(p);
+    }
+    free_buf(&g->release);
+    free(g);
+}
+
+bool
+gremlin_impair_incoming(struct gremlin_impair *g)
+{
+    if (impair_lose(g, &g->in_bad))
+    {
+        ++g->n_lost_in;
+        dmsg(D_GREMLIN_VERBOSE, "GREMLIN: impaired incoming packet lost");
+        return true;
+    }
+    return false;
+}
+
+bool
+gremlin_impair_outgoing(struct gremlin_impair *g, const struct buffer *buf,
+                        const struct link_socket_actual *to)
+{
+    const struct gremlin_impair_options *o = g->opt;
+
+    /* held back packet whose time has come */
+    if (buf->data == g->release.data)
+    {
+        return false;
+    }
+
+    ++g->n_out;
+    if (impair_lose(g, &g->out_bad))
+    {
+        ++g->n_lost_out;
+        dmsg(D_GREMLIN_VERBOSE, "GREMLIN: impaired outgoing packet lost");
+        return true;
+    }
+
+    if (!o->delay_ms && !o->jitter_ms && !o->rate)
+    {
+        return false;
+    }
+
+    if (g->n_held >= (o->limit ? o->limit : GREMLIN_IMPAIR_LIMIT_DEFAULT))
+    {
+        ++g->n_overflow;
+        dmsg(D_GREMLIN_VERBOSE, "GREMLIN: impaired link queue full");
+        return true;
+    }
+
+    int64_t due = impair_now();
+    if (o->rate)
+    {
+        g->link_free = max_int64(g->link_free, due)
+                       + (int64_t) BLEN(buf) * 1000000 / o->rate;
+        due = g->link_free;
+    }
+
+    if (impair_chance(g, o->reorder))
+    {
+        /* skip the delay and overtake the packets held back */
+        ++g->n_reordered;
+    }
+    else
+    {
+        int64_t delay = (int64_t) o->delay_ms * 1000;
+        if (o->jitter_ms)
+        {
+            const int64_t jitter = (int64_t) o->jitter_ms * 1000;
+            delay += (int64_t) (impair_random(g) % (uint32_t) (2 * jitter + 1)) - jitter;
+        }
+        due = max_int64(due + max_int64(delay, 0), g->last_due);
+        g->last_due = due;
+    }
+
+    struct gremlin_packet *p = malloc(sizeof(*p) + BLEN(buf));
+    check_malloc_return(p);
+    p->due = due;
+    p->to = *to;
+    p->len = BLEN(buf);
+    memcpy(p->data, BPTR(buf), BLEN(buf));
+
+    struct gremlin_packet **pp = &g->head;
+    while (*pp && (*pp)->due <= due)
+    {
+        pp = &(*pp)->next;
+    }
+    p->next = *pp;
+    *pp = p;
+    ++g->n_held;
+    return true;
+}
+
+struct buffer *
+gremlin_impair_ready(struct gremlin_impair *g, struct link_socket_actual **to)
+{
+    struct gremlin_packet *p = g->head;
+
+    if (!p || p->due > impair_now())
+    {
+        return NULL;
+    }
+
+    g->head = p->next;
+    --g->n_held;
+
+    ASSERT(buf_init(&g->release, g->headroom));
+    ASSERT(buf_write(&g->release, p->data, p->len));
+    g->release_to = p->to;
+    *to = &g->release_to;
+    free(p);
+    return &g->release;
+}
+
+bool
+gremlin_impair_wakeup(const struct gremlin_impair *g, struct timeval *tv)
+{
+    if (!g->head)
+    {
+        return false;
+    }
+
+    const int64_t wait = max_int64(g->head->due - impair_now(), 0);
+    if (wait < (int64_t) tv->tv_sec * 1000000 + tv->tv_usec)
+    {
+        tv->tv_sec = (time_t) (wait / 1000000);
+        tv->tv_usec = (long) (wait % 1000000);
+    }
+    return true;
+}
 #endif /* ifdef ENABLE_DEBUG */
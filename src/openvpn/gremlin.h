@@ -56,6 +56,7 @@
 #define GREMLIN_DROP_LEVEL(x)             (((x)>>GREMLIN_DROP_SHIFT)             & GREMLIN_DROP_MASK)
 
 #include "buffer.h"
+#include "socket.h"
 
 struct packet_flood_parms
 {
@@ -69,5 +70,69 @@ void corrupt_gremlin(struct buffer *buf, int flags);
 
 struct packet_flood_parms get_packet_flood_parms(int level);
 
+/*
+ * Network impairments of --gremlin-impair.  Outgoing packets are
+ * delayed, reordered, rate limited and lost, incoming packets are only
+ * lost.  Probabilities are in 1/100 of a percent.
+ */
+struct gremlin_impair_options
+{
+    int delay_ms;       /* fixed delay of every outgoing packet */
+    int jitter_ms;      /* uniformly distributed extra delay, +/- */
+    int loss;           /* average packet loss, both directions */
+    int loss_burst;     /* average length of a loss burst in packets */
+    int reorder;        /* outgoing packets that skip the delay */
+    int rate;           /* outgoing bytes per second, 0 = unlimited */
+    int limit;          /* delayed packets held at most */
+    unsigned int seed;  /* of the loss, jitter and reorder decisions */
+};
+
+#define GREMLIN_IMPAIR_LIMIT_DEFAULT 1000
+
+static inline bool
+gremlin_impair_defined(const struct gremlin_impair_options *o)
+{
+    return o->delay_ms || o->jitter_ms || o->loss || o->reorder || o->rate;
+}
+
+/*
+ * Parse one "key value" pair of --gremlin-impair into o.
+ */
+bool gremlin_impair_parse(struct gremlin_impair_options *o,
+                          const char *key, const char *value, int msglevel);
+
+/* per tunnel state, see gremlin.c */
+struct gremlin_impair;
+
+struct gremlin_impair *gremlin_impair_new(const struct gremlin_impair_options *o,
+                                          const struct frame *frame);
+
+void gremlin_impair_free(struct gremlin_impair *g);
+
+/*
+ * Return true if the received packet is lost.
+ */
+bool gremlin_impair_incoming(struct gremlin_impair *g);
+
+/*
+ * Return true if the packet to be sent was lost or is held back to be
+ * sent later, false if it has to be sent now.
+ */
+bool gremlin_impair_outgoing(struct gremlin_impair *g, const struct buffer *buf,
+                             const struct link_socket_actual *to);
+
+/*
+ * Return a held back packet whose time has come and its destination,
+ * or NULL.  The packet stays valid until the next call.
+ */
+struct buffer *gremlin_impair_ready(struct gremlin_impair *g,
+                                    struct link_socket_actual **to);
+
+/*
+ * Lower tv to the time until the next held back packet is due.
+ * Return true while packets are held back.
+ */
+bool gremlin_impair_wakeup(const struct gremlin_impair *g, struct timeval *tv);
+
 #endif /* ifdef ENABLE_DEBUG */
 #endif /* ifndef GREMLIN_H */
@@ -0,0 +1,832 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "handoff.h"
+#include "errlevel.h"
+#include "fdmisc.h"
+#include "platform.h"
+#include "socket.h"
+
+#include "memdbg.h"
+
+/*
+ * The stream starts with a fixed header that carries the two file
+ * descriptors, followed by one length-prefixed record per client and a
+ * record of length 0.  All integers are in network byte order.  Records
+ * hold the fields of struct handoff_client in a fixed order; the
+ * version in the header changes whenever that order does.
+ */
+#define HANDOFF_MAGIC     "OVPNHAND"
+#define HANDOFF_VERSION   1
+#define HANDOFF_NAME_LEN  64
+#define HANDOFF_HDR_LEN   (8 + 4 + HANDOFF_NAME_LEN)
+
+/* neither side waits longer than this for the other */
+#define HANDOFF_TIMEOUT 30
+
+/*
+ * Field encoding
+ */
+
+static void
+write_u64(struct buffer *buf, uint64_t v)
+{
+    buf_write_u32(buf, (uint32_t) (v >> 32));
+    buf_write_u32(buf, (uint32_t) v);
+}
+
+static uint64_t
+read_u64(struct buffer *buf, bool *good)
+{
+    const uint64_t hi = buf_read_u32(buf, good);
+    const uint64_t lo = buf_read_u32(buf, good);
+    return (hi << 32) | lo;
+}
+
+/* opaque bytes, with their size so that a build with a different
+ * layout is noticed */
+static void
+write_raw(struct buffer *buf, const void *data, size_t len)
+{
+    buf_write_u16(buf, (uint16_t) len);
+    buf_write(buf, data, len);
+}
+
+static bool
+read_raw(struct buffer *buf, void *data, size_t len)
+{
+    return buf_read_u16(buf) == (int) len && buf_read(buf, data, (int) len);
+}
+
+static void
+write_string(struct buffer *buf, const char *str)
+{
+    if (!str)
+    {
+        buf_write_u16(buf, 0);
+        return;
+    }
+    const size_t len = strlen(str);
+    buf_write_u16(buf, (uint16_t) (len + 1));
+    buf_write(buf, str, len);
+}
+
+static bool
+read_string(struct buffer *buf, const char **str, struct gc_arena *gc)
+{
+    const int len = buf_read_u16(buf);
+    if (len <= 0)
+    {
+        *str = NULL;
+        return len == 0;
+    }
+
+    char *s = gc_malloc(len, false, gc);
+    if (!buf_read(buf, s, len - 1))
+    {
+        return false;
+    }
+    s[len - 1] = '\0';
+    *str = s;
+    return true;
+}
+
+static void
+write_pid(struct buffer *buf, const struct packet_id_net *pid)
+{
+    buf_write_u32(buf, pid->id);
+    write_u64(buf, (uint64_t) pid->time);
+}
+
+static bool
+read_pid(struct buffer *buf, struct packet_id_net *pid)
+{
+    bool good = true;
+    pid->id = buf_read_u32(buf, &good);
+    pid->time = (time_t) read_u64(buf, &good);
+    return good;
+}
+
+static void
+write_key2(struct buffer *buf, const struct key2 *key)
+{
+    buf_write_u8(buf, (uint8_t) key->n);
+    if (key->n)
+    {
+        write_raw(buf, key->keys, sizeof(key->keys));
+    }
+}
+
+static bool
+read_key2(struct buffer *buf, struct key2 *key)
+{
+    const int n = buf_read_u8(buf);
+    key->n = n;
+    return n == 0 || (n == 2 && read_raw(buf, key->keys, sizeof(key->keys)));
+}
+
+static void
+write_tls(struct buffer *buf, const struct tls_handoff_state *hs)
+{
+    write_raw(buf, &hs->session_id, sizeof(hs->session_id));
+    write_raw(buf, &hs->session_id_remote, sizeof(hs->session_id_remote));
+    buf_write_u8(buf, (uint8_t) hs->key_id);
+    buf_write_u32(buf, hs->crypto_flags);
+    write_u64(buf, (uint64_t) hs->established);
+    write_key2(buf, &hs->data_key);
+    buf_write_u16(buf, hs->send_epoch);
+    buf_write_u16(buf, hs->recv_epoch);
+    write_pid(buf, &hs->send_pid);
+    write_pid(buf, &hs->recv_pid);
+    write_key2(buf, &hs->wrap_client_key);
+    write_pid(buf, &hs->wrap_send_pid);
+    write_pid(buf, &hs->wrap_recv_pid);
+    write_key2(buf, &hs->reneg_key);
+    write_pid(buf, &hs->reneg_send_pid);
+    write_pid(buf, &hs->reneg_recv_pid);
+}
+
+static bool
+read_tls(struct buffer *buf, struct tls_handoff_state *hs)
+{
+    bool good = read_raw(buf, &hs->session_id, sizeof(hs->session_id))
+                && read_raw(buf, &hs->session_id_remote, sizeof(hs->session_id_remote));
+    hs->key_id = buf_read_u8(buf);
+    hs->crypto_flags = buf_read_u32(buf, &good);
+    hs->established = (time_t) read_u64(buf, &good);
+    good = good && read_key2(buf, &hs->data_key);
+    hs->send_epoch = (uint16_t) buf_read_u16(buf);
+    hs->recv_epoch = (uint16_t) buf_read_u16(buf);
+    return good
+           && read_pid(buf, &hs->send_pid)
+           && read_pid(buf, &hs->recv_pid)
+           && read_key2(buf, &hs->wrap_client_key)
+           && read_pid(buf, &hs->wrap_send_pid)
+           && read_pid(buf, &hs->wrap_recv_pid)
+           && read_key2(buf, &hs->reneg_key)
+           && read_pid(buf, &hs->reneg_send_pid)
+           && read_pid(buf, &hs->reneg_recv_pid)
+           && hs->key_id >= 0 && hs->key_id <= P_KEY_ID_MASK;
+}
+
+static void
+write_acl(struct buffer *buf, const struct acl_list *acl)
+{
+    buf_write_u8(buf, acl ? 1 : 0);
+    if (!acl)
+    {
+        return;
+    }
+
+    buf_write_u8(buf, acl->deny);
+    for (int i = 0; i < (int) SIZE(acl->chains); ++i)
+    {
+        const struct acl_chain *chain = &acl->chains[i];
+        buf_write_u16(buf, (uint16_t) chain->n);
+        for (int j = 0; j < chain->n; ++j)
+        {
+            const struct acl_rule *rule = &chain->rules[j];
+            buf_write_u8(buf, rule->allow);
+            buf_write_u32(buf, (uint32_t) rule->proto);
+            buf_write_u16(buf, rule->port_lo);
+            buf_write_u16(buf, rule->port_hi);
+            write_raw(buf, rule->net, sizeof(rule->net));
+            write_raw(buf, rule->mask, sizeof(rule->mask));
+            write_string(buf, rule->text);
+        }
+    }
+}
+
+static bool
+read_acl(struct buffer *buf, struct acl_list **aclp, struct gc_arena *gc)
+{
+    *aclp = NULL;
+    const int present = buf_read_u8(buf);
+    if (present <= 0)
+    {
+        return present == 0;
+    }
+
+    struct acl_list *acl = acl_list_new(gc);
+    bool good = true;
+    acl->deny = buf_read_u8(buf) == 1;
+    for (int i = 0; good && i < (int) SIZE(acl->chains); ++i)
+    {
+        const int n = buf_read_u16(buf);
+        good = n >= 0;
+        for (int j = 0; good && j < n; ++j)
+        {
+            struct acl_rule rule;
+            CLEAR(rule);
+            rule.allow = buf_read_u8(buf) == 1;
+            rule.proto = (int) buf_read_u32(buf, &good);
+            rule.port_lo = (uint16_t) buf_read_u16(buf);
+            rule.port_hi = (uint16_t) buf_read_u16(buf);
+            good = good
+                   && read_raw(buf, rule.net, sizeof(rule.net))
+                   && read_raw(buf, rule.mask, sizeof(rule.mask))
+                   && read_string(buf, &rule.text, gc);
+            if (good)
+            {
+                acl_list_append(acl, i, &rule, gc);
+            }
+        }
+    }
+    *aclp = acl;
+    return good;
+}
+
+void
+handoff_client_write(struct buffer *buf, const struct handoff_client *hc)
+{
+    write_raw(buf, &hc->remote, sizeof(hc->remote));
+    buf_write_u32(buf, hc->peer_id);
+    buf_write_u8(buf, hc->use_peer_id);
+    write_u64(buf, (uint64_t) hc->created);
+
+    write_string(buf, hc->common_name);
+    write_string(buf, hc->username);
+    write_string(buf, hc->peer_info);
+    write_string(buf, hc->ciphername);
+    write_string(buf, hc->authname);
+
+    buf_write_u32(buf, hc->cert_hash_mask);
+    for (int i = 0; i < MAX_CERT_DEPTH; ++i)
+    {
+        if (hc->cert_hash_mask & (1u << i))
+        {
+            write_raw(buf, &hc->cert_hash[i], sizeof(hc->cert_hash[i]));
+        }
+    }
+
+    buf_write_u8(buf, hc->ifconfig_defined);
+    buf_write_u32(buf, hc->ifconfig_local);
+    buf_write_u32(buf, hc->ifconfig_remote_netmask);
+    buf_write_u32(buf, hc->ifconfig_local_alias);
+    buf_write_u8(buf, hc->ifconfig_ipv6_defined);
+    write_raw(buf, &hc->ifconfig_ipv6_local, sizeof(hc->ifconfig_ipv6_local));
+    buf_write_u32(buf, (uint32_t) hc->ifconfig_ipv6_netbits);
+    write_raw(buf, &hc->ifconfig_ipv6_remote, sizeof(hc->ifconfig_ipv6_remote));
+    buf_write_u32(buf, (uint32_t) hc->pool_handle);
+
+    buf_write_u16(buf, hc->vlan_pvid);
+
+    int n = 0;
+    for (const struct iroute *ir = hc->iroutes; ir; ir = ir->next)
+    {
+        ++n;
+    }
+    buf_write_u16(buf, (uint16_t) n);
+    for (const struct iroute *ir = hc->iroutes; ir; ir = ir->next)
+    {
+        buf_write_u32(buf, ir->network);
+        buf_write_u8(buf, (uint8_t) ir->netbits);
+    }
+
+    n = 0;
+    for (const struct iroute_ipv6 *ir6 = hc->iroutes_ipv6; ir6; ir6 = ir6->next)
+    {
+        ++n;
+    }
+    buf_write_u16(buf, (uint16_t) n);
+    for (const struct iroute_ipv6 *ir6 = hc->iroutes_ipv6; ir6; ir6 = ir6->next)
+    {
+        write_raw(buf, &ir6->network, sizeof(ir6->network));
+        buf_write_u8(buf, (uint8_t) ir6->netbits);
+    }
+
+    write_acl(buf, hc->acl);
+    write_tls(buf, &hc->tls);
+}
+
+bool
+handoff_client_read(struct buffer *buf, struct handoff_client *hc,
+                    struct gc_arena *gc)
+{
+    bool good = read_raw(buf, &hc->remote, sizeof(hc->remote));
+    hc->peer_id = buf_read_u32(buf, &good);
+    hc->use_peer_id = buf_read_u8(buf) == 1;
+    hc->created = (time_t) read_u64(buf, &good);
+
+    good = good
+           && read_string(buf, &hc->common_name, gc)
+           && read_string(buf, &hc->username, gc)
+           && read_string(buf, &hc->peer_info, gc)
+           && read_string(buf, &hc->ciphername, gc)
+           && read_string(buf, &hc->authname, gc);
+
+    hc->cert_hash_mask = buf_read_u32(buf, &good);
+    for (int i = 0; good && i < MAX_CERT_DEPTH; ++i)
+    {
+        if (hc->cert_hash_mask & (1u << i))
+        {
+            good = read_raw(buf, &hc->cert_hash[i], sizeof(hc->cert_hash[i]));
+        }
+    }
+
+    hc->ifconfig_defined = buf_read_u8(buf) == 1;
+    hc->ifconfig_local = buf_read_u32(buf, &good);
+    hc->ifconfig_remote_netmask = buf_read_u32(buf, &good);
+    hc->ifconfig_local_alias = buf_read_u32(buf, &good);
+    hc->ifconfig_ipv6_defined = buf_read_u8(buf) == 1;
+    good = good && read_raw(buf, &hc->ifconfig_ipv6_local,
+                            sizeof(hc->ifconfig_ipv6_local));
+    hc->ifconfig_ipv6_netbits = (int) buf_read_u32(buf, &good);
+    good = good && read_raw(buf, &hc->ifconfig_ipv6_remote,
+                            sizeof(hc->ifconfig_ipv6_remote));
+    hc->pool_handle = (int) buf_read_u32(buf, &good);
+
+    hc->vlan_pvid = (uint16_t) buf_read_u16(buf);
+
+    int n = buf_read_u16(buf);
+    for (int i = 0; good && i < n; ++i)
+    {
+        struct iroute *ir;
+        ALLOC_OBJ_GC(ir, struct iroute, gc);
+        ir->network = buf_read_u32(buf, &good);
+        ir->netbits = buf_read_u8(buf);
+        ir->next = hc->iroutes;
+        hc->iroutes = ir;
+        good = good && ir->netbits >= 0 && ir->netbits <= 32;
+    }
+
+    n = buf_read_u16(buf);
+    for (int i = 0; good && i < n; ++i)
+    {
+        struct iroute_ipv6 *ir6;
+        ALLOC_OBJ_GC(ir6, struct iroute_ipv6, gc);
+        good = read_raw(buf, &ir6->network, sizeof(ir6->network));
+        const int bits = buf_read_u8(buf);
+        good = good && bits >= 0 && bits <= 128;
+        ir6->netbits = bits;
+        ir6->next = hc->iroutes_ipv6;
+        hc->iroutes_ipv6 = ir6;
+    }
+
+    return good
+           && n >= 0
+           && read_acl(buf, &hc->acl, gc)
+           && read_tls(buf, &hc->tls)
+           && hc->ciphername;
+}
+
+#if UNIX_SOCK_SUPPORT
+
+/* root, ourselves, or the --user the other process dropped to */
+static bool
+handoff_peer_trusted(socket_descriptor_t sd, int user_uid)
+{
+    int uid;
+    if (!unix_socket_get_peer_uid_gid(sd, &uid, NULL))
+    {
+        msg(M_WARN, "HANDOFF: cannot get the credentials of the peer");
+        return false;
+    }
+    if (uid != 0 && uid != (int) geteuid() && uid != user_uid)
+    {
+        msg(M_WARN, "HANDOFF: refusing peer with uid %d", uid);
+        return false;
+    }
+    return true;
+}
+
+static void
+handoff_set_blocking(socket_descriptor_t sd)
+{
+    struct timeval tv = { .tv_sec = HANDOFF_TIMEOUT };
+
+    fcntl(sd, F_SETFL, fcntl(sd, F_GETFL) & ~O_NONBLOCK);
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+static bool
+handoff_write(socket_descriptor_t sd, const uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = send(sd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            msg(M_WARN | M_ERRNO, "HANDOFF: send failed");
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+static bool
+handoff_read(socket_descriptor_t sd, uint8_t *data, size_t len)
+{
+    while (len > 0)
+    {
+        const ssize_t n = recv(sd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            msg(M_WARN | (n < 0 ? M_ERRNO : 0), "HANDOFF: receive failed");
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+/*
+ * Old process
+ */
+
+socket_descriptor_t
+handoff_listen(const char *path)
+{
+    struct sockaddr_un local;
+    socket_descriptor_t sd = create_socket_unix();
+
+    CLEAR(local);
+    sockaddr_unix_init(&local, path);
+    socket_delete_unix(&local);
+    socket_bind_unix(sd, &local, "HANDOFF");
+    /* the socket hands out key material, keep it to ourselves */
+    if (chmod(path, S_IRUSR | S_IWUSR))
+    {
+        msg(M_WARN | M_ERRNO, "HANDOFF: cannot restrict access to %s", path);
+    }
+    if (listen(sd, 1))
+    {
+        msg(M_ERR, "HANDOFF: listen() failed on %s", path);
+    }
+    set_nonblock(sd);
+    msg(M_INFO, "HANDOFF: waiting for a new process on %s", path);
+    return sd;
+}
+
+socket_descriptor_t
+handoff_accept(socket_descriptor_t sd)
+{
+    struct sockaddr_un remote;
+    socket_descriptor_t new_sd = socket_accept_unix(sd, &remote);
+
+    if (!socket_defined(new_sd))
+    {
+        return SOCKET_UNDEFINED;
+    }
+    if (!handoff_peer_trusted(new_sd, -1))
+    {
+        openvpn_close_socket(new_sd);
+        return SOCKET_UNDEFINED;
+    }
+    handoff_set_blocking(new_sd);
+    return new_sd;
+}
+
+void
+handoff_close(socket_descriptor_t sd, const char *path)
+{
+    struct sockaddr_un local;
+
+    if (!socket_defined(sd))
+    {
+        return;
+    }
+    openvpn_close_socket(sd);
+    if (path)
+    {
+        CLEAR(local);
+        sockaddr_unix_init(&local, path);
+        socket_delete_unix(&local);
+    }
+}
+
+bool
+handoff_send_begin(socket_descriptor_t sd, socket_descriptor_t link_sd,
+                   int tun_fd, const char *tun_name)
+{
+    uint8_t hdr[HANDOFF_HDR_LEN];
+    const uint32_t version = htonl(HANDOFF_VERSION);
+    const int fds[2] = { link_sd, tun_fd };
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(fds))];
+    } control_un;
+    struct msghdr mesg;
+    struct iovec iov;
+
+    CLEAR(hdr);
+    memcpy(hdr, HANDOFF_MAGIC, 8);
+    memcpy(hdr + 8, &version, 4);
+    strncpynt((char *) hdr + 12, tun_name, HANDOFF_NAME_LEN);
+
+    CLEAR(mesg);
+    CLEAR(control_un);
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(hdr);
+    mesg.msg_iov = &iov;
+    mesg.msg_iovlen = 1;
+    mesg.msg_control = control_un.control;
+    mesg.msg_controllen = sizeof(control_un.control);
+
+    struct cmsghdr *h = CMSG_FIRSTHDR(&mesg);
+    h->cmsg_level = SOL_SOCKET;
+    h->cmsg_type = SCM_RIGHTS;
+    h->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(h), fds, sizeof(fds));
+
+    if (sendmsg(sd, &mesg, MSG_NOSIGNAL) != (ssize_t) sizeof(hdr))
+    {
+        msg(M_WARN | M_ERRNO, "HANDOFF: cannot send the descriptors");
+        return false;
+    }
+    return true;
+}
+
+bool
+handoff_send_client(socket_descriptor_t sd, const struct handoff_client *hc)
+{
+    struct buffer buf = alloc_buf(HANDOFF_CLIENT_MAX);
+    bool ret = false;
+
+    /* room for the length */
+    ASSERT(buf_write_u32(&buf, 0));
+    handoff_client_write(&buf, hc);
+    if (buf.len >= HANDOFF_CLIENT_MAX)
+    {
+        msg(M_WARN, "HANDOFF: state of client %s does not fit into a record",
+            np(hc->common_name));
+        goto done;
+    }
+
+    const uint32_t len = htonl(BLEN(&buf) - 4);
+    memcpy(BPTR(&buf), &len, sizeof(len));
+    ret = handoff_write(sd, BPTR(&buf), BLEN(&buf));
+
+done:
+    buf_clear(&buf);
+    free_buf(&buf);
+    return ret;
+}
+
+bool
+handoff_send_end(socket_descriptor_t sd)
+{
+    const uint32_t len = 0;
+    return handoff_write(sd, (const uint8_t *) &len, sizeof(len));
+}
+
+/*
+ * New process
+ */
+
+/* Close whatever descriptors came with a message that is not taken */
+static void
+handoff_close_fds(struct msghdr *mesg)
+{
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(mesg); cm; cm = CMSG_NXTHDR(mesg, cm))
+    {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS
+            || cm->cmsg_len < CMSG_LEN(0))
+        {
+            continue;
+        }
+        const size_t nfds = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < nfds; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cm) + i * sizeof(fd), sizeof(fd));
+            close(fd);
+        }
+    }
+}
+
+static bool
+handoff_receive_header(struct handoff *h, socket_descriptor_t sd)
+{
+    uint8_t hdr[HANDOFF_HDR_LEN];
+    uint32_t version;
+    int fds[2];
+    union {
+        struct cmsghdr cm;
+        char control[CMSG_SPACE(sizeof(fds))];
+    } control_un;
+    struct msghdr mesg;
+    struct iovec iov;
+
+    CLEAR(mesg);
+    iov.iov_base = hdr;
+    iov.iov_len = sizeof(hdr);
+    mesg.msg_iov = &iov;
+    mesg.msg_iovlen = 1;
+    mesg.msg_control = control_un.control;
+    mesg.msg_controllen = sizeof(control_un.control);
+
+    /* the descriptors arrive with the first byte */
+    const ssize_t n = recvmsg(sd, &mesg, MSG_NOSIGNAL);
+    if (n <= 0)
+    {
+        msg(M_WARN | (n < 0 ? M_ERRNO : 0), "HANDOFF: no reply from the old process");
+        return false;
+    }
+
+    struct cmsghdr *cm = CMSG_FIRSTHDR(&mesg);
+    if (!cm || cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS
+        || cm->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        msg(M_WARN, "HANDOFF: descriptors are missing");
+        handoff_close_fds(&mesg);
+        return false;
+    }
+    memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    h->link_sd = fds[0];
+    h->tun_fd = fds[1];
+    set_cloexec(h->link_sd);
+    set_cloexec(h->tun_fd);
+
+    if (!handoff_read(sd, hdr + n, sizeof(hdr) - n))
+    {
+        return false;
+    }
+    memcpy(&version, hdr + 8, 4);
+    if (memcmp(hdr, HANDOFF_MAGIC, 8) || ntohl(version) != HANDOFF_VERSION)
+    {
+        msg(M_WARN, "HANDOFF: the old process speaks an unknown version");
+        return false;
+    }
+    hdr[sizeof(hdr) - 1] = '\0';
+    h->tun_name = string_alloc((const char *) hdr + 12, &h->gc);
+    return true;
+}
+
+static bool
+handoff_receive_clients(struct handoff *h, socket_descriptor_t sd)
+{
+    int capacity = 0;
+
+    while (true)
+    {
+        uint32_t len;
+        if (!handoff_read(sd, (uint8_t *) &len, sizeof(len)))
+        {
+            return false;
+        }
+        len = ntohl(len);
+        if (!len)
+        {
+            return true;
+        }
+        if (len >= HANDOFF_CLIENT_MAX)
+        {
+            msg(M_WARN, "HANDOFF: client record too large");
+            return false;
+        }
+
+        struct buffer buf = alloc_buf_gc(len, &h->gc);
+        if (!handoff_read(sd, BPTR(&buf), len))
+        {
+            return false;
+        }
+        ASSERT(buf_inc_len(&buf, len));
+
+        if (h->n_clients == capacity)
+        {
+            struct handoff_client *clients;
+            capacity = max_int(64, capacity * 2);
+            ALLOC_ARRAY_CLEAR_GC(clients, struct handoff_client, capacity, &h->gc);
+            if (h->n_clients)
+            {
+                memcpy(clients, h->clients, h->n_clients * sizeof(*clients));
+                secure_memzero(h->clients, h->n_clients * sizeof(*clients));
+            }
+            h->clients = clients;
+        }
+
+        struct handoff_client *hc = &h->clients[h->n_clients];
+        const bool good = handoff_client_read(&buf, hc, &h->gc);
+        buf_clear(&buf);
+        if (!good)
+        {
+            msg(M_WARN, "HANDOFF: malformed client record");
+            secure_memzero(hc, sizeof(*hc));
+            return false;
+        }
+        ++h->n_clients;
+    }
+}
+
+struct handoff *
+handoff_receive(const char *path, const char *username)
+{
+    struct platform_state_user user_state;
+    int user_uid = -1;
+    struct sockaddr_un remote;
+    socket_descriptor_t sd = create_socket_unix();
+    struct handoff *h = NULL;
+
+    CLEAR(remote);
+    sockaddr_unix_init(&remote, path);
+    const int status = socket_connect_unix(sd, &remote);
+    if (status)
+    {
+        msg(D_LOW, "HANDOFF: no process to take over from on %s: %s",
+            path, strerror(status));
+        goto done;
+    }
+    if (username && platform_user_get(username, &user_state))
+    {
+        user_uid = platform_state_user_uid(&user_state);
+    }
+    if (!handoff_peer_trusted(sd, user_uid))
+    {
+        goto done;
+    }
+    handoff_set_blocking(sd);
+
+    ALLOC_OBJ_CLEAR(h, struct handoff);
+    h->gc = gc_new();
+    h->link_sd = SOCKET_UNDEFINED;
+    h->tun_fd = -1;
+
+    msg(M_INFO, "HANDOFF: taking over from the process on %s", path);
+    if (!handoff_receive_header(h, sd) || !handoff_receive_clients(h, sd))
+    {
+        handoff_free(h);
+        h = NULL;
+        goto done;
+    }
+
+    /* the old process keeps the connection open until it exits, and
+     * with it the management interface, the pid file and so on */
+    uint8_t c;
+    ssize_t n;
+    struct timeval tv = { 0 };
+    setsockopt(sd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    do
+    {
+        n = recv(sd, &c, 1, MSG_NOSIGNAL);
+    } while (n > 0 || (n < 0 && errno == EINTR));
+    msg(M_INFO, "HANDOFF: took over %d clients from the old process",
+        h->n_clients);
+
+done:
+    openvpn_close_socket(sd);
+    return h;
+}
+
+void
+handoff_free(struct handoff *h)
+{
+    if (!h)
+    {
+        return;
+    }
+    if (socket_defined(h->link_sd))
+    {
+        openvpn_close_socket(h->link_sd);
+    }
+    if (h->tun_fd >= 0)
+    {
+        close(h->tun_fd);
+    }
+    if (h->clients)
+    {
+        secure_memzero(h->clients, h->n_clients * sizeof(*h->clients));
+    }
+    gc_free(&h->gc);
+    free(h);
+}
+
+#endif /* if UNIX_SOCK_SUPPORT */
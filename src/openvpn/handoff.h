@@ -0,0 +1,165 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+/**
+ * @file
+ * Moving the clients of a UDP server to a new process, for --handoff.
+ *
+ * A server with --handoff listens on a unix socket.  A new process
+ * started with the same --handoff path connects to it before it opens
+ * anything else.  The old process then sends its UDP socket and tun
+ * device as file descriptors, followed by the state of every client
+ * that can be moved: addresses, routes, identity and the data channel
+ * keys of the active TLS session.  It exits without running any
+ * disconnect scripts or removing the interface configuration, and the
+ * new process goes on from where the old one stopped once the end of
+ * the connection shows that the old process is gone.
+ *
+ * The TLS connections themselves are not moved, so the clients keep
+ * their data channel but renegotiate a new TLS session as usual.
+ */
+
+#include "buffer.h"
+#include "acl.h"
+#include "route.h"
+#include "ssl.h"
+#include "ssl_verify.h"
+
+/** Upper bound of an encoded client, mostly for peer-info and --acl */
+#define HANDOFF_CLIENT_MAX 65536
+
+/** State of one client instance, see multi_export_client() */
+struct handoff_client
+{
+    struct link_socket_actual remote;
+    uint32_t peer_id;
+    bool use_peer_id;
+    time_t created;
+
+    const char *common_name;
+    const char *username;
+    const char *peer_info;
+    const char *ciphername;
+    const char *authname;
+
+    /** locked certificate hashes, bit i of the mask is set if
+     *  cert_hash[i] is defined */
+    unsigned int cert_hash_mask;
+    struct cert_hash cert_hash[MAX_CERT_DEPTH];
+
+    bool ifconfig_defined;
+    in_addr_t ifconfig_local;
+    in_addr_t ifconfig_remote_netmask;
+    in_addr_t ifconfig_local_alias;
+    bool ifconfig_ipv6_defined;
+    struct in6_addr ifconfig_ipv6_local;
+    int ifconfig_ipv6_netbits;
+    struct in6_addr ifconfig_ipv6_remote;
+    int pool_handle;            /**< ifconfig pool entry, or -1 */
+
+    uint16_t vlan_pvid;
+    struct iroute *iroutes;
+    struct iroute_ipv6 *iroutes_ipv6;
+    struct acl_list *acl;
+
+    struct tls_handoff_state tls;
+};
+
+/**
+ * Append the encoding of \c hc to \c buf, which is also used by
+ * --replicate-peer.  Check the buffer for overflow afterwards.
+ */
+void handoff_client_write(struct buffer *buf, const struct handoff_client *hc);
+
+/**
+ * Decode a client written by handoff_client_write().  Strings, routes
+ * and the --acl are allocated in \c gc.
+ *
+ * @return false if the record is malformed
+ */
+bool handoff_client_read(struct buffer *buf, struct handoff_client *hc,
+                         struct gc_arena *gc);
+
+#if UNIX_SOCK_SUPPORT
+
+/** What a new process took over from the old one */
+struct handoff
+{
+    struct gc_arena gc;
+    socket_descriptor_t link_sd; /**< UDP socket, until it is adopted */
+    int tun_fd;                  /**< tun/tap device, until it is adopted */
+    const char *tun_name;
+    int n_clients;
+    struct handoff_client *clients;
+};
+
+/**
+ * Listen on the --handoff socket for a new process.  A stale socket file
+ * left by an earlier process is replaced.
+ */
+socket_descriptor_t handoff_listen(const char *path);
+
+/**
+ * Accept a new process on the listening socket, without blocking.
+ *
+ * @return the connection, or SOCKET_UNDEFINED if there is none or it
+ *         does not come from our user or root
+ */
+socket_descriptor_t handoff_accept(socket_descriptor_t sd);
+
+/** Close the listening socket and remove its file */
+void handoff_close(socket_descriptor_t sd, const char *path);
+
+/**
+ * Send the descriptors of the UDP socket and the tun device.  Must be
+ * called first on a connection from handoff_accept().
+ */
+bool handoff_send_begin(socket_descriptor_t sd, socket_descriptor_t link_sd,
+                        int tun_fd, const char *tun_name);
+
+/** Send the state of one client */
+bool handoff_send_client(socket_descriptor_t sd, const struct handoff_client *hc);
+
+/** Mark the end of the clients */
+bool handoff_send_end(socket_descriptor_t sd);
+
+/**
+ * Take over from a process that is listening on \c path, if there is
+ * one.  Blocks until that process has sent everything and exited.
+ * The process must run as root, as our own user or as \c username,
+ * the --user it may have dropped to.
+ *
+ * @return the state received, or NULL if no process was listening or
+ *         the transfer failed
+ */
+struct handoff *handoff_receive(const char *path, const char *username);
+
+/** Close what was not adopted and wipe the key material */
+void handoff_free(struct handoff *h);
+
+#endif /* if UNIX_SOCK_SUPPORT */
+
+#endif /* HANDOFF_H */
@@ -46,6 +46,7 @@
 #include "lladdr.h"
 #include "ping.h"
 #include "mstats.h"
+#include "trace.h"
 #include "ssl_verify.h"
 #include "ssl_ncp.h"
 #include "tls_crypt.h"
@@ -54,6 +55,7 @@
 #include "mss.h"
 #include "mudp.h"
 #include "dco.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -503,11 +505,12 @@ init_connection_list(struct context *c)
 static void
 clear_remote_addrlist(struct link_socket_addr *lsa, bool free)
 {
-    if (lsa->remote_list && free)
+    if (lsa->remote_list && free && !lsa->remote_list_cached)
     {
         freeaddrinfo(lsa->remote_list);
     }
     lsa->remote_list = NULL;
+    lsa->remote_list_cached = false;
     lsa->current_remote = NULL;
 }
 
@@ -749,6 +752,14 @@ context_init_1(struct context *c)
             pkcs11_addProvider(c->options.pkcs11_providers[i], c->options.pkcs11_protected_authentication[i],
                                c->options.pkcs11_private_mode[i], c->options.pkcs11_cert_private[i]);
         }
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+        pkcs11_sign_thread_set(c->options.pkcs11_sign_thread);
+#else
+        if (c->options.pkcs11_sign_thread)
+        {
+            msg(M_WARN, "WARNING: --pkcs11-sign-thread is not supported on this platform, ignored");
+        }
+#endif
     }
 #endif
 
@@ -823,6 +834,8 @@ init_static(void)
 
 #if defined(DMALLOC)
     crypto_init_dmalloc();
+#else
+    crypto_init_mem_accounting();
 #endif
 
 
@@ -860,11 +873,6 @@ init_static(void)
 
     init_ssl_lib();
 
-#ifdef SCHEDULE_TEST
-    schedule_test();
-    return false;
-#endif
-
 #ifdef LIST_TEST
     list_test();
     return false;
@@ -932,7 +940,7 @@ init_static(void)
 #ifdef MSTATS_TEST
     {
         int i;
-        mstats_open("/dev/shm/mstats.dat");
+        mstats_open("/dev/shm/mstats.dat", 0);
         for (i = 0; i < 30; ++i)
         {
             mmap_stats->n_clients += 1;
@@ -975,6 +983,7 @@ init_verb_mute(struct context *c, unsigned int flags)
         set_check_status(D_LINK_ERRORS, D_READ_WRITE);
         set_debug_level(c->options.verbosity, SDL_CONSTRAIN);
         set_mute_cutoff(c->options.mute);
+        set_mute_repeats(c->options.mute_repeats);
     }
 
     /* special D_LOG_RW mode */
@@ -1265,7 +1274,15 @@ do_uid_gid_chroot(struct context *c, bool no_delay)
 #ifdef ENABLE_MEMSTATS
         if (c->first_time && c->options.memstats_fn)
         {
-            mstats_open(c->options.memstats_fn);
+            mstats_open(c->options.memstats_fn,
+                        c->options.mode == MODE_SERVER ? c->options.max_clients : 0);
+        }
+#endif
+
+#ifdef ENABLE_TRACE
+        if (c->first_time && c->options.trace_ring_fn)
+        {
+            trace_open(c->options.trace_ring_fn, c->options.trace_ring_size);
         }
 #endif
 
@@ -1353,6 +1370,8 @@ void
 reset_coarse_timers(struct context *c)
 {
     c->c2.coarse_timer_wakeup = 0;
+    c->c2.pre_select_wakeup = 0;
+    c->c2.keepalive_wakeup = 0;
 }
 
 /*
@@ -1370,6 +1389,31 @@ do_init_server_poll_timeout(struct context *c)
     }
 }
 
+#ifndef _WIN32
+/*
+ * Bind the --multipath sockets next to the one of the connection, they
+ * live and die with it.
+ */
+static void
+do_open_multipath_sockets(struct context *c)
+{
+    struct link_socket *sock = c->c2.link_socket;
+    const struct socket_buffer_size sbs = { c->options.rcvbuf, c->options.sndbuf, 0 };
+
+    if (!sock || sock->n_extra || !c->options.n_multipath || c->mode != CM_P2P)
+    {
+        return;
+    }
+
+    for (int i = 0; i < c->options.n_multipath; ++i)
+    {
+        sock->extra_sd[i] = link_socket_open_udp_extra(c->options.multipath_host[i],
+                                                       "0", &sbs);
+    }
+    sock->n_extra = c->options.n_multipath;
+}
+#endif
+
 /*
  * Initialize timers
  */
@@ -1385,6 +1429,12 @@ do_init_timers(struct context *c, bool deferred)
         event_timeout_init(&c->c2.inactivity_interval, c->options.inactivity_timeout, now);
     }
 
+    /* initialize idle compaction */
+    if (c->options.compact_idle)
+    {
+        event_timeout_init(&c->c2.compact_idle_interval, c->options.compact_idle, now);
+    }
+
     /* initialize inactivity timeout */
     if (c->options.session_timeout)
     {
@@ -1443,6 +1493,11 @@ do_init_timers(struct context *c, bool deferred)
             event_timeout_init(&c->c2.occ_mtu_load_test_interval, OCC_MTU_LOAD_INTERVAL_SECONDS, now);
         }
 
+        if (c->options.pmtu_probe)
+        {
+            event_timeout_init(&c->c2.pmtu_probe_interval, OCC_PMTU_PROBE_INTERVAL_SECONDS, now);
+        }
+
         /* initialize packet_id persistence timer */
         if (c->options.packet_id_file)
         {
@@ -1464,7 +1519,7 @@ do_init_traffic_shaper(struct context *c)
     /* initialize traffic shaper (i.e. transmit bandwidth limiter) */
     if (c->options.shaper)
     {
-        shaper_init(&c->c2.shaper, c->options.shaper);
+        shaper_init(&c->c2.shaper, c->options.shaper, c->options.shaper_burst);
         shaper_msg(&c->c2.shaper);
     }
 }
@@ -1767,6 +1822,70 @@ do_route(const struct options *options,
     return ret;
 }
 
+/*
+ * Reconcile the routes left installed by --persist-tun with the routes
+ * pulled on this connection, see --persist-routes.  Returns false if
+ * that is not possible and the tun device needs to be reopened instead.
+ */
+static bool
+do_update_routes(struct context *c)
+{
+    struct route_list old_rl;
+    struct route_ipv6_list old_rl6;
+
+    if (route_did_redirect_default_gateway(c->c1.route_list))
+    {
+        return false;
+    }
+
+    msg(M_INFO, "NOTE: Pulled routes changed, updating routes on %s",
+        c->c1.tuntap->actual_name);
+
+    do_alloc_route_list(c);
+
+    /* detach the installed routes, the lists are reinitialized below */
+    CLEAR(old_rl);
+    CLEAR(old_rl6);
+    if (c->c1.route_list)
+    {
+        old_rl = *c->c1.route_list;
+        CLEAR(*c->c1.route_list);
+    }
+    if (c->c1.route_ipv6_list)
+    {
+        old_rl6 = *c->c1.route_ipv6_list;
+        CLEAR(*c->c1.route_ipv6_list);
+    }
+
+    ASSERT(c->c2.link_socket);
+    if (c->options.routes && c->c1.route_list)
+    {
+        do_init_route_list(&c->options, c->c1.route_list,
+                           &c->c2.link_socket->info, c->c2.es, &c->net_ctx);
+    }
+    if (c->options.routes_ipv6 && c->c1.route_ipv6_list)
+    {
+        do_init_route_ipv6_list(&c->options, c->c1.route_ipv6_list,
+                                &c->c2.link_socket->info, c->c2.es,
+                                &c->net_ctx);
+    }
+
+    if (!c->options.route_noexec)
+    {
+        update_routes(c->c1.route_list, c->c1.route_ipv6_list, &old_rl, &old_rl6,
+                      c->c1.tuntap, ROUTE_OPTION_FLAGS(&c->options),
+                      c->c2.es, &c->net_ctx);
+    }
+    else
+    {
+        gc_free(&old_rl.gc);
+        gc_free(&old_rl6.gc);
+    }
+
+    c->c1.pulled_routes_digest_save = c->c2.pulled_routes_digest;
+    return true;
+}
+
 /*
  * initialize tun/tap device object
  */
@@ -1855,6 +1974,23 @@ do_open_tun(struct context *c, int *error_flags)
         /* allocate route list structure */
         do_alloc_route_list(c);
 
+#if UNIX_SOCK_SUPPORT
+        /* the previous process configured the device and its routes and
+         * left them in place for us, --handoff */
+        if (c->handoff && c->handoff->tun_fd >= 0)
+        {
+            c->c1.tuntap->fd = c->handoff->tun_fd;
+            c->c1.tuntap->actual_name = string_alloc(c->handoff->tun_name, NULL);
+            c->handoff->tun_fd = -1;
+            msg(M_INFO, "HANDOFF: using %s of the previous process",
+                c->c1.tuntap->actual_name);
+
+            static_context = c;
+            gc_free(&gc);
+            return true;
+        }
+#endif
+
         /* parse and resolve the route option list */
         ASSERT(c->c2.link_socket);
         if (c->options.routes && c->c1.route_list)
@@ -2022,6 +2158,7 @@ do_close_tun_simple(struct context *c)
     }
     c->c1.tuntap_owned = false;
     CLEAR(c->c1.pulled_options_digest_save);
+    CLEAR(c->c1.pulled_routes_digest_save);
 }
 
 static void
@@ -2344,6 +2481,10 @@ tls_print_deferred_options_results(struct context *c)
         {
             buf_printf(&out, " dyn-tls-crypt");
         }
+        if (o->imported_protocol_flags & CO_EPOCH_DATA_KEY_FORMAT)
+        {
+            buf_printf(&out, " aead-epoch-tag-first");
+        }
     }
 
     if (buf_len(&out) > strlen(header))
@@ -2411,11 +2552,26 @@ do_up(struct context *c, bool pulled_options, unsigned int option_types_found)
              * Was tun interface object persisted from previous restart iteration,
              * and if so did pulled options string change from previous iteration?
              */
+            bool reopen_tun = !c->c2.did_open_tun
+                              && PULL_DEFINED(&c->options)
+                              && c->c1.tuntap
+                              && options_hash_changed_or_zero(&c->c1.pulled_options_digest_save,
+                                                              &c->c2.pulled_options_digest);
+
+            /* with --persist-routes, a change of pushed routes alone is applied in place */
             if (!c->c2.did_open_tun
                 && PULL_DEFINED(&c->options)
                 && c->c1.tuntap
-                && options_hash_changed_or_zero(&c->c1.pulled_options_digest_save,
-                                                &c->c2.pulled_options_digest))
+                && !reopen_tun
+                && c->options.persist_routes
+                && memcmp(&c->c1.pulled_routes_digest_save,
+                          &c->c2.pulled_routes_digest,
+                          sizeof(struct sha256_digest)))
+            {
+                reopen_tun = !do_update_routes(c);
+            }
+
+            if (reopen_tun)
             {
                 /* if so, close tun, delete routes, then reinitialize tun and add routes */
                 msg(M_INFO, "NOTE: Pulled options changed on restart, will need to close and reopen TUN/TAP device.");
@@ -2493,6 +2649,7 @@ do_up(struct context *c, bool pulled_options, unsigned int option_types_found)
         if (c->c2.did_open_tun)
         {
             c->c1.pulled_options_digest_save = c->c2.pulled_options_digest;
+            c->c1.pulled_routes_digest_save = c->c2.pulled_routes_digest;
 
             /* if --route-delay was specified, start timer */
             if ((route_order() == ROUTE_AFTER_TUN) && c->options.route_delay_defined)
@@ -2525,6 +2682,42 @@ do_up(struct context *c, bool pulled_options, unsigned int option_types_found)
     return true;
 }
 
+bool
+do_push_update(struct context *c, unsigned int parts)
+{
+    bool ret = false;
+
+    if (!c->c1.tuntap)
+    {
+        msg(D_PUSH_ERRORS, "ERROR: No TUN/TAP device to apply the pulled options to");
+    }
+    else if (!(parts & PULL_RESET_DNS) && do_update_routes(c))
+    {
+        ret = true;
+    }
+    else if (dco_enabled(&c->options))
+    {
+        msg(D_PUSH_ERRORS, "ERROR: Cannot reopen the TUN/TAP device with data channel offload");
+    }
+    else
+    {
+        int error_flags = 0;
+
+        msg(M_INFO, "NOTE: Pulled options changed, will need to close and reopen TUN/TAP device.");
+        do_close_tun(c, true);
+        management_sleep(1);
+        c->c2.did_open_tun = do_open_tun(c, &error_flags);
+        update_time();
+        ret = c->c2.did_open_tun && !error_flags;
+    }
+
+    /* the options differ from what the server pushed on connect now, so
+     * a restart with --persist-tun has to apply them all over again */
+    CLEAR(c->c1.pulled_options_digest_save);
+    CLEAR(c->c1.pulled_routes_digest_save);
+    return ret;
+}
+
 /*
  * These are the option categories which will be accepted by pull.
  */
@@ -2646,6 +2839,7 @@ do_deferred_options(struct context *c, const unsigned int found)
         msg(D_PUSH_DEBUG, "OPTIONS IMPORT: compression parms modified");
         comp_uninit(c->c2.comp_context);
         c->c2.comp_context = comp_init(&c->options.comp);
+        c->c2.ping_frame_len = 0;
 #endif
     }
 
@@ -2718,6 +2912,30 @@ do_deferred_options(struct context *c, const unsigned int found)
         }
     }
 
+    if (c->options.fec && !c->c2.fec)
+    {
+        msg(D_PUSH, "OPTIONS IMPORT: fec set to %d", c->options.fec);
+        c->c2.fec = fec_init(c->options.fec, &c->c2.frame);
+    }
+
+    if ((c->options.imported_protocol_flags & CO_MULTIPATH) && !c->c2.multipath)
+    {
+        if (c->options.mode == MODE_SERVER)
+        {
+            c->c2.multipath = multipath_new_learn();
+        }
+        else if (c->c2.link_socket && c->c2.link_socket->n_extra)
+        {
+            c->c2.multipath = multipath_new_sockets(c->c2.link_socket->n_extra,
+                                                    c->options.multipath_weight);
+        }
+        if (c->c2.multipath)
+        {
+            msg(D_PUSH, "OPTIONS IMPORT: data channel spread over several paths");
+            event_timeout_init(&c->c2.multipath_interval, 1, now);
+        }
+    }
+
     if (found & OPT_P_PUSH_MTU)
     {
         /* MTU has changed, check that the pushed MTU is small enough to
@@ -2937,6 +3155,9 @@ frame_finalize_options(struct context *c, const struct options *o)
     /* compression header and fragment header (part of the encrypted payload) */
     headroom += 1 + 1;
 
+    /* --fec header, which may only be known after a push */
+    headroom += FEC_OVERHEAD;
+
     /* Round up headroom to the next multiple of 4 to ensure alignment */
     headroom = (headroom + 3) & ~3;
 
@@ -2968,10 +3189,16 @@ static void
 key_schedule_free(struct key_schedule *ks, bool free_ssl_ctx)
 {
     free_key_ctx_bi(&ks->static_key);
-    if (tls_ctx_initialised(&ks->ssl_ctx) && free_ssl_ctx)
+    if (free_ssl_ctx)
     {
-        tls_ctx_free(&ks->ssl_ctx);
+        /* the context may already have been handed to tls_ctx_stash() */
+        if (tls_ctx_initialised(&ks->ssl_ctx))
+        {
+            tls_ctx_free(&ks->ssl_ctx);
+        }
         free_key_ctx(&ks->auth_token_key);
+        verify_cache_free(ks->verify_cache);
+        crl_dir_free(ks->crl_dir);
     }
     CLEAR(*ks);
 }
@@ -3098,6 +3325,12 @@ do_init_tls_wrap_key(struct context *c)
             tls_crypt_v2_init_server_key(&c->c1.ks.tls_crypt_v2_server_key,
                                          true, options->ce.tls_crypt_v2_file,
                                          options->ce.tls_crypt_v2_file_inline);
+            c->c1.ks.tls_crypt_v2_wkc_cache = tls_crypt_v2_wkc_cache_new();
+            if (options->tls_crypt_v2_verify_script)
+            {
+                c->c1.ks.tls_crypt_v2_verify_cache =
+                    tls_crypt_v2_verify_cache_new(options->tls_crypt_v2_verify_cache);
+            }
         }
         else
         {
@@ -3208,6 +3441,17 @@ do_init_crypto_tls_c1(struct context *c)
                                    c->options.auth_token_secret_file_inline);
         }
 
+        if (options->verify_cache_size)
+        {
+            c->c1.ks.verify_cache = verify_cache_new(options->verify_cache_size,
+                                                     options->verify_cache_max_age);
+        }
+
+        if (options->crl_file && (options->ssl_flags & SSLF_CRL_VERIFY_DIR))
+        {
+            c->c1.ks.crl_dir = crl_dir_new(options->crl_file);
+        }
+
 #if 0 /* was: #if ENABLE_INLINE_FILES --  Note that enabling this code will break restarts */
         if (options->priv_key_file_inline)
         {
@@ -3278,6 +3522,7 @@ do_init_crypto_tls(struct context *c, const unsigned int flags)
     to.transition_window = options->transition_window;
     to.handshake_window = options->handshake_window;
     to.packet_timeout = options->tls_timeout;
+    to.send_window = options->tls_window;
     to.renegotiate_bytes = options->renegotiate_bytes;
     to.renegotiate_packets = options->renegotiate_packets;
     if (options->renegotiate_seconds_min < 0)
@@ -3328,9 +3573,11 @@ do_init_crypto_tls(struct context *c, const unsigned int flags)
     to.verify_x509_name = options->verify_x509_name;
     to.crl_file = options->crl_file;
     to.crl_file_inline = options->crl_file_inline;
+    to.verify_cache = c->c1.ks.verify_cache;
+    to.crl_dir = c->c1.ks.crl_dir;
     to.ssl_flags = options->ssl_flags;
     to.ns_cert_type = options->ns_cert_type;
-    memcpy(to.remote_cert_ku, options->remote_cert_ku, sizeof(to.remote_cert_ku));
+    to.remote_cert_ku = options->remote_cert_ku;
     to.remote_cert_eku = options->remote_cert_eku;
     to.verify_hash = options->verify_hash;
     to.verify_hash_algo = options->verify_hash_algo;
@@ -3427,7 +3674,10 @@ do_init_crypto_tls(struct context *c, const unsigned int flags)
         if (options->tls_server)
         {
             to.tls_wrap.tls_crypt_v2_server_key = c->c1.ks.tls_crypt_v2_server_key;
+            to.tls_wrap.tls_crypt_v2_wkc_cache = c->c1.ks.tls_crypt_v2_wkc_cache;
             to.tls_crypt_v2_verify_script = c->options.tls_crypt_v2_verify_script;
+            to.tls_crypt_v2_verify_via_env = c->options.tls_crypt_v2_verify_via_env;
+            to.tls_crypt_v2_verify_cache = c->c1.ks.tls_crypt_v2_verify_cache;
             if (options->ce.tls_crypt_v2_force_cookie)
             {
                 to.tls_wrap.opt.flags |= CO_FORCE_TLSCRYPTV2_COOKIE;
@@ -3438,6 +3688,8 @@ do_init_crypto_tls(struct context *c, const unsigned int flags)
     /* let the TLS engine know if keys have to be installed in DCO or not */
     to.dco_enabled = dco_enabled(options);
 
+    to.multipath = options->n_multipath > 0;
+
     /*
      * Initialize OpenVPN's master TLS-mode object.
      */
@@ -3695,10 +3947,69 @@ init_context_buffers(const struct frame *frame)
     return b;
 }
 
+/*
+ * Like init_context_buffers(), but without storage.  The buffers are
+ * taken from pool when they are first used after
+ * context_buffers_release().
+ */
+static struct context_buffers *
+init_context_buffers_pooled(struct buffer_pool *pool)
+{
+    struct context_buffers *b;
+
+    ALLOC_OBJ_CLEAR(b, struct context_buffers);
+    b->pool = pool;
+    return b;
+}
+
+void
+context_buffers_checkout(struct context_buffers *b)
+{
+    ASSERT(b->pool && !b->checked_out);
+
+    b->read_link_buf = buffer_pool_get(b->pool);
+    b->read_tun_buf = buffer_pool_get(b->pool);
+    b->aux_buf = buffer_pool_get(b->pool);
+    b->encrypt_buf = buffer_pool_get(b->pool);
+    b->decrypt_buf = buffer_pool_get(b->pool);
+#ifdef USE_COMP
+    b->compress_buf = buffer_pool_get(b->pool);
+    b->decompress_buf = buffer_pool_get(b->pool);
+#endif
+    b->checked_out = true;
+}
+
+/*
+ * Give pooled buffers back.  Only call this when nothing that is
+ * still queued (c2.to_link, c2.to_tun) points into them.
+ */
+void
+context_buffers_release(struct context_buffers *b)
+{
+    if (b && b->pool && b->checked_out)
+    {
+        buffer_pool_put(b->pool, &b->read_link_buf);
+        buffer_pool_put(b->pool, &b->read_tun_buf);
+        buffer_pool_put(b->pool, &b->aux_buf);
+        buffer_pool_put(b->pool, &b->encrypt_buf);
+        buffer_pool_put(b->pool, &b->decrypt_buf);
+#ifdef USE_COMP
+        buffer_pool_put(b->pool, &b->compress_buf);
+        buffer_pool_put(b->pool, &b->decompress_buf);
+#endif
+        b->checked_out = false;
+    }
+}
+
 void
 free_context_buffers(struct context_buffers *b)
 {
-    if (b)
+    if (b && b->pool)
+    {
+        context_buffers_release(b);
+        free(b);
+    }
+    else if (b)
     {
         free_buf(&b->read_link_buf);
         free_buf(&b->read_tun_buf);
@@ -3723,14 +4034,32 @@ free_context_buffers(struct context_buffers *b)
 static void
 do_init_buffers(struct context *c)
 {
-    c->c2.buffers = init_context_buffers(&c->c2.frame);
+    if (c->c2.buffer_pool && c->c2.buffer_pool->size == (size_t) BUF_SIZE(&c->c2.frame))
+    {
+        c->c2.buffers = init_context_buffers_pooled(c->c2.buffer_pool);
+    }
+    else
+    {
+        c->c2.buffers = init_context_buffers(&c->c2.frame);
+    }
     c->c2.buffers_owned = true;
+
+#ifndef _WIN32
+    /* draining the queues would not wait for --shaper */
+    if (c->mode == CM_P2P && !c->options.shaper)
+    {
+        c->c2.tun_queue = pktq_init(PKTQ_PACKETS, BUF_SIZE(&c->c2.frame),
+                                    c->c2.frame.buf.headroom, false);
+        c->c2.link_queue = pktq_init(PKTQ_PACKETS, BUF_SIZE(&c->c2.frame),
+                                     c->c2.frame.buf.headroom, true);
+    }
+#endif
 }
 
 #ifdef ENABLE_FRAGMENT
 /*
- * Fragmenting code has buffers to initialize
- * once frame parameters are known.
+ * Fragmenting code needs the frame parameters, its
+ * buffers are allocated when first needed.
  */
 static void
 do_init_fragment(struct context *c)
@@ -3738,7 +4067,6 @@ do_init_fragment(struct context *c)
     ASSERT(c->options.ce.fragment);
     frame_calculate_dynamic(&c->c2.frame_fragment, &c->c1.ks.key_type,
                             &c->options, get_link_socket_info(c));
-    fragment_frame_init(c->c2.fragment, &c->c2.frame_fragment);
 }
 #endif
 
@@ -3833,6 +4161,10 @@ do_init_first_time(struct context *c)
 
         /* should we change scheduling priority? */
         platform_nice(c->options.nice);
+
+        /* should we stay on one NUMA node, or even one CPU? */
+        platform_numa_node(c->options.numa_node);
+        platform_cpu_affinity(c->options.cpu_affinity);
     }
 }
 
@@ -3848,6 +4180,10 @@ do_close_free_buf(struct context *c)
         c->c2.buffers = NULL;
         c->c2.buffers_owned = false;
     }
+    pktq_free(c->c2.tun_queue);
+    c->c2.tun_queue = NULL;
+    pktq_free(c->c2.link_queue);
+    c->c2.link_queue = NULL;
 }
 
 /*
@@ -3873,6 +4209,11 @@ do_close_tls(struct context *c)
         md_ctx_cleanup(c->c2.pulled_options_state);
         md_ctx_free(c->c2.pulled_options_state);
     }
+    if (c->c2.pulled_routes_state)
+    {
+        md_ctx_cleanup(c->c2.pulled_routes_state);
+        md_ctx_free(c->c2.pulled_routes_state);
+    }
 
     tls_auth_standalone_free(c->c2.tls_auth_standalone);
 }
@@ -3888,11 +4229,26 @@ do_close_free_key_schedule(struct context *c, bool free_ssl_ctx)
      * be reloaded from memory (pre-cached)
      */
     free_key_ctx(&c->c1.ks.tls_crypt_v2_server_key);
+    /* the cache belongs to the server key, child contexts only borrow it */
+    if (free_ssl_ctx)
+    {
+        tls_crypt_v2_wkc_cache_free(c->c1.ks.tls_crypt_v2_wkc_cache);
+        tls_crypt_v2_verify_cache_free(c->c1.ks.tls_crypt_v2_verify_cache);
+    }
+    c->c1.ks.tls_crypt_v2_wkc_cache = NULL;
+    c->c1.ks.tls_crypt_v2_verify_cache = NULL;
     free_key_ctx_bi(&c->c1.ks.tls_wrap_key);
     CLEAR(c->c1.ks.tls_wrap_key);
     buf_clear(&c->c1.ks.tls_crypt_v2_wkc);
     free_buf(&c->c1.ks.tls_crypt_v2_wkc);
 
+    /* keep the TLS context for init_ssl() to reuse if nothing changed */
+    if (free_ssl_ctx && c->sig->signal_received == SIGHUP
+        && tls_ctx_initialised(&c->c1.ks.ssl_ctx))
+    {
+        tls_ctx_stash(&c->c1.ks.ssl_ctx);
+    }
+
     if (!(c->sig->signal_received == SIGUSR1 && c->options.persist_key))
     {
         key_schedule_free(&c->c1.ks, free_ssl_ctx);
@@ -3991,7 +4347,15 @@ do_event_set_init(struct context *c,
 {
     unsigned int flags = 0;
 
-    c->c2.event_set_max = BASE_N_EVENTS;
+    c->c2.event_set_max = BASE_N_EVENTS - 1 + tun_event_count(&c->options.tuntap_options)
+                          + c->options.n_listen_extra + c->options.n_multipath;
+#ifdef ENABLE_MANAGEMENT
+    /* the listen socket and the further management clients */
+    if (c->options.management_max_clients > 1)
+    {
+        c->c2.event_set_max += c->options.management_max_clients;
+    }
+#endif
 
     flags |= EVENT_METHOD_FAST;
 
@@ -4337,6 +4701,7 @@ open_management(struct context *c)
                                 c->options.management_log_history_cache,
                                 c->options.management_echo_buffer_size,
                                 c->options.management_state_buffer_size,
+                                c->options.management_max_clients,
                                 c->options.remap_sigusr1,
                                 flags))
             {
@@ -4652,11 +5017,26 @@ init_instance(struct context *c, const struct env_set *env, const unsigned int f
     }
 
     /* initialize output speed limiter */
-    if (c->mode == CM_P2P)
+    if (c->mode == CM_P2P || child)
     {
         do_init_traffic_shaper(c);
     }
 
+    /* initialize --fec, which a server and a client only know after
+     * the connect, see do_deferred_options() */
+    if (options->fec && c->mode == CM_P2P && !options->pull)
+    {
+        c->c2.fec = fec_init(options->fec, &c->c2.frame);
+    }
+
+#ifdef ENABLE_DEBUG
+    /* initialize --gremlin-impair */
+    if (gremlin_impair_defined(&options->gremlin_impair) && (c->mode == CM_P2P || child))
+    {
+        c->c2.gremlin_impair = gremlin_impair_new(&c->options.gremlin_impair, &c->c2.frame);
+    }
+#endif
+
     /* do one-time inits, and possibly become a daemon here */
     do_init_first_time(c);
 
@@ -4675,7 +5055,9 @@ init_instance(struct context *c, const struct env_set *env, const unsigned int f
     if (c->mode == CM_P2P || c->mode == CM_TOP || c->mode == CM_CHILD_TCP)
     {
         link_socket_init_phase2(c);
-
+#ifndef _WIN32
+        do_open_multipath_sockets(c);
+#endif
 
         /* Update dynamic frame calculation as exact transport socket information
          * (IP vs IPv6) may be only available after socket phase2 has finished.
@@ -4794,6 +5176,20 @@ close_instance(struct context *c)
         do_close_fragment(c);
 #endif
 
+        /* close --fec */
+        fec_free(c->c2.fec);
+        c->c2.fec = NULL;
+
+        /* close --multipath, its sockets go with the link socket */
+        multipath_free(c->c2.multipath);
+        c->c2.multipath = NULL;
+
+#ifdef ENABLE_DEBUG
+        /* release packets held back by --gremlin-impair */
+        gremlin_impair_free(c->c2.gremlin_impair);
+        c->c2.gremlin_impair = NULL;
+#endif
+
         /* close --ifconfig-pool-persist obj */
         do_close_ifconfig_pool_persist(c);
 
@@ -4830,12 +5226,16 @@ inherit_context_child(struct context *dest,
     dest->c1.ks.tls_wrap_key = src->c1.ks.tls_wrap_key;
     dest->c1.ks.tls_auth_key_type = src->c1.ks.tls_auth_key_type;
     dest->c1.ks.tls_crypt_v2_server_key = src->c1.ks.tls_crypt_v2_server_key;
+    dest->c1.ks.tls_crypt_v2_wkc_cache = src->c1.ks.tls_crypt_v2_wkc_cache;
+    dest->c1.ks.tls_crypt_v2_verify_cache = src->c1.ks.tls_crypt_v2_verify_cache;
     /* inherit pre-NCP ciphers */
     dest->options.ciphername = src->options.ciphername;
     dest->options.authname = src->options.authname;
 
     /* inherit auth-token */
     dest->c1.ks.auth_token_key = src->c1.ks.auth_token_key;
+    dest->c1.ks.verify_cache = src->c1.ks.verify_cache;
+    dest->c1.ks.crl_dir = src->c1.ks.crl_dir;
 
     /* options */
     dest->options = src->options;
@@ -4848,6 +5248,9 @@ inherit_context_child(struct context *dest,
          * and the CM_CHILD_TCP context does the accept().
          */
         dest->c2.accept_from = src->c2.link_socket;
+
+        /* take workspace buffers from the pool of the parent */
+        dest->c2.buffer_pool = src->c2.buffer_pool;
     }
 
 #ifdef ENABLE_PLUGIN
@@ -5035,10 +5438,67 @@ test_crypto_thread(void *arg)
     return NULL;
 }
 
+/*
+ * Benchmark the data channel crypto of every cipher in --data-ciphers.
+ */
+static void
+bench_datachannel(struct context *c)
+{
+    const struct options *options = &c->options;
+    struct compress_context *compctx = NULL;
+    const char *compname = "none";
+    struct gc_arena gc = gc_new();
+
+    ASSERT(options->bench_datachannel);
+    init_verb_mute(c, IVM_LEVEL_1);
+    context_init_1(c);
+    next_connection_entry(c);
+
+    frame_finalize_options(c, options);
+
+    for (int i = 0; i < options->bench_n_sizes; i++)
+    {
+        if (options->bench_sizes[i] > c->c2.frame.tun_max_mtu)
+        {
+            msg(M_FATAL, "--bench-datachannel: packet size %d is larger than "
+                "the maximum tun MTU of %d (see --tun-mtu-max)",
+                options->bench_sizes[i], c->c2.frame.tun_max_mtu);
+        }
+    }
+
+#ifdef USE_COMP
+    if (comp_enabled(&options->comp))
+    {
+        compctx = comp_init(&options->comp);
+        compname = compctx->alg.name;
+    }
+#endif
+
+    msg(M_INFO, "Entering " PACKAGE_NAME " data channel benchmark mode, "
+        "%d packet sizes, %d seconds per cipher, compression: %s.",
+        options->bench_n_sizes, options->bench_seconds, compname);
+
+    char *ciphers = string_alloc(options->ncp_ciphers, &gc);
+    for (const char *ciphername = strtok(ciphers, ":"); ciphername;
+         ciphername = strtok(NULL, ":"))
+    {
+        struct key_type kt;
+        init_key_type(&kt, ciphername, options->authname, true, false);
+        bench_crypto(&kt, &c->c2.frame, compctx, options->bench_sizes,
+                     options->bench_n_sizes, options->bench_seconds);
+    }
+
+#ifdef USE_COMP
+    comp_uninit(compctx);
+#endif
+    context_gc_free(c);
+    gc_free(&gc);
+}
+
 bool
 do_test_crypto(const struct options *o)
 {
-    if (o->test_crypto)
+    if (o->test_crypto || o->bench_datachannel)
     {
         struct context c;
 
@@ -5049,7 +5509,14 @@ do_test_crypto(const struct options *o)
         c.options = *o;
         options_detach(&c.options);
         c.first_time = true;
-        test_crypto_thread((void *) &c);
+        if (o->test_crypto)
+        {
+            test_crypto_thread((void *) &c);
+        }
+        else
+        {
+            bench_datachannel(&c);
+        }
         return true;
     }
     return false;
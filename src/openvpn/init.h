@@ -30,7 +30,7 @@
  * Baseline maximum number of events
  * to wait for.
  */
-#define BASE_N_EVENTS 5
+#define BASE_N_EVENTS 6
 
 void context_clear(struct context *c);
 
@@ -86,6 +86,16 @@ bool do_up(struct context *c,
            bool pulled_options,
            unsigned int option_types_found);
 
+/**
+ * Applies the options a PUSH_UPDATE has replaced to the tun device,
+ * in place for routes, otherwise by reopening it.
+ *
+ * @param c         context of the connection
+ * @param parts     PULL_RESET_x flags of the replaced options
+ * @return          false if the update could not be applied
+ */
+bool do_push_update(struct context *c, unsigned int parts);
+
 unsigned int pull_permission_mask(const struct context *c);
 
 const char *format_common_name(struct context *c, struct gc_arena *gc);
@@ -111,6 +121,25 @@ struct context_buffers *init_context_buffers(const struct frame *frame);
 
 void free_context_buffers(struct context_buffers *b);
 
+void context_buffers_checkout(struct context_buffers *b);
+
+void context_buffers_release(struct context_buffers *b);
+
+/*
+ * Return the workspace buffers of a context, taking them from
+ * the pool first if they are pooled and not checked out.
+ */
+static inline struct context_buffers *
+get_context_buffers(struct context *c)
+{
+    struct context_buffers *b = c->c2.buffers;
+    if (b->pool && !b->checked_out)
+    {
+        context_buffers_checkout(b);
+    }
+    return b;
+}
+
 #define ISC_ERRORS (1<<0)
 #define ISC_SERVER (1<<1)
 #define ISC_ROUTE_ERRORS (1<<2)
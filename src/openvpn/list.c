@@ -34,6 +34,29 @@
 
 #include "memdbg.h"
 
+/* smallest table allocated by hash_init() */
+#define HASH_MIN_BUCKETS 8
+
+/* slots of the previous table moved per add or remove while resizing */
+#define HASH_MIGRATE_STEP 4
+
+/*
+ * Slots of the current table that are in use, including deleted
+ * elements which have not been cleaned up yet.
+ */
+static inline int
+hash_n_used(const struct hash *hash)
+{
+    return hash->n_elements - hash->old_n_elements + hash->n_deleted;
+}
+
+/* grow once more than 3/4 of the slots are in use */
+static inline bool
+hash_overloaded(const struct hash *hash, int n_used)
+{
+    return n_used > hash->n_buckets - hash->n_buckets / 4;
+}
+
 struct hash *
 hash_init(const int n_buckets,
           const uint32_t iv,
@@ -41,120 +64,257 @@ hash_init(const int n_buckets,
           bool (*compare_function)(const void *key1, const void *key2))
 {
     struct hash *h;
-    int i;
 
     ASSERT(n_buckets > 0);
     ALLOC_OBJ_CLEAR(h, struct hash);
-    h->n_buckets = (int) adjust_power_of_2(n_buckets);
+    h->n_buckets = max_int((int) adjust_power_of_2(n_buckets), HASH_MIN_BUCKETS);
     h->mask = h->n_buckets - 1;
     h->hash_function = hash_function;
     h->compare_function = compare_function;
     h->iv = iv;
-    ALLOC_ARRAY(h->buckets, struct hash_bucket, h->n_buckets);
-    for (i = 0; i < h->n_buckets; ++i)
-    {
-        struct hash_bucket *b = &h->buckets[i];
-        b->list = NULL;
-    }
+    ALLOC_ARRAY_CLEAR(h->buckets, struct hash_element, h->n_buckets);
     return h;
 }
 
 void
 hash_free(struct hash *hash)
 {
-    int i;
-    for (i = 0; i < hash->n_buckets; ++i)
+    free(hash->old_buckets);
+    free(hash->buckets);
+    free(hash);
+}
+
+size_t
+hash_mem_usage(const struct hash *hash)
+{
+    return sizeof(*hash)
+           + (size_t) hash->n_buckets * sizeof(struct hash_element)
+           + (hash->old_buckets ? (size_t) hash->old_n_buckets * sizeof(struct hash_element) : 0);
+}
+
+/*
+ * Robin Hood probing keeps every element at least as close to its
+ * home slot as the elements after it, so a search can stop at the
+ * first slot whose element is closer to home than the probe.
+ */
+static struct hash_element *
+hash_table_find(const struct hash *hash,
+                struct hash_element *table,
+                uint32_t mask,
+                const void *key,
+                uint32_t hv)
+{
+    uint32_t i = hv & mask;
+
+    for (uint32_t dist = 1;; ++dist)
     {
-        struct hash_bucket *b = &hash->buckets[i];
-        struct hash_element *he = b->list;
+        struct hash_element *he = &table[i];
 
-        while (he)
+        if (he->dist < dist)
         {
-            struct hash_element *next = he->next;
-            free(he);
-            he = next;
+            return NULL;
         }
+        if (he->hash_value == hv && he->key
+            && (*hash->compare_function)(key, he->key))
+        {
+            return he;
+        }
+        i = (i + 1) & mask;
+    }
+}
+
+static void
+hash_table_insert(struct hash_element *table, uint32_t mask, struct hash_element e)
+{
+    uint32_t i = e.hash_value & mask;
+
+    e.dist = 1;
+    while (true)
+    {
+        struct hash_element *he = &table[i];
+
+        if (!he->dist)
+        {
+            *he = e;
+            return;
+        }
+        if (he->dist < e.dist)
+        {
+            /* take the slot from the element closer to home */
+            struct hash_element tmp = *he;
+            *he = e;
+            e = tmp;
+        }
+        i = (i + 1) & mask;
+        ++e.dist;
+    }
+}
+
+/*
+ * Remove the element in slot i and shift the elements following it
+ * one slot back, until an empty slot or an element in its home slot.
+ */
+static void
+hash_table_erase(struct hash_element *table, uint32_t mask, uint32_t i)
+{
+    while (true)
+    {
+        const uint32_t next = (i + 1) & mask;
+
+        if (table[next].dist <= 1)
+        {
+            CLEAR(table[i]);
+            return;
+        }
+        table[i] = table[next];
+        --table[i].dist;
+        i = next;
     }
-    free(hash->buckets);
-    free(hash);
+}
+
+/*
+ * Move up to n_slots slots of the previous table into the current one.
+ * Moved slots are left behind as deleted elements so that searches in
+ * the previous table still probe past them.
+ */
+static void
+hash_migrate(struct hash *hash, int n_slots)
+{
+    while (hash->old_buckets && n_slots-- > 0)
+    {
+        struct hash_element *he = &hash->old_buckets[hash->old_index++];
+
+        if (he->dist && he->key)
+        {
+            hash_table_insert(hash->buckets, hash->mask, *he);
+            he->key = NULL;
+            --hash->old_n_elements;
+        }
+
+        if (hash->old_index == hash->old_n_buckets)
+        {
+            ASSERT(hash->old_n_elements == 0);
+            free(hash->old_buckets);
+            hash->old_buckets = NULL;
+            hash->old_n_buckets = 0;
+            hash->old_index = 0;
+        }
+    }
+}
+
+static void
+hash_grow(struct hash *hash)
+{
+    hash_migrate(hash, INT_MAX);
+
+    hash->old_buckets = hash->buckets;
+    hash->old_n_buckets = hash->n_buckets;
+    hash->old_n_elements = hash->n_elements;
+    hash->old_index = 0;
+    hash->n_deleted = 0;
+
+    hash->n_buckets *= 2;
+    hash->mask = hash->n_buckets - 1;
+    ALLOC_ARRAY_CLEAR(hash->buckets, struct hash_element, hash->n_buckets);
 }
 
 struct hash_element *
 hash_lookup_fast(struct hash *hash,
-                 struct hash_bucket *bucket,
                  const void *key,
                  uint32_t hv)
 {
     struct hash_element *he;
-    struct hash_element *prev = NULL;
 
-    he = bucket->list;
+    he = hash_table_find(hash, hash->buckets, hash->mask, key, hv);
+    if (!he && hash->old_buckets)
+    {
+        he = hash_table_find(hash, hash->old_buckets, hash->old_n_buckets - 1,
+                             key, hv);
+    }
+    return he;
+}
 
-    while (he)
+void
+hash_add_fast(struct hash *hash,
+              const void *key,
+              uint32_t hv,
+              void *value)
+{
+    struct hash_element he = { .value = value, .key = key, .hash_value = hv };
+
+    if (!hash->n_iterators)
     {
-        if (hv == he->hash_value && (*hash->compare_function)(key, he->key))
+        hash_migrate(hash, HASH_MIGRATE_STEP);
+        if (hash_overloaded(hash, hash_n_used(hash) + 1))
         {
-            /* move to head of list */
-            if (prev)
-            {
-                prev->next = he->next;
-                he->next = bucket->list;
-                bucket->list = he;
-            }
-            return he;
+            hash_grow(hash);
         }
-        prev = he;
-        he = he->next;
+    }
+    else if (hash_n_used(hash) + 1 >= hash->n_buckets)
+    {
+        /* an iterator is open on a full table, resize it in one go */
+        hash_grow(hash);
+        hash_migrate(hash, INT_MAX);
     }
 
-    return NULL;
+    hash_table_insert(hash->buckets, hash->mask, he);
+    ++hash->n_elements;
 }
 
 bool
 hash_remove_fast(struct hash *hash,
-                 struct hash_bucket *bucket,
                  const void *key,
                  uint32_t hv)
 {
     struct hash_element *he;
-    struct hash_element *prev = NULL;
-
-    he = bucket->list;
 
-    while (he)
+    he = hash_table_find(hash, hash->buckets, hash->mask, key, hv);
+    if (he)
     {
-        if (hv == he->hash_value && (*hash->compare_function)(key, he->key))
+        if (hash->n_iterators)
         {
-            if (prev)
-            {
-                prev->next = he->next;
-            }
-            else
-            {
-                bucket->list = he->next;
-            }
-            free(he);
-            --hash->n_elements;
-            return true;
+            /* do not move elements under an open iterator */
+            he->key = NULL;
+            he->value = NULL;
+            ++hash->n_deleted;
         }
-        prev = he;
-        he = he->next;
+        else
+        {
+            hash_table_erase(hash->buckets, hash->mask,
+                             (uint32_t) (he - hash->buckets));
+        }
+    }
+    else if (hash->old_buckets
+             && (he = hash_table_find(hash, hash->old_buckets,
+                                      hash->old_n_buckets - 1, key, hv)))
+    {
+        he->key = NULL;
+        he->value = NULL;
+        --hash->old_n_elements;
+    }
+    else
+    {
+        return false;
     }
-    return false;
+
+    --hash->n_elements;
+    if (!hash->n_iterators)
+    {
+        hash_migrate(hash, HASH_MIGRATE_STEP);
+    }
+    return true;
 }
 
 bool
 hash_add(struct hash *hash, const void *key, void *value, bool replace)
 {
     uint32_t hv;
-    struct hash_bucket *bucket;
     struct hash_element *he;
     bool ret = false;
 
     hv = hash_value(hash, key);
-    bucket = &hash->buckets[hv & hash->mask];
 
-    if ((he = hash_lookup_fast(hash, bucket, key, hv))) /* already exists? */
+    if ((he = hash_lookup_fast(hash, key, hv))) /* already exists? */
     {
         if (replace)
         {
@@ -164,7 +324,7 @@ hash_add(struct hash *hash, const void *key, void *value, bool replace)
     }
     else
     {
-        hash_add_fast(hash, bucket, key, hv, value);
+        hash_add_fast(hash, key, hv, value);
         ret = true;
     }
 
@@ -188,33 +348,22 @@ hash_remove_by_value(struct hash *hash, void *value)
     hash_iterator_free(&hi);
 }
 
+/*
+ * Clean up the elements deleted through an iterator in slots
+ * start to end - 1.  Going backwards means that hash_table_erase()
+ * only moves elements that have already been looked at.
+ */
 static void
-hash_remove_marked(struct hash *hash, struct hash_bucket *bucket)
+hash_remove_marked(struct hash *hash, int start, int end)
 {
-    struct hash_element *prev = NULL;
-    struct hash_element *he = bucket->list;
-
-    while (he)
+    for (int i = end - 1; i >= start; --i)
     {
-        if (!he->key) /* marked? */
-        {
-            struct hash_element *newhe;
-            if (prev)
-            {
-                newhe = prev->next = he->next;
-            }
-            else
-            {
-                newhe = bucket->list = he->next;
-            }
-            free(he);
-            --hash->n_elements;
-            he = newhe;
-        }
-        else
+        const struct hash_element *he = &hash->buckets[i];
+
+        if (he->dist && !he->key)
         {
-            prev = he;
-            he = he->next;
+            hash_table_erase(hash->buckets, hash->mask, (uint32_t) i);
+            --hash->n_deleted;
         }
     }
 }
@@ -225,6 +374,9 @@ hash_iterator_init_range(struct hash *hash,
                          int start_bucket,
                          int end_bucket)
 {
+    /* finish a pending resize, so that all elements are in one table */
+    hash_migrate(hash, INT_MAX);
+
     if (end_bucket > hash->n_buckets)
     {
         end_bucket = hash->n_buckets;
@@ -232,14 +384,13 @@ hash_iterator_init_range(struct hash *hash,
 
     ASSERT(start_bucket >= 0 && start_bucket <= end_bucket);
 
+    ++hash->n_iterators;
     hi->hash = hash;
-    hi->elem = NULL;
-    hi->bucket = NULL;
     hi->last = NULL;
     hi->bucket_marked = false;
     hi->bucket_index_start = start_bucket;
     hi->bucket_index_end = end_bucket;
-    hi->bucket_index = hi->bucket_index_start - 1;
+    hi->bucket_index = start_bucket;
 }
 
 void
@@ -249,79 +400,49 @@ hash_iterator_init(struct hash *hash,
     hash_iterator_init_range(hash, hi, 0, hash->n_buckets);
 }
 
-static inline void
-hash_iterator_lock(struct hash_iterator *hi, struct hash_bucket *b)
+void
+hash_iterator_free(struct hash_iterator *hi)
 {
-    hi->bucket = b;
-    hi->last = NULL;
-    hi->bucket_marked = false;
-}
+    struct hash *hash = hi->hash;
 
-static inline void
-hash_iterator_unlock(struct hash_iterator *hi)
-{
-    if (hi->bucket)
+    if (hash)
     {
-        if (hi->bucket_marked)
+        ASSERT(hash->n_iterators > 0);
+        --hash->n_iterators;
+        if (hi->bucket_marked && !hash->n_iterators)
         {
-            hash_remove_marked(hi->hash, hi->bucket);
-            hi->bucket_marked = false;
+            hash_remove_marked(hash, hi->bucket_index_start, hi->bucket_index);
         }
-        hi->bucket = NULL;
+        hi->hash = NULL;
         hi->last = NULL;
     }
 }
 
-static inline void
-hash_iterator_advance(struct hash_iterator *hi)
-{
-    hi->last = hi->elem;
-    hi->elem = hi->elem->next;
-}
-
-void
-hash_iterator_free(struct hash_iterator *hi)
-{
-    hash_iterator_unlock(hi);
-}
-
 struct hash_element *
 hash_iterator_next(struct hash_iterator *hi)
 {
-    struct hash_element *ret = NULL;
-    if (hi->elem)
+    while (hi->bucket_index < hi->bucket_index_end)
     {
-        ret = hi->elem;
-        hash_iterator_advance(hi);
-    }
-    else
-    {
-        while (++hi->bucket_index < hi->bucket_index_end)
+        struct hash_element *he = &hi->hash->buckets[hi->bucket_index++];
+
+        if (he->dist && he->key)
         {
-            struct hash_bucket *b;
-            hash_iterator_unlock(hi);
-            b = &hi->hash->buckets[hi->bucket_index];
-            if (b->list)
-            {
-                hash_iterator_lock(hi, b);
-                hi->elem = b->list;
-                if (hi->elem)
-                {
-                    ret = hi->elem;
-                    hash_iterator_advance(hi);
-                    break;
-                }
-            }
+            hi->last = he;
+            return he;
         }
     }
-    return ret;
+    hi->last = NULL;
+    return NULL;
 }
 
 void
 hash_iterator_delete_element(struct hash_iterator *hi)
 {
-    ASSERT(hi->last);
+    ASSERT(hi->last && hi->last->key);
     hi->last->key = NULL;
+    hi->last->value = NULL;
+    ++hi->hash->n_deleted;
+    --hi->hash->n_elements;
     hi->bucket_marked = true;
 }
 
@@ -653,3 +774,102 @@ hash_func(const uint8_t *k, uint32_t length, uint32_t initval)
     /*-------------------------------------- report the result */
     return c;
 }
+
+/*
+ * A multiply-mix hash for short keys such as the IPv4, IPv6 and
+ * Ethernet addresses of struct mroute_addr, after wyhash by Wang Yi
+ * (public domain).  It needs two 64-bit multiplications for keys of
+ * up to 16 bytes, where hash_func() needs one mix() round per 12 bytes
+ * plus a final one.  Like hash_func(), it is not a cryptographic hash.
+ */
+
+/* replace a and b with the low and high half of their 128-bit product */
+static inline void
+hash_mum(uint64_t *a, uint64_t *b)
+{
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 r = (unsigned __int128) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+#else
+    const uint64_t ha = *a >> 32, hb = *b >> 32;
+    const uint64_t la = (uint32_t) *a, lb = (uint32_t) *b;
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    const uint64_t t = rl + (rm0 << 32);
+    const uint64_t lo = t + (rm1 << 32);
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+    *a = lo;
+#endif
+}
+
+static inline uint64_t
+hash_mix(uint64_t a, uint64_t b)
+{
+    hash_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t
+hash_read64(const uint8_t *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t
+hash_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t
+hash_func_short(const uint8_t *k, uint32_t length, uint32_t initval)
+{
+    static const uint64_t s0 = 0xa0761d6478bd642full;
+    static const uint64_t s1 = 0xe7037ed1a0b428dbull;
+    uint64_t seed = initval;
+    uint64_t a, b;
+
+    seed ^= hash_mix(seed ^ s0, s1);
+
+    if (length <= 16)
+    {
+        if (length >= 4)
+        {
+            const uint32_t off = (length >> 3) << 2;
+            a = (hash_read32(k) << 32) | hash_read32(k + off);
+            b = (hash_read32(k + length - 4) << 32) | hash_read32(k + length - 4 - off);
+        }
+        else if (length > 0)
+        {
+            a = ((uint64_t) k[0] << 16) | ((uint64_t) k[length >> 1] << 8) | k[length - 1];
+            b = 0;
+        }
+        else
+        {
+            a = b = 0;
+        }
+    }
+    else
+    {
+        uint32_t i = length;
+        while (i > 16)
+        {
+            seed = hash_mix(hash_read64(k) ^ s1, hash_read64(k + 8) ^ seed);
+            k += 16;
+            i -= 16;
+        }
+        a = hash_read64(k + i - 16);
+        b = hash_read64(k + i - 8);
+    }
+
+    a ^= s1;
+    b ^= seed;
+    hash_mum(&a, &b);
+
+    const uint64_t h = hash_mix(a ^ s0 ^ length, b ^ s1);
+    return (uint32_t) h ^ (uint32_t) (h >> 32);
+}
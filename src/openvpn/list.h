@@ -25,9 +25,8 @@
 #define LIST_H
 
 /*
- * This code is a fairly straightforward hash
- * table implementation using Bob Jenkins'
- * hash function.
+ * This code is an open-addressing hash table with
+ * Robin Hood probing and incremental resizing.
  *
  * Hash tables are used in OpenVPN to keep track of
  * client instances over various key spaces.
@@ -42,28 +41,42 @@
 #define hashsize(n) ((uint32_t)1<<(n))
 #define hashmask(n) (hashsize(n)-1)
 
+/*
+ * One slot of the table.  Slots are stored inline in the bucket
+ * array, so a pointer to an element is only valid until the table
+ * is modified again.
+ */
 struct hash_element
 {
     void *value;
-    const void *key;
-    unsigned int hash_value;
-    struct hash_element *next;
-};
-
-struct hash_bucket
-{
-    struct hash_element *list;
+    const void *key;            /* NULL for a deleted element */
+    uint32_t hash_value;
+    uint32_t dist;              /* 0 if the slot is empty, otherwise 1 +
+                                 * the distance from the home slot */
 };
 
 struct hash
 {
-    int n_buckets;
-    int n_elements;
+    int n_buckets;              /* slots in the current table */
+    int n_elements;             /* elements in both tables */
     int mask;
     uint32_t iv;
     uint32_t (*hash_function)(const void *key, uint32_t iv);
     bool (*compare_function)(const void *key1, const void *key2); /* return true if equal */
-    struct hash_bucket *buckets;
+    struct hash_element *buckets;
+
+    /* deleted elements still occupying a slot of the current table */
+    int n_deleted;
+
+    /* number of open iterators, resizing is postponed while > 0 */
+    int n_iterators;
+
+    /* after a resize, the previous table is moved over a few slots
+     * at a time by hash_add_fast() and hash_remove_fast() */
+    struct hash_element *old_buckets;
+    int old_n_buckets;
+    int old_n_elements;
+    int old_index;
 };
 
 struct hash *hash_init(const int n_buckets,
@@ -73,26 +86,36 @@ struct hash *hash_init(const int n_buckets,
 
 void hash_free(struct hash *hash);
 
+/* bytes of heap memory used by the table, not counting the values */
+size_t hash_mem_usage(const struct hash *hash);
+
 bool hash_add(struct hash *hash, const void *key, void *value, bool replace);
 
 struct hash_element *hash_lookup_fast(struct hash *hash,
-                                      struct hash_bucket *bucket,
                                       const void *key,
                                       uint32_t hv);
 
+/* NOTE: assumes that key is not a duplicate */
+void hash_add_fast(struct hash *hash,
+                   const void *key,
+                   uint32_t hv,
+                   void *value);
+
 bool hash_remove_fast(struct hash *hash,
-                      struct hash_bucket *bucket,
                       const void *key,
                       uint32_t hv);
 
 void hash_remove_by_value(struct hash *hash, void *value);
 
+/*
+ * Iterate over the elements of a hash table.  While an iterator is
+ * open, elements must only be removed with hash_iterator_delete_element()
+ * and no elements should be added.
+ */
 struct hash_iterator
 {
     struct hash *hash;
     int bucket_index;
-    struct hash_bucket *bucket;
-    struct hash_element *elem;
     struct hash_element *last;
     bool bucket_marked;
     int bucket_index_start;
@@ -114,6 +137,8 @@ void hash_iterator_free(struct hash_iterator *hi);
 
 uint32_t hash_func(const uint8_t *k, uint32_t length, uint32_t initval);
 
+uint32_t hash_func_short(const uint8_t *k, uint32_t length, uint32_t initval);
+
 #ifdef LIST_TEST
 void list_test(void);
 
@@ -137,21 +162,14 @@ hash_n_buckets(const struct hash *hash)
     return hash->n_buckets;
 }
 
-static inline struct hash_bucket *
-hash_bucket(struct hash *hash, uint32_t hv)
-{
-    return &hash->buckets[hv & hash->mask];
-}
-
 static inline void *
 hash_lookup(struct hash *hash, const void *key)
 {
     void *ret = NULL;
     struct hash_element *he;
     uint32_t hv = hash_value(hash, key);
-    struct hash_bucket *bucket = &hash->buckets[hv & hash->mask];
 
-    he = hash_lookup_fast(hash, bucket, key, hv);
+    he = hash_lookup_fast(hash, key, hv);
     if (he)
     {
         ret = he->value;
@@ -160,36 +178,10 @@ hash_lookup(struct hash *hash, const void *key)
     return ret;
 }
 
-/* NOTE: assumes that key is not a duplicate */
-static inline void
-hash_add_fast(struct hash *hash,
-              struct hash_bucket *bucket,
-              const void *key,
-              uint32_t hv,
-              void *value)
-{
-    struct hash_element *he;
-
-    ALLOC_OBJ(he, struct hash_element);
-    he->value = value;
-    he->key = key;
-    he->hash_value = hv;
-    he->next = bucket->list;
-    bucket->list = he;
-    ++hash->n_elements;
-}
-
 static inline bool
 hash_remove(struct hash *hash, const void *key)
 {
-    uint32_t hv;
-    struct hash_bucket *bucket;
-    bool ret;
-
-    hv = hash_value(hash, key);
-    bucket = &hash->buckets[hv & hash->mask];
-    ret = hash_remove_fast(hash, bucket, key, hv);
-    return ret;
+    return hash_remove_fast(hash, key, hash_value(hash, key));
 }
 
 #endif /* LIST */
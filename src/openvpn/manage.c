@@ -42,6 +42,7 @@
 #include "manage.h"
 #include "openvpn.h"
 #include "dco.h"
+#include "forward.h"
 
 #include "memdbg.h"
 
@@ -73,7 +74,8 @@ man_help(void)
     msg(M_CLIENT, "Management Interface for %s", title_string);
     msg(M_CLIENT, "Commands:");
     msg(M_CLIENT, "auth-retry t           : Auth failure retry mode (none,interact,nointeract).");
-    msg(M_CLIENT, "bytecount n            : Show bytes in/out, update every n secs (0=off).");
+    msg(M_CLIENT, "bytecount n [all]      : Show bytes in/out, update every n secs (0=off).");
+    msg(M_CLIENT, "                         In server mode only changed clients unless 'all'.");
     msg(M_CLIENT, "echo [on|off] [N|all]  : Like log, but only show messages in echo buffer.");
     msg(M_CLIENT, "cr-response response   : Send a challenge response answer via CR_RESPONSE to server");
     msg(M_CLIENT, "exit|quit              : Close management session.");
@@ -86,6 +88,8 @@ man_help(void)
     msg(M_CLIENT, "load-stats             : Show global server load stats.");
     msg(M_CLIENT, "log [on|off] [N|all]   : Turn on/off realtime log display");
     msg(M_CLIENT, "                         + show last N lines or 'all' for entire history.");
+    msg(M_CLIENT, "memstats               : Show the memory used by each subsystem.");
+    msg(M_CLIENT, "metrics                : Show process counters in OpenMetrics text format.");
     msg(M_CLIENT, "mute [n]               : Set log mute level to n, or show level if n is absent.");
     msg(M_CLIENT, "needok type action     : Enter confirmation for NEED-OK request of 'type',");
     msg(M_CLIENT, "                         where action = 'ok' or 'cancel'.");
@@ -97,6 +101,8 @@ man_help(void)
     msg(M_CLIENT, "remote-entry-count     : Get number of available remote entries.");
     msg(M_CLIENT, "remote-entry-get  i|all [j]: Get remote entry at index = i to to j-1 or all.");
     msg(M_CLIENT, "proxy type [host port flags] : Enter dynamic proxy server info.");
+    msg(M_CLIENT, "perf [on|off|reset]    : Show packet path latency histograms, or turn");
+    msg(M_CLIENT, "                         their collection on/off or clear them.");
     msg(M_CLIENT, "pid                    : Show process ID of the current OpenVPN process.");
 #ifdef ENABLE_PKCS11
     msg(M_CLIENT, "pkcs11-id-count        : Get number of available PKCS#11 identities.");
@@ -109,10 +115,16 @@ man_help(void)
     msg(M_CLIENT, "client-pending-auth CID KID MSG timeout : Instruct OpenVPN to send AUTH_PENDING and INFO_PRE msg");
     msg(M_CLIENT, "                                      to the client and wait for a final client-auth/client-deny");
     msg(M_CLIENT, "client-kill CID [M]    : Kill client instance CID with message M (def=RESTART)");
+    msg(M_CLIENT, "client-notify on|off   : Turn on/off >CLIENT notifications for this session.");
+    msg(M_CLIENT, "push-update all|cn P|vlan V O : Send the comma separated route, route-ipv6,");
+    msg(M_CLIENT, "                         dhcp-option and dns options O to all clients, those");
+    msg(M_CLIENT, "                         with common name P (P* for a prefix) or in VLAN V.");
+    msg(M_CLIENT, "push-update-status     : Show how many clients applied the last push-update.");
     msg(M_CLIENT, "env-filter [level]     : Set env-var filter level");
     msg(M_CLIENT, "rsa-sig                : Enter a signature in response to >RSA_SIGN challenge");
     msg(M_CLIENT, "                         Enter signature base64 on subsequent lines followed by END");
-    msg(M_CLIENT, "pk-sig                 : Enter a signature in response to >PK_SIGN challenge");
+    msg(M_CLIENT, "pk-sig [ID]            : Enter a signature in response to >PK_SIGN challenge");
+    msg(M_CLIENT, "                         or to the >PK_SIGN_ASYNC challenge with the given ID");
     msg(M_CLIENT, "                         Enter signature base64 on subsequent lines followed by END");
     msg(M_CLIENT, "certificate            : Enter a client certificate in response to >NEED-CERT challenge");
     msg(M_CLIENT, "                         Enter certificate base64 on subsequent lines followed by END");
@@ -121,6 +133,8 @@ man_help(void)
     msg(M_CLIENT, "state [on|off] [N|all] : Like log, but show state history.");
     msg(M_CLIENT, "status [n]             : Show current daemon status info using format #n.");
     msg(M_CLIENT, "test n                 : Produce n lines of output for testing/debugging.");
+    msg(M_CLIENT, "top [n [key]]          : Show the n clients causing the most load, sorted by");
+    msg(M_CLIENT, "                         key = cpu (default), pps, bps or handshakes.");
     msg(M_CLIENT, "username type u        : Enter username u for a queried OpenVPN username.");
     msg(M_CLIENT, "verb [n]               : Set log verbosity level to n, or show if n is absent.");
     msg(M_CLIENT, "version [n]            : Set client's version to n or show current version of daemon.");
@@ -190,7 +204,7 @@ man_welcome(struct management *man)
 static inline bool
 man_password_needed(struct management *man)
 {
-    return man->settings.up.defined && !man->connection.password_verified;
+    return man->settings.up.defined && !man->active->password_verified;
 }
 
 static void
@@ -205,36 +219,149 @@ man_check_password(struct management *man, const char *line)
         size_t compare_len = min_uint(strlen(line) + 1, sizeof(man->settings.up.password));
         if (memcmp_constant_time(line, man->settings.up.password, compare_len) == 0)
         {
-            man->connection.password_verified = true;
+            man->active->password_verified = true;
             msg(M_CLIENT, "SUCCESS: password is correct");
             man_welcome(man);
         }
         else
         {
-            man->connection.password_verified = false;
+            man->active->password_verified = false;
             msg(M_CLIENT, "ERROR: bad password");
-            if (++man->connection.password_tries >= MANAGEMENT_N_PASSWORD_RETRIES)
+            if (++man->active->password_tries >= MANAGEMENT_N_PASSWORD_RETRIES)
             {
                 msg(M_WARN, "MAN: client connection rejected after %d failed password attempts",
                     MANAGEMENT_N_PASSWORD_RETRIES);
-                man->connection.halt = true;
+                man->active->halt = true;
             }
         }
     }
 }
 
+static inline bool
+man_client_connected(const struct man_connection *mc)
+{
+    return mc->state == MS_CC_WAIT_READ || mc->state == MS_CC_WAIT_WRITE;
+}
+
+/*
+ * Return client i of --management-max-clients, the first one being the
+ * connection object, or NULL if there is no such client.
+ */
+static struct man_connection *
+man_client(struct management *man, const int i)
+{
+    if (i == 0)
+    {
+        return &man->connection;
+    }
+    else if (i <= man->n_extra)
+    {
+        return &man->extra[i - 1];
+    }
+    return NULL;
+}
+
+static struct man_connection *
+man_client_free(struct management *man)
+{
+    for (int i = 0; i < man->n_extra; ++i)
+    {
+        if (man->extra[i].state == MS_INITIAL)
+        {
+            return &man->extra[i];
+        }
+    }
+    return NULL;
+}
+
+/* notifications a client can ask for */
+#define MAN_NOTIFY_ALL       0
+#define MAN_NOTIFY_LOG       1
+#define MAN_NOTIFY_STATE     2
+#define MAN_NOTIFY_ECHO      3
+#define MAN_NOTIFY_CLIENT    4
+#define MAN_NOTIFY_BYTECOUNT 5
+
+struct man_notify
+{
+    struct man_connection *save;
+    int i;
+};
+
+static void
+man_notify_init(struct management *man, struct man_notify *mn)
+{
+    mn->save = man->active;
+    mn->i = 0;
+}
+
+/*
+ * Make the next logged in client which asked for the notifications of
+ * type the active one.  When there is none left, make the client active
+ * again that was before man_notify_init() and return false.
+ */
+static bool
+man_notify_next(struct management *man, struct man_notify *mn, const int type)
+{
+    struct man_connection *mc;
+
+    while ((mc = man_client(man, mn->i++)))
+    {
+        bool wanted = false;
+
+        if (!man_client_connected(mc)
+            || (man->settings.up.defined && !mc->password_verified))
+        {
+            continue;
+        }
+        switch (type)
+        {
+            case MAN_NOTIFY_ALL:
+                wanted = true;
+                break;
+
+            case MAN_NOTIFY_LOG:
+                wanted = mc->log_realtime;
+                break;
+
+            case MAN_NOTIFY_STATE:
+                wanted = mc->state_realtime;
+                break;
+
+            case MAN_NOTIFY_ECHO:
+                wanted = mc->echo_realtime;
+                break;
+
+            case MAN_NOTIFY_CLIENT:
+                wanted = mc->client_realtime;
+                break;
+
+            case MAN_NOTIFY_BYTECOUNT:
+                wanted = mc->bytecount_update_seconds > 0;
+                break;
+        }
+        if (wanted)
+        {
+            man->active = mc;
+            return true;
+        }
+    }
+    man->active = mn->save;
+    return false;
+}
+
 static void
 man_update_io_state(struct management *man)
 {
-    if (socket_defined(man->connection.sd_cli))
+    if (socket_defined(man->active->sd_cli))
     {
-        if (buffer_list_defined(man->connection.out))
+        if (buffer_list_defined(man->active->out))
         {
-            man->connection.state = MS_CC_WAIT_WRITE;
+            man->active->state = MS_CC_WAIT_WRITE;
         }
         else
         {
-            man->connection.state = MS_CC_WAIT_READ;
+            man->active->state = MS_CC_WAIT_READ;
         }
     }
 }
@@ -242,7 +369,7 @@ man_update_io_state(struct management *man)
 static void
 man_output_list_push_finalize(struct management *man)
 {
-    if (management_connected(man))
+    if (man_client_connected(man->active))
     {
         man_update_io_state(man);
         if (!man->persist.standalone_disabled)
@@ -256,9 +383,9 @@ man_output_list_push_finalize(struct management *man)
 static void
 man_output_list_push_str(struct management *man, const char *str)
 {
-    if (management_connected(man) && str)
+    if (man_client_connected(man->active) && str)
     {
-        buffer_list_push(man->connection.out, str);
+        buffer_list_push(man->active->out, str);
     }
 }
 
@@ -318,7 +445,6 @@ virtual_output_callback_func(void *arg, const unsigned int flags, const char *st
     static int recursive_level = 0; /* GLOBAL */
 
 #define AF_DID_PUSH  (1<<0)
-#define AF_DID_RESET (1<<1)
     if (recursive_level < 5) /* limit recursion */
     {
         struct gc_arena gc = gc_new();
@@ -344,31 +470,39 @@ virtual_output_callback_func(void *arg, const unsigned int flags, const char *st
             log_history_add(man->persist.log, &e);
         }
 
-        if (!man_password_needed(man))
+        if (flags == M_CLIENT)
         {
-            if (flags == M_CLIENT)
+            if (!man_password_needed(man))
             {
                 out = log_entry_print(&e, LOG_PRINT_CRLF, &gc);
-            }
-            else if (man->connection.log_realtime)
-            {
-                out = log_entry_print(&e, LOG_PRINT_INT_DATE
-                                      |   LOG_PRINT_MSG_FLAGS
-                                      |   LOG_PRINT_LOG_PREFIX
-                                      |   LOG_PRINT_CRLF, &gc);
-            }
-            if (out)
-            {
                 man_output_list_push_str(man, out);
                 action_flags |= AF_DID_PUSH;
             }
+        }
+        else
+        {
+            struct man_notify mn;
+
+            man_notify_init(man, &mn);
+            while (man_notify_next(man, &mn, MAN_NOTIFY_LOG))
+            {
+                if (!out)
+                {
+                    out = log_entry_print(&e, LOG_PRINT_INT_DATE
+                                          |   LOG_PRINT_MSG_FLAGS
+                                          |   LOG_PRINT_LOG_PREFIX
+                                          |   LOG_PRINT_CRLF, &gc);
+                }
+                man_output_list_push(man, out);
+            }
             if (flags & M_FATAL)
             {
                 out = log_entry_print(&e, LOG_FATAL_NOTIFY|LOG_PRINT_CRLF, &gc);
-                if (out)
+                man_notify_init(man, &mn);
+                while (man_notify_next(man, &mn, MAN_NOTIFY_ALL))
                 {
-                    man_output_list_push_str(man, out);
-                    action_flags |= (AF_DID_PUSH|AF_DID_RESET);
+                    man_output_list_push(man, out);
+                    man_reset_client_socket(man, true);
                 }
             }
         }
@@ -379,10 +513,6 @@ virtual_output_callback_func(void *arg, const unsigned int flags, const char *st
         {
             man_output_list_push_finalize(man);
         }
-        if (action_flags & AF_DID_RESET)
-        {
-            man_reset_client_socket(man, true);
-        }
 
         --recursive_level;
     }
@@ -471,19 +601,26 @@ man_status(struct management *man, const int version, struct status_output *so)
 }
 
 static void
-man_bytecount(struct management *man, const int update_seconds)
+man_bytecount(struct management *man, const int update_seconds, const char *which)
 {
+    if (which && !streq(which, "all") && !streq(which, "changed"))
+    {
+        msg(M_CLIENT, "ERROR: bytecount parameter must be 'all' or 'changed'");
+        return;
+    }
+    man->active->bytecount_all = which && streq(which, "all");
+
     if (update_seconds > 0)
     {
-        man->connection.bytecount_update_seconds = update_seconds;
-        event_timeout_init(&man->connection.bytecount_update_interval,
-                           man->connection.bytecount_update_seconds,
+        man->active->bytecount_update_seconds = update_seconds;
+        event_timeout_init(&man->active->bytecount_update_interval,
+                           man->active->bytecount_update_seconds,
                            now);
     }
     else
     {
-        man->connection.bytecount_update_seconds = 0;
-        event_timeout_clear(&man->connection.bytecount_update_interval);
+        man->active->bytecount_update_seconds = 0;
+        event_timeout_clear(&man->active->bytecount_update_interval);
     }
     msg(M_CLIENT, "SUCCESS: bytecount interval changed");
 }
@@ -507,13 +644,25 @@ man_bytecount_output_server(const counter_type *bytes_in_total,
                             const counter_type *bytes_out_total,
                             struct man_def_auth_context *mdac)
 {
+    const bool changed = *bytes_in_total != mdac->bytecount_in
+                         || *bytes_out_total != mdac->bytecount_out;
     char in[32];
     char out[32];
     /* do in a roundabout way to work around possible mingw or mingw-glibc bug */
     openvpn_snprintf(in, sizeof(in), counter_format, *bytes_in_total);
     openvpn_snprintf(out, sizeof(out), counter_format, *bytes_out_total);
-    msg(M_CLIENT, ">BYTECOUNT_CLI:%lu,%s,%s", mdac->cid, in, out);
-    mdac->bytecount_last_update = now;
+
+    struct man_notify mn;
+    man_notify_init(management, &mn);
+    while (man_notify_next(management, &mn, MAN_NOTIFY_BYTECOUNT))
+    {
+        if (changed || management->active->bytecount_all)
+        {
+            msg(M_CLIENT, ">BYTECOUNT_CLI:%lu,%s,%s", mdac->cid, in, out);
+        }
+    }
+    mdac->bytecount_in = *bytes_in_total;
+    mdac->bytecount_out = *bytes_out_total;
 }
 
 static void
@@ -650,7 +799,7 @@ man_log(struct management *man, const char *parm)
                 parm,
                 "log",
                 man->persist.log,
-                &man->connection.log_realtime,
+                &man->active->log_realtime,
                 LOG_PRINT_INT_DATE|LOG_PRINT_MSG_FLAGS);
 }
 
@@ -661,7 +810,7 @@ man_echo(struct management *man, const char *parm)
                 parm,
                 "echo",
                 man->persist.echo,
-                &man->connection.echo_realtime,
+                &man->active->echo_realtime,
                 LOG_PRINT_INT_DATE|MANAGEMENT_ECHO_FLAGS);
 }
 
@@ -672,7 +821,7 @@ man_state(struct management *man, const char *parm)
                 parm,
                 "state",
                 man->persist.state,
-                &man->connection.state_realtime,
+                &man->active->state_realtime,
                 LOG_PRINT_INT_DATE|LOG_PRINT_STATE
                 |LOG_PRINT_LOCAL_IP|LOG_PRINT_REMOTE_IP);
 }
@@ -957,23 +1106,91 @@ in_extra_reset(struct man_connection *mc, const int mode)
     }
 }
 
+static struct man_pk_sig_request *
+man_pk_sig_find(struct management *man, const unsigned int id)
+{
+    struct man_pk_sig_request *req;
+    for (req = man->connection.pk_sig_requests; req; req = req->next)
+    {
+        if (req->id == id)
+        {
+            break;
+        }
+    }
+    return req;
+}
+
+/*
+ * Store the signature collected in in_extra for request id and
+ * resume the handshake waiting for it.
+ */
+static void
+man_pk_sig_async_done(struct management *man, const unsigned int id)
+{
+    struct man_pk_sig_request *req = man_pk_sig_find(man, id);
+    if (!req || req->done)
+    {
+        msg(M_CLIENT, "ERROR: pk-sig command failed");
+        return;
+    }
+
+    buffer_list_aggregate(man->active->in_extra, 2048);
+    const struct buffer *buf = buffer_list_peek(man->active->in_extra);
+    if (buf && BLEN(buf) > 0)
+    {
+        req->sig = (char *) malloc(BLEN(buf)+1);
+        check_malloc_return(req->sig);
+        memcpy(req->sig, buf->data, BLEN(buf));
+        req->sig[BLEN(buf)] = '\0';
+    }
+    req->done = true;
+    msg(M_CLIENT, "SUCCESS: pk-sig command succeeded");
+
+    if (req->wakeup)
+    {
+        (*req->wakeup)(req->arg);
+    }
+}
+
+/*
+ * Drop all pending signature requests.  With wakeup, the handshakes
+ * waiting for them are resumed, so that they fail right away.
+ */
+static void
+man_pk_sig_requests_free(struct management *man, const bool wakeup)
+{
+    struct man_pk_sig_request *req = man->connection.pk_sig_requests;
+    man->connection.pk_sig_requests = NULL;
+    while (req)
+    {
+        struct man_pk_sig_request *next = req->next;
+        if (wakeup && !req->done && req->wakeup)
+        {
+            (*req->wakeup)(req->arg);
+        }
+        free(req->sig);
+        free(req);
+        req = next;
+    }
+}
+
 static void
 in_extra_dispatch(struct management *man)
 {
-    switch (man->connection.in_extra_cmd)
+    switch (man->active->in_extra_cmd)
     {
         case IEC_CLIENT_AUTH:
             if (man->persist.callback.client_auth)
             {
                 const bool status = (*man->persist.callback.client_auth)
                                         (man->persist.callback.arg,
-                                        man->connection.in_extra_cid,
-                                        man->connection.in_extra_kid,
+                                        man->active->in_extra_cid,
+                                        man->active->in_extra_kid,
                                         true,
                                         NULL,
                                         NULL,
-                                        man->connection.in_extra);
-                man->connection.in_extra = NULL;
+                                        man->active->in_extra);
+                man->active->in_extra = NULL;
                 if (status)
                 {
                     msg(M_CLIENT, "SUCCESS: client-auth command succeeded");
@@ -992,18 +1209,22 @@ in_extra_dispatch(struct management *man)
         case IEC_PK_SIGN:
             man->connection.ext_key_state = EKS_READY;
             buffer_list_free(man->connection.ext_key_input);
-            man->connection.ext_key_input = man->connection.in_extra;
-            man->connection.in_extra = NULL;
+            man->connection.ext_key_input = man->active->in_extra;
+            man->active->in_extra = NULL;
             return;
 
+        case IEC_PK_SIGN_ASYNC:
+            man_pk_sig_async_done(man, man->active->in_extra_kid);
+            break;
+
         case IEC_CERTIFICATE:
             man->connection.ext_cert_state = EKS_READY;
             buffer_list_free(man->connection.ext_cert_input);
-            man->connection.ext_cert_input = man->connection.in_extra;
-            man->connection.in_extra = NULL;
+            man->connection.ext_cert_input = man->active->in_extra;
+            man->active->in_extra = NULL;
             return;
     }
-    in_extra_reset(&man->connection, IER_RESET);
+    in_extra_reset(man->active, IER_RESET);
 }
 
 static bool
@@ -1080,7 +1301,7 @@ man_client_pending_auth(struct management *man, const char *cid_str,
 static void
 man_client_auth(struct management *man, const char *cid_str, const char *kid_str, const bool extra)
 {
-    struct man_connection *mc = &man->connection;
+    struct man_connection *mc = man->active;
     mc->in_extra_cid = 0;
     mc->in_extra_kid = 0;
     if (parse_cid(cid_str, &mc->in_extra_cid)
@@ -1153,6 +1374,42 @@ man_client_kill(struct management *man, const char *cid_str, const char *kill_ms
     }
 }
 
+static void
+man_push_update(struct management *man, const char **p)
+{
+    /* push-update all OPTIONS or push-update cn|vlan VALUE OPTIONS */
+    const bool all = streq(p[1], "all");
+    const char *value = all ? NULL : p[2];
+    const char *options = all ? p[2] : p[3];
+
+    if (!man->persist.callback.push_update)
+    {
+        man_command_unsupported("push-update");
+    }
+    else if (!options || p[all ? 3 : 4])
+    {
+        msg(M_CLIENT, "ERROR: push-update: use push-update all|cn P|vlan V \"OPTIONS\"");
+    }
+    else
+    {
+        (*man->persist.callback.push_update)(man->persist.callback.arg, p[1],
+                                             value, options, M_CLIENT);
+    }
+}
+
+static void
+man_push_update_status(struct management *man)
+{
+    if (!man->persist.callback.push_update_status)
+    {
+        man_command_unsupported("push-update-status");
+    }
+    else if (!(*man->persist.callback.push_update_status)(man->persist.callback.arg, M_CLIENT))
+    {
+        msg(M_CLIENT, "ERROR: push-update-status: no push-update was sent");
+    }
+}
+
 static void
 man_client_n_clients(struct management *man)
 {
@@ -1167,10 +1424,29 @@ man_client_n_clients(struct management *man)
     }
 }
 
+static void
+man_client_notify(struct management *man, const char *parm)
+{
+    if (streq(parm, "on"))
+    {
+        man->active->client_realtime = true;
+        msg(M_CLIENT, "SUCCESS: client notification set to ON");
+    }
+    else if (streq(parm, "off"))
+    {
+        man->active->client_realtime = false;
+        msg(M_CLIENT, "SUCCESS: client notification set to OFF");
+    }
+    else
+    {
+        msg(M_CLIENT, "ERROR: client-notify parameter must be 'on' or 'off'");
+    }
+}
+
 static void
 man_env_filter(struct management *man, const int level)
 {
-    man->connection.env_filter_level = level;
+    man->active->env_filter_level = level;
     msg(M_CLIENT, "SUCCESS: env_filter_level=%d", level);
 }
 
@@ -1178,10 +1454,10 @@ man_env_filter(struct management *man, const int level)
 static void
 man_pk_sig(struct management *man, const char *cmd_name)
 {
-    struct man_connection *mc = &man->connection;
-    if (mc->ext_key_state == EKS_SOLICIT)
+    struct man_connection *mc = man->active;
+    if (man->connection.ext_key_state == EKS_SOLICIT)
     {
-        mc->ext_key_state = EKS_INPUT;
+        man->connection.ext_key_state = EKS_INPUT;
         mc->in_extra_cmd = IEC_PK_SIGN;
         in_extra_reset(mc, IER_NEW);
     }
@@ -1191,13 +1467,37 @@ man_pk_sig(struct management *man, const char *cmd_name)
     }
 }
 
+static void
+man_pk_sig_async(struct management *man, const char *id_str)
+{
+    struct man_connection *mc = man->active;
+    unsigned int id;
+
+    if (!parse_uint(id_str, "ID", &id))
+    {
+        return;
+    }
+
+    const struct man_pk_sig_request *req = man_pk_sig_find(man, id);
+    if (req && !req->done)
+    {
+        mc->in_extra_cmd = IEC_PK_SIGN_ASYNC;
+        mc->in_extra_kid = id;
+        in_extra_reset(mc, IER_NEW);
+    }
+    else
+    {
+        msg(M_CLIENT, "ERROR: no pending >PK_SIGN_ASYNC request with ID %u", id);
+    }
+}
+
 static void
 man_certificate(struct management *man)
 {
-    struct man_connection *mc = &man->connection;
-    if (mc->ext_cert_state == EKS_SOLICIT)
+    struct man_connection *mc = man->active;
+    if (man->connection.ext_cert_state == EKS_SOLICIT)
     {
-        mc->ext_cert_state = EKS_INPUT;
+        man->connection.ext_cert_state = EKS_INPUT;
         mc->in_extra_cmd = IEC_CERTIFICATE;
         in_extra_reset(mc, IER_NEW);
     }
@@ -1207,21 +1507,215 @@ man_certificate(struct management *man)
     }
 }
 
+static void
+man_perf(const char *parm)
+{
+    if (!parm)
+    {
+        perf_print(M_CLIENT);
+        msg(M_CLIENT, "END");
+    }
+    else if (streq(parm, "on") || streq(parm, "off"))
+    {
+        perf_enable(streq(parm, "on"));
+        msg(M_CLIENT, "SUCCESS: perf measurement is %s", parm);
+    }
+    else if (streq(parm, "reset"))
+    {
+        perf_reset();
+        msg(M_CLIENT, "SUCCESS: perf histograms cleared");
+    }
+    else
+    {
+        msg(M_CLIENT, "ERROR: perf parameter must be 'on', 'off' or 'reset'");
+    }
+}
+
 static void
 man_load_stats(struct management *man)
 {
     extern counter_type link_read_bytes_global;
     extern counter_type link_write_bytes_global;
+    extern struct object_cache multi_instance_cache;
+    extern struct object_cache tls_multi_cache;
     int nclients = 0;
 
     if (man->persist.callback.n_clients)
     {
         nclients = (*man->persist.callback.n_clients)(man->persist.callback.arg);
     }
-    msg(M_CLIENT, "SUCCESS: nclients=%d,bytesin=" counter_format ",bytesout=" counter_format,
+    msg(M_CLIENT, "SUCCESS: nclients=%d,bytesin=" counter_format ",bytesout=" counter_format
+        ",objcached=%d,objreused=" counter_format ",drops=" counter_format,
         nclients,
         link_read_bytes_global,
+        link_write_bytes_global,
+        multi_instance_cache.n_free + tls_multi_cache.n_free,
+        multi_instance_cache.n_reused + tls_multi_cache.n_reused,
+        link_socket_drops_global);
+}
+
+static void
+man_metrics(struct management *man)
+{
+    extern counter_type link_read_bytes_global;
+    extern counter_type link_write_bytes_global;
+    extern counter_type link_read_packets_global;
+    extern counter_type link_write_packets_global;
+    const struct tls_handshake_stats *hs = &tls_handshake_stats_global;
+    counter_type cumulative = 0;
+
+    msg(M_CLIENT, "# TYPE openvpn_link_bytes counter");
+    msg(M_CLIENT, "# HELP openvpn_link_bytes Bytes read from and written to the transport.");
+    msg(M_CLIENT, "openvpn_link_bytes_total{direction=\"in\"} " counter_format,
+        link_read_bytes_global);
+    msg(M_CLIENT, "openvpn_link_bytes_total{direction=\"out\"} " counter_format,
         link_write_bytes_global);
+    msg(M_CLIENT, "# TYPE openvpn_link_packets counter");
+    msg(M_CLIENT, "# HELP openvpn_link_packets Packets read from and written to the transport.");
+    msg(M_CLIENT, "openvpn_link_packets_total{direction=\"in\"} " counter_format,
+        link_read_packets_global);
+    msg(M_CLIENT, "openvpn_link_packets_total{direction=\"out\"} " counter_format,
+        link_write_packets_global);
+    msg(M_CLIENT, "# TYPE openvpn_link_drops counter");
+    msg(M_CLIENT, "# HELP openvpn_link_drops Datagrams dropped by the kernel on receive.");
+    msg(M_CLIENT, "openvpn_link_drops_total " counter_format, link_socket_drops_global);
+
+    msg(M_CLIENT, "# TYPE openvpn_decrypt_errors counter");
+    msg(M_CLIENT, "# HELP openvpn_decrypt_errors Data channel packets dropped on receive.");
+    msg(M_CLIENT, "openvpn_decrypt_errors_total{reason=\"replay\"} " counter_format,
+        crypto_replay_errors_global);
+    msg(M_CLIENT, "openvpn_decrypt_errors_total{reason=\"auth\"} " counter_format,
+        crypto_auth_errors_global);
+    msg(M_CLIENT, "openvpn_decrypt_errors_total{reason=\"key_id\"} " counter_format,
+        tls_key_id_errors_global);
+
+    msg(M_CLIENT, "# TYPE openvpn_tls_handshakes counter");
+    msg(M_CLIENT, "# HELP openvpn_tls_handshakes Finished TLS handshakes, including renegotiations.");
+    msg(M_CLIENT, "openvpn_tls_handshakes_total{result=\"success\"} " counter_format,
+        hs->success);
+    msg(M_CLIENT, "openvpn_tls_handshakes_total{result=\"failure\"} " counter_format,
+        hs->error);
+    msg(M_CLIENT, "# TYPE openvpn_tls_handshake_seconds histogram");
+    msg(M_CLIENT, "# HELP openvpn_tls_handshake_seconds Duration of the successful TLS handshakes.");
+    for (int i = 0; i < TLS_HANDSHAKE_BUCKETS - 1; ++i)
+    {
+        cumulative += hs->bucket[i];
+        msg(M_CLIENT, "openvpn_tls_handshake_seconds_bucket{le=\"%d\"} " counter_format,
+            tls_handshake_bucket_bounds[i], cumulative);
+    }
+    cumulative += hs->bucket[TLS_HANDSHAKE_BUCKETS - 1];
+    msg(M_CLIENT, "openvpn_tls_handshake_seconds_bucket{le=\"+Inf\"} " counter_format,
+        cumulative);
+    msg(M_CLIENT, "openvpn_tls_handshake_seconds_count " counter_format, cumulative);
+    msg(M_CLIENT, "openvpn_tls_handshake_seconds_sum " counter_format, hs->seconds);
+
+    const struct connect_phase_stats *cs = &connect_phase_stats_global;
+    msg(M_CLIENT, "# TYPE openvpn_connect_phase_seconds histogram");
+    msg(M_CLIENT, "# HELP openvpn_connect_phase_seconds Time spent in each phase of the initial connect of a client.");
+    for (int p = 0; p < CONNECT_PHASE_N; ++p)
+    {
+        const char *name = connect_phase_names[p];
+        cumulative = 0;
+        for (int i = 0; i < CONNECT_PHASE_BUCKETS - 1; ++i)
+        {
+            cumulative += cs->bucket[p][i];
+            msg(M_CLIENT, "openvpn_connect_phase_seconds_bucket{phase=\"%s\",le=\"%g\"} " counter_format,
+                name, connect_phase_bucket_bounds[i] / 1000.0, cumulative);
+        }
+        cumulative += cs->bucket[p][CONNECT_PHASE_BUCKETS - 1];
+        msg(M_CLIENT, "openvpn_connect_phase_seconds_bucket{phase=\"%s\",le=\"+Inf\"} " counter_format,
+            name, cumulative);
+        msg(M_CLIENT, "openvpn_connect_phase_seconds_count{phase=\"%s\"} " counter_format,
+            name, cumulative);
+        msg(M_CLIENT, "openvpn_connect_phase_seconds_sum{phase=\"%s\"} %.3f",
+            name, cs->ms[p] / 1000.0);
+    }
+    const struct event_loop_stats *el = &event_loop_stats_global;
+    msg(M_CLIENT, "# TYPE openvpn_event_loop_busy_seconds histogram");
+    msg(M_CLIENT, "# HELP openvpn_event_loop_busy_seconds Time between two waits of the event loop, the longest time a ready event waited.");
+    cumulative = 0;
+    for (int i = 0; i < EVENT_LOOP_BUCKETS - 1; ++i)
+    {
+        cumulative += el->busy_bucket[i];
+        msg(M_CLIENT, "openvpn_event_loop_busy_seconds_bucket{le=\"%g\"} " counter_format,
+            event_loop_busy_bounds[i] / 1000000.0, cumulative);
+    }
+    cumulative += el->busy_bucket[EVENT_LOOP_BUCKETS - 1];
+    msg(M_CLIENT, "openvpn_event_loop_busy_seconds_bucket{le=\"+Inf\"} " counter_format,
+        cumulative);
+    msg(M_CLIENT, "openvpn_event_loop_busy_seconds_count " counter_format, cumulative);
+    msg(M_CLIENT, "openvpn_event_loop_busy_seconds_sum %.6f", el->busy_usec / 1000000.0);
+    msg(M_CLIENT, "# TYPE openvpn_event_loop_events histogram");
+    msg(M_CLIENT, "# HELP openvpn_event_loop_events Events returned by one wait of the event loop.");
+    cumulative = 0;
+    for (int i = 0; i < EVENT_LOOP_BUCKETS - 1; ++i)
+    {
+        cumulative += el->events_bucket[i];
+        msg(M_CLIENT, "openvpn_event_loop_events_bucket{le=\"%d\"} " counter_format,
+            event_loop_events_bounds[i], cumulative);
+    }
+    cumulative += el->events_bucket[EVENT_LOOP_BUCKETS - 1];
+    msg(M_CLIENT, "openvpn_event_loop_events_bucket{le=\"+Inf\"} " counter_format,
+        cumulative);
+    msg(M_CLIENT, "openvpn_event_loop_events_count " counter_format, cumulative);
+    msg(M_CLIENT, "openvpn_event_loop_events_sum " counter_format, el->events);
+
+    msg(M_CLIENT, "# TYPE openvpn_tls_retransmits counter");
+    msg(M_CLIENT, "# HELP openvpn_tls_retransmits Control channel packets sent again.");
+    msg(M_CLIENT, "openvpn_tls_retransmits_total " counter_format,
+        reliable_retransmits_global);
+
+    if (man->persist.callback.metrics)
+    {
+        (*man->persist.callback.metrics)(man->persist.callback.arg, M_CLIENT);
+    }
+    msg(M_CLIENT, "# EOF");
+    msg(M_CLIENT, "END");
+}
+
+static void
+man_memstats(struct management *man)
+{
+    size_t bytes;
+
+    msg(M_CLIENT, "HEADER,MEMSTATS,Subsystem,Objects,Bytes");
+    if (man->persist.callback.memstats)
+    {
+        (*man->persist.callback.memstats)(man->persist.callback.arg, M_CLIENT);
+    }
+    if (crypto_mem_in_use(&bytes))
+    {
+        msg(M_CLIENT, "MEMSTATS,crypto_library,,%zu", bytes);
+    }
+    msg(M_CLIENT, "END");
+}
+
+static void
+man_top(struct management *man, const char *n, const char *sort)
+{
+    const int count = n ? atoi(n) : 10;
+
+    if (!sort)
+    {
+        sort = "cpu";
+    }
+
+    if (!man->persist.callback.top)
+    {
+        man_command_unsupported("top");
+    }
+    else if (count <= 0)
+    {
+        msg(M_CLIENT, "ERROR: top: number of clients must be positive");
+    }
+    else if ((*man->persist.callback.top)(man->persist.callback.arg, count, sort, M_CLIENT))
+    {
+        msg(M_CLIENT, "END");
+    }
+    else
+    {
+        msg(M_CLIENT, "ERROR: top: unknown sort key '%s', use cpu, pps, bps or handshakes", sort);
+    }
 }
 
 #define MN_AT_LEAST (1<<0)
@@ -1324,7 +1818,7 @@ set_client_version(struct management *man, const char *version)
 {
     if (version)
     {
-        man->connection.client_version = atoi(version);
+        man->active->client_version = atoi(version);
     }
 }
 
@@ -1336,7 +1830,7 @@ man_dispatch_command(struct management *man, struct status_output *so, const cha
     ASSERT(p[0]);
     if (streq(p[0], "exit") || streq(p[0], "quit"))
     {
-        man->connection.halt = true;
+        man->active->halt = true;
         goto done;
     }
     else if (streq(p[0], "help"))
@@ -1393,6 +1887,22 @@ man_dispatch_command(struct management *man, struct status_output *so, const cha
     {
         man_load_stats(man);
     }
+    else if (streq(p[0], "metrics"))
+    {
+        man_metrics(man);
+    }
+    else if (streq(p[0], "memstats"))
+    {
+        man_memstats(man);
+    }
+    else if (streq(p[0], "top"))
+    {
+        man_top(man, p[1], p[1] ? p[2] : NULL);
+    }
+    else if (streq(p[0], "perf"))
+    {
+        man_perf(p[1]);
+    }
     else if (streq(p[0], "status"))
     {
         int version = 0;
@@ -1560,9 +2070,9 @@ man_dispatch_command(struct management *man, struct status_output *so, const cha
     }
     else if (streq(p[0], "bytecount"))
     {
-        if (man_need(man, p, 1, 0))
+        if (man_need(man, p, 1, MN_AT_LEAST))
         {
-            man_bytecount(man, atoi(p[1]));
+            man_bytecount(man, atoi(p[1]), p[2]);
         }
     }
     else if (streq(p[0], "client-kill"))
@@ -1572,6 +2082,24 @@ man_dispatch_command(struct management *man, struct status_output *so, const cha
             man_client_kill(man, p[1], p[2]);
         }
     }
+    else if (streq(p[0], "push-update"))
+    {
+        if (man_need(man, p, 2, MN_AT_LEAST))
+        {
+            man_push_update(man, p);
+        }
+    }
+    else if (streq(p[0], "push-update-status"))
+    {
+        man_push_update_status(man);
+    }
+    else if (streq(p[0], "client-notify"))
+    {
+        if (man_need(man, p, 1, 0))
+        {
+            man_client_notify(man, p[1]);
+        }
+    }
     else if (streq(p[0], "client-deny"))
     {
         if (man_need(man, p, 3, MN_AT_LEAST))
@@ -1604,6 +2132,10 @@ man_dispatch_command(struct management *man, struct status_output *so, const cha
     {
         man_pk_sig(man, "rsa-sig");
     }
+    else if (streq(p[0], "pk-sig") && p[1])
+    {
+        man_pk_sig_async(man, p[1]);
+    }
     else if (streq(p[0], "pk-sig"))
     {
         man_pk_sig(man, "pk-sig");
@@ -1705,14 +2237,15 @@ man_stop_ne32(struct management *man)
 static void
 man_connection_settings_reset(struct management *man)
 {
-    man->connection.state_realtime = false;
-    man->connection.log_realtime = false;
-    man->connection.echo_realtime = false;
-    man->connection.bytecount_update_seconds = 0;
-    man->connection.password_verified = false;
-    man->connection.password_tries = 0;
-    man->connection.halt = false;
-    man->connection.state = MS_CC_WAIT_WRITE;
+    man->active->state_realtime = false;
+    man->active->log_realtime = false;
+    man->active->echo_realtime = false;
+    man->active->bytecount_update_seconds = 0;
+    man->active->password_verified = false;
+    man->active->password_tries = 0;
+    man->active->halt = false;
+    man->active->client_realtime = true;
+    man->active->state = MS_CC_WAIT_WRITE;
 }
 
 static void
@@ -1720,7 +2253,7 @@ man_new_connection_post(struct management *man, const char *description)
 {
     struct gc_arena gc = gc_new();
 
-    set_nonblock(man->connection.sd_cli);
+    set_nonblock(man->active->sd_cli);
 
     man_connection_settings_reset(man);
 
@@ -1747,7 +2280,7 @@ man_new_connection_post(struct management *man, const char *description)
     {
         struct sockaddr_storage addr;
         socklen_t addrlen = sizeof(addr);
-        if (!getpeername(man->connection.sd_cli, (struct sockaddr *) &addr,
+        if (!getpeername(man->active->sd_cli, (struct sockaddr *) &addr,
                          &addrlen))
         {
             msg(D_MANAGEMENT, "MANAGEMENT: %s %s", description,
@@ -1759,7 +2292,7 @@ man_new_connection_post(struct management *man, const char *description)
         }
     }
 
-    buffer_list_reset(man->connection.out);
+    buffer_list_reset(man->active->out);
 
     if (!man_password_needed(man))
     {
@@ -1779,7 +2312,7 @@ man_verify_unix_peer_uid_gid(struct management *man, const socket_descriptor_t s
     {
         static const char err_prefix[] = "MANAGEMENT: unix domain socket client connection rejected --";
         int uid, gid;
-        if (unix_socket_get_peer_uid_gid(man->connection.sd_cli, &uid, &gid))
+        if (unix_socket_get_peer_uid_gid(sd, &uid, &gid))
         {
             if (man->settings.client_uid != -1 && man->settings.client_uid != uid)
             {
@@ -1807,9 +2340,23 @@ man_verify_unix_peer_uid_gid(struct management *man, const socket_descriptor_t s
 static void
 man_accept(struct management *man)
 {
+    struct man_connection *mc = &man->connection;
     struct link_socket_actual act;
     CLEAR(act);
 
+    /*
+     * With the first client connected, the listen socket is only
+     * watched while there is room for another one.
+     */
+    if (mc->state != MS_LISTEN)
+    {
+        mc = man_client_free(man);
+        if (!mc)
+        {
+            return;
+        }
+    }
+
     /*
      * Accept the TCP or Unix domain socket client.
      */
@@ -1817,28 +2364,33 @@ man_accept(struct management *man)
     if (man->settings.flags & MF_UNIX_SOCK)
     {
         struct sockaddr_un remote;
-        man->connection.sd_cli = socket_accept_unix(man->connection.sd_top, &remote);
-        if (!man_verify_unix_peer_uid_gid(man, man->connection.sd_cli))
+        mc->sd_cli = socket_accept_unix(man->connection.sd_top, &remote);
+        if (!man_verify_unix_peer_uid_gid(man, mc->sd_cli))
         {
-            sd_close(&man->connection.sd_cli);
+            sd_close(&mc->sd_cli);
         }
     }
     else
 #endif
-    man->connection.sd_cli = socket_do_accept(man->connection.sd_top, &act, false);
+    mc->sd_cli = socket_do_accept(man->connection.sd_top, &act, false);
 
-    if (socket_defined(man->connection.sd_cli))
+    if (socket_defined(mc->sd_cli))
     {
-        man->connection.remote = act.dest;
+        struct man_connection *save = man->active;
 
-        if (socket_defined(man->connection.sd_top))
+        mc->remote = act.dest;
+        mc->persist_state = 0;
+
+        if (mc == &man->connection && socket_defined(man->connection.sd_top))
         {
 #ifdef _WIN32
             man_stop_ne32(man);
 #endif
         }
 
+        man->active = mc;
         man_new_connection_post(man, "Client connected from");
+        man->active = save;
     }
 }
 
@@ -1990,6 +2542,25 @@ done:
 static void
 man_reset_client_socket(struct management *man, const bool exiting)
 {
+    struct man_connection *mc = man->active;
+
+    if (mc != &man->connection)
+    {
+        /* one of the further clients, its slot is simply freed */
+        if (socket_defined(mc->sd_cli))
+        {
+            man_close_socket(man, mc->sd_cli);
+            mc->sd_cli = SOCKET_UNDEFINED;
+            mc->state = MS_INITIAL;
+            command_line_reset(mc->in);
+            buffer_list_reset(mc->out);
+            in_extra_reset(mc, IER_RESET);
+            event_timeout_clear(&mc->bytecount_update_interval);
+            msg(D_MANAGEMENT, "MANAGEMENT: Client disconnected");
+        }
+        return;
+    }
+
     if (socket_defined(man->connection.sd_cli))
     {
 #ifdef _WIN32
@@ -2001,6 +2572,7 @@ man_reset_client_socket(struct management *man, const bool exiting)
         command_line_reset(man->connection.in);
         buffer_list_reset(man->connection.out);
         in_extra_reset(&man->connection, IER_RESET);
+        man_pk_sig_requests_free(man, true);
         msg(D_MANAGEMENT, "MANAGEMENT: Client disconnected");
     }
     if (!exiting)
@@ -2043,7 +2615,7 @@ man_process_command(struct management *man, const char *line)
 
     CLEAR(parms);
     so = status_open(NULL, 0, -1, &man->persist.vout, 0);
-    in_extra_reset(&man->connection, IER_RESET);
+    in_extra_reset(man->active, IER_RESET);
 
     if (man_password_needed(man))
     {
@@ -2056,7 +2628,7 @@ man_process_command(struct management *man, const char *line)
         {
             msg(D_MANAGEMENT_DEBUG, "MANAGEMENT: CMD 'password [...]'");
         }
-        else if (!streq(line, "load-stats"))
+        else if (!streq(line, "load-stats") && !streq(line, "metrics"))
         {
             msg(D_MANAGEMENT_DEBUG, "MANAGEMENT: CMD '%s'", line);
         }
@@ -2239,24 +2811,31 @@ managment_android_persisttun_action(struct management *man)
 
 #endif /* ifdef TARGET_ANDROID */
 
+/*
+ * Bytes read from or written to the management client at once.  Large
+ * enough that a client pipelining many commands, like client-auth-nt
+ * decisions after a reconnect storm, gets them handled in a few passes.
+ */
+#define MAN_IO_SIZE 4096
+
 static int
 man_read(struct management *man)
 {
     /*
      * read command line from socket
      */
-    unsigned char buf[256];
+    unsigned char buf[MAN_IO_SIZE];
     int len = 0;
 
 #ifdef TARGET_ANDROID
     int fd;
-    len = man_recv_with_fd(man->connection.sd_cli, buf, sizeof(buf), MSG_NOSIGNAL, &fd);
+    len = man_recv_with_fd(man->active->sd_cli, buf, sizeof(buf), MSG_NOSIGNAL, &fd);
     if (fd >= 0)
     {
         man->connection.lastfdreceived = fd;
     }
 #else  /* ifdef TARGET_ANDROID */
-    len = recv(man->connection.sd_cli, (void *)buf, sizeof(buf), MSG_NOSIGNAL);
+    len = recv(man->active->sd_cli, (void *)buf, sizeof(buf), MSG_NOSIGNAL);
 #endif
 
     if (len == 0)
@@ -2268,21 +2847,21 @@ man_read(struct management *man)
         bool processed_command = false;
 
         ASSERT(len <= (int) sizeof(buf));
-        command_line_add(man->connection.in, buf, len);
+        command_line_add(man->active->in, buf, len);
 
         /*
          * Reset output object
          */
-        buffer_list_reset(man->connection.out);
+        buffer_list_reset(man->active->out);
 
         /*
          * process command line if complete
          */
         {
             const char *line;
-            while ((line = command_line_get(man->connection.in)))
+            while ((line = command_line_get(man->active->in)))
             {
-                if (man->connection.in_extra)
+                if (man->active->in_extra)
                 {
                     if (!strcmp(line, "END"))
                     {
@@ -2290,18 +2869,18 @@ man_read(struct management *man)
                     }
                     else
                     {
-                        buffer_list_push(man->connection.in_extra, line);
+                        buffer_list_push(man->active->in_extra, line);
                     }
                 }
                 else
                 {
                     man_process_command(man, (char *) line);
                 }
-                if (man->connection.halt)
+                if (man->active->halt)
                 {
                     break;
                 }
-                command_line_next(man->connection.in);
+                command_line_next(man->active->in);
                 processed_command = true;
             }
         }
@@ -2309,7 +2888,7 @@ man_read(struct management *man)
         /*
          * Reset output state to MS_CC_WAIT_(READ|WRITE)
          */
-        if (man->connection.halt)
+        if (man->active->halt)
         {
             man_reset_client_socket(man, false);
             len = 0;
@@ -2336,27 +2915,27 @@ man_read(struct management *man)
 static int
 man_write(struct management *man)
 {
-    const int size_hint = 1024;
+    const int size_hint = MAN_IO_SIZE;
     int sent = 0;
     const struct buffer *buf;
 
-    buffer_list_aggregate(man->connection.out, size_hint);
-    buf = buffer_list_peek(man->connection.out);
+    buffer_list_aggregate(man->active->out, size_hint);
+    buf = buffer_list_peek(man->active->out);
     if (buf && BLEN(buf))
     {
         const int len = min_int(size_hint, BLEN(buf));
 #ifdef TARGET_ANDROID
         if (man->connection.fdtosend > 0)
         {
-            sent = man_send_with_fd(man->connection.sd_cli, BPTR(buf), len, MSG_NOSIGNAL, man->connection.fdtosend);
+            sent = man_send_with_fd(man->active->sd_cli, BPTR(buf), len, MSG_NOSIGNAL, man->connection.fdtosend);
             man->connection.fdtosend = -1;
         }
         else
 #endif
-        sent = send(man->connection.sd_cli, (const void *)BPTR(buf), len, MSG_NOSIGNAL);
+        sent = send(man->active->sd_cli, (const void *)BPTR(buf), len, MSG_NOSIGNAL);
         if (sent >= 0)
         {
-            buffer_list_advance(man->connection.out, sent);
+            buffer_list_advance(man->active->out, sent);
         }
         else if (sent < 0)
         {
@@ -2458,6 +3037,7 @@ man_settings_init(struct man_settings *ms,
                   const int log_history_cache,
                   const int echo_buffer_size,
                   const int state_buffer_size,
+                  const int max_clients,
                   const int remap_sigusr1,
                   const unsigned int flags)
 {
@@ -2536,6 +3116,7 @@ man_settings_init(struct man_settings *ms,
         ms->log_history_cache = log_history_cache;
         ms->echo_buffer_size = echo_buffer_size;
         ms->state_buffer_size = state_buffer_size;
+        ms->max_clients = max_clients;
 
         /*
          * Set remap sigusr1 flags
@@ -2581,15 +3162,33 @@ man_connection_init(struct management *man)
          * Allocate helper objects for command line input and
          * command output from/to the socket.
          */
-        man->connection.in = command_line_new(1024);
+        man->connection.in = command_line_new(2 * MAN_IO_SIZE);
         man->connection.out = buffer_list_new();
 
+        /*
+         * The further clients of --management-max-clients.
+         */
+        man->n_extra = max_int(man->settings.max_clients, 1) - 1;
+        if (man->n_extra)
+        {
+            ALLOC_ARRAY_CLEAR(man->extra, struct man_connection, man->n_extra);
+            for (int i = 0; i < man->n_extra; ++i)
+            {
+                struct man_connection *mc = &man->extra[i];
+                man_connection_clear(mc);
+                mc->in = command_line_new(2 * MAN_IO_SIZE);
+                mc->out = buffer_list_new();
+                mc->client_version = 1;
+            }
+        }
+
         /*
          * Initialize event set for standalone usage, when we are
-         * running outside of the primary event loop.
+         * running outside of the primary event loop.  It also finds
+         * the ready sockets when there are several clients.
          */
         {
-            int maxevents = 1;
+            int maxevents = man->n_extra ? man->n_extra + 2 : 1;
             man->connection.es = event_set_init(&maxevents, EVENT_METHOD_FAST);
         }
 
@@ -2614,6 +3213,23 @@ man_connection_close(struct management *man)
 {
     struct man_connection *mc = &man->connection;
 
+    for (int i = 0; i < man->n_extra; ++i)
+    {
+        struct man_connection *x = &man->extra[i];
+        if (socket_defined(x->sd_cli))
+        {
+            man_close_socket(man, x->sd_cli);
+        }
+        command_line_free(x->in);
+        buffer_list_free(x->out);
+        event_timeout_clear(&x->bytecount_update_interval);
+        in_extra_reset(x, IER_RESET);
+    }
+    free(man->extra);
+    man->extra = NULL;
+    man->n_extra = 0;
+    man->active = mc;
+
     event_free(mc->es);
 #ifdef _WIN32
     net_event_win32_close(&mc->ne32);
@@ -2633,8 +3249,9 @@ man_connection_close(struct management *man)
 
     event_timeout_clear(&mc->bytecount_update_interval);
 
-    in_extra_reset(&man->connection, IER_RESET);
+    in_extra_reset(mc, IER_RESET);
     buffer_list_free(mc->ext_key_input);
+    man_pk_sig_requests_free(man, false);
     man_connection_clear(mc);
 }
 
@@ -2650,6 +3267,7 @@ management_init(void)
                      MANAGEMENT_STATE_BUFFER_SIZE);
 
     man_connection_clear(&man->connection);
+    man->active = &man->connection;
 
     return man;
 }
@@ -2664,6 +3282,7 @@ management_open(struct management *man,
                 const int log_history_cache,
                 const int echo_buffer_size,
                 const int state_buffer_size,
+                const int max_clients,
                 const int remap_sigusr1,
                 const unsigned int flags)
 {
@@ -2682,6 +3301,7 @@ management_open(struct management *man,
                       log_history_cache,
                       echo_buffer_size,
                       state_buffer_size,
+                      max_clients,
                       remap_sigusr1,
                       flags);
 
@@ -2775,19 +3395,20 @@ management_set_state(struct management *man,
 
         log_history_add(man->persist.state, &e);
 
-        if (man->connection.state_realtime)
-        {
-            out = log_entry_print(&e, LOG_PRINT_STATE_PREFIX
-                                  |   LOG_PRINT_INT_DATE
-                                  |   LOG_PRINT_STATE
-                                  |   LOG_PRINT_LOCAL_IP
-                                  |   LOG_PRINT_REMOTE_IP
-                                  |   LOG_PRINT_CRLF
-                                  |   LOG_ECHO_TO_LOG, &gc);
-        }
-
-        if (out)
+        struct man_notify mn;
+        man_notify_init(man, &mn);
+        while (man_notify_next(man, &mn, MAN_NOTIFY_STATE))
         {
+            if (!out)
+            {
+                out = log_entry_print(&e, LOG_PRINT_STATE_PREFIX
+                                      |   LOG_PRINT_INT_DATE
+                                      |   LOG_PRINT_STATE
+                                      |   LOG_PRINT_LOCAL_IP
+                                      |   LOG_PRINT_REMOTE_IP
+                                      |   LOG_PRINT_CRLF
+                                      |   LOG_ECHO_TO_LOG, &gc);
+            }
             man_output_list_push(man, out);
         }
 
@@ -2873,7 +3494,7 @@ man_output_extra_env(struct management *man, const char *prefix)
         const int nclients = (*man->persist.callback.n_clients)(man->persist.callback.arg);
         setenv_int(es, "n_clients", nclients);
     }
-    man_output_env(es, false, man->connection.env_filter_level, prefix);
+    man_output_env(es, false, man->active->env_filter_level, prefix);
     gc_free(&gc);
 }
 
@@ -2935,17 +3556,23 @@ management_notify_client_needing_auth(struct management *management,
     if (!(mdac->flags & DAF_CONNECTION_CLOSED))
     {
         const char *mode = "CONNECT";
+        struct man_notify mn;
+
         if (mdac->flags & DAF_CONNECTION_ESTABLISHED)
         {
             mode = "REAUTH";
         }
-        msg(M_CLIENT, ">CLIENT:%s,%lu,%u", mode, mdac->cid, mda_key_id);
-        man_output_extra_env(management, "CLIENT");
-        if (management->connection.env_filter_level>0)
+        man_notify_init(management, &mn);
+        while (man_notify_next(management, &mn, MAN_NOTIFY_CLIENT))
         {
-            man_output_peer_info_env(management, mdac);
+            msg(M_CLIENT, ">CLIENT:%s,%lu,%u", mode, mdac->cid, mda_key_id);
+            man_output_extra_env(management, "CLIENT");
+            if (management->active->env_filter_level>0)
+            {
+                man_output_peer_info_env(management, mdac);
+            }
+            man_output_env(es, true, management->active->env_filter_level, "CLIENT");
         }
-        man_output_env(es, true, management->connection.env_filter_level, "CLIENT");
         mdac->flags |= DAF_INITIAL_AUTH;
     }
 }
@@ -2959,16 +3586,21 @@ management_notify_client_cr_response(unsigned mda_key_id,
     struct gc_arena gc;
     if (management)
     {
+        struct man_notify mn;
         gc = gc_new();
 
-        msg(M_CLIENT, ">CLIENT:CR_RESPONSE,%lu,%u,%s",
-            mdac->cid, mda_key_id, response);
-        man_output_extra_env(management, "CLIENT");
-        if (management->connection.env_filter_level > 0)
+        man_notify_init(management, &mn);
+        while (man_notify_next(management, &mn, MAN_NOTIFY_CLIENT))
         {
-            man_output_peer_info_env(management, mdac);
+            msg(M_CLIENT, ">CLIENT:CR_RESPONSE,%lu,%u,%s",
+                mdac->cid, mda_key_id, response);
+            man_output_extra_env(management, "CLIENT");
+            if (management->active->env_filter_level > 0)
+            {
+                man_output_peer_info_env(management, mdac);
+            }
+            man_output_env(es, true, management->active->env_filter_level, "CLIENT");
         }
-        man_output_env(es, true, management->connection.env_filter_level, "CLIENT");
         gc_free(&gc);
     }
 }
@@ -2978,10 +3610,16 @@ management_connection_established(struct management *management,
                                   struct man_def_auth_context *mdac,
                                   const struct env_set *es)
 {
+    struct man_notify mn;
+
     mdac->flags |= DAF_CONNECTION_ESTABLISHED;
-    msg(M_CLIENT, ">CLIENT:ESTABLISHED,%lu", mdac->cid);
-    man_output_extra_env(management, "CLIENT");
-    man_output_env(es, true, management->connection.env_filter_level, "CLIENT");
+    man_notify_init(management, &mn);
+    while (man_notify_next(management, &mn, MAN_NOTIFY_CLIENT))
+    {
+        msg(M_CLIENT, ">CLIENT:ESTABLISHED,%lu", mdac->cid);
+        man_output_extra_env(management, "CLIENT");
+        man_output_env(es, true, management->active->env_filter_level, "CLIENT");
+    }
 }
 
 void
@@ -2991,8 +3629,14 @@ management_notify_client_close(struct management *management,
 {
     if ((mdac->flags & DAF_INITIAL_AUTH) && !(mdac->flags & DAF_CONNECTION_CLOSED))
     {
-        msg(M_CLIENT, ">CLIENT:DISCONNECT,%lu", mdac->cid);
-        man_output_env(es, true, management->connection.env_filter_level, "CLIENT");
+        struct man_notify mn;
+
+        man_notify_init(management, &mn);
+        while (man_notify_next(management, &mn, MAN_NOTIFY_CLIENT))
+        {
+            msg(M_CLIENT, ">CLIENT:DISCONNECT,%lu", mdac->cid);
+            man_output_env(es, true, management->active->env_filter_level, "CLIENT");
+        }
         mdac->flags |= DAF_CONNECTION_CLOSED;
     }
 }
@@ -3006,10 +3650,15 @@ management_learn_addr(struct management *management,
     struct gc_arena gc = gc_new();
     if ((mdac->flags & DAF_INITIAL_AUTH) && !(mdac->flags & DAF_CONNECTION_CLOSED))
     {
-        msg(M_CLIENT, ">CLIENT:ADDRESS,%lu,%s,%d",
-            mdac->cid,
-            mroute_addr_print_ex(addr, MAPF_SUBNET, &gc),
-            BOOL_CAST(primary));
+        const char *a = mroute_addr_print_ex(addr, MAPF_SUBNET, &gc);
+        struct man_notify mn;
+
+        man_notify_init(management, &mn);
+        while (man_notify_next(management, &mn, MAN_NOTIFY_CLIENT))
+        {
+            msg(M_CLIENT, ">CLIENT:ADDRESS,%lu,%s,%d",
+                mdac->cid, a, BOOL_CAST(primary));
+        }
     }
     gc_free(&gc);
 }
@@ -3031,13 +3680,14 @@ management_echo(struct management *man, const char *string, const bool pull)
 
         log_history_add(man->persist.echo, &e);
 
-        if (man->connection.echo_realtime)
-        {
-            out = log_entry_print(&e, LOG_PRINT_INT_DATE|LOG_PRINT_ECHO_PREFIX|LOG_PRINT_CRLF|MANAGEMENT_ECHO_FLAGS, &gc);
-        }
-
-        if (out)
+        struct man_notify mn;
+        man_notify_init(man, &mn);
+        while (man_notify_next(man, &mn, MAN_NOTIFY_ECHO))
         {
+            if (!out)
+            {
+                out = log_entry_print(&e, LOG_PRINT_INT_DATE|LOG_PRINT_ECHO_PREFIX|LOG_PRINT_CRLF|MANAGEMENT_ECHO_FLAGS, &gc);
+            }
             man_output_list_push(man, out);
         }
 
@@ -3201,12 +3851,129 @@ management_io(struct management *man)
 
 #else  /* ifdef _WIN32 */
 
+/*
+ * Add the sockets of the further clients to es, and the listen socket
+ * while the first client is connected and there is room for another.
+ */
+static void
+man_socket_set_extra(struct management *man,
+                     struct event_set *es,
+                     void *arg,
+                     unsigned int *persistent)
+{
+    if (man->connection.state == MS_LISTEN)
+    {
+        man->persist_listen = 0;
+    }
+    else if (socket_defined(man->connection.sd_top))
+    {
+        const bool room = man_client_free(man) != NULL;
+        if (persistent)
+        {
+            if (man_persist_state(&man->persist_listen, room ? 1 : 2))
+            {
+                event_ctl(es, man->connection.sd_top, room ? EVENT_READ : 0, arg);
+            }
+        }
+        else if (room)
+        {
+            event_ctl(es, man->connection.sd_top, EVENT_READ, arg);
+        }
+    }
+
+    for (int i = 0; i < man->n_extra; ++i)
+    {
+        struct man_connection *mc = &man->extra[i];
+        unsigned int *p = persistent ? &mc->persist_state : NULL;
+
+        switch (mc->state)
+        {
+            case MS_CC_WAIT_READ:
+                if (man_persist_state(p, 2))
+                {
+                    event_ctl(es, mc->sd_cli, EVENT_READ, arg);
+                }
+                break;
+
+            case MS_CC_WAIT_WRITE:
+                if (man_persist_state(p, 3))
+                {
+                    event_ctl(es, mc->sd_cli, EVENT_WRITE, arg);
+                }
+                break;
+        }
+    }
+}
+
+/*
+ * An event set does not tell which of the management sockets is ready,
+ * so with several clients poll them all without waiting and serve the
+ * ready ones, each client becoming the active one for its I/O.
+ */
+static void
+man_io_extra(struct management *man)
+{
+    struct event_set_return esr[MANAGEMENT_MAX_CLIENTS + 1];
+    struct event_set *es = man->connection.es;
+    struct man_connection *save = man->active;
+    struct timeval tv;
+    int n;
+
+    event_reset(es);
+    for (int i = 0; man_client(man, i); ++i)
+    {
+        struct man_connection *mc = man_client(man, i);
+        if (mc->state == MS_CC_WAIT_READ)
+        {
+            event_ctl(es, mc->sd_cli, EVENT_READ, mc);
+        }
+        else if (mc->state == MS_CC_WAIT_WRITE)
+        {
+            event_ctl(es, mc->sd_cli, EVENT_WRITE, mc);
+        }
+    }
+    if (socket_defined(man->connection.sd_top)
+        && (man->connection.state == MS_LISTEN || man_client_free(man)))
+    {
+        event_ctl(es, man->connection.sd_top, EVENT_READ, man);
+    }
+
+    tv.tv_sec = 0;
+    tv.tv_usec = 0;
+    n = event_wait(es, &tv, esr, SIZE(esr));
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (esr[i].arg == man)
+        {
+            man_accept(man);
+            continue;
+        }
+
+        man->active = (struct man_connection *) esr[i].arg;
+        if (man->active->state == MS_CC_WAIT_READ)
+        {
+            man_read(man);
+        }
+        else if (man->active->state == MS_CC_WAIT_WRITE)
+        {
+            man_write(man);
+        }
+        man->active = save;
+    }
+}
+
 void
 management_socket_set(struct management *man,
                       struct event_set *es,
                       void *arg,
                       unsigned int *persistent)
 {
+    if (man->n_extra)
+    {
+        man_socket_set_extra(man, es, arg, persistent);
+    }
+
     switch (man->connection.state)
     {
         case MS_LISTEN:
@@ -3241,6 +4008,12 @@ management_socket_set(struct management *man,
 void
 management_io(struct management *man)
 {
+    if (man->n_extra)
+    {
+        man_io_extra(man);
+        return;
+    }
+
     switch (man->connection.state)
     {
         case MS_LISTEN:
@@ -3352,10 +4125,17 @@ man_output_standalone(struct management *man, volatile int *signal_received)
 {
     if (man_standalone_ok(man))
     {
-        while (man->connection.state == MS_CC_WAIT_WRITE)
+        while (man->active->state == MS_CC_WAIT_WRITE)
         {
-            management_io(man);
-            if (man->connection.state == MS_CC_WAIT_WRITE)
+            if (man->n_extra)
+            {
+                man_write(man);
+            }
+            else
+            {
+                management_io(man);
+            }
+            if (man->active->state == MS_CC_WAIT_WRITE)
             {
                 man_block(man, signal_received, 0);
             }
@@ -3771,6 +4551,77 @@ management_query_pk_sig(struct management *man, const char *b64_data,
     return ret;
 }
 
+bool
+management_pk_sig_async_enabled(const struct management *man)
+{
+    return man->connection.client_version >= 6
+           && (man->persist.callback.flags & MCF_SERVER)
+           && management_connected(man);
+}
+
+unsigned int
+management_query_pk_sig_async(struct management *man, const char *b64_data,
+                              const char *algorithm, int (*wakeup)(void *arg),
+                              void *arg)
+{
+    struct man_pk_sig_request *req;
+    ALLOC_OBJ_CLEAR(req, struct man_pk_sig_request);
+    req->id = ++man->connection.pk_sig_next_id;
+    req->wakeup = wakeup;
+    req->arg = arg;
+    req->next = man->connection.pk_sig_requests;
+    man->connection.pk_sig_requests = req;
+
+    msg(M_CLIENT, ">PK_SIGN_ASYNC:%u,%s,%s", req->id, b64_data, algorithm);
+    return req->id;
+}
+
+bool
+management_pk_sig_async_result(struct management *man, unsigned int id,
+                               char **sig)
+{
+    struct man_pk_sig_request **pp = &man->connection.pk_sig_requests;
+    while (*pp && (*pp)->id != id)
+    {
+        pp = &(*pp)->next;
+    }
+
+    struct man_pk_sig_request *req = *pp;
+    *sig = NULL;
+    if (req)
+    {
+        if (!req->done)
+        {
+            return false;
+        }
+        *sig = req->sig;
+        *pp = req->next;
+        free(req);
+    }
+    /* requests dropped on disconnect or cancel count as failed */
+    return true;
+}
+
+void
+management_pk_sig_async_cancel(struct management *man, const void *arg)
+{
+    struct man_pk_sig_request **pp = &man->connection.pk_sig_requests;
+    while (*pp)
+    {
+        struct man_pk_sig_request *req = *pp;
+        if (req->arg == arg)
+        {
+            *pp = req->next;
+            free(req->sig);
+            free(req);
+        }
+        else
+        {
+            pp = &req->next;
+        }
+    }
+}
+
 char *
 management_query_cert(struct management *man, const char *cert_name)
 {
@@ -3868,7 +4719,6 @@ command_line_new(const int buf_len)
     struct command_line *cl;
     ALLOC_OBJ_CLEAR(cl, struct command_line);
     cl->buf = alloc_buf(buf_len);
-    cl->residual = alloc_buf(buf_len);
     return cl;
 }
 
@@ -3876,7 +4726,7 @@ void
 command_line_reset(struct command_line *cl)
 {
     buf_clear(&cl->buf);
-    buf_clear(&cl->residual);
+    cl->line_len = 0;
 }
 
 void
@@ -3888,7 +4738,6 @@ command_line_free(struct command_line *cl)
     }
     command_line_reset(cl);
     free_buf(&cl->buf);
-    free_buf(&cl->residual);
     free(cl);
 }
 
@@ -3896,6 +4745,15 @@ void
 command_line_add(struct command_line *cl, const unsigned char *buf, const int len)
 {
     int i;
+
+    /* move the unprocessed input to the front, so that the lines already
+     * handled do not take up space */
+    if (cl->buf.offset)
+    {
+        memmove(cl->buf.data, BPTR(&cl->buf), BLEN(&cl->buf));
+        cl->buf.offset = 0;
+    }
+
     for (i = 0; i < len; ++i)
     {
         if (buf[i] && char_class(buf[i], (CC_PRINT|CC_NEWLINE)))
@@ -3908,6 +4766,10 @@ command_line_add(struct command_line *cl, const unsigned char *buf, const int le
     }
 }
 
+/*
+ * Return the next complete line, which is terminated in place so that
+ * a burst of lines is not copied around once per line.
+ */
 const char *
 command_line_get(struct command_line *cl)
 {
@@ -3917,9 +4779,13 @@ command_line_get(struct command_line *cl)
     i = buf_substring_len(&cl->buf, '\n');
     if (i >= 0)
     {
-        buf_copy_excess(&cl->residual, &cl->buf, i);
-        buf_chomp(&cl->buf);
-        ret = BSTR(&cl->buf);
+        char *line = (char *) BPTR(&cl->buf);
+        cl->line_len = i;
+        while (i > 0 && char_class(line[i - 1], CC_CRLF|CC_NULL))
+        {
+            line[--i] = '\0';
+        }
+        ret = line;
     }
     return ret;
 }
@@ -3927,9 +4793,8 @@ command_line_get(struct command_line *cl)
 void
 command_line_next(struct command_line *cl)
 {
-    buf_clear(&cl->buf);
-    buf_copy(&cl->buf, &cl->residual);
-    buf_clear(&cl->residual);
+    buf_advance(&cl->buf, cl->line_len);
+    cl->line_len = 0;
 }
 
 /*
@@ -4138,23 +5003,50 @@ management_sleep(const int n)
 void
 management_check_bytecount(struct context *c, struct management *man, struct timeval *timeval)
 {
-    if (event_timeout_trigger(&man->connection.bytecount_update_interval,
-                              timeval, ETT_DEFAULT))
-    {
-        counter_type dco_read_bytes = 0;
-        counter_type dco_write_bytes = 0;
+    struct man_notify mn;
+    bool dco_stats = false;
 
-        if (dco_enabled(&c->options) && (dco_get_peer_stats(c) == 0))
+    man_notify_init(man, &mn);
+    while (man_notify_next(man, &mn, MAN_NOTIFY_BYTECOUNT))
+    {
+        /* in server mode this runs for every client instance, but
+         * nothing is reported from here, so do not ask the kernel
+         * for the counters of each DCO peer */
+        if (event_timeout_trigger(&man->active->bytecount_update_interval,
+                                  timeval, ETT_DEFAULT)
+            && !(man->persist.callback.flags & MCF_SERVER))
         {
-            dco_read_bytes = c->c2.dco_read_bytes;
-            dco_write_bytes = c->c2.dco_write_bytes;
+            counter_type dco_read_bytes = 0;
+            counter_type dco_write_bytes = 0;
+
+            if (dco_enabled(&c->options)
+                && (dco_stats || dco_get_peer_stats(c) == 0))
+            {
+                dco_stats = true;
+                dco_read_bytes = c->c2.dco_read_bytes;
+                dco_write_bytes = c->c2.dco_write_bytes;
+            }
+
+            man_bytecount_output_client(man, dco_read_bytes, dco_write_bytes);
         }
+    }
+}
+
+int
+management_bytecount_seconds(struct management *man)
+{
+    struct man_notify mn;
+    int seconds = 0;
 
-        if (!(man->persist.callback.flags & MCF_SERVER))
+    man_notify_init(man, &mn);
+    while (man_notify_next(man, &mn, MAN_NOTIFY_BYTECOUNT))
+    {
+        if (!seconds || man->active->bytecount_update_seconds < seconds)
         {
-            man_bytecount_output_client(man, dco_read_bytes, dco_write_bytes);
+            seconds = man->active->bytecount_update_seconds;
         }
     }
+    return seconds;
 }
 
 /* DCO resets stats on reconnect. Since client expects stats
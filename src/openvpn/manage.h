@@ -52,11 +52,12 @@
 #include "socket.h"
 #include "mroute.h"
 
-#define MANAGEMENT_VERSION                      5
+#define MANAGEMENT_VERSION                      6
 #define MANAGEMENT_N_PASSWORD_RETRIES           3
 #define MANAGEMENT_LOG_HISTORY_INITIAL_SIZE   100
 #define MANAGEMENT_ECHO_BUFFER_SIZE           100
 #define MANAGEMENT_STATE_BUFFER_SIZE          100
+#define MANAGEMENT_MAX_CLIENTS                 16
 
 /*
  * Management-interface-based deferred authentication
@@ -71,7 +72,9 @@ struct man_def_auth_context {
 
     unsigned int mda_key_id_counter;
 
-    time_t bytecount_last_update;
+    /* counters of the last >BYTECOUNT_CLI notification */
+    counter_type bytecount_in;
+    counter_type bytecount_out;
 };
 
 /*
@@ -80,7 +83,7 @@ struct man_def_auth_context {
 struct command_line
 {
     struct buffer buf;
-    struct buffer residual;
+    int line_len; /* length of the line returned by command_line_get() */
 };
 
 struct command_line *command_line_new(const int buf_len);
@@ -183,6 +186,9 @@ struct management_callback
     int (*kill_by_addr) (void *arg, const in_addr_t addr, const int port);
     void (*delete_event) (void *arg, event_t event);
     int (*n_clients) (void *arg);
+    void (*metrics) (void *arg, const int msglevel);
+    bool (*top) (void *arg, const int n, const char *sort, const int msglevel);
+    void (*memstats) (void *arg, const int msglevel);
     bool (*send_cc_message) (void *arg, const char *message, const char *parameter);
     bool (*kill_by_cid)(void *arg, const unsigned long cid, const char *kill_msg);
     bool (*client_auth) (void *arg,
@@ -198,6 +204,9 @@ struct management_callback
                                  const char *extra,
                                  unsigned int timeout);
     char *(*get_peer_info) (void *arg, const unsigned long cid);
+    bool (*push_update) (void *arg, const char *type, const char *value,
+                         const char *options, const int msglevel);
+    bool (*push_update_status) (void *arg, const int msglevel);
     bool (*proxy_cmd)(void *arg, const char **p);
     bool (*remote_cmd) (void *arg, const char **p);
 #ifdef TARGET_ANDROID
@@ -207,6 +216,21 @@ struct management_callback
     bool (*remote_entry_get)(void *arg, unsigned int index, char **remote);
 };
 
+/*
+ * A signature requested with >PK_SIGN_ASYNC.  The handshake needing it
+ * is suspended until the management client answers with pk-sig ID, and
+ * wakeup(arg) is called then to resume it.
+ */
+struct man_pk_sig_request
+{
+    unsigned int id;
+    bool done;
+    char *sig;                  /* base64 signature, NULL on failure */
+    int (*wakeup)(void *arg);
+    void *arg;
+    struct man_pk_sig_request *next;
+};
+
 /*
  * Management object, split into three components:
  *
@@ -255,6 +279,7 @@ struct man_settings {
     int state_buffer_size;
     int client_uid;
     int client_gid;
+    int max_clients;
 
 /* flags for handling the management interface "signal" command */
 #define MANSIG_IGNORE_USR1_HUP  (1<<0)
@@ -300,6 +325,7 @@ struct man_connection {
 #define IEC_RSA_SIGN    3
 #define IEC_CERTIFICATE 4
 #define IEC_PK_SIGN     5
+#define IEC_PK_SIGN_ASYNC 6
     int in_extra_cmd;
     struct buffer_list *in_extra;
     unsigned long in_extra_cid;
@@ -312,13 +338,17 @@ struct man_connection {
     struct buffer_list *ext_key_input;
     int ext_cert_state;
     struct buffer_list *ext_cert_input;
+    struct man_pk_sig_request *pk_sig_requests;
+    unsigned int pk_sig_next_id;
     struct event_set *es;
     int env_filter_level;
 
     bool state_realtime;
     bool log_realtime;
     bool echo_realtime;
+    bool client_realtime;
     int bytecount_update_seconds;
+    bool bytecount_all; /* also >BYTECOUNT_CLI for unchanged counters */
     struct event_timeout bytecount_update_interval;
 
     const char *up_query_type;
@@ -330,13 +360,33 @@ struct man_connection {
     int lastfdreceived;
 #endif
     int client_version;
+
+    /* state last registered for sd_cli in a persistent event set */
+    unsigned int persist_state;
 };
 
+/*
+ * With --management-max-clients n, the first client connected (the
+ * connection object itself) is joined by up to n - 1 further clients
+ * in extra.  Queries for passwords, hold release, signatures etc. and
+ * their state belong to the first client, the other fields of struct
+ * man_connection exist for each client.  Command replies go to the
+ * active client, the one whose command is being run, and notifications
+ * go to the clients which asked for them.
+ */
 struct management
 {
     struct man_persist persist;
     struct man_settings settings;
     struct man_connection connection;
+
+    struct man_connection *extra;
+    int n_extra;
+    struct man_connection *active;
+
+    /* state last registered for sd_top in a persistent event set
+     * while the first client is connected */
+    unsigned int persist_listen;
 };
 
 extern struct management *management;
@@ -354,6 +404,7 @@ bool management_open(struct management *man,
                      const int log_history_cache,
                      const int echo_buffer_size,
                      const int state_buffer_size,
+                     const int max_clients,
                      const int remap_sigusr1,
                      const unsigned int flags);
 
@@ -432,6 +483,39 @@ char *management_query_pk_sig(struct management *man, const char *b64_data,
 
 char *management_query_cert(struct management *man, const char *cert_name);
 
+/**
+ * Return true if signatures can be requested without blocking, that is
+ * if the management client announced version 6 or higher and OpenVPN
+ * is able to resume the handshake waiting for the reply.
+ */
+bool management_pk_sig_async_enabled(const struct management *man);
+
+/**
+ * Send a >PK_SIGN_ASYNC request and return its ID.  wakeup(arg) is
+ * called when the reply arrives or the request fails.
+ */
+unsigned int management_query_pk_sig_async(struct management *man,
+                                           const char *b64_data,
+                                           const char *algorithm,
+                                           int (*wakeup)(void *arg),
+                                           void *arg);
+
+/**
+ * Check for the reply to an asynchronous signature request.
+ *
+ * @return false while the request is pending.  Otherwise true, and
+ *         \c *sig is set to the allocated base64 signature or to NULL
+ *         if the request failed.
+ */
+bool management_pk_sig_async_result(struct management *man, unsigned int id,
+                                    char **sig);
+
+/**
+ * Drop all pending signature requests made with the wakeup argument
+ * arg, e.g. because the handshake waiting for them is torn down.
+ */
+void management_pk_sig_async_cancel(struct management *man, const void *arg);
+
 static inline bool
 management_connected(const struct management *man)
 {
@@ -533,25 +617,18 @@ management_bytes_client(struct management *man,
     }
 }
 
+/**
+ * Return the shortest bytecount interval of the management clients,
+ * or 0 if none of them asked for bytecount notifications.
+ */
+int
+management_bytecount_seconds(struct management *man);
+
 void
 man_bytecount_output_server(const counter_type *bytes_in_total,
                             const counter_type *bytes_out_total,
                             struct man_def_auth_context *mdac);
 
-static inline void
-management_bytes_server(struct management *man,
-                        const counter_type *bytes_in_total,
-                        const counter_type *bytes_out_total,
-                        struct man_def_auth_context *mdac)
-{
-    if (man->connection.bytecount_update_seconds > 0
-        && now >= mdac->bytecount_last_update + man->connection.bytecount_update_seconds
-        && (mdac->flags & (DAF_CONNECTION_ESTABLISHED | DAF_CONNECTION_CLOSED)) == DAF_CONNECTION_ESTABLISHED)
-    {
-        man_bytecount_output_server(bytes_in_total, bytes_out_total, mdac);
-    }
-}
-
 void
 man_persist_client_stats(struct management *man, struct context *c);
 
@@ -32,6 +32,7 @@
 #include "integer.h"
 #include "misc.h"
 #include "mbuf.h"
+#include "probe.h"
 
 #include "memdbg.h"
 
@@ -42,6 +43,18 @@ mbuf_init(unsigned int size)
     ALLOC_OBJ_CLEAR(ret, struct mbuf_set);
     ret->capacity = adjust_power_of_2(size);
     ALLOC_ARRAY(ret->array, struct mbuf_item, ret->capacity);
+    ALLOC_ARRAY(ret->next, unsigned int, ret->capacity);
+    ALLOC_ARRAY(ret->flows, struct mbuf_flow, ret->capacity);
+    for (unsigned int i = 0; i < ret->capacity; ++i)
+    {
+        ret->next[i] = i + 1 < ret->capacity ? i + 1 : MBUF_NONE;
+        ret->flows[i].next = i + 1 < ret->capacity ? i + 1 : MBUF_NONE;
+    }
+    ret->free_slot = 0;
+    ret->free_flow = 0;
+    ret->active_head = MBUF_NONE;
+    ret->active_tail = MBUF_NONE;
+    ret->last_flow = MBUF_NONE;
     return ret;
 }
 
@@ -50,25 +63,80 @@ mbuf_free(struct mbuf_set *ms)
 {
     if (ms)
     {
-        int i;
-        for (i = 0; i < (int) ms->len; ++i)
+        for (unsigned int f = ms->active_head; f != MBUF_NONE; f = ms->flows[f].next)
+        {
+            for (unsigned int i = ms->flows[f].head; i != MBUF_NONE; i = ms->next[i])
+            {
+                mbuf_free_buf(ms->array[i].buffer);
+            }
+        }
+        while (ms->free_list)
         {
-            struct mbuf_item *item = &ms->array[MBUF_INDEX(ms->head, i, ms->capacity)];
-            mbuf_free_buf(item->buffer);
+            struct mbuf_buffer *mb = ms->free_list;
+            ms->free_list = mb->next_free;
+            free_buf(&mb->buf);
+            free(mb->recipients);
+            free(mb);
         }
+        free(ms->flows);
+        free(ms->next);
         free(ms->array);
         free(ms);
     }
 }
 
+size_t
+mbuf_mem_usage(const struct mbuf_set *ms)
+{
+    size_t bytes = sizeof(*ms)
+                   + ms->capacity * (sizeof(*ms->array) + sizeof(*ms->next) + sizeof(*ms->flows));
+
+    for (unsigned int f = ms->active_head; f != MBUF_NONE; f = ms->flows[f].next)
+    {
+        for (unsigned int i = ms->flows[f].head; i != MBUF_NONE; i = ms->next[i])
+        {
+            const struct mbuf_buffer *mb = ms->array[i].buffer;
+            bytes += (sizeof(*mb) + buf_mem_usage(&mb->buf)) / max_int(mb->refcount, 1);
+        }
+    }
+    for (const struct mbuf_buffer *mb = ms->free_list; mb; mb = mb->next_free)
+    {
+        bytes += sizeof(*mb) + buf_mem_usage(&mb->buf);
+    }
+    return bytes;
+}
+
 struct mbuf_buffer *
-mbuf_alloc_buf(const struct buffer *buf)
+mbuf_alloc_buf(struct mbuf_set *ms, const struct buffer *buf)
 {
-    struct mbuf_buffer *ret;
-    ALLOC_OBJ(ret, struct mbuf_buffer);
-    ret->buf = clone_buf(buf);
+    struct mbuf_buffer *ret = ms->free_list;
+
+    if (ret)
+    {
+        ms->free_list = ret->next_free;
+        if (ret->buf.capacity < buf->capacity)
+        {
+            free_buf(&ret->buf);
+            free(ret->recipients);
+            free(ret);
+            ret = NULL;
+        }
+    }
+    if (!ret)
+    {
+        ALLOC_OBJ_CLEAR(ret, struct mbuf_buffer);
+        ret->buf = alloc_buf(buf->capacity);
+        ret->set = ms;
+    }
+
+    ret->buf.offset = buf->offset;
+    ret->buf.len = buf->len;
+    memcpy(BPTR(&ret->buf), BPTR(buf), BLEN(buf));
     ret->refcount = 1;
     ret->flags = 0;
+    ret->next_free = NULL;
+    ret->n_recipients = 0;
+    ret->next_recipient = 0;
     return ret;
 }
 
@@ -79,27 +147,166 @@ mbuf_free_buf(struct mbuf_buffer *mb)
     {
         if (--mb->refcount <= 0)
         {
-            free_buf(&mb->buf);
-            free(mb);
+            mb->next_free = mb->set->free_list;
+            mb->set->free_list = mb;
         }
     }
 }
 
-void
-mbuf_add_item(struct mbuf_set *ms, const struct mbuf_item *item)
+/*
+ * Find the active flow of source, or start a new one at the end of
+ * the round.  The urgent flow has no source and starts at the front.
+ */
+static struct mbuf_flow *
+mbuf_get_flow(struct mbuf_set *ms, const struct multi_instance *source, bool urgent)
+{
+    unsigned int f = ms->last_flow;
+
+    if (urgent)
+    {
+        source = NULL;
+    }
+
+    if (f == MBUF_NONE || !ms->flows[f].len || ms->flows[f].source != source
+        || ms->flows[f].urgent != urgent)
+    {
+        for (f = ms->active_head; f != MBUF_NONE; f = ms->flows[f].next)
+        {
+            if (ms->flows[f].source == source && ms->flows[f].urgent == urgent)
+            {
+                break;
+            }
+        }
+    }
+
+    if (f == MBUF_NONE)
+    {
+        /* there are never more flows than items */
+        f = ms->free_flow;
+        ASSERT(f != MBUF_NONE);
+        ms->free_flow = ms->flows[f].next;
+
+        struct mbuf_flow *flow = &ms->flows[f];
+        flow->source = source;
+        flow->head = flow->tail = MBUF_NONE;
+        flow->len = 0;
+        flow->deficit = MBUF_QUANTUM;
+        flow->urgent = urgent;
+        flow->next = MBUF_NONE;
+        if (urgent)
+        {
+            flow->next = ms->active_head;
+            ms->active_head = f;
+            if (ms->active_tail == MBUF_NONE)
+            {
+                ms->active_tail = f;
+            }
+        }
+        else if (ms->active_tail != MBUF_NONE)
+        {
+            ms->flows[ms->active_tail].next = f;
+        }
+        else
+        {
+            ms->active_head = f;
+        }
+        ms->active_tail = f;
+    }
+
+    ms->last_flow = f;
+    return &ms->flows[f];
+}
+
+/*
+ * Remove the first item of active flow f, which follows flow prev in
+ * the round (MBUF_NONE if f is the first).  The flow is retired when
+ * it has no items left.
+ */
+static void
+mbuf_pop_item(struct mbuf_set *ms, unsigned int f, unsigned int prev, struct mbuf_item *item)
+{
+    struct mbuf_flow *flow = &ms->flows[f];
+    const unsigned int i = flow->head;
+
+    *item = ms->array[i];
+    flow->head = ms->next[i];
+    ms->next[i] = ms->free_slot;
+    ms->free_slot = i;
+    --flow->len;
+    --ms->len;
+
+    if (!flow->len)
+    {
+        if (prev != MBUF_NONE)
+        {
+            ms->flows[prev].next = flow->next;
+        }
+        else
+        {
+            ms->active_head = flow->next;
+        }
+        if (ms->active_tail == f)
+        {
+            ms->active_tail = prev;
+        }
+        flow->next = ms->free_flow;
+        ms->free_flow = f;
+    }
+}
+
+/*
+ * Drop the oldest item of the source with the most items queued, so
+ * that a full set makes the source responsible pay for it.
+ */
+static void
+mbuf_drop_item(struct mbuf_set *ms)
+{
+    unsigned int longest = ms->active_head;
+    unsigned int prev = MBUF_NONE, longest_prev = MBUF_NONE;
+
+    for (unsigned int f = ms->active_head; f != MBUF_NONE; prev = f, f = ms->flows[f].next)
+    {
+        if (ms->flows[f].len > ms->flows[longest].len)
+        {
+            longest = f;
+            longest_prev = prev;
+        }
+    }
+
+    struct mbuf_item rm;
+    mbuf_pop_item(ms, longest, longest_prev, &rm);
+    OVPN_PROBE3(mbuf_drop, rm.instance, BLEN(&rm.buffer->buf), ms->flows[longest].len);
+    mbuf_free_buf(rm.buffer);
+}
+
+static void
+mbuf_add_item_dowork(struct mbuf_set *ms, const struct mbuf_item *item, bool urgent)
 {
     ASSERT(ms);
     if (ms->len == ms->capacity)
     {
-        struct mbuf_item rm;
-        ASSERT(mbuf_extract_item(ms, &rm));
-        mbuf_free_buf(rm.buffer);
+        mbuf_drop_item(ms);
         msg(D_MULTI_DROPPED, "MBUF: mbuf packet dropped");
     }
 
     ASSERT(ms->len < ms->capacity);
 
-    ms->array[MBUF_INDEX(ms->head, ms->len, ms->capacity)] = *item;
+    struct mbuf_flow *flow = mbuf_get_flow(ms, item->source, urgent);
+    const unsigned int i = ms->free_slot;
+    ms->free_slot = ms->next[i];
+    ms->array[i] = *item;
+    ms->next[i] = MBUF_NONE;
+    if (flow->tail != MBUF_NONE)
+    {
+        ms->next[flow->tail] = i;
+    }
+    else
+    {
+        flow->head = i;
+    }
+    flow->tail = i;
+    ++flow->len;
+
     if (++ms->len > ms->max_queued)
     {
         ms->max_queued = ms->len;
@@ -107,45 +314,144 @@ mbuf_add_item(struct mbuf_set *ms, const struct mbuf_item *item)
     ++item->buffer->refcount;
 }
 
-bool
-mbuf_extract_item(struct mbuf_set *ms, struct mbuf_item *item)
+void
+mbuf_add_item(struct mbuf_set *ms, const struct mbuf_item *item)
 {
-    bool ret = false;
-    if (ms)
+    mbuf_add_item_dowork(ms, item, false);
+}
+
+void
+mbuf_add_item_urgent(struct mbuf_set *ms, const struct mbuf_item *item)
+{
+    mbuf_add_item_dowork(ms, item, true);
+}
+
+void
+mbuf_add_recipient(struct mbuf_buffer *mb, struct multi_instance *mi)
+{
+    if (mb->n_recipients == mb->recipients_capacity)
     {
-        while (ms->len)
+        mb->recipients_capacity = max_uint(16, mb->recipients_capacity * 2);
+        mb->recipients = realloc(mb->recipients, mb->recipients_capacity
+                                 * sizeof(*mb->recipients));
+        check_malloc_return(mb->recipients);
+    }
+    mb->recipients[mb->n_recipients++] = mi;
+}
+
+void
+mbuf_add_bcast(struct mbuf_set *ms, struct mbuf_buffer *mb,
+               const struct multi_instance *source)
+{
+    if (mb->n_recipients)
+    {
+        struct mbuf_item item;
+        item.buffer = mb;
+        item.instance = mb->recipients[0];
+        item.source = source;
+        mb->next_recipient = 0;
+        mbuf_add_item(ms, &item);
+    }
+}
+
+/*
+ * Move item, a queued broadcast, on to its next recipient that was not
+ * dereferenced.  Returns false if there is none left.
+ */
+static bool
+mbuf_next_recipient(struct mbuf_item *item)
+{
+    struct mbuf_buffer *mb = item->buffer;
+
+    while (++mb->next_recipient < mb->n_recipients)
+    {
+        if (mb->recipients[mb->next_recipient])
         {
-            *item = ms->array[ms->head];
-            ms->head = MBUF_INDEX(ms->head, 1, ms->capacity);
-            --ms->len;
-            if (item->instance) /* ignore dereferenced instances */
+            item->instance = mb->recipients[mb->next_recipient];
+            return true;
+        }
+    }
+    item->instance = NULL;
+    return false;
+}
+
+/*
+ * Advance the round robin to the flow whose first item is to be sent
+ * next, dropping the items of dereferenced instances on the way.
+ * Return that item, or NULL if the set is empty.
+ */
+static struct mbuf_item *
+mbuf_next_item(struct mbuf_set *ms)
+{
+    while (ms->active_head != MBUF_NONE)
+    {
+        const unsigned int f = ms->active_head;
+        struct mbuf_flow *flow = &ms->flows[f];
+        struct mbuf_item *item = &ms->array[flow->head];
+
+        if (!item->instance) /* ignore dereferenced instances */
+        {
+            struct mbuf_item rm;
+            mbuf_pop_item(ms, f, MBUF_NONE, &rm);
+            continue;
+        }
+
+        /* the urgent flow stays at the front until it is empty */
+        if (!flow->urgent && flow->deficit < BLEN(&item->buffer->buf))
+        {
+            /* turn is over, move to the end of the round */
+            flow->deficit += MBUF_QUANTUM;
+            if (flow->next != MBUF_NONE)
             {
-                ret = true;
-                break;
+                ms->active_head = flow->next;
+                ms->flows[ms->active_tail].next = f;
+                ms->active_tail = f;
+                flow->next = MBUF_NONE;
             }
+            continue;
         }
+
+        return item;
     }
-    return ret;
+    return NULL;
 }
 
-struct multi_instance *
-mbuf_peek_dowork(struct mbuf_set *ms)
+bool
+mbuf_extract_item(struct mbuf_set *ms, struct mbuf_item *item)
 {
-    struct multi_instance *ret = NULL;
-    if (ms)
+    struct mbuf_item *next;
+
+    if (ms && (next = mbuf_next_item(ms)))
     {
-        int i;
-        for (i = 0; i < (int) ms->len; ++i)
+        struct mbuf_flow *flow = &ms->flows[ms->active_head];
+        flow->deficit -= BLEN(&next->buffer->buf);
+
+        /* a broadcast stays queued until all recipients had their copy */
+        if (next->buffer->n_recipients)
         {
-            struct mbuf_item *item = &ms->array[MBUF_INDEX(ms->head, i, ms->capacity)];
-            if (item->instance)
+            *item = *next;
+            ++item->buffer->refcount;
+            if (mbuf_next_recipient(next))
             {
-                ret = item->instance;
-                break;
+                return true;
             }
+            struct mbuf_item rm;
+            mbuf_pop_item(ms, ms->active_head, MBUF_NONE, &rm);
+            mbuf_free_buf(rm.buffer);
+            return true;
         }
+
+        mbuf_pop_item(ms, ms->active_head, MBUF_NONE, item);
+        return true;
     }
-    return ret;
+    return false;
+}
+
+struct multi_instance *
+mbuf_peek_dowork(struct mbuf_set *ms)
+{
+    const struct mbuf_item *item = mbuf_next_item(ms);
+    return item ? item->instance : NULL;
 }
 
 void
@@ -153,16 +459,40 @@ mbuf_dereference_instance(struct mbuf_set *ms, struct multi_instance *mi)
 {
     if (ms)
     {
-        int i;
-        for (i = 0; i < (int) ms->len; ++i)
+        for (unsigned int f = ms->active_head; f != MBUF_NONE; f = ms->flows[f].next)
         {
-            struct mbuf_item *item = &ms->array[MBUF_INDEX(ms->head, i, ms->capacity)];
-            if (item->instance == mi)
+            for (unsigned int i = ms->flows[f].head; i != MBUF_NONE; i = ms->next[i])
+            {
+                struct mbuf_item *item = &ms->array[i];
+                struct mbuf_buffer *mb = item->buffer;
+                if (mb && mb->n_recipients)
+                {
+                    for (unsigned int r = mb->next_recipient + 1; r < mb->n_recipients; ++r)
+                    {
+                        if (mb->recipients[r] == mi)
+                        {
+                            mb->recipients[r] = NULL;
+                        }
+                    }
+                    if (item->instance == mi && !mbuf_next_recipient(item))
+                    {
+                        mbuf_free_buf(mb);
+                        item->buffer = NULL;
+                    }
+                }
+                else if (item->instance == mi)
+                {
+                    mbuf_free_buf(item->buffer);
+                    item->buffer = NULL;
+                    item->instance = NULL;
+                    msg(D_MBUF, "MBUF: dereferenced queued packet");
+                }
+            }
+
+            /* mi may be reused for a new instance */
+            if (ms->flows[f].source == mi)
             {
-                mbuf_free_buf(item->buffer);
-                item->buffer = NULL;
-                item->instance = NULL;
-                msg(D_MBUF, "MBUF: dereferenced queued packet");
+                ms->flows[f].source = NULL;
             }
         }
     }
@@ -36,8 +36,6 @@
 
 struct multi_instance;
 
-#define MBUF_INDEX(head, offset, size) (((head) + (offset)) & ((size)-1))
-
 struct mbuf_buffer
 {
     struct buffer buf;
@@ -45,33 +43,100 @@ struct mbuf_buffer
 
 #define MF_UNICAST (1<<0)
     unsigned int flags;
+
+    struct mbuf_set *set;          /* set whose pool this buffer returns to */
+    struct mbuf_buffer *next_free; /* link in the pool of unused buffers */
+
+    /* recipients of a broadcast queued as a single item by
+     * mbuf_add_bcast(), handed out one at a time by mbuf_extract_item() */
+    struct multi_instance **recipients;
+    unsigned int n_recipients;
+    unsigned int next_recipient;
+    unsigned int recipients_capacity;
 };
 
 struct mbuf_item
 {
     struct mbuf_buffer *buffer;
     struct multi_instance *instance;
+    const struct multi_instance *source; /* sender, NULL if the packet
+                                          * came from the tun/tap device */
+};
+
+/*
+ * Items are queued per source and taken out by deficit round robin,
+ * so that one source sending a lot, such as a client flooding the
+ * broadcast domain, does not delay the packets of the others.
+ */
+#define MBUF_QUANTUM 1500       /* bytes per source and round */
+#define MBUF_NONE    UINT_MAX
+
+struct mbuf_flow
+{
+    const struct multi_instance *source;
+    unsigned int head;          /* first and last item of this source */
+    unsigned int tail;
+    unsigned int len;
+    int deficit;                /* bytes the source may still send in this round */
+    bool urgent;                /* see mbuf_add_item_urgent() */
+    unsigned int next;          /* next active flow, or next free flow */
 };
 
 struct mbuf_set
 {
-    unsigned int head;
     unsigned int len;
     unsigned int capacity;
     unsigned int max_queued;
     struct mbuf_item *array;
+    unsigned int *next;         /* next item of the same flow, or next free slot */
+    unsigned int free_slot;
+
+    struct mbuf_flow *flows;
+    unsigned int free_flow;
+    unsigned int active_head;   /* flows with queued items, in round robin order */
+    unsigned int active_tail;
+    unsigned int last_flow;     /* flow the last item was added to */
+
+    /* buffers whose refcount dropped to zero, kept for reuse so that
+     * queueing a packet does not allocate memory once the set is warm */
+    struct mbuf_buffer *free_list;
 };
 
 struct mbuf_set *mbuf_init(unsigned int size);
 
 void mbuf_free(struct mbuf_set *ms);
 
-struct mbuf_buffer *mbuf_alloc_buf(const struct buffer *buf);
+/*
+ * Return a copy of buf in a buffer from the pool of ms, with a
+ * refcount of one.  The buffer goes back to the pool when the
+ * last reference is dropped with mbuf_free_buf().  It may only be
+ * queued on ms.
+ */
+struct mbuf_buffer *mbuf_alloc_buf(struct mbuf_set *ms, const struct buffer *buf);
 
 void mbuf_free_buf(struct mbuf_buffer *mb);
 
 void mbuf_add_item(struct mbuf_set *ms, const struct mbuf_item *item);
 
+/*
+ * Like mbuf_add_item(), but the item goes to a flow of its own that
+ * is served before all others, whatever its source.
+ */
+void mbuf_add_item_urgent(struct mbuf_set *ms, const struct mbuf_item *item);
+
+/*
+ * Add mi to the recipients of the broadcast in mb.
+ */
+void mbuf_add_recipient(struct mbuf_buffer *mb, struct multi_instance *mi);
+
+/*
+ * Queue mb for all recipients added with mbuf_add_recipient() as one
+ * item.  It takes a single slot of ms however many recipients there
+ * are, mbuf_extract_item() returns one item per recipient.
+ */
+void mbuf_add_bcast(struct mbuf_set *ms, struct mbuf_buffer *mb,
+                    const struct multi_instance *source);
+
 bool mbuf_extract_item(struct mbuf_set *ms, struct mbuf_item *item);
 
 void mbuf_dereference_instance(struct mbuf_set *ms, struct multi_instance *mi);
@@ -94,6 +159,12 @@ mbuf_maximum_queued(const struct mbuf_set *ms)
     return (int) ms->max_queued;
 }
 
+/*
+ * Bytes of heap memory used by the set and its packet buffers.  A
+ * buffer queued in several sets is split evenly among them.
+ */
+size_t mbuf_mem_usage(const struct mbuf_set *ms);
+
 struct multi_instance *mbuf_peek_dowork(struct mbuf_set *ms);
 
 static inline struct multi_instance *
@@ -0,0 +1,484 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "mcast_snoop.h"
+#include "crypto.h"
+#include "error.h"
+#include "otime.h"
+#include "proto.h"
+#include "tun.h"
+
+#include "memdbg.h"
+
+/* seconds a membership survives a leave message, so that other hosts
+ * behind the same client can still answer the query of the router */
+#define MCAST_LEAVE_DELAY 2
+
+/* seconds between two sweeps for expired memberships */
+#define MCAST_SWEEP_INTERVAL 10
+
+/* IGMP message types, RFC 1112, 2236, 3376 */
+#define IGMP_V1_REPORT   0x12
+#define IGMP_V2_REPORT   0x16
+#define IGMP_V2_LEAVE    0x17
+#define IGMP_V3_REPORT   0x22
+
+/* MLD message types, RFC 2710, 3810 */
+#define MLD_V1_REPORT    131
+#define MLD_V1_DONE      132
+#define MLD_V2_REPORT    143
+
+/* IGMPv3 and MLDv2 group record types */
+#define MCAST_MODE_IS_INCLUDE        1
+#define MCAST_MODE_IS_EXCLUDE        2
+#define MCAST_CHANGE_TO_INCLUDE      3
+#define MCAST_CHANGE_TO_EXCLUDE      4
+#define MCAST_ALLOW_NEW_SOURCES      5
+
+#define IPV6_HOP_BY_HOP  0
+
+static bool
+mcast_snoop_compare_function(const void *key1, const void *key2)
+{
+    return mroute_addr_equal(key1, key2);
+}
+
+struct mcast_snoop *
+mcast_snoop_new(int timeout)
+{
+    struct mcast_snoop *ms;
+
+    ALLOC_OBJ_CLEAR(ms, struct mcast_snoop);
+    ms->groups = hash_init(16, get_random(), mroute_addr_hash_function,
+                           mcast_snoop_compare_function);
+    ms->timeout = timeout;
+    return ms;
+}
+
+static void
+mcast_group_free(struct mcast_group *g)
+{
+    while (g->members)
+    {
+        struct mcast_member *mm = g->members;
+        g->members = mm->next;
+        free(mm);
+    }
+    free(g);
+}
+
+void
+mcast_snoop_free(struct mcast_snoop *ms)
+{
+    if (ms)
+    {
+        struct hash_iterator hi;
+        struct hash_element *he;
+
+        hash_iterator_init(ms->groups, &hi);
+        while ((he = hash_iterator_next(&hi)))
+        {
+            struct mcast_group *g = he->value;
+            hash_iterator_delete_element(&hi);
+            mcast_group_free(g);
+        }
+        hash_iterator_free(&hi);
+        hash_free(ms->groups);
+        free(ms);
+    }
+}
+
+/*
+ * The key of a group: its IP address in tun mode, the multicast MAC
+ * address it maps to (RFC 1112, RFC 2464) plus the VID in tap mode.
+ */
+static void
+mcast_group_addr(struct mroute_addr *ma, int dev_type, uint16_t vid,
+                 int ip_ver, const uint8_t *group)
+{
+    mroute_addr_init(ma);
+    if (dev_type == DEV_TYPE_TAP)
+    {
+        ma->type = MR_ADDR_ETHER;
+        ma->len = OPENVPN_ETH_ALEN + sizeof(vid);
+        if (ip_ver == 4)
+        {
+            const uint8_t mac[] = { 0x01, 0x00, 0x5e, group[1] & 0x7f,
+                                    group[2], group[3] };
+            memcpy(ma->ether.addr, mac, sizeof(mac));
+        }
+        else
+        {
+            const uint8_t mac[] = { 0x33, 0x33, group[12], group[13],
+                                    group[14], group[15] };
+            memcpy(ma->ether.addr, mac, sizeof(mac));
+        }
+        ma->ether.vid = vid;
+    }
+    else if (ip_ver == 4)
+    {
+        ma->type = MR_ADDR_IPV4;
+        ma->len = 4;
+        memcpy(&ma->v4.addr, group, 4);
+    }
+    else
+    {
+        ma->type = MR_ADDR_IPV6;
+        ma->len = 16;
+        memcpy(&ma->v6.addr, group, 16);
+    }
+}
+
+/*
+ * Only groups beyond link-local scope are snooped, see RFC 4541 2.1.2
+ */
+static bool
+mcast_group_snooped(int ip_ver, const uint8_t *group)
+{
+    if (ip_ver == 4)
+    {
+        return group[0] >= 224 && group[0] <= 239
+               && !(group[0] == 224 && group[1] == 0 && group[2] == 0);
+    }
+    else
+    {
+        return group[0] == 0xff && (group[1] & 0x0f) > 2;
+    }
+}
+
+static void
+mcast_snoop_update(struct mcast_snoop *ms, struct multi_instance *mi,
+                   int dev_type, uint16_t vid, int ip_ver,
+                   const uint8_t *group, bool join)
+{
+    if (!mcast_group_snooped(ip_ver, group))
+    {
+        return;
+    }
+
+    struct mroute_addr addr;
+    mcast_group_addr(&addr, dev_type, vid, ip_ver, group);
+
+    const uint32_t hv = hash_value(ms->groups, &addr);
+    struct hash_element *he = hash_lookup_fast(ms->groups, &addr, hv);
+    struct mcast_group *g = he ? he->value : NULL;
+    struct mcast_member *mm = NULL;
+
+    if (g)
+    {
+        for (mm = g->members; mm && mm->mi != mi; mm = mm->next)
+        {
+        }
+    }
+
+    if (join)
+    {
+        if (!g)
+        {
+            ALLOC_OBJ_CLEAR(g, struct mcast_group);
+            g->addr = addr;
+            hash_add_fast(ms->groups, &g->addr, hv, g);
+        }
+        if (!mm)
+        {
+            ALLOC_OBJ_CLEAR(mm, struct mcast_member);
+            mm->mi = mi;
+            mm->next = g->members;
+            g->members = mm;
+        }
+        mm->expires = now + ms->timeout;
+    }
+    else if (mm && mm->expires > now + MCAST_LEAVE_DELAY)
+    {
+        mm->expires = now + MCAST_LEAVE_DELAY;
+    }
+}
+
+/*
+ * Returns true if an IGMPv3/MLDv2 group record changes the membership,
+ * *join tells if it is a join or a leave.  Any record that wants traffic
+ * from some source counts as a join of the whole group.
+ */
+static bool
+mcast_record_is_join(uint8_t type, int n_sources, bool *join)
+{
+    switch (type)
+    {
+        case MCAST_MODE_IS_EXCLUDE:
+        case MCAST_CHANGE_TO_EXCLUDE:
+            *join = true;
+            return true;
+
+        case MCAST_MODE_IS_INCLUDE:
+        case MCAST_CHANGE_TO_INCLUDE:
+            /* INCLUDE with an empty source list is a leave */
+            *join = n_sources > 0;
+            return true;
+
+        case MCAST_ALLOW_NEW_SOURCES:
+            *join = true;
+            return n_sources > 0;
+
+        default:
+            return false;
+    }
+}
+
+static void
+mcast_snoop_igmp(struct mcast_snoop *ms, struct multi_instance *mi,
+                 const uint8_t *p, int len, int dev_type, uint16_t vid)
+{
+    if (len < 8)
+    {
+        return;
+    }
+
+    switch (p[0])
+    {
+        case IGMP_V1_REPORT:
+        case IGMP_V2_REPORT:
+            mcast_snoop_update(ms, mi, dev_type, vid, 4, p + 4, true);
+            break;
+
+        case IGMP_V2_LEAVE:
+            mcast_snoop_update(ms, mi, dev_type, vid, 4, p + 4, false);
+            break;
+
+        case IGMP_V3_REPORT:
+        {
+            int n_records = (p[6] << 8) | p[7];
+            int off = 8;
+            while (n_records-- > 0 && off + 8 <= len)
+            {
+                const uint8_t *rec = p + off;
+                const int n_sources = (rec[2] << 8) | rec[3];
+                bool join;
+                if (mcast_record_is_join(rec[0], n_sources, &join))
+                {
+                    mcast_snoop_update(ms, mi, dev_type, vid, 4, rec + 4, join);
+                }
+                off += 8 + 4 * n_sources + 4 * rec[1];
+            }
+            break;
+        }
+    }
+}
+
+static void
+mcast_snoop_mld(struct mcast_snoop *ms, struct multi_instance *mi,
+                const uint8_t *p, int len, int dev_type, uint16_t vid)
+{
+    if (len < 24)
+    {
+        return;
+    }
+
+    switch (p[0])
+    {
+        case MLD_V1_REPORT:
+            mcast_snoop_update(ms, mi, dev_type, vid, 6, p + 8, true);
+            break;
+
+        case MLD_V1_DONE:
+            mcast_snoop_update(ms, mi, dev_type, vid, 6, p + 8, false);
+            break;
+
+        case MLD_V2_REPORT:
+        {
+            int n_records = (p[6] << 8) | p[7];
+            int off = 8;
+            while (n_records-- > 0 && off + 20 <= len)
+            {
+                const uint8_t *rec = p + off;
+                const int n_sources = (rec[2] << 8) | rec[3];
+                bool join;
+                if (mcast_record_is_join(rec[0], n_sources, &join))
+                {
+                    mcast_snoop_update(ms, mi, dev_type, vid, 6, rec + 4, join);
+                }
+                off += 20 + 16 * n_sources + 4 * rec[1];
+            }
+            break;
+        }
+    }
+}
+
+void
+mcast_snoop_learn(struct mcast_snoop *ms, struct multi_instance *mi,
+                  const struct buffer *buf, int dev_type, uint16_t vid)
+{
+    struct ip_packet_info ipi;
+
+    ip_packet_parse(dev_type, buf, &ipi);
+    if (!ipi.l4_offset)
+    {
+        return;
+    }
+
+    const uint8_t *p = BPTR(buf) + ipi.l4_offset;
+    int len = BLEN(buf) - ipi.l4_offset;
+
+    if (ipi.version == 4 && ipi.l4_proto == OPENVPN_IPPROTO_IGMP)
+    {
+        mcast_snoop_igmp(ms, mi, p, len, dev_type, vid);
+    }
+    else if (ipi.version == 6)
+    {
+        uint8_t proto = ipi.l4_proto;
+
+        /* MLD messages carry a router alert in a hop-by-hop header */
+        if (proto == IPV6_HOP_BY_HOP && len >= 8)
+        {
+            const int hlen = (p[1] + 1) * 8;
+            proto = p[0];
+            p += hlen;
+            len -= hlen;
+        }
+        if (proto == OPENVPN_IPPROTO_ICMPV6)
+        {
+            mcast_snoop_mld(ms, mi, p, len, dev_type, vid);
+        }
+    }
+}
+
+bool
+mcast_snoop_members(struct mcast_snoop *ms, const struct buffer *buf,
+                    int dev_type, uint16_t vid,
+                    const struct mcast_member **members)
+{
+    struct ip_packet_info ipi;
+    const uint8_t *group;
+
+    ip_packet_parse(dev_type, buf, &ipi);
+    if (ipi.version == 4)
+    {
+        const struct openvpn_iphdr *pip =
+            (const struct openvpn_iphdr *)(BPTR(buf) + ipi.l3_offset);
+        group = (const uint8_t *) &pip->daddr;
+    }
+    else if (ipi.version == 6 && ipi.l4_offset) /* complete header */
+    {
+        const struct openvpn_ipv6hdr *pip6 =
+            (const struct openvpn_ipv6hdr *)(BPTR(buf) + ipi.l3_offset);
+        group = pip6->daddr.s6_addr;
+    }
+    else
+    {
+        return false;
+    }
+
+    /* IGMP goes to everybody, like link-local groups */
+    if (!mcast_group_snooped(ipi.version, group)
+        || (ipi.version == 4 && ipi.l4_proto == OPENVPN_IPPROTO_IGMP))
+    {
+        return false;
+    }
+
+    struct mroute_addr addr;
+    mcast_group_addr(&addr, dev_type, vid, ipi.version, group);
+
+    struct mcast_group *g = hash_lookup(ms->groups, &addr);
+    if (!g)
+    {
+        *members = NULL;
+        return true;
+    }
+
+    /* drop expired members on the way */
+    struct mcast_member **pp = &g->members;
+    while (*pp)
+    {
+        struct mcast_member *mm = *pp;
+        if (mm->expires < now)
+        {
+            *pp = mm->next;
+            free(mm);
+        }
+        else
+        {
+            pp = &mm->next;
+        }
+    }
+    *members = g->members;
+    return true;
+}
+
+/*
+ * Remove the expired members and those of mi from all groups, and the
+ * groups that end up empty.
+ */
+static void
+mcast_snoop_remove(struct mcast_snoop *ms, const struct multi_instance *mi)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(ms->groups, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct mcast_group *g = he->value;
+        struct mcast_member **pp = &g->members;
+        while (*pp)
+        {
+            struct mcast_member *mm = *pp;
+            if (mm->mi == mi || mm->expires < now)
+            {
+                *pp = mm->next;
+                free(mm);
+            }
+            else
+            {
+                pp = &mm->next;
+            }
+        }
+        if (!g->members)
+        {
+            hash_iterator_delete_element(&hi);
+            free(g);
+        }
+    }
+    hash_iterator_free(&hi);
+}
+
+void
+mcast_snoop_remove_instance(struct mcast_snoop *ms,
+                            const struct multi_instance *mi)
+{
+    mcast_snoop_remove(ms, mi);
+}
+
+void
+mcast_snoop_sweep(struct mcast_snoop *ms)
+{
+    if (now >= ms->next_sweep)
+    {
+        mcast_snoop_remove(ms, NULL);
+        ms->next_sweep = now + MCAST_SWEEP_INTERVAL;
+    }
+}
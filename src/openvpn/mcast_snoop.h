@@ -0,0 +1,110 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MCAST_SNOOP_H
+#define MCAST_SNOOP_H
+
+/**
+ * @file
+ * IGMP and MLD snooping for --multicast-snooping.
+ *
+ * The IGMP (IPv4) and MLD (IPv6) membership reports that clients send
+ * are used to learn which instances joined which multicast group.
+ * Packets to such a group are then only sent to its members instead of
+ * to all clients.  A membership ends when it has not been refreshed by
+ * a report within the configured time, shortly after a leave message,
+ * or when the instance is closed.
+ *
+ * Groups of link-local scope (224.0.0.0/24, ff02::/16) are never
+ * snooped and still go to all clients, as RFC 4541 requires.  In tap
+ * mode the groups are keyed by the multicast MAC address the group maps
+ * to and the VID, so they follow the forwarding of the frames.
+ * Source-specific (IGMPv3/MLDv2 INCLUDE) filters are not evaluated, a
+ * client that asks for some sources of a group gets the whole group.
+ */
+
+#include "basic.h"
+#include "buffer.h"
+#include "list.h"
+#include "mroute.h"
+
+/* the IGMP group membership interval, RFC 3376 8.4 */
+#define MCAST_SNOOPING_TIMEOUT_DEFAULT 260
+
+struct multi_instance;
+
+struct mcast_member
+{
+    struct multi_instance *mi;
+    time_t expires;
+    struct mcast_member *next;
+};
+
+struct mcast_group
+{
+    struct mroute_addr addr;        /* hash key */
+    struct mcast_member *members;
+};
+
+struct mcast_snoop
+{
+    struct hash *groups;            /* struct mcast_group by address */
+    int timeout;                    /* seconds a report keeps a membership */
+    time_t next_sweep;
+};
+
+struct mcast_snoop *mcast_snoop_new(int timeout);
+
+void mcast_snoop_free(struct mcast_snoop *ms);
+
+/**
+ * Learn group memberships of mi from buf if it holds an IGMP or MLD
+ * message.  buf is a packet received from the client, dev_type tells
+ * if it starts with an IP or an Ethernet header.
+ */
+void mcast_snoop_learn(struct mcast_snoop *ms, struct multi_instance *mi,
+                       const struct buffer *buf, int dev_type, uint16_t vid);
+
+/**
+ * Look up the receivers of the multicast packet in buf.
+ *
+ * @return  false if the packet has to go to all clients.  Otherwise
+ *          *members is set to the current members of the group, which
+ *          may be none.
+ */
+bool mcast_snoop_members(struct mcast_snoop *ms, const struct buffer *buf,
+                         int dev_type, uint16_t vid,
+                         const struct mcast_member **members);
+
+/**
+ * Drop all memberships of mi.  Has to be called before mi is freed.
+ */
+void mcast_snoop_remove_instance(struct mcast_snoop *ms,
+                                 const struct multi_instance *mi);
+
+/**
+ * Drop expired memberships, at most once every few seconds.
+ */
+void mcast_snoop_sweep(struct mcast_snoop *ms);
+
+#endif /* MCAST_SNOOP_H */
@@ -360,9 +360,9 @@ mroute_addr_mask_host_bits(struct mroute_addr *ma)
 uint32_t
 mroute_addr_hash_function(const void *key, uint32_t iv)
 {
-    return hash_func(mroute_addr_hash_ptr((const struct mroute_addr *) key),
-                     mroute_addr_hash_len((const struct mroute_addr *) key),
-                     iv);
+    return hash_func_short(mroute_addr_hash_ptr((const struct mroute_addr *) key),
+                           mroute_addr_hash_len((const struct mroute_addr *) key),
+                           iv);
 }
 
 bool
@@ -463,81 +463,290 @@ mroute_addr_print_ex(const struct mroute_addr *ma,
 
 /*
  * mroute_helper's main job is keeping track of
- * currently used CIDR netlengths, so we don't
- * have to cycle through all 33.
+ * the currently used iroutes, so we only have to
+ * try the netlengths that can contain an address.
+ *
+ * The iroutes of each address family are kept in a
+ * binary trie with path compression.  There is a node
+ * for every iroute prefix and for every bit position
+ * where prefixes branch.  The refcount of a node is
+ * the number of iroutes with exactly its prefix, so
+ * nodes that only branch have a refcount of 0.
  */
 
-struct mroute_helper *
-mroute_helper_init(int ageable_ttl_secs)
+struct mroute_trie_node
 {
-    struct mroute_helper *mh;
-    ALLOC_OBJ_CLEAR(mh, struct mroute_helper);
-    mh->ageable_ttl_secs = ageable_ttl_secs;
-    return mh;
+    struct mroute_trie_node *child[2];
+    int refcount;
+    uint8_t netbits;
+    uint8_t addr[16];           /* prefix, host bits are zero */
+};
+
+static inline int
+mroute_trie_bit(const uint8_t *addr, int n)
+{
+    return (addr[n / 8] >> (7 - n % 8)) & 1;
+}
+
+/*
+ * Number of leading bits, at most max, in which a and b agree, given
+ * that they are known to agree in the first start bits.
+ */
+static int
+mroute_trie_common_bits(const uint8_t *a, const uint8_t *b, int start, int max)
+{
+    int n = start;
+
+    while (n % 8 && n < max && mroute_trie_bit(a, n) == mroute_trie_bit(b, n))
+    {
+        ++n;
+    }
+    if (n % 8)
+    {
+        return n;
+    }
+    while (n + 8 <= max && a[n / 8] == b[n / 8])
+    {
+        n += 8;
+    }
+    while (n < max && mroute_trie_bit(a, n) == mroute_trie_bit(b, n))
+    {
+        ++n;
+    }
+    return n;
+}
+
+static struct mroute_trie_node *
+mroute_trie_node_new(const uint8_t *addr, int netbits, int refcount)
+{
+    struct mroute_trie_node *node;
+
+    ALLOC_OBJ_CLEAR(node, struct mroute_trie_node);
+    node->netbits = (uint8_t) netbits;
+    node->refcount = refcount;
+    memcpy(node->addr, addr, (netbits + 7) / 8);
+    if (netbits % 8)
+    {
+        node->addr[netbits / 8] &= 0xff << (8 - netbits % 8);
+    }
+    return node;
 }
 
 static void
-mroute_helper_regenerate(struct mroute_helper *mh)
+mroute_trie_add(struct mroute_trie_node **pp, const uint8_t *addr, int netbits)
 {
-    int i, j = 0;
-    for (i = MR_HELPER_NET_LEN - 1; i >= 0; --i)
+    int matched = 0;
+
+    while (*pp)
     {
-        if (mh->net_len_refcount[i] > 0)
+        struct mroute_trie_node *node = *pp;
+        const int common = mroute_trie_common_bits(node->addr, addr, matched,
+                                                   min_int(node->netbits, netbits));
+
+        if (common < node->netbits)
+        {
+            /* the new prefix branches off inside the prefix of node, or is
+             * a shorter prefix of it: insert a node above it */
+            struct mroute_trie_node *parent =
+                mroute_trie_node_new(addr, common, common == netbits ? 1 : 0);
+            parent->child[mroute_trie_bit(node->addr, common)] = node;
+            *pp = parent;
+            if (common < netbits)
+            {
+                parent->child[mroute_trie_bit(addr, common)] =
+                    mroute_trie_node_new(addr, netbits, 1);
+            }
+            return;
+        }
+        if (node->netbits == netbits)
         {
-            mh->net_len[j++] = (uint8_t) i;
+            ++node->refcount;
+            return;
         }
+        matched = node->netbits;
+        pp = &node->child[mroute_trie_bit(addr, node->netbits)];
     }
-    mh->n_net_len = j;
+    *pp = mroute_trie_node_new(addr, netbits, 1);
+}
 
-#ifdef ENABLE_DEBUG
-    if (check_debug_level(D_MULTI_DEBUG))
+/*
+ * Remove *pp if it is neither an iroute nor a branch any more.
+ */
+static void
+mroute_trie_collapse(struct mroute_trie_node **pp)
+{
+    struct mroute_trie_node *node = *pp;
+
+    if (node->refcount == 0 && !(node->child[0] && node->child[1]))
     {
-        struct gc_arena gc = gc_new();
-        struct buffer out = alloc_buf_gc(256, &gc);
-        buf_printf(&out, "MROUTE CIDR netlen:");
-        for (i = 0; i < mh->n_net_len; ++i)
+        *pp = node->child[0] ? node->child[0] : node->child[1];
+        free(node);
+    }
+}
+
+static void
+mroute_trie_del(struct mroute_trie_node **pp, const uint8_t *addr, int netbits)
+{
+    struct mroute_trie_node **parent = NULL;
+    int matched = 0;
+
+    while (*pp && (*pp)->netbits < netbits)
+    {
+        matched = mroute_trie_common_bits((*pp)->addr, addr, matched,
+                                          (*pp)->netbits);
+        ASSERT(matched == (*pp)->netbits);
+        parent = pp;
+        pp = &(*pp)->child[mroute_trie_bit(addr, (*pp)->netbits)];
+    }
+
+    struct mroute_trie_node *node = *pp;
+    ASSERT(node && node->netbits == netbits && node->refcount > 0);
+    ASSERT(mroute_trie_common_bits(node->addr, addr, matched, netbits) == netbits);
+
+    if (--node->refcount == 0)
+    {
+        mroute_trie_collapse(pp);
+        /* the parent may now be a branch with only one child left */
+        if (!*pp && parent)
         {
-            buf_printf(&out, " /%d", mh->net_len[i]);
+            mroute_trie_collapse(parent);
         }
-        dmsg(D_MULTI_DEBUG, "%s", BSTR(&out));
-        gc_free(&gc);
     }
-#endif
 }
 
-void
-mroute_helper_add_iroute46(struct mroute_helper *mh, int netbits)
+static int
+mroute_trie_lookup(const struct mroute_trie_node *node, const uint8_t *addr,
+                   int maxbits, uint8_t *netbits)
 {
-    if (netbits >= 0)
+    int n = 0;
+    int matched = 0;
+
+    while (node && node->netbits <= maxbits)
     {
-        ASSERT(netbits < MR_HELPER_NET_LEN);
-        ++mh->cache_generation;
-        ++mh->net_len_refcount[netbits];
-        if (mh->net_len_refcount[netbits] == 1)
+        matched = mroute_trie_common_bits(node->addr, addr, matched, node->netbits);
+        if (matched < node->netbits)
+        {
+            break;
+        }
+        if (node->refcount)
         {
-            mroute_helper_regenerate(mh);
+            netbits[n++] = node->netbits;
+        }
+        if (node->netbits == maxbits)
+        {
+            break;
         }
+        node = node->child[mroute_trie_bit(addr, node->netbits)];
+    }
+
+    /* longest prefix first */
+    for (int i = 0; i < n / 2; ++i)
+    {
+        const uint8_t tmp = netbits[i];
+        netbits[i] = netbits[n - 1 - i];
+        netbits[n - 1 - i] = tmp;
+    }
+    return n;
+}
+
+static void
+mroute_trie_free(struct mroute_trie_node *node)
+{
+    if (node)
+    {
+        mroute_trie_free(node->child[0]);
+        mroute_trie_free(node->child[1]);
+        free(node);
+    }
+}
+
+struct mroute_helper *
+mroute_helper_init(int ageable_ttl_secs)
+{
+    struct mroute_helper *mh;
+    ALLOC_OBJ_CLEAR(mh, struct mroute_helper);
+    mh->ageable_ttl_secs = ageable_ttl_secs;
+    return mh;
+}
+
+/*
+ * Returns the trie for the address family of addr and its address
+ * length in bits, or NULL for non-IP addresses.
+ */
+static struct mroute_trie_node **
+mroute_helper_trie(struct mroute_helper *mh, const struct mroute_addr *addr,
+                   int *maxbits)
+{
+    switch (addr->type & MR_ADDR_MASK)
+    {
+        case MR_ADDR_IPV4:
+            *maxbits = 32;
+            return &mh->iroutes_ipv4;
+
+        case MR_ADDR_IPV6:
+            *maxbits = 128;
+            return &mh->iroutes_ipv6;
+
+        default:
+            return NULL;
     }
 }
 
 void
-mroute_helper_del_iroute46(struct mroute_helper *mh, int netbits)
+mroute_helper_add_iroute46(struct mroute_helper *mh,
+                           const struct mroute_addr *net)
 {
-    if (netbits >= 0)
+    int maxbits;
+    struct mroute_trie_node **trie = mroute_helper_trie(mh, net, &maxbits);
+
+    if (trie && (net->type & MR_WITH_NETBITS))
     {
-        ASSERT(netbits < MR_HELPER_NET_LEN);
+        ASSERT(net->netbits <= maxbits);
         ++mh->cache_generation;
-        --mh->net_len_refcount[netbits];
-        ASSERT(mh->net_len_refcount[netbits] >= 0);
-        if (!mh->net_len_refcount[netbits])
-        {
-            mroute_helper_regenerate(mh);
-        }
+        mroute_trie_add(trie, net->raw_addr, net->netbits);
+    }
+}
+
+void
+mroute_helper_del_iroute46(struct mroute_helper *mh,
+                           const struct mroute_addr *net)
+{
+    int maxbits;
+    struct mroute_trie_node **trie = mroute_helper_trie(mh, net, &maxbits);
+
+    if (trie && (net->type & MR_WITH_NETBITS))
+    {
+        ASSERT(net->netbits <= maxbits);
+        ++mh->cache_generation;
+        mroute_trie_del(trie, net->raw_addr, net->netbits);
+    }
+}
+
+int
+mroute_helper_lookup(const struct mroute_helper *mh,
+                     const struct mroute_addr *addr,
+                     uint8_t netbits[MR_HELPER_NET_LEN])
+{
+    switch (addr->type & MR_ADDR_MASK)
+    {
+        case MR_ADDR_IPV4:
+            return mroute_trie_lookup(mh->iroutes_ipv4, addr->raw_addr, 32, netbits);
+
+        case MR_ADDR_IPV6:
+            return mroute_trie_lookup(mh->iroutes_ipv6, addr->raw_addr, 128, netbits);
+
+        default:
+            return 0;
     }
 }
 
 void
 mroute_helper_free(struct mroute_helper *mh)
 {
-    free(mh);
+    if (mh)
+    {
+        mroute_trie_free(mh->iroutes_ipv4);
+        mroute_trie_free(mh->iroutes_ipv6);
+        free(mh);
+    }
 }
@@ -121,19 +121,20 @@ static_assert(offsetof(struct mroute_addr, v4mappedv6.addr) ==
               "Unexpected struct packing of v4mappedv6");
 
 /*
- * Number of bits in an address.  Should be raised for IPv6.
+ * Number of possible CIDR netlengths of an IPv6 address.
  */
 #define MR_HELPER_NET_LEN 129
 
+struct mroute_trie_node;
+
 /*
  * Used to help maintain CIDR routing table.
  */
 struct mroute_helper {
     unsigned int cache_generation; /* incremented when route added */
     int ageable_ttl_secs;        /* host route cache entry time-to-live*/
-    int n_net_len;               /* length of net_len array */
-    uint8_t net_len[MR_HELPER_NET_LEN];    /* CIDR netlengths in descending order */
-    int net_len_refcount[MR_HELPER_NET_LEN]; /* refcount of each netlength */
+    struct mroute_trie_node *iroutes_ipv4; /* prefix tries of the iroutes */
+    struct mroute_trie_node *iroutes_ipv6;
 };
 
 struct openvpn_sockaddr;
@@ -167,9 +168,24 @@ struct mroute_helper *mroute_helper_init(int ageable_ttl_secs);
 
 void mroute_helper_free(struct mroute_helper *mh);
 
-void mroute_helper_add_iroute46(struct mroute_helper *mh, int netbits);
+/*
+ * Add or remove an iroute.  net is the network address of the iroute,
+ * host routes (no MR_WITH_NETBITS) are ignored.
+ */
+void mroute_helper_add_iroute46(struct mroute_helper *mh,
+                                const struct mroute_addr *net);
+
+void mroute_helper_del_iroute46(struct mroute_helper *mh,
+                                const struct mroute_addr *net);
 
-void mroute_helper_del_iroute46(struct mroute_helper *mh, int netbits);
+/*
+ * Find the netlengths of all iroutes that contain the IPv4 or IPv6
+ * address addr.  They are stored in netbits, longest first, and their
+ * number is returned.
+ */
+int mroute_helper_lookup(const struct mroute_helper *mh,
+                         const struct mroute_addr *addr,
+                         uint8_t netbits[MR_HELPER_NET_LEN]);
 
 unsigned int mroute_extract_addr_ip(struct mroute_addr *src,
                                     struct mroute_addr *dest,
@@ -40,98 +40,91 @@
  */
 
 /*
- * IPv4 packet: find TCP header, check flags for "SYN"
- *              if yes, hand to mss_fixup_dowork()
+ * Packet parsed by ip_packet_parse(): check for a complete TCP "SYN"
+ * segment, if yes, hand to mss_fixup_dowork()
  */
 void
-mss_fixup_ipv4(struct buffer *buf, int maxmss)
+mss_fixup_packet(struct buffer *buf, const struct ip_packet_info *ipi, int maxmss)
 {
-    const struct openvpn_iphdr *pip;
-    int hlen;
+    const int ip_len = BLEN(buf) - ipi->l3_offset;
+    const uint8_t *ip = BPTR(buf) + ipi->l3_offset;
 
-    if (BLEN(buf) < (int) sizeof(struct openvpn_iphdr))
+    if (ipi->l4_proto != OPENVPN_IPPROTO_TCP || !ipi->l4_offset
+        || BLEN(buf) - ipi->l4_offset < (int) sizeof(struct openvpn_tcphdr))
     {
         return;
     }
 
-    verify_align_4(buf);
-    pip = (struct openvpn_iphdr *) BPTR(buf);
-
-    hlen = OPENVPN_IPH_GET_LEN(pip->version_len);
+    /* do we have the full IP packet? */
+    if (ipi->version == 4)
+    {
+        const struct openvpn_iphdr *pip = (const struct openvpn_iphdr *) ip;
+        if (ntohs(pip->tot_len) != ip_len)
+        {
+            return;
+        }
+    }
+    else
+    {
+        /* "payload_len" does not include IPv6 header (+40 bytes) */
+        const struct openvpn_ipv6hdr *pip6 = (const struct openvpn_ipv6hdr *) ip;
+        if ((int) ntohs(pip6->payload_len) + 40 != ip_len)
+        {
+            return;
+        }
+        /* the TCP header does not follow the IPv4 header */
+        maxmss -= 20;
+    }
 
-    if (pip->protocol == OPENVPN_IPPROTO_TCP
-        && ntohs(pip->tot_len) == BLEN(buf)
-        && (ntohs(pip->frag_off) & OPENVPN_IP_OFFMASK) == 0
-        && hlen <= BLEN(buf)
-        && BLEN(buf) - hlen
-        >= (int) sizeof(struct openvpn_tcphdr))
+    const struct openvpn_tcphdr *tc =
+        (const struct openvpn_tcphdr *) (BPTR(buf) + ipi->l4_offset);
+    if (tc->flags & OPENVPN_TCPH_SYN_MASK)
     {
         struct buffer newbuf = *buf;
-        if (buf_advance(&newbuf, hlen))
+        if (buf_advance(&newbuf, ipi->l4_offset))
         {
-            struct openvpn_tcphdr *tc = (struct openvpn_tcphdr *) BPTR(&newbuf);
-            if (tc->flags & OPENVPN_TCPH_SYN_MASK)
-            {
-                mss_fixup_dowork(&newbuf, (uint16_t) maxmss);
-            }
+            mss_fixup_dowork(&newbuf, (uint16_t) maxmss);
         }
     }
 }
 
 /*
- * IPv6 packet: find TCP header, check flags for "SYN"
+ * IPv4 packet: find TCP header, check flags for "SYN"
  *              if yes, hand to mss_fixup_dowork()
- *              (IPv6 header structure is sufficiently different from IPv4...)
  */
 void
-mss_fixup_ipv6(struct buffer *buf, int maxmss)
+mss_fixup_ipv4(struct buffer *buf, int maxmss)
 {
-    const struct openvpn_ipv6hdr *pip6;
-    struct buffer newbuf;
-
-    if (BLEN(buf) < (int) sizeof(struct openvpn_ipv6hdr))
-    {
-        return;
-    }
+    struct ip_packet_info ipi;
 
-    verify_align_4(buf);
-    pip6 = (struct openvpn_ipv6hdr *) BPTR(buf);
-
-    /* do we have the full IPv6 packet?
-     * "payload_len" does not include IPv6 header (+40 bytes)
-     */
-    if (BLEN(buf) != (int) ntohs(pip6->payload_len)+40)
+    ip_packet_parse(DEV_TYPE_TUN, buf, &ipi);
+    if (ipi.version == 4)
     {
-        return;
+        mss_fixup_packet(buf, &ipi, maxmss);
     }
+}
 
-    /* follow header chain until we reach final header, then check for TCP
-     *
-     * An IPv6 packet could, theoretically, have a chain of multiple headers
-     * before the final header (TCP, UDP, ...), so we'd need to walk that
-     * chain (see RFC 2460 and RFC 6564 for details).
-     *
-     * In practice, "most typically used" extension headers (AH, routing,
-     * fragment, mobility) are very unlikely to be seen inside an OpenVPN
-     * tun, so for now, we only handle the case of "single next header = TCP"
-     */
-    if (pip6->nexthdr != OPENVPN_IPPROTO_TCP)
-    {
-        return;
-    }
+/*
+ * IPv6 packet: find TCP header, check flags for "SYN"
+ *              if yes, hand to mss_fixup_dowork()
+ *
+ * An IPv6 packet could, theoretically, have a chain of multiple headers
+ * before the final header (TCP, UDP, ...), so we'd need to walk that
+ * chain (see RFC 2460 and RFC 6564 for details).
+ *
+ * In practice, "most typically used" extension headers (AH, routing,
+ * fragment, mobility) are very unlikely to be seen inside an OpenVPN
+ * tun, so for now, we only handle the case of "single next header = TCP"
+ */
+void
+mss_fixup_ipv6(struct buffer *buf, int maxmss)
+{
+    struct ip_packet_info ipi;
 
-    /* skip IPv6 header (40 bytes),
-     * verify remainder is large enough to contain a full TCP header
-     */
-    newbuf = *buf;
-    if (buf_advance( &newbuf, 40 )
-        && BLEN(&newbuf) >= (int) sizeof(struct openvpn_tcphdr))
+    ip_packet_parse(DEV_TYPE_TUN, buf, &ipi);
+    if (ipi.version == 6)
     {
-        struct openvpn_tcphdr *tc = (struct openvpn_tcphdr *) BPTR(&newbuf);
-        if (tc->flags & OPENVPN_TCPH_SYN_MASK)
-        {
-            mss_fixup_dowork(&newbuf, (uint16_t) maxmss-20);
-        }
+        mss_fixup_packet(buf, &ipi, maxmss);
     }
 }
 
@@ -352,11 +345,16 @@ frame_calculate_dynamic(struct frame *frame, struct key_type *kt,
  */
 void
 frame_adjust_path_mtu(struct context *c)
+{
+    frame_apply_path_mtu(c, c->c2.link_socket->mtu, "path MTU discovery");
+}
+
+void
+frame_apply_path_mtu(struct context *c, int pmtu, const char *source)
 {
     struct link_socket_info *lsi = get_link_socket_info(c);
     struct options *o = &c->options;
 
-    int pmtu = c->c2.link_socket->mtu;
     sa_family_t af = lsi->lsa->actual.dest.addr.sa.sa_family;
     int proto = lsi->proto;
 
@@ -368,8 +366,8 @@ frame_adjust_path_mtu(struct context *c)
     {
         const char *mtustr = o->ce.mssfix_encap ? " mtu" : "";
         msg(D_MTU_INFO, "Note adjusting 'mssfix %d%s' to 'mssfix %d mtu' "
-            "according to path MTU discovery", o->ce.mssfix,
-            mtustr, pmtu);
+            "according to %s", o->ce.mssfix,
+            mtustr, pmtu, source);
         o->ce.mssfix = pmtu;
         o->ce.mssfix_encap = true;
         frame_calculate_dynamic(&c->c2.frame, &c->c1.ks.key_type, o, lsi);
@@ -381,8 +379,8 @@ frame_adjust_path_mtu(struct context *c)
     {
         const char *mtustr = o->ce.fragment_encap ? " mtu" : "";
         msg(D_MTU_INFO, "Note adjusting 'fragment %d%s' to 'fragment %d mtu' "
-            "according to path MTU discovery", o->ce.fragment,
-            mtustr, pmtu);
+            "according to %s", o->ce.fragment,
+            mtustr, pmtu, source);
         o->ce.fragment = pmtu;
         o->ce.fragment_encap = true;
         frame_calculate_dynamic(&c->c2.frame_fragment, &c->c1.ks.key_type,
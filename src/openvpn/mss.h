@@ -29,6 +29,15 @@
 #include "mtu.h"
 #include "ssl_common.h"
 
+/**
+ * Lower the MSS option of a TCP SYN packet from or to the tun device.
+ *
+ * @param buf       the packet, including any link layer header
+ * @param ipi       its headers, as parsed by ip_packet_parse()
+ * @param maxmss    the MSS to enforce for IPv4, 20 less is used for IPv6
+ */
+void mss_fixup_packet(struct buffer *buf, const struct ip_packet_info *ipi, int maxmss);
+
 void mss_fixup_ipv4(struct buffer *buf, int maxmss);
 
 void mss_fixup_ipv6(struct buffer *buf, int maxmss);
@@ -47,4 +56,13 @@ void frame_calculate_dynamic(struct frame *frame, struct key_type *kt,
  */
 void frame_adjust_path_mtu(struct context *c);
 
+/**
+ * Lower the fragment and mssfix values to fit a path MTU of \c pmtu
+ * bytes, including the IP and UDP headers.
+ * @param c       context to adjust
+ * @param pmtu    the path MTU
+ * @param source  where the value comes from, for the log
+ */
+void frame_apply_path_mtu(struct context *c, int pmtu, const char *source);
+
 #endif /* ifndef MSS_H */
@@ -37,20 +37,24 @@
 
 #include "error.h"
 #include "misc.h"
+#include "otime.h"
 #include "mstats.h"
 
 #include "memdbg.h"
 
 volatile struct mmap_stats *mmap_stats = NULL; /* GLOBAL */
 static char mmap_fn[128];
+static size_t mmap_size;
+static time_t mmap_updated; /* GLOBAL */
 
 void
-mstats_open(const char *fn)
+mstats_open(const char *fn, int n_slots)
 {
     void *data;
     ssize_t stat;
     int fd;
     struct mmap_stats ms;
+    const size_t size = sizeof(ms) + n_slots * sizeof(struct mmap_stats_client);
 
     if (mmap_stats) /* already called? */
     {
@@ -72,11 +76,12 @@ mstats_open(const char *fn)
     }
 
     /* set the file to the correct size to contain a
-     * struct mmap_stats, and zero it */
+     * struct mmap_stats and the client slots, and zero it */
     CLEAR(ms);
     ms.state = MSTATS_ACTIVE;
+    ms.n_slots = n_slots;
     stat = write(fd, &ms, sizeof(ms));
-    if (stat != sizeof(ms))
+    if (stat != sizeof(ms) || ftruncate(fd, size))
     {
         msg(M_ERR, "mstats_open: write error: %s", fn);
         close(fd);
@@ -84,7 +89,7 @@ mstats_open(const char *fn)
     }
 
     /* mmap the file */
-    data = mmap(NULL, sizeof(struct mmap_stats), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    data = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
     if (data == MAP_FAILED)
     {
         msg(M_ERR, "mstats_open: write error: %s", fn);
@@ -103,17 +108,44 @@ mstats_open(const char *fn)
 
     /* save a global pointer to memory-mapped region */
     mmap_stats = (struct mmap_stats *)data;
+    mmap_size = size;
 
     msg(M_INFO, "memstats data will be written to %s", fn);
 }
 
+void
+mstats_update(void)
+{
+    extern counter_type link_read_bytes_global;
+    extern counter_type link_write_bytes_global;
+
+    if (mmap_stats && mmap_updated != now)
+    {
+        mmap_stats->link_read_bytes = link_read_bytes_global;
+        mmap_stats->link_write_bytes = link_write_bytes_global;
+        mmap_updated = now;
+    }
+}
+
+volatile struct mmap_stats_client *
+mstats_client(uint32_t peer_id)
+{
+    if (!mmap_stats || peer_id >= (uint32_t)mmap_stats->n_slots)
+    {
+        return NULL;
+    }
+    return (volatile struct mmap_stats_client *)(mmap_stats + 1) + peer_id;
+}
+
 void
 mstats_close(void)
 {
     if (mmap_stats)
     {
+        mmap_updated = 0;
+        mstats_update();
         mmap_stats->state = MSTATS_EXPIRED;
-        if (munmap((void *)mmap_stats, sizeof(struct mmap_stats)))
+        if (munmap((void *)mmap_stats, mmap_size))
         {
             msg(M_WARN | M_ERRNO, "mstats_close: munmap error");
         }
@@ -40,11 +40,47 @@ struct mmap_stats {
 #define MSTATS_ACTIVE  1
 #define MSTATS_EXPIRED 2
     int state;
+
+    int n_slots; /* number of struct mmap_stats_client following this struct */
+};
+
+/*
+ * In server mode, the file continues with one slot per peer-id.  A slot
+ * is in use if its state is MSTATS_ACTIVE.  The slots are rewritten once
+ * per second; seq is odd while a slot is being written, so a reader
+ * should retry if it is odd or changed while reading the slot.
+ */
+struct mmap_stats_client {
+    uint32_t seq;
+    int state;
+    uint32_t peer_id;
+    uint32_t srtt_ms;               /* control channel RTT, 0 if unknown */
+    counter_type bytes_in;
+    counter_type bytes_out;
+    counter_type packets_in;        /* not counted with DCO */
+    counter_type packets_out;
+    int64_t connected_since;
+    int64_t last_activity;          /* last time bytes were received */
+    uint8_t vaddr[4];               /* network byte order, 0 if none */
+    uint8_t vaddr_ipv6[16];
+    char common_name[64];
 };
 
 extern volatile struct mmap_stats *mmap_stats; /* GLOBAL */
 
-void mstats_open(const char *fn);
+void mstats_open(const char *fn, int n_slots);
+
+/*
+ * Returns the slot of a peer-id, or NULL if there is none.
+ */
+volatile struct mmap_stats_client *mstats_client(uint32_t peer_id);
+
+/*
+ * Copy the byte counters into the mapped file.  Called from the
+ * event loops, does the copy at most once per second so that the
+ * data path does not write to the shared page for every packet.
+ */
+void mstats_update(void);
 
 void mstats_close(void);
 
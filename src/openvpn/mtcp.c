@@ -29,12 +29,10 @@
 
 #include "multi.h"
 #include "forward.h"
+#include "pkcs11.h"
 
 #include "memdbg.h"
 
-#ifdef HAVE_SYS_INOTIFY_H
-#include <sys/inotify.h>
-#endif
 
 /*
  * TCP States
@@ -60,9 +58,13 @@
 #define MTCP_MANAGEMENT ((void *)4)
 #define MTCP_FILE_CLOSE_WRITE ((void *)5)
 #define MTCP_DCO        ((void *)6)
+#define MTCP_PKCS11     ((void *)7)
 
 #define MTCP_N           ((void *)16) /* upper bound on MTCP_x */
 
+/* max connections accepted per listen socket event */
+#define MTCP_ACCEPT_BATCH 64
+
 struct ta_iow_flags
 {
     unsigned int flags;
@@ -128,11 +130,10 @@ multi_create_instance_tcp(struct multi_context *m)
     {
         struct hash_element *he;
         const uint32_t hv = hash_value(hash, &mi->real);
-        struct hash_bucket *bucket = hash_bucket(hash, hv);
 
         multi_assign_peer_id(m, mi);
 
-        he = hash_lookup_fast(hash, bucket, &mi->real, hv);
+        he = hash_lookup_fast(hash, &mi->real, hv);
 
         if (he)
         {
@@ -145,7 +146,7 @@ multi_create_instance_tcp(struct multi_context *m)
         }
         else
         {
-            hash_add_fast(hash, bucket, &mi->real, hv, mi);
+            hash_add_fast(hash, &mi->real, hv, mi);
         }
 
         mi->did_real_hash = true;
@@ -252,14 +253,16 @@ multi_tcp_set_global_rw_flags(struct multi_context *m, struct multi_instance *mi
         mi->socket_set_called = true;
         socket_set(mi->context.c2.link_socket,
                    m->mtcp->es,
-                   mbuf_defined(mi->tcp_link_out_deferred) ? EVENT_WRITE : EVENT_READ,
+                   ((mbuf_defined(mi->tcp_link_out_deferred)
+                     || link_socket_tcp_out_pending(mi->context.c2.link_socket))
+                    ? EVENT_WRITE : EVENT_READ) | EVENT_EDGE,
                    mi,
                    &mi->tcp_rwflags);
     }
 }
 
 static inline int
-multi_tcp_wait(const struct context *c,
+multi_tcp_wait(struct context *c,
                struct multi_tcp *mtcp)
 {
     int status;
@@ -280,6 +283,14 @@ multi_tcp_wait(const struct context *c,
         persistent = NULL;
     }
 #endif
+    if (tun_read_residual(c->c1.tuntap))
+    {
+        /* segments of a --tun-offload super-packet are still waiting */
+        mtcp->esr[0].arg = MTCP_TUN;
+        mtcp->esr[0].rwflags = EVENT_READ;
+        mtcp->n_esr = 1;
+        return 1;
+    }
     tun_set(c->c1.tuntap, mtcp->es, EVENT_READ, MTCP_TUN, persistent);
 #if defined(TARGET_LINUX) || defined(TARGET_FREEBSD)
     dco_event_set(&c->c1.tuntap->dco, mtcp->es, MTCP_DCO);
@@ -297,8 +308,23 @@ multi_tcp_wait(const struct context *c,
     event_ctl(mtcp->es, c->c2.inotify_fd, EVENT_READ, MTCP_FILE_CLOSE_WRITE);
 #endif
 
-    status = event_wait(mtcp->es, &c->c2.timeval, mtcp->esr, mtcp->maxevents);
-    update_time();
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    /* signatures finished by --pkcs11-sign-thread */
+    if (pkcs11_sign_event_fd() >= 0)
+    {
+        event_ctl(mtcp->es, pkcs11_sign_event_fd(), EVENT_READ, MTCP_PKCS11);
+    }
+#endif
+
+#ifdef _WIN32
+    /* wake up wintun for packets written to its ring before sleeping */
+    wintun_receive_flush(c->c1.tuntap);
+#endif
+
+    msg_flush();
+    status = event_wait_spin(c, mtcp->es, &c->c2.timeval, mtcp->esr, mtcp->maxevents);
+    update_time_usec();
+    msg_defer_flush();
     mtcp->n_esr = 0;
     if (status > 0)
     {
@@ -327,6 +353,40 @@ multi_tcp_process_outgoing_link_ready(struct multi_context *m, struct multi_inst
     bool ret = true;
     ASSERT(mi);
 
+#ifndef _WIN32
+    struct link_socket *ls = mi->context.c2.link_socket;
+
+    /* first write what the socket did not take the last time */
+    if (link_socket_tcp_out_pending(ls))
+    {
+        link_socket_tcp_flush(ls);
+        if (link_socket_tcp_out_pending(ls))
+        {
+            return ret;
+        }
+    }
+
+    /* collect as many queued packets as fit, and write them at once.
+     * Stop when the instance has a new packet of its own to send, it
+     * is queued behind the remaining ones by the next TA_SOCKET_WRITE */
+    link_socket_tcp_cork(ls);
+    while (link_socket_tcp_out_room(ls) && !LINK_OUT(&mi->context)
+           && mbuf_extract_item(mi->tcp_link_out_deferred, &item)) /* ciphertext IP packet */
+    {
+        dmsg(D_MULTI_TCP, "MULTI TCP: transmitting previously deferred packet");
+
+        ASSERT(mi == item.instance);
+        mi->context.c2.to_link = item.buffer->buf;
+        ret = multi_process_outgoing_link_dowork(m, mi, mpp_flags);
+        mbuf_free_buf(item.buffer);
+        if (!ret)
+        {
+            /* instance has been closed, and its socket with it */
+            return ret;
+        }
+    }
+    link_socket_tcp_flush(ls);
+#else  /* ifndef _WIN32 */
     /* extract from queue */
     if (mbuf_extract_item(mi->tcp_link_out_deferred, &item)) /* ciphertext IP packet */
     {
@@ -341,9 +401,38 @@ multi_tcp_process_outgoing_link_ready(struct multi_context *m, struct multi_inst
         }
         mbuf_free_buf(item.buffer);
     }
+#endif /* ifndef _WIN32 */
     return ret;
 }
 
+/*
+ * Should a packet that has to wait for the TCP socket of mi be sent
+ * ahead of the bulk queued before it?  That is the case for small
+ * packets, such as TCP ACKs and interactive traffic, and with --passtos
+ * for those marked with a DSCP of CS5 or above, such as EF for voice.
+ */
+static bool
+multi_tcp_urgent(const struct multi_context *m, const struct multi_instance *mi,
+                 const struct buffer *buf)
+{
+    if (!m->tcp_queue_priority)
+    {
+        return false;
+    }
+    if (BLEN(buf) <= m->tcp_queue_priority)
+    {
+        return true;
+    }
+#if PASSTOS_CAPABILITY
+    const struct link_socket *ls = mi->context.c2.link_socket;
+    if (ls->ptos_defined && (ls->ptos >> 2) >= 40)
+    {
+        return true;
+    }
+#endif
+    return false;
+}
+
 static bool
 multi_tcp_process_outgoing_link(struct multi_context *m, bool defer, const unsigned int mpp_flags)
 {
@@ -352,20 +441,30 @@ multi_tcp_process_outgoing_link(struct multi_context *m, bool defer, const unsig
 
     if (mi)
     {
-        if (defer || mbuf_defined(mi->tcp_link_out_deferred))
+        if (defer || mbuf_defined(mi->tcp_link_out_deferred)
+            || link_socket_tcp_out_pending(mi->context.c2.link_socket))
         {
             /* save to queue */
             struct buffer *buf = &mi->context.c2.to_link;
             if (BLEN(buf) > 0)
             {
-                struct mbuf_buffer *mb = mbuf_alloc_buf(buf);
+                struct mbuf_buffer *mb = mbuf_alloc_buf(mi->tcp_link_out_deferred, buf);
                 struct mbuf_item item;
 
                 set_prefix(mi);
-                dmsg(D_MULTI_TCP, "MULTI TCP: queuing deferred packet");
                 item.buffer = mb;
                 item.instance = mi;
-                mbuf_add_item(mi->tcp_link_out_deferred, &item);
+                item.source = NULL;
+                if (multi_tcp_urgent(m, mi, buf))
+                {
+                    dmsg(D_MULTI_TCP, "MULTI TCP: queuing deferred packet ahead");
+                    mbuf_add_item_urgent(mi->tcp_link_out_deferred, &item);
+                }
+                else
+                {
+                    dmsg(D_MULTI_TCP, "MULTI TCP: queuing deferred packet");
+                    mbuf_add_item(mi->tcp_link_out_deferred, &item);
+                }
                 mbuf_free_buf(mb);
                 buf_reset(buf);
                 ret = multi_process_post(m, mi, mpp_flags);
@@ -475,7 +574,7 @@ multi_tcp_dispatch(struct multi_context *m, struct multi_instance *mi, const int
             read_incoming_tun(&m->top);
             if (!IS_SIG(&m->top))
             {
-                multi_process_incoming_tun(m, mpp_flags);
+                multi_process_incoming_tun(m, mpp_flags | MPP_SKIP_IDLE);
             }
             break;
 
@@ -488,7 +587,7 @@ multi_tcp_dispatch(struct multi_context *m, struct multi_instance *mi, const int
             clear_prefix();
             if (!IS_SIG(&mi->context))
             {
-                multi_process_incoming_link(m, mi, mpp_flags);
+                multi_process_incoming_link(m, mi, mpp_flags | MPP_SKIP_IDLE);
                 if (!IS_SIG(&mi->context))
                 {
                     stream_buf_read_setup(mi->context.c2.link_socket);
@@ -501,7 +600,7 @@ multi_tcp_dispatch(struct multi_context *m, struct multi_instance *mi, const int
             break;
 
         case TA_TUN_WRITE:
-            multi_process_outgoing_tun(m, mpp_flags);
+            multi_process_outgoing_tun(m, mpp_flags | MPP_SKIP_IDLE);
             break;
 
         case TA_TUN_WRITE_TIMEOUT:
@@ -550,7 +649,7 @@ multi_tcp_post(struct multi_context *m, struct multi_instance *mi, const int act
     {
         flags |= MTP_TUN_OUT;
     }
-    if (LINK_OUT(c))
+    if (LINK_OUT(c) && !(mi && mi->shaper_held))
     {
         flags |= MTP_LINK_OUT;
     }
@@ -683,6 +782,35 @@ multi_tcp_action(struct multi_context *m, struct multi_instance *mi, int action,
     } while (action != TA_UNDEF);
 }
 
+/*
+ * Create instances for the connections waiting on the listen socket,
+ * up to MTCP_ACCEPT_BATCH of them, rather than one per event.
+ */
+static void
+multi_tcp_accept(struct multi_context *m)
+{
+    struct link_socket *ls = m->top.c2.link_socket;
+    ASSERT(ls);
+
+    socket_reset_listen_persistent(ls);
+    for (int i = 0; i < MTCP_ACCEPT_BATCH && link_socket_accept(ls); ++i)
+    {
+        struct multi_instance *mi = multi_create_instance_tcp(m);
+
+        /* the instance failed before taking over the connection */
+        if (socket_defined(ls->accepted_sd))
+        {
+            openvpn_close_socket(ls->accepted_sd);
+            ls->accepted_sd = SOCKET_UNDEFINED;
+        }
+
+        if (mi)
+        {
+            multi_tcp_action(m, mi, TA_INITIAL, false);
+        }
+    }
+}
+
 static void
 multi_tcp_process_io(struct multi_context *m)
 {
@@ -734,14 +862,7 @@ multi_tcp_process_io(struct multi_context *m)
             /* new incoming TCP client attempting to connect? */
             else if (e->arg == MTCP_SOCKET)
             {
-                struct multi_instance *mi;
-                ASSERT(m->top.c2.link_socket);
-                socket_reset_listen_persistent(m->top.c2.link_socket);
-                mi = multi_create_instance_tcp(m);
-                if (mi)
-                {
-                    multi_tcp_action(m, mi, TA_INITIAL, false);
-                }
+                multi_tcp_accept(m);
             }
 #if defined(ENABLE_DCO) && (defined(TARGET_LINUX) || defined(TARGET_FREEBSD))
             /* incoming data on DCO? */
@@ -760,6 +881,12 @@ multi_tcp_process_io(struct multi_context *m)
             {
                 multi_process_file_closed(m, MPP_PRE_SELECT | MPP_RECORD_TOUCH);
             }
+#endif
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+            else if (e->arg == MTCP_PKCS11)
+            {
+                pkcs11_sign_process_done();
+            }
 #endif
         }
         if (IS_SIG(&m->top))
@@ -814,11 +941,7 @@ tunnel_server_tcp(struct context *top)
     initialization_sequence_completed(top, ISC_SERVER); /* --mode server --proto tcp-server */
 
 #ifdef ENABLE_ASYNC_PUSH
-    multi.top.c2.inotify_fd = inotify_init();
-    if (multi.top.c2.inotify_fd < 0)
-    {
-        msg(D_MULTI_ERRORS | M_ERRNO, "MULTI: inotify_init error");
-    }
+    multi_inotify_init(&multi);
 #endif
 
     /* per-packet event loop */
@@ -834,6 +957,9 @@ tunnel_server_tcp(struct context *top)
         /* check on status of coarse timers */
         multi_process_per_second_timers(&multi);
 
+        /* reap and start --script-workers scripts */
+        script_queue_process(multi.script_queue);
+
         /* timeout? */
         if (status > 0)
         {
@@ -846,6 +972,13 @@ tunnel_server_tcp(struct context *top)
             multi_tcp_action(&multi, NULL, TA_TIMEOUT, false);
         }
 
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+        if (dco_enabled(&multi.top.options))
+        {
+            dco_batch_flush(&multi.top.c1.tuntap->dco);
+        }
+#endif
+
         perf_pop();
     }
 
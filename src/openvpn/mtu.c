@@ -34,6 +34,7 @@
 #include "mtu.h"
 #include "options.h"
 #include "crypto.h"
+#include "fec.h"
 
 #include "memdbg.h"
 
@@ -56,6 +57,12 @@ calc_packet_id_size_dc(const struct options *options, const struct key_type *kt)
 
     bool packet_id_long_form = !tlsmode || cipher_kt_mode_ofb_cfb(kt->cipher);
 
+    if (tlsmode && (options->imported_protocol_flags & CO_EPOCH_DATA_KEY_FORMAT)
+        && cipher_kt_mode_aead(kt->cipher))
+    {
+        return PACKET_ID_EPOCH_SIZE;
+    }
+
     return packet_id_size(packet_id_long_form);
 }
 
@@ -127,6 +134,12 @@ frame_calculate_payload_overhead(size_t extra_tun,
     }
 #endif
 
+    /* Add the header of a --fec repair packet, the largest one */
+    if (options->fec)
+    {
+        overhead += FEC_OVERHEAD;
+    }
+
     if (cipher_kt_mode_cbc(kt->cipher))
     {
         /* The packet id is part of the plain text payload instead of the
@@ -356,6 +369,12 @@ format_extended_socket_error(int fd, int *mtu, struct gc_arena *gc)
             buf_printf(&out, "NO-INFO|");
             goto exit;
         }
+#ifdef SO_EE_ORIGIN_ZEROCOPY
+        if (e->ee_origin == SO_EE_ORIGIN_ZEROCOPY)
+        {
+            continue;           /* MSG_ZEROCOPY completion, not an error */
+        }
+#endif
 
         switch (e->ee_errno)
         {
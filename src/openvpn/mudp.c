@@ -30,13 +30,11 @@
 #include "multi.h"
 #include <inttypes.h>
 #include "forward.h"
+#include "pkcs11.h"
 
 #include "memdbg.h"
 #include "ssl_pkt.h"
 
-#ifdef HAVE_SYS_INOTIFY_H
-#include <sys/inotify.h>
-#endif
 
 static void
 send_hmac_reset_packet(struct multi_context *m,
@@ -74,12 +72,27 @@ do_pre_decrypt_check(struct multi_context *m,
 
     struct tls_auth_standalone *tas = m->top.c2.tls_auth_standalone;
 
-    verdict = tls_pre_decrypt_lite(tas, state, &m->top.c2.from, &m->top.c2.buf);
-
     hmac_ctx_t *hmac = m->top.c2.session_id_hmac;
     struct openvpn_sockaddr *from = &m->top.c2.from.dest;
     int handwindow = m->top.options.handshake_window;
 
+    /* Check the per-prefix limit before unwrapping the packet, which
+     * for tls-crypt(-v2) is the expensive part.  It only counts against
+     * the sender's own network, so it is safe to apply to packets that
+     * have not been authenticated yet. */
+    if (m->prefix_rate_limiter && BLEN(&m->top.c2.buf) > 0)
+    {
+        int op = *BPTR(&m->top.c2.buf) >> P_OPCODE_SHIFT;
+        if ((op == P_CONTROL_HARD_RESET_CLIENT_V2
+             || op == P_CONTROL_HARD_RESET_CLIENT_V3)
+            && !reflect_filter_prefix_check(m->prefix_rate_limiter, from))
+        {
+            return false;
+        }
+    }
+
+    verdict = tls_pre_decrypt_lite(tas, state, &m->top.c2.from, &m->top.c2.buf);
+
     if (verdict == VERDICT_VALID_RESET_V3 || verdict == VERDICT_VALID_RESET_V2)
     {
         /* Check if we are still below our limit for sending out
@@ -122,9 +135,9 @@ do_pre_decrypt_check(struct multi_context *m,
             if (tas->tls_wrap.opt.flags & CO_FORCE_TLSCRYPTV2_COOKIE)
             {
                 struct gc_arena gc = gc_new();
-                const char *peer = print_link_socket_actual(&m->top.c2.from, &gc);
                 msg(D_MULTI_DEBUG, "tls-crypt-v2 force-cookie is enabled, "
-                    "ignoring connection attempt from old client (%s)", peer);
+                    "ignoring connection attempt from old client (%s)",
+                    print_link_socket_actual(&m->top.c2.from, &gc));
                 gc_free(&gc);
                 return false;
             }
@@ -155,19 +168,20 @@ do_pre_decrypt_check(struct multi_context *m,
 
         bool ret = check_session_id_hmac(state, from, hmac, handwindow);
 
-        const char *peer = print_link_socket_actual(&m->top.c2.from, &gc);
         uint8_t pkt_firstbyte = *BPTR( &m->top.c2.buf);
         int op = pkt_firstbyte >> P_OPCODE_SHIFT;
 
         if (!ret)
         {
             msg(D_MULTI_MEDIUM, "Packet (%s) with invalid or missing SID from %s",
-                packet_opcode_name(op), peer);
+                packet_opcode_name(op),
+                print_link_socket_actual(&m->top.c2.from, &gc));
         }
         else
         {
             msg(D_MULTI_DEBUG, "Valid packet (%s) with HMAC challenge from peer (%s), "
-                "accepting new connection.", packet_opcode_name(op), peer);
+                "accepting new connection.", packet_opcode_name(op),
+                print_link_socket_actual(&m->top.c2.from, &gc));
         }
         gc_free(&gc);
 
@@ -197,7 +211,6 @@ multi_get_create_instance_udp(struct multi_context *m, bool *floated)
     {
         struct hash_element *he;
         const uint32_t hv = hash_value(hash, &real);
-        struct hash_bucket *bucket = hash_bucket(hash, hv);
         uint8_t *ptr = BPTR(&m->top.c2.buf);
         uint8_t op = ptr[0] >> P_OPCODE_SHIFT;
         bool v2 = (op == P_DATA_V2) && (m->top.c2.buf.len >= (1 + 3));
@@ -209,13 +222,11 @@ multi_get_create_instance_udp(struct multi_context *m, bool *floated)
             uint32_t peer_id = ntohl(*(uint32_t *)ptr) & 0xFFFFFF;
             peer_id_disabled = (peer_id == MAX_PEER_ID);
 
-            if (!peer_id_disabled && (peer_id < m->max_clients) && (m->instances[peer_id]))
+            if (!peer_id_disabled && (mi = multi_peer_id_lookup(m, peer_id)))
             {
-                mi = m->instances[peer_id];
-
                 *floated = !link_socket_actual_match(&mi->context.c2.from, &m->top.c2.from);
 
-                if (*floated)
+                if (*floated && !mi->context.c2.multipath)
                 {
                     /* reset prefix, since here we are not sure peer is the one it claims to be */
                     ungenerate_prefix(mi);
@@ -226,7 +237,7 @@ multi_get_create_instance_udp(struct multi_context *m, bool *floated)
         }
         if (!v2 || peer_id_disabled)
         {
-            he = hash_lookup_fast(hash, bucket, &real, hv);
+            he = hash_lookup_fast(hash, &real, hv);
             if (he)
             {
                 mi = (struct multi_instance *) he->value;
@@ -255,11 +266,16 @@ multi_get_create_instance_udp(struct multi_context *m, bool *floated)
                     /* a successful three-way handshake only counts against
                      * connect-freq but not against connect-freq-initial */
                     reflect_filter_rate_limit_decrease(m->initial_rate_limiter);
+                    if (m->prefix_rate_limiter)
+                    {
+                        reflect_filter_prefix_decrease(m->prefix_rate_limiter,
+                                                       &m->top.c2.from.dest);
+                    }
 
                     mi = multi_create_instance(m, &real);
                     if (mi)
                     {
-                        hash_add_fast(hash, bucket, &mi->real, hv, mi);
+                        hash_add_fast(hash, &mi->real, hv, mi);
                         mi->did_real_hash = true;
                         multi_assign_peer_id(m, mi);
 
@@ -322,6 +338,76 @@ multi_process_outgoing_link(struct multi_context *m, const unsigned int mpp_flag
     }
 }
 
+/*
+ * Process incoming data on the UDP port or the tun/tap device.
+ */
+static void
+multi_process_input_udp(struct multi_context *m, const unsigned int status,
+                        const unsigned int mpp_flags)
+{
+    /* Incoming data on UDP port */
+    if (status & SOCKET_READ)
+    {
+        read_incoming_link(&m->top);
+        if (!IS_SIG(&m->top))
+        {
+            multi_process_incoming_link(m, NULL, mpp_flags | MPP_RECV_BATCH | MPP_SKIP_IDLE);
+        }
+    }
+    /* Incoming data on TUN device */
+    else if (status & TUN_READ)
+    {
+        read_incoming_tun(&m->top);
+        if (!IS_SIG(&m->top))
+        {
+            multi_process_incoming_tun(m, mpp_flags | MPP_SKIP_IDLE);
+        }
+    }
+}
+
+#ifndef _WIN32
+/*
+ * Incoming data on one of the --listen-extra sockets.  Takes one
+ * datagram, the event loop comes back for the next one.
+ */
+static void
+multi_process_input_udp_extra(struct multi_context *m, const unsigned int mpp_flags)
+{
+    struct context *c = &m->top;
+
+    c->c2.buf = get_context_buffers(c)->read_link_buf;
+    ASSERT(buf_init(&c->c2.buf, c->c2.frame.buf.headroom));
+
+    const int status = link_socket_read_udp_extra(c->c2.link_socket, &c->c2.buf,
+                                                  &c->c2.from);
+    check_status(status, "read", c->c2.link_socket, NULL);
+
+    if (!IS_SIG(c) && c->c2.buf.len > 0)
+    {
+        multi_process_incoming_link(m, NULL, mpp_flags | MPP_SKIP_IDLE);
+    }
+}
+
+/*
+ * Bind the --listen-extra sockets.  Done before init_instance(), which
+ * may drop the privileges needed for low ports.
+ */
+static int
+multi_udp_open_extra(const struct options *o, socket_descriptor_t *sd)
+{
+    int i;
+
+    const struct socket_buffer_size sbs = { o->rcvbuf, o->sndbuf, 0 };
+
+    for (i = 0; i < o->n_listen_extra; ++i)
+    {
+        sd[i] = link_socket_open_udp_extra(o->listen_extra_host[i],
+                                           o->listen_extra_port[i], &sbs);
+    }
+    return i;
+}
+#endif /* ifndef _WIN32 */
+
 /*
  * Process an I/O event.
  */
@@ -367,34 +453,44 @@ multi_process_io_udp(struct multi_context *m)
     }
 #endif
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    if (status & PKCS11_SIGN_DONE)
+    {
+        pkcs11_sign_process_done();
+    }
+#endif
+
     /* UDP port ready to accept write */
     if (status & SOCKET_WRITE)
     {
+        const bool from_mbuf = !m->pending;
+
         multi_process_outgoing_link(m, mpp_flags);
+
+        /* take in a packet for every one sent from the bcast/client-to-client
+         * queue, see p2mp_iow_flags() */
+        if (from_mbuf && !m->pending && !IS_SIG(&m->top))
+        {
+            multi_process_input_udp(m, status, mpp_flags);
+        }
     }
     /* TUN device ready to accept write */
     else if (status & TUN_WRITE)
     {
-        multi_process_outgoing_tun(m, mpp_flags);
+        multi_process_outgoing_tun(m, mpp_flags | MPP_RECV_BATCH | MPP_SKIP_IDLE);
     }
-    /* Incoming data on UDP port */
-    else if (status & SOCKET_READ)
+    /* Incoming data on UDP port or TUN device */
+    else if (status & (SOCKET_READ|TUN_READ))
     {
-        read_incoming_link(&m->top);
-        if (!IS_SIG(&m->top))
-        {
-            multi_process_incoming_link(m, NULL, mpp_flags);
-        }
+        multi_process_input_udp(m, status, mpp_flags);
     }
-    /* Incoming data on TUN device */
-    else if (status & TUN_READ)
+#ifndef _WIN32
+    /* Incoming data on a --listen-extra socket */
+    else if (status & SOCKET_EXTRA_READ)
     {
-        read_incoming_tun(&m->top);
-        if (!IS_SIG(&m->top))
-        {
-            multi_process_incoming_tun(m, mpp_flags);
-        }
+        multi_process_input_udp_extra(m, mpp_flags);
     }
+#endif
 #ifdef ENABLE_ASYNC_PUSH
     /* INOTIFY callback */
     else if (status & FILE_CLOSED)
@@ -431,7 +527,7 @@ p2mp_iow_flags(const struct multi_context *m)
         {
             flags |= IOW_TO_TUN;
         }
-        if (LINK_OUT(&m->pending->context))
+        if (LINK_OUT(&m->pending->context) && !m->pending->shaper_held)
         {
             flags |= IOW_TO_LINK;
         }
@@ -439,6 +535,15 @@ p2mp_iow_flags(const struct multi_context *m)
     else if (mbuf_defined(m->mbuf))
     {
         flags |= IOW_MBUF;
+
+        /* keep reading while the queue drains, so that packets from the
+         * other clients are not held up behind one client's broadcasts.
+         * The queue serves the senders in turn.  Once it is half full,
+         * push back on input again. */
+        if (mbuf_len(m->mbuf) < m->mbuf->capacity / 2)
+        {
+            flags |= IOW_READ;
+        }
     }
     else if (m->hmac_reply_dest)
     {
@@ -446,7 +551,9 @@ p2mp_iow_flags(const struct multi_context *m)
     }
     else
     {
-        flags |= IOW_READ;
+        /* IOW_CHECK_RESIDUAL makes us consume the rest of a
+         * --udp-recv-batch before waiting for new events */
+        flags |= IOW_READ|IOW_CHECK_RESIDUAL;
     }
 #ifdef _WIN32
     if (tuntap_ring_empty(m->top.c1.tuntap))
@@ -466,19 +573,69 @@ tunnel_server_udp(struct context *top)
     top->mode = CM_TOP;
     context_clear_2(top);
 
+#if UNIX_SOCK_SUPPORT
+    /* before init_instance() drops privileges */
+    socket_descriptor_t handoff_listen_sd = SOCKET_UNDEFINED;
+    if (top->options.handoff)
+    {
+        handoff_listen_sd = handoff_listen(top->options.handoff);
+    }
+#endif
+
+#ifndef _WIN32
+    socket_descriptor_t extra_sd[LINK_SOCKET_EXTRA_MAX];
+    const int n_extra = multi_udp_open_extra(&top->options, extra_sd);
+#endif
+
     /* initialize top-tunnel instance */
     init_instance_handle_signals(top, top->es, CC_HARD_USR1_TO_HUP);
     if (IS_SIG(top))
     {
+#ifndef _WIN32
+        for (int i = 0; i < n_extra; ++i)
+        {
+            openvpn_close_socket(extra_sd[i]);
+        }
+#endif
+#if UNIX_SOCK_SUPPORT
+        handoff_close(handoff_listen_sd, top->options.handoff);
+        handoff_free(top->handoff);
+        top->handoff = NULL;
+#endif
         return;
     }
 
+#ifndef _WIN32
+    /* closed along with the main socket */
+    memcpy(top->c2.link_socket->extra_sd, extra_sd, sizeof(extra_sd));
+    top->c2.link_socket->n_extra = n_extra;
+
+    if (top->options.udp_prefilter)
+    {
+        link_socket_set_prefilter(top->c2.link_socket,
+                                  top->options.ce.tls_crypt_v2_file != NULL);
+    }
+#endif
+
     /* initialize global multi_context object */
     multi_init(&multi, top, false);
 
     /* initialize our cloned top object */
     multi_top_init(&multi, top);
 
+#if UNIX_SOCK_SUPPORT
+    multi.handoff_listen_sd = handoff_listen_sd;
+
+    /* set up the clients of the process we replaced */
+    if (top->handoff)
+    {
+        multi.handoff = top->handoff;
+        top->handoff = NULL;
+        multi.top.handoff = NULL;
+        multi_handoff_import(&multi);
+    }
+#endif
+
     /* initialize management interface */
     init_management_callback_multi(&multi);
 
@@ -486,11 +643,7 @@ tunnel_server_udp(struct context *top)
     initialization_sequence_completed(top, ISC_SERVER); /* --mode server --proto udp */
 
 #ifdef ENABLE_ASYNC_PUSH
-    multi.top.c2.inotify_fd = inotify_init();
-    if (multi.top.c2.inotify_fd < 0)
-    {
-        msg(D_MULTI_ERRORS | M_ERRNO, "MULTI: inotify_init error");
-    }
+    multi_inotify_init(&multi);
 #endif
 
     /* per-packet event loop */
@@ -506,6 +659,9 @@ tunnel_server_udp(struct context *top)
         /* check on status of coarse timers */
         multi_process_per_second_timers(&multi);
 
+        /* reap and start --script-workers scripts */
+        script_queue_process(multi.script_queue);
+
         /* timeout? */
         if (multi.top.c2.event_set_status == ES_TIMEOUT)
         {
@@ -518,6 +674,16 @@ tunnel_server_udp(struct context *top)
             MULTI_CHECK_SIG(&multi);
         }
 
+        /* send the datagrams this pass queued for --udp-send-batch */
+        link_socket_send_batch_flush(multi.top.c2.link_socket);
+
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+        if (dco_enabled(&multi.top.options))
+        {
+            dco_batch_flush(&multi.top.c1.tuntap->dco);
+        }
+#endif
+
         perf_pop();
     }
 
@@ -531,6 +697,13 @@ tunnel_server_udp(struct context *top)
     /* save ifconfig-pool */
     multi_ifconfig_pool_persist(&multi, true);
 
+#if UNIX_SOCK_SUPPORT
+    /* the socket file belongs to the new process after a handoff, and
+     * the connection to it stays open until we exit */
+    handoff_close(multi.handoff_listen_sd,
+                  multi.handed_off ? NULL : top->options.handoff);
+#endif
+
     /* tear down tunnel instance (unless --persist-tun) */
     multi_uninit(&multi);
     multi_top_free(&multi);
@@ -41,6 +41,7 @@
 #include "mstats.h"
 #include "ssl_verify.h"
 #include "ssl_ncp.h"
+#include "tls_crypt.h"
 #include "vlan.h"
 #include <inttypes.h>
 
@@ -51,6 +52,9 @@
 #include "ssl_util.h"
 #include "dco.h"
 #include "reflect_filter.h"
+#include "probe.h"
+
+struct object_cache multi_instance_cache = OBJECT_CACHE_INIT(struct multi_instance); /* GLOBAL */
 
 /*#define MULTI_DEBUG_EVENT_LOOP*/
 
@@ -78,6 +82,45 @@ set_cc_config(struct multi_instance *mi, struct buffer_list *cc_config)
 }
 #endif
 
+/*
+ * Timing of the work done for each client, see struct multi_load.
+ */
+static inline uint64_t
+multi_load_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+/* returns 0 if the load is not collected */
+static inline uint64_t
+multi_load_start(void)
+{
+#ifdef ENABLE_MANAGEMENT
+    if (management)
+    {
+        return multi_load_now();
+    }
+#endif
+    return 0;
+}
+
+static inline void
+multi_load_stop(uint64_t *ns, const uint64_t start)
+{
+    if (start)
+    {
+        *ns += multi_load_now() - start;
+    }
+}
+
 static inline void
 update_mstat_n_clients(const int n_clients)
 {
@@ -148,7 +191,18 @@ learn_address_script(const struct multi_context *m,
         {
             argv_printf_cat(&argv, "%s", tls_common_name(mi->context.c2.tls_multi, false));
         }
-        if (!openvpn_run_script(&argv, es, 0, "--learn-address"))
+        if (m->script_queue)
+        {
+            /* the route is learned without waiting for the script, only
+             * its failure to run at all is reported back */
+            if (!script_queue_add(m->script_queue, &argv, es,
+                                  mroute_addr_print(addr, &gc), NULL,
+                                  "--learn-address"))
+            {
+                ret = false;
+            }
+        }
+        else if (!openvpn_run_script(&argv, es, 0, "--learn-address"))
         {
             ret = false;
         }
@@ -171,23 +225,105 @@ multi_ifconfig_pool_persist(struct multi_context *m, bool force)
     }
 }
 
+/*
+ * Time at which r may stop being defined because it has not been
+ * referenced, or 0 if it can only go away with its instance or with
+ * a new iroute generation.
+ */
+static time_t
+multi_route_expiry(const struct multi_context *m, const struct multi_route *r)
+{
+    time_t expiry = 0;
+
+    if (r->flags & MULTI_ROUTE_AGEABLE)
+    {
+        expiry = r->last_reference + m->route_helper->ageable_ttl_secs + 1;
+    }
+    if (m->top.options.stale_routes_check_interval > 0)
+    {
+        const time_t stale = r->last_reference + m->top.options.stale_routes_ageing_time;
+        if (!expiry || stale < expiry)
+        {
+            expiry = stale;
+        }
+    }
+    return expiry;
+}
+
+static bool
+multi_route_stale(const struct multi_context *m, const struct multi_route *r)
+{
+    return m->top.options.stale_routes_check_interval > 0
+           && difftime(now, r->last_reference) >= m->top.options.stale_routes_ageing_time;
+}
+
+/*
+ * Put r in the reaper wheel slot for time when, or take it off the
+ * wheel if when is 0.
+ */
 static void
-multi_reap_range(const struct multi_context *m,
-                 int start_bucket,
-                 int end_bucket)
+multi_reap_schedule(const struct multi_context *m, struct multi_route *r, time_t when)
 {
-    struct gc_arena gc = gc_new();
-    struct hash_iterator hi;
-    struct hash_element *he;
+    struct multi_reap *mr = m->reaper;
+
+    multi_route_unreap(r);
+    r->reap_time = when;
+    if (when)
+    {
+        /* slots up to last_call have been done already */
+        if (when <= mr->last_call)
+        {
+            when = mr->last_call + 1;
+        }
+
+        struct multi_route **slot = &mr->slots[when & (REAP_WHEEL_SLOTS - 1)];
+        r->reap_next = *slot;
+        if (r->reap_next)
+        {
+            r->reap_next->reap_pprev = &r->reap_next;
+        }
+        r->reap_pprev = slot;
+        *slot = r;
+    }
+}
 
-    if (start_bucket < 0)
+static void
+multi_reap_route(const struct multi_context *m, struct multi_route *r)
+{
+    if (r->reap_time > now)
+    {
+        /* due in a later turn of the wheel */
+        multi_reap_schedule(m, r, r->reap_time);
+    }
+    else if (multi_route_defined(m, r) && !multi_route_stale(m, r))
+    {
+        /* referenced since it was scheduled */
+        multi_reap_schedule(m, r, multi_route_expiry(m, r));
+    }
+    else
     {
-        start_bucket = 0;
-        end_bucket = hash_n_buckets(m->vhash);
+        struct gc_arena gc = gc_new();
+        dmsg(D_MULTI_DEBUG, "MULTI: REAP DEL %s",
+             mroute_addr_print(&r->addr, &gc));
+        learn_address_script(m, NULL, "delete", &r->addr);
+        ASSERT(hash_remove(m->vhash, &r->addr));
+        multi_route_del(r);
+        gc_free(&gc);
     }
+}
+
+/*
+ * Remove all routes which are no longer defined, regardless of the
+ * reaper wheel.
+ */
+static void
+multi_reap_all(const struct multi_context *m)
+{
+    struct gc_arena gc = gc_new();
+    struct hash_iterator hi;
+    struct hash_element *he;
 
-    dmsg(D_MULTI_DEBUG, "MULTI: REAP range %d -> %d", start_bucket, end_bucket);
-    hash_iterator_init_range(m->vhash, &hi, start_bucket, end_bucket);
+    hash_iterator_init(m->vhash, &hi);
     while ((he = hash_iterator_next(&hi)) != NULL)
     {
         struct multi_route *r = (struct multi_route *) he->value;
@@ -204,19 +340,11 @@ multi_reap_range(const struct multi_context *m,
     gc_free(&gc);
 }
 
-static void
-multi_reap_all(const struct multi_context *m)
-{
-    multi_reap_range(m, -1, 0);
-}
-
 static struct multi_reap *
-multi_reap_new(int buckets_per_pass)
+multi_reap_new(void)
 {
     struct multi_reap *mr;
-    ALLOC_OBJ(mr, struct multi_reap);
-    mr->bucket_base = 0;
-    mr->buckets_per_pass = buckets_per_pass;
+    ALLOC_OBJ_CLEAR(mr, struct multi_reap);
     mr->last_call = now;
     return mr;
 }
@@ -225,28 +353,52 @@ void
 multi_reap_process_dowork(const struct multi_context *m)
 {
     struct multi_reap *mr = m->reaper;
-    if (mr->bucket_base >= hash_n_buckets(m->vhash))
+    time_t t = mr->last_call;
+
+    /* after a long sleep every slot is done once */
+    if (now - t > REAP_WHEEL_SLOTS)
     {
-        mr->bucket_base = 0;
+        t = now - REAP_WHEEL_SLOTS;
     }
-    multi_reap_range(m, mr->bucket_base, mr->bucket_base + mr->buckets_per_pass);
-    mr->bucket_base += mr->buckets_per_pass;
     mr->last_call = now;
+
+    while (t < now)
+    {
+        struct multi_route **slot = &mr->slots[++t & (REAP_WHEEL_SLOTS - 1)];
+        struct multi_route *list = *slot;
+
+        /* detach the slot, so that routes rescheduled into it are
+         * not looked at again in this pass */
+        *slot = NULL;
+        if (list)
+        {
+            list->reap_pprev = &list;
+        }
+        while (list)
+        {
+            struct multi_route *r = list;
+            multi_route_unreap(r);
+            multi_reap_route(m, r);
+        }
+    }
 }
 
+/*
+ * Routes of a closed instance are removed in the next reaper pass.
+ */
 static void
-multi_reap_free(struct multi_reap *mr)
+multi_reap_instance(const struct multi_context *m, struct multi_instance *mi)
 {
-    free(mr);
+    for (struct multi_route *r = mi->routes; r; r = r->instance_next)
+    {
+        multi_reap_schedule(m, r, now);
+    }
 }
 
-/*
- * How many buckets in vhash to reap per pass.
- */
-static int
-reap_buckets_per_pass(int n_buckets)
+static void
+multi_reap_free(struct multi_reap *mr)
 {
-    return constrain_int(n_buckets / REAP_DIVISOR, REAP_MIN, REAP_MAX);
+    free(mr);
 }
 
 #ifdef ENABLE_MANAGEMENT
@@ -268,20 +420,134 @@ cid_compare_function(const void *key1, const void *key2)
 
 #endif
 
-#ifdef ENABLE_ASYNC_PUSH
-static uint32_t
 /*
- * inotify watcher descriptors are used as hash value
+ * Instances sharing a common name are kept on one list, so that
+ * --duplicate-cn enforcement and the management kill command do not
+ * need to compare the common name of every connected client.
  */
-int_hash_function(const void *key, uint32_t iv)
+struct multi_cn_entry
+{
+    char *cn;
+    struct multi_instance *head;
+};
+
+static uint32_t
+cn_hash_function(const void *key, uint32_t iv)
 {
-    return (unsigned long)key;
+    const char *cn = (const char *)key;
+    return hash_func((const uint8_t *) cn, (uint32_t) strlen(cn), iv);
 }
 
 static bool
-int_compare_function(const void *key1, const void *key2)
+cn_compare_function(const void *key1, const void *key2)
+{
+    return !strcmp((const char *)key1, (const char *)key2);
+}
+
+static void
+multi_cn_index_remove(struct multi_context *m, struct multi_instance *mi)
+{
+    struct multi_cn_entry *e = mi->cn_entry;
+
+    if (!e)
+    {
+        return;
+    }
+
+    *mi->cn_pprev = mi->cn_next;
+    if (mi->cn_next)
+    {
+        mi->cn_next->cn_pprev = mi->cn_pprev;
+    }
+    mi->cn_entry = NULL;
+    mi->cn_next = NULL;
+    mi->cn_pprev = NULL;
+
+    if (!e->head)
+    {
+        ASSERT(hash_remove(m->cn_hash, e->cn));
+        free(e->cn);
+        free(e);
+    }
+}
+
+/*
+ * Called once the common name of an instance has been locked, so
+ * that it cannot change anymore while the instance is on the list.
+ */
+static void
+multi_cn_index_add(struct multi_context *m, struct multi_instance *mi)
+{
+    const char *cn = tls_common_name(mi->context.c2.tls_multi, true);
+
+    if (!cn || mi->cn_entry)
+    {
+        return;
+    }
+
+    const uint32_t hv = hash_value(m->cn_hash, cn);
+    struct hash_element *he = hash_lookup_fast(m->cn_hash, cn, hv);
+    struct multi_cn_entry *e;
+    if (he)
+    {
+        e = (struct multi_cn_entry *) he->value;
+    }
+    else
+    {
+        ALLOC_OBJ_CLEAR(e, struct multi_cn_entry);
+        e->cn = string_alloc(cn, NULL);
+        hash_add_fast(m->cn_hash, e->cn, hv, e);
+    }
+
+    mi->cn_next = e->head;
+    if (e->head)
+    {
+        e->head->cn_pprev = &mi->cn_next;
+    }
+    mi->cn_pprev = &e->head;
+    e->head = mi;
+    mi->cn_entry = e;
+}
+
+static void
+multi_cn_index_free(struct multi_context *m)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(m->cn_hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_cn_entry *e = (struct multi_cn_entry *) he->value;
+        hash_iterator_delete_element(&hi);
+        free(e->cn);
+        free(e);
+    }
+    hash_iterator_free(&hi);
+    hash_free(m->cn_hash);
+    m->cn_hash = NULL;
+}
+
+static struct multi_instance *
+multi_cn_index_lookup(struct multi_context *m, const char *cn)
+{
+    const struct multi_cn_entry *e = hash_lookup(m->cn_hash, cn);
+    return e ? e->head : NULL;
+}
+
+#ifdef ENABLE_ASYNC_PUSH
+/*
+ * Forget the file in --tmp-dir that is watched for mi.
+ */
+static void
+multi_inotify_remove(struct multi_context *m, struct multi_instance *mi)
 {
-    return (unsigned long)key1 == (unsigned long)key2;
+    if (mi->inotify_file)
+    {
+        hash_remove(m->inotify_watchers, mi->inotify_file);
+        free(mi->inotify_file);
+        mi->inotify_file = NULL;
+    }
 }
 #endif
 
@@ -307,6 +573,11 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
      */
     CLEAR(*m);
 
+    /*
+     * Format the push list shared by all clients once.
+     */
+    push_reply_cache_init(&t->options);
+
     /*
      * Real address hash table (source port number is
      * considered to be part of the address).  Used
@@ -328,15 +599,30 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
                          mroute_addr_compare_function);
 
     /*
-     * This hash table is a clone of m->hash but with a
-     * bucket size of one so that it can be used
-     * for fast iteration through the list.
+     * This hash table is a clone of m->hash but starts
+     * at the smallest size, so that iterating over it
+     * costs in proportion to the number of clients
+     * rather than to --hash-size.
      */
     m->iter = hash_init(1,
                         get_random(),
                         mroute_addr_hash_function,
                         mroute_addr_compare_function);
 
+    /*
+     * Instances by PVID, so that VLAN broadcasts only
+     * visit the members of that VLAN.
+     */
+    vlan_index_init(m, &t->options);
+
+    /*
+     * Instances by common name, see multi_cn_index_add().
+     */
+    m->cn_hash = hash_init(t->options.real_hash_size,
+                           get_random(),
+                           cn_hash_function,
+                           cn_compare_function);
+
 #ifdef ENABLE_MANAGEMENT
     m->cid_hash = hash_init(t->options.real_hash_size,
                             0,
@@ -346,13 +632,13 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
 
 #ifdef ENABLE_ASYNC_PUSH
     /*
-     * Mapping between inotify watch descriptors and
-     * multi_instances.
+     * Mapping between the names of watched files in --tmp-dir
+     * and multi_instances.
      */
     m->inotify_watchers = hash_init(t->options.real_hash_size,
                                     get_random(),
-                                    int_hash_function,
-                                    int_compare_function);
+                                    cn_hash_function,
+                                    cn_compare_function);
 #endif
 
     /*
@@ -369,6 +655,50 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
                                                      t->options.cf_per);
     m->initial_rate_limiter = initial_rate_limit_init(t->options.cf_initial_max,
                                                       t->options.cf_initial_per);
+    if (t->options.cf_prefix_max)
+    {
+        m->prefix_rate_limiter = prefix_rate_limit_init(t->options.cf_prefix_max,
+                                                        t->options.cf_prefix_per,
+                                                        t->options.cf_prefix_ipv4_bits,
+                                                        t->options.cf_prefix_ipv6_bits);
+    }
+
+    if (t->options.ccd_cache)
+    {
+        m->ccd_cache = ccd_cache_new(t->options.ccd_cache);
+    }
+
+    m->replica = replica_new(&t->options);
+
+    if (t->options.mcast_snooping)
+    {
+        m->mcast_snoop = mcast_snoop_new(t->options.mcast_snooping);
+    }
+
+    if (t->options.neighbor_proxy)
+    {
+        m->neighbor_proxy = neighbor_proxy_new(t->options.neighbor_proxy);
+    }
+
+    if (t->options.script_workers)
+    {
+        m->script_queue = script_queue_new(t->options.script_workers);
+        if (t->c1.ks.tls_crypt_v2_verify_cache)
+        {
+            tls_crypt_v2_verify_cache_set_queue(t->c1.ks.tls_crypt_v2_verify_cache,
+                                                m->script_queue);
+        }
+    }
+
+    /*
+     * Limit the renegotiations started because of
+     * --reneg-sec, to spread them out over time.
+     */
+    if (t->options.reneg_freq_per)
+    {
+        m->reneg_limiter = frequency_limit_init(t->options.reneg_freq_max,
+                                                t->options.reneg_freq_per);
+    }
 
     /*
      * Allocate broadcast/multicast buffer list
@@ -419,7 +749,7 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
     /*
      * Initialize route and instance reaper.
      */
-    m->reaper = multi_reap_new(reap_buckets_per_pass(t->options.virtual_hash_size));
+    m->reaper = multi_reap_new();
 
     /*
      * Get local ifconfig address
@@ -432,9 +762,23 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
      * Per-client limits
      */
     m->max_clients = t->options.max_clients;
+    m->peer_id_index_mask = MAX_PEER_ID >> t->options.peer_id_node_bits;
+    m->peer_id_node = (uint32_t) t->options.peer_id_node
+                      << (24 - t->options.peer_id_node_bits);
 
     m->instances = calloc(m->max_clients, sizeof(struct multi_instance *));
 
+    /*
+     * Keep the structures of up to max_clients disconnected clients for
+     * reuse, so that a reconnect storm does not churn the heap.  With
+     * --huge-pages they are carved out of 2 MB pages to spare the TLB.
+     */
+    huge_chunks_enable(t->options.huge_pages);
+    object_cache_use_huge_pages(&multi_instance_cache);
+    object_cache_use_huge_pages(&tls_multi_cache);
+    object_cache_set_limit(&multi_instance_cache, m->max_clients);
+    object_cache_set_limit(&tls_multi_cache, m->max_clients);
+
     /*
      * Initialize multi-socket TCP I/O wait object
      */
@@ -443,6 +787,18 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
         m->mtcp = multi_tcp_init(t->options.max_clients, &m->max_clients);
     }
     m->tcp_queue_limit = t->options.tcp_queue_limit;
+    m->tcp_queue_priority = t->options.tcp_queue_priority;
+
+    /*
+     * Limit the output to all clients together?
+     */
+    m->shaper_tail = &m->shaper_head;
+    if (t->options.shaper_total)
+    {
+        shaper_init(&m->shaper, t->options.shaper_total, t->options.shaper_total_burst);
+        msg(M_INFO, "Total output traffic shaping at %d bytes per second, burst %d bytes",
+            m->shaper.bytes_per_second, m->shaper.burst);
+    }
 
     /*
      * Allow client <-> client communication, without going through
@@ -450,15 +806,18 @@ multi_init(struct multi_context *m, struct context *t, bool tcp_mode)
      */
     m->enable_c2c = t->options.enable_c2c;
 
-    /* initialize stale routes check timer */
     if (t->options.stale_routes_check_interval > 0)
     {
-        msg(M_INFO, "Initializing stale route check timer to run every %i seconds and to removing routes with activity timeout older than %i seconds",
-            t->options.stale_routes_check_interval, t->options.stale_routes_ageing_time);
-        event_timeout_init(&m->stale_routes_check_et, t->options.stale_routes_check_interval, 0);
+        msg(M_INFO, "Removing routes with activity timeout older than %i seconds",
+            t->options.stale_routes_ageing_time);
     }
 
     m->deferred_shutdown_signal.signal_received = 0;
+
+#if UNIX_SOCK_SUPPORT
+    m->handoff_listen_sd = SOCKET_UNDEFINED;
+    m->handoff_sd = SOCKET_UNDEFINED;
+#endif
 }
 
 const char *
@@ -516,10 +875,46 @@ ungenerate_prefix(struct multi_instance *mi)
     set_prefix(mi);
 }
 
+/*
+ * Build the vhash key of an IPv4 (host order) or IPv6 address, which
+ * is a network if netbits >= 0.
+ */
+static void
+multi_mroute_addr_in4(struct mroute_addr *addr, in_addr_t a, int netbits)
+{
+    struct openvpn_sockaddr remote_si;
+
+    CLEAR(remote_si);
+    remote_si.addr.in4.sin_family = AF_INET;
+    remote_si.addr.in4.sin_addr.s_addr = htonl(a);
+    ASSERT(mroute_extract_openvpn_sockaddr(addr, &remote_si, false));
+
+    if (netbits >= 0)
+    {
+        addr->type |= MR_WITH_NETBITS;
+        addr->netbits = (uint8_t) netbits;
+    }
+}
+
+static void
+multi_mroute_addr_in6(struct mroute_addr *addr, struct in6_addr a6, int netbits)
+{
+    addr->len = 16;
+    addr->type = MR_ADDR_IPV6;
+    addr->netbits = 0;
+    addr->v6.addr = a6;
+
+    if (netbits >= 0)
+    {
+        addr->type |= MR_WITH_NETBITS;
+        addr->netbits = (uint8_t) netbits;
+        mroute_addr_mask_host_bits(addr);
+    }
+}
+
 /*
  * Tell the route helper about deleted iroutes so
- * that it can update its mask of currently used
- * CIDR netlengths.
+ * that it can remove them from its prefix tries.
  */
 static void
 multi_del_iroutes(struct multi_context *m,
@@ -527,6 +922,7 @@ multi_del_iroutes(struct multi_context *m,
 {
     const struct iroute *ir;
     const struct iroute_ipv6 *ir6;
+    struct mroute_addr net;
 
     dco_delete_iroutes(m, mi);
 
@@ -534,12 +930,14 @@ multi_del_iroutes(struct multi_context *m,
     {
         for (ir = mi->context.options.iroutes; ir != NULL; ir = ir->next)
         {
-            mroute_helper_del_iroute46(m->route_helper, ir->netbits);
+            multi_mroute_addr_in4(&net, ir->network, ir->netbits);
+            mroute_helper_del_iroute46(m->route_helper, &net);
         }
 
         for (ir6 = mi->context.options.iroutes_ipv6; ir6 != NULL; ir6 = ir6->next)
         {
-            mroute_helper_del_iroute46(m->route_helper, ir6->netbits);
+            multi_mroute_addr_in6(&net, ir6->network, ir6->netbits);
+            mroute_helper_del_iroute46(m->route_helper, &net);
         }
     }
 }
@@ -547,9 +945,12 @@ multi_del_iroutes(struct multi_context *m,
 static void
 setenv_stats(struct multi_context *m, struct context *c)
 {
-    if (dco_enabled(&m->top.options))
+    /* only ask for the stats of this peer, many clients may disconnect
+     * at the same time */
+    if (dco_enabled(&m->top.options) && c->c2.tls_multi
+        && c->c2.tls_multi->dco_peer_id != -1)
     {
-        dco_get_peer_stats_multi(&m->top.c1.tuntap->dco, m);
+        dco_get_peer_stats(c);
     }
 
     setenv_counter(c->c2.es, "bytes_received", c->c2.link_read_bytes + c->c2.dco_read_bytes);
@@ -598,6 +999,9 @@ multi_client_disconnect_script(struct multi_context *m, struct multi_instance *m
 #endif
 }
 
+static void
+multi_shaper_dequeue(struct multi_context *m, struct multi_instance *mi);
+
 void
 multi_close_instance(struct multi_context *m,
                      struct multi_instance *mi,
@@ -607,8 +1011,10 @@ multi_close_instance(struct multi_context *m,
 
     ASSERT(!mi->halt);
     mi->halt = true;
+    multi_reap_instance(m, mi);
 
     dmsg(D_MULTI_DEBUG, "MULTI: multi_close_instance called");
+    OVPN_PROBE4(instance_close, mi, trace_peer(&mi->context), now - mi->created, shutdown);
 
     /* adjust current client connection count */
     m->n_clients += mi->n_clients_delta;
@@ -624,6 +1030,7 @@ multi_close_instance(struct multi_context *m,
     {
         m->earliest_wakeup = NULL;
     }
+    multi_shaper_dequeue(m, mi);
 
     if (!shutdown)
     {
@@ -635,6 +1042,16 @@ multi_close_instance(struct multi_context *m,
         {
             ASSERT(hash_remove(m->iter, &mi->real));
         }
+        vlan_index_remove(m, mi);
+        multi_cn_index_remove(m, mi);
+        if (m->mcast_snoop)
+        {
+            mcast_snoop_remove_instance(m->mcast_snoop, mi);
+        }
+        if (m->neighbor_proxy)
+        {
+            neighbor_proxy_remove_instance(m->neighbor_proxy, mi);
+        }
 #ifdef ENABLE_MANAGEMENT
         if (mi->did_cid_hash)
         {
@@ -643,16 +1060,21 @@ multi_close_instance(struct multi_context *m,
 #endif
 
 #ifdef ENABLE_ASYNC_PUSH
-        if (mi->inotify_watch != -1)
+        multi_inotify_remove(m, mi);
+#endif
+
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+        /* queued key operations must not outlive the peer-id */
+        if (dco_enabled(&m->top.options))
         {
-            hash_remove(m->inotify_watchers, (void *) (unsigned long)mi->inotify_watch);
-            mi->inotify_watch = -1;
+            dco_batch_flush(&m->top.c1.tuntap->dco);
         }
 #endif
 
-        if (mi->context.c2.tls_multi->peer_id != MAX_PEER_ID)
+        const int index = multi_peer_id_index(m, mi->context.c2.tls_multi->peer_id);
+        if (index >= 0 && m->instances[index] == mi)
         {
-            m->instances[mi->context.c2.tls_multi->peer_id] = NULL;
+            m->instances[index] = NULL;
         }
 
         schedule_remove_entry(m->schedule, (struct schedule_entry *) mi);
@@ -677,7 +1099,19 @@ multi_close_instance(struct multi_context *m,
     set_cc_config(mi, NULL);
 #endif
 
-    if (mi->context.c2.tls_multi->multi_state >= CAS_CONNECT_DONE)
+    /* the peer server keeps the clients of a server that shuts down */
+    if (!shutdown && mi->context.c2.tls_multi->multi_state >= CAS_CONNECT_DONE)
+    {
+        replica_client_down(m->replica,
+                            tls_common_name(mi->context.c2.tls_multi, true));
+    }
+
+    /* clients handed off with --handoff are still connected */
+    if (mi->context.c2.tls_multi->multi_state >= CAS_CONNECT_DONE
+#if UNIX_SOCK_SUPPORT
+        && !m->handed_off
+#endif
+        )
     {
         multi_client_disconnect_script(m, mi);
     }
@@ -706,6 +1140,13 @@ multi_uninit(struct multi_context *m)
 {
     if (m->hash)
     {
+        /* drop a partly generated status file */
+        if (m->status_section != MULTI_STATUS_IDLE)
+        {
+            status_reset(m->top.c1.status_output);
+            m->status_section = MULTI_STATUS_IDLE;
+        }
+
         struct hash_iterator hi;
         struct hash_element *he;
 
@@ -723,10 +1164,12 @@ multi_uninit(struct multi_context *m)
         hash_free(m->hash);
         hash_free(m->vhash);
         hash_free(m->iter);
+        multi_cn_index_free(m);
 #ifdef ENABLE_MANAGEMENT
         hash_free(m->cid_hash);
 #endif
         m->hash = NULL;
+        vlan_index_free(m);
 
         free(m->instances);
 
@@ -739,17 +1182,44 @@ multi_uninit(struct multi_context *m)
         mbuf_free(m->mbuf);
         ifconfig_pool_free(m->ifconfig_pool);
         frequency_limit_free(m->new_connection_limiter);
+        frequency_limit_free(m->reneg_limiter);
         initial_rate_limit_free(m->initial_rate_limiter);
+        prefix_rate_limit_free(m->prefix_rate_limiter);
+        ccd_cache_free(m->ccd_cache);
+        replica_free(m->replica);
+        m->replica = NULL;
+        mcast_snoop_free(m->mcast_snoop);
+        neighbor_proxy_free(m->neighbor_proxy);
         multi_reap_free(m->reaper);
         mroute_helper_free(m->route_helper);
         multi_tcp_free(m->mtcp);
+
+        /* runs the learn-address "delete" calls queued above */
+        if (m->top.c1.ks.tls_crypt_v2_verify_cache)
+        {
+            tls_crypt_v2_verify_cache_set_queue(m->top.c1.ks.tls_crypt_v2_verify_cache,
+                                                NULL);
+        }
+        script_queue_free(m->script_queue);
+        m->script_queue = NULL;
+
+        object_cache_set_limit(&multi_instance_cache, 0);
+        object_cache_set_limit(&tls_multi_cache, 0);
+
+#if UNIX_SOCK_SUPPORT
+        handoff_free(m->handoff);
+        m->handoff = NULL;
+#endif
     }
 }
 
 /*
  * Create a client instance object for a newly connected client.
  */
-struct multi_instance *
+static void
+multi_async_wakeup(void *ctx, void *arg);
+
+struct multi_instance *
 multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
 {
     struct gc_arena gc = gc_new();
@@ -759,7 +1229,7 @@ multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
 
     msg(D_MULTI_MEDIUM, "MULTI: multi_create_instance called");
 
-    ALLOC_OBJ_CLEAR(mi, struct multi_instance);
+    mi = object_cache_alloc(&multi_instance_cache);
 
     mi->gc = gc_new();
     multi_instance_inc_refcount(mi);
@@ -780,6 +1250,10 @@ multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
     }
 
     mi->context.c2.tls_multi->multi_state = CAS_NOT_CONNECTED;
+    mi->context.c2.tls_multi->opt.reneg_limiter = m->reneg_limiter;
+    mi->context.c2.tls_multi->opt.async_wakeup = multi_async_wakeup;
+    mi->context.c2.tls_multi->opt.async_wakeup_ctx = m;
+    mi->context.c2.tls_multi->opt.async_wakeup_arg = mi;
 
     if (hash_n_elements(m->hash) >= m->max_clients)
     {
@@ -803,6 +1277,7 @@ multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
         goto err;
     }
     mi->did_iter = true;
+    vlan_index_update(m, mi);
 
 #ifdef ENABLE_MANAGEMENT
     do
@@ -813,9 +1288,6 @@ multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
 #endif
 
     mi->context.c2.push_request_received = false;
-#ifdef ENABLE_ASYNC_PUSH
-    mi->inotify_watch = -1;
-#endif
 
     if (!multi_process_post(m, mi, MPP_PRE_SELECT))
     {
@@ -823,6 +1295,7 @@ multi_create_instance(struct multi_context *m, const struct mroute_addr *real)
         goto err;
     }
 
+    OVPN_PROBE2(instance_create, mi, m->n_clients);
     perf_pop();
     gc_free(&gc);
     return mi;
@@ -835,207 +1308,279 @@ err:
 }
 
 /*
- * Dump tables -- triggered by SIGUSR2.
- * If status file is defined, write to file.
- * If status file is NULL, write to syslog.
+ * Fetch the DCO counters of all peers. Several users in the same second,
+ * e.g. the status file and management clients, share one dump.
  */
-void
-multi_print_status(struct multi_context *m, struct status_output *so, const int version)
+static void
+multi_dco_update_stats(struct multi_context *m)
 {
-    if (m->hash)
+    if (dco_enabled(&m->top.options) && m->dco_stats_updated != now)
     {
-        struct gc_arena gc_top = gc_new();
-        struct hash_iterator hi;
-        const struct hash_element *he;
+        dco_get_peer_stats_multi(&m->top.c1.tuntap->dco, m);
+        m->dco_stats_updated = now;
+    }
+}
 
-        status_reset(so);
+static void
+multi_print_status_client(struct status_output *so,
+                          const struct multi_instance *mi, const int version)
+{
+    struct gc_arena gc = gc_new();
 
-        if (dco_enabled(&m->top.options))
-        {
-            dco_get_peer_stats_multi(&m->top.c1.tuntap->dco, m);
-        }
+    if (version == 1)
+    {
+        status_printf(so, "%s,%s," counter_format "," counter_format ",%s",
+                      tls_common_name(mi->context.c2.tls_multi, false),
+                      mroute_addr_print(&mi->real, &gc),
+                      mi->context.c2.link_read_bytes + mi->context.c2.dco_read_bytes,
+                      mi->context.c2.link_write_bytes + mi->context.c2.dco_write_bytes,
+                      time_string(mi->created, 0, false, &gc));
+    }
+    else
+    {
+        const char sep = (version == 3) ? '\t' : ',';
 
-        if (version == 1)
-        {
-            /*
-             * Status file version 1
-             */
-            status_printf(so, "OpenVPN CLIENT LIST");
-            status_printf(so, "Updated,%s", time_string(0, 0, false, &gc_top));
-            status_printf(so, "Common Name,Real Address,Bytes Received,Bytes Sent,Connected Since");
-            hash_iterator_init(m->hash, &hi);
-            while ((he = hash_iterator_next(&hi)))
-            {
-                struct gc_arena gc = gc_new();
-                const struct multi_instance *mi = (struct multi_instance *) he->value;
+        status_printf(so, "CLIENT_LIST%c%s%c%s%c%s%c%s%c" counter_format "%c" counter_format "%c%s%c%u%c%s%c"
+#ifdef ENABLE_MANAGEMENT
+                      "%lu"
+#else
+                      ""
+#endif
+                      "%c%" PRIu32 "%c%s",
+                      sep, tls_common_name(mi->context.c2.tls_multi, false),
+                      sep, mroute_addr_print(&mi->real, &gc),
+                      sep, print_in_addr_t(mi->reporting_addr, IA_EMPTY_IF_UNDEF, &gc),
+                      sep, print_in6_addr(mi->reporting_addr_ipv6, IA_EMPTY_IF_UNDEF, &gc),
+                      sep, mi->context.c2.link_read_bytes + mi->context.c2.dco_read_bytes,
+                      sep, mi->context.c2.link_write_bytes + mi->context.c2.dco_write_bytes,
+                      sep, time_string(mi->created, 0, false, &gc),
+                      sep, (unsigned int)mi->created,
+                      sep, tls_username(mi->context.c2.tls_multi, false),
+#ifdef ENABLE_MANAGEMENT
+                      sep, mi->context.c2.mda_context.cid,
+#else
+                      sep,
+#endif
+                      sep, mi->context.c2.tls_multi ? mi->context.c2.tls_multi->peer_id : UINT32_MAX,
+                      sep, translate_cipher_name_to_openvpn(mi->context.options.ciphername));
+    }
+    gc_free(&gc);
+}
 
-                if (!mi->halt)
-                {
-                    status_printf(so, "%s,%s," counter_format "," counter_format ",%s",
-                                  tls_common_name(mi->context.c2.tls_multi, false),
-                                  mroute_addr_print(&mi->real, &gc),
-                                  mi->context.c2.link_read_bytes + mi->context.c2.dco_read_bytes,
-                                  mi->context.c2.link_write_bytes + mi->context.c2.dco_write_bytes,
-                                  time_string(mi->created, 0, false, &gc));
-                }
-                gc_free(&gc);
-            }
-            hash_iterator_free(&hi);
+static void
+multi_print_status_route(struct status_output *so,
+                         const struct multi_route *route, const int version)
+{
+    struct gc_arena gc = gc_new();
+    const struct multi_instance *mi = route->instance;
+    const struct mroute_addr *ma = &route->addr;
+    char flags[2] = {0, 0};
 
-            status_printf(so, "ROUTING TABLE");
-            status_printf(so, "Virtual Address,Common Name,Real Address,Last Ref");
-            hash_iterator_init(m->vhash, &hi);
-            while ((he = hash_iterator_next(&hi)))
-            {
-                struct gc_arena gc = gc_new();
-                const struct multi_route *route = (struct multi_route *) he->value;
+    if (route->flags & MULTI_ROUTE_CACHE)
+    {
+        flags[0] = 'C';
+    }
 
-                if (multi_route_defined(m, route))
-                {
-                    const struct multi_instance *mi = route->instance;
-                    const struct mroute_addr *ma = &route->addr;
-                    char flags[2] = {0, 0};
+    if (version == 1)
+    {
+        status_printf(so, "%s%s,%s,%s,%s",
+                      mroute_addr_print(ma, &gc),
+                      flags,
+                      tls_common_name(mi->context.c2.tls_multi, false),
+                      mroute_addr_print(&mi->real, &gc),
+                      time_string(route->last_reference, 0, false, &gc));
+    }
+    else
+    {
+        const char sep = (version == 3) ? '\t' : ',';
 
-                    if (route->flags & MULTI_ROUTE_CACHE)
-                    {
-                        flags[0] = 'C';
-                    }
-                    status_printf(so, "%s%s,%s,%s,%s",
-                                  mroute_addr_print(ma, &gc),
-                                  flags,
-                                  tls_common_name(mi->context.c2.tls_multi, false),
-                                  mroute_addr_print(&mi->real, &gc),
-                                  time_string(route->last_reference, 0, false, &gc));
-                }
-                gc_free(&gc);
-            }
-            hash_iterator_free(&hi);
+        status_printf(so, "ROUTING_TABLE%c%s%s%c%s%c%s%c%s%c%u",
+                      sep, mroute_addr_print(ma, &gc), flags,
+                      sep, tls_common_name(mi->context.c2.tls_multi, false),
+                      sep, mroute_addr_print(&mi->real, &gc),
+                      sep, time_string(route->last_reference, 0, false, &gc),
+                      sep, (unsigned int)route->last_reference);
+    }
+    gc_free(&gc);
+}
 
-            status_printf(so, "GLOBAL STATS");
-            if (m->mbuf)
-            {
-                status_printf(so, "Max bcast/mcast queue length,%d",
-                              mbuf_maximum_queued(m->mbuf));
-            }
+/*
+ * Print the lines of bucket range [start, end) of the client hash
+ * (MULTI_STATUS_CLIENTS) or the route hash (MULTI_STATUS_ROUTES).
+ */
+static void
+multi_print_status_range(struct multi_context *m, struct status_output *so,
+                         const int version, const int section,
+                         const int start, const int end)
+{
+    struct hash_iterator hi;
+    const struct hash_element *he;
 
-            status_printf(so, "END");
-        }
-        else if (version == 2 || version == 3)
+    if (section == MULTI_STATUS_CLIENTS)
+    {
+        hash_iterator_init_range(m->hash, &hi, start, end);
+        while ((he = hash_iterator_next(&hi)))
         {
-            const char sep = (version == 3) ? '\t' : ',';
+            const struct multi_instance *mi = (struct multi_instance *) he->value;
 
-            /*
-             * Status file version 2 and 3
-             */
-            status_printf(so, "TITLE%c%s", sep, title_string);
-            status_printf(so, "TIME%c%s%c%u", sep, time_string(now, 0, false, &gc_top), sep, (unsigned int)now);
-            status_printf(so, "HEADER%cCLIENT_LIST%cCommon Name%cReal Address%cVirtual Address%cVirtual IPv6 Address%cBytes Received%cBytes Sent%cConnected Since%cConnected Since (time_t)%cUsername%cClient ID%cPeer ID%cData Channel Cipher",
-                          sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep);
-            hash_iterator_init(m->hash, &hi);
-            while ((he = hash_iterator_next(&hi)))
+            if (!mi->halt)
             {
-                struct gc_arena gc = gc_new();
-                const struct multi_instance *mi = (struct multi_instance *) he->value;
-
-                if (!mi->halt)
-                {
-                    status_printf(so, "CLIENT_LIST%c%s%c%s%c%s%c%s%c" counter_format "%c" counter_format "%c%s%c%u%c%s%c"
-#ifdef ENABLE_MANAGEMENT
-                                  "%lu"
-#else
-                                  ""
-#endif
-                                  "%c%" PRIu32 "%c%s",
-                                  sep, tls_common_name(mi->context.c2.tls_multi, false),
-                                  sep, mroute_addr_print(&mi->real, &gc),
-                                  sep, print_in_addr_t(mi->reporting_addr, IA_EMPTY_IF_UNDEF, &gc),
-                                  sep, print_in6_addr(mi->reporting_addr_ipv6, IA_EMPTY_IF_UNDEF, &gc),
-                                  sep, mi->context.c2.link_read_bytes + mi->context.c2.dco_read_bytes,
-                                  sep, mi->context.c2.link_write_bytes + mi->context.c2.dco_write_bytes,
-                                  sep, time_string(mi->created, 0, false, &gc),
-                                  sep, (unsigned int)mi->created,
-                                  sep, tls_username(mi->context.c2.tls_multi, false),
-#ifdef ENABLE_MANAGEMENT
-                                  sep, mi->context.c2.mda_context.cid,
-#else
-                                  sep,
-#endif
-                                  sep, mi->context.c2.tls_multi ? mi->context.c2.tls_multi->peer_id : UINT32_MAX,
-                                  sep, translate_cipher_name_to_openvpn(mi->context.options.ciphername));
-                }
-                gc_free(&gc);
+                multi_print_status_client(so, mi, version);
             }
-            hash_iterator_free(&hi);
+        }
+    }
+    else
+    {
+        hash_iterator_init_range(m->vhash, &hi, start, end);
+        while ((he = hash_iterator_next(&hi)))
+        {
+            const struct multi_route *route = (struct multi_route *) he->value;
 
-            status_printf(so, "HEADER%cROUTING_TABLE%cVirtual Address%cCommon Name%cReal Address%cLast Ref%cLast Ref (time_t)",
-                          sep, sep, sep, sep, sep, sep);
-            hash_iterator_init(m->vhash, &hi);
-            while ((he = hash_iterator_next(&hi)))
+            if (multi_route_defined(m, route))
             {
-                struct gc_arena gc = gc_new();
-                const struct multi_route *route = (struct multi_route *) he->value;
-
-                if (multi_route_defined(m, route))
-                {
-                    const struct multi_instance *mi = route->instance;
-                    const struct mroute_addr *ma = &route->addr;
-                    char flags[2] = {0, 0};
-
-                    if (route->flags & MULTI_ROUTE_CACHE)
-                    {
-                        flags[0] = 'C';
-                    }
-                    status_printf(so, "ROUTING_TABLE%c%s%s%c%s%c%s%c%s%c%u",
-                                  sep, mroute_addr_print(ma, &gc), flags,
-                                  sep, tls_common_name(mi->context.c2.tls_multi, false),
-                                  sep, mroute_addr_print(&mi->real, &gc),
-                                  sep, time_string(route->last_reference, 0, false, &gc),
-                                  sep, (unsigned int)route->last_reference);
-                }
-                gc_free(&gc);
+                multi_print_status_route(so, route, version);
             }
-            hash_iterator_free(&hi);
+        }
+    }
+    hash_iterator_free(&hi);
+}
 
-            if (m->mbuf)
-            {
-                status_printf(so, "GLOBAL_STATS%cMax bcast/mcast queue length%c%d",
-                              sep, sep, mbuf_maximum_queued(m->mbuf));
-            }
+/*
+ * Print the lines that precede the client list (MULTI_STATUS_CLIENTS),
+ * the route list (MULTI_STATUS_ROUTES) or that end the status
+ * (MULTI_STATUS_DONE).
+ */
+static void
+multi_print_status_header(struct multi_context *m, struct status_output *so,
+                          const int version, const int section)
+{
+    struct gc_arena gc = gc_new();
+    const char sep = (version == 3) ? '\t' : ',';
 
-            status_printf(so, "GLOBAL_STATS%cdco_enabled%c%d", sep, sep, dco_enabled(&m->top.options));
-            status_printf(so, "END");
+    if (version < 1 || version > 3)
+    {
+        if (section == MULTI_STATUS_CLIENTS)
+        {
+            status_printf(so, "ERROR: bad status format version number");
+        }
+    }
+    else if (section == MULTI_STATUS_CLIENTS)
+    {
+        if (version == 1)
+        {
+            status_printf(so, "OpenVPN CLIENT LIST");
+            status_printf(so, "Updated,%s", time_string(0, 0, false, &gc));
+            status_printf(so, "Common Name,Real Address,Bytes Received,Bytes Sent,Connected Since");
         }
         else
         {
-            status_printf(so, "ERROR: bad status format version number");
+            status_printf(so, "TITLE%c%s", sep, title_string);
+            status_printf(so, "TIME%c%s%c%u", sep, time_string(now, 0, false, &gc), sep, (unsigned int)now);
+            status_printf(so, "HEADER%cCLIENT_LIST%cCommon Name%cReal Address%cVirtual Address%cVirtual IPv6 Address%cBytes Received%cBytes Sent%cConnected Since%cConnected Since (time_t)%cUsername%cClient ID%cPeer ID%cData Channel Cipher",
+                          sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep, sep);
+        }
+    }
+    else if (section == MULTI_STATUS_ROUTES)
+    {
+        if (version == 1)
+        {
+            status_printf(so, "ROUTING TABLE");
+            status_printf(so, "Virtual Address,Common Name,Real Address,Last Ref");
+        }
+        else
+        {
+            status_printf(so, "HEADER%cROUTING_TABLE%cVirtual Address%cCommon Name%cReal Address%cLast Ref%cLast Ref (time_t)",
+                          sep, sep, sep, sep, sep, sep);
+        }
+    }
+    else if (version == 1)
+    {
+        status_printf(so, "GLOBAL STATS");
+        if (m->mbuf)
+        {
+            status_printf(so, "Max bcast/mcast queue length,%d",
+                          mbuf_maximum_queued(m->mbuf));
+        }
+        status_printf(so, "Kernel receive drops," counter_format,
+                      link_socket_drops_global);
+
+        status_printf(so, "END");
+    }
+    else
+    {
+        if (m->mbuf)
+        {
+            status_printf(so, "GLOBAL_STATS%cMax bcast/mcast queue length%c%d",
+                          sep, sep, mbuf_maximum_queued(m->mbuf));
         }
 
+        status_printf(so, "GLOBAL_STATS%cdco_enabled%c%d", sep, sep, dco_enabled(&m->top.options));
+        status_printf(so, "GLOBAL_STATS%cKernel receive drops%c" counter_format,
+                      sep, sep, link_socket_drops_global);
+        status_printf(so, "END");
+    }
+
 #ifdef PACKET_TRUNCATION_CHECK
+    if (section == MULTI_STATUS_DONE)
+    {
+        struct hash_iterator hi;
+        const struct hash_element *he;
+
+        status_printf(so, "HEADER,ERRORS,Common Name,TUN Read Trunc,TUN Write Trunc,Pre-encrypt Trunc,Post-decrypt Trunc");
+        hash_iterator_init(m->hash, &hi);
+        while ((he = hash_iterator_next(&hi)))
         {
-            status_printf(so, "HEADER,ERRORS,Common Name,TUN Read Trunc,TUN Write Trunc,Pre-encrypt Trunc,Post-decrypt Trunc");
-            hash_iterator_init(m->hash, &hi);
-            while ((he = hash_iterator_next(&hi)))
-            {
-                struct gc_arena gc = gc_new();
-                const struct multi_instance *mi = (struct multi_instance *) he->value;
+            const struct multi_instance *mi = (struct multi_instance *) he->value;
 
-                if (!mi->halt)
-                {
-                    status_printf(so, "ERRORS,%s," counter_format "," counter_format "," counter_format "," counter_format,
-                                  tls_common_name(mi->context.c2.tls_multi, false),
-                                  m->top.c2.n_trunc_tun_read,
-                                  mi->context.c2.n_trunc_tun_write,
-                                  mi->context.c2.n_trunc_pre_encrypt,
-                                  mi->context.c2.n_trunc_post_decrypt);
-                }
-                gc_free(&gc);
+            if (!mi->halt)
+            {
+                status_printf(so, "ERRORS,%s," counter_format "," counter_format "," counter_format "," counter_format,
+                              tls_common_name(mi->context.c2.tls_multi, false),
+                              m->top.c2.n_trunc_tun_read,
+                              mi->context.c2.n_trunc_tun_write,
+                              mi->context.c2.n_trunc_pre_encrypt,
+                              mi->context.c2.n_trunc_post_decrypt);
             }
-            hash_iterator_free(&hi);
         }
+        hash_iterator_free(&hi);
+    }
 #endif /* ifdef PACKET_TRUNCATION_CHECK */
 
+    gc_free(&gc);
+}
+
+static bool
+multi_print_status_has_lists(const int version)
+{
+    return version >= 1 && version <= 3;
+}
+
+/*
+ * Dump tables -- triggered by SIGUSR2.
+ * If status file is defined, write to file.
+ * If status file is NULL, write to syslog.
+ */
+void
+multi_print_status(struct multi_context *m, struct status_output *so, const int version)
+{
+    if (m->hash)
+    {
+        status_reset(so);
+
+        multi_dco_update_stats(m);
+
+        multi_print_status_header(m, so, version, MULTI_STATUS_CLIENTS);
+        if (multi_print_status_has_lists(version))
+        {
+            multi_print_status_range(m, so, version, MULTI_STATUS_CLIENTS,
+                                     0, hash_n_buckets(m->hash));
+            multi_print_status_header(m, so, version, MULTI_STATUS_ROUTES);
+            multi_print_status_range(m, so, version, MULTI_STATUS_ROUTES,
+                                     0, hash_n_buckets(m->vhash));
+        }
+        multi_print_status_header(m, so, version, MULTI_STATUS_DONE);
+
         status_flush(so);
-        gc_free(&gc_top);
     }
 
 #ifdef ENABLE_ASYNC_PUSH
@@ -1046,6 +1591,56 @@ multi_print_status(struct multi_context *m, struct status_output *so, const int
 #endif
 }
 
+/*
+ * Write the next slice of the status file started by the per-second
+ * timer, see MULTI_STATUS_SLICE.
+ */
+void
+multi_status_file_continue(struct multi_context *m)
+{
+    struct status_output *so = m->top.c1.status_output;
+    const int version = m->status_file_version;
+
+    if (m->status_section == MULTI_STATUS_IDLE)
+    {
+        status_reset(so);
+        multi_dco_update_stats(m);
+        multi_print_status_header(m, so, version, MULTI_STATUS_CLIENTS);
+
+        m->status_section = multi_print_status_has_lists(version)
+                            ? MULTI_STATUS_CLIENTS : MULTI_STATUS_DONE;
+        m->status_bucket = 0;
+    }
+
+    if (m->status_section != MULTI_STATUS_DONE)
+    {
+        struct hash *hash = (m->status_section == MULTI_STATUS_CLIENTS)
+                            ? m->hash : m->vhash;
+        const int end = min_int(m->status_bucket + MULTI_STATUS_SLICE,
+                                hash_n_buckets(hash));
+
+        multi_print_status_range(m, so, version, m->status_section,
+                                 m->status_bucket, end);
+        m->status_bucket = end;
+
+        if (end < hash_n_buckets(hash))
+        {
+            return;
+        }
+
+        m->status_section++;
+        m->status_bucket = 0;
+        multi_print_status_header(m, so, version, m->status_section);
+        if (m->status_section != MULTI_STATUS_DONE)
+        {
+            return;
+        }
+    }
+
+    status_flush(so);
+    m->status_section = MULTI_STATUS_IDLE;
+}
+
 /*
  * Learn a virtual address or route.
  * The learn will fail if the learn address
@@ -1062,13 +1657,12 @@ multi_learn_addr(struct multi_context *m,
 {
     struct hash_element *he;
     const uint32_t hv = hash_value(m->vhash, addr);
-    struct hash_bucket *bucket = hash_bucket(m->vhash, hv);
     struct multi_route *oldroute = NULL;
     struct multi_instance *owner = NULL;
     struct gc_arena gc = gc_new();
 
     /* if route currently exists, get the instance which owns it */
-    he = hash_lookup_fast(m->vhash, bucket, addr, hv);
+    he = hash_lookup_fast(m->vhash, addr, hv);
     if (he)
     {
         oldroute = (struct multi_route *) he->value;
@@ -1085,7 +1679,7 @@ multi_learn_addr(struct multi_context *m,
         struct multi_route *newroute;
         bool learn_succeeded = false;
 
-        ALLOC_OBJ(newroute, struct multi_route);
+        ALLOC_OBJ_CLEAR(newroute, struct multi_route);
         newroute->addr = *addr;
         newroute->instance = mi;
         newroute->flags = flags;
@@ -1125,7 +1719,7 @@ multi_learn_addr(struct multi_context *m,
                 route_quota_inc(mi);
 
                 /* add new route */
-                hash_add_fast(m->vhash, bucket, &newroute->addr, hv, newroute);
+                hash_add_fast(m->vhash, &newroute->addr, hv, newroute);
             }
         }
 
@@ -1134,7 +1728,18 @@ multi_learn_addr(struct multi_context *m,
             mroute_addr_print(&newroute->addr, &gc),
             multi_instance_string(mi, false, &gc));
 
-        if (!learn_succeeded)
+        if (learn_succeeded)
+        {
+            newroute->instance_next = mi->routes;
+            if (mi->routes)
+            {
+                mi->routes->instance_pprev = &newroute->instance_next;
+            }
+            newroute->instance_pprev = &mi->routes;
+            mi->routes = newroute;
+            multi_reap_schedule(m, newroute, multi_route_expiry(m, newroute));
+        }
+        else
         {
             free(newroute);
         }
@@ -1172,16 +1777,17 @@ multi_get_instance_by_virtual_addr(struct multi_context *m,
     }
     else if (cidr_routing) /* do we need to regenerate a host route cache entry? */
     {
-        struct mroute_helper *rh = m->route_helper;
+        uint8_t net_len[MR_HELPER_NET_LEN];
         struct mroute_addr tryaddr;
-        int i;
+        int i, n_net_len;
 
-        /* cycle through each CIDR length */
-        for (i = 0; i < rh->n_net_len; ++i)
+        /* cycle through the CIDR length of each iroute containing addr */
+        n_net_len = mroute_helper_lookup(m->route_helper, addr, net_len);
+        for (i = 0; i < n_net_len; ++i)
         {
             tryaddr = *addr;
             tryaddr.type |= MR_WITH_NETBITS;
-            tryaddr.netbits = rh->net_len[i];
+            tryaddr.netbits = net_len[i];
             mroute_addr_mask_host_bits(&tryaddr);
 
             /* look up a possible route with netbits netmask */
@@ -1233,19 +1839,9 @@ multi_learn_in_addr_t(struct multi_context *m,
                       int netbits,  /* -1 if host route, otherwise # of network bits in address */
                       bool primary)
 {
-    struct openvpn_sockaddr remote_si;
     struct mroute_addr addr;
 
-    CLEAR(remote_si);
-    remote_si.addr.in4.sin_family = AF_INET;
-    remote_si.addr.in4.sin_addr.s_addr = htonl(a);
-    ASSERT(mroute_extract_openvpn_sockaddr(&addr, &remote_si, false));
-
-    if (netbits >= 0)
-    {
-        addr.type |= MR_WITH_NETBITS;
-        addr.netbits = (uint8_t) netbits;
-    }
+    multi_mroute_addr_in4(&addr, a, netbits);
 
     struct multi_instance *owner = multi_learn_addr(m, mi, &addr, 0);
 #ifdef ENABLE_MANAGEMENT
@@ -1275,17 +1871,7 @@ multi_learn_in6_addr(struct multi_context *m,
 {
     struct mroute_addr addr;
 
-    addr.len = 16;
-    addr.type = MR_ADDR_IPV6;
-    addr.netbits = 0;
-    addr.v6.addr = a6;
-
-    if (netbits >= 0)
-    {
-        addr.type |= MR_WITH_NETBITS;
-        addr.netbits = (uint8_t) netbits;
-        mroute_addr_mask_host_bits( &addr );
-    }
+    multi_mroute_addr_in6(&addr, a6, netbits);
 
     struct multi_instance *owner = multi_learn_addr(m, mi, &addr, 0);
 #ifdef ENABLE_MANAGEMENT
@@ -1317,6 +1903,7 @@ multi_add_iroutes(struct multi_context *m,
     struct gc_arena gc = gc_new();
     const struct iroute *ir;
     const struct iroute_ipv6 *ir6;
+    struct mroute_addr net;
     if (TUNNEL_TYPE(mi->context.c1.tuntap) == DEV_TYPE_TUN)
     {
         mi->did_iroutes = true;
@@ -1336,7 +1923,8 @@ multi_add_iroutes(struct multi_context *m,
                     multi_instance_string(mi, false, &gc));
             }
 
-            mroute_helper_add_iroute46(m->route_helper, ir->netbits);
+            multi_mroute_addr_in4(&net, ir->network, ir->netbits);
+            mroute_helper_add_iroute46(m->route_helper, &net);
 
             multi_learn_in_addr_t(m, mi, ir->network, ir->netbits, false);
         }
@@ -1347,7 +1935,8 @@ multi_add_iroutes(struct multi_context *m,
                 ir6->netbits,
                 multi_instance_string(mi, false, &gc));
 
-            mroute_helper_add_iroute46(m->route_helper, ir6->netbits);
+            multi_mroute_addr_in6(&net, ir6->network, ir6->netbits);
+            mroute_helper_add_iroute46(m->route_helper, &net);
 
             multi_learn_in6_addr(m, mi, ir6->network, ir6->netbits, false);
         }
@@ -1367,27 +1956,20 @@ multi_delete_dup(struct multi_context *m, struct multi_instance *new_mi)
         const char *new_cn = tls_common_name(new_mi->context.c2.tls_multi, true);
         if (new_cn)
         {
-            struct hash_iterator hi;
-            struct hash_element *he;
+            struct multi_instance *mi = multi_cn_index_lookup(m, new_cn);
             int count = 0;
 
-            hash_iterator_init(m->iter, &hi);
-            while ((he = hash_iterator_next(&hi)))
+            while (mi)
             {
-                struct multi_instance *mi = (struct multi_instance *) he->value;
+                /* closing the instance unlinks it from the list */
+                struct multi_instance *next = mi->cn_next;
                 if (mi != new_mi && !mi->halt)
                 {
-                    const char *cn = tls_common_name(mi->context.c2.tls_multi, true);
-                    if (cn && !strcmp(cn, new_cn))
-                    {
-                        mi->did_iter = false;
-                        multi_close_instance(m, mi, false);
-                        hash_iterator_delete_element(&hi);
-                        ++count;
-                    }
+                    multi_close_instance(m, mi, false);
+                    ++count;
                 }
+                mi = next;
             }
-            hash_iterator_free(&hi);
 
             if (count)
             {
@@ -1397,38 +1979,12 @@ multi_delete_dup(struct multi_context *m, struct multi_instance *new_mi)
     }
 }
 
-static void
-check_stale_routes(struct multi_context *m)
-{
-
-    struct gc_arena gc = gc_new();
-    struct hash_iterator hi;
-    struct hash_element *he;
-
-    dmsg(D_MULTI_DEBUG, "MULTI: Checking stale routes");
-    hash_iterator_init_range(m->vhash, &hi, 0, hash_n_buckets(m->vhash));
-    while ((he = hash_iterator_next(&hi)) != NULL)
-    {
-        struct multi_route *r = (struct multi_route *) he->value;
-        if (multi_route_defined(m, r) && difftime(now, r->last_reference) >= m->top.options.stale_routes_ageing_time)
-        {
-            dmsg(D_MULTI_DEBUG, "MULTI: Deleting stale route for address '%s'",
-                 mroute_addr_print(&r->addr, &gc));
-            learn_address_script(m, NULL, "delete", &r->addr);
-            multi_route_del(r);
-            hash_iterator_delete_element(&hi);
-        }
-    }
-    hash_iterator_free(&hi);
-    gc_free(&gc);
-}
-
-/*
- * Ensure that endpoint to be pushed to client
- * complies with --ifconfig-push-constraint directive.
- */
-static bool
-ifconfig_push_constraint_satisfied(const struct context *c)
+/*
+ * Ensure that endpoint to be pushed to client
+ * complies with --ifconfig-push-constraint directive.
+ */
+static bool
+ifconfig_push_constraint_satisfied(const struct context *c)
 {
     const struct options *o = &c->options;
     if (o->push_ifconfig_constraint_defined && c->c2.push_ifconfig_defined)
@@ -1816,6 +2372,8 @@ multi_client_set_protocol_options(struct context *c)
         c->c2.push_request_received = true;
     }
 
+    c->c2.push_update_supported = (proto & IV_PROTO_PUSH_UPDATE) != 0;
+
 #ifdef HAVE_EXPORT_KEYING_MATERIAL
     if (proto & IV_PROTO_TLS_KEY_EXPORT)
     {
@@ -1825,6 +2383,12 @@ multi_client_set_protocol_options(struct context *c)
     {
         o->imported_protocol_flags |= CO_USE_DYNAMIC_TLS_CRYPT;
     }
+    /* epoch data keys are derived from the TLS-EKM key material */
+    if ((proto & IV_PROTO_DATA_EPOCH) && (proto & IV_PROTO_TLS_KEY_EXPORT)
+        && !dco_enabled(o))
+    {
+        o->imported_protocol_flags |= CO_EPOCH_DATA_KEY_FORMAT;
+    }
 #endif
 
     if (proto & IV_PROTO_CC_EXIT_NOTIFY)
@@ -1832,6 +2396,13 @@ multi_client_set_protocol_options(struct context *c)
         o->imported_protocol_flags |= CO_USE_CC_EXIT_NOTIFY;
     }
 
+    /* paths are told apart by the peer-id of their packets */
+    if ((proto & IV_PROTO_MULTIPATH) && tls_multi->use_peer_id
+        && proto_is_udp(o->ce.proto) && !dco_enabled(o))
+    {
+        o->imported_protocol_flags |= CO_MULTIPATH;
+    }
+
     /* Select cipher if client supports Negotiable Crypto Parameters */
 
     /* if we have already created our key, we cannot *change* our own
@@ -1851,7 +2422,12 @@ multi_client_set_protocol_options(struct context *c)
      * Push the first cipher from --data-ciphers to the client that
      * the client announces to be supporting.
      */
-    char *push_cipher = ncp_get_best_cipher(o->ncp_ciphers, peer_info,
+    const char *server_ciphers = o->ncp_ciphers;
+    if (o->ncp_hw_aware)
+    {
+        server_ciphers = ncp_hw_aware_ciphers(server_ciphers, peer_info, &o->gc);
+    }
+    char *push_cipher = ncp_get_best_cipher(server_ciphers, peer_info,
                                             tls_multi->remote_ciphername,
                                             &o->gc);
 
@@ -2298,7 +2874,23 @@ multi_client_connect_call_script(struct multi_context *m,
         argv_parse_cmd(&argv, mi->context.options.client_connect_script);
         argv_printf_cat(&argv, "%s", ccs->config_file);
 
-        if (openvpn_run_script(&argv, mi->context.c2.es, 0, "--client-connect"))
+        if (m->script_queue)
+        {
+            /* the queue writes the exit status of the script to the
+             * deferred return file, which is picked up like that of a
+             * script that deferred itself */
+            if (script_queue_add(m->script_queue, &argv, mi->context.c2.es,
+                                 NULL, ccs->deferred_ret_file,
+                                 "--client-connect"))
+            {
+                ret = CC_RET_DEFERRED;
+            }
+            else
+            {
+                ret = CC_RET_FAILED;
+            }
+        }
+        else if (openvpn_run_script(&argv, mi->context.c2.es, 0, "--client-connect"))
         {
             if (ccs_test_deferred_ret_file(mi) == CC_RET_DEFERRED)
             {
@@ -2337,6 +2929,19 @@ multi_client_setup_dco_initial(struct multi_context *m,
         /* DCO not enabled, nothing to do, return sucess */
         return true;
     }
+
+    /* only possible with --dco-reject-incompatible */
+    if (!tls_item_in_cipher_list(mi->context.options.ciphername,
+                                 dco_get_supported_ciphers()))
+    {
+        msg(D_MULTI_ERRORS, "MULTI: client %s negotiated cipher '%s' that is "
+            "not supported by data channel offload, rejecting client",
+            multi_instance_string(mi, false, gc), mi->context.options.ciphername);
+        auth_set_client_reason(mi->context.c2.tls_multi, "Data channel cipher "
+                               "not supported by the server");
+        return false;
+    }
+
     int ret = dco_multi_add_new_peer(m, mi);
     if (ret < 0)
     {
@@ -2389,6 +2994,63 @@ multi_client_generate_tls_keys(struct context *c)
     return true;
 }
 
+/*
+ * Collect the state of a connected client for --handoff and
+ * --replicate-peer, without the TLS session.
+ */
+static bool
+multi_export_client(struct multi_instance *mi, struct handoff_client *hc)
+{
+    struct context *c = &mi->context;
+    struct tls_multi *multi = c->c2.tls_multi;
+
+    CLEAR(*hc);
+    if (mi->halt || multi->multi_state != CAS_CONNECT_DONE)
+    {
+        return false;
+    }
+
+    hc->remote = c->c2.from;
+    hc->peer_id = multi->peer_id;
+    hc->use_peer_id = multi->use_peer_id;
+    hc->created = mi->created;
+
+    hc->common_name = tls_common_name(multi, true);
+    hc->username = tls_username(multi, true);
+    hc->peer_info = multi->peer_info;
+    hc->ciphername = c->options.ciphername;
+    hc->authname = c->options.authname;
+
+    if (multi->locked_cert_hash_set)
+    {
+        for (int i = 0; i < MAX_CERT_DEPTH; ++i)
+        {
+            const struct cert_hash *ch = multi->locked_cert_hash_set->ch[i];
+            if (ch)
+            {
+                hc->cert_hash[i] = *ch;
+                hc->cert_hash_mask |= 1u << i;
+            }
+        }
+    }
+
+    hc->ifconfig_defined = c->c2.push_ifconfig_defined;
+    hc->ifconfig_local = c->c2.push_ifconfig_local;
+    hc->ifconfig_remote_netmask = c->c2.push_ifconfig_remote_netmask;
+    hc->ifconfig_local_alias = c->c2.push_ifconfig_local_alias;
+    hc->ifconfig_ipv6_defined = c->c2.push_ifconfig_ipv6_defined;
+    hc->ifconfig_ipv6_local = c->c2.push_ifconfig_ipv6_local;
+    hc->ifconfig_ipv6_netbits = c->c2.push_ifconfig_ipv6_netbits;
+    hc->ifconfig_ipv6_remote = c->c2.push_ifconfig_ipv6_remote;
+    hc->pool_handle = mi->vaddr_handle;
+
+    hc->vlan_pvid = c->options.vlan_pvid;
+    hc->iroutes = c->options.iroutes;
+    hc->iroutes_ipv6 = c->options.iroutes_ipv6;
+    hc->acl = c->options.acl;
+    return true;
+}
+
 static void
 multi_client_connect_late_setup(struct multi_context *m,
                                 struct multi_instance *mi,
@@ -2398,11 +3060,25 @@ multi_client_connect_late_setup(struct multi_context *m,
     ASSERT(mi);
 
     struct gc_arena gc = gc_new();
+
+    /* --fec, from the config or ccd, needs a client that can do it */
+    if (mi->context.options.fec
+        && (!proto_is_udp(mi->context.options.ce.proto)
+            || !extract_var_peer_info(mi->context.c2.tls_multi->peer_info, "IV_FEC=", &gc)))
+    {
+        msg(D_MULTI_LOW, "MULTI: --fec is not supported by %s",
+            multi_instance_string(mi, false, &gc));
+        mi->context.options.fec = 0;
+    }
+
     /*
      * Process sourced options.
      */
     do_deferred_options(&mi->context, option_types_found);
 
+    /* --vlan-pvid may have been set by client-connect or ccd */
+    vlan_index_update(m, mi);
+
     /*
      * make sure we got ifconfig settings from somewhere
      */
@@ -2484,6 +3160,7 @@ multi_client_connect_late_setup(struct multi_context *m,
 
     /* set context-level authentication flag */
     mi->context.c2.tls_multi->multi_state = CAS_CONNECT_DONE;
+    tls_connect_phase(mi->context.c2.tls_multi, CONNECT_PHASE_PUSH);
 
     /* authentication complete, calculate dynamic client specific options */
     if (!multi_client_set_protocol_options(&mi->context))
@@ -2501,6 +3178,14 @@ multi_client_connect_late_setup(struct multi_context *m,
     {
         mi->context.c2.tls_multi->multi_state = CAS_FAILED;
     }
+    else if (m->replica)
+    {
+        struct handoff_client hc;
+        if (multi_export_client(mi, &hc))
+        {
+            replica_client_up(m->replica, &hc);
+        }
+    }
 
     /* send push reply if ready */
     if (mi->context.c2.push_request_received)
@@ -2530,6 +3215,7 @@ multi_client_connect_early_setup(struct multi_context *m,
     {
         multi_delete_dup(m, mi);
     }
+    multi_cn_index_add(m, mi);
 
     /* reset pool handle to null */
     mi->vaddr_handle = -1;
@@ -2605,8 +3291,22 @@ multi_client_connect_source_ccd(struct multi_context *m,
                               CCD_DEFAULT, &gc);
 
 
+        const char *ccd_config = NULL;
+
+        if (m->ccd_cache)
+        {
+            /* try common-name file, then default file, from the cache */
+            if ((ccd_config = ccd_cache_get(m->ccd_cache, ccd_client)))
+            {
+                ccd_file = ccd_client;
+            }
+            else if ((ccd_config = ccd_cache_get(m->ccd_cache, ccd_default)))
+            {
+                ccd_file = ccd_default;
+            }
+        }
         /* try common-name file */
-        if (platform_test_file(ccd_client))
+        else if (platform_test_file(ccd_client))
         {
             ccd_file = ccd_client;
         }
@@ -2616,7 +3316,17 @@ multi_client_connect_source_ccd(struct multi_context *m,
             ccd_file = ccd_default;
         }
 
-        if (ccd_file)
+        if (ccd_config)
+        {
+            options_server_import_string(&mi->context.options,
+                                         ccd_file,
+                                         ccd_config,
+                                         D_IMPORT_ERRORS|M_OPTERR,
+                                         CLIENT_CONNECT_OPT_MASK,
+                                         option_types_found,
+                                         mi->context.c2.es);
+        }
+        else if (ccd_file)
         {
             options_server_import(&mi->context.options,
                                   ccd_file,
@@ -2624,6 +3334,10 @@ multi_client_connect_source_ccd(struct multi_context *m,
                                   CLIENT_CONNECT_OPT_MASK,
                                   option_types_found,
                                   mi->context.c2.es);
+        }
+
+        if (ccd_file)
+        {
             /*
              * Select a virtual address from either --ifconfig-push in
              * --client-config-dir file or --ifconfig-pool.
@@ -2639,6 +3353,72 @@ multi_client_connect_source_ccd(struct multi_context *m,
     return ret;
 }
 
+/**
+ * Take over what the client-connect handlers of the peer server decided
+ * for a client that comes back with a valid auth-token after a failover,
+ * see --replicate-listen.  The handlers that follow are then skipped.
+ */
+static enum client_connect_return
+multi_client_connect_replica(struct multi_context *m,
+                             struct multi_instance *mi,
+                             bool deferred,
+                             unsigned int *option_types_found)
+{
+    ASSERT(!deferred);
+    struct tls_multi *multi = mi->context.c2.tls_multi;
+    const struct key_state *ks = &multi->session[TM_ACTIVE].key[KS_PRIMARY];
+    const struct replica_entry *e =
+        replica_lookup(m->replica, tls_common_name(multi, true));
+    const char *username = tls_username(multi, true);
+
+    if (!e || ks->auth_token_state_flags != AUTH_TOKEN_HMAC_OK
+        || !username || !e->hc.username || strcmp(username, e->hc.username))
+    {
+        return CC_RET_SKIPPED;
+    }
+
+    /* copy the entry, it goes away with the next update from the peer */
+    struct options *o = &mi->context.options;
+    struct handoff_client hc;
+    struct buffer buf = alloc_buf(HANDOFF_CLIENT_MAX);
+    handoff_client_write(&buf, &e->hc);
+    const bool good = handoff_client_read(&buf, &hc, &o->gc);
+    free_buf(&buf);
+    if (!good)
+    {
+        return CC_RET_SKIPPED;
+    }
+
+    o->iroutes = hc.iroutes;
+    o->iroutes_ipv6 = hc.iroutes_ipv6;
+    o->acl = hc.acl;
+    o->vlan_pvid = hc.vlan_pvid;
+
+    /* a pool address was reserved for the client when the entry came in,
+     * anything else was given with --ifconfig-push */
+    if (hc.pool_handle < 0 && hc.ifconfig_defined)
+    {
+        o->push_ifconfig_defined = true;
+        o->push_ifconfig_local = hc.ifconfig_local;
+        o->push_ifconfig_remote_netmask = hc.ifconfig_remote_netmask;
+        o->push_ifconfig_local_alias = hc.ifconfig_local_alias;
+    }
+    if (hc.pool_handle < 0 && hc.ifconfig_ipv6_defined)
+    {
+        o->push_ifconfig_ipv6_defined = true;
+        o->push_ifconfig_ipv6_local = hc.ifconfig_ipv6_local;
+        o->push_ifconfig_ipv6_netbits = hc.ifconfig_ipv6_netbits;
+        o->push_ifconfig_ipv6_remote = hc.ifconfig_ipv6_remote;
+    }
+    multi_select_virtual_addr(m, mi);
+    multi_client_connect_setenv(m, mi);
+
+    msg(D_MULTI_LOW, "MULTI: restored the connect of %s from the peer server",
+        multi_instance_string(mi, false, &o->gc));
+    mi->replica_restored = true;
+    return CC_RET_SUCCEEDED;
+}
+
 typedef enum client_connect_return (*multi_client_connect_handler)
     (struct multi_context *m, struct multi_instance *mi,
     bool from_deferred, unsigned int *option_types_found);
@@ -2646,6 +3426,7 @@ typedef enum client_connect_return (*multi_client_connect_handler)
 static const multi_client_connect_handler client_connect_handlers[] = {
     multi_client_connect_compress_migrate,
     multi_client_connect_source_ccd,
+    multi_client_connect_replica,
     multi_client_connect_call_plugin_v1,
     multi_client_connect_call_plugin_v2,
     multi_client_connect_call_script,
@@ -2653,6 +3434,83 @@ static const multi_client_connect_handler client_connect_handlers[] = {
     NULL,
 };
 
+/*
+ * Whether the deferred_ret_file of mi is watched, so that the handler
+ * that deferred is resumed when the file is written.
+ */
+static bool
+multi_deferred_ret_file_watched(const struct multi_instance *mi)
+{
+#ifdef ENABLE_ASYNC_PUSH
+    const char *file = mi->client_connect_defer_state.deferred_ret_file;
+    const char *name = file ? strrchr(file, '/') : NULL;
+
+    return mi->inotify_file && name && !strcmp(mi->inotify_file, name + 1);
+#else
+    return false;
+#endif
+}
+
+#ifdef ENABLE_ASYNC_PUSH
+/*
+ * Have the client-connect handler of mi that deferred called again on
+ * the next pass, because its result may be there now.
+ */
+static void
+multi_client_connect_wake(struct multi_instance *mi)
+{
+    mi->client_connect_defer_state.resume = true;
+    mi->context.c2.timeval.tv_sec = 0;
+    mi->context.c2.timeval.tv_usec = 0;
+    mi->context.c2.pre_select_wakeup = now;
+}
+#endif
+
+/*
+ * Whether multi_connection_established() has to run for mi: for the
+ * first time, or to call the handler that deferred again, once it was
+ * told that its result may be there or when it is due to be polled.
+ */
+static bool
+multi_client_connect_resume(struct multi_instance *mi)
+{
+    struct client_connect_defer_state *ccs = &mi->client_connect_defer_state;
+
+    if (mi->context.c2.tls_multi->multi_state == CAS_PENDING
+        || ccs->resume
+        || (ccs->resume_at && now >= ccs->resume_at))
+    {
+        ccs->resume = false;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Wake mi up in time for the next poll of its deferred client-connect
+ * handler.
+ */
+static void
+multi_client_connect_schedule(struct multi_instance *mi)
+{
+    struct context *c = &mi->context;
+    const time_t at = mi->client_connect_defer_state.resume_at;
+
+    if (at)
+    {
+        const time_t sec = at > now ? at - now : 0;
+        if (sec < c->c2.timeval.tv_sec)
+        {
+            c->c2.timeval.tv_sec = sec;
+            c->c2.timeval.tv_usec = 0;
+        }
+        if (at < c->c2.pre_select_wakeup)
+        {
+            c->c2.pre_select_wakeup = at;
+        }
+    }
+}
+
 /*
  * Called as soon as the SSL/TLS connection is authenticated.
  *
@@ -2679,9 +3537,9 @@ multi_connection_established(struct multi_context *m, struct multi_instance *mi)
      * can ignore other states here */
     bool from_deferred = (mi->context.c2.tls_multi->multi_state != CAS_PENDING);
 
-    int *cur_handler_index = &mi->client_connect_defer_state.cur_handler_index;
-    unsigned int *option_types_found =
-        &mi->client_connect_defer_state.option_types_found;
+    struct client_connect_defer_state *ccs = &mi->client_connect_defer_state;
+    int *cur_handler_index = &ccs->cur_handler_index;
+    unsigned int *option_types_found = &ccs->option_types_found;
 
     /* We are called for the first time */
     if (!from_deferred)
@@ -2691,12 +3549,15 @@ multi_connection_established(struct multi_context *m, struct multi_instance *mi)
         /* Initially we have no handler that has returned a result */
         mi->context.c2.tls_multi->multi_state = CAS_PENDING_DEFERRED;
 
+        tls_connect_phase(mi->context.c2.tls_multi, CONNECT_PHASE_POOL);
         multi_client_connect_early_setup(m, mi);
+        tls_connect_phase(mi->context.c2.tls_multi, CONNECT_PHASE_CLIENT_CONNECT);
     }
 
     bool cc_succeeded = true;
 
     while (cc_succeeded
+           && !mi->replica_restored
            && client_connect_handlers[*cur_handler_index] != NULL)
     {
         enum client_connect_return ret;
@@ -2726,8 +3587,15 @@ multi_connection_established(struct multi_context *m, struct multi_instance *mi)
                 /*
                  * we already set multi_status to DEFERRED_RESULT or
                  * DEFERRED_NO_RESULT. We just return
-                 * from the function as having multi_status
+                 * from the function as having multi_status.  The handler
+                 * is called again once its result may be there, see
+                 * multi_client_connect_resume().
                  */
+                ccs->resume = false;
+                ccs->file_only = client_connect_handlers[*cur_handler_index]
+                                 == multi_client_connect_call_script;
+                ccs->resume_at = (ccs->file_only && multi_deferred_ret_file_watched(mi))
+                                 ? 0 : now + CLIENT_CONNECT_POLL_INTERVAL;
                 return;
 
             case CC_RET_FAILED:
@@ -2802,77 +3670,194 @@ multi_connection_established(struct multi_context *m, struct multi_instance *mi)
 
 #ifdef ENABLE_ASYNC_PUSH
 /*
- * Called when inotify event is fired, which happens when acf
- * or connect-status file is closed or deleted.
- * Continues authentication and sends push_reply
- * (or be deferred again by client-connect)
+ * The inotify watch of mi is gone or replaced, so any deferred auth
+ * control file needs to be read again, and polled from now on.
+ */
+static void
+multi_unwatch_auth_control_file(struct multi_instance *mi)
+{
+    if (mi->context.c2.tls_multi)
+    {
+        tls_authentication_status_watch(mi->context.c2.tls_multi, false);
+    }
+}
+
+void
+multi_inotify_init(struct multi_context *m)
+{
+    const char *dir = m->top.options.tmp_dir;
+    int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (fd < 0)
+    {
+        msg(D_MULTI_ERRORS | M_ERRNO, "MULTI: inotify_init error");
+    }
+    else if (inotify_add_watch(fd, dir, IN_CLOSE_WRITE | IN_DELETE | IN_ONLYDIR) < 0)
+    {
+        msg(D_MULTI_ERRORS | M_ERRNO, "MULTI: inotify_add_watch error on %s", dir);
+        close(fd);
+        fd = -1;
+    }
+    m->top.c2.inotify_fd = fd;
+}
+
+static void multi_schedule_context_wakeup(struct multi_context *m, struct multi_instance *mi);
+
+/*
+ * The kernel dropped events, so have every instance with a watched file
+ * read it again on its next pass.
+ */
+static void
+multi_inotify_overflow(struct multi_context *m)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    msg(D_MULTI_ERRORS, "MULTI: inotify event queue overflow");
+
+    hash_iterator_init(m->inotify_watchers, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        if (mi->context.c2.tls_multi)
+        {
+            tls_authentication_status_watch(mi->context.c2.tls_multi, true);
+        }
+        multi_client_connect_wake(mi);
+        multi_schedule_context_wakeup(m, mi);
+    }
+    hash_iterator_free(&hi);
+}
+
+/*
+ * Called when inotify event is fired, which happens when a file in
+ * --tmp-dir is closed or deleted.  Continues authentication of the
+ * instances whose acf or connect-status file was written and sends
+ * push_reply (or be deferred again by client-connect).  All events that
+ * are queued are handled in one go.
  */
 void
 multi_process_file_closed(struct multi_context *m, const unsigned int mpp_flags)
 {
     char buffer[INOTIFY_EVENT_BUFFER_SIZE];
-    size_t buffer_i = 0;
-    int r = read(m->top.c2.inotify_fd, buffer, INOTIFY_EVENT_BUFFER_SIZE);
+    ssize_t r;
 
-    while (buffer_i < r)
+    while ((r = read(m->top.c2.inotify_fd, buffer, sizeof(buffer))) > 0)
     {
-        /* parse inotify events */
-        struct inotify_event *pevent = (struct inotify_event *) &buffer[buffer_i];
-        size_t event_size = sizeof(struct inotify_event) + pevent->len;
-        buffer_i += event_size;
+        size_t buffer_i = 0;
+        while (buffer_i < (size_t) r)
+        {
+            /* parse inotify events */
+            const struct inotify_event *pevent = (const struct inotify_event *) &buffer[buffer_i];
+            buffer_i += sizeof(struct inotify_event) + pevent->len;
+
+            if (pevent->mask & IN_Q_OVERFLOW)
+            {
+                multi_inotify_overflow(m);
+                continue;
+            }
 
-        msg(D_MULTI_DEBUG, "MULTI: modified fd %d, mask %d", pevent->wd, pevent->mask);
+            /* most files in --tmp-dir are not ours to watch */
+            struct multi_instance *mi = pevent->len ? hash_lookup(m->inotify_watchers, pevent->name) : NULL;
+            if (!mi)
+            {
+                continue;
+            }
 
-        struct multi_instance *mi = hash_lookup(m->inotify_watchers, (void *) (unsigned long) pevent->wd);
+            msg(D_MULTI_DEBUG, "MULTI: modified file %s, mask %d", pevent->name, pevent->mask);
 
-        if (pevent->mask & IN_CLOSE_WRITE)
-        {
-            if (mi)
+            if (pevent->mask & IN_CLOSE_WRITE)
             {
+                /* read the file once more, it may also have been closed
+                 * when it was created */
+                if (mi->context.c2.tls_multi)
+                {
+                    tls_authentication_status_watch(mi->context.c2.tls_multi, true);
+                }
+                multi_client_connect_wake(mi);
+
                 /* continue authentication, perform NCP negotiation and send push_reply */
                 multi_process_post(m, mi, mpp_flags);
             }
-            else
-            {
-                msg(D_MULTI_ERRORS, "MULTI: multi_instance not found!");
-            }
-        }
-        else if (pevent->mask & IN_IGNORED)
-        {
-            /* this event is _always_ fired when watch is removed or file is deleted */
-            if (mi)
+            else if (pevent->mask & IN_DELETE)
             {
-                hash_remove(m->inotify_watchers, (void *) (unsigned long) pevent->wd);
-                mi->inotify_watch = -1;
+                multi_inotify_remove(m, mi);
+                multi_unwatch_auth_control_file(mi);
+                mi->client_connect_defer_state.resume_at = now;
             }
         }
-        else
-        {
-            msg(D_MULTI_ERRORS, "MULTI: unknown mask %d", pevent->mask);
-        }
+    }
+
+    if (r < 0 && errno != EAGAIN && errno != EINTR)
+    {
+        msg(D_MULTI_ERRORS | M_ERRNO, "MULTI: inotify read error");
     }
 }
 #endif /* ifdef ENABLE_ASYNC_PUSH */
 
+/*
+ * Check that mi can take another packet from the queue, count the drop
+ * otherwise.
+ */
+static bool
+multi_mbuf_accept(struct multi_context *m,
+                  struct multi_instance *mi,
+                  const struct mbuf_buffer *mb)
+{
+    if (mi->shaper_held)
+    {
+        ++m->shaper_drops;
+        trace_event(TRACE_DROP, trace_peer(&mi->context), BLEN(&mb->buf), TRACE_DROP_SHAPER,
+                    mbuf_len(m->mbuf));
+        OVPN_PROBE3(queue_drop, mi, BLEN(&mb->buf), TRACE_DROP_SHAPER);
+        msg(D_MULTI_DROPPED, "MULTI: packet dropped due to traffic shaping (multi_add_mbuf)");
+        return false;
+    }
+    else if (!multi_output_queue_ready(m, mi))
+    {
+        ++m->tcp_queue_drops;
+        trace_event(TRACE_DROP, trace_peer(&mi->context), BLEN(&mb->buf), TRACE_DROP_QUEUE,
+                    mbuf_len(m->mbuf));
+        OVPN_PROBE3(queue_drop, mi, BLEN(&mb->buf), TRACE_DROP_QUEUE);
+        msg(D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_add_mbuf)");
+        return false;
+    }
+    return true;
+}
+
 /*
  * Add a mbuf buffer to a particular
- * instance.
+ * instance.  source is the instance that sent
+ * the packet, NULL if it came from tun/tap.
  */
 void
 multi_add_mbuf(struct multi_context *m,
                struct multi_instance *mi,
+               const struct multi_instance *source,
                struct mbuf_buffer *mb)
 {
-    if (multi_output_queue_ready(m, mi))
+    if (multi_mbuf_accept(m, mi, mb))
     {
         struct mbuf_item item;
         item.buffer = mb;
         item.instance = mi;
+        item.source = source;
         mbuf_add_item(m->mbuf, &item);
     }
-    else
+}
+
+/*
+ * Add mi to the recipients of the broadcast in mb, which is queued
+ * once for all of them by mbuf_add_bcast().
+ */
+static inline void
+multi_add_recipient(struct multi_context *m,
+                    struct multi_instance *mi,
+                    struct mbuf_buffer *mb)
+{
+    if (multi_mbuf_accept(m, mi, mb))
     {
-        msg(D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_add_mbuf)");
+        mbuf_add_recipient(mb, mi);
     }
 }
 
@@ -2882,15 +3867,16 @@ multi_add_mbuf(struct multi_context *m,
 static inline void
 multi_unicast(struct multi_context *m,
               const struct buffer *buf,
-              struct multi_instance *mi)
+              struct multi_instance *mi,
+              const struct multi_instance *source)
 {
     struct mbuf_buffer *mb;
 
     if (BLEN(buf) > 0)
     {
-        mb = mbuf_alloc_buf(buf);
+        mb = mbuf_alloc_buf(m->mbuf, buf);
         mb->flags = MF_UNICAST;
-        multi_add_mbuf(m, mi, mb);
+        multi_add_mbuf(m, mi, source, mb);
         mbuf_free_buf(mb);
     }
 }
@@ -2916,30 +3902,85 @@ multi_bcast(struct multi_context *m,
 #ifdef MULTI_DEBUG_EVENT_LOOP
         printf("BCAST len=%d\n", BLEN(buf));
 #endif
-        mb = mbuf_alloc_buf(buf);
-        hash_iterator_init(m->iter, &hi);
+        mb = mbuf_alloc_buf(m->mbuf, buf);
 
-        while ((he = hash_iterator_next(&hi)))
+        if (vid != 0 && m->vlan_members)
         {
-            mi = (struct multi_instance *) he->value;
-            if (mi != sender_instance && !mi->halt)
+            /* only the members of the VLAN can receive the frame */
+            for (mi = m->vlan_members[vid]; mi; mi = mi->vlan_next)
             {
-                if (vid != 0 && vid != mi->context.options.vlan_pvid)
+                if (mi != sender_instance && !mi->halt)
                 {
-                    continue;
+                    multi_add_recipient(m, mi, mb);
                 }
-                multi_add_mbuf(m, mi, mb);
             }
         }
+        else
+        {
+            hash_iterator_init(m->iter, &hi);
 
-        hash_iterator_free(&hi);
+            while ((he = hash_iterator_next(&hi)))
+            {
+                mi = (struct multi_instance *) he->value;
+                if (mi != sender_instance && !mi->halt)
+                {
+                    if (vid != 0 && vid != mi->context.options.vlan_pvid)
+                    {
+                        continue;
+                    }
+                    multi_add_recipient(m, mi, mb);
+                }
+            }
+
+            hash_iterator_free(&hi);
+        }
+        mbuf_add_bcast(m->mbuf, mb, sender_instance);
         mbuf_free_buf(mb);
         perf_pop();
     }
 }
 
 /*
- * Given a time delta, indicating that we wish to be
+ * Send a broadcast or multicast packet to the clients that joined its
+ * multicast group with --multicast-snooping, or else to all clients.
+ */
+static void
+multi_mcast(struct multi_context *m,
+            const struct buffer *buf,
+            const struct multi_instance *sender_instance,
+            int dev_type,
+            uint16_t vid)
+{
+    const struct mcast_member *mm;
+
+    if (!m->mcast_snoop
+        || !mcast_snoop_members(m->mcast_snoop, buf, dev_type, vid, &mm))
+    {
+        multi_bcast(m, buf, sender_instance, NULL, vid);
+        return;
+    }
+
+    if (BLEN(buf) > 0 && mm)
+    {
+        perf_push(PERF_MULTI_BCAST);
+        struct mbuf_buffer *mb = mbuf_alloc_buf(m->mbuf, buf);
+
+        for (; mm; mm = mm->next)
+        {
+            if (mm->mi != sender_instance && !mm->mi->halt)
+            {
+                multi_add_recipient(m, mm->mi, mb);
+            }
+        }
+
+        mbuf_add_bcast(m->mbuf, mb, sender_instance);
+        mbuf_free_buf(mb);
+        perf_pop();
+    }
+}
+
+/*
+ * Given a time delta, indicating that we wish to be
  * awoken by the scheduler at time now + delta, figure
  * a sigma parameter (in microseconds) that represents
  * a sort of fuzz factor around delta, so that we're
@@ -2974,8 +4015,8 @@ compute_wakeup_sigma(const struct timeval *delta)
 static void
 multi_schedule_context_wakeup(struct multi_context *m, struct multi_instance *mi)
 {
-    /* calculate an absolute wakeup time */
-    ASSERT(!openvpn_gettimeofday(&mi->wakeup, NULL));
+    /* calculate an absolute wakeup time, relative to the last event wait */
+    tv_now(&mi->wakeup);
     tv_add(&mi->wakeup, &mi->context.c2.timeval);
 
     /* tell scheduler to wake us up at some point in the future */
@@ -2985,31 +4026,275 @@ multi_schedule_context_wakeup(struct multi_context *m, struct multi_instance *mi
                        compute_wakeup_sigma(&mi->context.c2.timeval));
 }
 
-#if defined(ENABLE_ASYNC_PUSH)
+/*
+ * A handshake of mi that waited for an external key operation, like a
+ * --management-external-key signature, can go on.
+ */
+static void
+multi_async_wakeup(void *ctx, void *arg)
+{
+    struct multi_context *m = (struct multi_context *) ctx;
+    struct multi_instance *mi = (struct multi_instance *) arg;
+
+    if (!mi->halt)
+    {
+        reschedule_multi_process(&mi->context);
+        multi_schedule_context_wakeup(m, mi);
+    }
+}
+
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+/*
+ * A queued DCO key operation of a client failed. Restart the client,
+ * as check_dco_key_status() does when the error is reported at once.
+ */
 static void
+multi_dco_batch_error(void *arg, unsigned int peerid, int err)
+{
+    struct multi_context *m = arg;
+
+    struct multi_instance *mi = multi_peer_id_lookup(m, peerid);
+    if (mi)
+    {
+        register_signal(mi->context.sig, SIGUSR1, "dco update keys error");
+
+        /* let the timeout processing see the signal */
+        mi->context.c2.timeval.tv_sec = 0;
+        mi->context.c2.timeval.tv_usec = 0;
+        multi_schedule_context_wakeup(m, mi);
+    }
+}
+#endif
+
+#if defined(ENABLE_ASYNC_PUSH)
+/*
+ * Watch file for mi.  The file is seen through the --tmp-dir watch of
+ * multi_inotify_init(), so this fails for a file anywhere else.
+ */
+static bool
 add_inotify_file_watch(struct multi_context *m, struct multi_instance *mi,
-                       int inotify_fd, const char *file)
+                       const char *file)
+{
+    const char *dir = m->top.options.tmp_dir;
+    const size_t len = strlen(dir);
+
+    if (m->top.c2.inotify_fd < 0
+        || strncmp(file, dir, len) || file[len] != '/' || strchr(file + len + 1, '/'))
+    {
+        return false;
+    }
+
+    if (mi->inotify_file)
+    {
+        multi_inotify_remove(m, mi);
+        multi_unwatch_auth_control_file(mi);
+    }
+    mi->inotify_file = string_alloc(file + len + 1, NULL);
+    hash_add(m->inotify_watchers, mi->inotify_file, mi, true);
+    return true;
+}
+
+/*
+ * Watch the auth control file of a key that has just been deferred, so
+ * that the result is picked up when the file is written instead of by
+ * polling it.  An instance has a single watch, so if both a plugin and
+ * a script deferred the key, the files are still polled.
+ */
+static void
+multi_watch_auth_control_file(struct multi_context *m, struct multi_instance *mi,
+                              const struct key_state *ks)
+{
+    const char *plugin_acf = ks->plugin_auth.auth_control_file;
+    const char *script_acf = ks->script_auth.auth_control_file;
+    bool watched = false;
+
+    if (plugin_acf)
+    {
+        watched = add_inotify_file_watch(m, mi, plugin_acf);
+    }
+    if (script_acf)
+    {
+        watched = !plugin_acf
+                  && add_inotify_file_watch(m, mi, script_acf);
+    }
+
+    if (watched && mi->context.c2.tls_multi)
+    {
+        tls_authentication_status_watch(mi->context.c2.tls_multi, true);
+
+        /* the file may have been written before the watch was added,
+         * so read it once more on the next pass */
+        mi->context.c2.timeval.tv_sec = 0;
+        mi->context.c2.timeval.tv_usec = 0;
+        mi->context.c2.pre_select_wakeup = now;
+    }
+}
+
+/*
+ * Watch the return file of a deferred client-connect handler, so that
+ * the handler is resumed when the file is written.  A script only
+ * answers through the file, so it is not polled while the watch is
+ * there.  Plugins are polled all the same.
+ */
+static void
+multi_watch_deferred_ret_file(struct multi_context *m, struct multi_instance *mi)
+{
+    struct client_connect_defer_state *ccs = &mi->client_connect_defer_state;
+
+    if (!ccs->deferred_ret_file || multi_deferred_ret_file_watched(mi)
+        || !add_inotify_file_watch(m, mi, ccs->deferred_ret_file))
+    {
+        return;
+    }
+
+    if (ccs->file_only)
+    {
+        ccs->resume_at = 0;
+    }
+
+    /* the file may have been written before the watch was added */
+    multi_client_connect_wake(mi);
+}
+#endif /* if defined(ENABLE_ASYNC_PUSH) */
+
+/*
+ * Returns true if the next datagram waiting in the --udp-recv-batch is
+ * a data channel packet from the same peer as mi.  Post-processing of
+ * mi can then be left to the last packet of that run.
+ */
+static bool
+multi_recv_batch_continues(const struct multi_context *m, const struct multi_instance *mi)
+{
+    const struct link_socket_actual *from;
+    const uint8_t *data;
+    int len;
+
+    if (!link_socket_recv_batch_peek(m->top.c2.link_socket, &data, &len, &from)
+        || len < 1)
+    {
+        return false;
+    }
+
+    const int op = data[0] >> P_OPCODE_SHIFT;
+    return (op == P_DATA_V1 || op == P_DATA_V2)
+           && link_socket_actual_match(&mi->context.c2.from, from);
+}
+
+/*
+ * Traffic shaping in server mode.  A packet that has to wait for
+ * the shaper stays in the to_link buffer of its instance, and the
+ * instance is not made pending, so that the others are served in the
+ * meantime.  It is woken up by the scheduler when the packet may go.
+ *
+ * Instances waiting for the --shaper-total bucket are kept in a FIFO
+ * and sent one packet each in turn.  With a single packet per instance
+ * waiting, this is what deficit round robin comes down to.
+ */
+static void
+multi_shaper_wakeup(struct multi_context *m, struct multi_instance *mi, int delay)
+{
+    struct timeval tv, wakeup;
+
+    tv.tv_sec = delay / 1000000;
+    tv.tv_usec = delay % 1000000;
+    ASSERT(!openvpn_gettimeofday(&wakeup, NULL));
+    tv_add(&wakeup, &tv);
+
+    /* never postpone a wakeup that the instance timers need earlier */
+    if (!IN_TREE(&mi->se) || tv_lt(&wakeup, &mi->se.tv))
+    {
+        mi->wakeup = wakeup;
+        schedule_add_entry(m->schedule,
+                           (struct schedule_entry *) mi,
+                           &mi->wakeup,
+                           compute_wakeup_sigma(&tv));
+    }
+}
+
+static void
+multi_shaper_enqueue(struct multi_context *m, struct multi_instance *mi)
+{
+    if (!mi->shaper_queued)
+    {
+        mi->shaper_next = NULL;
+        *m->shaper_tail = mi;
+        m->shaper_tail = &mi->shaper_next;
+        mi->shaper_queued = true;
+    }
+}
+
+static void
+multi_shaper_dequeue(struct multi_context *m, struct multi_instance *mi)
 {
-    /* watch acf file */
-    long watch_descriptor = inotify_add_watch(inotify_fd, file,
-                                              IN_CLOSE_WRITE | IN_ONESHOT);
-    if (watch_descriptor >= 0)
+    if (mi->shaper_queued)
     {
-        if (mi->inotify_watch != -1)
+        struct multi_instance **pp = &m->shaper_head;
+        const bool was_head = (m->shaper_head == mi);
+
+        while (*pp != mi)
+        {
+            pp = &(*pp)->shaper_next;
+        }
+        *pp = mi->shaper_next;
+        if (m->shaper_tail == &mi->shaper_next)
+        {
+            m->shaper_tail = pp;
+        }
+        mi->shaper_next = NULL;
+        mi->shaper_queued = false;
+
+        /* it is the next instance's turn */
+        if (was_head && m->shaper_head)
         {
-            hash_remove(m->inotify_watchers,
-                        (void *) (unsigned long)mi->inotify_watch);
+            multi_shaper_wakeup(m, m->shaper_head, 0);
         }
-        hash_add(m->inotify_watchers, (const uintptr_t *)watch_descriptor,
-                 mi, true);
-        mi->inotify_watch = watch_descriptor;
     }
-    else
+}
+
+/*
+ * Return true if the link output of mi has to wait for the traffic
+ * shaper, after making sure that mi is woken up when it is its turn.
+ */
+static bool
+multi_shaper_hold(struct multi_context *m, struct multi_instance *mi)
+{
+    int delay;
+
+    if (!LINK_OUT(&mi->context))
+    {
+        multi_shaper_dequeue(m, mi);
+        return false;
+    }
+
+    /* per client limit */
+    if (mi->context.options.shaper
+        && (delay = shaper_delay(&mi->context.c2.shaper)) >= 1000)
+    {
+        multi_shaper_dequeue(m, mi);
+        multi_shaper_wakeup(m, mi, delay);
+        return true;
+    }
+
+    /* limit for all clients together */
+    if (m->top.options.shaper_total)
     {
-        msg(M_NONFATAL | M_ERRNO, "MULTI: inotify_add_watch error");
+        if (m->shaper_head && m->shaper_head != mi)
+        {
+            /* woken up by multi_shaper_dequeue() */
+            multi_shaper_enqueue(m, mi);
+            return true;
+        }
+        if ((delay = shaper_delay(&m->shaper)) >= 1000)
+        {
+            multi_shaper_enqueue(m, mi);
+            multi_shaper_wakeup(m, mi, delay);
+            return true;
+        }
+        multi_shaper_dequeue(m, mi);
     }
+
+    return false;
 }
-#endif /* if defined(ENABLE_ASYNC_PUSH) */
 
 /*
  * Figure instance-specific timers, convert
@@ -3023,7 +4308,9 @@ multi_process_post(struct multi_context *m, struct multi_instance *mi, const uns
 {
     bool ret = true;
 
-    if (!IS_SIG(&mi->context) && ((flags & MPP_PRE_SELECT) || ((flags & MPP_CONDITIONAL_PRE_SELECT) && !ANY_OUT(&mi->context))))
+    if (!IS_SIG(&mi->context) && ((flags & MPP_PRE_SELECT) || ((flags & MPP_CONDITIONAL_PRE_SELECT) && !ANY_OUT(&mi->context)))
+        && !((flags & MPP_RECV_BATCH) && multi_recv_batch_continues(m, mi))
+        && !((flags & MPP_SKIP_IDLE) && !pre_select_needed(&mi->context)))
     {
 #if defined(ENABLE_ASYNC_PUSH)
         bool was_unauthenticated = true;
@@ -3037,7 +4324,9 @@ multi_process_post(struct multi_context *m, struct multi_instance *mi, const uns
 
         /* figure timeouts and fetch possible outgoing
          * to_link packets (such as ping or TLS control) */
+        const uint64_t load_start = multi_load_start();
         pre_select(&mi->context);
+        multi_load_stop(&mi->load.tls_ns, load_start);
 
 #if defined(ENABLE_ASYNC_PUSH)
         /*
@@ -3045,17 +4334,9 @@ multi_process_post(struct multi_context *m, struct multi_instance *mi, const uns
          * and an auth_control_file, we assume it got just added and add
          * inotify watch to that file
          */
-        if (ks && ks->plugin_auth.auth_control_file && was_unauthenticated
-            && (ks->authenticated == KS_AUTH_DEFERRED))
-        {
-            add_inotify_file_watch(m, mi, m->top.c2.inotify_fd,
-                                   ks->plugin_auth.auth_control_file);
-        }
-        if (ks && ks->script_auth.auth_control_file && was_unauthenticated
-            && (ks->authenticated == KS_AUTH_DEFERRED))
+        if (ks && was_unauthenticated && (ks->authenticated == KS_AUTH_DEFERRED))
         {
-            add_inotify_file_watch(m, mi, m->top.c2.inotify_fd,
-                                   ks->script_auth.auth_control_file);
+            multi_watch_auth_control_file(m, mi, ks);
         }
 #endif
 
@@ -3064,19 +4345,18 @@ multi_process_post(struct multi_context *m, struct multi_instance *mi, const uns
             /* connection is "established" when SSL/TLS key negotiation succeeds
              * and (if specified) auth user/pass succeeds */
 
-            if (is_cas_pending(mi->context.c2.tls_multi->multi_state))
+            if (is_cas_pending(mi->context.c2.tls_multi->multi_state)
+                && multi_client_connect_resume(mi))
             {
                 multi_connection_established(m, mi);
             }
-#if defined(ENABLE_ASYNC_PUSH)
-            if (is_cas_pending(mi->context.c2.tls_multi->multi_state)
-                && mi->client_connect_defer_state.deferred_ret_file)
+            if (is_cas_pending(mi->context.c2.tls_multi->multi_state))
             {
-                add_inotify_file_watch(m, mi, m->top.c2.inotify_fd,
-                                       mi->client_connect_defer_state.
-                                       deferred_ret_file);
-            }
+#if defined(ENABLE_ASYNC_PUSH)
+                multi_watch_deferred_ret_file(m, mi);
 #endif
+                multi_client_connect_schedule(mi);
+            }
             /* tell scheduler to wake us up at some point in the future */
             multi_schedule_context_wakeup(m, mi);
         }
@@ -3092,8 +4372,19 @@ multi_process_post(struct multi_context *m, struct multi_instance *mi, const uns
     }
     else
     {
+        /* link output may have to wait for the traffic shaper */
+        mi->shaper_held = multi_shaper_hold(m, mi);
+
         /* continue to pend on output? */
-        multi_set_pending(m, ANY_OUT(&mi->context) ? mi : NULL);
+        multi_set_pending(m, (TUN_OUT(&mi->context)
+                              || (LINK_OUT(&mi->context) && !mi->shaper_held))
+                          ? mi : NULL);
+
+        /* an idle instance does not need pooled workspace buffers */
+        if (!ANY_OUT(&mi->context))
+        {
+            context_buffers_release(mi->context.c2.buffers);
+        }
 
 #ifdef MULTI_DEBUG_EVENT_LOOP
         printf("POST %s[%d] to=%d lo=%d/%d w=%" PRIi64 "/%ld\n",
@@ -3128,11 +4419,10 @@ multi_process_float(struct multi_context *m, struct multi_instance *mi)
     }
 
     const uint32_t hv = hash_value(hash, &real);
-    struct hash_bucket *bucket = hash_bucket(hash, hv);
 
     /* make sure that we don't float to an address taken by another client */
-    struct hash_element *he = hash_lookup_fast(hash, bucket, &real, hv);
-    if (he)
+    struct hash_element *he = hash_lookup_fast(hash, &real, hv);
+    if (he && he->value != mi)
     {
         struct multi_instance *ex_mi = (struct multi_instance *) he->value;
 
@@ -3275,9 +4565,8 @@ multi_process_incoming_dco(struct multi_context *m)
         return ret > 0;
     }
 
-    if ((peer_id < m->max_clients) && (m->instances[peer_id]))
+    if ((mi = multi_peer_id_lookup(m, peer_id)))
     {
-        mi = m->instances[peer_id];
         if (dco->dco_message_type == OVPN_CMD_DEL_PEER)
         {
             process_incoming_del_peer(m, mi, dco);
@@ -3316,6 +4605,29 @@ multi_process_incoming_dco(struct multi_context *m)
 }
 #endif /* if defined(ENABLE_DCO) && defined(TARGET_LINUX) */
 
+/*
+ * Answer the ARP request or neighbor solicitation in buf from m->pending
+ * in place of the client that owns the address it asks for, if any.
+ */
+static bool
+multi_neighbor_proxy(struct multi_context *m, const struct buffer *buf, uint16_t vid)
+{
+    struct gc_arena gc = gc_new();
+    const struct frame *frame = &m->top.c2.frame;
+    struct buffer reply = alloc_buf_gc(BUF_SIZE(frame), &gc);
+    bool ret = false;
+
+    ASSERT(buf_init(&reply, frame->buf.headroom));
+    if (neighbor_proxy_reply(m->neighbor_proxy, m->pending, buf, vid, &reply))
+    {
+        multi_unicast(m, &reply, m->pending, NULL);
+        ret = true;
+    }
+
+    gc_free(&gc);
+    return ret;
+}
+
 /*
  * Process packets in the TCP/UDP socket -> TUN/TAP interface direction,
  * i.e. client -> server direction.
@@ -3375,13 +4687,19 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
 
             /* decrypt in instance context */
 
+            const uint64_t load_start = multi_load_start();
             perf_push(PERF_PROC_IN_LINK);
             lsi = get_link_socket_info(c);
             orig_buf = c->c2.buf.data;
             if (process_incoming_link_part1(c, lsi, floated))
             {
                 /* nonzero length means that we have a valid, decrypted packed */
-                if (floated && c->c2.buf.len > 0)
+                if (c->c2.buf.len > 0 && c->c2.multipath
+                    && multipath_incoming(c->c2.multipath, &m->top.c2.from, !floated))
+                {
+                    /* a path of a --multipath client, not a float */
+                }
+                else if (floated && c->c2.buf.len > 0)
                 {
                     multi_process_float(m, m->pending);
                 }
@@ -3389,6 +4707,7 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
                 process_incoming_link_part2(c, lsi, orig_buf);
             }
             perf_pop();
+            multi_load_stop(&m->pending->load.link_ns, load_start);
 
             if (TUNNEL_TYPE(m->top.c1.tuntap) == DEV_TYPE_TUN)
             {
@@ -3420,14 +4739,21 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
                     }
                     c->c2.to_tun.len = 0;
                 }
+                /* filtered by the client's --acl? */
+                else if (c->options.acl
+                         && !acl_permits(c->options.acl, ACL_IN, &c->c2.to_tun))
+                {
+                    ++m->acl_drops;
+                    msg(D_MULTI_DROPPED, "MULTI: packet from client dropped by --acl");
+                    c->c2.to_tun.len = 0;
+                }
                 /* client-to-client communication enabled? */
                 else if (m->enable_c2c)
                 {
                     /* multicast? */
                     if (mroute_flags & MROUTE_EXTRACT_MCAST)
                     {
-                        /* for now, treat multicast as broadcast */
-                        multi_bcast(m, &c->c2.to_tun, m->pending, NULL, 0);
+                        multi_mcast(m, &c->c2.to_tun, m->pending, DEV_TYPE_TUN, 0);
                     }
                     else /* possible client to client routing */
                     {
@@ -3437,14 +4763,30 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
                         /* if dest addr is a known client, route to it */
                         if (mi)
                         {
+                            if (mi->context.options.acl
+                                && !acl_permits(mi->context.options.acl, ACL_OUT,
+                                                &c->c2.to_tun))
+                            {
+                                ++m->acl_drops;
+                                msg(D_MULTI_DROPPED, "MULTI: client-to-client packet dropped by --acl of the destination");
+                            }
+                            else
                             {
-                                multi_unicast(m, &c->c2.to_tun, mi);
+                                multi_unicast(m, &c->c2.to_tun, mi, m->pending);
                                 register_activity(c, BLEN(&c->c2.to_tun));
                             }
                             c->c2.to_tun.len = 0;
                         }
                     }
                 }
+
+                /* IGMP/MLD reports of a client with a valid source address */
+                if (m->mcast_snoop && (mroute_flags & MROUTE_EXTRACT_MCAST)
+                    && BLEN(&c->c2.to_tun))
+                {
+                    mcast_snoop_learn(m->mcast_snoop, m->pending, &c->c2.to_tun,
+                                      DEV_TYPE_TUN, 0);
+                }
             }
             else if (TUNNEL_TYPE(m->top.c1.tuntap) == DEV_TYPE_TAP)
             {
@@ -3474,13 +4816,34 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
                 {
                     if (multi_learn_addr(m, m->pending, &src, 0) == m->pending)
                     {
+                        /* ARP/ND addresses of the client */
+                        if (m->neighbor_proxy)
+                        {
+                            neighbor_proxy_learn(m->neighbor_proxy, m->pending,
+                                                 &c->c2.to_tun, vid);
+                        }
+
+                        /* IGMP/MLD reports of the client */
+                        if (m->mcast_snoop && (mroute_flags & MROUTE_EXTRACT_BCAST))
+                        {
+                            mcast_snoop_learn(m->mcast_snoop, m->pending,
+                                              &c->c2.to_tun, DEV_TYPE_TAP, vid);
+                        }
+
                         /* check for broadcast */
                         if (m->enable_c2c)
                         {
-                            if (mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
+                            if ((mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
+                                && m->neighbor_proxy
+                                && multi_neighbor_proxy(m, &c->c2.to_tun, vid))
                             {
-                                multi_bcast(m, &c->c2.to_tun, m->pending, NULL,
-                                            vid);
+                                /* answered in place of another client */
+                                c->c2.to_tun.len = 0;
+                            }
+                            else if (mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
+                            {
+                                multi_mcast(m, &c->c2.to_tun, m->pending,
+                                            DEV_TYPE_TAP, vid);
                             }
                             else /* try client-to-client routing */
                             {
@@ -3489,7 +4852,7 @@ multi_process_incoming_link(struct multi_context *m, struct multi_instance *inst
                                 /* if dest addr is a known client, route to it */
                                 if (mi)
                                 {
-                                    multi_unicast(m, &c->c2.to_tun, mi);
+                                    multi_unicast(m, &c->c2.to_tun, mi, m->pending);
                                     register_activity(c, BLEN(&c->c2.to_tun));
                                     c->c2.to_tun.len = 0;
                                 }
@@ -3573,8 +4936,7 @@ multi_process_incoming_tun(struct multi_context *m, const unsigned int mpp_flags
             /* broadcast or multicast dest addr? */
             if (mroute_flags & (MROUTE_EXTRACT_BCAST|MROUTE_EXTRACT_MCAST))
             {
-                /* for now, treat multicast as broadcast */
-                multi_bcast(m, &m->top.c2.buf, NULL, NULL, vid);
+                multi_mcast(m, &m->top.c2.buf, NULL, dev_type, vid);
             }
             else
             {
@@ -3587,6 +4949,21 @@ multi_process_incoming_tun(struct multi_context *m, const unsigned int mpp_flags
 
                     set_prefix(m->pending);
 
+                    if (c->options.acl
+                        && !acl_permits(c->options.acl, ACL_OUT, &m->top.c2.buf))
+                    {
+                        ++m->acl_drops;
+                        msg(D_MULTI_DROPPED, "MULTI: packet to client dropped by --acl");
+                        buf_reset_len(&c->c2.buf);
+                    }
+                    else if (m->pending->shaper_held)
+                    {
+                        /* drop packet, the previous one still waits */
+                        ++m->shaper_drops;
+                        msg(D_MULTI_DROPPED, "MULTI: packet dropped due to traffic shaping (multi_process_incoming_tun)");
+                        buf_reset_len(&c->c2.buf);
+                    }
+                    else
                     {
                         if (multi_output_queue_ready(m, m->pending))
                         {
@@ -3596,13 +4973,16 @@ multi_process_incoming_tun(struct multi_context *m, const unsigned int mpp_flags
                         else
                         {
                             /* drop packet */
+                            ++m->tcp_queue_drops;
                             msg(D_MULTI_DROPPED, "MULTI: packet dropped due to output saturation (multi_process_incoming_tun)");
                             buf_reset_len(&c->c2.buf);
                         }
                     }
 
                     /* encrypt in instance context */
+                    const uint64_t load_start = multi_load_start();
                     process_incoming_tun(c);
+                    multi_load_stop(&m->pending->load.tun_ns, load_start);
 
                     /* postprocess and set wakeup */
                     ret = multi_process_post(m, m->pending, mpp_flags);
@@ -3628,6 +5008,13 @@ multi_get_queue(struct mbuf_set *ms)
     {
         unsigned int pip_flags = PIPV4_PASSTOS | PIPV6_IMCP_NOHOST_SERVER;
 
+        /* queued before the instance output started to wait for the shaper */
+        if (item.instance->shaper_held)
+        {
+            mbuf_free_buf(item.buffer);
+            return NULL;
+        }
+
         set_prefix(item.instance);
         item.instance->context.c2.buf = item.buffer->buf;
         if (item.buffer->flags & MF_UNICAST) /* --mssfix doesn't make sense for broadcast or multicast */
@@ -3651,8 +5038,28 @@ multi_get_queue(struct mbuf_set *ms)
 
 /*
  * Called when an I/O wait times out.  Usually means that a particular
- * client instance object needs timer-based service.
+ * client instance object needs timer-based service.  Other instances
+ * that are due at the same time are served in the same call, up to
+ * MULTI_TIMEOUT_BATCH of them.
+ */
+#define MULTI_TIMEOUT_BATCH 64
+
+/*
+ * Serve a timer wakeup of an instance for which pre_select() has
+ * nothing to do.  Usually one of its keepalive timers expired, or was
+ * pushed back by traffic since the instance was scheduled.
  */
+static bool
+multi_process_keepalive(struct multi_context *m, struct multi_instance *mi, const unsigned int mpp_flags)
+{
+    pre_select_idle(&mi->context);
+    if (!IS_SIG(&mi->context))
+    {
+        multi_schedule_context_wakeup(m, mi);
+    }
+    return multi_process_post(m, mi, mpp_flags & ~(MPP_PRE_SELECT | MPP_CONDITIONAL_PRE_SELECT));
+}
+
 bool
 multi_process_timeout(struct multi_context *m, const unsigned int mpp_flags)
 {
@@ -3663,20 +5070,42 @@ multi_process_timeout(struct multi_context *m, const unsigned int mpp_flags)
 #endif
 
     /* instance marked for wakeup? */
-    if (m->earliest_wakeup)
+    for (int n = 1; m->earliest_wakeup; ++n)
     {
-        if (m->earliest_wakeup == (struct multi_instance *)&m->deferred_shutdown_signal)
+        struct multi_instance *mi = m->earliest_wakeup;
+
+        m->earliest_wakeup = NULL;
+        if (mi == (struct multi_instance *)&m->deferred_shutdown_signal)
         {
             schedule_remove_entry(m->schedule, (struct schedule_entry *) &m->deferred_shutdown_signal);
             throw_signal(m->deferred_shutdown_signal.signal_received);
+            break;
+        }
+
+        set_prefix(mi);
+        if (pre_select_needed(&mi->context))
+        {
+            ret = multi_process_post(m, mi, mpp_flags);
         }
         else
         {
-            set_prefix(m->earliest_wakeup);
-            ret = multi_process_post(m, m->earliest_wakeup, mpp_flags);
-            clear_prefix();
+            ret = multi_process_keepalive(m, mi, mpp_flags);
+        }
+        clear_prefix();
+
+        /* serve the other instances that are already due in the same
+         * pass, unless output is pending or the caller needs to know
+         * the one instance that was touched (TCP) */
+        if (!m->pending && !(mpp_flags & MPP_RECORD_TOUCH)
+            && n < MULTI_TIMEOUT_BATCH)
+        {
+            m->earliest_wakeup = (struct multi_instance *) schedule_get_due(m->schedule);
+            if (m->earliest_wakeup == mi)
+            {
+                /* not rescheduled */
+                m->earliest_wakeup = NULL;
+            }
         }
-        m->earliest_wakeup = NULL;
     }
     return ret;
 }
@@ -3753,58 +5182,395 @@ gremlin_flood_clients(struct multi_context *m)
 }
 #endif /* ifdef ENABLE_DEBUG */
 
-static bool
-stale_route_check_trigger(struct multi_context *m)
-{
-    struct timeval null;
-    CLEAR(null);
-    return event_timeout_trigger(&m->stale_routes_check_et, &null, ETT_DEFAULT);
-}
-
 /*
  * Process timers in the top-level context
  */
-void
-multi_process_per_second_timers_dowork(struct multi_context *m)
+#ifdef ENABLE_MANAGEMENT
+/*
+ * Send >BYTECOUNT_CLI for the established clients in the hash buckets
+ * from m->bytecount_bucket up to end, the management layer leaves out
+ * those whose counters did not change unless asked for all.
+ */
+static void
+multi_bytecount_sweep(struct multi_context *m, const int end)
 {
-    /* possibly reap instances/routes in vhash */
-    multi_reap_process(m);
+    struct hash_iterator hi;
+    struct hash_element *he;
 
-    /* possibly print to status log */
-    if (m->top.c1.status_output)
+    if (m->bytecount_bucket >= end)
+    {
+        return;
+    }
+
+    hash_iterator_init_range(m->hash, &hi, m->bytecount_bucket, end);
+    while ((he = hash_iterator_next(&hi)))
     {
-        if (status_trigger(m->top.c1.status_output))
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        struct context_2 *c2 = &mi->context.c2;
+        struct man_def_auth_context *mdac = &c2->mda_context;
+        const counter_type bytes_in = c2->link_read_bytes + c2->dco_read_bytes;
+        const counter_type bytes_out = c2->link_write_bytes + c2->dco_write_bytes;
+
+        if (!mi->halt
+            && (mdac->flags & (DAF_CONNECTION_ESTABLISHED | DAF_CONNECTION_CLOSED)) == DAF_CONNECTION_ESTABLISHED)
         {
-            multi_print_status(m, m->top.c1.status_output, m->status_file_version);
+            man_bytecount_output_server(&bytes_in, &bytes_out, mdac);
+        }
+    }
+    hash_iterator_free(&hi);
+
+    m->bytecount_bucket = end;
+}
+
+void
+multi_bytecount_continue(struct multi_context *m)
+{
+    multi_bytecount_sweep(m, min_int(m->bytecount_bucket + MULTI_BYTECOUNT_SLICE,
+                                     m->bytecount_due));
+}
+
+/*
+ * Each second, set the share of the client hash that visits every client
+ * once per bytecount interval as due.  The clients of a hash bucket
+ * are therefore reported at the same offset into each interval, and the
+ * work is spread over the interval and, by multi_bytecount_continue(),
+ * over the event loop iterations of each second.
+ */
+static void
+multi_bytecount_process(struct multi_context *m)
+{
+    const int seconds = management_bytecount_seconds(management);
+    if (seconds <= 0)
+    {
+        m->bytecount_bucket = 0;
+        m->bytecount_due = 0;
+        return;
+    }
+
+    /* what the previous second did not get to */
+    multi_bytecount_sweep(m, m->bytecount_due);
+
+    const int n_buckets = hash_n_buckets(m->hash);
+    if (m->bytecount_bucket >= n_buckets)
+    {
+        m->bytecount_bucket = 0;
+    }
+    if (m->bytecount_bucket == 0)
+    {
+        multi_dco_update_stats(m);
+    }
+
+    const int step = (n_buckets + seconds - 1) / seconds;
+    m->bytecount_due = min_int(m->bytecount_bucket + step, n_buckets);
+    multi_bytecount_continue(m);
+}
+
+/*
+ * Tell the management client when the CPU share of a client rises above
+ * --management-load-alert percent, and again when it has fallen below
+ * half of that, so that it can move heavy clients to a different server.
+ */
+static void
+multi_load_alert(struct multi_instance *mi, const int percent)
+{
+    struct multi_load *load = &mi->load;
+    const double cpu = load->cpu_rate / 1e7;
+
+    if (!load->alerted && cpu >= percent)
+    {
+        load->alerted = true;
+    }
+    else if (load->alerted && cpu < percent / 2.0)
+    {
+        load->alerted = false;
+    }
+    else
+    {
+        return;
+    }
+
+    struct gc_arena gc = gc_new();
+    const char *state = load->alerted ? "HIGH" : "NORMAL";
+    msg(M_INFO, "%s load %s: %.1f%% CPU",
+        multi_instance_string(mi, false, &gc), state, cpu);
+    msg(M_CLIENT, ">LOAD:%s,%lu,%.1f", state,
+        mi->context.c2.mda_context.cid, cpu);
+    gc_free(&gc);
+}
+
+/*
+ * Update the load rates of all clients, as moving averages which
+ * follow a change of the load within about eight seconds.
+ */
+static void
+multi_load_update(struct multi_context *m)
+{
+    const time_t elapsed = now - m->load_updated;
+    if (elapsed <= 0)
+    {
+        return;
+    }
+    const double weight = elapsed >= 8 ? 1.0 : elapsed / 8.0;
+    const int alert = m->top.options.management_load_alert;
+    m->load_updated = now;
+    m->tcp_deferred = 0;
+    m->tcp_deferred_max = 0;
+
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(m->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        const struct context_2 *c2 = &mi->context.c2;
+        struct multi_load *load = &mi->load;
+
+        const uint64_t ns = load->link_ns + load->tun_ns + load->tls_ns;
+        const counter_type packets = c2->link_read_packets + c2->link_write_packets;
+        const counter_type bytes = c2->link_read_bytes + c2->link_write_bytes
+                                   + c2->dco_read_bytes + c2->dco_write_bytes;
+        const int handshakes = c2->tls_multi ? c2->tls_multi->n_sessions : 0;
+
+        load->cpu_rate += weight * ((double)(ns - load->last_ns) / elapsed - load->cpu_rate);
+        load->pps_rate += weight * ((double)(packets - load->last_packets) / elapsed - load->pps_rate);
+        load->bps_rate += weight * ((double)(bytes - load->last_bytes) / elapsed - load->bps_rate);
+        load->handshake_rate += weight * ((double)(handshakes - load->last_handshakes) / elapsed
+                                          - load->handshake_rate);
+
+        load->last_ns = ns;
+        load->last_packets = packets;
+        load->last_bytes = bytes;
+        load->last_handshakes = handshakes;
+
+        if (alert)
+        {
+            multi_load_alert(mi, alert);
+        }
+
+        if (mi->tcp_link_out_deferred)
+        {
+            const unsigned int queued = mbuf_len(mi->tcp_link_out_deferred);
+            m->tcp_deferred += queued;
+            m->tcp_deferred_max = max_uint(m->tcp_deferred_max, queued);
+        }
+    }
+    hash_iterator_free(&hi);
+}
+#endif /* ifdef ENABLE_MANAGEMENT */
+
+#ifdef ENABLE_MEMSTATS
+/*
+ * Copy the state of each client into its --memstats slot, and release
+ * the slots of clients that are gone.
+ */
+static void
+multi_mstats_update_clients(struct multi_context *m)
+{
+    for (int i = 0; i < m->max_clients; ++i)
+    {
+        volatile struct mmap_stats_client *slot = mstats_client(i);
+        if (!slot)
+        {
+            break;
+        }
+
+        const struct multi_instance *mi = m->instances[i];
+        const uint32_t seq = slot->seq;
+        if (!mi || mi->halt)
+        {
+            if (slot->state != MSTATS_UNDEF)
+            {
+                slot->seq = seq + 1;
+                slot->state = MSTATS_UNDEF;
+                slot->seq = seq + 2;
+            }
+            continue;
+        }
+
+        const struct context_2 *c2 = &mi->context.c2;
+        const struct tls_multi *multi = c2->tls_multi;
+        const struct reliable *rel = multi->session[TM_ACTIVE].key[KS_PRIMARY].send_reliable;
+        const char *cn = tls_common_name(multi, true);
+        const in_addr_t vaddr = htonl(mi->reporting_addr);
+        struct mmap_stats_client cs;
+
+        CLEAR(cs);
+        cs.seq = seq + 1;
+        cs.state = MSTATS_ACTIVE;
+        cs.peer_id = i;
+        cs.srtt_ms = rel ? rel->srtt_ms : 0;
+        cs.bytes_in = c2->link_read_bytes + c2->dco_read_bytes;
+        cs.bytes_out = c2->link_write_bytes + c2->dco_write_bytes;
+        cs.packets_in = c2->link_read_packets;
+        cs.packets_out = c2->link_write_packets;
+        cs.connected_since = mi->created;
+        if (slot->state != MSTATS_ACTIVE || slot->connected_since != mi->created)
+        {
+            cs.last_activity = mi->created;
+        }
+        else
+        {
+            cs.last_activity = cs.bytes_in != slot->bytes_in ? now : slot->last_activity;
+        }
+        memcpy(cs.vaddr, &vaddr, sizeof(cs.vaddr));
+        memcpy(cs.vaddr_ipv6, &mi->reporting_addr_ipv6, sizeof(cs.vaddr_ipv6));
+        if (cn)
+        {
+            strncpynt(cs.common_name, cn, sizeof(cs.common_name));
+        }
+
+        slot->seq = seq + 1;
+        *slot = cs;
+        slot->seq = seq + 2;
+    }
+}
+#endif /* ifdef ENABLE_MEMSTATS */
+
+/* Send every connected client to the peer server, see --replicate-peer */
+static void
+multi_replica_snapshot(struct multi_context *m)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(m->iter, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        struct handoff_client hc;
+        if (multi_export_client(mi, &hc))
+        {
+            replica_client_up(m->replica, &hc);
+        }
+    }
+    hash_iterator_free(&hi);
+}
+
+void
+multi_process_per_second_timers_dowork(struct multi_context *m)
+{
+#ifdef ENABLE_MANAGEMENT
+    if (management)
+    {
+        multi_bytecount_process(m);
+        multi_load_update(m);
+    }
+#endif
+
+    /* possibly reap instances/routes in vhash */
+    multi_reap_process(m);
+
+    /* expire multicast group memberships */
+    if (m->mcast_snoop)
+    {
+        mcast_snoop_sweep(m->mcast_snoop);
+    }
+
+    /* expire learned ARP/ND addresses */
+    if (m->neighbor_proxy)
+    {
+        neighbor_proxy_sweep(m->neighbor_proxy);
+    }
+
+    /* account for datagrams the kernel dropped, maybe grow --rcvbuf */
+    link_socket_check_drops(m->top.c2.link_socket);
+
+    /* possibly print to status log */
+    if (m->top.c1.status_output)
+    {
+        if (m->status_section == MULTI_STATUS_IDLE
+            && status_trigger(m->top.c1.status_output))
+        {
+            multi_status_file_continue(m);
         }
     }
 
     /* possibly flush ifconfig-pool file */
     multi_ifconfig_pool_persist(m, false);
 
+#ifdef ENABLE_MEMSTATS
+    if (mmap_stats)
+    {
+        multi_dco_update_stats(m);
+        multi_mstats_update_clients(m);
+    }
+    mstats_update();
+#endif
+
 #ifdef ENABLE_DEBUG
     gremlin_flood_clients(m);
 #endif
 
-    /* Should we check for stale routes? */
-    if (m->top.options.stale_routes_check_interval && stale_route_check_trigger(m))
+    /* talk to the peer server, it may need all our clients */
+    if (replica_process(m->replica, m->ifconfig_pool))
     {
-        check_stale_routes(m);
+        multi_replica_snapshot(m);
     }
+
+#if UNIX_SOCK_SUPPORT
+    /* a new process wants to take over the clients, see --handoff */
+    if (socket_defined(m->handoff_listen_sd) && !socket_defined(m->handoff_sd))
+    {
+        m->handoff_sd = handoff_accept(m->handoff_listen_sd);
+        if (socket_defined(m->handoff_sd))
+        {
+            msg(M_INFO, "HANDOFF: a new process connected, handing over the clients");
+            register_signal(m->top.sig, SIGTERM, "handoff");
+        }
+    }
+#endif
 }
 
 void
 multi_top_init(struct multi_context *m, struct context *top)
 {
     inherit_context_top(&m->top, top);
+    m->parent = top;
     m->top.c2.buffers = init_context_buffers(&top->c2.frame);
+
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+    /* the key operations of all clients served in one pass of the
+     * event loop are sent to the kernel together */
+    if (dco_enabled(&top->options))
+    {
+        dco_batch_begin(&top->c1.tuntap->dco, multi_dco_batch_error, m);
+    }
+#endif
+
+    /* TCP instances only hold workspace buffers while they have
+     * packets in flight (UDP instances share the ones of top) */
+    if (!proto_is_dgram(top->options.ce.proto))
+    {
+        m->top.c2.buffer_pool = buffer_pool_new(BUF_SIZE(&top->c2.frame));
+        buffer_pool_use_huge_pages(m->top.c2.buffer_pool);
+    }
 }
 
 void
 multi_top_free(struct multi_context *m)
 {
+#if defined(ENABLE_DCO) && defined(TARGET_LINUX)
+    if (dco_enabled(&m->top.options))
+    {
+        dco_batch_end(&m->top.c1.tuntap->dco);
+    }
+#endif
     close_context(&m->top, -1, CC_GC_FREE);
     free_context_buffers(m->top.c2.buffers);
+    buffer_pool_free(m->top.c2.buffer_pool);
+
+    while (m->reloads)
+    {
+        struct multi_reload *r = m->reloads;
+        m->reloads = r->next;
+        if (tls_ctx_initialised(&r->old_ssl_ctx))
+        {
+            tls_ctx_free(&r->old_ssl_ctx);
+        }
+        uninit_options(&r->options);
+        free(r);
+    }
 }
 
 static bool
@@ -3820,34 +5586,347 @@ multi_push_restart_schedule_exit(struct multi_context *m, bool next_server)
     struct hash_element *he;
     struct timeval tv;
 
-    /* tell all clients to restart */
-    hash_iterator_init(m->iter, &hi);
-    while ((he = hash_iterator_next(&hi)))
+    /* tell all clients to restart */
+    hash_iterator_init(m->iter, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        if (!mi->halt)
+        {
+            send_control_channel_string(&mi->context, next_server ? "RESTART,[N]" : "RESTART", D_PUSH);
+            multi_schedule_context_wakeup(m, mi);
+        }
+    }
+    hash_iterator_free(&hi);
+
+    /* reschedule signal */
+    ASSERT(!openvpn_gettimeofday(&m->deferred_shutdown_signal.wakeup, NULL));
+    tv.tv_sec = 2;
+    tv.tv_usec = 0;
+    tv_add(&m->deferred_shutdown_signal.wakeup, &tv);
+
+    m->deferred_shutdown_signal.signal_received = m->top.sig->signal_received;
+
+    schedule_add_entry(m->schedule,
+                       (struct schedule_entry *) &m->deferred_shutdown_signal,
+                       &m->deferred_shutdown_signal.wakeup,
+                       compute_wakeup_sigma(&m->deferred_shutdown_signal.wakeup));
+
+    signal_reset(m->top.sig, 0);
+}
+
+/*
+ * Read the configuration again and apply it without disconnecting the
+ * clients (--live-reload).  Certificates, keys and the CRL take effect
+ * for new TLS sessions, including the renegotiations of connected
+ * clients.  Pushed options can only reach a client on a reconnect, so
+ * the clients that were already sent the old ones are asked to
+ * reconnect if they changed.
+ *
+ * Returns false if an option changed that needs a restart.
+ */
+static bool
+multi_live_reload(struct multi_context *m)
+{
+    struct context *top = &m->top;
+    struct multi_reload *r;
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    msg(M_INFO, "Live reload: reading the configuration");
+
+    ALLOC_OBJ_CLEAR(r, struct multi_reload);
+    init_options(&r->options, true);
+    parse_argv(&r->options, top->argc, top->argv, M_USAGE, OPT_P_DEFAULT,
+               NULL, top->es);
+    init_options_dev(&r->options);
+    options_postprocess(&r->options, top->es);
+
+    if (!options_live_reload_check(&top->options, &r->options))
+    {
+        uninit_options(&r->options);
+        free(r);
+        return false;
+    }
+
+    const bool in_chroot = m->parent->c0 && m->parent->c0->uid_gid_chroot_set;
+    if (!tls_ctx_reload(&r->options, &top->c1.ks.ssl_ctx, &r->old_ssl_ctx,
+                        in_chroot))
+    {
+        uninit_options(&r->options);
+        free(r);
+        return true;
+    }
+    /* the parent stashes it for the next restart */
+    m->parent->c1.ks.ssl_ctx = top->c1.ks.ssl_ctx;
+
+    const bool push_changed = !push_list_equal(&top->options.push_list,
+                                               &r->options.push_list);
+    push_reply_cache_init(&r->options);
+    options_live_reload_apply(&top->options, &r->options);
+
+    int n_restarted = 0;
+    hash_iterator_init(m->iter, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        struct context *c = &mi->context;
+
+        c->c1.ks.ssl_ctx = top->c1.ks.ssl_ctx;
+        if (c->c2.tls_multi)
+        {
+            c->c2.tls_multi->opt.ssl_ctx = top->c1.ks.ssl_ctx;
+            c->c2.tls_multi->opt.crl_file = top->options.crl_file;
+            c->c2.tls_multi->opt.crl_file_inline = top->options.crl_file_inline;
+        }
+
+        if (push_changed)
+        {
+            if (c->options.push_list_shared)
+            {
+                c->options.push_list = top->options.push_list;
+                c->options.push_cache = top->options.push_cache;
+            }
+            if (!mi->halt && c->c2.sent_push_reply_expiry)
+            {
+                send_control_channel_string(c, "RESTART", D_PUSH);
+                multi_schedule_context_wakeup(m, mi);
+                ++n_restarted;
+            }
+        }
+    }
+    hash_iterator_free(&hi);
+
+    r->next = m->reloads;
+    m->reloads = r;
+
+    msg(M_INFO, "Live reload: configuration applied, %d clients asked to reconnect",
+        n_restarted);
+    return true;
+}
+
+#if UNIX_SOCK_SUPPORT
+/*
+ * Send the socket, the tun device and the clients to the process that
+ * connected to the --handoff socket.
+ */
+static bool
+multi_handoff_send(struct multi_context *m)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+    int n_sent = 0;
+    int n_left = 0;
+    bool ret = true;
+
+    if (!handoff_send_begin(m->handoff_sd, m->top.c2.link_socket->sd,
+                            m->top.c1.tuntap->fd, m->top.c1.tuntap->actual_name))
+    {
+        return false;
+    }
+
+    hash_iterator_init(m->iter, &hi);
+    while (ret && (he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        struct handoff_client hc;
+
+        /* the keys of the TLS session go along, if they can */
+        if (!multi_export_client(mi, &hc)
+            || !tls_session_handoff_export(mi->context.c2.tls_multi, &hc.tls))
+        {
+            ++n_left;
+            continue;
+        }
+        ret = handoff_send_client(m->handoff_sd, &hc);
+        secure_memzero(&hc.tls, sizeof(hc.tls));
+        ++n_sent;
+    }
+    hash_iterator_free(&hi);
+
+    if (ret && handoff_send_end(m->handoff_sd))
+    {
+        msg(M_INFO, "HANDOFF: handed over %d clients, %d others will reconnect",
+            n_sent, n_left);
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Set up a client taken over from the old process like
+ * multi_client_connect_late_setup() does after a connect, from the
+ * state it sent instead of the options and scripts.
+ */
+static void
+multi_handoff_import_instance(struct multi_context *m,
+                              const struct handoff_client *hc)
+{
+    struct gc_arena gc = gc_new();
+    struct multi_instance *mi;
+    struct mroute_addr real;
+
+    if (!mroute_extract_openvpn_sockaddr(&real, &hc->remote.dest, true)
+        || (multi_peer_id_index(m, hc->peer_id) < 0 && hc->use_peer_id)
+        || multi_peer_id_lookup(m, hc->peer_id))
+    {
+        msg(D_MULTI_ERRORS, "HANDOFF: cannot take over %s, address or peer-id in use",
+            np(hc->common_name));
+        gc_free(&gc);
+        return;
+    }
+
+    mi = multi_create_instance(m, &real);
+    if (!mi)
+    {
+        gc_free(&gc);
+        return;
+    }
+    if (!hash_add(m->hash, &mi->real, mi, false))
+    {
+        goto err;
+    }
+    mi->did_real_hash = true;
+    mi->created = hc->created;
+
+    struct context *c = &mi->context;
+    struct tls_multi *multi = c->c2.tls_multi;
+
+    if (multi_peer_id_index(m, hc->peer_id) >= 0)
+    {
+        multi->peer_id = hc->peer_id;
+        m->instances[multi_peer_id_index(m, hc->peer_id)] = mi;
+    }
+    else
+    {
+        multi_assign_peer_id(m, mi);
+    }
+    multi->use_peer_id = hc->use_peer_id;
+
+    c->c2.from = hc->remote;
+    c->c2.to_link_addr = &c->c2.from;
+    c->c2.link_socket_info->lsa->actual = hc->remote;
+    c->c2.link_socket_info->connection_established = true;
+
+    /* identity, as locked at the original connect */
+    multi->session[TM_ACTIVE].common_name = string_alloc(hc->common_name, NULL);
+    multi->locked_cn = string_alloc(hc->common_name, NULL);
+    multi->locked_username = string_alloc(hc->username, NULL);
+    multi->peer_info = string_alloc(hc->peer_info, NULL);
+    if (hc->cert_hash_mask)
+    {
+        struct cert_hash_set *chs;
+        ALLOC_OBJ_CLEAR(chs, struct cert_hash_set);
+        for (int i = 0; i < MAX_CERT_DEPTH; ++i)
+        {
+            if (hc->cert_hash_mask & (1u << i))
+            {
+                ALLOC_OBJ(chs->ch[i], struct cert_hash);
+                *chs->ch[i] = hc->cert_hash[i];
+            }
+        }
+        multi->locked_cert_hash_set = chs;
+    }
+    generate_prefix(mi);
+
+    /* the strings and lists live in m->handoff */
+    c->options.ciphername = hc->ciphername;
+    c->options.authname = hc->authname;
+    c->options.iroutes = hc->iroutes;
+    c->options.iroutes_ipv6 = hc->iroutes_ipv6;
+    c->options.acl = hc->acl;
+    c->options.vlan_pvid = hc->vlan_pvid;
+
+    c->c2.push_ifconfig_defined = hc->ifconfig_defined;
+    c->c2.push_ifconfig_local = hc->ifconfig_local;
+    c->c2.push_ifconfig_remote_netmask = hc->ifconfig_remote_netmask;
+    c->c2.push_ifconfig_local_alias = hc->ifconfig_local_alias;
+    c->c2.push_ifconfig_ipv6_defined = hc->ifconfig_ipv6_defined;
+    c->c2.push_ifconfig_ipv6_local = hc->ifconfig_ipv6_local;
+    c->c2.push_ifconfig_ipv6_netbits = hc->ifconfig_ipv6_netbits;
+    c->c2.push_ifconfig_ipv6_remote = hc->ifconfig_ipv6_remote;
+    if (hc->pool_handle >= 0)
+    {
+        mi->vaddr_handle = ifconfig_pool_claim(m->ifconfig_pool, hc->pool_handle,
+                                               hc->ifconfig_ipv6_defined
+                                               ? &hc->ifconfig_ipv6_local : NULL,
+                                               hc->common_name);
+    }
+
+    struct frame *frame_fragment = NULL;
+#ifdef ENABLE_FRAGMENT
+    if (c->options.ce.fragment)
+    {
+        frame_fragment = &c->c2.frame_fragment;
+    }
+#endif
+    if (!tls_session_handoff_import(multi, &hc->tls, &hc->remote, &c->options,
+                                    &c->c2.frame, frame_fragment,
+                                    get_link_socket_info(c)))
+    {
+        goto err;
+    }
+
+    multi_cn_index_add(m, mi);
+    vlan_index_update(m, mi);
+
+    if (TUNNEL_TYPE(c->c1.tuntap) == DEV_TYPE_TUN)
     {
-        struct multi_instance *mi = (struct multi_instance *) he->value;
-        if (!mi->halt)
+        if (c->c2.push_ifconfig_defined)
         {
-            send_control_channel_string(&mi->context, next_server ? "RESTART,[N]" : "RESTART", D_PUSH);
-            multi_schedule_context_wakeup(m, mi);
+            multi_learn_in_addr_t(m, mi, c->c2.push_ifconfig_local, -1, true);
+        }
+        if (c->c2.push_ifconfig_ipv6_defined)
+        {
+            multi_learn_in6_addr(m, mi, c->c2.push_ifconfig_ipv6_local, -1, true);
         }
+        multi_add_iroutes(m, mi);
     }
-    hash_iterator_free(&hi);
+    mi->reporting_addr = c->c2.push_ifconfig_local;
+    mi->reporting_addr_ipv6 = c->c2.push_ifconfig_ipv6_local;
 
-    /* reschedule signal */
-    ASSERT(!openvpn_gettimeofday(&m->deferred_shutdown_signal.wakeup, NULL));
-    tv.tv_sec = 2;
-    tv.tv_usec = 0;
-    tv_add(&m->deferred_shutdown_signal.wakeup, &tv);
+    multi_set_virtual_addr_env(mi);
+    setenv_str(c->c2.es, "common_name", hc->common_name);
+    setenv_str(c->c2.es, "username", hc->username);
 
-    m->deferred_shutdown_signal.signal_received = m->top.sig->signal_received;
+    multi->multi_state = CAS_CONNECT_DONE;
+    ++m->n_clients;
+    update_mstat_n_clients(m->n_clients);
+    --mi->n_clients_delta;
 
-    schedule_add_entry(m->schedule,
-                       (struct schedule_entry *) &m->deferred_shutdown_signal,
-                       &m->deferred_shutdown_signal.wakeup,
-                       compute_wakeup_sigma(&m->deferred_shutdown_signal.wakeup));
+#ifdef ENABLE_MANAGEMENT
+    if (management)
+    {
+        management_connection_established(management, &c->c2.mda_context,
+                                          c->c2.es);
+    }
+#endif
 
-    signal_reset(m->top.sig, 0);
+    msg(D_MULTI_LOW, "HANDOFF: took over %s", multi_instance_string(mi, false, &gc));
+    multi_process_post(m, mi, MPP_PRE_SELECT);
+    gc_free(&gc);
+    return;
+
+err:
+    msg(D_MULTI_ERRORS, "HANDOFF: cannot take over %s", np(hc->common_name));
+    multi_close_instance(m, mi, false);
+    gc_free(&gc);
+}
+
+void
+multi_handoff_import(struct multi_context *m)
+{
+    struct handoff *h = m->handoff;
+
+    for (int i = 0; i < h->n_clients; ++i)
+    {
+        multi_handoff_import_instance(m, &h->clients[i]);
+        secure_memzero(&h->clients[i].tls, sizeof(h->clients[i].tls));
+    }
+    msg(M_INFO, "HANDOFF: %d of %d clients taken over", m->n_clients,
+        h->n_clients);
 }
+#endif /* if UNIX_SOCK_SUPPORT */
 
 /*
  * Return true if event loop should break,
@@ -3863,6 +5942,36 @@ multi_process_signal(struct multi_context *m)
         status_close(so);
         return false;
     }
+    /* only a SIGHUP from the outside, not one raised by an error */
+    else if (m->top.options.live_reload
+             && m->top.sig->signal_received == SIGHUP
+             && m->top.sig->source == SIG_SOURCE_HARD
+             && multi_live_reload(m))
+    {
+        signal_reset(m->top.sig, SIGHUP);
+        return false;
+    }
+#if UNIX_SOCK_SUPPORT
+    /* raised when a new process connected to the --handoff socket */
+    else if (socket_defined(m->handoff_sd)
+             && m->top.sig->signal_received == SIGTERM)
+    {
+        if (multi_handoff_send(m))
+        {
+            /* leave the device, its addresses and routes to the new
+             * process, which waits for our end of the connection to
+             * close when we exit */
+            m->handed_off = true;
+            m->parent->c1.tuntap_owned = false;
+            return true;
+        }
+        msg(M_WARN, "HANDOFF: failed, keeping the clients");
+        openvpn_close_socket(m->handoff_sd);
+        m->handoff_sd = SOCKET_UNDEFINED;
+        signal_reset(m->top.sig, SIGTERM);
+        return false;
+    }
+#endif
     else if (proto_is_dgram(m->top.options.ce.proto)
              && is_exit_restart(m->top.sig->signal_received)
              && (m->deferred_shutdown_signal.signal_received == 0)
@@ -3901,29 +6010,283 @@ management_callback_n_clients(void *arg)
     return m->n_clients;
 }
 
-static int
-management_callback_kill_by_cn(void *arg, const char *del_cn)
+static void
+management_callback_metrics(void *arg, const int msglevel)
+{
+    struct multi_context *m = (struct multi_context *) arg;
+
+    msg(msglevel, "# TYPE openvpn_clients gauge");
+    msg(msglevel, "# HELP openvpn_clients Authenticated clients.");
+    msg(msglevel, "openvpn_clients %d", m->n_clients);
+    msg(msglevel, "# TYPE openvpn_instances gauge");
+    msg(msglevel, "# HELP openvpn_instances Client instances, including unauthenticated ones.");
+    msg(msglevel, "openvpn_instances %d", hash_n_elements(m->hash));
+    msg(msglevel, "# TYPE openvpn_schedule_entries gauge");
+    msg(msglevel, "# HELP openvpn_schedule_entries Instances waiting for a timed wakeup.");
+    msg(msglevel, "openvpn_schedule_entries %d", m->schedule->size);
+    msg(msglevel, "# TYPE openvpn_mbuf_queued gauge");
+    msg(msglevel, "# HELP openvpn_mbuf_queued Packets waiting in the multi-client output queue.");
+    msg(msglevel, "openvpn_mbuf_queued %u", mbuf_len(m->mbuf));
+    msg(msglevel, "# TYPE openvpn_mbuf_queued_max gauge");
+    msg(msglevel, "# HELP openvpn_mbuf_queued_max High water mark of the multi-client output queue.");
+    msg(msglevel, "openvpn_mbuf_queued_max %d", mbuf_maximum_queued(m->mbuf));
+    msg(msglevel, "# TYPE openvpn_mbuf_capacity gauge");
+    msg(msglevel, "# HELP openvpn_mbuf_capacity Size of the multi-client output queue.");
+    msg(msglevel, "openvpn_mbuf_capacity %u", m->mbuf->capacity);
+    if (m->mtcp)
+    {
+        msg(msglevel, "# TYPE openvpn_tcp_queued gauge");
+        msg(msglevel, "# HELP openvpn_tcp_queued Packets waiting in the output queues of the TCP clients.");
+        msg(msglevel, "openvpn_tcp_queued %u", m->tcp_deferred);
+        msg(msglevel, "# TYPE openvpn_tcp_queued_max gauge");
+        msg(msglevel, "# HELP openvpn_tcp_queued_max Packets waiting in the longest output queue of a TCP client.");
+        msg(msglevel, "openvpn_tcp_queued_max %u", m->tcp_deferred_max);
+    }
+    msg(msglevel, "# TYPE openvpn_tcp_queue_drops counter");
+    msg(msglevel, "# HELP openvpn_tcp_queue_drops Packets dropped because a TCP client queue reached --tcp-queue-limit.");
+    msg(msglevel, "openvpn_tcp_queue_drops_total " counter_format, m->tcp_queue_drops);
+    msg(msglevel, "# TYPE openvpn_shaper_drops counter");
+    msg(msglevel, "# HELP openvpn_shaper_drops Packets dropped because the client's output waited for --shaper or --shaper-total.");
+    msg(msglevel, "openvpn_shaper_drops_total " counter_format, m->shaper_drops);
+    msg(msglevel, "# TYPE openvpn_acl_drops counter");
+    msg(msglevel, "# HELP openvpn_acl_drops Packets dropped by --acl.");
+    msg(msglevel, "openvpn_acl_drops_total " counter_format, m->acl_drops);
+}
+
+/* memory use of one subsystem, see management_callback_memstats() */
+struct mem_usage
+{
+    unsigned int objects;
+    size_t bytes;
+};
+
+static inline void
+mem_usage_add(struct mem_usage *u, const size_t bytes)
+{
+    ++u->objects;
+    u->bytes += bytes;
+}
+
+static void
+management_callback_memstats(void *arg, const int msglevel)
 {
     struct multi_context *m = (struct multi_context *) arg;
+    struct mem_usage instances = { 0 }, tls = { 0 }, reliable = { 0 };
+    struct mem_usage fragment = { 0 }, mbuf = { 0 }, hash = { 0 };
+    struct mem_usage env = { 0 }, push = { 0 };
+
+    mem_usage_add(&mbuf, mbuf_mem_usage(m->mbuf));
+    mem_usage_add(&hash, hash_mem_usage(m->hash));
+    mem_usage_add(&hash, hash_mem_usage(m->vhash));
+    mem_usage_add(&hash, hash_mem_usage(m->iter));
+    mem_usage_add(&hash, hash_mem_usage(m->cid_hash));
+    hash.bytes += hash_n_elements(m->vhash) * sizeof(struct multi_route);
+
     struct hash_iterator hi;
-    struct hash_element *he;
-    int count = 0;
+    const struct hash_element *he;
 
-    hash_iterator_init(m->iter, &hi);
+    hash_iterator_init(m->hash, &hi);
     while ((he = hash_iterator_next(&hi)))
     {
-        struct multi_instance *mi = (struct multi_instance *) he->value;
-        if (!mi->halt)
+        const struct multi_instance *mi = (struct multi_instance *) he->value;
+        const struct context *c = &mi->context;
+
+        mem_usage_add(&instances, sizeof(*mi));
+        if (c->c2.tls_multi)
+        {
+            const struct tls_multi *multi = c->c2.tls_multi;
+            size_t bytes = sizeof(*multi);
+            for (int s = 0; s < TM_SIZE; ++s)
+            {
+                for (int k = 0; k < KS_SIZE; ++k)
+                {
+                    const struct key_state *ks = &multi->session[s].key[k];
+                    bytes += buf_mem_usage(&ks->plaintext_read_buf)
+                             + buf_mem_usage(&ks->plaintext_write_buf)
+                             + buf_mem_usage(&ks->ack_write_buf);
+                    if (ks->send_reliable)
+                    {
+                        mem_usage_add(&reliable, reliable_mem_usage(ks->send_reliable));
+                    }
+                    if (ks->rec_reliable)
+                    {
+                        mem_usage_add(&reliable, reliable_mem_usage(ks->rec_reliable));
+                    }
+                }
+            }
+            mem_usage_add(&tls, bytes);
+        }
+#ifdef ENABLE_FRAGMENT
+        if (c->c2.fragment)
+        {
+            mem_usage_add(&fragment, fragment_mem_usage(c->c2.fragment));
+        }
+#endif
+        if (mi->tcp_link_out_deferred)
         {
-            const char *cn = tls_common_name(mi->context.c2.tls_multi, false);
-            if (cn && !strcmp(cn, del_cn))
+            mem_usage_add(&mbuf, mbuf_mem_usage(mi->tcp_link_out_deferred));
+        }
+        if (c->c2.es)
+        {
+            mem_usage_add(&env, env_set_mem_usage(c->c2.es));
+        }
+        if (!c->options.push_list_shared)
+        {
+            for (const struct push_entry *e = c->options.push_list.head; e; e = e->next)
             {
-                multi_signal_instance(m, mi, SIGTERM);
-                ++count;
+                mem_usage_add(&push, sizeof(*e) + strlen(e->option) + 1);
             }
         }
     }
     hash_iterator_free(&hi);
+
+    msg(msglevel, "MEMSTATS,instances,%u,%zu", instances.objects, instances.bytes);
+    msg(msglevel, "MEMSTATS,instance_cache,%d,%zu", multi_instance_cache.n_free,
+        multi_instance_cache.n_free * sizeof(struct multi_instance));
+    msg(msglevel, "MEMSTATS,tls,%u,%zu", tls.objects, tls.bytes);
+    msg(msglevel, "MEMSTATS,tls_cache,%d,%zu", tls_multi_cache.n_free,
+        tls_multi_cache.n_free * sizeof(struct tls_multi));
+    msg(msglevel, "MEMSTATS,reliable,%u,%zu", reliable.objects, reliable.bytes);
+    msg(msglevel, "MEMSTATS,fragment,%u,%zu", fragment.objects, fragment.bytes);
+    msg(msglevel, "MEMSTATS,mbuf,%u,%zu", mbuf.objects, mbuf.bytes);
+    msg(msglevel, "MEMSTATS,hash,%u,%zu", hash.objects, hash.bytes);
+    msg(msglevel, "MEMSTATS,env_set,%u,%zu", env.objects, env.bytes);
+    msg(msglevel, "MEMSTATS,push_list,%u,%zu", push.objects, push.bytes);
+
+    int chunks, hugetlb;
+    huge_chunks_stats(&chunks, &hugetlb);
+    msg(msglevel, "MEMSTATS,huge_chunks,%d,%zu", chunks,
+        (size_t) chunks * HUGE_CHUNK_SIZE);
+    msg(msglevel, "MEMSTATS,huge_chunks_hugetlb,%d,%zu", hugetlb,
+        (size_t) hugetlb * HUGE_CHUNK_SIZE);
+}
+
+struct top_entry
+{
+    double value;
+    const struct multi_instance *mi;
+};
+
+static int
+top_entry_cmp(const void *a, const void *b)
+{
+    const double va = ((const struct top_entry *) a)->value;
+    const double vb = ((const struct top_entry *) b)->value;
+    return (va < vb) - (va > vb);
+}
+
+static bool
+management_callback_top(void *arg, const int n, const char *sort, const int msglevel)
+{
+    struct multi_context *m = (struct multi_context *) arg;
+    struct gc_arena gc = gc_new();
+    enum { TOP_CPU, TOP_PPS, TOP_BPS, TOP_HANDSHAKES } key;
+
+    if (streq(sort, "cpu"))
+    {
+        key = TOP_CPU;
+    }
+    else if (streq(sort, "pps"))
+    {
+        key = TOP_PPS;
+    }
+    else if (streq(sort, "bps"))
+    {
+        key = TOP_BPS;
+    }
+    else if (streq(sort, "handshakes"))
+    {
+        key = TOP_HANDSHAKES;
+    }
+    else
+    {
+        gc_free(&gc);
+        return false;
+    }
+
+    struct top_entry *entries;
+    int n_entries = 0;
+    ALLOC_ARRAY_CLEAR_GC(entries, struct top_entry, hash_n_elements(m->hash), &gc);
+
+    struct hash_iterator hi;
+    const struct hash_element *he;
+
+    hash_iterator_init(m->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        const struct multi_instance *mi = (struct multi_instance *) he->value;
+        const struct multi_load *load = &mi->load;
+
+        if (mi->halt)
+        {
+            continue;
+        }
+        switch (key)
+        {
+            case TOP_CPU:
+                entries[n_entries].value = load->cpu_rate;
+                break;
+
+            case TOP_PPS:
+                entries[n_entries].value = load->pps_rate;
+                break;
+
+            case TOP_BPS:
+                entries[n_entries].value = load->bps_rate;
+                break;
+
+            case TOP_HANDSHAKES:
+                entries[n_entries].value = load->handshake_rate;
+                break;
+        }
+        entries[n_entries++].mi = mi;
+    }
+    hash_iterator_free(&hi);
+
+    qsort(entries, n_entries, sizeof(entries[0]), top_entry_cmp);
+
+    msg(msglevel, "HEADER,TOP,Common Name,Real Address,Client ID,Peer ID,"
+        "CPU %%,Packets/s,Bytes/s,Handshakes/min,Link ms,Tun ms,TLS ms,Handshakes");
+    for (int i = 0; i < n_entries && i < n; ++i)
+    {
+        const struct multi_instance *mi = entries[i].mi;
+        const struct multi_load *load = &mi->load;
+        const struct tls_multi *multi = mi->context.c2.tls_multi;
+
+        msg(msglevel, "TOP,%s,%s,%lu,%" PRIu32 ",%.1f,%.0f,%.0f,%.1f,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d",
+            tls_common_name(multi, false),
+            mroute_addr_print(&mi->real, &gc),
+            mi->context.c2.mda_context.cid,
+            multi ? multi->peer_id : UINT32_MAX,
+            load->cpu_rate / 1e7,
+            load->pps_rate,
+            load->bps_rate,
+            load->handshake_rate * 60,
+            load->link_ns / 1000000,
+            load->tun_ns / 1000000,
+            load->tls_ns / 1000000,
+            multi ? multi->n_sessions : 0);
+    }
+
+    gc_free(&gc);
+    return true;
+}
+
+static int
+management_callback_kill_by_cn(void *arg, const char *del_cn)
+{
+    struct multi_context *m = (struct multi_context *) arg;
+    int count = 0;
+
+    for (struct multi_instance *mi = multi_cn_index_lookup(m, del_cn);
+         mi; mi = mi->cn_next)
+    {
+        if (!mi->halt)
+        {
+            multi_signal_instance(m, mi, SIGTERM);
+            ++count;
+        }
+    }
     return count;
 }
 
@@ -3931,8 +6294,6 @@ static int
 management_callback_kill_by_addr(void *arg, const in_addr_t addr, const int port)
 {
     struct multi_context *m = (struct multi_context *) arg;
-    struct hash_iterator hi;
-    struct hash_element *he;
     struct openvpn_sockaddr saddr;
     struct mroute_addr maddr;
     int count = 0;
@@ -3943,21 +6304,147 @@ management_callback_kill_by_addr(void *arg, const in_addr_t addr, const int port
     saddr.addr.in4.sin_port = htons(port);
     if (mroute_extract_openvpn_sockaddr(&maddr, &saddr, true))
     {
-        hash_iterator_init(m->iter, &hi);
-        while ((he = hash_iterator_next(&hi)))
+        struct multi_instance *mi = hash_lookup(m->hash, &maddr);
+        if (mi && !mi->halt)
         {
-            struct multi_instance *mi = (struct multi_instance *) he->value;
-            if (!mi->halt && mroute_addr_equal(&maddr, &mi->real))
-            {
-                multi_signal_instance(m, mi, SIGTERM);
-                ++count;
-            }
+            multi_signal_instance(m, mi, SIGTERM);
+            ++count;
         }
-        hash_iterator_free(&hi);
     }
     return count;
 }
 
+/*
+ * A push-update pattern is a common name, or the beginning of
+ * common names followed by '*'.
+ */
+static bool
+push_update_cn_match(const char *pattern, const char *cn)
+{
+    const size_t len = strlen(pattern);
+    if (!cn)
+    {
+        return false;
+    }
+    if (len && pattern[len - 1] == '*')
+    {
+        return !strncmp(pattern, cn, len - 1);
+    }
+    return streq(pattern, cn);
+}
+
+static bool
+management_callback_push_update(void *arg, const char *type, const char *value,
+                                const char *options, const int msglevel)
+{
+    struct multi_context *m = (struct multi_context *) arg;
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(PUSH_BUNDLE_SIZE, &gc);
+    struct hash_iterator hi;
+    struct hash_element *he;
+    const char *cn = NULL;
+    int vid = 0;
+    int sent = 0;
+    int skipped = 0;
+    bool ret = false;
+
+    if (streq(type, "cn"))
+    {
+        cn = value;
+    }
+    else if (streq(type, "vlan"))
+    {
+        vid = atoi(value);
+        if (vid < OPENVPN_8021Q_MIN_VID || vid > OPENVPN_8021Q_MAX_VID)
+        {
+            msg(msglevel, "ERROR: push-update: VLAN ID must be between %d and %d",
+                OPENVPN_8021Q_MIN_VID, OPENVPN_8021Q_MAX_VID);
+            goto done;
+        }
+    }
+    else if (!streq(type, "all"))
+    {
+        msg(msglevel, "ERROR: push-update: unknown selector '%s', use all, cn or vlan", type);
+        goto done;
+    }
+
+    /* the message is the same for every client, so format it once */
+    const unsigned int id = m->push_update_id + 1;
+    if (!push_update_format(&buf, id, options))
+    {
+        msg(msglevel, "ERROR: push-update: only route, route-ipv6, dhcp-option "
+            "and dns options of up to %d bytes in all can be updated", PUSH_BUNDLE_SIZE);
+        goto done;
+    }
+    m->push_update_id = id;
+
+    hash_iterator_init(m->iter, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct multi_instance *mi = (struct multi_instance *) he->value;
+        struct context *c = &mi->context;
+
+        if (mi->halt || !c->c2.tls_multi
+            || c->c2.tls_multi->multi_state != CAS_CONNECT_DONE)
+        {
+            continue;
+        }
+        if ((vid && c->options.vlan_pvid != vid)
+            || (cn && !push_update_cn_match(cn, tls_common_name(c->c2.tls_multi, true))))
+        {
+            continue;
+        }
+        if (!c->c2.push_update_supported)
+        {
+            ++skipped;
+            continue;
+        }
+        send_push_update(c, id, BSTR(&buf));
+        multi_schedule_context_wakeup(m, mi);
+        ++sent;
+    }
+    hash_iterator_free(&hi);
+
+    msg(M_INFO, "PUSH_UPDATE %u sent to %d client(s): %s", id, sent, options);
+    msg(msglevel, "SUCCESS: push-update %u sent to %d client(s), %d client(s) "
+        "without PUSH_UPDATE support", id, sent, skipped);
+    ret = true;
+
+done:
+    gc_free(&gc);
+    return ret;
+}
+
+static bool
+management_callback_push_update_status(void *arg, const int msglevel)
+{
+    struct multi_context *m = (struct multi_context *) arg;
+    struct hash_iterator hi;
+    struct hash_element *he;
+    int count[PUSH_UPDATE_FAILED + 1] = { 0 };
+
+    if (!m->push_update_id)
+    {
+        return false;
+    }
+
+    hash_iterator_init(m->iter, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        const struct multi_instance *mi = (const struct multi_instance *) he->value;
+        if (!mi->halt && mi->context.c2.push_update_id == m->push_update_id)
+        {
+            ++count[mi->context.c2.push_update_state];
+        }
+    }
+    hash_iterator_free(&hi);
+
+    msg(msglevel, "SUCCESS: push-update %u: %d applied, %d failed, %d pending",
+        m->push_update_id, count[PUSH_UPDATE_ACKED], count[PUSH_UPDATE_FAILED],
+        count[PUSH_UPDATE_PENDING]);
+    return true;
+}
+
 static void
 management_delete_event(void *arg, event_t event)
 {
@@ -4057,6 +6544,12 @@ management_client_auth(void *arg,
         ret = tls_authenticate_key(mi->context.c2.tls_multi, mda_key_id, auth, client_reason);
         if (ret)
         {
+            /* act on the answer right away instead of on the next poll */
+            mi->context.c2.timeval.tv_sec = 0;
+            mi->context.c2.timeval.tv_usec = 0;
+            mi->context.c2.pre_select_wakeup = now;
+            multi_schedule_context_wakeup(m, mi);
+
             if (auth)
             {
                 if (mi->context.c2.tls_multi->multi_state <= CAS_WAITING_AUTH)
@@ -4112,10 +6605,15 @@ init_management_callback_multi(struct multi_context *m)
         cb.kill_by_addr = management_callback_kill_by_addr;
         cb.delete_event = management_delete_event;
         cb.n_clients = management_callback_n_clients;
+        cb.metrics = management_callback_metrics;
+        cb.top = management_callback_top;
+        cb.memstats = management_callback_memstats;
         cb.kill_by_cid = management_kill_by_cid;
         cb.client_auth = management_client_auth;
         cb.client_pending_auth = management_client_pending_auth;
         cb.get_peer_info = management_get_peer_info;
+        cb.push_update = management_callback_push_update;
+        cb.push_update_status = management_callback_push_update_status;
         management_set_callback(management, &cb);
     }
 #endif /* ifdef ENABLE_MANAGEMENT */
@@ -4125,13 +6623,13 @@ void
 multi_assign_peer_id(struct multi_context *m, struct multi_instance *mi)
 {
     /* max_clients must be less then max peer-id value */
-    ASSERT(m->max_clients < MAX_PEER_ID);
+    ASSERT((uint32_t) m->max_clients < m->peer_id_index_mask);
 
     for (int i = 0; i < m->max_clients; ++i)
     {
         if (!m->instances[i])
         {
-            mi->context.c2.tls_multi->peer_id = i;
+            mi->context.c2.tls_multi->peer_id = m->peer_id_node | (uint32_t) i;
             m->instances[i] = mi;
             break;
         }
@@ -4139,7 +6637,7 @@ multi_assign_peer_id(struct multi_context *m, struct multi_instance *mi)
 
     /* should not really end up here, since multi_create_instance returns null
      * if amount of clients exceeds max_clients */
-    ASSERT(mi->context.c2.tls_multi->peer_id < m->max_clients);
+    ASSERT(multi_peer_id_lookup(m, mi->context.c2.tls_multi->peer_id) == mi);
 }
 
 
@@ -40,18 +40,28 @@
 #include "perf.h"
 #include "vlan.h"
 #include "reflect_filter.h"
+#include "ccd_cache.h"
+#include "mcast_snoop.h"
+#include "neighbor_proxy.h"
+#include "script_queue.h"
+#include "handoff.h"
+#include "replica.h"
 
 #define MULTI_PREFIX_MAX_LENGTH 256
 
 /*
- * Walk (don't run) through the routing table,
- * deleting old entries, and possibly multi_instance
- * structs as well which have been marked for deletion.
+ * Timing wheel of learned routes with one slot per second.  A route
+ * sits in the slot of the time at which it may become stale, or of the
+ * next pass once its instance has been closed.  Each second the reaper
+ * walks the slot of that second only, so it never has to scan vhash.
+ * Routes which can not age out are not on the wheel until their
+ * instance is closed.
  */
+#define REAP_WHEEL_SLOTS 64     /* must be a power of 2 */
+
 struct multi_reap
 {
-    int bucket_base;
-    int buckets_per_pass;
+    struct multi_route *slots[REAP_WHEEL_SLOTS];
     time_t last_call;
 };
 
@@ -63,6 +73,10 @@ struct deferred_signal_schedule_entry
     struct timeval wakeup;
 };
 
+/** Seconds between calls of a deferred client-connect handler that is
+ *  not told when its result is there */
+#define CLIENT_CONNECT_POLL_INTERVAL 1
+
 /**
  * Detached client connection state.  This is the state that is tracked while
  * the client connect hooks are executed.
@@ -86,6 +100,48 @@ struct client_connect_defer_state
      * returned by the client-connect script
      */
     char *config_file;
+
+    /**
+     * Set when what the deferred handler waits for may have happened,
+     * e.g. deferred_ret_file was written.  The handler is only called
+     * again then, or at resume_at.
+     */
+    bool resume;
+
+    /**
+     * When to call the deferred handler again without being told, for
+     * results that can only be polled, 0 for never.
+     */
+    time_t resume_at;
+
+    /** The result of the deferred handler only comes in deferred_ret_file */
+    bool file_only;
+};
+
+/**
+ * Load caused by one client, shown by the management interface "top"
+ * command.  Only collected while a management interface is configured.
+ */
+struct multi_load
+{
+    /* time spent on the client, in nanoseconds */
+    uint64_t link_ns;           /**< packets received from the client */
+    uint64_t tun_ns;            /**< packets routed to the client */
+    uint64_t tls_ns;            /**< pre_select(), mostly tls_multi_process() */
+
+    /* rates, averaged over the last few seconds */
+    double cpu_rate;            /**< nanoseconds per second */
+    double pps_rate;            /**< transport packets per second */
+    double bps_rate;            /**< transport bytes per second */
+    double handshake_rate;      /**< TLS handshakes per second */
+
+    /* totals at the last rate update */
+    uint64_t last_ns;
+    counter_type last_packets;
+    counter_type last_bytes;
+    int last_handshakes;
+
+    bool alerted;               /**< above --management-load-alert */
 };
 
 /**
@@ -106,6 +162,7 @@ struct multi_instance {
     bool halt;
     int refcount;
     int route_count;           /* number of routes (including cached routes) owned by this instance */
+    struct multi_route *routes; /* list of those routes */
     time_t created;             /**< Time at which a VPN tunnel instance
                                  *   was created.  This parameter is set
                                  *   by the \c multi_create_instance()
@@ -131,17 +188,47 @@ struct multi_instance {
     struct buffer_list *cc_config;
 #endif
     bool did_iroutes;
+    bool replica_restored;      /* connect taken from the peer server */
     int n_clients_delta; /* added to multi_context.n_clients when instance is closed */
 
+    /* traffic shaping, see multi_shaper_hold() */
+    bool shaper_held;           /* to_link waits for the shaper */
+    bool shaper_queued;         /* in the --shaper-total queue */
+    struct multi_instance *shaper_next;
+
+    /* broadcast fan-out per VLAN, see vlan_index_update() */
+    uint16_t vlan_vid;          /* VID of the list we are on, 0 if none */
+    struct multi_instance *vlan_next;
+    struct multi_instance **vlan_pprev;
+
+    /* instances by common name, see multi_cn_index_add() */
+    struct multi_cn_entry *cn_entry; /* list we are on, NULL if none */
+    struct multi_instance *cn_next;
+    struct multi_instance **cn_pprev;
+
+    struct multi_load load;     /* see multi_load_update() */
+
     struct context context;     /**< The context structure storing state
                                  *   for this VPN tunnel. */
     struct client_connect_defer_state client_connect_defer_state;
 #ifdef ENABLE_ASYNC_PUSH
-    int inotify_watch; /* watch descriptor for acf */
+    char *inotify_file; /* name of the watched file in --tmp-dir */
 #endif
 };
 
 
+/**
+ * A configuration read again by --live-reload.  It is kept together with
+ * the TLS context it replaced until the server restarts, because the
+ * clients which connected before the reload still use both.
+ */
+struct multi_reload
+{
+    struct options options;
+    struct tls_root_ctx old_ssl_ctx;
+    struct multi_reload *next;
+};
+
 /**
  * Main OpenVPN server state structure.
  *
@@ -163,6 +250,8 @@ struct multi_context {
     struct hash *iter;          /**< VPN tunnel instances indexed by real
                                  *   address of the remote peer, optimized
                                  *   for iteration. */
+    struct hash *cn_hash;       /**< VPN tunnel instances indexed by their
+                                 *   locked common name. */
     struct schedule *schedule;
     struct mbuf_set *mbuf;      /**< Set of buffers for passing data
                                  *   channel packets between VPN tunnel
@@ -171,19 +260,43 @@ struct multi_context {
                                  *   as external transport. */
     struct ifconfig_pool *ifconfig_pool;
     struct frequency_limit *new_connection_limiter;
+    struct frequency_limit *reneg_limiter;
     struct initial_packet_rate_limit *initial_rate_limiter;
+    struct prefix_rate_limit *prefix_rate_limiter;
+    struct ccd_cache *ccd_cache; /**< --ccd-cache */
+    struct mcast_snoop *mcast_snoop; /**< --multicast-snooping */
+    struct neighbor_proxy *neighbor_proxy; /**< --neighbor-proxy */
+    struct script_queue *script_queue; /**< --script-workers */
     struct mroute_helper *route_helper;
     struct multi_reap *reaper;
     struct mroute_addr local;
     bool enable_c2c;
     int max_clients;
+    uint32_t peer_id_node;      /**< --peer-id-node id, in place */
+    uint32_t peer_id_index_mask; /**< peer-id bits that index \c instances */
     int tcp_queue_limit;
+    int tcp_queue_priority;     /* --tcp-queue-priority size, 0 if disabled */
+    counter_type tcp_queue_drops; /* packets dropped at tcp_queue_limit */
+
+    struct shaper shaper;       /**< --shaper-total */
+    struct multi_instance *shaper_head; /**< Instances waiting for
+                                         *   \c shaper, served in turn. */
+    struct multi_instance **shaper_tail;
+    counter_type shaper_drops;  /* packets dropped while the client's
+                                 * output waited for a shaper */
+    counter_type acl_drops;     /* packets dropped by --acl */
+
+    struct multi_instance **vlan_members; /**< With --vlan-tagging, the
+                                           *   instances indexed by their
+                                           *   PVID, for broadcasts. */
     int status_file_version;
     int n_clients; /* current number of authenticated clients */
 
 #ifdef ENABLE_MANAGEMENT
     struct hash *cid_hash;
     unsigned long cid_counter;
+    unsigned int push_update_id; /**< last push-update of the
+                                  *   management interface */
 #endif
 
     struct multi_instance *pending;
@@ -191,20 +304,44 @@ struct multi_context {
     struct multi_instance **mpp_touched;
     struct context_buffers *context_buffers;
     time_t per_second_trigger;
+    time_t dco_stats_updated;   /**< last dump of all DCO peer stats */
+    int status_section;         /**< part of the status file being
+                                 *   written, see MULTI_STATUS_SLICE */
+    int status_bucket;          /**< next hash bucket of that part */
+#ifdef ENABLE_MANAGEMENT
+    int bytecount_bucket;       /**< next hash bucket of the management
+                                 *   bytecount sweep */
+    int bytecount_due;          /**< hash bucket the sweep is to reach in
+                                 *   this second, see
+                                 *   MULTI_BYTECOUNT_SLICE */
+    time_t load_updated;        /**< last update of the client load rates */
+    unsigned int tcp_deferred;  /**< packets in the TCP client output queues,
+                                 *   at the last load update */
+    unsigned int tcp_deferred_max; /**< longest of those queues */
+#endif
 
     struct context top;         /**< Storage structure for process-wide
                                  *   configuration. */
+    struct context *parent;     /**< The context \c top was cloned from,
+                                 *   which owns the TLS context */
+    struct multi_reload *reloads; /**< Configurations applied by
+                                   *   --live-reload, newest first */
+    struct replica *replica;    /**< --replicate-peer and
+                                 *   --replicate-listen */
+#if UNIX_SOCK_SUPPORT
+    socket_descriptor_t handoff_listen_sd; /**< --handoff listener */
+    socket_descriptor_t handoff_sd; /**< Connection of the process taking
+                                     *   over the clients */
+    bool handed_off;            /**< The clients were moved to it */
+    struct handoff *handoff;    /**< Clients taken over at startup, owns
+                                 *   their --iroute, --acl and cipher names */
+#endif
 
     struct buffer hmac_reply;
     struct link_socket_actual *hmac_reply_dest;
 
-    /*
-     * Timer object for stale route check
-     */
-    struct event_timeout stale_routes_check_et;
-
 #ifdef ENABLE_ASYNC_PUSH
-    /* mapping between inotify watch descriptors and multi_instances */
+    /* mapping between names of watched files and multi_instances */
     struct hash *inotify_watchers;
 #endif
 
@@ -236,6 +373,15 @@ struct multi_route
 
     unsigned int cache_generation;
     time_t last_reference;
+
+    /* list of the routes owned by instance */
+    struct multi_route *instance_next;
+    struct multi_route **instance_pprev;
+
+    /* reaper wheel slot, see struct multi_reap */
+    time_t reap_time;
+    struct multi_route *reap_next;
+    struct multi_route **reap_pprev;
 };
 
 
@@ -253,6 +399,10 @@ struct multi_route
  */
 void tunnel_server(struct context *top);
 
+/** Freed \c multi_instance structures kept for reuse by
+ *  \c multi_create_instance(). */
+extern struct object_cache multi_instance_cache;
+
 
 const char *multi_instance_string(const struct multi_instance *mi, bool null, struct gc_arena *gc);
 
@@ -268,6 +418,16 @@ void multi_top_init(struct multi_context *m, struct context *top);
 
 void multi_top_free(struct multi_context *m);
 
+#if UNIX_SOCK_SUPPORT
+/**
+ * Create instances for the clients in \c m->handoff, which a new process
+ * took over from the old one with --handoff.  Clients that cannot be
+ * set up again are dropped and will reconnect.
+ */
+void multi_handoff_import(struct multi_context *m);
+
+#endif
+
 struct multi_instance *multi_create_instance(struct multi_context *m, const struct mroute_addr *real);
 
 void multi_close_instance(struct multi_context *m, struct multi_instance *mi, bool shutdown);
@@ -288,6 +448,12 @@ void multi_process_float(struct multi_context *m, struct multi_instance *mi);
 #define MPP_CONDITIONAL_PRE_SELECT (1<<1)
 #define MPP_CLOSE_ON_SIGNAL        (1<<2)
 #define MPP_RECORD_TOUCH           (1<<3)
+#define MPP_RECV_BATCH             (1<<4) /* defer pre_select() while the
+                                           * --udp-recv-batch has more data
+                                           * packets from the same peer */
+#define MPP_SKIP_IDLE              (1<<5) /* skip pre_select() for data
+                                           * channel packets unless
+                                           * pre_select_needed() */
 
 
 /**************************************************************************/
@@ -377,6 +543,7 @@ struct multi_instance *multi_get_queue(struct mbuf_set *ms);
 
 void multi_add_mbuf(struct multi_context *m,
                     struct multi_instance *mi,
+                    const struct multi_instance *source,
                     struct mbuf_buffer *mb);
 
 void multi_ifconfig_pool_persist(struct multi_context *m, bool force);
@@ -388,6 +555,14 @@ void multi_close_instance_on_signal(struct multi_context *m, struct multi_instan
 void init_management_callback_multi(struct multi_context *m);
 
 #ifdef ENABLE_ASYNC_PUSH
+/**
+ * Set up the inotify descriptor of the server, with a single watch on
+ * --tmp-dir, where the auth control and client-connect files are.
+ *
+ * @param m multi_context
+ */
+void multi_inotify_init(struct multi_context *m);
+
 /**
  * Called when inotify event is fired, which happens when acf file is closed or deleted.
  * Continues authentication and sends push_repl
@@ -486,14 +661,46 @@ multi_instance_dec_refcount(struct multi_instance *mi)
     if (--mi->refcount <= 0)
     {
         gc_free(&mi->gc);
-        free(mi);
+        object_cache_free(&multi_instance_cache, mi);
     }
 }
 
+/*
+ * Take a route off the reaper wheel.
+ */
+static inline void
+multi_route_unreap(struct multi_route *route)
+{
+    if (route->reap_pprev)
+    {
+        *route->reap_pprev = route->reap_next;
+        if (route->reap_next)
+        {
+            route->reap_next->reap_pprev = route->reap_pprev;
+        }
+        route->reap_next = NULL;
+        route->reap_pprev = NULL;
+    }
+}
+
+/*
+ * Free a route which has already been removed from vhash.
+ */
 static inline void
 multi_route_del(struct multi_route *route)
 {
     struct multi_instance *mi = route->instance;
+
+    multi_route_unreap(route);
+    if (route->instance_pprev)
+    {
+        *route->instance_pprev = route->instance_next;
+        if (route->instance_next)
+        {
+            route->instance_next->instance_pprev = route->instance_pprev;
+        }
+    }
+
     route_quota_dec(mi);
     multi_instance_dec_refcount(mi);
     free(route);
@@ -554,19 +761,26 @@ clear_prefix(void)
     msg_set_prefix(NULL);
 }
 
+/*
+ * The --status file is written in slices of MULTI_STATUS_SLICE hash
+ * buckets, one slice per event loop iteration, and then written to disk
+ * at once. multi_context.status_section tells which part of the file is
+ * being generated.
+ */
+#define MULTI_STATUS_SLICE   256
+#define MULTI_STATUS_IDLE    0
+#define MULTI_STATUS_CLIENTS 1
+#define MULTI_STATUS_ROUTES  2
+#define MULTI_STATUS_DONE    3
+
 /*
  * Instance Reaper
  *
- * Reaper constants.  The reaper is the process where the virtual address
- * and virtual route hash table is scanned for dead entries which are
- * then removed.  The hash table could potentially be quite large, so we
- * don't want to reap in a single pass.
+ * The reaper is the process where dead entries of the virtual address
+ * and virtual route hash table are removed, see struct multi_reap.
  */
 
 #define REAP_MAX_WAKEUP   10  /* Do reap pass at least once per n seconds */
-#define REAP_DIVISOR     256  /* How many passes to cover whole hash table */
-#define REAP_MIN          16  /* Minimum number of buckets per pass */
-#define REAP_MAX        1024  /* Maximum number of buckets per pass */
 
 /*
  * Mark a cached host route for deletion after this
@@ -578,6 +792,19 @@ void multi_reap_process_dowork(const struct multi_context *m);
 
 void multi_process_per_second_timers_dowork(struct multi_context *m);
 
+void multi_status_file_continue(struct multi_context *m);
+
+#ifdef ENABLE_MANAGEMENT
+/*
+ * The >BYTECOUNT_CLI notifications of a second are sent in slices of
+ * MULTI_BYTECOUNT_SLICE hash buckets, one slice per event loop
+ * iteration, so that they do not hold up packets all at once.
+ */
+#define MULTI_BYTECOUNT_SLICE 64
+
+void multi_bytecount_continue(struct multi_context *m);
+#endif
+
 static inline void
 multi_reap_process(const struct multi_context *m)
 {
@@ -595,6 +822,19 @@ multi_process_per_second_timers(struct multi_context *m)
         multi_process_per_second_timers_dowork(m);
         m->per_second_trigger = now;
     }
+    else
+    {
+        if (m->status_section != MULTI_STATUS_IDLE)
+        {
+            multi_status_file_continue(m);
+        }
+#ifdef ENABLE_MANAGEMENT
+        if (m->bytecount_bucket < m->bytecount_due)
+        {
+            multi_bytecount_continue(m);
+        }
+#endif
+    }
 }
 
 /*
@@ -611,10 +851,11 @@ multi_get_timeout(struct multi_context *m, struct timeval *dest)
     struct timeval tv, current;
 
     CLEAR(tv);
+    ASSERT(!openvpn_gettimeofday(&current, NULL));
+    schedule_advance(m->schedule, &current);
     m->earliest_wakeup = (struct multi_instance *) schedule_get_earliest_wakeup(m->schedule, &tv);
     if (m->earliest_wakeup)
     {
-        ASSERT(!openvpn_gettimeofday(&current, NULL));
         tv_delta(dest, &current, &tv);
         if (dest->tv_sec >= REAP_MAX_WAKEUP)
         {
@@ -628,6 +869,28 @@ multi_get_timeout(struct multi_context *m, struct timeval *dest)
         dest->tv_sec = REAP_MAX_WAKEUP;
         dest->tv_usec = 0;
     }
+
+    /* do not wait while the status file is being written or
+     * bytecount notifications are being sent */
+    if (m->status_section != MULTI_STATUS_IDLE
+#ifdef ENABLE_MANAGEMENT
+        || m->bytecount_bucket < m->bytecount_due
+#endif
+        )
+    {
+        m->earliest_wakeup = NULL;
+        dest->tv_sec = 0;
+        dest->tv_usec = 0;
+    }
+
+    /* come back soon to reap scripts from the --script-workers queue */
+    if (script_queue_busy(m->script_queue)
+        && (dest->tv_sec || dest->tv_usec > SCRIPT_QUEUE_POLL_USEC))
+    {
+        m->earliest_wakeup = NULL;
+        dest->tv_sec = 0;
+        dest->tv_usec = SCRIPT_QUEUE_POLL_USEC;
+    }
 }
 
 
@@ -670,14 +933,20 @@ multi_process_outgoing_tun(struct multi_context *m, const unsigned int mpp_flags
 
 #define CLIENT_CONNECT_OPT_MASK (OPT_P_INSTANCE | OPT_P_INHERIT   \
                                  |OPT_P_PUSH | OPT_P_TIMER | OPT_P_CONFIG   \
-                                 |OPT_P_ECHO | OPT_P_COMP | OPT_P_SOCKFLAGS)
+                                 |OPT_P_ECHO | OPT_P_COMP | OPT_P_SOCKFLAGS \
+                                 |OPT_P_SHAPER)
 
 static inline bool
 multi_process_outgoing_link_dowork(struct multi_context *m, struct multi_instance *mi, const unsigned int mpp_flags)
 {
     bool ret = true;
+    const int len = BLEN(&mi->context.c2.to_link);
     set_prefix(mi);
     process_outgoing_link(&mi->context);
+    if (m->top.options.shaper_total)
+    {
+        shaper_wrote_bytes(&m->shaper, len);
+    }
     ret = multi_process_post(m, mi, mpp_flags);
     clear_prefix();
     return ret;
@@ -703,5 +972,33 @@ multi_set_pending(struct multi_context *m, struct multi_instance *mi)
  */
 void multi_assign_peer_id(struct multi_context *m, struct multi_instance *mi);
 
+/**
+ * Index of \c peer_id in the instances array of \c m, or -1 if the
+ * peer-id was not handed out by this server.  With --peer-id-node the
+ * node id takes the top bits of the peer-id and the index the rest.
+ */
+static inline int
+multi_peer_id_index(const struct multi_context *m, uint32_t peer_id)
+{
+    const uint32_t index = peer_id & m->peer_id_index_mask;
+
+    if ((peer_id & ~m->peer_id_index_mask) != m->peer_id_node
+        || index >= (uint32_t) m->max_clients)
+    {
+        return -1;
+    }
+    return (int) index;
+}
+
+/**
+ * The instance that was assigned \c peer_id, or NULL.
+ */
+static inline struct multi_instance *
+multi_peer_id_lookup(const struct multi_context *m, uint32_t peer_id)
+{
+    const int index = multi_peer_id_index(m, peer_id);
+    return index < 0 ? NULL : m->instances[index];
+}
+
 
 #endif /* MULTI_H */
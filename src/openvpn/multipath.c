@@ -0,0 +1,265 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "error.h"
+#include "integer.h"
+#include "otime.h"
+#include "multipath.h"
+
+#include "memdbg.h"
+
+static bool
+multipath_up(const struct multipath *mp, const struct multipath_path *p)
+{
+    return p->defined && p->last_rx + MULTIPATH_TIMEOUT + mp->n >= now;
+}
+
+static int
+multipath_weight(const struct multipath_path *p)
+{
+    if (p->weight)
+    {
+        return p->weight;
+    }
+    if (p->rx_second == now)
+    {
+        return p->rx_last + 1;
+    }
+    if (p->rx_second == now - 1)
+    {
+        return p->rx_now + 1;
+    }
+    return 1;
+}
+
+struct multipath *
+multipath_new_sockets(int n_extra, const int *weights)
+{
+    struct multipath *mp;
+
+    ASSERT(n_extra < MULTIPATH_MAX);
+    ALLOC_OBJ_CLEAR(mp, struct multipath);
+    mp->n = n_extra + 1;
+    mp->probe = -1;
+
+    mp->paths[0].defined = true;
+    mp->paths[0].weight = 1;
+    for (int i = 1; i < mp->n; ++i)
+    {
+        mp->paths[i].defined = true;
+        mp->paths[i].weight = weights[i - 1];
+    }
+    return mp;
+}
+
+struct multipath *
+multipath_new_learn(void)
+{
+    struct multipath *mp;
+
+    ALLOC_OBJ_CLEAR(mp, struct multipath);
+    mp->learn = true;
+    mp->n = 1;
+    mp->probe = -1;
+    mp->paths[0].defined = true;
+    return mp;
+}
+
+void
+multipath_free(struct multipath *mp)
+{
+    if (!mp)
+    {
+        return;
+    }
+
+    for (int i = 0; i < mp->n; ++i)
+    {
+        const struct multipath_path *p = &mp->paths[i];
+        if (p->defined)
+        {
+            msg(D_MULTIPATH, "MULTIPATH: path %d sent " counter_format
+                " and received " counter_format " packets", i,
+                p->tx_packets, p->rx_packets);
+        }
+    }
+    free(mp);
+}
+
+/*
+ * Find the path of a packet that did not come over path 0, or a slot
+ * for a new one, or -1.
+ */
+static int
+multipath_find(struct multipath *mp, const struct link_socket_actual *from)
+{
+    int i;
+
+    if (!mp->learn)
+    {
+        /* listener i is the extra socket of path i */
+        return from->listener < mp->n ? from->listener : -1;
+    }
+
+    for (i = 1; i < mp->n; ++i)
+    {
+        if (mp->paths[i].defined && link_socket_actual_match(&mp->paths[i].addr, from))
+        {
+            return i;
+        }
+    }
+
+    /* a new path, as long as the old ones are up, a peer that lost them
+     * all has moved to a new address */
+    if (!multipath_up(mp, &mp->paths[0]))
+    {
+        return -1;
+    }
+    for (i = 1; i < mp->n; ++i)
+    {
+        if (!multipath_up(mp, &mp->paths[i]))
+        {
+            break;
+        }
+    }
+    if (i == MULTIPATH_MAX)
+    {
+        return -1;
+    }
+
+    struct gc_arena gc = gc_new();
+    msg(D_MULTIPATH, "MULTIPATH: path %d is %s", i, print_link_socket_actual(from, &gc));
+    gc_free(&gc);
+
+    CLEAR(mp->paths[i]);
+    mp->paths[i].defined = true;
+    mp->paths[i].addr = *from;
+    mp->n = max_int(mp->n, i + 1);
+    return i;
+}
+
+bool
+multipath_incoming(struct multipath *mp, const struct link_socket_actual *from,
+                   bool primary)
+{
+    const int i = primary ? 0 : multipath_find(mp, from);
+    if (i < 0)
+    {
+        return false;
+    }
+
+    struct multipath_path *p = &mp->paths[i];
+    if (!multipath_up(mp, p))
+    {
+        msg(D_MULTIPATH, "MULTIPATH: path %d is up", i);
+    }
+    if (p->rx_second != now)
+    {
+        p->rx_last = (p->rx_second == now - 1) ? p->rx_now : 0;
+        p->rx_now = 0;
+        p->rx_second = now;
+    }
+    ++p->rx_now;
+    ++p->rx_packets;
+    p->last_rx = now;
+    return true;
+}
+
+void
+multipath_select(struct multipath *mp, struct link_socket_actual **to)
+{
+    int best = mp->probe;
+
+    if (best >= 0)
+    {
+        mp->probe = -1;
+    }
+    else
+    {
+        int total = 0;
+        for (int i = 0; i < mp->n; ++i)
+        {
+            struct multipath_path *p = &mp->paths[i];
+            if (multipath_up(mp, p))
+            {
+                const int w = multipath_weight(p);
+                p->current += w;
+                total += w;
+                if (best < 0 || p->current > mp->paths[best].current)
+                {
+                    best = i;
+                }
+            }
+        }
+
+        if (best < 0)
+        {
+            /* nothing heard on any path, stay on the connection */
+            best = 0;
+        }
+        else
+        {
+            mp->paths[best].current -= total;
+        }
+    }
+
+    struct multipath_path *p = &mp->paths[best];
+    p->last_tx = now;
+    ++p->tx_packets;
+
+    if (best == 0)
+    {
+        return;
+    }
+    if (mp->learn)
+    {
+        *to = &p->addr;
+    }
+    else
+    {
+        mp->out = **to;
+        mp->out.listener = (uint8_t) best;
+        *to = &mp->out;
+    }
+}
+
+int
+multipath_probe_due(const struct multipath *mp)
+{
+    for (int i = 0; i < mp->n; ++i)
+    {
+        const struct multipath_path *p = &mp->paths[i];
+        /* a learned path that went down is up to the peer to revive */
+        if (p->defined && p->last_tx < now && (!mp->learn || multipath_up(mp, p)))
+        {
+            return i;
+        }
+    }
+    return -1;
+}
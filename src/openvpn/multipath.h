@@ -0,0 +1,112 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef MULTIPATH_H
+#define MULTIPATH_H
+
+/**
+ * @file
+ * Spreading the data channel over several paths, for --multipath.
+ *
+ * A client with --multipath has more UDP sockets, bound to the local
+ * addresses of its other uplinks, next to the one of the connection.
+ * Path 0 is the connection itself, path i sends and receives through
+ * the extra socket i - 1 of the link_socket.
+ *
+ * The server learns the paths of such a client from the source
+ * addresses of its data packets, which it would otherwise take as a
+ * float.  Path 0 is the address of the connection.
+ *
+ * Data packets go out over the paths that are up, in smooth weighted
+ * round robin order.  A client has the weights of its configuration,
+ * the server weighs a path by the packets it received over it in the
+ * last second, which mirrors the choice of the client.  A path is up
+ * while packets arrive over it.  Every path that was idle for a second
+ * gets a ping, to find out when it comes back, and to keep it up in the
+ * eyes of the peer.  The control channel stays on path 0.
+ */
+
+#include "socket.h"
+
+#define MULTIPATH_MAX     (LINK_SOCKET_EXTRA_MAX + 1)
+
+/** Seconds without packets after which a path is down, plus the
+ *  number of paths, which take turns in getting a ping */
+#define MULTIPATH_TIMEOUT 3
+
+struct multipath_path
+{
+    bool defined;
+    struct link_socket_actual addr; /**< of the peer, learned paths only */
+    int weight;                     /**< 0 to weigh by packets received */
+    int current;                    /**< smooth weighted round robin state */
+    time_t last_rx;
+    time_t last_tx;
+    time_t rx_second;               /**< second that rx_now counts */
+    unsigned int rx_now;            /**< packets received in rx_second */
+    unsigned int rx_last;           /**< packets received the second before */
+    counter_type rx_packets;
+    counter_type tx_packets;
+};
+
+struct multipath
+{
+    bool learn;                 /**< paths are addresses of the peer */
+    int n;                      /**< paths, including path 0 */
+    int probe;                  /**< path of the next packet, or -1 */
+    struct multipath_path paths[MULTIPATH_MAX];
+    struct link_socket_actual out; /**< destination over an extra socket */
+};
+
+/**
+ * Paths over path 0 and \c n_extra extra sockets, with a weight each.
+ */
+struct multipath *multipath_new_sockets(int n_extra, const int *weights);
+
+/** Paths that are learned from the peer */
+struct multipath *multipath_new_learn(void);
+
+void multipath_free(struct multipath *mp);
+
+/**
+ * Account an authenticated data packet that came from \c from, over
+ * path 0 if \c primary.  A server learns a new path here.
+ *
+ * @return false if the packet does not belong to a path and path 0 of
+ *         the peer has to float to \c from instead
+ */
+bool multipath_incoming(struct multipath *mp, const struct link_socket_actual *from,
+                        bool primary);
+
+/**
+ * Pick the path of an outgoing data packet.  \c *to is the destination
+ * over path 0 and is changed to the one of the path.
+ */
+void multipath_select(struct multipath *mp, struct link_socket_actual **to);
+
+/**
+ * Return a path that has not sent anything for a second, or -1.
+ */
+int multipath_probe_due(const struct multipath *mp);
+
+#endif /* MULTIPATH_H */
@@ -0,0 +1,369 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "neighbor_proxy.h"
+#include "crypto.h"
+#include "error.h"
+#include "otime.h"
+
+#include "memdbg.h"
+
+/* seconds between two sweeps for expired addresses */
+#define NEIGHBOR_SWEEP_INTERVAL 10
+
+/* neighbor discovery, RFC 4861 */
+#define ND_HOP_LIMIT            255
+#define ND_HDR_SIZE             24      /* ICMPv6 header, flags, target */
+#define ND_OPT_TARGET_LLADDR    2
+#define ND_NA_FLAG_SOLICITED    0x40
+#define ND_NA_FLAG_OVERRIDE     0x20
+
+static uint32_t
+neighbor_key_hash_function(const void *key, uint32_t iv)
+{
+    return hash_func(key, sizeof(struct neighbor_key), iv);
+}
+
+static bool
+neighbor_key_compare_function(const void *key1, const void *key2)
+{
+    return memcmp(key1, key2, sizeof(struct neighbor_key)) == 0;
+}
+
+static void
+neighbor_key_init(struct neighbor_key *key, uint16_t vid, int version,
+                  const void *addr)
+{
+    CLEAR(*key);
+    key->vid = vid;
+    key->version = (uint8_t) version;
+    memcpy(key->addr, addr, version == 4 ? 4 : 16);
+}
+
+struct neighbor_proxy *
+neighbor_proxy_new(int timeout)
+{
+    struct neighbor_proxy *np;
+
+    ALLOC_OBJ_CLEAR(np, struct neighbor_proxy);
+    np->entries = hash_init(256, get_random(), neighbor_key_hash_function,
+                            neighbor_key_compare_function);
+    np->timeout = timeout;
+    return np;
+}
+
+/*
+ * Forget the addresses of mi, or the expired ones if mi is NULL.
+ */
+static void
+neighbor_proxy_remove(struct neighbor_proxy *np, const struct multi_instance *mi)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(np->entries, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct neighbor_entry *e = he->value;
+        if (mi ? e->mi == mi : e->expires <= now)
+        {
+            hash_iterator_delete_element(&hi);
+            free(e);
+        }
+    }
+    hash_iterator_free(&hi);
+}
+
+void
+neighbor_proxy_free(struct neighbor_proxy *np)
+{
+    if (np)
+    {
+        msg(D_MULTI_LOW, "NEIGHBOR PROXY: answered " counter_format " requests",
+            np->n_replies);
+        struct hash_iterator hi;
+        struct hash_element *he;
+
+        hash_iterator_init(np->entries, &hi);
+        while ((he = hash_iterator_next(&hi)))
+        {
+            struct neighbor_entry *e = he->value;
+            hash_iterator_delete_element(&hi);
+            free(e);
+        }
+        hash_iterator_free(&hi);
+        hash_free(np->entries);
+        free(np);
+    }
+}
+
+static void
+neighbor_proxy_update(struct neighbor_proxy *np, struct multi_instance *mi,
+                      uint16_t vid, int version, const void *addr,
+                      const uint8_t *mac)
+{
+    struct neighbor_key key;
+    neighbor_key_init(&key, vid, version, addr);
+
+    const uint32_t hv = hash_value(np->entries, &key);
+    struct hash_element *he = hash_lookup_fast(np->entries, &key, hv);
+    struct neighbor_entry *e = he ? he->value : NULL;
+
+    if (!e)
+    {
+        ALLOC_OBJ_CLEAR(e, struct neighbor_entry);
+        e->key = key;
+        hash_add_fast(np->entries, &e->key, hv, e);
+    }
+    memcpy(e->mac, mac, OPENVPN_ETH_ALEN);
+    e->mi = mi;
+    e->expires = now + np->timeout;
+}
+
+static const struct neighbor_entry *
+neighbor_proxy_lookup(struct neighbor_proxy *np, const struct multi_instance *mi,
+                      uint16_t vid, int version, const void *addr)
+{
+    struct neighbor_key key;
+    neighbor_key_init(&key, vid, version, addr);
+
+    const struct neighbor_entry *e = hash_lookup(np->entries, &key);
+
+    /* a client asking for its own address is doing duplicate detection */
+    if (e && e->mi != mi && e->expires > now)
+    {
+        return e;
+    }
+    return NULL;
+}
+
+/*
+ * Return the ARP packet in the Ethernet frame buf, or NULL.
+ */
+static const struct openvpn_arp *
+neighbor_arp(const struct buffer *buf)
+{
+    const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR(buf);
+
+    if (BLEN(buf) < (int) (sizeof(struct openvpn_ethhdr) + sizeof(struct openvpn_arp))
+        || eth->proto != htons(OPENVPN_ETH_P_ARP))
+    {
+        return NULL;
+    }
+
+    const struct openvpn_arp *arp = (const struct openvpn_arp *) (eth + 1);
+    if (arp->mac_addr_type != htons(ARP_MAC_ADDR_TYPE)
+        || arp->proto_addr_type != htons(OPENVPN_ETH_P_IPV4)
+        || arp->mac_addr_size != OPENVPN_ETH_ALEN
+        || arp->proto_addr_size != 4)
+    {
+        return NULL;
+    }
+    return arp;
+}
+
+/*
+ * Return the IPv6 header of a neighbor solicitation or advertisement in
+ * the Ethernet frame buf, or NULL.  *icmp is set to its ICMPv6 message.
+ */
+static const struct openvpn_ipv6hdr *
+neighbor_nd(const struct buffer *buf, const uint8_t **icmp)
+{
+    const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR(buf);
+    const int hlen = sizeof(struct openvpn_ethhdr) + sizeof(struct openvpn_ipv6hdr);
+
+    if (BLEN(buf) < hlen + ND_HDR_SIZE || eth->proto != htons(OPENVPN_ETH_P_IPV6))
+    {
+        return NULL;
+    }
+
+    /* RFC 4861 7.1.1 and 7.1.2, the checksum is left to the receiver */
+    const struct openvpn_ipv6hdr *ip6 = (const struct openvpn_ipv6hdr *) (eth + 1);
+    const uint8_t *p = BPTR(buf) + hlen;
+    if (ip6->nexthdr != OPENVPN_IPPROTO_ICMPV6 || ip6->hop_limit != ND_HOP_LIMIT
+        || (p[0] != OPENVPN_ND_NEIGHBOR_SOLICIT && p[0] != OPENVPN_ND_NEIGHBOR_ADVERT)
+        || p[1] != 0
+        || IN6_IS_ADDR_MULTICAST((const struct in6_addr *) (p + 8)))
+    {
+        return NULL;
+    }
+    *icmp = p;
+    return ip6;
+}
+
+void
+neighbor_proxy_learn(struct neighbor_proxy *np, struct multi_instance *mi,
+                     const struct buffer *buf, uint16_t vid)
+{
+    const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR(buf);
+    const struct openvpn_arp *arp = neighbor_arp(buf);
+    const struct openvpn_ipv6hdr *ip6;
+    const uint8_t *icmp;
+
+    /* the Ethernet source was checked to belong to mi, so it is used
+     * rather than the addresses inside the packet */
+    if (arp)
+    {
+        if ((arp->arp_command == htons(ARP_REQUEST)
+             || arp->arp_command == htons(ARP_REPLY))
+            && arp->ip_src != 0)
+        {
+            neighbor_proxy_update(np, mi, vid, 4, &arp->ip_src, eth->source);
+        }
+    }
+    else if ((ip6 = neighbor_nd(buf, &icmp)))
+    {
+        if (icmp[0] == OPENVPN_ND_NEIGHBOR_ADVERT)
+        {
+            neighbor_proxy_update(np, mi, vid, 6, icmp + 8, eth->source);
+        }
+        else if (!IN6_IS_ADDR_UNSPECIFIED(&ip6->saddr))
+        {
+            neighbor_proxy_update(np, mi, vid, 6, &ip6->saddr, eth->source);
+        }
+    }
+}
+
+static void
+neighbor_reply_arp(const struct neighbor_entry *e, const struct openvpn_ethhdr *eth,
+                   const struct openvpn_arp *req, struct buffer *reply)
+{
+    struct openvpn_ethhdr reth;
+    struct openvpn_arp rarp;
+
+    memcpy(reth.dest, eth->source, OPENVPN_ETH_ALEN);
+    memcpy(reth.source, e->mac, OPENVPN_ETH_ALEN);
+    reth.proto = htons(OPENVPN_ETH_P_ARP);
+
+    rarp = *req;
+    rarp.arp_command = htons(ARP_REPLY);
+    memcpy(rarp.mac_src, e->mac, OPENVPN_ETH_ALEN);
+    rarp.ip_src = req->ip_dest;
+    memcpy(rarp.mac_dest, req->mac_src, OPENVPN_ETH_ALEN);
+    rarp.ip_dest = req->ip_src;
+
+    ASSERT(buf_write(reply, &reth, sizeof(reth)));
+    ASSERT(buf_write(reply, &rarp, sizeof(rarp)));
+}
+
+static void
+neighbor_reply_nd(const struct neighbor_entry *e, const struct openvpn_ethhdr *eth,
+                  const struct openvpn_ipv6hdr *req, const uint8_t *target,
+                  struct buffer *reply)
+{
+    struct openvpn_ethhdr reth;
+    struct openvpn_ipv6hdr rip6;
+    uint8_t na[ND_HDR_SIZE + 8] = { OPENVPN_ND_NEIGHBOR_ADVERT, 0, 0, 0,
+                                    ND_NA_FLAG_SOLICITED | ND_NA_FLAG_OVERRIDE };
+
+    memcpy(reth.dest, eth->source, OPENVPN_ETH_ALEN);
+    memcpy(reth.source, e->mac, OPENVPN_ETH_ALEN);
+    reth.proto = htons(OPENVPN_ETH_P_IPV6);
+
+    CLEAR(rip6);
+    rip6.version_prio = 0x60;
+    rip6.payload_len = htons(sizeof(na));
+    rip6.nexthdr = OPENVPN_IPPROTO_ICMPV6;
+    rip6.hop_limit = ND_HOP_LIMIT;
+    memcpy(&rip6.saddr, target, 16);
+    rip6.daddr = req->saddr;
+
+    memcpy(na + 8, target, 16);
+    na[ND_HDR_SIZE] = ND_OPT_TARGET_LLADDR;
+    na[ND_HDR_SIZE + 1] = 1;            /* in units of 8 bytes */
+    memcpy(na + ND_HDR_SIZE + 2, e->mac, OPENVPN_ETH_ALEN);
+
+    const uint16_t csum = htons(ip_checksum(AF_INET6, na, sizeof(na),
+                                            (const uint8_t *) &rip6.saddr,
+                                            (const uint8_t *) &rip6.daddr,
+                                            OPENVPN_IPPROTO_ICMPV6));
+    memcpy(na + 2, &csum, sizeof(csum));
+
+    ASSERT(buf_write(reply, &reth, sizeof(reth)));
+    ASSERT(buf_write(reply, &rip6, sizeof(rip6)));
+    ASSERT(buf_write(reply, na, sizeof(na)));
+}
+
+bool
+neighbor_proxy_reply(struct neighbor_proxy *np, const struct multi_instance *mi,
+                     const struct buffer *buf, uint16_t vid, struct buffer *reply)
+{
+    const struct openvpn_ethhdr *eth = (const struct openvpn_ethhdr *) BPTR(buf);
+    const struct openvpn_arp *arp = neighbor_arp(buf);
+    const struct openvpn_ipv6hdr *ip6;
+    const struct neighbor_entry *e;
+    const uint8_t *icmp;
+
+    if (arp)
+    {
+        /* probes and announcements (RFC 5227) go to the owner */
+        if (arp->arp_command != htons(ARP_REQUEST) || arp->ip_src == 0
+            || arp->ip_src == arp->ip_dest
+            || !(e = neighbor_proxy_lookup(np, mi, vid, 4, &arp->ip_dest)))
+        {
+            return false;
+        }
+        neighbor_reply_arp(e, eth, arp, reply);
+    }
+    else if ((ip6 = neighbor_nd(buf, &icmp)))
+    {
+        /* duplicate address detection goes to the owner */
+        if (icmp[0] != OPENVPN_ND_NEIGHBOR_SOLICIT
+            || IN6_IS_ADDR_UNSPECIFIED(&ip6->saddr)
+            || !(e = neighbor_proxy_lookup(np, mi, vid, 6, icmp + 8)))
+        {
+            return false;
+        }
+        neighbor_reply_nd(e, eth, ip6, icmp + 8, reply);
+    }
+    else
+    {
+        return false;
+    }
+
+    ++np->n_replies;
+    return true;
+}
+
+void
+neighbor_proxy_remove_instance(struct neighbor_proxy *np,
+                               const struct multi_instance *mi)
+{
+    neighbor_proxy_remove(np, mi);
+}
+
+void
+neighbor_proxy_sweep(struct neighbor_proxy *np)
+{
+    if (now >= np->next_sweep)
+    {
+        neighbor_proxy_remove(np, NULL);
+        np->next_sweep = now + NEIGHBOR_SWEEP_INTERVAL;
+    }
+}
@@ -0,0 +1,114 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef NEIGHBOR_PROXY_H
+#define NEIGHBOR_PROXY_H
+
+/**
+ * @file
+ * ARP and IPv6 neighbor discovery proxy for --neighbor-proxy.
+ *
+ * In tap mode with --client-to-client, an ARP request or a neighbor
+ * solicitation of one client is a broadcast or multicast frame that goes
+ * to every other client.  The proxy learns the IP to MAC address pairs
+ * of the clients from the ARP packets, neighbor solicitations and
+ * neighbor advertisements they send, and answers a request for such an
+ * address itself, with a unicast reply to the client that asked.  The
+ * request then goes nowhere else.
+ *
+ * A client only ever gets an answer that another client announced for
+ * the same VLAN, so the proxy does not let a client claim more than it
+ * could by answering itself.  Requests for unknown addresses, duplicate
+ * address detection and gratuitous ARP still go to all clients.
+ */
+
+#include "basic.h"
+#include "buffer.h"
+#include "list.h"
+#include "proto.h"
+
+/* seconds a learned address is used without being announced again */
+#define NEIGHBOR_PROXY_TIMEOUT_DEFAULT 300
+
+struct multi_instance;
+
+struct neighbor_key
+{
+    uint16_t vid;
+    uint8_t version;                /* 4 or 6 */
+    uint8_t addr[16];               /* IPv4 addresses use the first 4 bytes */
+};
+
+struct neighbor_entry
+{
+    struct neighbor_key key;        /* hash key */
+    uint8_t mac[OPENVPN_ETH_ALEN];
+    struct multi_instance *mi;
+    time_t expires;
+};
+
+struct neighbor_proxy
+{
+    struct hash *entries;           /* struct neighbor_entry by key */
+    int timeout;
+    time_t next_sweep;
+    counter_type n_replies;
+};
+
+struct neighbor_proxy *neighbor_proxy_new(int timeout);
+
+void neighbor_proxy_free(struct neighbor_proxy *np);
+
+/**
+ * Learn the addresses that client mi announces in the Ethernet frame
+ * buf, if it is an ARP packet or a neighbor solicitation or
+ * advertisement.
+ */
+void neighbor_proxy_learn(struct neighbor_proxy *np, struct multi_instance *mi,
+                          const struct buffer *buf, uint16_t vid);
+
+/**
+ * If the Ethernet frame buf from client mi is an ARP request or a
+ * neighbor solicitation for an address that another client announced,
+ * write the answer of that client to reply, which has to have headroom
+ * and room for a full frame.
+ *
+ * @return  true if reply holds the answer and buf need not be sent on
+ */
+bool neighbor_proxy_reply(struct neighbor_proxy *np,
+                          const struct multi_instance *mi,
+                          const struct buffer *buf, uint16_t vid,
+                          struct buffer *reply);
+
+/**
+ * Forget all addresses of mi.  Has to be called before mi is freed.
+ */
+void neighbor_proxy_remove_instance(struct neighbor_proxy *np,
+                                    const struct multi_instance *mi);
+
+/**
+ * Forget expired addresses, at most once every few seconds.
+ */
+void neighbor_proxy_sweep(struct neighbor_proxy *np);
+
+#endif /* NEIGHBOR_PROXY_H */
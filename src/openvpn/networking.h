@@ -355,4 +355,58 @@ int net_route_v6_best_gw(openvpn_net_ctx_t *ctx, const struct in6_addr *dst,
 
 #endif /* ENABLE_SITNL || ENABLE_IPROUTE */
 
+#if defined(ENABLE_SITNL)
+
+/**
+ * Start queueing the routes added with net_route_v4_add() and
+ * net_route_v6_add() instead of installing them one request at a time.
+ * The add functions return 0 for a queued route.
+ *
+ * @param ctx       the implementation specific context
+ */
+void net_route_batch_begin(openvpn_net_ctx_t *ctx);
+
+/**
+ * Return the number of routes queued since net_route_batch_begin()
+ *
+ * @param ctx       the implementation specific context
+ */
+int net_route_batch_len(openvpn_net_ctx_t *ctx);
+
+/**
+ * Install the queued routes and stop queueing.  Failures are logged
+ * route by route.
+ *
+ * @param ctx       the implementation specific context
+ * @param results   array of net_route_batch_len() entries receiving the
+ *                  result of each queued route in the order in which it
+ *                  was added: 0 on success, a negative error code otherwise
+ */
+void net_route_batch_end(openvpn_net_ctx_t *ctx, int *results);
+
+#else  /* if defined(ENABLE_SITNL) */
+
+/* other backends install every route right away */
+static inline void
+net_route_batch_begin(openvpn_net_ctx_t *ctx)
+{
+    (void)ctx;
+}
+
+static inline int
+net_route_batch_len(openvpn_net_ctx_t *ctx)
+{
+    (void)ctx;
+    return 0;
+}
+
+static inline void
+net_route_batch_end(openvpn_net_ctx_t *ctx, int *results)
+{
+    (void)ctx;
+    (void)results;
+}
+
+#endif /* if defined(ENABLE_SITNL) */
+
 #endif /* NETWORKING_H_ */
@@ -105,6 +105,22 @@ struct sitnl_route_req {
 
 typedef int (*sitnl_parse_reply_cb)(struct nlmsghdr *msg, void *arg);
 
+/**
+ * Route requests queued between net_route_batch_begin() and
+ * net_route_batch_end()
+ */
+struct sitnl_route_batch {
+    struct sitnl_route_req *reqs;
+    int n;
+    int capacity;
+};
+
+/* number of requests in flight at a time while sending a batch */
+#define SITNL_BATCH_WINDOW 64
+
+/* the batch routes are currently queued to, if any */
+static struct sitnl_route_batch *sitnl_batch;
+
 /**
  * Object returned by route request operation
  */
@@ -941,7 +957,23 @@ sitnl_route_set(int cmd, uint32_t flags, int ifindex, sa_family_t af_family,
         SITNL_ADDATTR(&req.n, sizeof(req), RTA_PRIORITY, &metric, 4);
     }
 
-    ret = sitnl_send(&req.n, 0, 0, NULL, NULL);
+    if (sitnl_batch && cmd == RTM_NEWROUTE)
+    {
+        /* sent and acknowledged together by net_route_batch_end() */
+        struct sitnl_route_batch *b = sitnl_batch;
+        if (b->n == b->capacity)
+        {
+            b->capacity = b->capacity ? b->capacity * 2 : SITNL_BATCH_WINDOW;
+            b->reqs = realloc(b->reqs, b->capacity * sizeof(*b->reqs));
+            check_malloc_return(b->reqs);
+        }
+        b->reqs[b->n++] = req;
+        ret = 0;
+    }
+    else
+    {
+        ret = sitnl_send(&req.n, 0, 0, NULL, NULL);
+    }
 err:
     return ret;
 }
@@ -1492,6 +1524,194 @@ net_iface_del(openvpn_net_ctx_t *ctx, const char *iface)
     return sitnl_send(&req.n, 0, 0, NULL, NULL);
 }
 
+void
+net_route_batch_begin(openvpn_net_ctx_t *ctx)
+{
+    ASSERT(!sitnl_batch);
+    ALLOC_OBJ_CLEAR(sitnl_batch, struct sitnl_route_batch);
+}
+
+int
+net_route_batch_len(openvpn_net_ctx_t *ctx)
+{
+    return sitnl_batch ? sitnl_batch->n : 0;
+}
+
+/**
+ * Send the queued requests, SITNL_BATCH_WINDOW at a time over a single
+ * socket, and store the error code of each one's ACK in results.
+ */
+static void
+sitnl_batch_send(struct sitnl_route_batch *b, int *results)
+{
+    const int bufsize = SITNL_BATCH_WINDOW * sizeof(struct sitnl_route_req);
+    const unsigned int seq_base = time(NULL);
+    struct sockaddr_nl nladdr;
+    char buf[1024 * 16];
+    int fd, first, i;
+
+    /* anything > 0 means "no ACK yet" */
+    for (i = 0; i < b->n; ++i)
+    {
+        results[i] = 1;
+    }
+
+    fd = sitnl_socket();
+    if (fd < 0)
+    {
+        msg(M_WARN | M_ERRNO, "%s: can't open rtnl socket", __func__);
+        first = 0;
+        goto fail;
+    }
+
+    /* the defaults of sitnl_socket() are too small for a whole window */
+    if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize)) < 0
+        || setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize)) < 0
+        || sitnl_bind(fd, 0) < 0)
+    {
+        msg(M_WARN | M_ERRNO, "%s: can't set up rtnl socket", __func__);
+        first = 0;
+        goto fail;
+    }
+
+    for (first = 0; first < b->n; first += SITNL_BATCH_WINDOW)
+    {
+        const int last = min_int(b->n, first + SITNL_BATCH_WINDOW);
+        struct iovec iov[SITNL_BATCH_WINDOW];
+        struct msghdr nlmsg;
+        int pending = last - first;
+
+        for (i = first; i < last; ++i)
+        {
+            b->reqs[i].n.nlmsg_seq = seq_base + i;
+            b->reqs[i].n.nlmsg_flags |= NLM_F_ACK;
+            iov[i - first].iov_base = &b->reqs[i].n;
+            iov[i - first].iov_len = NLMSG_ALIGN(b->reqs[i].n.nlmsg_len);
+        }
+
+        CLEAR(nladdr);
+        nladdr.nl_family = AF_NETLINK;
+        CLEAR(nlmsg);
+        nlmsg.msg_name = &nladdr;
+        nlmsg.msg_namelen = sizeof(nladdr);
+        nlmsg.msg_iov = iov;
+        nlmsg.msg_iovlen = last - first;
+
+        if (sendmsg(fd, &nlmsg, 0) < 0)
+        {
+            msg(M_WARN | M_ERRNO, "%s: rtnl: error on sendmsg()", __func__);
+            goto fail;
+        }
+
+        while (pending > 0)
+        {
+            struct iovec riov = { .iov_base = buf, .iov_len = sizeof(buf) };
+            nlmsg.msg_iov = &riov;
+            nlmsg.msg_iovlen = 1;
+            nlmsg.msg_namelen = sizeof(nladdr);
+
+            int rcv_len = recvmsg(fd, &nlmsg, 0);
+            if (rcv_len < 0 && (errno == EINTR || errno == EAGAIN))
+            {
+                continue;
+            }
+            if (rcv_len <= 0)
+            {
+                msg(M_WARN | M_ERRNO, "%s: rtnl: error on recvmsg()", __func__);
+                goto fail;
+            }
+
+            for (struct nlmsghdr *h = (struct nlmsghdr *)buf;
+                 NLMSG_OK(h, (unsigned int)rcv_len);
+                 h = NLMSG_NEXT(h, rcv_len))
+            {
+                const int idx = (int)(h->nlmsg_seq - seq_base);
+
+                if (h->nlmsg_type != NLMSG_ERROR
+                    || h->nlmsg_len < NLMSG_LENGTH(sizeof(struct nlmsgerr))
+                    || idx < first || idx >= last || results[idx] <= 0)
+                {
+                    continue;
+                }
+                results[idx] = ((struct nlmsgerr *)NLMSG_DATA(h))->error;
+                --pending;
+            }
+        }
+    }
+
+    close(fd);
+    return;
+
+fail:
+    for (i = first; i < b->n; ++i)
+    {
+        if (results[i] > 0)
+        {
+            results[i] = -EIO;
+        }
+    }
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+/**
+ * Log a failed route request, decoded from the request itself.
+ */
+static void
+sitnl_batch_log_error(struct sitnl_route_req *req, int error)
+{
+    struct rtattr *tb[RTA_MAX + 1];
+    char dst[INET6_ADDRSTRLEN] = "default";
+    char gw[INET6_ADDRSTRLEN] = "-";
+    char dev[IFNAMSIZ] = "-";
+
+    sitnl_parse_rtattr(tb, RTA_MAX, RTM_RTA(&req->r), RTM_PAYLOAD(&req->n));
+    if (tb[RTA_DST])
+    {
+        inet_ntop(req->r.rtm_family, RTA_DATA(tb[RTA_DST]), dst, sizeof(dst));
+    }
+    if (tb[RTA_GATEWAY])
+    {
+        inet_ntop(req->r.rtm_family, RTA_DATA(tb[RTA_GATEWAY]), gw, sizeof(gw));
+    }
+    if (tb[RTA_OIF] && !if_indextoname(*(int *)RTA_DATA(tb[RTA_OIF]), dev))
+    {
+        strcpy(dev, "?");
+    }
+
+    msg(error == -EEXIST ? D_ROUTE : M_WARN,
+        "%s: rtnl: adding route %s/%d via %s dev %s failed (%d): %s",
+        __func__, dst, req->r.rtm_dst_len, gw, dev, error, strerror(-error));
+}
+
+void
+net_route_batch_end(openvpn_net_ctx_t *ctx, int *results)
+{
+    struct sitnl_route_batch *b = sitnl_batch;
+
+    ASSERT(b);
+    sitnl_batch = NULL;
+
+    if (b->n)
+    {
+        msg(D_ROUTE, "%s: sending %d route requests", __func__, b->n);
+        sitnl_batch_send(b, results);
+
+        for (int i = 0; i < b->n; ++i)
+        {
+            if (results[i] < 0)
+            {
+                sitnl_batch_log_error(&b->reqs[i], results[i]);
+            }
+        }
+    }
+
+    free(b->reqs);
+    free(b);
+}
+
 #endif /* !ENABLE_SITNL */
 
 #endif /* TARGET_LINUX */
@@ -29,6 +29,7 @@
 
 #include "occ.h"
 #include "forward.h"
+#include "mss.h"
 #include "memdbg.h"
 
 
@@ -213,12 +214,90 @@ check_send_occ_load_test_dowork(struct context *c)
     }
 }
 
+/*
+ * --pmtu-probe: find the largest packet that makes it from the peer to
+ * us, by asking the peer for OCC_MTU_LOAD packets of the size under test.
+ * This is a binary search between OCC_PMTU_PROBE_MIN and the full packet
+ * size, as in RFC 8899, with the full size tried first.  The result
+ * lowers --mssfix and --fragment like a path MTU reported by the kernel.
+ * A new search starts every --pmtu-probe seconds, to notice a path that
+ * got narrower.
+ */
+void
+check_send_occ_pmtu_probe_dowork(struct context *c)
+{
+    if (!connection_established(c))
+    {
+        return;
+    }
+
+    if (!c->c2.pmtu_probe_size)
+    {
+        /* start a search */
+        const int full = (int) (frame_calculate_payload_size(&c->c2.frame, &c->options,
+                                                             &c->c1.ks.key_type)
+                                + frame_calculate_protocol_header_size(&c->c1.ks.key_type,
+                                                                       &c->options, false));
+        c->c2.pmtu_probe_lo = min_int(OCC_PMTU_PROBE_MIN, full);
+        c->c2.pmtu_probe_hi = full + 1;
+        c->c2.pmtu_probe_size = full;
+        c->c2.pmtu_probe_n_tries = 0;
+        event_timeout_init(&c->c2.pmtu_probe_interval, OCC_PMTU_PROBE_INTERVAL_SECONDS, now);
+    }
+    else if (c->c2.pmtu_probe_seen || ++c->c2.pmtu_probe_n_tries >= OCC_PMTU_PROBE_TRIES)
+    {
+        if (!c->c2.pmtu_probe_seen)
+        {
+            c->c2.pmtu_probe_hi = c->c2.pmtu_probe_size;
+        }
+        if (c->c2.pmtu_probe_hi - c->c2.pmtu_probe_lo <= OCC_PMTU_PROBE_STEP)
+        {
+            struct link_socket_info *lsi = get_link_socket_info(c);
+            const int overhead = datagram_overhead(lsi->lsa->actual.dest.addr.sa.sa_family,
+                                                   lsi->proto);
+
+            msg(D_MTU_INFO, "Path MTU probe: packets of %d bytes arrive from the peer",
+                c->c2.pmtu_probe_lo);
+            frame_apply_path_mtu(c, c->c2.pmtu_probe_lo + overhead, "path MTU probing");
+            c->c2.pmtu_probe_size = 0;
+            event_timeout_init(&c->c2.pmtu_probe_interval, c->options.pmtu_probe, now);
+            return;
+        }
+        c->c2.pmtu_probe_size = (c->c2.pmtu_probe_lo + c->c2.pmtu_probe_hi) / 2;
+        c->c2.pmtu_probe_n_tries = 0;
+    }
+
+    c->c2.pmtu_probe_seen = false;
+    c->c2.occ_mtu_load_size = c->c2.pmtu_probe_size;
+    c->c2.occ_op = OCC_MTU_LOAD_REQUEST;
+}
+
+/*
+ * An OCC_MTU_LOAD arrived, which is the answer to a --pmtu-probe request
+ * if it has about the size under test.  A smaller one still shows that
+ * its own size works.
+ */
+static void
+process_received_pmtu_probe(struct context *c)
+{
+    const int size = c->c2.original_recv_size;
+
+    if (c->c2.pmtu_probe_size)
+    {
+        c->c2.pmtu_probe_lo = max_int(c->c2.pmtu_probe_lo, size);
+        if (size + OCC_PMTU_PROBE_STEP >= c->c2.pmtu_probe_size)
+        {
+            c->c2.pmtu_probe_seen = true;
+        }
+    }
+}
+
 void
 check_send_occ_msg_dowork(struct context *c)
 {
     bool doit = false;
 
-    c->c2.buf = c->c2.buffers->aux_buf;
+    c->c2.buf = get_context_buffers(c)->aux_buf;
     ASSERT(buf_init(&c->c2.buf, c->c2.frame.buf.headroom));
     ASSERT(buf_safe(&c->c2.buf, c->c2.frame.buf.payload_size));
     ASSERT(buf_write(&c->c2.buf, occ_magic, OCC_STRING_SIZE));
@@ -384,6 +463,11 @@ process_received_occ_msg(struct context *c)
             }
             break;
 
+        case OCC_MTU_LOAD:
+            dmsg(D_PACKET_CONTENT, "RECEIVED OCC_MTU_LOAD");
+            process_received_pmtu_probe(c);
+            break;
+
         case OCC_REPLY:
             dmsg(D_PACKET_CONTENT, "RECEIVED OCC_REPLY");
             if (c->options.occ && !TLS_MODE(c) && c->c2.options_string_remote)
@@ -61,6 +61,17 @@
  */
 #define OCC_MTU_LOAD_INTERVAL_SECONDS 3
 
+/*
+ * --pmtu-probe asks for a load of the size under test every n seconds,
+ * and gives up on a size after a number of requests.  A search ends when
+ * the limits are within a step.  The search starts from a size that is
+ * assumed to work, a 576 byte IPv4 datagram.
+ */
+#define OCC_PMTU_PROBE_INTERVAL_SECONDS 2
+#define OCC_PMTU_PROBE_TRIES            3
+#define OCC_PMTU_PROBE_STEP             16
+#define OCC_PMTU_PROBE_MIN              548
+
 /*
  * Send an exit message to remote.
  */
@@ -92,6 +103,8 @@ void check_send_occ_req_dowork(struct context *c);
 
 void check_send_occ_load_test_dowork(struct context *c);
 
+void check_send_occ_pmtu_probe_dowork(struct context *c);
+
 void check_send_occ_msg_dowork(struct context *c);
 
 /*
@@ -134,6 +147,21 @@ check_send_occ_load_test(struct context *c)
     }
 }
 
+/*
+ * Should we send a path MTU probe?
+ */
+static inline void
+check_send_occ_pmtu_probe(struct context *c)
+{
+    if (event_timeout_defined(&c->c2.pmtu_probe_interval)
+        && event_timeout_trigger(&c->c2.pmtu_probe_interval,
+                                 &c->c2.timeval,
+                                 (!TO_LINK_DEF(c) && c->c2.occ_op < 0) ? ETT_DEFAULT : 0))
+    {
+        check_send_occ_pmtu_probe_dowork(c);
+    }
+}
+
 /*
  * Should we send an OCC message?
  */
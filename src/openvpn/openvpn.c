@@ -32,6 +32,9 @@
 #include "multi.h"
 #include "win32.h"
 #include "platform.h"
+#include "mstats.h"
+#include "handoff.h"
+#include "bench_load.h"
 
 #include "memdbg.h"
 
@@ -73,9 +76,23 @@ tunnel_point_to_point(struct context *c)
     {
         perf_push(PERF_EVENT_LOOP);
 
-        /* process timers, TLS, etc. */
-        pre_select(c);
-        P2P_CHECK_SIG();
+#ifdef ENABLE_MEMSTATS
+        mstats_update();
+#endif
+
+        /* process timers, TLS, etc., unless only data channel I/O
+         * happened since the last time and none of them is due yet */
+        if ((c->c2.event_set_status & ~(SOCKET_READ|SOCKET_WRITE|TUN_READ|TUN_WRITE))
+            || pre_select_needed(c))
+        {
+            pre_select(c);
+            P2P_CHECK_SIG();
+        }
+        else
+        {
+            pre_select_idle(c);
+            P2P_CHECK_SIG();
+        }
 
         /* set up and do the I/O wait */
         io_wait(c, p2p_iow_flags(c));
@@ -105,6 +122,9 @@ tunnel_point_to_point(struct context *c)
 
 #undef PROCESS_SIGNAL_P2P
 
+/* providers loaded by init_early(), to be unloaded by uninit_early() */
+static provider_t *loaded_providers[MAX_PARMS]; /* GLOBAL */
+
 void
 init_early(struct context *c)
 {
@@ -118,18 +138,18 @@ init_early(struct context *c)
      * printing depends on it */
     for (int j = 1; j < MAX_PARMS && c->options.providers.names[j]; j++)
     {
-        c->options.providers.providers[j] =
-            crypto_load_provider(c->options.providers.names[j]);
+        loaded_providers[j] = crypto_load_provider(c->options.providers.names[j]);
     }
 }
 
 static void
 uninit_early(struct context *c)
 {
-    for (int j = 1; j < MAX_PARMS && c->options.providers.providers[j]; j++)
+    for (int j = 1; j < MAX_PARMS && loaded_providers[j]; j++)
     {
         crypto_unload_provider(c->options.providers.names[j],
-                               c->options.providers.providers[j]);
+                               loaded_providers[j]);
+        loaded_providers[j] = NULL;
     }
     net_ctx_free(&c->net_ctx);
 }
@@ -213,6 +233,8 @@ openvpn_main(int argc, char *argv[])
 
             /* parse command line options, and read configuration file */
             parse_argv(&c.options, argc, argv, M_USAGE, OPT_P_DEFAULT, NULL, c.es);
+            c.argc = argc;
+            c.argv = argv;
 
 #ifdef ENABLE_PLUGIN
             /* plugins may contribute options configuration */
@@ -277,6 +299,16 @@ openvpn_main(int argc, char *argv[])
 #endif
             init_query_passwords(&c);
 
+#if UNIX_SOCK_SUPPORT
+            /* take over from a running server before we open anything,
+             * it goes away once it has handed everything over */
+            if (c.first_time && c.options.handoff)
+            {
+                c.handoff = handoff_receive(c.options.handoff,
+                                            c.options.username);
+            }
+#endif
+
             /* become a daemon if --daemon */
             if (c.first_time)
             {
@@ -309,7 +341,14 @@ openvpn_main(int argc, char *argv[])
                 switch (c.options.mode)
                 {
                     case MODE_POINT_TO_POINT:
-                        tunnel_point_to_point(&c);
+                        if (c.options.bench_load_clients)
+                        {
+                            tunnel_bench_load(&c);
+                        }
+                        else
+                        {
+                            tunnel_point_to_point(&c);
+                        }
                         break;
 
                     case MODE_SERVER:
@@ -35,6 +35,8 @@
 #include "interval.h"
 #include "status.h"
 #include "fragment.h"
+#include "fec.h"
+#include "multipath.h"
 #include "shaper.h"
 #include "route.h"
 #include "proxy.h"
@@ -42,6 +44,7 @@
 #include "sig.h"
 #include "misc.h"
 #include "mbuf.h"
+#include "pktq.h"
 #include "pool.h"
 #include "plugin.h"
 #include "manage.h"
@@ -69,8 +72,16 @@ struct key_schedule
      * renegotiation key */
     struct key2 original_wrap_keydata;
     struct key_ctx tls_crypt_v2_server_key;
+    struct tls_crypt_v2_wkc_cache *tls_crypt_v2_wkc_cache;
+    struct tls_crypt_v2_verify_cache *tls_crypt_v2_verify_cache;
     struct buffer tls_crypt_v2_wkc;             /**< Wrapped client key */
     struct key_ctx auth_token_key;
+
+    /* --verify-cache results, shared with child contexts */
+    struct verify_cache *verify_cache;
+
+    /* --crl-verify dir index, shared with child contexts */
+    struct crl_dir *crl_dir;
 };
 
 /*
@@ -112,6 +123,11 @@ struct context_buffers
      */
     struct buffer read_link_buf;
     struct buffer read_tun_buf;
+
+    /* if set, the buffers above are only taken from this pool while
+     * they are in use, see get_context_buffers() */
+    struct buffer_pool *pool;
+    bool checked_out;
 };
 
 /*
@@ -201,6 +217,11 @@ struct context_1
      *   remote OpenVPN server.  Only used in
      *   client-mode. */
 
+    struct sha256_digest pulled_routes_digest_save;
+    /**< Hash of the route options received from
+     *   the remote OpenVPN server, if kept apart
+     *   by --persist-routes. */
+
     struct user_pass *auth_user_pass;
     /**< Username and password for
      *   authentication. */
@@ -242,7 +263,7 @@ struct context_2
 
     /** This variable is used instead link_socket->info for P2MP UDP childs */
     struct link_socket_info *link_socket_info;
-    const struct link_socket *accept_from; /* possibly do accept() on a parent link_socket */
+    struct link_socket *accept_from; /* possibly do accept() on a parent link_socket */
 
     struct link_socket_actual *to_link_addr;    /* IP address of remote */
     struct link_socket_actual from;             /* address of incoming datagram */
@@ -259,20 +280,35 @@ struct context_2
     struct frame frame_fragment_omit;
 #endif
 
+#ifdef ENABLE_DEBUG
+    /* --gremlin-impair state */
+    struct gremlin_impair *gremlin_impair;
+#endif
+
+    /* --fec state, once the group size is known */
+    struct fec *fec;
+
+    /* --multipath state, once the peer agreed to it */
+    struct multipath *multipath;
+    struct event_timeout multipath_interval;
+
     /*
      * Traffic shaper object.
      */
     struct shaper shaper;
 
     /*
-     * Statistics
+     * Statistics, the ones updated for every packet are kept
+     * next to each other to touch as few cache lines as possible
      */
     counter_type tun_read_bytes;
     counter_type tun_write_bytes;
     counter_type link_read_bytes;
-    counter_type dco_read_bytes;
     counter_type link_read_bytes_auth;
     counter_type link_write_bytes;
+    counter_type link_read_packets;
+    counter_type link_write_packets;
+    counter_type dco_read_bytes;
     counter_type dco_write_bytes;
 #ifdef PACKET_TRUNCATION_CHECK
     counter_type n_trunc_tun_read;
@@ -289,10 +325,18 @@ struct context_2
     struct event_timeout ping_send_interval;
     struct event_timeout ping_rec_interval;
 
+    /* ping_string after compression and fragmentation, see
+     * check_ping_send_dowork() */
+    uint8_t ping_frame[32];
+    int ping_frame_len;
+
     /* --inactive */
     struct event_timeout inactivity_interval;
     int64_t inactivity_bytes;
 
+    /* --compact-idle */
+    struct event_timeout compact_idle_interval;
+
     struct event_timeout session_interval;
 
     /* auth token renewal timer */
@@ -323,6 +367,14 @@ struct context_2
     struct event_timeout occ_mtu_load_test_interval;
     int occ_mtu_load_n_tries;
 
+    /* --pmtu-probe, see check_send_occ_pmtu_probe_dowork() */
+    struct event_timeout pmtu_probe_interval;
+    int pmtu_probe_lo;          /* largest packet known to arrive */
+    int pmtu_probe_hi;          /* smallest packet known not to arrive */
+    int pmtu_probe_size;        /* size under test, 0 between searches */
+    int pmtu_probe_n_tries;     /* requests sent for this size */
+    bool pmtu_probe_seen;       /* a load of this size arrived */
+
     /*
      * TLS-mode crypto objects.
      */
@@ -373,6 +425,9 @@ struct context_2
     struct context_buffers *buffers;
     bool buffers_owned; /* if true, we should free all buffers on close */
 
+    /* pool for the buffers of TCP server instances, owned by multi_top */
+    struct buffer_pool *buffer_pool;
+
     /*
      * These buffers don't actually allocate storage, they are used
      * as pointers to the allocated buffers in
@@ -382,6 +437,10 @@ struct context_2
     struct buffer to_tun;
     struct buffer to_link;
 
+    /* point-to-point only, packets that wait for the fd to be writable */
+    struct packet_queue *tun_queue;
+    struct packet_queue *link_queue;
+
     /* should we print R|W|r|w to console on packet transfers? */
     bool log_rw;
 
@@ -404,6 +463,12 @@ struct context_2
     /* next wakeup for processing coarse timers (>1 sec resolution) */
     time_t coarse_timer_wakeup;
 
+    /* earliest timer due in pre_select(), see pre_select_needed() */
+    time_t pre_select_wakeup;
+
+    /* next wakeup for --ping, --ping-restart and --inactive */
+    time_t keepalive_wakeup;
+
     /* maintain a random delta to add to timeouts to avoid contexts
      * waking up simultaneously */
     time_t update_timeout_random_component;
@@ -429,6 +494,14 @@ struct context_2
     /* don't wait for TUN/TAP/UDP to be ready to accept write */
     bool fast_io;
 
+    /* TUN/TAP reads left before the next event wait, see --tun-read-ahead */
+    int tun_read_ahead;
+
+    /* --spin-wait: current budget, and time spun in the second spin_window */
+    int spin_usec;
+    time_t spin_window;
+    int spin_window_usec;
+
     /* --ifconfig endpoints to be pushed to client */
     bool push_request_received;
     bool push_ifconfig_defined;
@@ -442,6 +515,11 @@ struct context_2
     int push_ifconfig_ipv6_netbits;
     struct in6_addr push_ifconfig_ipv6_remote;
 
+    /* push-update of the management interface, see push.c */
+    bool push_update_supported;
+    unsigned int push_update_id; /* last PUSH_UPDATE sent or received */
+    int push_update_state;       /* PUSH_UPDATE_x on the server */
+
     struct event_timeout push_request_interval;
     time_t push_request_timeout;
 
@@ -449,6 +527,8 @@ struct context_2
     bool pulled_options_digest_init_done;
     md_ctx_t *pulled_options_state;
     struct sha256_digest pulled_options_digest;
+    md_ctx_t *pulled_routes_state;
+    struct sha256_digest pulled_routes_digest;
 
     struct event_timeout scheduled_exit;
     int scheduled_exit_signal;
@@ -501,6 +581,13 @@ struct context
 
     struct env_set *es;         /**< Set of environment variables. */
 
+    int argc;                   /**< Command line, kept to read the */
+    char **argv;                /**< configuration again on a live reload. */
+
+    struct handoff *handoff;    /**< Socket, device and clients taken over
+                                 *   from the previous process with
+                                 *   --handoff, until the server adopts them */
+
     openvpn_net_ctx_t net_ctx;  /**< Networking API opaque context */
 
     struct signal_info *sig;    /**< Internal error signaling object. */
@@ -60,6 +60,8 @@
 #include "platform.h"
 #include "xkey_common.h"
 #include "dco.h"
+#include "mcast_snoop.h"
+#include "neighbor_proxy.h"
 #include <ctype.h>
 
 #include "memdbg.h"
@@ -162,6 +164,8 @@ static const char usage_message[] =
     "--resolv-retry n: If hostname resolve fails for --remote, retry\n"
     "                  resolve for n seconds before failing (disabled by default).\n"
     "                  Set n=\"infinite\" to retry indefinitely.\n"
+    "--resolv-cache n: Reuse the addresses resolved for --remote on reconnects\n"
+    "                  for up to n seconds (default=0, disabled).\n"
     "--float         : Allow remote to change its IP address/port, such as through\n"
     "                  DHCP (this is the default if --remote is not used).\n"
     "--ipchange cmd  : Run command cmd on remote ip address initial\n"
@@ -253,7 +257,9 @@ static const char usage_message[] =
     "                  1 -- (default) only call built-ins such as ifconfig\n"
     "                  2 -- allow calling of built-ins and scripts\n"
     "                  3 -- allow password to be passed to scripts via env\n"
-    "--shaper n      : Restrict output to peer to n bytes per second.\n"
+    "--shaper n [burst] : Restrict output to peer to n bytes per second,\n"
+    "                  allowing bursts of up to burst bytes (default=0).\n"
+    "                  In server mode, applies to each client.\n"
     "--keepalive n m : Helper option for setting timeouts in server mode.  Send\n"
     "                  ping once every n seconds, restart if ping not received\n"
     "                  for m seconds.\n"
@@ -269,8 +275,15 @@ static const char usage_message[] =
     "--multihome     : Configure a multi-homed UDP server.\n"
 #endif
     "--fast-io       : (experimental) Optimize TUN/TAP/UDP writes.\n"
+    "--tun-read-ahead n : Read up to n more packets from TUN/TAP without\n"
+    "                  waiting for events in between.\n"
+    "--spin-wait usec [cpu] : Poll for up to usec microseconds before sleeping\n"
+    "                  in the event loop, using at most cpu percent of a CPU\n"
+    "                  (default 50).\n"
     "--remap-usr1 s  : On SIGUSR1 signals, remap signal (s='SIGHUP' or 'SIGTERM').\n"
     "--persist-tun   : Keep tun/tap device open across SIGUSR1 or --ping-restart.\n"
+    "--persist-routes : With --persist-tun, only add and delete the pushed routes\n"
+    "                  that changed across SIGUSR1 or --ping-restart.\n"
     "--persist-remote-ip : Keep remote IP address across SIGUSR1 or --ping-restart.\n"
     "--persist-local-ip  : Keep local IP address across SIGUSR1 or --ping-restart.\n"
     "--persist-key   : Don't re-read key files across SIGUSR1 or --ping-restart.\n"
@@ -289,6 +302,15 @@ static const char usage_message[] =
     "                  'maybe' -- Use per-route hints\n"
     "                  'yes'   -- Always DF (Don't Fragment)\n"
     "--mtu-test      : Empirically measure and report MTU.\n"
+    "--pmtu-probe [n]: Find the path MTU by probing, again every n seconds\n"
+    "                  (default=600), and lower --mssfix and --fragment to it.\n"
+    "--fec n         : Send a repair packet after every n data packets, which\n"
+    "                  rebuilds one lost packet of them (n=2..32, 0=off).\n"
+#ifndef _WIN32
+    "--multipath host [w] : Also send data packets from local address host, with\n"
+    "                  weight w (default=1) against 1 of the connection.\n"
+    "                  Up to 8 times, client only.\n"
+#endif
 #ifdef ENABLE_FRAGMENT
     "--fragment max  : Enable internal datagram fragmentation so that no UDP\n"
     "                  datagrams are sent which are larger than max bytes.\n"
@@ -298,16 +320,32 @@ static const char usage_message[] =
     "                  or --fragment max value, whichever is lower.\n"
     "--sndbuf size   : Set the TCP/UDP send buffer size.\n"
     "--rcvbuf size   : Set the TCP/UDP receive buffer size.\n"
+    "--rcvbuf-max size : Grow the UDP receive buffer up to size when the kernel\n"
+    "                  drops datagrams (Linux only).\n"
+    "--tcp-notsent-lowat bytes : Let the TCP socket take new data only while\n"
+    "                  less than bytes of it are unsent (TCP_NOTSENT_LOWAT).\n"
+    "--tcp-fastopen  : Use TCP Fast Open to send the first packet of a TCP\n"
+    "                  connection in the SYN.\n"
 #if defined(TARGET_LINUX) && HAVE_DECL_SO_MARK
     "--mark value    : Mark encrypted packets being sent with value. The mark value\n"
     "                  can be matched in policy routing and packetfilter rules.\n"
     "--bind-dev dev  : Bind to the given device when making connection to a peer or\n"
     "                  listening for connections. This allows sending encrypted packets\n"
     "                  via a VRF present on the system.\n"
+    "--busy-poll usec [prefer [budget]] : Busy poll the network device for up to\n"
+    "                  usec microseconds when reading from the TCP/UDP socket,\n"
+    "                  taking up to budget packets per poll.\n"
 #endif
     "--txqueuelen n  : Set the tun/tap TX queue length to n (Linux only).\n"
+    "--tun-queues n  : Open the tun/tap device with n queues (Linux only).\n"
+    "--tun-offload   : Accept TSO super-packets from the tun device (Linux only).\n"
 #ifdef ENABLE_MEMSTATS
-    "--memstats file : Write live usage stats to memory mapped binary file.\n"
+    "--memstats file : Write live usage stats to memory mapped binary file,\n"
+    "                  in server mode including one slot per client.\n"
+#endif
+#ifdef ENABLE_TRACE
+    "--trace-ring file [n] : Record the last n data path events (default=65536)\n"
+    "                  in a memory mapped binary file.\n"
 #endif
     "--mlock         : Disable Paging -- ensures key material and tunnel\n"
     "                  data will never be written to disk.\n"
@@ -341,6 +379,11 @@ static const char usage_message[] =
     "--machine-readable-output : Always log timestamp, message flags to stdout/stderr.\n"
     "--writepid file : Write main process ID to file.\n"
     "--nice n        : Change process priority (>0 = lower, <0 = higher).\n"
+    "--cpu-affinity n : Run on CPU n only (Linux only).\n"
+    "--numa-node n|dev : Run on the CPUs of NUMA node n, or of the node of network\n"
+    "                  device dev, and allocate memory there (Linux only).\n"
+    "--huge-pages    : Allocate client instances and TCP packet buffers from\n"
+    "                  2 MB pages (server only).\n"
     "--echo [parms ...] : Echo parameters to log output.\n"
     "--verb n        : Set output verbosity to n (default=%d):\n"
     "                  (Level 3 is recommended if you want a good summary\n"
@@ -354,12 +397,17 @@ static const char usage_message[] =
     "                       and received from TCP/UDP (caps) or tun/tap (lc)\n"
     "                : 6 to 11 -- debug messages of increasing verbosity\n"
     "--mute n        : Log at most n consecutive messages in the same category.\n"
+    "--mute-repeats  : Log identical consecutive messages once, followed by a\n"
+    "                  count of the repetitions.\n"
     "--status file [n] : Write operational status to file every n seconds.\n"
     "--status-version [n] : Choose the status file format version number.\n"
     "                  Currently, n can be 1, 2, or 3 (default=1).\n"
     "--disable-occ   : (DEPRECATED) Disable options consistency check between peers.\n"
 #ifdef ENABLE_DEBUG
     "--gremlin mask  : Special stress testing mode (for debugging only).\n"
+    "--gremlin-impair key value ... : Impair the link for testing: delay ms,\n"
+    "                  jitter ms, loss %%, loss-burst n, reorder %%, rate bytes/s,\n"
+    "                  limit n and seed n (for debugging only).\n"
 #endif
 #if defined(USE_COMP)
     "--compress alg  : Use compression algorithm alg\n"
@@ -402,6 +450,10 @@ static const char usage_message[] =
     "--management-client-auth : gives management interface client the responsibility\n"
     "                           to authenticate clients after their client certificate\n"
     "			      has been verified.\n"
+    "--management-load-alert pct : Notify the management interface when a client\n"
+    "                  uses more than pct percent of a CPU.\n"
+    "--management-max-clients n : Serve up to n management clients at the same\n"
+    "                  time (default=1).\n"
 #endif /* ifdef ENABLE_MANAGEMENT */
 #ifdef ENABLE_PLUGIN
     "--plugin m [str]: Load plug-in module m passing str as an argument\n"
@@ -463,27 +515,77 @@ static const char usage_message[] =
     "--no-name-remapping : (DEPRECATED) Allow Common Name and X509 Subject to include\n"
     "                      any printable character.\n"
     "--client-to-client : Internally route client-to-client traffic.\n"
+    "--acl allow|deny in|out [proto [address[/bits] [port[-port]]]] :\n"
+    "                  Filter packets from (in) or to (out) the client.\n"
+    "                  Also valid in a client-specific config file.\n"
+    "--acl-default allow|deny : Action for packets no --acl rule matches.\n"
     "--duplicate-cn  : Allow multiple clients with the same common name to\n"
     "                  concurrently connect.\n"
     "--client-connect cmd : Run command cmd on client connection.\n"
     "--client-disconnect cmd : Run command cmd on client disconnection.\n"
     "--client-config-dir dir : Directory for custom client config files.\n"
     "--ccd-exclusive : Refuse connection unless custom client config is found.\n"
+    "--ccd-cache n   : Keep --client-config-dir files in memory and check them\n"
+    "                  for changes at most every n seconds.\n"
     "--tmp-dir dir   : Temporary directory, used for --client-connect return file and plugin communication.\n"
     "--hash-size r v : Set the size of the real address hash table to r and the\n"
     "                  virtual address table to v.\n"
     "--bcast-buffers n : Allocate n broadcast buffers.\n"
+    "--multicast-snooping [n] : Send multicast only to clients that joined the\n"
+    "                  group with IGMP or MLD. Memberships expire after n\n"
+    "                  seconds without a report (default=%d).\n"
+    "--neighbor-proxy [n] : Answer ARP and neighbor solicitations of clients for\n"
+    "                  addresses of other clients, learned within the last n\n"
+    "                  seconds (default=%d, tap only).\n"
     "--tcp-queue-limit n : Maximum number of queued TCP output packets.\n"
+    "--tcp-queue-priority size : Send queued TCP output packets of up to size\n"
+    "                  bytes, or marked for low delay, ahead of the others.\n"
+    "--shaper-total n [burst] : Restrict output to all clients together to\n"
+    "                  n bytes per second, allowing bursts of burst bytes.\n"
+    "--udp-recv-batch n : Read up to n UDP datagrams per receive system call.\n"
+    "--udp-recv-gro  : Let the kernel coalesce received UDP datagrams (UDP_GRO).\n"
+    "--udp-send-batch n : Queue up to n UDP datagrams per send system call.\n"
+    "--udp-send-zerocopy : Send large batched UDP datagrams with MSG_ZEROCOPY.\n"
     "--tcp-nodelay   : Macro that sets TCP_NODELAY socket flag on the server\n"
     "                  as well as pushes it to connecting clients.\n"
     "--learn-address cmd : Run command cmd to validate client virtual addresses.\n"
+    "--script-workers n : Run --learn-address and --client-connect scripts in the\n"
+    "                  background, up to n at the same time.\n"
+    "--live-reload   : On SIGHUP, apply changed certificates, keys and push options\n"
+    "                  without disconnecting the clients.\n"
+#if UNIX_SOCK_SUPPORT
+    "--handoff path  : Hand the connected clients over to a new process that\n"
+    "                  connects to the unix socket path (UDP only).\n"
+#endif
+#ifndef _WIN32
+    "--listen-extra host port : Also accept UDP clients on host port, up to 8 times.\n"
+#endif
+    "--udp-prefilter : Drop UDP packets with an opcode or a length that the server\n"
+    "                  never accepts in the kernel (Linux only).\n"
+    "--replicate-peer host port : Send the connected clients to a standby server\n"
+    "                  at host port, to spare them the connect on failover.\n"
+    "--replicate-listen IP port [ttl] : Accept clients from an active server on\n"
+    "                  IP port and keep them for ttl seconds (default 3600) after\n"
+    "                  it goes away.\n"
+    "--replicate-secret file : Static key authenticating the two directions above.\n"
     "--connect-freq n s : Allow a maximum of n new connections per s seconds.\n"
     "--connect-freq-initial n s : Allow a maximum of n replies for initial connections attempts per s seconds.\n"
+    "--connect-freq-prefix n s [b4 [b6]] : Allow a maximum of n replies for initial\n"
+    "                  connection attempts per s seconds from each IPv4 /b4 (default 24)\n"
+    "                  and IPv6 /b6 (default 56) source prefix.\n"
+    "--reneg-freq n s : Start a maximum of n renegotiations because of --reneg-sec\n"
+    "                  per s seconds.\n"
+#if defined(ENABLE_DCO)
+    "--dco-reject-incompatible : Keep data channel offload when --data-ciphers\n"
+    "                  contains ciphers that DCO does not support, and reject\n"
+    "                  the clients that negotiate one of them.\n"
+#endif
     "--max-clients n : Allow a maximum of n simultaneously connected clients.\n"
+    "--peer-id-node id bits : Put node id in the top bits of every peer-id, so\n"
+    "                  that a load balancer can route data packets by peer-id.\n"
     "--max-routes-per-client n : Allow a maximum of n internal routes per client.\n"
     "--stale-routes-check n [t] : Remove routes with a last activity timestamp\n"
-    "                             older than n seconds. Run this check every t\n"
-    "                             seconds (defaults to n).\n"
+    "                             older than n seconds (t is ignored).\n"
     "--explicit-exit-notify [n] : In UDP server mode send [RESTART] command on exit/restart to connected\n"
     "                             clients. n = 1 - reconnect to same server,\n"
     "                             2 - advance to next server, default=1.\n"
@@ -545,6 +647,8 @@ static const char usage_message[] =
     "                  You should usually use --data-ciphers instead.\n"
     "                  Set alg=none to disable encryption.\n"
     "--data-ciphers list : List of ciphers that are allowed to be negotiated.\n"
+    "--data-ciphers-hw-aware : Prefer CHACHA20-POLY1305 for clients or servers\n"
+    "                  without hardware accelerated AES (server only).\n"
 #ifndef ENABLE_CRYPTO_MBEDTLS
     "--engine [name] : Enable OpenSSL hardware crypto engine functionality.\n"
 #endif
@@ -556,6 +660,14 @@ static const char usage_message[] =
     "                  using file.\n"
     "--test-crypto   : Run a self-test of crypto features enabled.\n"
     "                  For debugging only.\n"
+    "--bench-datachannel [sizes] [s] : Measure encryption and decryption\n"
+    "                  throughput of each cipher in --data-ciphers for s\n"
+    "                  seconds (default=3) using the comma separated packet\n"
+    "                  sizes or 'imix' (default).\n"
+    "--bench-load n [sizes] [s] : Connect n times to the server, then send\n"
+    "                  data packets of all n sessions for s seconds\n"
+    "                  (default=3) using the packet sizes of\n"
+    "                  --bench-datachannel.\n"
 #ifdef ENABLE_PREDICTION_RESISTANCE
     "--use-prediction-resistance: Enable prediction resistance on the random\n"
     "                             number generator.\n"
@@ -601,9 +713,13 @@ static const char usage_message[] =
     "                : Use --show-tls to see a list of supported TLS ciphers (suites).\n"
     "--tls-cert-profile p : Set the allowed certificate crypto algorithm profile\n"
     "                  (default=legacy).\n"
+    "--tls-session-tickets [n] : Resume TLS sessions with session tickets that\n"
+    "                  are valid for n seconds (default=3600).\n"
     "--providers l   : A list l of OpenSSL providers to load.\n"
     "--tls-timeout n : Packet retransmit timeout on TLS control channel\n"
     "                  if no ACK from remote within n seconds (default=%d).\n"
+    "--tls-window n  : Number of unacknowledged TLS control channel packets\n"
+    "                  in flight (default=%d, max=%d).\n"
     "--reneg-bytes n : Renegotiate data chan. key after n bytes sent and recvd.\n"
     "--reneg-pkts n  : Renegotiate data chan. key after n packets sent and recvd.\n"
     "--reneg-sec max [min] : Renegotiate data chan. key after at most max (default=%d)\n"
@@ -636,16 +752,21 @@ static const char usage_message[] =
     "                  keyfile.  If supplied, include metadata in wrapped key.\n"
     "--genkey tls-crypt-v2-server [keyfile] [base64 metadata]: Generate a\n"
     "                  fresh tls-crypt-v2 server key, and store to keyfile\n"
-    "--tls-crypt-v2-verify cmd : Run command cmd to verify the metadata of the\n"
-    "                  client-supplied tls-crypt-v2 client key\n"
+    "--tls-crypt-v2-verify cmd [via-file|via-env] : Run command cmd to verify\n"
+    "                  the metadata of the client-supplied tls-crypt-v2 client\n"
+    "                  key, passing the metadata in a file or in the environment.\n"
+    "--tls-crypt-v2-verify-cache n : Keep the verdicts of --tls-crypt-v2-verify\n"
+    "                  for n seconds.\n"
     "--askpass [file]: Get PEM password from controlling tty before we daemonize.\n"
     "--auth-nocache  : Don't cache --askpass or --auth-user-pass passwords.\n"
-    "--crl-verify crl ['dir']: Check peer certificate against a CRL.\n"
+    "--crl-verify crl ['dir'|'async']: Check peer certificate against a CRL.\n"
     "--tls-verify cmd: Run command cmd to verify the X509 name of a\n"
     "                  pending TLS connection that has otherwise passed all other\n"
     "                  tests of certification.  cmd should return 0 to allow\n"
     "                  TLS handshake to proceed, or 1 to fail.  (cmd is\n"
     "                  executed as 'cmd certificate_depth subject')\n"
+    "--verify-cache n [sec] : Remember up to n certificates that passed --tls-verify\n"
+    "                  and skip the check for them for sec seconds (default=%d).\n"
     "--tls-export-cert [directory] : Get peer cert in PEM format and store it \n"
     "                  in an openvpn temporary file in [directory]. Peer cert is \n"
     "                  stored before tls-verify script execution and deleted after.\n"
@@ -685,6 +806,8 @@ static const char usage_message[] =
     "                                  certificate can be accessed. Set for each provider.\n"
     "--pkcs11-pin-cache seconds      : Number of seconds to cache PIN. The default is -1\n"
     "                                  cache until token is removed.\n"
+    "--pkcs11-sign-thread            : Sign on a separate thread, so that the server\n"
+    "                                  serves other clients meanwhile (server only).\n"
     "--pkcs11-id-management          : Acquire identity from management interface.\n"
     "--pkcs11-id serialized-id 'id'  : Identity to use, get using standalone --show-pkcs11-ids\n"
 #endif                  /* ENABLE_PKCS11 */
@@ -816,6 +939,8 @@ init_options(struct options *o, const bool init_gc)
     o->connect_retry_max = 0;
     o->ce.local_port = o->ce.remote_port = OPENVPN_PORT;
     o->verbosity = 1;
+    o->cpu_affinity = -1;
+    o->spin_wait_cpu = 50;
     o->status_file_update_freq = 60;
     o->status_file_version = 1;
     o->ce.bind_local = true;
@@ -836,6 +961,7 @@ init_options(struct options *o, const bool init_gc)
     o->management_log_history_cache = 250;
     o->management_echo_buffer_size = 100;
     o->management_state_buffer_size = 100;
+    o->management_max_clients = 1;
 #endif
 #ifdef ENABLE_FEATURE_TUN_PERSIST
     o->persist_mode = 1;
@@ -858,9 +984,13 @@ init_options(struct options *o, const bool init_gc)
     o->virtual_hash_size = 256;
     o->n_bcast_buf = 256;
     o->tcp_queue_limit = 64;
+    o->udp_recv_batch = 1;
+    o->udp_send_batch = 1;
     o->max_clients = 1024;
     o->cf_initial_per = 10;
     o->cf_initial_max = 100;
+    o->cf_prefix_ipv4_bits = 24;
+    o->cf_prefix_ipv6_bits = 56;
     o->max_routes_per_client = 256;
     o->stale_routes_check_interval = 0;
     o->ifconfig_pool_persist_refresh_freq = 600;
@@ -868,11 +998,13 @@ init_options(struct options *o, const bool init_gc)
     o->authname = "SHA1";
     o->replay_window = DEFAULT_SEQ_BACKTRACK;
     o->replay_time = DEFAULT_TIME_BACKTRACK;
+    o->bench_seconds = 3;
     o->key_direction = KEY_DIRECTION_BIDIRECTIONAL;
 #ifdef ENABLE_PREDICTION_RESISTANCE
     o->use_prediction_resistance = false;
 #endif
     o->tls_timeout = 2;
+    o->tls_window = TLS_RELIABLE_N_SEND_BUFFERS;
     o->renegotiate_bytes = -1;
     o->renegotiate_seconds = 3600;
     o->renegotiate_seconds_min = -1;
@@ -924,6 +1056,8 @@ uninit_options(struct options *o)
     {
         gc_free(&o->gc);
         gc_free(&o->dns_options.gc);
+        buffer_list_free(o->reload_fixed);
+        o->reload_fixed = NULL;
     }
 }
 
@@ -936,13 +1070,28 @@ struct pull_filter
     int type;
     int size;
     char *pattern;
+    int order;                  /** position in the list */
     struct pull_filter *next;
 };
 
+/*
+ * The patterns of all filters in a prefix tree, so that the filters
+ * matching a pushed option are found in one pass over the option.
+ */
+struct pull_filter_node
+{
+    char c;
+    struct pull_filter *filter; /** first filter whose pattern ends here */
+    struct pull_filter_node *child;
+    struct pull_filter_node *sibling;
+};
+
 struct pull_filter_list
 {
     struct pull_filter *head;
     struct pull_filter *tail;
+    int n;
+    struct pull_filter_node root;
 };
 
 #ifndef ENABLE_SMALL
@@ -1541,14 +1690,25 @@ show_p2mp_parms(const struct options *o)
     msg(D_SHOW_PARMS, "  ifconfig_ipv6_pool_base = %s", print_in6_addr(o->ifconfig_ipv6_pool_base, 0, &gc));
     SHOW_INT(ifconfig_ipv6_pool_netbits);
     SHOW_INT(n_bcast_buf);
+    SHOW_INT(mcast_snooping);
+    SHOW_INT(neighbor_proxy);
     SHOW_INT(tcp_queue_limit);
+    SHOW_INT(tcp_queue_priority);
+    SHOW_INT(shaper_total);
+    SHOW_INT(shaper_total_burst);
+    SHOW_INT(udp_recv_batch);
+    SHOW_BOOL(udp_recv_gro);
+    SHOW_INT(udp_send_batch);
+    SHOW_BOOL(udp_send_zerocopy);
     SHOW_INT(real_hash_size);
     SHOW_INT(virtual_hash_size);
     SHOW_STR(client_connect_script);
     SHOW_STR(learn_address_script);
+    SHOW_INT(script_workers);
     SHOW_STR(client_disconnect_script);
     SHOW_STR(client_crresponse_script);
     SHOW_STR(client_config_dir);
+    SHOW_INT(ccd_cache);
     SHOW_BOOL(ccd_exclusive);
     SHOW_STR(tmp_dir);
     SHOW_BOOL(push_ifconfig_defined);
@@ -1563,7 +1723,17 @@ show_p2mp_parms(const struct options *o)
     SHOW_INT(cf_per);
     SHOW_INT(cf_initial_max);
     SHOW_INT(cf_initial_per);
+    SHOW_INT(cf_prefix_max);
+    SHOW_INT(cf_prefix_per);
+    SHOW_INT(cf_prefix_ipv4_bits);
+    SHOW_INT(cf_prefix_ipv6_bits);
+    SHOW_INT(reneg_freq_max);
+    SHOW_INT(reneg_freq_per);
+    SHOW_BOOL(dco_reject_incompatible);
     SHOW_INT(max_clients);
+    SHOW_INT(peer_id_node);
+    SHOW_INT(peer_id_node_bits);
+    SHOW_BOOL(udp_prefilter);
     SHOW_INT(max_routes_per_client);
     SHOW_STR(auth_user_pass_verify_script);
     SHOW_BOOL(auth_user_pass_verify_script_via_file);
@@ -1672,7 +1842,78 @@ options_detach(struct options *o)
     gc_detach(&o->gc);
     o->routes = NULL;
     o->client_nat = NULL;
-    clone_push_list(o);
+    /* rules from a client-specific config are appended to the copy */
+    if (o->acl)
+    {
+        o->acl = acl_list_clone(o->acl, &o->gc);
+    }
+    /* copied by push.c on the first change */
+    o->push_list_shared = o->push_list.head != NULL;
+}
+
+bool
+options_live_reload_check(const struct options *o, const struct options *new_o)
+{
+    const struct buffer_entry *a = o->reload_fixed ? o->reload_fixed->head : NULL;
+    const struct buffer_entry *b = new_o->reload_fixed ? new_o->reload_fixed->head : NULL;
+
+    while (a && b)
+    {
+        if (BLEN(&a->buf) != BLEN(&b->buf)
+            || memcmp(BPTR(&a->buf), BPTR(&b->buf), BLEN(&a->buf)) != 0)
+        {
+            msg(M_INFO, "Live reload: option --%s changed, restarting",
+                (const char *) BPTR(&b->buf));
+            return false;
+        }
+        a = a->next;
+        b = b->next;
+    }
+    if (a || b)
+    {
+        msg(M_INFO, "Live reload: option --%s %s, restarting",
+            (const char *) BPTR(a ? &a->buf : &b->buf), a ? "removed" : "added");
+        return false;
+    }
+
+    /* the CRL directory is set up once at startup */
+    if ((o->ssl_flags ^ new_o->ssl_flags) & SSLF_CRL_VERIFY_DIR)
+    {
+        msg(M_INFO, "Live reload: option --crl-verify dir changed, restarting");
+        return false;
+    }
+    return true;
+}
+
+void
+options_live_reload_apply(struct options *o, const struct options *new_o)
+{
+    o->push_list = new_o->push_list;
+    o->push_list_shared = new_o->push_list.head != NULL;
+    o->push_cache = new_o->push_cache;
+
+    o->ca_file = new_o->ca_file;
+    o->ca_file_inline = new_o->ca_file_inline;
+    o->ca_path = new_o->ca_path;
+    o->cert_file = new_o->cert_file;
+    o->cert_file_inline = new_o->cert_file_inline;
+    o->priv_key_file = new_o->priv_key_file;
+    o->priv_key_file_inline = new_o->priv_key_file_inline;
+    o->extra_certs_file = new_o->extra_certs_file;
+    o->extra_certs_file_inline = new_o->extra_certs_file_inline;
+    o->dh_file = new_o->dh_file;
+    o->dh_file_inline = new_o->dh_file_inline;
+    o->pkcs12_file = new_o->pkcs12_file;
+    o->pkcs12_file_inline = new_o->pkcs12_file_inline;
+    o->crl_file = new_o->crl_file;
+    o->crl_file_inline = new_o->crl_file_inline;
+    o->cipher_list = new_o->cipher_list;
+    o->cipher_list_tls13 = new_o->cipher_list_tls13;
+    o->tls_groups = new_o->tls_groups;
+    o->tls_cert_profile = new_o->tls_cert_profile;
+    o->ecdh_curve = new_o->ecdh_curve;
+    /* the other flags come from options which did not change */
+    o->ssl_flags = new_o->ssl_flags;
 }
 
 void
@@ -1702,6 +1943,15 @@ cnol_check_alloc(struct options *options)
     }
 }
 
+static void
+acl_check_alloc(struct options *options)
+{
+    if (!options->acl)
+    {
+        options->acl = acl_list_new(&options->gc);
+    }
+}
+
 #ifndef ENABLE_SMALL
 static void
 show_connection_entry(const struct connection_entry *o)
@@ -1836,7 +2086,11 @@ show_settings(const struct options *o)
     SHOW_STR(ifconfig_ipv6_remote);
 
     SHOW_INT(shaper);
+    SHOW_INT(shaper_burst);
     SHOW_INT(mtu_test);
+    SHOW_INT(pmtu_probe);
+    SHOW_INT(fec);
+    SHOW_INT(n_multipath);
 
     SHOW_BOOL(mlock);
 
@@ -1845,12 +2099,14 @@ show_settings(const struct options *o)
     SHOW_INT(inactivity_timeout);
     SHOW_INT(session_timeout);
     SHOW_INT64(inactivity_minimum_bytes);
+    SHOW_INT(compact_idle);
     SHOW_INT(ping_send_timeout);
     SHOW_INT(ping_rec_timeout);
     SHOW_INT(ping_rec_timeout_action);
     SHOW_BOOL(ping_timer_remote);
     SHOW_INT(remap_sigusr1);
     SHOW_BOOL(persist_tun);
+    SHOW_BOOL(persist_routes);
     SHOW_BOOL(persist_local_ip);
     SHOW_BOOL(persist_remote_ip);
     SHOW_BOOL(persist_key);
@@ -1861,6 +2117,7 @@ show_settings(const struct options *o)
 
     SHOW_INT(resolve_retry_seconds);
     SHOW_BOOL(resolve_in_advance);
+    SHOW_INT(resolv_cache);
 
     SHOW_STR(username);
     SHOW_STR(groupname);
@@ -1880,10 +2137,22 @@ show_settings(const struct options *o)
     SHOW_BOOL(suppress_timestamps);
     SHOW_BOOL(machine_readable_output);
     SHOW_INT(nice);
+    SHOW_INT(cpu_affinity);
+    SHOW_STR(numa_node);
+    SHOW_BOOL(huge_pages);
     SHOW_INT(verbosity);
     SHOW_INT(mute);
+    SHOW_BOOL(mute_repeats);
 #ifdef ENABLE_DEBUG
     SHOW_INT(gremlin);
+    SHOW_INT(gremlin_impair.delay_ms);
+    SHOW_INT(gremlin_impair.jitter_ms);
+    SHOW_INT(gremlin_impair.loss);
+    SHOW_INT(gremlin_impair.loss_burst);
+    SHOW_INT(gremlin_impair.reorder);
+    SHOW_INT(gremlin_impair.rate);
+    SHOW_INT(gremlin_impair.limit);
+    SHOW_UNSIGNED(gremlin_impair.seed);
 #endif
     SHOW_STR(status_file);
     SHOW_INT(status_file_version);
@@ -1891,13 +2160,22 @@ show_settings(const struct options *o)
 
     SHOW_BOOL(occ);
     SHOW_INT(rcvbuf);
+    SHOW_INT(rcvbuf_max);
     SHOW_INT(sndbuf);
 #if defined(TARGET_LINUX) && HAVE_DECL_SO_MARK
     SHOW_INT(mark);
 #endif
+    SHOW_INT(busy_poll);
+    SHOW_BOOL(busy_poll_prefer);
+    SHOW_INT(busy_poll_budget);
+    SHOW_INT(tcp_notsent_lowat);
+    SHOW_BOOL(tcp_fastopen);
     SHOW_INT(sockflags);
 
     SHOW_BOOL(fast_io);
+    SHOW_INT(tun_read_ahead);
+    SHOW_INT(spin_wait);
+    SHOW_INT(spin_wait_cpu);
 
     SHOW_INT(comp.alg);
     SHOW_INT(comp.flags);
@@ -1924,6 +2202,11 @@ show_settings(const struct options *o)
         print_client_nat_list(o->client_nat, D_SHOW_PARMS);
     }
 
+    if (o->acl)
+    {
+        acl_list_print(o->acl, D_SHOW_PARMS);
+    }
+
     show_dns_options(&o->dns_options);
 
 #ifdef ENABLE_MANAGEMENT
@@ -1931,6 +2214,8 @@ show_settings(const struct options *o)
     SHOW_STR(management_port);
     SHOW_STR(management_user_pass);
     SHOW_INT(management_log_history_cache);
+    SHOW_INT(management_load_alert);
+    SHOW_INT(management_max_clients);
     SHOW_INT(management_echo_buffer_size);
     SHOW_STR(management_client_user);
     SHOW_STR(management_client_group);
@@ -1947,6 +2232,7 @@ show_settings(const struct options *o)
     SHOW_PARM(key_direction, keydirection2ascii(o->key_direction, false, true), "%s");
     SHOW_STR(ciphername);
     SHOW_STR(ncp_ciphers);
+    SHOW_BOOL(ncp_hw_aware);
     SHOW_STR(authname);
 #ifndef ENABLE_CRYPTO_MBEDTLS
     SHOW_BOOL(engine);
@@ -1956,6 +2242,9 @@ show_settings(const struct options *o)
     SHOW_INT(replay_time);
     SHOW_STR(packet_id_file);
     SHOW_BOOL(test_crypto);
+    SHOW_BOOL(bench_datachannel);
+    SHOW_INT(bench_seconds);
+    SHOW_INT(bench_load_clients);
 #ifdef ENABLE_PREDICTION_RESISTANCE
     SHOW_BOOL(use_prediction_resistance);
 #endif
@@ -1992,11 +2281,14 @@ show_settings(const struct options *o)
     SHOW_STR(cipher_list);
     SHOW_STR(cipher_list_tls13);
     SHOW_STR(tls_cert_profile);
+    SHOW_INT(tls_session_tickets);
     SHOW_STR(tls_verify);
     SHOW_STR(tls_export_cert);
     SHOW_INT(verify_x509_type);
     SHOW_STR(verify_x509_name);
     SHOW_STR_INLINE(crl_file);
+    SHOW_INT(verify_cache_size);
+    SHOW_INT(verify_cache_max_age);
     SHOW_INT(ns_cert_type);
     {
         int i;
@@ -2026,6 +2318,7 @@ show_settings(const struct options *o)
     SHOW_INT(ssl_flags);
 
     SHOW_INT(tls_timeout);
+    SHOW_INT(tls_window);
 
     SHOW_INT(renegotiate_bytes);
     SHOW_INT(renegotiate_packets);
@@ -2039,6 +2332,8 @@ show_settings(const struct options *o)
     SHOW_BOOL(tls_exit);
 
     SHOW_STR(tls_crypt_v2_metadata);
+    SHOW_BOOL(tls_crypt_v2_verify_via_env);
+    SHOW_INT(tls_crypt_v2_verify_cache);
 
 #ifdef ENABLE_PKCS11
     {
@@ -2070,6 +2365,7 @@ show_settings(const struct options *o)
         }
     }
     SHOW_INT(pkcs11_pin_cache_period);
+    SHOW_BOOL(pkcs11_sign_thread);
     SHOW_STR(pkcs11_id);
     SHOW_BOOL(pkcs11_id_management);
 #endif                  /* ENABLE_PKCS11 */
@@ -2251,9 +2547,40 @@ alloc_pull_filter(struct options *o, const int msglevel)
         l->head = f;
     }
     l->tail = f;
+    f->order = l->n++;
     return f;
 }
 
+/* Add the pattern of a filter from alloc_pull_filter() to the tree */
+static void
+pull_filter_add_pattern(struct options *o, struct pull_filter *f)
+{
+    struct pull_filter_node *node = &o->pull_filter_list->root;
+
+    for (const char *c = f->pattern; *c; ++c)
+    {
+        struct pull_filter_node *child = node->child;
+        while (child && child->c != *c)
+        {
+            child = child->sibling;
+        }
+        if (!child)
+        {
+            ALLOC_OBJ_CLEAR_GC(child, struct pull_filter_node, &o->gc);
+            child->c = *c;
+            child->sibling = node->child;
+            node->child = child;
+        }
+        node = child;
+    }
+
+    /* a later filter with the same pattern can never match */
+    if (!node->filter)
+    {
+        node->filter = f;
+    }
+}
+
 static void
 connection_entry_load_re(struct connection_entry *ce, const struct remote_entry *re)
 {
@@ -2328,7 +2655,7 @@ options_postprocess_verify_ce(const struct options *options,
     {
         notnull(options->shared_secret_file, "key file (--secret)");
     }
-    else
+    else if (!options->bench_datachannel)
     {
         notnull(options->dev, "TUN/TAP device (--dev)");
     }
@@ -2367,6 +2694,50 @@ options_postprocess_verify_ce(const struct options *options,
         msg(M_USAGE, "--mtu-test only makes sense with --proto udp");
     }
 
+    if (!proto_is_udp(ce->proto) && options->pmtu_probe)
+    {
+        msg(M_USAGE, "--pmtu-probe only makes sense with --proto udp");
+    }
+
+    if (options->mtu_test && options->pmtu_probe)
+    {
+        msg(M_USAGE, "--pmtu-probe cannot be used with --mtu-test");
+    }
+
+    if (!proto_is_udp(ce->proto) && options->fec)
+    {
+        msg(M_USAGE, "--fec only makes sense with --proto udp");
+    }
+
+    if (options->pull && options->fec)
+    {
+        msg(M_USAGE, "--fec cannot be used with --pull/--client, the server pushes it");
+    }
+
+    if (options->bench_load_clients)
+    {
+        if (!options->pull || !options->tls_client)
+        {
+            msg(M_USAGE, "--bench-load requires --client");
+        }
+        if (!proto_is_udp(ce->proto))
+        {
+            msg(M_USAGE, "--bench-load only makes sense with --proto udp");
+        }
+    }
+
+    if (options->n_multipath)
+    {
+        if (!options->pull || !proto_is_udp(ce->proto))
+        {
+            msg(M_USAGE, "--multipath only works with --client --proto udp");
+        }
+        if (ce->socks_proxy_server || ce->http_proxy_options)
+        {
+            msg(M_USAGE, "--multipath cannot be used with a proxy");
+        }
+    }
+
     /* will we be pulling options from server? */
     pull = options->pull;
 
@@ -2431,6 +2802,8 @@ options_postprocess_verify_ce(const struct options *options,
 #ifdef ENABLE_MANAGEMENT
     if (!options->management_addr
         && (options->management_flags
+            || options->management_load_alert
+            || options->management_max_clients != defaults.management_max_clients
             || options->management_log_history_cache != defaults.management_log_history_cache))
     {
         msg(M_USAGE, "--management is not specified, however one or more options which modify the behavior of --management were specified");
@@ -2442,6 +2815,17 @@ options_postprocess_verify_ce(const struct options *options,
         msg(M_USAGE, "--management-client-(user|group) can only be used on unix domain sockets");
     }
 
+    if (options->management_max_clients > 1)
+    {
+#ifdef _WIN32
+        msg(M_USAGE, "--management-max-clients is not supported on Windows");
+#endif
+        if (options->management_flags & MF_CONNECT_AS_CLIENT)
+        {
+            msg(M_USAGE, "--management-max-clients cannot be used with --management-client");
+        }
+    }
+
     if (options->management_addr
         && !(options->management_flags & MF_UNIX_SOCK)
         && (!options->management_user_pass))
@@ -2608,10 +2992,6 @@ options_postprocess_verify_ce(const struct options *options,
             msg(M_USAGE, "<connection> cannot be used with --mode server");
         }
 
-        if (options->shaper)
-        {
-            msg(M_USAGE, "--shaper cannot be used with --mode server");
-        }
         if (options->ipchange)
         {
             msg(M_USAGE,
@@ -2626,6 +3006,55 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--connect-freq only works with --mode server --proto udp.  Try --max-clients instead.");
         }
+        if (!proto_is_udp(ce->proto) && options->udp_recv_batch > 1)
+        {
+            msg(M_WARN, "NOTE: --udp-recv-batch has no effect without --proto udp");
+        }
+        if (!proto_is_udp(ce->proto) && options->udp_recv_gro)
+        {
+            msg(M_WARN, "NOTE: --udp-recv-gro has no effect without --proto udp");
+        }
+        if (!proto_is_udp(ce->proto) && options->handoff)
+        {
+            msg(M_USAGE, "--handoff only works with --mode server --proto udp");
+        }
+        if (!proto_is_udp(ce->proto) && options->n_listen_extra)
+        {
+            msg(M_USAGE, "--listen-extra only works with --mode server --proto udp");
+        }
+        if (options->handoff && options->n_listen_extra)
+        {
+            msg(M_USAGE, "--listen-extra cannot be used with --handoff");
+        }
+        if (!proto_is_udp(ce->proto) && options->udp_prefilter)
+        {
+            msg(M_USAGE, "--udp-prefilter only works with --mode server --proto udp");
+        }
+        if ((options->replicate_peer_host || options->replicate_listen_host)
+            && !options->replicate_secret)
+        {
+            msg(M_USAGE, "--replicate-peer and --replicate-listen require --replicate-secret");
+        }
+        if (options->peer_id_node_bits
+            && options->max_clients >= (1 << (24 - options->peer_id_node_bits)))
+        {
+            msg(M_USAGE, "--peer-id-node with %d bits leaves room for less than "
+                "--max-clients %d clients", options->peer_id_node_bits,
+                options->max_clients);
+        }
+        if ((options->replicate_peer_host || options->replicate_listen_host)
+            && options->duplicate_cn)
+        {
+            msg(M_USAGE, "--replicate-peer and --replicate-listen do not work with --duplicate-cn");
+        }
+        if (!proto_is_udp(ce->proto) && options->udp_send_batch > 1)
+        {
+            msg(M_WARN, "NOTE: --udp-send-batch has no effect without --proto udp");
+        }
+        if (options->udp_send_zerocopy && options->udp_send_batch < 2)
+        {
+            msg(M_WARN, "NOTE: --udp-send-zerocopy has no effect without --udp-send-batch");
+        }
         if (!(dev == DEV_TYPE_TAP || (dev == DEV_TYPE_TUN && options->topology == TOP_SUBNET)) && options->ifconfig_pool_netmask)
         {
             msg(M_USAGE, "The third parameter to --ifconfig-pool (netmask) is only valid in --dev tap mode");
@@ -2665,6 +3094,10 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--ccd-exclusive must be used with --client-config-dir");
         }
+        if (options->ccd_cache && !options->client_config_dir)
+        {
+            msg(M_USAGE, "--ccd-cache must be used with --client-config-dir");
+        }
         if (options->auth_token_generate && !options->renegotiate_seconds)
         {
             msg(M_USAGE, "--auth-gen-token needs a non-infinite "
@@ -2701,6 +3134,18 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--vlan-tagging must be used with --dev tap");
         }
+        if (options->neighbor_proxy && dev != DEV_TYPE_TAP)
+        {
+            msg(M_USAGE, "--neighbor-proxy must be used with --dev tap");
+        }
+        if (options->neighbor_proxy && !options->enable_c2c)
+        {
+            msg(M_WARN, "NOTE: --neighbor-proxy has no effect without --client-to-client");
+        }
+        if (options->acl && dev != DEV_TYPE_TUN)
+        {
+            msg(M_USAGE, "--acl/--acl-default must be used with --dev tun");
+        }
         if (!options->vlan_tagging)
         {
             if (options->vlan_accept != defaults.vlan_accept)
@@ -2732,10 +3177,69 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--hash-size requires --mode server");
         }
+        if (options->shaper_total)
+        {
+            msg(M_USAGE, "--shaper-total requires --mode server");
+        }
+        if (options->udp_recv_batch != defaults.udp_recv_batch)
+        {
+            msg(M_USAGE, "--udp-recv-batch requires --mode server");
+        }
+        if (options->udp_recv_gro)
+        {
+            msg(M_USAGE, "--udp-recv-gro requires --mode server");
+        }
+        if (options->udp_send_batch != defaults.udp_send_batch)
+        {
+            msg(M_USAGE, "--udp-send-batch requires --mode server");
+        }
+        if (options->udp_send_zerocopy)
+        {
+            msg(M_USAGE, "--udp-send-zerocopy requires --mode server");
+        }
         if (options->learn_address_script)
         {
             msg(M_USAGE, "--learn-address requires --mode server");
         }
+        if (options->script_workers)
+        {
+            msg(M_USAGE, "--script-workers requires --mode server");
+        }
+        if (options->live_reload)
+        {
+            msg(M_USAGE, "--live-reload requires --mode server");
+        }
+        if (options->handoff)
+        {
+            msg(M_USAGE, "--handoff requires --mode server");
+        }
+        if (options->peer_id_node_bits)
+        {
+            msg(M_USAGE, "--peer-id-node requires --mode server");
+        }
+        if (options->n_listen_extra)
+        {
+            msg(M_USAGE, "--listen-extra requires --mode server");
+        }
+        if (options->udp_prefilter)
+        {
+            msg(M_USAGE, "--udp-prefilter requires --mode server");
+        }
+        if (options->huge_pages)
+        {
+            msg(M_USAGE, "--huge-pages requires --mode server");
+        }
+#ifdef ENABLE_MANAGEMENT
+        if (options->management_load_alert)
+        {
+            msg(M_USAGE, "--management-load-alert requires --mode server");
+        }
+#endif
+        if (options->replicate_peer_host || options->replicate_listen_host
+            || options->replicate_secret)
+        {
+            msg(M_USAGE, "--replicate-peer, --replicate-listen and --replicate-secret require --mode server");
+        }
         if (options->client_connect_script)
         {
             msg(M_USAGE, "--client-connect requires --mode server");
@@ -2756,6 +3260,28 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--client-to-client requires --mode server");
         }
+        if (options->mcast_snooping)
+        {
+            msg(M_USAGE, "--multicast-snooping requires --mode server");
+        }
+        if (options->neighbor_proxy)
+        {
+            msg(M_USAGE, "--neighbor-proxy requires --mode server");
+        }
+        if (options->acl)
+        {
+            msg(M_USAGE, "--acl/--acl-default requires --mode server");
+        }
+        if (options->ncp_hw_aware)
+        {
+            msg(M_USAGE, "--data-ciphers-hw-aware requires --mode server");
+        }
+#ifdef ENABLE_PKCS11
+        if (options->pkcs11_sign_thread)
+        {
+            msg(M_USAGE, "--pkcs11-sign-thread requires --mode server");
+        }
+#endif
         if (options->duplicate_cn)
         {
             msg(M_USAGE, "--duplicate-cn requires --mode server");
@@ -2764,6 +3290,14 @@ options_postprocess_verify_ce(const struct options *options,
         {
             msg(M_USAGE, "--connect-freq requires --mode server");
         }
+        if (options->reneg_freq_max || options->reneg_freq_per)
+        {
+            msg(M_USAGE, "--reneg-freq requires --mode server");
+        }
+        if (options->dco_reject_incompatible)
+        {
+            msg(M_USAGE, "--dco-reject-incompatible requires --mode server");
+        }
         if (options->ssl_flags & (SSLF_CLIENT_CERT_NOT_REQUIRED|SSLF_CLIENT_CERT_OPTIONAL))
         {
             msg(M_USAGE, "--verify-client-cert requires --mode server");
@@ -3045,10 +3579,12 @@ options_postprocess_verify_ce(const struct options *options,
         MUST_BE_UNDEF(cipher_list);
         MUST_BE_UNDEF(cipher_list_tls13);
         MUST_BE_UNDEF(tls_cert_profile);
+        MUST_BE_UNDEF(tls_session_tickets);
         MUST_BE_UNDEF(tls_verify);
         MUST_BE_UNDEF(tls_export_cert);
         MUST_BE_UNDEF(verify_x509_name);
         MUST_BE_UNDEF(tls_timeout);
+        MUST_BE_UNDEF(tls_window);
         MUST_BE_UNDEF(renegotiate_bytes);
         MUST_BE_UNDEF(renegotiate_packets);
         MUST_BE_UNDEF(renegotiate_seconds);
@@ -3061,6 +3597,7 @@ options_postprocess_verify_ce(const struct options *options,
         MUST_BE_UNDEF(push_peer_info);
         MUST_BE_UNDEF(tls_exit);
         MUST_BE_UNDEF(crl_file);
+        MUST_BE_UNDEF(verify_cache_size);
         MUST_BE_UNDEF(ns_cert_type);
         MUST_BE_UNDEF(remote_cert_ku[0]);
         MUST_BE_UNDEF(remote_cert_eku);
@@ -3370,6 +3907,91 @@ pre_connect_restore(struct options *o, struct gc_arena *gc)
     o->push_continuation = 0;
     o->push_option_types_found = 0;
     o->imported_protocol_flags = 0;
+
+    /* only ever pushed to a client */
+    o->fec = 0;
+}
+
+struct options_pre_connect *
+options_save_pulled(const struct options *o, struct gc_arena *gc)
+{
+    struct options_pre_connect *pp;
+
+    ALLOC_OBJ_CLEAR_GC(pp, struct options_pre_connect, gc);
+    pp->tuntap_options = o->tuntap_options;
+    pp->tuntap_options_defined = true;
+    pp->foreign_option_index = o->foreign_option_index;
+
+    if (o->routes)
+    {
+        pp->routes = clone_route_option_list(o->routes, gc);
+        pp->routes_defined = true;
+    }
+    if (o->routes_ipv6)
+    {
+        pp->routes_ipv6 = clone_route_ipv6_option_list(o->routes_ipv6, gc);
+        pp->routes_ipv6_defined = true;
+    }
+    pp->dns_options = clone_dns_options(o->dns_options, gc);
+    return pp;
+}
+
+void
+options_reset_pulled(struct options *o, const struct options_pre_connect *pp,
+                     unsigned int parts, struct env_set *es, struct gc_arena *gc)
+{
+    if (!pp)
+    {
+        return;
+    }
+
+    if (parts & PULL_RESET_ROUTES)
+    {
+        if (pp->routes_defined)
+        {
+            rol_check_alloc(o);
+            copy_route_option_list(o->routes, pp->routes, gc);
+        }
+        else
+        {
+            o->routes = NULL;
+        }
+    }
+
+    if (parts & PULL_RESET_ROUTES_IPV6)
+    {
+        if (pp->routes_ipv6_defined)
+        {
+            rol6_check_alloc(o);
+            copy_route_ipv6_option_list(o->routes_ipv6, pp->routes_ipv6, gc);
+        }
+        else
+        {
+            o->routes_ipv6 = NULL;
+        }
+    }
+
+    if (parts & PULL_RESET_DNS)
+    {
+        CLEAR(o->tuntap_options);
+        if (pp->tuntap_options_defined)
+        {
+            o->tuntap_options = pp->tuntap_options;
+        }
+
+        gc_free(&o->dns_options.gc);
+        struct gc_arena dns_gc = gc_new();
+        o->dns_options = clone_dns_options(pp->dns_options, &dns_gc);
+        o->dns_options.gc = dns_gc;
+
+        for (int i = pp->foreign_option_index + 1; i <= o->foreign_option_index; ++i)
+        {
+            char name[32];
+            openvpn_snprintf(name, sizeof(name), "foreign_option_%d", i);
+            setenv_del(es, name);
+        }
+        o->foreign_option_index = pp->foreign_option_index;
+    }
 }
 
 static void
@@ -4780,10 +5402,14 @@ usage(void)
             o.ce.local_port, o.ce.remote_port,
             TUN_MTU_DEFAULT, TAP_MTU_EXTRA_DEFAULT,
             o.verbosity,
+            MCAST_SNOOPING_TIMEOUT_DEFAULT,
+            NEIGHBOR_PROXY_TIMEOUT_DEFAULT,
             o.authname,
             o.replay_window, o.replay_time,
-            o.tls_timeout, o.renegotiate_seconds,
-            o.handshake_window, o.transition_window);
+            o.tls_timeout, o.tls_window, RELIABLE_CAPACITY,
+            o.renegotiate_seconds,
+            o.handshake_window, o.transition_window,
+            VERIFY_CACHE_MAX_AGE_DEFAULT);
     fflush(fp);
 
 #endif /* ENABLE_SMALL */
@@ -4830,6 +5456,9 @@ show_library_versions(const unsigned int flags)
     msg(flags, "library versions: %s%s%s", get_ssl_library_version(),
         LZO_LIB_VER_STR);
 
+    const char *aes_hw = crypto_aes_hw_accel();
+    msg(flags, "AES hardware acceleration: %s", aes_hw ? aes_hw : "none");
+
 #undef LZO_LIB_VER_STR
 }
 
@@ -4892,24 +5521,78 @@ positive_atoi(const char *str)
     return i < 0 ? 0 : i;
 }
 
-#ifdef _WIN32  /* This function is only used when compiling on Windows */
-static unsigned int
-atou(const char *str)
-{
-    unsigned int val = 0;
-    sscanf(str, "%u", &val);
-    return val;
-}
-#endif
-
-static inline bool
-space(unsigned char c)
+/*
+ * Parse the packet sizes of --bench-datachannel, either 'imix' or a
+ * comma separated list of payload sizes.
+ */
+static bool
+parse_bench_sizes(struct options *o, const char *str, int msglevel)
 {
-    return c == '\0' || isspace(c);
-}
+    /* simple IMIX, 7:4:1 of 40, 576 and 1500 byte packets */
+    static const int imix[] = {
+        40, 576, 40, 40, 576, 40, 1500, 40, 576, 40, 576, 40
+    };
+    bool ret = true;
 
-int
-parse_line(const char *line,
+    if (!o->bench_sizes)
+    {
+        ALLOC_ARRAY_GC(o->bench_sizes, int, BENCH_SIZES_MAX, &o->gc);
+    }
+    o->bench_n_sizes = 0;
+    if (streq(str, "imix"))
+    {
+        memcpy(o->bench_sizes, imix, sizeof(imix));
+        o->bench_n_sizes = SIZE(imix);
+        return true;
+    }
+
+    struct gc_arena gc = gc_new();
+    char *list = string_alloc(str, &gc);
+    for (const char *token = strtok(list, ","); token; token = strtok(NULL, ","))
+    {
+        const int size = atoi(token);
+        if (size < 1 || size > 65535)
+        {
+            msg(msglevel, "--bench-datachannel: invalid packet size '%s'", token);
+            ret = false;
+            break;
+        }
+        if (o->bench_n_sizes >= BENCH_SIZES_MAX)
+        {
+            msg(msglevel, "--bench-datachannel: at most %d packet sizes can be given",
+                BENCH_SIZES_MAX);
+            ret = false;
+            break;
+        }
+        o->bench_sizes[o->bench_n_sizes++] = size;
+    }
+    if (ret && !o->bench_n_sizes)
+    {
+        msg(msglevel, "--bench-datachannel: no packet sizes given");
+        ret = false;
+    }
+    gc_free(&gc);
+    return ret;
+}
+
+#ifdef _WIN32  /* This function is only used when compiling on Windows */
+static unsigned int
+atou(const char *str)
+{
+    unsigned int val = 0;
+    sscanf(str, "%u", &val);
+    return val;
+}
+#endif
+
+static inline bool
+space(unsigned char c)
+{
+    return c == '\0' || isspace(c);
+}
+
+int
+parse_line(const char *line,
            char *p[],
            const int n,
            const char *file,
@@ -5091,86 +5774,58 @@ bypass_doubledash(char **p)
     }
 }
 
-struct in_src {
-#define IS_TYPE_FP 1
-#define IS_TYPE_BUF 2
-    int type;
-    union {
-        FILE *fp;
-        struct buffer *multiline;
-    } u;
-};
-
-static bool
-in_src_get(const struct in_src *is, char *line, const int size)
-{
-    if (is->type == IS_TYPE_FP)
-    {
-        return BOOL_CAST(fgets(line, size, is->u.fp));
-    }
-    else if (is->type == IS_TYPE_BUF)
-    {
-        bool status = buf_parse(is->u.multiline, '\n', line, size);
-        if ((int) strlen(line) + 1 < size)
-        {
-            strcat(line, "\n");
-        }
-        return status;
-    }
-    else
-    {
-        ASSERT(0);
-        return false;
-    }
-}
-
+/*
+ * Returns the lines of multiline up to the line with close_tag as one
+ * string and moves multiline past that line.  The blob is copied out in
+ * one piece, so large inline CA bundles and CRLs cost a single pass.
+ */
 static char *
-read_inline_file(struct in_src *is, const char *close_tag,
+read_inline_file(struct buffer *multiline, const char *close_tag,
                  int *num_lines, struct gc_arena *gc)
 {
-    char line[OPTION_LINE_SIZE];
-    struct buffer buf = alloc_buf(8*OPTION_LINE_SIZE);
+    const char *start = (const char *) BPTR(multiline);
+    const int len = BLEN(multiline);
+    const size_t tag_len = strlen(close_tag);
+    int pos = 0;
+    int end = -1;
     char *ret;
-    bool endtagfound = false;
 
-    while (in_src_get(is, line, sizeof(line)))
+    while (pos < len)
     {
+        const char *line = start + pos;
+        const char *nl = memchr(line, '\n', len - pos);
+        const int line_len = nl ? (int) (nl - line) + 1 : len - pos;
+        const char *line_ptr = line;
+
         (*num_lines)++;
-        char *line_ptr = line;
         /* Remove leading spaces */
-        while (isspace(*line_ptr))
+        while (line_ptr < line + line_len && isspace(*line_ptr))
         {
             line_ptr++;
         }
-        if (!strncmp(line_ptr, close_tag, strlen(close_tag)))
+        if ((size_t) (line + line_len - line_ptr) >= tag_len
+            && !strncmp(line_ptr, close_tag, tag_len))
         {
-            endtagfound = true;
+            end = pos;
+            pos += line_len;
             break;
         }
-        if (!buf_safe(&buf, strlen(line)+1))
-        {
-            /* Increase buffer size */
-            struct buffer buf2 = alloc_buf(buf.capacity * 2);
-            ASSERT(buf_copy(&buf2, &buf));
-            buf_clear(&buf);
-            free_buf(&buf);
-            buf = buf2;
-        }
-        buf_printf(&buf, "%s", line);
+        pos += line_len;
     }
-    if (!endtagfound)
+    if (end < 0)
     {
         msg(M_FATAL, "ERROR: Endtag %s missing", close_tag);
     }
-    ret = string_alloc(BSTR(&buf), gc);
-    buf_clear(&buf);
-    free_buf(&buf);
-    secure_memzero(line, sizeof(line));
+
+    ret = gc_malloc(end + 1, false, gc);
+    memcpy(ret, start, end);
+    ret[end] = '\0';
+    ASSERT(buf_advance(multiline, pos));
     return ret;
 }
 
 static int
-check_inline_file(struct in_src *is, char *p[], struct gc_arena *gc)
+check_inline_file(struct buffer *multiline, char *p[], struct gc_arena *gc)
 {
     int num_inline_lines = 0;
 
@@ -5185,7 +5840,7 @@ check_inline_file(struct in_src *is, char *p[], struct gc_arena *gc)
             p[0] = string_alloc(arg + 1, gc);
             close_tag = alloc_buf(strlen(p[0]) + 4);
             buf_printf(&close_tag, "</%s>", p[0]);
-            p[1] = read_inline_file(is, BSTR(&close_tag), &num_inline_lines, gc);
+            p[1] = read_inline_file(multiline, BSTR(&close_tag), &num_inline_lines, gc);
             p[2] = NULL;
             free_buf(&close_tag);
         }
@@ -5193,23 +5848,46 @@ check_inline_file(struct in_src *is, char *p[], struct gc_arena *gc)
     return num_inline_lines;
 }
 
-static int
-check_inline_file_via_fp(FILE *fp, char *p[], struct gc_arena *gc)
+/*
+ * Reads all of fp into memory.  size is what the file is expected to
+ * hold, 0 if that is not known, as for stdin, pipes and FIFOs such as
+ * --config <(...).  The buffer grows as needed and is not allocated
+ * with alloc_buf_gc(), as a config with large inline files may well
+ * exceed BUF_SIZE_MAX.
+ */
+static struct buffer
+read_config_fp(FILE *fp, size_t size, struct gc_arena *gc)
 {
-    struct in_src is;
-    is.type = IS_TYPE_FP;
-    is.u.fp = fp;
-    return check_inline_file(&is, p, gc);
-}
+    /* room for the trailing \0 and to see the end of the file */
+    size_t cap = size ? size + 2 : 8*OPTION_LINE_SIZE;
+    uint8_t *data = gc_malloc(cap, false, gc);
+    size_t len = 0;
+    size_t n;
 
-static int
-check_inline_file_via_buf(struct buffer *multiline, char *p[],
-                          struct gc_arena *gc)
-{
-    struct in_src is;
-    is.type = IS_TYPE_BUF;
-    is.u.multiline = multiline;
-    return check_inline_file(&is, p, gc);
+    while ((n = fread(data + len, 1, cap - len - 1, fp)) > 0)
+    {
+        len += n;
+        if (cap - len <= 1)
+        {
+            if (cap > INT_MAX / 2)
+            {
+                msg(M_FATAL, "Configuration file is too large");
+            }
+            uint8_t *bigger = gc_malloc(2 * cap, false, gc);
+            memcpy(bigger, data, len);
+            secure_memzero(data, len);
+            data = bigger;
+            cap *= 2;
+        }
+    }
+    data[len] = '\0';
+
+    struct buffer ret;
+    CLEAR(ret);
+    ret.data = data;
+    ret.capacity = (int) cap;
+    ret.len = (int) len;
+    return ret;
 }
 
 static void
@@ -5236,7 +5914,8 @@ read_config_file(struct options *options,
                  struct env_set *es)
 {
     const int max_recursive_levels = 10;
-    FILE *fp;
+    struct gc_arena gc = gc_new();
+    struct buffer content;
     int line_num;
     char line[OPTION_LINE_SIZE+1];
     char *p[MAX_PARMS+1];
@@ -5244,18 +5923,28 @@ read_config_file(struct options *options,
     ++level;
     if (level <= max_recursive_levels)
     {
-        if (streq(file, "stdin"))
-        {
-            fp = stdin;
-        }
-        else
-        {
-            fp = platform_fopen(file, "r");
-        }
+        FILE *fp = streq(file, "stdin") ? stdin : platform_fopen(file, "r");
         if (fp)
         {
+            platform_stat_t file_stat;
+            size_t size = 0;
+
+            /* read the file in one go and parse it in memory */
+            if (fp != stdin && platform_stat(file, &file_stat) == 0
+                && file_stat.st_size > 0 && file_stat.st_size < INT_MAX / 2)
+            {
+                size = (size_t) file_stat.st_size;
+            }
+            content = read_config_fp(fp, size, &gc);
+            if (fp != stdin)
+            {
+                fclose(fp);
+            }
+
+            struct buffer multiline = content;
+
             line_num = 0;
-            while (fgets(line, sizeof(line), fp))
+            while (buf_parse(&multiline, '\n', line, sizeof(line)))
             {
                 int offset = 0;
                 CLEAR(p);
@@ -5274,17 +5963,14 @@ read_config_file(struct options *options,
                 if (parse_line(line + offset, p, SIZE(p)-1, file, line_num, msglevel, &options->gc))
                 {
                     bypass_doubledash(&p[0]);
-                    int lines_inline = check_inline_file_via_fp(fp, p, &options->gc);
+                    int lines_inline = check_inline_file(&multiline, p, &options->gc);
                     add_option(options, p, lines_inline, file, line_num, level,
                                msglevel, permission_mask, option_types_found,
                                es);
                     line_num += lines_inline;
                 }
             }
-            if (fp != stdin)
-            {
-                fclose(fp);
-            }
+            secure_memzero(BPTR(&content), BLEN(&content));
         }
         else
         {
@@ -5295,6 +5981,7 @@ read_config_file(struct options *options,
     {
         msg(msglevel, "In %s:%d: Maximum recursive include levels exceeded in include attempt of file %s -- probably you have a configuration file that tries to include itself.", top_file, top_line, file);
     }
+    gc_free(&gc);
     secure_memzero(line, sizeof(line));
     CLEAR(p);
 }
@@ -5322,7 +6009,7 @@ read_config_string(const char *prefix,
         if (parse_line(line, p, SIZE(p)-1, prefix, line_num, msglevel, &options->gc))
         {
             bypass_doubledash(&p[0]);
-            int lines_inline = check_inline_file_via_buf(&multiline, p, &options->gc);
+            int lines_inline = check_inline_file(&multiline, p, &options->gc);
             add_option(options, p, lines_inline, prefix, line_num, 0, msglevel,
                        permission_mask, option_types_found, es);
             line_num += lines_inline;
@@ -5421,27 +6108,42 @@ apply_pull_filter(const struct options *o, char *line)
         line++;
     }
 
-    for (f = o->pull_filter_list->head; f; f = f->next)
+    /* the first filter in the list whose pattern is a prefix of line */
+    const struct pull_filter_node *node = &o->pull_filter_list->root;
+    f = node->filter;
+    for (const char *c = line; *c && node; ++c)
     {
-        if (f->type == PUF_TYPE_ACCEPT && strncmp(line, f->pattern, f->size) == 0)
-        {
-            msg(D_LOW, "Pushed option accepted by filter: '%s'", line);
-            return true;
-        }
-        else if (f->type == PUF_TYPE_IGNORE && strncmp(line, f->pattern, f->size) == 0)
+        for (node = node->child; node && node->c != *c; node = node->sibling)
         {
-            msg(D_PUSH, "Pushed option removed by filter: '%s'", line);
-            *line = '\0';
-            return true;
         }
-        else if (f->type == PUF_TYPE_REJECT && strncmp(line, f->pattern, f->size) == 0)
+        if (node && node->filter && (!f || node->filter->order < f->order))
         {
-            msg(M_WARN, "Pushed option rejected by filter: '%s'. Restarting.", line);
-            *line = '\0';
-            throw_signal_soft(SIGUSR1, "Offending option received from server");
-            return false;
+            f = node->filter;
         }
     }
+
+    if (!f)
+    {
+        return true;
+    }
+    if (f->type == PUF_TYPE_ACCEPT)
+    {
+        msg(D_LOW, "Pushed option accepted by filter: '%s'", line);
+        return true;
+    }
+    else if (f->type == PUF_TYPE_IGNORE)
+    {
+        msg(D_PUSH, "Pushed option removed by filter: '%s'", line);
+        *line = '\0';
+        return true;
+    }
+    else if (f->type == PUF_TYPE_REJECT)
+    {
+        msg(M_WARN, "Pushed option rejected by filter: '%s'. Restarting.", line);
+        *line = '\0';
+        throw_signal_soft(SIGUSR1, "Offending option received from server");
+        return false;
+    }
     return true;
 }
 
@@ -5495,6 +6197,25 @@ options_server_import(struct options *o,
                      es);
 }
 
+void
+options_server_import_string(struct options *o,
+                             const char *filename,
+                             const char *config,
+                             int msglevel,
+                             unsigned int permission_mask,
+                             unsigned int *option_types_found,
+                             struct env_set *es)
+{
+    msg(D_PUSH, "OPTIONS IMPORT: reading client specific options from: %s (cached)", filename);
+    read_config_string(filename,
+                       o,
+                       config,
+                       msglevel,
+                       permission_mask,
+                       option_types_found,
+                       es);
+}
+
 void
 options_string_import(struct options *options,
                       const char *config,
@@ -5672,6 +6393,347 @@ key_is_external(const struct options *options)
     return ret;
 }
 
+/*
+ * Handlers for the options that make up most of pushed options and
+ * client config dir files.  add_option() looks these up in
+ * option_fast_handlers before walking its chain of option names.
+ * A handler returns false if the parameters do not match, so
+ * add_option() reports the option as unrecognized as before.
+ */
+
+/* --route and --route-ipv6 */
+static bool
+add_option_route(struct options *options,
+                 char *p[],
+                 bool is_inline,
+                 const char *file,
+                 int line,
+                 const int msglevel,
+                 const unsigned int permission_mask,
+                 unsigned int *option_types_found)
+{
+    const bool pull_mode = BOOL_CAST(permission_mask & OPT_P_PULL_MODE);
+
+    if (streq(p[0], "route") && p[1] && !p[5])
+    {
+        VERIFY_PERMISSION(OPT_P_ROUTE);
+        rol_check_alloc(options);
+        if (pull_mode)
+        {
+            if (!ip_or_dns_addr_safe(p[1], options->allow_pull_fqdn) && !is_special_addr(p[1])) /* FQDN -- may be DNS name */
+            {
+                msg(msglevel, "route parameter network/IP '%s' must be a valid address", p[1]);
+                goto err;
+            }
+            if (p[2] && !ip_addr_dotted_quad_safe(p[2])) /* FQDN -- must be IP address */
+            {
+                msg(msglevel, "route parameter netmask '%s' must be an IP address", p[2]);
+                goto err;
+            }
+            if (p[3] && !ip_or_dns_addr_safe(p[3], options->allow_pull_fqdn) && !is_special_addr(p[3])) /* FQDN -- may be DNS name */
+            {
+                msg(msglevel, "route parameter gateway '%s' must be a valid address", p[3]);
+                goto err;
+            }
+        }
+        add_route_to_option_list(options->routes, p[1], p[2], p[3], p[4]);
+    }
+    else if (streq(p[0], "route-ipv6") && p[1] && !p[4])
+    {
+        VERIFY_PERMISSION(OPT_P_ROUTE);
+        rol6_check_alloc(options);
+        if (pull_mode)
+        {
+            if (!ipv6_addr_safe_hexplusbits(p[1]))
+            {
+                msg(msglevel, "route-ipv6 parameter network/IP '%s' must be a valid address", p[1]);
+                goto err;
+            }
+            if (p[2] && !ipv6_addr_safe(p[2]))
+            {
+                msg(msglevel, "route-ipv6 parameter gateway '%s' must be a valid address", p[2]);
+                goto err;
+            }
+            /* p[3] is metric, if present */
+        }
+        add_route_ipv6_to_option_list(options->routes_ipv6, p[1], p[2], p[3]);
+    }
+    else
+    {
+        return false;
+    }
+
+err:
+    return true;
+}
+
+/* --push, --push-reset and --push-remove */
+static bool
+add_option_push(struct options *options,
+                char *p[],
+                bool is_inline,
+                const char *file,
+                int line,
+                const int msglevel,
+                const unsigned int permission_mask,
+                unsigned int *option_types_found)
+{
+    if (streq(p[0], "push") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_PUSH);
+        push_options(options, &p[1], msglevel, &options->gc);
+    }
+    else if (streq(p[0], "push-reset") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+        push_reset(options);
+    }
+    else if (streq(p[0], "push-remove") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+        msg(D_PUSH, "PUSH_REMOVE '%s'", p[1]);
+        push_remove_option(options, p[1]);
+    }
+    else
+    {
+        return false;
+    }
+
+err:
+    return true;
+}
+
+/* --iroute and --iroute-ipv6 */
+static bool
+add_option_iroute(struct options *options,
+                  char *p[],
+                  bool is_inline,
+                  const char *file,
+                  int line,
+                  const int msglevel,
+                  const unsigned int permission_mask,
+                  unsigned int *option_types_found)
+{
+    if (streq(p[0], "iroute") && p[1] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+        option_iroute(options, p[1], p[2], msglevel);
+    }
+    else if (streq(p[0], "iroute-ipv6") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+        option_iroute_ipv6(options, p[1], msglevel);
+    }
+    else
+    {
+        return false;
+    }
+
+err:
+    return true;
+}
+
+/* --ifconfig-push */
+static bool
+add_option_ifconfig_push(struct options *options,
+                         char *p[],
+                         bool is_inline,
+                         const char *file,
+                         int line,
+                         const int msglevel,
+                         const unsigned int permission_mask,
+                         unsigned int *option_types_found)
+{
+    if (streq(p[0], "ifconfig-push") && p[1] && p[2] && !p[4])
+    {
+        in_addr_t local, remote_netmask;
+
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+        local = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[1], 0, NULL, NULL);
+        remote_netmask = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[2], 0, NULL, NULL);
+        if (local && remote_netmask)
+        {
+            options->push_ifconfig_defined = true;
+            options->push_ifconfig_local = local;
+            options->push_ifconfig_remote_netmask = remote_netmask;
+            if (p[3])
+            {
+                options->push_ifconfig_local_alias = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[3], 0, NULL, NULL);
+            }
+        }
+        else
+        {
+            msg(msglevel, "cannot parse --ifconfig-push addresses");
+            goto err;
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+err:
+    return true;
+}
+
+/* --ifconfig-ipv6-push */
+static bool
+add_option_ifconfig_ipv6_push(struct options *options,
+                              char *p[],
+                              bool is_inline,
+                              const char *file,
+                              int line,
+                              const int msglevel,
+                              const unsigned int permission_mask,
+                              unsigned int *option_types_found)
+{
+    if (streq(p[0], "ifconfig-ipv6-push") && p[1] && !p[3])
+    {
+        struct in6_addr local, remote;
+        unsigned int netbits;
+
+        VERIFY_PERMISSION(OPT_P_INSTANCE);
+
+        if (!get_ipv6_addr( p[1], &local, &netbits, msglevel ) )
+        {
+            msg(msglevel, "cannot parse --ifconfig-ipv6-push addresses");
+            goto err;
+        }
+
+        if (p[2])
+        {
+            if (!get_ipv6_addr( p[2], &remote, NULL, msglevel ) )
+            {
+                msg( msglevel, "cannot parse --ifconfig-ipv6-push addresses");
+                goto err;
+            }
+        }
+        else
+        {
+            if (!options->ifconfig_ipv6_local
+                || !get_ipv6_addr( options->ifconfig_ipv6_local, &remote,
+                                   NULL, msglevel ) )
+            {
+                msg( msglevel, "second argument to --ifconfig-ipv6-push missing and no global --ifconfig-ipv6 address set");
+                goto err;
+            }
+        }
+
+        options->push_ifconfig_ipv6_defined = true;
+        options->push_ifconfig_ipv6_local = local;
+        options->push_ifconfig_ipv6_netbits = netbits;
+        options->push_ifconfig_ipv6_remote = remote;
+        options->push_ifconfig_ipv6_blocked = false;
+    }
+    else
+    {
+        return false;
+    }
+
+err:
+    return true;
+}
+
+typedef bool (*option_handler_t)(struct options *options, char *p[],
+                                  bool is_inline, const char *file, int line,
+                                  const int msglevel,
+                                  const unsigned int permission_mask,
+                                  unsigned int *option_types_found);
+
+struct option_fast_handler
+{
+    const char *name;
+    option_handler_t handler;
+};
+
+/* sorted by name for bsearch() */
+static const struct option_fast_handler option_fast_handlers[] = {
+    { "ifconfig-ipv6-push", add_option_ifconfig_ipv6_push },
+    { "ifconfig-push", add_option_ifconfig_push },
+    { "iroute", add_option_iroute },
+    { "iroute-ipv6", add_option_iroute },
+    { "push", add_option_push },
+    { "push-remove", add_option_push },
+    { "push-reset", add_option_push },
+    { "route", add_option_route },
+    { "route-ipv6", add_option_route },
+};
+
+static int
+option_fast_handler_cmp(const void *key, const void *elem)
+{
+    return strcmp((const char *) key,
+                  ((const struct option_fast_handler *) elem)->name);
+}
+
+static option_handler_t
+option_fast_handler_find(const char *name)
+{
+    const struct option_fast_handler *h;
+    h = bsearch(name, option_fast_handlers, SIZE(option_fast_handlers),
+                sizeof(option_fast_handlers[0]), option_fast_handler_cmp);
+    return h ? h->handler : NULL;
+}
+
+/*
+ * Options that --live-reload takes over from the configuration without
+ * a restart, see options_live_reload_apply().
+ */
+static const char *const live_reload_options[] = {
+    "push",
+    "ca",
+    "capath",
+    "cert",
+    "key",
+    "extra-certs",
+    "dh",
+    "pkcs12",
+    "crl-verify",
+    "tls-cipher",
+    "tls-ciphersuites",
+    "tls-groups",
+    "tls-cert-profile",
+    "tls-version-min",
+    "tls-version-max",
+    "ecdh-curve",
+};
+
+/*
+ * Remember an option of the configuration which a live reload cannot
+ * change, so that options_live_reload_check() can find out whether it
+ * was changed.
+ */
+static void
+record_fixed_option(struct options *options, char *p[])
+{
+    for (size_t i = 0; i < SIZE(live_reload_options); ++i)
+    {
+        if (streq(p[0], live_reload_options[i]))
+        {
+            return;
+        }
+    }
+
+    size_t len = 0;
+    for (int i = 0; i < MAX_PARMS && p[i]; ++i)
+    {
+        len += strlen(p[i]) + 1;
+    }
+
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(len, &gc);
+    for (int i = 0; i < MAX_PARMS && p[i]; ++i)
+    {
+        buf_write(&buf, p[i], strlen(p[i]) + 1);
+    }
+    if (!options->reload_fixed)
+    {
+        options->reload_fixed = buffer_list_new();
+    }
+    buffer_list_push_data(options->reload_fixed, BPTR(&buf), BLEN(&buf));
+    gc_free(&gc);
+}
+
 static void
 add_option(struct options *options,
            char *p[],
@@ -5690,6 +6752,13 @@ add_option(struct options *options,
 
     ASSERT(MAX_PARMS >= 7);
 
+    /* only the configuration itself, not --client-config-dir files or
+     * pushed options */
+    if (permission_mask == OPT_P_DEFAULT)
+    {
+        record_fixed_option(options, p);
+    }
+
     /*
      * If directive begins with "setenv opt" prefix, don't raise an error if
      * directive is unrecognized.
@@ -5709,6 +6778,15 @@ add_option(struct options *options,
         file = "[CMD-LINE]";
         line = 1;
     }
+
+    option_handler_t handler = option_fast_handler_find(p[0]);
+    if (handler && handler(options, p, is_inline, file, line, msglevel,
+                           permission_mask, option_types_found))
+    {
+        gc_free(&gc);
+        return;
+    }
+
     if (streq(p[0], "help"))
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
@@ -5921,13 +6999,40 @@ add_option(struct options *options,
         int cache;
 
         VERIFY_PERMISSION(OPT_P_GENERAL);
-        cache = atoi(p[1]);
-        if (cache < 1)
+        cache = atoi(p[1]);
+        if (cache < 1)
+        {
+            msg(msglevel, "--management-log-cache parameter is out of range");
+            goto err;
+        }
+        options->management_log_history_cache = cache;
+    }
+    else if (streq(p[0], "management-load-alert") && p[1] && !p[2])
+    {
+        int percent;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        percent = atoi(p[1]);
+        if (percent < 1 || percent > 100)
+        {
+            msg(msglevel, "--management-load-alert parameter must be between 1 and 100");
+            goto err;
+        }
+        options->management_load_alert = percent;
+    }
+    else if (streq(p[0], "management-max-clients") && p[1] && !p[2])
+    {
+        int n;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        n = atoi(p[1]);
+        if (n < 1 || n > MANAGEMENT_MAX_CLIENTS)
         {
-            msg(msglevel, "--management-log-cache parameter is out of range");
+            msg(msglevel, "--management-max-clients parameter must be between 1 and %d",
+                MANAGEMENT_MAX_CLIENTS);
             goto err;
         }
-        options->management_log_history_cache = cache;
+        options->management_max_clients = n;
     }
 #endif /* ifdef ENABLE_MANAGEMENT */
 #ifdef ENABLE_PLUGIN
@@ -5983,6 +7088,11 @@ add_option(struct options *options,
     {
         options->tuntap_options.disable_dco = true;
     }
+    else if (streq(p[0], "dco-reject-incompatible") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->dco_reject_incompatible = true;
+    }
     else if (streq(p[0], "dev-node") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
@@ -6219,6 +7329,11 @@ add_option(struct options *options,
             options->resolve_retry_seconds = positive_atoi(p[1]);
         }
     }
+    else if (streq(p[0], "resolv-cache") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->resolv_cache = positive_atoi(p[1]);
+    }
     else if ((streq(p[0], "preresolve") || streq(p[0], "ip-remote-hint")) && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
@@ -6285,6 +7400,22 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->gremlin = positive_atoi(p[1]);
     }
+    else if (streq(p[0], "gremlin-impair") && p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        for (int i = 1; p[i]; i += 2)
+        {
+            if (!p[i + 1])
+            {
+                msg(msglevel, "--gremlin-impair: missing value for %s", p[i]);
+                goto err;
+            }
+            if (!gremlin_impair_parse(&options->gremlin_impair, p[i], p[i + 1], msglevel))
+            {
+                goto err;
+            }
+        }
+    }
 #endif
     else if (streq(p[0], "chroot") && p[1] && !p[2])
     {
@@ -6399,6 +7530,19 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->memstats_fn = p[1];
     }
+#endif
+#ifdef ENABLE_TRACE
+    else if (streq(p[0], "trace-ring") && p[1] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->trace_ring_fn = p[1];
+        options->trace_ring_size = p[2] ? positive_atoi(p[2]) : 65536;
+        if (options->trace_ring_size < 1)
+        {
+            msg(msglevel, "--trace-ring: the number of events must be positive");
+            goto err;
+        }
+    }
 #endif
     else if (streq(p[0], "mlock") && !p[1])
     {
@@ -6436,6 +7580,11 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_MESSAGES);
         options->mute = positive_atoi(p[1]);
     }
+    else if (streq(p[0], "mute-repeats") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_MESSAGES);
+        options->mute_repeats = true;
+    }
     else if (streq(p[0], "errors-to-stderr") && !p[1])
     {
         VERIFY_PERMISSION(OPT_P_MESSAGES);
@@ -6576,16 +7725,80 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->mtu_test = true;
     }
+    else if (streq(p[0], "fec") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL|OPT_P_PUSH_MTU|OPT_P_INSTANCE);
+        int fec = atoi(p[1]);
+        if (fec && (fec < FEC_GROUP_MIN || fec > FEC_GROUP_MAX))
+        {
+            msg(msglevel, "--fec group size must be 0 or from %d to %d",
+                FEC_GROUP_MIN, FEC_GROUP_MAX);
+            goto err;
+        }
+        options->fec = fec;
+    }
+#ifndef _WIN32
+    else if (streq(p[0], "multipath") && p[1] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (options->n_multipath >= LINK_SOCKET_EXTRA_MAX)
+        {
+            msg(msglevel, "--multipath can be given at most %d times",
+                LINK_SOCKET_EXTRA_MAX);
+            goto err;
+        }
+        int weight = p[2] ? atoi(p[2]) : 1;
+        if (weight < 1 || weight > 100)
+        {
+            msg(msglevel, "--multipath weight must be from 1 to 100");
+            goto err;
+        }
+        options->multipath_host[options->n_multipath] = p[1];
+        options->multipath_weight[options->n_multipath] = weight;
+        ++options->n_multipath;
+    }
+#endif
+    else if (streq(p[0], "pmtu-probe") && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->pmtu_probe = p[1] ? atoi(p[1]) : 600;
+        if (options->pmtu_probe < OCC_PMTU_PROBE_INTERVAL_SECONDS)
+        {
+            msg(msglevel, "--pmtu-probe interval must be at least %d seconds",
+                OCC_PMTU_PROBE_INTERVAL_SECONDS);
+            goto err;
+        }
+    }
     else if (streq(p[0], "nice") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_NICE);
         options->nice = atoi(p[1]);
     }
+    else if (streq(p[0], "cpu-affinity") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_NICE);
+        options->cpu_affinity = positive_atoi(p[1]);
+    }
+    else if (streq(p[0], "numa-node") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_NICE);
+        options->numa_node = p[1];
+    }
+    else if (streq(p[0], "huge-pages") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->huge_pages = true;
+    }
     else if (streq(p[0], "rcvbuf") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_SOCKBUF);
         options->rcvbuf = positive_atoi(p[1]);
     }
+    else if (streq(p[0], "rcvbuf-max") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->rcvbuf_max = positive_atoi(p[1]);
+    }
     else if (streq(p[0], "sndbuf") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_SOCKBUF);
@@ -6596,6 +7809,57 @@ add_option(struct options *options,
 #if defined(TARGET_LINUX) && HAVE_DECL_SO_MARK
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->mark = atoi(p[1]);
+#endif
+    }
+    else if (streq(p[0], "busy-poll") && p[1] && !p[4])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (p[2] && !streq(p[2], "prefer"))
+        {
+            msg(msglevel, "--busy-poll: unknown flag '%s'", p[2]);
+            goto err;
+        }
+        if (p[3] && (atoi(p[3]) < 1 || atoi(p[3]) > 1024))
+        {
+            msg(msglevel, "--busy-poll: budget must be from 1 to 1024");
+            goto err;
+        }
+#if defined(TARGET_LINUX) && defined(SO_BUSY_POLL)
+        options->busy_poll = positive_atoi(p[1]);
+        options->busy_poll_prefer = p[2] != NULL;
+        options->busy_poll_budget = p[3] ? atoi(p[3]) : 0;
+#ifndef SO_PREFER_BUSY_POLL
+        if (options->busy_poll_prefer)
+        {
+            msg(M_WARN, "NOTE: --busy-poll prefer is not supported on this platform, ignoring");
+        }
+#endif
+#ifndef SO_BUSY_POLL_BUDGET
+        if (options->busy_poll_budget)
+        {
+            msg(M_WARN, "NOTE: --busy-poll budget is not supported on this platform, ignoring");
+        }
+#endif
+#else
+        msg(M_WARN, "NOTE: --busy-poll is not supported on this platform, ignoring");
+#endif
+    }
+    else if (streq(p[0], "tcp-notsent-lowat") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#if defined(IPPROTO_TCP) && defined(TCP_NOTSENT_LOWAT)
+        options->tcp_notsent_lowat = positive_atoi(p[1]);
+#else
+        msg(M_WARN, "NOTE: --tcp-notsent-lowat is not supported on this platform, ignoring");
+#endif
+    }
+    else if (streq(p[0], "tcp-fastopen") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#if defined(IPPROTO_TCP) && defined(TCP_FASTOPEN)
+        options->tcp_fastopen = true;
+#else
+        msg(M_WARN, "NOTE: --tcp-fastopen is not supported on this platform, ignoring");
 #endif
     }
     else if (streq(p[0], "socket-flags"))
@@ -6631,9 +7895,37 @@ add_option(struct options *options,
         goto err;
 #endif
     }
-    else if (streq(p[0], "shaper") && p[1] && !p[2])
+    else if (streq(p[0], "tun-queues") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#ifdef TARGET_LINUX
+        int queues = atoi(p[1]);
+        if (queues < 1 || queues > TUN_QUEUES_MAX)
+        {
+            msg(msglevel, "--tun-queues parameter must be between 1 and %d",
+                TUN_QUEUES_MAX);
+            goto err;
+        }
+        options->tuntap_options.queues = queues;
+#else
+        msg(msglevel, "--tun-queues not supported on this OS");
+        goto err;
+#endif
+    }
+    else if (streq(p[0], "tun-offload") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#ifdef TARGET_LINUX
+        options->tuntap_options.offload = true;
+#else
+        msg(msglevel, "--tun-offload not supported on this OS");
+        goto err;
+#endif
+    }
+    else if (streq(p[0], "shaper") && p[1] && !p[3])
     {
         int shaper;
+        int burst = 0;
 
         VERIFY_PERMISSION(OPT_P_SHAPER);
         shaper = atoi(p[1]);
@@ -6643,7 +7935,18 @@ add_option(struct options *options,
                 SHAPER_MIN, SHAPER_MAX);
             goto err;
         }
+        if (p[2])
+        {
+            burst = atoi(p[2]);
+            if (burst < 0 || burst > SHAPER_MAX)
+            {
+                msg(msglevel, "Bad shaper burst, must be between 0 and %d",
+                    SHAPER_MAX);
+                goto err;
+            }
+        }
         options->shaper = shaper;
+        options->shaper_burst = burst;
     }
     else if (streq(p[0], "port") && p[1] && !p[2])
     {
@@ -6681,6 +7984,26 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->fast_io = true;
     }
+    else if (streq(p[0], "tun-read-ahead") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->tun_read_ahead = positive_atoi(p[1]);
+    }
+    else if (streq(p[0], "spin-wait") && p[1] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->spin_wait = positive_atoi(p[1]);
+        if (p[2])
+        {
+            const int cpu = positive_atoi(p[2]);
+            if (cpu < 1 || cpu > 100)
+            {
+                msg(msglevel, "--spin-wait: cpu percentage must be between 1 and 100");
+                goto err;
+            }
+            options->spin_wait_cpu = cpu;
+        }
+    }
     else if (streq(p[0], "inactive") && p[1] && !p[3])
     {
         VERIFY_PERMISSION(OPT_P_TIMER);
@@ -6699,6 +8022,11 @@ add_option(struct options *options,
             }
         }
     }
+    else if (streq(p[0], "compact-idle") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->compact_idle = positive_atoi(p[1]);
+    }
     else if (streq(p[0], "session-timeout") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_TIMER);
@@ -6912,6 +8240,11 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_PERSIST);
         options->persist_tun = true;
     }
+    else if (streq(p[0], "persist-routes") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->persist_routes = true;
+    }
     else if (streq(p[0], "persist-key") && !p[1])
     {
         VERIFY_PERMISSION(OPT_P_PERSIST);
@@ -6933,50 +8266,6 @@ add_option(struct options *options,
         cnol_check_alloc(options);
         add_client_nat_to_option_list(options->client_nat, p[1], p[2], p[3], p[4], msglevel);
     }
-    else if (streq(p[0], "route") && p[1] && !p[5])
-    {
-        VERIFY_PERMISSION(OPT_P_ROUTE);
-        rol_check_alloc(options);
-        if (pull_mode)
-        {
-            if (!ip_or_dns_addr_safe(p[1], options->allow_pull_fqdn) && !is_special_addr(p[1])) /* FQDN -- may be DNS name */
-            {
-                msg(msglevel, "route parameter network/IP '%s' must be a valid address", p[1]);
-                goto err;
-            }
-            if (p[2] && !ip_addr_dotted_quad_safe(p[2])) /* FQDN -- must be IP address */
-            {
-                msg(msglevel, "route parameter netmask '%s' must be an IP address", p[2]);
-                goto err;
-            }
-            if (p[3] && !ip_or_dns_addr_safe(p[3], options->allow_pull_fqdn) && !is_special_addr(p[3])) /* FQDN -- may be DNS name */
-            {
-                msg(msglevel, "route parameter gateway '%s' must be a valid address", p[3]);
-                goto err;
-            }
-        }
-        add_route_to_option_list(options->routes, p[1], p[2], p[3], p[4]);
-    }
-    else if (streq(p[0], "route-ipv6") && p[1] && !p[4])
-    {
-        VERIFY_PERMISSION(OPT_P_ROUTE);
-        rol6_check_alloc(options);
-        if (pull_mode)
-        {
-            if (!ipv6_addr_safe_hexplusbits(p[1]))
-            {
-                msg(msglevel, "route-ipv6 parameter network/IP '%s' must be a valid address", p[1]);
-                goto err;
-            }
-            if (p[2] && !ipv6_addr_safe(p[2]))
-            {
-                msg(msglevel, "route-ipv6 parameter gateway '%s' must be a valid address", p[2]);
-                goto err;
-            }
-            /* p[3] is metric, if present */
-        }
-        add_route_ipv6_to_option_list(options->routes_ipv6, p[1], p[2], p[3]);
-    }
     else if (streq(p[0], "max-routes") && !p[2])
     {
         msg(M_WARN, "DEPRECATED OPTION: --max-routes option ignored."
@@ -7094,6 +8383,7 @@ add_option(struct options *options,
         }
         f->pattern = p[2];
         f->size = strlen(p[2]);
+        pull_filter_add_pattern(options, f);
     }
     else if (streq(p[0], "allow-pull-fqdn") && !p[1])
     {
@@ -7354,22 +8644,6 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->server_bridge_proxy_dhcp = true;
     }
-    else if (streq(p[0], "push") && p[1] && !p[2])
-    {
-        VERIFY_PERMISSION(OPT_P_PUSH);
-        push_options(options, &p[1], msglevel, &options->gc);
-    }
-    else if (streq(p[0], "push-reset") && !p[1])
-    {
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-        push_reset(options);
-    }
-    else if (streq(p[0], "push-remove") && p[1] && !p[2])
-    {
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-        msg(D_PUSH, "PUSH_REMOVE '%s'", p[1]);
-        push_remove_option(options, p[1]);
-    }
     else if (streq(p[0], "ifconfig-pool") && p[1] && p[2] && !p[4])
     {
         const int lev = M_WARN;
@@ -7480,6 +8754,51 @@ add_option(struct options *options,
         options->cf_initial_max = cf_max;
         options->cf_initial_per = cf_per;
     }
+    else if (streq(p[0], "connect-freq-prefix") && p[1] && p[2] && !p[5])
+    {
+        long cf_max, cf_per, b4 = 24, b6 = 56;
+        char *e1, *e2, *e3 = "", *e4 = "";
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        cf_max = strtol(p[1], &e1, 10);
+        cf_per = strtol(p[2], &e2, 10);
+        if (p[3])
+        {
+            b4 = strtol(p[3], &e3, 10);
+        }
+        if (p[3] && p[4])
+        {
+            b6 = strtol(p[4], &e4, 10);
+        }
+        if (*e1 != '\0' || *e2 != '\0' || *e3 != '\0' || *e4 != '\0'
+            || cf_max < 0 || cf_max >= UINT16_MAX || cf_per <= 0
+            || b4 < 0 || b4 > 32 || b6 < 0 || b6 > 128)
+        {
+            msg(msglevel, "--connect-freq-prefix parameters must be integers, "
+                "n < %d, s > 0 and valid IPv4/IPv6 prefix lengths", UINT16_MAX);
+            goto err;
+        }
+        options->cf_prefix_max = cf_max;
+        options->cf_prefix_per = cf_per;
+        options->cf_prefix_ipv4_bits = b4;
+        options->cf_prefix_ipv6_bits = b6;
+    }
+    else if (streq(p[0], "reneg-freq") && p[1] && p[2] && !p[3])
+    {
+        long rf_max, rf_per;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        char *e1, *e2;
+        rf_max = strtol(p[1], &e1, 10);
+        rf_per = strtol(p[2], &e2, 10);
+        if (rf_max < 0 || rf_per < 0 || *e1 != '\0' || *e2 != '\0')
+        {
+            msg(msglevel, "--reneg-freq parameters must be integers and >= 0");
+            goto err;
+        }
+        options->reneg_freq_max = rf_max;
+        options->reneg_freq_per = rf_per;
+    }
     else if (streq(p[0], "max-clients") && p[1] && !p[2])
     {
         int max_clients;
@@ -7498,6 +8817,25 @@ add_option(struct options *options,
         }
         options->max_clients = max_clients;
     }
+    else if (streq(p[0], "peer-id-node") && p[1] && p[2] && !p[3])
+    {
+        int id = atoi(p[1]);
+        int bits = atoi(p[2]);
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (bits < 1 || bits > 16)
+        {
+            msg(msglevel, "--peer-id-node bits must be between 1 and 16");
+            goto err;
+        }
+        if (id < 0 || id >= (1 << bits))
+        {
+            msg(msglevel, "--peer-id-node id must be less than %d", 1 << bits);
+            goto err;
+        }
+        options->peer_id_node = id;
+        options->peer_id_node_bits = bits;
+    }
     else if (streq(p[0], "max-routes-per-client") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_INHERIT);
@@ -7632,25 +8970,93 @@ add_option(struct options *options,
         set_user_script(options, &options->client_crresponse_script,
                         p[1], "client-crresponse", true);
     }
-    else if (streq(p[0], "client-disconnect") && p[1])
+    else if (streq(p[0], "client-disconnect") && p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_SCRIPT);
+        if (!no_more_than_n_args(msglevel, p, 2, NM_QUOTE_HINT))
+        {
+            goto err;
+        }
+        set_user_script(options, &options->client_disconnect_script,
+                        p[1], "client-disconnect", true);
+    }
+    else if (streq(p[0], "learn-address") && p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_SCRIPT);
+        if (!no_more_than_n_args(msglevel, p, 2, NM_QUOTE_HINT))
+        {
+            goto err;
+        }
+        set_user_script(options, &options->learn_address_script,
+                        p[1], "learn-address", true);
+    }
+    else if (streq(p[0], "script-workers") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->script_workers = positive_atoi(p[1]);
+        if (options->script_workers <= 0)
+        {
+            msg(msglevel, "--script-workers parameter must be > 0");
+            goto err;
+        }
+    }
+    else if (streq(p[0], "live-reload") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->live_reload = true;
+    }
+#if UNIX_SOCK_SUPPORT
+    else if (streq(p[0], "handoff") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->handoff = p[1];
+    }
+#endif
+#ifndef _WIN32
+    else if (streq(p[0], "listen-extra") && p[1] && p[2] && !p[3])
     {
-        VERIFY_PERMISSION(OPT_P_SCRIPT);
-        if (!no_more_than_n_args(msglevel, p, 2, NM_QUOTE_HINT))
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (options->n_listen_extra >= LINK_SOCKET_EXTRA_MAX)
         {
+            msg(msglevel, "--listen-extra can be given at most %d times",
+                LINK_SOCKET_EXTRA_MAX);
             goto err;
         }
-        set_user_script(options, &options->client_disconnect_script,
-                        p[1], "client-disconnect", true);
+        options->listen_extra_host[options->n_listen_extra] = p[1];
+        options->listen_extra_port[options->n_listen_extra] = p[2];
+        ++options->n_listen_extra;
     }
-    else if (streq(p[0], "learn-address") && p[1])
+#endif
+    else if (streq(p[0], "udp-prefilter") && !p[1])
     {
-        VERIFY_PERMISSION(OPT_P_SCRIPT);
-        if (!no_more_than_n_args(msglevel, p, 2, NM_QUOTE_HINT))
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#ifdef TARGET_LINUX
+        options->udp_prefilter = true;
+#else
+        msg(M_WARN, "NOTE: --udp-prefilter is not supported on this platform, ignoring");
+#endif
+    }
+    else if (streq(p[0], "replicate-peer") && p[1] && p[2] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->replicate_peer_host = p[1];
+        options->replicate_peer_port = p[2];
+    }
+    else if (streq(p[0], "replicate-listen") && p[1] && p[2] && !p[4])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->replicate_listen_host = p[1];
+        options->replicate_listen_port = p[2];
+        options->replicate_ttl = 3600;
+        if (p[3])
         {
-            goto err;
+            options->replicate_ttl = positive_atoi(p[3]);
         }
-        set_user_script(options, &options->learn_address_script,
-                        p[1], "learn-address", true);
+    }
+    else if (streq(p[0], "replicate-secret") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->replicate_secret = p[1];
     }
     else if (streq(p[0], "tmp-dir") && p[1] && !p[2])
     {
@@ -7667,6 +9073,44 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->ccd_exclusive = true;
     }
+    else if (streq(p[0], "ccd-cache") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->ccd_cache = positive_atoi(p[1]);
+        if (options->ccd_cache <= 0)
+        {
+            msg(msglevel, "--ccd-cache parameter must be > 0");
+            goto err;
+        }
+    }
+    else if (streq(p[0], "multicast-snooping") && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->mcast_snooping = MCAST_SNOOPING_TIMEOUT_DEFAULT;
+        if (p[1])
+        {
+            options->mcast_snooping = positive_atoi(p[1]);
+            if (options->mcast_snooping <= 0)
+            {
+                msg(msglevel, "--multicast-snooping parameter must be > 0");
+                goto err;
+            }
+        }
+    }
+    else if (streq(p[0], "neighbor-proxy") && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->neighbor_proxy = NEIGHBOR_PROXY_TIMEOUT_DEFAULT;
+        if (p[1])
+        {
+            options->neighbor_proxy = positive_atoi(p[1]);
+            if (options->neighbor_proxy <= 0)
+            {
+                msg(msglevel, "--neighbor-proxy parameter must be > 0");
+                goto err;
+            }
+        }
+    }
     else if (streq(p[0], "bcast-buffers") && p[1] && !p[2])
     {
         int n_bcast_buf;
@@ -7691,6 +9135,103 @@ add_option(struct options *options,
         }
         options->tcp_queue_limit = tcp_queue_limit;
     }
+    else if (streq(p[0], "tcp-queue-priority") && p[1] && !p[2])
+    {
+        int size;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        size = atoi(p[1]);
+        if (size < 0)
+        {
+            msg(msglevel, "--tcp-queue-priority parameter must be >= 0");
+            goto err;
+        }
+        options->tcp_queue_priority = size;
+    }
+    else if (streq(p[0], "shaper-total") && p[1] && !p[3])
+    {
+        int shaper;
+        int burst = 0;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        shaper = atoi(p[1]);
+        if (shaper < SHAPER_MIN || shaper > SHAPER_MAX)
+        {
+            msg(msglevel, "Bad --shaper-total value, must be between %d and %d",
+                SHAPER_MIN, SHAPER_MAX);
+            goto err;
+        }
+        if (p[2])
+        {
+            burst = atoi(p[2]);
+            if (burst < 0 || burst > SHAPER_MAX)
+            {
+                msg(msglevel, "Bad --shaper-total burst, must be between 0 and %d",
+                    SHAPER_MAX);
+                goto err;
+            }
+        }
+        options->shaper_total = shaper;
+        options->shaper_total_burst = burst;
+    }
+    else if (streq(p[0], "udp-recv-batch") && p[1] && !p[2])
+    {
+        int udp_recv_batch;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        udp_recv_batch = atoi(p[1]);
+        if (udp_recv_batch < 1 || udp_recv_batch > UDP_RECV_BATCH_MAX)
+        {
+            msg(msglevel, "--udp-recv-batch parameter must be between 1 and %d",
+                UDP_RECV_BATCH_MAX);
+            goto err;
+        }
+#if !ENABLE_UDP_RECV_BATCH
+        if (udp_recv_batch > 1)
+        {
+            msg(M_WARN, "NOTE: --udp-recv-batch is not supported on this platform, ignoring");
+        }
+#endif
+        options->udp_recv_batch = udp_recv_batch;
+    }
+    else if (streq(p[0], "udp-recv-gro") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#if ENABLE_UDP_RECV_GRO
+        options->udp_recv_gro = true;
+#else
+        msg(M_WARN, "NOTE: --udp-recv-gro is not supported on this platform, ignoring");
+#endif
+    }
+    else if (streq(p[0], "udp-send-batch") && p[1] && !p[2])
+    {
+        int udp_send_batch;
+
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        udp_send_batch = atoi(p[1]);
+        if (udp_send_batch < 1 || udp_send_batch > UDP_SEND_BATCH_MAX)
+        {
+            msg(msglevel, "--udp-send-batch parameter must be between 1 and %d",
+                UDP_SEND_BATCH_MAX);
+            goto err;
+        }
+#if !ENABLE_UDP_SEND_BATCH
+        if (udp_send_batch > 1)
+        {
+            msg(M_WARN, "NOTE: --udp-send-batch is not supported on this platform, ignoring");
+        }
+#endif
+        options->udp_send_batch = udp_send_batch;
+    }
+    else if (streq(p[0], "udp-send-zerocopy") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+#if ENABLE_UDP_SEND_ZEROCOPY
+        options->udp_send_zerocopy = true;
+#else
+        msg(M_WARN, "NOTE: --udp-send-zerocopy is not supported on this platform, ignoring");
+#endif
+    }
 #if PORT_SHARE
     else if (streq(p[0], "port-share") && p[1] && p[2] && !p[4])
     {
@@ -7705,44 +9246,39 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->enable_c2c = true;
     }
-    else if (streq(p[0], "duplicate-cn") && !p[1])
-    {
-        VERIFY_PERMISSION(OPT_P_GENERAL);
-        options->duplicate_cn = true;
-    }
-    else if (streq(p[0], "iroute") && p[1] && !p[3])
+    else if (streq(p[0], "acl") && p[1] && p[2] && !p[6])
     {
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-        option_iroute(options, p[1], p[2], msglevel);
-    }
-    else if (streq(p[0], "iroute-ipv6") && p[1] && !p[2])
-    {
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-        option_iroute_ipv6(options, p[1], msglevel);
+        VERIFY_PERMISSION(OPT_P_GENERAL|OPT_P_INSTANCE);
+        acl_check_alloc(options);
+        if (!acl_list_add(options->acl, (const char **) &p[1], msglevel, &options->gc))
+        {
+            goto err;
+        }
     }
-    else if (streq(p[0], "ifconfig-push") && p[1] && p[2] && !p[4])
+    else if (streq(p[0], "acl-default") && p[1] && !p[2])
     {
-        in_addr_t local, remote_netmask;
-
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-        local = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[1], 0, NULL, NULL);
-        remote_netmask = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[2], 0, NULL, NULL);
-        if (local && remote_netmask)
+        VERIFY_PERMISSION(OPT_P_GENERAL|OPT_P_INSTANCE);
+        if (streq(p[1], "allow"))
         {
-            options->push_ifconfig_defined = true;
-            options->push_ifconfig_local = local;
-            options->push_ifconfig_remote_netmask = remote_netmask;
-            if (p[3])
-            {
-                options->push_ifconfig_local_alias = getaddr(GETADDR_HOST_ORDER|GETADDR_RESOLVE, p[3], 0, NULL, NULL);
-            }
+            acl_check_alloc(options);
+            options->acl->deny = false;
+        }
+        else if (streq(p[1], "deny"))
+        {
+            acl_check_alloc(options);
+            options->acl->deny = true;
         }
         else
         {
-            msg(msglevel, "cannot parse --ifconfig-push addresses");
+            msg(msglevel, "--acl-default must be 'allow' or 'deny'");
             goto err;
         }
     }
+    else if (streq(p[0], "duplicate-cn") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->duplicate_cn = true;
+    }
     else if (streq(p[0], "ifconfig-push-constraint") && p[1] && p[2] && !p[3])
     {
         in_addr_t network, netmask;
@@ -7762,44 +9298,6 @@ add_option(struct options *options,
             goto err;
         }
     }
-    else if (streq(p[0], "ifconfig-ipv6-push") && p[1] && !p[3])
-    {
-        struct in6_addr local, remote;
-        unsigned int netbits;
-
-        VERIFY_PERMISSION(OPT_P_INSTANCE);
-
-        if (!get_ipv6_addr( p[1], &local, &netbits, msglevel ) )
-        {
-            msg(msglevel, "cannot parse --ifconfig-ipv6-push addresses");
-            goto err;
-        }
-
-        if (p[2])
-        {
-            if (!get_ipv6_addr( p[2], &remote, NULL, msglevel ) )
-            {
-                msg( msglevel, "cannot parse --ifconfig-ipv6-push addresses");
-                goto err;
-            }
-        }
-        else
-        {
-            if (!options->ifconfig_ipv6_local
-                || !get_ipv6_addr( options->ifconfig_ipv6_local, &remote,
-                                   NULL, msglevel ) )
-            {
-                msg( msglevel, "second argument to --ifconfig-ipv6-push missing and no global --ifconfig-ipv6 address set");
-                goto err;
-            }
-        }
-
-        options->push_ifconfig_ipv6_defined = true;
-        options->push_ifconfig_ipv6_local = local;
-        options->push_ifconfig_ipv6_netbits = netbits;
-        options->push_ifconfig_ipv6_remote = remote;
-        options->push_ifconfig_ipv6_blocked = false;
-    }
     else if (streq(p[0], "disable") && !p[1])
     {
         VERIFY_PERMISSION(OPT_P_INSTANCE);
@@ -8584,6 +10082,11 @@ add_option(struct options *options,
         }
         options->ncp_ciphers = p[1];
     }
+    else if (streq(p[0], "data-ciphers-hw-aware") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->ncp_hw_aware = true;
+    }
     else if (streq(p[0], "key-derivation") && p[1])
     {
         /* NCP only option that is pushed by the server to enable EKM,
@@ -8621,7 +10124,15 @@ add_option(struct options *options,
             {
                 options->imported_protocol_flags |= CO_USE_DYNAMIC_TLS_CRYPT;
             }
+            else if (streq(p[j], "aead-epoch-tag-first"))
+            {
+                options->imported_protocol_flags |= CO_EPOCH_DATA_KEY_FORMAT;
+            }
 #endif
+            else if (streq(p[j], "multipath"))
+            {
+                options->imported_protocol_flags |= CO_MULTIPATH;
+            }
             else
             {
                 msg(msglevel, "Unknown protocol-flags flag: %s", p[j]);
@@ -8694,6 +10205,47 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->test_crypto = true;
     }
+    else if (streq(p[0], "bench-datachannel") && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (!parse_bench_sizes(options, p[1] ? p[1] : "imix", msglevel))
+        {
+            goto err;
+        }
+        if (p[2])
+        {
+            options->bench_seconds = atoi(p[2]);
+            if (options->bench_seconds < 1)
+            {
+                msg(msglevel, "--bench-datachannel: duration must be at least one second");
+                goto err;
+            }
+        }
+        options->bench_datachannel = true;
+    }
+    else if (streq(p[0], "bench-load") && p[1] && !p[4])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->bench_load_clients = atoi(p[1]);
+        if (options->bench_load_clients < 1)
+        {
+            msg(msglevel, "--bench-load: at least one session is needed");
+            goto err;
+        }
+        if (!parse_bench_sizes(options, p[2] ? p[2] : "imix", msglevel))
+        {
+            goto err;
+        }
+        if (p[3])
+        {
+            options->bench_seconds = atoi(p[3]);
+            if (options->bench_seconds < 1)
+            {
+                msg(msglevel, "--bench-load: duration must be at least one second");
+                goto err;
+            }
+        }
+    }
 #ifndef ENABLE_CRYPTO_MBEDTLS
     else if (streq(p[0], "engine") && !p[2])
     {
@@ -8956,12 +10508,27 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->cipher_list_tls13 = p[1];
     }
+    else if (streq(p[0], "tls-session-tickets") && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->tls_session_tickets = 3600;
+        if (p[1])
+        {
+            options->tls_session_tickets = positive_atoi(p[1]);
+            if (options->tls_session_tickets <= 0)
+            {
+                msg(msglevel, "--tls-session-tickets lifetime must be positive");
+                goto err;
+            }
+        }
+    }
     else if (streq(p[0], "tls-groups") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->tls_groups = p[1];
     }
     else if (streq(p[0], "crl-verify") && p[1] && ((p[2] && streq(p[2], "dir"))
+                                                   || (p[2] && streq(p[2], "async"))
                                                    || !p[2]))
     {
         VERIFY_PERMISSION(OPT_P_GENERAL|OPT_P_INLINE);
@@ -8969,6 +10536,15 @@ add_option(struct options *options,
         {
             options->ssl_flags |= SSLF_CRL_VERIFY_DIR;
         }
+        else if (p[2] && streq(p[2], "async"))
+        {
+#ifdef ENABLE_CRL_ASYNC
+            options->ssl_flags |= SSLF_CRL_VERIFY_ASYNC;
+#else
+            msg(M_WARN, "WARNING: --crl-verify async is not supported by this build, "
+                "the CRL is reloaded synchronously");
+#endif
+        }
         options->crl_file = p[1];
         options->crl_file_inline = is_inline;
     }
@@ -8983,6 +10559,21 @@ add_option(struct options *options,
                         string_substitute(p[1], ',', ' ', &options->gc),
                         "tls-verify", true);
     }
+    else if (streq(p[0], "verify-cache") && p[1] && !p[3])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->verify_cache_size = positive_atoi(p[1]);
+        options->verify_cache_max_age = VERIFY_CACHE_MAX_AGE_DEFAULT;
+        if (p[2])
+        {
+            options->verify_cache_max_age = positive_atoi(p[2]);
+        }
+        if (options->verify_cache_size <= 0 || options->verify_cache_max_age <= 0)
+        {
+            msg(msglevel, "--verify-cache parameters must be positive integers");
+            goto err;
+        }
+    }
 #ifndef ENABLE_CRYPTO_MBEDTLS
     else if (streq(p[0], "tls-export-cert") && p[1] && !p[2])
     {
@@ -9093,6 +10684,19 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_TLS_PARMS);
         options->tls_timeout = positive_atoi(p[1]);
     }
+    else if (streq(p[0], "tls-window") && p[1] && !p[2])
+    {
+        int window = positive_atoi(p[1]);
+
+        VERIFY_PERMISSION(OPT_P_TLS_PARMS);
+        if (window < 1 || window > RELIABLE_CAPACITY)
+        {
+            msg(msglevel, "--tls-window must be between 1 and %d",
+                RELIABLE_CAPACITY);
+            goto err;
+        }
+        options->tls_window = window;
+    }
     else if (streq(p[0], "reneg-bytes") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_TLS_PARMS);
@@ -9202,11 +10806,25 @@ add_option(struct options *options,
             msg(msglevel, "Unsupported tls-crypt-v2 argument: %s", p[2]);
         }
     }
-    else if (streq(p[0], "tls-crypt-v2-verify") && p[1] && !p[2])
+    else if (streq(p[0], "tls-crypt-v2-verify") && p[1] && !p[3])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
+        if (p[2] && streq(p[2], "via-env"))
+        {
+            options->tls_crypt_v2_verify_via_env = true;
+        }
+        else if (p[2] && !streq(p[2], "via-file"))
+        {
+            msg(msglevel, "second parm to --tls-crypt-v2-verify must be 'via-env' or 'via-file'");
+            goto err;
+        }
         options->tls_crypt_v2_verify_script = p[1];
     }
+    else if (streq(p[0], "tls-crypt-v2-verify-cache") && p[1] && !p[2])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->tls_crypt_v2_verify_cache = positive_atoi(p[1]);
+    }
     else if (streq(p[0], "x509-track") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
@@ -9339,6 +10957,11 @@ add_option(struct options *options,
         VERIFY_PERMISSION(OPT_P_GENERAL);
         options->pkcs11_pin_cache_period = atoi(p[1]);
     }
+    else if (streq(p[0], "pkcs11-sign-thread") && !p[1])
+    {
+        VERIFY_PERMISSION(OPT_P_GENERAL);
+        options->pkcs11_sign_thread = true;
+    }
     else if (streq(p[0], "pkcs11-id") && p[1] && !p[2])
     {
         VERIFY_PERMISSION(OPT_P_GENERAL);
@@ -41,8 +41,10 @@
 #include "comp.h"
 #include "pushlist.h"
 #include "clinat.h"
+#include "acl.h"
 #include "crypto_backend.h"
 #include "dns.h"
+#include "gremlin.h"
 
 
 /*
@@ -198,8 +200,6 @@ struct provider_list
 {
     /* Names of the providers */
     const char *names[MAX_PARMS];
-    /* Pointers to the loaded providers to unload them */
-    provider_t *providers[MAX_PARMS];
 };
 
 enum vlan_acceptable_frames
@@ -241,6 +241,27 @@ struct options
     /* first config file */
     const char *config;
 
+    /* re-read the configuration on SIGHUP without restarting */
+    bool live_reload;
+    /* options a live reload cannot change, in the order they were given */
+    struct buffer_list *reload_fixed;
+    /* unix socket to hand the clients over to a new process */
+    const char *handoff;
+    /* more UDP sockets to listen on in server mode */
+    const char *listen_extra_host[LINK_SOCKET_EXTRA_MAX];
+    const char *listen_extra_port[LINK_SOCKET_EXTRA_MAX];
+    int n_listen_extra;
+
+    /* drop malformed packets in the kernel, see --udp-prefilter */
+    bool udp_prefilter;
+    /* stream the connected clients to a standby server, or be one */
+    const char *replicate_peer_host;
+    const char *replicate_peer_port;
+    const char *replicate_listen_host;
+    const char *replicate_listen_port;
+    int replicate_ttl;
+    const char *replicate_secret;
+
     /* major mode */
 #define MODE_POINT_TO_POINT 0
 #define MODE_SERVER         1
@@ -313,13 +334,22 @@ struct options
     bool ifconfig_noexec;
     bool ifconfig_nowarn;
     int shaper;
+    int shaper_burst;
 
     int proto_force;
 
     bool mtu_test;
+    int pmtu_probe;             /* seconds between path MTU searches */
+    int fec;                    /* packets per --fec group, 0 if off */
+    /* more local addresses to spread the data channel over */
+    const char *multipath_host[LINK_SOCKET_EXTRA_MAX];
+    int multipath_weight[LINK_SOCKET_EXTRA_MAX];
+    int n_multipath;
 
 #ifdef ENABLE_MEMSTATS
     char *memstats_fn;
+    const char *trace_ring_fn;
+    int trace_ring_size;
 #endif
 
     bool mlock;
@@ -330,6 +360,8 @@ struct options
     int inactivity_timeout;     /* --inactive */
     int64_t inactivity_minimum_bytes;
 
+    int compact_idle;           /* --compact-idle */
+
     int session_timeout;        /* Force-kill session after n seconds */
 
     int ping_send_timeout;      /* Send a TCP/UDP ping to remote every n seconds */
@@ -342,6 +374,7 @@ struct options
     int ping_rec_timeout_action; /* What action to take on ping_rec_timeout (exit or restart)? */
 
     bool persist_tun;           /* Don't close/reopen TUN/TAP dev on SIGUSR1 or PING_RESTART */
+    bool persist_routes;        /* Only update changed pushed routes on SIGUSR1 or PING_RESTART */
     bool persist_local_ip;      /* Don't re-resolve local address on SIGUSR1 or PING_RESTART */
     bool persist_remote_ip;     /* Don't re-resolve remote address on SIGUSR1 or PING_RESTART */
     bool persist_key;           /* Don't re-read key files on SIGUSR1 or PING_RESTART */
@@ -352,6 +385,7 @@ struct options
 
     int resolve_retry_seconds;  /* If hostname resolve fails, retry for n seconds */
     bool resolve_in_advance;
+    int resolv_cache;           /* keep --remote lookups for n seconds */
     const char *ip_remote_hint;
 
     struct tuntap_options tuntap_options;
@@ -379,11 +413,16 @@ struct options
     bool suppress_timestamps;
     bool machine_readable_output;
     int nice;
+    int cpu_affinity;
+    const char *numa_node;
+    bool huge_pages;
     int verbosity;
     int mute;
+    bool mute_repeats;
 
 #ifdef ENABLE_DEBUG
     int gremlin;
+    struct gremlin_impair_options gremlin_impair;
 #endif
 
     const char *status_file;
@@ -393,16 +432,35 @@ struct options
     /* optimize TUN/TAP/UDP writes */
     bool fast_io;
 
+    /* TUN/TAP reads without an event wait in between */
+    int tun_read_ahead;
+
+    /* poll before sleeping in the event loop */
+    int spin_wait;
+    int spin_wait_cpu;
+
     struct compress_options comp;
 
     /* buffer sizes */
     int rcvbuf;
     int sndbuf;
+    int rcvbuf_max;
 
     /* mark value */
     int mark;
     char *bind_dev;
 
+    /* SO_BUSY_POLL on the link socket */
+    int busy_poll;
+    bool busy_poll_prefer;
+    int busy_poll_budget;
+
+    /* TCP_NOTSENT_LOWAT on the link socket */
+    int tcp_notsent_lowat;
+
+    /* TCP Fast Open on the link socket */
+    bool tcp_fastopen;
+
     /* socket flags */
     unsigned int sockflags;
 
@@ -439,6 +497,12 @@ struct options
     const char *management_client_group;
 
     const char *management_certificate;
+
+    /* percent of a CPU used by a client that triggers a >LOAD: alert */
+    int management_load_alert;
+
+    /* number of management clients served at the same time */
+    int management_max_clients;
 #endif
     /* Mask of MF_ values of manage.h */
     unsigned int management_flags;
@@ -470,6 +534,10 @@ struct options
     in_addr_t server_bridge_pool_end;
 
     struct push_list push_list;
+    /* push_list entries belong to the parent context, copy before changing */
+    bool push_list_shared;
+    /* preformatted push_list, NULL once push_list has been changed */
+    const struct push_reply_cache *push_cache;
     bool ifconfig_pool_defined;
     in_addr_t ifconfig_pool_start;
     in_addr_t ifconfig_pool_end;
@@ -486,14 +554,26 @@ struct options
     const char *client_connect_script;
     const char *client_disconnect_script;
     const char *learn_address_script;
+    int script_workers;
     const char *client_crresponse_script;
     const char *client_config_dir;
     bool ccd_exclusive;
+    int ccd_cache;
     bool disable;
     int n_bcast_buf;
+    int mcast_snooping;         /* membership timeout, 0 if disabled */
+    int neighbor_proxy;         /* ARP/ND address timeout, 0 if disabled */
     int tcp_queue_limit;
+    int tcp_queue_priority;
+    int shaper_total;
+    int shaper_total_burst;
+    int udp_recv_batch;
+    bool udp_recv_gro;
+    int udp_send_batch;
+    bool udp_send_zerocopy;
     struct iroute *iroutes;
     struct iroute_ipv6 *iroutes_ipv6;                   /* IPv6 */
+    struct acl_list *acl;
     bool push_ifconfig_defined;
     in_addr_t push_ifconfig_local;
     in_addr_t push_ifconfig_remote_netmask;
@@ -516,7 +596,20 @@ struct options
     int cf_initial_max;
     int cf_initial_per;
 
+    int cf_prefix_max;
+    int cf_prefix_per;
+    int cf_prefix_ipv4_bits;
+    int cf_prefix_ipv6_bits;
+
+    int reneg_freq_max;
+    int reneg_freq_per;
+
+    bool dco_reject_incompatible;
+
     int max_clients;
+    /* peer-ids carry a node id in their top peer_id_node_bits bits */
+    int peer_id_node;
+    int peer_id_node_bits;
     int max_routes_per_client;
     int stale_routes_check_interval;
     int stale_routes_ageing_time;
@@ -557,6 +650,8 @@ struct options
     bool enable_ncp_fallback;      /**< If defined fall back to
                                    * ciphername if NCP fails */
     const char *ncp_ciphers;
+    bool ncp_hw_aware;             /**< prefer CHACHA20-POLY1305 for peers
+                                   * without hardware AES */
     const char *authname;
     const char *engine;
     struct provider_list providers;
@@ -565,6 +660,12 @@ struct options
     int replay_time;
     const char *packet_id_file;
     bool test_crypto;
+    bool bench_datachannel;
+#define BENCH_SIZES_MAX 16
+    int *bench_sizes;           /* BENCH_SIZES_MAX entries, in gc */
+    int bench_n_sizes;
+    int bench_seconds;
+    int bench_load_clients;
 #ifdef ENABLE_PREDICTION_RESISTANCE
     bool use_prediction_resistance;
 #endif
@@ -589,6 +690,7 @@ struct options
     const char *cipher_list_tls13;
     const char *tls_groups;
     const char *tls_cert_profile;
+    int tls_session_tickets;
     const char *ecdh_curve;
     const char *tls_verify;
     int verify_x509_type;
@@ -596,6 +698,8 @@ struct options
     const char *tls_export_cert;
     const char *crl_file;
     bool crl_file_inline;
+    int verify_cache_size;
+    int verify_cache_max_age;
 
     int ns_cert_type; /* set to 0, NS_CERT_CHECK_SERVER, or NS_CERT_CHECK_CLIENT */
     unsigned remote_cert_ku[MAX_PARMS];
@@ -612,6 +716,7 @@ struct options
     bool pkcs11_protected_authentication[MAX_PARMS];
     bool pkcs11_cert_private[MAX_PARMS];
     int pkcs11_pin_cache_period;
+    bool pkcs11_sign_thread;
     const char *pkcs11_id;
     bool pkcs11_id_management;
 #endif
@@ -621,6 +726,7 @@ struct options
 #endif
     /* Per-packet timeout on control channel */
     int tls_timeout;
+    int tls_window;
 
     /* Data channel key renegotiation parameters */
     int renegotiate_bytes;
@@ -656,6 +762,8 @@ struct options
     const char *tls_crypt_v2_metadata;
 
     const char *tls_crypt_v2_verify_script;
+    bool tls_crypt_v2_verify_via_env;
+    int tls_crypt_v2_verify_cache;
 
     /* Allow only one session */
     bool single_session;
@@ -840,6 +948,38 @@ bool options_postprocess_pull(struct options *o, struct env_set *es);
 
 void pre_connect_restore(struct options *o, struct gc_arena *gc);
 
+/* parts of the pulled options, see options_reset_pulled() */
+#define PULL_RESET_ROUTES      (1<<0)
+#define PULL_RESET_ROUTES_IPV6 (1<<1)
+#define PULL_RESET_DNS         (1<<2)  /* --dhcp-option and --dns */
+
+/**
+ * Saves the current values of the options that options_reset_pulled()
+ * resets, so that a PUSH_UPDATE which cannot be applied can put them
+ * back.
+ *
+ * @param o         options of the connection
+ * @param gc        arena for the copy
+ */
+struct options_pre_connect *options_save_pulled(const struct options *o,
+                                                struct gc_arena *gc);
+
+/**
+ * Resets parts of the options to the values saved in \c pp: those of
+ * o->pre_connect from before they were pulled, so that a PUSH_UPDATE
+ * can replace them, or those of options_save_pulled().
+ *
+ * @param o         options of the connection
+ * @param pp        the values to reset to
+ * @param parts     PULL_RESET_x flags of the parts to reset
+ * @param es        environment, the foreign_option_n variables of
+ *                  --dhcp-option beyond those of \c pp are removed
+ * @param gc        arena for the restored route lists
+ */
+void options_reset_pulled(struct options *o, const struct options_pre_connect *pp,
+                          unsigned int parts, struct env_set *es,
+                          struct gc_arena *gc);
+
 bool apply_push_options(struct options *options,
                         struct buffer *buf,
                         unsigned int permission_mask,
@@ -848,6 +988,24 @@ bool apply_push_options(struct options *options,
 
 void options_detach(struct options *o);
 
+/**
+ * Checks whether a configuration read again on SIGHUP differs from the
+ * running one only in options that --live-reload can change.
+ *
+ * @param o      The running options
+ * @param new_o  The options read from the configuration again
+ *
+ * @return true if new_o can be applied with options_live_reload_apply()
+ */
+bool options_live_reload_check(const struct options *o,
+                               const struct options *new_o);
+
+/**
+ * Takes over the options a live reload can change.  The strings stay
+ * owned by new_o, which must be kept until o is freed.
+ */
+void options_live_reload_apply(struct options *o, const struct options *new_o);
+
 void options_server_import(struct options *o,
                            const char *filename,
                            int msglevel,
@@ -855,6 +1013,18 @@ void options_server_import(struct options *o,
                            unsigned int *option_types_found,
                            struct env_set *es);
 
+/**
+ * Like options_server_import(), but parses config, the already read
+ * content of filename, e.g. from the --ccd-cache.
+ */
+void options_server_import_string(struct options *o,
+                                  const char *filename,
+                                  const char *config,
+                                  int msglevel,
+                                  unsigned int permission_mask,
+                                  unsigned int *option_types_found,
+                                  struct env_set *es);
+
 void pre_pull_default(struct options *o);
 
 void rol_check_alloc(struct options *options);
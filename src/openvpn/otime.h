@@ -73,6 +73,17 @@ openvpn_gettimeofday(struct timeval *tv, void *tz)
     return status;
 }
 
+/*
+ * Clock read by update_time(): a coarse one, updated once per kernel
+ * tick, where the C library reads it from the vDSO or shared page
+ * without a system call.
+ */
+#if defined(CLOCK_REALTIME_COARSE) && !defined(_WIN32)
+#define OTIME_CLOCK_COARSE CLOCK_REALTIME_COARSE    /* Linux */
+#elif defined(CLOCK_REALTIME_FAST) && !defined(_WIN32)
+#define OTIME_CLOCK_COARSE CLOCK_REALTIME_FAST      /* FreeBSD, DragonFly */
+#endif
+
 static inline void
 update_time(void)
 {
@@ -80,10 +91,41 @@ update_time(void)
     /* on _WIN32, gettimeofday is faster than time(NULL) */
     struct timeval tv;
     openvpn_gettimeofday(&tv, NULL);
+#else
+    const time_t last = now;
+#ifdef OTIME_CLOCK_COARSE
+    struct timespec ts;
+    clock_gettime(OTIME_CLOCK_COARSE, &ts);
+    update_now(ts.tv_sec);
 #else
     update_now(time(NULL));
-    now_usec = 0;
 #endif
+    /* keep now/now_usec from going backwards within a second, see tv_now() */
+    if (now != last)
+    {
+        now_usec = 0;
+    }
+#endif
+}
+
+/*
+ * Like update_time(), but with usec precision.  The event loops call
+ * this once after each event wait, so that code handling the events can
+ * use tv_now() instead of reading the clock again.
+ */
+static inline void
+update_time_usec(void)
+{
+    struct timeval tv;
+    openvpn_gettimeofday(&tv, NULL);
+}
+
+/* the time of the last update_time_usec() or openvpn_gettimeofday() */
+static inline void
+tv_now(struct timeval *tv)
+{
+    tv->tv_sec = now;
+    tv->tv_usec = now_usec;
 }
 
 static inline time_t
@@ -42,15 +42,6 @@
 
 #include "memdbg.h"
 
-/* #define PID_SIMULATE_BACKTRACK */
-
-/*
- * Special time_t value that indicates that
- * sequence number has expired.
- */
-#define SEQ_UNSEEN  ((time_t)0)
-#define SEQ_EXPIRED ((time_t)1)
-
 #ifdef ENABLE_DEBUG
 static void packet_id_debug_print(int msglevel,
                                   const struct packet_id_rec *p,
@@ -75,6 +66,19 @@ packet_id_debug(int msglevel,
 #endif
 }
 
+/* the word of the replay window that holds packet-id id */
+static inline struct seq_word *
+seq_word(const struct packet_id_rec *p, packet_id_type id)
+{
+    return &p->seq_words[(id / SEQ_WORD_BITS) % p->n_seq_words];
+}
+
+static inline uint64_t
+seq_bit(packet_id_type id)
+{
+    return (uint64_t)1 << (id % SEQ_WORD_BITS);
+}
+
 void
 packet_id_init(struct packet_id *p, int seq_backtrack, int time_backtrack, const char *name, int unit)
 {
@@ -91,7 +95,10 @@ packet_id_init(struct packet_id *p, int seq_backtrack, int time_backtrack, const
     {
         ASSERT(MIN_SEQ_BACKTRACK <= seq_backtrack && seq_backtrack <= MAX_SEQ_BACKTRACK);
         ASSERT(MIN_TIME_BACKTRACK <= time_backtrack && time_backtrack <= MAX_TIME_BACKTRACK);
-        CIRC_LIST_ALLOC(p->rec.seq_list, struct seq_list, seq_backtrack);
+        /* the window does not start on a word boundary, so it can touch
+         * one word more than its size alone needs */
+        p->rec.n_seq_words = (seq_backtrack + SEQ_WORD_BITS - 1) / SEQ_WORD_BITS + 1;
+        ALLOC_ARRAY_CLEAR(p->rec.seq_words, struct seq_word, p->rec.n_seq_words);
         p->rec.seq_backtrack = seq_backtrack;
         p->rec.time_backtrack = time_backtrack;
     }
@@ -104,7 +111,7 @@ packet_id_free(struct packet_id *p)
     if (p)
     {
         dmsg(D_PID_DEBUG, "PID packet_id_free");
-        free(p->rec.seq_list);
+        free(p->rec.seq_words);
         CLEAR(*p);
     }
 }
@@ -113,7 +120,7 @@ void
 packet_id_add(struct packet_id_rec *p, const struct packet_id_net *pin)
 {
     const time_t local_now = now;
-    if (p->seq_list)
+    if (p->seq_words)
     {
         packet_id_type diff;
 
@@ -121,35 +128,39 @@ packet_id_add(struct packet_id_rec *p, const struct packet_id_net *pin)
          * If time value increases, start a new
          * sequence number sequence.
          */
-        if (!CIRC_LIST_SIZE(p->seq_list)
+        if (!p->id
             || pin->time > p->time
             || (pin->id >= (packet_id_type)p->seq_backtrack
                 && pin->id - (packet_id_type)p->seq_backtrack > p->id))
         {
             p->time = pin->time;
-            p->id = 0;
-            if (pin->id > (packet_id_type)p->seq_backtrack)
-            {
-                p->id = pin->id - (packet_id_type)p->seq_backtrack;
-            }
-            CIRC_LIST_RESET(p->seq_list);
+            p->id = pin->id;
+            p->expired = 0;
+            memset(p->seq_words, 0, p->n_seq_words * sizeof(*p->seq_words));
         }
 
-        while (p->id < pin->id
-#ifdef PID_SIMULATE_BACKTRACK
-               || (get_random() % 64) < 31
-#endif
-               )
+        /* clear the words that the window moves into */
+        if (pin->id > p->id)
         {
-            CIRC_LIST_PUSH(p->seq_list, SEQ_UNSEEN);
-            ++p->id;
+            packet_id_type word = p->id / SEQ_WORD_BITS;
+            const packet_id_type new_word = pin->id / SEQ_WORD_BITS;
+            for (int i = 0; word < new_word && i < p->n_seq_words; ++i)
+            {
+                ++word;
+                CLEAR(*seq_word(p, word * SEQ_WORD_BITS));
+            }
+            p->id = pin->id;
         }
 
         diff = p->id - pin->id;
-        if (diff < (packet_id_type) CIRC_LIST_SIZE(p->seq_list)
-            && local_now > SEQ_EXPIRED)
+        if (diff < (packet_id_type) p->seq_backtrack)
         {
-            CIRC_LIST_ITEM(p->seq_list, diff) = local_now;
+            struct seq_word *w = seq_word(p, pin->id);
+            w->seen |= seq_bit(pin->id);
+            if (!w->time)
+            {
+                w->time = local_now;
+            }
         }
     }
     else
@@ -162,7 +173,10 @@ packet_id_add(struct packet_id_rec *p, const struct packet_id_net *pin)
 /*
  * Expire sequence numbers which can no longer
  * be accepted because they would violate
- * time_backtrack.
+ * time_backtrack.  Starting with the newest word,
+ * the first word that received its first packet
+ * too long ago is expired together with all older
+ * ones.
  */
 void
 packet_id_reap(struct packet_id_rec *p)
@@ -170,23 +184,21 @@ packet_id_reap(struct packet_id_rec *p)
     const time_t local_now = now;
     if (p->time_backtrack)
     {
-        int i;
-        bool expire = false;
-        for (i = 0; i < CIRC_LIST_SIZE(p->seq_list); ++i)
+        packet_id_type id = p->id;
+        for (int i = 0; i < p->n_seq_words && id > p->expired; ++i)
         {
-            const time_t t = CIRC_LIST_ITEM(p->seq_list, i);
-            if (t == SEQ_EXPIRED)
+            const struct seq_word *w = seq_word(p, id);
+            if (w->time && w->time + p->time_backtrack < local_now)
             {
+                p->expired = id;
                 break;
             }
-            if (!expire && t && t + p->time_backtrack < local_now)
-            {
-                expire = true;
-            }
-            if (expire)
+            if (id < SEQ_WORD_BITS)
             {
-                CIRC_LIST_ITEM(p->seq_list, i) = SEQ_EXPIRED;
+                break;
             }
+            /* last packet-id of the previous word */
+            id = id - id % SEQ_WORD_BITS - 1;
         }
     }
     p->last_reap = local_now;
@@ -237,25 +249,20 @@ packet_id_test(struct packet_id_rec *p,
                 packet_id_debug(D_PID_DEBUG_LOW, p, pin, "PID_ERR replay-window backtrack occurred", p->max_backtrack_stat);
             }
 
-            if (diff >= (packet_id_type) CIRC_LIST_SIZE(p->seq_list))
+            if (diff >= (packet_id_type) p->seq_backtrack)
             {
                 packet_id_debug(D_PID_DEBUG_LOW, p, pin, "PID_ERR large diff", diff);
                 return false;
             }
 
+            if (pin->id <= p->expired
+                || (seq_word(p, pin->id)->seen & seq_bit(pin->id)))
             {
-                const time_t v = CIRC_LIST_ITEM(p->seq_list, diff);
-                if (v == 0)
-                {
-                    return true;
-                }
-                else
-                {
-                    /* raised from D_PID_DEBUG_LOW to reduce verbosity */
-                    packet_id_debug(D_PID_DEBUG_MEDIUM, p, pin, "PID_ERR replay", diff);
-                    return false;
-                }
+                /* raised from D_PID_DEBUG_LOW to reduce verbosity */
+                packet_id_debug(D_PID_DEBUG_MEDIUM, p, pin, "PID_ERR replay", diff);
+                return false;
             }
+            return true;
         }
         else if (pin->time < p->time) /* if time goes back, reject */
         {
@@ -385,6 +392,54 @@ packet_id_write(struct packet_id_send *p, struct buffer *buf, bool long_form,
     return true;
 }
 
+bool
+packet_id_store_aead(struct packet_id_send *p, bool epoch_format,
+                     uint16_t epoch, uint8_t *dst)
+{
+    if (!packet_id_send_update(p, false))
+    {
+        return false;
+    }
+
+    const packet_id_type net_id = htonpid(p->id);
+    if (epoch_format)
+    {
+        /* 16 bit epoch, then the 48 bit counter of which we only use the
+         * lower 32 bits, since the counter restarts with every epoch */
+        const uint16_t net_epoch = htons(epoch);
+        memcpy(dst, &net_epoch, sizeof(net_epoch));
+        memset(dst + sizeof(net_epoch), 0, sizeof(uint16_t));
+        dst += sizeof(net_epoch) + sizeof(uint16_t);
+    }
+    memcpy(dst, &net_id, sizeof(net_id));
+    return true;
+}
+
+uint16_t
+packet_id_load_aead(struct packet_id_net *pin, bool epoch_format,
+                    const uint8_t *src)
+{
+    uint16_t net_epoch = htons(1);
+    uint16_t net_id_high = 0;
+    packet_id_type net_id;
+
+    pin->time = 0;
+    if (epoch_format)
+    {
+        memcpy(&net_epoch, src, sizeof(net_epoch));
+        memcpy(&net_id_high, src + sizeof(net_epoch), sizeof(net_id_high));
+        src += sizeof(net_epoch) + sizeof(net_id_high);
+    }
+    memcpy(&net_id, src, sizeof(net_id));
+    if (net_id_high != 0)
+    {
+        pin->id = 0;
+        return 0;
+    }
+    pin->id = ntohpid(net_id);
+    return ntohs(net_epoch);
+}
+
 const char *
 packet_id_net_print(const struct packet_id_net *pin, bool print_timestamp, struct gc_arena *gc)
 {
@@ -408,6 +463,7 @@ packet_id_persist_init(struct packet_id_persist *p)
 {
     p->filename = NULL;
     p->fd = -1;
+    p->image = NULL;
     p->time = p->time_last_written = 0;
     p->id = p->id_last_written = 0;
 }
@@ -418,6 +474,12 @@ packet_id_persist_close(struct packet_id_persist *p)
 {
     if (packet_id_persist_enabled(p))
     {
+#ifdef HAVE_SYS_MMAN_H
+        if (p->image && munmap(p->image, sizeof(*p->image)))
+        {
+            msg(D_PID_PERSIST | M_ERRNO, "Cannot unmap --replay-persist file %s", p->filename);
+        }
+#endif
         if (close(p->fd))
         {
             msg(D_PID_PERSIST | M_ERRNO, "Close error on --replay-persist file %s", p->filename);
@@ -426,6 +488,39 @@ packet_id_persist_close(struct packet_id_persist *p)
     }
 }
 
+#ifdef HAVE_SYS_MMAN_H
+/*
+ * Map the file image into memory, so that saving the state is a memory
+ * copy which the kernel writes back on its own, instead of a write() that
+ * can block the event loop on slow storage.  If this fails, the file is
+ * written with write() as before.
+ */
+static void
+packet_id_persist_map(struct packet_id_persist *p)
+{
+    const size_t size = sizeof(struct packet_id_persist_file_image);
+    struct stat st;
+
+    /* pages beyond the end of the file cannot be accessed */
+    if (fstat(p->fd, &st)
+        || ((size_t)st.st_size < size && ftruncate(p->fd, size)))
+    {
+        msg(D_PID_PERSIST | M_ERRNO,
+            "Cannot resize --replay-persist file %s", p->filename);
+        return;
+    }
+
+    void *image = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+    if (image == MAP_FAILED)
+    {
+        msg(D_PID_PERSIST | M_ERRNO,
+            "Cannot map --replay-persist file %s into memory", p->filename);
+        return;
+    }
+    p->image = image;
+}
+#endif /* ifdef HAVE_SYS_MMAN_H */
+
 /* load persisted rec packet_id (time and id) only once from file, and set state to enabled */
 void
 packet_id_persist_load(struct packet_id_persist *p, const char *filename)
@@ -470,11 +565,52 @@ packet_id_persist_load(struct packet_id_persist *p, const char *filename)
                     "Read error on --replay-persist file %s",
                     p->filename);
             }
+#ifdef HAVE_SYS_MMAN_H
+            packet_id_persist_map(p);
+#endif
         }
     }
     gc_free(&gc);
 }
 
+/* write image to the --replay-persist file, returns false on error */
+static bool
+packet_id_persist_write(struct packet_id_persist *p,
+                        const struct packet_id_persist_file_image *image)
+{
+#ifdef HAVE_SYS_MMAN_H
+    if (p->image)
+    {
+        /* MS_ASYNC only schedules the write back, it does not wait */
+        *p->image = *image;
+        if (msync(p->image, sizeof(*image), MS_ASYNC))
+        {
+            msg(D_PID_PERSIST | M_ERRNO,
+                "Cannot write to --replay-persist file %s",
+                p->filename);
+            return false;
+        }
+        return true;
+    }
+#endif
+
+    if (lseek(p->fd, (off_t)0, SEEK_SET) != (off_t)0)
+    {
+        msg(D_PID_PERSIST | M_ERRNO,
+            "Cannot seek to beginning of --replay-persist file %s",
+            p->filename);
+        return false;
+    }
+    if (write(p->fd, image, sizeof(*image)) != sizeof(*image))
+    {
+        msg(D_PID_PERSIST | M_ERRNO,
+            "Cannot write to --replay-persist file %s",
+            p->filename);
+        return false;
+    }
+    return true;
+}
+
 /* save persisted rec packet_id (time and id) to file (only if enabled state) */
 void
 packet_id_persist_save(struct packet_id_persist *p)
@@ -483,35 +619,17 @@ packet_id_persist_save(struct packet_id_persist *p)
                                                     || p->id != p->id_last_written))
     {
         struct packet_id_persist_file_image image;
-        ssize_t n;
-        off_t seek_ret;
         struct gc_arena gc = gc_new();
 
+        CLEAR(image);
         image.time = p->time;
         image.id = p->id;
-        seek_ret = lseek(p->fd, (off_t)0, SEEK_SET);
-        if (seek_ret == (off_t)0)
-        {
-            n = write(p->fd, &image, sizeof(image));
-            if (n == sizeof(image))
-            {
-                p->time_last_written = p->time;
-                p->id_last_written = p->id;
-                dmsg(D_PID_PERSIST_DEBUG, "PID Persist Write to %s: %s",
-                     p->filename, packet_id_persist_print(p, &gc));
-            }
-            else
-            {
-                msg(D_PID_PERSIST | M_ERRNO,
-                    "Cannot write to --replay-persist file %s",
-                    p->filename);
-            }
-        }
-        else
+        if (packet_id_persist_write(p, &image))
         {
-            msg(D_PID_PERSIST | M_ERRNO,
-                "Cannot seek to beginning of --replay-persist file %s",
-                p->filename);
+            p->time_last_written = p->time;
+            p->id_last_written = p->id;
+            dmsg(D_PID_PERSIST_DEBUG, "PID Persist Write to %s: %s",
+                 p->filename, packet_id_persist_print(p, &gc));
         }
         gc_free(&gc);
     }
@@ -563,7 +681,6 @@ packet_id_debug_print(int msglevel,
     struct buffer out = alloc_buf_gc(256, &gc);
     struct timeval tv;
     const time_t prev_now = now;
-    const struct seq_list *sl = p->seq_list;
     int i;
 
     CLEAR(tv);
@@ -571,24 +688,25 @@ packet_id_debug_print(int msglevel,
 
     buf_printf(&out, "%s [%d]", message, value);
     buf_printf(&out, " [%s-%d] [", p->name, p->unit);
-    for (i = 0; sl != NULL && i < sl->x_size; ++i)
+    for (i = 0; p->seq_words != NULL && i < p->seq_backtrack
+         && (packet_id_type) i < p->id; ++i)
     {
+        const packet_id_type id = p->id - i;
+        const struct seq_word *w = seq_word(p, id);
         char c;
-        time_t v;
         int diff;
 
-        v = CIRC_LIST_ITEM(sl, i);
-        if (v == SEQ_UNSEEN)
+        if (id <= p->expired)
         {
-            c = '_';
+            c = 'E';
         }
-        else if (v == SEQ_EXPIRED)
+        else if (!(w->seen & seq_bit(id)))
         {
-            c = 'E';
+            c = '_';
         }
         else
         {
-            diff = (int) prev_now - v;
+            diff = (int) prev_now - w->time;
             if (diff < 0)
             {
                 c = 'N';
@@ -620,13 +738,11 @@ packet_id_debug_print(int msglevel,
                p->time_backtrack,
                p->max_backtrack_stat,
                (int)p->initialized);
-    if (sl != NULL)
+    if (p->seq_words != NULL)
     {
-        buf_printf(&out, " sl=[%d,%d,%d,%d]",
-                   sl->x_head,
-                   sl->x_size,
-                   sl->x_cap,
-                   sl->x_sizeof);
+        buf_printf(&out, " sw=[%d," packet_id_format "]",
+                   p->n_seq_words,
+                   (packet_id_print_type)p->expired);
     }
 
 
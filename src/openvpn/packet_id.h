@@ -30,7 +30,6 @@
 #ifndef PACKET_ID_H
 #define PACKET_ID_H
 
-#include "circ_list.h"
 #include "buffer.h"
 #include "error.h"
 #include "otime.h"
@@ -48,9 +47,14 @@ typedef uint32_t net_time_t;
 /*
  * In TLS mode, when a packet ID gets to this level,
  * start thinking about triggering a new
- * SSL/TLS handshake.
+ * SSL/TLS handshake.  The remaining 2^28 packet IDs
+ * last for several minutes even at a million packets
+ * per second, enough for the handshake to complete
+ * before the old key runs out of packet IDs.  Peers
+ * using epoch data keys never get here, their packet
+ * counter restarts with every epoch.
  */
-#define PACKET_ID_WRAP_TRIGGER 0xFF000000
+#define PACKET_ID_WRAP_TRIGGER 0xF0000000
 
 /* convert a packet_id_type from host to network order */
 #define htonpid(x) htonl(x)
@@ -117,7 +121,19 @@ typedef unsigned int packet_id_print_type;
  */
 #define SEQ_REAP_INTERVAL 5
 
-CIRC_LIST(seq_list, time_t);
+/*
+ * The replay window is a bitmap of the packet-ids seen so far, in the
+ * style of RFC 6479.  Each word covers SEQ_WORD_BITS consecutive
+ * packet-ids and also records when the first of them was received, which
+ * is what the time_backtrack check works with.
+ */
+#define SEQ_WORD_BITS 64
+
+struct seq_word
+{
+    uint64_t seen;            /* one bit per packet-id */
+    time_t time;              /* first packet-id of this word received, or 0 */
+};
 
 /*
  * This is the data structure we keep on the receiving side,
@@ -133,7 +149,9 @@ struct packet_id_rec
     int time_backtrack;       /* set from --replay-window */
     int max_backtrack_stat;   /* maximum backtrack seen so far */
     bool initialized;         /* true if packet_id_init was called */
-    struct seq_list *seq_list; /* packet-id "memory" */
+    packet_id_type expired;   /* packet-ids up to here violate time_backtrack */
+    int n_seq_words;          /* size of seq_words */
+    struct seq_word *seq_words; /* packet-id "memory" */
     const char *name;
     int unit;
 };
@@ -146,6 +164,7 @@ struct packet_id_persist
 {
     const char *filename;
     int fd;
+    struct packet_id_persist_file_image *image; /* file mapped into memory, or NULL */
     time_t time;           /* time stamp */
     packet_id_type id;     /* sequence number */
     time_t time_last_written;
@@ -260,6 +279,42 @@ bool packet_id_read(struct packet_id_net *pin, struct buffer *buf, bool long_for
 bool packet_id_write(struct packet_id_send *p, struct buffer *buf,
                      bool long_form, bool prepend);
 
+/** Size of the packet ID of the AEAD data channel, which is also the
+ *  explicit part of its IV. */
+#define PACKET_ID_AEAD_SIZE(epoch_format) \
+    ((epoch_format) ? PACKET_ID_EPOCH_SIZE : (int) sizeof(packet_id_type))
+
+/**
+ * Store the next packet ID of the AEAD data channel at dst, and update
+ * the packet ID state.  The short form is the same as packet_id_write()
+ * writes, the 64-bit epoch data key format consists of the 16-bit epoch
+ * and a 48-bit packet counter.  The caller has to have checked that
+ * there are PACKET_ID_AEAD_SIZE() bytes of room.
+ *
+ * @param p             Packet ID state.
+ * @param epoch_format  Store the epoch data key format.
+ * @param epoch         The epoch of the data key, if \c epoch_format.
+ * @param dst           Where to store the packet ID.
+ *
+ * @return false if the packet ID would roll over.
+ */
+bool packet_id_store_aead(struct packet_id_send *p, bool epoch_format,
+                          uint16_t epoch, uint8_t *dst);
+
+/**
+ * Load a packet ID stored by packet_id_store_aead() from src, which has
+ * to have PACKET_ID_AEAD_SIZE() bytes.
+ *
+ * @param pin           Filled with the packet counter.
+ * @param epoch_format  Load the epoch data key format.
+ * @param src           The packet ID.
+ *
+ * @return the epoch of the packet, 0 if the counter does not fit into a
+ *         \c packet_id_type, and 1 for the short form.
+ */
+uint16_t packet_id_load_aead(struct packet_id_net *pin, bool epoch_format,
+                             const uint8_t *src);
+
 /*
  * Inline functions.
  */
@@ -306,6 +361,10 @@ reset_packet_id_send(struct packet_id_send *p)
 
 const char *packet_id_net_print(const struct packet_id_net *pin, bool print_timestamp, struct gc_arena *gc);
 
+/* size of the packet ID with epoch data keys: 16-bit epoch and
+ * 48-bit counter */
+#define PACKET_ID_EPOCH_SIZE 8
+
 static inline int
 packet_id_size(bool long_form)
 {
@@ -29,13 +29,13 @@
 
 #include "perf.h"
 
-#ifdef ENABLE_PERFORMANCE_METRICS
-
 #include "error.h"
 #include "otime.h"
 
 #include "memdbg.h"
 
+bool perf_enabled; /* GLOBAL */
+
 static const char *metric_names[] = {
     "PERF_BIO_READ_PLAINTEXT",
     "PERF_BIO_WRITE_PLAINTEXT",
@@ -66,11 +66,12 @@ struct perf
 #define PS_METER_INTERRUPTED  2
     int state;
 
-    struct timeval start;
-    double sofar;
-    double sum;
-    double max;
-    double count;
+    uint64_t start;             /* ns, while running */
+    uint64_t sofar;             /* ns of this run, without nested stages */
+    uint64_t sum;
+    uint64_t max;
+    uint64_t count;
+    uint64_t hist[PERF_HIST_N];
 };
 
 struct perf_set
@@ -84,6 +85,33 @@ static struct perf_set perf_set;
 
 static void perf_print_state(int lev);
 
+static inline uint64_t
+perf_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+/*
+ * The stage stack got out of step, which can only be a missing
+ * perf_pop() somewhere.  Don't take the daemon down for that, just
+ * stop measuring.
+ */
+static void
+perf_fail(const char *reason)
+{
+    perf_print_state(M_INFO);
+    msg(M_WARN, "PERF: %s, latency measurement disabled", reason);
+    perf_enabled = false;
+}
+
 static inline int
 get_stack_index(int sdelta)
 {
@@ -134,7 +162,7 @@ get_perf(int sdelta)
     }
 }
 
-static void
+static bool
 push_perf_index(int pindex)
 {
     const int sindex = get_stack_index(0);
@@ -147,18 +175,20 @@ push_perf_index(int pindex)
         {
             if (perf_set.stack[i] == pindex)
             {
-                perf_print_state(M_INFO);
-                msg(M_FATAL, "PERF: push_perf_index %s failed",
-                    metric_names [pindex]);
+                msg(M_INFO, "PERF: push_perf_index %s failed", metric_names[pindex]);
+                perf_fail("stage pushed twice");
+                return false;
             }
         }
 
         perf_set.stack[sindex] = pindex;
         perf_set.stack_len = newlen;
+        return true;
     }
     else
     {
-        msg(M_FATAL, "PERF: push_perf_index: stack push error");
+        perf_fail("stack push error");
+        return false;
     }
 }
 
@@ -170,133 +200,208 @@ pop_perf_index(void)
     {
         perf_set.stack_len = newlen;
     }
-    else
-    {
-        msg(M_FATAL, "PERF: pop_perf_index: stack pop error");
-    }
 }
 
 static void
-state_must_be(const struct perf *p, const int wanted)
+update_sofar(struct perf *p, uint64_t now)
 {
-    if (p->state != wanted)
-    {
-        msg(M_FATAL, "PERF: bad state actual=%d wanted=%d",
-            p->state,
-            wanted);
-    }
+    p->sofar += now - p->start;
+    p->start = 0;
 }
 
 static void
-update_sofar(struct perf *p)
+perf_start(struct perf *p, uint64_t now)
 {
-    struct timeval current;
-    ASSERT(!gettimeofday(&current, NULL));
-    p->sofar += (double) tv_subtract(&current, &p->start, 600) / 1000000.0;
-    tv_clear(&p->start);
-}
-
-static void
-perf_start(struct perf *p)
-{
-    state_must_be(p, PS_INITIAL);
-    ASSERT(!gettimeofday(&p->start, NULL));
-    p->sofar = 0.0;
+    p->start = now;
+    p->sofar = 0;
     p->state = PS_METER_RUNNING;
 }
 
 static void
-perf_stop(struct perf *p)
+perf_stop(struct perf *p, uint64_t now)
 {
-    state_must_be(p, PS_METER_RUNNING);
-    update_sofar(p);
+    int bucket = 0;
+
+    update_sofar(p, now);
     p->sum += p->sofar;
     if (p->sofar > p->max)
     {
         p->max = p->sofar;
     }
-    p->count += 1.0;
-    p->sofar = 0.0;
+    p->count++;
+
+    while (bucket < PERF_HIST_N - 1 && (p->sofar >> (bucket + 1)))
+    {
+        ++bucket;
+    }
+    p->hist[bucket]++;
+
+    p->sofar = 0;
     p->state = PS_INITIAL;
 }
 
 static void
-perf_interrupt(struct perf *p)
+perf_interrupt(struct perf *p, uint64_t now)
 {
-    state_must_be(p, PS_METER_RUNNING);
-    update_sofar(p);
+    update_sofar(p, now);
     p->state = PS_METER_INTERRUPTED;
 }
 
 static void
-perf_resume(struct perf *p)
+perf_resume(struct perf *p, uint64_t now)
 {
-    state_must_be(p, PS_METER_INTERRUPTED);
-    ASSERT(!gettimeofday(&p->start, NULL));
+    p->start = now;
     p->state = PS_METER_RUNNING;
 }
 
 void
-perf_push(int type)
+perf_push_dowork(int type)
 {
+    const uint64_t now = perf_now();
     struct perf *prev;
     struct perf *cur;
 
     ASSERT(SIZE(metric_names) == PERF_N);
-    push_perf_index(type);
+    if (!push_perf_index(type))
+    {
+        return;
+    }
 
     prev = get_perf(-2);
     cur = get_perf(-1);
 
     ASSERT(cur);
 
-    if (prev)
+    if (prev && prev->state == PS_METER_RUNNING)
     {
-        perf_interrupt(prev);
+        perf_interrupt(prev, now);
     }
-    perf_start(cur);
+    perf_start(cur, now);
 }
 
 void
-perf_pop(void)
+perf_pop_dowork(void)
 {
+    const uint64_t now = perf_now();
     struct perf *prev;
     struct perf *cur;
 
+    /* stages that were entered before measuring was enabled */
+    if (perf_set.stack_len == 0)
+    {
+        return;
+    }
+
     prev = get_perf(-2);
     cur = get_perf(-1);
 
     ASSERT(cur);
-    perf_stop(cur);
+    if (cur->state != PS_METER_RUNNING)
+    {
+        perf_fail("stage stopped twice");
+        return;
+    }
+    perf_stop(cur, now);
 
-    if (prev)
+    if (prev && prev->state == PS_METER_INTERRUPTED)
     {
-        perf_resume(prev);
+        perf_resume(prev, now);
     }
 
     pop_perf_index();
 }
 
 void
-perf_output_results(void)
+perf_enable(bool enable)
 {
-    int i;
-    msg(M_INFO, "LATENCY PROFILE (mean and max are in milliseconds)");
-    for (i = 0; i < PERF_N; ++i)
+    if (enable && !perf_enabled)
+    {
+        for (int i = 0; i < PERF_N; ++i)
+        {
+            perf_set.perf[i].state = PS_INITIAL;
+        }
+        perf_set.stack_len = 0;
+    }
+    perf_enabled = enable;
+}
+
+void
+perf_reset(void)
+{
+    for (int i = 0; i < PERF_N; ++i)
     {
         struct perf *p = &perf_set.perf[i];
-        if (p->count > 0.0)
+        p->sum = 0;
+        p->max = 0;
+        p->count = 0;
+        CLEAR(p->hist);
+    }
+}
+
+/*
+ * Upper bound of the histogram bucket that holds quantile q (0..1).
+ */
+static uint64_t
+perf_quantile(const struct perf *p, double q)
+{
+    const uint64_t rank = (uint64_t) (q * (double) p->count);
+    uint64_t seen = 0;
+
+    for (int i = 0; i < PERF_HIST_N; ++i)
+    {
+        seen += p->hist[i];
+        if (seen > rank)
         {
-            const double mean = p->sum / p->count;
-            msg(M_INFO, "%s n=%.0f mean=%.3f max=%.3f", metric_names[i], p->count, mean*1000.0, p->max*1000.0);
+            const uint64_t bound = (uint64_t) 1 << (i + 1);
+            return bound < p->max ? bound : p->max;
         }
     }
+    return p->max;
+}
+
+void
+perf_print(int msglevel)
+{
+    struct gc_arena gc = gc_new();
+
+    for (int i = 0; i < PERF_N; ++i)
+    {
+        const struct perf *p = &perf_set.perf[i];
+        struct buffer hist = alloc_buf_gc(PERF_HIST_N * 24, &gc);
+
+        if (!p->count)
+        {
+            continue;
+        }
+        for (int j = 0; j < PERF_HIST_N; ++j)
+        {
+            if (p->hist[j])
+            {
+                buf_printf(&hist, "%s%d:%" PRIu64, BLEN(&hist) ? "," : "", j, p->hist[j]);
+            }
+        }
+        msg(msglevel, "%s n=%" PRIu64 " mean_ns=%" PRIu64 " p50_ns=%" PRIu64
+            " p99_ns=%" PRIu64 " p999_ns=%" PRIu64 " max_ns=%" PRIu64 " hist=%s",
+            metric_names[i], p->count, p->sum / p->count,
+            perf_quantile(p, 0.5), perf_quantile(p, 0.99), perf_quantile(p, 0.999),
+            p->max, BSTR(&hist));
+    }
+    gc_free(&gc);
+}
+
+void
+perf_output_results(void)
+{
+    if (perf_enabled)
+    {
+        msg(M_INFO, "LATENCY PROFILE (times are in nanoseconds, hist=log2 bucket:count)");
+        perf_print(M_INFO);
+    }
 }
 
 static void
 perf_print_state(int lev)
 {
-    struct gc_arena gc = gc_new();
     int i;
     msg(lev, "PERF STATE");
     msg(lev, "Stack:");
@@ -304,16 +409,15 @@ perf_print_state(int lev)
     {
         const int j = perf_set.stack[i];
         const struct perf *p = &perf_set.perf[j];
-        msg(lev, "[%d] %s state=%d start=%s sofar=%f sum=%f max=%f count=%f",
+        msg(lev, "[%d] %s state=%d start=%" PRIu64 " sofar=%" PRIu64 " sum=%" PRIu64
+            " max=%" PRIu64 " count=%" PRIu64,
             i,
             metric_names[j],
             p->state,
-            tv_string(&p->start, &gc),
+            p->start,
             p->sofar,
             p->sum,
             p->max,
             p->count);
     }
-    gc_free(&gc);
 }
-#endif /* ifdef ENABLE_PERFORMANCE_METRICS */
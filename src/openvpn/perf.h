@@ -30,8 +30,6 @@
 #ifndef PERF_H
 #define PERF_H
 
-/*#define ENABLE_PERFORMANCE_METRICS*/
-
 /*
  * Metrics
  */
@@ -57,8 +55,6 @@
 #define PERF_PROC_OUT_TUN_MTCP      19
 #define PERF_N                      20
 
-#ifdef ENABLE_PERFORMANCE_METRICS
-
 #include "basic.h"
 
 /*
@@ -66,27 +62,62 @@
  */
 #define STACK_N               64
 
-void perf_push(int type);
+/*
+ * Latency histogram buckets, bucket i counts stage times of
+ * [2^i, 2^(i+1)) nanoseconds.
+ */
+#define PERF_HIST_N           32
 
-void perf_pop(void);
+/*
+ * Measuring is off by default and switched on at runtime with the
+ * "perf on" management command, so perf_push() and perf_pop() cost a
+ * single test in the packet path while it is off.
+ */
+extern bool perf_enabled; /* GLOBAL */
 
-void perf_output_results(void);
+void perf_push_dowork(int type);
 
-#else  /* ifdef ENABLE_PERFORMANCE_METRICS */
+void perf_pop_dowork(void);
 
 static inline void
 perf_push(int type)
 {
+    if (perf_enabled)
+    {
+        perf_push_dowork(type);
+    }
 }
+
 static inline void
 perf_pop(void)
 {
+    if (perf_enabled)
+    {
+        perf_pop_dowork();
+    }
 }
-static inline void
-perf_output_results(void)
-{
-}
 
-#endif /* ifdef ENABLE_PERFORMANCE_METRICS */
+/**
+ * Start or stop measuring.  Starting clears the stage stack, but keeps
+ * the histograms collected so far.
+ */
+void perf_enable(bool enable);
+
+/**
+ * Clear all histograms.
+ */
+void perf_reset(void);
+
+/**
+ * Print one line per stage that has samples: count, mean, max, the
+ * 50th, 99th and 99.9th percentile and the non-empty histogram buckets.
+ */
+void perf_print(int msglevel);
+
+/**
+ * Print the results at exit, if measuring was enabled.
+ */
+void perf_output_results(void);
+
 
 #endif /* ifndef PERF_H */
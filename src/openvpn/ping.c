@@ -74,16 +74,35 @@ trigger_ping_timeout_signal(struct context *c)
 void
 check_ping_send_dowork(struct context *c)
 {
-    c->c2.buf = c->c2.buffers->aux_buf;
+    c->c2.buf = get_context_buffers(c)->aux_buf;
     ASSERT(buf_init(&c->c2.buf, c->c2.frame.buf.headroom));
     ASSERT(buf_safe(&c->c2.buf, c->c2.frame.buf.payload_size));
-    ASSERT(buf_write(&c->c2.buf, ping_string, sizeof(ping_string)));
+
+    /*
+     * A ping is too short to be compressed and never fragmented, so
+     * compression and fragmentation always frame it the same way.
+     * Do it once and send the framed ping from then on.
+     */
+    if (c->c2.ping_frame_len > 0)
+    {
+        ASSERT(buf_write(&c->c2.buf, c->c2.ping_frame, c->c2.ping_frame_len));
+    }
+    else
+    {
+        ASSERT(buf_write(&c->c2.buf, ping_string, sizeof(ping_string)));
+        compress_fragment(c);
+        if (c->c2.buf.len > 0 && c->c2.buf.len <= (int) sizeof(c->c2.ping_frame))
+        {
+            memcpy(c->c2.ping_frame, BPTR(&c->c2.buf), BLEN(&c->c2.buf));
+            c->c2.ping_frame_len = BLEN(&c->c2.buf);
+        }
+    }
 
     /*
      * We will treat the ping like any other outgoing packet,
      * encrypt, sign, etc.
      */
-    encrypt_sign(c, true);
+    encrypt_sign(c, false);
     /* Set length to 0, so it won't be counted as activity */
     c->c2.buf.len = 0;
     dmsg(D_PING, "SENT PING");
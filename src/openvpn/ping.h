@@ -43,6 +43,17 @@ is_ping_msg(const struct buffer *buf)
     return buf_string_match(buf, ping_string, PING_STRING_SIZE);
 }
 
+/*
+ * Is the decrypted packet a ping, framed for compression and
+ * fragmentation the same way as the pings we send?
+ */
+static inline bool
+is_framed_ping_msg(const struct context *c, const struct buffer *buf)
+{
+    return c->c2.ping_frame_len > 0
+           && buf_string_match(buf, c->c2.ping_frame, c->c2.ping_frame_len);
+}
+
 /**
  * Trigger the correct signal on a --ping timeout
  * depending if --ping-exit is set (SIGTERM) or not
@@ -162,6 +162,11 @@ _pkcs11_msg_openvpn2pkcs11(
     return pkcs11_flags;
 }
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+/* the thread that called pkcs11_initialize() */
+static pthread_t pkcs11_main_thread;    /* GLOBAL */
+#endif
+
 static
 void
 _pkcs11_openvpn_log(
@@ -175,6 +180,14 @@ _pkcs11_openvpn_log(
 
     (void)global_data;
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    /* msg() is not thread safe, drop what is logged on the signing thread */
+    if (!pthread_equal(pthread_self(), pkcs11_main_thread))
+    {
+        return;
+    }
+#endif
+
     vsnprintf(Buffer, sizeof(Buffer), szFormat, args);
     Buffer[sizeof(Buffer)-1] = 0;
 
@@ -302,6 +315,9 @@ pkcs11_initialize(
         goto cleanup;
     }
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    pkcs11_main_thread = pthread_self();
+#endif
     if ((rv = pkcs11h_setLogHook(_pkcs11_openvpn_log, NULL)) != CKR_OK)
     {
         msg(M_FATAL, "PKCS#11: Cannot set hooks %ld-'%s'", rv, pkcs11h_getMessage(rv));
@@ -871,6 +887,9 @@ show_pkcs11_ids(
         goto cleanup;
     }
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    pkcs11_main_thread = pthread_self();
+#endif
     if ((rv = pkcs11h_setLogHook(_pkcs11_openvpn_log, NULL)) != CKR_OK)
     {
         msg(M_FATAL, "PKCS#11: Cannot set hooks %ld-'%s'", rv, pkcs11h_getMessage(rv));
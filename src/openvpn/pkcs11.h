@@ -27,6 +27,12 @@
 #if defined(ENABLE_PKCS11)
 
 #include "ssl_common.h"
+#include "xkey_common.h"
+
+/* PKCS#11 signatures can be made on a separate thread, see --pkcs11-sign-thread */
+#if defined(HAVE_XKEY_PROVIDER) && defined(HAVE_PTHREAD_H) && !defined(_WIN32)
+#define ENABLE_PKCS11_SIGN_THREADS
+#endif
 
 bool
 pkcs11_initialize(
@@ -71,6 +77,39 @@ show_pkcs11_ids(
     bool cert_private
     );
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+
+/**
+ * Sets whether the PKCS#11 key of the TLS context loaded next signs on a
+ * separate thread.  If not, signing blocks the event loop.
+ */
+void
+pkcs11_sign_thread_set(bool enabled);
+
+/**
+ * Returns the descriptor that becomes readable when the signing thread
+ * has finished a signature, or -1 if it is not running.
+ */
+int
+pkcs11_sign_event_fd(void);
+
+/**
+ * Wakes up the TLS sessions whose signature was finished by the signing
+ * thread.  Called by the event loop when pkcs11_sign_event_fd() is
+ * readable.
+ */
+void
+pkcs11_sign_process_done(void);
+
+/**
+ * Cancels the pending signatures of the TLS object \c arg, so that its
+ * handshake fails when it is resumed.
+ */
+void
+pkcs11_sign_cancel(const void *arg);
+
+#endif /* ENABLE_PKCS11_SIGN_THREADS */
+
 #endif                  /* ENABLE_PKCS11 */
 
 #endif                  /* OPENVPN_PKCS11H_H */
@@ -35,10 +35,13 @@
 #if defined(ENABLE_PKCS11) && defined(ENABLE_CRYPTO_OPENSSL)
 
 #include "errlevel.h"
+#include "fdmisc.h"
+#include "pkcs11.h"
 #include "pkcs11_backend.h"
 #include "ssl_verify.h"
 #include "xkey_common.h"
 #include <pkcs11-helper-1.0/pkcs11h-openssl.h>
+#include <openssl/async.h>
 
 #ifdef HAVE_XKEY_PROVIDER
 static XKEY_EXTERNAL_SIGN_fn xkey_pkcs11h_sign;
@@ -152,6 +155,369 @@ pkcs11h_certificate_signAny_ex(const pkcs11h_certificate_t cert,
 }
 #endif /* PKCS11H_VERSION > 1.27 */
 
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+/*
+ * The signing thread of --pkcs11-sign-thread.  A TLS handshake that needs
+ * a signature queues a job and pauses its OpenSSL async job, so that the
+ * event loop goes on serving other clients while the token signs.  The
+ * thread signs with its own copy of the certificate object, which never
+ * prompts for a PIN.  When it is done with a job it writes a byte to a
+ * pipe, the main thread then wakes up the session, which picks up the
+ * signature when its handshake is resumed.
+ *
+ * pkcs11-helper uses one session per token and serializes the operations
+ * on it, so more threads would only wait for each other.
+ */
+struct sign_job
+{
+    CK_MECHANISM mech;
+    CK_RSA_PKCS_PSS_PARAMS pss_params;
+    unsigned char tbs[EVP_MAX_MD_SIZE + 32];
+    size_t tbslen;
+    unsigned char *sig;
+    size_t siglen;
+    CK_RV rv;
+
+    ASYNC_callback_fn wakeup;
+    void *wakeup_arg;
+
+    bool done;                  /* under lock */
+    bool cancelled;             /* set under lock by the main thread */
+    int refs;                   /* main thread only */
+    struct sign_job *next;      /* queue or done list, under lock */
+    struct sign_job *wnext;     /* waiting list, main thread only */
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool enabled;               /* by --pkcs11-sign-thread */
+    bool running;
+    pthread_t thread;
+    pkcs11h_certificate_t thread_cert; /* copy the thread signs with */
+    pkcs11h_certificate_t cert; /* xkey handle it signs for */
+    bool stop;                  /* under lock */
+    struct sign_job *queue;     /* under lock */
+    struct sign_job *queue_tail;
+    struct sign_job *done;      /* under lock */
+    struct sign_job *waiting;   /* jobs of paused handshakes */
+    int pipe[2];
+} signer = {                    /* GLOBAL */
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .cond = PTHREAD_COND_INITIALIZER,
+    .pipe = { -1, -1 },
+};
+
+static void
+sign_job_unref(struct sign_job *job)
+{
+    if (--job->refs == 0)
+    {
+        free(job->sig);
+        free(job);
+    }
+}
+
+static void *
+signer_thread(void *arg)
+{
+    pkcs11h_certificate_t cert = arg;
+
+    pthread_mutex_lock(&signer.lock);
+    while (true)
+    {
+        while (!signer.stop && !signer.queue)
+        {
+            pthread_cond_wait(&signer.cond, &signer.lock);
+        }
+        if (signer.stop)
+        {
+            break;
+        }
+
+        struct sign_job *job = signer.queue;
+        signer.queue = job->next;
+        const bool cancelled = job->cancelled;
+        pthread_mutex_unlock(&signer.lock);
+
+        /* no logging in here, msg() is not thread safe; the pkcs11-helper
+         * log hook drops messages of this thread */
+        job->rv = CKR_FUNCTION_CANCELED;
+        if (!cancelled)
+        {
+            job->rv = pkcs11h_certificate_signAny_ex(cert, &job->mech, job->tbs,
+                                                     job->tbslen, job->sig,
+                                                     &job->siglen);
+        }
+
+        pthread_mutex_lock(&signer.lock);
+        job->done = true;
+        job->next = signer.done;
+        signer.done = job;
+        pthread_mutex_unlock(&signer.lock);
+
+        /* a full pipe means the main thread is going to look anyway */
+        const char c = 0;
+        ssize_t n = write(signer.pipe[1], &c, 1);
+        (void) n;
+
+        pthread_mutex_lock(&signer.lock);
+    }
+    pthread_mutex_unlock(&signer.lock);
+    return NULL;
+}
+
+/* Start the signing thread for the xkey handle cert, returns false if
+ * there is none */
+static bool
+signer_start(pkcs11h_certificate_t cert)
+{
+    if (!signer.enabled)
+    {
+        return false;
+    }
+    if (signer.running)
+    {
+        msg(M_WARN, "PKCS#11: the signing thread still serves the previous key, "
+            "signing in the main thread");
+        return false;
+    }
+
+    pkcs11h_certificate_t copy = NULL;
+    CK_RV rv = pkcs11h_certificate_duplicateCertificate(&copy, cert);
+    if (rv != CKR_OK)
+    {
+        msg(M_WARN, "PKCS#11: Cannot duplicate certificate %ld-'%s'", rv,
+            pkcs11h_getMessage(rv));
+        return false;
+    }
+    pkcs11h_certificate_setPromptMask(copy, 0);
+
+    if (pipe(signer.pipe) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "PKCS#11: cannot create pipe, signing in the main thread");
+        signer.pipe[0] = signer.pipe[1] = -1;
+        pkcs11h_certificate_freeCertificate(copy);
+        return false;
+    }
+    for (int i = 0; i < 2; i++)
+    {
+        set_nonblock(signer.pipe[i]);
+        set_cloexec(signer.pipe[i]);
+    }
+
+    if (pthread_create(&signer.thread, NULL, signer_thread, copy) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "PKCS#11: cannot start signing thread");
+        pkcs11h_certificate_freeCertificate(copy);
+        close(signer.pipe[0]);
+        close(signer.pipe[1]);
+        signer.pipe[0] = signer.pipe[1] = -1;
+        return false;
+    }
+
+    signer.running = true;
+    signer.thread_cert = copy;
+    signer.cert = cert;
+    msg(M_INFO, "PKCS#11: signing on a separate thread");
+    return true;
+}
+
+/*
+ * Stop the signing thread and free the jobs left.  Called when the key is
+ * freed, by then the handshakes that used it are gone and their jobs
+ * cancelled.
+ */
+static void
+signer_stop(void)
+{
+    pthread_mutex_lock(&signer.lock);
+    signer.stop = true;
+    pthread_cond_broadcast(&signer.cond);
+    pthread_mutex_unlock(&signer.lock);
+
+    pthread_join(signer.thread, NULL);
+    pkcs11h_certificate_freeCertificate(signer.thread_cert);
+
+    struct sign_job *lists[] = { signer.queue, signer.done };
+    for (int i = 0; i < SIZE(lists); i++)
+    {
+        while (lists[i])
+        {
+            struct sign_job *next = lists[i]->next;
+            sign_job_unref(lists[i]);
+            lists[i] = next;
+        }
+    }
+
+    close(signer.pipe[0]);
+    close(signer.pipe[1]);
+    signer.pipe[0] = signer.pipe[1] = -1;
+    signer.queue = signer.queue_tail = signer.done = NULL;
+    signer.waiting = NULL;
+    signer.cert = signer.thread_cert = NULL;
+    signer.running = false;
+    signer.stop = false;
+}
+
+void
+pkcs11_sign_thread_set(bool enabled)
+{
+    signer.enabled = enabled;
+}
+
+int
+pkcs11_sign_event_fd(void)
+{
+    return signer.running ? signer.pipe[0] : -1;
+}
+
+void
+pkcs11_sign_process_done(void)
+{
+    char buf[64];
+    while (read(signer.pipe[0], buf, sizeof(buf)) > 0)
+    {
+    }
+
+    pthread_mutex_lock(&signer.lock);
+    struct sign_job *job = signer.done;
+    signer.done = NULL;
+    pthread_mutex_unlock(&signer.lock);
+
+    while (job)
+    {
+        struct sign_job *next = job->next;
+        if (!job->cancelled)
+        {
+            (*job->wakeup)(job->wakeup_arg);
+        }
+        sign_job_unref(job);
+        job = next;
+    }
+}
+
+void
+pkcs11_sign_cancel(const void *arg)
+{
+    for (struct sign_job *job = signer.waiting; job; job = job->wnext)
+    {
+        if (job->wakeup_arg == arg)
+        {
+            pthread_mutex_lock(&signer.lock);
+            job->cancelled = true;
+            pthread_mutex_unlock(&signer.lock);
+        }
+    }
+}
+
+/**
+ * Sign like pkcs11h_certificate_signAny_ex(), but on the signing thread
+ * if called from an OpenSSL async job that can be woken up.  The job is
+ * paused until the signature is there.  If the thread fails, for example
+ * because the token needs a PIN, sign again in the main thread.
+ */
+static CK_RV
+pkcs11h_certificate_signAny_async(const pkcs11h_certificate_t cert,
+                                  const CK_MECHANISM *mech, const unsigned char *tbs,
+                                  size_t tbslen, unsigned char *sig, size_t *siglen)
+{
+    ASYNC_JOB *async_job = ASYNC_get_current_job();
+    ASYNC_callback_fn wakeup = NULL;
+    void *wakeup_arg = NULL;
+    struct sign_job *job;
+
+    if (cert != signer.cert || !async_job
+        || tbslen > sizeof(job->tbs)
+        || !ASYNC_WAIT_CTX_get_callback(ASYNC_get_wait_ctx(async_job), &wakeup,
+                                        &wakeup_arg)
+        || !wakeup)
+    {
+        return pkcs11h_certificate_signAny_ex(cert, mech, tbs, tbslen, sig, siglen);
+    }
+
+    ALLOC_OBJ_CLEAR(job, struct sign_job);
+    job->mech = *mech;
+    if (mech->pParameter)
+    {
+        ASSERT(mech->ulParameterLen == sizeof(job->pss_params));
+        memcpy(&job->pss_params, mech->pParameter, sizeof(job->pss_params));
+        job->mech.pParameter = &job->pss_params;
+    }
+    memcpy(job->tbs, tbs, tbslen);
+    job->tbslen = tbslen;
+    job->sig = malloc(*siglen);
+    check_malloc_return(job->sig);
+    job->siglen = *siglen;
+    job->wakeup = wakeup;
+    job->wakeup_arg = wakeup_arg;
+    job->refs = 2;              /* this function and the pool */
+    job->wnext = signer.waiting;
+    signer.waiting = job;
+
+    pthread_mutex_lock(&signer.lock);
+    if (signer.queue)
+    {
+        signer.queue_tail->next = job;
+    }
+    else
+    {
+        signer.queue = job;
+    }
+    signer.queue_tail = job;
+    pthread_cond_signal(&signer.cond);
+    pthread_mutex_unlock(&signer.lock);
+
+    bool done, cancelled;
+    while (true)
+    {
+        pthread_mutex_lock(&signer.lock);
+        done = job->done;
+        cancelled = job->cancelled;
+        pthread_mutex_unlock(&signer.lock);
+        if (done || cancelled)
+        {
+            break;
+        }
+        if (!ASYNC_pause_job())
+        {
+            pthread_mutex_lock(&signer.lock);
+            job->cancelled = cancelled = true;
+            pthread_mutex_unlock(&signer.lock);
+            break;
+        }
+    }
+
+    struct sign_job **pj = &signer.waiting;
+    while (*pj != job)
+    {
+        pj = &(*pj)->wnext;
+    }
+    *pj = job->wnext;
+
+    CK_RV rv = CKR_FUNCTION_CANCELED;
+    if (!cancelled)
+    {
+        rv = job->rv;
+        if (rv == CKR_OK && job->siglen <= *siglen)
+        {
+            memcpy(sig, job->sig, job->siglen);
+            *siglen = job->siglen;
+        }
+        else
+        {
+            msg(M_WARN, "PKCS#11: signing thread failed %ld-'%s', signing in the main thread",
+                rv, pkcs11h_getMessage(rv));
+            rv = pkcs11h_certificate_signAny_ex(cert, mech, tbs, tbslen, sig, siglen);
+        }
+    }
+    sign_job_unref(job);
+    return rv;
+}
+#else  /* ifdef ENABLE_PKCS11_SIGN_THREADS */
+#define pkcs11h_certificate_signAny_async pkcs11h_certificate_signAny_ex
+#endif /* ENABLE_PKCS11_SIGN_THREADS */
+
 /**
  * Sign op called from xkey provider
  *
@@ -233,8 +599,8 @@ xkey_pkcs11h_sign(void *handle, unsigned char *sig,
         ASSERT(0);  /* coding error -- we couldnt have created any such key */
     }
 
-    if (CKR_OK != pkcs11h_certificate_signAny_ex(cert, &mech,
-                                                 tbs, tbslen, sig, siglen))
+    if (CKR_OK != pkcs11h_certificate_signAny_async(cert, &mech,
+                                                    tbs, tbslen, sig, siglen))
     {
         return 0;
     }
@@ -259,6 +625,12 @@ xkey_pkcs11h_sign(void *handle, unsigned char *sig,
 static void
 xkey_handle_free(void *handle)
 {
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    if (handle == signer.cert)
+    {
+        signer_stop();
+    }
+#endif
     pkcs11h_certificate_freeCertificate(handle);
 }
 
@@ -298,6 +670,9 @@ xkey_load_from_pkcs11h(pkcs11h_certificate_t certificate,
         goto cleanup;
     }
     /* provider took ownership of the pkcs11h certificate object -- do not free below */
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    pkcs11h_certificate_t handle = certificate;
+#endif
     certificate = NULL;
 
     if (!SSL_CTX_use_cert_and_key(ctx->ctx, x509, pkey, NULL, 0))
@@ -305,6 +680,12 @@ xkey_load_from_pkcs11h(pkcs11h_certificate_t certificate,
         msg(M_WARN, "PKCS#11: Failed to set cert and private key for OpenSSL");
         goto cleanup;
     }
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+    if (signer_start(handle))
+    {
+        SSL_CTX_set_mode(ctx->ctx, SSL_MODE_ASYNC);
+    }
+#endif
     ret = 1;
 
 cleanup:
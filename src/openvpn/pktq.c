@@ -0,0 +1,109 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "pktq.h"
+#include "socket.h"
+
+#include "memdbg.h"
+
+struct packet_queue *
+pktq_init(int capacity, int size, int headroom, bool with_addr)
+{
+    struct packet_queue *q;
+
+    ASSERT(capacity > 0 && headroom <= size);
+    ALLOC_OBJ_CLEAR(q, struct packet_queue);
+    ALLOC_ARRAY_CLEAR(q->bufs, struct buffer, capacity);
+    for (int i = 0; i < capacity; ++i)
+    {
+        q->bufs[i] = alloc_buf(size);
+    }
+    if (with_addr)
+    {
+        ALLOC_ARRAY_CLEAR(q->to, struct link_socket_actual, capacity);
+    }
+    q->headroom = headroom;
+    q->capacity = capacity;
+    return q;
+}
+
+void
+pktq_free(struct packet_queue *q)
+{
+    if (q)
+    {
+        for (int i = 0; i < q->capacity; ++i)
+        {
+            free_buf(&q->bufs[i]);
+        }
+        free(q->bufs);
+        free(q->to);
+        free(q);
+    }
+}
+
+bool
+pktq_push(struct packet_queue *q, const struct buffer *buf,
+          const struct link_socket_actual *to)
+{
+    if (pktq_full(q))
+    {
+        return false;
+    }
+
+    const int i = (q->head + q->len) % q->capacity;
+    struct buffer *b = &q->bufs[i];
+    if (!buf_init(b, q->headroom) || !buf_copy(b, buf))
+    {
+        return false;
+    }
+    if (q->to && to)
+    {
+        q->to[i] = *to;
+    }
+    ++q->len;
+    return true;
+}
+
+struct link_socket_actual *
+pktq_front(struct packet_queue *q, struct buffer *buf)
+{
+    ASSERT(!pktq_empty(q));
+    *buf = q->bufs[q->head];
+    return q->to ? &q->to[q->head] : NULL;
+}
+
+void
+pktq_pop(struct packet_queue *q)
+{
+    ASSERT(!pktq_empty(q));
+    q->head = (q->head + 1) % q->capacity;
+    --q->len;
+}
@@ -0,0 +1,91 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+#ifndef PKTQ_H
+#define PKTQ_H
+
+/*
+ * Small bounded queues of packets that are ready to be written to the
+ * link or the tun/tap device of a point-to-point context, but could not
+ * be because the socket or device would have blocked.  Packets wait here
+ * while the context goes on to read in the other direction, and are
+ * written in a batch once the fd is writable again.
+ */
+
+#include "basic.h"
+#include "buffer.h"
+
+struct link_socket_actual;
+
+/* packets a queue holds, per direction */
+#define PKTQ_PACKETS 32
+
+struct packet_queue
+{
+    struct buffer *bufs;
+    struct link_socket_actual *to;  /* destination of each packet, may be NULL */
+    int headroom;
+    int capacity;
+    int head;
+    int len;
+};
+
+/*
+ * A queue for capacity packets of up to size bytes each, which keeps
+ * headroom bytes in front of them, as buffers of the frame do.  If
+ * with_addr is set, the link destination of each packet is kept too.
+ */
+struct packet_queue *pktq_init(int capacity, int size, int headroom, bool with_addr);
+
+void pktq_free(struct packet_queue *q);
+
+/*
+ * Copy buf and, if the queue keeps them, *to to the tail of q.  Returns
+ * false if q is full or buf does not fit.
+ */
+bool pktq_push(struct packet_queue *q, const struct buffer *buf,
+               const struct link_socket_actual *to);
+
+/*
+ * Point *buf at the packet at the head of q and return its destination.
+ * The packet remains queued until pktq_pop(), *buf may be changed in
+ * the meantime, but not its data outside of the packet and headroom.
+ */
+struct link_socket_actual *pktq_front(struct packet_queue *q, struct buffer *buf);
+
+void pktq_pop(struct packet_queue *q);
+
+static inline bool
+pktq_empty(const struct packet_queue *q)
+{
+    return !q || q->len == 0;
+}
+
+static inline bool
+pktq_full(const struct packet_queue *q)
+{
+    return q && q->len == q->capacity;
+}
+
+#endif /* PKTQ_H */
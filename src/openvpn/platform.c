@@ -49,6 +49,17 @@
 #include <sys/prctl.h>
 #endif
 
+#ifdef HAVE_SCHED_SETAFFINITY
+#include <sched.h>
+#endif
+
+#if defined(TARGET_LINUX) && defined(HAVE_SCHED_SETAFFINITY)
+#include <sys/syscall.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#endif
+
 /* Redefine the top level directory of the filesystem
  * to restrict access to files for security */
 void
@@ -328,6 +339,160 @@ platform_nice(int niceval)
     }
 }
 
+/* Pin the process to a single CPU, cpu < 0 leaves it unpinned */
+void
+platform_cpu_affinity(int cpu)
+{
+    if (cpu >= 0)
+    {
+#ifdef HAVE_SCHED_SETAFFINITY
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+        {
+            msg(M_WARN | M_ERRNO, "WARNING: cpu-affinity %d failed", cpu);
+        }
+        else
+        {
+            msg(M_INFO, "cpu-affinity %d succeeded", cpu);
+        }
+#else  /* ifdef HAVE_SCHED_SETAFFINITY */
+        msg(M_WARN, "WARNING: cpu-affinity %d failed (function not implemented)", cpu);
+#endif
+    }
+}
+
+#if defined(TARGET_LINUX) && defined(HAVE_SCHED_SETAFFINITY)
+/* Read the first line of a sysfs file, without the newline */
+static bool
+platform_read_sysfs(const char *path, char *line, size_t size)
+{
+    FILE *fp = platform_fopen(path, "r");
+    bool ret = false;
+
+    if (fp)
+    {
+        ret = fgets(line, (int)size, fp) != NULL;
+        fclose(fp);
+    }
+    if (ret)
+    {
+        line[strcspn(line, "\n")] = '\0';
+    }
+    return ret;
+}
+
+/* Parse a sysfs CPU list like "0-7,16-23" */
+static bool
+platform_parse_cpulist(const char *list, cpu_set_t *set)
+{
+    CPU_ZERO(set);
+    while (*list)
+    {
+        char *end;
+        long first = strtol(list, &end, 10);
+        long last = first;
+
+        if (end == list || first < 0)
+        {
+            return false;
+        }
+        if (*end == '-')
+        {
+            list = end + 1;
+            last = strtol(list, &end, 10);
+            if (end == list || last < first)
+            {
+                return false;
+            }
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu)
+        {
+            CPU_SET(cpu, set);
+        }
+        list = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',')
+        {
+            return false;
+        }
+    }
+    return CPU_COUNT(set) > 0;
+}
+#endif /* if defined(TARGET_LINUX) && defined(HAVE_SCHED_SETAFFINITY) */
+
+/*
+ * Run on the CPUs of one NUMA node and prefer its memory for everything
+ * allocated from now on.  node is a node number or the name of a network
+ * interface, whose node is taken from sysfs.  NULL does nothing.
+ */
+void
+platform_numa_node(const char *node)
+{
+    if (!node)
+    {
+        return;
+    }
+#if defined(TARGET_LINUX) && defined(HAVE_SCHED_SETAFFINITY)
+    char path[256];
+    char line[1024];
+    int n;
+
+    if (isdigit((unsigned char)node[0]))
+    {
+        n = atoi(node);
+    }
+    else
+    {
+        openvpn_snprintf(path, sizeof(path), "/sys/class/net/%s/device/numa_node", node);
+        if (!platform_read_sysfs(path, line, sizeof(line)))
+        {
+            msg(M_WARN | M_ERRNO, "WARNING: numa-node: cannot read %s", path);
+            return;
+        }
+        n = atoi(line);
+        if (n < 0)
+        {
+            msg(M_WARN, "WARNING: numa-node: %s is not attached to a NUMA node", node);
+            return;
+        }
+    }
+
+    cpu_set_t set;
+    openvpn_snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", n);
+    if (!platform_read_sysfs(path, line, sizeof(line))
+        || !platform_parse_cpulist(line, &set))
+    {
+        msg(M_WARN, "WARNING: numa-node: cannot find the CPUs of node %d", n);
+        return;
+    }
+    if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "WARNING: numa-node %d: cpu affinity failed", n);
+        return;
+    }
+
+    unsigned long mask[4] = { 0 };
+    const unsigned long bits = sizeof(mask[0]) * 8;
+    if (n >= (int)(sizeof(mask) * 8))
+    {
+        msg(M_WARN, "WARNING: numa-node %d: node number too large for the memory policy", n);
+    }
+    else
+    {
+        mask[n / bits] |= 1UL << (n % bits);
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask, sizeof(mask) * 8 + 1) != 0)
+        {
+            msg(M_WARN | M_ERRNO, "WARNING: numa-node %d: memory policy failed", n);
+        }
+    }
+    msg(M_INFO, "numa-node %d (CPUs %s) succeeded", n, line);
+#else  /* if defined(TARGET_LINUX) && defined(HAVE_SCHED_SETAFFINITY) */
+    msg(M_WARN, "WARNING: numa-node %s failed (function not implemented)", node);
+#endif
+}
+
 /* Get current PID */
 unsigned int
 platform_getpid(void)
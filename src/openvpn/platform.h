@@ -115,6 +115,10 @@ void platform_chroot(const char *path);
 
 void platform_nice(int niceval);
 
+void platform_cpu_affinity(int cpu);
+
+void platform_numa_node(const char *node);
+
 unsigned int platform_getpid(void);
 
 void platform_mlockall(bool print_msg);  /* Disable paging */
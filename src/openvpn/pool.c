@@ -32,86 +32,499 @@
 #include "error.h"
 #include "socket.h"
 #include "otime.h"
+#include "list.h"
+#include "crypto.h"
 
 #include "memdbg.h"
 
+/*
+ * The entries that carry a common name are chained through cn_next,
+ * so that a returning client finds its previous address without
+ * scanning the pool.
+ */
+struct ifconfig_pool_cn
+{
+    char *common_name;
+    int first;
+};
+
+static uint32_t
+ifconfig_pool_cn_hash_function(const void *key, uint32_t iv)
+{
+    const char *cn = key;
+    return hash_func((const uint8_t *) cn, (uint32_t) strlen(cn), iv);
+}
+
+static bool
+ifconfig_pool_cn_compare_function(const void *key1, const void *key2)
+{
+    return !strcmp((const char *) key1, (const char *) key2);
+}
+
 static void
-ifconfig_pool_entry_free(struct ifconfig_pool_entry *ipe, bool hard)
+ifconfig_pool_cn_link(struct ifconfig_pool *pool, int i, const char *common_name)
 {
-    ipe->in_use = false;
-    if (hard && ipe->common_name)
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+    struct ifconfig_pool_cn *pcn = hash_lookup(pool->cn_hash, common_name);
+
+    if (!pcn)
     {
-        free(ipe->common_name);
-        ipe->common_name = NULL;
+        ALLOC_OBJ_CLEAR(pcn, struct ifconfig_pool_cn);
+        pcn->common_name = string_alloc(common_name, NULL);
+        pcn->first = -1;
+        hash_add(pool->cn_hash, pcn->common_name, pcn, false);
     }
-    if (hard)
+
+    ipe->common_name = string_alloc(common_name, NULL);
+    ipe->cn_next = pcn->first;
+    pcn->first = i;
+    ++pool->generation;
+}
+
+static void
+ifconfig_pool_cn_unlink(struct ifconfig_pool *pool, int i)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+    struct ifconfig_pool_cn *pcn;
+
+    if (!ipe->common_name)
     {
-        ipe->last_release = 0;
+        return;
+    }
+
+    pcn = hash_lookup(pool->cn_hash, ipe->common_name);
+    ASSERT(pcn);
+
+    int *p = &pcn->first;
+    while (*p != i)
+    {
+        ASSERT(*p >= 0);
+        p = &pool->list[*p].cn_next;
+    }
+    *p = ipe->cn_next;
+    ipe->cn_next = -1;
+
+    if (pcn->first < 0)
+    {
+        hash_remove(pool->cn_hash, pcn->common_name);
+        free(pcn->common_name);
+        free(pcn);
+    }
+
+    free(ipe->common_name);
+    ipe->common_name = NULL;
+    ++pool->generation;
+}
+
+static void
+ifconfig_pool_free_list_remove(struct ifconfig_pool *pool, int i)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+
+    if (!ipe->on_free_list)
+    {
+        return;
+    }
+    if (ipe->free_prev >= 0)
+    {
+        pool->list[ipe->free_prev].free_next = ipe->free_next;
     }
     else
     {
-        ipe->last_release = now;
+        pool->free_head = ipe->free_next;
+    }
+    if (ipe->free_next >= 0)
+    {
+        pool->list[ipe->free_next].free_prev = ipe->free_prev;
+    }
+    else
+    {
+        pool->free_tail = ipe->free_prev;
+    }
+    ipe->free_prev = ipe->free_next = -1;
+    ipe->on_free_list = false;
+}
+
+/*
+ * Entries released earlier are handed out first.  A soft release goes
+ * to the tail, as its last_release is now, a hard release to the head.
+ */
+static void
+ifconfig_pool_free_list_add(struct ifconfig_pool *pool, int i, bool head)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+
+    ifconfig_pool_free_list_remove(pool, i);
+    if (ipe->fixed || pool->sparse)
+    {
+        return;
+    }
+
+    if (head)
+    {
+        ipe->free_prev = -1;
+        ipe->free_next = pool->free_head;
+        if (pool->free_head >= 0)
+        {
+            pool->list[pool->free_head].free_prev = i;
+        }
+        else
+        {
+            pool->free_tail = i;
+        }
+        pool->free_head = i;
+    }
+    else
+    {
+        ipe->free_next = -1;
+        ipe->free_prev = pool->free_tail;
+        if (pool->free_tail >= 0)
+        {
+            pool->list[pool->free_tail].free_next = i;
+        }
+        else
+        {
+            pool->free_head = i;
+        }
+        pool->free_tail = i;
+    }
+    ipe->on_free_list = true;
+}
+
+static void
+ifconfig_pool_set_in_use(struct ifconfig_pool *pool, int i, bool in_use)
+{
+    pool->list[i].in_use = in_use;
+    if (!pool->in_use_map)
+    {
+        return;
+    }
+    if (in_use)
+    {
+        pool->in_use_map[i / 64] |= (uint64_t)1 << (i % 64);
+    }
+    else
+    {
+        pool->in_use_map[i / 64] &= ~((uint64_t)1 << (i % 64));
+    }
+}
+
+/*
+ * Sparse pools
+ */
+
+struct ifconfig_pool_offset
+{
+    uint64_t offset;
+    int handle;
+};
+
+static uint32_t
+ifconfig_pool_offset_hash_function(const void *key, uint32_t iv)
+{
+    return hash_func((const uint8_t *) key, sizeof(uint64_t), iv);
+}
+
+static bool
+ifconfig_pool_offset_compare_function(const void *key1, const void *key2)
+{
+    return *(const uint64_t *) key1 == *(const uint64_t *) key2;
+}
+
+/* where the address of a common name is, unless it is taken */
+static uint64_t
+ifconfig_pool_sparse_home(const struct ifconfig_pool *pool, const char *common_name)
+{
+    const uint8_t *cn = (const uint8_t *) common_name;
+    const uint32_t len = (uint32_t) strlen(common_name);
+
+    /* fixed initial values, the address must survive a restart */
+    const uint64_t h = ((uint64_t) hash_func(cn, len, 0x6f76706e) << 32)
+                       | hash_func(cn, len, 0x706f6f6c);
+    return h % pool->ipv6.space;
+}
+
+static struct in6_addr
+ifconfig_pool_sparse_address(const struct ifconfig_pool *pool, uint64_t offset)
+{
+    struct in6_addr ret = pool->ipv6.base;
+    uint64_t low = 0;
+
+    for (int i = 8; i < 16; i++)
+    {
+        low = (low << 8) | ret.s6_addr[i];
+    }
+    /* the space ends before the host part would carry over */
+    low += offset;
+    for (int i = 15; i >= 8; i--)
+    {
+        ret.s6_addr[i] = (uint8_t) low;
+        low >>= 8;
+    }
+    return ret;
+}
+
+static bool
+ifconfig_pool_sparse_offset(const struct ifconfig_pool *pool,
+                            const struct in6_addr *in_addr, uint64_t *offset)
+{
+    uint64_t base = 0, addr = 0;
+
+    for (int i = 0; i < 8; i++)
+    {
+        if (pool->ipv6.base.s6_addr[i] != in_addr->s6_addr[i])
+        {
+            return false;
+        }
+    }
+    for (int i = 8; i < 16; i++)
+    {
+        base = (base << 8) | pool->ipv6.base.s6_addr[i];
+        addr = (addr << 8) | in_addr->s6_addr[i];
+    }
+    *offset = addr - base;
+    return addr >= base && *offset < pool->ipv6.space;
+}
+
+/* entries that do not stand for an address are chained through free_next */
+static bool
+ifconfig_pool_sparse_grow(struct ifconfig_pool *pool, int size)
+{
+    struct ifconfig_pool_entry *list;
+
+    if (size <= pool->size
+        || !(list = realloc(pool->list, array_mult_safe(sizeof(*list), size, 0))))
+    {
+        return false;
     }
+    pool->list = list;
+    for (int i = size - 1; i >= pool->size; --i)
+    {
+        CLEAR(list[i]);
+        list[i].cn_next = -1;
+        list[i].free_prev = -1;
+        list[i].free_next = pool->unused_head;
+        pool->unused_head = i;
+    }
+    pool->size = size;
+    return true;
 }
 
 static int
-ifconfig_pool_find(struct ifconfig_pool *pool, const char *common_name)
+ifconfig_pool_sparse_lookup(struct ifconfig_pool *pool, uint64_t offset)
 {
+    const struct ifconfig_pool_offset *po = hash_lookup(pool->offset_hash, &offset);
+    return po ? po->handle : -1;
+}
+
+static int
+ifconfig_pool_sparse_add(struct ifconfig_pool *pool, uint64_t offset)
+{
+    struct ifconfig_pool_offset *po;
     int i;
-    time_t earliest_release = 0;
-    int previous_usage = -1;
-    int new_usage = -1;
 
-    for (i = 0; i < pool->size; ++i)
+    if (pool->unused_head < 0
+        && (pool->size > INT_MAX / 2 || !ifconfig_pool_sparse_grow(pool, pool->size * 2)))
+    {
+        msg(D_IFCONFIG_POOL, "IFCONFIG POOL IPv6: cannot grow beyond %d entries",
+            pool->size);
+        return -1;
+    }
+    i = pool->unused_head;
+    pool->unused_head = pool->list[i].free_next;
+    pool->list[i].free_next = -1;
+    pool->list[i].allocated = true;
+    pool->list[i].offset = offset;
+    ++pool->n_allocated;
+
+    ALLOC_OBJ(po, struct ifconfig_pool_offset);
+    po->offset = offset;
+    po->handle = i;
+    hash_add(pool->offset_hash, &po->offset, po, false);
+    return i;
+}
+
+static void
+ifconfig_pool_sparse_remove(struct ifconfig_pool *pool, int i)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+    struct ifconfig_pool_offset *po = hash_lookup(pool->offset_hash, &ipe->offset);
+
+    ASSERT(po && po->handle == i);
+    ifconfig_pool_cn_unlink(pool, i);
+    hash_remove(pool->offset_hash, &po->offset);
+    free(po);
+
+    CLEAR(*ipe);
+    ipe->cn_next = -1;
+    ipe->free_prev = -1;
+    ipe->free_next = pool->unused_head;
+    pool->unused_head = i;
+    --pool->n_allocated;
+}
+
+/* an address gets its entry when it is first seen */
+static int
+ifconfig_pool_sparse_handle(struct ifconfig_pool *pool, const struct in6_addr *in_addr)
+{
+    uint64_t offset;
+
+    if (!ifconfig_pool_sparse_offset(pool, in_addr, &offset))
+    {
+        return -1;
+    }
+    const int i = ifconfig_pool_sparse_lookup(pool, offset);
+    return i >= 0 ? i : ifconfig_pool_sparse_add(pool, offset);
+}
+
+static int
+ifconfig_pool_sparse_find(struct ifconfig_pool *pool, const char *common_name)
+{
+    uint64_t offset;
+
+    if ((uint64_t) pool->n_allocated >= pool->ipv6.space)
     {
-        struct ifconfig_pool_entry *ipe = &pool->list[i];
-        if (!ipe->in_use)
+        return -1;
+    }
+
+    if (common_name)
+    {
+        /* an address remembered for it, say from --ifconfig-pool-persist */
+        const struct ifconfig_pool_cn *pcn = hash_lookup(pool->cn_hash, common_name);
+
+        for (int i = pcn ? pcn->first : -1; i >= 0; i = pool->list[i].cn_next)
         {
-            /*
-             * If duplicate_cn mode, take first available IP address
-             */
-            if (pool->duplicate_cn)
+            if (!pool->list[i].in_use)
             {
-                new_usage = i;
-                break;
+                return i;
             }
+        }
+        offset = ifconfig_pool_sparse_home(pool, common_name);
+    }
+    else
+    {
+        offset = pool->next_offset;
+    }
 
-            /*
-             * Keep track of the unused IP address entry which
-             * was released earliest.
-             */
-            if ((new_usage == -1 || ipe->last_release < earliest_release) && !ipe->fixed)
-            {
-                earliest_release = ipe->last_release;
-                new_usage = i;
-            }
+    /* the first address from there on that nobody uses or is remembered for */
+    while (ifconfig_pool_sparse_lookup(pool, offset) >= 0)
+    {
+        offset = (offset + 1) % pool->ipv6.space;
+    }
+    if (!common_name)
+    {
+        pool->next_offset = (offset + 1) % pool->ipv6.space;
+    }
+    return ifconfig_pool_sparse_add(pool, offset);
+}
 
-            /*
-             * Keep track of a possible allocation to us
-             * from an earlier session.
-             */
-            if (previous_usage < 0
-                && common_name
-                && ipe->common_name
-                && !strcmp(common_name, ipe->common_name))
+/*
+ * A released address is only remembered if the common name would not
+ * lead to it anyway, so that the pool only grows with the clients that
+ * are connected.
+ */
+static void
+ifconfig_pool_sparse_free(struct ifconfig_pool *pool, int i, bool hard)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+
+    ifconfig_pool_set_in_use(pool, i, false);
+    ipe->last_release = now;
+    if (!ipe->fixed
+        && (hard || !ipe->common_name
+            || ipe->offset == ifconfig_pool_sparse_home(pool, ipe->common_name)))
+    {
+        ifconfig_pool_sparse_remove(pool, i);
+    }
+}
+
+static bool
+ifconfig_pool_handle_valid(const struct ifconfig_pool *pool, ifconfig_pool_handle hand)
+{
+    return hand >= 0 && hand < pool->size
+           && (!pool->sparse || pool->list[hand].allocated);
+}
+
+static void
+ifconfig_pool_entry_free(struct ifconfig_pool *pool, int i, bool hard)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+
+    if (pool->sparse)
+    {
+        ifconfig_pool_sparse_free(pool, i, hard);
+        return;
+    }
+
+    ifconfig_pool_set_in_use(pool, i, false);
+    if (hard)
+    {
+        ifconfig_pool_cn_unlink(pool, i);
+        ipe->last_release = 0;
+    }
+    else
+    {
+        ipe->last_release = now;
+    }
+    ifconfig_pool_free_list_add(pool, i, hard);
+}
+
+/* lowest entry that is not in use, fixed or not */
+static int
+ifconfig_pool_find_first_free(const struct ifconfig_pool *pool)
+{
+    for (int w = 0; w * 64 < pool->size; ++w)
+    {
+        if (pool->in_use_map[w] != UINT64_MAX)
+        {
+            for (int i = w * 64; i < (w + 1) * 64 && i < pool->size; ++i)
             {
-                previous_usage = i;
+                if (!pool->list[i].in_use)
+                {
+                    return i;
+                }
             }
-
         }
     }
+    return -1;
+}
 
-    if (previous_usage >= 0)
+static int
+ifconfig_pool_find(struct ifconfig_pool *pool, const char *common_name)
+{
+    /*
+     * If duplicate_cn mode, take first available IP address
+     */
+    if (pool->duplicate_cn)
     {
-        return previous_usage;
+        return ifconfig_pool_find_first_free(pool);
     }
 
-    if (new_usage >= 0)
+    /*
+     * Prefer a possible allocation to us from an earlier session.
+     */
+    if (common_name)
     {
-        return new_usage;
+        const struct ifconfig_pool_cn *pcn = hash_lookup(pool->cn_hash, common_name);
+        int previous_usage = -1;
+
+        for (int i = pcn ? pcn->first : -1; i >= 0; i = pool->list[i].cn_next)
+        {
+            if (!pool->list[i].in_use && (previous_usage < 0 || i < previous_usage))
+            {
+                previous_usage = i;
+            }
+        }
+        if (previous_usage >= 0)
+        {
+            return previous_usage;
+        }
     }
 
-    return -1;
+    /*
+     * Otherwise the unused IP address entry which was released earliest.
+     */
+    return pool->free_head;
 }
 
 /*
@@ -242,15 +655,38 @@ ifconfig_pool_init(const bool ipv4_pool, enum pool_type type, in_addr_t start,
                           ? (1 << (128 - ipv6_netbits)) - base
                           : IFCONFIG_POOL_MAX;
 
-        if (pool_ipv6_size < 2)
+        /* without an IPv4 pool to match, do not stop at IFCONFIG_POOL_MAX */
+        if (!pool->ipv4.enabled && ipv6_netbits < 112)
+        {
+            uint64_t base_low = 0, mask = UINT64_MAX;
+
+            for (int i = 8; i < 16; i++)
+            {
+                base_low = (base_low << 8) | pool->ipv6.base.s6_addr[i];
+            }
+            if (ipv6_netbits > 64)
+            {
+                mask = ((uint64_t) 1 << (128 - ipv6_netbits)) - 1;
+            }
+            pool->sparse = true;
+            pool->ipv6.space = mask - (base_low & mask);
+
+            msg(D_IFCONFIG_POOL, "IFCONFIG POOL IPv6: base=%s sparse size=%" PRIu64
+                " netbits=%d", print_in6_addr(pool->ipv6.base, 0, &gc),
+                pool->ipv6.space, ipv6_netbits);
+        }
+
+        else if (pool_ipv6_size < 2)
         {
             msg(M_FATAL, "IPv6 pool size is too small (%d), must be at least 2",
                 pool_ipv6_size);
         }
-
-        msg(D_IFCONFIG_POOL, "IFCONFIG POOL IPv6: base=%s size=%d netbits=%d",
-            print_in6_addr(pool->ipv6.base, 0, &gc), pool_ipv6_size,
-            ipv6_netbits);
+        else
+        {
+            msg(D_IFCONFIG_POOL, "IFCONFIG POOL IPv6: base=%s size=%d netbits=%d",
+                print_in6_addr(pool->ipv6.base, 0, &gc), pool_ipv6_size,
+                ipv6_netbits);
+        }
 
         /* if there is no v4 pool, or the v6 pool is smaller, use
          * v6 pool size as "unified pool size"
@@ -280,7 +716,34 @@ ifconfig_pool_init(const bool ipv4_pool, enum pool_type type, in_addr_t start,
 
     ASSERT(pool->size > 0);
 
+    pool->free_head = pool->free_tail = -1;
+    pool->unused_head = -1;
+
+    if (pool->sparse)
+    {
+        pool->size = 0;
+        ASSERT(ifconfig_pool_sparse_grow(pool, 256));
+        pool->cn_hash = hash_init(pool->size, get_random(),
+                                  ifconfig_pool_cn_hash_function,
+                                  ifconfig_pool_cn_compare_function);
+        pool->offset_hash = hash_init(pool->size, get_random(),
+                                      ifconfig_pool_offset_hash_function,
+                                      ifconfig_pool_offset_compare_function);
+        gc_free(&gc);
+        return pool;
+    }
+
     ALLOC_ARRAY_CLEAR(pool->list, struct ifconfig_pool_entry, pool->size);
+    ALLOC_ARRAY_CLEAR(pool->in_use_map, uint64_t, (pool->size + 63) / 64);
+    pool->cn_hash = hash_init(pool->size, get_random(),
+                              ifconfig_pool_cn_hash_function,
+                              ifconfig_pool_cn_compare_function);
+
+    for (int i = 0; i < pool->size; ++i)
+    {
+        pool->list[i].cn_next = -1;
+        ifconfig_pool_free_list_add(pool, i, false);
+    }
 
     gc_free(&gc);
     return pool;
@@ -295,29 +758,48 @@ ifconfig_pool_free(struct ifconfig_pool *pool)
 
         for (i = 0; i < pool->size; ++i)
         {
-            ifconfig_pool_entry_free(&pool->list[i], true);
+            if (pool->list[i].allocated)
+            {
+                ifconfig_pool_sparse_remove(pool, i);
+            }
+            ifconfig_pool_cn_unlink(pool, i);
+        }
+        hash_free(pool->cn_hash);
+        if (pool->offset_hash)
+        {
+            hash_free(pool->offset_hash);
         }
+        free(pool->in_use_map);
         free(pool->list);
         free(pool);
     }
 }
 
+static void
+ifconfig_pool_take(struct ifconfig_pool *pool, int i, const char *common_name)
+{
+    struct ifconfig_pool_entry *ipe = &pool->list[i];
+    ASSERT(!ipe->in_use);
+    ifconfig_pool_cn_unlink(pool, i);
+    ifconfig_pool_free_list_remove(pool, i);
+    ipe->last_release = 0;
+    ifconfig_pool_set_in_use(pool, i, true);
+    if (common_name)
+    {
+        ifconfig_pool_cn_link(pool, i, common_name);
+    }
+}
+
 ifconfig_pool_handle
 ifconfig_pool_acquire(struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *remote, struct in6_addr *remote_ipv6, const char *common_name)
 {
     int i;
 
-    i = ifconfig_pool_find(pool, common_name);
+    i = pool->sparse ? ifconfig_pool_sparse_find(pool, common_name)
+        : ifconfig_pool_find(pool, common_name);
     if (i >= 0)
     {
-        struct ifconfig_pool_entry *ipe = &pool->list[i];
-        ASSERT(!ipe->in_use);
-        ifconfig_pool_entry_free(ipe, true);
-        ipe->in_use = true;
-        if (common_name)
-        {
-            ipe->common_name = string_alloc(common_name, NULL);
-        }
+        ifconfig_pool_take(pool, i, common_name);
 
         if (pool->ipv4.enabled && local && remote)
         {
@@ -347,20 +829,42 @@ ifconfig_pool_acquire(struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *r
         /* IPv6 pools are always INDIV (--linear) */
         if (pool->ipv6.enabled && remote_ipv6)
         {
-            *remote_ipv6 = add_in6_addr(pool->ipv6.base, i);
+            *remote_ipv6 = pool->sparse
+                           ? ifconfig_pool_sparse_address(pool, pool->list[i].offset)
+                           : add_in6_addr(pool->ipv6.base, i);
         }
     }
     return i;
 }
 
+ifconfig_pool_handle
+ifconfig_pool_claim(struct ifconfig_pool *pool, ifconfig_pool_handle hand,
+                    const struct in6_addr *remote_ipv6, const char *common_name)
+{
+    if (!pool)
+    {
+        return -1;
+    }
+    if (pool->sparse)
+    {
+        hand = remote_ipv6 ? ifconfig_pool_sparse_handle(pool, remote_ipv6) : -1;
+    }
+    if (!ifconfig_pool_handle_valid(pool, hand) || pool->list[hand].in_use)
+    {
+        return -1;
+    }
+    ifconfig_pool_take(pool, hand, common_name);
+    return hand;
+}
+
 bool
 ifconfig_pool_release(struct ifconfig_pool *pool, ifconfig_pool_handle hand, const bool hard)
 {
     bool ret = false;
 
-    if (pool && hand >= 0 && hand < pool->size)
+    if (pool && ifconfig_pool_handle_valid(pool, hand))
     {
-        ifconfig_pool_entry_free(&pool->list[hand], hard);
+        ifconfig_pool_entry_free(pool, hand, hard);
         ret = true;
     }
     return ret;
@@ -403,12 +907,17 @@ ifconfig_pool_ip_base_to_handle(const struct ifconfig_pool *pool, const in_addr_
 }
 
 static ifconfig_pool_handle
-ifconfig_pool_ipv6_base_to_handle(const struct ifconfig_pool *pool,
+ifconfig_pool_ipv6_base_to_handle(struct ifconfig_pool *pool,
                                   const struct in6_addr *in_addr)
 {
     ifconfig_pool_handle ret;
     uint32_t base, addr;
 
+    if (pool->sparse)
+    {
+        return ifconfig_pool_sparse_handle(pool, in_addr);
+    }
+
     /* IPv6 pool is always IFCONFIG_POOL_INDIV.
      *
      * We assume the offset can't be larger than 2^32-1, therefore we compute
@@ -477,9 +986,11 @@ ifconfig_pool_handle_to_ipv6_base(const struct ifconfig_pool *pool, ifconfig_poo
     struct in6_addr ret = IN6ADDR_ANY_INIT;
 
     /* IPv6 pools are always INDIV (--linear) */
-    if (pool->ipv6.enabled && hand >= 0 && hand < pool->size)
+    if (pool->ipv6.enabled && ifconfig_pool_handle_valid(pool, hand))
     {
-        ret = add_in6_addr( pool->ipv6.base, hand );
+        ret = pool->sparse
+              ? ifconfig_pool_sparse_address(pool, pool->list[hand].offset)
+              : add_in6_addr( pool->ipv6.base, hand );
     }
     return ret;
 }
@@ -489,11 +1000,38 @@ ifconfig_pool_set(struct ifconfig_pool *pool, const char *cn,
                   ifconfig_pool_handle h, const bool fixed)
 {
     struct ifconfig_pool_entry *e = &pool->list[h];
-    ifconfig_pool_entry_free(e, true);
-    e->in_use = false;
-    e->common_name = string_alloc(cn, NULL);
+    ifconfig_pool_set_in_use(pool, h, false);
+    ifconfig_pool_cn_unlink(pool, h);
+    ifconfig_pool_cn_link(pool, h, cn);
     e->last_release = now;
     e->fixed = fixed;
+    ifconfig_pool_free_list_add(pool, h, false);
+}
+
+bool
+ifconfig_pool_reserve(struct ifconfig_pool *pool, const char *common_name,
+                      const in_addr_t local, const struct in6_addr *local_ipv6)
+{
+    ifconfig_pool_handle h = -1;
+
+    if (!pool || !common_name)
+    {
+        return false;
+    }
+    if (pool->ipv4.enabled && local)
+    {
+        h = ifconfig_pool_ip_base_to_handle(pool, local);
+    }
+    else if (pool->ipv6.enabled && local_ipv6)
+    {
+        h = ifconfig_pool_ipv6_base_to_handle(pool, local_ipv6);
+    }
+    if (h < 0 || pool->list[h].in_use)
+    {
+        return false;
+    }
+    ifconfig_pool_set(pool, common_name, h, false);
+    return true;
 }
 
 static void
@@ -734,9 +1272,17 @@ ifconfig_pool_write(struct ifconfig_pool_persist *persist, const struct ifconfig
 {
     if (persist && persist->file && (status_rw_flags(persist->file) & STATUS_OUTPUT_WRITE) && pool)
     {
+        /* the file only lists the common names of the entries, do not
+         * rewrite it if none of them changed since the last write */
+        if (persist->written && persist->written_generation == pool->generation)
+        {
+            return;
+        }
         status_reset(persist->file);
         ifconfig_pool_list(pool, persist->file);
         status_flush(persist->file);
+        persist->written = true;
+        persist->written_generation = pool->generation;
     }
 }
 
@@ -44,6 +44,14 @@ struct ifconfig_pool_entry
     char *common_name;
     time_t last_release;
     bool fixed;
+    int cn_next;        /* next entry with the same common_name, or -1 */
+    int free_prev;      /* neighbours in the free list, or -1 */
+    int free_next;
+    bool on_free_list;
+
+    /* sparse pools only */
+    bool allocated;     /* the entry stands for an address */
+    uint64_t offset;    /* of the address from the IPv6 base */
 };
 
 struct ifconfig_pool
@@ -57,15 +65,44 @@ struct ifconfig_pool
     struct {
         bool enabled;
         struct in6_addr base;
+        uint64_t space;     /* addresses from base on, sparse pools only */
     } ipv6;
     int size;
     struct ifconfig_pool_entry *list;
+
+    /*
+     * An IPv6 only pool larger than IFCONFIG_POOL_MAX is sparse: list
+     * grows with the number of addresses that are in use or remembered
+     * for a common name, the others do not take any memory.  An entry
+     * stands for the address at its offset, which is derived from the
+     * common name of the client.
+     */
+    bool sparse;
+    int unused_head;            /* entries not standing for an address */
+    int n_allocated;
+    uint64_t next_offset;       /* for clients without a common name */
+    struct hash *offset_hash;   /* offset -> struct ifconfig_pool_offset */
+
+    /* entries that are neither in use nor fixed, earliest released first */
+    int free_head;
+    int free_tail;
+
+    /* one bit per entry that is in use */
+    uint64_t *in_use_map;
+
+    /* common name -> struct ifconfig_pool_cn, the entries that carry it */
+    struct hash *cn_hash;
+
+    /* incremented whenever an entry's common name changes */
+    unsigned int generation;
 };
 
 struct ifconfig_pool_persist
 {
     struct status_output *file;
     bool fixed;
+    bool written;
+    unsigned int written_generation;
 };
 
 typedef int ifconfig_pool_handle;
@@ -83,6 +120,25 @@ bool ifconfig_pool_verify_range(const int msglevel, const in_addr_t start, const
 
 ifconfig_pool_handle ifconfig_pool_acquire(struct ifconfig_pool *pool, in_addr_t *local, in_addr_t *remote, struct in6_addr *remote_ipv6, const char *common_name);
 
+/**
+ * Mark the given entry as used by \c common_name, for a client whose
+ * address was handed out by another process.  The handles of a sparse
+ * pool are local to the process, its entry is found by \c remote_ipv6
+ * instead.  Returns the handle of the entry, or -1 if it is in use.
+ */
+ifconfig_pool_handle ifconfig_pool_claim(struct ifconfig_pool *pool, ifconfig_pool_handle hand,
+                                         const struct in6_addr *remote_ipv6,
+                                         const char *common_name);
+
+/**
+ * Remember the address \c local, or \c local_ipv6 for an IPv6 only pool,
+ * for \c common_name as --ifconfig-pool-persist does, so that the client
+ * gets it again when it connects.  Fails if the address is outside the
+ * pool or in use.
+ */
+bool ifconfig_pool_reserve(struct ifconfig_pool *pool, const char *common_name,
+                           const in_addr_t local, const struct in6_addr *local_ipv6);
+
 bool ifconfig_pool_release(struct ifconfig_pool *pool, ifconfig_pool_handle hand, const bool hard);
 
 struct ifconfig_pool_persist *ifconfig_pool_persist_init(const char *filename, int refresh_freq);
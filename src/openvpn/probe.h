@@ -0,0 +1,70 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+
+/*
+ * USDT static probes for perf, bpftrace and SystemTap, in the provider
+ * "openvpn".  Without --enable-usdt the macros expand to nothing and
+ * their arguments are not evaluated.  A probe that is not attached
+ * costs a nop.  The probe names and arguments are a stable interface:
+ *
+ *   link_decrypt(peer_id, len, ok)       packet authenticated/decrypted
+ *   tun_write(peer_id, len)              packet written to tun, len -1 on error
+ *   instance_create(mi, n_clients)       server created a client instance
+ *   instance_close(mi, peer_id, age, shutdown)
+ *   tls_state(peer_id, key_id, old, new) S_x state of the primary key changed
+ *   key_soft_reset(key_id, age, bytes)   renegotiation, age/bytes of old key
+ *   push_reply(peer_id, continued, cached)
+ *   queue_drop(mi, len, reason)          TRACE_DROP_x, see trace.h
+ *   mbuf_drop(mi, len, flow_len)         full output queue dropped a packet
+ *
+ * mi is the address of the struct multi_instance, which pairs the
+ * instance and drop probes, and peer_id is 0xFFFFFFFF if not known.
+ */
+
+#ifndef OPENVPN_PROBE_H
+#define OPENVPN_PROBE_H
+
+#ifdef ENABLE_USDT
+
+#include <sys/sdt.h>
+
+#define OVPN_PROBE1(name, a1) \
+    STAP_PROBE1(openvpn, name, a1)
+#define OVPN_PROBE2(name, a1, a2) \
+    STAP_PROBE2(openvpn, name, a1, a2)
+#define OVPN_PROBE3(name, a1, a2, a3) \
+    STAP_PROBE3(openvpn, name, a1, a2, a3)
+#define OVPN_PROBE4(name, a1, a2, a3, a4) \
+    STAP_PROBE4(openvpn, name, a1, a2, a3, a4)
+
+#else  /* ifdef ENABLE_USDT */
+
+#define OVPN_PROBE1(name, a1) do { } while (0)
+#define OVPN_PROBE2(name, a1, a2) do { } while (0)
+#define OVPN_PROBE3(name, a1, a2, a3) do { } while (0)
+#define OVPN_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+
+#endif /* ifdef ENABLE_USDT */
+
+#endif /* ifndef OPENVPN_PROBE_H */
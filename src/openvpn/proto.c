@@ -33,14 +33,14 @@
 #include "memdbg.h"
 
 /*
- * If raw tunnel packet is IPv<X>, return true and increment
- * buffer offset to start of IP header.
+ * Return the IP version (4 or 6) of a raw tunnel packet and set *offset
+ * to the start of its IP header, or return 0 if it is no IP packet.
  */
-static bool
-is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
+static int
+ip_packet_version(int tunnel_type, const struct buffer *buf, int *offset)
 {
-    int offset;
     uint16_t proto;
+    int ip_ver;
     const struct openvpn_iphdr *ih;
 
     verify_align_4(buf);
@@ -48,9 +48,10 @@ is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
     {
         if (BLEN(buf) < sizeof(struct openvpn_iphdr))
         {
-            return false;
+            return 0;
         }
-        offset = 0;
+        *offset = 0;
+        ip_ver = OPENVPN_IPH_GET_VER(*BPTR(buf));
     }
     else if (tunnel_type == DEV_TYPE_TAP)
     {
@@ -58,13 +59,13 @@ is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
         if (BLEN(buf) < (sizeof(struct openvpn_ethhdr)
                          + sizeof(struct openvpn_iphdr)))
         {
-            return false;
+            return 0;
         }
         eh = (const struct openvpn_ethhdr *)BPTR(buf);
 
         /* start by assuming this is a standard Eth fram */
         proto = eh->proto;
-        offset = sizeof(struct openvpn_ethhdr);
+        *offset = sizeof(struct openvpn_ethhdr);
 
         /* if this is a 802.1q frame, parse the header using the according
          * format
@@ -75,29 +76,54 @@ is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
             if (BLEN(buf) < (sizeof(struct openvpn_ethhdr)
                              + sizeof(struct openvpn_iphdr)))
             {
-                return false;
+                return 0;
             }
 
             evh = (const struct openvpn_8021qhdr *)BPTR(buf);
 
             proto = evh->proto;
-            offset = sizeof(struct openvpn_8021qhdr);
+            *offset = sizeof(struct openvpn_8021qhdr);
         }
 
-        if (ntohs(proto) != (ip_ver == 6 ? OPENVPN_ETH_P_IPV6 : OPENVPN_ETH_P_IPV4))
+        if (proto == htons(OPENVPN_ETH_P_IPV4))
+        {
+            ip_ver = 4;
+        }
+        else if (proto == htons(OPENVPN_ETH_P_IPV6))
+        {
+            ip_ver = 6;
+        }
+        else
         {
-            return false;
+            return 0;
         }
     }
     else
     {
-        return false;
+        return 0;
     }
 
-    ih = (const struct openvpn_iphdr *)(BPTR(buf) + offset);
+    ih = (const struct openvpn_iphdr *)(BPTR(buf) + *offset);
 
     /* IP version is stored in the same bits for IPv4 or IPv6 header */
-    if (OPENVPN_IPH_GET_VER(ih->version_len) == ip_ver)
+    if ((ip_ver == 4 || ip_ver == 6)
+        && OPENVPN_IPH_GET_VER(ih->version_len) == ip_ver)
+    {
+        return ip_ver;
+    }
+    return 0;
+}
+
+/*
+ * If raw tunnel packet is IPv<X>, return true and increment
+ * buffer offset to start of IP header.
+ */
+static bool
+is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
+{
+    int offset;
+
+    if (ip_packet_version(tunnel_type, buf, &offset) == ip_ver)
     {
         return buf_advance(buf, offset);
     }
@@ -107,6 +133,42 @@ is_ipv_X(int tunnel_type, struct buffer *buf, int ip_ver)
     }
 }
 
+void
+ip_packet_parse(int tunnel_type, const struct buffer *buf,
+                struct ip_packet_info *ipi)
+{
+    CLEAR(*ipi);
+    ipi->version = ip_packet_version(tunnel_type, buf, &ipi->l3_offset);
+
+    if (ipi->version == 4)
+    {
+        const struct openvpn_iphdr *pip =
+            (const struct openvpn_iphdr *)(BPTR(buf) + ipi->l3_offset);
+        const int hlen = OPENVPN_IPH_GET_LEN(pip->version_len);
+
+        /* only the first fragment has a transport header */
+        if (hlen >= (int) sizeof(struct openvpn_iphdr)
+            && ipi->l3_offset + hlen <= BLEN(buf)
+            && (ntohs(pip->frag_off) & OPENVPN_IP_OFFMASK) == 0)
+        {
+            ipi->l4_offset = ipi->l3_offset + hlen;
+            ipi->l4_proto = pip->protocol;
+        }
+    }
+    else if (ipi->version == 6)
+    {
+        const struct openvpn_ipv6hdr *pip6 =
+            (const struct openvpn_ipv6hdr *)(BPTR(buf) + ipi->l3_offset);
+
+        /* extension headers are not followed, see mss_fixup_ipv6() */
+        if (ipi->l3_offset + (int) sizeof(struct openvpn_ipv6hdr) <= BLEN(buf))
+        {
+            ipi->l4_offset = ipi->l3_offset + sizeof(struct openvpn_ipv6hdr);
+            ipi->l4_proto = pip6->nexthdr;
+        }
+    }
+}
+
 bool
 is_ipv4(int tunnel_type, struct buffer *buf)
 {
@@ -119,55 +181,73 @@ is_ipv6(int tunnel_type, struct buffer *buf)
 }
 
 
-uint16_t
-ip_checksum(const sa_family_t af, const uint8_t *payload, const int len_payload,
-            const uint8_t *src_addr, const uint8_t *dest_addr, const int proto)
+/*
+ * Add data to a one's complement sum.  The words are added in host byte
+ * order, 32 bits at a time into a 64 bit accumulator, which compilers
+ * turn into vector code.  The one's complement sum does not depend on
+ * the byte order, see RFC 1071, so the caller only needs to byte swap
+ * the folded result.
+ */
+static inline uint64_t
+ip_checksum_add(uint64_t sum, const uint8_t *data, int len)
 {
-    uint32_t sum = 0;
-    int addr_len = (af == AF_INET) ? 4 : 16;
+    uint32_t w32;
+    uint16_t w16;
 
-    /*
-     * make 16 bit words out of every two adjacent 8 bit words and  */
-    /* calculate the sum of all 16 bit words
-     */
-    for (int i = 0; i < len_payload; i += 2)
+    for (; len >= 4; data += 4, len -= 4)
     {
-        sum +=  (uint16_t)(((payload[i] << 8) & 0xFF00)
-                           +((i + 1 < len_payload) ? (payload[i + 1] & 0xFF) : 0));
-
+        memcpy(&w32, data, sizeof(w32));
+        sum += w32;
     }
-
-    /*
-     * add the pseudo header which contains the IP source and destination
-     * addresses
-     */
-    for (int i = 0; i < addr_len; i += 2)
+    if (len >= 2)
     {
-        sum += (uint16_t)((src_addr[i] << 8) & 0xFF00) + (src_addr[i + 1] & 0xFF);
-
+        memcpy(&w16, data, sizeof(w16));
+        sum += w16;
+        data += 2;
+        len -= 2;
     }
-    for (int i = 0; i < addr_len; i += 2)
+    if (len)
     {
-        sum += (uint16_t)((dest_addr[i] << 8) & 0xFF00) + (dest_addr[i + 1] & 0xFF);
+        /* an odd byte is padded with a zero byte */
+        const uint8_t pad[2] = { data[0], 0 };
+        memcpy(&w16, pad, sizeof(w16));
+        sum += w16;
     }
+    return sum;
+}
 
-    /* the length of the payload */
-    sum += (uint16_t)len_payload;
+static inline uint16_t
+ip_checksum_fold(uint64_t sum)
+{
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFFFFFF) + (sum >> 32);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    sum = (sum & 0xFFFF) + (sum >> 16);
+    return (uint16_t) sum;
+}
 
-    /* The next header or proto field*/
-    sum += (uint16_t)proto;
+uint16_t
+ip_checksum(const sa_family_t af, const uint8_t *payload, const int len_payload,
+            const uint8_t *src_addr, const uint8_t *dest_addr, const int proto)
+{
+    int addr_len = (af == AF_INET) ? 4 : 16;
+    uint64_t sum = 0;
 
     /*
-     * keep only the last 16 bits of the 32 bit calculated sum and add
-     * the carries
+     * sum up the payload and the pseudo header which contains the IP
+     * source and destination addresses
      */
-    while (sum >> 16)
-    {
-        sum = (sum & 0xFFFF) + (sum >> 16);
-    }
+    sum = ip_checksum_add(sum, payload, len_payload);
+    sum = ip_checksum_add(sum, src_addr, addr_len);
+    sum = ip_checksum_add(sum, dest_addr, addr_len);
+
+    /* back to host order to add the length and next header/proto field */
+    sum = ntohs(ip_checksum_fold(sum));
+    sum += (uint16_t)len_payload;
+    sum += (uint16_t)proto;
 
     /* Take the one's complement of sum */
-    return ((uint16_t) ~sum);
+    return (uint16_t) ~ip_checksum_fold(sum);
 }
 
 #ifdef PACKET_TRUNCATION_CHECK
@@ -295,6 +295,20 @@ bool is_ipv4(int tunnel_type, struct buffer *buf);
 
 bool is_ipv6(int tunnel_type, struct buffer *buf);
 
+/*
+ * Header offsets of a raw tunnel packet, parsed once by
+ * ip_packet_parse() and shared by the features that look at them.
+ */
+struct ip_packet_info {
+    int version;            /* 4 or 6, or 0 if not an IP packet */
+    int l3_offset;          /* offset of the IP header */
+    int l4_offset;          /* offset of the transport header, 0 if unknown */
+    uint8_t l4_proto;       /* OPENVPN_IPPROTO_x of the transport header */
+};
+
+void ip_packet_parse(int tunnel_type, const struct buffer *buf,
+                     struct ip_packet_info *ipi);
+
 /**
  *  Calculates an IP or IPv6 checksum with a pseudo header as required by
  *  TCP, UDP and ICMPv6
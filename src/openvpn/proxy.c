@@ -59,6 +59,56 @@ init_http_proxy_options_once(struct http_proxy_options **hpo,
 /* cached proxy username/password */
 static struct user_pass static_proxy_user_pass;
 
+/*
+ * The authentication method that an 'auto' proxy asked for last time,
+ * kept across restarts, so that a reconnect does not need an extra
+ * round trip and connection to find it out again.
+ */
+static struct {
+    char *server;
+    char *port;
+    int auth_method;
+    char *proxy_authenticate;   /* digest challenge */
+} static_proxy_auth;            /* GLOBAL */
+
+static void
+remember_proxy_auth(const struct http_proxy_info *p, const int method,
+                    const char *pa)
+{
+    free(static_proxy_auth.server);
+    free(static_proxy_auth.port);
+    free(static_proxy_auth.proxy_authenticate);
+    static_proxy_auth.server = string_alloc(p->options.server, NULL);
+    static_proxy_auth.port = string_alloc(p->options.port, NULL);
+    static_proxy_auth.auth_method = method;
+    static_proxy_auth.proxy_authenticate = pa ? string_alloc(pa, NULL) : NULL;
+}
+
+static void
+recall_proxy_auth(struct http_proxy_info *p)
+{
+    if (static_proxy_auth.server
+        && !strcmp(static_proxy_auth.server, p->options.server)
+        && !strcmp(static_proxy_auth.port, p->options.port)
+        && (static_proxy_auth.auth_method != HTTP_AUTH_DIGEST
+            || static_proxy_auth.proxy_authenticate)
+        && (static_proxy_auth.auth_method != HTTP_AUTH_BASIC
+            || p->options.auth_retry != PAR_NCT))
+    {
+        msg(D_PROXY, "HTTP proxy: using the authentication method of the last connection");
+        p->auth_method = static_proxy_auth.auth_method;
+        if (static_proxy_auth.proxy_authenticate)
+        {
+            p->proxy_authenticate = string_alloc(static_proxy_auth.proxy_authenticate, NULL);
+        }
+    }
+}
+
+/*
+ * Read a line terminated by CRLF.  The data is peeked at in blocks and
+ * only the bytes up to the end of the line are consumed, so that what
+ * the proxy sends after the headers stays in the socket for the tunnel.
+ */
 static bool
 recv_line(socket_descriptor_t sd,
           char *buf,
@@ -70,6 +120,7 @@ recv_line(socket_descriptor_t sd,
 {
     struct buffer la;
     int lastc = 0;
+    bool eol = false;
 
     CLEAR(la);
     if (lookahead)
@@ -77,18 +128,15 @@ recv_line(socket_descriptor_t sd,
         la = *lookahead;
     }
 
-    while (true)
+    while (!eol)
     {
         int status;
         ssize_t size;
         fd_set reads;
         struct timeval tv;
-        uint8_t c;
-
-        if (buf_defined(&la))
-        {
-            ASSERT(buf_init(&la, 0));
-        }
+        uint8_t block[256];
+        int n = 0;
+        bool non_ascii = false;
 
         FD_ZERO(&reads);
         openvpn_fd_set(sd, &reads);
@@ -123,11 +171,11 @@ recv_line(socket_descriptor_t sd,
             goto error;
         }
 
-        /* read single char */
-        size = recv(sd, (void *)&c, 1, MSG_NOSIGNAL);
+        /* look at what has arrived */
+        size = recv(sd, (void *)block, sizeof(block), MSG_PEEK | MSG_NOSIGNAL);
 
         /* error? */
-        if (size != 1)
+        if (size <= 0)
         {
             if (verbose)
             {
@@ -136,46 +184,52 @@ recv_line(socket_descriptor_t sd,
             goto error;
         }
 
-#if 0
-        if (isprint(c))
+        while (n < size && !eol && !non_ascii)
         {
-            msg(M_INFO, "PROXY: read '%c' (%d)", c, (int)c);
-        }
-        else
-        {
-            msg(M_INFO, "PROXY: read (%d)", (int)c);
-        }
-#endif
+            const uint8_t c = block[n++];
 
-        /* store char in buffer */
-        if (len > 1)
-        {
-            *buf++ = c;
-            --len;
-        }
+            /* store char in buffer */
+            if (len > 1)
+            {
+                *buf++ = c;
+                --len;
+            }
 
-        /* also store char in lookahead buffer */
-        if (buf_defined(&la))
-        {
-            buf_write_u8(&la, c);
-            if (!isprint(c) && !isspace(c)) /* not ascii? */
+            /* also store char in lookahead buffer */
+            if (buf_defined(&la))
             {
-                if (verbose)
+                ASSERT(buf_init(&la, 0));
+                buf_write_u8(&la, c);
+                if (!isprint(c) && !isspace(c)) /* not ascii? */
                 {
-                    msg(D_LINK_ERRORS | M_ERRNO, "recv_line: Non-ASCII character (%d) read on recv()", (int)c);
+                    if (verbose)
+                    {
+                        msg(D_LINK_ERRORS | M_ERRNO, "recv_line: Non-ASCII character (%d) read on recv()", (int)c);
+                    }
+                    non_ascii = true;
                 }
-                *lookahead = la;
-                return false;
             }
+
+            /* end of line? */
+            eol = lastc == '\r' && c == '\n';
+            lastc = c;
         }
 
-        /* end of line? */
-        if (lastc == '\r' && c == '\n')
+        /* consume what was used of the block */
+        if (recv(sd, (void *)block, n, MSG_NOSIGNAL) != n)
         {
-            break;
+            if (verbose)
+            {
+                msg(D_LINK_ERRORS | M_ERRNO, "recv_line: TCP port read failed on recv()");
+            }
+            goto error;
         }
 
-        lastc = c;
+        if (non_ascii)
+        {
+            *lookahead = la;
+            return false;
+        }
     }
 
     /* append trailing null */
@@ -533,6 +587,11 @@ http_proxy_new(const struct http_proxy_options *o)
         }
     }
 
+    if (o->auth_retry)
+    {
+        recall_proxy_auth(p);
+    }
+
     /* only basic and NTLM/NTLMv2 authentication supported so far */
     if (p->auth_method == HTTP_AUTH_BASIC || p->auth_method == HTTP_AUTH_NTLM || p->auth_method == HTTP_AUTH_NTLM2)
     {
@@ -553,6 +612,7 @@ http_proxy_new(const struct http_proxy_options *o)
 void
 http_proxy_close(struct http_proxy_info *hp)
 {
+    free(hp->proxy_authenticate);
     free(hp);
 }
 
@@ -1008,6 +1068,7 @@ establish_http_proxy_passthru(struct http_proxy_info *p,
                     goto error;
                 }
                 p->auth_method = method;
+                remember_proxy_auth(p, method, pa);
                 store_proxy_authenticate(p, pa);
                 ret = true;
                 goto done;
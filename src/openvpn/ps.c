@@ -42,6 +42,9 @@ struct port_share *port_share = NULL; /* GLOBAL */
 /* size of i/o buffers */
 #define PROXY_CONNECTION_BUFFER_SIZE 1500
 
+/* max bytes moved through a pipe by one splice() call */
+#define PROXY_CONNECTION_SPLICE_SIZE 65536
+
 /* Command codes for foreground -> background communication */
 #define COMMAND_REDIRECT 10
 #define COMMAND_EXIT     11
@@ -73,6 +76,10 @@ struct proxy_connection {
     int rwflags;
     int sd;
     char *jfn;
+#if PORT_SHARE_SPLICE
+    int pipe[2];  /* data from sd to counterpart->sd passes here, if defined */
+    int pipe_len; /* number of bytes in pipe */
+#endif
 };
 
 #if 0
@@ -281,6 +288,14 @@ proxy_entry_mark_for_close(struct proxy_connection *pc, struct event_set *es)
         pc->buffer_initial = false;
         pc->rwflags = 0;
         pc->defined = false;
+#if PORT_SHARE_SPLICE
+        if (pc->pipe[0] >= 0)
+        {
+            close(pc->pipe[0]);
+            close(pc->pipe[1]);
+            pc->pipe[0] = pc->pipe[1] = -1;
+        }
+#endif
         if (pc->jfn)
         {
             unlink(pc->jfn);
@@ -404,6 +419,28 @@ proxy_connection_io_requeue(struct proxy_connection *pc, const int rwflags_new,
     }
 }
 
+#if PORT_SHARE_SPLICE
+/*
+ * Set up the pipe that lets data from pc be spliced to its counterpart.
+ * Without it the data is copied through pc->buf.
+ */
+static void
+proxy_connection_pipe_init(struct proxy_connection *pc)
+{
+    if (pipe(pc->pipe) == 0)
+    {
+        set_cloexec(pc->pipe[0]);
+        set_cloexec(pc->pipe[1]);
+    }
+    else
+    {
+        msg(M_WARN|M_ERRNO, "PORT SHARE PROXY: cannot create pipe, copying data instead");
+        pc->pipe[0] = pc->pipe[1] = -1;
+    }
+    pc->pipe_len = 0;
+}
+#endif
+
 /*
  * Create a new pair of proxy_connection entries, one for each
  * socket file descriptor involved in the proxy.  We are given
@@ -464,6 +501,11 @@ proxy_entry_new(struct proxy_connection **list,
     cp->rwflags = EVENT_UNDEF;
     cp->sd = sd_server;
 
+#if PORT_SHARE_SPLICE
+    proxy_connection_pipe_init(pc);
+    proxy_connection_pipe_init(cp);
+#endif
+
     /* add to list */
     *list = pc;
 
@@ -633,6 +675,53 @@ proxy_connection_io_send(struct proxy_connection *pc, int *bytes_sent)
     return IOSTAT_GOOD;
 }
 
+#if PORT_SHARE_SPLICE
+/*
+ * Move data from pc to pc->counterpart through pc's pipe, so that it
+ * is not copied into user space.
+ */
+static int
+proxy_connection_io_splice(struct proxy_connection *pc, int *bytes_sent)
+{
+    const socket_descriptor_t sd = pc->counterpart->sd;
+    ssize_t status;
+
+    if (!pc->pipe_len)
+    {
+        status = splice(pc->sd, NULL, pc->pipe[1], NULL, PROXY_CONNECTION_SPLICE_SIZE,
+                        SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+        if (status < 0)
+        {
+            return (errno == EAGAIN) ? IOSTAT_EAGAIN_ON_READ : IOSTAT_READ_ERROR;
+        }
+        if (!status)
+        {
+            return IOSTAT_READ_ERROR;
+        }
+        dmsg(D_PS_PROXY_DEBUG, "PORT SHARE PROXY: read[%d] %d", (int)pc->sd, (int)status);
+        pc->pipe_len = (int) status;
+    }
+
+    status = splice(pc->pipe[0], NULL, sd, NULL, pc->pipe_len,
+                    SPLICE_F_MOVE|SPLICE_F_NONBLOCK);
+    if (status < 0)
+    {
+        return (errno == EAGAIN) ? IOSTAT_EAGAIN_ON_WRITE : IOSTAT_WRITE_ERROR;
+    }
+
+    *bytes_sent += (int) status;
+    pc->pipe_len -= (int) status;
+    if (pc->pipe_len)
+    {
+        dmsg(D_PS_PROXY_DEBUG, "PORT SHARE PROXY: partial write[%d], tried=%d got=%d",
+             (int)sd, pc->pipe_len + (int) status, (int) status);
+        return IOSTAT_EAGAIN_ON_WRITE;
+    }
+    dmsg(D_PS_PROXY_DEBUG, "PORT SHARE PROXY: wrote[%d] %d", (int)sd, (int) status);
+    return IOSTAT_GOOD;
+}
+#endif /* if PORT_SHARE_SPLICE */
+
 /*
  * Forward data from pc to pc->counterpart.
  */
@@ -643,6 +732,19 @@ proxy_connection_io_xfer(struct proxy_connection *pc, const int max_transfer)
     int transferred = 0;
     while (transferred < max_transfer)
     {
+#if PORT_SHARE_SPLICE
+        /* data already in buf, like the initial data, is sent first */
+        if (!BLEN(&pc->buf) && pc->pipe[0] >= 0)
+        {
+            const int status = proxy_connection_io_splice(pc, &transferred);
+            if (status != IOSTAT_GOOD)
+            {
+                return status;
+            }
+            continue;
+        }
+#endif
+
         if (!BLEN(&pc->buf))
         {
             const int status = proxy_connection_io_recv(pc);
@@ -854,6 +956,7 @@ port_share_open(const char *host,
     /*
      * Fork off background proxy process.
      */
+    msg_flush();
     pid = fork();
 
     if (pid)
@@ -900,6 +1003,9 @@ port_share_open(const char *host,
         /* Let msg know that we forked */
         msg_forked();
 
+        /* the parent hands out the random bytes it has batched */
+        prng_reset();
+
 #ifdef ENABLE_MANAGEMENT
         /* Don't interact with management interface */
         management = NULL;
@@ -33,6 +33,7 @@
 #include "ssl_verify.h"
 #include "ssl_ncp.h"
 #include "manage.h"
+#include "probe.h"
 
 #include "memdbg.h"
 #include "ssl_util.h"
@@ -496,6 +497,128 @@ send_restart(struct context *c, const char *kill_msg)
     send_control_channel_string(c, kill_msg ? kill_msg : "RESTART", D_PUSH);
 }
 
+void
+send_push_update(struct context *c, unsigned int id, const char *message)
+{
+    c->c2.push_update_id = id;
+    c->c2.push_update_state = PUSH_UPDATE_PENDING;
+    /* one line per client would flood the log */
+    send_control_channel_string(c, message, D_PUSH_DEBUG);
+}
+
+void
+receive_push_update(struct context *c, const struct buffer *buffer)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = *buffer;
+    char line[OPTION_PARM_SIZE];
+    unsigned int parts = 0;
+    unsigned int option_types_found = 0;
+    bool installed = false;
+    bool ok = false;
+
+    msg(D_PUSH, "PUSH: Received control message: '%s'", sanitize_control_message(BSTR(buffer), &gc));
+
+    if (!c->options.pull || !c->c2.do_up_ran)
+    {
+        msg(D_PUSH_ERRORS, "WARNING: Ignoring PUSH_UPDATE, the tunnel is not up");
+        goto cleanup;
+    }
+    if (!buf_string_compare_advance(&buf, "PUSH_UPDATE,")
+        || !buf_parse(&buf, ',', line, sizeof(line)))
+    {
+        msg(D_PUSH_ERRORS, "WARNING: Received bad PUSH_UPDATE message");
+        goto cleanup;
+    }
+    c->c2.push_update_id = (unsigned int) strtoul(line, NULL, 10);
+
+    /* the options to apply, without the removals */
+    struct buffer opts = alloc_buf_gc(BLEN(&buf) + 1, &gc);
+    while (buf_parse(&buf, ',', line, sizeof(line)))
+    {
+        const unsigned int p = push_update_option_parts(line);
+        if (!p)
+        {
+            msg(D_PUSH_ERRORS, "WARNING: PUSH_UPDATE option cannot be updated: '%s'",
+                sanitize_control_message(line, &gc));
+            goto reply;
+        }
+        parts |= p;
+        if (line[0] != '-')
+        {
+            buf_printf(&opts, "%s%s", BLEN(&opts) ? "," : "", line);
+        }
+    }
+
+    /* what is put back if the update cannot be applied */
+    const struct options_pre_connect *saved = options_save_pulled(&c->options, &gc);
+    struct env_set *saved_es = env_set_create(&gc);
+    env_set_inherit(saved_es, c->c2.es);
+
+    options_reset_pulled(&c->options, c->options.pre_connect, parts, c->c2.es,
+                         &c->c2.gc);
+    if (apply_push_options(&c->options, &opts,
+                           pull_permission_mask(c) & (OPT_P_ROUTE | OPT_P_DHCPDNS),
+                           &option_types_found, c->c2.es)
+        && (!(parts & PULL_RESET_DNS) || options_postprocess_pull(&c->options, c->c2.es)))
+    {
+        installed = true;
+        ok = do_push_update(c, parts);
+    }
+    if (!ok)
+    {
+        options_reset_pulled(&c->options, saved, parts, c->c2.es, &c->c2.gc);
+        env_set_restore(c->c2.es, saved_es);
+        if (installed)
+        {
+            /* the routes or the device may be half updated, go back to
+             * the previous settings there as well */
+            do_push_update(c, parts);
+        }
+    }
+
+reply:
+    if (!ok)
+    {
+        msg(D_PUSH_ERRORS, "ERROR: Failed to apply PUSH_UPDATE %u", c->c2.push_update_id);
+    }
+    struct buffer ack = alloc_buf_gc(64, &gc);
+    buf_printf(&ack, "PUSH_UPDATE_%s,%u", ok ? "ACK" : "NACK", c->c2.push_update_id);
+    send_control_channel_string(c, BSTR(&ack), D_PUSH);
+
+cleanup:
+    gc_free(&gc);
+}
+
+void
+receive_push_update_ack(struct context *c, const struct buffer *buffer)
+{
+    struct buffer buf = *buffer;
+    int state = PUSH_UPDATE_ACKED;
+    char id[16];
+
+    if (!buf_string_compare_advance(&buf, "PUSH_UPDATE_ACK,"))
+    {
+        state = PUSH_UPDATE_FAILED;
+        if (!buf_string_compare_advance(&buf, "PUSH_UPDATE_NACK,"))
+        {
+            msg(D_PUSH_ERRORS, "WARNING: Received bad PUSH_UPDATE reply");
+            return;
+        }
+    }
+    buf_parse(&buf, ',', id, sizeof(id));
+
+    /* replies to an earlier update are of no interest anymore */
+    if (c->c2.push_update_state == PUSH_UPDATE_PENDING
+        && strtoul(id, NULL, 10) == c->c2.push_update_id)
+    {
+        c->c2.push_update_state = state;
+    }
+    msg(state == PUSH_UPDATE_ACKED ? D_PUSH_DEBUG : D_PUSH_ERRORS,
+        "PUSH_UPDATE %s was %s by the client", id,
+        state == PUSH_UPDATE_ACKED ? "applied" : "not applied");
+}
+
 /*
  * Push/Pull
  */
@@ -686,11 +809,28 @@ prepare_push_reply(struct context *c, struct gc_arena *gc,
         buf_printf(&proto_flags, " dyn-tls-crypt");
     }
 
+    if (o->imported_protocol_flags & CO_EPOCH_DATA_KEY_FORMAT)
+    {
+        buf_printf(&proto_flags, " aead-epoch-tag-first");
+    }
+
+    if (o->imported_protocol_flags & CO_MULTIPATH)
+    {
+        buf_printf(&proto_flags, " multipath");
+    }
+
     if (buf_len(&proto_flags) > 0)
     {
         push_option_fmt(gc, push_list, M_USAGE, "protocol-flags%s", buf_str(&proto_flags));
     }
 
+    /* multi_client_connect_late_setup() clears --fec for clients that
+     * cannot do it */
+    if (o->fec)
+    {
+        push_option_fmt(gc, push_list, M_USAGE, "fec %d", o->fec);
+    }
+
     /* Push our mtu to the peer if it supports pushable MTUs */
     int client_max_mtu = 0;
     const char *iv_mtu = extract_var_peer_info(tls_multi->peer_info, "IV_MTU=", gc);
@@ -710,10 +850,19 @@ prepare_push_reply(struct context *c, struct gc_arena *gc,
     return true;
 }
 
+/* extra space for possible trailing ifconfig and push-continuation */
+#define PUSH_REPLY_EXTRA 84
+
+/*
+ * Append the options of push_list to buf.  Full messages are sent to
+ * the client of c, or collected in cache when building the
+ * push_reply_cache.
+ */
 static bool
 send_push_options(struct context *c, struct buffer *buf,
                   struct push_list *push_list, int safe_cap,
-                  bool *push_sent, bool *multi_push)
+                  bool *push_sent, bool *multi_push,
+                  struct push_reply_cache *cache, struct gc_arena *gc)
 {
     struct push_entry *e = push_list->head;
 
@@ -725,17 +874,34 @@ send_push_options(struct context *c, struct buffer *buf,
             if (BLEN(buf) + l >= safe_cap)
             {
                 buf_printf(buf, ",push-continuation 2");
+                if (cache)
+                {
+                    struct push_entry *f;
+                    ALLOC_OBJ_CLEAR_GC(f, struct push_entry, gc);
+                    f->enable = true;
+                    f->option = string_alloc(BSTR(buf), gc);
+                    if (cache->fragments.tail)
+                    {
+                        cache->fragments.tail->next = f;
+                    }
+                    else
+                    {
+                        cache->fragments.head = f;
+                    }
+                    cache->fragments.tail = f;
+                }
+                else
                 {
                     const bool status = send_control_channel_string(c, BSTR(buf), D_PUSH);
                     if (!status)
                     {
                         return false;
                     }
-                    *push_sent = true;
-                    *multi_push = true;
-                    buf_reset_len(buf);
-                    buf_printf(buf, "%s", push_reply_cmd);
                 }
+                *push_sent = true;
+                *multi_push = true;
+                buf_reset_len(buf);
+                buf_printf(buf, "%s", push_reply_cmd);
             }
             if (BLEN(buf) + l >= safe_cap)
             {
@@ -775,22 +941,37 @@ send_push_reply(struct context *c, struct push_list *per_client_push_list)
     struct gc_arena gc = gc_new();
     struct buffer buf = alloc_buf_gc(PUSH_BUNDLE_SIZE, &gc);
     bool multi_push = false;
-    const int extra = 84; /* extra space for possible trailing ifconfig and push-continuation */
-    const int safe_cap = BCAP(&buf) - extra;
+    const int safe_cap = BCAP(&buf) - PUSH_REPLY_EXTRA;
     bool push_sent = false;
-
-    buf_printf(&buf, "%s", push_reply_cmd);
+    const struct push_reply_cache *cache = c->options.push_cache;
 
     /* send options which are common to all clients */
-    if (!send_push_options(c, &buf, &c->options.push_list, safe_cap,
-                           &push_sent, &multi_push))
+    if (cache)
     {
-        goto fail;
+        for (struct push_entry *e = cache->fragments.head; e; e = e->next)
+        {
+            if (!send_control_channel_string(c, e->option, D_PUSH))
+            {
+                goto fail;
+            }
+            push_sent = true;
+            multi_push = true;
+        }
+        buf_printf(&buf, "%s", cache->tail);
+    }
+    else
+    {
+        buf_printf(&buf, "%s", push_reply_cmd);
+        if (!send_push_options(c, &buf, &c->options.push_list, safe_cap,
+                               &push_sent, &multi_push, NULL, NULL))
+        {
+            goto fail;
+        }
     }
 
     /* send client-specific options */
     if (!send_push_options(c, &buf, per_client_push_list, safe_cap,
-                           &push_sent, &multi_push))
+                           &push_sent, &multi_push, NULL, NULL))
     {
         goto fail;
     }
@@ -826,6 +1007,8 @@ send_push_reply(struct context *c, struct push_list *per_client_push_list)
         }
     }
 
+    OVPN_PROBE3(push_reply, c->c2.tls_multi->peer_id, multi_push, cache != NULL);
+    tls_connect_phase_done(c->c2.tls_multi);
     gc_free(&gc);
     return true;
 
@@ -834,6 +1017,26 @@ fail:
     return false;
 }
 
+void
+push_reply_cache_init(struct options *o)
+{
+    struct gc_arena gc = gc_new();
+    struct push_reply_cache *cache;
+    struct buffer buf = alloc_buf_gc(PUSH_BUNDLE_SIZE, &gc);
+    const int safe_cap = BCAP(&buf) - PUSH_REPLY_EXTRA;
+    bool push_sent = false, multi_push = false;
+
+    ALLOC_OBJ_CLEAR_GC(cache, struct push_reply_cache, &o->gc);
+    buf_printf(&buf, "%s", push_reply_cmd);
+    if (send_push_options(NULL, &buf, &o->push_list, safe_cap,
+                          &push_sent, &multi_push, cache, &o->gc))
+    {
+        cache->tail = string_alloc(BSTR(&buf), &o->gc);
+        o->push_cache = cache;
+    }
+    gc_free(&gc);
+}
+
 static void
 push_option_ex(struct gc_arena *gc, struct push_list *push_list,
                const char *opt, bool enable, int msglevel)
@@ -846,7 +1049,7 @@ push_option_ex(struct gc_arena *gc, struct push_list *push_list,
     {
         struct push_entry *e;
         ALLOC_OBJ_CLEAR_GC(e, struct push_entry, gc);
-        e->enable = true;
+        e->enable = enable;
         e->option = opt;
         if (push_list->head)
         {
@@ -863,10 +1066,53 @@ push_option_ex(struct gc_arena *gc, struct push_list *push_list,
     }
 }
 
+/*
+ * A child context shares the push list entries of its parent until it
+ * changes them, most clients never do.  Make a private copy first.
+ */
+static void
+push_list_unshare(struct options *o)
+{
+    if (o->push_list_shared)
+    {
+        o->push_list_shared = false;
+        clone_push_list(o);
+    }
+}
+
+/*
+ * Returns the entry at the position of e in the private copy of the
+ * push list of o.
+ */
+static struct push_entry *
+push_entry_unshare(struct options *o, struct push_entry *e)
+{
+    if (!o->push_list_shared)
+    {
+        return e;
+    }
+
+    int pos = 0;
+    for (const struct push_entry *i = o->push_list.head; i != e; i = i->next)
+    {
+        ++pos;
+    }
+
+    push_list_unshare(o);
+    e = o->push_list.head;
+    while (pos--)
+    {
+        e = e->next;
+    }
+    return e;
+}
+
 void
 push_option(struct options *o, const char *opt, int msglevel)
 {
+    push_list_unshare(o);
     push_option_ex(&o->gc, &o->push_list, opt, true, msglevel);
+    o->push_cache = NULL;
 }
 
 void
@@ -874,14 +1120,17 @@ clone_push_list(struct options *o)
 {
     if (o->push_list.head)
     {
+        /* the copy has the same content, so the cache stays valid */
+        const struct push_reply_cache *cache = o->push_cache;
         const struct push_entry *e = o->push_list.head;
         push_reset(o);
         while (e)
         {
             push_option_ex(&o->gc, &o->push_list,
-                           string_alloc(e->option, &o->gc), true, M_FATAL);
+                           string_alloc(e->option, &o->gc), e->enable, M_FATAL);
             e = e->next;
         }
+        o->push_cache = cache;
     }
 }
 
@@ -915,6 +1164,37 @@ void
 push_reset(struct options *o)
 {
     CLEAR(o->push_list);
+    o->push_list_shared = false;
+    o->push_cache = NULL;
+}
+
+bool
+push_list_equal(const struct push_list *a, const struct push_list *b)
+{
+    const struct push_entry *ea = a->head;
+    const struct push_entry *eb = b->head;
+
+    while (true)
+    {
+        while (ea && !ea->enable)
+        {
+            ea = ea->next;
+        }
+        while (eb && !eb->enable)
+        {
+            eb = eb->next;
+        }
+        if (!ea || !eb)
+        {
+            return ea == eb;
+        }
+        if (strcmp(ea->option, eb->option) != 0)
+        {
+            return false;
+        }
+        ea = ea->next;
+        eb = eb->next;
+    }
 }
 
 void
@@ -947,7 +1227,9 @@ push_remove_option(struct options *o, const char *p)
                 && strncmp( e->option, p, strlen(p) ) == 0)
             {
                 msg(D_PUSH_DEBUG, "PUSH_REMOVE removing: '%s'", e->option);
+                e = push_entry_unshare(o, e);
                 e->enable = false;
+                o->push_cache = NULL;
             }
 
             e = e->next;
@@ -1001,16 +1283,48 @@ process_incoming_push_request(struct context *c)
     return ret;
 }
 
+/*
+ * Pushed options that may change on restart without affecting the tun
+ * device, its routes or DNS, and so should not trigger reopening tun.
+ * Where a split into push-continuation messages falls depends on the
+ * length of the auth-token, so ignore that as well.
+ */
+static const char *const push_digest_ignored[] = {
+    "peer-id ",
+    "auth-token ",
+    "auth-token-user ",
+    "push-continuation ",
+    "ping ",
+    "ping-restart ",
+    "ping-exit ",
+    "inactive ",
+    "session-timeout ",
+    "explicit-exit-notify",
+    "key-derivation ",
+    "protocol-flags ",
+};
+
+static bool
+push_digest_ignores(const char *line)
+{
+    for (size_t i = 0; i < SIZE(push_digest_ignored); ++i)
+    {
+        if (strprefix(line, push_digest_ignored[i]))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
 static void
-push_update_digest(md_ctx_t *ctx, struct buffer *buf, const struct options *opt)
+push_update_digest(md_ctx_t *ctx, md_ctx_t *routes_ctx, struct buffer *buf,
+                   const struct options *opt)
 {
     char line[OPTION_PARM_SIZE];
     while (buf_parse(buf, ',', line, sizeof(line)))
     {
-        /* peer-id and auth-token might change on restart and this should not trigger reopening tun */
-        if (strprefix(line, "peer-id ")
-            || strprefix(line, "auth-token ")
-            || strprefix(line, "auth-token-user "))
+        if (push_digest_ignores(line))
         {
             continue;
         }
@@ -1019,6 +1333,13 @@ push_update_digest(md_ctx_t *ctx, struct buffer *buf, const struct options *opt)
         {
             continue;
         }
+        /* with --persist-routes, a change of routes is handled without reopening tun */
+        if (opt->persist_routes
+            && (strprefix(line, "route ") || strprefix(line, "route-ipv6 ")))
+        {
+            md_ctx_update(routes_ctx, (const uint8_t *) line, strlen(line)+1);
+            continue;
+        }
         md_ctx_update(ctx, (const uint8_t *) line, strlen(line)+1);
     }
 }
@@ -1038,6 +1359,8 @@ process_incoming_push_reply(struct context *c,
         {
             c->c2.pulled_options_state = md_ctx_new();
             md_ctx_init(c->c2.pulled_options_state, "SHA256");
+            c->c2.pulled_routes_state = md_ctx_new();
+            md_ctx_init(c->c2.pulled_routes_state, "SHA256");
             c->c2.pulled_options_digest_init_done = true;
         }
         if (apply_push_options(&c->options,
@@ -1046,7 +1369,8 @@ process_incoming_push_reply(struct context *c,
                                option_types_found,
                                c->c2.es))
         {
-            push_update_digest(c->c2.pulled_options_state, &buf_orig,
+            push_update_digest(c->c2.pulled_options_state,
+                               c->c2.pulled_routes_state, &buf_orig,
                                &c->options);
             switch (c->options.push_continuation)
             {
@@ -1057,6 +1381,11 @@ process_incoming_push_reply(struct context *c,
                     md_ctx_cleanup(c->c2.pulled_options_state);
                     md_ctx_free(c->c2.pulled_options_state);
                     c->c2.pulled_options_state = NULL;
+                    md_ctx_final(c->c2.pulled_routes_state,
+                                 c->c2.pulled_routes_digest.digest);
+                    md_ctx_cleanup(c->c2.pulled_routes_state);
+                    md_ctx_free(c->c2.pulled_routes_state);
+                    c->c2.pulled_routes_state = NULL;
                     c->c2.pulled_options_digest_init_done = false;
                     ret = PUSH_MSG_REPLY;
                     break;
@@ -1174,10 +1503,12 @@ remove_iroutes_from_push_route_list(struct options *o)
                 }
 
                 /* should we copy the push item? */
-                e->enable = enable;
                 if (!enable)
                 {
+                    e = push_entry_unshare(o, e);
+                    e->enable = false;
                     msg(D_PUSH, "REMOVE PUSH ROUTE: '%s'", e->option);
+                    o->push_cache = NULL;
                 }
             }
 
@@ -68,8 +68,21 @@ void push_reset(struct options *o);
 
 void push_remove_option(struct options *o, const char *p);
 
+/**
+ * Returns true if both push lists send the same options.
+ */
+bool push_list_equal(const struct push_list *a, const struct push_list *b);
+
 void remove_iroutes_from_push_route_list(struct options *o);
 
+/**
+ * Format the push list of the server options once into PUSH_REPLY
+ * messages, so send_push_reply() only has to append the client specific
+ * options for clients that keep the server push list.  The cache lives
+ * in the options gc and is therefore rebuilt after a SIGHUP.
+ */
+void push_reply_cache_init(struct options *o);
+
 void send_auth_failed(struct context *c, const char *client_reason);
 
 /**
@@ -102,4 +115,59 @@ void send_push_reply_auth_token(struct tls_multi *multi);
 void
 receive_auth_pending(struct context *c, const struct buffer *buffer);
 
+/* state of the last PUSH_UPDATE sent to a client, see struct context_2 */
+#define PUSH_UPDATE_NONE     0
+#define PUSH_UPDATE_PENDING  1  /* sent, no reply yet */
+#define PUSH_UPDATE_ACKED    2  /* applied by the client */
+#define PUSH_UPDATE_FAILED   3  /* the client could not apply it */
+
+/**
+ * Returns the PULL_RESET_x part of the pulled options that an option of
+ * a PUSH_UPDATE replaces, or 0 if it cannot be updated.  A plain
+ * "-name" removes all options of that name.
+ *
+ * @param line      one option of the update
+ */
+unsigned int push_update_option_parts(const char *line);
+
+/**
+ * Formats a PUSH_UPDATE message, so that it can be sent to any number
+ * of clients.  Only --route, --route-ipv6, --dhcp-option and --dns can
+ * be updated; the options of an update replace all pulled options of
+ * the same name, and a plain "-name" removes them.
+ *
+ * @param buf       buffer of PUSH_BUNDLE_SIZE bytes for the message
+ * @param id        sequence number of the update
+ * @param options   comma separated options
+ * @return          false if the options cannot be updated or do not fit
+ */
+bool push_update_format(struct buffer *buf, unsigned int id, const char *options);
+
+/**
+ * Queues a message formatted by push_update_format() on the control
+ * channel of a client and waits for its reply.
+ *
+ * @param c         context of the client instance
+ * @param id        sequence number the message was formatted with
+ * @param message   the message
+ */
+void send_push_update(struct context *c, unsigned int id, const char *message);
+
+/**
+ * Applies a PUSH_UPDATE on a client and replies with PUSH_UPDATE_ACK or
+ * PUSH_UPDATE_NACK.
+ *
+ * @param c         The context struct
+ * @param buffer    Buffer containing the control message
+ */
+void receive_push_update(struct context *c, const struct buffer *buffer);
+
+/**
+ * Records the reply of a client to a PUSH_UPDATE on the server.
+ *
+ * @param c         context of the client instance
+ * @param buffer    Buffer containing the control message
+ */
+void receive_push_update_ack(struct context *c, const struct buffer *buffer);
+
 #endif /* ifndef PUSH_H */
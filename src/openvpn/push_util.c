@@ -0,0 +1,102 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "push.h"
+#include "options.h"
+
+#include "memdbg.h"
+
+/*
+ * The options a PUSH_UPDATE can carry and the part of the pulled
+ * options each of them replaces.
+ */
+static const struct {
+    const char *name;
+    unsigned int parts;
+} push_update_options[] = {
+    { "route", PULL_RESET_ROUTES },
+    { "route-ipv6", PULL_RESET_ROUTES_IPV6 },
+    { "dhcp-option", PULL_RESET_DNS },
+    { "dns", PULL_RESET_DNS },
+};
+
+unsigned int
+push_update_option_parts(const char *line)
+{
+    const bool remove = line[0] == '-';
+    if (remove)
+    {
+        ++line;
+    }
+
+    const size_t len = strcspn(line, " ");
+    if (remove && line[len] != '\0')
+    {
+        return 0;
+    }
+    for (size_t i = 0; i < SIZE(push_update_options); ++i)
+    {
+        if (strlen(push_update_options[i].name) == len
+            && !strncmp(line, push_update_options[i].name, len))
+        {
+            return push_update_options[i].parts;
+        }
+    }
+    return 0;
+}
+
+bool
+push_update_format(struct buffer *buf, unsigned int id, const char *options)
+{
+    struct buffer in;
+    char line[OPTION_PARM_SIZE];
+    bool empty = true;
+
+    buf_set_read(&in, (const uint8_t *) options, strlen(options));
+    if (!buf_printf(buf, "PUSH_UPDATE,%u", id))
+    {
+        return false;
+    }
+    while (buf_parse(&in, ',', line, sizeof(line)))
+    {
+        if (!push_update_option_parts(line))
+        {
+            msg(D_PUSH_ERRORS, "PUSH_UPDATE: option cannot be updated: '%s'", line);
+            return false;
+        }
+        if (!buf_printf(buf, ",%s", line))
+        {
+            msg(D_PUSH_ERRORS, "PUSH_UPDATE: options are longer than %d bytes",
+                PUSH_BUNDLE_SIZE);
+            return false;
+        }
+        empty = false;
+    }
+    return !empty;
+}
@@ -37,4 +37,12 @@ struct push_list {
     struct push_entry *tail;
 };
 
+/* the server-wide push list, preformatted into PUSH_REPLY messages */
+struct push_reply_cache {
+    struct push_list fragments; /* complete messages ending with
+                                 * push-continuation 2 */
+    const char *tail;           /* start of the last message, client
+                                 * specific options are appended to it */
+};
+
 #endif /* if !defined(PUSHLIST_H) */
@@ -36,6 +36,8 @@
 #include <memory.h>
 
 #include "crypto.h"
+#include "list.h"
+#include "socket.h"
 #include "reflect_filter.h"
 
 
@@ -103,3 +105,166 @@ initial_rate_limit_free(struct initial_packet_rate_limit *irl)
 {
     free(irl);
 }
+
+/* length of the key we hash: address family followed by the masked
+ * address */
+#define PREFIX_KEY_LEN (1 + 16)
+
+/*
+ * Fill key with the source prefix of from.  IPv4-mapped IPv6
+ * addresses are treated as IPv4.  Returns the prefix length used,
+ * or -1 for an unknown address family.
+ */
+static int
+prefix_rate_limit_key(const struct prefix_rate_limit *prl,
+                      const struct openvpn_sockaddr *from,
+                      uint8_t key[PREFIX_KEY_LEN])
+{
+    const uint8_t *addr;
+    int len, bits;
+
+    memset(key, 0, PREFIX_KEY_LEN);
+
+    if (from->addr.sa.sa_family == AF_INET)
+    {
+        addr = (const uint8_t *) &from->addr.in4.sin_addr.s_addr;
+        len = 4;
+    }
+    else if (from->addr.sa.sa_family == AF_INET6
+             && IN6_IS_ADDR_V4MAPPED(&from->addr.in6.sin6_addr))
+    {
+        addr = from->addr.in6.sin6_addr.s6_addr + 12;
+        len = 4;
+    }
+    else if (from->addr.sa.sa_family == AF_INET6)
+    {
+        addr = from->addr.in6.sin6_addr.s6_addr;
+        len = 16;
+    }
+    else
+    {
+        return -1;
+    }
+
+    bits = (len == 4) ? prl->ipv4_bits : prl->ipv6_bits;
+    key[0] = (uint8_t) len;
+    for (int i = 0; i < len && i * 8 < bits; i++)
+    {
+        uint8_t mask = 0xff;
+        if (bits - i * 8 < 8)
+        {
+            mask <<= 8 - (bits - i * 8);
+        }
+        key[1 + i] = addr[i] & mask;
+    }
+    return bits;
+}
+
+static void
+prefix_rate_limit_reset(struct prefix_rate_limit *prl)
+{
+    if (prl->dropped > 0)
+    {
+        msg(D_TLS_DEBUG_LOW, "Dropped %" PRId64 " initial handshake packets"
+            " due to --connect-freq-prefix %d %d", prl->dropped,
+            prl->max_per_period, prl->period_length);
+    }
+    memset(prl->count, 0, sizeof(prl->count));
+    prl->last_period_reset = now;
+    prl->dropped = 0;
+}
+
+bool
+reflect_filter_prefix_check(struct prefix_rate_limit *prl,
+                            const struct openvpn_sockaddr *from)
+{
+    uint8_t key[PREFIX_KEY_LEN];
+    int bits = prefix_rate_limit_key(prl, from, key);
+    if (bits < 0)
+    {
+        return true;
+    }
+
+    if (now > prl->last_period_reset + prl->period_length)
+    {
+        prefix_rate_limit_reset(prl);
+    }
+
+    int estimate = INT_MAX;
+    for (int i = 0; i < PREFIX_RATE_LIMIT_DEPTH; i++)
+    {
+        uint32_t h = hash_func(key, PREFIX_KEY_LEN, prl->seed[i]);
+        uint16_t *c = &prl->count[i][h & (PREFIX_RATE_LIMIT_WIDTH - 1)];
+        if (*c < UINT16_MAX)
+        {
+            (*c)++;
+        }
+        estimate = min_int(estimate, *c);
+    }
+
+    if (estimate <= prl->max_per_period)
+    {
+        return true;
+    }
+
+    /* warn once per prefix and period, when it crosses the limit */
+    prl->dropped++;
+    if (estimate == prl->max_per_period + 1)
+    {
+        struct gc_arena gc = gc_new();
+        msg(M_WARN, "Note: --connect-freq-prefix %d %d rate limit exceeded "
+            "by the /%d of %s, dropping its initial handshake packets for "
+            "the next %d seconds", prl->max_per_period, prl->period_length,
+            bits, print_openvpn_sockaddr_ex(from, "", PS_DONT_SHOW_FAMILY, &gc),
+            (int)(prl->last_period_reset + prl->period_length - now));
+        gc_free(&gc);
+    }
+    return false;
+}
+
+void
+reflect_filter_prefix_decrease(struct prefix_rate_limit *prl,
+                               const struct openvpn_sockaddr *from)
+{
+    uint8_t key[PREFIX_KEY_LEN];
+    if (prefix_rate_limit_key(prl, from, key) < 0)
+    {
+        return;
+    }
+
+    for (int i = 0; i < PREFIX_RATE_LIMIT_DEPTH; i++)
+    {
+        uint32_t h = hash_func(key, PREFIX_KEY_LEN, prl->seed[i]);
+        uint16_t *c = &prl->count[i][h & (PREFIX_RATE_LIMIT_WIDTH - 1)];
+        if (*c > 0 && *c < UINT16_MAX)
+        {
+            (*c)--;
+        }
+    }
+}
+
+struct prefix_rate_limit *
+prefix_rate_limit_init(int max_per_period, int period_length,
+                       int ipv4_bits, int ipv6_bits)
+{
+    struct prefix_rate_limit *prl;
+
+    ALLOC_OBJ_CLEAR(prl, struct prefix_rate_limit);
+
+    prl->max_per_period = max_per_period;
+    prl->period_length = period_length;
+    prl->ipv4_bits = ipv4_bits;
+    prl->ipv6_bits = ipv6_bits;
+    for (int i = 0; i < PREFIX_RATE_LIMIT_DEPTH; i++)
+    {
+        prl->seed[i] = get_random();
+    }
+
+    return prl;
+}
+
+void
+prefix_rate_limit_free(struct prefix_rate_limit *prl)
+{
+    free(prl);
+}
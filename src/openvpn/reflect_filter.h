@@ -72,4 +72,68 @@ initial_rate_limit_init(int max_per_period, int period_length);
  * free the initial-packet rate limiter structure
  */
 void initial_rate_limit_free(struct initial_packet_rate_limit *irl);
+
+struct openvpn_sockaddr;
+
+/** Number of rows in the per-prefix count-min sketch */
+#define PREFIX_RATE_LIMIT_DEPTH 4
+
+/** Number of counters per row, must be a power of two */
+#define PREFIX_RATE_LIMIT_WIDTH 4096
+
+/** struct that limits the initial responses per source prefix, so a
+ * single network cannot use up all of --connect-freq-initial */
+struct prefix_rate_limit {
+    /** maximum packets per period from one prefix */
+    int max_per_period;
+
+    /** period length in seconds */
+    int period_length;
+
+    /** prefix length used to group IPv4 and IPv6 sources */
+    int ipv4_bits;
+    int ipv6_bits;
+
+    /** Last time we reset our counters */
+    time_t last_period_reset;
+
+    /** packets dropped in the current period */
+    int64_t dropped;
+
+    /** hash seeds, one per row of the sketch */
+    uint32_t seed[PREFIX_RATE_LIMIT_DEPTH];
+
+    /** count-min sketch of the packets seen per prefix in the current
+     * period.  Estimates never undercount, so a prefix is never allowed
+     * more than max_per_period packets */
+    uint16_t count[PREFIX_RATE_LIMIT_DEPTH][PREFIX_RATE_LIMIT_WIDTH];
+};
+
+/**
+ * checks if the source prefix of from is still below its share of
+ * initial responses. This also increases the counter for the prefix.
+ */
+bool
+reflect_filter_prefix_check(struct prefix_rate_limit *prl,
+                            const struct openvpn_sockaddr *from);
+
+/**
+ * decreases the counter of the source prefix of from, used when a
+ * connection completes the three-way handshake
+ */
+void
+reflect_filter_prefix_decrease(struct prefix_rate_limit *prl,
+                               const struct openvpn_sockaddr *from);
+
+/**
+ * allocate and initialize the per-prefix rate limiter structure
+ */
+struct prefix_rate_limit *
+prefix_rate_limit_init(int max_per_period, int period_length,
+                       int ipv4_bits, int ipv6_bits);
+
+/**
+ * free the per-prefix rate limiter structure
+ */
+void prefix_rate_limit_free(struct prefix_rate_limit *prl);
 #endif /* ifndef REFLECT_FILTER_H */
@@ -39,6 +39,8 @@
 
 #include "memdbg.h"
 
+counter_type reliable_retransmits_global; /* GLOBAL */
+
 /* calculates test - base while allowing for base or test wraparound. test is
  * assumed to be higher than base */
 static inline packet_id_type
@@ -357,19 +359,14 @@ done:
 void
 reliable_init(struct reliable *rel, int buf_size, int offset, int array_size, bool hold)
 {
-    int i;
-
     CLEAR(*rel);
     ASSERT(array_size > 0 && array_size <= RELIABLE_CAPACITY);
     rel->hold = hold;
     rel->size = array_size;
     rel->offset = offset;
-    for (i = 0; i < rel->size; ++i)
-    {
-        struct reliable_entry *e = &rel->array[i];
-        e->buf = alloc_buf(buf_size);
-        ASSERT(buf_init(&e->buf, offset));
-    }
+    rel->buf_size = buf_size;
+    /* the buffers are allocated by reliable_get_buf() when first needed,
+     * most handshakes use only a few of them */
 }
 
 void
@@ -388,6 +385,18 @@ reliable_free(struct reliable *rel)
     free(rel);
 }
 
+size_t
+reliable_mem_usage(const struct reliable *rel)
+{
+    size_t bytes = sizeof(*rel);
+
+    for (int i = 0; i < RELIABLE_CAPACITY; ++i)
+    {
+        bytes += buf_mem_usage(&rel->array[i].buf);
+    }
+    return bytes;
+}
+
 /* no active buffers? */
 bool
 reliable_empty(const struct reliable *rel)
@@ -404,6 +413,43 @@ reliable_empty(const struct reliable *rel)
     return true;
 }
 
+/*
+ * Update the round trip time estimate with a new sample and derive the
+ * retransmit timeout from it as described in RFC 6298.  Our timers have
+ * a granularity of one second, which is also the lower bound RFC 6298
+ * recommends for the RTO.
+ */
+static void
+reliable_rtt_sample(struct reliable *rel, const struct timeval *sent)
+{
+    struct timeval tv;
+    openvpn_gettimeofday(&tv, NULL);
+
+    int rtt_ms = (int)((tv.tv_sec - sent->tv_sec) * 1000
+                       + (tv.tv_usec - sent->tv_usec) / 1000);
+    if (rtt_ms < 0)
+    {
+        return;
+    }
+
+    if (!rel->srtt_ms)
+    {
+        rel->srtt_ms = max_int(rtt_ms, 1);
+        rel->rttvar_ms = rtt_ms / 2;
+    }
+    else
+    {
+        rel->rttvar_ms += (abs(rel->srtt_ms - rtt_ms) - rel->rttvar_ms) / 4;
+        rel->srtt_ms = max_int(rel->srtt_ms + (rtt_ms - rel->srtt_ms) / 8, 1);
+    }
+
+    int rto_ms = rel->srtt_ms + max_int(1000, 4 * rel->rttvar_ms);
+    rel->rto = constrain_int((rto_ms + 999) / 1000, 1, RELIABLE_MAX_TIMEOUT);
+
+    dmsg(D_REL_DEBUG, "ACK RTT sample %d ms, srtt=%d rttvar=%d rto=%d",
+         rtt_ms, rel->srtt_ms, rel->rttvar_ms, (int)rel->rto);
+}
+
 /* del acknowledged items from send buf */
 void
 reliable_send_purge(struct reliable *rel, const struct reliable_ack *ack)
@@ -430,6 +476,10 @@ reliable_send_purge(struct reliable *rel, const struct reliable_ack *ack)
                     }
                 }
 #endif
+                if (e->n_sent == 1)
+                {
+                    reliable_rtt_sample(rel, &e->sent);
+                }
                 e->active = false;
             }
             else if (e->active && e->packet_id < pid)
@@ -541,6 +591,10 @@ reliable_get_buf(struct reliable *rel)
         struct reliable_entry *e = &rel->array[i];
         if (!e->active)
         {
+            if (!e->buf.data)
+            {
+                e->buf = alloc_buf(rel->buf_size);
+            }
             ASSERT(buf_init(&e->buf, rel->offset));
             return &e->buf;
         }
@@ -548,6 +602,22 @@ reliable_get_buf(struct reliable *rel)
     return NULL;
 }
 
+int
+reliable_compact(struct reliable *rel)
+{
+    int freed = 0;
+    for (int i = 0; i < rel->size; ++i)
+    {
+        struct reliable_entry *e = &rel->array[i];
+        if (!e->active && e->buf.data)
+        {
+            freed += e->buf.capacity;
+            free_buf(&e->buf);
+        }
+    }
+    return freed;
+}
+
 int
 reliable_get_num_output_sequenced_available(struct reliable *rel)
 {
@@ -684,9 +754,18 @@ reliable_send(struct reliable *rel, int *opcode)
     }
     if (best)
     {
+        if (best->n_sent++ == 0)
+        {
+            openvpn_gettimeofday(&best->sent, NULL);
+        }
+        else
+        {
+            ++reliable_retransmits_global;
+        }
         /* exponential backoff */
         best->next_try = local_now + best->timeout;
-        best->timeout *= 2;
+        best->timeout = min_int(best->timeout * 2,
+                                max_int(RELIABLE_MAX_TIMEOUT, rel->initial_timeout));
         best->n_acks = 0;
         *opcode = best->opcode;
         dmsg(D_REL_DEBUG, "ACK reliable_send ID " packet_id_format " (size=%d to=%d)",
@@ -710,7 +789,7 @@ reliable_schedule_now(struct reliable *rel)
         if (e->active)
         {
             e->next_try = now;
-            e->timeout = rel->initial_timeout;
+            e->timeout = reliable_get_timeout(rel);
         }
     }
 }
@@ -805,7 +884,9 @@ reliable_mark_active_outgoing(struct reliable *rel, struct buffer *buf, int opco
             e->active = true;
             e->opcode = opcode;
             e->next_try = 0;
-            e->timeout = rel->initial_timeout;
+            e->n_sent = 0;
+            e->n_acks = 0;
+            e->timeout = reliable_get_timeout(rel);
             dmsg(D_REL_DEBUG, "ACK mark active outgoing ID " packet_id_format, (packet_id_print_type)e->packet_id);
             return;
         }
@@ -54,6 +54,10 @@
                                  *   this many later packets have been
                                  *   ACKed. */
 
+#define RELIABLE_MAX_TIMEOUT 60 /**< Upper bound in seconds for the
+                                 *   retransmit timeout derived from the
+                                 *   measured round trip time. */
+
 /**
  * The acknowledgment structure in which packet IDs are stored for later
  * acknowledgment.
@@ -80,6 +84,10 @@ struct reliable_entry
     size_t n_acks;  /* Number of acks received for packets with higher PID.
                      * Used for fast retransmission when there were at least
                      * N_ACK_RETRANSMIT. */
+    int n_sent;     /* Number of times the packet was sent, only packets
+                     * ACKed after their first transmission are used to
+                     * sample the RTT (Karn's algorithm) */
+    struct timeval sent;    /* time of the first transmission */
     int opcode;
     struct buffer buf;
 };
@@ -91,13 +99,23 @@ struct reliable_entry
 struct reliable
 {
     int size;
-    interval_t initial_timeout;
+    interval_t initial_timeout; /**< retransmit timeout until the RTT
+                                 *   has been measured (--tls-timeout) */
+    int srtt_ms;    /**< smoothed round trip time, 0 if not measured yet */
+    int rttvar_ms;  /**< round trip time variation */
+    interval_t rto; /**< retransmit timeout derived from srtt_ms and
+                     *   rttvar_ms as in RFC 6298, 0 if not measured yet */
     packet_id_type packet_id;
     int offset; /**< Offset of the bufs in the reliable_entry array */
+    int buf_size; /**< Capacity of the bufs, used to allocate them on
+                   *   first use and after reliable_compact() */
     bool hold; /* don't xmit until reliable_schedule_now is called */
     struct reliable_entry array[RELIABLE_CAPACITY];
 };
 
+/** Control channel packets sent again because no ACK arrived in time. */
+extern counter_type reliable_retransmits_global;
+
 
 /**************************************************************************/
 /** @name Functions for processing incoming acknowledgments
@@ -226,7 +244,8 @@ bool reliable_ack_write(struct reliable_ack *ack,
  *  @{ */
 
 /**
- * Initialize a reliable structure.
+ * Initialize a reliable structure.  The packet buffers are only
+ * allocated when \c reliable_get_buf() first hands them out.
  *
  * @param rel The reliable structure to initialize.
  * @param buf_size The size of the buffers in which packets will be
@@ -248,6 +267,12 @@ void reliable_init(struct reliable *rel, int buf_size, int offset, int array_siz
  */
 void reliable_free(struct reliable *rel);
 
+/**
+ * Returns the bytes of heap memory used by a reliable structure,
+ * including its packet buffers.
+ */
+size_t reliable_mem_usage(const struct reliable *rel);
+
 /** @} name Functions for initialization and cleanup */
 
 
@@ -329,6 +354,16 @@ bool reliable_ack_read_packet_id(struct buffer *buf, packet_id_type *pid);
  */
 struct buffer *reliable_get_buf(struct reliable *rel);
 
+/**
+ * Free the buffers of all free %reliable entries.  They are allocated
+ * again by \c reliable_get_buf() when needed.
+ *
+ * @param rel The reliable structure to compact.
+ *
+ * @return The number of bytes freed.
+ */
+int reliable_compact(struct reliable *rel);
+
 /**
  * Mark the %reliable entry associated with the given buffer as active
  * incoming.
@@ -533,6 +568,13 @@ reliable_set_timeout(struct reliable *rel, interval_t timeout)
     rel->initial_timeout = timeout;
 }
 
+/* timeout for the first retransmission of a packet */
+static inline interval_t
+reliable_get_timeout(const struct reliable *rel)
+{
+    return rel->rto ? rel->rto : rel->initial_timeout;
+}
+
 /* print a reliable ACK record coming off the wire */
 const char *reliable_ack_print(struct buffer *buf, bool verbose, struct gc_arena *gc);
 
@@ -0,0 +1,710 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "replica.h"
+#include "errlevel.h"
+#include "fdmisc.h"
+#include "options.h"
+#include "otime.h"
+
+#include "memdbg.h"
+
+/*
+ * The receiver starts every connection with a greeting of a magic, a
+ * version and its nonce.  The sender answers with the clients it has
+ * and then keeps the receiver up to date with messages of the form
+ *
+ *   length (4) | type (1) | payload | HMAC-SHA256 (32)
+ *
+ * where the length counts type and payload, and the HMAC covers the
+ * nonce, the message number (8) and everything before the HMAC itself.
+ * The payload of REPLICA_ADD is a handoff_client_write() record, so the
+ * version changes along with that record.
+ */
+#define REPLICA_MAGIC      "OVPNREPL"
+#define REPLICA_VERSION    1
+#define REPLICA_GREET_LEN  (8 + 4 + REPLICA_NONCE_LEN)
+#define REPLICA_HMAC_LEN   32
+#define REPLICA_MSG_MAX    (4 + 1 + HANDOFF_CLIENT_MAX + REPLICA_HMAC_LEN)
+
+#define REPLICA_ADD 1
+#define REPLICA_DEL 2
+
+/* seconds between connection attempts to --replicate-peer */
+#define REPLICA_RETRY 10
+
+/* messages queued for a peer that does not read them, before we give
+ * up on the connection; enough for a snapshot of a large server */
+#define REPLICA_QUEUE_MAX 131072
+
+static uint32_t
+replica_hash_function(const void *key, uint32_t iv)
+{
+    const char *cn = key;
+    return hash_func((const uint8_t *) cn, (uint32_t) strlen(cn), iv);
+}
+
+static bool
+replica_compare_function(const void *key1, const void *key2)
+{
+    return !strcmp((const char *) key1, (const char *) key2);
+}
+
+static void
+replica_entry_free(struct replica_entry *e)
+{
+    gc_free(&e->gc);
+    free(e);
+}
+
+static void
+replica_remove(struct replica *r, const char *common_name)
+{
+    struct replica_entry *e = hash_lookup(r->entries, common_name);
+    if (e)
+    {
+        hash_remove(r->entries, common_name);
+        replica_entry_free(e);
+    }
+}
+
+/*
+ * Connections
+ */
+
+static void
+replica_link_init(struct replica_link *l)
+{
+    CLEAR(*l);
+    l->sd = SOCKET_UNDEFINED;
+}
+
+static void
+replica_link_open(struct replica_link *l, socket_descriptor_t sd,
+                  bool connecting)
+{
+    replica_link_init(l);
+    l->sd = sd;
+    l->connecting = connecting;
+    l->in = alloc_buf(REPLICA_MSG_MAX);
+    l->out = buffer_list_new();
+}
+
+static void
+replica_link_close(struct replica_link *l)
+{
+    if (socket_defined(l->sd))
+    {
+        openvpn_close_socket(l->sd);
+    }
+    free_buf(&l->in);
+    buffer_list_free(l->out);
+    replica_link_init(l);
+}
+
+/* The peer that sent our entries went away, they now age out */
+static void
+replica_peer_lost(struct replica *r)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    replica_link_close(&r->from);
+
+    hash_iterator_init(r->entries, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct replica_entry *e = he->value;
+        if (!e->expires)
+        {
+            e->expires = now + r->ttl;
+        }
+    }
+    hash_iterator_free(&hi);
+}
+
+static void
+replica_expire(struct replica *r)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(r->entries, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct replica_entry *e = he->value;
+        if (e->expires && e->expires <= now)
+        {
+            hash_iterator_delete_element(&hi);
+            replica_entry_free(e);
+        }
+    }
+    hash_iterator_free(&hi);
+}
+
+static void
+replica_mac(struct replica *r, const struct replica_link *l,
+            const uint8_t *data, int len, uint8_t *mac)
+{
+    uint8_t seq[8];
+
+    for (int i = 0; i < 8; ++i)
+    {
+        seq[i] = (uint8_t) (l->seq >> (56 - 8 * i));
+    }
+    hmac_ctx_reset(r->hmac);
+    hmac_ctx_update(r->hmac, l->nonce, REPLICA_NONCE_LEN);
+    hmac_ctx_update(r->hmac, seq, sizeof(seq));
+    hmac_ctx_update(r->hmac, data, len);
+    hmac_ctx_final(r->hmac, mac);
+}
+
+/* Send what is queued until the socket is full */
+static bool
+replica_flush(struct replica_link *l)
+{
+    struct buffer *buf;
+
+    while ((buf = buffer_list_peek(l->out)))
+    {
+        const ssize_t n = send(l->sd, BPTR(buf), BLEN(buf), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            return ignore_sys_error(openvpn_errno(), false);
+        }
+        buffer_list_advance(l->out, (int) n);
+    }
+    return true;
+}
+
+/* Receive until the socket is empty, false on error or end of file */
+static bool
+replica_recv(struct replica_link *l)
+{
+    while (BCAP(&l->in) > 0)
+    {
+        const ssize_t n = recv(l->sd, BEND(&l->in), BCAP(&l->in), MSG_NOSIGNAL);
+        if (n == 0)
+        {
+            return false;
+        }
+        if (n < 0)
+        {
+            return ignore_sys_error(openvpn_errno(), false);
+        }
+        ASSERT(buf_inc_len(&l->in, (int) n));
+    }
+    return true;
+}
+
+/*
+ * Sender, --replicate-peer
+ */
+
+static void
+replica_connect(struct replica *r, struct addrinfo *ai)
+{
+    for (; ai; ai = ai->ai_next)
+    {
+        const socket_descriptor_t sd = create_socket_tcp(ai);
+        set_nonblock(sd);
+        set_cloexec(sd);
+        if (connect(sd, ai->ai_addr, (socklen_t) ai->ai_addrlen) == 0
+            || ignore_sys_error(openvpn_errno(), false)
+            || openvpn_errno() == EINPROGRESS)
+        {
+            replica_link_open(&r->to, sd, true);
+            return;
+        }
+        openvpn_close_socket(sd);
+    }
+}
+
+/* true once the greeting of the receiver is in */
+static bool
+replica_sender_process(struct replica *r)
+{
+    struct replica_link *l = &r->to;
+
+    if (!socket_defined(l->sd))
+    {
+        if (now >= r->next_connect)
+        {
+            struct addrinfo *ai = NULL;
+            r->next_connect = now + REPLICA_RETRY;
+            if (openvpn_getaddrinfo(GETADDR_RESOLVE, r->peer_host, r->peer_port,
+                                    0, NULL, AF_UNSPEC, &ai) == 0)
+            {
+                replica_connect(r, ai);
+                freeaddrinfo(ai);
+            }
+        }
+        return false;
+    }
+
+    if (l->connecting)
+    {
+        /* SO_ERROR tells about a failure, getpeername() about success */
+        struct openvpn_sockaddr addr;
+        socklen_t len = sizeof(int);
+        int err = 0;
+        if (getsockopt(l->sd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) < 0
+            || err)
+        {
+            replica_link_close(l);
+            return false;
+        }
+        len = sizeof(addr.addr);
+        if (getpeername(l->sd, &addr.addr.sa, &len) < 0)
+        {
+            return false;
+        }
+        l->connecting = false;
+    }
+
+    if (!l->ready)
+    {
+        if (!replica_recv(l))
+        {
+            msg(M_WARN, "replicate-peer: connection to %s closed",
+                r->peer_host);
+            replica_link_close(l);
+            return false;
+        }
+        if (BLEN(&l->in) < REPLICA_GREET_LEN)
+        {
+            return false;
+        }
+        uint32_t version;
+        memcpy(&version, BPTR(&l->in) + 8, sizeof(version));
+        if (memcmp(BPTR(&l->in), REPLICA_MAGIC, 8)
+            || ntohl(version) != REPLICA_VERSION)
+        {
+            msg(M_WARN, "replicate-peer: %s is not a --replicate-listen of "
+                "this version", r->peer_host);
+            replica_link_close(l);
+            return false;
+        }
+        memcpy(l->nonce, BPTR(&l->in) + 12, REPLICA_NONCE_LEN);
+        l->ready = true;
+        msg(M_INFO, "replicate-peer: connected to %s", r->peer_host);
+        return true;
+    }
+
+    if (!replica_flush(l))
+    {
+        msg(M_WARN | M_ERRNO, "replicate-peer: connection to %s lost",
+            r->peer_host);
+        replica_link_close(l);
+    }
+    return false;
+}
+
+static void
+replica_send(struct replica *r, uint8_t type, const struct buffer *payload)
+{
+    struct replica_link *l = &r->to;
+    uint8_t mac[REPLICA_HMAC_LEN];
+
+    if (!l->ready)
+    {
+        return;
+    }
+    if (l->out->size >= REPLICA_QUEUE_MAX)
+    {
+        msg(M_WARN, "replicate-peer: %s does not keep up, reconnecting",
+            r->peer_host);
+        replica_link_close(l);
+        return;
+    }
+
+    struct buffer frame = alloc_buf(REPLICA_MSG_MAX);
+    buf_write_u32(&frame, (uint32_t) (1 + BLEN(payload)));
+    buf_write_u8(&frame, type);
+    buf_copy(&frame, payload);
+    replica_mac(r, l, BPTR(&frame), BLEN(&frame), mac);
+    buf_write(&frame, mac, sizeof(mac));
+    ++l->seq;
+
+    buffer_list_push_data(l->out, BPTR(&frame), BLEN(&frame));
+    free_buf(&frame);
+
+    if (!replica_flush(l))
+    {
+        msg(M_WARN | M_ERRNO, "replicate-peer: connection to %s lost",
+            r->peer_host);
+        replica_link_close(l);
+    }
+}
+
+void
+replica_client_up(struct replica *r, const struct handoff_client *hc)
+{
+    if (!r || !r->to.ready || !hc->common_name)
+    {
+        return;
+    }
+
+    struct buffer payload = alloc_buf(HANDOFF_CLIENT_MAX);
+    handoff_client_write(&payload, hc);
+    if (BLEN(&payload) >= HANDOFF_CLIENT_MAX)
+    {
+        msg(M_WARN, "replicate-peer: client %s does not fit into a message",
+            hc->common_name);
+    }
+    else
+    {
+        replica_send(r, REPLICA_ADD, &payload);
+    }
+    free_buf(&payload);
+}
+
+void
+replica_client_down(struct replica *r, const char *common_name)
+{
+    if (!r || !r->to.ready || !common_name)
+    {
+        return;
+    }
+
+    struct buffer payload;
+    buf_set_read(&payload, (const uint8_t *) common_name, strlen(common_name));
+    replica_send(r, REPLICA_DEL, &payload);
+}
+
+/*
+ * Receiver, --replicate-listen
+ */
+
+static void
+replica_accept(struct replica *r)
+{
+    struct openvpn_sockaddr remote;
+    socklen_t len = sizeof(remote.addr);
+
+    CLEAR(remote);
+    const socket_descriptor_t sd = accept(r->listen_sd, &remote.addr.sa, &len);
+    if (!socket_defined(sd))
+    {
+        return;
+    }
+    set_nonblock(sd);
+    set_cloexec(sd);
+
+    /* a candidate until its first message proves it knows the secret */
+    replica_link_close(&r->pending);
+    replica_link_open(&r->pending, sd, false);
+    rand_bytes(r->pending.nonce, REPLICA_NONCE_LEN);
+    r->pending.ready = true;
+
+    struct buffer greet = alloc_buf(REPLICA_GREET_LEN);
+    buf_write(&greet, REPLICA_MAGIC, 8);
+    buf_write_u32(&greet, REPLICA_VERSION);
+    buf_write(&greet, r->pending.nonce, REPLICA_NONCE_LEN);
+    buffer_list_push_data(r->pending.out, BPTR(&greet), BLEN(&greet));
+    free_buf(&greet);
+
+    struct gc_arena gc = gc_new();
+    msg(M_INFO, "replicate-listen: connection from %s",
+        print_sockaddr(&remote.addr.sa, &gc));
+    gc_free(&gc);
+
+    if (!replica_flush(&r->pending))
+    {
+        replica_link_close(&r->pending);
+    }
+}
+
+/*
+ * Check the first message of the candidate connection.  Once it is
+ * authentic, the candidate becomes the current active server and the
+ * message is processed by replica_receiver_process() as any other.
+ * Returns false if the candidate is to be dropped.
+ */
+static bool
+replica_candidate_process(struct replica *r)
+{
+    struct replica_link *l = &r->pending;
+    const bool ret = replica_recv(l);
+
+    if (BLEN(&l->in) >= 4)
+    {
+        const uint8_t *data = BPTR(&l->in);
+        uint8_t mac[REPLICA_HMAC_LEN];
+        uint32_t len;
+
+        memcpy(&len, data, sizeof(len));
+        len = ntohl(len);
+        if (len < 1 || len > HANDOFF_CLIENT_MAX)
+        {
+            msg(M_WARN, "replicate-listen: bad message length");
+            return false;
+        }
+        if (BLEN(&l->in) >= (int) (4 + len + REPLICA_HMAC_LEN))
+        {
+            replica_mac(r, l, data, 4 + len, mac);
+            if (memcmp_constant_time(mac, data + 4 + len, REPLICA_HMAC_LEN))
+            {
+                msg(M_WARN, "replicate-listen: message authentication failed, "
+                    "check --replicate-secret");
+                return false;
+            }
+
+            /* the new connection is the current active server */
+            if (socket_defined(r->from.sd))
+            {
+                replica_peer_lost(r);
+            }
+            r->from = *l;
+            replica_link_init(l);
+            return true;
+        }
+    }
+
+    return ret && replica_flush(l);
+}
+
+static bool
+replica_apply(struct replica *r, struct ifconfig_pool *pool, uint8_t type,
+              struct buffer *payload)
+{
+    if (type == REPLICA_DEL)
+    {
+        struct gc_arena gc = gc_new();
+        char *cn = gc_malloc(BLEN(payload) + 1, true, &gc);
+        memcpy(cn, BPTR(payload), BLEN(payload));
+        replica_remove(r, cn);
+        gc_free(&gc);
+        return true;
+    }
+    else if (type == REPLICA_ADD)
+    {
+        struct replica_entry *e;
+
+        ALLOC_OBJ_CLEAR(e, struct replica_entry);
+        e->gc = gc_new();
+        if (!handoff_client_read(payload, &e->hc, &e->gc)
+            || !e->hc.common_name)
+        {
+            replica_entry_free(e);
+            return false;
+        }
+        replica_remove(r, e->hc.common_name);
+        hash_add(r->entries, e->hc.common_name, e, false);
+
+        if (e->hc.pool_handle >= 0
+            && !ifconfig_pool_reserve(pool, e->hc.common_name,
+                                      e->hc.ifconfig_defined ? e->hc.ifconfig_local : 0,
+                                      e->hc.ifconfig_ipv6_defined ? &e->hc.ifconfig_ipv6_local : NULL))
+        {
+            msg(D_MULTI_LOW, "replicate-listen: address of %s is not free here",
+                e->hc.common_name);
+        }
+        return true;
+    }
+    return false;
+}
+
+/* Process the complete messages that were received */
+static bool
+replica_receiver_process(struct replica *r, struct ifconfig_pool *pool)
+{
+    struct replica_link *l = &r->from;
+    bool ret = replica_recv(l);
+
+    while (BLEN(&l->in) >= 4)
+    {
+        const uint8_t *data = BPTR(&l->in);
+        uint8_t mac[REPLICA_HMAC_LEN];
+        uint32_t len;
+
+        memcpy(&len, data, sizeof(len));
+        len = ntohl(len);
+        if (len < 1 || len > HANDOFF_CLIENT_MAX)
+        {
+            msg(M_WARN, "replicate-listen: bad message length");
+            return false;
+        }
+        if (BLEN(&l->in) < (int) (4 + len + REPLICA_HMAC_LEN))
+        {
+            break;
+        }
+
+        replica_mac(r, l, data, 4 + len, mac);
+        if (memcmp_constant_time(mac, data + 4 + len, REPLICA_HMAC_LEN))
+        {
+            msg(M_WARN, "replicate-listen: message authentication failed, "
+                "check --replicate-secret");
+            return false;
+        }
+        ++l->seq;
+
+        struct buffer payload;
+        buf_set_read(&payload, data + 5, len - 1);
+        if (!replica_apply(r, pool, data[4], &payload))
+        {
+            msg(M_WARN, "replicate-listen: malformed message");
+            return false;
+        }
+        buf_advance(&l->in, 4 + len + REPLICA_HMAC_LEN);
+    }
+
+    /* keep the start of the next message at the front */
+    memmove(l->in.data, BPTR(&l->in), BLEN(&l->in));
+    l->in.offset = 0;
+
+    return ret && replica_flush(l);
+}
+
+/*
+ * Setup and polling
+ */
+
+struct replica *
+replica_new(const struct options *o)
+{
+    struct replica *r;
+    struct key2 key2;
+
+    if (!o->replicate_peer_host && !o->replicate_listen_host)
+    {
+        return NULL;
+    }
+
+    ALLOC_OBJ_CLEAR(r, struct replica);
+    replica_link_init(&r->to);
+    replica_link_init(&r->from);
+    replica_link_init(&r->pending);
+    r->listen_sd = SOCKET_UNDEFINED;
+    r->peer_host = o->replicate_peer_host;
+    r->peer_port = o->replicate_peer_port;
+    r->ttl = o->replicate_ttl;
+    r->entries = hash_init(256, get_random(), replica_hash_function,
+                           replica_compare_function);
+
+    read_key_file(&key2, o->replicate_secret, RKF_MUST_SUCCEED);
+    r->hmac = hmac_ctx_new();
+    hmac_ctx_init(r->hmac, key2.keys[0].hmac, "SHA256");
+    secure_memzero(&key2, sizeof(key2));
+
+    if (o->replicate_listen_host)
+    {
+        struct addrinfo *ai = NULL;
+        openvpn_getaddrinfo(GETADDR_RESOLVE | GETADDR_PASSIVE | GETADDR_FATAL,
+                            o->replicate_listen_host, o->replicate_listen_port,
+                            0, NULL, AF_UNSPEC, &ai);
+        r->listen_sd = create_socket_tcp(ai);
+        socket_bind(r->listen_sd, ai, ai->ai_family, "replicate-listen", false);
+        freeaddrinfo(ai);
+        if (listen(r->listen_sd, 1))
+        {
+            msg(M_ERR, "replicate-listen: listen() failed");
+        }
+        set_nonblock(r->listen_sd);
+        set_cloexec(r->listen_sd);
+    }
+    return r;
+}
+
+void
+replica_free(struct replica *r)
+{
+    if (!r)
+    {
+        return;
+    }
+
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(r->entries, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct replica_entry *e = he->value;
+        hash_iterator_delete_element(&hi);
+        replica_entry_free(e);
+    }
+    hash_iterator_free(&hi);
+    hash_free(r->entries);
+
+    replica_link_close(&r->to);
+    replica_link_close(&r->from);
+    replica_link_close(&r->pending);
+    if (socket_defined(r->listen_sd))
+    {
+        openvpn_close_socket(r->listen_sd);
+    }
+    hmac_ctx_cleanup(r->hmac);
+    hmac_ctx_free(r->hmac);
+    free(r);
+}
+
+bool
+replica_process(struct replica *r, struct ifconfig_pool *pool)
+{
+    bool snapshot = false;
+
+    if (!r)
+    {
+        return false;
+    }
+
+    if (r->peer_host)
+    {
+        snapshot = replica_sender_process(r);
+    }
+
+    if (socket_defined(r->listen_sd))
+    {
+        /* before a new connection can take the place of the candidate */
+        if (socket_defined(r->pending.sd) && !replica_candidate_process(r))
+        {
+            replica_link_close(&r->pending);
+        }
+        replica_accept(r);
+        if (socket_defined(r->from.sd) && !replica_receiver_process(r, pool))
+        {
+            msg(M_INFO, "replicate-listen: active server gone, keeping its "
+                "clients for %d seconds", r->ttl);
+            replica_peer_lost(r);
+        }
+        replica_expire(r);
+    }
+    return snapshot;
+}
+
+const struct replica_entry *
+replica_lookup(struct replica *r, const char *common_name)
+{
+    if (!r || !common_name)
+    {
+        return NULL;
+    }
+    return hash_lookup(r->entries, common_name);
+}
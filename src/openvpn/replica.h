@@ -0,0 +1,122 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef REPLICA_H
+#define REPLICA_H
+
+/**
+ * @file
+ * Sharing the connected clients with a standby server, for
+ * --replicate-peer and --replicate-listen.
+ *
+ * The active server sends its peer a summary of every client once the
+ * client-connect handlers are done with it, and a note when it goes
+ * away.  The summary holds what those handlers decided: common name,
+ * username, virtual addresses, --iroute, --acl and --vlan-pvid.  The
+ * standby reserves the addresses in its own pool, and when one of these
+ * clients comes back with a valid auth-token after a failover, it takes
+ * the summary instead of running the plugins, the --client-connect
+ * script and the management approval again.  No keys are ever sent.
+ *
+ * Messages are authenticated with HMAC-SHA256 over a nonce that the
+ * receiver picks for every connection and a message counter, with the
+ * key from --replicate-secret.  They are not encrypted.
+ */
+
+#include "buffer.h"
+#include "crypto.h"
+#include "handoff.h"
+#include "list.h"
+#include "options.h"
+#include "pool.h"
+#include "socket.h"
+
+#define REPLICA_NONCE_LEN 16
+
+/** A client of the peer server */
+struct replica_entry
+{
+    struct gc_arena gc;
+    struct handoff_client hc;
+    time_t expires;             /**< 0 as long as the peer is connected */
+};
+
+/** One replication connection */
+struct replica_link
+{
+    socket_descriptor_t sd;
+    bool connecting;            /**< non-blocking connect() in progress */
+    bool ready;                 /**< the nonce is known */
+    uint8_t nonce[REPLICA_NONCE_LEN];
+    uint64_t seq;               /**< number of the next message */
+    struct buffer in;           /**< received data not yet processed */
+    struct buffer_list *out;    /**< data not yet sent */
+};
+
+struct replica
+{
+    hmac_ctx_t *hmac;
+
+    /* --replicate-peer */
+    const char *peer_host;
+    const char *peer_port;
+    struct replica_link to;
+    time_t next_connect;
+
+    /* --replicate-listen */
+    socket_descriptor_t listen_sd;
+    struct replica_link from;
+    struct replica_link pending; /**< new connection, not yet authenticated */
+    int ttl;
+    struct hash *entries;       /**< common name -> struct replica_entry */
+};
+
+/**
+ * Set up replication as configured, or return NULL if neither
+ * --replicate-peer nor --replicate-listen is used.
+ */
+struct replica *replica_new(const struct options *o);
+
+void replica_free(struct replica *r);
+
+/**
+ * Connect, accept, send and receive without blocking.  Called once per
+ * second.  Addresses of new entries are reserved in \c pool.
+ *
+ * @return true if the connection to --replicate-peer has just come up
+ *         and every connected client has to be sent with
+ *         replica_client_up()
+ */
+bool replica_process(struct replica *r, struct ifconfig_pool *pool);
+
+/** Tell the peer about a client that completed its connect */
+void replica_client_up(struct replica *r, const struct handoff_client *hc);
+
+/** Tell the peer that the client \c common_name is gone */
+void replica_client_down(struct replica *r, const char *common_name);
+
+/** The client \c common_name of the peer server, or NULL */
+const struct replica_entry *replica_lookup(struct replica *r,
+                                           const char *common_name);
+
+#endif /* REPLICA_H */
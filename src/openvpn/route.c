@@ -40,6 +40,8 @@
 #include "win32.h"
 #include "options.h"
 #include "networking.h"
+#include "list.h"
+#include "crypto.h"
 
 #include "memdbg.h"
 
@@ -69,6 +71,11 @@ static int add_route_ipapi(const struct route_ipv4 *r, const struct tuntap *tt,
 
 static bool del_route_ipapi(const struct route_ipv4 *r, const struct tuntap *tt);
 
+static void route_service_batch_begin(HANDLE pipe);
+
+static int route_service_batch_len(void);
+
+static void route_service_batch_end(int *results);
 
 #endif
 
@@ -1173,12 +1180,104 @@ undo_redirect_default_route_to_vpn(struct route_list *rl,
     }
 }
 
+/*
+ * The routes of add_routes() are queued to the networking backend, or on
+ * Windows to the interactive service, if there is one.
+ */
+static void
+route_batch_begin(openvpn_net_ctx_t *ctx, const struct tuntap *tt)
+{
+#if defined(_WIN32)
+    if (tt->options.msg_channel)
+    {
+        route_service_batch_begin(tt->options.msg_channel);
+    }
+#else
+    net_route_batch_begin(ctx);
+#endif
+}
+
+static int
+route_batch_len(openvpn_net_ctx_t *ctx)
+{
+#if defined(_WIN32)
+    return route_service_batch_len();
+#else
+    return net_route_batch_len(ctx);
+#endif
+}
+
+/*
+ * Install the routes queued by add_routes() and fix up the RT_ADDED
+ * flags, which add_route() and add_route_ipv6() set for a queued route.
+ */
+static bool
+add_routes_batch_end(openvpn_net_ctx_t *ctx, unsigned int **route_flags)
+{
+    struct gc_arena gc = gc_new();
+    const int n = route_batch_len(ctx);
+    bool ret = true;
+    int *results;
+
+    ALLOC_ARRAY_CLEAR_GC(results, int, n + 1, &gc);
+#if defined(_WIN32)
+    route_service_batch_end(results);
+#else
+    net_route_batch_end(ctx, results);
+#endif
+
+    for (int i = 0; i < n; ++i)
+    {
+        if (results[i] == 0)
+        {
+            continue;
+        }
+        *route_flags[i] &= ~RT_ADDED;
+        if (results[i] == -EEXIST)
+        {
+            msg(D_ROUTE, "NOTE: route addition failed because route exists");
+        }
+        else
+        {
+            /* the error is logged by the backend */
+            ret = false;
+        }
+    }
+
+    gc_free(&gc);
+    return ret;
+}
+
 bool
 add_routes(struct route_list *rl, struct route_ipv6_list *rl6,
            const struct tuntap *tt, unsigned int flags,
            const struct env_set *es, openvpn_net_ctx_t *ctx)
 {
     bool ret = redirect_default_route_to_vpn(rl, tt, flags, es, ctx);
+    struct gc_arena gc = gc_new();
+    unsigned int **queued = NULL;
+
+    /*
+     * Let the networking backend install the routes in one batch, rather
+     * than waiting for the kernel to acknowledge each of them.  Not with
+     * --route-delete-first, which has to delete a route before adding it.
+     */
+    const bool batch = !(flags & ROUTE_DELETE_FIRST);
+    if (batch)
+    {
+        int n_routes = 0;
+        for (const struct route_ipv4 *r = rl ? rl->routes : NULL; r; r = r->next)
+        {
+            ++n_routes;
+        }
+        for (const struct route_ipv6 *r = rl6 ? rl6->routes_ipv6 : NULL; r; r = r->next)
+        {
+            ++n_routes;
+        }
+        ALLOC_ARRAY_CLEAR_GC(queued, unsigned int *, n_routes + 1, &gc);
+        route_batch_begin(ctx, tt);
+    }
+
     if (rl && !(rl->iflags & RL_ROUTES_ADDED) )
     {
         struct route_ipv4 *r;
@@ -1211,7 +1310,12 @@ add_routes(struct route_list *rl, struct route_ipv6_list *rl6,
             {
                 delete_route(r, tt, flags, &rl->rgi, es, ctx);
             }
+            const int n_queued = route_batch_len(ctx);
             ret = add_route(r, tt, flags, &rl->rgi, es, ctx) && ret;
+            if (batch && route_batch_len(ctx) > n_queued)
+            {
+                queued[n_queued] = &r->flags;
+            }
         }
         rl->iflags |= RL_ROUTES_ADDED;
     }
@@ -1233,10 +1337,22 @@ add_routes(struct route_list *rl, struct route_ipv6_list *rl6,
             {
                 delete_route_ipv6(r, tt, flags, es, ctx);
             }
+            const int n_queued = route_batch_len(ctx);
             ret = add_route_ipv6(r, tt, flags, es, ctx) && ret;
+            if (batch && route_batch_len(ctx) > n_queued)
+            {
+                queued[n_queued] = &r->flags;
+            }
         }
         rl6->iflags |= RL_ROUTES_ADDED;
     }
+
+    if (batch)
+    {
+        ret = add_routes_batch_end(ctx, queued) && ret;
+    }
+
+    gc_free(&gc);
     return ret;
 }
 
@@ -1278,6 +1394,174 @@ delete_routes(struct route_list *rl, struct route_ipv6_list *rl6,
     }
 }
 
+static uint32_t
+route_hash_function(const void *key, uint32_t iv)
+{
+    const struct route_ipv4 *r = key;
+    const in_addr_t k[3] = { r->network, r->netmask, r->gateway };
+    return hash_func((const uint8_t *) k, sizeof(k), iv);
+}
+
+static bool
+route_compare_function(const void *key1, const void *key2)
+{
+    const struct route_ipv4 *r1 = key1;
+    const struct route_ipv4 *r2 = key2;
+    return r1->network == r2->network
+           && r1->netmask == r2->netmask
+           && r1->gateway == r2->gateway
+           && (r1->flags & RT_METRIC_DEFINED) == (r2->flags & RT_METRIC_DEFINED)
+           && r1->metric == r2->metric;
+}
+
+static uint32_t
+route_ipv6_hash_function(const void *key, uint32_t iv)
+{
+    const struct route_ipv6 *r6 = key;
+    return hash_func((const uint8_t *) &r6->network, sizeof(r6->network),
+                     iv ^ r6->netbits);
+}
+
+static bool
+route_ipv6_compare_function(const void *key1, const void *key2)
+{
+    const struct route_ipv6 *r1 = key1;
+    const struct route_ipv6 *r2 = key2;
+    return IN6_ARE_ADDR_EQUAL(&r1->network, &r2->network)
+           && r1->netbits == r2->netbits
+           && IN6_ARE_ADDR_EQUAL(&r1->gateway, &r2->gateway)
+           && (r1->flags & RT_METRIC_DEFINED) == (r2->flags & RT_METRIC_DEFINED)
+           && r1->metric == r2->metric
+           && streq(r1->iface ? r1->iface : "", r2->iface ? r2->iface : "");
+}
+
+/*
+ * Take over the routes in old_rl and old_rl6, which were installed by
+ * add_routes() on a previous connection, for the freshly initialized
+ * rl and rl6.  Routes present in both are left alone, the others are
+ * deleted or added.  The old lists are cleared.
+ */
+bool
+update_routes(struct route_list *rl, struct route_ipv6_list *rl6,
+              struct route_list *old_rl, struct route_ipv6_list *old_rl6,
+              const struct tuntap *tt, unsigned int flags,
+              const struct env_set *es, openvpn_net_ctx_t *ctx)
+{
+    struct hash *hash = hash_init(256, get_random(), route_hash_function,
+                                  route_compare_function);
+    struct hash *hash6 = hash_init(256, get_random(), route_ipv6_hash_function,
+                                   route_ipv6_compare_function);
+    int n_kept = 0, n_added = 0, n_deleted = 0;
+    bool ret = true;
+
+    if (old_rl && (old_rl->iflags & RL_ROUTES_ADDED))
+    {
+        for (struct route_ipv4 *r = old_rl->routes; r; r = r->next)
+        {
+            /* a duplicate refers to the same kernel route, delete it once */
+            if ((r->flags & RT_ADDED) && !hash_add(hash, r, r, false))
+            {
+                r->flags &= ~RT_ADDED;
+            }
+        }
+    }
+    if (old_rl6 && (old_rl6->iflags & RL_ROUTES_ADDED))
+    {
+        for (struct route_ipv6 *r6 = old_rl6->routes_ipv6; r6; r6 = r6->next)
+        {
+            /* a duplicate refers to the same kernel route, delete it once */
+            if ((r6->flags & RT_ADDED) && !hash_add(hash6, r6, r6, false))
+            {
+                r6->flags &= ~RT_ADDED;
+            }
+        }
+    }
+
+    /*
+     * A route that is still wanted moves its RT_ADDED flag from the old
+     * to the new list, so that only the obsolete routes keep it.
+     */
+    for (struct route_ipv4 *r = rl ? rl->routes : NULL; r; r = r->next)
+    {
+        struct route_ipv4 *old = hash_lookup(hash, r);
+        if (old && (old->flags & RT_ADDED) && (r->flags & RT_DEFINED))
+        {
+            old->flags &= ~RT_ADDED;
+            r->flags |= RT_ADDED;
+            ++n_kept;
+        }
+    }
+    for (struct route_ipv6 *r6 = rl6 ? rl6->routes_ipv6 : NULL; r6; r6 = r6->next)
+    {
+        struct route_ipv6 *old = hash_lookup(hash6, r6);
+        if (old && (old->flags & RT_ADDED) && (r6->flags & RT_DEFINED))
+        {
+            old->flags &= ~RT_ADDED;
+            r6->flags |= RT_ADDED;
+            ++n_kept;
+        }
+    }
+
+    /* delete first, a changed route might conflict with its old version */
+    for (struct route_ipv4 *r = old_rl ? old_rl->routes : NULL; r; r = r->next)
+    {
+        if (r->flags & RT_ADDED)
+        {
+            delete_route(r, tt, flags, &old_rl->rgi, es, ctx);
+            ++n_deleted;
+        }
+    }
+    for (struct route_ipv6 *r6 = old_rl6 ? old_rl6->routes_ipv6 : NULL; r6; r6 = r6->next)
+    {
+        if (r6->flags & RT_ADDED)
+        {
+            delete_route_ipv6(r6, tt, flags, es, ctx);
+            ++n_deleted;
+        }
+    }
+
+    if (rl)
+    {
+        for (struct route_ipv4 *r = rl->routes; r; r = r->next)
+        {
+            if (!(r->flags & RT_ADDED))
+            {
+                check_subnet_conflict(r->network, r->netmask, "route");
+                ret = add_route(r, tt, flags, &rl->rgi, es, ctx) && ret;
+                ++n_added;
+            }
+        }
+        rl->iflags |= RL_ROUTES_ADDED;
+    }
+    if (rl6)
+    {
+        for (struct route_ipv6 *r6 = rl6->routes_ipv6; r6; r6 = r6->next)
+        {
+            if (!(r6->flags & RT_ADDED))
+            {
+                ret = add_route_ipv6(r6, tt, flags, es, ctx) && ret;
+                ++n_added;
+            }
+        }
+        rl6->iflags |= RL_ROUTES_ADDED;
+    }
+
+    msg(M_INFO, "Updated routes: %d kept, %d added, %d deleted",
+        n_kept, n_added, n_deleted);
+
+    hash_free(hash);
+    hash_free(hash6);
+    if (old_rl)
+    {
+        clear_route_list(old_rl);
+    }
+    if (old_rl6)
+    {
+        clear_route_ipv6_list(old_rl6);
+    }
+    return ret;
+}
+
 #ifndef ENABLE_SMALL
 
 static const char *
@@ -2953,36 +3237,185 @@ del_route_ipapi(const struct route_ipv4 *r, const struct tuntap *tt)
 
 /* Returns RTA_SUCCESS on success, RTA_EEXIST if route exists, RTA_ERROR on error */
 static int
-do_route_service(const bool add, const route_message_t *rt, const size_t size, HANDLE pipe)
+route_service_status(const bool add, const route_message_t *rt, const DWORD error_number)
 {
-    int ret = RTA_ERROR;
-    ack_message_t ack;
     struct gc_arena gc = gc_new();
+    int ret = RTA_SUCCESS;
 
-    if (!send_msg_iservice(pipe, rt, size, &ack, "ROUTE"))
+    if (error_number != NO_ERROR)
     {
-        goto out;
+        ret = (error_number == ERROR_OBJECT_ALREADY_EXISTS) ? RTA_EEXIST : RTA_ERROR;
+        if (ret == RTA_ERROR)
+        {
+            msg(M_WARN, "ERROR: route %s failed using service: %s [status=%u if_index=%d]",
+                (add ? "addition" : "deletion"), strerror_win32(error_number, &gc),
+                error_number, rt->iface.index);
+        }
+    }
+
+    gc_free(&gc);
+    return ret;
+}
+
+/*
+ * Route additions queued between route_service_batch_begin() and
+ * route_service_batch_end(), to send them ROUTE_BATCH_MAX at a time
+ * rather than waiting for the service to acknowledge each of them
+ */
+struct route_service_batch {
+    HANDLE pipe;
+    route_message_t *routes;
+    int n;
+    int capacity;
+};
+
+/* the batch route additions are currently queued to, if any */
+static struct route_service_batch *service_batch;
+
+static void
+route_service_batch_begin(HANDLE pipe)
+{
+    ASSERT(!service_batch);
+    ALLOC_OBJ_CLEAR(service_batch, struct route_service_batch);
+    service_batch->pipe = pipe;
+}
+
+static int
+route_service_batch_len(void)
+{
+    return service_batch ? service_batch->n : 0;
+}
+
+/*
+ * Send n <= ROUTE_BATCH_MAX routes in one message and store the result
+ * of each one in results, as route_service_batch_end() does.  Returns
+ * false if the service does not know route batches.
+ */
+static bool
+route_service_batch_send(HANDLE pipe, const route_message_t *routes, const int n,
+                         int *results)
+{
+    struct gc_arena gc = gc_new();
+    route_batch_message_t *batch;
+    route_batch_ack_message_t ack;
+    DWORD len = 0;
+    bool ret = true;
+
+    ALLOC_OBJ_CLEAR_GC(batch, route_batch_message_t, &gc);
+    batch->header.type = msg_route_batch;
+    batch->header.size = offsetof(route_batch_message_t, routes) + n * sizeof(*routes);
+    batch->count = n;
+    if (n)
+    {
+        memcpy(batch->routes, routes, n * sizeof(*routes));
     }
 
-    if (ack.error_number != NO_ERROR)
+    CLEAR(ack);
+    if (!WriteFile(pipe, batch, (DWORD) batch->header.size, &len, NULL)
+        || !ReadFile(pipe, &ack, sizeof(ack), &len, NULL))
     {
-        ret = (ack.error_number == ERROR_OBJECT_ALREADY_EXISTS) ? RTA_EEXIST : RTA_ERROR;
-        if (ret == RTA_ERROR)
+        msg(M_WARN, "ROUTE: could not talk to service: %s [%lu]",
+            strerror_win32(GetLastError(), &gc), GetLastError());
+        for (int i = 0; i < n; ++i)
         {
-            msg(M_WARN, "ERROR: route %s failed using service: %s [status=%u if_index=%d]",
-                (add ? "addition" : "deletion"), strerror_win32(ack.error_number, &gc),
-                ack.error_number, rt->iface.index);
+            results[i] = -1;
         }
         goto out;
     }
 
-    ret = RTA_SUCCESS;
+    /* an older service answers with a plain ack and ERROR_MESSAGE_TYPE */
+    if (len != sizeof(ack) || ack.error_number != NO_ERROR || ack.count != n)
+    {
+        msg(D_ROUTE, "ROUTE: service did not take a batch of routes [status=%d]",
+            ack.error_number);
+        ret = false;
+        goto out;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        const int status = route_service_status(true, &routes[i], ack.route_error[i]);
+        results[i] = (status == RTA_SUCCESS) ? 0 : (status == RTA_EEXIST) ? -EEXIST : -1;
+    }
 
 out:
     gc_free(&gc);
     return ret;
 }
 
+/* Returns RTA_SUCCESS on success, RTA_EEXIST if route exists, RTA_ERROR on error */
+static int
+do_route_service(const bool add, const route_message_t *rt, const size_t size, HANDLE pipe)
+{
+    ack_message_t ack;
+
+    if (add && service_batch)
+    {
+        /* sent and acknowledged together by route_service_batch_end() */
+        struct route_service_batch *b = service_batch;
+        if (b->n == b->capacity)
+        {
+            b->capacity = b->capacity ? b->capacity * 2 : ROUTE_BATCH_MAX;
+            b->routes = realloc(b->routes, b->capacity * sizeof(*b->routes));
+            check_malloc_return(b->routes);
+        }
+        b->routes[b->n++] = *rt;
+        return RTA_SUCCESS;
+    }
+
+    if (!send_msg_iservice(pipe, rt, size, &ack, "ROUTE"))
+    {
+        return RTA_ERROR;
+    }
+
+    return route_service_status(add, rt, ack.error_number);
+}
+
+/*
+ * Install the queued routes and stop queueing.  results receives the
+ * result of each queued route in the order in which it was added: 0 on
+ * success, -EEXIST if the route exists, -1 on other errors.
+ */
+static void
+route_service_batch_end(int *results)
+{
+    struct route_service_batch *b = service_batch;
+
+    if (!b)
+    {
+        return;
+    }
+    service_batch = NULL;
+
+    /* an empty batch first, an older service would choke on a full one */
+    bool batched = b->n && route_service_batch_send(b->pipe, NULL, 0, NULL);
+    if (batched)
+    {
+        msg(D_ROUTE, "ROUTE: sending %d routes to the service", b->n);
+    }
+
+    for (int i = 0; i < b->n; i += ROUTE_BATCH_MAX)
+    {
+        const int n = min_int(b->n - i, ROUTE_BATCH_MAX);
+        batched = batched && route_service_batch_send(b->pipe, &b->routes[i], n, &results[i]);
+        if (batched)
+        {
+            continue;
+        }
+
+        /* one route at a time then */
+        for (int j = i; j < i + n; ++j)
+        {
+            const int status = do_route_service(true, &b->routes[j],
+                                                sizeof(b->routes[j]), b->pipe);
+            results[j] = (status == RTA_SUCCESS) ? 0 : (status == RTA_EEXIST) ? -EEXIST : -1;
+        }
+    }
+
+    free(b->routes);
+    free(b);
+}
+
 /* Returns RTA_SUCCESS on success, RTA_EEXIST if route exists, RTA_ERROR on error */
 static int
 do_route_ipv4_service(const bool add, const struct route_ipv4 *r, const struct tuntap *tt)
@@ -309,6 +309,11 @@ void delete_routes(struct route_list *rl,
                    const struct env_set *es,
                    openvpn_net_ctx_t *ctx);
 
+bool update_routes(struct route_list *rl, struct route_ipv6_list *rl6,
+                   struct route_list *old_rl, struct route_ipv6_list *old_rl6,
+                   const struct tuntap *tt, unsigned int flags,
+                   const struct env_set *es, openvpn_net_ctx_t *ctx);
+
 void setenv_routes(struct env_set *es, const struct route_list *rl);
 
 void setenv_routes_ipv6(struct env_set *es, const struct route_ipv6_list *rl6);
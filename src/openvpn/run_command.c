@@ -36,6 +36,10 @@
 
 #include "run_command.h"
 
+#ifdef HAVE_POSIX_SPAWN
+#include <spawn.h>
+#endif
+
 /* contains an SSEC_x value defined in platform.h */
 static int script_security_level = SSEC_BUILT_IN; /* GLOBAL */
 
@@ -54,7 +58,7 @@ script_security_set(int level)
 /*
  * Generate an error message based on the status code returned by openvpn_execve().
  */
-static const char *
+const char *
 system_error_message(int stat, struct gc_arena *gc)
 {
     struct buffer out = alloc_buf_gc(256, gc);
@@ -121,6 +125,70 @@ openvpn_execve_allowed(const unsigned int flags)
 
 
 #ifndef _WIN32
+pid_t
+openvpn_spawn(const char *cmd, char *const *argv, char *const *envp,
+              int stdout_fd, int close_fd)
+{
+    pid_t pid = -1;
+
+    msg_flush();
+#ifdef HAVE_POSIX_SPAWN
+    posix_spawn_file_actions_t actions;
+    int err = posix_spawn_file_actions_init(&actions);
+
+    if (!err && close_fd >= 0)
+    {
+        err = posix_spawn_file_actions_addclose(&actions, close_fd);
+    }
+    if (!err && stdout_fd >= 0)
+    {
+        err = posix_spawn_file_actions_adddup2(&actions, stdout_fd, 1);
+    }
+    if (!err)
+    {
+        err = posix_spawn(&pid, cmd, &actions, NULL, argv, envp);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    if (err)
+    {
+        errno = err;
+        return -1;
+    }
+#else  /* ifdef HAVE_POSIX_SPAWN */
+    pid = fork();
+    if (pid == (pid_t)0) /* child side */
+    {
+        if (close_fd >= 0)
+        {
+            close(close_fd);
+        }
+        if (stdout_fd >= 0)
+        {
+            dup2(stdout_fd, 1);
+        }
+        execve(cmd, argv, envp);
+        exit(OPENVPN_EXECVE_FAILURE);
+    }
+#endif /* ifdef HAVE_POSIX_SPAWN */
+    return pid;
+}
+
+/*
+ * posix_spawn() reports an execve() failure to the parent instead of
+ * having the child exit with OPENVPN_EXECVE_FAILURE.  Tell the two cases
+ * where we cannot create a process at all from the ones where the
+ * program could not be executed.
+ */
+static bool
+openvpn_spawn_exec_failed(void)
+{
+#ifdef HAVE_POSIX_SPAWN
+    return errno != EAGAIN && errno != ENOMEM;
+#else
+    return false;
+#endif
+}
+
 /*
  * Run execve() inside a fork().  Designed to replicate the semantics of system() but
  * in a safer way that doesn't require the invocation of a shell or the risks
@@ -143,13 +211,13 @@ openvpn_execve(const struct argv *a, const struct env_set *es, const unsigned in
             const char *cmd = a->argv[0];
             char *const *argv = a->argv;
             char *const *envp = (char *const *)make_env_array(es, true, &gc);
-            pid_t pid;
+            const pid_t pid = openvpn_spawn(cmd, argv, envp, -1, -1);
 
-            pid = fork();
-            if (pid == (pid_t)0) /* child side */
+            if (pid < (pid_t)0 && openvpn_spawn_exec_failed())
             {
-                execve(cmd, argv, envp);
-                exit(OPENVPN_EXECVE_FAILURE);
+                msg(M_WARN | M_ERRNO, "openvpn_execve: unable to execute %s", cmd);
+                /* the wait status of exit(OPENVPN_EXECVE_FAILURE) */
+                ret = OPENVPN_EXECVE_FAILURE << 8;
             }
             else if (pid < (pid_t)0) /* fork failed */
             {
@@ -246,15 +314,9 @@ openvpn_popen(const struct argv *a,  const struct env_set *es)
 
             if (pipe(pipe_stdout) == 0)
             {
-                pid = fork();
-                if (pid == (pid_t)0)       /* child side */
-                {
-                    close(pipe_stdout[0]);         /* Close read end */
-                    dup2(pipe_stdout[1], 1);
-                    execve(cmd, argv, envp);
-                    exit(OPENVPN_EXECVE_FAILURE);
-                }
-                else if (pid > (pid_t)0)       /* parent side */
+                /* the child gets the write end as stdout only */
+                pid = openvpn_spawn(cmd, argv, envp, pipe_stdout[1], pipe_stdout[0]);
+                if (pid > (pid_t)0)       /* parent side */
                 {
                     int status = 0;
 
@@ -262,6 +324,12 @@ openvpn_popen(const struct argv *a,  const struct env_set *es)
                     waitpid(pid, &status, 0);
                     ret = pipe_stdout[0];
                 }
+                else if (openvpn_spawn_exec_failed())
+                {
+                    close(pipe_stdout[0]);
+                    close(pipe_stdout[1]);
+                    msg(M_WARN | M_ERRNO, "openvpn_popen: unable to execute %s", cmd);
+                }
                 else       /* fork failed */
                 {
                     close(pipe_stdout[0]);
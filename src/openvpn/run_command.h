@@ -48,9 +48,31 @@ void script_security_set(int level);
  * return exit code when between 0 and 255 and -1 otherwise */
 #define S_EXITCODE  (1<<2)
 
+/**
+ * Generate an error message based on the status code returned by
+ * openvpn_execve().
+ */
+const char *system_error_message(int stat, struct gc_arena *gc);
+
 /* wrapper around the execve() call */
 int openvpn_popen(const struct argv *a,  const struct env_set *es);
 
+#ifndef _WIN32
+/**
+ * Start \c cmd in a child process without waiting for it, with
+ * posix_spawn() where available so that a large server process does not
+ * pay for copying its page tables as fork() would.
+ *
+ * @param stdout_fd  descriptor to become the child's stdout, or -1
+ * @param close_fd   descriptor to close in the child, or -1
+ *
+ * @return the pid of the child, or -1 with errno set if it could not be
+ *         started
+ */
+pid_t openvpn_spawn(const char *cmd, char *const *argv, char *const *envp,
+                    int stdout_fd, int close_fd);
+#endif
+
 bool openvpn_execve_allowed(const unsigned int flags);
 
 int openvpn_execve_check(const struct argv *a, const struct env_set *es,
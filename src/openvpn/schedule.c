@@ -21,6 +21,7 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
@@ -34,19 +35,7 @@
 
 #include "memdbg.h"
 
-#ifdef SCHEDULE_TEST
-
-struct status
-{
-    int sru;
-    int ins;
-    int coll;
-    int lsteps;
-};
-
-static struct status z;
-
-#endif
+#define SCHEDULE_SLOT_MASK  (SCHEDULE_SLOTS - 1)
 
 #ifdef ENABLE_DEBUG
 static void
@@ -55,10 +44,10 @@ schedule_entry_debug_info(const char *caller, const struct schedule_entry *e)
     struct gc_arena gc = gc_new();
     if (e)
     {
-        dmsg(D_SCHEDULER, "SCHEDULE: %s wakeup=[%s] pri=%u",
+        dmsg(D_SCHEDULER, "SCHEDULE: %s wakeup=[%s] slot=%d",
              caller,
              tv_string_abs(&e->tv, &gc),
-             e->pri);
+             e->slot);
     }
     else
     {
@@ -69,277 +58,210 @@ schedule_entry_debug_info(const char *caller, const struct schedule_entry *e)
 }
 #endif
 
-static inline void
-schedule_set_pri(struct schedule_entry *e)
+static inline uint64_t
+schedule_tick(const struct timeval *tv)
+{
+    return ((uint64_t) tv->tv_sec << SCHEDULE_TICK_BITS)
+           + (((uint64_t) tv->tv_usec << SCHEDULE_TICK_BITS) / 1000000);
+}
+
+/* index of the lowest bit set in a non-zero slot bitmap */
+static inline int
+schedule_first_slot(uint64_t used)
 {
-    e->pri = random();
-    if (e->pri < 1)
+#if defined(__GNUC__)
+    return __builtin_ctzll(used);
+#else
+    int i = 0;
+    while (!(used & 1))
     {
-        e->pri = 1;
+        used >>= 1;
+        ++i;
     }
+    return i;
+#endif
 }
 
-/* This is the master key comparison routine.  A key is
- * simply a struct timeval containing the absolute time for
- * an event.  The unique treap priority (pri) is used to ensure
- * that keys do not collide.
+/*
+ * Put an entry on the list that matches its wakeup tick:
+ * the due list if the tick has passed, otherwise the slot
+ * on the lowest level whose block contains both the wakeup
+ * tick and the current tick.
  */
-static inline int
-schedule_entry_compare(const struct schedule_entry *e1,
-                       const struct schedule_entry *e2)
+static void
+schedule_link(struct schedule *s, struct schedule_entry *e)
 {
-    if (e1->tv.tv_sec < e2->tv.tv_sec)
+    struct schedule_entry **head;
+
+    if (e->tick <= s->tick)
     {
-        return -1;
+        /* append, so that due entries are served in order */
+        e->slot = SCHEDULE_SLOT_DUE;
+        e->next = NULL;
+        e->pprev = s->due_tail;
+        *s->due_tail = e;
+        s->due_tail = &e->next;
+        return;
     }
-    else if (e1->tv.tv_sec > e2->tv.tv_sec)
+
+    uint64_t diff = e->tick ^ s->tick;
+    int level = 0;
+    while (level < SCHEDULE_LEVELS && diff >= SCHEDULE_SLOTS)
+    {
+        diff >>= SCHEDULE_SLOT_BITS;
+        ++level;
+    }
+
+    if (level < SCHEDULE_LEVELS)
     {
-        return 1;
+        const int slot = (int) (e->tick >> (level * SCHEDULE_SLOT_BITS)) & SCHEDULE_SLOT_MASK;
+        e->slot = level * SCHEDULE_SLOTS + slot;
+        s->used[level] |= (uint64_t) 1 << slot;
     }
     else
     {
-        if (e1->tv.tv_usec < e2->tv.tv_usec)
-        {
-            return -1;
-        }
-        else if (e1->tv.tv_usec > e2->tv.tv_usec)
-        {
-            return 1;
-        }
-        else
-        {
-            if (e1->pri < e2->pri)
-            {
-                return -1;
-            }
-            else if (e1->pri > e2->pri)
-            {
-                return 1;
-            }
-            else
-            {
-                return 0;
-            }
-        }
+        e->slot = SCHEDULE_SLOT_FAR;
     }
-}
 
-/*
- * Detach a btree node from its parent
- */
-static inline void
-schedule_detach_parent(struct schedule *s, struct schedule_entry *e)
-{
-    if (e)
+    head = &s->slots[e->slot];
+    e->next = *head;
+    if (e->next)
     {
-        if (e->parent)
-        {
-            if (e->parent->lt == e)
-            {
-                e->parent->lt = NULL;
-            }
-            else if (e->parent->gt == e)
-            {
-                e->parent->gt = NULL;
-            }
-            else
-            {
-                /* parent <-> child linkage is corrupted */
-                ASSERT(0);
-            }
-            e->parent = NULL;
-        }
-        else
-        {
-            if (s->root == e) /* last element deleted, tree is empty */
-            {
-                s->root = NULL;
-            }
-        }
+        e->next->pprev = &e->next;
     }
+    e->pprev = head;
+    *head = e;
 }
 
-/*
- *
- * Given a binary search tree, move a node toward the root
- * while still maintaining the correct ordering relationships
- * within the tree.  This function is the workhorse
- * of the tree balancer.
- *
- * This code will break on key collisions, which shouldn't
- * happen because the treap priority is considered part of the key
- * and is guaranteed to be unique.
- */
 static void
-schedule_rotate_up(struct schedule *s, struct schedule_entry *e)
+schedule_unlink(struct schedule *s, struct schedule_entry *e)
 {
-    if (e && e->parent)
+    *e->pprev = e->next;
+    if (e->next)
+    {
+        e->next->pprev = e->pprev;
+    }
+    else if (e->slot == SCHEDULE_SLOT_DUE)
     {
-        struct schedule_entry *lt = e->lt;
-        struct schedule_entry *gt = e->gt;
-        struct schedule_entry *p = e->parent;
-        struct schedule_entry *gp = p->parent;
+        s->due_tail = e->pprev;
+    }
 
-        if (gp) /* if grandparent exists, modify its child link */
-        {
-            if (gp->gt == p)
-            {
-                gp->gt = e;
-            }
-            else if (gp->lt == p)
-            {
-                gp->lt = e;
-            }
-            else
-            {
-                ASSERT(0);
-            }
-        }
-        else /* no grandparent, now we are the root */
-        {
-            s->root = e;
-        }
+    if (e->slot < SCHEDULE_SLOT_FAR && !s->slots[e->slot])
+    {
+        s->used[e->slot / SCHEDULE_SLOTS] &= ~((uint64_t) 1 << (e->slot & SCHEDULE_SLOT_MASK));
+    }
+    e->next = NULL;
+    e->pprev = NULL;
+}
 
-        /* grandparent is now our parent */
-        e->parent = gp;
+/* detach the list of a slot and put its entries where they belong now */
+static void
+schedule_cascade(struct schedule *s, int slot)
+{
+    struct schedule_entry *e = s->slots[slot];
 
-        /* parent is now our child */
-        p->parent = e;
+    s->slots[slot] = NULL;
+    if (slot < SCHEDULE_SLOT_FAR)
+    {
+        s->used[slot / SCHEDULE_SLOTS] &= ~((uint64_t) 1 << (slot & SCHEDULE_SLOT_MASK));
+    }
+    while (e)
+    {
+        struct schedule_entry *next = e->next;
+        schedule_link(s, e);
+        e = next;
+    }
+}
 
-        /* reorient former parent's links
-         * to reflect new position in the tree */
-        if (p->gt == e)
-        {
-            e->lt = p;
-            p->gt = lt;
-            if (lt)
-            {
-                lt->parent = p;
-            }
-        }
-        else if (p->lt == e)
-        {
-            e->gt = p;
-            p->lt = gt;
-            if (gt)
-            {
-                gt->parent = p;
-            }
-        }
-        else
+/* take every entry off the wheel and put it back relative to tick */
+static void
+schedule_rebuild(struct schedule *s, uint64_t tick)
+{
+    struct schedule_entry *list = NULL;
+
+    for (int i = 0; i <= SCHEDULE_SLOT_DUE; ++i)
+    {
+        struct schedule_entry *e = s->slots[i];
+        while (e)
         {
-            /* parent <-> child linkage is corrupted */
-            ASSERT(0);
+            struct schedule_entry *next = e->next;
+            e->next = list;
+            list = e;
+            e = next;
         }
+        s->slots[i] = NULL;
+    }
+    CLEAR(s->used);
+    s->due_tail = &s->slots[SCHEDULE_SLOT_DUE];
+    s->tick = tick;
 
-#ifdef SCHEDULE_TEST
-        ++z.sru;
-#endif
+    while (list)
+    {
+        struct schedule_entry *next = list->next;
+        schedule_link(s, list);
+        list = next;
     }
 }
 
-/*
- * This is the treap deletion algorithm:
- *
- * Rotate lesser-priority children up in the tree
- * until we are childless.  Then delete.
- */
-void
-schedule_remove_node(struct schedule *s, struct schedule_entry *e)
+/* the entry with the earliest wakeup time on a list */
+static struct schedule_entry *
+schedule_list_least(struct schedule_entry *e)
 {
-    while (e->lt || e->gt)
+    struct schedule_entry *least = e;
+
+    for (; e; e = e->next)
     {
-        if (e->lt)
-        {
-            if (e->gt)
-            {
-                if (e->lt->pri < e->gt->pri)
-                {
-                    schedule_rotate_up(s, e->lt);
-                }
-                else
-                {
-                    schedule_rotate_up(s, e->gt);
-                }
-            }
-            else
-            {
-                schedule_rotate_up(s, e->lt);
-            }
-        }
-        else if (e->gt)
+        if (tv_lt(&e->tv, &least->tv))
         {
-            schedule_rotate_up(s, e->gt);
+            least = e;
         }
     }
-
-    schedule_detach_parent(s, e);
-    e->pri = 0;
+    return least;
 }
 
 /*
- * Trivially add a node to a binary search tree without
- * regard for balance.
+ * An entry on level n shares every digit above n with the
+ * current tick and has a larger digit n, so the lowest used
+ * slot of the lowest used level holds the earliest entries.
+ * Entries on level 0 all have the same tick.
  */
-static void
-schedule_insert(struct schedule *s, struct schedule_entry *e)
+struct schedule_entry *
+schedule_find_least(struct schedule *s)
 {
-    struct schedule_entry *c = s->root;
-    while (true)
-    {
-        const int comp = schedule_entry_compare(e, c);
+    struct schedule_entry *ret = s->slots[SCHEDULE_SLOT_DUE];
 
-#ifdef SCHEDULE_TEST
-        ++z.ins;
-#endif
+    if (!ret)
+    {
+        int level;
+        for (level = 0; level < SCHEDULE_LEVELS && !s->used[level]; ++level)
+        {
+        }
 
-        if (comp == -1)
+        if (level == 0)
         {
-            if (c->lt)
-            {
-                c = c->lt;
-                continue;
-            }
-            else
-            {
-                c->lt = e;
-                e->parent = c;
-                break;
-            }
+            ret = s->slots[schedule_first_slot(s->used[0])];
         }
-        else if (comp == 1)
+        else if (level < SCHEDULE_LEVELS)
         {
-            if (c->gt)
-            {
-                c = c->gt;
-                continue;
-            }
-            else
-            {
-                c->gt = e;
-                e->parent = c;
-                break;
-            }
+            const int slot = level * SCHEDULE_SLOTS + schedule_first_slot(s->used[level]);
+            ret = schedule_list_least(s->slots[slot]);
         }
         else
         {
-            /* rare key/priority collision -- no big deal,
-             * just choose another priority and retry */
-#ifdef SCHEDULE_TEST
-            ++z.coll;
-#endif
-            schedule_set_pri(e);
-            /* msg (M_INFO, "PRI COLLISION pri=%u", e->pri); */
-            c = s->root;
-            continue;
+            ret = schedule_list_least(s->slots[SCHEDULE_SLOT_FAR]);
         }
     }
+
+#ifdef ENABLE_DEBUG
+    if (check_debug_level(D_SCHEDULER))
+    {
+        schedule_entry_debug_info("schedule_find_least", ret);
+    }
+#endif
+
+    return ret;
 }
 
-/*
- * Given an element, remove it from the btree if it's already
- * there and re-insert it based on its current key.
- */
 void
 schedule_add_modify(struct schedule *s, struct schedule_entry *e)
 {
@@ -350,372 +272,121 @@ schedule_add_modify(struct schedule *s, struct schedule_entry *e)
     }
 #endif
 
-    /* already in tree, remove */
     if (IN_TREE(e))
     {
-        schedule_remove_node(s, e);
-    }
-
-    /* set random priority */
-    schedule_set_pri(e);
-
-    if (s->root)
-    {
-        schedule_insert(s, e);   /* trivial insert into tree */
+        schedule_unlink(s, e);
     }
     else
     {
-        s->root = e; /* tree was empty, we are the first element */
-
-    }
-    /* This is the magic of the randomized treap algorithm which
-     * keeps the tree balanced.  Move the node up the tree until
-     * its own priority is greater than that of its parent */
-    while (e->parent && e->parent->pri > e->pri)
-    {
-        schedule_rotate_up(s, e);
+        ++s->size;
     }
-}
+    e->tick = schedule_tick(&e->tv);
+    schedule_link(s, e);
 
-/*
- * Find the earliest event to be scheduled
- */
-struct schedule_entry *
-schedule_find_least(struct schedule_entry *e)
-{
-    if (e)
+    /* keep the cache valid unless the cached entry moved */
+    if (s->earliest_wakeup == e)
     {
-        while (e->lt)
-        {
-#ifdef SCHEDULE_TEST
-            ++z.lsteps;
-#endif
-            e = e->lt;
-        }
+        s->earliest_wakeup = NULL;
     }
-
-#ifdef ENABLE_DEBUG
-    if (check_debug_level(D_SCHEDULER))
+    else if (s->earliest_wakeup && tv_lt(&e->tv, &s->earliest_wakeup->tv))
     {
-        schedule_entry_debug_info("schedule_find_least", e);
+        s->earliest_wakeup = e;
     }
-#endif
-
-    return e;
-}
-
-/*
- *  Public functions below this point
- */
-
-struct schedule *
-schedule_init(void)
-{
-    struct schedule *s;
-
-    ALLOC_OBJ_CLEAR(s, struct schedule);
-    return s;
-}
-
-void
-schedule_free(struct schedule *s)
-{
-    free(s);
 }
 
 void
-schedule_remove_entry(struct schedule *s, struct schedule_entry *e)
+schedule_advance(struct schedule *s, const struct timeval *tv)
 {
-    s->earliest_wakeup = NULL; /* invalidate cache */
-    schedule_remove_node(s, e);
-}
-
-/*
- *  Debug functions below this point
- */
-
-#ifdef SCHEDULE_TEST
+    const uint64_t tick = schedule_tick(tv);
 
-static inline struct schedule_entry *
-schedule_find_earliest_wakeup(struct schedule *s)
-{
-    return schedule_find_least(s->root);
-}
-
-/*
- * Recursively check that the treap (btree) is
- * internally consistent.
- */
-int
-schedule_debug_entry(const struct schedule_entry *e,
-                     int depth,
-                     int *count,
-                     struct timeval *least,
-                     const struct timeval *min,
-                     const struct timeval *max)
-{
-    struct gc_arena gc = gc_new();
-    int maxdepth = depth;
-    if (e)
+    if (tick < s->tick)
     {
-        int d;
+        /* clock went backwards */
+        schedule_rebuild(s, tick);
+        s->earliest_wakeup = NULL;
+        return;
+    }
 
-        ASSERT(e != e->lt);
-        ASSERT(e != e->gt);
-        ASSERT(e != e->parent);
-        ASSERT(!e->parent || e->parent != e->lt);
-        ASSERT(!e->parent || e->parent != e->gt);
-        ASSERT(!e->lt || e->lt != e->gt);
+    while (s->tick < tick)
+    {
+        int level;
 
-        if (e->lt)
+        /* no entries below the lowest used level can become due
+         * before the current block of that level ends */
+        for (level = 0; level < SCHEDULE_LEVELS && !s->used[level]; ++level)
         {
-            ASSERT(e->lt->parent == e);
-            ASSERT(schedule_entry_compare(e->lt, e) == -1);
-            ASSERT(e->lt->pri >= e->pri);
         }
-
-        if (e->gt)
+        if (level > 0)
         {
-            ASSERT(e->gt->parent == e);
-            ASSERT(schedule_entry_compare(e->gt, e));
-            ASSERT(e->gt->pri >= e->pri);
+            if (level == SCHEDULE_LEVELS && !s->slots[SCHEDULE_SLOT_FAR])
+            {
+                s->tick = tick;
+                break;
+            }
+            const uint64_t block_end = s->tick | (((uint64_t) 1 << (level * SCHEDULE_SLOT_BITS)) - 1);
+            if (block_end >= tick)
+            {
+                s->tick = tick;
+                break;
+            }
+            s->tick = block_end;
         }
 
-        ASSERT(tv_le(min, &e->tv));
-        ASSERT(tv_le(&e->tv, max));
+        ++s->tick;
 
-        if (count)
+        /* the current tick entered a new block on every level whose
+         * lower digits are all zero now, cascade from the top down */
+        for (level = 1; level <= SCHEDULE_LEVELS; ++level)
         {
-            ++(*count);
-        }
-
-        if (least && tv_lt(&e->tv, least))
-        {
-            *least = e->tv;
+            if (s->tick & (((uint64_t) 1 << (level * SCHEDULE_SLOT_BITS)) - 1))
+            {
+                break;
+            }
         }
-
-        d = schedule_debug_entry(e->lt, depth+1, count, least, min, &e->tv);
-        if (d > maxdepth)
+        if (level > SCHEDULE_LEVELS)
         {
-            maxdepth = d;
+            schedule_cascade(s, SCHEDULE_SLOT_FAR);
+            level = SCHEDULE_LEVELS;
         }
-
-        d = schedule_debug_entry(e->gt, depth+1, count, least, &e->tv, max);
-        if (d > maxdepth)
+        while (--level > 0)
         {
-            maxdepth = d;
+            const int slot = (int) (s->tick >> (level * SCHEDULE_SLOT_BITS)) & SCHEDULE_SLOT_MASK;
+            schedule_cascade(s, level * SCHEDULE_SLOTS + slot);
         }
+        schedule_cascade(s, (int) (s->tick & SCHEDULE_SLOT_MASK));
     }
-    gc_free(&gc);
-    return maxdepth;
 }
 
-int
-schedule_debug(struct schedule *s, int *count, struct timeval *least)
-{
-    struct timeval min;
-    struct timeval max;
-
-    min.tv_sec = 0;
-    min.tv_usec = 0;
-    max.tv_sec = 0x7FFFFFFF;
-    max.tv_usec = 0x7FFFFFFF;
-
-    if (s->root)
-    {
-        ASSERT(s->root->parent == NULL);
-    }
-    return schedule_debug_entry(s->root, 0, count, least, &min, &max);
-}
-
-#if 1
-
-void
-tv_randomize(struct timeval *tv)
-{
-    tv->tv_sec += random() % 100;
-    tv->tv_usec = random() % 100;
-}
-
-#else  /* if 1 */
-
-void
-tv_randomize(struct timeval *tv)
-{
-    struct gc_arena gc = gc_new();
-    long int choice = get_random();
-    if ((choice & 0xFF) == 0)
-    {
-        tv->tv_usec += ((choice >> 8) & 0xFF);
-    }
-    else
-    {
-        prng_bytes((uint8_t *)tv, sizeof(struct timeval));
-    }
-    gc_free(&gc);
-}
-
-#endif /* if 1 */
-
-void
-schedule_verify(struct schedule *s)
-{
-    struct gc_arena gc = gc_new();
-    struct timeval least;
-    int count;
-    int maxlev;
-    struct schedule_entry *e;
-    const struct status zz = z;
-
-    least.tv_sec = least.tv_usec = 0x7FFFFFFF;
-
-    count = 0;
-
-    maxlev = schedule_debug(s, &count, &least);
-
-    e = schedule_find_earliest_wakeup(s);
-
-    if (e)
-    {
-        printf("Verification Phase  count=%d maxlev=%d sru=%d ins=%d coll=%d ls=%d l=%s",
-               count,
-               maxlev,
-               zz.sru,
-               zz.ins,
-               zz.coll,
-               zz.lsteps,
-               tv_string(&e->tv, &gc));
-
-        if (!tv_eq(&least, &e->tv))
-        {
-            printf(" [COMPUTED DIFFERENT MIN VALUES!]");
-        }
-
-        printf("\n");
-    }
-
-    CLEAR(z);
-    gc_free(&gc);
-}
+/*
+ *  Public functions below this point
+ */
 
-void
-schedule_randomize_array(struct schedule_entry **array, int size)
+struct schedule *
+schedule_init(void)
 {
-    int i;
-    for (i = 0; i < size; ++i)
-    {
-        const int src = get_random() % size;
-        struct schedule_entry *tmp = array [i];
-        if (i != src)
-        {
-            array [i] = array [src];
-            array [src] = tmp;
-        }
-    }
-}
+    struct schedule *s;
 
-void
-schedule_print_work(struct schedule_entry *e, int indent)
-{
-    struct gc_arena gc = gc_new();
-    int i;
-    for (i = 0; i < indent; ++i)
-    {
-        printf(" ");
-    }
-    if (e)
-    {
-        printf("%s [%u] e=" ptr_format ", p=" ptr_format " lt=" ptr_format " gt=" ptr_format "\n",
-               tv_string(&e->tv, &gc),
-               e->pri,
-               (ptr_type)e,
-               (ptr_type)e->parent,
-               (ptr_type)e->lt,
-               (ptr_type)e->gt);
-        schedule_print_work(e->lt, indent+1);
-        schedule_print_work(e->gt, indent+1);
-    }
-    else
-    {
-        printf("NULL\n");
-    }
-    gc_free(&gc);
+    ALLOC_OBJ_CLEAR(s, struct schedule);
+    s->due_tail = &s->slots[SCHEDULE_SLOT_DUE];
+    return s;
 }
 
 void
-schedule_print(struct schedule *s)
+schedule_free(struct schedule *s)
 {
-    printf("*************************\n");
-    schedule_print_work(s->root, 0);
+    free(s);
 }
 
 void
-schedule_test(void)
+schedule_remove_entry(struct schedule *s, struct schedule_entry *e)
 {
-    struct gc_arena gc = gc_new();
-    int n = 1000;
-    int n_mod = 25;
-
-    int i, j;
-    struct schedule_entry **array;
-    struct schedule *s = schedule_init();
-    struct schedule_entry *e;
-
-    CLEAR(z);
-    ALLOC_ARRAY(array, struct schedule_entry *, n);
-
-    printf("Creation/Insertion Phase\n");
-
-    for (i = 0; i < n; ++i)
+    if (s->earliest_wakeup == e)
     {
-        ALLOC_OBJ_CLEAR(array[i], struct schedule_entry);
-        tv_randomize(&array[i]->tv);
-        /*schedule_print (s);*/
-        /*schedule_verify (s);*/
-        schedule_add_modify(s, array[i]);
+        s->earliest_wakeup = NULL; /* invalidate cache */
     }
-
-    schedule_randomize_array(array, n);
-
-    /*schedule_print (s);*/
-    schedule_verify(s);
-
-    for (j = 1; j <= n_mod; ++j)
-    {
-        printf("Modification Phase Pass %d\n", j);
-
-        for (i = 0; i < n; ++i)
-        {
-            e = schedule_find_earliest_wakeup(s);
-            /*printf ("BEFORE %s\n", tv_string (&e->tv, &gc));*/
-            tv_randomize(&e->tv);
-            /*printf ("AFTER %s\n", tv_string (&e->tv, &gc));*/
-            schedule_add_modify(s, e);
-            /*schedule_verify (s);*/
-            /*schedule_print (s);*/
-        }
-        schedule_verify(s);
-        /*schedule_print (s);*/
-    }
-
-    /*printf ("INS=%d\n", z.ins);*/
-
-    while ((e = schedule_find_earliest_wakeup(s)))
-    {
-        schedule_remove_node(s, e);
-        /*schedule_verify (s);*/
-    }
-    schedule_verify(s);
-
-    printf("S->ROOT is %s\n", s->root ? "NOT NULL" : "NULL");
-
-    for (i = 0; i < n; ++i)
+    if (IN_TREE(e))
     {
-        free(array[i]);
+        schedule_unlink(s, e);
+        --s->size;
     }
-    free(array);
-    free(s);
-    gc_free(&gc);
 }
-
-#endif /* ifdef SCHEDULE_TEST */
@@ -21,39 +21,60 @@
  *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 
 /*
  * This code implements an efficient scheduler using
- * a random treap binary tree.
+ * a hierarchical timing wheel.
  *
  * The scheduler is used by the server executive to
  * keep track of which instances need service at a
  * known time in the future.  Instances need to
  * schedule events for things such as sending
  * a ping or scheduling a TLS renegotiation.
+ *
+ * Wakeup times are kept in ticks of 1/1024 second.
+ * Level 0 of the wheel has one slot per tick of the
+ * current 64 tick block, level 1 one slot per 64 tick
+ * block of the current 4096 tick block, and so on.
+ * An entry is kept on the lowest level whose block
+ * also contains the current tick, and is moved down
+ * (cascaded) when the current tick enters its slot.
+ * Adding and removing an entry is O(1), and entries
+ * are moved to the due list as their tick passes.
  */
 
-/* define to enable a special test mode */
-/*#define SCHEDULE_TEST*/
-
 #include "otime.h"
 #include "error.h"
 
+#define SCHEDULE_TICK_BITS  10   /* 1/1024 second per tick */
+#define SCHEDULE_SLOT_BITS  6
+#define SCHEDULE_SLOTS      (1 << SCHEDULE_SLOT_BITS)
+#define SCHEDULE_LEVELS     5    /* wheel spans 2^30 ticks, about 12 days */
+
+/* slot indices outside of the wheel */
+#define SCHEDULE_SLOT_FAR   (SCHEDULE_LEVELS * SCHEDULE_SLOTS) /* beyond the wheel */
+#define SCHEDULE_SLOT_DUE   (SCHEDULE_SLOT_FAR + 1)            /* tick has passed */
+
 struct schedule_entry
 {
     struct timeval tv;           /* wakeup time */
-    unsigned int pri;            /* random treap priority */
-    struct schedule_entry *parent; /* treap (btree) links */
-    struct schedule_entry *lt;
-    struct schedule_entry *gt;
+    uint64_t tick;               /* wakeup time in ticks */
+    int slot;                    /* index of the list this entry is on */
+    struct schedule_entry *next; /* slot list links */
+    struct schedule_entry **pprev; /* NULL if not scheduled */
 };
 
 struct schedule
 {
     struct schedule_entry *earliest_wakeup; /* cached earliest wakeup */
-    struct schedule_entry *root;          /* the root of the treap (btree) */
+    uint64_t tick;                          /* current tick */
+    uint64_t used[SCHEDULE_LEVELS];         /* bitmaps of non-empty slots */
+    struct schedule_entry **due_tail;       /* end of the due list */
+    int size;                               /* number of scheduled entries */
+    struct schedule_entry *slots[SCHEDULE_SLOT_DUE + 1];
 };
 
 /* Public functions */
@@ -64,27 +85,28 @@ void schedule_free(struct schedule *s);
 
 void schedule_remove_entry(struct schedule *s, struct schedule_entry *e);
 
-#ifdef SCHEDULE_TEST
-void schedule_test(void);
-
-#endif
+/*
+ * Move the current tick of the wheel forward to tv.  Entries
+ * whose wakeup time is not later than tv become due.  Should
+ * be called with the current time before looking for the
+ * earliest wakeup.
+ */
+void schedule_advance(struct schedule *s, const struct timeval *tv);
 
 /* Private Functions */
 
-/* is node already in tree? */
-#define IN_TREE(e) ((e)->pri)
+/* is entry already scheduled? */
+#define IN_TREE(e) ((e)->pprev != NULL)
 
-struct schedule_entry *schedule_find_least(struct schedule_entry *e);
+struct schedule_entry *schedule_find_least(struct schedule *s);
 
 void schedule_add_modify(struct schedule *s, struct schedule_entry *e);
 
-void schedule_remove_node(struct schedule *s, struct schedule_entry *e);
-
 /* Public inline functions */
 
 /*
  * Add a struct schedule_entry (whose storage is managed by
- * caller) to the btree.  tv signifies the wakeup time for
+ * caller) to the wheel.  tv signifies the wakeup time for
  * a future event.  sigma is a time interval measured
  * in microseconds -- the event window being represented
  * starts at (tv - sigma) and ends at (tv + sigma).
@@ -104,15 +126,14 @@ schedule_add_entry(struct schedule *s,
     {
         e->tv = *tv;
         schedule_add_modify(s, e);
-        s->earliest_wakeup = NULL; /* invalidate cache */
     }
 }
 
 /*
- * Return the node with the earliest wakeup time.  If two
- * nodes have the exact same wakeup time, select based on
- * the random priority assigned to each node (the priority
- * is randomized every time an entry is re-added).
+ * Return the node with the earliest wakeup time.  Entries
+ * that are already due are returned first, in the order
+ * in which they became due.  Entries that fall into the
+ * same tick are not ordered.
  */
 static inline struct schedule_entry *
 schedule_get_earliest_wakeup(struct schedule *s,
@@ -123,7 +144,7 @@ schedule_get_earliest_wakeup(struct schedule *s,
     /* cache result */
     if (!s->earliest_wakeup)
     {
-        s->earliest_wakeup = schedule_find_least(s->root);
+        s->earliest_wakeup = schedule_find_least(s);
     }
     ret = s->earliest_wakeup;
     if (ret)
@@ -134,4 +155,15 @@ schedule_get_earliest_wakeup(struct schedule *s,
     return ret;
 }
 
+/*
+ * Return an entry whose wakeup time had passed at the last
+ * schedule_advance(), or NULL.  Used to serve all entries that
+ * have become due in one pass.
+ */
+static inline struct schedule_entry *
+schedule_get_due(struct schedule *s)
+{
+    return s->slots[SCHEDULE_SLOT_DUE];
+}
+
 #endif /* ifndef SCHEDULE_H */
@@ -0,0 +1,318 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "script_queue.h"
+#include "errlevel.h"
+#include "platform.h"
+#include "run_command.h"
+
+#include "memdbg.h"
+
+struct script_queue *
+script_queue_new(int max_running)
+{
+    struct script_queue *sq;
+
+    ALLOC_OBJ_CLEAR(sq, struct script_queue);
+    sq->max_running = max_running;
+    return sq;
+}
+
+static void
+script_job_free(struct script_job *job)
+{
+    gc_free(&job->gc);
+    free(job);
+}
+
+/*
+ * Complete the deferred client-connect status file like the synchronous
+ * --client-connect path would: success unless the script failed, or
+ * nothing at all if the script has written "2" to defer itself.
+ */
+static void
+script_job_write_status(const char *status_file, bool ok)
+{
+    FILE *fp = fopen(status_file, "r+");
+    if (!fp)
+    {
+        /* the client is already gone */
+        return;
+    }
+
+    if (!ok || fgetc(fp) != '2')
+    {
+        rewind(fp);
+        fputc(ok ? '1' : '0', fp);
+    }
+    fclose(fp);
+}
+
+static void
+script_job_complete(struct script_job *job, bool ok)
+{
+    dmsg(D_MULTI_DEBUG, "SCRIPT QUEUE: %s %s finished, %s",
+         job->hook, job->argv[0], ok ? "success" : "failure");
+    if (job->status_file)
+    {
+        script_job_write_status(job->status_file, ok);
+    }
+}
+
+#if defined(ENABLE_FEATURE_EXECVE) && !defined(_WIN32)
+
+static bool
+script_job_start(struct script_job *job)
+{
+    const pid_t pid = openvpn_spawn(job->argv[0], job->argv, job->envp, -1, -1);
+    if (pid < (pid_t)0)
+    {
+        msg(M_WARN | M_ERRNO, "WARNING: unable to run %s", job->hook);
+        return false;
+    }
+    job->pid = pid;
+    return true;
+}
+
+/*
+ * Is a job with this key in the list, before the job stop?
+ */
+static bool
+script_queue_key_in(const struct script_job *job, const struct script_job *stop,
+                    const char *key)
+{
+    for (; job && job != stop; job = job->next)
+    {
+        if (job->key && !strcmp(job->key, key))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+script_queue_start(struct script_queue *sq)
+{
+    struct script_job *prev = NULL;
+    struct script_job *job = sq->pending_head;
+
+    while (job && sq->n_running < sq->max_running)
+    {
+        struct script_job *next = job->next;
+
+        if (job->key
+            && (script_queue_key_in(sq->running, NULL, job->key)
+                || script_queue_key_in(sq->pending_head, job, job->key)))
+        {
+            /* an earlier job for the same key has to finish first */
+            prev = job;
+            job = next;
+            continue;
+        }
+
+        /* unlink from the pending list */
+        if (prev)
+        {
+            prev->next = next;
+        }
+        else
+        {
+            sq->pending_head = next;
+        }
+        if (sq->pending_tail == job)
+        {
+            sq->pending_tail = prev;
+        }
+        --sq->n_pending;
+
+        if (script_job_start(job))
+        {
+            job->next = sq->running;
+            sq->running = job;
+            ++sq->n_running;
+        }
+        else
+        {
+            script_job_complete(job, false);
+            script_job_free(job);
+        }
+        job = next;
+    }
+}
+
+static void
+script_queue_reap(struct script_queue *sq, bool block)
+{
+    struct script_job **pp = &sq->running;
+
+    while (*pp)
+    {
+        struct script_job *job = *pp;
+        int stat = OPENVPN_EXECVE_ERROR;
+        const pid_t ret = waitpid(job->pid, &stat, block ? 0 : WNOHANG);
+
+        if (ret == 0)
+        {
+            /* still running */
+            pp = &job->next;
+            continue;
+        }
+        if (ret != job->pid)
+        {
+            stat = OPENVPN_EXECVE_ERROR;
+        }
+
+        const bool ok = platform_system_ok(stat);
+        if (!ok)
+        {
+            struct gc_arena gc = gc_new();
+            msg(M_WARN, "WARNING: Failed running command (%s): %s",
+                job->hook, system_error_message(stat, &gc));
+            gc_free(&gc);
+        }
+        script_job_complete(job, ok);
+
+        *pp = job->next;
+        --sq->n_running;
+        script_job_free(job);
+    }
+}
+
+void
+script_queue_process(struct script_queue *sq)
+{
+    if (script_queue_busy(sq))
+    {
+        script_queue_reap(sq, false);
+        script_queue_start(sq);
+    }
+}
+
+void
+script_queue_free(struct script_queue *sq)
+{
+    if (!sq)
+    {
+        return;
+    }
+
+    if (script_queue_busy(sq))
+    {
+        msg(M_INFO, "SCRIPT QUEUE: waiting for %d running and %d queued scripts",
+            sq->n_running, sq->n_pending);
+    }
+    while (script_queue_busy(sq))
+    {
+        script_queue_start(sq);
+        script_queue_reap(sq, true);
+    }
+    free(sq);
+}
+
+#else  /* if defined(ENABLE_FEATURE_EXECVE) && !defined(_WIN32) */
+
+/*
+ * Without fork() the scripts are run synchronously from
+ * script_queue_add(), so the queue never holds a job.
+ */
+void
+script_queue_process(struct script_queue *sq)
+{
+}
+
+void
+script_queue_free(struct script_queue *sq)
+{
+    free(sq);
+}
+
+#endif /* if defined(ENABLE_FEATURE_EXECVE) && !defined(_WIN32) */
+
+bool
+script_queue_add(struct script_queue *sq, const struct argv *a,
+                 const struct env_set *es, const char *key,
+                 const char *status_file, const char *hook)
+{
+    static bool warn_shown = false;
+    struct script_job *job;
+
+    ASSERT(a && a->argv[0]);
+
+    if (!openvpn_execve_allowed(S_SCRIPT))
+    {
+        if (!warn_shown)
+        {
+            msg(M_WARN, SCRIPT_SECURITY_WARNING);
+            warn_shown = true;
+        }
+        return false;
+    }
+
+    ALLOC_OBJ_CLEAR(job, struct script_job);
+    job->gc = gc_new();
+    job->key = key ? string_alloc(key, &job->gc) : NULL;
+    job->status_file = status_file ? string_alloc(status_file, &job->gc) : NULL;
+    job->hook = hook;
+
+#if defined(ENABLE_FEATURE_EXECVE) && !defined(_WIN32)
+    /* copy the arguments and the environment, both may change before the
+     * job is started */
+    ALLOC_ARRAY_CLEAR_GC(job->argv, char *, a->argc + 1, &job->gc);
+    for (size_t i = 0; i < a->argc; ++i)
+    {
+        job->argv[i] = string_alloc(a->argv[i], &job->gc);
+    }
+
+    job->envp = (char **)make_env_array(es, true, &job->gc);
+    for (char **e = job->envp; *e; ++e)
+    {
+        *e = string_alloc(*e, &job->gc);
+    }
+
+    if (sq->pending_tail)
+    {
+        sq->pending_tail->next = job;
+    }
+    else
+    {
+        sq->pending_head = job;
+    }
+    sq->pending_tail = job;
+    ++sq->n_pending;
+
+    script_queue_start(sq);
+#else
+    job->argv = a->argv;
+    script_job_complete(job, openvpn_run_script(a, es, 0, hook));
+    script_job_free(job);
+#endif
+
+    return true;
+}
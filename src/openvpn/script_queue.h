@@ -0,0 +1,116 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef SCRIPT_QUEUE_H
+#define SCRIPT_QUEUE_H
+
+/**
+ * @file
+ * Queue of external scripts that run without blocking the event loop.
+ *
+ * openvpn_run_script() forks and then waits for the script to finish,
+ * so a slow --learn-address or --client-connect script stalls every
+ * client of the server, and a reconnect storm of thousands of clients
+ * stalls it for minutes.  With --script-workers, these scripts are
+ * queued instead and at most the configured number of them run
+ * concurrently.  The event loop calls script_queue_process() to reap
+ * finished scripts and start the next ones.
+ *
+ * Jobs that are queued with the same key run in the order in which they
+ * were queued and never concurrently, so e.g. the "add" and "delete"
+ * learn-address calls for one address cannot overtake each other.
+ */
+
+#include "argv.h"
+#include "buffer.h"
+#include "env_set.h"
+
+/** How often the event loop looks at running scripts, in microseconds */
+#define SCRIPT_QUEUE_POLL_USEC 10000
+
+struct script_job
+{
+    struct script_job *next;
+    char **argv;
+    char **envp;
+    char *key;          /* serialization key, may be NULL */
+    char *status_file;  /* deferred status file to complete, may be NULL */
+    const char *hook;
+    pid_t pid;
+    struct gc_arena gc;
+};
+
+struct script_queue
+{
+    int max_running;
+    int n_running;
+    int n_pending;
+    struct script_job *running;
+    struct script_job *pending_head;
+    struct script_job *pending_tail;
+};
+
+/**
+ * Allocate a queue that runs up to max_running scripts at the same time.
+ */
+struct script_queue *script_queue_new(int max_running);
+
+/**
+ * Frees the queue.  Scripts that are still queued or running are run to
+ * completion first, so that no learn-address event is lost on shutdown.
+ */
+void script_queue_free(struct script_queue *sq);
+
+/**
+ * Queue the script a to be run with the environment es.  Both are
+ * copied, so they can be modified or freed after this call.
+ *
+ * @param sq            the queue
+ * @param a             the script and its arguments
+ * @param es            the environment of the script
+ * @param key           jobs with an equal key are run one after the
+ *                      other, NULL if there is no ordering constraint
+ * @param status_file   if not NULL, the client-connect deferred status
+ *                      file that is completed with the exit status of
+ *                      the script, unless the script deferred itself
+ * @param hook          the name of the option, used in log messages
+ *
+ * @return false if the script may not be run because of
+ *         --script-security.
+ */
+bool script_queue_add(struct script_queue *sq, const struct argv *a,
+                      const struct env_set *es, const char *key,
+                      const char *status_file, const char *hook);
+
+/**
+ * Reap the scripts that have finished and start queued ones.
+ */
+void script_queue_process(struct script_queue *sq);
+
+static inline bool
+script_queue_busy(const struct script_queue *sq)
+{
+    return sq && (sq->n_running || sq->n_pending);
+}
+
+#endif /* SCRIPT_QUEUE_H */
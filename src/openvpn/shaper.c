@@ -81,12 +81,22 @@ shaper_soonest_event(struct timeval *tv, int delay)
 void
 shaper_reset_wakeup(struct shaper *s)
 {
-    CLEAR(s->wakeup);
+    /* start with a full bucket */
+    CLEAR(s->last);
+    s->credit = 0;
 }
 
 void
 shaper_msg(struct shaper *s)
 {
-    msg(M_INFO, "Output Traffic Shaping initialized at %d bytes per second",
-        s->bytes_per_second);
+    if (s->burst)
+    {
+        msg(M_INFO, "Output Traffic Shaping initialized at %d bytes per second, burst %d bytes",
+            s->bytes_per_second, s->burst);
+    }
+    else
+    {
+        msg(M_INFO, "Output Traffic Shaping initialized at %d bytes per second",
+            s->bytes_per_second);
+    }
 }
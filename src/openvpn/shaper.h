@@ -33,8 +33,14 @@
 #include "interval.h"
 
 /*
- * A simple traffic shaper for
+ * A token bucket traffic shaper for
  * the output direction.
+ *
+ * Credit is earned at bytes_per_second up to burst bytes.  A packet
+ * may be sent as long as the credit is not negative, and its size is
+ * then subtracted, possibly driving the credit below zero.  Only
+ * when it is, the sender has to wait -- until the debt is paid back.
+ * With a burst of 0 this paces every packet, like a plain rate limit.
  */
 
 #define SHAPER_MIN 100          /* bytes per second */
@@ -42,18 +48,15 @@
 
 #define SHAPER_MAX_TIMEOUT 10   /* seconds */
 
-#define SHAPER_USE_FP
-
 struct shaper
 {
     int bytes_per_second;
-    struct timeval wakeup;
+    int burst;
 
-#ifdef SHAPER_USE_FP
-    double factor;
-#else
-    int factor;
-#endif
+    /* credit in bytes, scaled by 1000000 so that it is refilled by
+     * bytes_per_second per microsecond without rounding */
+    int64_t credit;
+    struct timeval last;        /* time the credit was last refilled */
 };
 
 void shaper_msg(struct shaper *s);
@@ -71,21 +74,16 @@ bool shaper_soonest_event(struct timeval *tv, int delay);
  */
 
 static inline void
-shaper_reset(struct shaper *s, int bytes_per_second)
+shaper_reset(struct shaper *s, int bytes_per_second, int burst)
 {
     s->bytes_per_second = constrain_int(bytes_per_second, SHAPER_MIN, SHAPER_MAX);
-
-#ifdef SHAPER_USE_FP
-    s->factor = 1000000.0 / (double)s->bytes_per_second;
-#else
-    s->factor = 1000000 / s->bytes_per_second;
-#endif
+    s->burst = constrain_int(burst, 0, SHAPER_MAX);
 }
 
 static inline void
-shaper_init(struct shaper *s, int bytes_per_second)
+shaper_init(struct shaper *s, int bytes_per_second, int burst)
 {
-    shaper_reset(s, bytes_per_second);
+    shaper_reset(s, bytes_per_second, burst);
     shaper_reset_wakeup(s);
 }
 
@@ -95,6 +93,40 @@ shaper_current_bandwidth(struct shaper *s)
     return s->bytes_per_second;
 }
 
+/*
+ * Add the credit earned since the last call.
+ */
+static inline void
+shaper_refill(struct shaper *s, const struct timeval *tv)
+{
+    const int64_t full = (int64_t)s->burst * 1000000;
+
+    if (tv_defined(&s->last))
+    {
+        int64_t elapsed = (int64_t)(tv->tv_sec - s->last.tv_sec) * 1000000
+                          + (tv->tv_usec - s->last.tv_usec);
+
+        /* long enough to fill any bucket, short enough not to overflow */
+        if (elapsed > (int64_t)3600 * 1000000)
+        {
+            elapsed = (int64_t)3600 * 1000000;
+        }
+        if (elapsed > 0)
+        {
+            s->credit += elapsed * s->bytes_per_second;
+            if (s->credit > full)
+            {
+                s->credit = full;
+            }
+        }
+    }
+    else
+    {
+        s->credit = full;
+    }
+    s->last = *tv;
+}
+
 /*
  * Returns traffic shaping delay in microseconds relative to current
  * time, or 0 if no delay.
@@ -105,53 +137,45 @@ shaper_delay(struct shaper *s)
     struct timeval tv;
     int delay = 0;
 
-    if (tv_defined(&s->wakeup))
+    ASSERT(!openvpn_gettimeofday(&tv, NULL));
+    shaper_refill(s, &tv);
+    if (s->credit < 0)
     {
-        ASSERT(!openvpn_gettimeofday(&tv, NULL));
-        delay = tv_subtract(&s->wakeup, &tv, SHAPER_MAX_TIMEOUT);
+        /* cannot exceed SHAPER_MAX_TIMEOUT, see shaper_wrote_bytes() */
+        delay = (int)(-s->credit / s->bytes_per_second) + 1;
+    }
 #ifdef SHAPER_DEBUG
-        dmsg(D_SHAPER_DEBUG, "SHAPER shaper_delay delay=%d", delay);
+    dmsg(D_SHAPER_DEBUG, "SHAPER shaper_delay delay=%d", delay);
 #endif
-    }
 
-    return delay > 0 ? delay : 0;
+    return delay;
 }
 
 
 /*
  * We are about to send a datagram of nbytes bytes.
  *
- * Compute when we can send another datagram,
- * based on target throughput (s->bytes_per_second).
+ * Take it from the credit, which may go negative
+ * by at most SHAPER_MAX_TIMEOUT worth of traffic.
  */
 static inline void
 shaper_wrote_bytes(struct shaper *s, int nbytes)
 {
+    const int64_t max_debt = (int64_t)s->bytes_per_second * SHAPER_MAX_TIMEOUT * 1000000;
     struct timeval tv;
 
-    /* compute delay in microseconds */
-    tv.tv_sec = 0;
-#ifdef SHAPER_USE_FP
-    tv.tv_usec = min_int((int)((double)max_int(nbytes, 100) * s->factor), (SHAPER_MAX_TIMEOUT*1000000));
-#else
-    tv.tv_usec = s->bytes_per_second
-                 ? min_int(max_int(nbytes, 100) * s->factor, (SHAPER_MAX_TIMEOUT*1000000))
-                 : 0;
-#endif
-
-    if (tv.tv_usec)
+    ASSERT(!openvpn_gettimeofday(&tv, NULL));
+    shaper_refill(s, &tv);
+    s->credit -= (int64_t)nbytes * 1000000;
+    if (s->credit < -max_debt)
     {
-        ASSERT(!openvpn_gettimeofday(&s->wakeup, NULL));
-        tv_add(&s->wakeup, &tv);
+        s->credit = -max_debt;
+    }
 
 #ifdef SHAPER_DEBUG
-        dmsg(D_SHAPER_DEBUG, "SHAPER shaper_wrote_bytes bytes=%d delay=%ld sec=%" PRIi64 " usec=%ld",
-             nbytes,
-             (long)tv.tv_usec,
-             (int64_t)s->wakeup.tv_sec,
-             (long)s->wakeup.tv_usec);
+    dmsg(D_SHAPER_DEBUG, "SHAPER shaper_wrote_bytes bytes=%d credit=%" PRIi64,
+         nbytes, s->credit / 1000000);
 #endif
-    }
 }
 
 #if 0
@@ -166,7 +190,7 @@ shaper_change_pct(struct shaper *s, int pct)
     const int orig_bandwidth = s->bytes_per_second;
     const int new_bandwidth = orig_bandwidth + (orig_bandwidth * pct / 100);
     ASSERT(s->bytes_per_second);
-    shaper_reset(s, new_bandwidth);
+    shaper_reset(s, new_bandwidth, s->burst);
     return s->bytes_per_second != orig_bandwidth;
 }
 #endif
@@ -638,6 +638,9 @@ process_signal(struct context *c)
 {
     bool ret = true;
 
+    /* messages about the signal are written right away */
+    msg_flush();
+
     remap_restart_signals(c);
 
     if (c->sig->signal_received == SIGTERM || c->sig->signal_received == SIGINT)
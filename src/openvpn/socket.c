@@ -39,6 +39,7 @@
 #include "manage.h"
 #include "openvpn.h"
 #include "forward.h"
+#include "handoff.h"
 
 #include "memdbg.h"
 
@@ -239,7 +240,8 @@ streqnull(const char *a, const char *b)
 
 /*
  * get_cached_dns_entry return 0 on success and -1
- * otherwise. (like getaddrinfo)
+ * otherwise. (like getaddrinfo)  Entries past their
+ * --resolv-cache lifetime are ignored.
  */
 static int
 get_cached_dns_entry(struct cached_dns_entry *dns_cache,
@@ -260,7 +262,8 @@ get_cached_dns_entry(struct cached_dns_entry *dns_cache,
         if (streqnull(ph->hostname, hostname)
             && streqnull(ph->servname, servname)
             && ph->ai_family == ai_family
-            && ph->flags == flags)
+            && ph->flags == flags
+            && (!ph->expires || ph->expires > now))
         {
             *ai = ph->ai;
             return 0;
@@ -269,6 +272,61 @@ get_cached_dns_entry(struct cached_dns_entry *dns_cache,
     return -1;
 }
 
+static void
+cached_dns_entry_free(void *arg)
+{
+    struct cached_dns_entry *ph = (struct cached_dns_entry *) arg;
+    freeaddrinfo(ph->ai);
+    free(ph);
+}
+
+/*
+ * Store ai in the dns cache, which takes ownership of it.  An expired
+ * entry for the same name is updated in place; its old addresses may
+ * still be referenced and are only released together with gc, like
+ * the entries themselves.
+ */
+static void
+add_cached_dns_entry(struct cached_dns_entry **dns_cache,
+                     struct gc_arena *gc,
+                     const char *hostname,
+                     const char *servname,
+                     int ai_family,
+                     int resolve_flags,
+                     time_t expires,
+                     struct addrinfo *ai)
+{
+    const int flags = resolve_flags & GETADDR_CACHE_MASK;
+    struct cached_dns_entry **pp = dns_cache;
+
+    for (; *pp; pp = &(*pp)->next)
+    {
+        struct cached_dns_entry *ph = *pp;
+        if (streqnull(ph->hostname, hostname)
+            && streqnull(ph->servname, servname)
+            && ph->ai_family == ai_family
+            && ph->flags == flags)
+        {
+            gc_addspecial(ph->ai, &gc_freeaddrinfo_callback, gc);
+            ph->ai = ai;
+            ph->expires = expires;
+            return;
+        }
+    }
+
+    struct cached_dns_entry *ph;
+    ALLOC_OBJ_CLEAR(ph, struct cached_dns_entry);
+    ph->ai = ai;
+    ph->hostname = hostname;
+    ph->servname = servname;
+    ph->ai_family = ai_family;
+    ph->flags = flags;
+    ph->expires = expires;
+    *pp = ph;
+
+    gc_addspecial(ph, &cached_dns_entry_free, gc);
+}
+
 
 static int
 do_preresolve_host(struct context *c,
@@ -296,30 +354,8 @@ do_preresolve_host(struct context *c,
                                  af, &ai);
     if (status == 0)
     {
-        struct cached_dns_entry *ph;
-
-        ALLOC_OBJ_CLEAR_GC(ph, struct cached_dns_entry, &c->gc);
-        ph->ai = ai;
-        ph->hostname = hostname;
-        ph->servname = servname;
-        ph->flags = flags & GETADDR_CACHE_MASK;
-
-        if (!c->c1.dns_cache)
-        {
-            c->c1.dns_cache = ph;
-        }
-        else
-        {
-            struct cached_dns_entry *prev = c->c1.dns_cache;
-            while (prev->next)
-            {
-                prev = prev->next;
-            }
-            prev->next = ph;
-        }
-
-        gc_addspecial(ai, &gc_freeaddrinfo_callback, &c->gc);
-
+        add_cached_dns_entry(&c->c1.dns_cache, &c->gc, hostname, servname,
+                             af, flags, 0, ai);
     }
     return status;
 }
@@ -888,6 +924,7 @@ socket_set_rcvbuf(socket_descriptor_t sd, int size)
     }
     return true;
 #endif
+    return false;
 }
 
 static void
@@ -951,6 +988,77 @@ socket_set_mark(socket_descriptor_t sd, int mark)
 #endif
 }
 
+static inline void
+socket_set_busy_poll(socket_descriptor_t sd, int usec, bool prefer, int budget)
+{
+#if defined(TARGET_LINUX) && defined(SO_BUSY_POLL)
+    if (usec && setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL, (void *) &usec, sizeof(usec)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt SO_BUSY_POLL=%d failed", usec);
+    }
+#ifdef SO_PREFER_BUSY_POLL
+    int on = 1;
+    if (usec && prefer
+        && setsockopt(sd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (void *) &on, sizeof(on)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt SO_PREFER_BUSY_POLL failed");
+    }
+#endif
+#ifdef SO_BUSY_POLL_BUDGET
+    /* more than 64 packets per poll need CAP_NET_ADMIN */
+    if (usec && budget
+        && setsockopt(sd, SOL_SOCKET, SO_BUSY_POLL_BUDGET, (void *) &budget, sizeof(budget)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt SO_BUSY_POLL_BUDGET=%d failed", budget);
+    }
+#endif
+#endif
+}
+
+static inline void
+socket_set_tcp_notsent_lowat(socket_descriptor_t sd, int bytes)
+{
+#if defined(IPPROTO_TCP) && defined(TCP_NOTSENT_LOWAT)
+    if (bytes && setsockopt(sd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, (void *) &bytes, sizeof(bytes)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt TCP_NOTSENT_LOWAT=%d failed", bytes);
+    }
+#endif
+}
+
+/*
+ * Set up TCP Fast Open on a new TCP socket: a listening socket takes data
+ * in the SYN of clients that have a cookie, a connecting socket holds back
+ * the SYN until the first write so that it can carry the data.
+ */
+static void
+socket_set_tcp_fastopen(socket_descriptor_t sd, bool server)
+{
+#if defined(IPPROTO_TCP) && defined(TCP_FASTOPEN)
+    if (server)
+    {
+        /* queue of connections not through the handshake yet, as the
+         * backlog of listen() */
+        int qlen = 32;
+        if (setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN, (void *) &qlen, sizeof(qlen)) != 0)
+        {
+            msg(M_WARN | M_ERRNO, "NOTE: setsockopt TCP_FASTOPEN=%d failed", qlen);
+        }
+        return;
+    }
+#endif
+#if defined(IPPROTO_TCP) && defined(TCP_FASTOPEN_CONNECT)
+    if (!server)
+    {
+        int on = 1;
+        if (setsockopt(sd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, (void *) &on, sizeof(on)) != 0)
+        {
+            msg(M_WARN | M_ERRNO, "NOTE: setsockopt TCP_FASTOPEN_CONNECT failed");
+        }
+    }
+#endif
+}
+
 static bool
 socket_set_flags(socket_descriptor_t sd, unsigned int sockflags)
 {
@@ -990,6 +1098,79 @@ link_socket_update_buffer_sizes(struct link_socket *ls, int rcvbuf, int sndbuf)
     }
 }
 
+counter_type link_socket_drops_global; /* GLOBAL */
+
+#if defined(TARGET_LINUX) && defined(SO_MEMINFO)
+/* the SO_MEMINFO array, see <linux/sock_diag.h> */
+#define LINK_MEMINFO_DROPS 8
+#define LINK_MEMINFO_VARS 9
+#endif
+
+/*
+ * Account for datagrams the kernel dropped on a UDP link socket since
+ * the last call, mostly because the receive buffer was full.  With
+ * --rcvbuf-max the receive buffer is doubled on every drop until it
+ * reaches that size.  Checks at most once per second.
+ */
+void
+link_socket_check_drops(struct link_socket *ls)
+{
+#ifdef LINK_MEMINFO_DROPS
+    uint32_t meminfo[LINK_MEMINFO_VARS];
+    socklen_t len = sizeof(meminfo);
+
+    if (!ls || !socket_defined(ls->sd) || !proto_is_udp(ls->info.proto)
+        || ls->drops_checked == now)
+    {
+        return;
+    }
+    ls->drops_checked = now;
+
+    if (getsockopt(ls->sd, SOL_SOCKET, SO_MEMINFO, (void *) meminfo, &len) != 0
+        || len < sizeof(meminfo))
+    {
+        return;
+    }
+
+    const uint32_t drops = meminfo[LINK_MEMINFO_DROPS] - ls->drops;
+    ls->drops = meminfo[LINK_MEMINFO_DROPS];
+    if (drops == 0)
+    {
+        return;
+    }
+    link_socket_drops_global += drops;
+
+    struct socket_buffer_size *sbs = &ls->socket_buffer_sizes;
+    /* the kernel reports twice the size that was set */
+    const int rcvbuf = socket_get_rcvbuf(ls->sd) / 2;
+
+    if (rcvbuf > 0 && rcvbuf < sbs->rcvbuf_max)
+    {
+        sbs->rcvbuf = min_int(rcvbuf * 2, sbs->rcvbuf_max);
+        socket_set_rcvbuf(ls->sd, sbs->rcvbuf);
+
+        const int grown = socket_get_rcvbuf(ls->sd) / 2;
+        if (grown > rcvbuf)
+        {
+            msg(M_INFO, "UDP: kernel dropped %u datagram(s), receive buffer "
+                "grown to %d bytes", drops, grown);
+        }
+        else
+        {
+            msg(M_WARN, "UDP: kernel dropped %u datagram(s), cannot grow the "
+                "receive buffer beyond %d bytes (see net.core.rmem_max)",
+                drops, rcvbuf);
+            sbs->rcvbuf_max = 0;
+        }
+    }
+    else
+    {
+        msg(D_LINK_ERRORS, "UDP: kernel dropped %u datagram(s), receive "
+            "buffer is full (%d bytes)", drops, rcvbuf);
+    }
+#endif /* ifdef LINK_MEMINFO_DROPS */
+}
+
 /*
  * SOCKET INITIALIZATION CODE.
  * Create a TCP/UDP socket
@@ -1126,6 +1307,12 @@ create_socket(struct link_socket *sock, struct addrinfo *addr)
     else if (addr->ai_protocol == IPPROTO_TCP || addr->ai_socktype == SOCK_STREAM)
     {
         sock->sd = create_socket_tcp(addr);
+
+        /* a proxy would only see our first bytes, not the peer */
+        if (sock->tcp_fastopen && !sock->http_proxy && !sock->socks_proxy)
+        {
+            socket_set_tcp_fastopen(sock->sd, sock->info.proto == PROTO_TCP_SERVER);
+        }
     }
     else
     {
@@ -1141,6 +1328,10 @@ create_socket(struct link_socket *sock, struct addrinfo *addr)
     /* set socket to --mark packets with given value */
     socket_set_mark(sock->sd, sock->mark);
 
+    /* poll the device queue from the socket, see --busy-poll */
+    socket_set_busy_poll(sock->sd, sock->busy_poll, sock->busy_poll_prefer,
+                         sock->busy_poll_budget);
+
 #if defined(TARGET_LINUX)
     if (sock->bind_dev)
     {
@@ -1210,6 +1401,23 @@ socket_do_listen(socket_descriptor_t sd,
     gc_free(&gc);
 }
 
+bool
+link_socket_accept(struct link_socket *sock)
+{
+    ASSERT(!socket_defined(sock->accepted_sd));
+
+    sock->accepted_sd = accept(sock->sd, NULL, NULL);
+    if (!socket_defined(sock->accepted_sd))
+    {
+        if (!ignore_sys_error(openvpn_errno(), false))
+        {
+            msg(D_LINK_ERRORS | M_ERRNO, "TCP: accept(%d) failed", (int)sock->sd);
+        }
+        return false;
+    }
+    return true;
+}
+
 socket_descriptor_t
 socket_do_accept(socket_descriptor_t sd,
                  struct link_socket_actual *act,
@@ -1430,24 +1638,33 @@ socket_bind(socket_descriptor_t sd,
     gc_free(&gc);
 }
 
-int
-openvpn_connect(socket_descriptor_t sd,
-                const struct sockaddr *remote,
-                int connect_timeout,
-                volatile int *signal_received)
+/*
+ * Start a non-blocking connect, returns 0 or the errno of connect(),
+ * usually EINPROGRESS.
+ */
+static int
+openvpn_connect_start(socket_descriptor_t sd, const struct sockaddr *remote)
 {
-    int status = 0;
-
 #ifdef TARGET_ANDROID
     protect_fd_nonlocal(sd, remote);
 #endif
 
     set_nonblock(sd);
-    status = connect(sd, remote, af_addr_size(remote->sa_family));
-    if (status)
+    if (connect(sd, remote, af_addr_size(remote->sa_family)))
     {
-        status = openvpn_errno();
+        return openvpn_errno();
     }
+    return 0;
+}
+
+int
+openvpn_connect(socket_descriptor_t sd,
+                const struct sockaddr *remote,
+                int connect_timeout,
+                volatile int *signal_received)
+{
+    int status = openvpn_connect_start(sd, remote);
+
     if (
 #ifdef _WIN32
         status == WSAEWOULDBLOCK
@@ -1603,124 +1820,398 @@ done:
     gc_free(&gc);
 }
 
-/*
- * Stream buffer handling prototypes -- stream_buf is a helper class
- * to assist in the packetization of stream transport protocols
- * such as TCP.
- */
-
-static void
-stream_buf_init(struct stream_buf *sb, struct buffer *buf,
-                const unsigned int sockflags, const int proto);
-
-static void
-stream_buf_close(struct stream_buf *sb);
+#if POLL
 
-static bool
-stream_buf_added(struct stream_buf *sb, int length_added);
+/* "Connection Attempt Delay" recommended by RFC 8305 */
+#define CONNECT_RACE_DELAY_MS 250
 
-/* For stream protocols, allocate a buffer to build up packet.
- * Called after frame has been finalized. */
+/* max addresses of one --remote raced against each other */
+#define CONNECT_RACE_MAX 8
 
-static void
-socket_frame_init(const struct frame *frame, struct link_socket *sock)
+/*
+ * Put up to CONNECT_RACE_MAX addresses starting at first into the order
+ * they are tried in: alternating between the address families, starting
+ * with the family of first, and otherwise in resolver order.  *last is
+ * set to the last address of the list that was taken.
+ */
+static int
+connect_race_order(struct addrinfo *first, struct addrinfo **order,
+                   struct addrinfo **last)
 {
-#ifdef _WIN32
-    overlapped_io_init(&sock->reads, frame, FALSE);
-    overlapped_io_init(&sock->writes, frame, TRUE);
-    sock->rw_handle.read = sock->reads.overlapped.hEvent;
-    sock->rw_handle.write = sock->writes.overlapped.hEvent;
-#endif
+    struct addrinfo *fam[2][CONNECT_RACE_MAX];
+    int nfam[2] = { 0, 0 };
+    int n = 0;
 
-    if (link_socket_connection_oriented(sock))
+    for (struct addrinfo *ai = first;
+         ai && nfam[0] + nfam[1] < CONNECT_RACE_MAX;
+         ai = ai->ai_next)
     {
-#ifdef _WIN32
-        stream_buf_init(&sock->stream_buf,
-                        &sock->reads.buf_init,
-                        sock->sockflags,
-                        sock->info.proto);
-#else
-        alloc_buf_sock_tun(&sock->stream_buf_data, frame);
-
-        stream_buf_init(&sock->stream_buf,
-                        &sock->stream_buf_data,
-                        sock->sockflags,
-                        sock->info.proto);
-#endif
+        const int f = ai->ai_family != first->ai_family;
+        fam[f][nfam[f]++] = ai;
+        *last = ai;
     }
-}
-
-static void
-resolve_bind_local(struct link_socket *sock, const sa_family_t af)
-{
-    struct gc_arena gc = gc_new();
 
-    /* resolve local address if undefined */
-    if (!sock->info.lsa->bind_local)
+    for (int i = 0; n < nfam[0] + nfam[1]; ++i)
     {
-        int flags = GETADDR_RESOLVE | GETADDR_WARN_ON_SIGNAL
-                    |GETADDR_FATAL | GETADDR_PASSIVE;
-        int status;
-
-        if (proto_is_dgram(sock->info.proto))
-        {
-            flags |= GETADDR_DATAGRAM;
-        }
-
-        /* will return AF_{INET|INET6}from local_host */
-        status = get_cached_dns_entry(sock->dns_cache,
-                                      sock->local_host,
-                                      sock->local_port,
-                                      af,
-                                      flags,
-                                      &sock->info.lsa->bind_local);
-
-        if (status)
+        if (i < nfam[0])
         {
-            status = openvpn_getaddrinfo(flags, sock->local_host, sock->local_port, 0,
-                                         NULL, af, &sock->info.lsa->bind_local);
+            order[n++] = fam[0][i];
         }
-
-        if (status !=0)
+        if (i < nfam[1])
         {
-            msg(M_FATAL, "getaddrinfo() failed for local \"%s:%s\": %s",
-                sock->local_host, sock->local_port,
-                gai_strerror(status));
+            order[n++] = fam[1][i];
         }
     }
+    return n;
+}
 
-    gc_free(&gc);
+static int
+connect_race_elapsed_ms(const struct timeval *start)
+{
+    struct timeval tv;
+
+    openvpn_gettimeofday(&tv, NULL);
+    return (int) ((tv.tv_sec - start->tv_sec) * 1000
+                  + (tv.tv_usec - start->tv_usec) / 1000);
 }
 
+/*
+ * Connect to one of the addresses a --remote resolved to, in the manner
+ * of RFC 8305 ("Happy Eyeballs"): a new attempt is started every
+ * CONNECT_RACE_DELAY_MS, or as soon as all running attempts have failed,
+ * and the first socket to connect wins.  sock->sd has already been
+ * created for the first address.
+ */
 static void
-resolve_remote(struct link_socket *sock,
-               int phase,
-               const char **remote_dynamic,
-               struct signal_info *sig_info)
+socket_connect_race(struct link_socket *sock, struct signal_info *sig_info)
 {
-    volatile int *signal_received = sig_info ? &sig_info->signal_received : NULL;
     struct gc_arena gc = gc_new();
+    struct addrinfo *order[CONNECT_RACE_MAX];
+    struct addrinfo *last = NULL;
+    struct pollfd fds[CONNECT_RACE_MAX];
+    const int n = connect_race_order(sock->info.lsa->current_remote, order, &last);
+    const int timeout_ms = get_server_poll_remaining_time(sock->server_poll_timeout) * 1000;
+    int started = 0;
+    int failed = 0;
+    int winner = -1;
+    int next_start_ms = 0;
+    int elapsed_ms = 0;
+    struct timeval start;
+
+    msg(M_INFO, "Attempting to establish TCP connection with %s or %d more address(es) of %s",
+        print_sockaddr(order[0]->ai_addr, &gc), n - 1, sock->remote_host);
 
-    /* resolve remote address if undefined */
-    if (!sock->info.lsa->remote_list)
+#ifdef ENABLE_MANAGEMENT
+    if (management)
     {
-        if (sock->remote_host)
+        management_set_state(management,
+                             OPENVPN_STATE_TCP_CONNECT,
+                             NULL,
+                             NULL,
+                             NULL,
+                             NULL,
+                             NULL);
+    }
+#endif
+
+    openvpn_gettimeofday(&start, NULL);
+    while (winner < 0 && failed < n)
+    {
+        if (started < n && (elapsed_ms >= next_start_ms || failed == started))
         {
-            unsigned int flags = sf2gaf(GETADDR_RESOLVE|GETADDR_UPDATE_MANAGEMENT_STATE, sock->sockflags);
-            int retry = 0;
-            int status = -1;
-            struct addrinfo *ai;
-            if (proto_is_dgram(sock->info.proto))
+            struct addrinfo *ai = order[started];
+            int status;
+
+            if (started > 0)
             {
-                flags |= GETADDR_DATAGRAM;
+                create_socket(sock, ai);
             }
+            fds[started].fd = sock->sd;
+            fds[started].events = POLLOUT;
+            fds[started].revents = 0;
+            sock->sd = SOCKET_UNDEFINED;
 
-            if (sock->resolve_retry_seconds == RESOLV_RETRY_INFINITE)
+            status = openvpn_connect_start(fds[started].fd, ai->ai_addr);
+            if (status == 0)
             {
-                if (phase == 2)
-                {
-                    flags |= (GETADDR_TRY_ONCE | GETADDR_FATAL);
-                }
+                winner = started;
+            }
+            else if (status != EINPROGRESS)
+            {
+                msg(D_LINK_ERRORS, "TCP: connect to %s failed: %s",
+                    print_sockaddr(ai->ai_addr, &gc), strerror(status));
+                openvpn_close_socket(fds[started].fd);
+                fds[started].fd = SOCKET_UNDEFINED;
+                ++failed;
+            }
+            next_start_ms = elapsed_ms + CONNECT_RACE_DELAY_MS;
+            ++started;
+            continue;
+        }
+
+        if (elapsed_ms >= timeout_ms)
+        {
+            msg(D_LINK_ERRORS, "TCP: connect to %s timed out",
+                sock->remote_host);
+            break;
+        }
+
+        int wait_ms = min_int(timeout_ms - elapsed_ms, 1000);
+        if (started < n)
+        {
+            wait_ms = min_int(wait_ms, next_start_ms - elapsed_ms);
+        }
+
+        const int status = poll(fds, started, wait_ms);
+
+        get_signal(&sig_info->signal_received);
+        if (sig_info->signal_received)
+        {
+            break;
+        }
+        if (status == 0)
+        {
+            management_sleep(0);
+        }
+
+        for (int i = 0; status > 0 && i < started && winner < 0; ++i)
+        {
+            int val = 0;
+            socklen_t len = sizeof(val);
+
+            if (fds[i].fd == SOCKET_UNDEFINED || !fds[i].revents)
+            {
+                continue;
+            }
+            if (getsockopt(fds[i].fd, SOL_SOCKET, SO_ERROR, (void *) &val, &len) != 0)
+            {
+                val = openvpn_errno();
+            }
+            if (val == 0)
+            {
+                winner = i;
+                break;
+            }
+
+            msg(D_LINK_ERRORS, "TCP: connect to %s failed: %s",
+                print_sockaddr(order[i]->ai_addr, &gc), strerror(val));
+            openvpn_close_socket(fds[i].fd);
+            fds[i].fd = SOCKET_UNDEFINED;
+            ++failed;
+        }
+
+        elapsed_ms = connect_race_elapsed_ms(&start);
+    }
+
+    for (int i = 0; i < started; ++i)
+    {
+        if (i != winner && fds[i].fd != SOCKET_UNDEFINED)
+        {
+            openvpn_close_socket(fds[i].fd);
+        }
+    }
+
+    if (winner >= 0)
+    {
+        sock->sd = fds[winner].fd;
+        sock->info.af = order[winner]->ai_family;
+        sock->info.lsa->current_remote = order[winner];
+        msg(M_INFO, "TCP connection established with %s",
+            print_sockaddr(order[winner]->ai_addr, &gc));
+    }
+    else if (!sig_info->signal_received)
+    {
+        /* all of them have been tried, continue after the last one */
+        sock->info.lsa->current_remote = last;
+        register_signal(sig_info, SIGUSR1, "connection-failed");
+    }
+
+    gc_free(&gc);
+}
+
+#endif /* if POLL */
+
+/*
+ * Stream buffer handling prototypes -- stream_buf is a helper class
+ * to assist in the packetization of stream transport protocols
+ * such as TCP.
+ */
+
+static void
+stream_buf_init(struct stream_buf *sb, struct buffer *buf,
+                const unsigned int sockflags, const int proto);
+
+static void
+stream_buf_close(struct stream_buf *sb);
+
+static bool
+stream_buf_added(struct stream_buf *sb, int length_added);
+
+#if ENABLE_UDP_RECV_BATCH
+static void
+link_socket_recv_batch_init(struct link_socket_recv_batch *rb,
+                            const struct frame *frame);
+
+static void
+link_socket_recv_batch_free(struct link_socket_recv_batch *rb);
+
+#endif
+
+#if ENABLE_UDP_SEND_BATCH
+static void
+link_socket_send_batch_init(struct link_socket *sock,
+                            const struct frame *frame);
+
+static void
+link_socket_send_batch_free(struct link_socket_send_batch *sb);
+
+#endif
+
+#if ENABLE_UDP_RECV_GRO
+static void
+link_socket_recv_gro_enable(struct link_socket *sock);
+
+#endif
+
+#if ENABLE_UDP_SEND_ZEROCOPY
+static void
+link_socket_zerocopy_enable(struct link_socket *sock);
+
+static void
+link_socket_zerocopy_reap(struct link_socket *sock);
+
+#endif
+
+/* For stream protocols, allocate a buffer to build up packet, for
+ * batched UDP reads and writes the recvmmsg()/sendmmsg() buffers.
+ * Called after frame has been finalized. */
+
+static void
+socket_frame_init(const struct frame *frame, struct link_socket *sock)
+{
+#ifdef _WIN32
+    /* keep several datagrams in flight, a stream has a single buffer */
+    sock->n_io = proto_is_udp(sock->info.proto) ? SOCKET_IO_QUEUE : 1;
+    for (int i = 0; i < sock->n_io; ++i)
+    {
+        overlapped_io_init(&sock->reads[i], frame, FALSE);
+        overlapped_io_init(&sock->writes[i], frame, TRUE);
+    }
+    sock->read_next = sock->write_next = 0;
+    sock->rw_handle.read = socket_reads(sock)->overlapped.hEvent;
+    sock->rw_handle.write = socket_writes(sock)->overlapped.hEvent;
+#endif
+
+    if (link_socket_connection_oriented(sock))
+    {
+#ifdef _WIN32
+        stream_buf_init(&sock->stream_buf,
+                        &sock->reads[0].buf_init,
+                        sock->sockflags,
+                        sock->info.proto);
+#else
+        sock->stream_buf_data = alloc_buf(BUF_SIZE(frame) + (STREAM_BUF_PACKETS - 1)
+                                          * (frame->buf.payload_size + sizeof(packet_size_type)));
+        ASSERT(buf_init(&sock->stream_buf_data, frame->buf.headroom));
+        sock->stream_buf_data.len = frame->buf.payload_size;
+
+        stream_buf_init(&sock->stream_buf,
+                        &sock->stream_buf_data,
+                        sock->sockflags,
+                        sock->info.proto);
+#endif
+    }
+#if ENABLE_UDP_RECV_BATCH
+    else if (sock->info.proto == PROTO_UDP && !sock->socks_proxy
+             && (sock->recv_batch.size > 1
+#if ENABLE_UDP_RECV_GRO
+                 || sock->recv_batch.gro
+#endif
+                 ))
+    {
+        link_socket_recv_batch_init(&sock->recv_batch, frame);
+    }
+#endif
+#if ENABLE_UDP_SEND_BATCH
+    if (sock->info.proto == PROTO_UDP && !sock->socks_proxy
+        && sock->send_batch.size > 1)
+    {
+        link_socket_send_batch_init(sock, frame);
+    }
+#endif
+}
+
+static void
+resolve_bind_local(struct link_socket *sock, const sa_family_t af)
+{
+    struct gc_arena gc = gc_new();
+
+    /* resolve local address if undefined */
+    if (!sock->info.lsa->bind_local)
+    {
+        int flags = GETADDR_RESOLVE | GETADDR_WARN_ON_SIGNAL
+                    |GETADDR_FATAL | GETADDR_PASSIVE;
+        int status;
+
+        if (proto_is_dgram(sock->info.proto))
+        {
+            flags |= GETADDR_DATAGRAM;
+        }
+
+        /* will return AF_{INET|INET6}from local_host */
+        status = get_cached_dns_entry(*sock->dns_cache,
+                                      sock->local_host,
+                                      sock->local_port,
+                                      af,
+                                      flags,
+                                      &sock->info.lsa->bind_local);
+
+        if (status)
+        {
+            status = openvpn_getaddrinfo(flags, sock->local_host, sock->local_port, 0,
+                                         NULL, af, &sock->info.lsa->bind_local);
+        }
+
+        if (status !=0)
+        {
+            msg(M_FATAL, "getaddrinfo() failed for local \"%s:%s\": %s",
+                sock->local_host, sock->local_port,
+                gai_strerror(status));
+        }
+    }
+
+    gc_free(&gc);
+}
+
+static void
+resolve_remote(struct link_socket *sock,
+               int phase,
+               const char **remote_dynamic,
+               struct signal_info *sig_info)
+{
+    volatile int *signal_received = sig_info ? &sig_info->signal_received : NULL;
+    struct gc_arena gc = gc_new();
+
+    /* resolve remote address if undefined */
+    if (!sock->info.lsa->remote_list)
+    {
+        if (sock->remote_host)
+        {
+            unsigned int flags = sf2gaf(GETADDR_RESOLVE|GETADDR_UPDATE_MANAGEMENT_STATE, sock->sockflags);
+            int retry = 0;
+            int status = -1;
+            struct addrinfo *ai;
+            if (proto_is_dgram(sock->info.proto))
+            {
+                flags |= GETADDR_DATAGRAM;
+            }
+
+            if (sock->resolve_retry_seconds == RESOLV_RETRY_INFINITE)
+            {
+                if (phase == 2)
+                {
+                    flags |= (GETADDR_TRY_ONCE | GETADDR_FATAL);
+                }
                 retry = 0;
             }
             else if (phase == 1)
@@ -1753,20 +2244,31 @@ resolve_remote(struct link_socket *sock,
             }
 
 
-            status = get_cached_dns_entry(sock->dns_cache,
+            status = get_cached_dns_entry(*sock->dns_cache,
                                           sock->remote_host,
                                           sock->remote_port,
                                           sock->info.af,
                                           flags, &ai);
+            bool cached = status == 0;
             if (status)
             {
                 status = openvpn_getaddrinfo(flags, sock->remote_host, sock->remote_port,
                                              retry, sig_info, sock->info.af, &ai);
+                if (status == 0 && sock->resolv_cache > 0)
+                {
+                    /* reuse the addresses on reconnects, see --resolv-cache */
+                    add_cached_dns_entry(sock->dns_cache, sock->dns_cache_gc,
+                                         sock->remote_host, sock->remote_port,
+                                         sock->info.af, flags,
+                                         now + sock->resolv_cache, ai);
+                    cached = true;
+                }
             }
 
             if (status == 0)
             {
                 sock->info.lsa->remote_list = ai;
+                sock->info.lsa->remote_list_cached = cached;
                 sock->info.lsa->current_remote = ai;
 
                 dmsg(D_SOCKET_DEBUG,
@@ -1827,6 +2329,7 @@ link_socket_new(void)
     ALLOC_OBJ_CLEAR(sock, struct link_socket);
     sock->sd = SOCKET_UNDEFINED;
     sock->ctrl_sd = SOCKET_UNDEFINED;
+    sock->accepted_sd = SOCKET_UNDEFINED;
     return sock;
 }
 
@@ -1844,7 +2347,9 @@ link_socket_init_phase1(struct context *c, int mode)
     sock->local_port = o->ce.local_port;
     sock->remote_host = remote_host;
     sock->remote_port = remote_port;
-    sock->dns_cache = c->c1.dns_cache;
+    sock->dns_cache = &c->c1.dns_cache;
+    sock->dns_cache_gc = &c->gc;
+    sock->resolv_cache = o->resolv_cache;
     sock->http_proxy = c->c1.http_proxy;
     sock->socks_proxy = c->c1.socks_proxy;
     sock->bind_local = o->ce.bind_local;
@@ -1856,6 +2361,7 @@ link_socket_init_phase1(struct context *c, int mode)
 #endif
 
     sock->socket_buffer_sizes.rcvbuf = o->rcvbuf;
+    sock->socket_buffer_sizes.rcvbuf_max = o->rcvbuf_max;
     sock->socket_buffer_sizes.sndbuf = o->sndbuf;
 
     sock->sockflags = o->sockflags;
@@ -1866,7 +2372,30 @@ link_socket_init_phase1(struct context *c, int mode)
     }
 #endif
     sock->mark = o->mark;
+    sock->busy_poll = o->busy_poll;
+    sock->busy_poll_prefer = o->busy_poll_prefer;
+    sock->busy_poll_budget = o->busy_poll_budget;
+    sock->tcp_notsent_lowat = o->tcp_notsent_lowat;
+    sock->tcp_fastopen = o->tcp_fastopen;
     sock->bind_dev = o->bind_dev;
+#if ENABLE_UDP_RECV_BATCH
+    if (o->mode == MODE_SERVER)
+    {
+        sock->recv_batch.size = o->udp_recv_batch;
+#if ENABLE_UDP_RECV_GRO
+        sock->recv_batch.gro = o->udp_recv_gro;
+#endif
+    }
+#endif
+#if ENABLE_UDP_SEND_BATCH
+    if (o->mode == MODE_SERVER)
+    {
+        sock->send_batch.size = o->udp_send_batch;
+#if ENABLE_UDP_SEND_ZEROCOPY
+        sock->send_batch.zerocopy = o->udp_send_zerocopy;
+#endif
+    }
+#endif
 
     sock->info.proto = o->ce.proto;
     sock->info.af = o->ce.af;
@@ -1882,10 +2411,37 @@ link_socket_init_phase1(struct context *c, int mode)
     {
         ASSERT(c->c2.accept_from);
         ASSERT(sock->info.proto == PROTO_TCP_SERVER);
-        sock->sd = c->c2.accept_from->sd;
+        if (socket_defined(c->c2.accept_from->accepted_sd))
+        {
+            /* take over the connection accepted by the parent */
+            sock->sd = c->c2.accept_from->accepted_sd;
+            sock->accepted = true;
+            c->c2.accept_from->accepted_sd = SOCKET_UNDEFINED;
+        }
+        else
+        {
+            sock->sd = c->c2.accept_from->sd;
+        }
         /* inherit (possibly guessed) info AF from parent context */
         sock->info.af = c->c2.accept_from->info.af;
     }
+#if UNIX_SOCK_SUPPORT
+    else if (c->handoff && socket_defined(c->handoff->link_sd))
+    {
+        /* take over the bound socket of the previous process, --handoff */
+        struct openvpn_sockaddr local;
+        socklen_t len = sizeof(local.addr);
+
+        sock->sd = c->handoff->link_sd;
+        c->handoff->link_sd = SOCKET_UNDEFINED;
+        sock->sockflags |= SF_GETADDRINFO_DGRAM;
+        if (getsockname(sock->sd, &local.addr.sa, &len) == 0)
+        {
+            sock->info.af = local.addr.sa.sa_family;
+        }
+        msg(M_INFO, "HANDOFF: using the UDP socket of the previous process");
+    }
+#endif
 
     /* are we running in HTTP proxy mode? */
     if (sock->http_proxy)
@@ -1946,6 +2502,13 @@ phase2_set_socket_flags(struct link_socket *sock)
     /* set misc socket parameters */
     socket_set_flags(sock->sd, sock->sockflags);
 
+    /* keep unsent data in our queue rather than the kernel's, see
+     * --tcp-notsent-lowat */
+    if (proto_is_tcp(sock->info.proto))
+    {
+        socket_set_tcp_notsent_lowat(sock->sd, sock->tcp_notsent_lowat);
+    }
+
     /* set socket to non-blocking mode */
     set_nonblock(sock->sd);
 
@@ -1956,6 +2519,21 @@ phase2_set_socket_flags(struct link_socket *sock)
     /* if the OS supports it, enable extended error passing on the socket */
     set_sock_extended_error_passing(sock->sd, sock->info.af);
 #endif
+
+#if ENABLE_UDP_RECV_GRO
+    /* buffers for --udp-recv-gro are set up by socket_frame_init() */
+    if (sock->recv_batch.gro && sock->recv_batch.bufs)
+    {
+        link_socket_recv_gro_enable(sock);
+    }
+#endif
+#if ENABLE_UDP_SEND_ZEROCOPY
+    /* buffers for --udp-send-zerocopy are set up by socket_frame_init() */
+    if (sock->send_batch.pool)
+    {
+        link_socket_zerocopy_enable(sock);
+    }
+#endif
 }
 
 
@@ -2019,16 +2597,18 @@ phase2_tcp_server(struct link_socket *sock, const char *remote_dynamic,
             break;
 
         case LS_MODE_TCP_LISTEN:
+            /* non-blocking, so that link_socket_accept() can take
+             * connections until none is left */
             socket_do_listen(sock->sd,
                              sock->info.lsa->bind_local,
                              true,
-                             false);
+                             true);
             break;
 
         case LS_MODE_TCP_ACCEPT_FROM:
             sock->sd = socket_do_accept(sock->sd,
                                         &sock->info.lsa->actual,
-                                        false);
+                                        sock->accepted);
             if (!socket_defined(sock->sd))
             {
                 register_signal(sig_info, SIGTERM, "socket-undefiled");
@@ -2047,6 +2627,17 @@ static void
 phase2_tcp_client(struct link_socket *sock, struct signal_info *sig_info)
 {
     bool proxy_retry = false;
+
+#if POLL
+    /* race the addresses of the remote host if there are several */
+    if (!sock->http_proxy && !sock->socks_proxy && !sock->bind_local
+        && sock->info.lsa->current_remote->ai_next)
+    {
+        socket_connect_race(sock, sig_info);
+        return;
+    }
+#endif
+
     do
     {
         socket_connect(&sock->sd,
@@ -2117,9 +2708,13 @@ phase2_socks_client(struct link_socket *sock, struct signal_info *sig_info)
     addr_zero_host(&sock->info.lsa->actual.dest);
     if (sock->info.lsa->remote_list)
     {
-        freeaddrinfo(sock->info.lsa->remote_list);
+        if (!sock->info.lsa->remote_list_cached)
+        {
+            freeaddrinfo(sock->info.lsa->remote_list);
+        }
         sock->info.lsa->current_remote = NULL;
         sock->info.lsa->remote_list = NULL;
+        sock->info.lsa->remote_list_cached = false;
     }
 
     resolve_remote(sock, 1, NULL, sig_info);
@@ -2303,6 +2898,8 @@ link_socket_close(struct link_socket *sock)
 
         if (socket_defined(sock->sd))
         {
+            /* datagrams queued by --udp-send-batch, e.g. exit notifications */
+            link_socket_send_batch_flush(sock);
 #ifdef _WIN32
             close_net_event_win32(&sock->listen_handle, sock->sd, 0);
 #endif
@@ -2318,12 +2915,23 @@ link_socket_close(struct link_socket *sock)
 #ifdef _WIN32
             if (!gremlin)
             {
-                overlapped_io_close(&sock->reads);
-                overlapped_io_close(&sock->writes);
+                for (int i = 0; i < sock->n_io; ++i)
+                {
+                    overlapped_io_close(&sock->reads[i]);
+                    overlapped_io_close(&sock->writes[i]);
+                }
             }
 #endif
         }
 
+#ifndef _WIN32
+        for (int i = 0; i < sock->n_extra; ++i)
+        {
+            openvpn_close_socket(sock->extra_sd[i]);
+        }
+        sock->n_extra = 0;
+#endif
+
         if (socket_defined(sock->ctrl_sd))
         {
             if (openvpn_close_socket(sock->ctrl_sd))
@@ -2333,8 +2941,23 @@ link_socket_close(struct link_socket *sock)
             sock->ctrl_sd = SOCKET_UNDEFINED;
         }
 
+        if (socket_defined(sock->accepted_sd))
+        {
+            openvpn_close_socket(sock->accepted_sd);
+            sock->accepted_sd = SOCKET_UNDEFINED;
+        }
+
         stream_buf_close(&sock->stream_buf);
         free_buf(&sock->stream_buf_data);
+#ifndef _WIN32
+        free_buf(&sock->tcp_out.buf);
+#endif
+#if ENABLE_UDP_RECV_BATCH
+        link_socket_recv_batch_free(&sock->recv_batch);
+#endif
+#if ENABLE_UDP_SEND_BATCH
+        link_socket_send_batch_free(&sock->send_batch);
+#endif
         if (!gremlin)
         {
             free(sock);
@@ -2530,7 +3153,7 @@ socket_stat(const struct link_socket *s, unsigned int rwflags, struct gc_arena *
                        (s->rwflags_debug & EVENT_READ) ? "R" : "r");
 #ifdef _WIN32
             buf_printf(&out, "%s",
-                       overlapped_io_state_ascii(&s->reads));
+                       overlapped_io_state_ascii(&s->reads[s->read_next]));
 #endif
         }
         if (rwflags & EVENT_WRITE)
@@ -2539,7 +3162,7 @@ socket_stat(const struct link_socket *s, unsigned int rwflags, struct gc_arena *
                        (s->rwflags_debug & EVENT_WRITE) ? "W" : "w");
 #ifdef _WIN32
             buf_printf(&out, "%s",
-                       overlapped_io_state_ascii(&s->writes));
+                       overlapped_io_state_ascii(&s->writes[s->write_next]));
 #endif
         }
     }
@@ -2589,29 +3212,62 @@ stream_buf_init(struct stream_buf *sb,
 static inline void
 stream_buf_set_next(struct stream_buf *sb)
 {
-    /* set up 'next' for next i/o read */
+    /* room needed to complete the packet at the head of buf */
+    const int need = (sb->len >= 0 ? sb->len : (int) sizeof(packet_size_type) + sb->maxlen)
+                     - sb->buf.len;
+
+    /* move an incomplete packet back to the start if it does not
+     * fit into the space left behind it */
+    if (buf_forward_capacity(&sb->buf) < need)
+    {
+        struct buffer moved = sb->buf_init;
+        memmove(BPTR(&moved), BPTR(&sb->buf), BLEN(&sb->buf));
+        moved.len = sb->buf.len;
+        sb->buf = moved;
+    }
+
+    /* set up 'next' for next i/o read, which may take more than one packet */
     sb->next = sb->buf;
     sb->next.offset = sb->buf.offset + sb->buf.len;
-    sb->next.len = (sb->len >= 0 ? sb->len : sb->maxlen) - sb->buf.len;
+    sb->next.len = buf_forward_capacity(&sb->buf);
     dmsg(D_STREAM_DEBUG, "STREAM: SET NEXT, buf=[%d,%d] next=[%d,%d] len=%d maxlen=%d",
          sb->buf.offset, sb->buf.len,
          sb->next.offset, sb->next.len,
          sb->len, sb->maxlen);
-    ASSERT(sb->next.len > 0);
-    ASSERT(buf_safe(&sb->buf, sb->next.len));
+    ASSERT(sb->next.len >= need && need > 0);
 }
 
 static inline void
 stream_buf_get_final(struct stream_buf *sb, struct buffer *buf)
 {
     dmsg(D_STREAM_DEBUG, "STREAM: GET FINAL len=%d",
-         buf_defined(&sb->buf) ? sb->buf.len : -1);
+         buf_defined(&sb->buf) ? sb->len : -1);
     ASSERT(buf_defined(&sb->buf));
     *buf = sb->buf;
+    buf->len = sb->len;
 }
 
+/*
+ * Drop the packet returned by stream_buf_get_final() from the stream
+ * buffer.  It stays in place until the next read is set up.
+ */
 static inline void
-stream_buf_get_next(struct stream_buf *sb, struct buffer *buf)
+stream_buf_consume(struct stream_buf *sb)
+{
+    dmsg(D_STREAM_DEBUG, "STREAM: CONSUME len=%d left=%d",
+         sb->len, sb->buf.len - sb->len);
+    ASSERT(buf_advance(&sb->buf, sb->len));
+    if (!sb->buf.len)
+    {
+        sb->buf = sb->buf_init;
+    }
+    buf_reset(&sb->next);
+    sb->residual_fully_formed = false;
+    sb->len = -1;
+}
+
+static inline void
+stream_buf_get_next(struct stream_buf *sb, struct buffer *buf)
 {
     dmsg(D_STREAM_DEBUG, "STREAM: GET NEXT len=%d",
          buf_defined(&sb->next) ? sb->next.len : -1);
@@ -2622,21 +3278,27 @@ stream_buf_get_next(struct stream_buf *sb, struct buffer *buf)
 bool
 stream_buf_read_setup_dowork(struct link_socket *sock)
 {
-    if (sock->stream_buf.residual.len && !sock->stream_buf.residual_fully_formed)
+    struct stream_buf *sb = &sock->stream_buf;
+
+    if (sb->residual.len)
+    {
+        ASSERT(buf_copy(&sb->buf, &sb->residual));
+        ASSERT(buf_init(&sb->residual, 0));
+    }
+
+    if (sb->buf.len && !sb->residual_fully_formed)
     {
-        ASSERT(buf_copy(&sock->stream_buf.buf, &sock->stream_buf.residual));
-        ASSERT(buf_init(&sock->stream_buf.residual, 0));
-        sock->stream_buf.residual_fully_formed = stream_buf_added(&sock->stream_buf, 0);
+        sb->residual_fully_formed = stream_buf_added(sb, 0);
         dmsg(D_STREAM_DEBUG, "STREAM: RESIDUAL FULLY FORMED [%s], len=%d",
-             sock->stream_buf.residual_fully_formed ? "YES" : "NO",
-             sock->stream_buf.residual.len);
+             sb->residual_fully_formed ? "YES" : "NO",
+             sb->buf.len);
     }
 
-    if (!sock->stream_buf.residual_fully_formed)
+    if (!sb->residual_fully_formed && !sb->error)
     {
-        stream_buf_set_next(&sock->stream_buf);
+        stream_buf_set_next(sb);
     }
-    return !sock->stream_buf.residual_fully_formed;
+    return !sb->residual_fully_formed;
 }
 
 static bool
@@ -2687,15 +3349,10 @@ stream_buf_added(struct stream_buf *sb,
     /* is our incoming packet fully read? */
     if (sb->len > 0 && sb->buf.len >= sb->len)
     {
-        /* save any residual data that's part of the next packet */
-        ASSERT(buf_init(&sb->residual, 0));
-        if (sb->buf.len > sb->len)
-        {
-            ASSERT(buf_copy_excess(&sb->residual, &sb->buf, sb->len));
-        }
+        /* any data beyond it is part of the next packet and stays in buf */
         dmsg(D_STREAM_DEBUG, "STREAM: ADD returned TRUE, buf_len=%d, residual_len=%d",
-             BLEN(&sb->buf),
-             BLEN(&sb->residual));
+             sb->len,
+             BLEN(&sb->buf) - sb->len);
         return true;
     }
     else
@@ -3248,11 +3905,15 @@ link_socket_read_tcp(struct link_socket *sock,
 
 #ifdef _WIN32
         sockethandle_t sh = { .s = sock->sd };
-        len = sockethandle_finalize(sh, &sock->reads, buf, NULL);
+        len = sockethandle_finalize(sh, socket_reads(sock), buf, NULL);
 #else
         struct buffer frag;
         stream_buf_get_next(&sock->stream_buf, &frag);
         len = recv(sock->sd, BPTR(&frag), BLEN(&frag), MSG_NOSIGNAL);
+        if (len < 0 && errno == EAGAIN)
+        {
+            link_socket_blocked(sock, EVENT_READ);
+        }
 #endif
 
         if (!len)
@@ -3269,7 +3930,7 @@ link_socket_read_tcp(struct link_socket *sock,
         || stream_buf_added(&sock->stream_buf, len)) /* packet complete? */
     {
         stream_buf_get_final(&sock->stream_buf, buf);
-        stream_buf_reset(&sock->stream_buf);
+        stream_buf_consume(&sock->stream_buf);
         return buf->len;
     }
     else
@@ -3280,6 +3941,10 @@ link_socket_read_tcp(struct link_socket *sock,
 
 #ifndef _WIN32
 
+#if ENABLE_UDP_RECV_GRO && !defined(UDP_GRO)
+#define UDP_GRO 104             /* from <linux/udp.h>, Linux 5.0+ */
+#endif
+
 #if ENABLE_IP_PKTINFO
 
 /* make the buffer large enough to handle ancillary socket data for
@@ -3293,6 +3958,64 @@ link_socket_read_tcp(struct link_socket *sock,
                                   CMSG_SPACE(sizeof(struct in_addr)) )
 #endif
 
+/*
+ * Extract the destination address of a received datagram from the
+ * IP_PKTINFO/IP_RECVDSTADDR/IPV6_PKTINFO control message in mesg.
+ */
+static void
+link_socket_read_pktinfo(struct msghdr *mesg,
+                         struct link_socket_actual *from)
+{
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(mesg);
+#if ENABLE_UDP_RECV_GRO
+    /* the kernel puts the UDP_GRO segment size before the packet info */
+    if (cmsg != NULL
+        && cmsg->cmsg_level == IPPROTO_UDP
+        && cmsg->cmsg_type == UDP_GRO)
+    {
+        cmsg = CMSG_NXTHDR(mesg, cmsg);
+    }
+#endif
+    if (cmsg != NULL
+        && CMSG_NXTHDR(mesg, cmsg) == NULL
+#if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
+        && cmsg->cmsg_level == SOL_IP
+        && cmsg->cmsg_type == IP_PKTINFO
+        && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in_pktinfo)) )
+#elif defined(IP_RECVDSTADDR)
+        && cmsg->cmsg_level == IPPROTO_IP
+        && cmsg->cmsg_type == IP_RECVDSTADDR
+        && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in_addr)) )
+#else  /* if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST) */
+#error ENABLE_IP_PKTINFO is set without IP_PKTINFO xor IP_RECVDSTADDR (fix syshead.h)
+#endif
+    {
+#if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
+        struct in_pktinfo *pkti = (struct in_pktinfo *) CMSG_DATA(cmsg);
+        from->pi.in4.ipi_ifindex = pkti->ipi_ifindex;
+        from->pi.in4.ipi_spec_dst = pkti->ipi_spec_dst;
+#elif defined(IP_RECVDSTADDR)
+        from->pi.in4 = *(struct in_addr *) CMSG_DATA(cmsg);
+#else  /* if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST) */
+#error ENABLE_IP_PKTINFO is set without IP_PKTINFO xor IP_RECVDSTADDR (fix syshead.h)
+#endif
+    }
+    else if (cmsg != NULL
+             && CMSG_NXTHDR(mesg, cmsg) == NULL
+             && cmsg->cmsg_level == IPPROTO_IPV6
+             && cmsg->cmsg_type == IPV6_PKTINFO
+             && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in6_pktinfo)) )
+    {
+        struct in6_pktinfo *pkti6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
+        from->pi.in6.ipi6_ifindex = pkti6->ipi6_ifindex;
+        from->pi.in6.ipi6_addr = pkti6->ipi6_addr;
+    }
+    else if (cmsg != NULL)
+    {
+        msg(M_WARN, "CMSG received that cannot be parsed (cmsg_level=%d, cmsg_type=%d, cmsg=len=%d)", (int)cmsg->cmsg_level, (int)cmsg->cmsg_type, (int)cmsg->cmsg_len );
+    }
+}
+
 static socklen_t
 link_socket_read_udp_posix_recvmsg(struct link_socket *sock,
                                    struct buffer *buf,
@@ -3316,52 +4039,231 @@ link_socket_read_udp_posix_recvmsg(struct link_socket *sock,
     buf->len = recvmsg(sock->sd, &mesg, 0);
     if (buf->len >= 0)
     {
-        struct cmsghdr *cmsg;
         fromlen = mesg.msg_namelen;
-        cmsg = CMSG_FIRSTHDR(&mesg);
-        if (cmsg != NULL
-            && CMSG_NXTHDR(&mesg, cmsg) == NULL
-#if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
-            && cmsg->cmsg_level == SOL_IP
-            && cmsg->cmsg_type == IP_PKTINFO
-            && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in_pktinfo)) )
-#elif defined(IP_RECVDSTADDR)
-            && cmsg->cmsg_level == IPPROTO_IP
-            && cmsg->cmsg_type == IP_RECVDSTADDR
-            && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in_addr)) )
-#else  /* if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST) */
-#error ENABLE_IP_PKTINFO is set without IP_PKTINFO xor IP_RECVDSTADDR (fix syshead.h)
+        link_socket_read_pktinfo(&mesg, from);
+    }
+
+    return fromlen;
+}
+#endif /* if ENABLE_IP_PKTINFO */
+
+#if ENABLE_UDP_RECV_BATCH
+
+#if ENABLE_IP_PKTINFO
+#define RECV_BATCH_PKTINFO_SIZE PKTINFO_BUF_SIZE
+#else
+#define RECV_BATCH_PKTINFO_SIZE 0
+#endif
+
+#if ENABLE_UDP_RECV_GRO
+#define RECV_BATCH_CMSG_SIZE (RECV_BATCH_PKTINFO_SIZE + CMSG_SPACE(sizeof(int)))
+
+/* largest datagram the kernel coalesces with UDP_GRO */
+#define UDP_GRO_MAX_BYTES 65535
+#else
+#define RECV_BATCH_CMSG_SIZE RECV_BATCH_PKTINFO_SIZE
 #endif
+
+static void
+link_socket_recv_batch_init(struct link_socket_recv_batch *rb,
+                            const struct frame *frame)
+{
+    if (rb->bufs)
+    {
+        return;                 /* already initialised by an earlier phase2 */
+    }
+
+    rb->headroom = frame->buf.headroom;
+    rb->count = 0;
+    rb->next = 0;
+    ALLOC_ARRAY_CLEAR(rb->bufs, struct buffer, rb->size);
+    ALLOC_ARRAY_CLEAR(rb->from, struct link_socket_actual, rb->size);
+    ALLOC_ARRAY_CLEAR(rb->msgs, struct mmsghdr, rb->size);
+    ALLOC_ARRAY_CLEAR(rb->iov, struct iovec, rb->size);
+    if (RECV_BATCH_CMSG_SIZE > 0)
+    {
+        ALLOC_ARRAY_CLEAR(rb->cmsg, uint8_t, rb->size * RECV_BATCH_CMSG_SIZE);
+    }
+    for (int i = 0; i < rb->size; ++i)
+    {
+#if ENABLE_UDP_RECV_GRO
+        if (rb->gro)
         {
-#if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
-            struct in_pktinfo *pkti = (struct in_pktinfo *) CMSG_DATA(cmsg);
-            from->pi.in4.ipi_ifindex = pkti->ipi_ifindex;
-            from->pi.in4.ipi_spec_dst = pkti->ipi_spec_dst;
-#elif defined(IP_RECVDSTADDR)
-            from->pi.in4 = *(struct in_addr *) CMSG_DATA(cmsg);
-#else  /* if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST) */
-#error ENABLE_IP_PKTINFO is set without IP_PKTINFO xor IP_RECVDSTADDR (fix syshead.h)
+            /* room for a whole coalesced datagram */
+            rb->bufs[i] = alloc_buf(rb->headroom + UDP_GRO_MAX_BYTES);
+            continue;
+        }
 #endif
+        alloc_buf_sock_tun(&rb->bufs[i], frame);
+    }
+}
+
+#if ENABLE_UDP_RECV_GRO
+static void
+link_socket_recv_gro_enable(struct link_socket *sock)
+{
+    int on = 1;
+
+    if (setsockopt(sock->sd, IPPROTO_UDP, UDP_GRO, (void *) &on, sizeof(on)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt UDP_GRO failed, "
+            "--udp-recv-gro disabled");
+        sock->recv_batch.gro = false;
+    }
+}
+
+/*
+ * Return the segment size of a datagram the kernel has coalesced from
+ * several datagrams of the same flow, or 0 if mesg carries no UDP_GRO
+ * control message.
+ */
+static int
+link_socket_read_gro(struct msghdr *mesg)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(mesg); cmsg; cmsg = CMSG_NXTHDR(mesg, cmsg))
+    {
+        if (cmsg->cmsg_level == IPPROTO_UDP
+            && cmsg->cmsg_type == UDP_GRO
+            && cmsg->cmsg_len >= CMSG_LEN(sizeof(int)))
+        {
+            int seg;
+            memcpy(&seg, CMSG_DATA(cmsg), sizeof(seg));
+            return seg;
+        }
+    }
+    return 0;
+}
+#endif /* if ENABLE_UDP_RECV_GRO */
+
+static void
+link_socket_recv_batch_free(struct link_socket_recv_batch *rb)
+{
+    if (rb->bufs)
+    {
+        for (int i = 0; i < rb->size; ++i)
+        {
+            free_buf(&rb->bufs[i]);
         }
-        else if (cmsg != NULL
-                 && CMSG_NXTHDR(&mesg, cmsg) == NULL
-                 && cmsg->cmsg_level == IPPROTO_IPV6
-                 && cmsg->cmsg_type == IPV6_PKTINFO
-                 && cmsg->cmsg_len >= CMSG_LEN(sizeof(struct in6_pktinfo)) )
+    }
+    free(rb->bufs);
+    free(rb->from);
+    free(rb->msgs);
+    free(rb->iov);
+    free(rb->cmsg);
+    rb->bufs = NULL;
+    rb->from = NULL;
+    rb->msgs = NULL;
+    rb->iov = NULL;
+    rb->cmsg = NULL;
+    rb->count = 0;
+    rb->next = 0;
+#if ENABLE_UDP_RECV_GRO
+    rb->offset = 0;
+#endif
+}
+
+/*
+ * Return the next datagram of the current batch in buf/from, refilling
+ * the batch with a single recvmmsg() call once it has been used up.
+ *
+ * The returned buffer points into memory owned by the socket and stays
+ * valid until the whole batch has been handed out.
+ */
+static int
+link_socket_read_udp_posix_batch(struct link_socket *sock,
+                                 struct buffer *buf,
+                                 struct link_socket_actual *from,
+                                 socklen_t *fromlen)
+{
+    struct link_socket_recv_batch *rb = &sock->recv_batch;
+
+    if (rb->next >= rb->count)
+    {
+        rb->count = 0;
+        rb->next = 0;
+
+        for (int i = 0; i < rb->size; ++i)
         {
-            struct in6_pktinfo *pkti6 = (struct in6_pktinfo *) CMSG_DATA(cmsg);
-            from->pi.in6.ipi6_ifindex = pkti6->ipi6_ifindex;
-            from->pi.in6.ipi6_addr = pkti6->ipi6_addr;
+            struct msghdr *mesg = &rb->msgs[i].msg_hdr;
+
+            ASSERT(buf_init(&rb->bufs[i], rb->headroom));
+            CLEAR(rb->from[i]);
+            rb->iov[i].iov_base = BPTR(&rb->bufs[i]);
+            rb->iov[i].iov_len = buf_forward_capacity(&rb->bufs[i]);
+
+            CLEAR(*mesg);
+            mesg->msg_iov = &rb->iov[i];
+            mesg->msg_iovlen = 1;
+            mesg->msg_name = &rb->from[i].dest.addr;
+            mesg->msg_namelen = sizeof(rb->from[i].dest.addr);
+#if ENABLE_IP_PKTINFO
+            if (sock->sockflags & SF_USE_IP_PKTINFO)
+            {
+                mesg->msg_control = rb->cmsg + i * RECV_BATCH_CMSG_SIZE;
+                mesg->msg_controllen = RECV_BATCH_CMSG_SIZE;
+            }
+#endif
+#if ENABLE_UDP_RECV_GRO
+            if (rb->gro)
+            {
+                mesg->msg_control = rb->cmsg + i * RECV_BATCH_CMSG_SIZE;
+                mesg->msg_controllen = RECV_BATCH_CMSG_SIZE;
+            }
+#endif
         }
-        else if (cmsg != NULL)
+
+        int n = recvmmsg(sock->sd, rb->msgs, rb->size, 0, NULL);
+        if (n <= 0)
         {
-            msg(M_WARN, "CMSG received that cannot be parsed (cmsg_level=%d, cmsg_type=%d, cmsg=len=%d)", (int)cmsg->cmsg_level, (int)cmsg->cmsg_type, (int)cmsg->cmsg_len );
+            return buf->len = n;
         }
+        rb->count = n;
     }
 
-    return fromlen;
+    const int i = rb->next++;
+    struct msghdr *mesg = &rb->msgs[i].msg_hdr;
+
+    *buf = rb->bufs[i];
+    buf->len = rb->msgs[i].msg_len;
+#if ENABLE_UDP_RECV_GRO
+    if (rb->gro)
+    {
+        if (rb->offset == 0)
+        {
+            rb->seg = link_socket_read_gro(mesg);
+        }
+        if (rb->seg > 0 && rb->seg < buf->len)
+        {
+            /* split a coalesced datagram in place, one segment per call */
+            const int total = buf->len;
+
+            buf->offset += rb->offset;
+            buf->len = min_int(rb->seg, total - rb->offset);
+            buf->capacity = buf->offset + buf->len;
+            rb->offset += buf->len;
+            if (rb->offset < total)
+            {
+                rb->next = i;
+            }
+            else
+            {
+                rb->offset = 0;
+            }
+        }
+    }
+#endif
+    *from = rb->from[i];
+    *fromlen = mesg->msg_namelen;
+#if ENABLE_IP_PKTINFO
+    if (sock->sockflags & SF_USE_IP_PKTINFO)
+    {
+        link_socket_read_pktinfo(mesg, from);
+    }
+#endif
+    return buf->len;
 }
-#endif /* if ENABLE_IP_PKTINFO */
+
+#endif /* if ENABLE_UDP_RECV_BATCH */
 
 int
 link_socket_read_udp_posix(struct link_socket *sock,
@@ -3371,9 +4273,23 @@ link_socket_read_udp_posix(struct link_socket *sock,
     socklen_t fromlen = sizeof(from->dest.addr);
     socklen_t expectedlen = af_addr_size(sock->info.af);
     addr_zero_host(&from->dest);
+    from->listener = 0;
 
     ASSERT(sock->sd >= 0);                      /* can't happen */
 
+#if ENABLE_UDP_SEND_ZEROCOPY
+    if (sock->send_batch.zc_inflight > 0)
+    {
+        link_socket_zerocopy_reap(sock);
+    }
+#endif
+#if ENABLE_UDP_RECV_BATCH
+    if (sock->recv_batch.bufs)
+    {
+        link_socket_read_udp_posix_batch(sock, buf, from, &fromlen);
+    }
+    else
+#endif
 #if ENABLE_IP_PKTINFO
     /* Both PROTO_UDPv4 and PROTO_UDPv6 */
     if (sock->info.proto == PROTO_UDP && sock->sockflags & SF_USE_IP_PKTINFO)
@@ -3392,6 +4308,108 @@ link_socket_read_udp_posix(struct link_socket *sock,
     return buf->len;
 }
 
+socket_descriptor_t
+link_socket_open_udp_extra(const char *host, const char *port,
+                           const struct socket_buffer_size *sbs)
+{
+    struct addrinfo *ai = NULL;
+
+    openvpn_getaddrinfo(GETADDR_RESOLVE | GETADDR_PASSIVE | GETADDR_FATAL | GETADDR_DATAGRAM,
+                        host, port, 0, NULL, AF_UNSPEC, &ai);
+    const socket_descriptor_t sd = create_socket_udp(ai, 0);
+    socket_bind(sd, ai, ai->ai_family, "UDP extra", false);
+    socket_set_buffers(sd, sbs);
+    set_nonblock(sd);
+    set_cloexec(sd);
+    freeaddrinfo(ai);
+    return sd;
+}
+
+/*
+ * Classic BPF program for --udp-prefilter.  A UDP socket filter sees the
+ * UDP header first, the OpenVPN opcode is the first byte after it.  A
+ * packet passes if it has at least an opcode and a session id, and an
+ * opcode that a server accepts from a client, hard resets with key id 0
+ * only.  Everything else is dropped before it is queued to the socket.
+ */
+#define PREFILTER_UDP_HDR   8
+#define PREFILTER_DROP      12
+#define PREFILTER_PASS      13
+#define PREFILTER_JEQ(k, to, at) \
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, (k), (to) - (at) - 1, 0)
+
+void
+link_socket_set_prefilter(struct link_socket *sock, bool reset_v3)
+{
+#if defined(TARGET_LINUX) && defined(HAVE_LINUX_FILTER_H)
+    const uint8_t reset_v2_byte = P_CONTROL_HARD_RESET_CLIENT_V2 << P_OPCODE_SHIFT;
+    const uint8_t reset_v3_byte = reset_v3 ? P_CONTROL_HARD_RESET_CLIENT_V3 << P_OPCODE_SHIFT
+                                  : reset_v2_byte;
+
+    struct sock_filter code[] = {
+        /* 0 */ BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        /* 1 */ BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, PREFILTER_UDP_HDR + 1 + SID_SIZE,
+                         0, PREFILTER_DROP - 2),
+        /* 2 */ BPF_STMT(BPF_LD | BPF_B | BPF_ABS, PREFILTER_UDP_HDR),
+        /* 3 */ PREFILTER_JEQ(reset_v2_byte, PREFILTER_PASS, 3),
+        /* 4 */ PREFILTER_JEQ(reset_v3_byte, PREFILTER_PASS, 4),
+        /* 5 */ BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, P_OPCODE_SHIFT),
+        /* 6 */ PREFILTER_JEQ(P_CONTROL_SOFT_RESET_V1, PREFILTER_PASS, 6),
+        /* 7 */ PREFILTER_JEQ(P_CONTROL_V1, PREFILTER_PASS, 7),
+        /* 8 */ PREFILTER_JEQ(P_ACK_V1, PREFILTER_PASS, 8),
+        /* 9 */ PREFILTER_JEQ(P_DATA_V1, PREFILTER_PASS, 9),
+        /* 10 */ PREFILTER_JEQ(P_DATA_V2, PREFILTER_PASS, 10),
+        /* 11 */ PREFILTER_JEQ(P_CONTROL_WKC_V1, PREFILTER_PASS, 11),
+        /* 12 */ BPF_STMT(BPF_RET | BPF_K, 0),
+        /* 13 */ BPF_STMT(BPF_RET | BPF_K, 0xFFFFFFFF),
+    };
+    const struct sock_fprog prog = { .len = SIZE(code), .filter = code };
+
+    ASSERT(SIZE(code) == PREFILTER_PASS + 1);
+    for (int i = 0; i <= sock->n_extra; ++i)
+    {
+        const socket_descriptor_t sd = i ? sock->extra_sd[i - 1] : sock->sd;
+        if (setsockopt(sd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) != 0)
+        {
+            msg(M_WARN | M_ERRNO, "NOTE: setsockopt SO_ATTACH_FILTER failed, "
+                "--udp-prefilter is not used");
+            return;
+        }
+    }
+    msg(D_LOW, "UDP prefilter attached to %d socket(s)", sock->n_extra + 1);
+#endif /* if defined(TARGET_LINUX) && defined(HAVE_LINUX_FILTER_H) */
+}
+
+int
+link_socket_read_udp_extra(struct link_socket *sock,
+                           struct buffer *buf,
+                           struct link_socket_actual *from)
+{
+    for (int n = 0; n < sock->n_extra; ++n)
+    {
+        const int i = sock->extra_next;
+        socklen_t fromlen = sizeof(from->dest.addr);
+
+        sock->extra_next = (i + 1) % sock->n_extra;
+        CLEAR(*from);
+        const ssize_t len = recvfrom(sock->extra_sd[i], BPTR(buf), buf_forward_capacity(buf),
+                                     0, &from->dest.addr.sa, &fromlen);
+        if (len >= 0)
+        {
+            from->listener = (uint8_t) (i + 1);
+            buf->len = (int) len;
+            return buf->len;
+        }
+        if (!ignore_sys_error(openvpn_errno(), false))
+        {
+            buf->len = 0;
+            return -1;
+        }
+    }
+    buf->len = 0;
+    return 0;
+}
+
 #endif /* ifndef _WIN32 */
 
 /*
@@ -3411,37 +4429,105 @@ link_socket_write_tcp(struct link_socket *sock,
 #ifdef _WIN32
     return link_socket_write_win32(sock, buf, to);
 #else
+    if (sock->tcp_out.corked)
+    {
+        if (!buf_safe(&sock->tcp_out.buf, BLEN(buf)))
+        {
+            link_socket_tcp_flush(sock);
+            sock->tcp_out.corked = true;
+        }
+        if (!buf_copy(&sock->tcp_out.buf, buf))
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        return BLEN(buf);
+    }
     return link_socket_write_tcp_posix(sock, buf, to);
 #endif
 }
 
+#ifndef _WIN32
+
+/* Number of maximum sized packets that a corked TCP socket collects */
+#define TCP_OUT_PACKETS 16
+
+void
+link_socket_tcp_cork(struct link_socket *sock)
+{
+    struct link_socket_tcp_out *out = &sock->tcp_out;
+
+    if (!buf_valid(&out->buf))
+    {
+        out->buf = alloc_buf(TCP_OUT_PACKETS
+                             * (sock->stream_buf.maxlen + sizeof(packet_size_type)));
+    }
+    out->corked = true;
+}
+
+void
+link_socket_tcp_flush(struct link_socket *sock)
+{
+    struct link_socket_tcp_out *out = &sock->tcp_out;
+
+    out->corked = false;
+    if (BLEN(&out->buf) > 0)
+    {
+        const ssize_t size = send(sock->sd, BPTR(&out->buf), BLEN(&out->buf), MSG_NOSIGNAL);
+        dmsg(D_STREAM_DEBUG, "STREAM: FLUSH %d of %d", (int) size, BLEN(&out->buf));
+
+        if (size < BLEN(&out->buf) && (size >= 0 || errno == EAGAIN))
+        {
+            link_socket_blocked(sock, EVENT_WRITE);
+        }
+
+        if (size > 0)
+        {
+            buf_advance(&out->buf, size);
+        }
+        else if (size < 0 && !ignore_sys_error(openvpn_errno(), false))
+        {
+            /* the packets were accounted for already, the connection
+             * is broken and will be reset */
+            msg(D_LINK_ERRORS | M_ERRNO, "TCP: write of %d queued bytes failed",
+                BLEN(&out->buf));
+            out->buf.len = 0;
+        }
+
+        if (!BLEN(&out->buf))
+        {
+            ASSERT(buf_init(&out->buf, 0));
+        }
+    }
+}
+
+#endif /* ifndef _WIN32 */
+
 #if ENABLE_IP_PKTINFO
 
-size_t
-link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
-                                    struct buffer *buf,
-                                    struct link_socket_actual *to)
+/*
+ * Set the destination of mesg to "to" and add an IP_PKTINFO/
+ * IP_RECVDSTADDR/IPV6_PKTINFO control message selecting the local
+ * source address.  pktinfo_buf must hold at least PKTINFO_BUF_SIZE bytes.
+ */
+static void
+link_socket_write_pktinfo(struct msghdr *mesg,
+                          struct link_socket_actual *to,
+                          uint8_t *pktinfo_buf)
 {
-    struct iovec iov;
-    struct msghdr mesg;
     struct cmsghdr *cmsg;
-    uint8_t pktinfo_buf[PKTINFO_BUF_SIZE];
 
-    iov.iov_base = BPTR(buf);
-    iov.iov_len = BLEN(buf);
-    mesg.msg_iov = &iov;
-    mesg.msg_iovlen = 1;
     switch (to->dest.addr.sa.sa_family)
     {
         case AF_INET:
         {
-            mesg.msg_name = &to->dest.addr.sa;
-            mesg.msg_namelen = sizeof(struct sockaddr_in);
-            mesg.msg_control = pktinfo_buf;
-            mesg.msg_flags = 0;
+            mesg->msg_name = &to->dest.addr.sa;
+            mesg->msg_namelen = sizeof(struct sockaddr_in);
+            mesg->msg_control = pktinfo_buf;
+            mesg->msg_flags = 0;
 #if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
-            mesg.msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
-            cmsg = CMSG_FIRSTHDR(&mesg);
+            mesg->msg_controllen = CMSG_SPACE(sizeof(struct in_pktinfo));
+            cmsg = CMSG_FIRSTHDR(mesg);
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_pktinfo));
             cmsg->cmsg_level = SOL_IP;
             cmsg->cmsg_type = IP_PKTINFO;
@@ -3453,9 +4539,9 @@ link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
                 pkti->ipi_addr.s_addr = 0;
             }
 #elif defined(IP_RECVDSTADDR)
-            ASSERT( CMSG_SPACE(sizeof(struct in_addr)) <= sizeof(pktinfo_buf) );
-            mesg.msg_controllen = CMSG_SPACE(sizeof(struct in_addr));
-            cmsg = CMSG_FIRSTHDR(&mesg);
+            ASSERT( CMSG_SPACE(sizeof(struct in_addr)) <= PKTINFO_BUF_SIZE );
+            mesg->msg_controllen = CMSG_SPACE(sizeof(struct in_addr));
+            cmsg = CMSG_FIRSTHDR(mesg);
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in_addr));
             cmsg->cmsg_level = IPPROTO_IP;
             cmsg->cmsg_type = IP_RECVDSTADDR;
@@ -3469,14 +4555,14 @@ link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
         case AF_INET6:
         {
             struct in6_pktinfo *pkti6;
-            mesg.msg_name = &to->dest.addr.sa;
-            mesg.msg_namelen = sizeof(struct sockaddr_in6);
-
-            ASSERT( CMSG_SPACE(sizeof(struct in6_pktinfo)) <= sizeof(pktinfo_buf) );
-            mesg.msg_control = pktinfo_buf;
-            mesg.msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
-            mesg.msg_flags = 0;
-            cmsg = CMSG_FIRSTHDR(&mesg);
+            mesg->msg_name = &to->dest.addr.sa;
+            mesg->msg_namelen = sizeof(struct sockaddr_in6);
+
+            ASSERT( CMSG_SPACE(sizeof(struct in6_pktinfo)) <= PKTINFO_BUF_SIZE );
+            mesg->msg_control = pktinfo_buf;
+            mesg->msg_controllen = CMSG_SPACE(sizeof(struct in6_pktinfo));
+            mesg->msg_flags = 0;
+            cmsg = CMSG_FIRSTHDR(mesg);
             cmsg->cmsg_len = CMSG_LEN(sizeof(struct in6_pktinfo));
             cmsg->cmsg_level = IPPROTO_IPV6;
             cmsg->cmsg_type = IPV6_PKTINFO;
@@ -3489,11 +4575,574 @@ link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
 
         default: ASSERT(0);
     }
+}
+
+size_t
+link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
+                                    struct buffer *buf,
+                                    struct link_socket_actual *to)
+{
+    struct iovec iov;
+    struct msghdr mesg;
+    uint8_t pktinfo_buf[PKTINFO_BUF_SIZE];
+
+    iov.iov_base = BPTR(buf);
+    iov.iov_len = BLEN(buf);
+    mesg.msg_iov = &iov;
+    mesg.msg_iovlen = 1;
+    link_socket_write_pktinfo(&mesg, to, pktinfo_buf);
     return sendmsg(sock->sd, &mesg, 0);
 }
 
 #endif /* if ENABLE_IP_PKTINFO */
 
+#if ENABLE_UDP_SEND_BATCH
+
+#if defined(TARGET_LINUX) && !defined(UDP_SEGMENT)
+#define UDP_SEGMENT 103         /* from <linux/udp.h>, Linux 4.18+ */
+#endif
+
+/* kernel limits for one UDP_SEGMENT super-datagram */
+#define UDP_GSO_MAX_SEGMENTS 64
+#define UDP_GSO_MAX_BYTES 65000
+
+#if ENABLE_IP_PKTINFO
+#define SEND_BATCH_PKTINFO_SIZE PKTINFO_BUF_SIZE
+#else
+#define SEND_BATCH_PKTINFO_SIZE 0
+#endif
+
+#ifdef UDP_SEGMENT
+#define SEND_BATCH_CMSG_SIZE (SEND_BATCH_PKTINFO_SIZE + CMSG_SPACE(sizeof(uint16_t)))
+#else
+#define SEND_BATCH_CMSG_SIZE SEND_BATCH_PKTINFO_SIZE
+#endif
+
+#if ENABLE_UDP_SEND_ZEROCOPY
+
+/*
+ * Smaller messages are cheaper to copy than to pin, so only jumbo
+ * datagrams and GSO runs are sent with MSG_ZEROCOPY.
+ */
+#define UDP_ZEROCOPY_MIN_BYTES 8192
+
+/*
+ * Give up waiting for the completion of a buffer set after this many
+ * seconds, in case x_check_status() has drained the notification from
+ * the error queue before we could see it.
+ */
+#define UDP_ZEROCOPY_TIMEOUT 2
+
+static void
+link_socket_zerocopy_enable(struct link_socket *sock)
+{
+    int on = 1;
+
+    if (setsockopt(sock->sd, SOL_SOCKET, SO_ZEROCOPY, (void *) &on, sizeof(on)) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "NOTE: setsockopt SO_ZEROCOPY failed, "
+            "--udp-send-zerocopy disabled");
+        sock->send_batch.zerocopy = false;
+    }
+}
+
+static void
+link_socket_zerocopy_init(struct link_socket_send_batch *sb)
+{
+    sb->set = 0;
+    sb->zc_next = 0;
+    sb->zc_inflight = 0;
+    CLEAR(sb->zc);
+    ALLOC_ARRAY_CLEAR(sb->pool, struct buffer, UDP_ZEROCOPY_SETS * sb->size);
+    sb->bufs = sb->pool;
+}
+
+static void
+link_socket_zerocopy_set_done(struct link_socket_send_batch *sb,
+                              struct link_socket_zerocopy_set *zs)
+{
+    zs->pending = 0;
+    sb->zc_inflight--;
+}
+
+/*
+ * The kernel reports MSG_ZEROCOPY sends lo..hi as completed.  Ids count
+ * up from 0 for every MSG_ZEROCOPY send made on the socket, and may
+ * wrap around.
+ */
+static void
+link_socket_zerocopy_completed(struct link_socket_send_batch *sb,
+                               uint32_t lo, uint32_t hi)
+{
+    for (int i = 0; i < UDP_ZEROCOPY_SETS - 1; ++i)
+    {
+        struct link_socket_zerocopy_set *zs = &sb->zc[i];
+
+        if (zs->pending > 0)
+        {
+            const int32_t from = max_int((int32_t) (lo - zs->first), 0);
+            const int32_t to = min_int((int32_t) (hi - zs->first), zs->count - 1);
+
+            if (to >= from)
+            {
+                zs->pending -= to - from + 1;
+                if (zs->pending <= 0)
+                {
+                    link_socket_zerocopy_set_done(sb, zs);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Read the completion notifications of our MSG_ZEROCOPY sends from the
+ * socket error queue.  Called whenever sends are in flight, as pending
+ * notifications make the socket poll as readable.
+ */
+static void
+link_socket_zerocopy_reap(struct link_socket *sock)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+    uint8_t cbuf[256];
+
+    while (true)
+    {
+        struct msghdr mesg;
+        struct cmsghdr *cmsg;
+
+        CLEAR(mesg);
+        mesg.msg_control = cbuf;
+        mesg.msg_controllen = sizeof(cbuf);
+        if (recvmsg(sock->sd, &mesg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+        {
+            break;
+        }
+
+        for (cmsg = CMSG_FIRSTHDR(&mesg); cmsg; cmsg = CMSG_NXTHDR(&mesg, cmsg))
+        {
+            const struct sock_extended_err *e;
+
+            if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                && !(cmsg->cmsg_level == IPPROTO_IPV6 && cmsg->cmsg_type == IPV6_RECVERR))
+            {
+                continue;
+            }
+
+            e = (const struct sock_extended_err *) CMSG_DATA(cmsg);
+            if (e->ee_origin == SO_EE_ORIGIN_ZEROCOPY && e->ee_errno == 0)
+            {
+                link_socket_zerocopy_completed(sb, e->ee_info, e->ee_data);
+                if ((e->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) && sb->zerocopy)
+                {
+                    /* e.g. loopback or no scatter-gather on the egress device */
+                    msg(M_INFO, "UDP: the kernel copies MSG_ZEROCOPY datagrams "
+                        "on this path, sending with copies from now on");
+                    sb->zerocopy = false;
+                }
+            }
+            else if (e->ee_errno == EMSGSIZE && e->ee_info > 0)
+            {
+                /* keep the Path-MTU hint x_check_status() would have found */
+                sock->mtu = e->ee_info;
+                sock->info.mtu_changed = true;
+            }
+        }
+    }
+}
+
+/*
+ * Pick the buffer set to fill next: a MSG_ZEROCOPY set whose sends have
+ * all completed, or the copy set if none is free yet.
+ */
+static void
+link_socket_zerocopy_next_set(struct link_socket *sock)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+    const int zc_sets = UDP_ZEROCOPY_SETS - 1;
+
+    if (sb->zc_inflight > 0)
+    {
+        link_socket_zerocopy_reap(sock);
+    }
+
+    const int cur = sb->set;
+
+    sb->set = zc_sets;
+    for (int i = 1; i <= zc_sets; ++i)
+    {
+        const int s = (cur + i) % zc_sets;
+        struct link_socket_zerocopy_set *zs = &sb->zc[s];
+
+        if (zs->pending > 0 && now - zs->sent >= UDP_ZEROCOPY_TIMEOUT)
+        {
+            link_socket_zerocopy_set_done(sb, zs);
+        }
+        if (zs->pending == 0)
+        {
+            sb->set = s;
+            break;
+        }
+    }
+    sb->bufs = sb->pool + sb->set * sb->size;
+}
+
+/*
+ * Starting at message 0 of the vector built by
+ * link_socket_send_batch_build(), return the number of messages that
+ * can go out with the same flags, and set *flags for them.
+ */
+static int
+link_socket_zerocopy_run(const struct link_socket_send_batch *sb, int nmsg,
+                         int *flags)
+{
+    bool zc = false;
+    int i;
+
+    for (i = 0; i < nmsg; ++i)
+    {
+        const struct msghdr *mesg = &sb->msgs[i].msg_hdr;
+        size_t len = 0;
+
+        for (size_t j = 0; j < mesg->msg_iovlen; ++j)
+        {
+            len += mesg->msg_iov[j].iov_len;
+        }
+        if (i == 0)
+        {
+            zc = len >= UDP_ZEROCOPY_MIN_BYTES;
+        }
+        else if (zc != (len >= UDP_ZEROCOPY_MIN_BYTES))
+        {
+            break;
+        }
+    }
+
+    *flags = zc ? MSG_ZEROCOPY : 0;
+    return i;
+}
+
+#endif /* if ENABLE_UDP_SEND_ZEROCOPY */
+
+static void
+link_socket_send_batch_init(struct link_socket *sock,
+                            const struct frame *frame)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+    int nbufs = sb->size;
+
+    if (sb->bufs)
+    {
+        return;                 /* already initialised by an earlier phase2 */
+    }
+
+    sb->count = 0;
+#ifdef UDP_SEGMENT
+    sb->gso = true;
+#endif
+#if ENABLE_UDP_SEND_ZEROCOPY
+    if (sb->zerocopy)
+    {
+        link_socket_zerocopy_init(sb);
+    }
+    if (sb->pool)
+    {
+        nbufs = UDP_ZEROCOPY_SETS * sb->size;
+    }
+#endif
+    if (!sb->bufs)
+    {
+        ALLOC_ARRAY_CLEAR(sb->bufs, struct buffer, sb->size);
+    }
+    ALLOC_ARRAY_CLEAR(sb->to, struct link_socket_actual, sb->size);
+    ALLOC_ARRAY_CLEAR(sb->msgs, struct mmsghdr, sb->size);
+    ALLOC_ARRAY_CLEAR(sb->iov, struct iovec, sb->size);
+    if (SEND_BATCH_CMSG_SIZE > 0)
+    {
+        ALLOC_ARRAY_CLEAR(sb->cmsg, uint8_t, sb->size * SEND_BATCH_CMSG_SIZE);
+    }
+    for (int i = 0; i < nbufs; ++i)
+    {
+        alloc_buf_sock_tun(&sb->bufs[i], frame);
+    }
+}
+
+static void
+link_socket_send_batch_free(struct link_socket_send_batch *sb)
+{
+#if ENABLE_UDP_SEND_ZEROCOPY
+    if (sb->pool)
+    {
+        for (int i = 0; i < UDP_ZEROCOPY_SETS * sb->size; ++i)
+        {
+            free_buf(&sb->pool[i]);
+        }
+        free(sb->pool);
+        sb->pool = NULL;
+        sb->bufs = NULL;
+    }
+#endif
+    if (sb->bufs)
+    {
+        for (int i = 0; i < sb->size; ++i)
+        {
+            free_buf(&sb->bufs[i]);
+        }
+    }
+    free(sb->bufs);
+    free(sb->to);
+    free(sb->msgs);
+    free(sb->iov);
+    free(sb->cmsg);
+    sb->bufs = NULL;
+    sb->to = NULL;
+    sb->msgs = NULL;
+    sb->iov = NULL;
+    sb->cmsg = NULL;
+    sb->count = 0;
+}
+
+size_t
+link_socket_write_udp_posix_batch(struct link_socket *sock,
+                                  struct buffer *buf,
+                                  struct link_socket_actual *to)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+
+    if (sb->count >= sb->size)
+    {
+        link_socket_send_batch_flush_dowork(sock);
+        if (sb->count >= sb->size)
+        {
+            /* the socket took none of them, push back as sendto() would */
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    struct buffer *qbuf = &sb->bufs[sb->count];
+    ASSERT(buf_init(qbuf, 0));
+    ASSERT(buf_copy(qbuf, buf));
+    sb->to[sb->count] = *to;
+    sb->iov[sb->count].iov_base = BPTR(qbuf);
+    sb->iov[sb->count].iov_len = BLEN(qbuf);
+    sb->count++;
+
+    return BLEN(buf);
+}
+
+static bool
+link_socket_send_batch_same_dest(const struct link_socket_actual *a,
+                                 const struct link_socket_actual *b)
+{
+    return addr_port_match(&a->dest, &b->dest)
+#if ENABLE_IP_PKTINFO
+           && memcmp(&a->pi, &b->pi, sizeof(a->pi)) == 0
+#endif
+    ;
+}
+
+/*
+ * Build the sendmmsg() vector for the queued datagrams starting at
+ * index first.  With GSO, consecutive datagrams of equal size to the
+ * same peer (the last one may be shorter) are merged into a single
+ * message that the kernel splits again.  Returns the number of messages,
+ * start[m] is the index of the first datagram of message m.
+ */
+static int
+link_socket_send_batch_build(struct link_socket *sock, int first, int *start)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+    int nmsg = 0;
+    int i = first;
+
+    while (i < sb->count)
+    {
+        struct msghdr *mesg = &sb->msgs[nmsg].msg_hdr;
+        uint8_t *cmsg_buf = sb->cmsg ? sb->cmsg + nmsg * SEND_BATCH_CMSG_SIZE : NULL;
+        struct link_socket_actual *to = &sb->to[i];
+        const int seg = BLEN(&sb->bufs[i]);
+        int total = seg;
+        int j = i + 1;
+
+        while (sb->gso
+               && j < sb->count
+               && j - i < UDP_GSO_MAX_SEGMENTS
+               && total + BLEN(&sb->bufs[j]) <= UDP_GSO_MAX_BYTES
+               && BLEN(&sb->bufs[j]) <= seg
+               && link_socket_send_batch_same_dest(to, &sb->to[j]))
+        {
+            total += BLEN(&sb->bufs[j]);
+            if (BLEN(&sb->bufs[j++]) < seg)
+            {
+                break;          /* a short datagram ends a GSO run */
+            }
+        }
+
+        CLEAR(*mesg);
+        mesg->msg_iov = &sb->iov[i];
+        mesg->msg_iovlen = j - i;
+#if ENABLE_IP_PKTINFO
+        if ((sock->sockflags & SF_USE_IP_PKTINFO) && addr_defined_ipi(to))
+        {
+            link_socket_write_pktinfo(mesg, to, cmsg_buf);
+        }
+        else
+#endif
+        {
+            mesg->msg_name = &to->dest.addr.sa;
+            mesg->msg_namelen = (socklen_t) af_addr_size(to->dest.addr.sa.sa_family);
+        }
+#ifdef UDP_SEGMENT
+        if (j - i > 1)
+        {
+            struct cmsghdr *cmsg;
+
+            if (!mesg->msg_control)
+            {
+                mesg->msg_control = cmsg_buf;
+            }
+            cmsg = (struct cmsghdr *) ((uint8_t *) mesg->msg_control + mesg->msg_controllen);
+            mesg->msg_controllen += CMSG_SPACE(sizeof(uint16_t));
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            cmsg->cmsg_level = IPPROTO_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            *(uint16_t *) CMSG_DATA(cmsg) = (uint16_t) seg;
+        }
+#endif
+        start[nmsg++] = i;
+        i = j;
+    }
+
+    start[nmsg] = sb->count;
+    return nmsg;
+}
+
+/*
+ * Move the datagrams first..count-1 of the buffer set bufs, which the
+ * socket did not take, to the front of the set now being filled.
+ */
+static void
+link_socket_send_batch_requeue(struct link_socket_send_batch *sb,
+                               struct buffer *bufs, int first, int count)
+{
+    for (int i = first; i < count; ++i)
+    {
+        const int k = sb->count++;
+
+        if (bufs == sb->bufs)
+        {
+            const struct buffer tmp = bufs[k];
+            bufs[k] = bufs[i];
+            bufs[i] = tmp;
+        }
+        else
+        {
+            ASSERT(buf_init(&sb->bufs[k], 0));
+            ASSERT(buf_copy(&sb->bufs[k], &bufs[i]));
+        }
+        sb->to[k] = sb->to[i];
+        sb->iov[k].iov_base = BPTR(&sb->bufs[k]);
+        sb->iov[k].iov_len = BLEN(&sb->bufs[k]);
+    }
+}
+
+void
+link_socket_send_batch_flush_dowork(struct link_socket *sock)
+{
+    struct link_socket_send_batch *sb = &sock->send_batch;
+    int start[UDP_SEND_BATCH_MAX + 1];
+    int first = 0;
+#if ENABLE_UDP_SEND_ZEROCOPY
+    struct link_socket_zerocopy_set *zs = NULL;
+
+    if (sb->pool && sb->zerocopy && sb->set < UDP_ZEROCOPY_SETS - 1)
+    {
+        zs = &sb->zc[sb->set];
+        zs->first = sb->zc_next;
+        zs->count = 0;
+        zs->pending = 0;
+        zs->sent = now;
+    }
+#endif
+
+    while (first < sb->count)
+    {
+        int nmsg = link_socket_send_batch_build(sock, first, start);
+        int flags = 0;
+
+#if ENABLE_UDP_SEND_ZEROCOPY
+        if (zs)
+        {
+            nmsg = link_socket_zerocopy_run(sb, nmsg, &flags);
+        }
+#endif
+        const int n = sendmmsg(sock->sd, sb->msgs, nmsg, flags);
+
+        if (n > 0)
+        {
+#if ENABLE_UDP_SEND_ZEROCOPY
+            if (flags & MSG_ZEROCOPY)
+            {
+                zs->count += n;
+                zs->pending += n;
+                sb->zc_next += n;
+            }
+#endif
+            first = start[n];
+            continue;
+        }
+
+        const int err = openvpn_errno();
+#if ENABLE_UDP_SEND_ZEROCOPY
+        if ((flags & MSG_ZEROCOPY) && err == ENOBUFS)
+        {
+            /* too many pages pinned by earlier sends, copy the rest */
+            zs = NULL;
+            continue;
+        }
+#endif
+        if (sb->gso && sb->msgs[0].msg_hdr.msg_iovlen > 1
+            && (err == EIO || err == EINVAL))
+        {
+            /* e.g. no checksum offload on the egress interface */
+            msg(M_INFO, "UDP GSO rejected by the kernel, sending "
+                "datagrams of a batch individually from now on");
+            sb->gso = false;
+            continue;
+        }
+
+        if (err == EAGAIN || err == EWOULDBLOCK)
+        {
+            /* keep the rest until the socket is writable again */
+            break;
+        }
+
+        /* e.g. an unreachable peer, only its message is lost */
+        msg(D_LINK_ERRORS | M_ERRNO, "UDP: sendmmsg failed, dropping %d datagram(s)",
+            start[1] - start[0]);
+        first = start[1];
+    }
+
+    struct buffer *bufs = sb->bufs;
+    const int count = sb->count;
+
+    sb->count = 0;
+#if ENABLE_UDP_SEND_ZEROCOPY
+    if (sb->pool)
+    {
+        if (sb->set < UDP_ZEROCOPY_SETS - 1 && sb->zc[sb->set].pending > 0)
+        {
+            sb->zc_inflight++;
+        }
+        link_socket_zerocopy_next_set(sock);
+    }
+#endif
+    link_socket_send_batch_requeue(sb, bufs, first, count);
+}
+
+#endif /* if ENABLE_UDP_SEND_BATCH */
+
 /*
  * Win32 overlapped socket I/O functions.
  */
@@ -3511,10 +5160,10 @@ socket_get_last_error(const struct link_socket *sock)
     return WSAGetLastError();
 }
 
-int
-socket_recv_queue(struct link_socket *sock, int maxsize)
+static void
+socket_recv_queue_io(struct link_socket *sock, struct overlapped_io *io, int maxsize)
 {
-    if (sock->reads.iostate == IOSTATE_INITIAL)
+    if (io->iostate == IOSTATE_INITIAL)
     {
         WSABUF wsabuf[1];
         int status;
@@ -3522,11 +5171,11 @@ socket_recv_queue(struct link_socket *sock, int maxsize)
         /* reset buf to its initial state */
         if (proto_is_udp(sock->info.proto))
         {
-            sock->reads.buf = sock->reads.buf_init;
+            io->buf = io->buf_init;
         }
         else if (proto_is_tcp(sock->info.proto))
         {
-            stream_buf_get_next(&sock->stream_buf, &sock->reads.buf);
+            stream_buf_get_next(&sock->stream_buf, &io->buf);
         }
         else
         {
@@ -3534,48 +5183,48 @@ socket_recv_queue(struct link_socket *sock, int maxsize)
         }
 
         /* Win32 docs say it's okay to allocate the wsabuf on the stack */
-        wsabuf[0].buf = BSTR(&sock->reads.buf);
-        wsabuf[0].len = maxsize ? maxsize : BLEN(&sock->reads.buf);
+        wsabuf[0].buf = BSTR(&io->buf);
+        wsabuf[0].len = maxsize ? maxsize : BLEN(&io->buf);
 
         /* check for buffer overflow */
-        ASSERT(wsabuf[0].len <= BLEN(&sock->reads.buf));
+        ASSERT(wsabuf[0].len <= BLEN(&io->buf));
 
         /* the overlapped read will signal this event on I/O completion */
-        ASSERT(ResetEvent(sock->reads.overlapped.hEvent));
-        sock->reads.flags = 0;
+        ASSERT(ResetEvent(io->overlapped.hEvent));
+        io->flags = 0;
 
         if (socket_is_dco_win(sock))
         {
             status = ReadFile((HANDLE)sock->sd, wsabuf[0].buf, wsabuf[0].len,
-                              &sock->reads.size, &sock->reads.overlapped);
+                              &io->size, &io->overlapped);
             /* Readfile status is inverted from WSARecv */
             status = !status;
         }
         else if (proto_is_udp(sock->info.proto))
         {
-            sock->reads.addr_defined = true;
-            sock->reads.addrlen = sizeof(sock->reads.addr6);
+            io->addr_defined = true;
+            io->addrlen = sizeof(io->addr6);
             status = WSARecvFrom(
                 sock->sd,
                 wsabuf,
                 1,
-                &sock->reads.size,
-                &sock->reads.flags,
-                (struct sockaddr *) &sock->reads.addr,
-                &sock->reads.addrlen,
-                &sock->reads.overlapped,
+                &io->size,
+                &io->flags,
+                (struct sockaddr *) &io->addr,
+                &io->addrlen,
+                &io->overlapped,
                 NULL);
         }
         else if (proto_is_tcp(sock->info.proto))
         {
-            sock->reads.addr_defined = false;
+            io->addr_defined = false;
             status = WSARecv(
                 sock->sd,
                 wsabuf,
                 1,
-                &sock->reads.size,
-                &sock->reads.flags,
-                &sock->reads.overlapped,
+                &io->size,
+                &io->flags,
+                &io->overlapped,
                 NULL);
         }
         else
@@ -3588,36 +5237,36 @@ socket_recv_queue(struct link_socket *sock, int maxsize)
         {
             /* FIXME: won't do anything when sock->info.af == AF_UNSPEC */
             int af_len = af_addr_size(sock->info.af);
-            if (sock->reads.addr_defined && af_len && sock->reads.addrlen != af_len)
+            if (io->addr_defined && af_len && io->addrlen != af_len)
             {
-                bad_address_length(sock->reads.addrlen, af_len);
+                bad_address_length(io->addrlen, af_len);
             }
-            sock->reads.iostate = IOSTATE_IMMEDIATE_RETURN;
+            io->iostate = IOSTATE_IMMEDIATE_RETURN;
 
             /* since we got an immediate return, we must signal the event object ourselves */
-            ASSERT(SetEvent(sock->reads.overlapped.hEvent));
-            sock->reads.status = 0;
+            ASSERT(SetEvent(io->overlapped.hEvent));
+            io->status = 0;
 
             dmsg(D_WIN32_IO, "WIN32 I/O: Socket Receive immediate return [%d,%d]",
                  (int) wsabuf[0].len,
-                 (int) sock->reads.size);
+                 (int) io->size);
         }
         else
         {
             status = socket_get_last_error(sock);
             if (status == WSA_IO_PENDING) /* operation queued? */
             {
-                sock->reads.iostate = IOSTATE_QUEUED;
-                sock->reads.status = status;
+                io->iostate = IOSTATE_QUEUED;
+                io->status = status;
                 dmsg(D_WIN32_IO, "WIN32 I/O: Socket Receive queued [%d]",
                      (int) wsabuf[0].len);
             }
             else /* error occurred */
             {
                 struct gc_arena gc = gc_new();
-                ASSERT(SetEvent(sock->reads.overlapped.hEvent));
-                sock->reads.iostate = IOSTATE_IMMEDIATE_RETURN;
-                sock->reads.status = status;
+                ASSERT(SetEvent(io->overlapped.hEvent));
+                io->iostate = IOSTATE_IMMEDIATE_RETURN;
+                io->status = status;
                 dmsg(D_WIN32_IO, "WIN32 I/O: Socket Receive error [%d]: %s",
                      (int) wsabuf[0].len,
                      strerror_win32(status, &gc));
@@ -3625,34 +5274,46 @@ socket_recv_queue(struct link_socket *sock, int maxsize)
             }
         }
     }
-    return sock->reads.iostate;
+}
+
+int
+socket_recv_queue(struct link_socket *sock, int maxsize)
+{
+    /* queue the free reads in ring order, they complete in that order */
+    for (int i = 0; i < sock->n_io; ++i)
+    {
+        socket_recv_queue_io(sock, &sock->reads[(sock->read_next + i) % sock->n_io], maxsize);
+    }
+    return socket_reads(sock)->iostate;
 }
 
 int
 socket_send_queue(struct link_socket *sock, struct buffer *buf, const struct link_socket_actual *to)
 {
-    if (sock->writes.iostate == IOSTATE_INITIAL)
+    struct overlapped_io *io = socket_writes(sock);
+
+    if (io->iostate == IOSTATE_INITIAL)
     {
         WSABUF wsabuf[1];
         int status;
 
         /* make a private copy of buf */
-        sock->writes.buf = sock->writes.buf_init;
-        sock->writes.buf.len = 0;
-        ASSERT(buf_copy(&sock->writes.buf, buf));
+        io->buf = io->buf_init;
+        io->buf.len = 0;
+        ASSERT(buf_copy(&io->buf, buf));
 
         /* Win32 docs say it's okay to allocate the wsabuf on the stack */
-        wsabuf[0].buf = BSTR(&sock->writes.buf);
-        wsabuf[0].len = BLEN(&sock->writes.buf);
+        wsabuf[0].buf = BSTR(&io->buf);
+        wsabuf[0].len = BLEN(&io->buf);
 
         /* the overlapped write will signal this event on I/O completion */
-        ASSERT(ResetEvent(sock->writes.overlapped.hEvent));
-        sock->writes.flags = 0;
+        ASSERT(ResetEvent(io->overlapped.hEvent));
+        io->flags = 0;
 
         if (socket_is_dco_win(sock))
         {
             status = WriteFile((HANDLE)sock->sd, wsabuf[0].buf, wsabuf[0].len,
-                               &sock->writes.size, &sock->writes.overlapped);
+                               &io->size, &io->overlapped);
 
             /* WriteFile status is inverted from WSASendTo */
             status = !status;
@@ -3661,41 +5322,41 @@ socket_send_queue(struct link_socket *sock, struct buffer *buf, const struct lin
         else if (proto_is_udp(sock->info.proto))
         {
             /* set destination address for UDP writes */
-            sock->writes.addr_defined = true;
+            io->addr_defined = true;
             if (to->dest.addr.sa.sa_family == AF_INET6)
             {
-                sock->writes.addr6 = to->dest.addr.in6;
-                sock->writes.addrlen = sizeof(sock->writes.addr6);
+                io->addr6 = to->dest.addr.in6;
+                io->addrlen = sizeof(io->addr6);
             }
             else
             {
-                sock->writes.addr = to->dest.addr.in4;
-                sock->writes.addrlen = sizeof(sock->writes.addr);
+                io->addr = to->dest.addr.in4;
+                io->addrlen = sizeof(io->addr);
             }
 
             status = WSASendTo(
                 sock->sd,
                 wsabuf,
                 1,
-                &sock->writes.size,
-                sock->writes.flags,
-                (struct sockaddr *) &sock->writes.addr,
-                sock->writes.addrlen,
-                &sock->writes.overlapped,
+                &io->size,
+                io->flags,
+                (struct sockaddr *) &io->addr,
+                io->addrlen,
+                &io->overlapped,
                 NULL);
         }
         else if (proto_is_tcp(sock->info.proto))
         {
             /* destination address for TCP writes was established on connection initiation */
-            sock->writes.addr_defined = false;
+            io->addr_defined = false;
 
             status = WSASend(
                 sock->sd,
                 wsabuf,
                 1,
-                &sock->writes.size,
-                sock->writes.flags,
-                &sock->writes.overlapped,
+                &io->size,
+                io->flags,
+                &io->overlapped,
                 NULL);
         }
         else
@@ -3706,16 +5367,16 @@ socket_send_queue(struct link_socket *sock, struct buffer *buf, const struct lin
 
         if (!status) /* operation completed immediately? */
         {
-            sock->writes.iostate = IOSTATE_IMMEDIATE_RETURN;
+            io->iostate = IOSTATE_IMMEDIATE_RETURN;
 
             /* since we got an immediate return, we must signal the event object ourselves */
-            ASSERT(SetEvent(sock->writes.overlapped.hEvent));
+            ASSERT(SetEvent(io->overlapped.hEvent));
 
-            sock->writes.status = 0;
+            io->status = 0;
 
             dmsg(D_WIN32_IO, "WIN32 I/O: Socket Send immediate return [%d,%d]",
                  (int) wsabuf[0].len,
-                 (int) sock->writes.size);
+                 (int) io->size);
         }
         else
         {
@@ -3723,17 +5384,17 @@ socket_send_queue(struct link_socket *sock, struct buffer *buf, const struct lin
             /* both status code have the identical value */
             if (status == WSA_IO_PENDING || status == ERROR_IO_PENDING) /* operation queued? */
             {
-                sock->writes.iostate = IOSTATE_QUEUED;
-                sock->writes.status = status;
+                io->iostate = IOSTATE_QUEUED;
+                io->status = status;
                 dmsg(D_WIN32_IO, "WIN32 I/O: Socket Send queued [%d]",
                      (int) wsabuf[0].len);
             }
             else /* error occurred */
             {
                 struct gc_arena gc = gc_new();
-                ASSERT(SetEvent(sock->writes.overlapped.hEvent));
-                sock->writes.iostate = IOSTATE_IMMEDIATE_RETURN;
-                sock->writes.status = status;
+                ASSERT(SetEvent(io->overlapped.hEvent));
+                io->iostate = IOSTATE_IMMEDIATE_RETURN;
+                io->status = status;
 
                 dmsg(D_WIN32_IO, "WIN32 I/O: Socket Send error [%d]: %s",
                      (int) wsabuf[0].len,
@@ -3743,7 +5404,7 @@ socket_send_queue(struct link_socket *sock, struct buffer *buf, const struct lin
             }
         }
     }
-    return sock->writes.iostate;
+    return io->iostate;
 }
 
 /* Returns the number of bytes successfully read */
@@ -3895,6 +5556,8 @@ socket_set(struct link_socket *s,
         }
 #endif
 
+        s->es_edge = (rwflags & EVENT_EDGE) ? es : NULL;
+
         /* if persistent is defined, call event_ctl only if rwflags has changed since last call */
         if (!persistent || *persistent != rwflags)
         {
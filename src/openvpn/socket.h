@@ -78,6 +78,7 @@ struct cached_dns_entry {
     const char *servname;
     int ai_family;
     int flags;
+    time_t expires;             /* 0 = never, see --resolv-cache */
     struct addrinfo *ai;
     struct cached_dns_entry *next;
 };
@@ -88,6 +89,9 @@ struct link_socket_actual
     /*int dummy;*/ /* add offset to force a bug if dest not explicitly dereferenced */
 
     struct openvpn_sockaddr dest;
+    /* socket of a server the peer talks to: 0 for the main one, i for
+     * extra_sd[i - 1] of struct link_socket, see --listen-extra */
+    uint8_t listener;
 #if ENABLE_IP_PKTINFO
     union {
 #if defined(HAVE_IN_PKTINFO) && defined(HAVE_IPI_SPEC_DST)
@@ -105,6 +109,7 @@ struct link_socket_addr
 {
     struct addrinfo *bind_local;
     struct addrinfo *remote_list; /* complete remote list */
+    bool remote_list_cached;     /* remote_list is owned by the dns cache */
     struct addrinfo *current_remote; /* remote used in the
                                       * current connection attempt */
     struct link_socket_actual actual; /* reply to this address */
@@ -123,18 +128,28 @@ struct link_socket_info
     int mtu_changed;            /* Set to true when mtu value is changed */
 };
 
+/*
+ * Number of maximum sized packets that fit into the stream buffer
+ * of a TCP socket, and so can be returned by a single recv().
+ */
+#define STREAM_BUF_PACKETS 8
+
 /*
  * Used to extract packets encapsulated in streams into a buffer,
  * in this case IP packets embedded in a TCP stream.
+ *
+ * Data is read into buf_init as far as it has room, and the
+ * packets are returned in place.  Only an incomplete packet at the
+ * end is moved back to the start to make room for the next read.
  */
 struct stream_buf
 {
     struct buffer buf_init;
-    struct buffer residual;
+    struct buffer residual; /* data read by a proxy handshake */
     int maxlen;
-    bool residual_fully_formed;
+    bool residual_fully_formed; /* buf holds a complete packet */
 
-    struct buffer buf;
+    struct buffer buf;  /* data read but not returned yet */
     struct buffer next;
     int len;   /* -1 if not yet known */
 
@@ -155,6 +170,7 @@ struct socket_buffer_size
 {
     int rcvbuf;
     int sndbuf;
+    int rcvbuf_max;             /* grow rcvbuf up to this on drops, 0 = never */
 };
 
 /*
@@ -162,6 +178,103 @@ struct socket_buffer_size
  * defines try to abstract away our implementation differences between
  * using sockets on Posix vs. Win32.
  */
+/* upper bounds for --udp-recv-batch and --udp-send-batch */
+#define UDP_RECV_BATCH_MAX 64
+#define UDP_SEND_BATCH_MAX 64
+
+/* more UDP sockets a server can listen on, see --listen-extra */
+#define LINK_SOCKET_EXTRA_MAX 8
+
+#ifdef _WIN32
+/* overlapped reads and writes in flight at a time on a UDP socket */
+#define SOCKET_IO_QUEUE 8
+#endif
+
+#if ENABLE_UDP_RECV_BATCH
+/*
+ * Datagrams read ahead from a UDP socket by a single recvmmsg() call.
+ * link_socket_read() hands them out one at a time before it issues
+ * the next recvmmsg().
+ */
+struct link_socket_recv_batch
+{
+    int size;                   /* max datagrams per recvmmsg() call */
+    int count;                  /* datagrams returned by the last call */
+    int next;                   /* index of the next datagram to return */
+    int headroom;               /* headroom reserved in each buffer */
+#if ENABLE_UDP_RECV_GRO
+    bool gro;                   /* let the kernel coalesce datagrams (UDP_GRO) */
+    int seg;                    /* segment size of datagram next */
+    int offset;                 /* offset of the next segment in datagram next */
+#endif
+    struct buffer *bufs;
+    struct link_socket_actual *from;
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+    uint8_t *cmsg;
+};
+#endif
+
+#if ENABLE_UDP_SEND_BATCH
+#if ENABLE_UDP_SEND_ZEROCOPY
+/*
+ * With --udp-send-zerocopy the batch rotates between UDP_ZEROCOPY_SETS
+ * buffer sets.  A set sent with MSG_ZEROCOPY may only be refilled once
+ * the kernel has reported all of its sends as completed; the last set
+ * is never sent with MSG_ZEROCOPY and is used while all others are busy.
+ */
+#define UDP_ZEROCOPY_SETS 4
+
+struct link_socket_zerocopy_set
+{
+    uint32_t first;             /* kernel id of the first MSG_ZEROCOPY send */
+    int count;                  /* MSG_ZEROCOPY sends made from this set */
+    int pending;                /* ... not yet reported as completed */
+    time_t sent;
+};
+#endif
+
+/*
+ * Datagrams queued by link_socket_write() on a UDP socket, sent with a
+ * single sendmmsg() call by link_socket_send_batch_flush().  Those the
+ * socket does not take because it would block stay queued; once the
+ * queue is full, link_socket_write() fails with EAGAIN.
+ */
+struct link_socket_send_batch
+{
+    int size;                   /* max datagrams queued before a flush */
+    int count;                  /* datagrams currently queued */
+    bool gso;                   /* coalesce runs to one peer with UDP_SEGMENT */
+    struct buffer *bufs;        /* buffer set currently being filled */
+#if ENABLE_UDP_SEND_ZEROCOPY
+    bool zerocopy;              /* send large messages with MSG_ZEROCOPY */
+    int set;                    /* index of bufs in pool */
+    struct buffer *pool;        /* UDP_ZEROCOPY_SETS * size buffers */
+    struct link_socket_zerocopy_set zc[UDP_ZEROCOPY_SETS];
+    uint32_t zc_next;           /* kernel id of our next MSG_ZEROCOPY send */
+    int zc_inflight;            /* sets with pending completions */
+#endif
+    struct link_socket_actual *to;
+    struct mmsghdr *msgs;
+    struct iovec *iov;
+    uint8_t *cmsg;
+};
+#endif
+
+#ifndef _WIN32
+/*
+ * Packets written to a TCP socket while it is corked.  They are
+ * collected with their length prefix and written with a single send()
+ * by link_socket_tcp_flush().  Whatever the socket does not take stays
+ * here until the socket is writable again.
+ */
+struct link_socket_tcp_out
+{
+    struct buffer buf;
+    bool corked;
+};
+#endif
+
 struct link_socket
 {
     struct link_socket_info info;
@@ -169,9 +282,25 @@ struct link_socket
     socket_descriptor_t sd;
     socket_descriptor_t ctrl_sd; /* only used for UDP over Socks */
 
+#ifndef _WIN32
+    /* more UDP sockets of a server, see --listen-extra */
+    socket_descriptor_t extra_sd[LINK_SOCKET_EXTRA_MAX];
+    int n_extra;
+    int extra_next;             /* extra socket to read from first */
+#endif
+
 #ifdef _WIN32
-    struct overlapped_io reads;
-    struct overlapped_io writes;
+    /*
+     * Rings of n_io overlapped reads and writes, a single one of each on
+     * TCP.  reads[read_next] is the oldest read and writes[write_next]
+     * takes the next write, the oldest one in flight once all are used.
+     * rw_handle has the events of these two.
+     */
+    struct overlapped_io reads[SOCKET_IO_QUEUE];
+    struct overlapped_io writes[SOCKET_IO_QUEUE];
+    int n_io;
+    int read_next;
+    int write_next;
     struct rw_handle rw_handle;
     struct rw_handle listen_handle; /* For listening on TCP socket in server mode */
 #endif
@@ -179,14 +308,26 @@ struct link_socket
     /* used for printing status info only */
     unsigned int rwflags_debug;
 
+    /* event set this socket was last given to with EVENT_EDGE */
+    struct event_set *es_edge;
+
     /* used for long-term queueing of pre-accepted socket listen */
     bool listen_persistent_queued;
 
+    /* connection accepted on a listen socket by link_socket_accept(),
+     * to be taken over by the next instance created */
+    socket_descriptor_t accepted_sd;
+
+    /* sd of an accept-from socket was accepted by its parent already */
+    bool accepted;
+
     const char *remote_host;
     const char *remote_port;
     const char *local_host;
     const char *local_port;
-    struct cached_dns_entry *dns_cache;
+    struct cached_dns_entry **dns_cache;
+    struct gc_arena *dns_cache_gc;
+    int resolv_cache;           /* --resolv-cache seconds */
     bool bind_local;
 
 #define LS_MODE_DEFAULT           0
@@ -199,6 +340,10 @@ struct link_socket
 
     struct socket_buffer_size socket_buffer_sizes;
 
+    /* kernel receive drops, see link_socket_check_drops() */
+    uint32_t drops;
+    time_t drops_checked;
+
     int mtu;                    /* OS discovered MTU, or 0 if unknown */
 
 #define SF_USE_IP_PKTINFO (1<<0)
@@ -209,12 +354,29 @@ struct link_socket
 #define SF_DCO_WIN (1<<5)
     unsigned int sockflags;
     int mark;
+    int busy_poll;              /* --busy-poll microseconds */
+    bool busy_poll_prefer;
+    int busy_poll_budget;       /* packets per busy poll, 0 = kernel default */
+    int tcp_notsent_lowat;      /* --tcp-notsent-lowat bytes, 0 = kernel default */
+    bool tcp_fastopen;          /* --tcp-fastopen */
     const char *bind_dev;
 
     /* for stream sockets */
     struct stream_buf stream_buf;
     struct buffer stream_buf_data;
     bool stream_reset;
+#ifndef _WIN32
+    struct link_socket_tcp_out tcp_out;
+#endif
+
+#if ENABLE_UDP_RECV_BATCH
+    /* for datagram sockets with --udp-recv-batch */
+    struct link_socket_recv_batch recv_batch;
+#endif
+#if ENABLE_UDP_SEND_BATCH
+    /* for datagram sockets with --udp-send-batch */
+    struct link_socket_send_batch send_batch;
+#endif
 
     /* HTTP proxy */
     struct http_proxy_info *http_proxy;
@@ -448,6 +610,11 @@ bool link_socket_update_flags(struct link_socket *ls, unsigned int sockflags);
 
 void link_socket_update_buffer_sizes(struct link_socket *ls, int rcvbuf, int sndbuf);
 
+/* datagrams dropped by the kernel on all link sockets */
+extern counter_type link_socket_drops_global;
+
+void link_socket_check_drops(struct link_socket *ls);
+
 /*
  * Low-level functions
  */
@@ -469,6 +636,13 @@ bool ipv6_addr_safe(const char *ipv6_text_addr);
 
 socket_descriptor_t create_socket_tcp(struct addrinfo *);
 
+/*
+ * Accept a connection on the TCP listen socket sock without blocking,
+ * for the next instance created to take over.  Returns false if no
+ * connection is waiting.
+ */
+bool link_socket_accept(struct link_socket *sock);
+
 socket_descriptor_t socket_do_accept(socket_descriptor_t sd,
                                      struct link_socket_actual *act,
                                      const bool nowait);
@@ -885,7 +1059,7 @@ af_addr_size(sa_family_t af)
 static inline bool
 link_socket_actual_match(const struct link_socket_actual *a1, const struct link_socket_actual *a2)
 {
-    return addr_port_match(&a1->dest, &a2->dest);
+    return addr_port_match(&a1->dest, &a2->dest) && a1->listener == a2->listener;
 }
 
 #if PORT_SHARE
@@ -1041,6 +1215,20 @@ int link_socket_read_tcp(struct link_socket *sock,
 
 #ifdef _WIN32
 
+/* the oldest overlapped read, which completes first */
+static inline struct overlapped_io *
+socket_reads(struct link_socket *sock)
+{
+    return &sock->reads[sock->read_next];
+}
+
+/* the overlapped write that takes the next packet */
+static inline struct overlapped_io *
+socket_writes(struct link_socket *sock)
+{
+    return &sock->writes[sock->write_next];
+}
+
 static inline int
 link_socket_read_udp_win32(struct link_socket *sock,
                            struct buffer *buf,
@@ -1052,7 +1240,16 @@ link_socket_read_udp_win32(struct link_socket *sock,
         *from = sock->info.lsa->actual;
         sh.is_handle = true;
     }
-    return sockethandle_finalize(sh, &sock->reads, buf, from);
+
+    const int ret = sockethandle_finalize(sh, socket_reads(sock), buf, from);
+
+    /* done with this one, wait for the next read in the ring */
+    if (socket_reads(sock)->iostate == IOSTATE_INITIAL)
+    {
+        sock->read_next = (sock->read_next + 1) % sock->n_io;
+        sock->rw_handle.read = socket_reads(sock)->overlapped.hEvent;
+    }
+    return ret;
 }
 
 #else  /* ifdef _WIN32 */
@@ -1113,15 +1310,20 @@ link_socket_write_win32(struct link_socket *sock,
     int err = 0;
     int status = 0;
     sockethandle_t sh = { .s = sock->sd, .is_handle = socket_is_dco_win(sock) };
-    if (overlapped_io_active(&sock->writes))
+    if (overlapped_io_active(socket_writes(sock)))
     {
-        status = sockethandle_finalize(sh, &sock->writes, NULL, NULL);
+        status = sockethandle_finalize(sh, socket_writes(sock), NULL, NULL);
         if (status < 0)
         {
             err = SocketHandleGetLastError(sh);
         }
     }
-    socket_send_queue(sock, buf, to);
+    if (socket_send_queue(sock, buf, to) != IOSTATE_INITIAL)
+    {
+        /* in flight, the next packet goes to the next write in the ring */
+        sock->write_next = (sock->write_next + 1) % sock->n_io;
+        sock->rw_handle.write = socket_writes(sock)->overlapped.hEvent;
+    }
     if (status < 0)
     {
         SocketHandleSetLastError(sh, err);
@@ -1139,12 +1341,53 @@ size_t link_socket_write_udp_posix_sendmsg(struct link_socket *sock,
                                            struct buffer *buf,
                                            struct link_socket_actual *to);
 
+#if ENABLE_UDP_SEND_BATCH
+size_t link_socket_write_udp_posix_batch(struct link_socket *sock,
+                                         struct buffer *buf,
+                                         struct link_socket_actual *to);
+
+#endif
+
+/*
+ * Bind a non-blocking UDP socket for --listen-extra, fatal on errors.
+ */
+socket_descriptor_t link_socket_open_udp_extra(const char *host, const char *port,
+                                               const struct socket_buffer_size *sbs);
+
+/*
+ * Attach the --udp-prefilter program to the UDP socket and the
+ * --listen-extra sockets of a server.  P_CONTROL_HARD_RESET_CLIENT_V3
+ * only passes if \c reset_v3.
+ */
+void link_socket_set_prefilter(struct link_socket *sock, bool reset_v3);
+
+/*
+ * Read a datagram from one of the --listen-extra sockets that has one,
+ * taking them in turn.  Returns 0 if none has.
+ */
+int link_socket_read_udp_extra(struct link_socket *sock,
+                               struct buffer *buf,
+                               struct link_socket_actual *from);
 
 static inline size_t
 link_socket_write_udp_posix(struct link_socket *sock,
                             struct buffer *buf,
                             struct link_socket_actual *to)
 {
+    /* peers of a --listen-extra socket get their datagrams through it */
+    if (to->listener)
+    {
+        ASSERT(to->listener <= sock->n_extra);
+        return sendto(sock->extra_sd[to->listener - 1], BPTR(buf), BLEN(buf), 0,
+                      (struct sockaddr *) &to->dest.addr.sa,
+                      (socklen_t) af_addr_size(to->dest.addr.sa.sa_family));
+    }
+#if ENABLE_UDP_SEND_BATCH
+    if (sock->send_batch.bufs)
+    {
+        return link_socket_write_udp_posix_batch(sock, buf, to);
+    }
+#endif
 #if ENABLE_IP_PKTINFO
     if (proto_is_udp(sock->info.proto) && (sock->sockflags & SF_USE_IP_PKTINFO)
         && addr_defined_ipi(to))
@@ -1158,12 +1401,30 @@ link_socket_write_udp_posix(struct link_socket *sock,
                   (socklen_t) af_addr_size(to->dest.addr.sa.sa_family));
 }
 
+/*
+ * A read or write on sock did not complete because the kernel buffer
+ * was empty or full, tell an event set that watches it edge-triggered.
+ */
+static inline void
+link_socket_blocked(struct link_socket *sock, unsigned int rwflags)
+{
+    if (sock->es_edge)
+    {
+        event_blocked(sock->es_edge, sock->sd, rwflags);
+    }
+}
+
 static inline size_t
 link_socket_write_tcp_posix(struct link_socket *sock,
                             struct buffer *buf,
                             struct link_socket_actual *to)
 {
-    return send(sock->sd, BPTR(buf), BLEN(buf), MSG_NOSIGNAL);
+    const ssize_t size = send(sock->sd, BPTR(buf), BLEN(buf), MSG_NOSIGNAL);
+    if (size < BLEN(buf) && (size >= 0 || errno == EAGAIN))
+    {
+        link_socket_blocked(sock, EVENT_WRITE);
+    }
+    return size;
 }
 
 #endif /* ifdef _WIN32 */
@@ -1237,10 +1498,130 @@ link_socket_set_tos(struct link_socket *ls)
  * Socket I/O wait functions
  */
 
+/*
+ * Returns true if datagrams received by an earlier recvmmsg() call
+ * are still waiting to be returned by link_socket_read().
+ */
+static inline bool
+link_socket_recv_batch_pending(const struct link_socket *s)
+{
+#if ENABLE_UDP_RECV_BATCH
+    return s && s->recv_batch.next < s->recv_batch.count;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Look at the next datagram waiting in the --udp-recv-batch without
+ * consuming it.  Returns false if there is none.
+ */
+static inline bool
+link_socket_recv_batch_peek(const struct link_socket *s,
+                            const uint8_t **data, int *len,
+                            const struct link_socket_actual **from)
+{
+#if ENABLE_UDP_RECV_BATCH
+    if (link_socket_recv_batch_pending(s))
+    {
+        const struct link_socket_recv_batch *rb = &s->recv_batch;
+        *data = BPTR(&rb->bufs[rb->next]);
+        *len = (int) rb->msgs[rb->next].msg_len;
+        *from = &rb->from[rb->next];
+#if ENABLE_UDP_RECV_GRO
+        if (rb->offset > 0)
+        {
+            /* inside a coalesced datagram, see link_socket_read() */
+            *data += rb->offset;
+            *len = min_int(rb->seg, *len - rb->offset);
+        }
+#endif
+        return true;
+    }
+#endif
+    return false;
+}
+
+#ifndef _WIN32
+void link_socket_tcp_cork(struct link_socket *sock);
+
+void link_socket_tcp_flush(struct link_socket *sock);
+
+/* true if a corked TCP socket can take another packet */
+static inline bool
+link_socket_tcp_out_room(const struct link_socket *sock)
+{
+    return buf_forward_capacity(&sock->tcp_out.buf)
+           >= sock->stream_buf.maxlen + (int) sizeof(packet_size_type);
+}
+#endif
+
+/* true if packets written to a TCP socket still wait to be sent */
+static inline bool
+link_socket_tcp_out_pending(const struct link_socket *sock)
+{
+#ifndef _WIN32
+    return BLEN(&sock->tcp_out.buf) > 0;
+#else
+    return false;
+#endif
+}
+
+#if ENABLE_UDP_SEND_BATCH
+void link_socket_send_batch_flush_dowork(struct link_socket *sock);
+
+#endif
+
+static inline bool
+link_socket_send_batch_queued(const struct link_socket *s)
+{
+#if ENABLE_UDP_SEND_BATCH
+    return s && s->send_batch.count > 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Send the datagrams queued by --udp-send-batch.  Must be called before
+ * the event loop goes to sleep.
+ */
+static inline void
+link_socket_send_batch_flush(struct link_socket *s)
+{
+#if ENABLE_UDP_SEND_BATCH
+    if (link_socket_send_batch_queued(s))
+    {
+        link_socket_send_batch_flush_dowork(s);
+    }
+#endif
+}
+
+/*
+ * Returns true if the oldest of several overlapped reads on a UDP
+ * socket has completed already, so the completions of one wakeup are
+ * drained without waiting for events in between.
+ */
+static inline bool
+socket_reads_completed(const struct link_socket *s)
+{
+#ifdef _WIN32
+    if (s->n_io > 1)
+    {
+        const struct overlapped_io *io = &s->reads[s->read_next];
+        return io->iostate == IOSTATE_IMMEDIATE_RETURN
+               || (io->iostate == IOSTATE_QUEUED && HasOverlappedIoCompleted(&io->overlapped));
+    }
+#endif
+    return false;
+}
+
 static inline bool
 socket_read_residual(const struct link_socket *s)
 {
-    return s && s->stream_buf.residual_fully_formed;
+    return s && (s->stream_buf.residual_fully_formed
+                 || link_socket_recv_batch_pending(s)
+                 || socket_reads_completed(s));
 }
 
 static inline event_t
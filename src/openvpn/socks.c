@@ -82,50 +82,24 @@ socks_proxy_close(struct socks_proxy_info *sp)
     free(sp);
 }
 
+/*
+ * Read exactly len bytes of a SOCKS reply.  Each recv() asks for all
+ * that is still missing, never for more, so that nothing which follows
+ * the reply is taken from the socket.
+ */
 static bool
-socks_username_password_auth(struct socks_proxy_info *p,
-                             socket_descriptor_t sd,
-                             volatile int *signal_received)
+socks_recv(socket_descriptor_t sd, char *buf, int len, const char *who,
+           volatile int *signal_received)
 {
-    char to_send[516];
-    char buf[2];
-    int len = 0;
     const int timeout_sec = 5;
-    struct user_pass creds;
-    ssize_t size;
-    bool ret = false;
-
-    creds.defined = 0;
-    if (!get_user_pass(&creds, p->authfile, UP_TYPE_SOCKS, GET_USER_PASS_MANAGEMENT))
-    {
-        msg(M_NONFATAL, "SOCKS failed to get username/password.");
-        goto cleanup;
-    }
-
-    if ( (strlen(creds.username) > 255) || (strlen(creds.password) > 255) )
-    {
-        msg(M_NONFATAL,
-            "SOCKS username and/or password exceeds 255 characters.  "
-            "Authentication not possible.");
-        goto cleanup;
-    }
-    openvpn_snprintf(to_send, sizeof(to_send), "\x01%c%s%c%s", (int) strlen(creds.username),
-                     creds.username, (int) strlen(creds.password), creds.password);
-    size = send(sd, to_send, strlen(to_send), MSG_NOSIGNAL);
-
-    if (size != strlen(to_send))
-    {
-        msg(D_LINK_ERRORS | M_ERRNO, "socks_username_password_auth: TCP port write failed on send()");
-        goto cleanup;
-    }
+    int have = 0;
 
-    while (len < 2)
+    while (have < len)
     {
         int status;
         ssize_t size;
         fd_set reads;
         struct timeval tv;
-        char c;
 
         FD_ZERO(&reads);
         openvpn_fd_set(sd, &reads);
@@ -137,35 +111,80 @@ socks_username_password_auth(struct socks_proxy_info *p,
         get_signal(signal_received);
         if (*signal_received)
         {
-            goto cleanup;
+            return false;
         }
 
         /* timeout? */
         if (status == 0)
         {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_username_password_auth: TCP port read timeout expired");
-            goto cleanup;
+            msg(D_LINK_ERRORS | M_ERRNO, "%s: TCP port read timeout expired", who);
+            return false;
         }
 
         /* error */
         if (status < 0)
         {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_username_password_auth: TCP port read failed on select()");
-            goto cleanup;
+            msg(D_LINK_ERRORS | M_ERRNO, "%s: TCP port read failed on select()", who);
+            return false;
         }
 
-        /* read single char */
-        size = recv(sd, &c, 1, MSG_NOSIGNAL);
+        size = recv(sd, buf + have, len - have, MSG_NOSIGNAL);
 
         /* error? */
-        if (size != 1)
+        if (size < 0)
         {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_username_password_auth: TCP port read failed on recv()");
-            goto cleanup;
+            msg(D_LINK_ERRORS | M_ERRNO, "%s: TCP port read failed on recv()", who);
+            return false;
         }
+        else if (size == 0)
+        {
+            msg(D_LINK_ERRORS, "ERROR: %s: empty response from socks server", who);
+            return false;
+        }
+        have += (int) size;
+    }
+    return true;
+}
+
+static bool
+socks_username_password_auth(struct socks_proxy_info *p,
+                             socket_descriptor_t sd,
+                             volatile int *signal_received)
+{
+    char to_send[516];
+    char buf[2];
+    struct user_pass creds;
+    ssize_t size;
+    bool ret = false;
+
+    creds.defined = 0;
+    if (!get_user_pass(&creds, p->authfile, UP_TYPE_SOCKS, GET_USER_PASS_MANAGEMENT))
+    {
+        msg(M_NONFATAL, "SOCKS failed to get username/password.");
+        goto cleanup;
+    }
+
+    if ( (strlen(creds.username) > 255) || (strlen(creds.password) > 255) )
+    {
+        msg(M_NONFATAL,
+            "SOCKS username and/or password exceeds 255 characters.  "
+            "Authentication not possible.");
+        goto cleanup;
+    }
+    openvpn_snprintf(to_send, sizeof(to_send), "\x01%c%s%c%s", (int) strlen(creds.username),
+                     creds.username, (int) strlen(creds.password), creds.password);
+    size = send(sd, to_send, strlen(to_send), MSG_NOSIGNAL);
+
+    if (size != strlen(to_send))
+    {
+        msg(D_LINK_ERRORS | M_ERRNO, "socks_username_password_auth: TCP port write failed on send()");
+        goto cleanup;
+    }
 
-        /* store char in buffer */
-        buf[len++] = c;
+    if (!socks_recv(sd, buf, sizeof(buf), "socks_username_password_auth",
+                    signal_received))
+    {
+        goto cleanup;
     }
 
     /* VER = 5, SUCCESS = 0 --> auth success */
@@ -188,8 +207,6 @@ socks_handshake(struct socks_proxy_info *p,
                 volatile int *signal_received)
 {
     char buf[2];
-    int len = 0;
-    const int timeout_sec = 5;
     ssize_t size;
 
     /* VER = 5, NMETHODS = 1, METHODS = [0 (no auth)] */
@@ -206,53 +223,9 @@ socks_handshake(struct socks_proxy_info *p,
         return false;
     }
 
-    while (len < 2)
+    if (!socks_recv(sd, buf, sizeof(buf), "socks_handshake", signal_received))
     {
-        int status;
-        ssize_t size;
-        fd_set reads;
-        struct timeval tv;
-        char c;
-
-        FD_ZERO(&reads);
-        openvpn_fd_set(sd, &reads);
-        tv.tv_sec = timeout_sec;
-        tv.tv_usec = 0;
-
-        status = select(sd + 1, &reads, NULL, NULL, &tv);
-
-        get_signal(signal_received);
-        if (*signal_received)
-        {
-            return false;
-        }
-
-        /* timeout? */
-        if (status == 0)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_handshake: TCP port read timeout expired");
-            return false;
-        }
-
-        /* error */
-        if (status < 0)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_handshake: TCP port read failed on select()");
-            return false;
-        }
-
-        /* read single char */
-        size = recv(sd, &c, 1, MSG_NOSIGNAL);
-
-        /* error? */
-        if (size != 1)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "socks_handshake: TCP port read failed on recv()");
-            return false;
-        }
-
-        /* store char in buffer */
-        buf[len++] = c;
+        return false;
     }
 
     /* VER == 5 */
@@ -305,9 +278,7 @@ recv_socks_reply(socket_descriptor_t sd,
 {
     char atyp = '\0';
     int alen = 0;
-    int len = 0;
     char buf[270];              /* 4 + alen(max 256) + 2 */
-    const int timeout_sec = 5;
 
     if (addr != NULL)
     {
@@ -316,92 +287,40 @@ recv_socks_reply(socket_descriptor_t sd,
         addr->addr.in4.sin_port = htons(0);
     }
 
-    while (len < 4 + alen + 2)
+    /* VER, REP, RSV, ATYP and the first byte of the address, which is
+     * the length of a domain name */
+    if (!socks_recv(sd, buf, 5, "recv_socks_reply", signal_received))
     {
-        int status;
-        ssize_t size;
-        fd_set reads;
-        struct timeval tv;
-        char c;
-
-        FD_ZERO(&reads);
-        openvpn_fd_set(sd, &reads);
-        tv.tv_sec = timeout_sec;
-        tv.tv_usec = 0;
-
-        status = select(sd + 1, &reads, NULL, NULL, &tv);
-
-        get_signal(signal_received);
-        if (*signal_received)
-        {
-            return false;
-        }
+        return false;
+    }
 
-        /* timeout? */
-        if (status == 0)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "recv_socks_reply: TCP port read timeout expired");
-            return false;
-        }
+    atyp = buf[3];
+    switch (atyp)
+    {
+        case '\x01':    /* IP V4 */
+            alen = 4;
+            break;
 
-        /* error */
-        if (status < 0)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "recv_socks_reply: TCP port read failed on select()");
-            return false;
-        }
+        case '\x03':    /* DOMAINNAME */
+            /* RFC 1928, section 5: 1 byte length, <n> bytes name,
+             * so the total "address length" is (length+1)
+             */
+            alen = (unsigned char) buf[4] + 1;
+            break;
 
-        /* read single char */
-        size = recv(sd, &c, 1, MSG_NOSIGNAL);
+        case '\x04':    /* IP V6 */
+            alen = 16;
+            break;
 
-        /* error? */
-        if (size < 0)
-        {
-            msg(D_LINK_ERRORS | M_ERRNO, "recv_socks_reply: TCP port read failed on recv()");
+        default:
+            msg(D_LINK_ERRORS, "recv_socks_reply: Socks proxy returned bad address type");
             return false;
-        }
-        else if (size == 0)
-        {
-            msg(D_LINK_ERRORS, "ERROR: recv_socks_reply: empty response from socks server");
-            return false;
-        }
-
-        if (len == 3)
-        {
-            atyp = c;
-        }
-
-        if (len == 4)
-        {
-            switch (atyp)
-            {
-                case '\x01':    /* IP V4 */
-                    alen = 4;
-                    break;
-
-                case '\x03':    /* DOMAINNAME */
-                    /* RFC 1928, section 5: 1 byte length, <n> bytes name,
-                     * so the total "address length" is (length+1)
-                     */
-                    alen = (unsigned char) c + 1;
-                    break;
-
-                case '\x04':    /* IP V6 */
-                    alen = 16;
-                    break;
-
-                default:
-                    msg(D_LINK_ERRORS, "recv_socks_reply: Socks proxy returned bad address type");
-                    return false;
-            }
-        }
+    }
 
-        /* store char in buffer */
-        if (len < (int)sizeof(buf))
-        {
-            buf[len] = c;
-        }
-        ++len;
+    /* rest of the address and the port */
+    if (!socks_recv(sd, buf + 5, 4 + alen + 2 - 5, "recv_socks_reply", signal_received))
+    {
+        return false;
     }
 
     /* VER == 5 && REP == 0 (succeeded) */
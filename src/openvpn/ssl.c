@@ -52,6 +52,7 @@
 #include "gremlin.h"
 #include "pkcs11.h"
 #include "route.h"
+#include "crypto_epoch.h"
 #include "tls_crypt.h"
 
 #include "ssl.h"
@@ -62,9 +63,32 @@
 #include "auth_token.h"
 #include "mss.h"
 #include "dco.h"
+#include "probe.h"
 
 #include "memdbg.h"
 
+struct object_cache tls_multi_cache = OBJECT_CACHE_INIT(struct tls_multi); /* GLOBAL */
+
+/* plaintext buffers of the key states, recycled from one handshake to
+ * the next */
+static struct buffer_pool *tls_channel_buf_pool; /* GLOBAL */
+
+const int tls_handshake_bucket_bounds[TLS_HANDSHAKE_BUCKETS - 1] = { 1, 2, 5, 10, 30, 60 };
+
+struct tls_handshake_stats tls_handshake_stats_global; /* GLOBAL */
+
+const int connect_phase_bucket_bounds[CONNECT_PHASE_BUCKETS - 1] = {
+    10, 100, 500, 1000, 5000, 10000
+};
+
+const char *const connect_phase_names[CONNECT_PHASE_N] = {
+    "tls", "auth", "key_exchange", "deferred_auth", "pool",
+    "client_connect", "push"
+};
+
+struct connect_phase_stats connect_phase_stats_global; /* GLOBAL */
+counter_type tls_key_id_errors_global;                 /* GLOBAL */
+
 #ifdef MEASURE_TLS_HANDSHAKE_STATS
 
 static int tls_handshake_success; /* GLOBAL */
@@ -380,6 +404,18 @@ calc_control_channel_frame_overhead(const struct tls_session *session)
     return overhead;
 }
 
+/*
+ * The TLS context of the previous run is kept over a SIGHUP and reused
+ * if the options and files it was built from did not change, which saves
+ * parsing large CA bundles and CRLs again.
+ */
+static struct {
+    uint8_t fp[SHA256_DIGEST_LENGTH]; /* of the last context built */
+    bool fp_valid;
+    struct tls_root_ctx ctx;          /* stashed by tls_ctx_stash() */
+    bool stashed;
+} ssl_ctx_cache; /* GLOBAL */
+
 void
 init_ssl_lib(void)
 {
@@ -388,9 +424,26 @@ init_ssl_lib(void)
     crypto_init_lib();
 }
 
+#ifdef ENABLE_CRL_ASYNC
+static void crl_reload_cancel(void);
+
+#endif
 void
 free_ssl_lib(void)
 {
+#ifdef ENABLE_CRL_ASYNC
+    crl_reload_cancel();
+#endif
+    if (ssl_ctx_cache.stashed)
+    {
+        tls_ctx_free(&ssl_ctx_cache.ctx);
+        ssl_ctx_cache.stashed = false;
+    }
+    if (tls_channel_buf_pool && !tls_channel_buf_pool->n_out)
+    {
+        buffer_pool_free(tls_channel_buf_pool);
+        tls_channel_buf_pool = NULL;
+    }
     crypto_uninit_lib();
 
     tls_free_lib();
@@ -653,6 +706,249 @@ tls_ctx_reload_crl(struct tls_root_ctx *ssl_ctx, const char *crl_file,
     backend_tls_ctx_reload_crl(ssl_ctx, crl_file, crl_file_inline);
 }
 
+#ifdef ENABLE_CRL_ASYNC
+/*
+ * Reload thread of --crl-verify file async.  The thread only parses the
+ * file, the main thread starts it, polls for the result and swaps it into
+ * the TLS context.  Until then peers are checked against the old CRL.
+ */
+static struct {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    bool running;               /* started and not joined yet */
+    bool done;                  /* under lock */
+    char *file;
+    time_t mtime;
+    off_t size;
+    void *crls;                 /* backend_crl_parse() result */
+    bool complete;
+} crl_reload = { .lock = PTHREAD_MUTEX_INITIALIZER }; /* GLOBAL */
+
+static void *
+crl_reload_thread(void *arg)
+{
+    bool complete;
+    void *crls = backend_crl_parse(crl_reload.file, &complete);
+
+    pthread_mutex_lock(&crl_reload.lock);
+    crl_reload.crls = crls;
+    crl_reload.complete = complete;
+    crl_reload.done = true;
+    pthread_mutex_unlock(&crl_reload.lock);
+    return NULL;
+}
+
+/* Wait for a running reload and drop its result */
+static void
+crl_reload_cancel(void)
+{
+    if (crl_reload.running)
+    {
+        pthread_join(crl_reload.thread, NULL);
+        backend_crl_free(crl_reload.crls);
+        free(crl_reload.file);
+        crl_reload.crls = NULL;
+        crl_reload.file = NULL;
+        crl_reload.running = false;
+    }
+}
+
+/**
+ * Like tls_ctx_reload_crl(), but parse a changed CRL file on a thread
+ * and use it from the first call after the thread is done.
+ */
+static void
+tls_ctx_reload_crl_async(struct tls_root_ctx *ssl_ctx, const char *crl_file)
+{
+    if (crl_reload.running)
+    {
+        pthread_mutex_lock(&crl_reload.lock);
+        const bool done = crl_reload.done;
+        pthread_mutex_unlock(&crl_reload.lock);
+        if (!done)
+        {
+            return;
+        }
+
+        pthread_join(crl_reload.thread, NULL);
+        crl_reload.running = false;
+        if (!crl_reload.crls)
+        {
+            msg(M_WARN, "CRL: cannot read: %s", crl_reload.file);
+        }
+        else if (!crl_reload.complete)
+        {
+            msg(M_WARN, "CRL: cannot read CRL from file %s", crl_reload.file);
+        }
+        const int n = backend_tls_ctx_set_crl(ssl_ctx, crl_reload.crls);
+        msg(M_INFO, "CRL: loaded %d CRLs from file %s", n, crl_reload.file);
+        ssl_ctx->crl_last_mtime = crl_reload.mtime;
+        ssl_ctx->crl_last_size = crl_reload.size;
+        crl_reload.crls = NULL;
+        free(crl_reload.file);
+        crl_reload.file = NULL;
+    }
+
+    platform_stat_t crl_stat;
+    if (platform_stat(crl_file, &crl_stat) < 0)
+    {
+        msg(M_WARN, "WARNING: Failed to stat CRL file, not reloading CRL.");
+        return;
+    }
+    if (ssl_ctx->crl_last_size == crl_stat.st_size
+        && ssl_ctx->crl_last_mtime == crl_stat.st_mtime)
+    {
+        return;
+    }
+
+    crl_reload.file = string_alloc(crl_file, NULL);
+    crl_reload.mtime = crl_stat.st_mtime;
+    crl_reload.size = crl_stat.st_size;
+    crl_reload.done = false;
+    if (pthread_create(&crl_reload.thread, NULL, crl_reload_thread, NULL) != 0)
+    {
+        msg(M_WARN | M_ERRNO, "CRL: cannot start reload thread, reloading now");
+        free(crl_reload.file);
+        crl_reload.file = NULL;
+        tls_ctx_reload_crl(ssl_ctx, crl_file, false);
+        return;
+    }
+    crl_reload.running = true;
+    msg(D_TLS_DEBUG_LOW, "CRL: %s changed, reloading in the background", crl_file);
+}
+#endif /* ifdef ENABLE_CRL_ASYNC */
+
+static void
+tls_ctx_fp_string(md_ctx_t *md, const char *str)
+{
+    if (str)
+    {
+        md_ctx_update(md, (const uint8_t *) str, (int) strlen(str) + 1);
+    }
+    else
+    {
+        md_ctx_update(md, (const uint8_t *) "\xff", 1);
+    }
+}
+
+/* inline files by content, others by name and stat() */
+static void
+tls_ctx_fp_file(md_ctx_t *md, const char *file, bool is_inline)
+{
+    tls_ctx_fp_string(md, file);
+    if (file && !is_inline)
+    {
+        platform_stat_t st;
+        int64_t id[4] = { -1, -1, -1, -1 };
+        if (platform_stat(file, &st) == 0)
+        {
+            id[0] = (int64_t) st.st_ino;
+            id[1] = (int64_t) st.st_size;
+            id[2] = (int64_t) st.st_mtime;
+            id[3] = (int64_t) st.st_ctime;
+        }
+        md_ctx_update(md, (const uint8_t *) id, sizeof(id));
+    }
+}
+
+/*
+ * Hash everything init_ssl() builds the context from.  Returns false if
+ * the context depends on something that cannot be compared, such as a
+ * PKCS#11 token or a key held by the management client.
+ */
+static bool
+tls_ctx_fingerprint(const struct options *options, bool in_chroot,
+                    uint8_t fp[SHA256_DIGEST_LENGTH])
+{
+    if (key_is_external(options)
+#ifdef ENABLE_PKCS11
+        || options->pkcs11_providers[0]
+#endif
+#ifdef ENABLE_CRYPTOAPI
+        || options->cryptoapi_cert
+#endif
+#ifdef ENABLE_MANAGEMENT
+        || (options->management_flags & (MF_EXTERNAL_CERT | MF_EXTERNAL_KEY))
+#endif
+        )
+    {
+        return false;
+    }
+
+    const int flags[] = {
+        options->tls_server, options->ssl_flags, options->tls_session_tickets,
+        in_chroot
+    };
+    md_ctx_t *md = md_ctx_new();
+    md_ctx_init(md, "SHA256");
+    md_ctx_update(md, (const uint8_t *) flags, sizeof(flags));
+    tls_ctx_fp_string(md, options->tls_cert_profile);
+    tls_ctx_fp_string(md, options->cipher_list);
+    tls_ctx_fp_string(md, options->cipher_list_tls13);
+    tls_ctx_fp_string(md, options->tls_groups);
+    tls_ctx_fp_string(md, options->ecdh_curve);
+    tls_ctx_fp_string(md, options->chroot_dir);
+    tls_ctx_fp_file(md, options->dh_file, options->dh_file_inline);
+    tls_ctx_fp_file(md, options->pkcs12_file, options->pkcs12_file_inline);
+    tls_ctx_fp_file(md, options->cert_file, options->cert_file_inline);
+    tls_ctx_fp_file(md, options->priv_key_file, options->priv_key_file_inline);
+    tls_ctx_fp_file(md, options->ca_file, options->ca_file_inline);
+    tls_ctx_fp_file(md, options->ca_path, false);
+    tls_ctx_fp_file(md, options->extra_certs_file, options->extra_certs_file_inline);
+    /* a CRL file is reloaded by tls_ctx_reload_crl() when it changes */
+    tls_ctx_fp_string(md, options->crl_file);
+    md_ctx_final(md, fp);
+    md_ctx_cleanup(md);
+    md_ctx_free(md);
+    return true;
+}
+
+void
+tls_ctx_stash(struct tls_root_ctx *ctx)
+{
+    if (ssl_ctx_cache.stashed)
+    {
+        tls_ctx_free(&ssl_ctx_cache.ctx);
+        ssl_ctx_cache.stashed = false;
+    }
+    if (ssl_ctx_cache.fp_valid)
+    {
+        ssl_ctx_cache.ctx = *ctx;
+        ssl_ctx_cache.stashed = true;
+        CLEAR(*ctx);
+    }
+    else
+    {
+        tls_ctx_free(ctx);
+    }
+}
+
+static void
+init_ssl_crl(const struct options *options, struct tls_root_ctx *new_ctx, bool in_chroot)
+{
+    if (options->crl_file && !(options->ssl_flags & SSLF_CRL_VERIFY_DIR))
+    {
+        /* If we're running with the chroot option, we may run init_ssl() before
+         * and after chroot-ing. We can use the crl_file path as-is if we're
+         * not going to chroot, or if we already are inside the chroot.
+         *
+         * If we're going to chroot later, we need to prefix the path of the
+         * chroot directory to crl_file.
+         */
+        if (!options->chroot_dir || in_chroot || options->crl_file_inline)
+        {
+            tls_ctx_reload_crl(new_ctx, options->crl_file, options->crl_file_inline);
+        }
+        else
+        {
+            struct gc_arena gc = gc_new();
+            struct buffer crl_file_buf = prepend_dir(options->chroot_dir, options->crl_file, &gc);
+            tls_ctx_reload_crl(new_ctx, BSTR(&crl_file_buf), options->crl_file_inline);
+            gc_free(&gc);
+        }
+    }
+}
+
 /*
  * Initialize SSL context.
  * All files are in PEM format.
@@ -664,6 +960,29 @@ init_ssl(const struct options *options, struct tls_root_ctx *new_ctx, bool in_ch
 
     tls_clear_error();
 
+    uint8_t fp[SHA256_DIGEST_LENGTH];
+    const bool fp_valid = tls_ctx_fingerprint(options, in_chroot, fp);
+    if (ssl_ctx_cache.stashed)
+    {
+        ssl_ctx_cache.stashed = false;
+        if (fp_valid && ssl_ctx_cache.fp_valid
+            && memcmp(fp, ssl_ctx_cache.fp, sizeof(fp)) == 0)
+        {
+            msg(D_INIT_MEDIUM, "TLS: keys and certificates unchanged, reusing TLS context");
+            *new_ctx = ssl_ctx_cache.ctx;
+            CLEAR(ssl_ctx_cache.ctx);
+            tls_ctx_check_cert_time(new_ctx);
+            init_ssl_crl(options, new_ctx, in_chroot);
+            return;
+        }
+        tls_ctx_free(&ssl_ctx_cache.ctx);
+    }
+    ssl_ctx_cache.fp_valid = false;
+#ifdef ENABLE_CRL_ASYNC
+    /* a reload in progress belongs to the context being replaced */
+    crl_reload_cancel();
+#endif
+
     if (key_is_external(options))
     {
         load_xkey_provider();
@@ -704,6 +1023,12 @@ init_ssl(const struct options *options, struct tls_root_ctx *new_ctx, bool in_ch
         goto err;
     }
 
+    if (options->tls_session_tickets
+        && !tls_ctx_set_session_tickets(new_ctx, options->tls_session_tickets))
+    {
+        goto err;
+    }
+
     if (options->pkcs12_file)
     {
         if (0 != tls_ctx_load_pkcs12(new_ctx, options->pkcs12_file,
@@ -779,27 +1104,7 @@ init_ssl(const struct options *options, struct tls_root_ctx *new_ctx, bool in_ch
     tls_ctx_check_cert_time(new_ctx);
 
     /* Read CRL */
-    if (options->crl_file && !(options->ssl_flags & SSLF_CRL_VERIFY_DIR))
-    {
-        /* If we're running with the chroot option, we may run init_ssl() before
-         * and after chroot-ing. We can use the crl_file path as-is if we're
-         * not going to chroot, or if we already are inside the chroot.
-         *
-         * If we're going to chroot later, we need to prefix the path of the
-         * chroot directory to crl_file.
-         */
-        if (!options->chroot_dir || in_chroot || options->crl_file_inline)
-        {
-            tls_ctx_reload_crl(new_ctx, options->crl_file, options->crl_file_inline);
-        }
-        else
-        {
-            struct gc_arena gc = gc_new();
-            struct buffer crl_file_buf = prepend_dir(options->chroot_dir, options->crl_file, &gc);
-            tls_ctx_reload_crl(new_ctx, BSTR(&crl_file_buf), options->crl_file_inline);
-            gc_free(&gc);
-        }
-    }
+    init_ssl_crl(options, new_ctx, in_chroot);
 
     /* Once keys and cert are loaded, load ECDH parameters */
     if (options->tls_server)
@@ -812,6 +1117,12 @@ init_ssl(const struct options *options, struct tls_root_ctx *new_ctx, bool in_ch
     tls_ctx_personalise_random(new_ctx);
 #endif
 
+    if (fp_valid)
+    {
+        memcpy(ssl_ctx_cache.fp, fp, sizeof(fp));
+        ssl_ctx_cache.fp_valid = true;
+    }
+
     tls_clear_error();
     return;
 
@@ -821,6 +1132,41 @@ err:
     return;
 }
 
+bool
+tls_ctx_reload(const struct options *options, struct tls_root_ctx *ctx,
+               struct tls_root_ctx *old_ctx, bool in_chroot)
+{
+    uint8_t fp[SHA256_DIGEST_LENGTH];
+    if (tls_ctx_fingerprint(options, in_chroot, fp) && ssl_ctx_cache.fp_valid
+        && memcmp(fp, ssl_ctx_cache.fp, sizeof(fp)) == 0)
+    {
+        msg(D_INIT_MEDIUM, "Live reload: keys and certificates unchanged");
+        init_ssl_crl(options, ctx, in_chroot);
+        return true;
+    }
+
+    /* init_ssl() forgets the fingerprint of the running context */
+    memcpy(fp, ssl_ctx_cache.fp, sizeof(fp));
+    const bool fp_valid = ssl_ctx_cache.fp_valid;
+
+    struct tls_root_ctx new_ctx;
+    CLEAR(new_ctx);
+    init_ssl(options, &new_ctx, in_chroot);
+    if (!tls_ctx_initialised(&new_ctx))
+    {
+        memcpy(ssl_ctx_cache.fp, fp, sizeof(fp));
+        ssl_ctx_cache.fp_valid = fp_valid;
+        msg(M_WARN, "Live reload: cannot load the new keys and certificates, "
+            "keeping the current ones");
+        return false;
+    }
+
+    msg(M_INFO, "Live reload: new keys and certificates loaded");
+    *old_ctx = *ctx;
+    *ctx = new_ctx;
+    return true;
+}
+
 /*
  * Map internal constants to ascii names.
  */
@@ -995,11 +1341,15 @@ key_state_init(struct tls_session *session, struct key_state *ks)
     ALLOC_OBJ_CLEAR(ks->lru_acks, struct reliable_ack);
 
     /* allocate buffers */
-    ks->plaintext_read_buf = alloc_buf(TLS_CHANNEL_BUF_SIZE);
-    ks->plaintext_write_buf = alloc_buf(TLS_CHANNEL_BUF_SIZE);
+    if (!tls_channel_buf_pool)
+    {
+        tls_channel_buf_pool = buffer_pool_new(TLS_CHANNEL_BUF_SIZE);
+    }
+    ks->plaintext_read_buf = buffer_pool_get(tls_channel_buf_pool);
+    ks->plaintext_write_buf = buffer_pool_get(tls_channel_buf_pool);
     ks->ack_write_buf = alloc_buf(BUF_SIZE(&session->opt->frame));
     reliable_init(ks->send_reliable, BUF_SIZE(&session->opt->frame),
-                  session->opt->frame.buf.headroom, TLS_RELIABLE_N_SEND_BUFFERS,
+                  session->opt->frame.buf.headroom, session->opt->send_window,
                   ks->key_id ? false : session->opt->xmit_hold);
     reliable_init(ks->rec_reliable, BUF_SIZE(&session->opt->frame),
                   session->opt->frame.buf.headroom, TLS_RELIABLE_N_REC_BUFFERS,
@@ -1024,8 +1374,22 @@ key_state_init(struct tls_session *session, struct key_state *ks)
     if (session->opt->crl_file
         && !(session->opt->ssl_flags & SSLF_CRL_VERIFY_DIR))
     {
+#ifdef ENABLE_CRL_ASYNC
+        if ((session->opt->ssl_flags & SSLF_CRL_VERIFY_ASYNC)
+            && !session->opt->crl_file_inline)
+        {
+            tls_ctx_reload_crl_async(&session->opt->ssl_ctx, session->opt->crl_file);
+        }
+        else
+#endif
         tls_ctx_reload_crl(&session->opt->ssl_ctx,
                            session->opt->crl_file, session->opt->crl_file_inline);
+        if (session->opt->verify_cache)
+        {
+            verify_cache_check_crl(session->opt->verify_cache,
+                                   session->opt->ssl_ctx.crl_last_mtime,
+                                   session->opt->ssl_ctx.crl_last_size);
+        }
     }
 }
 
@@ -1051,8 +1415,12 @@ key_state_free(struct key_state *ks, bool clear)
     key_state_ssl_free(&ks->ks_ssl);
 
     free_key_ctx_bi(&ks->crypto_options.key_ctx_bi);
-    free_buf(&ks->plaintext_read_buf);
-    free_buf(&ks->plaintext_write_buf);
+    free_epoch_key_ctx(&ks->crypto_options);
+    /* the plaintext may contain credentials, wipe it before reuse */
+    buf_clear(&ks->plaintext_read_buf);
+    buf_clear(&ks->plaintext_write_buf);
+    buffer_pool_put(tls_channel_buf_pool, &ks->plaintext_read_buf);
+    buffer_pool_put(tls_channel_buf_pool, &ks->plaintext_write_buf);
     free_buf(&ks->ack_write_buf);
     buffer_list_free(ks->paybuf);
 
@@ -1302,16 +1670,81 @@ lame_duck_must_die(const struct tls_session *session, interval_t *wakeup)
     }
 }
 
+static uint64_t
+connect_timing_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+void
+tls_connect_phase(struct tls_multi *multi, enum connect_phase phase)
+{
+    struct connect_timing *ct = &multi->connect_timing;
+
+    if (ct->done || phase <= ct->phase)
+    {
+        return;
+    }
+
+    const uint64_t t = connect_timing_now();
+    ct->ms[ct->phase] = (uint32_t)(t - ct->mark);
+    ct->phase = phase;
+    ct->mark = t;
+}
+
+void
+tls_connect_phase_done(struct tls_multi *multi)
+{
+    struct connect_timing *ct = &multi->connect_timing;
+    struct connect_phase_stats *st = &connect_phase_stats_global;
+
+    if (ct->done)
+    {
+        return;
+    }
+    ct->ms[ct->phase] = (uint32_t)(connect_timing_now() - ct->mark);
+    ct->done = true;
+
+    struct gc_arena gc = gc_new();
+    struct buffer out = alloc_buf_gc(256, &gc);
+    uint64_t total = 0;
+
+    ++st->count;
+    for (int p = 0; p < CONNECT_PHASE_N; ++p)
+    {
+        int i = 0;
+        while (i < CONNECT_PHASE_BUCKETS - 1 && ct->ms[p] > connect_phase_bucket_bounds[i])
+        {
+            ++i;
+        }
+        ++st->bucket[p][i];
+        st->ms[p] += ct->ms[p];
+        total += ct->ms[p];
+        buf_printf(&out, " %s=%" PRIu32 "ms", connect_phase_names[p], ct->ms[p]);
+    }
+    msg(D_CONNECT_TIMING, "Connect timing:%s total=%" PRIu64 "ms", BSTR(&out), total);
+    gc_free(&gc);
+}
+
 struct tls_multi *
 tls_multi_init(struct tls_options *tls_options)
 {
     struct tls_multi *ret;
 
-    ALLOC_OBJ_CLEAR(ret, struct tls_multi);
+    ret = object_cache_alloc(&tls_multi_cache);
 
     /* get command line derived options */
     ret->opt = *tls_options;
     ret->dco_peer_id = -1;
+    ret->connect_timing.mark = connect_timing_now();
 
     return ret;
 }
@@ -1412,7 +1845,30 @@ tls_multi_free(struct tls_multi *multi, bool clear)
         secure_memzero(multi, sizeof(*multi));
     }
 
-    free(multi);
+    object_cache_free(&tls_multi_cache, multi);
+}
+
+int
+tls_multi_compact(struct tls_multi *multi)
+{
+    int freed = 0;
+
+    for (int i = 0; i < TM_SIZE; ++i)
+    {
+        for (int j = 0; j < KS_SIZE; ++j)
+        {
+            struct key_state *ks = &multi->session[i].key[j];
+            if (ks->send_reliable)
+            {
+                freed += reliable_compact(ks->send_reliable);
+            }
+            if (ks->rec_reliable)
+            {
+                freed += reliable_compact(ks->rec_reliable);
+            }
+        }
+    }
+    return freed;
 }
 
 /*
@@ -1529,6 +1985,12 @@ init_key_contexts(struct key_state *ks,
         CLEAR(key->decrypt);
         key->initialized = true;
     }
+    else if (ks->crypto_options.flags & CO_EPOCH_DATA_KEY_FORMAT)
+    {
+        epoch_init_key_ctx(&ks->crypto_options, key_type,
+                           &key2->keys[(int)server],
+                           &key2->keys[1 - (int)server]);
+    }
     else
     {
         init_key_ctx_bi(key, key2, key_direction, key_type, "Data Channel");
@@ -1716,6 +2178,7 @@ tls_session_generate_data_channel_keys(struct tls_multi *multi,
 
     /* set the state of the keys for the session to generated */
     ks->state = S_GENERATED_KEYS;
+    tls_key_states_changed(multi);
 
     ret = true;
 cleanup:
@@ -1748,6 +2211,19 @@ tls_session_update_crypto_params_do_work(struct tls_multi *multi,
         session->opt->crypto_flags |= CO_PACKET_ID_LONG_FORM;
     }
 
+    /* Epoch data keys are derived from the TLS-EKM key material and only
+     * defined for AEAD ciphers */
+    if (!(session->opt->crypto_flags & CO_USE_TLS_KEY_MATERIAL_EXPORT)
+        || !cipher_kt_mode_aead(session->opt->key_type.cipher))
+    {
+        session->opt->crypto_flags &= ~CO_EPOCH_DATA_KEY_FORMAT;
+    }
+
+    /* The frame calculation takes the packet id format from the options,
+     * which do not have the flag yet if it was negotiated in p2p mode */
+    options->imported_protocol_flags &= ~CO_EPOCH_DATA_KEY_FORMAT;
+    options->imported_protocol_flags |= session->opt->crypto_flags & CO_EPOCH_DATA_KEY_FORMAT;
+
     frame_calculate_dynamic(frame, &session->opt->key_type, options, lsi);
 
     frame_print(frame, D_MTU_INFO, "Data Channel MTU parms");
@@ -1798,6 +2274,179 @@ tls_session_update_crypto_params(struct tls_multi *multi,
                                                     frame, frame_fragment, lsi);
 }
 
+static void
+handoff_pid_export(const struct packet_id *pid, struct packet_id_net *send,
+                   struct packet_id_net *recv)
+{
+    send->id = pid->send.id;
+    send->time = pid->send.time;
+    recv->id = pid->rec.id;
+    recv->time = pid->rec.time;
+}
+
+/* continue the packet ids of another process.  Packets older than the
+ * highest one it received are refused, the replay window of the old
+ * process is not moved. */
+static void
+handoff_pid_import(struct packet_id *pid, const struct packet_id_net *send,
+                   const struct packet_id_net *recv)
+{
+    pid->send.id = send->id;
+    pid->send.time = send->time;
+    pid->rec.id = recv->id;
+    pid->rec.time = recv->time;
+    pid->rec.expired = recv->id;
+}
+
+bool
+tls_session_handoff_export(struct tls_multi *multi, struct tls_handoff_state *hs)
+{
+    struct tls_session *session = &multi->session[TM_ACTIVE];
+    const struct key_state *ks = &session->key[KS_PRIMARY];
+    const struct crypto_options *co = &ks->crypto_options;
+
+    CLEAR(*hs);
+    if (ks->state < S_GENERATED_KEYS || ks->authenticated != KS_AUTH_TRUE
+        || !(co->flags & CO_USE_TLS_KEY_MATERIAL_EXPORT)
+        || session->opt->dco_enabled)
+    {
+        return false;
+    }
+
+    /* the key material is wiped once the key contexts are set up, but the
+     * exporter gives it again as long as the TLS connection exists */
+    if (!generate_key_expansion_tls_export(session, &hs->data_key))
+    {
+        return false;
+    }
+
+    hs->session_id = session->session_id;
+    hs->session_id_remote = ks->session_id_remote;
+    hs->key_id = ks->key_id;
+    hs->crypto_flags = co->flags;
+    hs->established = ks->established;
+    if (co->flags & CO_EPOCH_DATA_KEY_FORMAT)
+    {
+        hs->send_epoch = co->key_ctx_bi.encrypt.epoch;
+        hs->recv_epoch = co->key_ctx_bi.decrypt.epoch;
+    }
+    handoff_pid_export(&co->packet_id, &hs->send_pid, &hs->recv_pid);
+
+    if (session->tls_wrap.cleanup_key_ctx)
+    {
+        hs->wrap_client_key = session->tls_wrap.original_wrap_keydata;
+    }
+    handoff_pid_export(&session->tls_wrap.opt.packet_id,
+                       &hs->wrap_send_pid, &hs->wrap_recv_pid);
+
+    if (session->tls_wrap_reneg.mode == TLS_WRAP_CRYPT)
+    {
+        hs->reneg_key = session->tls_wrap_reneg.original_wrap_keydata;
+        handoff_pid_export(&session->tls_wrap_reneg.opt.packet_id,
+                           &hs->reneg_send_pid, &hs->reneg_recv_pid);
+    }
+    return true;
+}
+
+bool
+tls_session_handoff_import(struct tls_multi *multi,
+                           const struct tls_handoff_state *hs,
+                           const struct link_socket_actual *remote,
+                           struct options *options,
+                           struct frame *frame,
+                           struct frame *frame_fragment,
+                           struct link_socket_info *lsi)
+{
+    struct tls_session *session = &multi->session[TM_ACTIVE];
+    struct key_state *ks = &session->key[KS_PRIMARY];
+
+    if (hs->data_key.n != 2)
+    {
+        return false;
+    }
+
+    session->session_id = hs->session_id;
+    ks->session_id_remote = hs->session_id_remote;
+    ks->remote_addr = *remote;
+    ks->key_id = hs->key_id;
+    ks->crypto_options.packet_id.rec.unit = hs->key_id;
+    /* the next renegotiation continues with the following key id, see
+     * key_state_init() */
+    session->key_id = (hs->key_id + 1) & P_KEY_ID_MASK;
+    if (!session->key_id)
+    {
+        session->key_id = 1;
+    }
+
+    if (hs->wrap_client_key.n == 2)
+    {
+        session->tls_wrap.original_wrap_keydata = hs->wrap_client_key;
+        tls_crypt_v2_use_client_key(&session->tls_wrap);
+    }
+    handoff_pid_import(&session->tls_wrap.opt.packet_id,
+                       &hs->wrap_send_pid, &hs->wrap_recv_pid);
+
+    session->opt->crypto_flags = hs->crypto_flags;
+    options->imported_protocol_flags = hs->crypto_flags
+                                       & (CO_USE_TLS_KEY_MATERIAL_EXPORT
+                                          | CO_USE_CC_EXIT_NOTIFY
+                                          | CO_USE_DYNAMIC_TLS_CRYPT
+                                          | CO_EPOCH_DATA_KEY_FORMAT);
+
+    init_key_type(&session->opt->key_type, options->ciphername,
+                  options->authname, true, true);
+    frame_calculate_dynamic(frame, &session->opt->key_type, options, lsi);
+    if (frame_fragment)
+    {
+        frame_calculate_dynamic(frame_fragment, &session->opt->key_type,
+                                options, lsi);
+    }
+
+    if (hs->reneg_key.n == 2)
+    {
+        tls_session_load_dynamic_tls_crypt_key(session, &hs->reneg_key);
+        handoff_pid_import(&session->tls_wrap_reneg.opt.packet_id,
+                           &hs->reneg_send_pid, &hs->reneg_recv_pid);
+    }
+
+    struct key2 key2 = hs->data_key;
+    for (int i = 0; i < 2; ++i)
+    {
+        if (!check_key(&key2.keys[i], &session->opt->key_type))
+        {
+            msg(D_TLS_ERRORS, "TLS Error: Bad handed off key");
+            secure_memzero(&key2, sizeof(key2));
+            return false;
+        }
+    }
+
+    ks->crypto_options.flags = session->opt->crypto_flags;
+    init_key_contexts(ks, multi, &session->opt->key_type, true, &key2, false);
+    secure_memzero(&key2, sizeof(key2));
+
+    if (ks->crypto_options.flags & CO_EPOCH_DATA_KEY_FORMAT)
+    {
+        epoch_advance_keys(&ks->crypto_options, hs->send_epoch,
+                           hs->recv_epoch);
+    }
+    handoff_pid_import(&ks->crypto_options.packet_id, &hs->send_pid,
+                       &hs->recv_pid);
+    tls_limit_reneg_bytes(session->opt->key_type.cipher,
+                          &session->opt->renegotiate_bytes);
+
+    /* the TLS connection stays with the old process, so the control
+     * channel of this key can only carry acks until the next
+     * renegotiation */
+    ks->established = hs->established;
+    ks->peer_last_packet = now;
+    ks->authenticated = KS_AUTH_TRUE;
+    ks->state = S_GENERATED_KEYS;
+    multi->n_sessions++;
+    tls_key_states_changed(multi);
+
+    return true;
+}
+
 
 static bool
 random_bytes_to_buf(struct buffer *buf,
@@ -1911,12 +2560,15 @@ key_state_soft_reset(struct tls_session *session)
     key_state_init(session, ks);
     ks->session_id_remote = ks_lame->session_id_remote;
     ks->remote_addr = ks_lame->remote_addr;
+
+    OVPN_PROBE3(key_soft_reset, ks->key_id, now - ks_lame->established, ks_lame->n_bytes);
 }
 
 void
 tls_session_soft_reset(struct tls_multi *tls_multi)
 {
     key_state_soft_reset(&tls_multi->session[TM_ACTIVE]);
+    tls_key_states_changed(tls_multi);
 }
 
 /*
@@ -2065,8 +2717,23 @@ push_peer_info(struct buffer *buf, struct tls_session *session)
             /* support for AUTH_FAIL,TEMP control message */
             iv_proto |= IV_PROTO_AUTH_FAIL_TEMP;
 
+            /* support for PUSH_UPDATE control messages */
+            iv_proto |= IV_PROTO_PUSH_UPDATE;
+
+            /* data packets over several paths */
+            if (session->opt->multipath)
+            {
+                iv_proto |= IV_PROTO_MULTIPATH;
+            }
+
             /* support for tun-mtu as part of the push message */
             buf_printf(&out, "IV_MTU=%d\n", session->opt->frame.tun_max_mtu);
+
+            /* support for a pushed --fec */
+            if (!session->opt->dco_enabled)
+            {
+                buf_printf(&out, "IV_FEC=1\n");
+            }
         }
 
         /* support for Negotiable Crypto Parameters */
@@ -2087,9 +2754,19 @@ push_peer_info(struct buffer *buf, struct tls_session *session)
 
         buf_printf(&out, "IV_CIPHERS=%s\n", session->opt->config_ncp_ciphers);
 
+        /* lets the server prefer a cipher that is fast without AES
+         * instructions, see --data-ciphers-hw-aware */
+        buf_printf(&out, "IV_AES_HW=%d\n", crypto_aes_hw_accel() ? 1 : 0);
+
 #ifdef HAVE_EXPORT_KEYING_MATERIAL
         iv_proto |= IV_PROTO_TLS_KEY_EXPORT;
         iv_proto |= IV_PROTO_DYN_TLS_CRYPT;
+
+        /* DCO does not know about epoch data keys */
+        if (!session->opt->dco_enabled)
+        {
+            iv_proto |= IV_PROTO_DATA_EPOCH;
+        }
 #endif
 
         buf_printf(&out, "IV_PROTO=%d\n", iv_proto);
@@ -2340,6 +3017,11 @@ key_method_2_read(struct buffer *buf, struct tls_multi *multi, struct tls_sessio
     /* allocate temporary objects */
     ALLOC_ARRAY_CLEAR_GC(options, char, TLS_OPTIONS_LEN, &gc);
 
+    if (session->opt->server)
+    {
+        tls_connect_phase(multi, CONNECT_PHASE_AUTH);
+    }
+
     /* discard leading uint32 */
     if (!buf_advance(buf, 4))
     {
@@ -2430,6 +3112,11 @@ key_method_2_read(struct buffer *buf, struct tls_multi *multi, struct tls_sessio
         ks->authenticated = KS_AUTH_TRUE;
     }
 
+    if (session->opt->server)
+    {
+        tls_connect_phase(multi, CONNECT_PHASE_KEY_EXCHANGE);
+    }
+
     /* clear username and password from memory */
     secure_memzero(up, sizeof(*up));
 
@@ -2581,6 +3268,22 @@ session_move_active(struct tls_multi *multi, struct tls_session *session,
     dmsg(D_TLS_DEBUG_MED, "STATE S_ACTIVE");
 
     ks->established = now;
+
+    const time_t duration = ks->established - ks->initial;
+    int i = 0;
+    while (i < TLS_HANDSHAKE_BUCKETS - 1 && duration > tls_handshake_bucket_bounds[i])
+    {
+        ++i;
+    }
+    ++tls_handshake_stats_global.bucket[i];
+    ++tls_handshake_stats_global.success;
+    tls_handshake_stats_global.seconds += duration;
+
+    if (session->opt->server)
+    {
+        tls_connect_phase(multi, CONNECT_PHASE_DEFERRED_AUTH);
+    }
+
     if (check_debug_level(D_HANDSHAKE))
     {
         print_details(&ks->ks_ssl, "Control Channel:");
@@ -2692,6 +3395,48 @@ error:
  * Read incoming ciphertext and passes it to the buffer of the SSL library.
  * Returns false if an error is encountered that should abort the session.
  */
+/*
+ * Follow the TLS record framing of the incoming ciphertext in buf, to
+ * know whether the peer is still in the middle of sending a record.
+ */
+static void
+track_incoming_tls_records(struct key_state *ks, const struct buffer *buf)
+{
+    const uint8_t *p = BPTR(buf);
+    int len = BLEN(buf);
+
+    while (len > 0)
+    {
+        if (ks->tls_rec_hdr < TLS_RECORD_HEADER_SIZE)
+        {
+            /* the body length is in the last two bytes of the header */
+            if (ks->tls_rec_hdr == TLS_RECORD_HEADER_SIZE - 2)
+            {
+                ks->tls_rec_left = *p << 8;
+            }
+            else if (ks->tls_rec_hdr == TLS_RECORD_HEADER_SIZE - 1)
+            {
+                ks->tls_rec_left |= *p;
+            }
+            ++ks->tls_rec_hdr;
+            ++p;
+            --len;
+        }
+        else
+        {
+            const int n = min_int(len, ks->tls_rec_left);
+            ks->tls_rec_left -= n;
+            p += n;
+            len -= n;
+        }
+
+        if (ks->tls_rec_hdr == TLS_RECORD_HEADER_SIZE && !ks->tls_rec_left)
+        {
+            ks->tls_rec_hdr = 0;
+        }
+    }
+}
+
 static bool
 read_incoming_tls_ciphertext(struct buffer *buf, struct key_state *ks,
                              bool *state_change)
@@ -2713,6 +3458,7 @@ read_incoming_tls_ciphertext(struct buffer *buf, struct key_state *ks,
     }
     if (status == 1)
     {
+        track_incoming_tls_records(ks, buf);
         reliable_mark_deleted(ks->rec_reliable, buf);
         *state_change = true;
         dmsg(D_TLS_DEBUG, "Incoming Ciphertext -> TLS");
@@ -2727,6 +3473,31 @@ control_packet_needs_wkc(const struct key_state *ks)
            && (ks->send_reliable->packet_id == 1);
 }
 
+/*
+ * Can the ACKs for the packets received so far wait for the next ones?
+ * That is the case while the peer is sending a TLS record that spans
+ * several packets, the rest of which follows right away: the ACKs can
+ * then go out together, or with our reply once the record is complete.
+ * Losses are acknowledged immediately, and nothing waits for more than
+ * CONTROL_ACK_DEFER_MAX packets or a second, which is below the
+ * retransmit timeout of the peer.
+ */
+static bool
+control_ack_can_wait(struct key_state *ks)
+{
+    if (!ks->tls_rec_hdr
+        || reliable_ack_outstanding(ks->rec_ack) >= CONTROL_ACK_DEFER_MAX
+        || !reliable_empty(ks->rec_reliable))
+    {
+        return false;
+    }
+    if (!ks->ack_deadline)
+    {
+        ks->ack_deadline = now + 1;
+    }
+    return now < ks->ack_deadline;
+}
+
 
 static bool
 read_incoming_tls_plaintext(struct key_state *ks, struct buffer *buf,
@@ -2771,71 +3542,57 @@ write_outgoing_tls_ciphertext(struct tls_session *session, bool *state_change)
     /* Subtract overhead */
     max_pkt_len -= calc_control_channel_frame_overhead(session);
 
-    /* calculate total available length for outgoing tls ciphertext */
-    int maxlen = max_pkt_len * rel_avail;
-
-    /* Is first packet one that will have a WKC appended? */
-    if (control_packet_needs_wkc(ks))
+    /* Read the TLS ciphertext (TLS records) directly into the reliable
+     * buffers, in chunks that respect tls_mtu, until the TLS library has
+     * nothing more to send or we run out of reliable buffers */
+    for (int i = 0; i < rel_avail; i++)
     {
-        maxlen -= buf_len(session->tls_wrap.tls_crypt_v2_wkc);
-    }
+        int len = max_pkt_len;
+        int opcode = P_CONTROL_V1;
+        if (control_packet_needs_wkc(ks))
+        {
+            opcode = P_CONTROL_WKC_V1;
+            len -= buf_len(session->tls_wrap.tls_crypt_v2_wkc);
+        }
 
-    /* If we end up with a size that leaves no room for payload, ignore the
-     * constraints to still be to send a packet. This might have gone negative
-     * if we have a large wrapped client key. */
-    if (maxlen < 16)
-    {
-        msg(D_TLS_ERRORS, "Warning: --max-packet-size (%d) setting too low. "
-            "Sending minimum sized packet.",
-            session->opt->frame.tun_mtu);
-        maxlen = 16;
-        /* We set the maximum length here to ensure a packet with a wrapped
-         * key can actually carry the 16 byte of payload */
-        max_pkt_len = TLS_CHANNEL_BUF_SIZE;
-    }
+        /* If we end up with a size that leaves no room for payload, ignore
+         * the constraints to still be able to send a packet. This might have
+         * gone negative if we have a large wrapped client key. */
+        if (len < 16)
+        {
+            msg(D_TLS_ERRORS, "Warning: --max-packet-size (%d) setting too low. "
+                "Sending minimum sized packet.",
+                session->opt->frame.tun_mtu);
+            len = 16;
+        }
 
-    /* This seems a bit wasteful to allocate every time */
-    struct gc_arena gc = gc_new();
-    struct buffer tmp = alloc_buf_gc(maxlen, &gc);
+        struct buffer *buf = reliable_get_buf_output_sequenced(ks->send_reliable);
+        /* we assert here since we checked for its availability before */
+        ASSERT(buf);
 
-    int status = key_state_read_ciphertext(&ks->ks_ssl, &tmp);
+        struct buffer payload = buf_sub(buf, len, false);
+        ASSERT(buf_defined(&payload));
 
-    if (status == -1)
-    {
-        msg(D_TLS_ERRORS,
-            "TLS Error: Ciphertext -> reliable TCP/UDP transport read error");
-        gc_free(&gc);
-        return false;
-    }
-    if (status == 1)
-    {
-        /* Split the TLS ciphertext (TLS record) into multiple small packets
-         * that respect tls_mtu */
-        while (tmp.len > 0)
+        int status = key_state_read_ciphertext(&ks->ks_ssl, &payload);
+        if (status == -1)
         {
-            int len = max_pkt_len;
-            int opcode = P_CONTROL_V1;
-            if (control_packet_needs_wkc(ks))
-            {
-                opcode = P_CONTROL_WKC_V1;
-                len = max_int(0, len - buf_len(session->tls_wrap.tls_crypt_v2_wkc));
-            }
-            /* do not send more than available */
-            len = min_int(len, tmp.len);
-
-            struct buffer *buf = reliable_get_buf_output_sequenced(ks->send_reliable);
-            /* we assert here since we checked for its availability before */
-            ASSERT(buf);
-            buf_copy_n(buf, &tmp, len);
-
-            reliable_mark_active_outgoing(ks->send_reliable, buf, opcode);
-            INCR_GENERATED;
-            *state_change = true;
+            msg(D_TLS_ERRORS,
+                "TLS Error: Ciphertext -> reliable TCP/UDP transport read error");
+            return false;
+        }
+        if (status == 0)
+        {
+            /* nothing to send, the reliable buffer stays unused */
+            break;
         }
+
+        buf->len = BLEN(&payload);
+        reliable_mark_active_outgoing(ks->send_reliable, buf, opcode);
+        INCR_GENERATED;
+        *state_change = true;
         dmsg(D_TLS_DEBUG, "Outgoing Ciphertext -> Reliable");
     }
 
-    gc_free(&gc);
     return true;
 }
 
@@ -3005,10 +3762,34 @@ error:
     tls_clear_error();
     ks->state = S_ERROR;
     msg(D_TLS_ERRORS, "TLS Error: TLS handshake failed");
+    ++tls_handshake_stats_global.error;
     INCR_ERROR;
     return false;
 
 }
+/*
+ * Returns true if the primary key has to be renegotiated because of
+ * --reneg-sec.  With --reneg-freq the renegotiation is postponed by
+ * a second at a time while too many others were started recently.
+ */
+static bool
+renegotiate_seconds_reached(struct tls_session *session,
+                            const struct key_state *ks)
+{
+    if (!session->opt->renegotiate_seconds
+        || now < ks->established + session->opt->renegotiate_seconds)
+    {
+        return false;
+    }
+    if (session->opt->reneg_limiter
+        && !frequency_limit_event_allowed(session->opt->reneg_limiter))
+    {
+        dmsg(D_TLS_DEBUG, "TLS: renegotiation postponed by --reneg-freq");
+        return false;
+    }
+    return true;
+}
+
 /*
  * This is the primary routine for processing TLS stuff inside the
  * the main event loop.  When this routine exits
@@ -3036,13 +3817,13 @@ tls_process(struct tls_multi *multi,
 
     /* Should we trigger a soft reset? -- new key, keeps old key for a while */
     if (ks->state >= S_GENERATED_KEYS
-        && ((session->opt->renegotiate_seconds
-             && now >= ks->established + session->opt->renegotiate_seconds)
+        && (renegotiate_seconds_reached(session, ks)
             || (session->opt->renegotiate_bytes > 0
                 && ks->n_bytes >= session->opt->renegotiate_bytes)
             || (session->opt->renegotiate_packets
                 && ks->n_packets >= session->opt->renegotiate_packets)
-            || (packet_id_close_to_wrapping(&ks->crypto_options.packet_id.send))))
+            || packet_id_close_to_wrapping(&ks->crypto_options.packet_id.send)
+            || epoch_close_to_wrapping(&ks->crypto_options)))
     {
         msg(D_TLS_DEBUG_LOW, "TLS: soft reset sec=%d/%d bytes=" counter_format
             "/%d pkts=" counter_format "/%d",
@@ -3070,8 +3851,13 @@ tls_process(struct tls_multi *multi,
              state_name(ks_lame->state),
              to_link->len,
              *wakeup);
+        const int old_state = ks->state;
         state_change = tls_process_state(multi, session, to_link, to_link_addr,
                                          to_link_socket_info, wakeup);
+        if (ks->state != old_state)
+        {
+            OVPN_PROBE4(tls_state, multi->peer_id, ks->key_id, old_state, ks->state);
+        }
 
         if (ks->state == S_ERROR)
         {
@@ -3088,10 +3874,21 @@ tls_process(struct tls_multi *multi,
      * gets resent if not received by remote, so instead we use an empty
      * control packet in this special case */
 
+    if (reliable_ack_empty(ks->rec_ack))
+    {
+        ks->ack_deadline = 0;
+    }
+
     /* Send 1 or more ACKs (each received control packet gets one ACK) */
     if (!to_link->len && !reliable_ack_empty(ks->rec_ack))
     {
-        if (control_packet_needs_wkc(ks))
+        if (control_ack_can_wait(ks))
+        {
+            dmsg(D_TLS_DEBUG, "TLS: deferring %d ACKs",
+                 reliable_ack_outstanding(ks->rec_ack));
+            compute_earliest_wakeup(wakeup, ks->ack_deadline - now);
+        }
+        else if (control_packet_needs_wkc(ks))
         {
             struct buffer *buf = reliable_get_buf_output_sequenced(ks->send_reliable);
             if (!buf)
@@ -3111,6 +3908,7 @@ tls_process(struct tls_multi *multi,
             write_control_auth(session, ks, &buf, to_link_addr, P_ACK_V1,
                                RELIABLE_ACK_SIZE, false);
             *to_link = buf;
+            ks->ack_deadline = 0;
             dmsg(D_TLS_DEBUG, "Dedicated ACK -> TCP/UDP");
         }
     }
@@ -3129,8 +3927,10 @@ tls_process(struct tls_multi *multi,
 
     if (ks->established && session->opt->renegotiate_seconds)
     {
+        /* at least a second if the renegotiation was postponed */
         compute_earliest_wakeup(wakeup,
-                                ks->established + session->opt->renegotiate_seconds - now);
+                                max_int(ks->established
+                                        + session->opt->renegotiate_seconds - now, 1));
     }
 
     dmsg(D_TLS_DEBUG, "TLS: tls_process: timeout set to %d", *wakeup);
@@ -3368,6 +4168,8 @@ nohard:
     }
 #endif
 
+    tls_key_states_changed(multi);
+
     perf_pop();
     gc_free(&gc);
 
@@ -3383,8 +4185,6 @@ print_key_id_not_found_reason(struct tls_multi *multi,
                               const struct link_socket_actual *from, int key_id)
 {
     struct gc_arena gc = gc_new();
-    const char *source = print_link_socket_actual(from, &gc);
-
 
     for (int i = 0; i < KEY_SCAN_SIZE; ++i)
     {
@@ -3400,7 +4200,7 @@ print_key_id_not_found_reason(struct tls_multi *multi,
         {
             msg(D_MULTI_DROPPED,
                 "Key %s [%d] not initialized (yet), dropping packet.",
-                source, key_id);
+                print_link_socket_actual(from, &gc), key_id);
             gc_free(&gc);
             return;
         }
@@ -3408,7 +4208,7 @@ print_key_id_not_found_reason(struct tls_multi *multi,
         {
             msg(D_MULTI_DROPPED,
                 "Key %s [%d] not authorized%s, dropping packet.",
-                source, key_id,
+                print_link_socket_actual(from, &gc), key_id,
                 (ks->authenticated == KS_AUTH_DEFERRED) ? " (deferred)" : "");
             gc_free(&gc);
             return;
@@ -3418,11 +4218,80 @@ print_key_id_not_found_reason(struct tls_multi *multi,
     msg(D_TLS_ERRORS,
         "TLS Error: local/remote TLS keys are out of sync: %s "
         "(received key id: %d, known key ids: %s)",
-        source, key_id,
+        print_link_socket_actual(from, &gc), key_id,
         print_key_id(multi, &gc));
     gc_free(&gc);
 }
 
+/**
+ * Drop the cached key selection if a key_state changed since it was
+ * made.
+ */
+static void
+tls_key_cache_validate(struct tls_multi *multi)
+{
+    if (multi->key_cache_gen != multi->key_state_gen)
+    {
+        multi->key_cache_gen = multi->key_state_gen;
+        multi->send_ks = NULL;
+        multi->send_ks_recheck = 0;
+        CLEAR(multi->recv_ks);
+    }
+}
+
+static inline bool
+key_state_usable(const struct key_state *ks)
+{
+    return ks->state >= S_GENERATED_KEYS && ks->authenticated == KS_AUTH_TRUE;
+}
+
+/*
+ * This is the basic test of TLS state compatibility between a local OpenVPN
+ * instance and its remote peer.
+ *
+ * If the test fails, it tells us that we are getting a packet from a source
+ * which claims reference to a prior negotiated TLS session, but the local
+ * OpenVPN instance has no memory of such a negotiation.
+ *
+ * It almost always occurs on UDP sessions when the passive side of the
+ * connection is restarted without the active side restarting as well (the
+ * passive side is the server which only listens for the connections, the
+ * active side is the client which initiates connections).
+ */
+static struct key_state *
+find_decryption_key(struct tls_multi *multi,
+                    const struct link_socket_actual *from, int key_id)
+{
+    for (int i = 0; i < KEY_SCAN_SIZE; ++i)
+    {
+        struct key_state *ks = get_key_scan(multi, i);
+        if (key_id == ks->key_id && key_state_usable(ks)
+            && (!from || link_socket_actual_match(from, &ks->remote_addr)))
+        {
+            return ks;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Return the first key_state in scan order that can decrypt packets
+ * with \c key_id, from a table kept per key id.
+ */
+static inline struct key_state *
+tls_select_decryption_key(struct tls_multi *multi, int key_id)
+{
+    tls_key_cache_validate(multi);
+
+    struct key_state *ks = multi->recv_ks[key_id];
+    if (!ks || ks->key_id != key_id || !key_state_usable(ks))
+    {
+        ks = find_decryption_key(multi, NULL, key_id);
+        multi->recv_ks[key_id] = ks;
+    }
+    return ks;
+}
+
 /**
  * Check the keyid of the an incoming data channel packet and
  * return the matching crypto parameters in \c opt if found.
@@ -3444,61 +4313,48 @@ handle_data_channel_packet(struct tls_multi *multi,
     int op = c >> P_OPCODE_SHIFT;
     int key_id = c & P_KEY_ID_MASK;
 
-    for (int i = 0; i < KEY_SCAN_SIZE; ++i)
+    struct key_state *ks = tls_select_decryption_key(multi, key_id);
+    if (ks && !floated && !link_socket_actual_match(from, &ks->remote_addr))
     {
-        struct key_state *ks = get_key_scan(multi, i);
+        ks = find_decryption_key(multi, from, key_id);
+    }
 
-        /*
-         * This is the basic test of TLS state compatibility between a local OpenVPN
-         * instance and its remote peer.
-         *
-         * If the test fails, it tells us that we are getting a packet from a source
-         * which claims reference to a prior negotiated TLS session, but the local
-         * OpenVPN instance has no memory of such a negotiation.
-         *
-         * It almost always occurs on UDP sessions when the passive side of the
-         * connection is restarted without the active side restarting as well (the
-         * passive side is the server which only listens for the connections, the
-         * active side is the client which initiates connections).
-         */
-        if (ks->state >= S_GENERATED_KEYS && key_id == ks->key_id
-            && ks->authenticated == KS_AUTH_TRUE
-            && (floated || link_socket_actual_match(from, &ks->remote_addr)))
+    if (ks)
+    {
+        ASSERT(ks->crypto_options.key_ctx_bi.initialized);
+        /* return appropriate data channel decrypt key in opt */
+        *opt = &ks->crypto_options;
+        if (op == P_DATA_V2)
         {
-            ASSERT(ks->crypto_options.key_ctx_bi.initialized);
-            /* return appropriate data channel decrypt key in opt */
-            *opt = &ks->crypto_options;
-            if (op == P_DATA_V2)
-            {
-                *ad_start = BPTR(buf);
-            }
-            ASSERT(buf_advance(buf, 1));
-            if (op == P_DATA_V1)
-            {
-                *ad_start = BPTR(buf);
-            }
-            else if (op == P_DATA_V2)
+            *ad_start = BPTR(buf);
+        }
+        ASSERT(buf_advance(buf, 1));
+        if (op == P_DATA_V1)
+        {
+            *ad_start = BPTR(buf);
+        }
+        else if (op == P_DATA_V2)
+        {
+            if (buf->len < 4)
             {
-                if (buf->len < 4)
-                {
-                    msg(D_TLS_ERRORS, "Protocol error: received P_DATA_V2 from %s but length is < 4",
-                        print_link_socket_actual(from, &gc));
-                    ++multi->n_soft_errors;
-                    goto done;
-                }
-                ASSERT(buf_advance(buf, 3));
+                msg(D_TLS_ERRORS, "Protocol error: received P_DATA_V2 from %s but length is < 4",
+                    print_link_socket_actual(from, &gc));
+                ++multi->n_soft_errors;
+                goto done;
             }
-
-            ++ks->n_packets;
-            ks->n_bytes += buf->len;
-            dmsg(D_TLS_KEYSELECT,
-                 "TLS: tls_pre_decrypt, key_id=%d, IP=%s",
-                 key_id, print_link_socket_actual(from, &gc));
-            gc_free(&gc);
-            return;
+            ASSERT(buf_advance(buf, 3));
         }
+
+        ++ks->n_packets;
+        ks->n_bytes += buf->len;
+        dmsg(D_TLS_KEYSELECT,
+             "TLS: tls_pre_decrypt, key_id=%d, IP=%s",
+             key_id, print_link_socket_actual(from, &gc));
+        gc_free(&gc);
+        return;
     }
 
+    ++tls_key_id_errors_global;
     print_key_id_not_found_reason(multi, from, key_id);
 
 done:
@@ -3886,6 +4742,8 @@ tls_pre_decrypt(struct tls_multi *multi,
     ks->peer_last_packet = now;
 
 done:
+    /* control packets may move sessions and change key states */
+    tls_key_states_changed(multi);
     buf->len = 0;
     *opt = NULL;
     gc_free(&gc);
@@ -3901,11 +4759,24 @@ error:
 struct key_state *
 tls_select_encryption_key(struct tls_multi *multi)
 {
-    struct key_state *ks_select = NULL;
+    tls_key_cache_validate(multi);
+
+    struct key_state *ks_select = multi->send_ks;
+    if (ks_select && key_state_usable(ks_select)
+        && (!multi->send_ks_recheck || now < multi->send_ks_recheck))
+    {
+        return ks_select;
+    }
+
+    /* A key that is still within its deferred auth window is only used
+     * if no other key is available.  The selection changes when the
+     * first of these windows ends. */
+    time_t recheck = 0;
+    ks_select = NULL;
     for (int i = 0; i < KEY_SCAN_SIZE; ++i)
     {
         struct key_state *ks = get_key_scan(multi, i);
-        if (ks->state >= S_GENERATED_KEYS && ks->authenticated == KS_AUTH_TRUE)
+        if (key_state_usable(ks))
         {
             ASSERT(ks->crypto_options.key_ctx_bi.initialized);
 
@@ -3918,8 +4789,15 @@ tls_select_encryption_key(struct tls_multi *multi)
                 ks_select = ks;
                 break;
             }
+            if (!recheck || ks->auth_deferred_expire < recheck)
+            {
+                recheck = ks->auth_deferred_expire;
+            }
         }
     }
+
+    multi->send_ks = ks_select;
+    multi->send_ks_recheck = recheck;
     return ks_select;
 }
 
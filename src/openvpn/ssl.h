@@ -54,6 +54,16 @@
  */
 #define CONTROL_SEND_ACK_MAX 4
 
+/*
+ * While the peer is in the middle of sending a TLS record, a dedicated
+ * P_ACK_V1 is held back until this many packets are to be acknowledged,
+ * so that the ACKs go out together, or with our reply to the record.
+ */
+#define CONTROL_ACK_DEFER_MAX 2
+
+/* content type, version and length of a TLS record */
+#define TLS_RECORD_HEADER_SIZE 5
+
 /*
  * Various timeouts
  */
@@ -107,6 +117,19 @@
 /** Support to dynamic tls-crypt (renegotiation with TLS-EKM derived tls-crypt key) */
 #define IV_PROTO_DYN_TLS_CRYPT   (1<<9)
 
+/** Support for epoch data keys with the 64-bit epoch packet id format.
+ * The data packets put the AEAD tag in front of the ciphertext and use
+ * packet id + implicit IV as IV, which is not the epoch format of other
+ * OpenVPN versions, so this uses a bit far away from the ones allocated
+ * upstream (where 1<<10 means their epoch format) */
+#define IV_PROTO_DATA_EPOCH      (1<<24)
+
+/** Sends data packets over several paths, see --multipath */
+#define IV_PROTO_MULTIPATH       (1<<11)
+
+/** Support for PUSH_UPDATE messages, see the push-update management command */
+#define IV_PROTO_PUSH_UPDATE     (1<<12)
+
 /* Default field in X509 to be username */
 #define X509_USERNAME_FIELD_DEFAULT "CN"
 
@@ -136,12 +159,95 @@ void free_ssl_lib(void);
  */
 void init_ssl(const struct options *options, struct tls_root_ctx *ctx, bool in_chroot);
 
+/**
+ * Take \c ctx over for the next init_ssl(), which reuses it if the
+ * options and files the context was built from are unchanged.  Used over
+ * a SIGHUP; \c ctx is cleared.
+ */
+void tls_ctx_stash(struct tls_root_ctx *ctx);
+
+/**
+ * Build a new TLS context for a live reload if the options and files
+ * \c ctx was built from changed, or else only reload the CRL.
+ *
+ * @param options   The options after the reload
+ * @param ctx       The running context, replaced by the new one
+ * @param old_ctx   Receives the replaced context, which is still used by
+ *                  the sessions created from it.  Left uninitialised if
+ *                  \c ctx did not change.
+ * @param in_chroot Whether we are running inside the chroot
+ *
+ * @return false if the new context could not be built
+ */
+bool tls_ctx_reload(const struct options *options, struct tls_root_ctx *ctx,
+                    struct tls_root_ctx *old_ctx, bool in_chroot);
+
 /** @addtogroup control_processor
  *  @{ */
 
 /** @name Functions for initialization and cleanup of tls_multi structures
  *  @{ */
 
+/** Freed \c tls_multi structures kept for reuse by \c tls_multi_init(). */
+extern struct object_cache tls_multi_cache;
+
+/** Number of buckets of the TLS handshake duration histogram, the last
+ *  one counts the handshakes that took longer than all the bounds. */
+#define TLS_HANDSHAKE_BUCKETS 7
+
+/** Upper bounds in seconds of the finite histogram buckets. */
+extern const int tls_handshake_bucket_bounds[TLS_HANDSHAKE_BUCKETS - 1];
+
+/** Process wide counters of TLS handshakes and their outcome. */
+struct tls_handshake_stats
+{
+    counter_type success;   /**< handshakes that reached S_ACTIVE */
+    counter_type error;     /**< handshakes that failed or timed out */
+    counter_type seconds;   /**< sum of the durations of the successful ones */
+    counter_type bucket[TLS_HANDSHAKE_BUCKETS]; /**< per duration, not cumulative */
+};
+
+extern struct tls_handshake_stats tls_handshake_stats_global;
+
+/** Number of buckets of the connect phase duration histograms, the last
+ *  one counts the phases that took longer than all the bounds. */
+#define CONNECT_PHASE_BUCKETS 7
+
+/** Upper bounds in milliseconds of the finite histogram buckets. */
+extern const int connect_phase_bucket_bounds[CONNECT_PHASE_BUCKETS - 1];
+
+/** Names of the connect phases, as used in logs and metrics. */
+extern const char *const connect_phase_names[CONNECT_PHASE_N];
+
+/** Process wide durations of the phases of finished client connects. */
+struct connect_phase_stats
+{
+    counter_type count;                     /**< finished connects */
+    counter_type ms[CONNECT_PHASE_N];       /**< sum of the durations */
+    counter_type bucket[CONNECT_PHASE_N][CONNECT_PHASE_BUCKETS]; /**< not cumulative */
+};
+
+extern struct connect_phase_stats connect_phase_stats_global;
+
+/**
+ * Moves the initial connection of a client on a server to the next
+ * phase, and accounts the time since the last call to the current one.
+ * Phases that are skipped keep a duration of zero.  Does nothing once
+ * the connection is complete, or if \c phase is not after the current
+ * one.
+ */
+void tls_connect_phase(struct tls_multi *multi, enum connect_phase phase);
+
+/**
+ * Ends the timing of the initial connection of a client when the push
+ * reply has been sent: logs the duration of each phase and adds them to
+ * \c connect_phase_stats_global.
+ */
+void tls_connect_phase_done(struct tls_multi *multi);
+
+/** Data channel packets dropped because no key with their key-id exists. */
+extern counter_type tls_key_id_errors_global;
+
 /**
  * Allocate and initialize a \c tls_multi structure.
  * @ingroup control_processor
@@ -215,6 +321,18 @@ void tls_multi_init_set_options(struct tls_multi *multi,
  */
 void tls_multi_free(struct tls_multi *multi, bool clear);
 
+/**
+ * Free the packet buffers of the reliability layer windows of all key
+ * states that are not holding a control channel packet.  They are
+ * allocated again when the next control channel packet is sent or
+ * received.
+ *
+ * @param multi        - The \c tls_multi structure to compact.
+ *
+ * @return The number of bytes freed.
+ */
+int tls_multi_compact(struct tls_multi *multi);
+
 /** @} name Functions for initialization and cleanup of tls_multi structures */
 
 /** @} addtogroup control_processor */
@@ -466,6 +584,73 @@ bool tls_session_update_crypto_params(struct tls_multi *multi,
                                       struct frame *frame_fragment,
                                       struct link_socket_info *lsi);
 
+/**
+ * The data channel and control channel wrapping state of the active key
+ * of a server session, as moved to another process by --handoff.  The TLS
+ * connection of the key cannot be moved; the next renegotiation starts a
+ * new one.
+ */
+struct tls_handoff_state
+{
+    struct session_id session_id;       /**< our session id */
+    struct session_id session_id_remote; /**< the peer's session id */
+    int key_id;                         /**< key id of the active key */
+    unsigned int crypto_flags;          /**< negotiated \c CO_ flags */
+    time_t established;                 /**< when the key became active */
+
+    struct key2 data_key;               /**< data channel key material */
+    uint16_t send_epoch;                /**< current epochs, with
+                                         *   \c CO_EPOCH_DATA_KEY_FORMAT */
+    uint16_t recv_epoch;
+    struct packet_id_net send_pid;      /**< last data packet id sent */
+    struct packet_id_net recv_pid;      /**< highest data packet id received */
+
+    struct key2 wrap_client_key;        /**< tls-crypt-v2 client key, \c n
+                                         *   is 0 without tls-crypt-v2 */
+    struct packet_id_net wrap_send_pid; /**< control channel packet ids */
+    struct packet_id_net wrap_recv_pid;
+    struct key2 reneg_key;              /**< dynamic tls-crypt key, \c n
+                                         *   is 0 if there is none yet */
+    struct packet_id_net reneg_send_pid;
+    struct packet_id_net reneg_recv_pid;
+};
+
+/**
+ * Collect the state of an established session for --handoff.  Only keys
+ * from the TLS keying material exporter can be exported again; sessions
+ * with keys from the OpenVPN PRF fail.
+ *
+ * @param multi     The TLS object of the client instance
+ * @param hs        Receives the state, wipe it with secure_memzero()
+ *
+ * @return false if the session cannot be handed off
+ */
+bool tls_session_handoff_export(struct tls_multi *multi,
+                                struct tls_handoff_state *hs);
+
+/**
+ * Install the state exported by tls_session_handoff_export() in the
+ * active session of a new client instance, instead of negotiating it.
+ * The cipher and auth names must already be set in \c options.
+ *
+ * @param multi           The TLS object of the new instance
+ * @param hs              The exported state
+ * @param remote          The address of the peer
+ * @param options         The options of the instance
+ * @param frame           The frame of the instance
+ * @param frame_fragment  The fragment frame of the instance
+ * @param lsi             The link socket info of the instance
+ *
+ * @return false if the keys could not be set up
+ */
+bool tls_session_handoff_import(struct tls_multi *multi,
+                                const struct tls_handoff_state *hs,
+                                const struct link_socket_actual *remote,
+                                struct options *options,
+                                struct frame *frame,
+                                struct frame *frame_fragment,
+                                struct link_socket_info *lsi);
+
 /*
  * inline functions
  */
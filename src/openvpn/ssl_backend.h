@@ -168,6 +168,18 @@ bool tls_ctx_initialised(struct tls_root_ctx *ctx);
  */
 bool tls_ctx_set_options(struct tls_root_ctx *ctx, unsigned int ssl_flags);
 
+/**
+ * Enable TLS session resumption with session tickets.  A server issues
+ * tickets, a client offers the last ticket it received in its next
+ * handshake.  Must be called after tls_ctx_set_options().
+ *
+ * @param ctx           TLS context to set options on
+ * @param lifetime      Number of seconds a ticket stays valid
+ *
+ * @return true on success, false if session tickets are not supported.
+ */
+bool tls_ctx_set_session_tickets(struct tls_root_ctx *ctx, int lifetime);
+
 /**
  * Restrict the list of ciphers that can be used within the TLS context for TLS 1.2
  * and below
@@ -389,6 +401,32 @@ void key_state_ssl_free(struct key_state_ssl *ks_ssl);
 void backend_tls_ctx_reload_crl(struct tls_root_ctx *ssl_ctx,
                                 const char *crl_file, bool crl_inline);
 
+#ifdef ENABLE_CRL_ASYNC
+/**
+ * Parse the CRLs in a file for backend_tls_ctx_set_crl().  Called on the
+ * CRL reload thread, so it must neither log nor touch any shared state.
+ *
+ * @param crl_file      The file name to load the CRLs from.
+ * @param complete      Set to false if the file could not be read to the
+ *                      end or holds no CRL.
+ * @return              The CRLs read, or NULL if the file cannot be opened.
+ */
+void *backend_crl_parse(const char *crl_file, bool *complete);
+
+/**
+ * Replace the CRLs of the TLS context by those returned from
+ * backend_crl_parse(), which are freed.  With NULL all CRLs are removed.
+ *
+ * @return              The number of CRLs added.
+ */
+int backend_tls_ctx_set_crl(struct tls_root_ctx *ssl_ctx, void *crls);
+
+/**
+ * Free CRLs returned from backend_crl_parse().
+ */
+void backend_crl_free(void *crls);
+#endif
+
 #define EXPORT_KEY_DATA_LABEL       "EXPORTER-OpenVPN-datakeys"
 #define EXPORT_P2P_PEERID_LABEL     "EXPORTER-OpenVPN-p2p-peerid"
 #define EXPORT_DYNAMIC_TLS_CRYPT_LABEL  "EXPORTER-OpenVPN-dynamic-tls-crypt"
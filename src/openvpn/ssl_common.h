@@ -36,6 +36,8 @@
 #include "options.h"
 
 #include "ssl_backend.h"
+#include "verify_cache.h"
+#include "crl_dir.h"
 
 /* passwords */
 #define UP_TYPE_AUTH        "Auth"
@@ -235,6 +237,12 @@ struct key_state
     struct reliable_ack *rec_ack; /* buffers all packet IDs we want to ACK back to sender */
     struct reliable_ack *lru_acks; /* keeps the most recently acked packages*/
 
+    /* position in the incoming TLS record stream: bytes of the current
+     * record header seen, and bytes of its body still to come */
+    int tls_rec_hdr;
+    int tls_rec_left;
+    time_t ack_deadline;          /* deferred ACKs go out at the latest then */
+
     /** Holds outgoing message for the control channel until ks->state reaches
      * S_ACTIVE */
     struct buffer_list *paybuf;
@@ -273,6 +281,9 @@ struct tls_wrap_ctx
     const struct buffer *tls_crypt_v2_wkc;   /**< Wrapped client key,
                                               *   sent to server */
     struct buffer tls_crypt_v2_metadata;     /**< Received from client */
+    struct tls_crypt_v2_wkc_cache *tls_crypt_v2_wkc_cache; /**< Recently
+                                                            *   unwrapped client
+                                                            *   keys (server) */
     bool cleanup_key_ctx;                    /**< opt.key_ctx_bi is owned by
                                               *   this context */
     /** original key data to be xored in to the key for dynamic tls-crypt.
@@ -328,9 +339,19 @@ struct tls_options
     int transition_window;
     int handshake_window;
     interval_t packet_timeout;
+    int send_window;    /**< control channel packets in flight */
     int renegotiate_bytes;
     int renegotiate_packets;
     interval_t renegotiate_seconds;
+    /** Limits the renegotiations that renegotiate_seconds starts, shared
+     *  by all instances of a server, NULL if unlimited */
+    struct frequency_limit *reneg_limiter;
+    /** Called as async_wakeup(async_wakeup_ctx, async_wakeup_arg) when a
+     *  handshake paused in an asynchronous private key operation can go
+     *  on; NULL if the owner cannot resume paused handshakes */
+    void (*async_wakeup)(void *ctx, void *arg);
+    void *async_wakeup_ctx;
+    void *async_wakeup_arg;
 
     /* cert verification parms */
     const char *verify_command;
@@ -340,12 +361,16 @@ struct tls_options
     const char *crl_file;
     bool crl_file_inline;
     int ns_cert_type;
-    unsigned remote_cert_ku[MAX_PARMS];
+    const unsigned *remote_cert_ku; /**< MAX_PARMS entries, in options */
     const char *remote_cert_eku;
     struct verify_hash_list *verify_hash;
     int verify_hash_depth;
     bool verify_hash_no_ca;
     hash_algo_type verify_hash_algo;
+    struct verify_cache *verify_cache; /**< --verify-cache, shared by all
+                                        *   sessions of the SSL context */
+    struct crl_dir *crl_dir;           /**< index of the --crl-verify
+                                        *   directory in dir mode */
 #ifdef ENABLE_X509ALTUSERNAME
     char *x509_username_field[MAX_PARMS];
 #else
@@ -364,6 +389,8 @@ struct tls_options
 
     bool tls_crypt_v2;
     const char *tls_crypt_v2_verify_script;
+    bool tls_crypt_v2_verify_via_env;
+    struct tls_crypt_v2_verify_cache *tls_crypt_v2_verify_cache;
 
     /** TLS handshake wrapping state */
     struct tls_wrap_ctx tls_wrap;
@@ -412,6 +439,7 @@ struct tls_options
 #define SSLF_TLS_VERSION_MAX_SHIFT    10
 #define SSLF_TLS_VERSION_MAX_MASK     0xF  /* (uses bit positions 10 to 13) */
 #define SSLF_TLS_DEBUG_ENABLED        (1<<14)
+#define SSLF_CRL_VERIFY_ASYNC         (1<<15)
     unsigned int ssl_flags;
 
 #ifdef ENABLE_MANAGEMENT
@@ -433,6 +461,8 @@ struct tls_options
     size_t ekm_size;
 
     bool dco_enabled; /**< Whether keys have to be installed in DCO or not */
+
+    bool multipath;   /**< --multipath is used */
 };
 
 /** @addtogroup control_processor
@@ -545,6 +575,9 @@ struct tls_session
  */
 #define KEY_SCAN_SIZE 3
 
+/* number of distinct key ids, see P_KEY_ID_MASK */
+#define KEY_ID_COUNT 8
+
 
 /* multi state (originally client authentication state (=CAS))
  * CAS_NOT_CONNECTED must be 0 since non multi code paths still check
@@ -584,6 +617,31 @@ enum multi_status {
  * multiple data channel security parameter sessions stored in \c
  * key_state structures.
  */
+/** Phases of a client connecting to a server, see tls_connect_phase() */
+enum connect_phase
+{
+    CONNECT_PHASE_TLS,            /**< TLS handshake, until the key_method_2
+                                   *   data of the client has arrived */
+    CONNECT_PHASE_AUTH,           /**< verify_user_pass(), including plugins
+                                   *   and scripts */
+    CONNECT_PHASE_KEY_EXCHANGE,   /**< until our key_method_2 data has been
+                                   *   acknowledged */
+    CONNECT_PHASE_DEFERRED_AUTH,  /**< waiting for deferred authentication */
+    CONNECT_PHASE_POOL,           /**< ifconfig pool selection */
+    CONNECT_PHASE_CLIENT_CONNECT, /**< the client-connect handlers */
+    CONNECT_PHASE_PUSH,           /**< until the push reply has been sent */
+    CONNECT_PHASE_N
+};
+
+/** Time spent in each phase of the initial connection of a client */
+struct connect_timing
+{
+    enum connect_phase phase;   /**< current phase */
+    bool done;                  /**< push reply sent, timing finished */
+    uint64_t mark;              /**< start of the current phase, in ms */
+    uint32_t ms[CONNECT_PHASE_N]; /**< duration of each phase */
+};
+
 struct tls_multi
 {
     /* used to coordinate access between main thread and TLS thread */
@@ -598,6 +656,19 @@ struct tls_multi
      */
     struct key_state *save_ks;  /* temporary pointer used between pre/post routines */
 
+    /*
+     * Results of the key_state scans of the data channel, see
+     * tls_select_encryption_key().  They are valid as long as
+     * key_cache_gen equals key_state_gen, which is bumped by
+     * tls_key_states_changed().
+     */
+    unsigned int key_state_gen;
+    unsigned int key_cache_gen;
+    struct key_state *send_ks;  /**< key to encrypt with */
+    time_t send_ks_recheck;     /**< redo the selection at this time,
+                                 *   0 if never */
+    struct key_state *recv_ks[KEY_ID_COUNT]; /**< keys by key id */
+
     /*
      * Used to return outgoing address from
      * tls_multi_process.
@@ -607,6 +678,7 @@ struct tls_multi
     int n_sessions;             /**< Number of sessions negotiated thus
                                  *   far. */
     enum multi_status multi_state;
+    struct connect_timing connect_timing; /**< server only */
 
     /*
      * Number of errors.
@@ -628,6 +700,10 @@ struct tls_multi
     /** The number of times we updated the cache */
     unsigned int tas_cache_num_updates;
 
+    /** The auth control file of a deferred key is watched by inotify, so
+     * the cached state is only updated when the file has been written */
+    bool tas_cache_watched;
+
     /*
      * An error message to send to client on AUTH_FAILED
      */
@@ -646,6 +722,15 @@ struct tls_multi
     /**< The first auth-token we sent to a client. We use this to remember
      * the session ID and initial timestamp when generating new auth-token.
      */
+    char *auth_token_verified;
+    /**< The last auth-token from the client whose HMAC was good, followed
+     * by the username it was checked against.  A client sends the same
+     * token on every renegotiation, so verify_auth_token() only needs to
+     * compute the HMAC again when the token or the username change.
+     */
+    unsigned int auth_token_verified_flags;
+    /**< The AUTH_TOKEN_HMAC_OK/AUTH_TOKEN_VALID_EMPTYUSER result for
+     * auth_token_verified */
 #define  AUTH_TOKEN_HMAC_OK              (1<<0)
     /**< Auth-token sent from client has valid hmac */
 #define  AUTH_TOKEN_EXPIRED              (1<<1)
@@ -712,6 +797,17 @@ get_key_scan(struct tls_multi *multi, int index)
     }
 }
 
+/**
+ * Invalidate the cached key selection of the data channel.  Must be
+ * called after the state, the authentication status or the position
+ * of a key_state in the \c session array changed.
+ */
+static inline void
+tls_key_states_changed(struct tls_multi *multi)
+{
+    ++multi->key_state_gen;
+}
+
 /**  gets an item  of \c key_state objects in the
  *   order they should be scanned by data
  *   channel modules. */
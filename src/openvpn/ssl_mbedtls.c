@@ -262,6 +262,13 @@ tls_ctx_set_options(struct tls_root_ctx *ctx, unsigned int ssl_flags)
     return true;
 }
 
+bool
+tls_ctx_set_session_tickets(struct tls_root_ctx *ctx, int lifetime)
+{
+    msg(M_WARN, "TLS session tickets are not supported with mbed TLS");
+    return false;
+}
+
 static const char *
 tls_translate_cipher_name(const char *cipher_name)
 {
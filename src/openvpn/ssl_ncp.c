@@ -69,6 +69,26 @@ tls_peer_info_ncp_ver(const char *peer_info)
     return 0;
 }
 
+/**
+ * Return 1 if the peer announced hardware accelerated AES with IV_AES_HW=1,
+ * 0 if it announced that it has none, or -1 if it did not tell.
+ */
+static int
+tls_peer_info_aes_hw(const char *peer_info)
+{
+    const char *aesstr = peer_info ? strstr(peer_info, "IV_AES_HW=") : NULL;
+    if (aesstr)
+    {
+        int aes_hw = 0;
+        int r = sscanf(aesstr, "IV_AES_HW=%d", &aes_hw);
+        if (r == 1)
+        {
+            return aes_hw ? 1 : 0;
+        }
+    }
+    return -1;
+}
+
 /**
  * Returns whether the client supports NCP either by
  * announcing IV_NCP>=2 or the IV_CIPHERS list
@@ -289,6 +309,34 @@ ncp_get_best_cipher(const char *server_list, const char *peer_info,
     return ret;
 }
 
+const char *
+ncp_hw_aware_ciphers(const char *server_list, const char *peer_info,
+                     struct gc_arena *gc)
+{
+    static const char *chacha = "CHACHA20-POLY1305";
+
+    if (!tls_item_in_cipher_list(chacha, server_list)
+        || (tls_peer_info_aes_hw(peer_info) != 0 && crypto_aes_hw_accel()))
+    {
+        return server_list;
+    }
+
+    /* move ChaCha20-Poly1305 to the front, keep the order of the others */
+    struct buffer out = alloc_buf_gc(strlen(server_list) + 1, gc);
+    buf_printf(&out, "%s", chacha);
+
+    char *tmp_ciphers = string_alloc(server_list, gc);
+    const char *token;
+    while ((token = strsep(&tmp_ciphers, ":")))
+    {
+        if (strcmp(token, chacha) != 0)
+        {
+            buf_printf(&out, ":%s", token);
+        }
+    }
+    return BSTR(&out);
+}
+
 /**
  * "Poor man's NCP": Use peer cipher if it is an allowed (NCP) cipher.
  * Allows non-NCP peers to upgrade their cipher individually.
@@ -463,6 +511,12 @@ p2p_ncp_set_options(struct tls_multi *multi, struct tls_session *session)
     {
         session->opt->crypto_flags |= CO_USE_DYNAMIC_TLS_CRYPT;
     }
+    if ((iv_proto_peer & IV_PROTO_DATA_EPOCH)
+        && (iv_proto_peer & IV_PROTO_TLS_KEY_EXPORT)
+        && !session->opt->dco_enabled)
+    {
+        session->opt->crypto_flags |= CO_EPOCH_DATA_KEY_FORMAT;
+    }
 #endif /* if defined(HAVE_EXPORT_KEYING_MATERIAL) */
 }
 
@@ -499,9 +553,11 @@ p2p_mode_ncp(struct tls_multi *multi, struct tls_session *session)
     }
 
     msg(D_TLS_DEBUG_LOW, "P2P mode NCP negotiation result: "
-        "TLS_export=%d, DATA_v2=%d, peer-id %d, cipher=%s",
+        "TLS_export=%d, DATA_v2=%d, peer-id %d, epoch=%d, cipher=%s",
         (bool)(session->opt->crypto_flags & CO_USE_TLS_KEY_MATERIAL_EXPORT),
-        multi->use_peer_id, multi->peer_id, common_cipher);
+        multi->use_peer_id, multi->peer_id,
+        (bool)(session->opt->crypto_flags & CO_EPOCH_DATA_KEY_FORMAT),
+        common_cipher);
 
     gc_free(&gc);
 }
@@ -74,6 +74,19 @@ char *
 ncp_get_best_cipher(const char *server_list, const char *peer_info,
                     const char *remote_cipher, struct gc_arena *gc);
 
+/**
+ * Returns the server cipher list for --data-ciphers-hw-aware: with
+ * CHACHA20-POLY1305 moved to the front if the peer announced that it has
+ * no hardware accelerated AES (IV_AES_HW=0) or if we have none.  Without
+ * either, or without CHACHA20-POLY1305 in the list, \c server_list is
+ * returned unchanged.
+ *
+ * @param gc   gc arena used to allocate the reordered list
+ */
+const char *
+ncp_hw_aware_ciphers(const char *server_list, const char *peer_info,
+                     struct gc_arena *gc);
+
 
 /**
  * Returns the support cipher list from the peer according to the IV_NCP
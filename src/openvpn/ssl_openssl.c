@@ -44,6 +44,7 @@
 #include "base64.h"
 #include "openssl_compat.h"
 #include "xkey_common.h"
+#include "pkcs11.h"
 
 #ifdef ENABLE_CRYPTOAPI
 #include "cryptoapi.h"
@@ -80,6 +81,123 @@ static void unload_xkey_provider(void);
 
 int mydata_index; /* GLOBAL */
 
+/*
+ * Index in SSL_CTX objects of the SSL_SESSION that a client offers to
+ * resume with --tls-session-tickets.
+ */
+static int resume_session_index = -1; /* GLOBAL */
+
+static void
+resume_session_free(void *parent, void *ptr, CRYPTO_EX_DATA *ad,
+                    int idx, long argl, void *argp)
+{
+    SSL_SESSION_free(ptr);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+#define SSL_RECYCLE
+
+/*
+ * SSL objects of freed key states, with their memory BIOs, reset with
+ * SSL_clear() and ready for the next handshake on the same SSL_CTX.
+ * SSL_new() copies the certificate and the settings of the SSL_CTX, so
+ * it is a noticeable part of the cost of starting a handshake.
+ */
+#define SSL_RECYCLE_MAX 64
+static struct {
+    SSL *ssl;
+    BIO *ct_in;
+    BIO *ct_out;
+} ssl_recycle[SSL_RECYCLE_MAX]; /* GLOBAL */
+static int ssl_recycle_n; /* GLOBAL */
+
+/* free the recycled SSL objects of ctx, or all of them if ctx is NULL */
+static void
+ssl_recycle_flush(const SSL_CTX *ctx)
+{
+    for (int i = ssl_recycle_n - 1; i >= 0; --i)
+    {
+        if (!ctx || SSL_get_SSL_CTX(ssl_recycle[i].ssl) == ctx)
+        {
+            SSL_free(ssl_recycle[i].ssl);
+            ssl_recycle[i] = ssl_recycle[--ssl_recycle_n];
+        }
+    }
+}
+
+static bool
+ssl_recycle_get(struct key_state_ssl *ks_ssl, const SSL_CTX *ctx)
+{
+    for (int i = ssl_recycle_n - 1; i >= 0; --i)
+    {
+        if (SSL_get_SSL_CTX(ssl_recycle[i].ssl) == ctx)
+        {
+            ks_ssl->ssl = ssl_recycle[i].ssl;
+            ks_ssl->ct_in = ssl_recycle[i].ct_in;
+            ks_ssl->ct_out = ssl_recycle[i].ct_out;
+            ssl_recycle[i] = ssl_recycle[--ssl_recycle_n];
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Keep the SSL object of ks_ssl for reuse.  Its session, which holds
+ * the peer certificate and the keys, is dropped and SSL_clear() resets
+ * the connection state, so nothing of the old peer is carried over.
+ * Returns false if the object has to be freed instead.
+ */
+static bool
+ssl_recycle_put(struct key_state_ssl *ks_ssl)
+{
+    SSL *ssl = ks_ssl->ssl;
+
+    if (ssl_recycle_n == SSL_RECYCLE_MAX)
+    {
+        return false;
+    }
+
+    SSL_set_session(ssl, NULL);
+    SSL_set_ex_data(ssl, mydata_index, NULL);
+    if (!SSL_clear(ssl)
+        || BIO_reset(ks_ssl->ct_in) != 1 || BIO_reset(ks_ssl->ct_out) != 1)
+    {
+        ERR_clear_error();
+        return false;
+    }
+
+    ssl_recycle[ssl_recycle_n].ssl = ssl;
+    ssl_recycle[ssl_recycle_n].ct_in = ks_ssl->ct_in;
+    ssl_recycle[ssl_recycle_n].ct_out = ks_ssl->ct_out;
+    ++ssl_recycle_n;
+    return true;
+}
+#endif /* if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER) */
+
+#ifdef HAVE_XKEY_PROVIDER
+#define SSL_ASYNC_SIGN
+
+/*
+ * With --management-external-key or --pkcs11-sign-thread the
+ * handshakes run as OpenSSL async jobs, which the xkey sign callbacks
+ * pause while the signature is computed elsewhere.  This is called
+ * when it is done, to get the instance processed and the job resumed.
+ */
+static int
+ssl_async_sign_wakeup(SSL *ssl, void *arg)
+{
+    const struct tls_session *session = SSL_get_ex_data(ssl, mydata_index);
+
+    if (session && session->opt->async_wakeup)
+    {
+        (*session->opt->async_wakeup)(session->opt->async_wakeup_ctx,
+                                      session->opt->async_wakeup_arg);
+    }
+    return 1;
+}
+#endif
+
 void
 tls_init_lib(void)
 {
@@ -92,11 +210,20 @@ tls_init_lib(void)
 #endif
     mydata_index = SSL_get_ex_new_index(0, "struct session *", NULL, NULL, NULL);
     ASSERT(mydata_index >= 0);
+    if (resume_session_index < 0)
+    {
+        resume_session_index = SSL_CTX_get_ex_new_index(0, "SSL_SESSION *", NULL,
+                                                        NULL, resume_session_free);
+        ASSERT(resume_session_index >= 0);
+    }
 }
 
 void
 tls_free_lib(void)
 {
+#ifdef SSL_RECYCLE
+    ssl_recycle_flush(NULL);
+#endif
 #if OPENSSL_VERSION_NUMBER < 0x10100000L
     EVP_cleanup();
 #ifndef ENABLE_SMALL
@@ -145,6 +272,9 @@ void
 tls_ctx_free(struct tls_root_ctx *ctx)
 {
     ASSERT(NULL != ctx);
+#ifdef SSL_RECYCLE
+    ssl_recycle_flush(ctx->ctx);
+#endif
     SSL_CTX_free(ctx->ctx);
     ctx->ctx = NULL;
     unload_xkey_provider(); /* in case it is loaded */
@@ -359,6 +489,79 @@ tls_ctx_set_options(struct tls_root_ctx *ctx, unsigned int ssl_flags)
     return true;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+/*
+ * Client: keep the last session ticket of the server to offer it in the
+ * next handshake.  We keep a copy, as OpenSSL marks the session of an SSL
+ * object that is freed without a TLS shutdown as not resumable.
+ */
+static int
+new_session_callback(SSL *ssl, SSL_SESSION *sess)
+{
+    SSL_CTX *ctx = SSL_get_SSL_CTX(ssl);
+
+    SSL_SESSION_free(SSL_CTX_get_ex_data(ctx, resume_session_index));
+    SSL_CTX_set_ex_data(ctx, resume_session_index, SSL_SESSION_dup(sess));
+    return 0;
+}
+
+/*
+ * Server: only resume a session from a ticket after the certificate of
+ * the original handshake has passed our verification again.
+ */
+static SSL_TICKET_RETURN
+decrypt_ticket_callback(SSL *ssl, SSL_SESSION *sess,
+                        const unsigned char *keyname, size_t keyname_len,
+                        SSL_TICKET_STATUS status, void *arg)
+{
+    switch (status)
+    {
+        case SSL_TICKET_SUCCESS:
+        case SSL_TICKET_SUCCESS_RENEW:
+            if (!verify_resumed_session(ssl, sess))
+            {
+                return SSL_TICKET_RETURN_IGNORE_RENEW;
+            }
+            return status == SSL_TICKET_SUCCESS ? SSL_TICKET_RETURN_USE
+                   : SSL_TICKET_RETURN_USE_RENEW;
+
+        case SSL_TICKET_FATAL_ERR_MALLOC:
+        case SSL_TICKET_FATAL_ERR_OTHER:
+            return SSL_TICKET_RETURN_ABORT;
+
+        default:
+            return SSL_TICKET_RETURN_IGNORE_RENEW;
+    }
+}
+#endif /* if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER) */
+
+bool
+tls_ctx_set_session_tickets(struct tls_root_ctx *ctx, int lifetime)
+{
+    ASSERT(NULL != ctx);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+    SSL_CTX_clear_options(ctx->ctx, SSL_OP_NO_TICKET);
+    SSL_CTX_set_timeout(ctx->ctx, lifetime);
+
+    /* server side, tickets are stateless and encrypted with a key that
+     * is generated randomly for this SSL_CTX */
+    SSL_CTX_set_num_tickets(ctx->ctx, 1);
+    SSL_CTX_set_session_id_context(ctx->ctx, (const unsigned char *) PACKAGE,
+                                   strlen(PACKAGE));
+    SSL_CTX_set_session_ticket_cb(ctx->ctx, NULL, decrypt_ticket_callback, NULL);
+
+    /* client side */
+    SSL_CTX_set_session_cache_mode(ctx->ctx, SSL_SESS_CACHE_CLIENT
+                                   |SSL_SESS_CACHE_NO_INTERNAL_STORE);
+    SSL_CTX_sess_set_new_cb(ctx->ctx, new_session_callback);
+    return true;
+#else
+    msg(M_WARN, "TLS session tickets require OpenSSL 1.1.1 or newer");
+    return false;
+#endif
+}
+
 void
 convert_tls_list_to_openssl(char *openssl_ciphers, size_t len, const char *ciphers)
 {
@@ -1086,23 +1289,15 @@ end:
     return ret;
 }
 
-void
-backend_tls_ctx_reload_crl(struct tls_root_ctx *ssl_ctx, const char *crl_file,
-                           bool crl_inline)
+/*
+ * Always start with a cleared CRL list, for that we need to manually
+ * find the CRL objects in the stack and remove them.
+ */
+static void
+tls_ctx_clear_crls(X509_STORE *store)
 {
-    BIO *in = NULL;
-
-    X509_STORE *store = SSL_CTX_get_cert_store(ssl_ctx->ctx);
-    if (!store)
-    {
-        crypto_msg(M_FATAL, "Cannot get certificate store");
-    }
-
-    /* Always start with a cleared CRL list, for that we
-     * we need to manually find the CRL object from the stack
-     * and remove it */
     STACK_OF(X509_OBJECT) *objs = X509_STORE_get0_objects(store);
-    for (int i = 0; i < sk_X509_OBJECT_num(objs); i++)
+    for (int i = sk_X509_OBJECT_num(objs) - 1; i >= 0; i--)
     {
         X509_OBJECT *obj = sk_X509_OBJECT_value(objs, i);
         ASSERT(obj);
@@ -1114,6 +1309,21 @@ backend_tls_ctx_reload_crl(struct tls_root_ctx *ssl_ctx, const char *crl_file,
     }
 
     X509_STORE_set_flags(store, X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+}
+
+void
+backend_tls_ctx_reload_crl(struct tls_root_ctx *ssl_ctx, const char *crl_file,
+                           bool crl_inline)
+{
+    BIO *in = NULL;
+
+    X509_STORE *store = SSL_CTX_get_cert_store(ssl_ctx->ctx);
+    if (!store)
+    {
+        crypto_msg(M_FATAL, "Cannot get certificate store");
+    }
+
+    tls_ctx_clear_crls(store);
 
     if (crl_inline)
     {
@@ -1169,6 +1379,83 @@ end:
     BIO_free(in);
 }
 
+#ifdef ENABLE_CRL_ASYNC
+void *
+backend_crl_parse(const char *crl_file, bool *complete)
+{
+    BIO *in = BIO_new_file(crl_file, "r");
+    STACK_OF(X509_CRL) *crls = sk_X509_CRL_new_null();
+    ASN1_INTEGER *serial = ASN1_INTEGER_new();
+    X509_CRL *crl;
+
+    *complete = false;
+    if (!in || !crls || !serial || !ASN1_INTEGER_set(serial, 0))
+    {
+        sk_X509_CRL_free(crls);
+        crls = NULL;
+        goto end;
+    }
+
+    while ((crl = PEM_read_bio_X509_CRL(in, NULL, NULL, NULL)))
+    {
+        /* the first lookup sorts the revoked serials for binary search,
+         * do that here rather than in the first handshake */
+        X509_REVOKED *revoked;
+        X509_CRL_get0_by_serial(crl, &revoked, serial);
+
+        if (!sk_X509_CRL_push(crls, crl))
+        {
+            X509_CRL_free(crl);
+            goto end;
+        }
+    }
+
+    /* PEM_R_NO_START_LINE can be considered equivalent to EOF */
+    *complete = sk_X509_CRL_num(crls) > 0
+                && ERR_GET_REASON(ERR_peek_last_error()) == PEM_R_NO_START_LINE;
+
+end:
+    /* the error queue of this thread is of no use to anyone */
+    ERR_clear_error();
+    ASN1_INTEGER_free(serial);
+    BIO_free(in);
+    return crls;
+}
+
+int
+backend_tls_ctx_set_crl(struct tls_root_ctx *ssl_ctx, void *crls)
+{
+    STACK_OF(X509_CRL) *sk = crls;
+    int n = 0;
+
+    X509_STORE *store = SSL_CTX_get_cert_store(ssl_ctx->ctx);
+    if (!store)
+    {
+        crypto_msg(M_FATAL, "Cannot get certificate store");
+    }
+
+    tls_ctx_clear_crls(store);
+
+    for (int i = 0; sk && i < sk_X509_CRL_num(sk); i++)
+    {
+        if (!X509_STORE_add_crl(store, sk_X509_CRL_value(sk, i)))
+        {
+            crypto_msg(M_WARN, "CRL: cannot add CRL to store");
+            break;
+        }
+        n++;
+    }
+    backend_crl_free(crls);
+    return n;
+}
+
+void
+backend_crl_free(void *crls)
+{
+    sk_X509_CRL_pop_free((STACK_OF(X509_CRL) *) crls, X509_CRL_free);
+}
+#endif /* ENABLE_CRL_ASYNC */
+
 
 #if defined(ENABLE_MANAGEMENT) && !defined(HAVE_XKEY_PROVIDER)
 
@@ -1498,6 +1785,8 @@ tls_ctx_use_management_external_key(struct tls_root_ctx *ctx)
         goto cleanup;
     }
     EVP_PKEY_free(privkey);
+    /* allow handshakes to wait for the signature without blocking */
+    SSL_CTX_set_mode(ctx->ctx, SSL_MODE_ASYNC);
 #else  /* ifdef HAVE_XKEY_PROVIDER */
 #if OPENSSL_VERSION_NUMBER < 0x30000000L
     if (EVP_PKEY_id(pkey) == EVP_PKEY_RSA)
@@ -1808,6 +2097,23 @@ bio_debug_oc(const char *mode, BIO *bio)
 
 #endif /* ifdef BIO_DEBUG */
 
+/*
+ * Return true if bio is the SSL BIO of a handshake paused in an async
+ * job, which is resumed by reading from it again.
+ */
+static bool
+bio_waiting_for_async(BIO *bio)
+{
+#ifdef SSL_ASYNC_SIGN
+    SSL *ssl = NULL;
+    return BIO_method_type(bio) == BIO_TYPE_SSL
+           && BIO_get_ssl(bio, &ssl) > 0 && ssl
+           && SSL_waiting_for_async(ssl);
+#else
+    return false;
+#endif
+}
+
 /*
  * Write to an OpenSSL BIO in non-blocking mode.
  */
@@ -1817,7 +2123,8 @@ bio_write(BIO *bio, const uint8_t *data, int size, const char *desc)
     int i;
     int ret = 0;
     ASSERT(size >= 0);
-    if (size)
+    /* SSL_write() would resume the job paused in SSL_read() */
+    if (size && !bio_waiting_for_async(bio))
     {
         /*
          * Free the L_TLS lock prior to calling BIO routines
@@ -1900,7 +2207,7 @@ bio_read(BIO *bio, struct buffer *buf, const char *desc)
     int ret = 0;
     if (i < 0)
     {
-        if (!BIO_should_retry(bio))
+        if (!BIO_should_retry(bio) && !bio_waiting_for_async(bio))
         {
             crypto_msg(D_TLS_ERRORS, "TLS_ERROR: BIO read %s error", desc);
             buf->len = 0;
@@ -1929,19 +2236,57 @@ key_state_ssl_init(struct key_state_ssl *ks_ssl, const struct tls_root_ctx *ssl_
     ASSERT(ks_ssl);
     CLEAR(*ks_ssl);
 
-    ks_ssl->ssl = SSL_new(ssl_ctx->ctx);
-    if (!ks_ssl->ssl)
+    bool recycled = false;
+#ifdef SSL_RECYCLE
+    recycled = ssl_recycle_get(ks_ssl, ssl_ctx->ctx);
+#endif
+    if (!recycled)
     {
-        crypto_msg(M_FATAL, "SSL_new failed");
+        ks_ssl->ssl = SSL_new(ssl_ctx->ctx);
+        if (!ks_ssl->ssl)
+        {
+            crypto_msg(M_FATAL, "SSL_new failed");
+        }
     }
 
     /* put session * in ssl object so we can access it
      * from verify callback*/
     SSL_set_ex_data(ks_ssl->ssl, mydata_index, session);
 
+#ifdef SSL_ASYNC_SIGN
+    if (SSL_get_mode(ks_ssl->ssl) & SSL_MODE_ASYNC)
+    {
+        SSL_set_async_callback(ks_ssl->ssl, ssl_async_sign_wakeup);
+    }
+#endif
+
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+    /* offer the session of a previous handshake, if it is still valid */
+    SSL_SESSION *resume = SSL_CTX_get_ex_data(ssl_ctx->ctx, resume_session_index);
+    if (!is_server && resume)
+    {
+        if (SSL_SESSION_is_resumable(resume)
+            && now < SSL_SESSION_get_time(resume) + SSL_SESSION_get_timeout(resume)
+            && verify_resumed_session(ks_ssl->ssl, resume))
+        {
+            SSL_SESSION *copy = SSL_SESSION_dup(resume);
+            SSL_set_session(ks_ssl->ssl, copy);
+            SSL_SESSION_free(copy);
+        }
+        else
+        {
+            SSL_SESSION_free(resume);
+            SSL_CTX_set_ex_data(ssl_ctx->ctx, resume_session_index, NULL);
+        }
+    }
+#endif /* if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER) */
+
     ASSERT((ks_ssl->ssl_bio = BIO_new(BIO_f_ssl())));
-    ASSERT((ks_ssl->ct_in = BIO_new(BIO_s_mem())));
-    ASSERT((ks_ssl->ct_out = BIO_new(BIO_s_mem())));
+    if (!recycled)
+    {
+        ASSERT((ks_ssl->ct_in = BIO_new(BIO_s_mem())));
+        ASSERT((ks_ssl->ct_out = BIO_new(BIO_s_mem())));
+    }
 
 #ifdef BIO_DEBUG
     bio_debug_oc("open ssl_bio", ks_ssl->ssl_bio);
@@ -1958,7 +2303,10 @@ key_state_ssl_init(struct key_state_ssl *ks_ssl, const struct tls_root_ctx *ssl_
         SSL_set_connect_state(ks_ssl->ssl);
     }
 
-    SSL_set_bio(ks_ssl->ssl, ks_ssl->ct_in, ks_ssl->ct_out);
+    if (!recycled)
+    {
+        SSL_set_bio(ks_ssl->ssl, ks_ssl->ct_in, ks_ssl->ct_out);
+    }
     BIO_set_ssl(ks_ssl->ssl_bio, ks_ssl->ssl, BIO_NOCLOSE);
 }
 
@@ -1971,8 +2319,33 @@ key_state_ssl_free(struct key_state_ssl *ks_ssl)
         bio_debug_oc("close ssl_bio", ks_ssl->ssl_bio);
         bio_debug_oc("close ct_in", ks_ssl->ct_in);
         bio_debug_oc("close ct_out", ks_ssl->ct_out);
+#endif
+#ifdef SSL_ASYNC_SIGN
+        if (SSL_waiting_for_async(ks_ssl->ssl))
+        {
+            /* fail the pending signature, so that the paused job ends;
+             * OpenSSL passes the SSL object as the wakeup argument */
+            uint8_t dummy;
+#ifdef ENABLE_MANAGEMENT
+            if (management)
+            {
+                management_pk_sig_async_cancel(management, ks_ssl->ssl);
+            }
+#endif
+#ifdef ENABLE_PKCS11_SIGN_THREADS
+            pkcs11_sign_cancel(ks_ssl->ssl);
+#endif
+            SSL_read(ks_ssl->ssl, &dummy, sizeof(dummy));
+            ERR_clear_error();
+        }
 #endif
         BIO_free_all(ks_ssl->ssl_bio);
+#ifdef SSL_RECYCLE
+        if (ssl_recycle_put(ks_ssl))
+        {
+            return;
+        }
+#endif
         SSL_free(ks_ssl->ssl);
     }
 }
@@ -2154,11 +2527,12 @@ print_details(struct key_state_ssl *ks_ssl, const char *prefix)
 
     s1[0] = s2[0] = 0;
     ciph = SSL_get_current_cipher(ks_ssl->ssl);
-    openvpn_snprintf(s1, sizeof(s1), "%s %s, cipher %s %s",
+    openvpn_snprintf(s1, sizeof(s1), "%s %s, cipher %s %s%s",
                      prefix,
                      SSL_get_version(ks_ssl->ssl),
                      SSL_CIPHER_get_version(ciph),
-                     SSL_CIPHER_get_name(ciph));
+                     SSL_CIPHER_get_name(ciph),
+                     SSL_session_reused(ks_ssl->ssl) ? ", resumed" : "");
     X509 *cert = SSL_get_peer_certificate(ks_ssl->ssl);
 
     if (cert)
@@ -32,6 +32,12 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+/* The CRL of --crl-verify file async is parsed on a thread, which needs
+ * the thread safety of OpenSSL 1.1.0 and later */
+#if defined(HAVE_PTHREAD_H) && !defined(_WIN32) && OPENSSL_VERSION_NUMBER >= 0x10100000L
+#define ENABLE_CRL_ASYNC
+#endif
+
 /**
  * Structure that wraps the TLS context. Contents differ depending on the
  * SSL library used.
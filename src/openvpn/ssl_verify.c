@@ -80,6 +80,7 @@ tls_deauthenticate(struct tls_multi *multi)
                 multi->session[i].key[j].authenticated = KS_AUTH_FALSE;
             }
         }
+        tls_key_states_changed(multi);
     }
 }
 
@@ -584,12 +585,10 @@ cleanup:
  * check peer cert against CRL directory
  */
 static result_t
-verify_check_crl_dir(const char *crl_dir, openvpn_x509_cert_t *cert,
+verify_check_crl_dir(struct crl_dir *crl_dir, openvpn_x509_cert_t *cert,
                      const char *subject, int cert_depth)
 {
     result_t ret = FAILURE;
-    char fn[256];
-    int fd = -1;
     struct gc_arena gc = gc_new();
 
     char *serial = backend_x509_get_serial(cert, &gc);
@@ -600,13 +599,7 @@ verify_check_crl_dir(const char *crl_dir, openvpn_x509_cert_t *cert,
         goto cleanup;
     }
 
-    if (!openvpn_snprintf(fn, sizeof(fn), "%s%c%s", crl_dir, PATH_SEPARATOR, serial))
-    {
-        msg(D_HANDSHAKE, "VERIFY CRL: filename overflow");
-        goto cleanup;
-    }
-    fd = platform_open(fn, O_RDONLY, 0);
-    if (fd >= 0)
+    if (crl_dir_is_revoked(crl_dir, serial))
     {
         msg(D_HANDSHAKE, "VERIFY CRL: depth=%d, %s, serial=%s is revoked",
             cert_depth, subject, serial);
@@ -616,11 +609,6 @@ verify_check_crl_dir(const char *crl_dir, openvpn_x509_cert_t *cert,
     ret = SUCCESS;
 
 cleanup:
-
-    if (fd != -1)
-    {
-        close(fd);
-    }
     gc_free(&gc);
     return ret;
 }
@@ -775,15 +763,27 @@ verify_cert(struct tls_session *session, openvpn_x509_cert_t *cert, int cert_dep
         goto cleanup;
     }
 
+    /* skip the plug-in(s) and script if they accepted this certificate
+     * recently, see --verify-cache */
+    struct buffer cert_sha256 = {0};
+    bool cached = false;
+    if (opt->verify_cache)
+    {
+        cert_sha256 = x509_get_sha256_fingerprint(cert, &gc);
+        cached = verify_cache_lookup(opt->verify_cache, BPTR(&cert_sha256), cert_depth);
+    }
+
     /* call --tls-verify plug-in(s), if registered */
-    if (SUCCESS != verify_cert_call_plugin(opt->plugins, opt->es, cert_depth, cert, subject))
+    if (!cached
+        && SUCCESS != verify_cert_call_plugin(opt->plugins, opt->es, cert_depth, cert, subject))
     {
         goto cleanup;
     }
 
     /* run --tls-verify script */
-    if (opt->verify_command && SUCCESS != verify_cert_call_command(opt->verify_command,
-                                                                   opt->es, cert_depth, cert, subject, opt->verify_export_cert))
+    if (!cached && opt->verify_command
+        && SUCCESS != verify_cert_call_command(opt->verify_command, opt->es, cert_depth,
+                                               cert, subject, opt->verify_export_cert))
     {
         goto cleanup;
     }
@@ -793,7 +793,8 @@ verify_cert(struct tls_session *session, openvpn_x509_cert_t *cert, int cert_dep
     {
         if (opt->ssl_flags & SSLF_CRL_VERIFY_DIR)
         {
-            if (SUCCESS != verify_check_crl_dir(opt->crl_file, cert, subject, cert_depth))
+            ASSERT(opt->crl_dir);
+            if (SUCCESS != verify_check_crl_dir(opt->crl_dir, cert, subject, cert_depth))
             {
                 goto cleanup;
             }
@@ -808,7 +809,13 @@ verify_cert(struct tls_session *session, openvpn_x509_cert_t *cert, int cert_dep
         }
     }
 
-    msg(D_HANDSHAKE, "VERIFY OK: depth=%d, %s", cert_depth, subject);
+    if (opt->verify_cache && !cached)
+    {
+        verify_cache_add(opt->verify_cache, BPTR(&cert_sha256), cert_depth);
+    }
+
+    msg(D_HANDSHAKE, "VERIFY OK: depth=%d, %s%s", cert_depth, subject,
+        cached ? " (cached)" : "");
     session->verified = true;
     ret = SUCCESS;
 
@@ -1161,11 +1168,23 @@ static time_t cache_intervals[] = {0, 0, 0, 0, 0, 1, 1, 2, 2, 4, 8};
 static bool
 tls_authentication_status_use_cache(struct tls_multi *multi)
 {
+    if (multi->tas_cache_watched)
+    {
+        return multi->tas_cache_last_update != 0;
+    }
+
     unsigned int idx = min_uint(multi->tas_cache_num_updates, SIZE(cache_intervals) - 1);
     time_t latency = cache_intervals[idx];
     return multi->tas_cache_last_update + latency >= now;
 }
 
+void
+tls_authentication_status_watch(struct tls_multi *multi, bool watched)
+{
+    multi->tas_cache_watched = watched;
+    multi->tas_cache_last_update = 0;
+}
+
 enum tls_auth_status
 tls_authentication_status(struct tls_multi *multi)
 {
@@ -1188,7 +1207,12 @@ tls_authentication_status(struct tls_multi *multi)
         if (TLS_AUTHENTICATED(multi, ks))
         {
             active++;
+            const enum ks_auth_state before = ks->authenticated;
             update_key_auth_status(cached, ks);
+            if (ks->authenticated != before)
+            {
+                tls_key_states_changed(multi);
+            }
 
             if (ks->authenticated == KS_AUTH_FALSE)
             {
@@ -1280,6 +1304,8 @@ tls_authenticate_key(struct tls_multi *multi, const unsigned int mda_key_id, con
                 ret = true;
             }
         }
+        /* the cached status does not know about the answer yet */
+        multi->tas_cache_last_update = 0;
     }
     return ret;
 }
@@ -1637,7 +1663,7 @@ verify_user_pass(struct user_pass *up, struct tls_multi *multi,
      */
     if (session->opt->auth_token_generate && is_auth_token(up->password))
     {
-        ks->auth_token_state_flags = verify_auth_token(up, multi, session);
+        ks->auth_token_state_flags = verify_auth_token_cached(up, multi, session);
 
         /* If this is the first time we see an auth-token in this multi session,
          * save it as initial auth token. This ensures using the
@@ -91,6 +91,19 @@ enum tls_auth_status
 enum tls_auth_status
 tls_authentication_status(struct tls_multi *multi);
 
+/**
+ * Tells tls_authentication_status() whether the auth control files of
+ * deferred keys are watched for changes.  While they are, the files are
+ * not polled, but only read when this function is called again.  Either
+ * way the next tls_authentication_status() call reads them.
+ *
+ * @param   multi       the tls_multi struct to operate on
+ * @param   watched     true if a write to the auth control file will be
+ *                      signalled by calling this function again
+ */
+void
+tls_authentication_status_watch(struct tls_multi *multi, bool watched);
+
 /** Check whether the \a ks \c key_state has finished the key exchange part
  *  of the OpenVPN hand shake. This is that the key_method_2read/write
  *  handshakes have been completed and certificate verification have
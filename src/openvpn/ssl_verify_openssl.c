@@ -112,6 +112,65 @@ cleanup:
     return ret;
 }
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+static bool
+verify_session_chain(X509_STORE_CTX *store_ctx, SSL *ssl, X509 *peer, bool run_callback)
+{
+    X509_STORE *store = SSL_CTX_get_cert_store(SSL_get_SSL_CTX(ssl));
+
+    if (!X509_STORE_CTX_init(store_ctx, store, peer, NULL))
+    {
+        return false;
+    }
+    X509_STORE_CTX_set_default(store_ctx, SSL_is_server(ssl) ? "ssl_client" : "ssl_server");
+    X509_VERIFY_PARAM_set1(X509_STORE_CTX_get0_param(store_ctx), SSL_get0_param(ssl));
+    if (run_callback)
+    {
+        X509_STORE_CTX_set_ex_data(store_ctx, SSL_get_ex_data_X509_STORE_CTX_idx(), ssl);
+        X509_STORE_CTX_set_verify_cb(store_ctx, verify_callback);
+    }
+
+    bool ret = X509_verify_cert(store_ctx) == 1;
+    X509_STORE_CTX_cleanup(store_ctx);
+    return ret;
+}
+
+bool
+verify_resumed_session(SSL *ssl, SSL_SESSION *sess)
+{
+    struct tls_session *session = (struct tls_session *) SSL_get_ex_data(ssl, mydata_index);
+    ASSERT(session);
+
+    X509 *peer = SSL_SESSION_get0_peer(sess);
+    if (!peer)
+    {
+        /* no certificate in the original handshake either */
+        return !(SSL_get_verify_mode(ssl) & SSL_VERIFY_FAIL_IF_NO_PEER_CERT);
+    }
+
+    X509_STORE_CTX *store_ctx = X509_STORE_CTX_new();
+    if (!store_ctx)
+    {
+        crypto_msg(M_FATAL, "X509_STORE_CTX_new failed");
+    }
+
+    /* Check the chain quietly first.  A peer that needs intermediate
+     * certificates that are not in our store just gets a full handshake
+     * instead of a verification error. */
+    bool ret = (session->opt->verify_hash_no_ca
+                || verify_session_chain(store_ctx, ssl, peer, false))
+               && verify_session_chain(store_ctx, ssl, peer, true);
+
+    X509_STORE_CTX_free(store_ctx);
+    if (!ret)
+    {
+        dmsg(D_TLS_DEBUG_LOW, "TLS: not resuming session, certificate not verified");
+        ERR_clear_error();
+    }
+    return ret;
+}
+#endif /* if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER) */
+
 #ifdef ENABLE_X509ALTUSERNAME
 bool
 x509_username_field_ext_supported(const char *fieldname)
@@ -31,6 +31,7 @@
 #define SSL_VERIFY_OPENSSL_H_
 
 #include <openssl/x509.h>
+#include <openssl/ssl.h>
 
 #ifndef __OPENVPN_X509_CERT_T_DECLARED
 #define __OPENVPN_X509_CERT_T_DECLARED
@@ -70,6 +71,27 @@ typedef X509 openvpn_x509_cert_t;
  */
 int verify_callback(int preverify_ok, X509_STORE_CTX *ctx);
 
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L && !defined(LIBRESSL_VERSION_NUMBER)
+/**
+ * Verify the certificate of a TLS session that is about to be resumed.
+ * @ingroup control_tls
+ *
+ * A resumed handshake does not transfer the peer's certificate, so
+ * \c verify_callback() is not called by the TLS library.  This function
+ * verifies the certificate that was stored in the session by the original
+ * handshake against our own trust store, and calls \c verify_callback()
+ * for every certificate of the chain, exactly like a full handshake does.
+ *
+ * @param ssl          - The SSL object of the new handshake, with the
+ *                       tls_session set as ex_data.
+ * @param sess         - The session that is going to be resumed.
+ *
+ * @return true if the session may be resumed, false if a full handshake
+ *     has to be done instead.
+ */
+bool verify_resumed_session(SSL *ssl, SSL_SESSION *sess);
+#endif
+
 /** @} name Function for authenticating a new connection from a remote OpenVPN peer */
 
 #endif /* SSL_VERIFY_OPENSSL_H_ */
@@ -34,6 +34,9 @@
 
 #include "memdbg.h"
 
+/* initial size of the buffer that collects the lines of a status file */
+#define STATUS_WRITE_BUF_INITIAL 4096
+
 /*
  * printf-style interface for outputting status info
  */
@@ -109,6 +112,10 @@ status_open(const char *filename,
                 {
                     so->read_buf = alloc_buf(512);
                 }
+                if (so->flags & STATUS_OUTPUT_WRITE)
+                {
+                    so->write_buf = alloc_buf(STATUS_WRITE_BUF_INITIAL);
+                }
             }
             else
             {
@@ -144,12 +151,39 @@ status_trigger(struct status_output *so)
     }
 }
 
+/*
+ * Write the lines collected by status_printf() to the file in one go
+ */
+static void
+status_write_pending(struct status_output *so)
+{
+    const uint8_t *data = BPTR(&so->write_buf);
+    int len = BLEN(&so->write_buf);
+
+    while (len > 0)
+    {
+        const ssize_t written = write(so->fd, data, len);
+        if (written <= 0)
+        {
+            so->errors = true;
+            break;
+        }
+        data += written;
+        len -= written;
+    }
+    ASSERT(buf_init(&so->write_buf, 0));
+}
+
 void
 status_reset(struct status_output *so)
 {
     if (so && so->fd >= 0)
     {
         lseek(so->fd, (off_t)0, SEEK_SET);
+        if (buf_defined(&so->write_buf))
+        {
+            ASSERT(buf_init(&so->write_buf, 0));
+        }
     }
 }
 
@@ -158,6 +192,8 @@ status_flush(struct status_output *so)
 {
     if (so && so->fd >= 0 && (so->flags & STATUS_OUTPUT_WRITE))
     {
+        status_write_pending(so);
+
 #if defined(HAVE_FTRUNCATE)
         {
             const off_t off = lseek(so->fd, (off_t)0, SEEK_CUR);
@@ -196,6 +232,14 @@ status_close(struct status_output *so)
         }
         if (so->fd >= 0)
         {
+            if (so->flags & STATUS_OUTPUT_WRITE)
+            {
+                status_write_pending(so);
+                if (so->errors)
+                {
+                    ret = false;
+                }
+            }
             if (close(so->fd) < 0)
             {
                 ret = false;
@@ -207,6 +251,7 @@ status_close(struct status_output *so)
         {
             free_buf(&so->read_buf);
         }
+        free_buf(&so->write_buf);
         free(so);
     }
     else
@@ -244,16 +289,18 @@ status_printf(struct status_output *so, const char *format, ...)
 
         if (so->fd >= 0 && !so->errors)
         {
-            int len;
             strcat(buf, "\n");
-            len = strlen(buf);
-            if (len > 0)
+            const int len = strlen(buf);
+
+            /* collect the lines and write them in status_flush() */
+            if (BLEN(&so->write_buf) + len > BCAP(&so->write_buf))
             {
-                if (write(so->fd, buf, len) != len)
-                {
-                    so->errors = true;
-                }
+                struct buffer grown = alloc_buf(2 * BCAP(&so->write_buf) + len);
+                ASSERT(buf_copy(&grown, &so->write_buf));
+                free_buf(&so->write_buf);
+                so->write_buf = grown;
             }
+            ASSERT(buf_write(&so->write_buf, buf, len));
         }
 
         if (so->vout && !so->errors)
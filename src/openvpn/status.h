@@ -57,6 +57,7 @@ struct status_output
     const struct virtual_output *vout;
 
     struct buffer read_buf;
+    struct buffer write_buf;    /* lines not yet written to fd */
 
     struct event_timeout et;
 
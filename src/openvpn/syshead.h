@@ -150,6 +150,10 @@
 #include <poll.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifdef ENABLE_SELINUX
 #include <selinux/selinux.h>
 #endif
@@ -184,6 +188,10 @@
 #include <linux/if_tun.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
 #ifdef HAVE_NETINET_IP_H
 #include <netinet/ip.h>
 #endif
@@ -200,6 +208,10 @@
 #include <linux/errqueue.h>
 #endif
 
+#ifdef HAVE_LINUX_FILTER_H
+#include <linux/filter.h>
+#endif
+
 #ifdef HAVE_NETINET_TCP_H
 #include <netinet/tcp.h>
 #endif
@@ -370,6 +382,41 @@ typedef int MIB_TCP_STATE;
 #define ENABLE_IP_PKTINFO 0
 #endif
 
+/*
+ * Can we read or write several UDP datagrams with a single
+ * recvmmsg()/sendmmsg() call?
+ */
+#if defined(HAVE_RECVMMSG) && defined(HAVE_MSGHDR) && !defined(_WIN32)
+#define ENABLE_UDP_RECV_BATCH 1
+#else
+#define ENABLE_UDP_RECV_BATCH 0
+#endif
+
+/*
+ * Can the kernel coalesce received UDP datagrams of one flow (UDP_GRO)?
+ */
+#if ENABLE_UDP_RECV_BATCH && defined(TARGET_LINUX)
+#define ENABLE_UDP_RECV_GRO 1
+#else
+#define ENABLE_UDP_RECV_GRO 0
+#endif
+
+#if defined(HAVE_SENDMMSG) && defined(HAVE_MSGHDR) && !defined(_WIN32)
+#define ENABLE_UDP_SEND_BATCH 1
+#else
+#define ENABLE_UDP_SEND_BATCH 0
+#endif
+
+/*
+ * Can batched UDP sends use MSG_ZEROCOPY?  The completion notifications
+ * are read from the socket error queue, see <linux/errqueue.h>.
+ */
+#if ENABLE_UDP_SEND_BATCH && EXTENDED_SOCKET_ERROR_CAPABILITY && defined(SO_ZEROCOPY) && defined(MSG_ZEROCOPY) && defined(SO_EE_ORIGIN_ZEROCOPY) && defined(SO_EE_CODE_ZEROCOPY_COPIED)
+#define ENABLE_UDP_SEND_ZEROCOPY 1
+#else
+#define ENABLE_UDP_SEND_ZEROCOPY 0
+#endif
+
 /*
  * Does this platform define SOL_IP
  * or only bsd-style IPPROTO_IP ?
@@ -456,6 +503,15 @@ socket_defined(const socket_descriptor_t sd)
 #define PORT_SHARE 0
 #endif
 
+/*
+ * Can the port share proxy move data between sockets with splice()?
+ */
+#if PORT_SHARE && defined(HAVE_SPLICE) && defined(SPLICE_F_NONBLOCK)
+#define PORT_SHARE_SPLICE 1
+#else
+#define PORT_SHARE_SPLICE 0
+#endif
+
 #ifdef ENABLE_CRYPTO_MBEDTLS
 #define ENABLE_PREDICTION_RESISTANCE
 #endif /* ENABLE_CRYPTO_MBEDTLS */
@@ -522,4 +578,11 @@ socket_defined(const socket_descriptor_t sd)
 #define ENABLE_MEMSTATS
 #endif
 
+/*
+ * Enable --trace-ring option
+ */
+#ifndef _WIN32
+#define ENABLE_TRACE
+#endif
+
 #endif /* ifndef SYSHEAD_H */
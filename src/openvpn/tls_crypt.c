@@ -32,6 +32,7 @@
 #include "crypto.h"
 #include "platform.h"
 #include "run_command.h"
+#include "script_queue.h"
 #include "session_id.h"
 #include "ssl.h"
 
@@ -94,9 +95,9 @@ xor_key2(struct key2 *key, const struct key2 *other)
     }
 }
 
-bool
-tls_session_generate_dynamic_tls_crypt_key(struct tls_multi *multi,
-                                           struct tls_session *session)
+void
+tls_session_load_dynamic_tls_crypt_key(struct tls_session *session,
+                                       const struct key2 *key)
 {
     session->tls_wrap_reneg.opt = session->tls_wrap.opt;
     session->tls_wrap_reneg.mode = TLS_WRAP_CRYPT;
@@ -109,7 +110,26 @@ tls_session_generate_dynamic_tls_crypt_key(struct tls_multi *multi,
                    session->opt->replay_time,
                    "TLS_WRAP_RENEG", session->key_id);
 
+    const int key_direction = session->opt->server ?
+                              KEY_DIRECTION_NORMAL : KEY_DIRECTION_INVERSE;
+
+    struct key_direction_state kds;
+    key_direction_state_init(&kds, key_direction);
+
+    struct key_type kt = tls_crypt_kt();
+
+    init_key_ctx_bi(&session->tls_wrap_reneg.opt.key_ctx_bi, key, key_direction,
+                    &kt, "dynamic tls-crypt");
+
+    /* the exporter gives a different key after a renegotiation, so keep
+     * it for handing the session over to another process */
+    session->tls_wrap_reneg.original_wrap_keydata = *key;
+}
 
+bool
+tls_session_generate_dynamic_tls_crypt_key(struct tls_multi *multi,
+                                           struct tls_session *session)
+{
     struct key2 rengokeys;
     if (!key_state_export_keying_material(session, EXPORT_DYNAMIC_TLS_CRYPT_LABEL,
                                           strlen(EXPORT_DYNAMIC_TLS_CRYPT_LABEL),
@@ -125,22 +145,12 @@ tls_session_generate_dynamic_tls_crypt_key(struct tls_multi *multi,
         xor_key2(&rengokeys, &session->tls_wrap.original_wrap_keydata);
     }
 
-    const int key_direction = session->opt->server ?
-                              KEY_DIRECTION_NORMAL : KEY_DIRECTION_INVERSE;
-
-    struct key_direction_state kds;
-    key_direction_state_init(&kds, key_direction);
-
-    struct key_type kt = tls_crypt_kt();
-
-    init_key_ctx_bi(&session->tls_wrap_reneg.opt.key_ctx_bi, &rengokeys, key_direction,
-                    &kt, "dynamic tls-crypt");
+    tls_session_load_dynamic_tls_crypt_key(session, &rengokeys);
     secure_memzero(&rengokeys, sizeof(rengokeys));
 
     return true;
 }
 
-
 bool
 tls_crypt_wrap(const struct buffer *src, struct buffer *dst,
                struct crypto_options *opt)
@@ -550,6 +560,110 @@ error_exit:
     return ret;
 }
 
+/** Number of verdicts in the verify cache, must be a power of two */
+#define TLS_CRYPT_V2_VERIFY_CACHE_SIZE 1024
+
+/** Seconds that the verdict of a script run through the script queue is
+ * kept at least, so that the retransmission of the client finds it */
+#define TLS_CRYPT_V2_VERIFY_KEEP 60
+
+struct tls_crypt_v2_verify_entry
+{
+    uint8_t digest[SHA256_DIGEST_LENGTH]; /**< of the metadata, with type */
+    time_t expires;             /**< 0 if the entry holds no verdict */
+    bool ok;
+    char *status_file;          /**< set while the script is running */
+};
+
+struct tls_crypt_v2_verify_cache
+{
+    int ttl;
+    struct script_queue *script_queue;
+    struct tls_crypt_v2_verify_entry entries[TLS_CRYPT_V2_VERIFY_CACHE_SIZE];
+};
+
+struct tls_crypt_v2_verify_cache *
+tls_crypt_v2_verify_cache_new(int ttl)
+{
+    struct tls_crypt_v2_verify_cache *cache;
+    ALLOC_OBJ_CLEAR(cache, struct tls_crypt_v2_verify_cache);
+    cache->ttl = ttl;
+    return cache;
+}
+
+static void
+tls_crypt_v2_verify_entry_clear(struct tls_crypt_v2_verify_entry *e)
+{
+    if (e->status_file)
+    {
+        platform_unlink(e->status_file);
+        free(e->status_file);
+    }
+    CLEAR(*e);
+}
+
+void
+tls_crypt_v2_verify_cache_free(struct tls_crypt_v2_verify_cache *cache)
+{
+    if (cache)
+    {
+        for (int i = 0; i < TLS_CRYPT_V2_VERIFY_CACHE_SIZE; ++i)
+        {
+            tls_crypt_v2_verify_entry_clear(&cache->entries[i]);
+        }
+        free(cache);
+    }
+}
+
+void
+tls_crypt_v2_verify_cache_set_queue(struct tls_crypt_v2_verify_cache *cache,
+                                    struct script_queue *sq)
+{
+    cache->script_queue = sq;
+}
+
+/*
+ * Return the entry for the metadata with digest, with the verdict of a
+ * script that has finished in the meantime filled in.  An entry without
+ * a verdict or script of its own is ready to take a new one.
+ */
+static struct tls_crypt_v2_verify_entry *
+tls_crypt_v2_verify_cache_get(struct tls_crypt_v2_verify_cache *cache,
+                              const uint8_t *digest)
+{
+    uint32_t slot;
+    memcpy(&slot, digest, sizeof(slot));
+    struct tls_crypt_v2_verify_entry *e =
+        &cache->entries[slot & (TLS_CRYPT_V2_VERIFY_CACHE_SIZE - 1)];
+
+    if (memcmp(e->digest, digest, sizeof(e->digest)) != 0
+        || (!e->status_file && now >= e->expires))
+    {
+        tls_crypt_v2_verify_entry_clear(e);
+        memcpy(e->digest, digest, sizeof(e->digest));
+    }
+    else if (e->status_file)
+    {
+        /* the script queue writes 1 or 0 to the file when the script is done */
+        FILE *fp = fopen(e->status_file, "r");
+        const int c = fp ? fgetc(fp) : EOF;
+        if (fp)
+        {
+            fclose(fp);
+        }
+
+        if (!fp || c == '0' || c == '1')
+        {
+            platform_unlink(e->status_file);
+            free(e->status_file);
+            e->status_file = NULL;
+            e->ok = c == '1';
+            e->expires = fp ? now + max_int(cache->ttl, TLS_CRYPT_V2_VERIFY_KEEP) : 0;
+        }
+    }
+    return e;
+}
+
 static bool
 tls_crypt_v2_verify_metadata(const struct tls_wrap_ctx *ctx,
                              const struct tls_options *opt)
@@ -557,19 +671,32 @@ tls_crypt_v2_verify_metadata(const struct tls_wrap_ctx *ctx,
     bool ret = false;
     struct gc_arena gc = gc_new();
     const char *tmp_file = NULL;
+    struct tls_crypt_v2_verify_cache *cache = opt->tls_crypt_v2_verify_cache;
+    struct tls_crypt_v2_verify_entry *e = NULL;
     struct buffer metadata = ctx->tls_crypt_v2_metadata;
-    int metadata_type = buf_read_u8(&metadata);
-    if (metadata_type < 0)
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+
+    if (cache && md_full("SHA256", BPTR(&metadata), BLEN(&metadata), digest))
     {
-        msg(M_WARN, "ERROR: no metadata type");
-        goto cleanup;
+        e = tls_crypt_v2_verify_cache_get(cache, digest);
+        if (e->status_file)
+        {
+            msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT PENDING");
+            goto cleanup;
+        }
+        if (e->expires)
+        {
+            ret = e->ok;
+            msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT %s (cached)",
+                ret ? "OK" : "ERROR");
+            goto cleanup;
+        }
     }
 
-    tmp_file = platform_create_temp_file(opt->tmp_dir, "tls_crypt_v2_metadata_",
-                                         &gc);
-    if (!tmp_file || !buffer_write_file(tmp_file, &metadata))
+    int metadata_type = buf_read_u8(&metadata);
+    if (metadata_type < 0)
     {
-        msg(M_WARN, "ERROR: could not write metadata to file");
+        msg(M_WARN, "ERROR: no metadata type");
         goto cleanup;
     }
 
@@ -579,34 +706,184 @@ tls_crypt_v2_verify_metadata(const struct tls_wrap_ctx *ctx,
     struct env_set *es = env_set_create(NULL);
     setenv_str(es, "script_type", "tls-crypt-v2-verify");
     setenv_str(es, "metadata_type", metadata_type_str);
-    setenv_str(es, "metadata_file", tmp_file);
+
+    if (opt->tls_crypt_v2_verify_via_env)
+    {
+        char *metadata_base64 = NULL;
+        if (openvpn_base64_encode(BPTR(&metadata), BLEN(&metadata),
+                                  &metadata_base64) < 0)
+        {
+            msg(M_WARN, "ERROR: could not encode metadata");
+            env_set_destroy(es);
+            goto cleanup;
+        }
+        setenv_str(es, "metadata_base64", metadata_base64);
+        free(metadata_base64);
+    }
+    else
+    {
+        tmp_file = platform_create_temp_file(opt->tmp_dir, "tls_crypt_v2_metadata_",
+                                             &gc);
+        if (!tmp_file || !buffer_write_file(tmp_file, &metadata))
+        {
+            msg(M_WARN, "ERROR: could not write metadata to file");
+            env_set_destroy(es);
+            goto cleanup;
+        }
+        setenv_str(es, "metadata_file", tmp_file);
+    }
 
     struct argv argv = argv_new();
     argv_parse_cmd(&argv, opt->tls_crypt_v2_verify_script);
     argv_msg_prefix(D_TLS_DEBUG, &argv, "Executing tls-crypt-v2-verify");
 
-    ret = openvpn_run_script(&argv, es, 0, "--tls-crypt-v2-verify");
+    /* the metadata file would have to outlive a queued script */
+    const char *status_file = NULL;
+    if (e && cache->script_queue && !tmp_file)
+    {
+        status_file = platform_create_temp_file(opt->tmp_dir,
+                                                 "tls_crypt_v2_verify_", &gc);
+    }
+
+    if (status_file)
+    {
+        /* this packet is dropped, the verdict is there for the one
+         * that the client sends again */
+        if (script_queue_add(cache->script_queue, &argv, es, NULL, status_file,
+                             "--tls-crypt-v2-verify"))
+        {
+            e->status_file = string_alloc(status_file, NULL);
+            msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT PENDING");
+        }
+        else
+        {
+            platform_unlink(status_file);
+            msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT ERROR");
+        }
+    }
+    else
+    {
+        ret = openvpn_run_script(&argv, es, 0, "--tls-crypt-v2-verify");
+        if (e && cache->ttl)
+        {
+            e->ok = ret;
+            e->expires = now + cache->ttl;
+        }
+        msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT %s", ret ? "OK" : "ERROR");
+    }
 
     argv_free(&argv);
     env_set_destroy(es);
 
-    if (!platform_unlink(tmp_file))
+    if (tmp_file && !platform_unlink(tmp_file))
     {
         msg(M_WARN, "WARNING: failed to remove temp file '%s", tmp_file);
     }
 
-    if (ret)
+cleanup:
+    gc_free(&gc);
+    return ret;
+}
+
+/** Number of entries in the WKc cache, must be a power of two */
+#define TLS_CRYPT_V2_WKC_CACHE_SIZE 16
+
+struct tls_crypt_v2_wkc_cache_entry
+{
+    uint16_t wkc_len;
+    uint16_t metadata_len;
+    uint8_t wkc[TLS_CRYPT_V2_MAX_WKC_LEN];
+    uint8_t metadata[TLS_CRYPT_V2_MAX_METADATA_LEN];
+    struct key2 client_key;
+};
+
+struct tls_crypt_v2_wkc_cache
+{
+    struct tls_crypt_v2_wkc_cache_entry entries[TLS_CRYPT_V2_WKC_CACHE_SIZE];
+};
+
+struct tls_crypt_v2_wkc_cache *
+tls_crypt_v2_wkc_cache_new(void)
+{
+    struct tls_crypt_v2_wkc_cache *cache;
+    ALLOC_OBJ_CLEAR(cache, struct tls_crypt_v2_wkc_cache);
+    return cache;
+}
+
+void
+tls_crypt_v2_wkc_cache_free(struct tls_crypt_v2_wkc_cache *cache)
+{
+    if (cache)
     {
-        msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT OK");
+        secure_memzero(cache, sizeof(*cache));
+        free(cache);
     }
-    else
+}
+
+/*
+ * The WKc starts with its authentication tag, so its first byte is as
+ * good as a hash to pick the slot.  A hit requires the whole WKc to
+ * match one that has been authenticated before.
+ */
+static struct tls_crypt_v2_wkc_cache_entry *
+tls_crypt_v2_wkc_cache_slot(struct tls_crypt_v2_wkc_cache *cache,
+                            const struct buffer *wkc)
+{
+    return &cache->entries[*BPTR(wkc) & (TLS_CRYPT_V2_WKC_CACHE_SIZE - 1)];
+}
+
+static bool
+tls_crypt_v2_wkc_cache_get(struct tls_crypt_v2_wkc_cache *cache,
+                           const struct buffer *wkc,
+                           struct key2 *client_key,
+                           struct buffer *metadata)
+{
+    if (!cache || BLEN(wkc) < 1 || BLEN(wkc) > TLS_CRYPT_V2_MAX_WKC_LEN)
     {
-        msg(D_HANDSHAKE, "TLS CRYPT V2 VERIFY SCRIPT ERROR");
+        return false;
     }
 
-cleanup:
-    gc_free(&gc);
-    return ret;
+    const struct tls_crypt_v2_wkc_cache_entry *e =
+        tls_crypt_v2_wkc_cache_slot(cache, wkc);
+    if (e->wkc_len != BLEN(wkc) || memcmp(e->wkc, BPTR(wkc), e->wkc_len) != 0)
+    {
+        return false;
+    }
+
+    *client_key = e->client_key;
+    return buf_write(metadata, e->metadata, e->metadata_len);
+}
+
+static void
+tls_crypt_v2_wkc_cache_put(struct tls_crypt_v2_wkc_cache *cache,
+                           const struct buffer *wkc,
+                           const struct key2 *client_key,
+                           const struct buffer *metadata)
+{
+    if (!cache || BLEN(wkc) < 1 || BLEN(wkc) > TLS_CRYPT_V2_MAX_WKC_LEN
+        || BLEN(metadata) > TLS_CRYPT_V2_MAX_METADATA_LEN)
+    {
+        return;
+    }
+
+    struct tls_crypt_v2_wkc_cache_entry *e =
+        tls_crypt_v2_wkc_cache_slot(cache, wkc);
+    e->wkc_len = (uint16_t) BLEN(wkc);
+    memcpy(e->wkc, BPTR(wkc), e->wkc_len);
+    e->metadata_len = (uint16_t) BLEN(metadata);
+    memcpy(e->metadata, BPTR(metadata), e->metadata_len);
+    e->client_key = *client_key;
+}
+
+void
+tls_crypt_v2_use_client_key(struct tls_wrap_ctx *ctx)
+{
+    ctx->mode = TLS_WRAP_CRYPT;
+    ctx->cleanup_key_ctx = true;
+    ctx->opt.flags |= CO_PACKET_ID_LONG_FORM;
+    memset(&ctx->opt.key_ctx_bi, 0, sizeof(ctx->opt.key_ctx_bi));
+    tls_crypt_v2_load_client_key(&ctx->opt.key_ctx_bi,
+                                 &ctx->original_wrap_keydata, true);
 }
 
 bool
@@ -642,10 +919,24 @@ tls_crypt_v2_extract_client_key(struct buffer *buf,
     }
 
     ctx->tls_crypt_v2_metadata = alloc_buf(TLS_CRYPT_V2_MAX_METADATA_LEN);
-    if (!tls_crypt_v2_unwrap_client_key(&ctx->original_wrap_keydata,
-                                        &ctx->tls_crypt_v2_metadata,
-                                        wrapped_client_key,
-                                        &ctx->tls_crypt_v2_server_key))
+    if (tls_crypt_v2_wkc_cache_get(ctx->tls_crypt_v2_wkc_cache,
+                                   &wrapped_client_key,
+                                   &ctx->original_wrap_keydata,
+                                   &ctx->tls_crypt_v2_metadata))
+    {
+        dmsg(D_TLS_DEBUG_MED, "%s: using cached client key", __func__);
+    }
+    else if (tls_crypt_v2_unwrap_client_key(&ctx->original_wrap_keydata,
+                                            &ctx->tls_crypt_v2_metadata,
+                                            wrapped_client_key,
+                                            &ctx->tls_crypt_v2_server_key))
+    {
+        tls_crypt_v2_wkc_cache_put(ctx->tls_crypt_v2_wkc_cache,
+                                   &wrapped_client_key,
+                                   &ctx->original_wrap_keydata,
+                                   &ctx->tls_crypt_v2_metadata);
+    }
+    else
     {
         msg(D_TLS_ERRORS, "Can not unwrap tls-crypt-v2 client key");
         secure_memzero(&ctx->original_wrap_keydata, sizeof(ctx->original_wrap_keydata));
@@ -653,12 +944,7 @@ tls_crypt_v2_extract_client_key(struct buffer *buf,
     }
 
     /* Load the decrypted key */
-    ctx->mode = TLS_WRAP_CRYPT;
-    ctx->cleanup_key_ctx = true;
-    ctx->opt.flags |= CO_PACKET_ID_LONG_FORM;
-    memset(&ctx->opt.key_ctx_bi, 0, sizeof(ctx->opt.key_ctx_bi));
-    tls_crypt_v2_load_client_key(&ctx->opt.key_ctx_bi,
-                                 &ctx->original_wrap_keydata, true);
+    tls_crypt_v2_use_client_key(ctx);
 
     /* Remove client key from buffer so tls-crypt code can unwrap message */
     ASSERT(buf_inc_len(buf, -(BLEN(&wrapped_client_key))));
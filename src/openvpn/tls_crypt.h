@@ -130,6 +130,17 @@ bool
 tls_session_generate_dynamic_tls_crypt_key(struct tls_multi *multi,
                                            struct tls_session *session);
 
+/**
+ * Sets up the control channel wrapping of renegotiations with the given
+ * dynamic tls-crypt key, which is already xored with the original key.
+ *
+ * @param session   session whose \c tls_wrap_reneg is initialised
+ * @param key       the dynamic tls-crypt key
+ */
+void
+tls_session_load_dynamic_tls_crypt_key(struct tls_session *session,
+                                       const struct key2 *key);
+
 /**
  * Returns the maximum overhead (in bytes) added to the destination buffer by
  * tls_crypt_wrap().
@@ -199,6 +210,49 @@ void tls_crypt_v2_init_client_key(struct key_ctx_bi *key,
                                   struct buffer *wrapped_key_buf,
                                   const char *key_file, bool key_inline);
 
+/**
+ * Allocate a cache for recently unwrapped tls-crypt-v2 client keys.
+ * Clients resending their WKc (retransmits, the P_CONTROL_WKC_V1 after
+ * the cookie exchange, reconnects) then skip the unwrap, which is the
+ * most expensive part of processing an initial packet.
+ */
+struct tls_crypt_v2_wkc_cache *tls_crypt_v2_wkc_cache_new(void);
+
+/**
+ * Wipe and free a cache allocated by tls_crypt_v2_wkc_cache_new().
+ */
+void tls_crypt_v2_wkc_cache_free(struct tls_crypt_v2_wkc_cache *cache);
+
+struct script_queue;
+
+/**
+ * Allocate a cache for the verdicts of the --tls-crypt-v2-verify script,
+ * keyed by the digest of the metadata.  Verdicts are kept for ttl
+ * seconds, 0 to run the script for every connection.
+ */
+struct tls_crypt_v2_verify_cache *tls_crypt_v2_verify_cache_new(int ttl);
+
+/**
+ * Free a cache allocated by tls_crypt_v2_verify_cache_new(), removing
+ * the status files of scripts that are still running.
+ */
+void tls_crypt_v2_verify_cache_free(struct tls_crypt_v2_verify_cache *cache);
+
+/**
+ * Run the --tls-crypt-v2-verify script through sq from now on, without
+ * waiting for it.  The packet that started the script is dropped, the
+ * retransmission of the client uses the verdict.  NULL to go back to
+ * running the script synchronously.
+ */
+void tls_crypt_v2_verify_cache_set_queue(struct tls_crypt_v2_verify_cache *cache,
+                                         struct script_queue *sq);
+
+/**
+ * Load the tls-crypt-v2 client key stored in \c ctx->original_wrap_keydata
+ * into the tls wrap context of a server session.
+ */
+void tls_crypt_v2_use_client_key(struct tls_wrap_ctx *ctx);
+
 /**
  * Extract a tls-crypt-v2 client key from a P_CONTROL_HARD_RESET_CLIENT_V3
  * message, and load the key into the supplied tls wrap context.
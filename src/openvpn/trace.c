@@ -0,0 +1,121 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Binary event tracing of the data path into a memory-mapped ring
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#if defined(ENABLE_TRACE)
+
+#include <sys/mman.h>
+
+#include "error.h"
+#include "integer.h"
+#include "trace.h"
+
+#include "memdbg.h"
+
+static_assert(sizeof(struct trace_event) == 24, "struct trace_event layout changed");
+
+volatile struct trace_ring *trace_ring = NULL; /* GLOBAL */
+static size_t trace_ring_len; /* GLOBAL */
+
+void
+trace_open(const char *fn, unsigned int size)
+{
+    unsigned int n = 1;
+    void *data;
+    int fd;
+
+    if (trace_ring) /* already called? */
+    {
+        return;
+    }
+
+    /* round up to a power of 2, so that the ring index is a mask */
+    while (n < size && n < (1u << 24))
+    {
+        n <<= 1;
+    }
+    trace_ring_len = sizeof(struct trace_ring) + (size_t) n * sizeof(struct trace_event);
+
+    /* create a zeroed file of the right size that will be memory mapped */
+    fd = open(fn, O_CREAT | O_TRUNC | O_RDWR, S_IRUSR | S_IWUSR);
+    if (fd < 0)
+    {
+        msg(M_ERR, "trace_open: cannot open: %s", fn);
+        return;
+    }
+    if (ftruncate(fd, (off_t) trace_ring_len))
+    {
+        msg(M_ERR, "trace_open: cannot resize: %s", fn);
+        close(fd);
+        return;
+    }
+
+    data = mmap(NULL, trace_ring_len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED)
+    {
+        msg(M_ERR, "trace_open: cannot map: %s", fn);
+        close(fd);
+        return;
+    }
+
+    /* close the fd (mmap now controls the file) */
+    if (close(fd))
+    {
+        msg(M_ERR, "trace_open: close error: %s", fn);
+    }
+
+    trace_ring = (struct trace_ring *) data;
+    trace_ring->magic = TRACE_MAGIC;
+    trace_ring->version = TRACE_VERSION;
+    trace_ring->event_size = sizeof(struct trace_event);
+    trace_ring->size = n;
+    trace_ring->enabled = 1;
+
+    msg(M_INFO, "trace events will be written to %s (%u events)", fn, n);
+}
+
+void
+trace_close(void)
+{
+    if (trace_ring)
+    {
+        /* keep the file, the events are what is left to look at */
+        trace_ring->enabled = 0;
+        if (munmap((void *) trace_ring, trace_ring_len))
+        {
+            msg(M_WARN | M_ERRNO, "trace_close: munmap error");
+        }
+        trace_ring = NULL;
+    }
+}
+
+#endif /* if defined(ENABLE_TRACE) */
@@ -0,0 +1,110 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Binary event tracing of the data path into a memory-mapped ring
+ */
+
+#ifndef OPENVPN_TRACE_H
+#define OPENVPN_TRACE_H
+
+#include "basic.h"
+#include "otime.h"
+
+/* struct trace_event.type */
+#define TRACE_LINK_IN   1       /* len: packet read from the TCP/UDP socket */
+#define TRACE_LINK_OUT  2       /* len: bytes written to the socket, or -1 */
+#define TRACE_TUN_IN    3       /* len: packet read from the tun device */
+#define TRACE_TUN_OUT   4       /* len: bytes written to the tun device, or -1 */
+#define TRACE_DECRYPT   5       /* len: plaintext length, arg: 1 if authenticated */
+#define TRACE_DROP      6       /* flags: TRACE_DROP_x, arg: output queue depth */
+
+#define TRACE_DROP_SHAPER  1    /* client output held by --shaper-total */
+#define TRACE_DROP_QUEUE   2    /* client output queue full */
+
+/* struct trace_event.peer of events that belong to no client */
+#define TRACE_PEER_NONE 0xFFFFFFFF
+
+/* one event, 24 bytes */
+struct trace_event {
+    uint64_t usec;              /* usec since the epoch, see tv_now() */
+    uint32_t peer;              /* peer-id of the client */
+    uint16_t type;              /* TRACE_x */
+    uint16_t flags;
+    int32_t len;
+    uint32_t arg;
+};
+
+/* this struct is mapped to the file, followed by the events */
+struct trace_ring {
+#define TRACE_MAGIC 0x5254564F  /* "OVTR" little endian */
+    uint32_t magic;
+#define TRACE_VERSION 1
+    uint16_t version;
+    uint16_t event_size;
+    uint32_t size;              /* number of events, a power of 2 */
+    uint32_t enabled;           /* may be flipped by the reader */
+    uint64_t head;              /* events recorded since the start */
+    struct trace_event events[];
+};
+
+#ifdef ENABLE_TRACE
+
+extern volatile struct trace_ring *trace_ring; /* GLOBAL */
+
+void trace_open(const char *fn, unsigned int size);
+
+void trace_close(void);
+
+/*
+ * Record an event.  Costs a test of one flag if tracing is off; never
+ * allocates or formats anything.
+ */
+static inline void
+trace_event(unsigned int type, uint32_t peer, int len, unsigned int flags, uint32_t arg)
+{
+    if (trace_ring && trace_ring->enabled)
+    {
+        const uint64_t head = trace_ring->head;
+        volatile struct trace_event *e = &trace_ring->events[head & (trace_ring->size - 1)];
+
+        e->usec = (uint64_t) now * 1000000 + now_usec;
+        e->peer = peer;
+        e->type = (uint16_t) type;
+        e->flags = (uint16_t) flags;
+        e->len = len;
+        e->arg = arg;
+        trace_ring->head = head + 1;
+    }
+}
+
+#else  /* ifdef ENABLE_TRACE */
+
+static inline void
+trace_event(unsigned int type, uint32_t peer, int len, unsigned int flags, uint32_t arg)
+{
+}
+
+#endif /* ifdef ENABLE_TRACE */
+
+#endif /* ifndef OPENVPN_TRACE_H */
@@ -2172,6 +2172,28 @@ read_tun(struct tuntap *tt, uint8_t *buf, int len)
 #error header file linux/sockios.h required
 #endif
 
+/*
+ * Header prepended to every packet on IFF_VNET_HDR devices, this is
+ * struct virtio_net_hdr from <linux/virtio_net.h> in host byte order.
+ */
+struct tun_vnet_hdr
+{
+#define TUN_VNET_HDR_F_NEEDS_CSUM 1
+    uint8_t flags;
+#define TUN_VNET_HDR_GSO_NONE  0
+#define TUN_VNET_HDR_GSO_TCPV4 1
+#define TUN_VNET_HDR_GSO_TCPV6 4
+#define TUN_VNET_HDR_GSO_ECN   0x80
+    uint8_t gso_type;
+    uint16_t hdr_len;
+    uint16_t gso_size;
+    uint16_t csum_start;
+    uint16_t csum_offset;
+};
+
+/* vnet header plus the largest TSO packet the kernel builds */
+#define TUN_OFFLOAD_BUF_SIZE (sizeof(struct tun_vnet_hdr) + 65535)
+
 #if !PEDANTIC
 
 void
@@ -2237,6 +2259,24 @@ open_tun(const char *dev, const char *dev_type, const char *dev_node, struct tun
                 dev);
         }
 
+        if (tt->options.queues > 1)
+        {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+
+        if (tt->options.offload)
+        {
+            if (tt->type == DEV_TYPE_TUN)
+            {
+                ifr.ifr_flags |= IFF_VNET_HDR;
+                tt->vnet_hdr = true;
+            }
+            else
+            {
+                msg(M_WARN, "NOTE: --tun-offload is only supported with --dev-type tun, ignoring");
+            }
+        }
+
         /*
          * Set an explicit name, if --dev is not tun or tap
          */
@@ -2256,6 +2296,53 @@ open_tun(const char *dev, const char *dev_type, const char *dev_node, struct tun
 
         msg(M_INFO, "TUN/TAP device %s opened", ifr.ifr_name);
 
+        /*
+         * Attach the additional queues of --tun-queues, ifr_name now
+         * holds the actual device name
+         */
+        tt->queue_fd[0] = tt->fd;
+        tt->n_queues = 1;
+        while (tt->n_queues < tt->options.queues)
+        {
+            const int fd = open(node, O_RDWR);
+
+            if (fd < 0)
+            {
+                msg(M_ERR, "ERROR: Cannot open TUN/TAP dev %s", node);
+            }
+            if (ioctl(fd, TUNSETIFF, (void *) &ifr) < 0)
+            {
+                msg(M_ERR, "ERROR: Cannot attach queue %d to TUN/TAP device %s",
+                    tt->n_queues, ifr.ifr_name);
+            }
+            set_nonblock(fd);
+            set_cloexec(fd);
+            tt->queue_fd[tt->n_queues++] = fd;
+        }
+        if (tt->n_queues > 1)
+        {
+            msg(M_INFO, "TUN/TAP device %s: using %d queues", ifr.ifr_name,
+                tt->n_queues);
+        }
+
+        /*
+         * Let the kernel hand us TCP super-packets and packets without
+         * a checksum, read_tun() segments them and fills in checksums
+         */
+        if (tt->vnet_hdr)
+        {
+            if (ioctl(tt->fd, TUNSETOFFLOAD, TUN_F_CSUM | TUN_F_TSO4 | TUN_F_TSO6) < 0)
+            {
+                msg(M_WARN | M_ERRNO, "Note: Cannot enable TSO offload on %s", ifr.ifr_name);
+            }
+            else
+            {
+                msg(M_INFO, "TUN/TAP device %s: TSO offload enabled", ifr.ifr_name);
+            }
+            tt->offload.buf = malloc(TUN_OFFLOAD_BUF_SIZE);
+            check_malloc_return(tt->offload.buf);
+        }
+
         /*
          * Try making the TX send queue bigger
          */
@@ -2372,6 +2459,12 @@ close_tun(struct tuntap *tt, openvpn_net_ctx_t *ctx)
         close_tun_dco(tt, ctx);
     }
 #endif
+    /* queue_fd[0] is closed as tt->fd */
+    for (int i = 1; i < tt->n_queues; ++i)
+    {
+        close(tt->queue_fd[i]);
+    }
+    free(tt->offload.buf);
     close_tun_generic(tt);
     free(tt);
 }
@@ -2379,13 +2472,270 @@ close_tun(struct tuntap *tt, openvpn_net_ctx_t *ctx)
 int
 write_tun(struct tuntap *tt, uint8_t *buf, int len)
 {
+    if (tt->vnet_hdr)
+    {
+        /* all-zero header: a single packet with a complete checksum */
+        struct tun_vnet_hdr hdr;
+        struct iovec iov[2];
+        int status;
+
+        CLEAR(hdr);
+        iov[0].iov_base = &hdr;
+        iov[0].iov_len = sizeof(hdr);
+        iov[1].iov_base = buf;
+        iov[1].iov_len = len;
+        status = writev(tt->fd, iov, 2);
+        return status > 0 ? status - (int) sizeof(hdr) : status;
+    }
     return write(tt->fd, buf, len);
 }
 
+/* reads from one queue before the others get a turn */
+#define TUN_QUEUE_READ_BURST 16
+
+static int
+read_tun_queues(struct tuntap *tt, uint8_t *buf, int len)
+{
+    if (tt->n_queues <= 1)
+    {
+        return read(tt->fd, buf, len);
+    }
+
+    /*
+     * The kernel spreads packets over the queues by flow, so stay on the
+     * queue that had data last, but move on after a burst so that no
+     * queue starves.  Empty queues only cost a failed read when the
+     * busy flows change.
+     */
+    if (tt->read_burst >= TUN_QUEUE_READ_BURST)
+    {
+        tt->read_queue = (tt->read_queue + 1) % tt->n_queues;
+        tt->read_burst = 0;
+    }
+
+    for (int i = 0; i < tt->n_queues; ++i)
+    {
+        const int q = (tt->read_queue + i) % tt->n_queues;
+        const int status = read(tt->queue_fd[q], buf, len);
+
+        if (status >= 0 || errno != EAGAIN)
+        {
+            if (q != tt->read_queue)
+            {
+                tt->read_queue = q;
+                tt->read_burst = 0;
+            }
+            tt->read_burst++;
+            return status;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Complete the checksum of a packet the kernel marked with
+ * TUN_VNET_HDR_F_NEEDS_CSUM.  Only TCP and UDP are offered to us.
+ */
+static bool
+tun_offload_csum(uint8_t *pkt, int len, int start, int offset)
+{
+    const int ver = OPENVPN_IPH_GET_VER(*pkt);
+    uint16_t *check = (uint16_t *) (pkt + start + offset);
+    int proto;
+    uint16_t sum;
+
+    if (offset == offsetof(struct openvpn_tcphdr, check))
+    {
+        proto = OPENVPN_IPPROTO_TCP;
+    }
+    else if (offset == offsetof(struct openvpn_udphdr, check))
+    {
+        proto = OPENVPN_IPPROTO_UDP;
+    }
+    else
+    {
+        return false;
+    }
+    if (start + offset + (int) sizeof(*check) > len
+        || (ver == 4 && len < (int) sizeof(struct openvpn_iphdr))
+        || (ver == 6 && len < (int) sizeof(struct openvpn_ipv6hdr))
+        || (ver != 4 && ver != 6))
+    {
+        return false;
+    }
+
+    *check = 0;
+    if (ver == 4)
+    {
+        const struct openvpn_iphdr *ip = (const struct openvpn_iphdr *) pkt;
+        sum = ip_checksum(AF_INET, pkt + start, len - start,
+                          (const uint8_t *) &ip->saddr, (const uint8_t *) &ip->daddr, proto);
+    }
+    else
+    {
+        const struct openvpn_ipv6hdr *ip6 = (const struct openvpn_ipv6hdr *) pkt;
+        sum = ip_checksum(AF_INET6, pkt + start, len - start,
+                          (const uint8_t *) &ip6->saddr, (const uint8_t *) &ip6->daddr, proto);
+    }
+    if (proto == OPENVPN_IPPROTO_UDP && sum == 0)
+    {
+        sum = 0xFFFF;
+    }
+    *check = htons(sum);
+    return true;
+}
+
+/*
+ * Copy the next segment of the super-packet in tt->offload to buf,
+ * with the IP and TCP headers fixed up for it.
+ */
+static int
+tun_offload_segment(struct tuntap *tt, uint8_t *buf, int len)
+{
+    struct tun_offload *o = &tt->offload;
+    const int payload = min_int(o->gso_size, o->len - o->pos);
+    const int seglen = o->hdr_len + payload;
+    const bool last = o->pos + payload >= o->len;
+    struct openvpn_tcphdr *tcp = (struct openvpn_tcphdr *) (buf + o->l4);
+    uint16_t sum;
+
+    if (seglen > len)
+    {
+        msg(D_LOW, "TUN/TAP: offload segment of %d bytes does not fit, dropping packet", seglen);
+        o->len = 0;
+        return 0;
+    }
+
+    memcpy(buf, o->buf, o->hdr_len);
+    memcpy(buf + o->hdr_len, o->buf + o->pos, payload);
+
+    tcp->seq = htonl(ntohl(tcp->seq) + (uint32_t) (o->pos - o->hdr_len));
+    if (!last)
+    {
+        tcp->flags &= ~(OPENVPN_TCPH_FIN_MASK | OPENVPN_TCPH_PSH_MASK);
+    }
+    if (o->seg > 0)
+    {
+        tcp->flags &= ~OPENVPN_TCPH_CWR_MASK;
+    }
+    tcp->check = 0;
+
+    if (OPENVPN_IPH_GET_VER(*buf) == 4)
+    {
+        struct openvpn_iphdr *ip = (struct openvpn_iphdr *) buf;
+        int acc = 0;
+
+        /* incremental header checksum update, as in mss.c */
+        acc += ip->tot_len + ip->id;
+        ip->tot_len = htons(seglen);
+        ip->id = htons(ntohs(ip->id) + o->seg);
+        acc -= ip->tot_len + ip->id;
+        ADJUST_CHECKSUM(acc, ip->check);
+
+        sum = ip_checksum(AF_INET, (uint8_t *) tcp, seglen - o->l4,
+                          (const uint8_t *) &ip->saddr, (const uint8_t *) &ip->daddr,
+                          OPENVPN_IPPROTO_TCP);
+    }
+    else
+    {
+        struct openvpn_ipv6hdr *ip6 = (struct openvpn_ipv6hdr *) buf;
+
+        ip6->payload_len = htons(seglen - sizeof(struct openvpn_ipv6hdr));
+        sum = ip_checksum(AF_INET6, (uint8_t *) tcp, seglen - o->l4,
+                          (const uint8_t *) &ip6->saddr, (const uint8_t *) &ip6->daddr,
+                          OPENVPN_IPPROTO_TCP);
+    }
+    tcp->check = htons(sum);
+
+    o->pos += payload;
+    o->seg++;
+    if (last)
+    {
+        o->len = 0;
+    }
+    return seglen;
+}
+
+/*
+ * read_tun() for devices opened with IFF_VNET_HDR: strip the vnet
+ * header, complete partial checksums and split TSO super-packets.
+ */
+static int
+read_tun_offload(struct tuntap *tt, uint8_t *buf, int len)
+{
+    struct tun_offload *o = &tt->offload;
+    struct tun_vnet_hdr hdr;
+    uint8_t *pkt;
+    int plen;
+    int gso_type;
+
+    if (o->len > 0)
+    {
+        return tun_offload_segment(tt, buf, len);
+    }
+
+    plen = read_tun_queues(tt, o->buf, TUN_OFFLOAD_BUF_SIZE);
+    if (plen < (int) sizeof(hdr))
+    {
+        return plen < 0 ? plen : 0;
+    }
+    memcpy(&hdr, o->buf, sizeof(hdr));
+    pkt = o->buf + sizeof(hdr);
+    plen -= sizeof(hdr);
+    gso_type = hdr.gso_type & ~TUN_VNET_HDR_GSO_ECN;
+
+    if (gso_type == TUN_VNET_HDR_GSO_NONE)
+    {
+        if ((hdr.flags & TUN_VNET_HDR_F_NEEDS_CSUM)
+            && !tun_offload_csum(pkt, plen, hdr.csum_start, hdr.csum_offset))
+        {
+            msg(D_LOW, "TUN/TAP: cannot complete checksum, dropping packet");
+            return 0;
+        }
+        if (plen > len)
+        {
+            msg(D_LOW, "TUN/TAP: packet of %d bytes too large, dropping", plen);
+            return 0;
+        }
+        memcpy(buf, pkt, plen);
+        return plen;
+    }
+
+    if (gso_type == TUN_VNET_HDR_GSO_TCPV4 || gso_type == TUN_VNET_HDR_GSO_TCPV6)
+    {
+        const int l4 = hdr.csum_start;
+
+        if (l4 + (int) sizeof(struct openvpn_tcphdr) <= plen && hdr.gso_size > 0)
+        {
+            const struct openvpn_tcphdr *tcp = (const struct openvpn_tcphdr *) (pkt + l4);
+            const int hdr_len = l4 + OPENVPN_TCPH_GET_DOFF(tcp->doff_res);
+
+            if (hdr_len <= plen)
+            {
+                memmove(o->buf, pkt, plen);
+                o->len = plen;
+                o->l4 = l4;
+                o->hdr_len = hdr_len;
+                o->gso_size = hdr.gso_size;
+                o->pos = hdr_len;
+                o->seg = 0;
+                return tun_offload_segment(tt, buf, len);
+            }
+        }
+    }
+
+    msg(D_LOW, "TUN/TAP: unsupported offload packet (gso_type %d), dropping", hdr.gso_type);
+    return 0;
+}
+
 int
 read_tun(struct tuntap *tt, uint8_t *buf, int len)
 {
-    return read(tt->fd, buf, len);
+    if (tt->vnet_hdr)
+    {
+        return read_tun_offload(tt, buf, len);
+    }
+    return read_tun_queues(tt, buf, len);
 }
 
 #elif defined(TARGET_SOLARIS)
@@ -145,11 +145,31 @@ struct tuntap_options {
 
 #elif defined(TARGET_LINUX)
 
+/* upper bound for --tun-queues */
+#define TUN_QUEUES_MAX 16
+
 struct tuntap_options {
     int txqueuelen;
+    int queues;
+    bool offload;
     bool disable_dco;
 };
 
+/*
+ * --tun-offload: a TSO super-packet read from the device, handed out
+ * by read_tun() one segment at a time.
+ */
+struct tun_offload
+{
+    uint8_t *buf;               /* packet as read, after the vnet header */
+    int len;                    /* 0 if no segments are left */
+    int l4;                     /* offset of the TCP header */
+    int hdr_len;                /* IP and TCP header length */
+    int gso_size;               /* TCP payload per segment */
+    int pos;                    /* offset of the next segment's payload */
+    int seg;                    /* index of the next segment */
+};
+
 #elif defined(TARGET_FREEBSD)
 
 struct tuntap_options {
@@ -218,10 +238,23 @@ struct tuntap
     HANDLE wintun_receive_ring_handle;
     struct tun_ring *wintun_send_ring;
     struct tun_ring *wintun_receive_ring;
+    int wintun_receive_queued; /* packets written to the receive ring, but not yet signalled */
 #else  /* ifdef _WIN32 */
     int fd; /* file descriptor for TUN/TAP dev */
 #endif /* ifdef _WIN32 */
 
+#ifdef TARGET_LINUX
+    /* IFF_MULTI_QUEUE queues opened for --tun-queues, queue_fd[0] == fd */
+    int n_queues;
+    int queue_fd[TUN_QUEUES_MAX];
+    int read_queue;             /* queue read from last */
+    int read_burst;             /* consecutive reads from read_queue */
+
+    /* device was opened with IFF_VNET_HDR for --tun-offload */
+    bool vnet_hdr;
+    struct tun_offload offload;
+#endif
+
 #ifdef TARGET_SOLARIS
     int ip_fd;
 #endif
@@ -594,6 +627,35 @@ is_ip_packet_valid(const struct buffer *buf)
     return true;
 }
 
+/*
+ * Packets written to the wintun receive ring are only signalled to the
+ * driver when the event loop runs out of work, or after this many.
+ */
+#define WINTUN_RECEIVE_BATCH 32
+
+static inline bool
+wintun_receive_pending(const struct tuntap *tt)
+{
+    return tt && tt->wintun_receive_queued > 0;
+}
+
+/**
+ * Wake up the wintun driver, if it is waiting for packets, after
+ * packets were written to the receive ring.
+ */
+static inline void
+wintun_receive_flush(struct tuntap *tt)
+{
+    if (wintun_receive_pending(tt))
+    {
+        tt->wintun_receive_queued = 0;
+        if (tt->wintun_receive_ring->alertable != 0)
+        {
+            SetEvent(tt->rw_handle.write);
+        }
+    }
+}
+
 static inline int
 write_wintun(struct tuntap *tt, struct buffer *buf)
 {
@@ -630,11 +692,11 @@ write_wintun(struct tuntap *tt, struct buffer *buf)
     packet->size = BLEN(buf);
     memcpy(packet->data, BPTR(buf), BLEN(buf));
 
-    /* move ring tail */
+    /* move ring tail, the driver is woken up once per batch */
     ring->tail = wintun_ring_wrap(tail + aligned_packet_size);
-    if (ring->alertable != 0)
+    if (++tt->wintun_receive_queued >= WINTUN_RECEIVE_BATCH)
     {
-        SetEvent(tt->rw_handle.write);
+        wintun_receive_flush(tt);
     }
 
     return BLEN(buf);
@@ -712,6 +774,33 @@ tuntap_is_dco_win_timeout(struct tuntap *tt, int status)
  * TUN/TAP I/O wait functions
  */
 
+/*
+ * Return true if read_tun() still has segments of a --tun-offload
+ * super-packet to hand out without reading from the device.
+ */
+static inline bool
+tun_read_residual(const struct tuntap *tt)
+{
+#ifdef TARGET_LINUX
+    return tt && tt->offload.len > 0;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Number of event set entries used by the TUN/TAP device.
+ */
+static inline int
+tun_event_count(const struct tuntap_options *o)
+{
+#ifdef TARGET_LINUX
+    return max_int(o->queues, 1);
+#else
+    return 1;
+#endif
+}
+
 static inline event_t
 tun_event_handle(const struct tuntap *tt)
 {
@@ -738,6 +827,13 @@ tun_set(struct tuntap *tt,
     if (!persistent || *persistent != rwflags)
     {
         event_ctl(es, tun_event_handle(tt), rwflags, arg);
+#ifdef TARGET_LINUX
+        /* writes always go to the first queue */
+        for (int i = 1; i < tt->n_queues; ++i)
+        {
+            event_ctl(es, tt->queue_fd[i], rwflags & EVENT_READ, arg);
+        }
+#endif
         if (persistent)
         {
             *persistent = rwflags;
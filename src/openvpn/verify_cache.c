@@ -0,0 +1,182 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "verify_cache.h"
+#include "crypto.h"
+#include "errlevel.h"
+
+#include "memdbg.h"
+
+static uint32_t
+verify_cache_hash_function(const void *key, uint32_t iv)
+{
+    const struct verify_cache_entry *e = key;
+    return hash_func_short(e->hash, sizeof(e->hash), iv ^ (uint32_t) e->depth);
+}
+
+static bool
+verify_cache_compare_function(const void *key1, const void *key2)
+{
+    const struct verify_cache_entry *e1 = key1;
+    const struct verify_cache_entry *e2 = key2;
+    return e1->depth == e2->depth && !memcmp(e1->hash, e2->hash, sizeof(e1->hash));
+}
+
+struct verify_cache *
+verify_cache_new(int max_entries, interval_t max_age)
+{
+    struct verify_cache *vc;
+
+    ASSERT(max_entries > 0);
+    ALLOC_OBJ_CLEAR(vc, struct verify_cache);
+    vc->hash = hash_init(max_entries, get_random(), verify_cache_hash_function,
+                         verify_cache_compare_function);
+    vc->max_entries = max_entries;
+    vc->max_age = max_age;
+    return vc;
+}
+
+void
+verify_cache_flush(struct verify_cache *vc)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+
+    hash_iterator_init(vc->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        free(he->value);
+        hash_iterator_delete_element(&hi);
+    }
+    hash_iterator_free(&hi);
+}
+
+void
+verify_cache_free(struct verify_cache *vc)
+{
+    if (vc)
+    {
+        verify_cache_flush(vc);
+        hash_free(vc->hash);
+        free(vc);
+    }
+}
+
+static struct verify_cache_entry *
+verify_cache_find(struct verify_cache *vc, const uint8_t *hash, int depth)
+{
+    struct verify_cache_entry key;
+
+    memcpy(key.hash, hash, sizeof(key.hash));
+    key.depth = depth;
+    return hash_lookup(vc->hash, &key);
+}
+
+bool
+verify_cache_lookup(struct verify_cache *vc, const uint8_t *hash, int depth)
+{
+    struct verify_cache_entry *e = verify_cache_find(vc, hash, depth);
+
+    if (!e)
+    {
+        return false;
+    }
+    if (now >= e->added + vc->max_age || now < e->added)
+    {
+        hash_remove(vc->hash, e);
+        free(e);
+        return false;
+    }
+    e->used = now;
+    return true;
+}
+
+/*
+ * Remove the least recently used entry.  This walks the whole table, but is
+ * only done for a new certificate while the cache is full.
+ */
+static void
+verify_cache_evict(struct verify_cache *vc)
+{
+    struct hash_iterator hi;
+    struct hash_element *he;
+    struct verify_cache_entry *oldest = NULL;
+
+    hash_iterator_init(vc->hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        struct verify_cache_entry *e = he->value;
+        if (!oldest || e->used < oldest->used)
+        {
+            oldest = e;
+        }
+    }
+    hash_iterator_free(&hi);
+
+    if (oldest)
+    {
+        hash_remove(vc->hash, oldest);
+        free(oldest);
+    }
+}
+
+void
+verify_cache_add(struct verify_cache *vc, const uint8_t *hash, int depth)
+{
+    struct verify_cache_entry *e = verify_cache_find(vc, hash, depth);
+
+    if (!e)
+    {
+        if (hash_n_elements(vc->hash) >= vc->max_entries)
+        {
+            verify_cache_evict(vc);
+        }
+        ALLOC_OBJ(e, struct verify_cache_entry);
+        memcpy(e->hash, hash, sizeof(e->hash));
+        e->depth = depth;
+        hash_add(vc->hash, e, e, false);
+    }
+    e->added = now;
+    e->used = now;
+}
+
+void
+verify_cache_check_crl(struct verify_cache *vc, time_t mtime, off_t size)
+{
+    if (vc->crl_mtime != mtime || vc->crl_size != size)
+    {
+        if (hash_n_elements(vc->hash))
+        {
+            msg(D_TLS_DEBUG_LOW, "CRL changed, flushing the certificate verification cache");
+        }
+        verify_cache_flush(vc);
+        vc->crl_mtime = mtime;
+        vc->crl_size = size;
+    }
+}
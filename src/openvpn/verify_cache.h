@@ -0,0 +1,97 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef VERIFY_CACHE_H
+#define VERIFY_CACHE_H
+
+/**
+ * @file
+ * Cache of certificates that passed the --tls-verify script and plug-ins.
+ *
+ * Renegotiations and reconnects present the same certificates again and
+ * again.  With --verify-cache, verify_cert() remembers the SHA256
+ * fingerprint and depth of each certificate that passed the expensive
+ * external checks, and skips those checks for the same certificate at the
+ * same depth until the entry expires.  The cache is flushed when the CRL
+ * file changes.
+ */
+
+#include "basic.h"
+#include "list.h"
+#include "otime.h"
+
+#define VERIFY_CACHE_HASH_LEN 32 /* SHA256 */
+
+/* long enough to cover two renegotiations with the default --reneg-sec */
+#define VERIFY_CACHE_MAX_AGE_DEFAULT 7200
+
+struct verify_cache_entry
+{
+    uint8_t hash[VERIFY_CACHE_HASH_LEN];
+    int depth;
+    time_t added;
+    time_t used;
+};
+
+struct verify_cache
+{
+    struct hash *hash;
+    int max_entries;
+    interval_t max_age;
+
+    /* stamp of the CRL file the entries were verified against */
+    time_t crl_mtime;
+    off_t crl_size;
+};
+
+/**
+ * Allocate a cache for up to max_entries certificates that are trusted for
+ * max_age seconds after their verification.
+ */
+struct verify_cache *verify_cache_new(int max_entries, interval_t max_age);
+
+void verify_cache_free(struct verify_cache *vc);
+
+/**
+ * Returns true if the certificate with the SHA256 fingerprint hash passed
+ * the verification at depth before, and the result has not expired yet.
+ */
+bool verify_cache_lookup(struct verify_cache *vc, const uint8_t *hash, int depth);
+
+/**
+ * Remember that the certificate with the SHA256 fingerprint hash passed
+ * the verification at depth.  If the cache is full, the least recently
+ * used entry is replaced.
+ */
+void verify_cache_add(struct verify_cache *vc, const uint8_t *hash, int depth);
+
+/** Forget all verification results. */
+void verify_cache_flush(struct verify_cache *vc);
+
+/**
+ * Flush the cache if the CRL file with the given modification time and
+ * size is not the one that the current entries were verified against.
+ */
+void verify_cache_check_crl(struct verify_cache *vc, time_t mtime, off_t size);
+
+#endif /* VERIFY_CACHE_H */
@@ -57,6 +57,20 @@ vlanhdr_set_vid(struct openvpn_8021qhdr *hdr, const uint16_t vid)
                        | (htons(vid) & OPENVPN_8021Q_MASK_VID);
 }
 
+/*
+ * Move the dst/src addresses of an ethernet header by the size of an
+ * 802.1q tag. The areas overlap, so go through a fixed size copy on the
+ * stack which the compiler turns into a few register moves.
+ */
+static inline void
+vlan_move_addrs(uint8_t *dst, const uint8_t *src)
+{
+    uint8_t addrs[2 * OPENVPN_ETH_ALEN];
+
+    memcpy(addrs, src, sizeof(addrs));
+    memcpy(dst, addrs, sizeof(addrs));
+}
+
 /*
  * vlan_decapsulate - remove 802.1q header and return VID
  *
@@ -153,18 +167,12 @@ vlan_decapsulate(const struct context *c, struct buffer *buf)
                 "removing vlan-tag from frame: vid: %u, wrapped proto/len: 0x%04x",
                 vid, ntohs(vlanhdr->proto));
 
-            /* save inner protocol to be restored later after decapsulation */
-            uint16_t proto = vlanhdr->proto;
-            /* move the buffer head forward to adjust the headroom to a
-             * non-tagged frame
+            /* move the buffer head forward over the tag, the inner
+             * protocol is then already in place and only the src/dst
+             * addresses have to follow
              */
             buf_advance(buf, SIZE_ETH_TO_8021Q_HDR);
-            /* move the content of the 802.1q header to the new head, so that
-             * src/dst addresses are copied over
-             */
-            ethhdr = memmove(BPTR(buf), vlanhdr, sizeof(*ethhdr));
-            /* restore the inner protocol value */
-            ethhdr->proto = proto;
+            vlan_move_addrs(BPTR(buf), vlanhdr->dest);
 
             return vid;
     }
@@ -229,17 +237,13 @@ vlan_encapsulate(const struct context *c, struct buffer *buf)
                                                          SIZE_ETH_TO_8021Q_HDR);
 
         /* Initialise VLAN/802.1q header.
-         * Move the Eth header so to keep dst/src addresses the same and then
-         * assign the other fields.
-         *
-         * Also, save the inner protocol first, so that it can be restored later
-         * after the memmove()
+         * The tag goes in the headroom in front of the inner protocol,
+         * which therefore stays where it is, only the dst/src addresses
+         * have to be moved in front of the tag.
          */
-        uint16_t proto = ethhdr->proto;
-        memmove(vlanhdr, ethhdr, sizeof(*ethhdr));
+        vlan_move_addrs(vlanhdr->dest, ethhdr->dest);
         vlanhdr->tpid = htons(OPENVPN_ETH_P_8021Q);
         vlanhdr->pcp_cfi_vid = 0;
-        vlanhdr->proto = proto;
     }
 
     /* set the VID corresponding to the current context (client) */
@@ -329,3 +333,61 @@ vlan_process_outgoing_tun(struct multi_context *m, struct multi_instance *mi)
         vlan_encapsulate(&mi->context, &mi->context.c2.to_tun);
     }
 }
+
+void
+vlan_index_init(struct multi_context *m, const struct options *o)
+{
+    if (o->vlan_tagging)
+    {
+        /* one list per 12-bit VID, also the reserved ones that may
+         * appear in frames read from the tap device */
+        ALLOC_ARRAY_CLEAR(m->vlan_members, struct multi_instance *, 4096);
+    }
+}
+
+void
+vlan_index_free(struct multi_context *m)
+{
+    free(m->vlan_members);
+    m->vlan_members = NULL;
+}
+
+void
+vlan_index_remove(struct multi_context *m, struct multi_instance *mi)
+{
+    if (mi->vlan_vid)
+    {
+        *mi->vlan_pprev = mi->vlan_next;
+        if (mi->vlan_next)
+        {
+            mi->vlan_next->vlan_pprev = mi->vlan_pprev;
+        }
+        mi->vlan_next = NULL;
+        mi->vlan_pprev = NULL;
+        mi->vlan_vid = 0;
+    }
+}
+
+void
+vlan_index_update(struct multi_context *m, struct multi_instance *mi)
+{
+    const uint16_t vid = mi->context.options.vlan_pvid;
+
+    if (!m->vlan_members || vid == mi->vlan_vid)
+    {
+        return;
+    }
+    ASSERT(vid <= OPENVPN_8021Q_MAX_VID);
+
+    vlan_index_remove(m, mi);
+
+    struct multi_instance **head = &m->vlan_members[vid];
+    mi->vlan_next = *head;
+    if (*head)
+    {
+        (*head)->vlan_pprev = &mi->vlan_next;
+    }
+    mi->vlan_pprev = head;
+    *head = mi;
+    mi->vlan_vid = vid;
+}
@@ -41,4 +41,24 @@ vlan_is_tagged(const struct buffer *buf);
 void
 vlan_process_outgoing_tun(struct multi_context *m, struct multi_instance *mi);
 
+/**
+ * Allocates the per-VLAN instance lists used by multi_bcast() if
+ * --vlan-tagging is enabled.
+ */
+void
+vlan_index_init(struct multi_context *m, const struct options *o);
+
+void
+vlan_index_free(struct multi_context *m);
+
+/**
+ * Puts \c mi on the list of its current PVID.  Has to be called whenever
+ * the PVID of an instance may have changed.
+ */
+void
+vlan_index_update(struct multi_context *m, struct multi_instance *mi);
+
+void
+vlan_index_remove(struct multi_context *m, struct multi_instance *mi);
+
 #endif /* VLAN_H */
@@ -35,6 +35,7 @@
 
 #ifdef HAVE_XKEY_PROVIDER
 
+#include <openssl/async.h>
 #include <openssl/provider.h>
 #include <openssl/params.h>
 #include <openssl/core_dispatch.h>
@@ -265,7 +266,33 @@ xkey_management_sign(void *unused, unsigned char *sig, size_t *siglen,
 
     if (management && bencret > 0)
     {
-        out_b64 = management_query_pk_sig(management, in_b64, alg_str);
+        ASYNC_JOB *job = ASYNC_get_current_job();
+        ASYNC_callback_fn wakeup = NULL;
+        void *wakeup_arg = NULL;
+
+        /* Inside an async job of a TLS object that can be woken up, let
+         * OpenVPN serve other clients while the signature is pending */
+        if (job && management_pk_sig_async_enabled(management)
+            && ASYNC_WAIT_CTX_get_callback(ASYNC_get_wait_ctx(job), &wakeup,
+                                           &wakeup_arg)
+            && wakeup)
+        {
+            unsigned int id = management_query_pk_sig_async(management, in_b64,
+                                                             alg_str, wakeup,
+                                                             wakeup_arg);
+            while (!management_pk_sig_async_result(management, id, &out_b64))
+            {
+                if (!ASYNC_pause_job())
+                {
+                    management_pk_sig_async_cancel(management, wakeup_arg);
+                    break;
+                }
+            }
+        }
+        else
+        {
+            out_b64 = management_query_pk_sig(management, in_b64, alg_str);
+        }
     }
     if (out_b64)
     {
@@ -735,6 +735,31 @@ out:
     return err;
 }
 
+static DWORD
+HandleRouteBatchMessage(route_batch_message_t *msg, route_batch_ack_message_t *ack,
+                        undo_lists_t *lists)
+{
+    int i;
+
+    for (i = 0; i < msg->count; i++)
+    {
+        const route_message_t *rt = &msg->routes[i];
+        if ((rt->header.type != msg_add_route && rt->header.type != msg_del_route)
+            || rt->header.size != sizeof(*rt))
+        {
+            return ERROR_MESSAGE_DATA;
+        }
+    }
+
+    for (i = 0; i < msg->count; i++)
+    {
+        ack->route_error[i] = HandleRouteMessage(&msg->routes[i], lists);
+    }
+    ack->count = msg->count;
+
+    return NO_ERROR;
+}
+
 
 static DWORD
 HandleFlushNeighborsMessage(flush_neighbors_message_t *msg)
@@ -1619,6 +1644,7 @@ HandleMessage(HANDLE pipe, HANDLE ovpn_proc,
         message_header_t header;
         address_message_t address;
         route_message_t route;
+        route_batch_message_t route_batch;
         flush_neighbors_message_t flush_neighbors;
         block_dns_message_t block_dns;
         dns_cfg_message_t dns;
@@ -1627,16 +1653,17 @@ HandleMessage(HANDLE pipe, HANDLE ovpn_proc,
         set_mtu_message_t mtu;
         wins_cfg_message_t wins;
     } msg;
-    ack_message_t ack = {
+    /* a plain ack_message_t, unless it answers a route batch */
+    route_batch_ack_message_t ack = {
         .header = {
             .type = msg_acknowledgement,
-            .size = sizeof(ack),
+            .size = sizeof(ack_message_t),
             .message_id = -1
         },
         .error_number = ERROR_MESSAGE_DATA
     };
 
-    read = ReadPipeAsync(pipe, &msg, bytes, count, events);
+    read = ReadPipeAsync(pipe, &msg, min(bytes, sizeof(msg)), count, events);
     if (read != bytes || read < sizeof(msg.header) || read != msg.header.size)
     {
         goto out;
@@ -1662,6 +1689,18 @@ HandleMessage(HANDLE pipe, HANDLE ovpn_proc,
             }
             break;
 
+        case msg_route_batch:
+            if (msg.header.size >= offsetof(route_batch_message_t, routes)
+                && msg.route_batch.count >= 0
+                && msg.route_batch.count <= ROUTE_BATCH_MAX
+                && msg.header.size == offsetof(route_batch_message_t, routes)
+                + msg.route_batch.count * sizeof(route_message_t))
+            {
+                ack.header.size = sizeof(ack);
+                ack.error_number = HandleRouteBatchMessage(&msg.route_batch, &ack, lists);
+            }
+            break;
+
         case msg_flush_neighbors:
             if (msg.header.size == sizeof(msg.flush_neighbors))
             {
@@ -1719,7 +1758,7 @@ HandleMessage(HANDLE pipe, HANDLE ovpn_proc,
     }
 
 out:
-    WritePipeAsync(pipe, &ack, sizeof(ack), count, events);
+    WritePipeAsync(pipe, &ack, (DWORD) ack.header.size, count, events);
 }
 
 
@@ -45,6 +45,8 @@
 #include <sys/socket.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <errno.h>
 #include <signal.h>
 #include <syslog.h>
 #include <limits.h>
@@ -126,8 +128,30 @@ struct user_pass {
     const struct name_value_list *name_value_list;
 };
 
+/*
+ * A deferred auth request waiting for a free worker.
+ */
+struct deferred_auth {
+    struct deferred_auth *next;
+    struct user_pass up;
+    char ac_file_name[PATH_MAX];
+};
+
+/*
+ * Deferred auth workers of the background process.  Each request is
+ * handled by its own child process, at most max_workers (0 = no limit)
+ * of them run at the same time, the others wait in a queue.
+ */
+struct deferred_workers {
+    int running;
+    int max_workers;
+    struct deferred_auth *head;
+    struct deferred_auth *tail;
+};
+
 /* Background process function */
-static void pam_server(int fd, const char *service, int verb, const struct name_value_list *name_value_list);
+static void pam_server(int fd, const char *service, int verb, int max_workers,
+                       const struct name_value_list *name_value_list);
 
 
 /*
@@ -364,6 +388,7 @@ openvpn_plugin_open_v3(const int v3structver,
 
     struct auth_pam_context *context;
     struct name_value_list name_value_list;
+    int max_workers = 0;
 
     const int base_parms = 2;
 
@@ -443,6 +468,21 @@ openvpn_plugin_open_v3(const int v3structver,
         }
     }
 
+    /*
+     * Limit of concurrent deferred authentications
+     */
+    {
+        const char *max_string = get_env("deferred_auth_pam_max", envp);
+        if (max_string)
+        {
+            max_workers = atoi(max_string);
+            if (max_workers < 0)
+            {
+                max_workers = 0;
+            }
+        }
+    }
+
     /*
      * Make a socket for foreground and background processes
      * to communicate.
@@ -506,7 +546,7 @@ openvpn_plugin_open_v3(const int v3structver,
 #endif
 
         /* execute the event loop */
-        pam_server(fd[1], argv[1], context->verb, &name_value_list);
+        pam_server(fd[1], argv[1], context->verb, max_workers, &name_value_list);
 
         close(fd[1]);
 
@@ -837,55 +877,80 @@ pam_auth(const char *service, const struct user_pass *up)
 }
 
 /*
- * deferred auth handler
- *   - fork() (twice, to avoid the need for async wait / SIGCHLD handling)
- *   - query PAM stack via pam_auth()
- *   - send response back to OpenVPN via "ac_file_name"
- *
- * parent process returns "0" for "fork() and wait() succeeded",
- *                        "-1" for "something went wrong, abort program"
+ * Written to by the SIGCHLD handler to wake up the event loop of the
+ * background process when a deferred auth worker has finished.
  */
+static int sigchld_pipe[2] = { -1, -1 };
 
 static void
-do_deferred_pam_auth(int fd, const char *ac_file_name,
-                     const char *service, const struct user_pass *up)
+sigchld_handler(int signum)
 {
-    if (send_control(fd, RESPONSE_DEFER) == -1)
+    const int saved_errno = errno;
+    const char c = 0;
+    if (write(sigchld_pipe[1], &c, 1) < 0)
     {
-        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: write error on response socket [4]");
-        return;
+        /* pipe full, the event loop will wake up anyway */
     }
+    errno = saved_errno;
+}
 
-    /* double forking so we do not need to wait() for async auth kids */
-    pid_t p1 = fork();
+/*
+ * Set up the wakeup pipe and the SIGCHLD handler.  SA_RESTART keeps
+ * the blocking reads on the command socket from failing with EINTR.
+ */
+static int
+deferred_workers_init(void)
+{
+    struct sigaction sa;
 
-    if (p1 < 0)
+    if (pipe(sigchld_pipe) == -1)
     {
-        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: fork(1) failed");
-        return;
+        return -1;
     }
-    if (p1 != 0)                           /* parent */
+    for (int i = 0; i < 2; ++i)
     {
-        waitpid(p1, NULL, 0);
-        return;                            /* parent's job succeeded */
+        fcntl(sigchld_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
     }
 
-    /* child */
-    close(fd);                              /* socketpair no longer needed */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    return sigaction(SIGCHLD, &sa, NULL);
+}
+
+/*
+ * deferred auth worker
+ *   - fork()
+ *   - query PAM stack via pam_auth() in the child
+ *   - send response back to OpenVPN via "ac_file_name"
+ *
+ * The child is reaped by the event loop of the background process.
+ */
+static void
+start_deferred_worker(int fd, struct deferred_workers *dw, const char *ac_file_name,
+                      const char *service, const struct user_pass *up)
+{
+    pid_t pid = fork();
 
-    pid_t p2 = fork();
-    if (p2 < 0)
+    if (pid < 0)
     {
-        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: fork(2) failed");
-        exit(1);
+        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: fork failed");
+        return;
     }
-
-    if (p2 != 0)                            /* new parent: exit right away */
+    if (pid != 0)                           /* parent */
     {
-        exit(0);
+        dw->running++;
+        return;
     }
 
-    /* grandchild */
+    /* child */
+    close(fd);                              /* socketpair no longer needed */
+    close(sigchld_pipe[0]);
+    close(sigchld_pipe[1]);
+    signal(SIGCHLD, SIG_DFL);
+
     plugin_log(PLOG_NOTE, MODULE, "BACKGROUND: deferred auth for '%s', pid=%d",
                up->username, (int) getpid() );
 
@@ -910,15 +975,137 @@ do_deferred_pam_auth(int fd, const char *ac_file_name,
     exit(0);
 }
 
+/*
+ * deferred auth handler
+ *   - tell the foreground that the result will come via "ac_file_name"
+ *   - start a worker, or queue the request if all workers are busy
+ */
+static void
+do_deferred_pam_auth(int fd, struct deferred_workers *dw, const char *ac_file_name,
+                     const char *service, const struct user_pass *up)
+{
+    if (send_control(fd, RESPONSE_DEFER) == -1)
+    {
+        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: write error on response socket [4]");
+        return;
+    }
+
+    if (dw->max_workers == 0 || dw->running < dw->max_workers)
+    {
+        start_deferred_worker(fd, dw, ac_file_name, service, up);
+        return;
+    }
+
+    struct deferred_auth *da = calloc(1, sizeof(*da));
+    if (!da)
+    {
+        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: cannot queue deferred auth");
+        return;
+    }
+    da->up = *up;
+    strncpy(da->ac_file_name, ac_file_name, sizeof(da->ac_file_name) - 1);
+    if (dw->tail)
+    {
+        dw->tail->next = da;
+    }
+    else
+    {
+        dw->head = da;
+    }
+    dw->tail = da;
+
+    if (DEBUG(up->verb))
+    {
+        plugin_log(PLOG_NOTE, MODULE, "BACKGROUND: %s: deferred auth queued, %d workers busy",
+                   up->username, dw->running);
+    }
+}
+
+/*
+ * Reap finished workers and start queued requests in their place.
+ */
+static void
+deferred_workers_run(int fd, struct deferred_workers *dw, const char *service)
+{
+    char buf[64];
+
+    while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0)
+    {
+    }
+    while (dw->running > 0 && waitpid(-1, NULL, WNOHANG) > 0)
+    {
+        dw->running--;
+    }
+
+    while (dw->head && dw->running < dw->max_workers)
+    {
+        struct deferred_auth *da = dw->head;
+        dw->head = da->next;
+        if (!dw->head)
+        {
+            dw->tail = NULL;
+        }
+        start_deferred_worker(fd, dw, da->ac_file_name, service, &da->up);
+        plugin_secure_memzero(da, sizeof(*da));
+        free(da);
+    }
+}
+
+static void
+deferred_workers_free(struct deferred_workers *dw)
+{
+    while (dw->head)
+    {
+        struct deferred_auth *da = dw->head;
+        dw->head = da->next;
+        plugin_secure_memzero(da, sizeof(*da));
+        free(da);
+    }
+    dw->tail = NULL;
+}
+
+/*
+ * Wait until the foreground sends a command, taking care of the
+ * deferred auth workers in the meantime.
+ */
+static int
+wait_for_command(int fd, struct deferred_workers *dw, const char *service)
+{
+    while (1)
+    {
+        struct pollfd pfd[2] = {
+            { .fd = fd, .events = POLLIN },
+            { .fd = sigchld_pipe[0], .events = POLLIN },
+        };
+
+        deferred_workers_run(fd, dw, service);
+
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return -1;
+        }
+        if (pfd[0].revents)
+        {
+            return 0;
+        }
+    }
+}
+
 /*
  * Background process -- runs with privilege.
  */
 static void
-pam_server(int fd, const char *service, int verb, const struct name_value_list *name_value_list)
+pam_server(int fd, const char *service, int verb, int max_workers,
+           const struct name_value_list *name_value_list)
 {
     struct user_pass up;
     char ac_file_name[PATH_MAX];
     int command;
+    struct deferred_workers dw = { .max_workers = max_workers };
 #ifdef USE_PAM_DLOPEN
     static const char pam_so[] = "libpam.so";
 #endif
@@ -943,6 +1130,13 @@ pam_server(int fd, const char *service, int verb, const struct name_value_list *
     }
 #endif
 
+    if (deferred_workers_init() == -1)
+    {
+        plugin_log(PLOG_ERR|PLOG_ERRNO, MODULE, "BACKGROUND: could not set up SIGCHLD handling");
+        send_control(fd, RESPONSE_INIT_FAILED);
+        goto done;
+    }
+
     /*
      * Tell foreground that we initialized successfully
      */
@@ -964,7 +1158,11 @@ pam_server(int fd, const char *service, int verb, const struct name_value_list *
         up.name_value_list = name_value_list;
 
         /* get a command from foreground process */
-        command = recv_control(fd);
+        command = -1;
+        if (wait_for_command(fd, &dw, service) == 0)
+        {
+            command = recv_control(fd);
+        }
 
         if (DEBUG(verb))
         {
@@ -1003,7 +1201,8 @@ pam_server(int fd, const char *service, int verb, const struct name_value_list *
                  */
                 if (strlen(ac_file_name) > 0)
                 {
-                    do_deferred_pam_auth(fd, ac_file_name, service, &up);
+                    do_deferred_pam_auth(fd, &dw, ac_file_name, service, &up);
+                    plugin_secure_memzero(up.password, sizeof(up.password));
                     break;
                 }
 
@@ -1047,6 +1246,7 @@ pam_server(int fd, const char *service, int verb, const struct name_value_list *
 done:
     plugin_secure_memzero(up.password, sizeof(up.password));
     plugin_secure_memzero(up.response, sizeof(up.response));
+    deferred_workers_free(&dw);
 #ifdef USE_PAM_DLOPEN
     dlclose_pam();
 #endif
@@ -0,0 +1,118 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <inttypes.h>
+
+#include "bench.h"
+
+volatile uintptr_t bench_sink;
+
+static uint64_t
+bench_now(void)
+{
+#if defined(CLOCK_MONOTONIC) && !defined(_WIN32)
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000000 + (uint64_t) tv.tv_usec * 1000;
+#endif
+}
+
+/*
+ * Double the iteration count until one run takes at least min_ns and
+ * report that run.
+ */
+static void
+bench_run(const struct bench_case *bc, uint64_t min_ns)
+{
+    uint64_t iterations = 1;
+    uint64_t elapsed;
+
+    while (true)
+    {
+        const uint64_t start = bench_now();
+        bc->run(iterations);
+        elapsed = bench_now() - start;
+
+        if (elapsed >= min_ns || iterations >= UINT64_MAX / 2)
+        {
+            break;
+        }
+        iterations *= 2;
+    }
+
+    printf("{\"name\": \"%s\", \"iterations\": %" PRIu64 ", "
+           "\"ns_per_op\": %.2f}\n",
+           bc->name, iterations, (double) elapsed / (double) iterations);
+    fflush(stdout);
+}
+
+int
+bench_main(int argc, char *argv[], const struct bench_case *cases,
+           size_t n_cases)
+{
+    uint64_t min_ns = 200 * 1000000;
+    const char *env = getenv("BENCH_MIN_TIME_MS");
+
+    if (env && atoi(env) > 0)
+    {
+        min_ns = (uint64_t) atoi(env) * 1000000;
+    }
+
+    if (argc < 2)
+    {
+        for (size_t i = 0; i < n_cases; i++)
+        {
+            bench_run(&cases[i], min_ns);
+        }
+        return 0;
+    }
+
+    for (int a = 1; a < argc; a++)
+    {
+        size_t i;
+        for (i = 0; i < n_cases; i++)
+        {
+            if (!strcmp(argv[a], cases[i].name))
+            {
+                bench_run(&cases[i], min_ns);
+                break;
+            }
+        }
+        if (i == n_cases)
+        {
+            fprintf(stderr, "unknown benchmark: %s\n", argv[a]);
+            return 1;
+        }
+    }
+    return 0;
+}
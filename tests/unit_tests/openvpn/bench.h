@@ -0,0 +1,58 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * One benchmark of a bench_* driver.  \c run has to execute the measured
+ * operation \c iterations times.
+ */
+struct bench_case
+{
+    const char *name;
+    void (*run)(uint64_t iterations);
+};
+
+/**
+ * Results that the benchmarks write here are never optimised away.
+ */
+extern volatile uintptr_t bench_sink;
+
+/**
+ * Runs the benchmarks of a driver and prints one JSON object per line
+ * with the name, the number of iterations and the time per iteration.
+ *
+ * Without arguments all benchmarks are run, otherwise only the named ones.
+ * The minimum run time per benchmark defaults to 200 ms and can be
+ * changed with the BENCH_MIN_TIME_MS environment variable.
+ *
+ * @return  0 on success, 1 if an unknown benchmark was requested
+ */
+int bench_main(int argc, char *argv[], const struct bench_case *cases,
+               size_t n_cases);
+
+#endif /* BENCH_H */
@@ -0,0 +1,274 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "buffer.h"
+#include "list.h"
+#include "mroute.h"
+#include "mss.h"
+#include "proto.h"
+#include "schedule.h"
+
+#include "bench.h"
+#include "mock_msg.h"
+
+/* Dummy functions to get the linker happy, only used by the mroute
+ * print functions that are not benchmarked */
+const char *
+print_in_addr_t(in_addr_t addr, unsigned int flags, struct gc_arena *gc)
+{
+    return "dummy print_in_addr_t from bench";
+}
+
+const char *
+print_in6_addr(struct in6_addr a6, unsigned int flags, struct gc_arena *gc)
+{
+    return "dummy print_in6_addr from bench";
+}
+
+#define BENCH_N_ADDRS 1024
+
+/* IPv4 TCP SYN from 10.8.0.6 to 192.168.1.1 with an MSS option of 1460 */
+static const uint8_t ipv4_tcp_syn[] = {
+    0x45, 0x00, 0x00, 0x2c, 0x00, 0x01, 0x00, 0x00,
+    0x40, 0x06, 0x00, 0x00, 0x0a, 0x08, 0x00, 0x06,
+    0xc0, 0xa8, 0x01, 0x01, 0x9c, 0x40, 0x00, 0x50,
+    0x00, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00,
+    0x60, 0x02, 0xfa, 0xf0, 0x00, 0x00, 0x00, 0x00,
+    0x02, 0x04, 0x05, 0xb4
+};
+
+/* IPv6 UDP header from fd00::1000 to fd00::1 */
+static const uint8_t ipv6_udp[] = {
+    0x60, 0x00, 0x00, 0x00, 0x00, 0x08, 0x11, 0x40,
+    0xfd, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+    0xfd, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01,
+    0x04, 0xaa, 0x00, 0x35, 0x00, 0x08, 0x00, 0x00
+};
+
+static struct hash *vhash;
+static struct mroute_addr addrs[BENCH_N_ADDRS];
+
+/* like m->vhash on a server with BENCH_N_ADDRS IPv4 clients */
+static void
+setup_hash(void)
+{
+    vhash = hash_init(BENCH_N_ADDRS, 0x5eed, mroute_addr_hash_function,
+                      mroute_addr_compare_function);
+
+    for (int i = 0; i < BENCH_N_ADDRS; i++)
+    {
+        struct mroute_addr *a = &addrs[i];
+        a->type = MR_ADDR_IPV4;
+        a->netbits = 0;
+        a->len = 4;
+        a->v4.addr = htonl(0x0a080000 + i);
+        hash_add(vhash, a, a, false);
+    }
+}
+
+static void
+bench_hash_lookup_fast(uint64_t iterations)
+{
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        const struct mroute_addr *a = &addrs[(i * 7) % BENCH_N_ADDRS];
+        const uint32_t hv = hash_value(vhash, a);
+        bench_sink = (uintptr_t) hash_lookup_fast(vhash, a, hv);
+    }
+}
+
+static struct mroute_helper *route_helper;
+
+/* like a hub with BENCH_N_ADDRS site iroutes of /16 to /30 in 10/8 */
+static void
+setup_iroutes(void)
+{
+    route_helper = mroute_helper_init(60);
+
+    for (int i = 0; i < BENCH_N_ADDRS; i++)
+    {
+        struct mroute_addr net = addrs[i];
+        net.type |= MR_WITH_NETBITS;
+        net.netbits = 16 + i % 15;
+        net.v4.addr = htonl(0x0a000000 + (i << 12));
+        mroute_addr_mask_host_bits(&net);
+        mroute_helper_add_iroute46(route_helper, &net);
+    }
+}
+
+static void
+bench_mroute_helper_lookup(uint64_t iterations)
+{
+    uint8_t netbits[MR_HELPER_NET_LEN];
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        struct mroute_addr a = addrs[0];
+        a.v4.addr = htonl(0x0a000000 + (((i * 7) % BENCH_N_ADDRS) << 12) + 1);
+        bench_sink = mroute_helper_lookup(route_helper, &a, netbits);
+    }
+}
+
+static void
+bench_mroute_extract_addr_ipv4(uint64_t iterations)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(sizeof(ipv4_tcp_syn), &gc);
+    struct mroute_addr src, dest;
+
+    ASSERT(buf_write(&buf, ipv4_tcp_syn, sizeof(ipv4_tcp_syn)));
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        bench_sink = mroute_extract_addr_ip(&src, &dest, &buf);
+    }
+    bench_sink = dest.v4.addr;
+    gc_free(&gc);
+}
+
+static void
+bench_mroute_extract_addr_ipv6(uint64_t iterations)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(sizeof(ipv6_udp), &gc);
+    struct mroute_addr src, dest;
+
+    ASSERT(buf_write(&buf, ipv6_udp, sizeof(ipv6_udp)));
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        bench_sink = mroute_extract_addr_ip(&src, &dest, &buf);
+    }
+    bench_sink = dest.v6.addr.s6_addr[15];
+    gc_free(&gc);
+}
+
+/* restores the SYN every iteration, as the first fixup would otherwise
+ * leave nothing to change for the following ones */
+static void
+bench_mss_fixup_ipv4(uint64_t iterations)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(sizeof(ipv4_tcp_syn), &gc);
+
+    ASSERT(buf_write(&buf, ipv4_tcp_syn, sizeof(ipv4_tcp_syn)));
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        memcpy(BPTR(&buf), ipv4_tcp_syn, sizeof(ipv4_tcp_syn));
+        mss_fixup_ipv4(&buf, 1400);
+    }
+    bench_sink = BPTR(&buf)[42];
+    gc_free(&gc);
+}
+
+/* like ipv6_send_icmp_unreachable() quoting a full-sized packet */
+static void
+bench_ip_checksum(uint64_t iterations)
+{
+    uint8_t payload[1232];
+    struct in6_addr src = IN6ADDR_LOOPBACK_INIT, dest = IN6ADDR_LOOPBACK_INIT;
+
+    for (size_t i = 0; i < sizeof(payload); i++)
+    {
+        payload[i] = (uint8_t) (i * 7);
+    }
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        payload[0] = (uint8_t) i;
+        bench_sink = ip_checksum(AF_INET6, payload, sizeof(payload),
+                                 src.s6_addr, dest.s6_addr, OPENVPN_IPPROTO_ICMPV6);
+    }
+}
+
+/* like multi_schedule_context_wakeup() rescheduling one of
+ * BENCH_N_ADDRS instances per packet */
+static void
+bench_schedule_add_modify(uint64_t iterations)
+{
+    struct schedule *s = schedule_init();
+    struct schedule_entry *entries;
+
+    ALLOC_ARRAY_CLEAR(entries, struct schedule_entry, BENCH_N_ADDRS);
+    schedule_advance(s, &(struct timeval) { .tv_sec = 1000 });
+    for (int i = 0; i < BENCH_N_ADDRS; i++)
+    {
+        entries[i].tv.tv_sec = 1000 + i;
+        schedule_add_modify(s, &entries[i]);
+    }
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        struct schedule_entry *e = &entries[(i * 7) % BENCH_N_ADDRS];
+        e->tv.tv_sec = 1000 + (i % 60);
+        e->tv.tv_usec = (i * 4099) % 1000000;
+        schedule_add_modify(s, e);
+    }
+    bench_sink = (uintptr_t) schedule_get_earliest_wakeup(s, &entries[0].tv);
+
+    schedule_free(s);
+    free(entries);
+}
+
+static void
+bench_buf_printf(uint64_t iterations)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(256, &gc);
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        buf_reset_len(&buf);
+        buf_printf(&buf, "%s/%s:%d", "client", "10.8.0.6", 1194);
+    }
+    bench_sink = BLEN(&buf);
+    gc_free(&gc);
+}
+
+int
+main(int argc, char *argv[])
+{
+    const struct bench_case cases[] = {
+        { "hash_lookup_fast", bench_hash_lookup_fast },
+        { "mroute_helper_lookup", bench_mroute_helper_lookup },
+        { "mroute_extract_addr_ipv4", bench_mroute_extract_addr_ipv4 },
+        { "mroute_extract_addr_ipv6", bench_mroute_extract_addr_ipv6 },
+        { "mss_fixup_ipv4", bench_mss_fixup_ipv4 },
+        { "ip_checksum", bench_ip_checksum },
+        { "schedule_add_modify", bench_schedule_add_modify },
+        { "buf_printf", bench_buf_printf },
+    };
+
+    setup_hash();
+    setup_iroutes();
+    int ret = bench_main(argc, argv, cases, SIZE(cases));
+    mroute_helper_free(route_helper);
+    hash_free(vhash);
+
+    return ret;
+}
@@ -0,0 +1,338 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single TCP/UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include "crypto.h"
+#include "options.h"
+#include "packet_id.h"
+#include "reliable.h"
+#include "ssl_backend.h"
+#include "ssl_pkt.h"
+#include "tls_crypt.h"
+
+#include "bench.h"
+#include "mock_msg.h"
+
+/* Dummy functions to get the linker happy, see test_pkt.c */
+int
+parse_line(const char *line, char **p, const int n, const char *file,
+           const int line_num, int msglevel, struct gc_arena *gc)
+{
+    ASSERT(0);
+    return 0;
+}
+
+bool
+key_state_export_keying_material(struct tls_session *session,
+                                 const char *label, size_t label_size,
+                                 void *ekm, size_t ekm_size)
+{
+    ASSERT(0);
+}
+
+const char *
+print_link_socket_actual(const struct link_socket_actual *act, struct gc_arena *gc)
+{
+    return "dummy print_link_socket_actual from bench";
+}
+
+/* key and packets from test_pkt.c */
+static const char static_key[] = "<tls-auth>\n"
+                                 "-----BEGIN OpenVPN Static key V1-----\n"
+                                 "37268ea8f95d7f71f9fb8fc03770c460\n"
+                                 "daf714a483d815c013ce0a537efc18f2\n"
+                                 "8f4f172669d9e6a413bac6741d8ea054\n"
+                                 "00f49b7fd6326470f23798c606bf53d4\n"
+                                 "de63ebc64ec59d57ce5d04d5b62e68b5\n"
+                                 "3ca6e5354351097fa370446c4d269f18\n"
+                                 "7bb6ae54af2dc70ff7317fe2f8754b82\n"
+                                 "82aad4202f9fa42c8640245d883e2c54\n"
+                                 "a0c1c489a036cf3a8964d8d289c1583b\n"
+                                 "9447c262b1da5fd167a5d27bd5ac5143\n"
+                                 "17bc2343a31a2efc38dd920d910375f5\n"
+                                 "1c2e27f3afd36c49269da079f7ce466e\n"
+                                 "bb0f9ad13e9bbb4665974e6bc24b513c\n"
+                                 "5700393bf4a3e7f967e2f384069ac8a8\n"
+                                 "e78b18b15604993fd16515cce9c0f3e4\n"
+                                 "2b4126b999005ade802797b0eeb8b9e6\n"
+                                 "-----END OpenVPN Static key V1-----\n"
+                                 "</tls-auth>\n";
+
+static const uint8_t client_reset_v2_tls_auth[] =
+{ 0x38, 0xde, 0x69, 0x4c, 0x5c, 0x7b, 0xfb, 0xa2,
+  0x74, 0x93, 0x53, 0x7c, 0x1d, 0xed, 0x4e, 0x78,
+  0x15, 0x29, 0xae, 0x7c, 0xfe, 0x4b, 0x8c, 0x6d,
+  0x6b, 0x2b, 0x51, 0xf0, 0x5a, 0x00, 0x00, 0x00,
+  0x01, 0x61, 0xd3, 0xbf, 0x6c, 0x00, 0x00, 0x00,
+  0x00, 0x00};
+
+static const uint8_t client_reset_v2_tls_crypt[] =
+{0x38, 0xf4, 0x19, 0xcb, 0x12, 0xd1, 0xf9, 0xe4,
+ 0x8f, 0x00, 0x00, 0x00, 0x01, 0x61, 0xd3, 0xf8,
+ 0xe1, 0x33, 0x02, 0x06, 0xf5, 0x68, 0x02, 0xbe,
+ 0x44, 0xfb, 0xed, 0x90, 0x50, 0x64, 0xe3, 0xdb,
+ 0x43, 0x41, 0x6b, 0xec, 0x5e, 0x52, 0x67, 0x19,
+ 0x46, 0x2b, 0x7e, 0xb9, 0x0c, 0x96, 0xde, 0xfc,
+ 0x9b, 0x05, 0xc4, 0x48, 0x79, 0xf7};
+
+static void
+bench_packet_id_test(uint64_t iterations, bool reorder)
+{
+    struct packet_id pid;
+    struct packet_id_net pin = { 0 };
+
+    packet_id_init(&pid, DEFAULT_SEQ_BACKTRACK, DEFAULT_TIME_BACKTRACK,
+                   "BENCH", 0);
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        /* 2, 1, 4, 3, ... when reordering */
+        pin.id = (packet_id_type) (reorder ? (i ^ 1) + 1 : i + 1);
+        if (packet_id_test(&pid.rec, &pin))
+        {
+            packet_id_add(&pid.rec, &pin);
+        }
+    }
+    bench_sink = pid.rec.id;
+
+    packet_id_free(&pid);
+}
+
+static void
+bench_packet_id_test_inorder(uint64_t iterations)
+{
+    bench_packet_id_test(iterations, false);
+}
+
+static void
+bench_packet_id_test_reorder(uint64_t iterations)
+{
+    bench_packet_id_test(iterations, true);
+}
+
+/* acknowledge four packets per control packet, with the MRU list full
+ * of previously sent acks */
+static void
+bench_reliable_ack_write(uint64_t iterations)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer work = alloc_buf_gc(256, &gc);
+    struct reliable_ack ack = { 0 };
+    struct reliable_ack ack_mru = { 0 };
+    struct session_id sid = { .id = { 1, 2, 3, 4, 5, 6, 7, 8 } };
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        struct buffer buf = work;
+        ASSERT(buf_init(&buf, 128));
+
+        ack.len = 4;
+        for (int j = 0; j < ack.len; j++)
+        {
+            ack.packet_id[j] = (packet_id_type) (i * 4 + j);
+        }
+        bench_sink = reliable_ack_write(&ack, &ack_mru, &buf, &sid,
+                                        RELIABLE_ACK_SIZE, true);
+    }
+
+    gc_free(&gc);
+}
+
+/* encrypt and decrypt small data channel packets, where the fixed cost
+ * per packet outweighs the cost of the cipher itself */
+static void
+bench_aead_small(uint64_t iterations, const char *ciphername)
+{
+    struct key_type kt;
+    struct key2 key2 = { .n = 2 };
+    struct crypto_options co = { 0 };
+    struct frame frame = { {.headroom = 128, .payload_size = 1400}, 0};
+    const uint8_t payload[64] = { 0 };
+
+    init_key_type(&kt, ciphername, "none", true, false);
+    init_key_ctx_bi(&co.key_ctx_bi, &key2, KEY_DIRECTION_BIDIRECTIONAL, &kt,
+                    "bench");
+    packet_id_init(&co.packet_id, DEFAULT_SEQ_BACKTRACK, DEFAULT_TIME_BACKTRACK,
+                   "bench", 0);
+    co.key_ctx_bi.encrypt.implicit_iv_len = co.key_ctx_bi.encrypt.iv_len
+                                            - sizeof(packet_id_type);
+    co.key_ctx_bi.decrypt.implicit_iv_len = co.key_ctx_bi.decrypt.iv_len
+                                            - sizeof(packet_id_type);
+
+    struct buffer plain = alloc_buf(1600);
+    struct buffer encrypted = alloc_buf(1600);
+
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        /* encrypt into the second buffer and decrypt back into the first */
+        struct buffer buf = plain;
+        ASSERT(buf_init(&buf, frame.buf.headroom));
+        ASSERT(buf_write(&buf, payload, sizeof(payload)));
+        struct buffer work = encrypted;
+        ASSERT(buf_init(&work, frame.buf.headroom));
+        openvpn_encrypt(&buf, work, &co);
+        ASSERT(openvpn_decrypt(&buf, plain, &co, &frame, BPTR(&buf)));
+        bench_sink = BLEN(&buf);
+    }
+
+    free_buf(&plain);
+    free_buf(&encrypted);
+    packet_id_free(&co.packet_id);
+    free_key_ctx_bi(&co.key_ctx_bi);
+}
+
+static void
+bench_aead_small_aes_gcm(uint64_t iterations)
+{
+    bench_aead_small(iterations, "AES-256-GCM");
+}
+
+static void
+bench_aead_small_chacha20(uint64_t iterations)
+{
+    bench_aead_small(iterations, "CHACHA20-POLY1305");
+}
+
+/* set up and free the data channel keys of one key_state, as it is done
+ * after every (re)negotiation */
+static void
+bench_key_ctx_init(uint64_t iterations)
+{
+    struct key_type kt;
+    struct key2 key2 = { .n = 2 };
+    struct key_ctx_bi ctx;
+
+    init_key_type(&kt, "AES-256-GCM", "none", true, false);
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        key2.keys[0].cipher[0] = (uint8_t) i;
+        init_key_ctx_bi(&ctx, &key2, KEY_DIRECTION_NORMAL, &kt, "bench");
+        bench_sink = (uintptr_t) ctx.encrypt.cipher;
+        free_key_ctx_bi(&ctx);
+    }
+}
+
+static struct tls_auth_standalone tas_auth;
+static struct tls_auth_standalone tas_crypt;
+
+static void
+setup_tas(void)
+{
+    struct key_type kt;
+    struct frame frame = { {.headroom = 200, .payload_size = 1400}, 0};
+
+    tas_auth.frame = frame;
+    tas_auth.tls_wrap.mode = TLS_WRAP_AUTH;
+    tas_auth.tls_wrap.opt.flags |= (CO_IGNORE_PACKET_ID|CO_PACKET_ID_LONG_FORM);
+    init_key_type(&kt, "none", "SHA1", true, false);
+    crypto_read_openvpn_key(&kt, &tas_auth.tls_wrap.opt.key_ctx_bi,
+                            static_key, true, KEY_DIRECTION_NORMAL,
+                            "Control Channel Authentication", "tls-auth",
+                            NULL);
+    tas_auth.workbuf = alloc_buf(1600);
+
+    tas_crypt.tls_wrap.mode = TLS_WRAP_CRYPT;
+    tas_crypt.tls_wrap.opt.flags |= (CO_IGNORE_PACKET_ID|CO_PACKET_ID_LONG_FORM);
+    tls_crypt_init_key(&tas_crypt.tls_wrap.opt.key_ctx_bi,
+                       &tas_crypt.tls_wrap.original_wrap_keydata, static_key,
+                       true, true);
+    tas_crypt.workbuf = alloc_buf(1600);
+    tas_crypt.tls_wrap.work = alloc_buf(1600);
+}
+
+static void
+free_tas(struct tls_auth_standalone *tas)
+{
+    free_key_ctx_bi(&tas->tls_wrap.opt.key_ctx_bi);
+    free_buf(&tas->workbuf);
+    free_buf(&tas->tls_wrap.work);
+}
+
+static void
+bench_tls_pre_decrypt_lite(uint64_t iterations,
+                           const struct tls_auth_standalone *tas,
+                           const uint8_t *pkt, size_t len)
+{
+    struct link_socket_actual from = { 0 };
+    struct tls_pre_decrypt_state state = { 0 };
+    struct buffer buf = alloc_buf(len);
+
+    ASSERT(buf_write(&buf, pkt, len));
+    for (uint64_t i = 0; i < iterations; i++)
+    {
+        enum first_packet_verdict verdict = tls_pre_decrypt_lite(tas, &state, &from, &buf);
+        ASSERT(verdict == VERDICT_VALID_RESET_V2);
+        free_tls_pre_decrypt_state(&state);
+    }
+
+    free_buf(&buf);
+}
+
+static void
+bench_tls_pre_decrypt_lite_auth(uint64_t iterations)
+{
+    bench_tls_pre_decrypt_lite(iterations, &tas_auth, client_reset_v2_tls_auth,
+                               sizeof(client_reset_v2_tls_auth));
+}
+
+static void
+bench_tls_pre_decrypt_lite_crypt(uint64_t iterations)
+{
+    bench_tls_pre_decrypt_lite(iterations, &tas_crypt, client_reset_v2_tls_crypt,
+                               sizeof(client_reset_v2_tls_crypt));
+}
+
+int
+main(int argc, char *argv[])
+{
+    const struct bench_case cases[] = {
+        { "packet_id_test_inorder", bench_packet_id_test_inorder },
+        { "packet_id_test_reorder", bench_packet_id_test_reorder },
+        { "reliable_ack_write", bench_reliable_ack_write },
+        { "tls_pre_decrypt_lite_auth", bench_tls_pre_decrypt_lite_auth },
+        { "tls_pre_decrypt_lite_crypt", bench_tls_pre_decrypt_lite_crypt },
+        { "aead_small_aes_gcm", bench_aead_small_aes_gcm },
+        { "aead_small_chacha20", bench_aead_small_chacha20 },
+        { "key_ctx_init", bench_key_ctx_init },
+    };
+
+#if defined(ENABLE_CRYPTO_OPENSSL)
+    OpenSSL_add_all_algorithms();
+#endif
+
+    setup_tas();
+    int ret = bench_main(argc, argv, cases, SIZE(cases));
+    free_tas(&tas_auth);
+    free_tas(&tas_crypt);
+
+#if defined(ENABLE_CRYPTO_OPENSSL)
+    EVP_cleanup();
+#endif
+
+    return ret;
+}
@@ -98,3 +98,8 @@ dont_mute(unsigned int flags)
 {
     return true;
 }
+
+void
+msg_flush(void)
+{
+}
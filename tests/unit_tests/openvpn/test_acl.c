@@ -0,0 +1,219 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "acl.h"
+#include "proto.h"
+
+#include "mock_msg.h"
+
+static void
+add(struct acl_list *acl, const char *rule, struct gc_arena *gc)
+{
+    const char *p[8] = { NULL };
+    char *s = string_alloc(rule, gc);
+    int n = 0;
+
+    for (char *tok = strtok(s, " "); tok && n < 7; tok = strtok(NULL, " "))
+    {
+        p[n++] = tok;
+    }
+    assert_true(acl_list_add(acl, p, M_WARN, gc));
+}
+
+static struct buffer
+ipv4_packet(uint8_t *data, int proto, const char *src, const char *dst,
+            uint16_t sport, uint16_t dport)
+{
+    struct openvpn_iphdr *ip = (struct openvpn_iphdr *) data;
+    struct openvpn_udphdr *udp = (struct openvpn_udphdr *) (ip + 1);
+
+    memset(data, 0, sizeof(*ip) + sizeof(*udp));
+    ip->version_len = 0x45;
+    ip->protocol = (uint8_t) proto;
+    assert_int_equal(inet_pton(AF_INET, src, &ip->saddr), 1);
+    assert_int_equal(inet_pton(AF_INET, dst, &ip->daddr), 1);
+    udp->source = htons(sport);
+    udp->dest = htons(dport);
+
+    struct buffer buf;
+    buf_set_read(&buf, data, sizeof(*ip) + sizeof(*udp));
+    return buf;
+}
+
+static struct buffer
+ipv6_packet(uint8_t *data, int proto, const char *src, const char *dst,
+            uint16_t sport, uint16_t dport, bool hopopts)
+{
+    struct openvpn_ipv6hdr *ip6 = (struct openvpn_ipv6hdr *) data;
+    uint8_t *l4 = (uint8_t *) (ip6 + 1);
+
+    memset(data, 0, sizeof(*ip6) + 16);
+    ip6->version_prio = 0x60;
+    ip6->nexthdr = (uint8_t) proto;
+    assert_int_equal(inet_pton(AF_INET6, src, &ip6->saddr), 1);
+    assert_int_equal(inet_pton(AF_INET6, dst, &ip6->daddr), 1);
+    if (hopopts)
+    {
+        ip6->nexthdr = 0;
+        l4[0] = (uint8_t) proto;
+        l4 += 8;
+    }
+    struct openvpn_udphdr *udp = (struct openvpn_udphdr *) l4;
+    udp->source = htons(sport);
+    udp->dest = htons(dport);
+
+    struct buffer buf;
+    buf_set_read(&buf, data, (int) (l4 - data) + sizeof(*udp));
+    return buf;
+}
+
+static void
+test_acl_ipv4(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct acl_list *acl = acl_list_new(&gc);
+    uint8_t data[64];
+
+    acl->deny = true;
+    add(acl, "allow in udp 10.8.0.1 53", &gc);
+    add(acl, "deny in tcp 192.168.1.10/32", &gc);
+    add(acl, "allow in tcp 192.168.1.0/24 80-443", &gc);
+    add(acl, "allow out icmp", &gc);
+
+    struct buffer buf = ipv4_packet(data, OPENVPN_IPPROTO_UDP, "10.8.0.6", "10.8.0.1", 40000, 53);
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_UDP, "10.8.0.6", "10.8.0.1", 40000, 54);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_TCP, "10.8.0.6", "192.168.1.20", 40000, 443);
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_TCP, "10.8.0.6", "192.168.1.20", 40000, 22);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+    /* the earlier deny rule wins */
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_TCP, "10.8.0.6", "192.168.1.10", 40000, 80);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+
+    /* packets to the client are matched on their source port */
+    buf = ipv4_packet(data, 1, "192.168.1.20", "10.8.0.6", 0, 0);
+    assert_true(acl_permits(acl, ACL_OUT, &buf));
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_UDP, "10.8.0.1", "10.8.0.6", 53, 40000);
+    assert_false(acl_permits(acl, ACL_OUT, &buf));
+
+    /* a non-first fragment has no ports and matches no port rule */
+    buf = ipv4_packet(data, OPENVPN_IPPROTO_UDP, "10.8.0.6", "10.8.0.1", 40000, 53);
+    ((struct openvpn_iphdr *) data)->frag_off = htons(100);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+
+    acl->deny = false;
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+
+    gc_free(&gc);
+}
+
+static void
+test_acl_ipv6(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct acl_list *acl = acl_list_new(&gc);
+    uint8_t data[128];
+
+    add(acl, "deny in tcp 2001:db8::/32 22", &gc);
+    add(acl, "deny in any 192.168.0.0/16", &gc);
+
+    struct buffer buf = ipv6_packet(data, OPENVPN_IPPROTO_TCP, "2001:db8:1::6", "2001:db8::1", 40000, 22, false);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+    buf = ipv6_packet(data, OPENVPN_IPPROTO_TCP, "2001:db8:1::6", "2001:db8::1", 40000, 80, false);
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+    buf = ipv6_packet(data, OPENVPN_IPPROTO_TCP, "2001:db8:1::6", "2001:db9::1", 40000, 22, false);
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+
+    /* extension headers do not hide the transport header */
+    buf = ipv6_packet(data, OPENVPN_IPPROTO_TCP, "2001:db8:1::6", "2001:db8::1", 40000, 22, true);
+    assert_false(acl_permits(acl, ACL_IN, &buf));
+
+    /* an IPv4 rule does not apply to IPv6 */
+    buf = ipv6_packet(data, OPENVPN_IPPROTO_UDP, "2001:db8:1::6", "c0a8::1", 40000, 53, false);
+    assert_true(acl_permits(acl, ACL_IN, &buf));
+
+    gc_free(&gc);
+}
+
+static void
+test_acl_parse(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct acl_list *acl = acl_list_new(&gc);
+    const char *bad[][6] = {
+        { "permit", "in", NULL },
+        { "allow", "up", NULL },
+        { "allow", "in", "sctpx", NULL },
+        { "allow", "in", "tcp", "10.0.0.0/33", NULL },
+        { "allow", "in", "icmp", "any", "80", NULL },
+        { "allow", "in", "tcp", "any", "443-80", NULL },
+    };
+
+    for (size_t i = 0; i < SIZE(bad); i++)
+    {
+        assert_false(acl_list_add(acl, bad[i], M_WARN, &gc));
+    }
+    for (int i = 0; i < 4; i++)
+    {
+        assert_int_equal(acl->chains[i].n, 0);
+    }
+
+    /* rules without an address go into both families, clones are
+     * independent of the original */
+    add(acl, "allow in tcp any 80", &gc);
+    struct acl_list *clone = acl_list_clone(acl, &gc);
+    add(clone, "deny out", &gc);
+    assert_int_equal(acl->chains[ACL_CHAIN(ACL_IN, 0)].n, 1);
+    assert_int_equal(acl->chains[ACL_CHAIN(ACL_IN, 1)].n, 1);
+    assert_int_equal(acl->chains[ACL_CHAIN(ACL_OUT, 0)].n, 0);
+    assert_int_equal(clone->chains[ACL_CHAIN(ACL_OUT, 1)].n, 1);
+
+    gc_free(&gc);
+}
+
+const struct CMUnitTest acl_tests[] = {
+    cmocka_unit_test(test_acl_ipv4),
+    cmocka_unit_test(test_acl_ipv6),
+    cmocka_unit_test(test_acl_parse),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(acl_tests, NULL, NULL);
+}
@@ -165,6 +165,42 @@ auth_token_fail_invalid_key(void **state)
 
 }
 
+static void
+auth_token_test_cached(void **state)
+{
+    struct test_context *ctx = (struct test_context *) *state;
+
+    now = 100000;
+    generate_auth_token(&ctx->up, &ctx->multi);
+    strcpy(ctx->up.password, ctx->multi.auth_token);
+    assert_int_equal(verify_auth_token_cached(&ctx->up, &ctx->multi, ctx->session),
+                     AUTH_TOKEN_HMAC_OK);
+
+    /* Change auth-token key, the HMAC result of the same token is reused */
+    struct key key;
+    memset(&key, '1', sizeof(key));
+    free_key_ctx(&ctx->multi.opt.auth_token_key);
+    init_key_ctx(&ctx->multi.opt.auth_token_key, &key, &ctx->kt, false, "TEST");
+    assert_int_equal(verify_auth_token_cached(&ctx->up, &ctx->multi, ctx->session),
+                     AUTH_TOKEN_HMAC_OK);
+    assert_int_equal(verify_auth_token(&ctx->up, &ctx->multi, ctx->session), 0);
+
+    /* but the timestamps are still checked */
+    now = 100000 + 2*ctx->session->opt->auth_token_renewal + 20;
+    assert_int_equal(verify_auth_token_cached(&ctx->up, &ctx->multi, ctx->session),
+                     AUTH_TOKEN_HMAC_OK|AUTH_TOKEN_EXPIRED);
+    now = 100000;
+
+    /* a different username needs a new HMAC */
+    strcpy(ctx->up.username, "test user name 2");
+    assert_int_equal(verify_auth_token_cached(&ctx->up, &ctx->multi, ctx->session), 0);
+
+    /* wiping the token also forgets the result */
+    strcpy(ctx->up.username, "test user name");
+    wipe_auth_token(&ctx->multi);
+    assert_int_equal(verify_auth_token_cached(&ctx->up, &ctx->multi, ctx->session), 0);
+}
+
 static void
 auth_token_test_timeout(void **state)
 {
@@ -418,6 +454,7 @@ main(void)
         cmocka_unit_test_setup_teardown(auth_token_test_random_keys, setup, teardown),
         cmocka_unit_test_setup_teardown(auth_token_test_key_load, setup, teardown),
         cmocka_unit_test_setup_teardown(auth_token_test_timeout, setup, teardown),
+        cmocka_unit_test_setup_teardown(auth_token_test_cached, setup, teardown),
         cmocka_unit_test_setup_teardown(auth_token_test_session_mismatch, setup, teardown)
     };
 
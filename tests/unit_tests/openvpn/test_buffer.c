@@ -289,6 +289,57 @@ test_buffer_free_gc_two(void **state)
     gc_free(&gc);
 }
 
+static void
+test_buffer_gc_chunks(void **state)
+{
+#ifdef GC_CHUNKED
+    struct gc_arena gc = gc_new();
+    struct gc_arena gc2 = gc_new();
+
+    char *s1 = gc_malloc(1, false, &gc);
+    char *s2 = gc_malloc(100, true, &gc);
+    assert_null(gc.list);
+    assert_non_null(gc.chunks);
+    assert_ptr_equal(s1 + GC_ALIGN, s2);
+    assert_int_equal(s2[99], 0);
+
+    /* fill the first chunk, the next allocation starts a new one */
+    while (gc.chunk_used + GC_SMALL_MAX <= GC_CHUNK_SIZE)
+    {
+        memset(gc_malloc(GC_SMALL_MAX, false, &gc), 'x', GC_SMALL_MAX);
+    }
+    gc_malloc(GC_SMALL_MAX, false, &gc);
+    assert_non_null(gc.chunks->next);
+    assert_null(gc.chunks->next->next);
+    assert_null(gc.list);
+
+    /* larger allocations are blocks of their own */
+    struct buffer buf = alloc_buf_gc(GC_SMALL_MAX + 1, &gc);
+    assert_ptr_equal(gc.list + 1, buf.data);
+
+    /* transfer keeps dest filling its current chunk */
+    char *t = gc_malloc(10, false, &gc2);
+    const size_t used = gc2.chunk_used;
+    struct gc_entry *first = gc2.chunks;
+    gc_transfer(&gc2, &gc);
+    assert_null(gc.chunks);
+    assert_ptr_equal(gc2.chunks, first);
+    assert_int_equal(gc2.chunk_used, used);
+    assert_non_null(gc2.list);
+    assert_ptr_equal(gc_malloc(10, false, &gc2), t + GC_ALIGN);
+
+    /* freed chunks are reused */
+    gc_free(&gc2);
+    assert_null(gc2.chunks);
+    const int cached = gc_chunk_cache_n;
+    assert_true(cached >= 3);
+    gc_malloc(10, false, &gc);
+    assert_int_equal(gc_chunk_cache_n, cached - 1);
+    gc_free(&gc);
+#else
+    skip();
+#endif
+}
 
 static void
 test_buffer_gc_realloc(void **state)
@@ -320,6 +371,126 @@ test_buffer_gc_realloc(void **state)
 }
 
 
+static void
+test_buffer_pool(void **state)
+{
+    struct buffer_pool *pool = buffer_pool_new(1600);
+
+    struct buffer b1 = buffer_pool_get(pool);
+    struct buffer b2 = buffer_pool_get(pool);
+    assert_int_equal(b1.capacity, 1600);
+    assert_int_equal(BLEN(&b1), 0);
+    assert_ptr_not_equal(b1.data, b2.data);
+    assert_int_equal(pool->n_out, 2);
+    assert_int_equal(pool->n_free, 0);
+
+    memset(BPTR(&b1), 'a', 1600);
+    uint8_t *data1 = b1.data;
+    buffer_pool_put(pool, &b1);
+    assert_null(b1.data);
+    assert_int_equal(b1.capacity, 0);
+    assert_int_equal(pool->n_out, 1);
+    assert_int_equal(pool->n_free, 1);
+
+    /* the block that was given back is handed out again, empty */
+    struct buffer b3 = buffer_pool_get(pool);
+    assert_ptr_equal(b3.data, data1);
+    assert_int_equal(BLEN(&b3), 0);
+    assert_int_equal(b3.offset, 0);
+    assert_int_equal(pool->n_free, 0);
+
+    buffer_pool_put(pool, &b2);
+    buffer_pool_put(pool, &b3);
+    assert_int_equal(pool->n_out, 0);
+    assert_int_equal(pool->n_free, 2);
+
+    buffer_pool_free(pool);
+}
+
+
+static void
+test_buffer_object_cache(void **state)
+{
+    struct object_cache oc = OBJECT_CACHE_INIT(uint8_t[64]);
+    object_cache_set_limit(&oc, 1);
+
+    uint8_t *o1 = object_cache_alloc(&oc);
+    uint8_t *o2 = object_cache_alloc(&oc);
+    assert_ptr_not_equal(o1, o2);
+    memset(o1, 'a', 64);
+
+    /* only one freed object is kept, and it comes back zeroed */
+    object_cache_free(&oc, o1);
+    object_cache_free(&oc, o2);
+    assert_int_equal(oc.n_free, 1);
+
+    uint8_t *o3 = object_cache_alloc(&oc);
+    assert_ptr_equal(o3, o1);
+    for (int i = 0; i < 64; i++)
+    {
+        assert_int_equal(o3[i], 0);
+    }
+    assert_int_equal(oc.n_free, 0);
+    assert_int_equal(oc.n_reused, 1);
+
+    object_cache_free(&oc, o3);
+    object_cache_set_limit(&oc, 0);
+    assert_int_equal(oc.n_free, 0);
+    assert_null(oc.free_list);
+}
+
+
+static void
+test_buffer_huge_pages(void **state)
+{
+    int chunks, hugetlb;
+    huge_chunks_enable(true);
+
+    /* pool buffers are carved one after the other out of one chunk */
+    struct buffer_pool *pool = buffer_pool_new(1600);
+    buffer_pool_use_huge_pages(pool);
+    assert_true(pool->huge);
+    struct buffer b1 = buffer_pool_get(pool);
+    struct buffer b2 = buffer_pool_get(pool);
+    assert_int_equal(b1.capacity, 1600);
+    assert_ptr_equal(b2.data, b1.data + 1600);
+    huge_chunks_stats(&chunks, &hugetlb);
+    assert_int_equal(chunks, 1);
+
+    buffer_pool_put(pool, &b1);
+    struct buffer b3 = buffer_pool_get(pool);
+    assert_ptr_equal(b3.data, b2.data - 1600);
+    buffer_pool_put(pool, &b2);
+    buffer_pool_put(pool, &b3);
+    buffer_pool_free(pool);
+    huge_chunks_stats(&chunks, &hugetlb);
+    assert_int_equal(chunks, 0);
+
+    /* a huge cache keeps every object until all of them are back */
+    struct object_cache oc = OBJECT_CACHE_INIT(uint8_t[100]);
+    object_cache_use_huge_pages(&oc);
+    object_cache_set_limit(&oc, 1);
+    uint8_t *o1 = object_cache_alloc(&oc);
+    uint8_t *o2 = object_cache_alloc(&oc);
+    assert_ptr_equal(o2, o1 + 128);
+    object_cache_free(&oc, o1);
+    object_cache_set_limit(&oc, 0);
+    assert_true(oc.huge);
+    assert_int_equal(oc.n_free, 1);
+
+    object_cache_free(&oc, o2);
+    assert_int_equal(oc.n_free, 2);
+    object_cache_set_limit(&oc, 0);
+    assert_false(oc.huge);
+    assert_int_equal(oc.n_free, 0);
+    assert_null(oc.free_list);
+    huge_chunks_stats(&chunks, &hugetlb);
+    assert_int_equal(chunks, 0);
+
+    huge_chunks_enable(false);
+}
+
+
 int
 main(void)
 {
@@ -350,7 +521,11 @@ main(void)
                                         test_buffer_list_teardown),
         cmocka_unit_test(test_buffer_free_gc_one),
         cmocka_unit_test(test_buffer_free_gc_two),
+        cmocka_unit_test(test_buffer_gc_chunks),
         cmocka_unit_test(test_buffer_gc_realloc),
+        cmocka_unit_test(test_buffer_pool),
+        cmocka_unit_test(test_buffer_object_cache),
+        cmocka_unit_test(test_buffer_huge_pages),
     };
 
     return cmocka_run_group_tests_name("buffer", tests, NULL, NULL);
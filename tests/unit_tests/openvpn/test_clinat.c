@@ -0,0 +1,245 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "clinat.h"
+#include "proto.h"
+#include "socket.h"
+
+#include "mock_msg.h"
+
+/* Dummy functions to get the linker happy, the tests fill in the
+ * entries without parsing addresses */
+in_addr_t
+getaddr(unsigned int flags, const char *hostname, int resolve_retry_seconds,
+        bool *succeeded, struct signal_info *sig_info)
+{
+    *succeeded = false;
+    return 0;
+}
+
+const char *
+print_in_addr_t(in_addr_t addr, unsigned int flags, struct gc_arena *gc)
+{
+    return "dummy print_in_addr_t from unit test";
+}
+
+static in_addr_t
+ip(const char *str)
+{
+    in_addr_t addr;
+    assert_int_equal(inet_pton(AF_INET, str, &addr), 1);
+    return addr;
+}
+
+static void
+add(struct client_nat_option_list *src, int type, const char *network,
+    const char *netmask, const char *foreign_network)
+{
+    struct client_nat_entry *e = &src->entries[src->n++];
+    e->type = type;
+    e->network = ip(network);
+    e->netmask = ip(netmask);
+    e->foreign_network = ip(foreign_network);
+}
+
+/* copy the entries into a new list, which compiles it */
+static struct client_nat_option_list *
+compile(const struct client_nat_option_list *src, struct gc_arena *gc)
+{
+    struct client_nat_option_list *list = new_client_nat_list(gc);
+    copy_client_nat_option_list(list, src);
+    return list;
+}
+
+/* the linear scan client_nat_transform() replaces */
+static void
+reference_transform(const struct client_nat_option_list *list,
+                    struct openvpn_iphdr *iph, const int direction)
+{
+    unsigned int alog = 0;
+
+    for (int i = 0; i < list->n; ++i)
+    {
+        const struct client_nat_entry *e = &list->entries[i];
+        uint32_t *addr_ptr = (e->type ^ direction) ? &iph->daddr : &iph->saddr;
+        const unsigned int amask = (e->type ^ direction) ? 2 : 1;
+        const in_addr_t from = direction ? e->foreign_network : e->network;
+        const in_addr_t to = direction ? e->network : e->foreign_network;
+
+        if ((*addr_ptr & e->netmask) == from && !(amask & alog))
+        {
+            *addr_ptr = (*addr_ptr & ~e->netmask) | to;
+            alog |= amask;
+        }
+    }
+}
+
+static uint16_t
+ip_header_sum(const struct openvpn_iphdr *iph)
+{
+    const uint16_t *p = (const uint16_t *) iph;
+    uint32_t sum = 0;
+    for (size_t i = 0; i < sizeof(*iph) / 2; ++i)
+    {
+        sum += p[i];
+    }
+    while (sum >> 16)
+    {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t) sum;
+}
+
+static void
+transform(const struct client_nat_option_list *list, struct openvpn_iphdr *iph,
+          const int direction)
+{
+    struct buffer buf;
+    buf_set_read(&buf, (uint8_t *) iph, sizeof(*iph));
+    client_nat_transform(list, &buf, direction);
+}
+
+static void
+make_packet(struct openvpn_iphdr *iph, in_addr_t saddr, in_addr_t daddr)
+{
+    CLEAR(*iph);
+    iph->version_len = 0x45;
+    iph->protocol = 1; /* ICMP, no checksum to adjust */
+    iph->saddr = saddr;
+    iph->daddr = daddr;
+    iph->check = ~ip_header_sum(iph);
+}
+
+static void
+test_clinat_first_match(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct client_nat_option_list src;
+    CLEAR(src);
+
+    /* the broader rule comes first and hides the more specific one */
+    add(&src, CN_SNAT, "192.168.0.0", "255.255.0.0", "10.1.0.0");
+    add(&src, CN_SNAT, "192.168.1.0", "255.255.255.0", "10.2.1.0");
+    add(&src, CN_DNAT, "10.99.1.0", "255.255.255.0", "172.16.1.0");
+    add(&src, CN_DNAT, "10.99.0.0", "255.255.0.0", "172.17.0.0");
+    struct client_nat_option_list *list = compile(&src, &gc);
+
+    struct openvpn_iphdr iph;
+    make_packet(&iph, ip("192.168.1.5"), ip("10.99.1.9"));
+    transform(list, &iph, CN_OUTGOING);
+    assert_int_equal(iph.saddr, ip("10.1.1.5"));
+    assert_int_equal(iph.daddr, ip("172.16.1.9"));
+    assert_int_equal(ip_header_sum(&iph), 0xffff);
+
+    make_packet(&iph, ip("172.17.2.3"), ip("10.1.7.8"));
+    transform(list, &iph, CN_INCOMING);
+    assert_int_equal(iph.saddr, ip("10.99.2.3"));
+    assert_int_equal(iph.daddr, ip("192.168.7.8"));
+    assert_int_equal(ip_header_sum(&iph), 0xffff);
+
+    /* no rule matches, the packet is left alone */
+    make_packet(&iph, ip("1.2.3.4"), ip("5.6.7.8"));
+    transform(list, &iph, CN_OUTGOING);
+    assert_int_equal(iph.saddr, ip("1.2.3.4"));
+    assert_int_equal(iph.daddr, ip("5.6.7.8"));
+
+    gc_free(&gc);
+}
+
+/*
+ * Compare the compiled lookup with the linear scan for random rule
+ * lists with many overlapping networks.
+ */
+static void
+test_clinat_random(void **state)
+{
+    static const char *masks[] = {
+        "255.0.0.0", "255.255.0.0", "255.255.255.0", "255.255.255.252",
+        "255.255.255.255", "0.0.0.0"
+    };
+    struct gc_arena gc = gc_new();
+
+    srand(1);
+    for (int round = 0; round < 200; round++)
+    {
+        struct client_nat_option_list src;
+        CLEAR(src);
+
+        const int n = 1 + rand() % MAX_CLIENT_NAT;
+        for (int i = 0; i < n; i++)
+        {
+            struct client_nat_entry *e = &src.entries[src.n++];
+            e->type = rand() % 2;
+            e->netmask = ip(masks[rand() % (sizeof(masks) / sizeof(masks[0]))]);
+            e->network = htonl(0x0a000000 | (rand() & 0x00030303)) & e->netmask;
+            e->foreign_network = htonl(0x0a000000 | (rand() & 0x00030303)) & e->netmask;
+            if (rand() % 16 == 0)
+            {
+                /* never matches */
+                e->network |= ~e->netmask;
+            }
+        }
+        struct client_nat_option_list *list = compile(&src, &gc);
+
+        for (int i = 0; i < 50; i++)
+        {
+            const int direction = rand() % 2;
+            struct openvpn_iphdr iph, ref;
+            make_packet(&iph, htonl(0x0a000000 | (rand() & 0x00030303)),
+                        htonl(0x0a000000 | (rand() & 0x00030303)));
+            ref = iph;
+
+            transform(list, &iph, direction);
+            reference_transform(&src, &ref, direction);
+            assert_int_equal(iph.saddr, ref.saddr);
+            assert_int_equal(iph.daddr, ref.daddr);
+            assert_int_equal(ip_header_sum(&iph), 0xffff);
+        }
+    }
+
+    gc_free(&gc);
+}
+
+const struct CMUnitTest clinat_tests[] = {
+    cmocka_unit_test(test_clinat_first_match),
+    cmocka_unit_test(test_clinat_random),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(clinat_tests, NULL, NULL);
+}
@@ -35,6 +35,7 @@
 #include <cmocka.h>
 
 #include "crypto.h"
+#include "crypto_epoch.h"
 #include "options.h"
 #include "ssl_backend.h"
 
@@ -137,6 +138,34 @@ crypto_translate_cipher_names(void **state)
 }
 
 
+static void
+crypto_cipher_lookup(void **state)
+{
+    /* more ciphers than the OpenSSL 3 backend keeps looked up, so that
+     * the second round has to replace entries of the first */
+    static const char *const modes[] = { "CBC", "GCM", "CFB", "OFB" };
+    static const int key_bits[] = { 128, 192, 256 };
+
+    for (int round = 0; round < 2; round++)
+    {
+        for (size_t m = 0; m < SIZE(modes); m++)
+        {
+            for (size_t k = 0; k < SIZE(key_bits); k++)
+            {
+                char name[32];
+                openvpn_snprintf(name, sizeof(name), "AES-%d-%s",
+                                 key_bits[k], modes[m]);
+
+                assert_string_equal(cipher_kt_name(name), name);
+                assert_int_equal(cipher_kt_key_size(name), key_bits[k] / 8);
+                assert_int_equal(cipher_kt_block_size(name), 16);
+                assert_int_equal(cipher_kt_iv_size(name), m == 1 ? 12 : 16);
+                assert_int_equal(cipher_kt_mode_aead(name), m == 1);
+            }
+        }
+    }
+}
+
 static uint8_t good_prf[32] = {0xd9, 0x8c, 0x85, 0x18, 0xc8, 0x5e, 0x94, 0x69,
                                0x27, 0x91, 0x6a, 0xcf, 0xc2, 0xd5, 0x92, 0xfb,
                                0xb1, 0x56, 0x7e, 0x4b, 0x4b, 0x14, 0x59, 0xe6,
@@ -211,6 +240,357 @@ crypto_test_hmac(void **state)
     hmac_ctx_free(hmac);
 }
 
+static void
+init_aead_crypto_options(struct crypto_options *co, struct key_type *kt)
+{
+    struct key2 key2 = { .n = 2 };
+    for (size_t i = 0; i < sizeof(key2.keys[0].cipher); i++)
+    {
+        key2.keys[0].cipher[i] = (uint8_t) i;
+    }
+
+    CLEAR(*co);
+    init_key_ctx_bi(&co->key_ctx_bi, &key2, KEY_DIRECTION_BIDIRECTIONAL, kt,
+                    "test");
+    packet_id_init(&co->packet_id, DEFAULT_SEQ_BACKTRACK, DEFAULT_TIME_BACKTRACK,
+                   "test", 0);
+
+    /* fixed implicit IV, so that both sets of options encrypt alike */
+    const size_t impl_iv_len = cipher_ctx_iv_length(co->key_ctx_bi.encrypt.cipher)
+                               - sizeof(packet_id_type);
+    memset(co->key_ctx_bi.encrypt.implicit_iv, 0x42, impl_iv_len);
+    co->key_ctx_bi.encrypt.implicit_iv_len = impl_iv_len;
+    memset(co->key_ctx_bi.decrypt.implicit_iv, 0x42, impl_iv_len);
+    co->key_ctx_bi.decrypt.implicit_iv_len = impl_iv_len;
+}
+
+static void
+crypto_test_aead_in_place(void **state)
+{
+    struct key_type kt;
+    init_key_type(&kt, "AES-256-GCM", "none", true, false);
+
+    struct crypto_options co_copy, co_in_place;
+    init_aead_crypto_options(&co_copy, &kt);
+    init_aead_crypto_options(&co_in_place, &kt);
+
+    const int headroom = 128;
+    struct frame frame = { .buf.headroom = headroom };
+    struct buffer work = alloc_buf(2048);
+    struct buffer buf_copy = alloc_buf(2048);
+    struct buffer buf_in_place = alloc_buf(2048);
+
+    for (int i = 0; i < 3; i++)
+    {
+        ASSERT(buf_init(&buf_copy, headroom));
+        ASSERT(buf_init(&buf_in_place, headroom));
+        ASSERT(buf_write(&buf_copy, ipsumlorem, strlen(ipsumlorem)));
+        ASSERT(buf_write(&buf_in_place, ipsumlorem, strlen(ipsumlorem)));
+
+        /* both ways of encrypting produce the same packet */
+        struct buffer copy = buf_copy;
+        ASSERT(buf_init(&work, headroom));
+        openvpn_encrypt(&copy, work, &co_copy);
+
+        struct buffer in_place = buf_in_place;
+        struct buffer work_in_place;
+        assert_true(openvpn_encrypt_in_place_init(&work_in_place, &in_place,
+                                                  &co_in_place, 16));
+        openvpn_encrypt(&in_place, work_in_place, &co_in_place);
+        assert_ptr_equal(in_place.data, buf_in_place.data);
+        assert_true(in_place.offset >= 16);
+
+        assert_int_equal(BLEN(&copy), BLEN(&in_place));
+        assert_memory_equal(BPTR(&copy), BPTR(&in_place), BLEN(&copy));
+
+        /* and decrypt to the original plaintext, in place or not */
+        ASSERT(buf_init(&work, headroom));
+        assert_true(openvpn_decrypt(&copy, work, &co_copy, &frame, BPTR(&copy)));
+        assert_true(openvpn_decrypt_in_place_init(&work_in_place, &in_place,
+                                                  &co_in_place));
+        assert_true(openvpn_decrypt(&in_place, work_in_place, &co_in_place,
+                                    &frame, BPTR(&in_place)));
+        assert_ptr_equal(in_place.data, buf_in_place.data);
+
+        assert_int_equal(BLEN(&in_place), strlen(ipsumlorem));
+        assert_memory_equal(BPTR(&in_place), ipsumlorem, strlen(ipsumlorem));
+        assert_int_equal(BLEN(&copy), strlen(ipsumlorem));
+        assert_memory_equal(BPTR(&copy), ipsumlorem, strlen(ipsumlorem));
+    }
+
+    /* not enough headroom left for the reserve */
+    ASSERT(buf_init(&buf_in_place, 30));
+    ASSERT(buf_write(&buf_in_place, ipsumlorem, 16));
+    assert_false(openvpn_encrypt_in_place_init(&work, &buf_in_place,
+                                               &co_in_place, 16));
+
+    free_buf(&work);
+    free_buf(&buf_copy);
+    free_buf(&buf_in_place);
+    free_key_ctx_bi(&co_copy.key_ctx_bi);
+    free_key_ctx_bi(&co_in_place.key_ctx_bi);
+    packet_id_free(&co_copy.packet_id);
+    packet_id_free(&co_in_place.packet_id);
+}
+
+/* AES-128-GCM test case 4 of the GCM specification */
+static const uint8_t gcm_key[] = {
+    0xfe, 0xff, 0xe9, 0x92, 0x86, 0x65, 0x73, 0x1c,
+    0x6d, 0x6a, 0x8f, 0x94, 0x67, 0x30, 0x83, 0x08
+};
+static const uint8_t gcm_iv[] = {
+    0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad,
+    0xde, 0xca, 0xf8, 0x88
+};
+static const uint8_t gcm_ad[] = {
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xfe, 0xed, 0xfa, 0xce, 0xde, 0xad, 0xbe, 0xef,
+    0xab, 0xad, 0xda, 0xd2
+};
+static const uint8_t gcm_plain[] = {
+    0xd9, 0x31, 0x32, 0x25, 0xf8, 0x84, 0x06, 0xe5,
+    0xa5, 0x59, 0x09, 0xc5, 0xaf, 0xf5, 0x26, 0x9a,
+    0x86, 0xa7, 0xa9, 0x53, 0x15, 0x34, 0xf7, 0xda,
+    0x2e, 0x4c, 0x30, 0x3d, 0x8a, 0x31, 0x8a, 0x72,
+    0x1c, 0x3c, 0x0c, 0x95, 0x95, 0x68, 0x09, 0x53,
+    0x2f, 0xcf, 0x0e, 0x24, 0x49, 0xa6, 0xb5, 0x25,
+    0xb1, 0x6a, 0xed, 0xf5, 0xaa, 0x0d, 0xe6, 0x57,
+    0xba, 0x63, 0x7b, 0x39
+};
+static const uint8_t gcm_cipher[] = {
+    0x42, 0x83, 0x1e, 0xc2, 0x21, 0x77, 0x74, 0x24,
+    0x4b, 0x72, 0x21, 0xb7, 0x84, 0xd0, 0xd4, 0x9c,
+    0xe3, 0xaa, 0x21, 0x2f, 0x2c, 0x02, 0xa4, 0xe0,
+    0x35, 0xc1, 0x7e, 0x23, 0x29, 0xac, 0xa1, 0x2e,
+    0x21, 0xd5, 0x14, 0xb2, 0x54, 0x66, 0x93, 0x1c,
+    0x7d, 0x8f, 0x6a, 0x5a, 0xac, 0x84, 0xaa, 0x05,
+    0x1b, 0xa3, 0x0b, 0x39, 0x6a, 0x0a, 0xac, 0x97,
+    0x3d, 0x58, 0xe0, 0x91
+};
+static const uint8_t gcm_tag[] = {
+    0x5b, 0xc9, 0x4f, 0xbc, 0x32, 0x21, 0xa5, 0xdb,
+    0x94, 0xfa, 0xe9, 0x5a, 0xe7, 0x12, 0x1a, 0x47
+};
+
+/* encrypt and decrypt in place through the cipher_ctx API, as the data
+ * channel does, and check the result against the known answer */
+static void
+crypto_test_aead_known_answer(void **state)
+{
+    uint8_t key[MAX_CIPHER_KEY_LENGTH] = { 0 };
+    memcpy(key, gcm_key, sizeof(gcm_key));
+
+    cipher_ctx_t *enc = cipher_ctx_new();
+    cipher_ctx_t *dec = cipher_ctx_new();
+    cipher_ctx_init(enc, key, "AES-128-GCM", OPENVPN_OP_ENCRYPT);
+    cipher_ctx_init(dec, key, "AES-128-GCM", OPENVPN_OP_DECRYPT);
+    assert_int_equal(cipher_ctx_iv_length(enc), sizeof(gcm_iv));
+
+    for (int i = 0; i < 2; i++)
+    {
+        uint8_t data[sizeof(gcm_plain)];
+        uint8_t tag[sizeof(gcm_tag)];
+        int outlen = 0;
+
+        memcpy(data, gcm_plain, sizeof(data));
+        assert_true(cipher_ctx_reset(enc, gcm_iv));
+        assert_true(cipher_ctx_update_ad(enc, gcm_ad, sizeof(gcm_ad)));
+        assert_true(cipher_ctx_update(enc, data, &outlen, data, sizeof(data)));
+        assert_int_equal(outlen, sizeof(data));
+        assert_true(cipher_ctx_final(enc, data + outlen, &outlen));
+        assert_int_equal(outlen, 0);
+        assert_true(cipher_ctx_get_tag(enc, tag, sizeof(tag)));
+        assert_memory_equal(data, gcm_cipher, sizeof(gcm_cipher));
+        assert_memory_equal(tag, gcm_tag, sizeof(gcm_tag));
+
+        assert_true(cipher_ctx_reset(dec, gcm_iv));
+        assert_true(cipher_ctx_update_ad(dec, gcm_ad, sizeof(gcm_ad)));
+        assert_true(cipher_ctx_update(dec, data, &outlen, data, sizeof(data)));
+        assert_true(cipher_ctx_final_check_tag(dec, data + outlen, &outlen,
+                                               tag, sizeof(tag)));
+        assert_memory_equal(data, gcm_plain, sizeof(gcm_plain));
+
+        /* a modified tag is refused */
+        tag[0] ^= 1;
+        assert_true(cipher_ctx_reset(dec, gcm_iv));
+        assert_true(cipher_ctx_update_ad(dec, gcm_ad, sizeof(gcm_ad)));
+        assert_true(cipher_ctx_update(dec, data, &outlen, (uint8_t *) gcm_cipher,
+                                      sizeof(gcm_cipher)));
+        assert_false(cipher_ctx_final_check_tag(dec, data + outlen, &outlen,
+                                                tag, sizeof(tag)));
+    }
+
+    cipher_ctx_free(enc);
+    cipher_ctx_free(dec);
+}
+
+/* HKDF-Expand-Label with the secret 0x00..0x1f, one and two blocks long */
+static const uint8_t epoch_label_upd[] = {
+    0xe3, 0x5b, 0xff, 0xa3, 0x1e, 0x27, 0x23, 0xbf, 0x09, 0xe8, 0xd3, 0x94,
+    0xfa, 0x91, 0x71, 0xca, 0x4e, 0x53, 0x45, 0x53, 0xbf, 0xfa, 0x1d, 0x34,
+    0x82, 0xde, 0x4c, 0x9b, 0x3b, 0xc6, 0x39, 0xd7
+};
+static const uint8_t epoch_label_test[] = {
+    0x0c, 0x5a, 0x25, 0x3d, 0xcd, 0x21, 0xb1, 0x1c, 0x82, 0x01, 0x64, 0xca,
+    0xd0, 0x6a, 0x02, 0x73, 0x99, 0x78, 0xf0, 0x7f, 0xa0, 0x4f, 0x0f, 0xd7,
+    0x73, 0x84, 0x8f, 0xb4, 0x5f, 0x00, 0x98, 0x64, 0x51, 0x20, 0x7d, 0x31,
+    0xe1, 0xe6, 0x8f, 0xde, 0xf9, 0xd1, 0x05, 0x13, 0x3a, 0x1b, 0x11, 0xbd
+};
+
+static void
+crypto_test_epoch_key_derivation(void **state)
+{
+    uint8_t secret[SHA256_DIGEST_LENGTH];
+    uint8_t out[48];
+
+    for (size_t i = 0; i < sizeof(secret); i++)
+    {
+        secret[i] = (uint8_t) i;
+    }
+
+    ovpn_expand_label(secret, "datakey upd", out, sizeof(epoch_label_upd));
+    assert_memory_equal(out, epoch_label_upd, sizeof(epoch_label_upd));
+    ovpn_expand_label(secret, "unit test", out, sizeof(epoch_label_test));
+    assert_memory_equal(out, epoch_label_test, sizeof(epoch_label_test));
+
+    struct epoch_key ek;
+    memcpy(ek.epoch_key, secret, sizeof(ek.epoch_key));
+    ek.epoch = 7;
+    epoch_key_iterate(&ek);
+    assert_int_equal(ek.epoch, 8);
+    assert_memory_equal(ek.epoch_key, epoch_label_upd, sizeof(ek.epoch_key));
+}
+
+static void
+init_epoch_crypto_options(struct crypto_options *co, struct key_type *kt,
+                          bool server)
+{
+    struct key2 key2 = { .n = 2 };
+    for (size_t i = 0; i < sizeof(key2.keys[0].cipher); i++)
+    {
+        key2.keys[0].cipher[i] = (uint8_t) i;
+        key2.keys[1].cipher[i] = (uint8_t) (0xff - i);
+    }
+
+    CLEAR(*co);
+    co->flags = CO_EPOCH_DATA_KEY_FORMAT;
+    packet_id_init(&co->packet_id, DEFAULT_SEQ_BACKTRACK, DEFAULT_TIME_BACKTRACK,
+                   "test", 0);
+    epoch_init_key_ctx(co, kt, &key2.keys[server], &key2.keys[!server]);
+}
+
+/* encrypt ipsumlorem, the packet is returned in a new buffer */
+static struct buffer
+epoch_encrypt(struct crypto_options *co)
+{
+    struct buffer work = alloc_buf(2048);
+    struct buffer src = alloc_buf(2048);
+    ASSERT(buf_init(&work, 128));
+    ASSERT(buf_init(&src, 128));
+    ASSERT(buf_write(&src, ipsumlorem, strlen(ipsumlorem)));
+
+    struct buffer buf = src;
+    openvpn_encrypt(&buf, work, co);
+    assert_true(BLEN(&buf) > 0);
+    struct buffer packet = clone_buf(&buf);
+
+    free_buf(&work);
+    free_buf(&src);
+    return packet;
+}
+
+static bool
+epoch_decrypt(struct crypto_options *co, const struct buffer *packet)
+{
+    struct frame frame = { .buf.headroom = 128 };
+    struct buffer work = alloc_buf(2048);
+    struct buffer copy = clone_buf(packet);
+    struct buffer buf = copy;
+
+    bool ret = openvpn_decrypt(&buf, work, co, &frame, BPTR(&buf));
+    if (ret)
+    {
+        assert_int_equal(BLEN(&buf), strlen(ipsumlorem));
+        assert_memory_equal(BPTR(&buf), ipsumlorem, strlen(ipsumlorem));
+    }
+
+    free_buf(&work);
+    free_buf(&copy);
+    return ret;
+}
+
+static void
+crypto_test_epoch_data_channel(void **state)
+{
+    struct key_type kt;
+    init_key_type(&kt, "AES-256-GCM", "none", true, false);
+
+    struct crypto_options client, server;
+    init_epoch_crypto_options(&client, &kt, false);
+    init_epoch_crypto_options(&server, &kt, true);
+
+    /* epoch 1, packet 1 */
+    struct buffer first = epoch_encrypt(&client);
+    const uint8_t first_id[] = { 0, 1, 0, 0, 0, 0, 0, 1 };
+    assert_memory_equal(BPTR(&first), first_id, sizeof(first_id));
+    assert_true(epoch_decrypt(&server, &first));
+    assert_false(epoch_decrypt(&server, &first));
+    struct buffer late = epoch_encrypt(&client);
+
+    /* the sender moves on to the next epoch once a key is used up */
+    client.packet_id.send.id = EPOCH_KEY_PACKETS;
+    struct buffer second = epoch_encrypt(&client);
+    assert_int_equal(client.key_ctx_bi.encrypt.epoch, 2);
+    assert_int_equal(client.packet_id.send.id, 1);
+    assert_true(epoch_decrypt(&server, &second));
+    assert_int_equal(server.key_ctx_bi.decrypt.epoch, 2);
+
+    /* a packet of the previous epoch is still accepted, but only once */
+    assert_true(epoch_decrypt(&server, &late));
+    assert_false(epoch_decrypt(&server, &late));
+
+    /* the receiver follows over skipped epochs... */
+    for (int i = 0; i < EPOCH_FUTURE_KEYS - 1; i++)
+    {
+        epoch_iterate_send_key(&client);
+    }
+    struct buffer skipped = epoch_encrypt(&client);
+    assert_true(epoch_decrypt(&server, &skipped));
+    assert_int_equal(server.key_ctx_bi.decrypt.epoch, 1 + EPOCH_FUTURE_KEYS);
+
+    /* ...but not beyond the keys it has ready */
+    for (int i = 0; i < EPOCH_FUTURE_KEYS + 1; i++)
+    {
+        epoch_iterate_send_key(&client);
+    }
+    struct buffer too_far = epoch_encrypt(&client);
+    assert_false(epoch_decrypt(&server, &too_far));
+    assert_int_equal(server.key_ctx_bi.decrypt.epoch, 1 + EPOCH_FUTURE_KEYS);
+
+    /* a modified epoch is refused */
+    struct buffer forged = epoch_encrypt(&server);
+    BPTR(&forged)[1] = 2;
+    assert_false(epoch_decrypt(&client, &forged));
+    struct buffer reply = epoch_encrypt(&server);
+    assert_true(epoch_decrypt(&client, &reply));
+    assert_int_equal(client.key_ctx_bi.decrypt.epoch, 1);
+
+    free_buf(&first);
+    free_buf(&late);
+    free_buf(&second);
+    free_buf(&skipped);
+    free_buf(&too_far);
+    free_buf(&forged);
+    free_buf(&reply);
+    for (int i = 0; i < 2; i++)
+    {
+        struct crypto_options *co = i ? &server : &client;
+        free_key_ctx_bi(&co->key_ctx_bi);
+        free_epoch_key_ctx(co);
+        packet_id_free(&co->packet_id);
+    }
+}
+
 void
 test_des_encrypt(void **state)
 {
@@ -466,15 +846,45 @@ test_mssfix_mtu_calculation(void **state)
     gc_free(&gc);
 }
 
+static void
+crypto_test_prng_batch(void **state)
+{
+    uint8_t iv[16], prev[16], big[2048];
+
+    /* consecutive requests get different bytes, also across batches */
+    prng_bytes(prev, sizeof(prev));
+    for (int i = 0; i < 200; i++)
+    {
+        prng_bytes(iv, sizeof(iv));
+        assert_memory_not_equal(iv, prev, sizeof(iv));
+        memcpy(prev, iv, sizeof(iv));
+    }
+
+    /* large requests bypass the batch, odd sizes do not misalign it */
+    CLEAR(big);
+    prng_bytes(big, sizeof(big));
+    assert_memory_not_equal(big, big + 1024, 1024);
+    prng_bytes(big, 7);
+    prng_reset();
+    prng_bytes(iv, sizeof(iv));
+    assert_memory_not_equal(iv, prev, sizeof(iv));
+}
+
 int
 main(void)
 {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(crypto_pem_encode_decode_loopback),
         cmocka_unit_test(crypto_translate_cipher_names),
+        cmocka_unit_test(crypto_cipher_lookup),
         cmocka_unit_test(crypto_test_tls_prf),
         cmocka_unit_test(crypto_test_hmac),
+        cmocka_unit_test(crypto_test_aead_in_place),
+        cmocka_unit_test(crypto_test_aead_known_answer),
+        cmocka_unit_test(crypto_test_epoch_key_derivation),
+        cmocka_unit_test(crypto_test_epoch_data_channel),
         cmocka_unit_test(test_des_encrypt),
+        cmocka_unit_test(crypto_test_prng_batch),
         cmocka_unit_test(test_occ_mtu_calculation),
         cmocka_unit_test(test_mssfix_mtu_calculation)
     };
@@ -58,6 +58,43 @@ management_query_pk_sig(struct management *man, const char *b64_data,
     return NULL;
 }
 
+bool
+management_pk_sig_async_enabled(const struct management *man)
+{
+    (void) man;
+    return false;
+}
+
+unsigned int
+management_query_pk_sig_async(struct management *man, const char *b64_data,
+                              const char *algorithm, int (*wakeup)(void *arg),
+                              void *arg)
+{
+    (void) man;
+    (void) b64_data;
+    (void) algorithm;
+    (void) wakeup;
+    (void) arg;
+    return 0;
+}
+
+bool
+management_pk_sig_async_result(struct management *man, unsigned int id,
+                                char **sig)
+{
+    (void) man;
+    (void) id;
+    *sig = NULL;
+    return true;
+}
+
+void
+management_pk_sig_async_cancel(struct management *man, const void *arg)
+{
+    (void) man;
+    (void) arg;
+}
+
 /* tls_libctx is defined in ssl_openssl.c which we do not want to compile in */
 OSSL_LIB_CTX *tls_libctx;
 
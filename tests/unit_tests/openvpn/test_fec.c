@@ -0,0 +1,240 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+
+#include "fec.h"
+
+#include "mock_msg.h"
+
+#define GROUP 4
+
+static struct frame
+test_frame(void)
+{
+    struct frame frame = { 0 };
+    frame.buf.payload_size = 1500;
+    frame.buf.headroom = 64;
+    frame.buf.tailroom = 64;
+    return frame;
+}
+
+/* packet i of a test flow, of a different length and content each */
+static struct buffer
+packet(struct gc_arena *gc, int i)
+{
+    struct buffer buf = alloc_buf_gc(1600, gc);
+    ASSERT(buf_init(&buf, 64));
+    for (int j = 0; j < 50 + 37 * i; j++)
+    {
+        ASSERT(buf_write_u8(&buf, (uint8_t) (i * 7 + j)));
+    }
+    return buf;
+}
+
+/* send packet i through tx, the copy on the wire goes to *wire */
+static void
+send_packet(struct gc_arena *gc, struct fec *tx, int i, struct buffer *wire)
+{
+    struct buffer buf = packet(gc, i);
+    fec_outgoing(tx, &buf);
+    *wire = clone_buf(&buf);
+}
+
+static void
+send_repair(struct fec *tx, struct buffer *wire)
+{
+    struct buffer buf;
+    assert_true(fec_repair_pending(tx));
+    fec_repair_ready(tx, &buf);
+    fec_outgoing(tx, &buf);
+    *wire = clone_buf(&buf);
+}
+
+static void
+assert_packet(struct gc_arena *gc, struct buffer *buf, int i)
+{
+    struct buffer expected = packet(gc, i);
+    assert_int_equal(BLEN(buf), BLEN(&expected));
+    assert_memory_equal(BPTR(buf), BPTR(&expected), BLEN(buf));
+}
+
+static void
+test_fec_rebuild(void **state)
+{
+    struct gc_arena gc = gc_new();
+    const struct frame frame = test_frame();
+
+    /* lose each packet of a group in turn */
+    for (int lost = 0; lost < GROUP; lost++)
+    {
+        struct fec *tx = fec_init(GROUP, &frame);
+        struct fec *rx = fec_init(GROUP, &frame);
+        struct buffer wire[GROUP + 1];
+
+        for (int i = 0; i < GROUP; i++)
+        {
+            send_packet(&gc, tx, i, &wire[i]);
+        }
+        send_repair(tx, &wire[GROUP]);
+
+        for (int i = 0; i < GROUP; i++)
+        {
+            if (i != lost)
+            {
+                fec_incoming(rx, &wire[i]);
+                assert_packet(&gc, &wire[i], i);
+            }
+        }
+
+        fec_incoming(rx, &wire[GROUP]);
+        assert_packet(&gc, &wire[GROUP], lost);
+        assert_int_equal(rx->n_rebuilt, 1);
+
+        /* the lost packet turns up after all */
+        fec_incoming(rx, &wire[lost]);
+        assert_int_equal(BLEN(&wire[lost]), 0);
+
+        for (int i = 0; i <= GROUP; i++)
+        {
+            free_buf(&wire[i]);
+        }
+        fec_free(tx);
+        fec_free(rx);
+    }
+
+    gc_free(&gc);
+}
+
+static void
+test_fec_no_rebuild(void **state)
+{
+    struct gc_arena gc = gc_new();
+    const struct frame frame = test_frame();
+    struct fec *tx = fec_init(GROUP, &frame);
+    struct fec *rx = fec_init(GROUP, &frame);
+    struct buffer wire[GROUP + 1];
+
+    /* nothing lost, the repair packet is not needed */
+    for (int i = 0; i < GROUP; i++)
+    {
+        send_packet(&gc, tx, i, &wire[i]);
+    }
+    send_repair(tx, &wire[GROUP]);
+    for (int i = 0; i <= GROUP; i++)
+    {
+        fec_incoming(rx, &wire[i]);
+    }
+    assert_int_equal(BLEN(&wire[GROUP]), 0);
+    for (int i = 0; i <= GROUP; i++)
+    {
+        free_buf(&wire[i]);
+    }
+
+    /* two lost, the repair packet cannot help */
+    for (int i = 0; i < GROUP; i++)
+    {
+        send_packet(&gc, tx, i, &wire[i]);
+    }
+    send_repair(tx, &wire[GROUP]);
+    fec_incoming(rx, &wire[0]);
+    fec_incoming(rx, &wire[3]);
+    fec_incoming(rx, &wire[GROUP]);
+    assert_int_equal(BLEN(&wire[GROUP]), 0);
+    assert_int_equal(rx->n_rebuilt, 0);
+
+    for (int i = 0; i <= GROUP; i++)
+    {
+        free_buf(&wire[i]);
+    }
+    fec_free(tx);
+    fec_free(rx);
+    gc_free(&gc);
+}
+
+static void
+test_fec_reorder(void **state)
+{
+    struct gc_arena gc = gc_new();
+    const struct frame frame = test_frame();
+    struct fec *tx = fec_init(GROUP, &frame);
+    struct fec *rx = fec_init(GROUP, &frame);
+    struct buffer wire[2][GROUP + 1];
+
+    for (int g = 0; g < 2; g++)
+    {
+        for (int i = 0; i < GROUP; i++)
+        {
+            send_packet(&gc, tx, i, &wire[g][i]);
+        }
+        send_repair(tx, &wire[g][GROUP]);
+    }
+
+    /* the second group overtakes the end of the first one */
+    fec_incoming(rx, &wire[0][0]);
+    fec_incoming(rx, &wire[0][1]);
+    for (int i = 1; i <= GROUP; i++)
+    {
+        fec_incoming(rx, &wire[1][i]);
+    }
+    assert_packet(&gc, &wire[1][GROUP], 0);
+    fec_incoming(rx, &wire[0][3]);
+    fec_incoming(rx, &wire[0][GROUP]);
+    assert_packet(&gc, &wire[0][GROUP], 2);
+    assert_int_equal(rx->n_rebuilt, 2);
+
+    for (int g = 0; g < 2; g++)
+    {
+        for (int i = 0; i <= GROUP; i++)
+        {
+            free_buf(&wire[g][i]);
+        }
+    }
+    fec_free(tx);
+    fec_free(rx);
+    gc_free(&gc);
+}
+
+const struct CMUnitTest fec_tests[] = {
+    cmocka_unit_test(test_fec_rebuild),
+    cmocka_unit_test(test_fec_no_rebuild),
+    cmocka_unit_test(test_fec_reorder),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(fec_tests, NULL, NULL);
+}
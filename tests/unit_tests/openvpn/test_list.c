@@ -0,0 +1,252 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "list.h"
+
+#include "mock_msg.h"
+
+#define N_KEYS 5000
+
+static uint32_t keys[N_KEYS];
+
+static uint32_t
+key_hash_function(const void *key, uint32_t iv)
+{
+    return hash_func_short(key, sizeof(uint32_t), iv);
+}
+
+/* puts every key in one of 16 home slots to exercise long probe runs */
+static uint32_t
+key_collide_function(const void *key, uint32_t iv)
+{
+    return *(const uint32_t *) key % 16;
+}
+
+static bool
+key_compare_function(const void *key1, const void *key2)
+{
+    return *(const uint32_t *) key1 == *(const uint32_t *) key2;
+}
+
+static void
+check_contents(struct hash *hash, const bool *present)
+{
+    int n = 0;
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        void *value = hash_lookup(hash, &keys[i]);
+        if (present[i])
+        {
+            assert_ptr_equal(value, &keys[i]);
+            n++;
+        }
+        else
+        {
+            assert_null(value);
+        }
+    }
+    assert_int_equal(hash_n_elements(hash), n);
+}
+
+static void
+run_random(uint32_t (*hash_function)(const void *key, uint32_t iv), int n_keys)
+{
+    struct hash *hash = hash_init(1, 0x1234, hash_function, key_compare_function);
+    bool present[N_KEYS] = { 0 };
+
+    srand(1);
+    for (int i = 0; i < n_keys; i++)
+    {
+        keys[i] = (uint32_t) i * 2654435761u;
+    }
+
+    /* mostly adds, so that the table is resized several times with
+     * lookups and removals in between the steps of a resize */
+    for (int round = 0; round < 8 * n_keys; round++)
+    {
+        const int i = rand() % n_keys;
+        if (rand() % 3 && !present[i])
+        {
+            assert_true(hash_add(hash, &keys[i], &keys[i], false));
+            present[i] = true;
+        }
+        else
+        {
+            assert_int_equal(hash_remove(hash, &keys[i]), present[i]);
+            present[i] = false;
+        }
+        assert_int_equal(hash_lookup(hash, &keys[i]) != NULL, present[i]);
+
+        const int j = rand() % n_keys;
+        assert_int_equal(hash_lookup(hash, &keys[j]) != NULL, present[j]);
+    }
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        if (i >= n_keys)
+        {
+            present[i] = false;
+        }
+    }
+    check_contents(hash, present);
+    assert_true(hash_n_buckets(hash) >= hash_n_elements(hash));
+
+    hash_free(hash);
+}
+
+static void
+test_list_random(void **state)
+{
+    run_random(key_hash_function, N_KEYS);
+}
+
+static void
+test_list_collisions(void **state)
+{
+    run_random(key_collide_function, 500);
+}
+
+static void
+test_list_iterator_delete(void **state)
+{
+    struct hash *hash = hash_init(4, 0, key_hash_function, key_compare_function);
+    bool present[N_KEYS];
+    int visited[N_KEYS] = { 0 };
+
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        keys[i] = (uint32_t) i;
+        hash_add(hash, &keys[i], &keys[i], false);
+        present[i] = true;
+    }
+
+    /* remove every third element while iterating */
+    struct hash_iterator hi;
+    struct hash_element *he;
+    hash_iterator_init(hash, &hi);
+    while ((he = hash_iterator_next(&hi)))
+    {
+        const uint32_t k = *(const uint32_t *) he->value;
+        visited[k]++;
+        if (k % 3 == 0)
+        {
+            hash_iterator_delete_element(&hi);
+            present[k] = false;
+        }
+    }
+    hash_iterator_free(&hi);
+
+    for (int i = 0; i < N_KEYS; i++)
+    {
+        assert_int_equal(visited[i], 1);
+    }
+    check_contents(hash, present);
+    assert_int_equal(hash->n_deleted, 0);
+
+    /* iterate in ranges as the reaper does, and remove the rest */
+    const int step = 7;
+    for (int start = 0; start < hash_n_buckets(hash); start += step)
+    {
+        hash_iterator_init_range(hash, &hi, start, start + step);
+        while ((he = hash_iterator_next(&hi)))
+        {
+            const uint32_t k = *(const uint32_t *) he->value;
+            visited[k]++;
+            hash_iterator_delete_element(&hi);
+            present[k] = false;
+        }
+        hash_iterator_free(&hi);
+    }
+
+    /* removal shifts elements back into ranges that were already
+     * visited, so repeat until the table is empty */
+    while (hash_n_elements(hash))
+    {
+        hash_iterator_init(hash, &hi);
+        while ((he = hash_iterator_next(&hi)))
+        {
+            present[*(const uint32_t *) he->value] = false;
+            hash_iterator_delete_element(&hi);
+        }
+        hash_iterator_free(&hi);
+    }
+    check_contents(hash, present);
+
+    hash_free(hash);
+}
+
+static void
+test_list_hash_func_short(void **state)
+{
+    uint8_t data[40];
+    uint32_t hv[sizeof(data) + 1];
+
+    for (size_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t) i;
+    }
+
+    /* every length reads all of its bytes and only those */
+    for (uint32_t len = 0; len <= sizeof(data); len++)
+    {
+        hv[len] = hash_func_short(data, len, 0);
+        for (uint32_t i = 0; i < len; i++)
+        {
+            data[i] ^= 0x80;
+            assert_int_not_equal(hash_func_short(data, len, 0), hv[len]);
+            data[i] ^= 0x80;
+        }
+        if (len < sizeof(data))
+        {
+            data[len] ^= 0x80;
+            assert_int_equal(hash_func_short(data, len, 0), hv[len]);
+            data[len] ^= 0x80;
+        }
+        assert_int_not_equal(hash_func_short(data, len, 1), hv[len]);
+    }
+}
+
+const struct CMUnitTest list_tests[] = {
+    cmocka_unit_test(test_list_random),
+    cmocka_unit_test(test_list_collisions),
+    cmocka_unit_test(test_list_iterator_delete),
+    cmocka_unit_test(test_list_hash_func_short),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(list_tests, NULL, NULL);
+}
@@ -0,0 +1,365 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+
+#include "mbuf.h"
+
+#include "mock_msg.h"
+
+/* the set never dereferences the instances */
+static struct multi_instance *const mi1 = (struct multi_instance *) 0x100;
+static struct multi_instance *const mi2 = (struct multi_instance *) 0x200;
+static struct multi_instance *const mi3 = (struct multi_instance *) 0x300;
+
+static struct buffer
+packet(struct gc_arena *gc, uint8_t fill)
+{
+    struct buffer buf = alloc_buf_gc(1600, gc);
+    ASSERT(buf_init(&buf, 128));
+    for (int i = 0; i < 100 + fill; i++)
+    {
+        ASSERT(buf_write_u8(&buf, fill));
+    }
+    return buf;
+}
+
+static void
+queue(struct mbuf_set *ms, const struct buffer *buf, struct multi_instance *mi)
+{
+    struct mbuf_buffer *mb = mbuf_alloc_buf(ms, buf);
+    struct mbuf_item item = { .buffer = mb, .instance = mi };
+    mbuf_add_item(ms, &item);
+    mbuf_free_buf(mb);
+}
+
+static void
+queue_from(struct mbuf_set *ms, const struct buffer *buf, struct multi_instance *mi,
+           const struct multi_instance *source)
+{
+    struct mbuf_buffer *mb = mbuf_alloc_buf(ms, buf);
+    struct mbuf_item item = { .buffer = mb, .instance = mi, .source = source };
+    mbuf_add_item(ms, &item);
+    mbuf_free_buf(mb);
+}
+
+static void
+test_mbuf_reuse(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct mbuf_set *ms = mbuf_init(8);
+    struct mbuf_buffer *seen[4] = { 0 };
+    struct mbuf_item item;
+
+    for (int round = 0; round < 10; round++)
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            struct buffer buf = packet(&gc, (uint8_t) (round + i));
+            queue(ms, &buf, mi1);
+        }
+        assert_int_equal(mbuf_len(ms), 4);
+
+        for (int i = 0; i < 4; i++)
+        {
+            assert_true(mbuf_extract_item(ms, &item));
+            assert_ptr_equal(item.instance, mi1);
+
+            /* copied with the same headroom and contents */
+            const struct buffer *buf = &item.buffer->buf;
+            assert_int_equal(buf->offset, 128);
+            assert_int_equal(BLEN(buf), 100 + round + i);
+            assert_int_equal(BPTR(buf)[0], round + i);
+            assert_int_equal(BPTR(buf)[BLEN(buf) - 1], round + i);
+
+            /* after the first round the pool hands out the same buffers */
+            if (round == 0)
+            {
+                seen[i] = item.buffer;
+            }
+            else
+            {
+                bool found = false;
+                for (int j = 0; j < 4; j++)
+                {
+                    found |= (seen[j] == item.buffer);
+                }
+                assert_true(found);
+            }
+            mbuf_free_buf(item.buffer);
+        }
+        assert_false(mbuf_extract_item(ms, &item));
+    }
+
+    mbuf_free(ms);
+    gc_free(&gc);
+}
+
+static void
+test_mbuf_shared(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct mbuf_set *ms = mbuf_init(4);
+    struct buffer buf = packet(&gc, 1);
+    struct mbuf_item item;
+
+    /* broadcast: one buffer queued for two instances */
+    struct mbuf_buffer *mb = mbuf_alloc_buf(ms, &buf);
+    item.buffer = mb;
+    item.instance = mi1;
+    mbuf_add_item(ms, &item);
+    item.instance = mi2;
+    mbuf_add_item(ms, &item);
+    mbuf_free_buf(mb);
+    assert_int_equal(mb->refcount, 2);
+
+    /* a closed instance drops its reference */
+    mbuf_dereference_instance(ms, mi1);
+    assert_int_equal(mb->refcount, 1);
+    assert_ptr_equal(mbuf_peek(ms), mi2);
+    assert_null(ms->free_list);
+
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_ptr_equal(item.instance, mi2);
+    assert_ptr_equal(item.buffer, mb);
+    mbuf_free_buf(item.buffer);
+    assert_ptr_equal(ms->free_list, mb);
+    assert_false(mbuf_defined(ms));
+
+    /* overflow drops the oldest packet and recycles its buffer */
+    for (int i = 0; i < 6; i++)
+    {
+        struct buffer b = packet(&gc, (uint8_t) i);
+        queue(ms, &b, mi1);
+    }
+    assert_int_equal(mbuf_len(ms), 4);
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_int_equal(BPTR(&item.buffer->buf)[0], 2);
+    mbuf_free_buf(item.buffer);
+
+    /* a larger packet does not fit in a pooled buffer */
+    struct buffer big = alloc_buf_gc(4000, &gc);
+    ASSERT(buf_init(&big, 3000));
+    ASSERT(buf_write_u8(&big, 42));
+    mb = mbuf_alloc_buf(ms, &big);
+    assert_true(mb->buf.capacity >= 4000);
+    assert_int_equal(BPTR(&mb->buf)[0], 42);
+    mbuf_free_buf(mb);
+
+    /* frees queued and pooled buffers */
+    mbuf_free(ms);
+    gc_free(&gc);
+}
+
+static void
+test_mbuf_fair(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct mbuf_set *ms = mbuf_init(32);
+    struct mbuf_item item;
+
+    /* mi1 floods the queue, then mi2 and the tun device send one each */
+    for (int i = 0; i < 20; i++)
+    {
+        struct buffer buf = packet(&gc, 1);
+        queue_from(ms, &buf, mi3, mi1);
+    }
+    struct buffer buf2 = packet(&gc, 2);
+    queue_from(ms, &buf2, mi3, mi2);
+    struct buffer buf3 = packet(&gc, 3);
+    queue_from(ms, &buf3, mi3, NULL);
+
+    /* each source may send MBUF_QUANTUM bytes before the next one's turn */
+    const int burst = MBUF_QUANTUM / 101;
+    for (int i = 0; i < burst; i++)
+    {
+        assert_true(mbuf_extract_item(ms, &item));
+        assert_int_equal(BPTR(&item.buffer->buf)[0], 1);
+        mbuf_free_buf(item.buffer);
+    }
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_int_equal(BPTR(&item.buffer->buf)[0], 2);
+    mbuf_free_buf(item.buffer);
+    assert_ptr_equal(mbuf_peek(ms), mi3);
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_int_equal(BPTR(&item.buffer->buf)[0], 3);
+    mbuf_free_buf(item.buffer);
+
+    /* a full set drops from the source with the most packets queued */
+    for (unsigned int i = mbuf_len(ms); i < 32; i++)
+    {
+        struct buffer buf = packet(&gc, 1);
+        queue_from(ms, &buf, mi3, mi1);
+    }
+    queue_from(ms, &buf2, mi3, mi2);
+    assert_int_equal(mbuf_len(ms), 32);
+
+    int from_mi2 = 0;
+    while (mbuf_extract_item(ms, &item))
+    {
+        from_mi2 += (BPTR(&item.buffer->buf)[0] == 2);
+        mbuf_free_buf(item.buffer);
+    }
+    assert_int_equal(from_mi2, 1);
+
+    mbuf_free(ms);
+    gc_free(&gc);
+}
+
+static void
+test_mbuf_urgent(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct mbuf_set *ms = mbuf_init(16);
+    struct mbuf_item item;
+
+    /* bulk from two sources, then urgent packets from both */
+    for (int i = 0; i < 4; i++)
+    {
+        struct buffer buf = packet(&gc, 1);
+        queue_from(ms, &buf, mi3, mi1);
+        buf = packet(&gc, 2);
+        queue_from(ms, &buf, mi3, NULL);
+    }
+    struct buffer buf = packet(&gc, 3);
+    struct mbuf_buffer *mb = mbuf_alloc_buf(ms, &buf);
+    struct mbuf_item urgent = { .buffer = mb, .instance = mi3, .source = mi1 };
+    mbuf_add_item_urgent(ms, &urgent);
+    urgent.source = mi2;
+    mbuf_add_item_urgent(ms, &urgent);
+    mbuf_free_buf(mb);
+    assert_int_equal(mbuf_len(ms), 10);
+
+    /* the urgent ones go first, in order, however large their source's turn */
+    for (int i = 0; i < 2; i++)
+    {
+        assert_true(mbuf_extract_item(ms, &item));
+        assert_int_equal(BPTR(&item.buffer->buf)[0], 3);
+        mbuf_free_buf(item.buffer);
+    }
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_int_equal(BPTR(&item.buffer->buf)[0], 1);
+    mbuf_free_buf(item.buffer);
+
+    /* and one queued in the middle of a turn still jumps ahead */
+    buf = packet(&gc, 3);
+    mb = mbuf_alloc_buf(ms, &buf);
+    urgent.buffer = mb;
+    mbuf_add_item_urgent(ms, &urgent);
+    mbuf_free_buf(mb);
+    assert_true(mbuf_extract_item(ms, &item));
+    assert_int_equal(BPTR(&item.buffer->buf)[0], 3);
+    mbuf_free_buf(item.buffer);
+
+    int n = 0;
+    while (mbuf_extract_item(ms, &item))
+    {
+        assert_int_not_equal(BPTR(&item.buffer->buf)[0], 3);
+        mbuf_free_buf(item.buffer);
+        n++;
+    }
+    assert_int_equal(n, 7);
+
+    mbuf_free(ms);
+    gc_free(&gc);
+}
+
+static void
+test_mbuf_bcast(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct mbuf_set *ms = mbuf_init(2);
+    struct buffer buf = packet(&gc, 1);
+    struct mbuf_item item;
+
+    /* more recipients than slots in the set, queued as one item */
+    struct mbuf_buffer *mb = mbuf_alloc_buf(ms, &buf);
+    for (uintptr_t i = 1; i <= 40; i++)
+    {
+        mbuf_add_recipient(mb, (struct multi_instance *) (i << 8));
+    }
+    mbuf_add_bcast(ms, mb, NULL);
+    mbuf_free_buf(mb);
+    assert_int_equal(mbuf_len(ms), 1);
+
+    /* closed instances are skipped, also the one up next */
+    mbuf_dereference_instance(ms, mi1);
+    mbuf_dereference_instance(ms, mi3);
+    assert_ptr_equal(mbuf_peek(ms), mi2);
+
+    uintptr_t expected = 2;
+    while (mbuf_extract_item(ms, &item))
+    {
+        assert_ptr_equal(item.instance, (struct multi_instance *) (expected << 8));
+        assert_ptr_equal(item.buffer, mb);
+        mbuf_free_buf(item.buffer);
+        expected += expected == 2 ? 2 : 1;
+    }
+    assert_int_equal(expected, 41);
+    assert_ptr_equal(ms->free_list, mb);
+
+    /* a reused buffer starts without recipients */
+    mb = mbuf_alloc_buf(ms, &buf);
+    mbuf_add_bcast(ms, mb, NULL);
+    assert_false(mbuf_defined(ms));
+
+    /* dropping all recipients releases the buffer */
+    mbuf_add_recipient(mb, mi1);
+    mbuf_add_recipient(mb, mi2);
+    mbuf_add_bcast(ms, mb, NULL);
+    mbuf_free_buf(mb);
+    mbuf_dereference_instance(ms, mi2);
+    mbuf_dereference_instance(ms, mi1);
+    assert_null(mbuf_peek(ms));
+    assert_false(mbuf_defined(ms));
+    assert_ptr_equal(ms->free_list, mb);
+
+    mbuf_free(ms);
+    gc_free(&gc);
+}
+
+const struct CMUnitTest mbuf_tests[] = {
+    cmocka_unit_test(test_mbuf_reuse),
+    cmocka_unit_test(test_mbuf_shared),
+    cmocka_unit_test(test_mbuf_fair),
+    cmocka_unit_test(test_mbuf_urgent),
+    cmocka_unit_test(test_mbuf_bcast),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(mbuf_tests, NULL, NULL);
+}
@@ -0,0 +1,293 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "mroute.h"
+
+#include "mock_msg.h"
+
+/* Dummy functions to get the linker happy, only used by the mroute
+ * print functions */
+const char *
+print_in_addr_t(in_addr_t addr, unsigned int flags, struct gc_arena *gc)
+{
+    return "dummy print_in_addr_t from unit test";
+}
+
+const char *
+print_in6_addr(struct in6_addr a6, unsigned int flags, struct gc_arena *gc)
+{
+    return "dummy print_in6_addr from unit test";
+}
+
+static struct mroute_addr
+ipv4_net(const char *str, int netbits)
+{
+    struct mroute_addr addr = { .len = 4, .type = MR_ADDR_IPV4 };
+    assert_int_equal(inet_pton(AF_INET, str, &addr.v4.addr), 1);
+    if (netbits >= 0)
+    {
+        addr.type |= MR_WITH_NETBITS;
+        addr.netbits = (uint8_t) netbits;
+    }
+    return addr;
+}
+
+static struct mroute_addr
+ipv6_net(const char *str, int netbits)
+{
+    struct mroute_addr addr = { .len = 16, .type = MR_ADDR_IPV6 };
+    assert_int_equal(inet_pton(AF_INET6, str, &addr.v6.addr), 1);
+    if (netbits >= 0)
+    {
+        addr.type |= MR_WITH_NETBITS;
+        addr.netbits = (uint8_t) netbits;
+    }
+    return addr;
+}
+
+static void
+test_mroute_helper_lookup_ipv4(void **state)
+{
+    struct mroute_helper *mh = mroute_helper_init(60);
+    uint8_t netbits[MR_HELPER_NET_LEN];
+    struct mroute_addr net8 = ipv4_net("10.0.0.0", 8);
+    struct mroute_addr net16 = ipv4_net("10.1.0.0", 16);
+    struct mroute_addr net24 = ipv4_net("10.1.2.0", 24);
+    struct mroute_addr other = ipv4_net("192.168.0.0", 16);
+    struct mroute_addr host = ipv4_net("10.1.2.3", -1);
+
+    mroute_helper_add_iroute46(mh, &net24);
+    mroute_helper_add_iroute46(mh, &net8);
+    mroute_helper_add_iroute46(mh, &other);
+    mroute_helper_add_iroute46(mh, &net16);
+    /* host routes are not tracked */
+    mroute_helper_add_iroute46(mh, &host);
+
+    assert_int_equal(mroute_helper_lookup(mh, &host, netbits), 3);
+    assert_int_equal(netbits[0], 24);
+    assert_int_equal(netbits[1], 16);
+    assert_int_equal(netbits[2], 8);
+
+    struct mroute_addr a = ipv4_net("10.2.0.1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 1);
+    assert_int_equal(netbits[0], 8);
+
+    a = ipv4_net("11.0.0.1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 0);
+
+    /* IPv6 addresses do not match IPv4 iroutes */
+    a = ipv6_net("a01:203::", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 0);
+
+    /* iroutes are reference counted */
+    mroute_helper_add_iroute46(mh, &net16);
+    mroute_helper_del_iroute46(mh, &net16);
+    assert_int_equal(mroute_helper_lookup(mh, &host, netbits), 3);
+
+    mroute_helper_del_iroute46(mh, &net16);
+    assert_int_equal(mroute_helper_lookup(mh, &host, netbits), 2);
+    assert_int_equal(netbits[0], 24);
+    assert_int_equal(netbits[1], 8);
+
+    mroute_helper_del_iroute46(mh, &net8);
+    mroute_helper_del_iroute46(mh, &net24);
+    mroute_helper_del_iroute46(mh, &host);
+    assert_int_equal(mroute_helper_lookup(mh, &host, netbits), 0);
+
+    a = ipv4_net("192.168.77.1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 1);
+    assert_int_equal(netbits[0], 16);
+    mroute_helper_del_iroute46(mh, &other);
+    assert_null(mh->iroutes_ipv4);
+
+    mroute_helper_free(mh);
+}
+
+static void
+test_mroute_helper_lookup_ipv6(void **state)
+{
+    struct mroute_helper *mh = mroute_helper_init(60);
+    uint8_t netbits[MR_HELPER_NET_LEN];
+    struct mroute_addr def = ipv6_net("::", 0);
+    struct mroute_addr net48 = ipv6_net("2001:db8:1::", 48);
+    struct mroute_addr net64 = ipv6_net("2001:db8:1:2::", 64);
+    struct mroute_addr net128 = ipv6_net("2001:db8:1:2::1", 128);
+
+    mroute_helper_add_iroute46(mh, &net64);
+    mroute_helper_add_iroute46(mh, &net128);
+    mroute_helper_add_iroute46(mh, &def);
+    mroute_helper_add_iroute46(mh, &net48);
+
+    struct mroute_addr a = ipv6_net("2001:db8:1:2::1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 4);
+    assert_int_equal(netbits[0], 128);
+    assert_int_equal(netbits[1], 64);
+    assert_int_equal(netbits[2], 48);
+    assert_int_equal(netbits[3], 0);
+
+    a = ipv6_net("2001:db8:1:3::1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 2);
+    assert_int_equal(netbits[0], 48);
+    assert_int_equal(netbits[1], 0);
+
+    a = ipv6_net("fd00::1", -1);
+    assert_int_equal(mroute_helper_lookup(mh, &a, netbits), 1);
+    assert_int_equal(netbits[0], 0);
+
+    mroute_helper_del_iroute46(mh, &def);
+    mroute_helper_del_iroute46(mh, &net48);
+    mroute_helper_del_iroute46(mh, &net128);
+    mroute_helper_del_iroute46(mh, &net64);
+    assert_null(mh->iroutes_ipv6);
+
+    mroute_helper_free(mh);
+}
+
+#define N_RANDOM_NETS 200
+
+/*
+ * Compare the tries against checking every iroute, with random
+ * overlapping prefixes that are added and removed in random order.
+ */
+static void
+test_mroute_helper_random(void **state)
+{
+    struct mroute_helper *mh = mroute_helper_init(60);
+    struct mroute_addr nets[N_RANDOM_NETS];
+    int refcount[N_RANDOM_NETS] = { 0 };
+
+    srand(1);
+    for (int i = 0; i < N_RANDOM_NETS; i++)
+    {
+        struct mroute_addr *net = &nets[i];
+        if (i % 2)
+        {
+            *net = ipv4_net("10.0.0.0", 8 + rand() % 25);
+            net->v4.addr |= htonl(rand() & 0x00030303);
+        }
+        else
+        {
+            *net = ipv6_net("2001:db8::", 32 + rand() % 97);
+            net->v6.addr.s6_addr[4] = rand() & 3;
+            net->v6.addr.s6_addr[8] = rand() & 3;
+            net->v6.addr.s6_addr[15] = rand() & 3;
+        }
+        mroute_addr_mask_host_bits(net);
+    }
+
+    for (int round = 0; round < 2000; round++)
+    {
+        const int i = rand() % N_RANDOM_NETS;
+        if (refcount[i] && rand() % 2)
+        {
+            mroute_helper_del_iroute46(mh, &nets[i]);
+            refcount[i]--;
+        }
+        else
+        {
+            mroute_helper_add_iroute46(mh, &nets[i]);
+            refcount[i]++;
+        }
+
+        /* look up a host address inside of a random iroute */
+        struct mroute_addr addr = nets[rand() % N_RANDOM_NETS];
+        addr.type &= ~MR_WITH_NETBITS;
+        addr.netbits = 0;
+        if ((addr.type & MR_ADDR_MASK) == MR_ADDR_IPV4)
+        {
+            addr.v4.addr |= htonl(rand() & 0x3);
+        }
+        else
+        {
+            addr.v6.addr.s6_addr[15] |= rand() & 0x3;
+        }
+
+        bool expected[MR_HELPER_NET_LEN] = { false };
+        for (int j = 0; j < N_RANDOM_NETS; j++)
+        {
+            struct mroute_addr tryaddr = addr;
+            if (!refcount[j] || nets[j].type != (addr.type | MR_WITH_NETBITS))
+            {
+                continue;
+            }
+            tryaddr.type |= MR_WITH_NETBITS;
+            tryaddr.netbits = nets[j].netbits;
+            mroute_addr_mask_host_bits(&tryaddr);
+            if (mroute_addr_equal(&tryaddr, &nets[j]))
+            {
+                expected[nets[j].netbits] = true;
+            }
+        }
+
+        uint8_t netbits[MR_HELPER_NET_LEN];
+        int n = mroute_helper_lookup(mh, &addr, netbits);
+        int k = 0;
+        for (int bits = MR_HELPER_NET_LEN - 1; bits >= 0; bits--)
+        {
+            if (expected[bits])
+            {
+                assert_true(k < n);
+                assert_int_equal(netbits[k], bits);
+                k++;
+            }
+        }
+        assert_int_equal(k, n);
+    }
+
+    for (int i = 0; i < N_RANDOM_NETS; i++)
+    {
+        while (refcount[i]--)
+        {
+            mroute_helper_del_iroute46(mh, &nets[i]);
+        }
+    }
+    assert_null(mh->iroutes_ipv4);
+    assert_null(mh->iroutes_ipv6);
+
+    mroute_helper_free(mh);
+}
+
+const struct CMUnitTest mroute_tests[] = {
+    cmocka_unit_test(test_mroute_helper_lookup_ipv4),
+    cmocka_unit_test(test_mroute_helper_lookup_ipv6),
+    cmocka_unit_test(test_mroute_helper_random),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(mroute_tests, NULL, NULL);
+}
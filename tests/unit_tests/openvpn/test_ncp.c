@@ -259,13 +259,46 @@ test_ncp_best(void **state)
     gc_free(&gc);
 }
 
+static void
+test_ncp_hw_aware(void **state)
+{
+    struct gc_arena gc = gc_new();
+
+    const char *serverlist = "AES-256-GCM:AES-128-GCM:CHACHA20-POLY1305";
+    const char *peer_ciphers = "IV_CIPHERS=AES-256-GCM:CHACHA20-POLY1305";
+
+    /* a client without hardware AES gets ChaCha20-Poly1305 */
+    const char *peer_info = "IV_CIPHERS=AES-256-GCM:CHACHA20-POLY1305\nIV_AES_HW=0";
+    const char *list = ncp_hw_aware_ciphers(serverlist, peer_info, &gc);
+    assert_string_equal(list, "CHACHA20-POLY1305:AES-256-GCM:AES-128-GCM");
+    assert_string_equal(ncp_get_best_cipher(list, peer_info, NULL, &gc),
+                        "CHACHA20-POLY1305");
+
+    /* with hardware AES on both ends, or no information from the client,
+     * the order only changes if we have no hardware AES ourselves */
+    const char *expected = crypto_aes_hw_accel() ? serverlist
+                           : "CHACHA20-POLY1305:AES-256-GCM:AES-128-GCM";
+    assert_string_equal(ncp_hw_aware_ciphers(serverlist, "IV_AES_HW=1", &gc),
+                        expected);
+    assert_string_equal(ncp_hw_aware_ciphers(serverlist, peer_ciphers, &gc),
+                        expected);
+
+    /* nothing to reorder without ChaCha20-Poly1305 */
+    assert_string_equal(ncp_hw_aware_ciphers("AES-256-GCM:AES-128-GCM",
+                                             "IV_AES_HW=0", &gc),
+                        "AES-256-GCM:AES-128-GCM");
+
+    gc_free(&gc);
+}
+
 
 
 const struct CMUnitTest ncp_tests[] = {
     cmocka_unit_test(test_check_ncp_ciphers_list),
     cmocka_unit_test(test_extract_client_ciphers),
     cmocka_unit_test(test_poor_man),
-    cmocka_unit_test(test_ncp_best)
+    cmocka_unit_test(test_ncp_best),
+    cmocka_unit_test(test_ncp_hw_aware)
 };
 
 
@@ -155,6 +155,234 @@ test_packet_id_write_long_wrap(void **state)
     assert_true(data->test_buf_data.buf_time == htonl(now));
 }
 
+static void
+test_packet_id_store_aead_epoch(void **state)
+{
+    struct test_packet_id_write_data *data = *state;
+    const uint8_t expected[] = { 0x01, 0x02, 0, 0, 0, 0, 0, 1 };
+    uint8_t dst[PACKET_ID_EPOCH_SIZE];
+
+    assert_int_equal(PACKET_ID_AEAD_SIZE(true), sizeof(expected));
+    assert_true(packet_id_store_aead(&data->pis, true, 0x0102, dst));
+    assert_int_equal(data->pis.id, 1);
+    assert_memory_equal(dst, expected, sizeof(expected));
+
+    /* the counter is limited to 32 bits, epochs change long before */
+    data->pis.id = ~0;
+    assert_false(packet_id_store_aead(&data->pis, true, 0x0102, dst));
+}
+
+static void
+test_packet_id_load_aead_epoch(void **state)
+{
+    struct test_packet_id_write_data *data = *state;
+    struct packet_id_net pin;
+    uint8_t dst[PACKET_ID_EPOCH_SIZE];
+
+    data->pis.id = 41;
+    assert_true(packet_id_store_aead(&data->pis, true, 7, dst));
+    assert_int_equal(packet_id_load_aead(&pin, true, dst), 7);
+    assert_int_equal(pin.id, 42);
+
+    /* the upper 16 bits of the 48-bit counter are never used */
+    dst[3] = 1;
+    assert_int_equal(packet_id_load_aead(&pin, true, dst), 0);
+    assert_int_equal(pin.id, 0);
+}
+
+static void
+test_packet_id_store_aead(void **state)
+{
+    struct test_packet_id_write_data *data = *state;
+    struct packet_id_net pin;
+    uint8_t dst[PACKET_ID_EPOCH_SIZE];
+
+    /* the short form has the same bytes as packet_id_write() */
+    data->pis.id = 41;
+    assert_true(packet_id_write(&data->pis, &data->test_buf, false, false));
+    data->pis.id = 41;
+    assert_true(packet_id_store_aead(&data->pis, false, 0, dst));
+    assert_memory_equal(dst, BPTR(&data->test_buf), PACKET_ID_AEAD_SIZE(false));
+    assert_int_equal(packet_id_load_aead(&pin, false, dst), 1);
+    assert_int_equal(pin.id, 42);
+
+    data->pis.id = ~0;
+    assert_false(packet_id_store_aead(&data->pis, false, 0, dst));
+}
+
+static void
+test_packet_id_close_to_wrapping(void **state)
+{
+    struct packet_id_send pis = { .id = PACKET_ID_WRAP_TRIGGER - 1 };
+
+    assert_false(packet_id_close_to_wrapping(&pis));
+    pis.id++;
+    assert_true(packet_id_close_to_wrapping(&pis));
+
+    /* enough packet ids are left for a renegotiation at 1M packets/s */
+    assert_true((uint64_t) PACKET_ID_MAX - PACKET_ID_WRAP_TRIGGER
+                > (uint64_t) 1000000 * 120);
+}
+
+/* packet_id_test() followed by packet_id_add() if the packet is accepted,
+ * as crypto_check_replay() does it */
+static bool
+check_add(struct packet_id_rec *rec, packet_id_type id, time_t time)
+{
+    struct packet_id_net pin = { .id = id, .time = time };
+    packet_id_reap_test(rec);
+    if (!packet_id_test(rec, &pin))
+    {
+        return false;
+    }
+    packet_id_add(rec, &pin);
+    return true;
+}
+
+static void
+test_packet_id_replay_window(void **state)
+{
+    struct packet_id pid;
+
+    now = 5010;
+    packet_id_init(&pid, 64, 15, "test", 0);
+    struct packet_id_rec *rec = &pid.rec;
+
+    assert_false(check_add(rec, 0, 0));
+    for (packet_id_type id = 1; id <= 5; id++)
+    {
+        if (id != 4)
+        {
+            assert_true(check_add(rec, id, 0));
+        }
+    }
+    assert_false(check_add(rec, 5, 0));
+    assert_true(check_add(rec, 4, 0));
+    assert_false(check_add(rec, 4, 0));
+
+    /* move the window across a word boundary */
+    assert_true(check_add(rec, 68, 0));
+    assert_false(check_add(rec, 4, 0));
+    assert_false(check_add(rec, 5, 0));
+    assert_true(check_add(rec, 6, 0));
+    assert_false(check_add(rec, 6, 0));
+    assert_true(check_add(rec, 64, 0));
+    assert_true(check_add(rec, 63, 0));
+    assert_false(check_add(rec, 68, 0));
+
+    /* a jump beyond the window starts over */
+    assert_true(check_add(rec, 1000, 0));
+    assert_false(check_add(rec, 936, 0));
+    assert_true(check_add(rec, 937, 0));
+    assert_true(check_add(rec, 999, 0));
+    assert_false(check_add(rec, 999, 0));
+
+    /* so does a newer timestamp, an older one is rejected */
+    assert_true(check_add(rec, 10, 1));
+    assert_true(check_add(rec, 9, 1));
+    assert_false(check_add(rec, 1001, 0));
+
+    packet_id_free(&pid);
+}
+
+static void
+test_packet_id_replay_window_large(void **state)
+{
+    struct packet_id pid;
+
+    now = 5010;
+    packet_id_init(&pid, MAX_SEQ_BACKTRACK, 15, "test", 0);
+    struct packet_id_rec *rec = &pid.rec;
+
+    /* receive every packet of the window backwards, twice */
+    const packet_id_type top = 100000;
+    assert_true(check_add(rec, top, 0));
+    for (packet_id_type id = top - 1; id > top - MAX_SEQ_BACKTRACK; id--)
+    {
+        assert_true(check_add(rec, id, 0));
+    }
+    assert_false(check_add(rec, top - MAX_SEQ_BACKTRACK, 0));
+    for (packet_id_type id = top; id > top - MAX_SEQ_BACKTRACK; id--)
+    {
+        assert_false(check_add(rec, id, 0));
+    }
+
+    /* slide half a window further, the new half is unseen */
+    assert_true(check_add(rec, top + MAX_SEQ_BACKTRACK / 2, 0));
+    for (packet_id_type id = top + 1; id < top + MAX_SEQ_BACKTRACK / 2; id++)
+    {
+        assert_true(check_add(rec, id, 0));
+    }
+    assert_false(check_add(rec, top, 0));
+    assert_false(check_add(rec, top - MAX_SEQ_BACKTRACK / 2, 0));
+
+    packet_id_free(&pid);
+}
+
+static void
+test_packet_id_replay_window_time(void **state)
+{
+    struct packet_id pid;
+
+    now = 5000;
+    packet_id_init(&pid, 256, 15, "test", 0);
+    struct packet_id_rec *rec = &pid.rec;
+
+    assert_true(check_add(rec, 10, 0));
+    now = 5010;
+    assert_true(check_add(rec, 70, 0));
+
+    /* packets older than the one received at 5000 are too late now */
+    now = 5016;
+    assert_false(check_add(rec, 9, 0));
+    assert_true(check_add(rec, 65, 0));
+    assert_true(check_add(rec, 100, 0));
+
+    /* and after 5025 everything up to the newest packet */
+    now = 5026;
+    assert_false(check_add(rec, 66, 0));
+    assert_false(check_add(rec, 99, 0));
+    assert_true(check_add(rec, 101, 0));
+
+    packet_id_free(&pid);
+}
+
+#ifndef _WIN32
+static void
+test_packet_id_persist(void **state)
+{
+    char filename[] = "/tmp/test_packet_id_persist.XXXXXX";
+    struct packet_id_persist p;
+
+    int fd = mkstemp(filename);
+    assert_true(fd >= 0);
+    close(fd);
+
+    packet_id_persist_init(&p);
+    packet_id_persist_load(&p, filename);
+    assert_true(packet_id_persist_enabled(&p));
+    assert_int_equal(p.time, 0);
+
+    p.time = 5000;
+    p.id = 0x12345678;
+    packet_id_persist_save(&p);
+    assert_int_equal(p.time_last_written, 5000);
+    assert_int_equal(p.id_last_written, 0x12345678);
+
+    p.id = 0x12345679;
+    packet_id_persist_save(&p);
+    packet_id_persist_close(&p);
+
+    packet_id_persist_init(&p);
+    packet_id_persist_load(&p, filename);
+    assert_int_equal(p.time, 5000);
+    assert_int_equal(p.id, 0x12345679);
+    packet_id_persist_close(&p);
+
+    unlink(filename);
+}
+#endif
+
 static void
 test_get_num_output_sequenced_available(void **state)
 {
@@ -294,6 +522,22 @@ main(void)
         cmocka_unit_test_setup_teardown(test_packet_id_write_long_wrap,
                                         test_packet_id_write_setup,
                                         test_packet_id_write_teardown),
+        cmocka_unit_test_setup_teardown(test_packet_id_store_aead_epoch,
+                                        test_packet_id_write_setup,
+                                        test_packet_id_write_teardown),
+        cmocka_unit_test_setup_teardown(test_packet_id_load_aead_epoch,
+                                        test_packet_id_write_setup,
+                                        test_packet_id_write_teardown),
+        cmocka_unit_test_setup_teardown(test_packet_id_store_aead,
+                                        test_packet_id_write_setup,
+                                        test_packet_id_write_teardown),
+        cmocka_unit_test(test_packet_id_close_to_wrapping),
+        cmocka_unit_test(test_packet_id_replay_window),
+        cmocka_unit_test(test_packet_id_replay_window_large),
+        cmocka_unit_test(test_packet_id_replay_window_time),
+#ifndef _WIN32
+        cmocka_unit_test(test_packet_id_persist),
+#endif
         cmocka_unit_test(test_get_num_output_sequenced_available),
         cmocka_unit_test(test_copy_acks_to_lru)
 
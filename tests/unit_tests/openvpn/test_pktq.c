@@ -0,0 +1,150 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "pktq.h"
+#include "socket.h"
+
+#include "mock_msg.h"
+
+#define HEADROOM 64
+
+static struct buffer
+packet(struct gc_arena *gc, uint8_t fill)
+{
+    struct buffer buf = alloc_buf_gc(1600, gc);
+    ASSERT(buf_init(&buf, HEADROOM));
+    for (int i = 0; i < 100 + fill; i++)
+    {
+        ASSERT(buf_write_u8(&buf, fill));
+    }
+    return buf;
+}
+
+static bool
+push(struct packet_queue *q, struct gc_arena *gc, uint8_t fill,
+     const struct link_socket_actual *to)
+{
+    const struct buffer buf = packet(gc, fill);
+    return pktq_push(q, &buf, to);
+}
+
+static void
+test_pktq_order(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct packet_queue *q = pktq_init(4, 1600, HEADROOM, false);
+    struct buffer buf;
+
+    assert_true(pktq_empty(q));
+    assert_true(pktq_empty(NULL));
+    assert_false(pktq_full(NULL));
+
+    /* packets come out in the order they went in, also around the end */
+    for (uint8_t i = 1; i <= 3; i++)
+    {
+        assert_true(push(q, &gc, i, NULL));
+    }
+    for (uint8_t i = 1; i <= 2; i++)
+    {
+        assert_null(pktq_front(q, &buf));
+        assert_int_equal(BLEN(&buf), 100 + i);
+        assert_int_equal(*BPTR(&buf), i);
+        pktq_pop(q);
+    }
+    for (uint8_t i = 4; i <= 6; i++)
+    {
+        assert_true(push(q, &gc, i, NULL));
+    }
+    assert_true(pktq_full(q));
+    assert_false(push(q, &gc, 7, NULL));
+
+    for (uint8_t i = 3; i <= 6; i++)
+    {
+        pktq_front(q, &buf);
+        assert_int_equal(BLEN(&buf), 100 + i);
+        assert_int_equal(*BPTR(&buf), i);
+        pktq_pop(q);
+    }
+    assert_true(pktq_empty(q));
+
+    pktq_free(q);
+    gc_free(&gc);
+}
+
+static void
+test_pktq_headroom(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct packet_queue *q = pktq_init(2, 1600, HEADROOM, true);
+    struct link_socket_actual to;
+    struct buffer buf;
+    uint16_t len = 0;
+
+    CLEAR(to);
+    to.dest.addr.in4.sin_family = AF_INET;
+    to.dest.addr.in4.sin_port = htons(1194);
+    assert_true(push(q, &gc, 1, &to));
+
+    /* the socket may prepend to the packet, that must not stick */
+    struct link_socket_actual *a = pktq_front(q, &buf);
+    assert_non_null(a);
+    assert_int_equal(ntohs(a->dest.addr.in4.sin_port), 1194);
+    assert_true(buf_write_prepend(&buf, &len, sizeof(len)));
+    pktq_front(q, &buf);
+    assert_int_equal(BLEN(&buf), 101);
+    assert_int_equal(buf_reverse_capacity(&buf), HEADROOM);
+
+    /* packets that do not fit are refused */
+    struct buffer big = alloc_buf_gc(2000, &gc);
+    ASSERT(buf_init(&big, 0));
+    ASSERT(buf_write_alloc(&big, 1600));
+    assert_false(pktq_push(q, &big, &to));
+    assert_int_equal(q->len, 1);
+
+    pktq_free(q);
+    gc_free(&gc);
+}
+
+const struct CMUnitTest pktq_tests[] = {
+    cmocka_unit_test(test_pktq_order),
+    cmocka_unit_test(test_pktq_headroom),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(pktq_tests, NULL, NULL);
+}
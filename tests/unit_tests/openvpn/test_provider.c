@@ -39,10 +39,19 @@
 #include <openssl/pem.h>
 #include <openssl/core_names.h>
 #include <openssl/evp.h>
+#include <openssl/async.h>
 
 struct management *management; /* global */
 static int mgmt_callback_called;
 
+/* state of the mock asynchronous management signature requests */
+static bool mgmt_async_enabled;
+static unsigned int mgmt_async_id;
+static char *mgmt_async_reply;
+static bool mgmt_async_replied;
+static int (*mgmt_async_wakeup)(void *arg);
+static void *mgmt_async_wakeup_arg;
+
 #ifndef _countof
 #define _countof(x) sizeof((x))/sizeof(*(x))
 #endif
@@ -187,6 +196,53 @@ management_query_pk_sig(struct management *man, const char *b64_data,
     return out;
 }
 
+bool
+management_pk_sig_async_enabled(const struct management *man)
+{
+    return mgmt_async_enabled;
+}
+
+/* Mock asynchronous signature request.  The request is checked like the
+ * blocking one, but its reply is handed out only once the test sets
+ * mgmt_async_replied.
+ */
+unsigned int
+management_query_pk_sig_async(struct management *man, const char *b64_data,
+                              const char *algorithm, int (*wakeup)(void *arg),
+                              void *arg)
+{
+    assert_null(mgmt_async_reply);
+    mgmt_async_reply = management_query_pk_sig(man, b64_data, algorithm);
+    mgmt_async_replied = false;
+    mgmt_async_wakeup = wakeup;
+    mgmt_async_wakeup_arg = arg;
+
+    return ++mgmt_async_id;
+}
+
+bool
+management_pk_sig_async_result(struct management *man, unsigned int id,
+                                char **sig)
+{
+    assert_int_equal(id, mgmt_async_id);
+    if (!mgmt_async_replied)
+    {
+        return false;
+    }
+    *sig = mgmt_async_reply;
+    mgmt_async_reply = NULL;
+    return true;
+}
+
+void
+management_pk_sig_async_cancel(struct management *man, const void *arg)
+{
+    assert_ptr_equal(arg, mgmt_async_wakeup_arg);
+    free(mgmt_async_reply);
+    mgmt_async_reply = NULL;
+    mgmt_async_wakeup = NULL;
+}
+
 /* Check signature and keymgmt methods can be fetched from the provider */
 static void
 xkey_provider_test_fetch(void **state)
@@ -312,6 +368,97 @@ again:
         EVP_PKEY_free(privkey);
     }
 }
+
+static int async_wakeup_called;
+
+static int
+async_wakeup(void *arg)
+{
+    assert_ptr_equal(arg, &async_wakeup_called);
+    async_wakeup_called++;
+    return 1;
+}
+
+struct async_sign_args
+{
+    EVP_PKEY *privkey;
+    uint8_t *sig;
+};
+
+static int
+async_sign_job(void *arg)
+{
+    struct async_sign_args *args = *(struct async_sign_args **)arg;
+
+    args->sig = digest_sign(args->privkey);
+    return args->sig != NULL;
+}
+
+/* Check that a management external key signature requested from inside
+ * an async job pauses the job instead of blocking, and that the job
+ * completes with the signature once the reply is in.
+ */
+static void
+xkey_provider_test_mgmt_sign_async(void **state)
+{
+    if (!ASYNC_is_capable())
+    {
+        skip();
+    }
+
+    for (size_t i = 0; i < _countof(pubkeys); i++)
+    {
+        EVP_PKEY *pubkey = load_pubkey(pubkeys[i]);
+        EVP_PKEY *privkey = xkey_load_management_key(NULL, pubkey);
+        assert_non_null(privkey);
+
+        management->settings.flags = MF_EXTERNAL_KEY|MF_EXTERNAL_KEY_PSSPAD;
+        mgmt_async_enabled = true;
+        mgmt_callback_called = 0;
+        async_wakeup_called = 0;
+
+        ASYNC_WAIT_CTX *wctx = ASYNC_WAIT_CTX_new();
+        assert_non_null(wctx);
+        assert_int_equal(ASYNC_WAIT_CTX_set_callback(wctx, async_wakeup,
+                                                     &async_wakeup_called), 1);
+
+        ASYNC_JOB *job = NULL;
+        int ret = 0;
+        struct async_sign_args args = { .privkey = privkey };
+        struct async_sign_args *argp = &args;
+
+        /* the request goes out and the job pauses */
+        assert_int_equal(ASYNC_start_job(&job, wctx, &ret, async_sign_job,
+                                         &argp, sizeof(argp)), ASYNC_PAUSE);
+        assert_int_equal(mgmt_callback_called, 1);
+        assert_ptr_equal(mgmt_async_wakeup, async_wakeup);
+        assert_null(args.sig);
+
+        /* resuming before the reply arrives pauses again */
+        assert_int_equal(ASYNC_start_job(&job, wctx, &ret, async_sign_job,
+                                         &argp, sizeof(argp)), ASYNC_PAUSE);
+        assert_null(args.sig);
+
+        /* the reply arrives and wakes up the job */
+        mgmt_async_replied = true;
+        mgmt_async_wakeup(mgmt_async_wakeup_arg);
+        assert_int_equal(async_wakeup_called, 1);
+
+        assert_int_equal(ASYNC_start_job(&job, wctx, &ret, async_sign_job,
+                                         &argp, sizeof(argp)), ASYNC_FINISH);
+        assert_int_equal(ret, 1);
+        assert_non_null(args.sig);
+        assert_memory_equal(args.sig, good_sig, sizeof(good_sig));
+        assert_null(mgmt_async_reply);
+        test_free(args.sig);
+
+        ASYNC_WAIT_CTX_free(wctx);
+        mgmt_async_enabled = false;
+
+        EVP_PKEY_free(pubkey);
+        EVP_PKEY_free(privkey);
+    }
+}
 #endif /* ifdef ENABLE_MANAGEMENT */
 
 /* helpers for testing generic key load and sign */
@@ -414,6 +561,7 @@ main(void)
         cmocka_unit_test(xkey_provider_test_fetch),
 #ifdef ENABLE_MANAGEMENT
         cmocka_unit_test(xkey_provider_test_mgmt_sign_cb),
+        cmocka_unit_test(xkey_provider_test_mgmt_sign_async),
 #endif
         cmocka_unit_test(xkey_provider_test_generic_sign_cb),
     };
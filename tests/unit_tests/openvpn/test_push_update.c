@@ -0,0 +1,138 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "push.h"
+#include "options.h"
+
+#include "mock_msg.h"
+
+static void
+test_push_update_option_parts(void **state)
+{
+    assert_int_equal(push_update_option_parts("route 10.1.0.0 255.255.0.0"),
+                     PULL_RESET_ROUTES);
+    assert_int_equal(push_update_option_parts("route-ipv6 fd00::/64"),
+                     PULL_RESET_ROUTES_IPV6);
+    assert_int_equal(push_update_option_parts("dhcp-option DNS 10.0.0.1"),
+                     PULL_RESET_DNS);
+    assert_int_equal(push_update_option_parts("dns server 1 address 10.0.0.1"),
+                     PULL_RESET_DNS);
+
+    /* a plain -name removes all options of that name */
+    assert_int_equal(push_update_option_parts("-route"), PULL_RESET_ROUTES);
+    assert_int_equal(push_update_option_parts("-route-ipv6"), PULL_RESET_ROUTES_IPV6);
+    assert_int_equal(push_update_option_parts("-dns"), PULL_RESET_DNS);
+    assert_int_equal(push_update_option_parts("-route 10.1.0.0 255.255.0.0"), 0);
+
+    /* only whole names match */
+    assert_int_equal(push_update_option_parts("routes 10.1.0.0"), 0);
+    assert_int_equal(push_update_option_parts("rout 10.1.0.0"), 0);
+    assert_int_equal(push_update_option_parts("route-gateway 10.0.0.1"), 0);
+    assert_int_equal(push_update_option_parts("-route-gateway"), 0);
+
+    /* everything else cannot be updated */
+    assert_int_equal(push_update_option_parts("ifconfig 10.0.0.2 255.255.255.0"), 0);
+    assert_int_equal(push_update_option_parts("redirect-gateway def1"), 0);
+    assert_int_equal(push_update_option_parts("-"), 0);
+    assert_int_equal(push_update_option_parts(""), 0);
+}
+
+static void
+test_push_update_format(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(PUSH_BUNDLE_SIZE, &gc);
+
+    assert_true(push_update_format(&buf, 7, "route 10.1.0.0 255.255.0.0,-dns,"
+                                   "dhcp-option DOMAIN example.org"));
+    assert_string_equal(BSTR(&buf), "PUSH_UPDATE,7,route 10.1.0.0 255.255.0.0,"
+                        "-dns,dhcp-option DOMAIN example.org");
+
+    buf_clear(&buf);
+    assert_true(push_update_format(&buf, 4294967295u, "-route"));
+    assert_string_equal(BSTR(&buf), "PUSH_UPDATE,4294967295,-route");
+
+    /* one option that cannot be updated spoils the update */
+    buf_clear(&buf);
+    assert_false(push_update_format(&buf, 8, "route 10.1.0.0 255.255.0.0,"
+                                    "ifconfig 10.0.0.2 255.255.255.0"));
+    buf_clear(&buf);
+    assert_false(push_update_format(&buf, 8, "-route 10.1.0.0"));
+
+    /* as does an update without options */
+    buf_clear(&buf);
+    assert_false(push_update_format(&buf, 9, ""));
+
+    gc_free(&gc);
+}
+
+static void
+test_push_update_format_overlong(void **state)
+{
+    struct gc_arena gc = gc_new();
+    struct buffer buf = alloc_buf_gc(PUSH_BUNDLE_SIZE, &gc);
+    struct buffer options = alloc_buf_gc(2 * PUSH_BUNDLE_SIZE, &gc);
+
+    /* just fits */
+    const char *route = "route 10.1.0.0 255.255.0.0";
+    const int fits = (PUSH_BUNDLE_SIZE - (int) strlen("PUSH_UPDATE,1") - 1)
+                     / (int) (strlen(route) + 1);
+    for (int i = 0; i < fits; i++)
+    {
+        buf_printf(&options, "%s%s", i ? "," : "", route);
+    }
+    assert_true(push_update_format(&buf, 1, BSTR(&options)));
+    assert_int_equal(BLEN(&buf), strlen("PUSH_UPDATE,1") + fits * (strlen(route) + 1));
+
+    /* one more does not */
+    buf_printf(&options, ",%s", route);
+    buf_clear(&buf);
+    assert_false(push_update_format(&buf, 1, BSTR(&options)));
+
+    gc_free(&gc);
+}
+
+const struct CMUnitTest push_update_tests[] = {
+    cmocka_unit_test(test_push_update_option_parts),
+    cmocka_unit_test(test_push_update_format),
+    cmocka_unit_test(test_push_update_format_overlong),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(push_update_tests, NULL, NULL);
+}
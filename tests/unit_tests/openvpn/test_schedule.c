@@ -0,0 +1,261 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+
+#include "schedule.h"
+
+#include "mock_msg.h"
+
+#define N_ENTRIES 2000
+
+static struct schedule_entry entries[N_ENTRIES];
+
+/* ticks as computed by the wheel, 1/1024 second */
+static uint64_t
+tick_of(const struct timeval *tv)
+{
+    return ((uint64_t) tv->tv_sec << SCHEDULE_TICK_BITS)
+           + (((uint64_t) tv->tv_usec << SCHEDULE_TICK_BITS) / 1000000);
+}
+
+static void
+random_tv(struct timeval *tv, const struct timeval *base, int max_sec)
+{
+    tv->tv_sec = base->tv_sec + rand() % max_sec;
+    tv->tv_usec = rand() % 1000000;
+}
+
+/* compare the wheel against a scan of every entry */
+static void
+check_schedule(struct schedule *s, const struct timeval *current)
+{
+    const struct schedule_entry *least = NULL;
+    int n_due = 0;
+    int n_scheduled = 0;
+
+    for (int i = 0; i < N_ENTRIES; i++)
+    {
+        const struct schedule_entry *e = &entries[i];
+        if (!IN_TREE(e))
+        {
+            continue;
+        }
+        n_scheduled++;
+        if (!least || tv_lt(&e->tv, &least->tv))
+        {
+            least = e;
+        }
+        if (tick_of(&e->tv) <= tick_of(current))
+        {
+            n_due++;
+        }
+    }
+
+    assert_int_equal(s->size, n_scheduled);
+
+    struct timeval tv;
+    struct schedule_entry *ret = schedule_get_earliest_wakeup(s, &tv);
+    if (!least)
+    {
+        assert_null(ret);
+        assert_null(schedule_get_due(s));
+        return;
+    }
+    assert_non_null(ret);
+    assert_true(tv_eq(&tv, &ret->tv));
+    if (n_due)
+    {
+        assert_true(tick_of(&ret->tv) <= tick_of(current));
+    }
+    else
+    {
+        /* entries within one tick are not ordered */
+        assert_int_equal(tick_of(&ret->tv), tick_of(&least->tv));
+    }
+
+    for (const struct schedule_entry *e = schedule_get_due(s); e; e = e->next)
+    {
+        assert_true(tick_of(&e->tv) <= tick_of(current));
+        n_due--;
+    }
+    assert_int_equal(n_due, 0);
+}
+
+static void
+run_random(int max_sec, int max_step_usec)
+{
+    struct schedule *s = schedule_init();
+    struct timeval current = { .tv_sec = 1700000000 };
+
+    memset(entries, 0, sizeof(entries));
+    srand(1);
+    schedule_advance(s, &current);
+
+    for (int round = 0; round < 20 * N_ENTRIES; round++)
+    {
+        struct schedule_entry *e = &entries[rand() % N_ENTRIES];
+        struct timeval tv;
+
+        switch (rand() % 4)
+        {
+            case 0:
+                schedule_remove_entry(s, e);
+                break;
+
+            case 1:
+                /* reschedule within the sigma window, usually a no-op */
+                random_tv(&tv, &current, max_sec);
+                schedule_add_entry(s, e, &tv, 1000000);
+                break;
+
+            default:
+                random_tv(&tv, &current, max_sec);
+                schedule_add_entry(s, e, &tv, 0);
+                break;
+        }
+
+        if (round % 16 == 0)
+        {
+            struct timeval step = { 0, rand() % max_step_usec };
+            step.tv_sec = step.tv_usec / 1000000;
+            step.tv_usec %= 1000000;
+            tv_add(&current, &step);
+            schedule_advance(s, &current);
+        }
+        check_schedule(s, &current);
+    }
+
+    schedule_free(s);
+}
+
+static void
+test_schedule_short(void **state)
+{
+    /* mostly level 0 and 1 of the wheel */
+    run_random(5, 100000);
+}
+
+static void
+test_schedule_long(void **state)
+{
+    /* up to four weeks ahead, so that part of the entries
+     * are beyond the wheel, and large steps in time */
+    run_random(28 * 24 * 3600, 2000000000);
+}
+
+static void
+test_schedule_serve(void **state)
+{
+    struct schedule *s = schedule_init();
+    struct timeval current = { .tv_sec = 1700000000, .tv_usec = 999000 };
+
+    memset(entries, 0, sizeof(entries));
+    schedule_advance(s, &current);
+    for (int i = 0; i < N_ENTRIES; i++)
+    {
+        struct timeval tv = current;
+        tv.tv_sec += 1 + i % 600;
+        tv.tv_usec = (i * 7919) % 1000000;
+        schedule_add_entry(s, &entries[i], &tv, 0);
+    }
+
+    /* serve entries in order as time passes, as the server does */
+    int n = 0;
+    struct timeval last = current;
+    while (n < N_ENTRIES)
+    {
+        struct timeval tv;
+        struct schedule_entry *e = schedule_get_earliest_wakeup(s, &tv);
+        assert_non_null(e);
+        assert_true(tick_of(&last) <= tick_of(&tv));
+        last = tv;
+        if (tv_gt(&tv, &current))
+        {
+            current = tv;
+        }
+        schedule_advance(s, &current);
+        while ((e = schedule_get_due(s)))
+        {
+            schedule_remove_entry(s, e);
+            n++;
+        }
+        check_schedule(s, &current);
+    }
+    assert_null(schedule_get_earliest_wakeup(s, &last));
+
+    schedule_free(s);
+}
+
+static void
+test_schedule_clock_backwards(void **state)
+{
+    struct schedule *s = schedule_init();
+    struct timeval current = { .tv_sec = 1700000000 };
+
+    memset(entries, 0, sizeof(entries));
+    srand(2);
+    schedule_advance(s, &current);
+    for (int i = 0; i < N_ENTRIES; i++)
+    {
+        struct timeval tv;
+        random_tv(&tv, &current, 3600);
+        schedule_add_entry(s, &entries[i], &tv, 0);
+    }
+
+    current.tv_sec += 1800;
+    schedule_advance(s, &current);
+    check_schedule(s, &current);
+
+    current.tv_sec -= 3600;
+    schedule_advance(s, &current);
+    check_schedule(s, &current);
+    assert_null(schedule_get_due(s));
+
+    schedule_free(s);
+}
+
+const struct CMUnitTest schedule_tests[] = {
+    cmocka_unit_test(test_schedule_short),
+    cmocka_unit_test(test_schedule_long),
+    cmocka_unit_test(test_schedule_serve),
+    cmocka_unit_test(test_schedule_clock_backwards),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(schedule_tests, NULL, NULL);
+}
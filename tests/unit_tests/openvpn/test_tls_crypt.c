@@ -672,6 +672,56 @@ test_tls_crypt_v2_write_client_key_file_metadata(void **state)
                                        true);
 }
 
+static void
+test_tls_crypt_v2_verify_cache(void **state)
+{
+    struct tls_crypt_v2_verify_cache *cache = tls_crypt_v2_verify_cache_new(10);
+    const char *status_file = "test_tls_crypt_v2_verify.status";
+    /* both map to the same slot */
+    const uint8_t d1[SHA256_DIGEST_LENGTH] = { 1 };
+    const uint8_t d2[SHA256_DIGEST_LENGTH] = { 1, 0, 0, 0, 2 };
+    struct tls_crypt_v2_verify_entry *e;
+
+    now = 1000;
+    e = tls_crypt_v2_verify_cache_get(cache, d1);
+    assert_int_equal(e->expires, 0);
+    e->ok = true;
+    e->expires = now + 10;
+
+    /* a verdict is kept until it expires, or another digest needs the slot */
+    now += 9;
+    assert_ptr_equal(tls_crypt_v2_verify_cache_get(cache, d1), e);
+    assert_int_equal(e->expires, 1010);
+    e = tls_crypt_v2_verify_cache_get(cache, d2);
+    assert_int_equal(e->expires, 0);
+    assert_memory_equal(e->digest, d2, sizeof(d2));
+
+    /* a queued script leaves its verdict in the status file */
+    FILE *fp = fopen(status_file, "w");
+    assert_non_null(fp);
+    fclose(fp);
+    e->status_file = string_alloc(status_file, NULL);
+    e = tls_crypt_v2_verify_cache_get(cache, d2);
+    assert_non_null(e->status_file);
+
+    fp = fopen(status_file, "w");
+    assert_non_null(fp);
+    fputc('1', fp);
+    fclose(fp);
+    e = tls_crypt_v2_verify_cache_get(cache, d2);
+    assert_null(e->status_file);
+    assert_true(e->ok);
+    assert_int_equal(e->expires, now + TLS_CRYPT_V2_VERIFY_KEEP);
+    assert_null(fopen(status_file, "r"));
+
+    now += TLS_CRYPT_V2_VERIFY_KEEP;
+    e = tls_crypt_v2_verify_cache_get(cache, d2);
+    assert_int_equal(e->expires, 0);
+    assert_false(e->ok);
+
+    tls_crypt_v2_verify_cache_free(cache);
+}
+
 int
 main(void)
 {
@@ -718,6 +768,7 @@ main(void)
         cmocka_unit_test(test_tls_crypt_v2_write_server_key_file),
         cmocka_unit_test(test_tls_crypt_v2_write_client_key_file),
         cmocka_unit_test(test_tls_crypt_v2_write_client_key_file_metadata),
+        cmocka_unit_test(test_tls_crypt_v2_verify_cache),
     };
 
 #if defined(ENABLE_CRYPTO_OPENSSL)
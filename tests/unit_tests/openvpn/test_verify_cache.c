@@ -0,0 +1,149 @@
+/*
+ *  OpenVPN -- An application to securely tunnel IP networks
+ *             over a single UDP port, with support for SSL/TLS-based
+ *             session authentication and key exchange,
+ *             packet encryption, packet authentication, and
+ *             packet compression.
+ *
+ *  Copyright (C) 2002-2023 OpenVPN Inc <sales@openvpn.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2
+ *  as published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License along
+ *  with this program; if not, write to the Free Software Foundation, Inc.,
+ *  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "syshead.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "verify_cache.h"
+
+#include "mock_msg.h"
+
+static void
+make_hash(uint8_t *hash, int i)
+{
+    memset(hash, 0, VERIFY_CACHE_HASH_LEN);
+    memcpy(hash, &i, sizeof(i));
+}
+
+static void
+test_verify_cache_lookup(void **state)
+{
+    struct verify_cache *vc = verify_cache_new(10, 100);
+    uint8_t hash[VERIFY_CACHE_HASH_LEN];
+
+    now = 1000;
+    make_hash(hash, 1);
+    assert_false(verify_cache_lookup(vc, hash, 0));
+
+    verify_cache_add(vc, hash, 0);
+    assert_true(verify_cache_lookup(vc, hash, 0));
+
+    /* the depth is part of the key */
+    assert_false(verify_cache_lookup(vc, hash, 1));
+
+    make_hash(hash, 2);
+    assert_false(verify_cache_lookup(vc, hash, 0));
+
+    /* entries expire max_age seconds after they were added */
+    make_hash(hash, 1);
+    now = 1099;
+    assert_true(verify_cache_lookup(vc, hash, 0));
+    now = 1100;
+    assert_false(verify_cache_lookup(vc, hash, 0));
+    assert_int_equal(hash_n_elements(vc->hash), 0);
+
+    /* adding again restarts the lifetime */
+    verify_cache_add(vc, hash, 0);
+    now = 1150;
+    assert_true(verify_cache_lookup(vc, hash, 0));
+
+    verify_cache_free(vc);
+}
+
+static void
+test_verify_cache_lru(void **state)
+{
+    struct verify_cache *vc = verify_cache_new(4, 1000);
+    uint8_t hash[VERIFY_CACHE_HASH_LEN];
+
+    for (int i = 0; i < 4; i++)
+    {
+        now = 2000 + i;
+        make_hash(hash, i);
+        verify_cache_add(vc, hash, 0);
+    }
+
+    /* use entry 0 again, so that 1 is the least recently used */
+    now = 2010;
+    make_hash(hash, 0);
+    assert_true(verify_cache_lookup(vc, hash, 0));
+
+    make_hash(hash, 4);
+    verify_cache_add(vc, hash, 0);
+    assert_int_equal(hash_n_elements(vc->hash), 4);
+
+    for (int i = 0; i < 5; i++)
+    {
+        make_hash(hash, i);
+        assert_int_equal(verify_cache_lookup(vc, hash, 0), i != 1);
+    }
+
+    verify_cache_free(vc);
+}
+
+static void
+test_verify_cache_crl(void **state)
+{
+    struct verify_cache *vc = verify_cache_new(4, 1000);
+    uint8_t hash[VERIFY_CACHE_HASH_LEN];
+
+    now = 3000;
+    verify_cache_check_crl(vc, 100, 500);
+    make_hash(hash, 1);
+    verify_cache_add(vc, hash, 0);
+
+    /* same CRL, e.g. from another session of the same context */
+    verify_cache_check_crl(vc, 100, 500);
+    assert_true(verify_cache_lookup(vc, hash, 0));
+
+    verify_cache_check_crl(vc, 101, 500);
+    assert_false(verify_cache_lookup(vc, hash, 0));
+
+    verify_cache_add(vc, hash, 0);
+    verify_cache_check_crl(vc, 101, 501);
+    assert_false(verify_cache_lookup(vc, hash, 0));
+
+    verify_cache_free(vc);
+}
+
+const struct CMUnitTest verify_cache_tests[] = {
+    cmocka_unit_test(test_verify_cache_lookup),
+    cmocka_unit_test(test_verify_cache_lru),
+    cmocka_unit_test(test_verify_cache_crl),
+};
+
+int
+main(void)
+{
+    return cmocka_run_group_tests(verify_cache_tests, NULL, NULL);
+}